@@ -12,6 +12,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
@@ -19,6 +20,8 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <eb32tree.h>
 #include <eb64tree.h>
@@ -42,11 +45,16 @@
 #define SEP(c) ((unsigned char)(c) <= ' ')
 #define SKIP_CHAR(p,c) do { while (1) { int __c = (unsigned char)*p++; if (__c == c) break; if (__c <= ' ') { p--; break; } } } while (0)
 
-/* [0] = err/date, [1] = req, [2] = conn, [3] = resp, [4] = data */
-static struct eb_root timers[5] = {
+#define MAX_THREADS 64
+
+/* [0] = err/date, [1] = req, [2] = conn, [3] = resp, [4] = data. Each thread
+ * fills its own set of trees, the main thread's ones receive the final result.
+ */
+static struct eb_root main_timers[5] = {
 	EB_ROOT_UNIQUE, EB_ROOT_UNIQUE, EB_ROOT_UNIQUE,
 	EB_ROOT_UNIQUE, EB_ROOT_UNIQUE,
 };
+static __thread struct eb_root *timers = main_timers;
 
 struct timer {
 	struct eb32_node node;
@@ -73,6 +81,15 @@ struct url_stat {
 	unsigned int nb_err, nb_req;
 };
 
+/* a slice of the mmapped input processed by one thread (-j) */
+struct chunk {
+	const char *cur, *end;      /* next line, end of the slice */
+	char buf[MAXLINE];          /* copy of the current line */
+	struct eb_root timers[5];   /* this thread's trees */
+	int linenum, parse_err, lines_out;
+	pthread_t thr;
+};
+
 #define FILT_COUNT_ONLY		0x01
 #define FILT_INVERT		0x02
 #define FILT_QUIET		0x04
@@ -122,12 +139,23 @@ struct url_stat {
 unsigned int filter = 0;
 unsigned int filter2 = 0;
 unsigned int filter_invert = 0;
-const char *line;
-int linenum = 0;
-int parse_err = 0;
-int lines_out = 0;
+__thread const char *line;
+__thread int linenum = 0;
+__thread int parse_err = 0;
+__thread int lines_out = 0;
 int lines_max = -1;
 
+/* input filter settings, shared by all threads */
+static const char *filter_term_code_name = NULL;
+static int filter_time_resp = 0;
+static int filt_http_status_low = 0, filt_http_status_high = 0;
+static int filt2_timestamp_low = 0, filt2_timestamp_high = 0;
+static int skip_fields = 1;
+static void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr) = NULL;
+
+/* the slice of input the current thread works on, NULL for stdin */
+static __thread struct chunk *cur_chunk = NULL;
+
 const char *fgets2(FILE *stream);
 
 void filter_count_url(const char *accept_field, const char *time_field, struct timer **tptr);
@@ -148,7 +176,8 @@ void usage(FILE *output, const char *msg)
 		"       halog [-q] [-c] [-m <lines>]\n"
 		"       {-cc|-gt|-pct|-st|-tc|-srv|-u|-uc|-ue|-ua|-ut|-uao|-uto|-uba|-ubt|-ic}\n"
 		"       [-s <skip>] [-e|-E] [-H] [-rt|-RT <time>] [-ad <delay>] [-ac <count>]\n"
-		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ] [ -time [min][:[max]] ] < log\n"
+		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ] [ -time [min][:[max]] ]\n"
+		"       [-j <threads>] < log\n"
 		"\n",
 		msg ? msg : ""
 		);
@@ -182,6 +211,9 @@ void help()
 	       " -m <lines>              limit output to the first <lines> lines\n"
                " -s <skip_n_fields>      skip n fields from the beginning of a line (default %d)\n"
                "                         you can also use -n to start from earlier then field %d\n"
+	       " -j <threads>            mmap the input file and split it across <threads>\n"
+	       "                         threads. Only for counting/statistics outputs, and\n"
+	       "                         not with -m. Lines longer than %d chars are truncated\n"
                "\n"
 	       "Output filters - only one may be used at a time\n"
 	       " -c    only report the number of lines that would have been printed\n"
@@ -197,7 +229,7 @@ void help()
 	       "       -ua : average response time, -ut : average total time\n"
 	       "       -uao, -uto: average times computed on valid ('OK') requests\n"
 	       "       -uba, -ubt: average bytes returned, total bytes returned\n",
-               SOURCE_FIELD,SOURCE_FIELD
+               SOURCE_FIELD,SOURCE_FIELD,MAXLINE-1
 	       );
 	exit(0);
 }
@@ -538,8 +570,9 @@ int convert_date_to_timestamp(const char *field)
 	unsigned char c;
 	const char *e;
 	time_t rawtime;
-	static struct tm * timeinfo;
-	static int last_res;
+	static __thread struct tm tm_buf;
+	static __thread struct tm * timeinfo;
+	static __thread int last_res;
 
 	d = mo = y = h = m = s = 0;
 	e = field;
@@ -660,7 +693,7 @@ int convert_date_to_timestamp(const char *field)
 	}
 	else {
 		time(&rawtime);
-		timeinfo = localtime(&rawtime);
+		timeinfo = localtime_r(&rawtime, &tm_buf);
 	}
 
 	timeinfo->tm_sec = 0;
@@ -682,24 +715,418 @@ void truncated_line(int linenum, const char *line)
 		fprintf(stderr, "Truncated line %d: %s\n", linenum, line);
 }
 
-int main(int argc, char **argv)
+/* Returns the next line of input with its trailing LF stripped, or NULL once
+ * the input is exhausted. Lines are read from stdin, or from the current
+ * thread's slice of the mapped file when one was assigned. In this case they
+ * are copied so that the filters may still modify them.
+ */
+static const char *read_line(void)
+{
+	struct chunk *c = cur_chunk;
+	const char *eol;
+	size_t len;
+
+	if (!c)
+		return fgets2(stdin);
+
+	if (c->cur >= c->end)
+		return NULL;
+
+	eol = memchr(c->cur, '\n', c->end - c->cur);
+	if (!eol)
+		eol = c->end;
+
+	len = eol - c->cur;
+	if (len >= sizeof(c->buf))
+		len = sizeof(c->buf) - 1;
+	memcpy(c->buf, c->cur, len);
+	c->buf[len] = '\0';
+	c->cur = eol + 1;
+	return c->buf;
+}
+
+/* Applies the input filters to all input lines and passes the matching ones to
+ * the output filter, which feeds the current thread's trees and counters.
+ */
+static void process_lines(void)
 {
 	const char *b, *p, *time_field, *accept_field, *source_field;
-	const char *filter_term_code_name = NULL;
+	struct timer *t = NULL;
+	unsigned int uval;
+	int f, val, test;
+
+	if (!line_filter && /* FILT_COUNT_ONLY ( see above), and no input filter (see below) */
+	    !(filter & (FILT_HTTP_ONLY|FILT_TIME_RESP|FILT_ERRORS_ONLY|FILT_HTTP_STATUS|FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY|FILT_TERM_CODE_NAME)) &&
+		!(filter2 & (FILT2_TIMESTAMP))) {
+		/* read the whole file at once first, ignore it if inverted output */
+		if (!filter_invert)
+			while ((lines_max < 0 || lines_out < lines_max) && read_line() != NULL)
+				lines_out++;
+
+		return;
+	}
+
+	while ((line = read_line()) != NULL) {
+		linenum++;
+		time_field = NULL; accept_field = NULL;
+		source_field = NULL;
+
+		test = 1;
+
+		/* for any line we process, we first ensure that there is a field
+		 * looking like the accept date field (beginning with a '[').
+		 */
+		if (filter & FILT_COUNT_IP_COUNT) {
+			/* we need the IP first */
+			source_field = field_start(line, SOURCE_FIELD + skip_fields);
+			accept_field = field_start(source_field, ACCEPT_FIELD - SOURCE_FIELD + 1);
+		}
+		else
+			accept_field = field_start(line, ACCEPT_FIELD + skip_fields);
+
+		if (unlikely(*accept_field != '[')) {
+			parse_err++;
+			continue;
+		}
+
+		/* the day of month field is begin 01 and 31 */
+		if (accept_field[1] < '0' || accept_field[1] > '3') {
+			parse_err++;
+			continue;
+		}
+
+		if (filter2 & FILT2_TIMESTAMP) {
+			uval = convert_date_to_timestamp(accept_field);
+			test &= (uval>=filt2_timestamp_low && uval<=filt2_timestamp_high) ;
+		}
+
+		if (filter & FILT_HTTP_ONLY) {
+			/* only report lines with at least 4 timers */
+			if (!time_field) {
+				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
+				if (unlikely(!*time_field)) {
+					truncated_line(linenum, line);
+					continue;
+				}
+			}
+
+			field_stop(time_field + 1);
+			/* we have field TIME_FIELD in [time_field]..[e-1] */
+			p = time_field;
+			f = 0;
+			while (!SEP(*p)) {
+				if (++f == 4)
+					break;
+				SKIP_CHAR(p, '/');
+			}
+			test &= (f >= 4);
+		}
+
+		if (filter & FILT_TIME_RESP) {
+			int tps;
+
+			/* only report lines with response times larger than filter_time_resp */
+			if (!time_field) {
+				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
+				if (unlikely(!*time_field)) {
+					truncated_line(linenum, line);
+					continue;
+				}
+			}
+
+			field_stop(time_field + 1);
+			/* we have field TIME_FIELD in [time_field]..[e-1], let's check only the response time */
+
+			p = time_field;
+			f = 0;
+			while (!SEP(*p)) {
+				tps = str2ic(p);
+				if (tps < 0) {
+					tps = -1;
+				}
+				if (++f == 4)
+					break;
+				SKIP_CHAR(p, '/');
+			}
+
+			if (unlikely(f < 4)) {
+				parse_err++;
+				continue;
+			}
+
+			test &= (tps >= filter_time_resp) ^ !!(filter & FILT_INVERT_TIME_RESP);
+		}
+
+		if (filter & (FILT_ERRORS_ONLY | FILT_HTTP_STATUS)) {
+			/* Check both error codes (-1, 5xx) and status code ranges */
+			if (time_field)
+				b = field_start(time_field, STATUS_FIELD - TIME_FIELD + 1);
+			else
+				b = field_start(accept_field, STATUS_FIELD - ACCEPT_FIELD + 1);
+
+			if (unlikely(!*b)) {
+				truncated_line(linenum, line);
+				continue;
+			}
+
+			val = str2ic(b);
+			if (filter & FILT_ERRORS_ONLY)
+				test &= (val < 0 || (val >= 500 && val <= 599)) ^ !!(filter & FILT_INVERT_ERRORS);
+
+			if (filter & FILT_HTTP_STATUS)
+				test &= (val >= filt_http_status_low && val <= filt_http_status_high) ^ !!(filter & FILT_INVERT_HTTP_STATUS);
+		}
+
+		if (filter & (FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY)) {
+			/* Check if the server's queue is non-nul */
+			if (time_field)
+				b = field_start(time_field, QUEUE_LEN_FIELD - TIME_FIELD + 1);
+			else
+				b = field_start(accept_field, QUEUE_LEN_FIELD - ACCEPT_FIELD + 1);
+
+			if (unlikely(!*b)) {
+				truncated_line(linenum, line);
+				continue;
+			}
+
+			if (*b == '0') {
+				if (filter & FILT_QUEUE_SRV_ONLY) {
+					test = 0;
+				}
+				else {
+					do {
+						b++;
+						if (*b == '/') {
+							b++;
+							break;
+						}
+					} while (*b);
+					test &= ((unsigned char)(*b - '1') < 9);
+				}
+			}
+		}
+
+		if (filter & FILT_TERM_CODE_NAME) {
+			/* only report corresponding termination code name */
+			if (time_field)
+				b = field_start(time_field, TERM_CODES_FIELD - TIME_FIELD + 1);
+			else
+				b = field_start(accept_field, TERM_CODES_FIELD - ACCEPT_FIELD + 1);
+
+			if (unlikely(!*b)) {
+				truncated_line(linenum, line);
+				continue;
+			}
+
+			test &= (b[0] == filter_term_code_name[0] && b[1] == filter_term_code_name[1]) ^ !!(filter & FILT_INVERT_TERM_CODE_NAME);
+		}
+
+
+		test ^= filter_invert;
+		if (!test)
+			continue;
+
+		/************** here we process inputs *******************/
+
+		if (line_filter) {
+			if (filter & FILT_COUNT_IP_COUNT)
+				filter_count_ip(source_field, accept_field, time_field, &t);
+			else
+				line_filter(accept_field, time_field, &t);
+		}
+		else
+			lines_out++; /* FILT_COUNT_ONLY was used, so we're just counting lines */
+		if (lines_max >= 0 && lines_out >= lines_max)
+			break;
+	}
+
+	if (t)
+		free(t);
+}
+
+/* Moves all nodes of the value tree <src> to <dst>, summing the counts of the
+ * values found in both.
+ */
+static void merge_values(struct eb_root *dst, struct eb_root *src)
+{
+	struct eb32_node *n, *next, *old;
+	struct timer *t;
+
+	for (n = eb32_first(src); n; n = next) {
+		next = eb32_next(n);
+		eb32_delete(n);
+		old = eb32i_insert(dst, n);
+		if (old == n)
+			continue;
+
+		t = container_of(n, struct timer, node);
+		container_of(old, struct timer, node)->count += t->count;
+		free(t);
+	}
+}
+
+/* Moves all servers of tree <src> to <dst>, merging the stats of the servers
+ * found in both.
+ */
+static void merge_servers(struct eb_root *dst, struct eb_root *src)
+{
+	struct ebmb_node *n, *next, *old;
+	struct srv_st *srv, *srv_old;
+	int f;
+
+	for (n = ebmb_first(src); n; n = next) {
+		next = ebmb_next(n);
+		ebmb_delete(n);
+		old = ebst_insert(dst, n);
+		if (old == n)
+			continue;
+
+		srv = container_of(n, struct srv_st, node);
+		srv_old = container_of(old, struct srv_st, node);
+		for (f = 0; f <= 5; f++)
+			srv_old->st_cnt[f] += srv->st_cnt[f];
+		srv_old->nb_ct += srv->nb_ct;
+		srv_old->nb_rt += srv->nb_rt;
+		srv_old->nb_ok += srv->nb_ok;
+		srv_old->cum_ct += srv->cum_ct;
+		srv_old->cum_rt += srv->cum_rt;
+		free(srv);
+	}
+}
+
+/* Moves all URLs (or sources) of tree <src> to <dst>, merging the stats of the
+ * entries found in both.
+ */
+static void merge_urls(struct eb_root *dst, struct eb_root *src)
+{
+	struct ebpt_node *n, *next, *old;
+	struct url_stat *ustat, *ustat_old;
+
+	for (n = ebpt_first(src); n; n = next) {
+		next = ebpt_next(n);
+		ebpt_delete(n);
+		old = ebis_insert(dst, n);
+		if (old == n)
+			continue;
+
+		ustat = container_of(n, struct url_stat, node.url);
+		ustat_old = container_of(old, struct url_stat, node.url);
+		ustat_old->nb_req += ustat->nb_req;
+		ustat_old->nb_err += ustat->nb_err;
+		ustat_old->total_time += ustat->total_time;
+		ustat_old->total_time_ok += ustat->total_time_ok;
+		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
+		free(ustat->url);
+		free(ustat);
+	}
+}
+
+/* thread entry point for slices 1 and above */
+static void *process_chunk(void *arg)
+{
+	struct chunk *c = arg;
+
+	cur_chunk = c;
+	timers = c->timers;
+	process_lines();
+
+	c->linenum = linenum;
+	c->parse_err = parse_err;
+	c->lines_out = lines_out;
+	return NULL;
+}
+
+/* Maps stdin and splits it into <nbthr> slices ending on line boundaries. The
+ * first one is processed by the calling thread, the other ones by as many new
+ * threads, whose trees and counters are then merged into the main thread's.
+ * Line numbers reported in warnings are relative to the slice. Returns 0 if
+ * stdin cannot be mapped (eg: a pipe), in which case nothing was read.
+ */
+static int process_mapped_input(int nbthr)
+{
+	struct chunk *chunks;
+	const char *map, *pos, *end, *stop;
+	struct stat st;
+	int i, f;
+
+	if (fstat(0, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size)
+		return 0;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+	if (map == MAP_FAILED)
+		return 0;
+
+#if defined(MADV_SEQUENTIAL)
+	madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	chunks = calloc(nbthr, sizeof(*chunks));
+	if (unlikely(!chunks)) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+
+	pos = map;
+	end = map + st.st_size;
+	for (i = 0; i < nbthr; i++) {
+		stop = map + st.st_size / nbthr * (i + 1);
+		if (i == nbthr - 1)
+			stop = end;
+		else if (stop <= pos)
+			stop = pos;
+		else {
+			stop = memchr(stop - 1, '\n', end - stop + 1);
+			stop = stop ? stop + 1 : end;
+		}
+
+		chunks[i].cur = pos;
+		chunks[i].end = stop;
+		for (f = 0; f < 5; f++)
+			chunks[i].timers[f] = EB_ROOT_UNIQUE;
+		pos = stop;
+	}
+
+	for (i = 1; i < nbthr; i++) {
+		if (pthread_create(&chunks[i].thr, NULL, process_chunk, &chunks[i]) != 0) {
+			fprintf(stderr, "%s: cannot create thread\n", __FUNCTION__);
+			exit(1);
+		}
+	}
+
+	cur_chunk = &chunks[0];
+	process_lines();
+	cur_chunk = NULL;
+
+	for (i = 1; i < nbthr; i++) {
+		pthread_join(chunks[i].thr, NULL);
+
+		linenum += chunks[i].linenum;
+		parse_err += chunks[i].parse_err;
+		lines_out += chunks[i].lines_out;
+
+		if (filter & FILT_COUNT_IP_COUNT || line_filter == filter_count_url)
+			merge_urls(&timers[0], &chunks[i].timers[0]);
+		else if (line_filter == filter_count_srv_status)
+			merge_servers(&timers[0], &chunks[i].timers[0]);
+		else
+			for (f = 0; f < 5; f++)
+				merge_values(&timers[f], &chunks[i].timers[f]);
+	}
+
+	free(chunks);
+	munmap((void *)map, st.st_size);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
 	const char *output_file = NULL;
 	int f, last;
 	struct timer *t = NULL;
 	struct eb32_node *n;
 	struct url_stat *ustat = NULL;
-	int val, test;
-	unsigned int uval;
 	int filter_acc_delay = 0, filter_acc_count = 0;
-	int filter_time_resp = 0;
-	int filt_http_status_low = 0, filt_http_status_high = 0;
-	int filt2_timestamp_low = 0, filt2_timestamp_high = 0;
-	int skip_fields = 1;
-
-	void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr) = NULL;
+	int nbthreads = 1;
 
 	argc--; argv++;
 	while (argc > 0) {
@@ -740,6 +1167,13 @@ int main(int argc, char **argv)
 			argc--; argv++;
 			lines_max = atol(*argv);
 		}
+		else if (strcmp(argv[0], "-j") == 0) {
+			if (argc < 2) die("missing option for -j");
+			argc--; argv++;
+			nbthreads = atol(*argv);
+			if (nbthreads < 1 || nbthreads > MAX_THREADS)
+				die("Fatal: invalid number of threads for -j.\n");
+		}
 		else if (strcmp(argv[0], "-e") == 0)
 			filter |= FILT_ERRORS_ONLY;
 		else if (strcmp(argv[0], "-E") == 0)
@@ -884,201 +1318,24 @@ int main(int argc, char **argv)
 	posix_fadvise(0, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
-	if (!line_filter && /* FILT_COUNT_ONLY ( see above), and no input filter (see below) */
-	    !(filter & (FILT_HTTP_ONLY|FILT_TIME_RESP|FILT_ERRORS_ONLY|FILT_HTTP_STATUS|FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY|FILT_TERM_CODE_NAME)) &&
-		!(filter2 & (FILT2_TIMESTAMP))) {
-		/* read the whole file at once first, ignore it if inverted output */
-		if (!filter_invert)
-			while ((lines_max < 0 || lines_out < lines_max) && fgets2(stdin) != NULL)
-				lines_out++;
-
-		goto skip_filters;
-	}
-
-	while ((line = fgets2(stdin)) != NULL) {
-		linenum++;
-		time_field = NULL; accept_field = NULL;
-		source_field = NULL;
-
-		test = 1;
-
-		/* for any line we process, we first ensure that there is a field
-		 * looking like the accept date field (beginning with a '[').
-		 */
-		if (filter & FILT_COUNT_IP_COUNT) {
-			/* we need the IP first */
-			source_field = field_start(line, SOURCE_FIELD + skip_fields);
-			accept_field = field_start(source_field, ACCEPT_FIELD - SOURCE_FIELD + 1);
-		}
-		else
-			accept_field = field_start(line, ACCEPT_FIELD + skip_fields);
-
-		if (unlikely(*accept_field != '[')) {
-			parse_err++;
-			continue;
-		}
-
-		/* the day of month field is begin 01 and 31 */
-		if (accept_field[1] < '0' || accept_field[1] > '3') {
-			parse_err++;
-			continue;
-		}
-
-		if (filter2 & FILT2_TIMESTAMP) {
-			uval = convert_date_to_timestamp(accept_field);
-			test &= (uval>=filt2_timestamp_low && uval<=filt2_timestamp_high) ;
-		}
-
-		if (filter & FILT_HTTP_ONLY) {
-			/* only report lines with at least 4 timers */
-			if (!time_field) {
-				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
-				if (unlikely(!*time_field)) {
-					truncated_line(linenum, line);
-					continue;
-				}
-			}
-
-			field_stop(time_field + 1);
-			/* we have field TIME_FIELD in [time_field]..[e-1] */
-			p = time_field;
-			f = 0;
-			while (!SEP(*p)) {
-				if (++f == 4)
-					break;
-				SKIP_CHAR(p, '/');
-			}
-			test &= (f >= 4);
-		}
-
-		if (filter & FILT_TIME_RESP) {
-			int tps;
-
-			/* only report lines with response times larger than filter_time_resp */
-			if (!time_field) {
-				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
-				if (unlikely(!*time_field)) {
-					truncated_line(linenum, line);
-					continue;
-				}
-			}
-
-			field_stop(time_field + 1);
-			/* we have field TIME_FIELD in [time_field]..[e-1], let's check only the response time */
-
-			p = time_field;
-			f = 0;
-			while (!SEP(*p)) {
-				tps = str2ic(p);
-				if (tps < 0) {
-					tps = -1;
-				}
-				if (++f == 4)
-					break;
-				SKIP_CHAR(p, '/');
-			}
-
-			if (unlikely(f < 4)) {
-				parse_err++;
-				continue;
-			}
-
-			test &= (tps >= filter_time_resp) ^ !!(filter & FILT_INVERT_TIME_RESP);
-		}
-
-		if (filter & (FILT_ERRORS_ONLY | FILT_HTTP_STATUS)) {
-			/* Check both error codes (-1, 5xx) and status code ranges */
-			if (time_field)
-				b = field_start(time_field, STATUS_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, STATUS_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			val = str2ic(b);
-			if (filter & FILT_ERRORS_ONLY)
-				test &= (val < 0 || (val >= 500 && val <= 599)) ^ !!(filter & FILT_INVERT_ERRORS);
-
-			if (filter & FILT_HTTP_STATUS)
-				test &= (val >= filt_http_status_low && val <= filt_http_status_high) ^ !!(filter & FILT_INVERT_HTTP_STATUS);
-		}
-
-		if (filter & (FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY)) {
-			/* Check if the server's queue is non-nul */
-			if (time_field)
-				b = field_start(time_field, QUEUE_LEN_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, QUEUE_LEN_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			if (*b == '0') {
-				if (filter & FILT_QUEUE_SRV_ONLY) {
-					test = 0;
-				}
-				else {
-					do {
-						b++;
-						if (*b == '/') {
-							b++;
-							break;
-						}
-					} while (*b);
-					test &= ((unsigned char)(*b - '1') < 9);
-				}
-			}
-		}
-
-		if (filter & FILT_TERM_CODE_NAME) {
-			/* only report corresponding termination code name */
-			if (time_field)
-				b = field_start(time_field, TERM_CODES_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, TERM_CODES_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			test &= (b[0] == filter_term_code_name[0] && b[1] == filter_term_code_name[1]) ^ !!(filter & FILT_INVERT_TERM_CODE_NAME);
-		}
-
-
-		test ^= filter_invert;
-		if (!test)
-			continue;
+	if (nbthreads > 1 && lines_max >= 0)
+		die("Fatal: -j cannot be combined with -m.\n");
 
-		/************** here we process inputs *******************/
+	if (nbthreads > 1 && line_filter == filter_output_line && !(filter & FILT_COUNT_IP_COUNT))
+		die("Fatal: -j only works with the counting and statistics outputs.\n");
 
-		if (line_filter) {
-			if (filter & FILT_COUNT_IP_COUNT)
-				filter_count_ip(source_field, accept_field, time_field, &t);
-			else
-				line_filter(accept_field, time_field, &t);
-		}
-		else
-			lines_out++; /* FILT_COUNT_ONLY was used, so we're just counting lines */
-		if (lines_max >= 0 && lines_out >= lines_max)
-			break;
+	if (nbthreads <= 1 || !process_mapped_input(nbthreads)) {
+		if (nbthreads > 1 && !(filter & FILT_QUIET))
+			fprintf(stderr, "Input cannot be mapped, processing it with a single thread.\n");
+		process_lines();
 	}
 
- skip_filters:
 	/*****************************************************
 	 * Here we've finished reading all input. Depending on the
 	 * filters, we may still have some analysis to run on the
 	 * collected data and to output data in a new format.
 	 *************************************************** */
 
-	if (t)
-		free(t);
-
 	if (filter & FILT_COUNT_ONLY) {
 		printf("%d\n", lines_out);
 		exit(0);
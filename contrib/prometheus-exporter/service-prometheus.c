@@ -27,6 +27,7 @@
 #include <proto/applet.h>
 #include <proto/backend.h>
 #include <proto/compression.h>
+#include <proto/counters.h>
 #include <proto/frontend.h>
 #include <proto/listener.h>
 #include <proto/http_htx.h>
@@ -57,6 +58,7 @@ enum {
         PROMEX_DUMPER_BACK,     /* dump metrics of backend proxies */
         PROMEX_DUMPER_LI,       /* dump metrics of listeners */
         PROMEX_DUMPER_SRV,      /* dump metrics of servers */
+	PROMEX_DUMPER_CACHED,   /* send a cached body */
 	PROMEX_DUMPER_DONE,     /* finished */
 };
 
@@ -72,6 +74,29 @@ enum {
 
 #define PROMEX_FL_SCOPE_ALL (PROMEX_FL_SCOPE_GLOBAL|PROMEX_FL_SCOPE_FRONT|PROMEX_FL_SCOPE_BACK|PROMEX_FL_SCOPE_SERVER)
 
+/* The flags which select the metrics, and so the contents of a body */
+#define PROMEX_FL_BODY_MASK (PROMEX_FL_SCOPE_ALL|PROMEX_FL_NO_MAINT_SRV)
+
+/* A complete response body, shared between the scrapes reusing it. It is
+ * referenced by the cache and by each applet sending it, and freed with the
+ * last reference.
+ */
+struct promex_body {
+	unsigned int refcnt;    /* number of references */
+	unsigned int flags;     /* PROMEX_FL_BODY_MASK flags the body was built with */
+	unsigned int date;      /* date (now_ms) the body was completed */
+	size_t len;             /* length of the body */
+	size_t size;            /* allocated size of <area> */
+	char area[VAR_ARRAY];
+};
+
+/* The last complete body, reused by the scrapes whose metrics are the same for
+ * "tune.prometheus.cache-time" milliseconds (0 = disabled).
+ */
+static struct promex_body *promex_cache;
+static __decl_spinlock(promex_cache_lock);
+static unsigned int promex_cache_time = 0;
+
 /* The max length for metrics name. It is a hard limit but it should be
  * enough.
  */
@@ -83,6 +108,11 @@ enum {
  */
 #define PROMEX_MAX_METRIC_LENGTH 512
 
+/* The latency histograms are exported with one bucket per power of two
+ * milliseconds, from 1ms to 2^(PROMEX_HIST_BOUNDS-1) ms, plus "+Inf".
+ */
+#define PROMEX_HIST_BOUNDS 18
+
 /* Matrix used to dump global metrics. Each metric points to the next one to be
  * processed or 0 to stop the dump. */
 const int promex_global_metrics[INF_TOTAL_FIELDS] = {
@@ -245,7 +275,15 @@ const int promex_front_metrics[ST_F_TOTAL_FIELDS] = {
 	[ST_F_CT_MAX]         = 0,
 	[ST_F_RT_MAX]         = 0,
 	[ST_F_TT_MAX]         = 0,
-	[ST_F_EINT]           = ST_F_REQ_RATE_MAX,
+	[ST_F_EINT]           = ST_F_QUIC_RX_PKTS,
+	[ST_F_QUIC_RX_PKTS]   = ST_F_QUIC_TX_PKTS,
+	[ST_F_QUIC_TX_PKTS]   = ST_F_QUIC_LOST_PKTS,
+	[ST_F_QUIC_LOST_PKTS] = ST_F_QUIC_PTO,
+	[ST_F_QUIC_PTO]       = ST_F_QUIC_RETRIES,
+	[ST_F_QUIC_RETRIES]   = ST_F_QUIC_SRESETS,
+	[ST_F_QUIC_SRESETS]   = ST_F_QUIC_HO_FWD,
+	[ST_F_QUIC_HO_FWD]    = ST_F_QUIC_HO_RCVD,
+	[ST_F_QUIC_HO_RCVD]   = ST_F_REQ_RATE_MAX,
 };
 
 /* Matrix used to dump backend metrics. Each metric points to the next one to be
@@ -344,7 +382,11 @@ const int promex_back_metrics[ST_F_TOTAL_FIELDS] = {
 	[ST_F_QT_MAX]         = ST_F_CT_MAX,
 	[ST_F_CT_MAX]         = ST_F_RT_MAX,
 	[ST_F_RT_MAX]         = ST_F_TT_MAX,
-	[ST_F_TT_MAX]         = ST_F_DREQ,
+	[ST_F_TT_MAX]         = ST_F_QT_P50,
+	[ST_F_QT_P50]         = ST_F_CT_P50,
+	[ST_F_CT_P50]         = ST_F_RT_P50,
+	[ST_F_RT_P50]         = ST_F_TT_P50,
+	[ST_F_TT_P50]         = ST_F_DREQ,
 	[ST_F_EINT]           = ST_F_CLI_ABRT,
 };
 
@@ -444,7 +486,11 @@ const int promex_srv_metrics[ST_F_TOTAL_FIELDS] = {
 	[ST_F_QT_MAX]         = ST_F_CT_MAX,
 	[ST_F_CT_MAX]         = ST_F_RT_MAX,
 	[ST_F_RT_MAX]         = ST_F_TT_MAX,
-	[ST_F_TT_MAX]         = ST_F_CONNECT,
+	[ST_F_TT_MAX]         = ST_F_QT_P50,
+	[ST_F_QT_P50]         = ST_F_CT_P50,
+	[ST_F_CT_P50]         = ST_F_RT_P50,
+	[ST_F_RT_P50]         = ST_F_TT_P50,
+	[ST_F_TT_P50]         = ST_F_CONNECT,
 	[ST_F_EINT]           = ST_F_CLI_ABRT,
 };
 
@@ -609,6 +655,19 @@ const struct ist promex_st_metric_names[ST_F_TOTAL_FIELDS] = {
 	[ST_F_RT_MAX]         = IST("max_response_time_seconds"),
 	[ST_F_TT_MAX]         = IST("max_total_time_seconds"),
 	[ST_F_EINT]           = IST("internal_errors_total"),
+	[ST_F_QUIC_RX_PKTS]   = IST("quic_rx_packets_total"),
+	[ST_F_QUIC_TX_PKTS]   = IST("quic_tx_packets_total"),
+	[ST_F_QUIC_LOST_PKTS] = IST("quic_lost_packets_total"),
+	[ST_F_QUIC_PTO]       = IST("quic_pto_total"),
+	[ST_F_QUIC_RETRIES]   = IST("quic_retries_total"),
+	[ST_F_QUIC_SRESETS]   = IST("quic_stateless_resets_total"),
+	[ST_F_QUIC_HO_FWD]    = IST("quic_handover_forwarded_total"),
+	[ST_F_QUIC_HO_RCVD]   = IST("quic_handover_received_total"),
+	/* the latency histograms are dumped in place of their median */
+	[ST_F_QT_P50]         = IST("queue_time_seconds"),
+	[ST_F_CT_P50]         = IST("connect_time_seconds"),
+	[ST_F_RT_P50]         = IST("response_time_seconds"),
+	[ST_F_TT_P50]         = IST("total_time_seconds"),
 };
 
 /* Description of all info fields */
@@ -772,6 +831,18 @@ const struct ist promex_st_metric_desc[ST_F_TOTAL_FIELDS] = {
 	[ST_F_RT_MAX]         = IST("Maximum observed time spent waiting for a server response"),
 	[ST_F_TT_MAX]         = IST("Maximum observed total request+response time (request+queue+connect+response+processing)"),
 	[ST_F_EINT]           = IST("Total number of internal errors."),
+	[ST_F_QUIC_RX_PKTS]   = IST("Total number of QUIC packets received."),
+	[ST_F_QUIC_TX_PKTS]   = IST("Total number of QUIC packets sent."),
+	[ST_F_QUIC_LOST_PKTS] = IST("Total number of QUIC packets declared lost."),
+	[ST_F_QUIC_PTO]       = IST("Total number of QUIC probe timeout expirations."),
+	[ST_F_QUIC_RETRIES]   = IST("Total number of QUIC Retry packets sent."),
+	[ST_F_QUIC_SRESETS]   = IST("Total number of QUIC stateless resets sent."),
+	[ST_F_QUIC_HO_FWD]    = IST("Total number of QUIC datagrams forwarded to another process."),
+	[ST_F_QUIC_HO_RCVD]   = IST("Total number of QUIC datagrams forwarded by another process."),
+	[ST_F_QT_P50]         = IST("Distribution of the times spent in the queue."),
+	[ST_F_CT_P50]         = IST("Distribution of the connect times."),
+	[ST_F_RT_P50]         = IST("Distribution of the response times."),
+	[ST_F_TT_P50]         = IST("Distribution of the total request+response times."),
 };
 
 /* Specific labels for all info fields. Empty by default. */
@@ -1091,6 +1162,18 @@ const struct ist promex_st_metric_types[ST_F_TOTAL_FIELDS] = {
 	[ST_F_RT_MAX]         = IST("gauge"),
 	[ST_F_TT_MAX]         = IST("gauge"),
 	[ST_F_EINT]           = IST("counter"),
+	[ST_F_QUIC_RX_PKTS]   = IST("counter"),
+	[ST_F_QUIC_TX_PKTS]   = IST("counter"),
+	[ST_F_QUIC_LOST_PKTS] = IST("counter"),
+	[ST_F_QUIC_PTO]       = IST("counter"),
+	[ST_F_QUIC_RETRIES]   = IST("counter"),
+	[ST_F_QUIC_SRESETS]   = IST("counter"),
+	[ST_F_QUIC_HO_FWD]    = IST("counter"),
+	[ST_F_QUIC_HO_RCVD]   = IST("counter"),
+	[ST_F_QT_P50]         = IST("histogram"),
+	[ST_F_CT_P50]         = IST("histogram"),
+	[ST_F_RT_P50]         = IST("histogram"),
+	[ST_F_TT_P50]         = IST("histogram"),
 };
 
 /* Return the server status: 0=DOWN, 1=UP, 2=MAINT, 3=DRAIN, 4=NOLB. */
@@ -1112,28 +1195,155 @@ static int promex_srv_status(struct server *sv)
 	return state;
 }
 
+/* Releases a reference on <body>, freeing it with the last one. */
+static void promex_body_release(struct promex_body *body)
+{
+	if (body && !HA_ATOMIC_SUB(&body->refcnt, 1))
+		free(body);
+}
+
+/* Appends <data> to the body captured by <appctx> for the cache, if any. The
+ * capture is given up if the body cannot grow.
+ */
+static void promex_body_append(struct appctx *appctx, const struct ist data)
+{
+	struct promex_body *body = appctx->ctx.stats.priv;
+	struct promex_body *new;
+	size_t size;
+
+	if (!body)
+		return;
+
+	if (body->len + data.len > body->size) {
+		size = body->size;
+		while (size < body->len + data.len)
+			size *= 2;
+		new = realloc(body, sizeof(*body) + size);
+		if (!new) {
+			free(body);
+			appctx->ctx.stats.priv = NULL;
+			return;
+		}
+		body = appctx->ctx.stats.priv = new;
+		body->size = size;
+	}
+	memcpy(body->area + body->len, data.ptr, data.len);
+	body->len += data.len;
+}
+
+/* Adds <out> to the response body in <htx>, and to the body captured for the
+ * cache. It returns 1 on success, 0 if <out> could not be added.
+ */
+static int promex_add_data(struct appctx *appctx, struct htx *htx, const struct ist out)
+{
+	if (!htx_add_data_atonce(htx, out))
+		return 0;
+	channel_add_input(si_ic(appctx->owner), out.len);
+	promex_body_append(appctx, out);
+	return 1;
+}
+
+/* Looks for a fresh cached body with the metrics selected by <appctx>. If one
+ * is found, it is referenced by <appctx> to be sent and 1 is returned.
+ * Otherwise 0 is returned, after a new body was allocated to capture the
+ * response if the cache is enabled.
+ */
+static int promex_cache_lookup(struct appctx *appctx)
+{
+	unsigned int flags = appctx->ctx.stats.flags & PROMEX_FL_BODY_MASK;
+	struct promex_body *body;
+
+	appctx->ctx.stats.priv = NULL;
+	if (!promex_cache_time)
+		return 0;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &promex_cache_lock);
+	body = promex_cache;
+	if (body && body->flags == flags &&
+	    !tick_is_expired(tick_add(body->date, promex_cache_time), now_ms))
+		HA_ATOMIC_ADD(&body->refcnt, 1);
+	else
+		body = NULL;
+	HA_SPIN_UNLOCK(OTHER_LOCK, &promex_cache_lock);
+
+	if (body) {
+		appctx->ctx.stats.priv = body;
+		return 1;
+	}
+
+	body = malloc(sizeof(*body) + global.tune.bufsize);
+	if (body) {
+		body->refcnt = 1;
+		body->flags = flags;
+		body->len = 0;
+		body->size = global.tune.bufsize;
+	}
+	appctx->ctx.stats.priv = body;
+	return 0;
+}
+
+/* Stores the complete body captured by <appctx> in the cache, in place of the
+ * previous one.
+ */
+static void promex_cache_store(struct appctx *appctx)
+{
+	struct promex_body *body = appctx->ctx.stats.priv;
+	struct promex_body *old;
+
+	if (!body)
+		return;
+
+	appctx->ctx.stats.priv = NULL;
+	body->date = now_ms;
+	HA_SPIN_LOCK(OTHER_LOCK, &promex_cache_lock);
+	old = promex_cache;
+	promex_cache = body;
+	HA_SPIN_UNLOCK(OTHER_LOCK, &promex_cache_lock);
+	promex_body_release(old);
+}
+
 /* Convert a field to its string representation and write it in <out>, followed
  * by a newline, if there is enough space. non-numeric value are converted in
  * "Nan" because Prometheus only support numerical values (but it is unexepceted
  * to process this kind of value). It returns 1 on success. Otherwise, it
- * returns 0. The buffer's length must not exceed <max> value.
+ * returns 0. The buffer's length must not exceed <max> value. The integers are
+ * directly written in place, without going through the printf family.
  */
 static int promex_metric_to_str(struct buffer *out, struct field *f, size_t max)
 {
+	char *pos = b_tail(out);
+	char *end = NULL;
+	size_t room;
 	int ret = 0;
 
+	if (max > out->size)
+		max = out->size;
+	if (out->data >= max)
+		return 0;
+	room = max - out->data;
+
 	switch (field_format(f, 0)) {
-		case FF_EMPTY: ret = chunk_strcat(out,  "Nan\n"); break;
-		case FF_S32:   ret = chunk_appendf(out, "%d\n", f->u.s32); break;
-		case FF_U32:   ret = chunk_appendf(out, "%u\n", f->u.u32); break;
-		case FF_S64:   ret = chunk_appendf(out, "%lld\n", (long long)f->u.s64); break;
-		case FF_U64:   ret = chunk_appendf(out, "%llu\n", (unsigned long long)f->u.u64); break;
-		case FF_FLT:   ret = chunk_appendf(out, "%f\n", f->u.flt); break;
-		case FF_STR:   ret = chunk_strcat(out,  "Nan\n"); break;
-		default:       ret = chunk_strcat(out,  "Nan\n"); break;
+		case FF_S32: end = lltoa(f->u.s32, pos, room); break;
+		case FF_U32: end = ulltoa(f->u.u32, pos, room); break;
+		case FF_S64: end = lltoa(f->u.s64, pos, room); break;
+		case FF_U64: end = ulltoa(f->u.u64, pos, room); break;
+		case FF_FLT:
+			ret = chunk_appendf(out, "%f\n", f->u.flt);
+			if (!ret || out->data > max)
+				return 0;
+			return 1;
+		default:
+			ret = chunk_strcat(out, "Nan\n");
+			if (!ret || out->data > max)
+				return 0;
+			return 1;
 	}
-	if (!ret || out->data > max)
+
+	/* <end> points to the trailing zero, always within <room> */
+	if (!end)
 		return 0;
+	*end++ = '\n';
+	out->data = end - out->area;
 	return 1;
 }
 
@@ -1251,6 +1461,89 @@ static int promex_dump_metric(struct appctx *appctx, struct htx *htx,
 
 }
 
+/* Dump one line of the histogram <name>, made of its <suffix>, its labels and
+ * the optional <le> bound, followed by the <val> value. It returns 1 on
+ * success, 0 if <out> length exceeds <max>.
+ */
+static int promex_dump_hist_line(struct appctx *appctx, const struct ist name, const char *suffix,
+				 const char *le, const char *val, struct ist *out, size_t max)
+{
+	struct proxy *px = appctx->ctx.stats.px;
+	struct server *srv = appctx->ctx.stats.sv;
+
+	if (istcat(out, name, max) == -1 ||
+	    istcat(out, ist(suffix), max) == -1 ||
+	    istcat(out, ist("{proxy=\""), max) == -1 ||
+	    istcat(out, ist2(px->id, strlen(px->id)), max) == -1 ||
+	    istcat(out, ist("\""), max) == -1 ||
+	    (srv && istcat(out, ist(",server=\""), max) == -1) ||
+	    (srv && istcat(out, ist2(srv->id, strlen(srv->id)), max) == -1) ||
+	    (srv && istcat(out, ist("\""), max) == -1) ||
+	    (le && istcat(out, ist(",le=\""), max) == -1) ||
+	    (le && istcat(out, ist(le), max) == -1) ||
+	    (le && istcat(out, ist("\""), max) == -1) ||
+	    istcat(out, ist("} "), max) == -1 ||
+	    istcat(out, ist(val), max) == -1 ||
+	    istcat(out, ist("\n"), max) == -1)
+		return 0;
+	return 1;
+}
+
+/* Dump the latency histogram <h> (in milliseconds) of the current proxy or
+ * server as a Prometheus histogram in seconds. The times being truncated to
+ * the millisecond, the values accounted below 2^n ms are the ones lower than
+ * or equal to this bound. Each bucket is read once so that the dumped counts
+ * are always cumulative. If not already done, the header lines are dumped
+ * first. It returns 1 on success. Otherwise if <out> length exceeds <max>, it
+ * returns 0.
+ */
+static int promex_dump_hist(struct appctx *appctx, struct htx *htx, const struct ist prefix,
+			    const struct lat_hist *h, struct ist *out, size_t max)
+{
+	struct ist name = { .ptr = (char[PROMEX_MAX_NAME_LEN]){ 0 }, .len = 0 };
+	unsigned long long count = 0;
+	size_t len = out->len;
+	char le[32], val[32];
+	int i, j = 0;
+
+	if (out->len + PROMEX_MAX_METRIC_LENGTH > max)
+		return 0;
+
+	promex_metric_name(appctx, &name, prefix);
+	if ((appctx->ctx.stats.flags & PROMEX_FL_METRIC_HDR) &&
+	    !promex_dump_metric_header(appctx, htx, name, out, max))
+		goto full;
+
+	for (i = 0; i < PROMEX_HIST_BOUNDS; i++) {
+		unsigned int end = lat_hist_idx(1U << i);
+
+		while (j < end)
+			count += h->bucket[j++];
+		snprintf(le, sizeof(le), "%g", (double)(1U << i) / 1000.0);
+		ulltoa(count, val, sizeof(val));
+		if (!promex_dump_hist_line(appctx, name, "_bucket", le, val, out, max))
+			goto full;
+	}
+
+	while (j < LAT_HIST_BUCKETS)
+		count += h->bucket[j++];
+	ulltoa(count, val, sizeof(val));
+	if (!promex_dump_hist_line(appctx, name, "_bucket", "+Inf", val, out, max))
+		goto full;
+
+	snprintf(le, sizeof(le), "%f", (double)h->sum / 1000.0);
+	if (!promex_dump_hist_line(appctx, name, "_sum", NULL, le, out, max) ||
+	    !promex_dump_hist_line(appctx, name, "_count", NULL, val, out, max))
+		goto full;
+
+	appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
+	return 1;
+  full:
+	// Restore previous length
+	out->len = len;
+	return 0;
+}
+
 
 /* Dump global metrics (prefixed by "haproxy_process_"). It returns 1 on success,
  * 0 if <htx> is full and -1 in case of any error. */
@@ -1264,7 +1557,7 @@ static int promex_dump_global_metrics(struct appctx *appctx, struct htx *htx)
 	int ret = 1;
 
 #ifdef USE_OPENSSL
-	int ssl_sess_rate = read_freq_ctr(&global.ssl_per_sec);
+	int ssl_sess_rate = read_freq_ctr_thr(&global.ssl_per_sec);
 	int ssl_key_rate = read_freq_ctr(&global.ssl_fe_keys_per_sec);
 	int ssl_reuse = 0;
 
@@ -1341,7 +1634,7 @@ static int promex_dump_global_metrics(struct appctx *appctx, struct htx *htx)
 				metric = mkf_u32(0, pipes_free);
 				break;
 			case INF_CONN_RATE:
-				metric = mkf_u32(FN_RATE, read_freq_ctr(&global.conn_per_sec));
+				metric = mkf_u32(FN_RATE, read_freq_ctr_thr(&global.conn_per_sec));
 				break;
 			case INF_CONN_RATE_LIMIT:
 				metric = mkf_u32(FO_CONFIG|FN_LIMIT, global.cps_lim);
@@ -1350,7 +1643,7 @@ static int promex_dump_global_metrics(struct appctx *appctx, struct htx *htx)
 				metric = mkf_u32(FN_MAX, global.cps_max);
 				break;
 			case INF_SESS_RATE:
-				metric = mkf_u32(FN_RATE, read_freq_ctr(&global.sess_per_sec));
+				metric = mkf_u32(FN_RATE, read_freq_ctr_thr(&global.sess_per_sec));
 				break;
 			case INF_SESS_RATE_LIMIT:
 				metric = mkf_u32(FO_CONFIG|FN_LIMIT, global.sps_lim);
@@ -1455,9 +1748,8 @@ static int promex_dump_global_metrics(struct appctx *appctx, struct htx *htx)
 
   end:
 	if (out.len) {
-		if (!htx_add_data_atonce(htx, out))
+		if (!promex_add_data(appctx, htx, out))
 			return -1; /* Unexpected and unrecoverable error */
-		channel_add_input(chn, out.len);
 	}
 	return ret;
   full:
@@ -1514,10 +1806,10 @@ static int promex_dump_front_metrics(struct appctx *appctx, struct htx *htx)
 					metric = mkf_u64(FN_COUNTER, px->fe_counters.cum_conn);
 					break;
 				case ST_F_BIN:
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.bytes_in);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, bytes_in));
 					break;
 				case ST_F_BOUT:
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.bytes_out);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, bytes_out));
 					break;
 				case ST_F_DREQ:
 					metric = mkf_u64(FN_COUNTER, px->fe_counters.denied_req);
@@ -1540,6 +1832,31 @@ static int promex_dump_front_metrics(struct appctx *appctx, struct htx *htx)
 				case ST_F_EINT:
 					metric = mkf_u64(FN_COUNTER, px->fe_counters.internal_errors);
 					break;
+#ifdef USE_QUIC
+				case ST_F_QUIC_RX_PKTS:
+				case ST_F_QUIC_TX_PKTS:
+				case ST_F_QUIC_LOST_PKTS:
+				case ST_F_QUIC_PTO:
+				case ST_F_QUIC_RETRIES:
+				case ST_F_QUIC_SRESETS:
+				case ST_F_QUIC_HO_FWD:
+				case ST_F_QUIC_HO_RCVD: {
+					struct quic_counters qcnt;
+
+					if (!proxy_fe_quic_counters(px, &qcnt))
+						goto next_px;
+					metric = mkf_u64(FN_COUNTER,
+					                 appctx->st2 == ST_F_QUIC_RX_PKTS   ? qcnt.rx_pkts :
+					                 appctx->st2 == ST_F_QUIC_TX_PKTS   ? qcnt.tx_pkts :
+					                 appctx->st2 == ST_F_QUIC_LOST_PKTS ? qcnt.lost_pkts :
+					                 appctx->st2 == ST_F_QUIC_PTO       ? qcnt.pto :
+					                 appctx->st2 == ST_F_QUIC_RETRIES   ? qcnt.retries :
+					                 appctx->st2 == ST_F_QUIC_SRESETS   ? qcnt.sresets :
+					                 appctx->st2 == ST_F_QUIC_HO_FWD    ? qcnt.ho_fwd :
+					                 qcnt.ho_rcvd);
+					break;
+				}
+#endif
 				case ST_F_REQ_RATE_MAX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
@@ -1548,42 +1865,42 @@ static int promex_dump_front_metrics(struct appctx *appctx, struct htx *htx)
 				case ST_F_REQ_TOT:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.cum_req);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.cum_req));
 					break;
 				case ST_F_HRSP_1XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[1]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[1]));
 					break;
 				case ST_F_HRSP_2XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[2]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[2]));
 					break;
 				case ST_F_HRSP_3XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[3]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[3]));
 					break;
 				case ST_F_HRSP_4XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[4]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[4]));
 					break;
 				case ST_F_HRSP_5XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[5]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[5]));
 					break;
 				case ST_F_HRSP_OTHER:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[0]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[0]));
 					break;
 				case ST_F_INTERCEPTED:
 					if (px->mode != PR_MODE_HTTP)
@@ -1638,9 +1955,8 @@ static int promex_dump_front_metrics(struct appctx *appctx, struct htx *htx)
 
   end:
 	if (out.len) {
-		if (!htx_add_data_atonce(htx, out))
+		if (!promex_add_data(appctx, htx, out))
 			return -1; /* Unexpected and unrecoverable error */
-		channel_add_input(chn, out.len);
 	}
 	return ret;
   full:
@@ -1705,10 +2021,10 @@ static int promex_dump_back_metrics(struct appctx *appctx, struct htx *htx)
 					metric = mkf_u64(FN_COUNTER, px->be_counters.reuse);
 					break;
 				case ST_F_BIN:
-					metric = mkf_u64(FN_COUNTER, px->be_counters.bytes_in);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, bytes_in));
 					break;
 				case ST_F_BOUT:
-					metric = mkf_u64(FN_COUNTER, px->be_counters.bytes_out);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, bytes_out));
 					break;
 				case ST_F_QTIME:
 					secs = (double)swrate_avg(px->be_counters.q_time, TIME_STATS_SAMPLES) / 1000.0;
@@ -1742,6 +2058,22 @@ static int promex_dump_back_metrics(struct appctx *appctx, struct htx *htx)
 					secs = (double)px->be_counters.ttime_max / 1000.0;
 					metric = mkf_flt(FN_MAX, secs);
 					break;
+				case ST_F_QT_P50:
+					if (!promex_dump_hist(appctx, htx, prefix, &px->be_counters.q_hist, &out, max))
+						goto full;
+					goto next_px;
+				case ST_F_CT_P50:
+					if (!promex_dump_hist(appctx, htx, prefix, &px->be_counters.c_hist, &out, max))
+						goto full;
+					goto next_px;
+				case ST_F_RT_P50:
+					if (!promex_dump_hist(appctx, htx, prefix, &px->be_counters.d_hist, &out, max))
+						goto full;
+					goto next_px;
+				case ST_F_TT_P50:
+					if (!promex_dump_hist(appctx, htx, prefix, &px->be_counters.t_hist, &out, max))
+						goto full;
+					goto next_px;
 				case ST_F_DREQ:
 					metric = mkf_u64(FN_COUNTER, px->be_counters.denied_req);
 					break;
@@ -1797,42 +2129,42 @@ static int promex_dump_back_metrics(struct appctx *appctx, struct htx *htx)
 				case ST_F_REQ_TOT:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.cum_req);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.cum_req));
 					break;
 				case ST_F_HRSP_1XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[1]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[1]));
 					break;
 				case ST_F_HRSP_2XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[2]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[2]));
 					break;
 				case ST_F_HRSP_3XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[3]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[3]));
 					break;
 				case ST_F_HRSP_4XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[4]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[4]));
 					break;
 				case ST_F_HRSP_5XX:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[5]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[5]));
 					break;
 				case ST_F_HRSP_OTHER:
 					if (px->mode != PR_MODE_HTTP)
 						goto next_px;
 					appctx->ctx.stats.flags &= ~PROMEX_FL_METRIC_HDR;
-					metric = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[0]);
+					metric = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[0]));
 					break;
 				case ST_F_CACHE_LOOKUPS:
 					if (px->mode != PR_MODE_HTTP)
@@ -1882,9 +2214,8 @@ static int promex_dump_back_metrics(struct appctx *appctx, struct htx *htx)
 
   end:
 	if (out.len) {
-		if (!htx_add_data_atonce(htx, out))
+		if (!promex_add_data(appctx, htx, out))
 			return -1; /* Unexpected and unrecoverable error */
-		channel_add_input(chn, out.len);
 	}
 	return ret;
   full:
@@ -1990,6 +2321,22 @@ static int promex_dump_srv_metrics(struct appctx *appctx, struct htx *htx)
 						secs = (double)sv->counters.ttime_max / 1000.0;
 						metric = mkf_flt(FN_MAX, secs);
 						break;
+					case ST_F_QT_P50:
+						if (!promex_dump_hist(appctx, htx, prefix, &sv->counters.q_hist, &out, max))
+							goto full;
+						goto next_sv;
+					case ST_F_CT_P50:
+						if (!promex_dump_hist(appctx, htx, prefix, &sv->counters.c_hist, &out, max))
+							goto full;
+						goto next_sv;
+					case ST_F_RT_P50:
+						if (!promex_dump_hist(appctx, htx, prefix, &sv->counters.d_hist, &out, max))
+							goto full;
+						goto next_sv;
+					case ST_F_TT_P50:
+						if (!promex_dump_hist(appctx, htx, prefix, &sv->counters.t_hist, &out, max))
+							goto full;
+						goto next_sv;
 					case ST_F_CONNECT:
 						metric = mkf_u64(FN_COUNTER, sv->counters.connect);
 						break;
@@ -2133,9 +2480,8 @@ static int promex_dump_srv_metrics(struct appctx *appctx, struct htx *htx)
 
   end:
 	if (out.len) {
-		if (!htx_add_data_atonce(htx, out))
+		if (!promex_add_data(appctx, htx, out))
 			return -1; /* Unexpected and unrecoverable error */
-		channel_add_input(chn, out.len);
 	}
 	return ret;
   full:
@@ -2143,6 +2489,31 @@ static int promex_dump_srv_metrics(struct appctx *appctx, struct htx *htx)
 	goto end;
 }
 
+/* Sends the end of the cached body referenced by <appctx>, starting at offset
+ * <appctx->st2>. It returns 1 once done, 0 if <htx> is full.
+ */
+static int promex_dump_cached(struct appctx *appctx, struct htx *htx)
+{
+	struct promex_body *body = appctx->ctx.stats.priv;
+	struct channel *chn = si_ic(appctx->owner);
+	size_t max, len;
+
+	while (appctx->st2 < body->len) {
+		max = htx_get_max_blksz(htx, channel_htx_recv_max(chn, htx));
+		len = body->len - appctx->st2;
+		if (len > max)
+			len = max;
+		if (!len)
+			return 0;
+		len = htx_add_data(htx, ist2(body->area + appctx->st2, len));
+		if (!len)
+			return 0;
+		channel_add_input(chn, len);
+		appctx->st2 += len;
+	}
+	return 1;
+}
+
 /* Dump all metrics (global, frontends, backends and servers) depending on the
  * dumper state (appctx->st1). It returns 1 on success, 0 if <htx> is full and
  * -1 in case of any error. */
@@ -2152,6 +2523,11 @@ static int promex_dump_metrics(struct appctx *appctx, struct stream_interface *s
 
 	switch (appctx->st1) {
 		case PROMEX_DUMPER_INIT:
+			if (promex_cache_lookup(appctx)) {
+				appctx->st2 = 0;
+				appctx->st1 = PROMEX_DUMPER_CACHED;
+				goto cached;
+			}
 			appctx->ctx.stats.px = NULL;
 			appctx->ctx.stats.sv = NULL;
 			appctx->ctx.stats.flags |= (PROMEX_FL_METRIC_HDR|PROMEX_FL_INFO_METRIC);
@@ -2221,11 +2597,22 @@ static int promex_dump_metrics(struct appctx *appctx, struct stream_interface *s
 				}
 			}
 
+			promex_cache_store(appctx);
 			appctx->ctx.stats.px = NULL;
 			appctx->ctx.stats.sv = NULL;
 			appctx->ctx.stats.flags &= ~(PROMEX_FL_METRIC_HDR|PROMEX_FL_INFO_METRIC|PROMEX_FL_STATS_METRIC);
 			appctx->st2 = 0;
 			appctx->st1 = PROMEX_DUMPER_DONE;
+			break;
+
+		case PROMEX_DUMPER_CACHED:
+		  cached:
+			if (!promex_dump_cached(appctx, htx))
+				goto full;
+			promex_body_release(appctx->ctx.stats.priv);
+			appctx->ctx.stats.priv = NULL;
+			appctx->st2 = 0;
+			appctx->st1 = PROMEX_DUMPER_DONE;
 			/* fall through */
 
 		case PROMEX_DUMPER_DONE:
@@ -2240,6 +2627,8 @@ static int promex_dump_metrics(struct appctx *appctx, struct stream_interface *s
 	return 0;
   error:
 	/* unrecoverable error */
+	promex_body_release(appctx->ctx.stats.priv);
+	appctx->ctx.stats.priv = NULL;
 	appctx->ctx.stats.px = NULL;
 	appctx->ctx.stats.sv = NULL;
 	appctx->ctx.stats.flags = 0;
@@ -2389,9 +2778,17 @@ static int promex_send_headers(struct appctx *appctx, struct stream_interface *s
 static int promex_appctx_init(struct appctx *appctx, struct proxy *px, struct stream *strm)
 {
 	appctx->st0 = PROMEX_ST_INIT;
+	appctx->ctx.stats.priv = NULL;
 	return 1;
 }
 
+/* Releases the body the applet was sending or capturing, if any. */
+static void promex_appctx_release(struct appctx *appctx)
+{
+	promex_body_release(appctx->ctx.stats.priv);
+	appctx->ctx.stats.priv = NULL;
+}
+
 /* The main I/O handler for the promex applet. */
 static void promex_appctx_handle_io(struct appctx *appctx)
 {
@@ -2478,6 +2875,7 @@ struct applet promex_applet = {
 	.name = "<PROMEX>", /* used for logging */
 	.init = promex_appctx_init,
 	.fct = promex_appctx_handle_io,
+	.release = promex_appctx_release,
 };
 
 static enum act_parse_ret service_parse_prometheus_exporter(const char **args, int *cur_arg, struct proxy *px,
@@ -2510,3 +2908,41 @@ static struct action_kw_list service_actions = { ILH, {
 
 INITCALL1(STG_REGISTER, service_keywords_register, &service_actions);
 INITCALL0(STG_REGISTER, promex_register_build_options);
+
+/* config parser for global "tune.prometheus.cache-time" */
+static int promex_parse_cache_time(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a time in milliseconds.", args[0]);
+		return -1;
+	}
+
+	res = parse_time_err(args[1], &promex_cache_time, TIME_UNIT_MS);
+	if (res) {
+		memprintf(err, "unexpected character '%c' in '%s'.", *res, args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static void promex_deinit(void)
+{
+	promex_body_release(promex_cache);
+	promex_cache = NULL;
+}
+
+REGISTER_POST_DEINIT(promex_deinit);
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.prometheus.cache-time", promex_parse_cache_time },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
@@ -42,6 +42,84 @@ struct eb32_node *eb32i_lookup(struct eb_root *root, s32 x)
 	return __eb32i_lookup(root, x);
 }
 
+/*
+ * Look up the <count> keys of <keys> in the tree <root> and store into the
+ * same entry of <nodes> the first occurrence of each of them, or NULL if it
+ * cannot be found. Up to EB_LOOKUP_BATCH lookups descend the tree together,
+ * one level at a time, each of them prefetching its next node before the other
+ * ones are processed, so that their cache misses overlap instead of adding up.
+ * Returns the number of keys found.
+ */
+int eb32_lookup_batch(struct eb_root *root, const u32 *keys, struct eb32_node **nodes, int count)
+{
+	eb_troot_t *troots[EB_LOOKUP_BATCH];
+	struct eb32_node *node;
+	eb_troot_t *troot;
+	int base, i, n, left;
+	int found = 0;
+	int node_bit;
+	u32 x, y;
+
+	for (base = 0; base < count; base += EB_LOOKUP_BATCH) {
+		n = count - base;
+		if (n > EB_LOOKUP_BATCH)
+			n = EB_LOOKUP_BATCH;
+
+		for (i = 0; i < n; i++) {
+			troots[i] = root->b[EB_LEFT];
+			nodes[base + i] = NULL;
+		}
+		left = root->b[EB_LEFT] ? n : 0;
+
+		while (left) {
+			for (i = 0; i < n; i++) {
+				troot = troots[i];
+				if (!troot)
+					continue;
+
+				x = keys[base + i];
+				if (eb_gettag(troot) == EB_LEAF) {
+					node = container_of(eb_untag(troot, EB_LEAF),
+							    struct eb32_node, node.branches);
+					if (node->key == x)
+						goto found;
+					goto done;
+				}
+				node = container_of(eb_untag(troot, EB_NODE),
+						    struct eb32_node, node.branches);
+				node_bit = node->node.bit;
+
+				y = node->key ^ x;
+				if (!y) {
+					/* same key or dup tree, see __eb32_lookup() */
+					if (node_bit < 0) {
+						troot = node->node.branches.b[EB_LEFT];
+						while (eb_gettag(troot) != EB_LEAF)
+							troot = (eb_untag(troot, EB_NODE))->b[EB_LEFT];
+						node = container_of(eb_untag(troot, EB_LEAF),
+								    struct eb32_node, node.branches);
+					}
+					goto found;
+				}
+
+				if ((y >> node_bit) >= EB_NODE_BRANCHES)
+					goto done; /* no more common bits */
+
+				troots[i] = node->node.branches.b[(x >> node_bit) & EB_NODE_BRANCH_MASK];
+				eb_prefetch(troots[i]);
+				continue;
+			found:
+				nodes[base + i] = node;
+				found++;
+			done:
+				troots[i] = NULL;
+				left--;
+			}
+		}
+	}
+	return found;
+}
+
 /*
  * Find the last occurrence of the highest key in the tree <root>, which is
  * equal to or less than <x>. NULL is returned is no key matches.
@@ -112,6 +112,7 @@ static inline void eb32_delete(struct eb32_node *eb32)
  * in eb32tree.c, which simply relies on their inline version.
  */
 struct eb32_node *eb32_lookup(struct eb_root *root, u32 x);
+int eb32_lookup_batch(struct eb_root *root, const u32 *keys, struct eb32_node **nodes, int count);
 struct eb32_node *eb32i_lookup(struct eb_root *root, s32 x);
 struct eb32_node *eb32_lookup_le(struct eb_root *root, u32 x);
 struct eb32_node *eb32_lookup_ge(struct eb_root *root, u32 x);
@@ -155,6 +156,7 @@ static forceinline struct eb32_node *__eb32_lookup(struct eb_root *root, u32 x)
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct eb32_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 		node_bit = node->node.bit;
 
 		y = node->key ^ x;
@@ -207,6 +209,7 @@ static forceinline struct eb32_node *__eb32i_lookup(struct eb_root *root, s32 x)
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct eb32_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 		node_bit = node->node.bit;
 
 		y = node->key ^ x;
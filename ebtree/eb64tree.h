@@ -158,6 +158,7 @@ static forceinline struct eb64_node *__eb64_lookup(struct eb_root *root, u64 x)
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct eb64_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		y = node->key ^ x;
 		if (!y) {
@@ -208,6 +209,7 @@ static forceinline struct eb64_node *__eb64i_lookup(struct eb_root *root, s64 x)
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct eb64_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		y = node->key ^ x;
 		if (!y) {
@@ -69,6 +69,7 @@ __ebim_lookup(struct eb_root *root, const void *x, unsigned int len)
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebpt_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		node_bit = node->node.bit;
 		if (node_bit < 0) {
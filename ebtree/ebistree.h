@@ -81,6 +81,7 @@ static forceinline struct ebpt_node *__ebis_lookup(struct eb_root *root, const v
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebpt_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 		node_bit = node->node.bit;
 
 		if (node_bit < 0) {
@@ -31,6 +31,121 @@ ebmb_lookup(struct eb_root *root, const void *x, unsigned int len)
 	return __ebmb_lookup(root, x, len);
 }
 
+/* Look up the <count> keys of <len> bytes pointed to by <keys> in the tree
+ * <root> and store into the same entry of <nodes> the first occurrence of each
+ * of them as ebmb_lookup() does, or NULL if it cannot be found. Up to
+ * EB_LOOKUP_BATCH lookups descend the tree together, one level at a time, each
+ * of them prefetching its next node before the other ones are processed, so
+ * that their cache misses overlap instead of adding up. Returns the number of
+ * keys found.
+ */
+int ebmb_lookup_batch(struct eb_root *root, const void *const *keys, unsigned int len,
+                      struct ebmb_node **nodes, int count)
+{
+	eb_troot_t *troots[EB_LOOKUP_BATCH];
+	const unsigned char *xs[EB_LOOKUP_BATCH];
+	unsigned int lens[EB_LOOKUP_BATCH];
+	int poss[EB_LOOKUP_BATCH];
+	const unsigned char *x;
+	struct ebmb_node *node;
+	eb_troot_t *troot;
+	int base, i, n, left;
+	int found = 0;
+	int pos, side, node_bit;
+	unsigned int l;
+
+	if (unlikely(len == 0)) {
+		/* all keys match the first node */
+		for (i = 0; i < count; i++) {
+			nodes[i] = __ebmb_lookup(root, keys[i], 0);
+			found += !!nodes[i];
+		}
+		return found;
+	}
+
+	for (base = 0; base < count; base += EB_LOOKUP_BATCH) {
+		n = count - base;
+		if (n > EB_LOOKUP_BATCH)
+			n = EB_LOOKUP_BATCH;
+
+		for (i = 0; i < n; i++) {
+			troots[i] = root->b[EB_LEFT];
+			xs[i] = keys[base + i];
+			lens[i] = len;
+			poss[i] = 0;
+			nodes[base + i] = NULL;
+		}
+		left = root->b[EB_LEFT] ? n : 0;
+
+		while (left) {
+			for (i = 0; i < n; i++) {
+				troot = troots[i];
+				if (!troot)
+					continue;
+
+				/* one step of __ebmb_lookup() */
+				x = xs[i];
+				l = lens[i];
+				pos = poss[i];
+				if (eb_gettag(troot) == EB_LEAF) {
+					node = container_of(eb_untag(troot, EB_LEAF),
+							    struct ebmb_node, node.branches);
+					if (memcmp(node->key + pos, x, l) == 0)
+						goto found;
+					goto done;
+				}
+				node = container_of(eb_untag(troot, EB_NODE),
+						    struct ebmb_node, node.branches);
+
+				node_bit = node->node.bit;
+				if (node_bit < 0) {
+					if (memcmp(node->key + pos, x, l) != 0)
+						goto done;
+					goto walk_left;
+				}
+
+				node_bit = ~node_bit + (pos << 3) + 8;
+				if (node_bit < 0) {
+					while (1) {
+						if (node->key[pos++] ^ *x++)
+							goto done;
+						if (--l == 0)
+							goto walk_left;
+						node_bit += 8;
+						if (node_bit >= 0)
+							break;
+					}
+				}
+
+				side = *x >> node_bit;
+				if (((node->key[pos] >> node_bit) ^ side) > 1)
+					goto done;
+				side &= 1;
+
+				troots[i] = node->node.branches.b[side];
+				eb_prefetch(troots[i]);
+				xs[i] = x;
+				lens[i] = l;
+				poss[i] = pos;
+				continue;
+			walk_left:
+				troot = node->node.branches.b[EB_LEFT];
+				while (eb_gettag(troot) != EB_LEAF)
+					troot = (eb_untag(troot, EB_NODE))->b[EB_LEFT];
+				node = container_of(eb_untag(troot, EB_LEAF),
+						    struct ebmb_node, node.branches);
+			found:
+				nodes[base + i] = node;
+				found++;
+			done:
+				troots[i] = NULL;
+				left--;
+			}
+		}
+	}
+	return found;
+}
+
 /* Insert ebmb_node <new> into subtree starting at node root <root>.
  * Only new->key needs be set with the key. The ebmb_node is returned.
  * If root->b[EB_RGHT]==1, the tree may only contain unique keys. The
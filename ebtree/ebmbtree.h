@@ -113,6 +113,8 @@ static forceinline void ebmb_delete(struct ebmb_node *ebmb)
  * in ebmbtree.c, which simply relies on their inline version.
  */
 struct ebmb_node *ebmb_lookup(struct eb_root *root, const void *x, unsigned int len);
+int ebmb_lookup_batch(struct eb_root *root, const void *const *keys, unsigned int len,
+                      struct ebmb_node **nodes, int count);
 struct ebmb_node *ebmb_insert(struct eb_root *root, struct ebmb_node *new, unsigned int len);
 struct ebmb_node *ebmb_lookup_longest(struct eb_root *root, const void *x);
 struct ebmb_node *ebmb_lookup_prefix(struct eb_root *root, const void *x, unsigned int pfx);
@@ -161,6 +163,7 @@ static forceinline struct ebmb_node *__ebmb_lookup(struct eb_root *root, const v
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebmb_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		node_bit = node->node.bit;
 		if (node_bit < 0) {
@@ -406,6 +409,7 @@ static forceinline struct ebmb_node *__ebmb_lookup_longest(struct eb_root *root,
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebmb_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		node_bit = node->node.bit;
 		if (node_bit < 0) {
@@ -500,6 +504,7 @@ static forceinline struct ebmb_node *__ebmb_lookup_prefix(struct eb_root *root,
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebmb_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 
 		node_bit = node->node.bit;
 		if (node_bit < 0) {
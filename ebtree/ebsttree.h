@@ -75,6 +75,7 @@ static forceinline struct ebmb_node *__ebst_lookup(struct eb_root *root, const v
 		}
 		node = container_of(eb_untag(troot, EB_NODE),
 				    struct ebmb_node, node.branches);
+		eb_prefetch_branches(&node->node.branches);
 		node_bit = node->node.bit;
 
 		if (node_bit < 0) {
@@ -336,6 +336,11 @@ static inline int fls64(unsigned long long x)
 #define EB_NODE_BRANCHES      (1 << EB_NODE_BITS)
 #define EB_NODE_BRANCH_MASK   (EB_NODE_BRANCHES - 1)
 
+/* Number of lookups progressing together in the ebXX_lookup_batch() functions.
+ * Each of them has one cache miss in flight at a time.
+ */
+#define EB_LOOKUP_BATCH       8
+
 /* Be careful not to tweak those values. The walking code is optimized for NULL
  * detection on the assumption that the following values are intact.
  */
@@ -445,6 +450,26 @@ static inline struct eb_node *eb_root_to_node(struct eb_root *root)
 	return container_of(root, struct eb_node, branches);
 }
 
+/* Starts to fetch the node designated by <troot>, or both nodes attached to
+ * <branches>, into the CPU caches, so that the one a lookup descends to is
+ * already on its way while the current node is being compared. In large
+ * trees, each level would otherwise cost a full cache miss. Prefetches never
+ * fault, so NULL or tagged pointers are fine, the tag only being an offset of
+ * one byte.
+ */
+static forceinline void eb_prefetch(const eb_troot_t *troot)
+{
+#if defined(__GNUC__)
+	__builtin_prefetch(troot);
+#endif
+}
+
+static forceinline void eb_prefetch_branches(const struct eb_root *branches)
+{
+	eb_prefetch(branches->b[EB_LEFT]);
+	eb_prefetch(branches->b[EB_RGHT]);
+}
+
 /* Walks down starting at root pointer <start>, and always walking on side
  * <side>. It either returns the node hosting the first leaf on that side,
  * or NULL if no leaf is found. <start> may either be NULL or a branch pointer.
@@ -43,12 +43,27 @@ struct buffer_wait {
 	struct mt_list list;        /* Next element in the <buffer_wq> list */
 };
 
+/* Per-thread LIFO of the last released regular buffers. They are still
+ * accounted as used in pool_head_buffer, and are reused first by the next
+ * allocations on the same thread since their contents are likely still in the
+ * CPU caches.
+ */
+struct buf_hot_cache {
+	unsigned int count;
+#if CONFIG_HAP_BUF_HOT_CACHE > 0
+	char *area[CONFIG_HAP_BUF_HOT_CACHE];
+#endif
+};
+
 extern struct pool_head *pool_head_buffer;
+extern struct pool_head *pool_head_small_buffer;
 extern struct mt_list buffer_wq;
 __decl_hathreads(extern HA_SPINLOCK_T buffer_wq_lock);
+extern THREAD_LOCAL struct buf_hot_cache buf_hot;
 
 int init_buffer();
 void buffer_dump(FILE *o, struct buffer *b, int from, int to);
+void b_hot_flush(void);
 
 /*****************************************************************/
 /* These functions are used to compute various buffer area sizes */
@@ -63,10 +78,49 @@ static inline int buffer_almost_full(const struct buffer *buf)
 	return b_almost_full(buf);
 }
 
+/* Return 1 if <buf> is an allocated small buffer ("tune.bufsize.small"),
+ * otherwise 0.
+ */
+static inline int b_is_small(const struct buffer *buf)
+{
+	return pool_head_small_buffer && buf->size == pool_head_small_buffer->size;
+}
+
 /**************************************************/
 /* Functions below are used for buffer allocation */
 /**************************************************/
 
+/* Returns the area of the last buffer released into the thread's hot buffer
+ * cache, or NULL if it is empty.
+ */
+static inline char *b_hot_get(void)
+{
+#if CONFIG_HAP_BUF_HOT_CACHE > 0
+	if (buf_hot.count) {
+		activity[tid].buf_hot++;
+		return buf_hot.area[--buf_hot.count];
+	}
+#endif
+	return NULL;
+}
+
+/* Tries to keep the regular buffer area <area> in the thread's hot buffer
+ * cache. This is not done when the cache is full, on memory pressure, or when
+ * some objects are waiting for a buffer, since they only consider the buffers
+ * available in the pool. Returns non-zero if the area was kept.
+ */
+static inline int b_hot_put(char *area)
+{
+#if CONFIG_HAP_BUF_HOT_CACHE > 0 && !defined(DEBUG_UAF)
+	if (buf_hot.count < CONFIG_HAP_BUF_HOT_CACHE &&
+	    likely(!pool_mem_pressure) && MT_LIST_ISEMPTY(&buffer_wq)) {
+		buf_hot.area[buf_hot.count++] = area;
+		return 1;
+	}
+#endif
+	return 0;
+}
+
 /* Allocates a buffer and assigns it to *buf. If no memory is available,
  * ((char *)1) is assigned instead with a zero size. No control is made to
  * check if *buf already pointed to another buffer. The allocated buffer is
@@ -77,12 +131,16 @@ static inline struct buffer *b_alloc(struct buffer *buf)
 	char *area;
 
 	*buf = BUF_WANTED;
+	area = b_hot_get();
+	if (area)
+		goto done;
+
 	area = pool_alloc_dirty(pool_head_buffer);
 	if (unlikely(!area)) {
 		activity[tid].buf_wait++;
 		return NULL;
 	}
-
+ done:
 	buf->area = area;
 	buf->size = pool_head_buffer->size;
 	return buf;
@@ -100,7 +158,9 @@ static inline struct buffer *b_alloc_fast(struct buffer *buf)
 	char *area;
 
 	*buf = BUF_WANTED;
-	area = pool_get_first(pool_head_buffer);
+	area = b_hot_get();
+	if (!area)
+		area = pool_get_first(pool_head_buffer);
 	if (unlikely(!area))
 		return NULL;
 
@@ -115,13 +175,15 @@ static inline struct buffer *b_alloc_fast(struct buffer *buf)
 static inline void __b_free(struct buffer *buf)
 {
 	char *area = buf->area;
+	struct pool_head *pool = b_is_small(buf) ? pool_head_small_buffer : pool_head_buffer;
 
 	/* let's first clear the area to save an occasional "show sess all"
 	 * glancing over our shoulder from getting a dangling pointer.
 	 */
 	*buf = BUF_NULL;
 	__ha_barrier_store();
-	pool_free(pool_head_buffer, area);
+	if (pool != pool_head_buffer || !b_hot_put(area))
+		pool_free(pool, area);
 }
 
 /* Releases buffer <buf> if allocated, and marks it empty. */
@@ -158,6 +220,13 @@ static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
 
 	*buf = BUF_WANTED;
 
+	/* hot path: the buffers of the hot cache are still accounted as used */
+	if (buf_hot.count &&
+	    (pool_head_buffer->allocated - pool_head_buffer->used + cached + buf_hot.count) > margin) {
+		area = b_hot_get();
+		goto done;
+	}
+
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
 	HA_SPIN_LOCK(POOL_LOCK, &pool_head_buffer->lock);
 #endif
@@ -191,6 +260,54 @@ static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
 	return buf;
 }
 
+/* Ensures that <buf> is allocated like b_alloc_margin() does, but starts with a
+ * small buffer when "tune.bufsize.small" is set. This is only meant for users
+ * which know how to continue with a regular buffer using b_grow_margin() when
+ * they need more room. A regular buffer is allocated if small ones are
+ * disabled or not available.
+ */
+static inline struct buffer *b_alloc_small_margin(struct buffer *buf, int margin)
+{
+	char *area;
+
+	if (buf->size)
+		return buf;
+
+	if (!pool_head_small_buffer)
+		return b_alloc_margin(buf, margin);
+
+	*buf = BUF_WANTED;
+	area = pool_alloc_dirty(pool_head_small_buffer);
+	if (unlikely(!area))
+		return b_alloc_margin(buf, margin);
+
+	buf->area = area;
+	buf->size = pool_head_small_buffer->size;
+	return buf;
+}
+
+/* Moves the contents of small buffer <buf> to a regular buffer allocated with
+ * b_alloc_margin() so that it may grow up to tune.bufsize bytes. The data are
+ * realigned at the beginning of the new buffer. Buffers which are not small
+ * ones are left untouched. Returns <buf>, or NULL if the regular buffer could
+ * not be allocated, in which case <buf> is left untouched as well.
+ */
+static inline struct buffer *b_grow_margin(struct buffer *buf, int margin)
+{
+	struct buffer large = BUF_NULL;
+
+	if (!b_is_small(buf))
+		return buf;
+
+	if (!b_alloc_margin(&large, margin))
+		return NULL;
+
+	large.data = b_getblk(buf, b_orig(&large), b_data(buf), 0);
+	__b_free(buf);
+	*buf = large;
+	return buf;
+}
+
 
 /* Offer a buffer currently belonging to target <from> to whoever needs one.
  * Any pointer is valid for <from>, including NULL. Its purpose is to avoid
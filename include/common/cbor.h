@@ -0,0 +1,106 @@
+/*
+ * include/common/cbor.h
+ * This file contains a minimal CBOR (RFC7049) encoder, only supporting the
+ * unsigned integers, byte and text strings, and definite length maps and
+ * arrays, which are enough to emit structured records.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _COMMON_CBOR_H
+#define _COMMON_CBOR_H
+
+#include <inttypes.h>
+#include <string.h>
+
+/* CBOR major types, already shifted */
+#define CBOR_MT_UINT    0x00
+#define CBOR_MT_BYTES   0x40
+#define CBOR_MT_TEXT    0x60
+#define CBOR_MT_ARRAY   0x80
+#define CBOR_MT_MAP     0xa0
+
+/* Returns the number of bytes needed to encode the head of an item carrying
+ * the value or length <val>.
+ */
+static inline size_t cbor_head_len(uint64_t val)
+{
+	return val < 24 ? 1 : val <= 0xff ? 2 : val <= 0xffff ? 3 : val <= 0xffffffff ? 5 : 9;
+}
+
+/* Encodes at <pos> the head of an item of major type <mt> carrying the value
+ * or length <val>, without going beyond <end>. Returns the position following
+ * the head, or NULL if there is not enough room.
+ */
+static inline char *cbor_put_head(char *pos, const char *end, unsigned char mt, uint64_t val)
+{
+	size_t len = cbor_head_len(val);
+	int shift;
+
+	if (!pos || end - pos < len)
+		return NULL;
+
+	if (len == 1) {
+		*pos++ = mt | val;
+		return pos;
+	}
+
+	*pos++ = mt | (len == 2 ? 24 : len == 3 ? 25 : len == 5 ? 26 : 27);
+	for (shift = (len - 2) * 8; shift >= 0; shift -= 8)
+		*pos++ = val >> shift;
+	return pos;
+}
+
+/* Encodes at <pos> the unsigned integer <val>. Returns the position following
+ * it, or NULL if there is not enough room before <end>.
+ */
+static inline char *cbor_put_uint(char *pos, const char *end, uint64_t val)
+{
+	return cbor_put_head(pos, end, CBOR_MT_UINT, val);
+}
+
+/* Encodes at <pos> the <len> bytes string <str> of major type <mt> (text or
+ * bytes). If <trunc> is non-zero, the string is truncated to the room left
+ * before <end>, otherwise NULL is returned if it does not fit. Returns the
+ * position following the string.
+ */
+static inline char *cbor_put_str(char *pos, const char *end, unsigned char mt,
+                                 const char *str, size_t len, int trunc)
+{
+	if (!pos)
+		return NULL;
+
+	if (trunc && end - pos < cbor_head_len(len) + len) {
+		if (end - pos < 1)
+			return NULL;
+		len = end - pos - 1;
+		while (len && cbor_head_len(len) + len > end - pos)
+			len--;
+	}
+
+	pos = cbor_put_head(pos, end, mt, len);
+	if (!pos || end - pos < len)
+		return NULL;
+	memcpy(pos, str, len);
+	return pos + len;
+}
+
+/* Encodes at <pos> the text string <str>. See cbor_put_str(). */
+static inline char *cbor_put_text(char *pos, const char *end, const char *str, size_t len, int trunc)
+{
+	return cbor_put_str(pos, end, CBOR_MT_TEXT, str, len, trunc);
+}
+
+#endif /* _COMMON_CBOR_H */
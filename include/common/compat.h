@@ -175,6 +175,17 @@ typedef struct { } empty_t;
 #endif
 #endif
 
+/* kernel TLS (Linux >= 4.13), the libc may not know about it yet */
+#if defined(__linux__)
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 /* FreeBSD doesn't define SOL_IP and prefers IPPROTO_IP */
 #ifndef SOL_IP
 #define SOL_IP IPPROTO_IP
@@ -121,6 +121,11 @@
 #define STKTABLE_FILTER_LEN 4
 #endif
 
+// max # of stick-table entries collected at once by a dump, at most 32
+#ifndef STKTABLE_DUMP_BATCH
+#define STKTABLE_DUMP_BATCH 16
+#endif
+
 // max # of loops we can perform around a read() which succeeds.
 // It's very frequent that the system returns a few TCP segments at a time.
 #ifndef MAX_READ_POLL_LOOPS
@@ -181,6 +186,17 @@
 #define DEF_HANA_ONERR		HANA_ONERR_FAILCHK
 #define DEF_HANA_ERRLIMIT	10
 
+/* outlier detection: base ejection time (ms), max percentage of ejected
+ * servers per backend, and number of response times averaged per server.
+ */
+#define DEF_EJECT_TIME		30000
+#define DEF_EJECT_MAX_PCT	50
+#define EJECT_RTIME_SAMPLES	16
+#define EJECT_MAX_SHIFT		5
+
+/* adaptive concurrency limit: number of response times per adjustment */
+#define ADAPT_RTIME_SAMPLES	16
+
 // X-Forwarded-For header default
 #define DEF_XFORWARDFOR_HDR	"X-Forwarded-For"
 
@@ -312,6 +328,20 @@
 #define CONFIG_HAP_POOL_CACHE_SIZE 524288
 #endif
 
+/* number of recently released buffers each thread keeps for immediate reuse,
+ * 0 disables this cache.
+ */
+#ifndef CONFIG_HAP_BUF_HOT_CACHE
+#define CONFIG_HAP_BUF_HOT_CACHE 4
+#endif
+
+/* number of NUMA nodes the lockless pools keep a shared free list for. Nodes
+ * above this one share the free list of their number modulo this value.
+ */
+#ifndef CONFIG_HAP_POOL_NODES
+#define CONFIG_HAP_POOL_NODES 4
+#endif
+
 /* Number of samples used to compute the times reported in stats. A power of
  * two is highly recommended, and this value multiplied by the largest response
  * time must not overflow and unsigned int. See freq_ctr.h for more information.
@@ -319,6 +349,11 @@
  * so in order to advertise accurate times across 1k samples, we effectively
  * measure over 512.
  */
+/* number of objects dumped by a stats dump before yielding */
+#ifndef STATS_DUMP_BUDGET
+#define STATS_DUMP_BUDGET 1000
+#endif
+
 #ifndef TIME_STATS_SAMPLES
 #define TIME_STATS_SAMPLES 512
 #endif
@@ -347,4 +382,16 @@
 #define DEFAULT_PAT_LRU_SIZE 10000
 #endif
 
+/* minimum number of consecutive "use_backend" rules matching the same sample
+ * against exact strings for them to be evaluated with a single lookup, and
+ * maximum length of these strings.
+ */
+#ifndef SW_DISPATCH_MIN_RULES
+#define SW_DISPATCH_MIN_RULES 4
+#endif
+
+#ifndef SW_DISPATCH_MAX_KEY
+#define SW_DISPATCH_MAX_KEY 256
+#endif
+
 #endif /* _COMMON_DEFAULTS_H */
@@ -163,6 +163,63 @@ enum h3_err {
 #define H3_SETTINGS_MAX_HEADER_LIST_SIZE   0x0006
 
 
+/* HTTP/3 frame types - draft-ietf-quic-http #7.2 */
+enum {
+	H3_FRM_DATA          = 0x00,
+	H3_FRM_HEADERS       = 0x01,
+	H3_FRM_CANCEL_PUSH   = 0x03,
+	H3_FRM_SETTINGS      = 0x04,
+	H3_FRM_PUSH_PROMISE  = 0x05,
+	H3_FRM_GOAWAY        = 0x07,
+	H3_FRM_MAX_PUSH_ID   = 0x0d,
+	/* RFC 9218 #7 */
+	H3_FRM_PRIORITY_UPDATE_REQ  = 0xf0700,
+	H3_FRM_PRIORITY_UPDATE_PUSH = 0xf0701,
+};
+
+/* Extensible priorities - RFC 9218 #4 */
+#define H3_URGENCY_MAX       7
+#define H3_URGENCY_DFLT      3
+
+/* HTTP/3 and QPACK unidirectional stream types - draft-ietf-quic-http #6.2 */
+enum {
+	H3_UNI_CTRL          = 0x00,
+	H3_UNI_PUSH          = 0x01,
+	H3_UNI_QPACK_ENC     = 0x02,
+	H3_UNI_QPACK_DEC     = 0x03,
+};
+
+/* HTTP/3 settings - draft-ietf-quic-http #7.2.4.1. The identifiers 0x02 to
+ * 0x05 are the reserved HTTP/2 ones above.
+ */
+#define H3_SETTINGS_QPACK_MAX_TABLE_CAPACITY 0x01
+#define H3_SETTINGS_MAX_FIELD_SECTION_SIZE   0x06
+#define H3_SETTINGS_QPACK_BLOCKED_STREAMS    0x07
+
+/* HTTP/3 and QPACK error codes - draft-ietf-quic-http #8.1 */
+enum {
+	H3_EC_NO_ERROR                   = 0x100,
+	H3_EC_GENERAL_PROTOCOL_ERROR     = 0x101,
+	H3_EC_INTERNAL_ERROR             = 0x102,
+	H3_EC_STREAM_CREATION_ERROR      = 0x103,
+	H3_EC_CLOSED_CRITICAL_STREAM     = 0x104,
+	H3_EC_FRAME_UNEXPECTED           = 0x105,
+	H3_EC_FRAME_ERROR                = 0x106,
+	H3_EC_EXCESSIVE_LOAD             = 0x107,
+	H3_EC_ID_ERROR                   = 0x108,
+	H3_EC_SETTINGS_ERROR             = 0x109,
+	H3_EC_MISSING_SETTINGS           = 0x10a,
+	H3_EC_REQUEST_REJECTED           = 0x10b,
+	H3_EC_REQUEST_CANCELLED          = 0x10c,
+	H3_EC_REQUEST_INCOMPLETE         = 0x10d,
+	H3_EC_CONNECT_ERROR              = 0x10f,
+	H3_EC_VERSION_FALLBACK           = 0x110,
+	H3_EC_QPACK_DECOMPRESSION_FAILED = 0x200,
+	H3_EC_QPACK_ENCODER_STREAM_ERROR = 0x201,
+	H3_EC_QPACK_DECODER_STREAM_ERROR = 0x202,
+};
+
+
 /* some protocol constants */
 
 // PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n
@@ -204,6 +261,7 @@ int h3_parse_cont_len_header(unsigned int *msgf, struct ist *value, unsigned lon
 int h3_make_htx_request(struct http_hdr *list, struct htx *htx, unsigned int *msgf, unsigned long long *body_len);
 int h3_make_htx_response(struct http_hdr *list, struct htx *htx, unsigned int *msgf, unsigned long long *body_len);
 int h3_make_htx_trailers(struct http_hdr *list, struct htx *htx);
+void h3_parse_priority(const struct ist value, unsigned int *urgency, unsigned int *incremental);
 
 /*
  * Some helpful debugging functions.
@@ -582,6 +582,7 @@ enum lock_label {
 	POOL_LOCK,
 	LISTENER_LOCK,
 	PROXY_LOCK,
+	QUEUE_LOCK,
 	SERVER_LOCK,
 	LBPRM_LOCK,
 	SIGNALS_LOCK,
@@ -600,6 +601,7 @@ enum lock_label {
 	NOTIF_LOCK,
 	SPOE_APPLET_LOCK,
 	DNS_LOCK,
+	DNS_CACHE_LOCK,
 	PID_LIST_LOCK,
 	EMAIL_ALERTS_LOCK,
 	PIPES_LOCK,
@@ -609,8 +611,11 @@ enum lock_label {
 	DICT_LOCK,
 	PROTO_LOCK,
 	CKCH_LOCK,
+	OCSP_LOCK,
 	SNI_LOCK,
 	SFT_LOCK, /* sink forward target */
+	QUIC_LOCK,
+	CACHE_LOCK,
 	OTHER_LOCK,
 	LOCK_LABELS
 };
@@ -700,6 +705,7 @@ static inline const char *lock_label(enum lock_label label)
 	case POOL_LOCK:            return "POOL";
 	case LISTENER_LOCK:        return "LISTENER";
 	case PROXY_LOCK:           return "PROXY";
+	case QUEUE_LOCK:           return "QUEUE";
 	case SERVER_LOCK:          return "SERVER";
 	case LBPRM_LOCK:           return "LBPRM";
 	case SIGNALS_LOCK:         return "SIGNALS";
@@ -718,6 +724,7 @@ static inline const char *lock_label(enum lock_label label)
 	case NOTIF_LOCK:           return "NOTIF";
 	case SPOE_APPLET_LOCK:     return "SPOE_APPLET";
 	case DNS_LOCK:             return "DNS";
+	case DNS_CACHE_LOCK:       return "DNS_CACHE";
 	case PID_LIST_LOCK:        return "PID_LIST";
 	case EMAIL_ALERTS_LOCK:    return "EMAIL_ALERTS";
 	case PIPES_LOCK:           return "PIPES";
@@ -727,8 +734,11 @@ static inline const char *lock_label(enum lock_label label)
 	case DICT_LOCK:            return "DICT";
 	case PROTO_LOCK:           return "PROTO";
 	case CKCH_LOCK:            return "CKCH";
+	case OCSP_LOCK:            return "OCSP";
 	case SNI_LOCK:             return "SNI";
 	case SFT_LOCK:             return "SFT";
+	case QUIC_LOCK:            return "QUIC";
+	case CACHE_LOCK:           return "CACHE";
 	case OTHER_LOCK:           return "OTHER";
 	case LOCK_LABELS:          break; /* keep compiler happy */
 	};
@@ -32,11 +32,58 @@
 #include <string.h>
 #include <common/buf.h>
 #include <common/config.h>
+#include <common/hpack-tbl.h>
 #include <common/http.h>
 #include <common/ist.h>
 
+/* Number of slots of the hash index of the encoder's dynamic table. It must be
+ * a power of two. With 4kB tables there are rarely more than 64 entries.
+ */
+#define HPACK_EDHT_SLOTS 64
+
+/* One slot of the encoder's dynamic table index. <seq> is the insertion number
+ * of the last entry whose name and value hashed to this slot.
+ */
+struct hpack_edht_slot {
+	uint32_t hash;
+	uint32_t seq;
+};
+
+/* Encoder-side dynamic table. The entries are stored in <dht> which mirrors
+ * the peer decoder's table since they are inserted and evicted in the same
+ * order. An entry's insertion number gives its position in the table, and
+ * the index only references entries which are looked up again before being
+ * used. The table is saved before the first insertion of a header block so
+ * that it may be restored if the block cannot be emitted.
+ */
+struct hpack_edht {
+	struct hpack_dht *dht;   /* entries currently known to the peer */
+	struct hpack_dht *snap;  /* saved copy of <dht> during a block, or NULL */
+	uint32_t cnt;            /* number of entries ever inserted */
+	uint32_t snap_cnt;       /* <cnt> at the beginning of the current block */
+	uint32_t size;           /* table size currently in use */
+	uint32_t max;            /* largest table size we may use */
+	uint8_t  flags;          /* HPACK_EDHT_F_* */
+	struct hpack_edht_slot idx[HPACK_EDHT_SLOTS];
+};
+
+#define HPACK_EDHT_F_SIZE_UPD   0x01  /* a table size update must be emitted */
+#define HPACK_EDHT_F_IN_BLOCK   0x02  /* a header block is being encoded */
+#define HPACK_EDHT_F_BROKEN     0x04  /* table desynchronized, don't use it */
+
 int hpack_encode_header(struct buffer *out, const struct ist n,
 			const struct ist v);
+int hpack_encode_str(char *out, int pos, int size, const struct ist str);
+
+void hpack_edht_init(struct hpack_edht *edht, struct hpack_dht *dht, uint32_t max);
+void hpack_edht_deinit(struct hpack_edht *edht);
+void hpack_edht_set_size(struct hpack_edht *edht, uint32_t size);
+int hpack_edht_start(struct hpack_edht *edht, struct buffer *out);
+void hpack_edht_commit(struct hpack_edht *edht);
+int hpack_edht_encode_header(struct hpack_edht *edht, struct buffer *out,
+                             const struct ist n, const struct ist v);
+int hpack_edht_encode_int_status(struct hpack_edht *edht, struct buffer *out,
+                                 unsigned int status);
 
 /* Returns the number of bytes required to encode the string length <len>. The
  * number of usable bits is an integral multiple of 7 plus 6 for the last byte.
@@ -100,30 +147,52 @@ static inline int hpack_encode_short_idx(struct buffer *out, int idx, struct ist
 }
 
 /* Tries to encode header field index <idx> with long value <val> into the
- * aligned buffer <out>. Returns non-zero on success, 0 on failure (buffer
- * full). The caller is responsible for ensuring <idx> is lower than 64 (static
- * list only), and that the buffer is aligned (head==0).
+ * aligned buffer <out>, Huffman-encoded when it is shorter. Returns non-zero
+ * on success, 0 on failure (buffer full). The caller is responsible for
+ * ensuring <idx> is lower than 64 (static list only), and that the buffer is
+ * aligned (head==0).
  */
 static inline int hpack_encode_long_idx(struct buffer *out, int idx, struct ist val)
 {
 	int len = out->data;
 
-	if (!hpack_len_to_bytes(val.len) ||
-	    1 + len + hpack_len_to_bytes(val.len) + val.len > out->size)
+	if (len >= out->size)
 		return 0;
 
 	/* emit literal with indexing (7541#6.2.1) :
 	 * [ 0 | 1 | Index (6+) ]
 	 */
 	out->area[len++] = idx | 0x40;
-	len = hpack_encode_len(out->area, len, val.len);
-	memcpy(out->area + len, val.ptr, val.len);
-	len += val.len;
+	len = hpack_encode_str(out->area, len, out->size, val);
+	if (!len)
+		return 0;
 
 	out->data = len;
 	return 1;
 }
 
+/* Returns the single byte code of the indexed field of the static table
+ * matching the :status pseudo-header with status <status>, or zero if there is
+ * none. It's inlined because it's easily optimizable by the compiler.
+ */
+static inline unsigned char hpack_status_sht_code(unsigned int status)
+{
+	return (status <= 304) ?
+		(status <= 204) ?
+			(status == 204) ? 0x89 :
+			(status == 200) ? 0x88 :
+		0: /* > 204 */
+			(status == 304) ? 0x8b :
+			(status == 206) ? 0x8a :
+		0:
+		(status <= 404) ?
+			(status == 404) ? 0x8d :
+			(status == 400) ? 0x8c :
+		0: /* > 404 */
+			(status == 500) ? 0x8e :
+		0;
+}
+
 /* Tries to encode a :status pseudo-header with the integer status <status>
  * into the aligned buffer <out>. Returns non-zero on success, 0 on failure
  * (buffer full). The caller is responsible for ensuring that the status is
@@ -141,21 +210,7 @@ static inline int hpack_encode_int_status(struct buffer *out, unsigned int statu
 	if (__builtin_expect(len > size, 0))
 		goto fail;
 
-	c = (status <= 304) ?
-		(status <= 204) ?
-			(status == 204) ? 0x89 :
-			(status == 200) ? 0x88 :
-		0: /* > 204 */
-			(status == 304) ? 0x8b :
-			(status == 206) ? 0x8a :
-		0:
-		(status <= 404) ?
-			(status == 404) ? 0x8d :
-			(status == 400) ? 0x8c :
-		0: /* > 404 */
-			(status == 500) ? 0x8e :
-		0;
-
+	c = hpack_status_sht_code(status);
 	if (c)
 		goto last;
 
@@ -241,9 +296,10 @@ static inline int hpack_encode_scheme(struct buffer *out, struct ist scheme)
 /* Tries to encode a :path pseudo-header with the path in <path>, into the
  * aligned buffer <out>. Returns non-zero on success or 0 on failure (buffer
  * full). The well-known values "/" and "/index.html" are recognized, and other
- * ones are handled as literals. The caller is responsible for ensuring that
- * the buffer is aligned.  Normally the compiler will detect constant strings
- * in the comparison if the code remains inlined.
+ * ones are handled as literals, Huffman-encoded when it is shorter. The caller
+ * is responsible for ensuring that the buffer is aligned.  Normally the
+ * compiler will detect constant strings in the comparison if the code remains
+ * inlined.
  */
 static inline int hpack_encode_path(struct buffer *out, struct ist path)
 {
@@ -251,8 +307,6 @@ static inline int hpack_encode_path(struct buffer *out, struct ist path)
 		out->area[out->data++] = 0x84; // indexed field : idx[04]=(":path", "/")
 	else if (out->data < out->size && isteq(path, ist("/index.html")))
 		out->area[out->data++] = 0x85; // indexed field : idx[05]=(":path", "/index.html")
-	else if (path.len < 127)
-		return hpack_encode_short_idx(out, 4, path); // name=":path" (idx 4)
 	else
 		return hpack_encode_long_idx(out, 4, path); // name=":path" (idx 4)
 	return 1;
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <common/buf.h>
 #include <common/config.h>
+#include <common/hathreads.h>
 #include <common/ist.h>
 #include <common/http.h>
 #include <common/http-hdr.h>
@@ -218,7 +219,7 @@ struct htx {
 	uint64_t extra;  /* known bytes amount remaining to receive */
 	uint32_t flags;  /* HTX_FL_* */
 
-	/* XXX 4 bytes unused */
+	uint32_t gen;    /* generation, changed when blocks are added, moved or renamed */
 
 	/* Blocks representing the HTTP message itself */
 	char blocks[0] __attribute__((aligned(8)));
@@ -226,6 +227,18 @@ struct htx {
 
 
 extern struct htx htx_empty;
+extern THREAD_LOCAL unsigned int htx_gen;
+
+/* Changes the generation of the HTX message <htx>. It must be called each time
+ * blocks are added, moved or renamed, so that any index built on the previous
+ * layout is not used anymore. Generations are unique since they are made of a
+ * per-thread counter and of the thread id. Removing blocks does not require it
+ * since they stay at the same position with the HTX_BLK_UNUSED type.
+ */
+static inline void htx_new_gen(struct htx *htx)
+{
+	htx->gen = ++htx_gen * MAX_THREADS + tid;
+}
 
 struct htx_blk *htx_defrag(struct htx *htx, struct htx_blk *blk);
 struct htx_blk *htx_add_blk(struct htx *htx, enum htx_blk_type type, uint32_t blksz);
@@ -254,6 +267,8 @@ struct htx_blk *htx_add_all_trailers(struct htx *htx, const struct http_hdr *hdr
 struct htx_blk *htx_add_endof(struct htx *htx, enum htx_blk_type type);
 struct htx_blk *htx_add_data_atonce(struct htx *htx, struct ist data);
 size_t htx_add_data(struct htx *htx, const struct ist data);
+struct htx *htx_from_buf_data(struct buffer *buf, size_t ofs, uint32_t len);
+struct htx_ret htx_reserve_max_data(struct htx *htx);
 struct htx_blk *htx_add_last_data(struct htx *htx, struct ist data);
 void htx_move_blk_before(struct htx *htx, struct htx_blk **blk, struct htx_blk **ref);
 int htx_append_msg(struct htx *dst, const struct htx *src);
@@ -694,6 +709,7 @@ static inline void htx_reset(struct htx *htx)
 	htx->tail_addr = htx->head_addr = htx->end_addr = 0;
 	htx->extra = 0;
 	htx->flags = HTX_FL_NONE;
+	htx_new_gen(htx);
 }
 
 /* Returns the available room for raw data in buffer <buf> once HTX overhead is
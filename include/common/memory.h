@@ -79,15 +79,24 @@ struct pool_free_list {
 	void **free_list;
 	uintptr_t seq;
 };
+
+/* NUMA node whose shared free lists are used by the current thread */
+extern THREAD_LOCAL unsigned int pool_node;
 #endif
 
 /* Note below, in case of lockless pools, we still need the lock only for
- * the flush() operation.
+ * the flush() operation. The lockless pools keep one shared free list per
+ * NUMA node, each in its own cache line, so that the objects released by
+ * the threads of a node are only reused by the threads of the same node.
  */
 struct pool_head {
-	void **free_list;
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
-	uintptr_t seq;
+	struct {
+		void **free_list;
+		uintptr_t seq;
+	} __attribute__((aligned(64))) node[CONFIG_HAP_POOL_NODES];
+#else
+	void **free_list;
 #endif
 	__decl_hathreads(HA_SPINLOCK_T lock); /* the spin lock */
 	unsigned int used;	/* how many chunks are currently in use */
@@ -110,6 +119,9 @@ extern unsigned int pool_base_count;
 /* poison each newly allocated area with this byte if >= 0 */
 extern int mem_poison_byte;
 
+/* non-zero while the pools are above "tune.memory.soft-limit" */
+extern unsigned int pool_mem_pressure;
+
 /* Allocates new entries for pool <pool> until there are at least <avail> + 1
  * available, then returns the last one for immediate use, so that at least
  * <avail> are left available in the pool upon return. NULL is returned if the
@@ -221,13 +233,52 @@ static inline unsigned int pool_avg(unsigned int sum)
 	return (sum + n - 1) / n;
 }
 
-/* returns true if the pool is considered to have too many free objects */
+/* returns true if the pool is considered to have too many free objects. Under
+ * memory pressure, any free object above the pool's minimum is one too many.
+ */
 static inline int pool_is_crowded(const struct pool_head *pool)
 {
-	return pool->allocated >= pool_avg(pool->needed_avg + pool->needed_avg / 4) &&
+	return (pool->allocated >= pool_avg(pool->needed_avg + pool->needed_avg / 4) ||
+	        unlikely(pool_mem_pressure)) &&
 	       (int)(pool->allocated - pool->used) >= pool->minavail;
 }
 
+#ifndef DEBUG_UAF /* normal allocator */
+
+/* Huge pages arena reserved by "tune.memory.hugepages", if any. The objects
+ * of each size are carved out of their own slabs there, and remain in the
+ * arena once released, until the arena is exhausted and malloc() is used.
+ */
+extern char *pool_arena_start;
+extern char *pool_arena_end;
+
+void *pool_arena_alloc(size_t size);
+void pool_arena_free(void *area, size_t size);
+
+/* allocates an area of size <size> and returns it. The semantics are similar
+ * to those of malloc().
+ */
+static inline void *pool_alloc_area(size_t size)
+{
+	if (unlikely(pool_arena_start != NULL))
+		return pool_arena_alloc(size);
+	return malloc(size);
+}
+
+/* frees an area <area> of size <size> allocated by pool_alloc_area(). The
+ * semantics are identical to free() except that the size must match the one
+ * passed to pool_alloc_area() for the areas coming from the arena.
+ */
+static inline void pool_free_area(void *area, size_t size)
+{
+	if (unlikely((char *)area >= pool_arena_start && (char *)area < pool_arena_end))
+		pool_arena_free(area, size);
+	else
+		free(area);
+}
+
+#endif /* DEBUG_UAF */
+
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
 
 /* Tries to retrieve an object from the local pool cache corresponding to pool
@@ -260,38 +311,52 @@ static inline void *__pool_get_from_cache(struct pool_head *pool)
 	return item;
 }
 
-/*
- * Returns a pointer to type <type> taken from the pool <pool_type> if
- * available, otherwise returns NULL. No malloc() is attempted, and poisonning
- * is never performed. The purpose is to get the fastest possible allocation.
+/* Tries to retrieve an object from the shared free list of NUMA node <node>
+ * of pool <pool>. Returns NULL if none is available. The pool's used counter
+ * is not updated.
  */
-static inline void *__pool_get_first(struct pool_head *pool)
+static inline void *__pool_get_from_node(struct pool_head *pool, unsigned int node)
 {
 	struct pool_free_list cmp, new;
-	void *ret = __pool_get_from_cache(pool);
 
-	if (ret)
-		return ret;
-
-	cmp.seq = pool->seq;
+	cmp.seq = pool->node[node].seq;
 	__ha_barrier_load();
 
-	cmp.free_list = pool->free_list;
+	cmp.free_list = pool->node[node].free_list;
 	do {
 		if (cmp.free_list == NULL)
 			return NULL;
 		new.seq = cmp.seq + 1;
 		__ha_barrier_load();
 		new.free_list = *POOL_LINK(pool, cmp.free_list);
-	} while (HA_ATOMIC_DWCAS((void *)&pool->free_list, (void *)&cmp, (void *)&new) == 0);
+	} while (HA_ATOMIC_DWCAS((void *)&pool->node[node].free_list, (void *)&cmp, (void *)&new) == 0);
 	__ha_barrier_atomic_store();
+	return cmp.free_list;
+}
+
+/*
+ * Returns a pointer to type <type> taken from the pool <pool_type> if
+ * available, otherwise returns NULL. No malloc() is attempted, and poisonning
+ * is never performed. The purpose is to get the fastest possible allocation.
+ * Only the free list of the current thread's NUMA node is checked.
+ */
+static inline void *__pool_get_first(struct pool_head *pool)
+{
+	void *ret = __pool_get_from_cache(pool);
+
+	if (ret)
+		return ret;
+
+	ret = __pool_get_from_node(pool, pool_node);
+	if (!ret)
+		return NULL;
 
 	_HA_ATOMIC_ADD(&pool->used, 1);
 #ifdef DEBUG_MEMORY_POOLS
 	/* keep track of where the element was allocated from */
-	*POOL_LINK(pool, cmp.free_list) = (void *)pool;
+	*POOL_LINK(pool, ret) = (void *)pool;
 #endif
-	return cmp.free_list;
+	return ret;
 }
 
 static inline void *pool_get_first(struct pool_head *pool)
@@ -333,24 +398,24 @@ static inline void *pool_alloc(struct pool_head *pool)
 	return p;
 }
 
-/* Locklessly add item <ptr> to pool <pool>, then update the pool used count.
- * Both the pool and the pointer must be valid. Use pool_free() for normal
- * operations.
+/* Locklessly add item <ptr> to the free list of the current thread's NUMA
+ * node in pool <pool>, then update the pool used count. Both the pool and the
+ * pointer must be valid. Use pool_free() for normal operations.
  */
 static inline void __pool_free(struct pool_head *pool, void *ptr)
 {
-	void **free_list = pool->free_list;
+	void **free_list = pool->node[pool_node].free_list;
 
 	_HA_ATOMIC_SUB(&pool->used, 1);
 
 	if (unlikely(pool_is_crowded(pool))) {
-		free(ptr);
+		pool_free_area(ptr, pool->size + POOL_EXTRA);
 		_HA_ATOMIC_SUB(&pool->allocated, 1);
 	} else {
 		do {
 			*POOL_LINK(pool, ptr) = (void *)free_list;
 			__ha_barrier_store();
-		} while (!_HA_ATOMIC_CAS(&pool->free_list, &free_list, ptr));
+		} while (!_HA_ATOMIC_CAS(&pool->node[pool_node].free_list, &free_list, ptr));
 		__ha_barrier_atomic_store();
 	}
 	pool_avg_add(&pool->needed_avg, pool->used);
@@ -366,9 +431,9 @@ static inline void pool_put_to_cache(struct pool_head *pool, void *ptr)
 
 	/* pool not in cache or too many objects for this pool (more than
 	 * half of the cache is used and this pool uses more than 1/8 of
-	 * the cache size).
+	 * the cache size), or memory pressure.
 	 */
-	if (idx < 0 ||
+	if (idx < 0 || unlikely(pool_mem_pressure) ||
 	    (pool_cache_bytes > CONFIG_HAP_POOL_CACHE_SIZE * 3 / 4 &&
 	     pool_cache[tid][idx].count >= 16 + pool_cache_count / 8)) {
 		__pool_free(pool, ptr);
@@ -447,26 +512,7 @@ static inline void *pool_alloc_dirty(struct pool_head *pool)
 	return p;
 }
 
-#ifndef DEBUG_UAF /* normal allocator */
-
-/* allocates an area of size <size> and returns it. The semantics are similar
- * to those of malloc().
- */
-static inline void *pool_alloc_area(size_t size)
-{
-	return malloc(size);
-}
-
-/* frees an area <area> of size <size> allocated by pool_alloc_area(). The
- * semantics are identical to free() except that the size is specified and
- * may be ignored.
- */
-static inline void pool_free_area(void *area, size_t __maybe_unused size)
-{
-	free(area);
-}
-
-#else  /* use-after-free detector */
+#ifdef DEBUG_UAF /* use-after-free detector */
 
 /* allocates an area of size <size> and returns it. The semantics are similar
  * to those of malloc(). However the allocation is rounded up to 4kB so that a
@@ -562,7 +608,7 @@ static inline void pool_free(struct pool_head *pool, void *ptr)
 		HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
 		pool->used--;
 		if (pool_is_crowded(pool)) {
-			free(ptr);
+			pool_free_area(ptr, pool->size + POOL_EXTRA);
 			pool->allocated--;
 		} else {
 			*POOL_LINK(pool, ptr) = (void *)pool->free_list;
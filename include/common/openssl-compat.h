@@ -378,5 +378,34 @@ static inline void SSL_CTX_up_ref(SSL_CTX *ctx)
 #define EVP_MD_CTX_free EVP_MD_CTX_destroy
 #endif
 
+/* RFC 8879 certificate compression relies on the compression callbacks of
+ * BoringSSL, and only zlib is supported.
+ */
+#if defined(OPENSSL_IS_BORINGSSL) && defined(USE_ZLIB)
+#define HAVE_SSL_CERT_COMP
+#define HA_TLS_CERT_COMP_ZLIB 1
+#endif
+
+/* Kernel TLS transmit offload relies on the kTLS BIO controls of OpenSSL 3.0
+ * which are only implemented for Linux here. The controls used to pass the
+ * keys and the control messages are internal to OpenSSL and only sent to the
+ * BIOs, their values are part of the ABI.
+ */
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_CTRL_GET_KTLS_SEND) && !defined(OPENSSL_NO_KTLS) && defined(__linux__)
+#define HAVE_SSL_KTLS
+
+#ifndef BIO_CTRL_SET_KTLS
+#define BIO_CTRL_SET_KTLS                       72
+#endif
+
+#ifndef BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG
+#define BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG      74
+#endif
+
+#ifndef BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG
+#define BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG         75
+#endif
+#endif
+
 #endif /* USE_OPENSSL */
 #endif /* _COMMON_OPENSSL_COMPAT_H */
@@ -0,0 +1,45 @@
+/*
+ * QPACK decompressor (draft-ietf-quic-qpack) - prototypes
+ *
+ * Copyright 2020 HAProxy Technologies, Frédéric Lécaille <flecaille@haproxy.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _COMMON_QPACK_DEC_H
+#define _COMMON_QPACK_DEC_H
+
+#include <inttypes.h>
+#include <common/chunk.h>
+#include <common/config.h>
+#include <common/qpack-tbl.h>
+
+int qpack_decode_enc(struct qpack_dec *dec, const uint8_t *raw, uint64_t len,
+                     struct buffer *tmp);
+int qpack_decode_fs(struct qpack_dec *dec, const uint8_t *raw, uint64_t len,
+                    struct http_hdr *list, int list_size,
+                    struct buffer *tmp, uint64_t *ric);
+int qpack_enc_section_ack(struct buffer *out, struct qpack_dec *dec,
+                          uint64_t id, uint64_t ric);
+int qpack_enc_stream_cancel(struct buffer *out, uint64_t id);
+int qpack_enc_insert_count_inc(struct buffer *out, struct qpack_dec *dec);
+
+#endif /* _COMMON_QPACK_DEC_H */
@@ -0,0 +1,141 @@
+/*
+ * QPACK header table management (draft-ietf-quic-qpack) - prototypes
+ *
+ * Copyright 2020 HAProxy Technologies, Frédéric Lécaille <flecaille@haproxy.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef _COMMON_QPACK_TBL_H
+#define _COMMON_QPACK_TBL_H
+
+#include <inttypes.h>
+#include <common/buf.h>
+#include <common/config.h>
+#include <common/hpack-tbl.h>
+#include <common/http-hdr.h>
+#include <common/ist.h>
+
+/* The QPACK dynamic table works exactly as the HPACK one, except that its
+ * entries are designated by an absolute index, which is the insertion rank
+ * of the entry starting at 0. So we use a struct hpack_dht for it, the
+ * relative HPACK index of an entry (1 for the newest one) being the total
+ * number of insertions minus its absolute index.
+ *
+ * The table allocated from the HPACK pool is never smaller than the capacity
+ * the encoder may set, so that an entry still referenced by the encoder is
+ * never evicted. We may keep a few more entries than the encoder does if it
+ * sets a smaller capacity, which is harmless as it will never reference them.
+ */
+
+/* QPACK decoder state, one per HTTP/3 connection */
+struct qpack_dec {
+	struct hpack_dht *dht;  /* dynamic table, filled from the encoder stream */
+	uint64_t ins_cnt;       /* total number of insertions into <dht> */
+	uint64_t known_rcvd;    /* insert count known to be received by the encoder */
+	uint32_t cap;           /* capacity of the dynamic table set by the encoder */
+	uint32_t max_cap;       /* advertised SETTINGS_QPACK_MAX_TABLE_CAPACITY */
+	uint32_t max_blocked;   /* advertised SETTINGS_QPACK_BLOCKED_STREAMS */
+	uint32_t nb_blocked;    /* number of streams currently blocked */
+};
+
+/* supported qpack encoding/decoding errors */
+enum {
+	QPACK_ERR_NONE = 0,           /* no error */
+	QPACK_ERR_ALLOC_FAIL,         /* memory allocation error */
+	QPACK_ERR_TRUNCATED,          /* truncated stream */
+	QPACK_ERR_HUFFMAN,            /* huffman decoding error */
+	QPACK_ERR_INVALID_IDX,        /* reference to an unknown or evicted entry */
+	QPACK_ERR_INVALID_RIC,        /* invalid Required Insert Count */
+	QPACK_ERR_INVALID_CAPACITY,   /* dynamic table capacity too large */
+	QPACK_ERR_DHT_INSERT_FAIL,    /* failed to insert into DHT */
+	QPACK_ERR_TOO_LARGE,          /* decoded request/response is too large */
+	QPACK_ERR_BLOCKED,            /* field section references entries not received yet */
+	QPACK_ERR_TOO_MANY_BLOCKED,   /* too many blocked streams */
+};
+
+/* static header table as in draft-ietf-quic-qpack Appendix A. */
+#define QPACK_SHT_SIZE 99
+extern const struct http_hdr qpack_sht[QPACK_SHT_SIZE];
+
+int qpack_dec_init(struct qpack_dec *dec, uint32_t max_cap, uint32_t max_blocked);
+void qpack_dec_deinit(struct qpack_dec *dec);
+int qpack_dht_insert(struct qpack_dec *dec, struct ist name, struct ist value);
+
+/* Returns the dynamic table entry of <dec> with <idx> as absolute index or
+ * NULL if this entry was not received yet or was evicted.
+ */
+static inline const struct hpack_dte *qpack_get_dte(const struct qpack_dec *dec, uint64_t idx)
+{
+	if (idx >= dec->ins_cnt || dec->ins_cnt - idx > dec->dht->used)
+		return NULL;
+
+	return hpack_get_dte(dec->dht, dec->ins_cnt - idx);
+}
+
+/* Registers a new stream blocked on <dec>. Returns 0 if the limit of blocked
+ * streams was reached, which is a connection error, non-zero if not.
+ */
+static inline int qpack_dec_block(struct qpack_dec *dec)
+{
+	if (dec->nb_blocked >= dec->max_blocked)
+		return 0;
+
+	dec->nb_blocked++;
+	return 1;
+}
+
+/* Unregisters a stream blocked on <dec>. */
+static inline void qpack_dec_unblock(struct qpack_dec *dec)
+{
+	dec->nb_blocked--;
+}
+
+/* Appends to <out> the integer <val> encoded with a <b>-bit prefix, <flags>
+ * being the bits of the first byte above this prefix. Returns 1 if succeeded,
+ * 0 if there was not enough room in <out>, in which case it is left untouched.
+ */
+static inline int qpack_put_varint(struct buffer *out, uint8_t flags, int b, uint64_t val)
+{
+	uint64_t mask = (1 << b) - 1;
+	uint64_t v;
+	size_t need;
+
+	need = 1;
+	if (val >= mask)
+		for (v = val - mask, need++; v >= 128; v >>= 7)
+			need++;
+
+	if (b_room(out) < need)
+		return 0;
+
+	if (val < mask) {
+		b_putchr(out, flags | val);
+		return 1;
+	}
+
+	b_putchr(out, flags | mask);
+	for (val -= mask; val >= 128; val >>= 7)
+		b_putchr(out, 0x80 | (val & 127));
+	b_putchr(out, val);
+	return 1;
+}
+
+#endif /* _COMMON_QPACK_TBL_H */
@@ -1596,6 +1596,31 @@ static inline int32_t ha_random()
 	return ha_random32() >> 1;
 }
 
+/* Per-thread state of ha_random64_local(), seeded from ha_random64() */
+extern THREAD_LOCAL uint64_t ha_random_local_state[2];
+
+/* Same xoroshiro128** generator as ha_random64(), working on a per-thread
+ * state, thus without any atomic operation. It is meant for the statistical
+ * uses on the fast path (e.g. load balancing) where the sequences of the
+ * different threads do not need to be coordinated.
+ */
+static inline uint64_t ha_random64_local()
+{
+	uint64_t s0 = ha_random_local_state[0];
+	uint64_t s1 = ha_random_local_state[1];
+	uint64_t result = rotl64(s0 * 5, 7) * 9;
+
+	s1 ^= s0;
+	ha_random_local_state[0] = rotl64(s0, 24) ^ s1 ^ (s1 << 16); // a, b
+	ha_random_local_state[1] = rotl64(s1, 37); // c
+	return result;
+}
+
+static inline uint32_t ha_random32_local()
+{
+	return ha_random64_local() >> 32;
+}
+
 /* HAP_STRING() makes a string from a literal while HAP_XSTRING() first
  * evaluates the argument and is suited to pass macros.
  *
@@ -55,6 +55,7 @@ struct lru64_head {
 	struct lru64  *spare;
 	int cache_size;
 	int cache_usage;
+	unsigned long long evictions; /* entries killed to make room for new ones */
 };
 
 struct lru64 {
@@ -37,9 +37,14 @@
 extern unsigned int profiling;
 extern unsigned long task_profiling_mask;
 extern struct activity activity[MAX_THREADS];
+extern struct sched_activity sched_activity[SCHED_ACT_HASH_BUCKETS];
+extern uint64_t slow_task_threshold;
 
 
 void report_stolen_time(uint64_t stolen);
+int poll_busy_timeout(int wait_time);
+void report_slow_task(const void *func, const void *ctx, int tasklet,
+                      const struct slow_task_owner *owner, uint64_t duration);
 
 /* Collect date and time information before calling poll(). This will be used
  * to count the run time of the past loop and the sleep time of the next poll.
@@ -98,6 +103,33 @@ static inline void activity_count_runtime()
 	}
 }
 
+/* Returns the entry of <array> collecting the activity of function <func>.
+ * The entry is indexed by a multiplicative hash of the function's address and
+ * is atomically assigned to the first function using it. Functions colliding
+ * with another one are accounted in entry 0. <func> must not be NULL.
+ */
+static inline struct sched_activity *sched_activity_entry(struct sched_activity *array, const void *func)
+{
+	const void *old = NULL;
+	uint32_t hash;
+
+	hash = ((unsigned long)func >> 4) * 2654435761U;
+	hash >>= 32 - SCHED_ACT_HASH_BITS;
+	if (!hash)
+		hash++;
+
+	if (likely(array[hash].func == func))
+		return &array[hash];
+
+	if (!array[hash].func && _HA_ATOMIC_CAS(&array[hash].func, &old, func))
+		return &array[hash];
+
+	/* the entry may have been assigned to the same function meanwhile */
+	if (array[hash].func == func)
+		return &array[hash];
+
+	return &array[0];
+}
 
 #endif /* _PROTO_ACTIVITY_H */
 
@@ -43,11 +43,14 @@ void back_handle_st_cer(struct stream *s);
 
 const char *backend_lb_algo_str(int algo);
 int backend_parse_balance(const char **args, char **err, struct proxy *curproxy);
+void srv_update_ewma(struct server *srv, unsigned int rtime);
 int tcp_persist_rdp_cookie(struct stream *s, struct channel *req, int an_bit);
 
 int be_downtime(struct proxy *px);
 void recount_servers(struct proxy *px);
 void update_backend_weight(struct proxy *px);
+void lb_defer_updates(struct proxy *px);
+void lb_resume_updates(struct proxy *px);
 int be_lastsession(const struct proxy *be);
 
 /* Returns number of usable servers in backend */
@@ -46,6 +46,19 @@ static inline void health_adjust(struct server *s, short status)
 	HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
 }
 
+void __srv_observe_outlier(struct server *s, int failed, int rtime);
+
+/* Reports to the outlier detection of <s> the outcome of a stream, <failed>
+ * being non-zero for a 5xx response or a server error or timeout, and <rtime>
+ * its response time in milliseconds, or negative if unknown. It does nothing
+ * if the outlier detection is not enabled on this server.
+ */
+static inline void srv_observe_outlier(struct server *s, int failed, int rtime)
+{
+	if (s->eject_task)
+		__srv_observe_outlier(s, failed, rtime);
+}
+
 void free_check(struct check *check);
 
 int init_email_alert(struct mailers *mailers, struct proxy *p, char **err);
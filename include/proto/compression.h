@@ -29,6 +29,7 @@ extern unsigned int compress_min_idle;
 
 int comp_append_type(struct comp *comp, const char *type);
 int comp_append_algo(struct comp *comp, const char *algo);
+int comp_algo_thread_safe(const struct comp_algo *algo);
 
 #ifdef USE_ZLIB
 extern long zlib_used_memory;
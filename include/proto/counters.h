@@ -0,0 +1,172 @@
+/*
+ * include/proto/counters.h
+ * This file contains the inline functions used to update and read the
+ * latency histograms of the statistics counters.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_COUNTERS_H
+#define _PROTO_COUNTERS_H
+
+#include <common/config.h>
+#include <common/hathreads.h>
+#include <common/standard.h>
+#include <types/counters.h>
+#include <types/global.h>
+
+/* Adds <val> to counter <field> of counters block <cnt> (struct fe_counters
+ * or be_counters), which must also be a field of struct thr_counters. When the
+ * block has per-thread shares, only the calling thread's one is updated,
+ * without atomic operation.
+ */
+#define COUNTERS_ADD(cnt, field, val) do {				\
+		if ((cnt)->thr)						\
+			(cnt)->thr[tid].field += (val);			\
+		else							\
+			_HA_ATOMIC_ADD(&(cnt)->field, (val));		\
+	} while (0)
+
+/* Returns the value of counter <field> of counters block <cnt>, summing it
+ * with all the threads' shares if any.
+ */
+#define COUNTERS_GET(cnt, field) ({					\
+		typeof((cnt)->field) __v = (cnt)->field;		\
+		int __thr;						\
+		if ((cnt)->thr)						\
+			for (__thr = 0; __thr < global.nbthread; __thr++) \
+				__v += (cnt)->thr[__thr].field;		\
+		__v;							\
+	})
+
+/* Returns non-zero if counter <field> of counters block <cnt> is above <val>.
+ * The other threads' shares are only read if the calling thread's one is not
+ * enough, so that once reached, a threshold is tested without touching them.
+ */
+#define COUNTERS_ABOVE(cnt, field, val)					\
+	((cnt)->field + ((cnt)->thr ? (cnt)->thr[tid].field : 0) > (val) || \
+	 COUNTERS_GET(cnt, field) > (val))
+
+/* Resets the frontend counters <cnt> including their per-thread shares, which
+ * remain allocated.
+ */
+static inline void fe_counters_clear(struct fe_counters *cnt)
+{
+	struct thr_counters *thr = cnt->thr;
+
+	memset(cnt, 0, sizeof(*cnt));
+	cnt->thr = thr;
+	if (thr)
+		memset(thr, 0, global.nbthread * sizeof(*thr));
+}
+
+/* Resets the backend counters <cnt> including their per-thread shares, which
+ * remain allocated.
+ */
+static inline void be_counters_clear(struct be_counters *cnt)
+{
+	struct thr_counters *thr = cnt->thr;
+
+	memset(cnt, 0, sizeof(*cnt));
+	cnt->thr = thr;
+	if (thr)
+		memset(thr, 0, global.nbthread * sizeof(*thr));
+}
+
+/* Returns the index of the bucket of a latency histogram holding <val>. */
+static inline unsigned int lat_hist_idx(unsigned int val)
+{
+	unsigned int e;
+
+	if (val < (1U << LAT_HIST_SUB_BITS))
+		return val;
+
+	e = my_flsl(val) - 1;
+	return ((e - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS) +
+	       ((val >> (e - LAT_HIST_SUB_BITS)) & ((1U << LAT_HIST_SUB_BITS) - 1));
+}
+
+/* Returns the lowest value held by bucket <idx> of a latency histogram. */
+static inline unsigned int lat_hist_low(unsigned int idx)
+{
+	unsigned int e = (idx >> LAT_HIST_SUB_BITS) + LAT_HIST_SUB_BITS - 1;
+
+	if (idx < (1U << LAT_HIST_SUB_BITS))
+		return idx;
+	return ((1U << LAT_HIST_SUB_BITS) + (idx & ((1U << LAT_HIST_SUB_BITS) - 1))) << (e - LAT_HIST_SUB_BITS);
+}
+
+/* Returns the highest value held by bucket <idx> of a latency histogram. */
+static inline unsigned int lat_hist_high(unsigned int idx)
+{
+	unsigned int e = (idx >> LAT_HIST_SUB_BITS) + LAT_HIST_SUB_BITS - 1;
+
+	if (idx < (1U << LAT_HIST_SUB_BITS))
+		return idx;
+	return lat_hist_low(idx) + (1U << (e - LAT_HIST_SUB_BITS)) - 1;
+}
+
+/* Accounts value <val> into histogram <h>. Negative values are accounted as
+ * zero. This is lock-free and may be called by any thread.
+ */
+static inline void lat_hist_add(struct lat_hist *h, int val)
+{
+	if (val < 0)
+		val = 0;
+	_HA_ATOMIC_ADD(&h->bucket[lat_hist_idx(val)], 1);
+	_HA_ATOMIC_ADD(&h->sum, val);
+}
+
+/* Returns the number of values accounted into histogram <h> */
+static inline unsigned long long lat_hist_count(const struct lat_hist *h)
+{
+	unsigned long long count = 0;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		count += h->bucket[i];
+	return count;
+}
+
+/* Returns the <pct> percentile (1..100) of the values accounted into histogram
+ * <h>, which is the highest value of the bucket it falls into, or 0 if the
+ * histogram is empty.
+ */
+static inline unsigned int lat_hist_percentile(const struct lat_hist *h, unsigned int pct)
+{
+	unsigned long long total = lat_hist_count(h);
+	unsigned long long target, count = 0;
+	int i;
+
+	if (!total)
+		return 0;
+
+	target = (total * pct + 99) / 100;
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		count += h->bucket[i];
+		if (count >= target)
+			break;
+	}
+	return lat_hist_high(i < LAT_HIST_BUCKETS ? i : LAT_HIST_BUCKETS - 1);
+}
+
+#endif /* _PROTO_COUNTERS_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
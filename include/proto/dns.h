@@ -41,6 +41,9 @@ int dns_get_ip_from_response(struct dns_response_packet *dns_p,
                              short currentip_sin_family,
                              void **newip, short *newip_sin_family,
                              void *owner);
+int dns_get_alt_ip_from_response(struct dns_response_packet *dns_p,
+                                 const struct sockaddr_storage *cur,
+                                 struct sockaddr_storage *alt);
 
 int dns_link_resolution(void *requester, int requester_type, int requester_locked);
 void dns_unlink_resolution(struct dns_requester *requester);
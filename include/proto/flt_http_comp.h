@@ -22,7 +22,9 @@
 #define _PROTO_FLT_HTTP_COMP_H
 
 #include <types/proxy.h>
+#include <types/stream.h>
 
 int check_implicit_http_comp_flt(struct proxy *proxy);
+int http_comp_set_level(struct stream *s, int level);
 
 #endif // _PROTO_FLT_HTTP_COMP_H
@@ -74,6 +74,31 @@ static inline unsigned int update_freq_ctr(struct freq_ctr *ctr, unsigned int in
 	return _HA_ATOMIC_ADD(&ctr->curr_ctr, inc);
 }
 
+/* Update the calling thread's part of per-thread frequency counter <ctr> by
+ * <inc> incremental units. It is automatically rotated if the period is over.
+ * Only the calling thread writes to its slot so no atomic operation is needed,
+ * the date is written last for the readers. Returns the thread's own count for
+ * the current period, use freq_ctr_thr_curr() to get the total one.
+ */
+static inline unsigned int update_freq_ctr_thr(struct freq_ctr_thr *ctr, unsigned int inc)
+{
+	struct freq_ctr *c;
+	unsigned int curr_sec = now.tv_sec & 0x7fffffff;
+
+	if (!ctr->slot)
+		return update_freq_ctr(&ctr->ctr, inc);
+
+	c = &ctr->slot[tid].ctr;
+	if (unlikely(c->curr_sec != curr_sec)) {
+		c->prev_ctr = (curr_sec - c->curr_sec == 1) ? c->curr_ctr : 0;
+		c->curr_ctr = 0;
+		HA_BARRIER();
+		c->curr_sec = curr_sec;
+	}
+	c->curr_ctr += inc;
+	return c->curr_ctr;
+}
+
 /* Update a frequency counter by <inc> incremental units. It is automatically
  * rotated if the period is over. It is important that it correctly initializes
  * a null area. This one works on frequency counters which have a period
@@ -131,6 +156,16 @@ unsigned int freq_ctr_remain(struct freq_ctr *ctr, unsigned int freq, unsigned i
  */
 unsigned int next_event_delay(struct freq_ctr *ctr, unsigned int freq, unsigned int pend);
 
+/* same as above for per-thread frequency counters, which sum all the threads'
+ * slots. freq_ctr_thr_curr() only returns the count for the current period.
+ */
+unsigned int read_freq_ctr_thr(struct freq_ctr_thr *ctr);
+unsigned int freq_ctr_thr_curr(struct freq_ctr_thr *ctr);
+unsigned int freq_ctr_thr_remain(struct freq_ctr_thr *ctr, unsigned int freq, unsigned int pend);
+unsigned int next_event_delay_thr(struct freq_ctr_thr *ctr, unsigned int freq, unsigned int pend);
+int freq_ctr_thr_alloc(struct freq_ctr_thr *ctr);
+void freq_ctr_thr_free(struct freq_ctr_thr *ctr);
+
 /* process freq counters over configurable periods */
 unsigned int read_freq_ctr_period(struct freq_ctr_period *ctr, unsigned int period);
 unsigned int freq_ctr_remain_period(struct freq_ctr_period *ctr, unsigned int period,
@@ -165,6 +165,7 @@ static inline struct bind_conf *bind_conf_alloc(struct proxy *fe, const char *fi
 	HA_RWLOCK_INIT(&bind_conf->sni_lock);
 	bind_conf->sni_ctx = EB_ROOT;
 	bind_conf->sni_w_ctx = EB_ROOT;
+	bind_conf->sni_lazy = EB_ROOT;
 #endif
 	LIST_INIT(&bind_conf->listeners);
 	return bind_conf;
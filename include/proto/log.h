@@ -190,6 +190,9 @@ char *update_log_hdr_rfc5424(const time_t time);
 char *update_log_hdr(const time_t time);
 char * get_format_pid_sep1(int format, size_t *len);
 char * get_format_pid_sep2(int format, size_t *len);
+size_t log_build_cbor(char *dst, size_t maxlen, char **rec, int pri,
+                      const char *tag, size_t tag_size, const char *pid, size_t pid_size,
+                      const char *sd, size_t sd_size, const char *msg, size_t size);
 
 #endif /* _PROTO_LOG_H */
 
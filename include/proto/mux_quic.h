@@ -0,0 +1,54 @@
+/*
+ * include/proto/mux_quic.h
+ * This file contains the QUIC mux function prototypes
+ *
+ * Copyright 2020 HAProxy Technologies, Frédéric Lécaille <flecaille@haproxy.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_MUX_QUIC_H
+#define _PROTO_MUX_QUIC_H
+
+#include <stdint.h>
+
+#include <common/config.h>
+#include <types/connection.h>
+
+extern const struct mux_ops mux_quic_ops;
+extern const struct mux_ops mux_quic_h3_ops;
+
+/* Functions called by the QUIC transport layer upon frame reception. They
+ * all return 1 if succeeded, 0 if the frame must be considered as a
+ * connection error by the transport layer.
+ */
+int qcc_recv_stream(struct connection *conn, uint64_t id, uint64_t offset,
+                    const unsigned char *data, uint64_t len, int fin);
+int qcc_recv_reset_stream(struct connection *conn, uint64_t id, uint64_t final_size);
+int qcc_recv_max_data(struct connection *conn, uint64_t max);
+int qcc_recv_max_stream_data(struct connection *conn, uint64_t id, uint64_t max);
+int qcc_recv_max_streams(struct connection *conn, uint64_t max, int uni);
+/* Called by the QUIC transport layer when a STREAM frame has been acknowledged. */
+void qcc_stream_acked(struct connection *conn, uint64_t id,
+                      uint64_t offset, uint64_t len, int fin);
+
+#endif /* _PROTO_MUX_QUIC_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
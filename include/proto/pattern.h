@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include <common/config.h>
+#include <common/hathreads.h>
 #include <common/standard.h>
 #include <types/pattern.h>
 
@@ -37,8 +38,18 @@ extern void (*pat_prune_fcts[PAT_MATCH_NUM])(struct pattern_expr *);
 extern struct pattern *(*pat_match_fcts[PAT_MATCH_NUM])(struct sample *, struct pattern_expr *, int);
 extern int pat_match_types[PAT_MATCH_NUM];
 
+/* bumped each time the entries of a reference flagged PAT_REF_IDX change */
+extern unsigned int pat_ref_idx_gen;
+
 int pattern_finalize_config(void);
 
+/* Reports a change of the entries of <ref> to the external indexes. */
+static inline void pat_ref_touch(struct pat_ref *ref)
+{
+	if (ref->flags & PAT_REF_IDX)
+		HA_ATOMIC_ADD(&pat_ref_idx_gen, 1);
+}
+
 /* return the PAT_MATCH_* index for match name "name", or < 0 if not found */
 static inline int pat_find_match_name(const char *name)
 {
@@ -194,6 +205,10 @@ int pat_ref_delete_by_id(struct pat_ref *ref, struct pat_ref_elt *refelt);
 void pat_ref_prune(struct pat_ref *ref);
 int pat_ref_load(struct pat_ref *ref, struct pattern_expr *expr, int patflags, int soe, char **err);
 void pat_ref_reload(struct pat_ref *ref, struct pat_ref *replace);
+int pat_ref_prepare(struct pat_ref *ref, unsigned int *gen, char **err);
+int pat_ref_add_gen(struct pat_ref *ref, unsigned int gen, const char *pattern, const char *sample, char **err);
+int pat_ref_commit(struct pat_ref *ref, unsigned int gen, char **err);
+int pat_ref_clear_gen(struct pat_ref *ref, unsigned int gen, char **err);
 
 
 /*
@@ -54,6 +54,8 @@ static inline struct xprt_ops *peer_xprt(struct peer *p)
 }
 #endif
 
+int intencode(uint64_t i, char **str);
+uint64_t intdecode(char **str, char *end);
 int peers_init_sync(struct peers *peers);
 int peers_alloc_dcache(struct peers *peers);
 void peers_register_table(struct peers *, struct stktable *table);
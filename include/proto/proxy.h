@@ -29,6 +29,7 @@
 #include <types/global.h>
 #include <types/proxy.h>
 #include <types/listener.h>
+#include <proto/counters.h>
 #include <proto/freq_ctr.h>
 
 extern struct proxy *proxies_list;
@@ -116,8 +117,8 @@ static inline void proxy_inc_fe_conn_ctr(struct listener *l, struct proxy *fe)
 	_HA_ATOMIC_ADD(&fe->fe_counters.cum_conn, 1);
 	if (l->counters)
 		_HA_ATOMIC_ADD(&l->counters->cum_conn, 1);
-	HA_ATOMIC_UPDATE_MAX(&fe->fe_counters.cps_max,
-			     update_freq_ctr(&fe->fe_conn_per_sec, 1));
+	update_freq_ctr_thr(&fe->fe_conn_per_sec, 1);
+	HA_ATOMIC_UPDATE_MAX(&fe->fe_counters.cps_max, freq_ctr_thr_curr(&fe->fe_conn_per_sec));
 }
 
 /* increase the number of cumulated connections accepted by the designated frontend */
@@ -127,8 +128,8 @@ static inline void proxy_inc_fe_sess_ctr(struct listener *l, struct proxy *fe)
 	_HA_ATOMIC_ADD(&fe->fe_counters.cum_sess, 1);
 	if (l->counters)
 		_HA_ATOMIC_ADD(&l->counters->cum_sess, 1);
-	HA_ATOMIC_UPDATE_MAX(&fe->fe_counters.sps_max,
-			     update_freq_ctr(&fe->fe_sess_per_sec, 1));
+	update_freq_ctr_thr(&fe->fe_sess_per_sec, 1);
+	HA_ATOMIC_UPDATE_MAX(&fe->fe_counters.sps_max, freq_ctr_thr_curr(&fe->fe_sess_per_sec));
 }
 
 /* increase the number of cumulated connections on the designated backend */
@@ -142,7 +143,7 @@ static inline void proxy_inc_be_ctr(struct proxy *be)
 /* increase the number of cumulated requests on the designated frontend */
 static inline void proxy_inc_fe_req_ctr(struct proxy *fe)
 {
-	_HA_ATOMIC_ADD(&fe->fe_counters.p.http.cum_req, 1);
+	COUNTERS_ADD(&fe->fe_counters, p.http.cum_req, 1);
 	HA_ATOMIC_UPDATE_MAX(&fe->fe_counters.p.http.rps_max,
 			     update_freq_ctr(&fe->fe_req_per_sec, 1));
 }
@@ -191,6 +192,36 @@ static inline int in_proxies_list(struct proxy *list, struct proxy *proxy)
 	return 0;
 }
 
+#ifdef USE_QUIC
+/* Fills <cnt> with the sum of the QUIC counters of the listeners of <px>
+ * frontend. Returns the number of QUIC listeners found, so 0 if <px> has none,
+ * in which case <cnt> must be ignored.
+ */
+static inline int proxy_fe_quic_counters(const struct proxy *px, struct quic_counters *cnt)
+{
+	const struct listener *l;
+	int ret = 0;
+
+	memset(cnt, 0, sizeof *cnt);
+	list_for_each_entry(l, &px->conf.listeners, by_fe) {
+		if (!l->bind_conf->is_quic)
+			continue;
+
+		cnt->rx_pkts   += l->quic_counters.rx_pkts;
+		cnt->tx_pkts   += l->quic_counters.tx_pkts;
+		cnt->lost_pkts += l->quic_counters.lost_pkts;
+		cnt->pto       += l->quic_counters.pto;
+		cnt->retries   += l->quic_counters.retries;
+		cnt->sresets   += l->quic_counters.sresets;
+		cnt->ho_fwd    += l->quic_counters.ho_fwd;
+		cnt->ho_rcvd   += l->quic_counters.ho_rcvd;
+		ret++;
+	}
+
+	return ret;
+}
+#endif
+
 #endif /* _PROTO_PROXY_H */
 
 /*
@@ -40,6 +40,7 @@ struct pendconn *pendconn_add(struct stream *strm);
 int pendconn_dequeue(struct stream *strm);
 void process_srv_queue(struct server *s);
 unsigned int srv_dynamic_maxconn(const struct server *s);
+void __srv_observe_concurrency(struct server *s, int overloaded, int rtime);
 int pendconn_redistribute(struct server *s);
 int pendconn_grab_from_px(struct server *s);
 void pendconn_unlink(struct pendconn *p);
@@ -76,6 +77,17 @@ static inline void pendconn_free(struct stream *s)
 }
 
 /* Returns 0 if all slots are full on a server, or 1 if there are slots available. */
+/* Reports to the adaptive concurrency limit of <s> the outcome of a stream,
+ * <overloaded> being non-zero if the server timed out, aborted or reported
+ * being unavailable, and <rtime> its response time in milliseconds, or
+ * negative if unknown. It does nothing if "adaptive-maxconn" is not set.
+ */
+static inline void srv_observe_concurrency(struct server *s, int overloaded, int rtime)
+{
+	if (s->adapt_limit)
+		__srv_observe_concurrency(s, overloaded, rtime);
+}
+
 static inline int server_has_room(const struct server *s) {
 	return !s->maxconn || s->cur_sess < srv_dynamic_maxconn(s);
 }
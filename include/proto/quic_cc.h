@@ -28,6 +28,7 @@
 #include <types/quic_cc.h>
 #include <types/xprt_quic.h>
 
+struct quic_cc_algo *quic_cc_algo_lookup(const char *name);
 void quic_cc_init(struct quic_cc *cc, struct quic_cc_algo *algo, struct quic_conn *qc);
 void quic_cc_event(struct quic_cc *cc, struct quic_cc_event *ev);
 void quic_cc_state_trace(struct buffer *buf, const struct quic_cc *cc);
@@ -44,6 +45,19 @@ static inline const char *quic_cc_state_str(enum quic_cc_algo_state_type state)
 	}
 }
 
+/* Return the qlog name of <state> congestion control state. */
+static inline const char *quic_cc_state_name(enum quic_cc_algo_state_type state)
+{
+	switch (state) {
+	case QUIC_CC_ST_SS:
+		return "slow_start";
+	case QUIC_CC_ST_CA:
+		return "congestion_avoidance";
+	default:
+		return "unknown";
+	}
+}
+
 /* Return a human readable string from <ev> control congestion event type. */
 static inline void quic_cc_event_trace(struct buffer *buf, const struct quic_cc_event *ev)
 {
@@ -59,7 +73,7 @@ static inline void quic_cc_event_trace(struct buffer *buf, const struct quic_cc_
 		              ev->loss.newest_time_sent, ev->loss.period);
 		break;
 	case QUIC_CC_EVT_ECN_CE:
-		chunk_appendf(buf, "ecn_ce");
+		chunk_appendf(buf, "ecn_ce time_sent=%u", ev->ecn.time_sent);
 		break;
 	}
 }
@@ -35,4 +35,8 @@ int qc_parse_frm(struct quic_frame *frm, struct quic_rx_packet *pkt,
                  const unsigned char **buf, const unsigned char *end,
                  struct quic_conn *conn);
 
+int quic_update_ack_ranges(struct quic_ack_ranges *qars, int64_t pn);
+size_t quic_ack_ranges_fit(struct quic_ack_ranges *qars, size_t limit,
+                           size_t *enc_sz);
+
 #endif /* _PROTO_QUIC_FRAME_H */
@@ -0,0 +1,76 @@
+/*
+ * include/proto/quic_pacing.h
+ * This file provides interface definition for QUIC packet pacing.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_QUIC_PACING_H
+#define _PROTO_QUIC_PACING_H
+
+#include <stddef.h>
+
+#include <types/quic_pacing.h>
+#include <types/xprt_quic.h>
+
+static inline void quic_pacer_init(struct quic_pacer *p)
+{
+	p->cc_rate = 0;
+	p->rate = 0;
+	p->next = 0;
+}
+
+/* Update the pacing rate of <p> pacer from the state of <path>, its path:
+ * the rate imposed by the congestion controller if any, else the congestion
+ * window spread over the smoothed RTT. The datagrams are not paced until
+ * the first RTT sample.
+ */
+static inline void quic_pacer_update(struct quic_pacer *p, const struct quic_path *path)
+{
+	if (p->cc_rate)
+		p->rate = p->cc_rate;
+	else if (path->loss.srtt)
+		/* srtt is in ms << 3 */
+		p->rate = path->cwnd * 8000 * QUIC_PACING_GAIN_NUM /
+			(QUIC_PACING_GAIN_DEN * (uint64_t)path->loss.srtt);
+	else
+		p->rate = 0;
+}
+
+/* Return the time (us) needed to transmit <len> bytes at the rate of <p>. */
+static inline uint64_t quic_pacer_tx_time(const struct quic_pacer *p, size_t len)
+{
+	return p->rate ? len * 1000000 / p->rate : 0;
+}
+
+/* Return the departure date (us) of the next datagram paced by <p> at <now_us>
+ * date. After an idle period, up to QUIC_PACING_BURST datagrams of <mtu> bytes
+ * may leave immediately.
+ */
+static inline uint64_t quic_pacer_edt(const struct quic_pacer *p, uint64_t now_us, size_t mtu)
+{
+	uint64_t credit;
+
+	if (!p->rate || p->next >= now_us)
+		return p->rate ? p->next : now_us;
+
+	credit = quic_pacer_tx_time(p, QUIC_PACING_BURST * mtu);
+	if (now_us - p->next > credit)
+		return now_us - credit;
+
+	return p->next;
+}
+
+#endif /* _PROTO_QUIC_PACING_H */
@@ -0,0 +1,65 @@
+/*
+ * include/proto/quic_qlog.h
+ * This file provides interface definition for the qlog events of the QUIC
+ * connections.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_QUIC_QLOG_H
+#define _PROTO_QUIC_QLOG_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <types/quic.h>
+#include <types/xprt_quic.h>
+
+void quic_qlog_conn_start(struct quic_conn *qc);
+void __quic_qlog_packet(struct quic_conn *qc, const char *name,
+                        enum quic_pkt_type type, uint64_t pn, size_t len);
+void __quic_qlog_metrics_updated(struct quic_conn *qc);
+void quic_qlog_cc_state_updated(struct quic_conn *qc, const char *old, const char *new);
+
+/* Returns non-zero if the events of <qc> are reported to qlog. */
+static inline int quic_qlog_enabled(const struct quic_conn *qc)
+{
+	return qc->flags & QUIC_FL_CONN_QLOG;
+}
+
+/* Reports to qlog the <pn> packet of <len> bytes and <type> sent by <qc>. */
+static inline void quic_qlog_packet_sent(struct quic_conn *qc, enum quic_pkt_type type,
+                                         uint64_t pn, size_t len)
+{
+	if (quic_qlog_enabled(qc))
+		__quic_qlog_packet(qc, "transport:packet_sent", type, pn, len);
+}
+
+/* Reports to qlog the <pn> packet of <len> bytes and <type> received by <qc>. */
+static inline void quic_qlog_packet_received(struct quic_conn *qc, enum quic_pkt_type type,
+                                             uint64_t pn, size_t len)
+{
+	if (quic_qlog_enabled(qc))
+		__quic_qlog_packet(qc, "transport:packet_received", type, pn, len);
+}
+
+/* Reports to qlog the RTT and congestion metrics of <qc>. */
+static inline void quic_qlog_metrics_updated(struct quic_conn *qc)
+{
+	if (quic_qlog_enabled(qc))
+		__quic_qlog_metrics_updated(qc);
+}
+
+#endif /* _PROTO_QUIC_QLOG_H */
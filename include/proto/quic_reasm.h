@@ -0,0 +1,48 @@
+/*
+ * include/proto/quic_reasm.h
+ * This file provides interface definition for the reassembly of the QUIC
+ * CRYPTO and STREAM data received out of order.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_QUIC_REASM_H
+#define _PROTO_QUIC_REASM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <types/quic_reasm.h>
+
+int quic_reasm_add(struct quic_reasm *r, uint64_t base, uint64_t off,
+                   const unsigned char *data, size_t len);
+const unsigned char *quic_reasm_get(const struct quic_reasm *r, uint64_t base, size_t *len);
+void quic_reasm_del(struct quic_reasm *r, uint64_t base, size_t len);
+void quic_reasm_release(struct quic_reasm *r);
+
+/* Initializes <r> reassembly context. */
+static inline void quic_reasm_init(struct quic_reasm *r)
+{
+	r->buf = NULL;
+	r->nb = 0;
+}
+
+/* Returns non-zero if some data are waiting in <r> for a gap to be filled. */
+static inline int quic_reasm_pending(const struct quic_reasm *r)
+{
+	return r->nb != 0;
+}
+
+#endif /* _PROTO_QUIC_REASM_H */
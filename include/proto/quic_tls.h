@@ -15,6 +15,7 @@
 #define _PROTO_QUIC_TLS_H
 
 #include <stdlib.h>
+#include <string.h>
 #include <openssl/ssl.h>
 
 #include <common/buf.h>
@@ -38,13 +39,19 @@ int quic_tls_derive_initial_secrets(const EVP_MD *md,
 
 int quic_tls_encrypt(unsigned char *buf, size_t len,
                      const unsigned char *aad, size_t aad_len,
-                     const EVP_CIPHER *aead,
-                     const unsigned char *key, const unsigned char *iv);
+                     EVP_CIPHER_CTX *ctx, const unsigned char *iv);
 
 int quic_tls_decrypt(unsigned char *buf, size_t len,
                      unsigned char *aad, size_t aad_len,
-                     const EVP_CIPHER *aead,
-                     const unsigned char *key, const unsigned char *iv);
+                     EVP_CIPHER_CTX *ctx, const unsigned char *iv);
+
+int quic_tls_decrypt_batch(struct quic_tls_dec *decs, int n, EVP_CIPHER_CTX *ctx,
+                           unsigned char *aead_iv, size_t aead_ivlen);
+
+int quic_tls_secrets_ctx_init(struct quic_tls_secrets *secs, int enc);
+
+int quic_tls_hp_masks(struct quic_tls_secrets *secs, unsigned char *samples,
+                      unsigned char *masks, int n);
 
 int quic_tls_derive_keys(const EVP_CIPHER *aead, const EVP_CIPHER *hp,
                          const EVP_MD *md,
@@ -56,6 +63,12 @@ int quic_tls_derive_keys(const EVP_CIPHER *aead, const EVP_CIPHER *hp,
 int quic_aead_iv_build(unsigned char *iv, size_t ivlen,
                        unsigned char *aead_iv, size_t aead_ivlen, uint64_t pn);
 
+int quic_tls_kp_derive(struct quic_tls_kp *kp, const struct quic_tls_secrets *secs,
+                       int enc);
+
+int quic_tls_retry_integrity_tag(unsigned char *buf, size_t len,
+                                 const unsigned char *odcid, unsigned char odcid_len);
+
 static inline const EVP_CIPHER *tls_aead(const SSL_CIPHER *cipher)
 {
 	switch (SSL_CIPHER_get_id(cipher)) {
@@ -120,6 +133,18 @@ static inline const EVP_CIPHER *tls_hp(const SSL_CIPHER *cipher)
 
 }
 
+/* Returns the AES-ECB cipher matching <hp> AES-CTR header protection
+ * cipher, NULL for the other ones.
+ */
+static inline const EVP_CIPHER *tls_hp_ecb(const EVP_CIPHER *hp)
+{
+	if (hp == EVP_aes_128_ctr())
+		return EVP_aes_128_ecb();
+	if (hp == EVP_aes_256_ctr())
+		return EVP_aes_256_ecb();
+	return NULL;
+}
+
 /* These following functions map TLS implementation encryption level to ours */
 static inline enum quic_tls_enc_level ssl_to_quic_enc_level(enum ssl_encryption_level_t level)
 {
@@ -373,6 +398,46 @@ static inline int quic_get_tls_enc_levels(enum quic_tls_enc_level *level,
 	return 1;
 }
 
+/* Release the cipher contexts of <secs> QUIC TLS secrets. */
+static inline void quic_tls_secrets_ctx_free(struct quic_tls_secrets *secs)
+{
+	EVP_CIPHER_CTX_free(secs->ctx);
+	secs->ctx = NULL;
+	EVP_CIPHER_CTX_free(secs->hp_ctx);
+	secs->hp_ctx = NULL;
+	EVP_CIPHER_CTX_free(secs->hp_ecb_ctx);
+	secs->hp_ecb_ctx = NULL;
+}
+
+/* Release the cipher context of <kp> key phase. */
+static inline void quic_tls_kp_free(struct quic_tls_kp *kp)
+{
+	EVP_CIPHER_CTX_free(kp->ctx);
+	kp->ctx = NULL;
+}
+
+/* Exchange the packet protection material of <secs> with the one of <kp>
+ * key phase, without any derivation nor cipher context initialization.
+ */
+static inline void quic_tls_kp_swap(struct quic_tls_secrets *secs, struct quic_tls_kp *kp)
+{
+	struct quic_tls_kp tmp;
+
+	tmp.ctx = secs->ctx;
+	memcpy(tmp.secret, secs->secret, sizeof tmp.secret);
+	tmp.secretlen = secs->secretlen;
+	memcpy(tmp.key, secs->key, sizeof tmp.key);
+	memcpy(tmp.iv, secs->iv, sizeof tmp.iv);
+
+	secs->ctx = kp->ctx;
+	memcpy(secs->secret, kp->secret, sizeof secs->secret);
+	secs->secretlen = kp->secretlen;
+	memcpy(secs->key, kp->key, sizeof secs->key);
+	memcpy(secs->iv, kp->iv, sizeof secs->iv);
+
+	*kp = tmp;
+}
+
 /* Flag the keys at <qel> encryption level as discarded. */
 static inline void quic_tls_discard_keys(struct quic_enc_level *qel)
 {
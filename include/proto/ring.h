@@ -23,12 +23,15 @@
 #define _PROTO_RING_H
 
 #include <stdlib.h>
+#include <common/buf.h>
+#include <common/hathreads.h>
 #include <common/ist.h>
 #include <types/ring.h>
 
 struct ring *ring_new(size_t size);
 struct ring *ring_resize(struct ring *ring, size_t size);
 void ring_free(struct ring *ring);
+int ring_set_backing_file(struct ring *ring, const char *path, char **err);
 ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], size_t npfx, const struct ist msg[], size_t nmsg);
 int ring_attach(struct ring *ring);
 void ring_detach_appctx(struct ring *ring, struct appctx *appctx, size_t ofs);
@@ -36,6 +39,18 @@ int ring_attach_cli(struct ring *ring, struct appctx *appctx);
 int cli_io_handler_show_ring(struct appctx *appctx);
 void cli_io_release_show_ring(struct appctx *appctx);
 
+/* Returns non-zero if the message following the readers count at offset <ofs>
+ * of <buf> (relative to its head) was completely written, so that it may be
+ * read. Readers must stop at the first uncommitted message.
+ */
+static inline int ring_msg_committed(const struct buffer *buf, size_t ofs)
+{
+	if (*b_peek(buf, ofs) & RING_RC_UNCOMMITTED)
+		return 0;
+	__ha_barrier_load();
+	return 1;
+}
+
 #endif /* _PROTO_RING_H */
 
 /*
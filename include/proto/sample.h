@@ -49,6 +49,9 @@ int smp_check_date_unit(struct arg *args, char **err);
 int smp_expr_output_type(struct sample_expr *expr);
 int c_none(struct sample *smp);
 int smp_dup(struct sample *smp);
+void smp_memo_reset(struct stream *s);
+void smp_memo_release(struct stream *s);
+int smp_args_eq(const struct arg *a, const struct arg *b);
 
 /*
  * This function just apply a cast on sample. It returns 0 if the cast is not
@@ -34,6 +34,8 @@
 int shctx_init(struct shared_context **orig_shctx,
                int maxblocks, int blocksize, unsigned int maxobjsz,
                int extra, int shared);
+int shctx_init_file(struct shared_context **orig_shctx, const char *path, int maxblocks,
+                    int blocksize, unsigned int maxobjsz, int extra);
 struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
                                            struct shared_block *last, int data_len);
 void shctx_row_inc_hot(struct shared_context *shctx, struct shared_block *first);
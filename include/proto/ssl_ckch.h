@@ -45,9 +45,18 @@ static inline int ssl_sock_is_ckch_valid(struct cert_key_and_chain *ckch)
 /* ckch_store functions */
 struct ckch_store *ckchs_load_cert_file(char *path, int multi, char **err);
 struct ckch_store *ckchs_lookup(char *path);
+struct ckch_store *ckchs_new_lazy(char *path, char **err);
+void ckchs_preload(char **paths, int count);
 struct ckch_store *ckchs_dup(const struct ckch_store *src);
 struct ckch_store *ckch_store_new(const char *filename, int nmemb);
 void ckch_store_free(struct ckch_store *store);
+#ifdef HAVE_SSL_CERT_COMP
+struct ckch_cert_comp *ckch_store_get_cert_comp(struct ckch_store *store);
+void ckch_cert_comp_release(struct ckch_cert_comp *cc);
+const struct ckch_cert_comp_msg *ckch_cert_comp_get_msg(struct ckch_cert_comp *cc,
+                                                        const unsigned char *msg, size_t len,
+                                                        int *cached);
+#endif
 
 
 /* ckch_inst functions */
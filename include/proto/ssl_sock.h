@@ -108,6 +108,7 @@ void ssl_sock_load_cert_sni(struct ckch_inst *ckch_inst, struct bind_conf *bind_
 #if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC) && !defined(LIBRESSL_VERSION_NUMBER)
 void ssl_async_fd_handler(int fd);
 void ssl_async_fd_free(int fd);
+void ssl_async_update_fds(SSL *ssl, void *owner, void (*iocb)(int fd));
 #endif
 struct issuer_chain* ssl_get0_issuer_chain(X509 *cert);
 int ssl_load_global_issuer_from_BIO(BIO *in, char *fp, char **err);
@@ -121,10 +122,10 @@ int ssl_store_load_locations_file(char *path);
 
 #define sh_ssl_sess_tree_delete(s)     ebmb_delete(&(s)->key);
 
-#define sh_ssl_sess_tree_insert(s)     (struct sh_ssl_sess_hdr *)ebmb_insert(sh_ssl_sess_tree, \
+#define sh_ssl_sess_tree_insert(r, s)  (struct sh_ssl_sess_hdr *)ebmb_insert((r), \
                                                                     &(s)->key, SSL_MAX_SSL_SESSION_ID_LENGTH);
 
-#define sh_ssl_sess_tree_lookup(k)     (struct sh_ssl_sess_hdr *)ebmb_lookup(sh_ssl_sess_tree, \
+#define sh_ssl_sess_tree_lookup(r, k)  (struct sh_ssl_sess_hdr *)ebmb_lookup((r), \
                                                                     (k), SSL_MAX_SSL_SESSION_ID_LENGTH);
 
 /* Registers the function <func> in order to be called on SSL/TLS protocol
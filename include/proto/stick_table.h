@@ -23,6 +23,8 @@
 #ifndef _PROTO_STICK_TABLE_H
 #define _PROTO_STICK_TABLE_H
 
+#include <sys/socket.h>
+
 #include <common/errors.h>
 #include <common/ticks.h>
 #include <common/time.h>
@@ -36,12 +38,14 @@ extern struct stktable *stktables_list;
 
 void stktable_store_name(struct stktable *t);
 struct stktable *stktable_find_by_name(const char *name);
+int stktable_reject_addr(struct stktable *t, struct sockaddr_storage *addr);
 struct stksess *stksess_new(struct stktable *t, struct stktable_key *key);
 void stksess_setkey(struct stktable *t, struct stksess *ts, struct stktable_key *key);
 void stksess_free(struct stktable *t, struct stksess *ts);
 int stksess_kill(struct stktable *t, struct stksess *ts, int decrefcount);
 
 int stktable_init(struct stktable *t);
+void stktable_persist_flush(struct stktable *t);
 int stktable_parse_type(char **args, int *idx, unsigned long *type, size_t *key_size);
 int parse_stick_table(const char *file, int linenum, char **args,
                       struct stktable *t, char *id, char *nid, struct peers *peers);
@@ -64,6 +68,8 @@ int stktable_register_data_store(int idx, const char *name, int std_type, int ar
 int stktable_get_data_type(char *name);
 int stktable_trash_oldest(struct stktable *t, int to_batch);
 int __stksess_kill(struct stktable *t, struct stksess *ts);
+struct stktable_shard *stksess_shard(const struct stktable *t, const struct stksess *ts);
+struct stksess *stktable_first_entry(struct stktable *t, unsigned int *shard);
 
 /* return allocation size for standard data type <type> */
 static inline int stktable_type_size(int type)
@@ -147,7 +153,23 @@ static inline void *stktable_data_ptr(struct stktable *t, struct stksess *ts, in
 	return __stktable_data_ptr(t, ts, type);
 }
 
-/* kill an entry if it's expired and its ref_cnt is zero */
+/* Atomically decrements the unsigned counter pointed to by <val> of a table
+ * entry, unless it is already zero. The counters are updated without the
+ * entry's lock so that they may be read without it.
+ */
+static inline void stktable_data_dec_uint(unsigned int *val)
+{
+	unsigned int old = *val;
+
+	do {
+		if (!old)
+			return;
+	} while (!_HA_ATOMIC_CAS(val, &old, old - 1));
+}
+
+/* kill an entry if it's expired and its ref_cnt is zero. The lock of the
+ * entry's shard must be held.
+ */
 static inline int __stksess_kill_if_expired(struct stktable *t, struct stksess *ts)
 {
 	if (t->expire != TICK_ETERNITY && tick_is_expired(ts->expire, now_ms))
@@ -158,15 +180,17 @@ static inline int __stksess_kill_if_expired(struct stktable *t, struct stksess *
 
 static inline void stksess_kill_if_expired(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	struct stktable_shard *shard __maybe_unused = stksess_shard(t, ts);
+
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
 
 	if (decrefcnt)
-		ts->ref_cnt--;
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 
 	if (t->expire != TICK_ETERNITY && tick_is_expired(ts->expire, now_ms))
 		__stksess_kill_if_expired(t, ts);
 
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
 }
 
 /* sets the stick counter's entry pointer */
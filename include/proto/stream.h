@@ -79,6 +79,7 @@ int parse_track_counters(char **args, int *arg,
 
 /* Update the stream's backend and server time stats */
 void stream_update_time_stats(struct stream *s);
+void sw_dispatch_free(struct sw_dispatch *d);
 void stream_release_buffers(struct stream *s);
 int stream_buf_available(void *arg);
 
@@ -106,6 +107,35 @@ static inline enum obj_type *strm_orig(const struct stream *strm)
 	return strm->sess->origin;
 }
 
+/* Returns the request capture slots of stream <s>, allocating them on first
+ * use since many streams never capture anything, or NULL if the frontend has
+ * no capture slot or if the allocation failed.
+ */
+static inline char **stream_req_cap(struct stream *s)
+{
+	struct proxy *fe = strm_fe(s);
+
+	if (unlikely(!s->req_cap) && fe->nb_req_cap) {
+		s->req_cap = pool_alloc(fe->req_cap_pool);
+		if (s->req_cap)
+			memset(s->req_cap, 0, fe->nb_req_cap * sizeof(void *));
+	}
+	return s->req_cap;
+}
+
+/* Same as stream_req_cap() for the response capture slots */
+static inline char **stream_res_cap(struct stream *s)
+{
+	struct proxy *fe = strm_fe(s);
+
+	if (unlikely(!s->res_cap) && fe->nb_rsp_cap) {
+		s->res_cap = pool_alloc(fe->rsp_cap_pool);
+		if (s->res_cap)
+			memset(s->res_cap, 0, fe->nb_rsp_cap * sizeof(void *));
+	}
+	return s->res_cap;
+}
+
 /* Remove the refcount from the stream to the tracked counters, and clear the
  * pointer to ensure this is only performed once. The caller is responsible for
  * ensuring that the pointer is valid first. We must be extremely careful not
@@ -127,12 +157,7 @@ static inline void stream_store_counters(struct stream *s)
 
 		ptr = stktable_data_ptr(s->stkctr[i].table, ts, STKTABLE_DT_CONN_CUR);
 		if (ptr) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
-			if (stktable_data_cast(ptr, conn_cur) > 0)
-				stktable_data_cast(ptr, conn_cur)--;
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+			stktable_data_dec_uint(&stktable_data_cast(ptr, conn_cur));
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(s->stkctr[i].table, ts, 0);
@@ -166,12 +191,7 @@ static inline void stream_stop_content_counters(struct stream *s)
 
 		ptr = stktable_data_ptr(s->stkctr[i].table, ts, STKTABLE_DT_CONN_CUR);
 		if (ptr) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
-			if (stktable_data_cast(ptr, conn_cur) > 0)
-				stktable_data_cast(ptr, conn_cur)--;
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+			stktable_data_dec_uint(&stktable_data_cast(ptr, conn_cur));
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(s->stkctr[i].table, ts, 0);
@@ -189,15 +209,13 @@ static inline void stream_start_counters(struct stktable *t, struct stksess *ts)
 {
 	void *ptr;
 
-	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 	ptr = stktable_data_ptr(t, ts, STKTABLE_DT_CONN_CUR);
 	if (ptr)
-		stktable_data_cast(ptr, conn_cur)++;
+		_HA_ATOMIC_ADD(&stktable_data_cast(ptr, conn_cur), 1);
 
 	ptr = stktable_data_ptr(t, ts, STKTABLE_DT_CONN_CNT);
 	if (ptr)
-		stktable_data_cast(ptr, conn_cnt)++;
+		_HA_ATOMIC_ADD(&stktable_data_cast(ptr, conn_cnt), 1);
 
 	ptr = stktable_data_ptr(t, ts, STKTABLE_DT_CONN_RATE);
 	if (ptr)
@@ -206,8 +224,6 @@ static inline void stream_start_counters(struct stktable *t, struct stksess *ts)
 	if (tick_isset(t->expire))
 		ts->expire = tick_add(now_ms, MS_TO_TICKS(t->expire));
 
-	HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
-
 	/* If data was modified, we need to touch to re-schedule sync */
 	stktable_touch_local(t, ts, 0);
 }
@@ -245,19 +261,15 @@ static inline void stream_inc_http_req_ctr(struct stream *s)
 				continue;
 		}
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_CNT);
 		if (ptr)
-			stktable_data_cast(ptr, http_req_cnt)++;
+			_HA_ATOMIC_ADD(&stktable_data_cast(ptr, http_req_cnt), 1);
 
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_RATE);
 		if (ptr)
 			update_freq_ctr_period(&stktable_data_cast(ptr, http_req_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_HTTP_REQ_RATE].u, 1);
 
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
-
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(stkctr->table, ts, 0);
 	}
@@ -282,19 +294,15 @@ static inline void stream_inc_be_http_req_ctr(struct stream *s)
 		if (!(stkctr_flags(&s->stkctr[i]) & STKCTR_TRACK_BACKEND))
 			continue;
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_CNT);
 		if (ptr)
-			stktable_data_cast(ptr, http_req_cnt)++;
+			_HA_ATOMIC_ADD(&stktable_data_cast(ptr, http_req_cnt), 1);
 
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_RATE);
 		if (ptr)
 			update_freq_ctr_period(&stktable_data_cast(ptr, http_req_rate),
 			                       stkctr->table->data_arg[STKTABLE_DT_HTTP_REQ_RATE].u, 1);
 
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
-
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(stkctr->table, ts, 0);
 	}
@@ -323,19 +331,15 @@ static inline void stream_inc_http_err_ctr(struct stream *s)
 				continue;
 		}
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_ERR_CNT);
 		if (ptr)
-			stktable_data_cast(ptr, http_err_cnt)++;
+			_HA_ATOMIC_ADD(&stktable_data_cast(ptr, http_err_cnt), 1);
 
 		ptr = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_ERR_RATE);
 		if (ptr)
 			update_freq_ctr_period(&stktable_data_cast(ptr, http_err_rate),
 			                       stkctr->table->data_arg[STKTABLE_DT_HTTP_ERR_RATE].u, 1);
 
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
-
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(stkctr->table, ts, 0);
 	}
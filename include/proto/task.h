@@ -83,6 +83,16 @@
 /* The farthest we can look back in a timer tree */
 #define TIMER_LOOK_BACK       (1U << 31)
 
+/* The timers of the tasks bound to a single thread which expire within the
+ * next TW0_SLOTS * TW1_SLOTS ticks are not stored in the tree but in a timer
+ * wheel of this thread, where queuing and unlinking are O(1). The task's wheel
+ * element then overlaps the branches of its wq node, whose leaf_p is set to
+ * TASK_WQ_WHEEL so that the task is still seen in the wait queue, bit to the
+ * level and pfx to the thread. Its key remains a minorant of the real
+ * expiration date.
+ */
+#define TASK_WQ_WHEEL         ((eb_troot_t *)1)
+
 /* a few exported variables */
 extern unsigned int nb_tasks;     /* total number of tasks */
 extern volatile unsigned long global_tasks_mask; /* Mask of threads with tasks in the global runqueue */
@@ -178,7 +188,13 @@ static inline void task_set_affinity(struct task *t, unsigned long thread_mask)
  */
 static inline struct task *__task_unlink_wq(struct task *t)
 {
-	eb32_delete(&t->wq);
+	if (t->wq.node.leaf_p == TASK_WQ_WHEEL) {
+		LIST_DEL(&t->wheel);
+		task_per_thread[t->wq.node.pfx].wheel_cnt[t->wq.node.bit]--;
+		t->wq.node.leaf_p = NULL;
+	}
+	else
+		eb32_delete(&t->wq);
 	return t;
 }
 
@@ -593,7 +609,8 @@ static inline int thread_has_tasks(void)
 	        !LIST_ISEMPTY(&sched->tasklets[TL_URGENT]) |
 	        !LIST_ISEMPTY(&sched->tasklets[TL_NORMAL]) |
 	        !LIST_ISEMPTY(&sched->tasklets[TL_BULK])   |
-		!MT_LIST_ISEMPTY(&sched->shared_tasklet_list));
+		!MT_LIST_ISEMPTY(&sched->shared_tasklet_list) |
+		!MT_LIST_ISEMPTY(&sched->steal_list));
 }
 
 /* adds list item <item> to work list <work> and wake up the associated task */
@@ -25,6 +25,7 @@
 #include <common/buffer.h>
 #include <common/compat.h>
 #include <common/config.h>
+#include <common/hathreads.h>
 #include <common/ist.h>
 #include <common/mini-clist.h>
 #include <types/log.h>
@@ -49,33 +50,28 @@
  * ordering allows many TRACE() calls to be placed using copy-paste and just
  * change the message at the beginning. Only TRACE_DEVEL(), TRACE_ENTER() and
  * TRACE_LEAVE() will report the calling function's name.
+ *
+ * All of them first check <trace_sources_active>, which is only non-zero while
+ * at least one trace source is not stopped. This way, as long as no trace is
+ * enabled, a trace point only costs a single test of a read-mostly global
+ * variable and none of its arguments is evaluated.
  */
-#define TRACE(msg, mask, ...)    \
-	trace(TRACE_LEVEL,           (mask), TRACE_SOURCE, ist(TRC_LOC), NULL, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_USER(msg, mask, ...)			\
-	trace(TRACE_LEVEL_USER,      (mask), TRACE_SOURCE, ist(TRC_LOC), NULL, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_DATA(msg, mask, ...)  \
-	trace(TRACE_LEVEL_DATA,   (mask), TRACE_SOURCE, ist(TRC_LOC), NULL, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_PROTO(msg, mask, ...)    \
-	trace(TRACE_LEVEL_PROTO,     (mask), TRACE_SOURCE, ist(TRC_LOC), NULL, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_STATE(msg, mask, ...)    \
-	trace(TRACE_LEVEL_STATE,     (mask), TRACE_SOURCE, ist(TRC_LOC), NULL, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_DEVEL(msg, mask, ...)    \
-	trace(TRACE_LEVEL_DEVELOPER, (mask), TRACE_SOURCE, ist(TRC_LOC), __FUNCTION__, TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg))
-
-#define TRACE_ENTER(mask, ...)  \
-	trace(TRACE_LEVEL_DEVELOPER, (mask), TRACE_SOURCE, ist(TRC_LOC), __FUNCTION__, TRC_5ARGS(__VA_ARGS__,,,,,), ist("entering"))
-
-#define TRACE_LEAVE(mask, ...)  \
-	trace(TRACE_LEVEL_DEVELOPER, (mask), TRACE_SOURCE, ist(TRC_LOC), __FUNCTION__, TRC_5ARGS(__VA_ARGS__,,,,,), ist("leaving"))
-
-#define TRACE_POINT(mask, ...)  \
-	trace(TRACE_LEVEL_DEVELOPER, (mask), TRACE_SOURCE, ist(TRC_LOC), __FUNCTION__, TRC_5ARGS(__VA_ARGS__,,,,,), ist("in"))
+#define _TRACE(level, mask, func, msg, ...)				\
+	do {								\
+		if (unlikely(trace_sources_active))			\
+			trace((level), (mask), TRACE_SOURCE, ist(TRC_LOC), func, \
+			      TRC_5ARGS(__VA_ARGS__,,,,,), ist(msg));	\
+	} while (0)
+
+#define TRACE(msg, mask, ...)         _TRACE(TRACE_LEVEL,           mask, NULL,         msg,        __VA_ARGS__)
+#define TRACE_USER(msg, mask, ...)    _TRACE(TRACE_LEVEL_USER,      mask, NULL,         msg,        __VA_ARGS__)
+#define TRACE_DATA(msg, mask, ...)    _TRACE(TRACE_LEVEL_DATA,      mask, NULL,         msg,        __VA_ARGS__)
+#define TRACE_PROTO(msg, mask, ...)   _TRACE(TRACE_LEVEL_PROTO,     mask, NULL,         msg,        __VA_ARGS__)
+#define TRACE_STATE(msg, mask, ...)   _TRACE(TRACE_LEVEL_STATE,     mask, NULL,         msg,        __VA_ARGS__)
+#define TRACE_DEVEL(msg, mask, ...)   _TRACE(TRACE_LEVEL_DEVELOPER, mask, __FUNCTION__, msg,        __VA_ARGS__)
+#define TRACE_ENTER(mask, ...)        _TRACE(TRACE_LEVEL_DEVELOPER, mask, __FUNCTION__, "entering", __VA_ARGS__)
+#define TRACE_LEAVE(mask, ...)        _TRACE(TRACE_LEVEL_DEVELOPER, mask, __FUNCTION__, "leaving",  __VA_ARGS__)
+#define TRACE_POINT(mask, ...)        _TRACE(TRACE_LEVEL_DEVELOPER, mask, __FUNCTION__, "in",       __VA_ARGS__)
 
 #if defined(DEBUG_DEV) || defined(DEBUG_FULL)
 #    define DBG_TRACE(msg, mask, ...)        TRACE(msg, mask, __VA_ARGS__)
@@ -100,6 +96,7 @@
 #endif
 
 extern struct list trace_sources;
+extern unsigned int trace_sources_active;
 extern THREAD_LOCAL struct buffer trace_buf;
 
 void __trace(enum trace_level level, uint64_t mask, struct trace_source *src,
@@ -124,6 +121,19 @@ static inline char trace_event_char(uint64_t conf, uint64_t ev)
 	return (conf & ev) ? '+' : '-';
 }
 
+/* atomically changes the state of trace source <src> to <state> and maintains
+ * the number of active sources accordingly.
+ */
+static inline void trace_set_state(struct trace_source *src, enum trace_state state)
+{
+	enum trace_state old = HA_ATOMIC_XCHG(&src->state, state);
+
+	if (old == TRACE_STATE_STOPPED && state != TRACE_STATE_STOPPED)
+		HA_ATOMIC_ADD(&trace_sources_active, 1);
+	else if (old != TRACE_STATE_STOPPED && state == TRACE_STATE_STOPPED)
+		HA_ATOMIC_SUB(&trace_sources_active, 1);
+}
+
 /* registers trace source <source>. Modifies the list element!
  * The {start,pause,stop,report} events are not changed so the source may
  * preset them.
@@ -31,12 +31,16 @@
 #include <common/ticks.h>
 #include <common/time.h>
 
+#include <types/global.h>
 #include <types/listener.h>
 #include <types/quic_frame.h>
 #include <types/xprt_quic.h>
 
+#include <import/xxhash.h>
+
 #include <proto/quic_cc.h>
 #include <proto/quic_loss.h>
+#include <proto/quic_pacing.h>
 
 #include <openssl/rand.h>
 
@@ -51,8 +55,19 @@ void hexdump(const void *buf, size_t buflen, const char *title_fmt, ...);
 #endif
 
 extern struct pool_head *pool_head_quic_connection_id;
+extern int quic_proc_gen;
+extern unsigned long quic_mem_used;
+extern unsigned int quic_conn_mem_max;
+extern unsigned int quic_mem_max;
 
 int ssl_quic_initial_ctx(struct bind_conf *bind_conf);
+int qc_snd_frm(struct connection *conn, const struct quic_frame *frm);
+
+/* Return the current date in microseconds. */
+static inline uint64_t quic_now_us(void)
+{
+	return now_us;
+}
 
 /*
  * Returns the required length in bytes to encode <cid> QUIC connection ID.
@@ -156,8 +171,23 @@ static inline void quic_connection_id_to_frm_cpy(struct quic_frame *dst,
 	to->stateless_reset_token = src->stateless_reset_token;
 }
 
+/* Returns the thread encoded in the first byte of <cid> connection ID
+ * generated by new_quic_connection_id().
+ */
+static inline unsigned int quic_cid_tid(const unsigned char *cid)
+{
+	return *cid % global.nbthread;
+}
+
+int quic_stateless_reset_token_build(unsigned char *token,
+                                     const unsigned char *cid, size_t cidlen);
+
 /*
- * Allocate a new CID and attach it to <root> ebtree.
+ * Allocate a new CID and attach it to <root> ebtree. Its first byte is
+ * the ID of the current thread so that the datagrams for this CID may be
+ * steered to this thread without any lookup (see quic_cid_tid()). With
+ * "quic-handover", its second byte is the generation of the process, so
+ * that the datagrams for this CID may be forwarded to it after a reload.
  * Returns the new CID if succedded, NULL if not.
  */
 static inline struct quic_connection_id *
@@ -170,12 +200,19 @@ new_quic_connection_id(struct eb_root *root, int seq_num)
 		return NULL;
 
 	cid->cid.len = QUIC_CID_LEN;
-	if (RAND_bytes(cid->cid.data, cid->cid.len) != 1 ||
-	    RAND_bytes(cid->stateless_reset_token, sizeof cid->stateless_reset_token) != 1) {
+	if (RAND_bytes(cid->cid.data, cid->cid.len) != 1) {
 		fprintf(stderr, "Could not generate %d random bytes\n", cid->cid.len);
 		goto err;
 	}
 
+	cid->cid.data[0] = tid;
+	if (quic_proc_gen >= 0)
+		cid->cid.data[1] = quic_proc_gen;
+	/* Derived from the final CID so that it may be recomputed from it alone. */
+	if (!quic_stateless_reset_token_build(cid->stateless_reset_token,
+	                                      cid->cid.data, cid->cid.len))
+		goto err;
+
 	cid->seq_num.key = seq_num;
 	cid->retire_prior_to = 0;
 	eb64_insert(root, &cid->seq_num);
@@ -187,6 +224,15 @@ new_quic_connection_id(struct eb_root *root, int seq_num)
 	return NULL;
 }
 
+/* Return the ACK range with <i> as rank in <qars> ACK ranges, the first one
+ * (0 rank) being the one with the largest packet numbers.
+ */
+static inline struct quic_ack_range *quic_ack_range_get(struct quic_ack_ranges *qars,
+                                                        size_t i)
+{
+	return &qars->arngs[(qars->head + i) & (QUIC_MAX_ACK_RANGES - 1)];
+}
+
 /* The maximum size of a variable-length QUIC integer encoded with 1 byte */
 #define QUIC_VARINT_1_BYTE_MAX       ((1UL <<  6) - 1)
 /* The maximum size of a variable-length QUIC integer encoded with 2 bytes */
@@ -410,20 +456,38 @@ static inline size_t max_stream_data_size(size_t sz, size_t ilen, size_t dlen)
  */
 static inline int quic_dec_int(uint64_t *val, const unsigned char **buf, const unsigned char *end)
 {
-	size_t len;
-
-	if (*buf >= end)
-		return 0;
+	const unsigned char *p = *buf;
 
-	len = 1 << (**buf >> QUIC_VARINT_BYTE_0_SHIFT);
-	if (*buf + len > end)
+	if (p >= end)
 		return 0;
 
-	*val = *(*buf)++ & QUIC_VARINT_BYTE_0_BITMASK;
-	while (--len)
-		*val = (*val << 8) | *(*buf)++;
-
-	return 1;
+	/* Each length is read at once from the network byte order instead of
+	 * one byte at a time, the length bits being masked afterwards.
+	 */
+	switch (*p >> QUIC_VARINT_BYTE_0_SHIFT) {
+	case 0:
+		*val = *p;
+		*buf = p + 1;
+		return 1;
+	case 1:
+		if (end - p < 2)
+			return 0;
+		*val = read_n16(p) & 0x3fff;
+		*buf = p + 2;
+		return 1;
+	case 2:
+		if (end - p < 4)
+			return 0;
+		*val = read_n32(p) & 0x3fffffff;
+		*buf = p + 4;
+		return 1;
+	default:
+		if (end - p < 8)
+			return 0;
+		*val = read_n64(p) & 0x3fffffffffffffffULL;
+		*buf = p + 8;
+		return 1;
+	}
 }
 
 /*
@@ -534,6 +598,7 @@ static inline void quic_transport_params_init(struct quic_transport_params *p, i
 	if (server)
 		p->with_stateless_reset_token      = 1;
 	p->active_connection_id_limit          = 8;
+	p->min_ack_delay                       = QUIC_DFLT_MIN_ACK_DELAY;
 
 }
 
@@ -641,6 +706,16 @@ static inline int quic_transport_param_decode(struct quic_transport_params *p, i
 		*buf += len;
 		p->initial_source_connection_id_present = 1;
 		break;
+	case QUIC_TP_RETRY_SOURCE_CONNECTION_ID:
+		if (!server || len >= sizeof p->retry_source_connection_id.data)
+			return 0;
+
+		if (len)
+			memcpy(p->retry_source_connection_id.data, *buf, len);
+		p->retry_source_connection_id.len = len;
+		*buf += len;
+		p->retry_source_connection_id_present = 1;
+		break;
 	case QUIC_TP_STATELESS_RESET_TOKEN:
 		if (!server || len != sizeof p->stateless_reset_token)
 			return 0;
@@ -707,6 +782,10 @@ static inline int quic_transport_param_decode(struct quic_transport_params *p, i
 		if (!quic_dec_int(&p->active_connection_id_limit, buf, end))
 			return 0;
 		break;
+	case QUIC_TP_MIN_ACK_DELAY:
+		if (!quic_dec_int(&p->min_ack_delay, buf, end) || !p->min_ack_delay)
+			return 0;
+		break;
 	default:
 		*buf += len;
 	};
@@ -820,6 +899,11 @@ static inline int quic_transport_params_encode(unsigned char *buf, const unsigne
 		if (p->with_preferred_address &&
 			!quic_transport_param_enc_pref_addr(&pos, end, &p->preferred_address))
 			return 0;
+		if (p->retry_source_connection_id_present &&
+		    !quic_transport_param_enc_mem(&pos, end, QUIC_TP_RETRY_SOURCE_CONNECTION_ID,
+		                                  p->retry_source_connection_id.data,
+		                                  p->retry_source_connection_id.len))
+			return 0;
 	}
 
 	if (!quic_transport_param_enc_mem(&pos, end,
@@ -895,6 +979,11 @@ static inline int quic_transport_params_encode(unsigned char *buf, const unsigne
 	                                          p->active_connection_id_limit))
 	    return 0;
 
+	/* Advertise the support of the ACK_FREQUENCY frames. */
+	if (p->min_ack_delay &&
+	    !quic_transport_param_enc_int(&pos, end, QUIC_TP_MIN_ACK_DELAY, p->min_ack_delay))
+	    return 0;
+
 	return pos - head;
 }
 
@@ -906,6 +995,8 @@ static inline int quic_transport_params_decode(struct quic_transport_params *p,
 	pos = buf;
 
 	quic_transport_params_init(p, server);
+	/* Only set if the peer supports the ACK_FREQUENCY extension. */
+	p->min_ack_delay = 0;
 	while (pos != end) {
 		uint64_t type, len;
 
@@ -927,6 +1018,10 @@ static inline int quic_transport_params_decode(struct quic_transport_params *p,
 	    !p->initial_source_connection_id_present)
 		return 0;
 
+	/* The minimum ACK delay may not be greater than the maximum one. */
+	if (p->min_ack_delay > p->max_ack_delay * 1000)
+		return 0;
+
 	return 1;
 }
 
@@ -955,12 +1050,14 @@ static inline void quic_pktns_init(struct quic_pktns *pktns)
 	pktns->tx.time_of_last_eliciting = 0;
 	pktns->tx.loss_time = TICK_ETERNITY;
 	pktns->tx.in_flight = 0;
+	memset(&pktns->tx.ecn_counts, 0, sizeof pktns->tx.ecn_counts);
 
 	pktns->rx.largest_pn = -1;
 	pktns->rx.nb_ack_eliciting = 0;
-	LIST_INIT(&pktns->rx.ack_ranges.list);
+	pktns->rx.ack_ranges.head = 0;
 	pktns->rx.ack_ranges.sz = 0;
 	pktns->rx.ack_ranges.enc_sz = 0;
+	memset(&pktns->rx.ecn_counts, 0, sizeof pktns->rx.ecn_counts);
 
 	pktns->flags = 0;
 }
@@ -1009,13 +1106,27 @@ static inline void quic_path_init(struct quic_path *path, int ipv4,
 	size_t max_dgram_sz;
 
 	max_dgram_sz = ipv4 ? QUIC_INITIAL_IPV4_MTU : QUIC_INITIAL_IPV6_MTU;
-	quic_cc_init(&path->cc, algo, qc);
 	quic_loss_init(&path->loss);
 	path->mtu = max_dgram_sz;
 	path->cwnd = min(10 * max_dgram_sz, max(max_dgram_sz << 1, 14720UL));
 	path->min_cwnd = max_dgram_sz << 1;
 	path->in_flight = 0;
 	path->in_flight_ae_pkts = 0;
+	path->delivered = 0;
+	path->delivered_time = quic_now_us();
+	path->first_sent_time = path->delivered_time;
+	path->app_limited = 0;
+	quic_pacer_init(&path->pacer);
+	path->ecn.state = (global.tune.options & GTUNE_QUIC_NO_ECN) ?
+		QUIC_ECN_ST_FAILED : QUIC_ECN_ST_TESTING;
+	path->ecn.nb_test_pkts = 0;
+	path->ecn.nb_test_lost = 0;
+	path->pmtud.state = QUIC_PMTUD_ST_BASE;
+	path->pmtud.low = path->pmtud.high = path->pmtud.size = max_dgram_sz;
+	path->pmtud.pn = -1;
+	path->pmtud.nb_lost = 0;
+	/* The congestion controller initializes its state from the path. */
+	quic_cc_init(&path->cc, algo, qc);
 }
 
 /* Return 1 if <pktns> matches with the Application packet number space of <conn> connection
@@ -1100,6 +1211,15 @@ static inline const unsigned char *q_buf_end(struct q_buf *buf)
 	return buf->end;
 }
 
+/*
+ * Return the pointer to one past the end of <buf> buffer for a datagram
+ * of at most <mtu> bytes.
+ */
+static inline const unsigned char *q_buf_end_mtu(struct q_buf *buf, size_t mtu)
+{
+	return buf->area + mtu < buf->end ? buf->area + mtu : buf->end;
+}
+
 /*
  * Set the position of <buf> buffer to <pos> value.
  */
@@ -1137,17 +1257,151 @@ static inline int qc_pkt_long(const struct quic_rx_packet *pkt)
 	return pkt->type != QUIC_PACKET_TYPE_SHORT;
 }
 
+/* Accounts for <bytes> more bytes of memory used by <qc>, also added to the
+ * total of all the QUIC connections.
+ */
+static inline void qc_mem_add(struct quic_conn *qc, size_t bytes)
+{
+	qc->mem_used += bytes;
+	_HA_ATOMIC_ADD(&quic_mem_used, bytes);
+}
+
+/* Accounts for <bytes> bytes of memory released by <qc>. */
+static inline void qc_mem_sub(struct quic_conn *qc, size_t bytes)
+{
+	qc->mem_used -= bytes;
+	_HA_ATOMIC_SUB(&quic_mem_used, bytes);
+}
+
+/* Returns 1 if <qc> uses more memory than allowed by "tune.quic.conn-mem-max"
+ * or if all the QUIC connections together use more than "tune.quic.mem-max",
+ * in which case the peer must be slowed down, 0 if not.
+ */
+static inline int qc_mem_pressure(const struct quic_conn *qc)
+{
+	return (quic_conn_mem_max && qc->mem_used > quic_conn_mem_max) ||
+	       (quic_mem_max && quic_mem_used > quic_mem_max);
+}
+
 /* Increment the reference counter of <pkt> */
 static inline void quic_rx_packet_refinc(struct quic_rx_packet *pkt)
 {
 	pkt->refcnt++;
 }
 
-/* Decrement the reference counter of <pkt> */
+/* Initialize <tree> QUIC connection ID tree. */
+static inline void quic_cid_tree_init(struct quic_cid_tree *tree)
+{
+	tree->root = EB_ROOT_UNIQUE;
+	HA_RWLOCK_INIT(&tree->lock);
+}
+
+/* Allocate and initialize an array of QUIC_CID_TREES_CNT connection ID trees.
+ * Returns NULL if failed.
+ */
+static inline struct quic_cid_tree *quic_cid_trees_new(void)
+{
+	int i;
+	struct quic_cid_tree *trees;
+
+	trees = calloc(QUIC_CID_TREES_CNT, sizeof *trees);
+	if (!trees)
+		return NULL;
+
+	for (i = 0; i < QUIC_CID_TREES_CNT; i++)
+		quic_cid_tree_init(&trees[i]);
+
+	return trees;
+}
+
+/* Returns the tree of <trees> array of QUIC_CID_TREES_CNT trees which
+ * <cid> connection ID with <len> as length belongs to.
+ */
+static inline struct quic_cid_tree *quic_cid_tree_get(struct quic_cid_tree *trees,
+                                                      const unsigned char *cid, size_t len)
+{
+	return &trees[XXH32(cid, len, 0) & (QUIC_CID_TREES_CNT - 1)];
+}
+
+/* Look up <cid> connection ID with <len> as length in <tree>.
+ * Returns the node found if any, NULL if not.
+ */
+static inline struct ebmb_node *quic_cid_lookup(struct quic_cid_tree *tree,
+                                                const unsigned char *cid, size_t len)
+{
+	struct ebmb_node *node;
+
+	HA_RWLOCK_RDLOCK(QUIC_LOCK, &tree->lock);
+	node = ebmb_lookup(&tree->root, cid, len);
+	HA_RWLOCK_RDUNLOCK(QUIC_LOCK, &tree->lock);
+
+	return node;
+}
+
+/* Insert <node> whose key is <len> bytes long into <tree>.
+ * Returns <node> if inserted, or the node already owning this key if any.
+ */
+static inline struct ebmb_node *quic_cid_insert(struct quic_cid_tree *tree,
+                                                struct ebmb_node *node, size_t len)
+{
+	struct ebmb_node *ret;
+
+	HA_RWLOCK_WRLOCK(QUIC_LOCK, &tree->lock);
+	ret = ebmb_insert(&tree->root, node, len);
+	HA_RWLOCK_WRUNLOCK(QUIC_LOCK, &tree->lock);
+
+	return ret;
+}
+
+/* Remove <node> from <tree>. */
+static inline void quic_cid_delete(struct quic_cid_tree *tree, struct ebmb_node *node)
+{
+	HA_RWLOCK_WRLOCK(QUIC_LOCK, &tree->lock);
+	ebmb_delete(node);
+	HA_RWLOCK_WRUNLOCK(QUIC_LOCK, &tree->lock);
+}
+
+/* Increment the reference counter of <dgram> */
+static inline void quic_dgram_refinc(struct quic_dgram *dgram)
+{
+	HA_ATOMIC_ADD(&dgram->refcnt, 1);
+}
+
+/* Decrement the reference counter of <dgram>. It may be shared with
+ * the thread it has been handed over to.
+ */
+static inline void quic_dgram_refdec(struct quic_dgram *dgram)
+{
+	if (!HA_ATOMIC_SUB(&dgram->refcnt, 1))
+		pool_free(pool_head_quic_dgram, dgram);
+}
+
+/* Allocate a new datagram buffer with a reference counter set to 1.
+ * Returns NULL if failed.
+ */
+static inline struct quic_dgram *quic_dgram_new(void)
+{
+	struct quic_dgram *dgram;
+
+	dgram = pool_alloc(pool_head_quic_dgram);
+	if (dgram) {
+		dgram->refcnt = 1;
+		MT_LIST_INIT(&dgram->list);
+	}
+
+	return dgram;
+}
+
+/* Decrement the reference counter of <pkt>, releasing also the reference
+ * it holds on its datagram.
+ */
 static inline void quic_rx_packet_refdec(struct quic_rx_packet *pkt)
 {
-	if (!--pkt->refcnt)
+	if (!--pkt->refcnt) {
+		if (pkt->dgram)
+			quic_dgram_refdec(pkt->dgram);
 		pool_free(pool_head_quic_rx_packet, pkt);
+	}
 }
 
 /* Add <pkt> RX packet to <list>, incrementing its reference counter. */
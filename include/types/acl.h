@@ -148,9 +148,28 @@ struct acl_term_suite {
 	struct list terms;          /* list of acl_terms */
 };
 
+/* One step of the compiled program of a condition, which is a flat array of
+ * the terms of all of its suites. A suite ends on its first term which does
+ * not pass or after its last term, and the evaluation then goes on with the
+ * first term of the next suite.
+ */
+struct acl_op {
+	struct acl *acl;            /* acl to evaluate */
+	int neg;                    /* 1 if the ACL result must be negated */
+	int slot;                   /* result slot shared with the same ACL's terms, -1 if none */
+	int next;                   /* index of the first term of the next suite */
+};
+
+/* max number of ACL results shared by the terms of a condition */
+#define ACL_COND_MAX_SLOTS 16
+
 struct acl_cond {
 	struct list list;           /* Some specific tests may use multiple conditions */
 	struct list suites;         /* list of acl_term_suites */
+	struct list all;            /* member of the list of all conditions */
+	struct acl_op *prog;        /* compiled program, made of <nb_ops> terms */
+	int nb_ops;                 /* number of terms in <prog> */
+	int nb_slots;               /* number of shared ACL results in <prog> */
 	enum acl_cond_pol pol;      /* polarity: ACL_COND_IF / ACL_COND_UNLESS */
 	unsigned int use;           /* or'ed bit mask of all suites's SMP_USE_* */
 	unsigned int val;           /* or'ed bit mask of all suites's SMP_VAL_* */
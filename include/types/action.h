@@ -145,6 +145,7 @@ struct act_rule {
 			struct sample_expr *expr;
 			const char *name;
 			enum vars_scope scope;
+			unsigned int idx;
 		} vars;
 		struct {
 			int sc;
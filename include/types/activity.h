@@ -45,6 +45,7 @@ struct activity {
 	unsigned int tasksw;       // total number of task switches
 	unsigned int empty_rq;     // calls to process_runnable_tasks() with nothing for the thread
 	unsigned int long_rq;      // process_runnable_tasks() left with tasks in the run queue
+	unsigned int stolen;       // migratable tasks stolen from other threads
 	unsigned int cpust_total;  // sum of half-ms stolen per thread
 	/* one cache line */
 	struct freq_ctr cpust_1s;  // avg amount of half-ms stolen over last second
@@ -55,6 +56,8 @@ struct activity {
 	unsigned int accq_full;    // accept queue connection not pushed because full
 	unsigned int pool_fail;    // failed a pool allocation
 	unsigned int buf_wait;     // waited on a buffer allocation
+	unsigned int buf_hot;      // buffer allocations served by the hot buffer cache
+	unsigned int busy_spin;    // null-timeout polls performed for busy-polling
 #if defined(DEBUG_DEV)
 	/* keep these ones at the end */
 	unsigned int ctr0;         // general purposee debug counter
@@ -65,6 +68,34 @@ struct activity {
 	char __end[0] __attribute__((aligned(64))); // align size to 64.
 };
 
+/* per-function scheduler activity, collected while task profiling is enabled.
+ * Entries are indexed by a hash of the function's address, entry 0 collects
+ * the functions which collided with another one.
+ */
+#define SCHED_ACT_HASH_BITS    8
+#define SCHED_ACT_HASH_BUCKETS (1U << SCHED_ACT_HASH_BITS)
+
+struct sched_activity {
+	const void *func;          // function called by the scheduler, NULL if unused
+	uint64_t calls;            // number of calls
+	uint64_t cpu_time;         // total CPU time spent in the calls (ns)
+	uint64_t lat_time;         // total scheduling latency before the calls (ns, tasks only)
+};
+
+/* size of the ring receiving the slow tasks reports */
+#define SLOW_TASKS_RING_SIZE   65536
+
+/* owner of a task or tasklet, sampled before its run so that it may still be
+ * reported once the run turned out to be slow, even if the owner was released
+ * meanwhile. Only streams are currently decoded.
+ */
+struct slow_task_owner {
+	const struct proxy *fe;    // frontend of the stream, or NULL
+	const struct proxy *be;    // backend of the stream, or NULL
+	const struct server *srv;  // server of the stream, or NULL
+	unsigned int uniq_id;      // stream's unique ID
+};
+
 #endif /* _TYPES_ACTIVITY_H */
 
 /*
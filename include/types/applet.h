@@ -86,6 +86,11 @@ struct appctx {
 			struct list wake_on_write;
 			int die;
 		} hlua_cosocket;                /* used by the Lua cosockets */
+		struct {
+			void *ocsp;             /* certificate_ocsp being updated, NULL once processed */
+			struct buffer buf;      /* HTTP request, then response (allocated) */
+			int sent;               /* non-zero once the request was sent */
+		} ssl_ocsp;                     /* used by the OCSP responses updater */
 		struct {
 			struct hlua *hlua;
 			int flags;
@@ -130,6 +135,9 @@ struct appctx {
 			unsigned int flags;	/* STAT_* */
 			int iid, type, sid;	/* proxy id, type and service id if bounding of stats is enabled */
 			int st_code;		/* the status code returned by an action */
+			int budget;		/* objects left to dump before yielding */
+			unsigned long since;	/* STAT_CHANGED: dump the objects changed since this date */
+			void *priv;		/* private data of the services using this context */
 		} stats;
 		struct {
 			struct bref bref;	/* back-reference from the session being dumped */
@@ -149,11 +157,16 @@ struct appctx {
 		struct {
 			void *target;		/* table we want to dump, or NULL for all */
 			struct stktable *t;	/* table being currently dumped (first if NULL) */
-			struct stksess *entry;	/* last entry we were trying to dump (or first if NULL) */
+			struct stksess *batch[STKTABLE_DUMP_BATCH]; /* referenced entries being dumped */
+			unsigned int batch_cnt;	/* number of entries in <batch> */
+			unsigned int batch_pos;	/* next entry of <batch> to dump */
+			unsigned int kill_mask;	/* entries of <batch> to remove once dumped */
+			unsigned int shard;	/* shard of the table the entries of <batch> belong to */
 			long long value[STKTABLE_FILTER_LEN];	     /* value to compare against */
 			signed char data_type[STKTABLE_FILTER_LEN];  /* type of data to compare, or -1 if none */
 			signed char data_op[STKTABLE_FILTER_LEN];    /* operator (STD_OP_*) when data_type set */
 			char action;            /* action on the table : one of STK_CLI_ACT_* */
+			char binary;            /* non-zero to dump the entries in the snapshot format */
 		} table;
 		struct {
 			unsigned int display_flags;
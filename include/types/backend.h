@@ -54,6 +54,7 @@
 #define BE_LB_RR_DYN    0x00000  /* dynamic round robin (default) */
 #define BE_LB_RR_STATIC 0x00001  /* static round robin */
 #define BE_LB_RR_RANDOM 0x00002  /* random round robin */
+#define BE_LB_RR_EWMA   0x00003  /* random draws weighed by response times */
 
 /* BE_LB_CB_* is used with BE_LB_KIND_CB */
 #define BE_LB_CB_LC     0x00000  /* least-connections */
@@ -85,6 +86,7 @@
 #define BE_LB_ALGO_LC   (BE_LB_KIND_CB | BE_LB_NEED_NONE | BE_LB_CB_LC)    /* least connections */
 #define BE_LB_ALGO_FAS  (BE_LB_KIND_CB | BE_LB_NEED_NONE | BE_LB_CB_FAS)   /* first available server */
 #define BE_LB_ALGO_SRR  (BE_LB_KIND_RR | BE_LB_NEED_NONE | BE_LB_RR_STATIC) /* static round robin */
+#define BE_LB_ALGO_EWMA (BE_LB_KIND_RR | BE_LB_NEED_NONE | BE_LB_RR_EWMA)   /* peak-EWMA of response times */
 #define BE_LB_ALGO_SH	(BE_LB_KIND_HI | BE_LB_NEED_ADDR | BE_LB_HASH_SRC) /* hash: source IP */
 #define BE_LB_ALGO_UH	(BE_LB_KIND_HI | BE_LB_NEED_HTTP | BE_LB_HASH_URI) /* hash: HTTP URI  */
 #define BE_LB_ALGO_PH	(BE_LB_KIND_HI | BE_LB_NEED_HTTP | BE_LB_HASH_PRM) /* hash: HTTP URL parameter */
@@ -136,6 +138,22 @@
  */
 #define BE_WEIGHT_SCALE 16
 
+/* "balance ewma" keeps for each server a peak-EWMA of its response times, in
+ * 1/2^BE_LB_EWMA_SHIFT ms. A sample above the average replaces it at once, a
+ * lower one moves it by the ratio of the time elapsed since the previous one
+ * to the decay time, and by at least 1/BE_LB_EWMA_MIN_STEP. The samples are
+ * capped to BE_LB_EWMA_MAX_MS and the servers in flight to BE_LB_EWMA_MAX_CUR
+ * so that the costs always fit in 64 bits once multiplied by a weight. A
+ * server without any sample yet costs BE_LB_EWMA_PROBE while it serves one
+ * request, so it receives a single one before its response time is known.
+ */
+#define BE_LB_EWMA_SHIFT     4
+#define BE_LB_EWMA_DECAY     10000          /* default decay time (ms) */
+#define BE_LB_EWMA_MIN_STEP  32
+#define BE_LB_EWMA_MAX_MS    ((1U << 24) - 1)
+#define BE_LB_EWMA_MAX_CUR   ((1U << 20) - 1)
+#define BE_LB_EWMA_PROBE     (1ULL << 49)
+
 /* LB parameters for all algorithms */
 struct lbprm {
 	union { /* LB parameters depending on the algo type */
@@ -158,7 +176,9 @@ struct lbprm {
 	int   arg_opt2;			/* extra option 2 for the LB algo (algo-specific) */
 	int   arg_opt3;			/* extra option 3 for the LB algo (algo-specific) */
 	struct server *fbck;		/* first backup server when !PR_O_USE_ALL_BK, or NULL */
-	__decl_hathreads(HA_SPINLOCK_T lock);
+	int defer_updates;		/* > 0 while the rebuilds of the LB structures are deferred */
+	int pending_updates;		/* a rebuild was deferred, to be done once <defer_updates> is zero */
+	__decl_hathreads(HA_RWLOCK_T lock); /* taken for reading by the lookups which do not change the LB state */
 
 	/* Call backs for some actions. Any of them may be NULL (thus should be ignored). */
 	void (*update_server_eweight)(struct server *);  /* to be called after eweight change */
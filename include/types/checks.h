@@ -170,6 +170,7 @@ struct check {
 	int alpn_len;                           /* ALPN string length */
 	const struct mux_proto_list *mux_proto; /* the mux to use for all outgoing connections (specified by the "proto" keyword) */
 	int via_socks4;                         /* check the connection via socks4 proxy */
+	int keep_alive;                         /* keep the connection between HTTP checks */
 };
 
 #define TCPCHK_OPT_NONE            0x0000  /* no options specified, default */
@@ -32,6 +32,16 @@
 #include <zlib.h>
 #endif
 
+#if defined(USE_BROTLI)
+#include <brotli/encode.h>
+#endif
+
+#if defined(USE_ZSTD)
+/* needed for the custom allocator of the contexts */
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#endif
+
 #include <common/buffer.h>
 
 struct comp {
@@ -53,6 +63,12 @@ struct comp_ctx {
 	void *zlib_prev;
 	void *zlib_pending_buf;
 	void *zlib_head;
+#endif
+#if defined(USE_BROTLI)
+	BrotliEncoderState *brotli; /* brotli encoder, NULL if not used */
+#endif
+#if defined(USE_ZSTD)
+	ZSTD_CCtx *zstd;            /* zstd encoder, NULL if not used */
 #endif
 	int cur_lvl;
 };
@@ -23,8 +23,41 @@
 #ifndef _TYPES_COUNTERS_H
 #define _TYPES_COUNTERS_H
 
+/* Log-linear latency histogram, in the spirit of HDR histograms: values below
+ * 4 have their own bucket, then each power of two is split into 4 buckets,
+ * which keeps the relative error below 25% over the whole 32-bit range in 124
+ * buckets (about 500 bytes). Buckets are atomically incremented by all
+ * threads and only read at dump time. See proto/counters.h.
+ */
+#define LAT_HIST_SUB_BITS  2
+#define LAT_HIST_BUCKETS   ((32 - 1) << LAT_HIST_SUB_BITS)
+
+struct lat_hist {
+	unsigned int bucket[LAT_HIST_BUCKETS];  /* number of values per bucket */
+	unsigned long long sum;                 /* sum of all values */
+};
+
+/* Counters updated for each transfer or request. When a counters block has
+ * them, each thread accumulates its own share in its own cache line, and the
+ * shares are added to the shared counters of the same name when read. See
+ * COUNTERS_ADD() and COUNTERS_GET() in proto/counters.h.
+ */
+struct thr_counters {
+	long long bytes_in;                     /* number of bytes transferred from the client to the server */
+	long long bytes_out;                    /* number of bytes transferred from the server to the client */
+
+	union {
+		struct {
+			long long cum_req;      /* cumulated number of processed HTTP requests */
+			long long rsp[6];       /* http response codes */
+		} http;
+	} p;                                    /* protocol-specific stats */
+	char __end[0] __attribute__((aligned(64))); // align size to 64.
+};
+
 /* counters used by listeners and frontends */
 struct fe_counters {
+	struct thr_counters *thr;               /* per-thread shares (global.nbthread), or NULL */
 	unsigned int conn_max;                  /* max # of active sessions */
 	long long    cum_conn;                  /* cumulated number of received connections */
 	long long    cum_sess;                  /* cumulated number of accepted connections */
@@ -65,6 +98,7 @@ struct fe_counters {
 
 /* counters used by listeners and frontends */
 struct be_counters {
+	struct thr_counters *thr;               /* per-thread shares (global.nbthread), or NULL */
 	unsigned int conn_max;                  /* max # of active sessions */
 	long long    cum_conn;                  /* cumulated number of received connections */
 	long long    cum_sess;                  /* cumulated number of accepted connections */
@@ -102,6 +136,7 @@ struct be_counters {
 
 	unsigned int q_time, c_time, d_time, t_time; /* sums of conn_time, queue_time, data_time, total_time */
 	unsigned int qtime_max, ctime_max, dtime_max, ttime_max; /* maximum of conn_time, queue_time, data_time, total_time observed */
+	struct lat_hist q_hist, c_hist, d_hist, t_hist; /* distributions of queue_time, conn_time, data_time, total_time (ms) */
 
 	union {
 		struct {
@@ -23,6 +23,7 @@
 #define _TYPES_DNS_H
 
 #include <eb32tree.h>
+#include <eb64tree.h>
 
 #include <common/mini-clist.h>
 #include <common/hathreads.h>
@@ -45,10 +46,20 @@ extern struct pool_head *dns_requester_pool;
 #define DNS_MAX_LABEL_SIZE   63
 #define DNS_MAX_NAME_SIZE    255
 #define DNS_MAX_UDP_MESSAGE  8192
+#define DNS_MAX_TCP_MESSAGE  65535
+
+/* room for the largest query we may build: header, name, question and EDNS */
+#define DNS_MAX_QUERY_SIZE   512
+
+/* maximum number of queries sent at once to a name server */
+#define DNS_SEND_BATCH       16
 
 /* DNS minimum record size: 1 char + 1 NULL + type + class */
 #define DNS_MIN_RECORD_SIZE  (1 + 1 + 2 + 2)
 
+/* longest time an answer is kept in the answers cache (seconds) */
+#define DNS_CACHE_MAX_TTL    86400
+
 /* DNS smallest fqdn 'a.gl' size */
 # define DNS_SMALLEST_FQDN_SIZE 4
 
@@ -177,6 +188,7 @@ struct dns_resolvers {
 	unsigned int accepted_payload_size; /* maximum payload size we accept for responses */
 	int          nb_nameservers;        /* total number of active nameservers in a resolvers section */
 	int          resolve_retries;       /* number of retries before giving up */
+	int          tcp_fallback;          /* retry the truncated responses over TCP */
 	struct {                            /* time to: */
 		int resolve;                /*     wait between 2 queries for the same resolution */
 		int retry;                  /*     wait for a response before retrying */
@@ -231,10 +243,27 @@ struct dns_nameserver {
 		long long too_big;      /* - too big response */
 		long long outdated;     /* - outdated response (server slower than the other ones) */
 		long long truncated;    /* - truncated response */
+		long long tcp;          /* - truncated response retried over TCP */
 	} counters;
+	struct list tcp_queries;        /* TCP queries in progress (dns_tcp_query) */
 	struct list list;               /* nameserver chained list */
 };
 
+/* Query sent over TCP to a name server after a truncated response. The query
+ * is sent then the response is received into <buf>, both being prefixed with
+ * their length over 2 bytes.
+ */
+struct dns_tcp_query {
+	struct dns_nameserver *ns;      /* name server the query is sent to */
+	struct dns_resolution *res;     /* resolution waiting for the response */
+	int            fd;              /* socket of the TCP connection */
+	int            sending;         /* non-zero until the query is fully sent */
+	unsigned int   len;             /* bytes to send, or to receive */
+	unsigned int   done;            /* bytes already sent, or received */
+	unsigned char *buf;             /* DNS_MAX_TCP_MESSAGE + 2 bytes */
+	struct list    list;            /* name server's TCP queries list */
+};
+
 struct dns_options {
 	int family_prio; /* which IP family should the resolver use when both are returned */
 	struct {
@@ -277,6 +306,8 @@ struct dns_resolution {
 	int                   try;                 /* current resolution try */
 	int                   nb_queries;          /* count number of queries sent */
 	int                   nb_responses;        /* count number of responses received */
+	int                   queued;              /* the query waits for dns_send_queries() */
+	struct dns_tcp_query *tcp;                 /* TCP query in progress, if any */
 
 	struct dns_response_packet response; /* structure hosting the DNS response */
 	struct dns_query_item response_query_records[DNS_MAX_QUERY_RECORDS]; /* <response> query records */
@@ -284,6 +315,23 @@ struct dns_resolution {
 	struct list list; /* resolution list */
 };
 
+/* Answer of the cache shared by all the resolvers sections, for a name and a
+ * query type. A valid answer holds the raw response it was parsed from, so
+ * that it may be replayed to any resolution asking for the same name. A
+ * negative answer (NXDOMAIN) holds no data.
+ */
+struct dns_cache_entry {
+	struct eb64_node node;                /* key: hash of <name> and <query_type> */
+	struct list      list;                /* entries chained in insertion order */
+	unsigned int     expire;              /* expiration date (ticks) */
+	int              status;              /* RSLV_STATUS_VALID or RSLV_STATUS_NX */
+	int              query_type;          /* DNS_RTYPE_* */
+	int              name_len;            /* length of <name> */
+	char             name[DNS_MAX_NAME_SIZE + 1]; /* lower case domain name label */
+	int              len;                 /* length of <data> */
+	unsigned char    data[0];             /* raw DNS response */
+};
+
 /* Structure used to describe the owner of a DNS resolution. */
 struct dns_requester {
 	enum obj_type         *owner;       /* pointer to the owner (server or dns_srvrq) */
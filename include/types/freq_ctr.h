@@ -34,6 +34,22 @@ struct freq_ctr {
 	unsigned int prev_ctr; /* value for last period */
 };
 
+/* One thread's part of a freq_ctr_thr, alone in its cache line. */
+struct freq_ctr_slot {
+	struct freq_ctr ctr;
+	char __end[0] __attribute__((aligned(64))); // align size to 64.
+};
+
+/* The freq_ctr_thr counter is a freq_ctr split in per-thread slots. Each
+ * thread only updates its own slot, without atomic operations nor sharing a
+ * cache line with the other threads, and the readers sum all the slots. Until
+ * the slots are allocated, <ctr> is used as a regular shared freq_ctr.
+ */
+struct freq_ctr_thr {
+	struct freq_ctr_slot *slot;    /* global.nbthread slots, or NULL */
+	struct freq_ctr ctr;           /* shared counter used without slots */
+};
+
 /* The generic freq_ctr_period counter counts a rate of events per period, where
  * the period has to be known by the user. The period is measured in ticks and
  * must be at least 2 ticks long. This form is slightly more CPU intensive than
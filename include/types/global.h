@@ -77,6 +77,13 @@
 #define GTUNE_STRICT_LIMITS      (1<<15)
 #define GTUNE_INSECURE_FORK      (1<<16)
 #define GTUNE_INSECURE_SETUID    (1<<17)
+#define GTUNE_QUIC_SOCK_PER_THR  (1<<18)
+#define GTUNE_QUIC_TXTIME        (1<<19)
+#define GTUNE_QUIC_NO_ECN        (1<<20)
+#define GTUNE_QUIC_GRO           (1<<21)
+#define GTUNE_USE_URING          (1<<22)
+#define GTUNE_SCHED_STEAL        (1<<23)
+#define GTUNE_SHARE_CHECKS       (1<<24)
 
 /* SSL server verify mode */
 enum {
@@ -100,14 +107,14 @@ struct global {
 	int ssl_used_backend;       /* non-zero if SSL is used in a backend */
 	int ssl_used_async_engines; /* number of used async engines */
 	unsigned int ssl_server_verify; /* default verify mode on servers side */
-	struct freq_ctr conn_per_sec;
-	struct freq_ctr sess_per_sec;
-	struct freq_ctr ssl_per_sec;
+	struct freq_ctr_thr conn_per_sec;
+	struct freq_ctr_thr sess_per_sec;
+	struct freq_ctr_thr ssl_per_sec;
 	struct freq_ctr ssl_fe_keys_per_sec;
 	struct freq_ctr ssl_be_keys_per_sec;
 	struct freq_ctr comp_bps_in;	/* bytes per second, before http compression */
 	struct freq_ctr comp_bps_out;	/* bytes per second, after http compression */
-	struct freq_ctr out_32bps;      /* #of 32-byte blocks emitted per second */
+	struct freq_ctr_thr out_32bps;  /* #of 32-byte blocks emitted per second */
 	unsigned long long out_bytes;   /* total #of bytes emitted */
 	int cps_lim, cps_max;
 	int sps_lim, sps_max;
@@ -142,6 +149,7 @@ struct global {
 		int runqueue_depth;/* max number of tasks to run at once */
 		int recv_enough;   /* how many input bytes at once are "enough" */
 		int bufsize;       /* buffer size in bytes, defaults to BUFSIZE */
+		int bufsize_small; /* size of the small buffers in bytes, 0 if disabled */
 		int maxrewrite;    /* buffer max rewrite size in bytes, defaults to MAXREWRITE */
 		int reserved_bufs; /* how many buffers can only be allocated for response */
 		int buf_limit;     /* if not null, how many total buffers may only be allocated */
@@ -162,6 +170,7 @@ struct global {
 		int pool_low_count;   /* max number of opened fd before we stop using new idle connections */
 		int pool_high_count;  /* max number of opened fd before we start killing idle connections when creating new connections */
 		unsigned short idle_timer; /* how long before an empty buffer is considered idle (ms) */
+		unsigned int busy_poll_max; /* max busy-polling time before sleeping (us), 0 = forever */
 	} tune;
 	struct {
 		char *prefix;           /* path prefix of unix bind socket */
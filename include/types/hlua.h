@@ -9,6 +9,8 @@
 #include <common/regex.h>
 #include <common/xref.h>
 
+#include <ebmbtree.h>
+
 #include <types/http_ana.h>
 #include <types/proxy.h>
 #include <types/server.h>
@@ -43,6 +45,9 @@ struct stream;
 
 #define HLUA_TXN_NOTERM   0x00000001
 
+/* hlua_function flags */
+#define HLUA_FCN_F_CACHEABLE 0x00000001 /* results may be cached in the stream */
+
 #define HLUA_CONCAT_BLOCSZ 2048
 
 enum hlua_exec {
@@ -59,6 +64,8 @@ enum hlua_exec {
 
 struct hlua {
 	lua_State *T; /* The LUA stack. */
+	int state_id; /* the state the stack belongs to: 0 is the shared state,
+	                 1 to nbthread are the per-thread states. */
 	int Tref; /* The reference of the stack in coroutine case.
 	             -1 for the main lua stack. */
 	int Mref; /* The reference of the memory context in coroutine case.
@@ -74,6 +81,9 @@ struct hlua {
 	struct list com; /* The list head of the signals attached to this task. */
 	struct ebpt_node node;
 	int gc_count;  /* number of items which need a GC */
+	int cache_ref; /* table of the cached results of the cacheable functions, or LUA_REFNIL */
+	const void *cache_rules;     /* rule list the cached results were computed in */
+	unsigned long long cache_in[2]; /* request and response bytes received at this time */
 };
 
 /* This is a part of the list containing references to functions
@@ -89,9 +99,12 @@ struct hlua_init_function {
  * or actions.
  */
 struct hlua_function {
+	struct list l;  /* entry in the list of the per-thread functions */
 	char *name;
-	int function_ref;
+	int function_ref[MAX_THREADS + 1]; /* reference in each state, -1 if none.
+	                                      Only [0] is set for the shared state. */
 	int nargs;
+	unsigned int flags; /* HLUA_FCN_F_* */
 };
 
 /* This struct is used with the structs:
@@ -101,7 +114,7 @@ struct hlua_function {
  * It contains the lua execution configuration.
  */
 struct hlua_rule {
-	struct hlua_function fcn;
+	struct hlua_function *fcn;
 	char **args;
 };
 
@@ -153,6 +166,24 @@ struct hlua_concat {
 	int len;
 };
 
+/* A variable stored out of the Lua states with core.shared_set(), so that
+ * all of them may access it. Its name is the key of the node.
+ */
+struct hlua_shared_var {
+	int type;               /* LUA_TBOOLEAN, LUA_TNUMBER or LUA_TSTRING */
+	int isint;              /* the number is an integer */
+	union {
+		int b;
+		lua_Integer i;
+		lua_Number n;
+		struct {
+			char *ptr;
+			size_t len;
+		} str;
+	} data;
+	struct ebmb_node node;  /* must be last, the key follows it */
+};
+
 struct hlua_addr {
 	union {
 		struct {
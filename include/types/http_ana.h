@@ -165,6 +165,9 @@ struct http_msg {
 	struct channel *chn;                   /* pointer to the channel transporting the message */
 };
 
+/* Maximum number of request headers a cached response may vary on */
+#define CACHE_VARY_MAX 8
+
 /* This is an HTTP transaction. It contains both a request message and a
  * response message (which can be empty).
  */
@@ -178,6 +181,7 @@ struct http_txn {
 	struct http_reply *http_reply;  /* The HTTP reply to use as reply */
 
 	char cache_hash[20];               /* Store the cache hash  */
+	unsigned int cache_vary_hash[CACHE_VARY_MAX]; /* hashes of the request headers a cached response may vary on */
 	char *uri;                      /* first line if log needed, NULL otherwise */
 	char *cli_cookie;               /* cookie presented by the client, in capture mode */
 	char *srv_cookie;               /* cookie presented by the server, in capture mode */
@@ -26,10 +26,28 @@
 #include <ebtree.h>
 #include <eb32tree.h>
 
+/* The trees of large farms are indexed by a table of 2^bits buckets, each of
+ * them pointing to the first node whose key is at or after the start of the
+ * bucket (NULL past the last node). There are about as many buckets as nodes,
+ * so that a lookup only has to step over a node or two instead of descending
+ * the whole tree. The table is rebuilt at the first lookup following changes
+ * to the tree. Smaller trees are looked up directly.
+ */
+#define CHASH_TBL_MIN_NODES 1024
+
+struct lb_chash_tbl {
+	struct eb32_node **bucket; /* first node at or after each bucket, or NULL */
+	unsigned int bits;         /* log2 of the number of buckets, 0 if no table */
+	unsigned int size;         /* number of allocated buckets */
+	int dirty;                 /* the tree changed since the table was built */
+};
+
 struct lb_chash {
 	struct eb_root act;	/* weighted chash entries of active servers */
 	struct eb_root bck;	/* weighted chash entries of backup servers */
 	struct eb32_node *last;	/* last node found in case of round robin (or NULL) */
+	struct lb_chash_tbl act_tbl; /* lookup table of <act> */
+	struct lb_chash_tbl bck_tbl; /* lookup table of <bck> */
 };
 
 #endif /* _TYPES_LB_CHASH_H */
@@ -103,6 +103,7 @@ enum li_state {
 #define LI_O_INHERITED          0x2000  /* inherited FD from the parent process (fd@) */
 #define LI_O_MWORKER            0x4000  /* keep the FD open in the master but close it in the children */
 #define LI_O_NOSTOP             0x8000  /* keep the listener active even after a soft stop */
+#define LI_O_INC_CPU            0x10000 /* pass connections to the thread bound to their SO_INCOMING_CPU */
 
 /* Note: if a listener uses LI_O_UNLIMITED, it is highly recommended that it adds its own
  * maxconn setting to the global.maxsock value so that its resources are reserved.
@@ -112,6 +113,7 @@ enum li_state {
 #define BC_SSL_O_NONE           0x0000
 #define BC_SSL_O_NO_TLS_TICKETS 0x0100	/* disable session resumption tickets */
 #define BC_SSL_O_PREF_CLIE_CIPH 0x0200  /* prefer client ciphers */
+#define BC_SSL_O_KTLS           0x0400  /* let the kernel encrypt the records (kTLS) */
 #endif
 
 struct tls_version_filter {
@@ -162,6 +164,8 @@ struct bind_conf {
 	__decl_hathreads(HA_RWLOCK_T sni_lock); /* lock the SNI trees during add/del operations */
 	struct eb_root sni_ctx;    /* sni_ctx tree of all known certs full-names sorted by name */
 	struct eb_root sni_w_ctx;  /* sni_ctx tree of all known certs wildcards sorted by name */
+	unsigned int sni_gen;      /* SNI trees generation, bumped on each change, under the lock */
+	struct eb_root sni_lazy;   /* sni_lazy tree of the certs loaded on demand, never changes at run time */
 	struct tls_keys_ref *keys_ref; /* TLS ticket keys reference */
 
 	char *ca_sign_file;        /* CAFile used to generate and sign server certificates */
@@ -177,6 +181,8 @@ struct bind_conf {
 #ifdef USE_QUIC
 	int is_quic;               /* 1 if QUIC listeners */
 	struct quic_transport_params quic_params; /* QUIC transport parameters */
+	struct quic_cc_algo *quic_cc_algo; /* QUIC congestion control algorithm ("quic-cc-algo"), NULL for the default one */
+	int quic_cert_comp;        /* 1 to compress the certificate chains (RFC 8879, "quic-cert-compression") */
 #endif
 	int generate_certs;        /* 1 if generate-certificates option is set, else 0 */
 	int level;                 /* stats access level (ACCESS_LVL_*) */
@@ -221,6 +227,8 @@ struct listener {
 	unsigned int analysers;		/* bitmap of required protocol analysers */
 	int maxseg;			/* for TCP, advertised MSS */
 	int tcp_ut;                     /* for TCP, user timeout */
+	int busy_poll;                  /* for TCP, SO_BUSY_POLL time in microseconds */
+	int notsent_lowat;              /* for TCP, TCP_NOTSENT_LOWAT in bytes, 0 = unset */
 	char *interface;		/* interface name or NULL */
 	char *name;			/* listener's name */
 
@@ -239,8 +247,10 @@ struct listener {
 	struct list proto_list;         /* list in the protocol header */
 
 #ifdef USE_QUIC
-	struct eb_root icids;
-	struct eb_root cids;
+	struct quic_cid_tree *icids;    /* QUIC_CID_TREES_CNT trees of original DCIDs chosen by the clients */
+	struct quic_cid_tree *cids;     /* QUIC_CID_TREES_CNT trees of our connection IDs */
+	int *quic_fds;                  /* per-thread sockets ([0] is <fd>), or NULL if only <fd> */
+	struct quic_counters quic_counters; /* QUIC counters, for QUIC listeners only */
 #endif
 
 	/* warning: this struct is huge, keep it at the bottom */
@@ -41,6 +41,11 @@
 #define STARTUP_LOG_SIZE        65536
 #endif
 
+/* maximum number of keyed fields ("%{key=...}") reported in a structured log */
+#ifndef LOG_MAX_FIELDS
+#define LOG_MAX_FIELDS          64
+#endif
+
 /* The array containing the names of the log levels. */
 extern const char *log_levels[];
 
@@ -50,6 +55,7 @@ enum {
 	LOG_FORMAT_RFC5424,
 	LOG_FORMAT_SHORT,
 	LOG_FORMAT_RAW,
+	LOG_FORMAT_CBOR,
 	LOG_FORMATS,          /* number of supported log formats, must always be last */
 };
 
@@ -154,6 +160,8 @@ struct logformat_node {
 	int options;   // LOG_OPT_*
 	char *arg;     // text for LOG_FMT_TEXT, arg for others
 	void *expr;    // for use with LOG_FMT_EXPR
+	size_t len;    // length of <arg> for LOG_FMT_TEXT
+	const char *key; // field name in structured logs (points into <arg>), or NULL
 };
 
 #define LOG_OPT_HEXA		0x00000001
@@ -163,6 +171,7 @@ struct logformat_node {
 #define LOG_OPT_RES_CAP         0x00000010
 #define LOG_OPT_HTTP            0x00000020
 #define LOG_OPT_ESC             0x00000040
+#define LOG_OPT_SEP_END         0x00000080  /* internal: LOG_FMT_TEXT ending with a resolved separator */
 
 
 /* Fields that need to be extracted from the incoming connection or request for
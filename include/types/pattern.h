@@ -27,6 +27,10 @@
 #include <common/mini-clist.h>
 #include <common/regex.h>
 
+#ifdef USE_HYPERSCAN
+#include <hs/hs.h>
+#endif
+
 #include <types/sample.h>
 
 #include <ebmbtree.h>
@@ -95,6 +99,25 @@ enum {
 #define PAT_REF_MAP 0x1 /* Set if the reference is used by at least one map. */
 #define PAT_REF_ACL 0x2 /* Set if the reference is used by at least one acl. */
 #define PAT_REF_SMP 0x4 /* Flag used if the reference contains a sample. */
+#define PAT_REF_IDX 0x8 /* Set if the entries are also indexed outside of the reference. */
+
+/* Pattern cache (LRU) accounting of the lookups of the expressions of a
+ * reference, all threads included. The lookups are counted once the result
+ * is known to be cached or not. An expression whose hit ratio stays below
+ * 1/PAT_LRU_MIN_RATIO over a window of PAT_LRU_WINDOW lookups only caches the
+ * keys whose hash has none of the PAT_LRU_SAMPLE_MASK bits set until its ratio
+ * recovers, so that it does not evict the entries of the others.
+ */
+#define PAT_LRU_WINDOW        4096
+#define PAT_LRU_MIN_RATIO     16
+#define PAT_LRU_SAMPLE_MASK   15     /* 1 key out of 16 when bypassed */
+
+struct pat_lru_stats {
+	unsigned long long hits;        /* lookups answered from the cache */
+	unsigned long long misses;      /* lookups stored into the cache */
+	unsigned long long evictions;   /* entries evicted to store the misses */
+	unsigned long long skipped;     /* lookups not cached while bypassed */
+};
 
 /* This struct contain a list of reference strings for dunamically
  * updatable patterns.
@@ -107,6 +130,10 @@ struct pat_ref {
 	char *display; /* String displayed to identify the pattern origin. */
 	struct list head; /* The head of the list of struct pat_ref_elt. */
 	struct list pat; /* The head of the list of struct pattern_expr. */
+	struct list pending; /* The struct pat_ref_elt of the version being prepared. */
+	unsigned int last_gen; /* Last version number assigned. */
+	unsigned int next_gen; /* Version being prepared, 0 if none. */
+	struct pat_lru_stats lru; /* Pattern cache usage of its expressions. */
 	__decl_hathreads(HA_SPINLOCK_T lock); /* Lock used to protect pat ref elements */
 };
 
@@ -174,10 +201,85 @@ struct pattern_list {
 	struct pattern pat;
 };
 
+/* Multi-pattern automaton (Aho-Corasick) indexing the list of string patterns
+ * of an expression. Each node is a prefix of at least one pattern, <fail>
+ * points to the node of its longest proper suffix, and its edges are sorted
+ * in <edges>. The patterns are designated by their rank in the list so that
+ * the first one in list order may always be reported.
+ */
+#define PAT_AC_NONE           UINT_MAX /* no pattern */
+#define PAT_AC_MIN_PATTERNS   16       /* don't index shorter lists */
+#define PAT_AC_REBUILD_DELAY  1000     /* min delay between two runtime rebuilds (ms) */
+
+struct pat_ac_edge {
+	unsigned int node;              /* node this edge leads to */
+	unsigned char c;                /* character of the edge */
+};
+
+struct pat_ac_node {
+	unsigned int fail;              /* node of the longest proper suffix */
+	unsigned int edges;             /* index of the first edge in <edges> */
+	unsigned int nb_edges;          /* number of edges */
+	unsigned int own;               /* rank of the first pattern ending here */
+	unsigned int best;              /* rank of the first pattern ending here or at a suffix */
+};
+
+struct pat_ac {
+	unsigned long long revision;    /* revision of the expression when built */
+	struct pattern **pats;          /* patterns by rank */
+	struct pat_ac_node *nodes;      /* nodes, the root being the first one */
+	struct pat_ac_edge *edges;      /* edges of all the nodes */
+	unsigned int root[256];         /* edges of the root, 0 if none */
+};
+
+/* The regex patterns of an expression may also be compiled all together as a
+ * set. With Hyperscan, a database of all of them reports the rank of the first
+ * pattern matching in the list order, possibly after confirming the candidates
+ * with their own regex for the constructs it only approximates. Otherwise an
+ * alternation of all of them tells whether one of them matches, so that the
+ * list is only walked for the samples matching one of the patterns.
+ */
+#define PAT_RS_NONE           UINT_MAX     /* no pattern matches */
+#define PAT_RS_LIST           (UINT_MAX-1) /* the list must be walked */
+#define PAT_RS_MIN_PATTERNS   4            /* don't compile shorter lists */
+
+struct pat_rs {
+	unsigned long long revision;    /* revision of the expression when built */
+	struct pattern **pats;          /* patterns by rank */
+#ifdef USE_HYPERSCAN
+	hs_database_t *db;              /* database of all the patterns, or NULL */
+	int exact;                      /* 0 if the matches of <db> must be confirmed */
+#endif
+	struct my_regex *alt;           /* alternation of all the patterns, or NULL */
+};
+
+/* The IPv4 prefixes of an expression may also be expanded in a multibit trie
+ * with a fixed 16-8-8 stride, so that the longest match is found in at most
+ * three memory reads. Each entry either designates a prefix by its rank + 1
+ * (0 meaning none), or with PAT_LPM_CHUNK, a chunk of 256 entries for the next
+ * 8 bits. The entries not covered by a longer prefix inherit the shorter one.
+ */
+#define PAT_LPM_CHUNK         0x80000000U  /* the entry designates a chunk */
+#define PAT_LPM_MIN_PATTERNS  64           /* don't index smaller trees */
+
+struct pat_lpm {
+	unsigned long long revision;    /* revision of the expression when built */
+	struct pattern_tree **leaves;   /* IPv4 prefixes by rank */
+	unsigned int *chunks;           /* chunks of the 2nd and 3rd levels */
+	unsigned int nb_chunks;         /* number of chunks in use */
+	unsigned int alloc_chunks;      /* number of chunks allocated */
+	unsigned int root[65536];       /* entries of the 16 upper bits */
+};
+
 /* Description of a pattern expression.
  * It contains pointers to the parse and match functions, and a list or tree of
  * patterns to test against. The structure is organized so that the hot parts
  * are grouped together in order to optimize caching.
+ *
+ * A new version of the patterns of a reference is built in the buffer of each
+ * expression which is not looked up, the expression itself or its <shadow>,
+ * then published by switching <live> under the expression's lock. The lookups
+ * and the runtime updates always apply to <live>, under this same lock.
  */
 struct pattern_expr {
 	struct list list; /* Used for chaining pattern_expr in pat_ref. */
@@ -192,6 +294,16 @@ struct pattern_expr {
 	struct eb_root pattern_tree;  /* may be used for lookup in large datasets */
 	struct eb_root pattern_tree_2;  /* may be used for different types */
 	int mflags;                     /* flags relative to the parsing or matching method. */
+	struct pat_ac *ac;              /* automaton indexing the list of patterns, if any */
+	struct pat_rs *rs;              /* set of the regex patterns, if any */
+	struct pat_lpm *lpm;            /* multibit trie of the IPv4 prefixes, if any */
+	unsigned long long ac_revision; /* revision the automaton or set was last built for */
+	unsigned int ac_next;           /* date of the next possible rebuild at runtime */
+	struct pattern_expr *live;      /* patterns looked up: this expression or <shadow> */
+	struct pattern_expr *shadow;    /* other patterns buffer for the versions, or NULL */
+	unsigned int lru_lookups;       /* cached lookups in the current window */
+	unsigned int lru_hits;          /* cache hits in the current window */
+	int lru_bypass;                 /* only a sample of the keys is cached */
 	__decl_hathreads(HA_RWLOCK_T lock);               /* lock used to protect patterns */
 };
 
@@ -37,6 +37,7 @@
 
 #include <eb32tree.h>
 #include <ebistree.h>
+#include <ebmbtree.h>
 
 #include <types/acl.h>
 #include <types/backend.h>
@@ -318,6 +319,7 @@ struct proxy {
 	struct server *srv, defsrv;		/* known servers; default server configuration */
 	struct lbprm lbprm;			/* load-balancing parameters */
 	int srv_act, srv_bck;			/* # of servers eligible for LB (UP|!checked) AND (enabled+weight!=0) */
+	unsigned int srv_ejected;		/* # of servers currently ejected by the outlier detection */
 	int served;				/* # of active sessions currently being served */
 	int  cookie_len;			/* strlen(cookie_name), computed only once */
 	char *cookie_domain;			/* domain used to insert the cookie */
@@ -354,12 +356,16 @@ struct proxy {
 	int nbpend;				/* number of pending connections with no server assigned yet */
 	int totpend;				/* total number of pending connections on this instance (for stats) */
 	unsigned int queue_idx;			/* number of pending connections which have been de-queued */
+	__decl_hathreads(HA_SPINLOCK_T queue_lock); /* protects <pendconns>, may be taken under the server's lock */
 	unsigned int feconn, beconn;		/* # of active frontend and backends streams */
 	struct freq_ctr fe_req_per_sec;		/* HTTP requests per second on the frontend */
-	struct freq_ctr fe_conn_per_sec;	/* received connections per second on the frontend */
-	struct freq_ctr fe_sess_per_sec;	/* accepted sessions per second on the frontend (after tcp rules) */
+	struct freq_ctr_thr fe_conn_per_sec;	/* received connections per second on the frontend */
+	struct freq_ctr_thr fe_sess_per_sec;	/* accepted sessions per second on the frontend (after tcp rules) */
 	struct freq_ctr be_sess_per_sec;	/* sessions per second on the backend */
 	unsigned int fe_sps_lim;		/* limit on new sessions per second on the frontend */
+	unsigned int log_sample;		/* log one stream out of <log_sample> ("log-sample"), 0 = all */
+	unsigned int log_sample_cnt;		/* streams counted for "log-sample" without a key */
+	struct sample_expr *log_sample_key;	/* "log-sample" key whose hash selects the streams, or NULL */
 	unsigned int fullconn;			/* #conns on backend above which servers are used at full load */
 	unsigned int tot_fe_maxconn;		/* #maxconn of frontends linked to that backend, it is used to compute fullconn */
 	struct in_addr except_net, except_mask; /* don't x-forward-for for this address. FIXME: should support IPv6 */
@@ -402,6 +408,10 @@ struct proxy {
 
 	struct mt_list listener_queue;		/* list of the temporarily limited listeners because of lack of a proxy resource */
 	struct stktable *table;			/* table for storing sticking streams */
+	struct {
+		char *name;			/* name of the table whose sources are rejected at accept time */
+		struct stktable *table;		/* the resolved table, NULL if none */
+	} early_reject;
 
 	struct task *task;			/* the associated task, mandatory to manage rate limiting, stopping and resource shortage, NULL if disabled */
 	struct tcpcheck_rules tcpcheck_rules;   /* tcp-check send / expect rules */
@@ -480,10 +490,29 @@ struct switching_rule {
 		char *name;			/* target backend name during config parsing */
 		struct list expr;		/* logformat expression to use for dynamic rules */
 	} be;
+	struct sw_dispatch *dispatch;		/* dispatch table of the rules starting here, or NULL */
 	char *file;
 	int line;
 };
 
+/* A sequence of consecutive switching rules which only match the same sample
+ * against exact strings, indexed by these strings. The first rule of the
+ * sequence points to it.
+ */
+struct sw_dispatch {
+	struct sample_expr *expr;		/* sample expression common to all rules */
+	int icase;				/* non-zero if the keys are lower case */
+	unsigned int gen;			/* value of pat_ref_idx_gen when built */
+	int nb_rules;				/* number of rules in the sequence */
+	struct switching_rule **rules;		/* the rules, in their declaration order */
+	struct eb_root keys;			/* sw_dispatch_key indexed by string */
+};
+
+struct sw_dispatch_key {
+	int idx;				/* index of the first rule matching this key */
+	struct ebmb_node node;			/* node in sw_dispatch->keys, followed by the key */
+};
+
 struct server_rule {
 	struct list list;			/* list linked to from the proxy */
 	struct acl_cond *cond;			/* acl condition to meet */
@@ -30,6 +30,8 @@
 #define QUIC_CC_INFINITE_SSTHESH ((uint64_t)-1)
 
 extern struct quic_cc_algo quic_cc_algo_nr;
+extern struct quic_cc_algo quic_cc_algo_cubic;
+extern struct quic_cc_algo quic_cc_algo_bbr;
 extern struct quic_cc_algo *default_quic_cc_algo;
 
 enum quic_cc_algo_state_type {
@@ -54,6 +56,15 @@ struct quic_cc_event {
 		struct ack {
 			size_t acked;
 			unsigned int time_sent;
+			/* Delivery rate sample (bytes by second, 0 if none),
+			 * with the path delivered bytes when the packet was sent,
+			 * a non-null value if it was application limited, and
+			 * its RTT (us).
+			 */
+			uint64_t rate;
+			uint64_t prior_delivered;
+			unsigned int app_limited;
+			unsigned int rtt_us;
 		} ack;
 		struct loss {
 			unsigned int now_ms;
@@ -62,11 +73,31 @@ struct quic_cc_event {
 			unsigned int newest_time_sent;
 			unsigned int period;
 		} loss;
+		struct ecn {
+			/* The send date of the largest acked packet. */
+			unsigned int time_sent;
+		} ecn;
 	};
 };
 
 enum quic_cc_algo_type {
 	QUIC_CC_ALGO_TP_NEWRENO,
+	QUIC_CC_ALGO_TP_CUBIC,
+	QUIC_CC_ALGO_TP_BBR,
+};
+
+/* BBR states. */
+enum quic_cc_bbr_state {
+	QUIC_CC_BBR_ST_STARTUP,
+	QUIC_CC_BBR_ST_DRAIN,
+	QUIC_CC_BBR_ST_PROBE_BW,
+	QUIC_CC_BBR_ST_PROBE_RTT,
+};
+
+/* Sample of a windowed max filter. */
+struct quic_cc_minmax_sample {
+	uint32_t t;
+	uint64_t v;
 };
 
 union quic_cc_algo_state {
@@ -77,6 +108,56 @@ union quic_cc_algo_state {
 		uint64_t ssthresh;
 		uint64_t recovery_start_time;
 	} nr;
+	/* CUBIC (RFC 8312) */
+	struct cubic {
+		enum quic_cc_algo_state_type state;
+		uint64_t cwnd;
+		uint64_t ssthresh;
+		uint64_t recovery_start_time;
+		/* Window before the last reduction (W_max). */
+		uint64_t last_max_cwnd;
+		/* Window reached at <K> ms from <epoch_start> (W_max or cwnd). */
+		uint64_t origin_point;
+		/* Time (ms) to reach <origin_point> from <epoch_start>. */
+		uint32_t K;
+		/* Start of the current congestion avoidance epoch (ms), 0 if none. */
+		uint32_t epoch_start;
+		/* Window estimated for a standard TCP (W_est) and the bytes
+		 * acknowledged since its last increment.
+		 */
+		uint64_t tcp_cwnd;
+		uint64_t tcp_acked;
+	} cubic;
+	/* BBR v1 */
+	struct bbr {
+		enum quic_cc_bbr_state state;
+		uint64_t cwnd;
+		/* Windowed max of the delivery rate (bytes/s) over the last
+		 * round trips (BtlBw), with <round_count> as time.
+		 */
+		struct quic_cc_minmax_sample btlbw[3];
+		/* Windowed min of the RTT (us) (RTprop) and its date (ms). */
+		uint32_t min_rtt;
+		uint32_t min_rtt_stamp;
+		/* Round trip counting. */
+		uint32_t round_count;
+		uint64_t next_round_delivered;
+		unsigned int round_start;
+		/* Full pipe detection during startup. */
+		unsigned int filled_pipe;
+		uint64_t full_bw;
+		unsigned int full_bw_cnt;
+		/* Gains in BBR_UNIT units. */
+		unsigned int pacing_gain;
+		unsigned int cwnd_gain;
+		/* ProbeBW gain cycle index and its start date (ms). */
+		unsigned int cycle_idx;
+		uint32_t cycle_stamp;
+		/* ProbeRTT end date (ms), 0 if not set, and window to restore. */
+		uint32_t probe_rtt_done_stamp;
+		unsigned int probe_rtt_round_done;
+		uint64_t prior_cwnd;
+	} bbr;
 };
 
 struct quic_cc {
@@ -88,9 +169,12 @@ struct quic_cc {
 
 struct quic_cc_algo {
 	enum quic_cc_algo_type type;
+	const char *name;
 	int (*init)(struct quic_cc *cc);
 	void (*event)(struct quic_cc *cc, struct quic_cc_event *ev);
 	void (*state_trace)(struct buffer *buf, const struct quic_cc *cc);
+	/* Name of the current state, as reported in the qlog events. */
+	const char *(*state_name)(const struct quic_cc *cc);
 };
 
 #endif /* _TYPES_QUIC_CC_H */
@@ -62,6 +62,8 @@ enum quic_frame_type {
 	QUIC_FT_CONNECTION_CLOSE     = 0x1c,
 	QUIC_FT_CONNECTION_CLOSE_APP = 0x1d,
 	QUIC_FT_HANDSHAKE_DONE       = 0x1e,
+	/* draft-ietf-quic-ack-frequency */
+	QUIC_FT_ACK_FREQUENCY        = 0xaf,
 	/* Do not insert enums after the following one. */
 	QUIC_FT_MAX
 };
@@ -94,17 +96,30 @@ struct quic_padding {
 	size_t len;
 };
 
+/* ECN counts of ACK_ECN frames. */
+struct quic_ecn_counts {
+	uint64_t ect0;
+	uint64_t ect1;
+	uint64_t ce;
+};
+
 struct quic_ack {
 	uint64_t largest_ack;
 	uint64_t ack_delay;
 	size_t ack_range_num;
 	uint64_t first_ack_range;
+	/* Only for ACK_ECN frames. */
+	struct quic_ecn_counts ecn_counts;
 };
 
 /* Structure used when emitting ACK frames. */
 struct quic_tx_ack {
 	uint64_t ack_delay;
 	struct quic_ack_ranges *ack_ranges;
+	/* The number of the first ranges of <ack_ranges> to be encoded. */
+	size_t nb_ranges;
+	/* The ECN counts to be encoded (ACK_ECN frames only). */
+	const struct quic_ecn_counts *ecn_counts;
 };
 
 struct quic_reset_stream {
@@ -135,6 +150,7 @@ struct quic_stream {
 	uint64_t offset;
 	uint64_t len;
 	const unsigned char *data;
+	unsigned char prio; /* TX only: scheduling class, < QUIC_TX_PRIO_NB, lowest first */
 };
 
 struct quic_max_data {
@@ -198,8 +214,22 @@ struct quic_connection_close_app {
 	unsigned char *reason_phrase;
 };
 
+/* ACK_FREQUENCY frame (draft-ietf-quic-ack-frequency). */
+struct quic_ack_frequency {
+	uint64_t seq_num;
+	uint64_t pkt_tolerance;
+	uint64_t max_ack_delay; /* microseconds */
+	unsigned char ignore_order;
+};
+
 struct quic_frame {
-	struct list list;
+	/* A frame is either in a list of its connection thread, or queued by
+	 * another thread into the <tx.frms_in> MPSC queue of its connection.
+	 */
+	union {
+		struct list list;
+		struct mt_list mt_list;
+	};
 	unsigned char type;
 	union {
 		struct quic_padding padding;
@@ -224,6 +254,7 @@ struct quic_frame {
 		struct quic_path_challenge_response path_challenge_response;
 		struct quic_connection_close connection_close;
 		struct quic_connection_close_app connection_close_app;
+		struct quic_ack_frequency ack_frequency;
 	};
 };
 
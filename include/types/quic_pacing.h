@@ -0,0 +1,55 @@
+/*
+ * include/types/quic_pacing.h
+ * This file contains definitions for QUIC packet pacing.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TYPES_QUIC_PACING_H
+#define _TYPES_QUIC_PACING_H
+
+#include <stdint.h>
+
+/* Without any rate imposed by the congestion controller, the datagrams are
+ * paced at N * cwnd / srtt with N = 5/4 so as not to be limited by the
+ * timer inaccuracy.
+ */
+#define QUIC_PACING_GAIN_NUM            5
+#define QUIC_PACING_GAIN_DEN            4
+/* Number of datagrams which may always be sent back to back. */
+#define QUIC_PACING_BURST               2
+/* Maximum advance (us) of the departure time of a datagram on the current
+ * date for it to be sent: one timer tick when the datagrams are released by
+ * the pacing timer, more when the kernel releases them itself (SO_TXTIME).
+ */
+#define QUIC_PACING_HORIZON          1000
+#define QUIC_PACING_TXTIME_HORIZON  10000
+
+/* Earliest departure time (EDT) pacer of a QUIC path. Each datagram is given
+ * a departure date from the departure date of the previous one plus its
+ * transmission time at <rate>.
+ */
+struct quic_pacer {
+	/* Pacing rate (bytes/s) imposed by the congestion controller, 0 if
+	 * it lets the pacer derive it from the congestion window.
+	 */
+	uint64_t cc_rate;
+	/* Current pacing rate (bytes/s), 0 if the datagrams are not paced. */
+	uint64_t rate;
+	/* Earliest departure date (us) of the next datagram. */
+	uint64_t next;
+};
+
+#endif /* _TYPES_QUIC_PACING_H */
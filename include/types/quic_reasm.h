@@ -0,0 +1,54 @@
+/*
+ * include/types/quic_reasm.h
+ * This file contains definitions for the reassembly of the QUIC CRYPTO and
+ * STREAM data received out of order.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TYPES_QUIC_REASM_H
+#define _TYPES_QUIC_REASM_H
+
+#include <stddef.h>
+
+#include <common/compat.h>
+
+/* Size of the window of data which may be received ahead of the first byte
+ * not delivered yet. RFC 9000 7.5 requires at least 4096 bytes for CRYPTO
+ * data, we accept a full certificate chain.
+ */
+#define QUIC_REASM_SHIFT      14
+#define QUIC_REASM_SZ         (1UL << QUIC_REASM_SHIFT) /* 16 KB */
+#define QUIC_REASM_MAP_SZ     (QUIC_REASM_SZ / LONGBITS)
+
+/* Storage of the data received out of order: a ring indexed by their offsets
+ * modulo QUIC_REASM_SZ, and a bitmap with one bit per byte of this ring set
+ * when this byte has been received.
+ */
+struct quic_reasm_buf {
+	unsigned char area[QUIC_REASM_SZ];
+	unsigned long map[QUIC_REASM_MAP_SZ];
+};
+
+/* Reassembly context of a stream of bytes. Only the payload of the frames is
+ * copied, so that their packets may be released at once. Its buffer is only
+ * allocated while some data are waiting for a gap to be filled.
+ */
+struct quic_reasm {
+	struct quic_reasm_buf *buf;
+	size_t nb;            /* number of bytes stored in <buf> */
+};
+
+#endif /* _TYPES_QUIC_REASM_H */
@@ -81,6 +81,11 @@ extern unsigned char initial_salt[20];
 #define QUIC_FL_TLS_SECRETS_SET  (1 << 0)
 /* Flag to be used when TLS secrets have been discarded. */
 #define QUIC_FL_TLS_SECRETS_DCD  (1 << 1)
+/* Flag set when the current key phase bit is 1 (1-RTT keys only). */
+#define QUIC_FL_TLS_KP_BIT_SET   (1 << 2)
+
+/* Maximum size of a TLS secret (SHA384). */
+#define QUIC_TLS_SECRET_MAXLEN   48
 
 struct quic_tls_secrets {
 	const EVP_CIPHER *aead;
@@ -94,14 +99,66 @@ struct quic_tls_secrets {
 	* the packet protection.
 	*/
 	unsigned char hp_key[32];
+	/* Long-lived cipher contexts keyed with <key> and <hp_key> by
+	 * quic_tls_secrets_ctx_init() so that only the IV has to be set
+	 * for each packet.
+	 */
+	EVP_CIPHER_CTX *ctx;
+	EVP_CIPHER_CTX *hp_ctx;
+	/* AES-ECB context keyed with <hp_key> for the AES based header
+	 * protection of the TX secrets, so that the masks of several packets
+	 * are computed at once (NULL for ChaCha20 and the RX secrets).
+	 */
+	EVP_CIPHER_CTX *hp_ecb_ctx;
+	/* The secret the keys are derived from, kept for the 1-RTT key updates. */
+	unsigned char secret[QUIC_TLS_SECRET_MAXLEN];
+	size_t secretlen;
 	char flags;
 };
 
+/* Packet protection material of another key phase than the current one
+ * for the 1-RTT key updates (RFC 9001 6): the secret, and the AEAD key, IV
+ * and keyed cipher context derived from it. The header protection key does
+ * not change.
+ */
+struct quic_tls_kp {
+	EVP_CIPHER_CTX *ctx;
+	unsigned char secret[QUIC_TLS_SECRET_MAXLEN];
+	size_t secretlen;
+	unsigned char key[32];
+	unsigned char iv[12];
+};
+
 struct quic_tls_ctx {
 	unsigned char aead_iv[12];
 	struct quic_tls_secrets rx;
 	struct quic_tls_secrets tx;
 };
 
+/* Length of the header protection samples and masks (RFC 9001 5.4.2). */
+#define QUIC_TLS_HP_SAMPLE_LEN   16
+
+/* Maximum number of header protection masks computed at once by
+ * quic_tls_hp_masks().
+ */
+#define QUIC_TLS_HP_BATCH        32
+
+/* Maximum number of packets decrypted at once by quic_tls_decrypt_batch(). */
+#define QUIC_TLS_DEC_BATCH       16
+
+/* A packet to be decrypted in place by quic_tls_decrypt_batch(): its payload
+ * <buf> of <len> bytes, the authentication tag included, its <aad> of
+ * <aad_len> bytes and its packet number <pn>. <ret> is set to the length of
+ * the decrypted data, 0 if the decryption failed.
+ */
+struct quic_tls_dec {
+	unsigned char *buf;
+	size_t len;
+	unsigned char *aad;
+	size_t aad_len;
+	uint64_t pn;
+	size_t ret;
+};
+
 #endif /* _TYPES_QUIC_TLS_H */
 
@@ -27,8 +27,8 @@
 #include <common/config.h>
 #include <common/ist.h>
 
-/* The code below handles circular buffers with single-producer and multiple
- * readers (up to 255). The buffer storage area must remain always allocated.
+/* The code below handles circular buffers with multiple producers and multiple
+ * readers (up to 127). The buffer storage area must remain always allocated.
  * It's made of series of payload blocks followed by a readers count (RC).
  * There is always a readers count at the beginning of the buffer as well. Each
  * payload block is composed of a varint-encoded size (VI) followed by the
@@ -44,7 +44,7 @@
  * long as the initial count is non-null. As such these readers count are
  * effective barriers against data recycling.
  *
- * Only the writer is allowed to update the buffer's tail/head. This ensures
+ * Only the writers are allowed to update the buffer's tail/head. This ensures
  * that events can remain as long as possible so that late readers can get the
  * maximum history available. It also helps dealing with multi-thread accesses
  * using a simple RW lock during the buffer head's manipulation. The writer
@@ -53,6 +53,14 @@
  * cannot fit due to insufficient room, the message is lost and the drop
  * counted must be incremented.
  *
+ * The write lock is only held by a writer to reserve the room of its message:
+ * it sets the RING_RC_UNCOMMITTED bit of the readers count preceding the
+ * message, writes its length and the next readers count, and releases the
+ * lock. The payload is then copied without the lock, other writers reserving
+ * and copying their own messages in parallel, and the message is committed by
+ * atomically clearing the bit. Readers stop at the first uncommitted message,
+ * and such a message is never deleted since its readers count is not null.
+ *
  * Like any buffer, this buffer naturally wraps at the end and continues at the
  * beginning. The creation process consists in immediately adding a null
  * readers count byte into the buffer. The write process consists in always
@@ -93,12 +101,44 @@
  *                 removed
  */
 
+/* set on the readers count preceding a message being written */
+#define RING_RC_UNCOMMITTED   0x80
+#define RING_MAX_READERS      (RING_RC_UNCOMMITTED - 1)
+
+/* A ring may also have its storage area in a file mapped in memory, so that
+ * external processes can read the messages in place. The file starts with the
+ * header below, in the native byte order, followed by the storage area at
+ * offset <hdr_size>. The <ofs>, <head> and <data> fields mirror the ring's
+ * ones each time a writer updates them, <seq> being odd during the update.
+ * The external readers don't hold any readers count and never prevent the
+ * messages from being deleted, so they must check that <ofs> did not pass a
+ * message once they copied it (see the management guide).
+ */
+#define RING_STORAGE_MAGIC    0x474e5248  /* "HRNG" in little endian */
+#define RING_STORAGE_VERSION  1
+
+struct ring_storage {
+	uint32_t magic;      // RING_STORAGE_MAGIC
+	uint16_t version;    // RING_STORAGE_VERSION
+	uint16_t hdr_size;   // offset of the storage area in the file
+	uint64_t size;       // size of the storage area
+	uint64_t seq;        // sequence number, odd while the fields below change
+	uint64_t ofs;        // absolute offset in history of the buffer's head
+	uint64_t head;       // position of the buffer's head in the storage area
+	uint64_t data;       // number of bytes in the storage area
+	uint32_t pid;        // pid of the writing process
+	uint32_t reserved;
+	uint64_t pad;        // pads the header to 64 bytes
+};
+
 struct ring {
 	struct buffer buf;   // storage area
 	size_t ofs;          // absolute offset in history of the buffer's head
 	struct list waiters; // list of waiters, for now, CLI "show event"
 	__decl_hathreads(HA_RWLOCK_T lock);
 	int readers_count;
+	struct ring_storage *storage; // mapped file holding the area, or NULL
+	size_t storage_size;          // size of the mapping
 };
 
 #endif /* _TYPES_RING_H */
@@ -303,6 +303,44 @@ struct sample_fetch {
 	unsigned int use;                         /* fetch source (SMP_USE_*) */
 	unsigned int val;                         /* fetch validity (SMP_VAL_*) */
 	void *private;                            /* private values. only used by Lua */
+	unsigned int flags;                       /* SMP_FETCH_F_* */
+};
+
+/* sample fetch flags */
+#define SMP_FETCH_F_MEMO   0x00000001  /* no side effect, results may be reused by the same stream */
+#define SMP_FETCH_F_PURE   0x00000002  /* no side effect, may be called in any order */
+
+/* Per-stream memory of the values returned by the SMP_FETCH_F_MEMO fetches to
+ * the ACLs. All the occurrences returned to an iterating ACL are kept, up to
+ * SMP_MEMO_VALUES, so that the same sequence may be replayed to the next ACLs
+ * using the same fetch with the same arguments. The short strings which do not
+ * point into a channel's buffer are copied into <area>. Everything is forgotten
+ * as soon as the messages change, which is detected by <sig>.
+ */
+#define SMP_MEMO_ENTRIES   8     /* fetches remembered per stream */
+#define SMP_MEMO_VALUES    4     /* occurrences remembered per fetch */
+#define SMP_MEMO_AREA      512   /* room for the copies of the strings */
+
+struct smp_memo_ent {
+	const struct sample_fetch *fetch;         /* fetch method, NULL if unused */
+	const struct arg *args;                   /* arguments of the first expression */
+	const struct proxy *px;                   /* proxy the fetch was called for */
+	unsigned int opt;                         /* SMP_OPT_* of the call */
+	int nb;                                   /* number of values, -1 while recording */
+	int cnt;                                  /* values recorded so far */
+	unsigned int end;                         /* SMP_F_* returned with the final failure */
+	unsigned int flags[SMP_MEMO_VALUES];      /* SMP_F_* of each value */
+	struct sample_data data[SMP_MEMO_VALUES];
+};
+
+struct smp_memo {
+	uint32_t sig[4];                          /* generation and size of both messages */
+	const struct sample *rec_smp;             /* sample being recorded into <rec> */
+	struct smp_memo_ent *rec;                 /* entry being recorded, NULL if none */
+	unsigned int next;                        /* next entry to replace */
+	unsigned int used;                        /* bytes used in <area> */
+	struct smp_memo_ent ent[SMP_MEMO_ENTRIES];
+	char area[SMP_MEMO_AREA];
 };
 
 /* sample expression */
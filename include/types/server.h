@@ -143,6 +143,7 @@ enum srv_initaddr {
 #define SRV_F_FASTOPEN     0x0200        /* Use TCP Fast Open to connect to server */
 #define SRV_F_SOCKS4_PROXY 0x0400        /* this server uses SOCKS4 proxy */
 #define SRV_F_NO_RESOLUTION 0x0800       /* disable runtime DNS resolution on this server */
+#define SRV_F_ADAPTIVE     0x1000        /* the concurrency limit adapts to the response times */
 
 /* configured server options for send-proxy (server->pp_opts) */
 #define SRV_PP_V1               0x0001   /* proxy protocol version 1 */
@@ -175,6 +176,7 @@ enum srv_initaddr {
 #define SRV_SSL_O_NO_TLS_TICKETS 0x0100 /* disable session resumption tickets */
 #define SRV_SSL_O_NO_REUSE     0x200  /* disable session reuse */
 #define SRV_SSL_O_EARLY_DATA   0x400  /* Allow using early data */
+#define SRV_SSL_O_KTLS         0x800  /* let the kernel encrypt the records (kTLS) */
 #endif
 
 /* log servers ring's protocols options */
@@ -227,12 +229,14 @@ struct server {
 	struct be_counters counters;		/* statistics counters */
 
 	struct eb_root pendconns;		/* pending connections */
+	unsigned int queue_calls;		/* dequeuing requests, all processed by the first caller */
 	struct list actconns;			/* active connections */
 	struct mt_list *idle_conns;		/* shareable idle connections*/
 	struct mt_list *safe_conns;		/* safe idle connections */
 	struct list *available_conns;           /* Connection in used, but with still new streams available */
 	unsigned int pool_purge_delay;          /* Delay before starting to purge the idle conns pool */
 	unsigned int max_idle_conns;            /* Max number of connection allowed in the orphan connections list */
+	unsigned int min_idle_conns;            /* Min number of idle connections per thread kept by the purge */
 	unsigned int curr_idle_conns;           /* Current number of orphan idling connections, both the idle and the safe lists */
 	unsigned int curr_idle_nb;              /* Current number of connections in the idle list */
 	unsigned int curr_safe_nb;              /* Current number of connections in the safe list */
@@ -240,6 +244,7 @@ struct server {
 	unsigned int max_used_conns;            /* Max number of used connections (the counter is reset at each connection purges */
 	unsigned int *curr_idle_thr;            /* Current number of orphan idling connections per thread */
 	int max_reuse;                          /* Max number of requests on a same connection */
+	unsigned int streams_per_conn;          /* Desired max number of streams per multiplexed connection, 0 = no limit */
 	struct eb32_node idle_node;             /* When to next do cleanup in the idle connections */
 	struct task *warmup;                    /* the task dedicated to the warmup when slowstart is set */
 
@@ -254,6 +259,20 @@ struct server {
 	short observe, onerror;			/* observing mode: one of HANA_OBS_*; what to do on error: on of ANA_ONERR_* */
 	short onmarkeddown;			/* what to do when marked down: one of HANA_ONMARKEDDOWN_* */
 	short onmarkedup;			/* what to do when marked up: one of HANA_ONMARKEDUP_* */
+	unsigned int eject_errors;		/* consecutive failures ejecting the server, 0 = disabled */
+	unsigned int eject_latency;		/* ratio of the backend's response time ejecting the server, 0 = disabled */
+	unsigned int eject_time;		/* base ejection time (ms), doubled on each consecutive ejection */
+	unsigned int eject_max_pct;		/* max percentage of the backend's servers ejected at once */
+	unsigned int eject_fails;		/* current number of consecutive failures */
+	unsigned int eject_rtime;		/* sliding average of the response times since the last ejection */
+	unsigned int eject_samples;		/* number of response times accounted in <eject_rtime> */
+	unsigned int eject_count;		/* number of consecutive ejections, for the backoff */
+	int eject_exp;				/* date the server is re-admitted, TICK_ETERNITY if not ejected */
+	struct task *eject_task;		/* task re-admitting the ejected server, NULL without outlier detection */
+	unsigned int adapt_limit;		/* adaptive concurrency limit ("adaptive-maxconn"), 0 if disabled */
+	unsigned int adapt_rtime;		/* sliding sum of the last ADAPT_RTIME_SAMPLES response times */
+	unsigned int adapt_base;		/* baseline of <adapt_rtime>, the lowest one seen, slowly rising */
+	unsigned int adapt_samples;		/* number of response times accounted since the last adjustment */
 	unsigned int flags;                     /* server flags (SRV_F_*) */
 	int slowstart;				/* slowstart time in seconds (ms in the conf) */
 
@@ -270,10 +289,13 @@ struct server {
 	unsigned lb_nodes_tot;                  /* number of allocated lb_nodes (C-HASH) */
 	unsigned lb_nodes_now;                  /* number of lb_nodes placed in the tree (C-HASH) */
 	struct tree_occ *lb_nodes;              /* lb_nodes_tot * struct tree_occ */
+	unsigned int lb_ewma;                   /* peak-EWMA of the response times, 0 if unknown ("balance ewma") */
+	unsigned int lb_ewma_date;              /* date of the last update of <lb_ewma> (ms) */
 
 	const struct netns_entry *netns;        /* contains network namespace name or NULL. Network namespace comes from configuration */
 	/* warning, these structs are huge, keep them at the bottom */
 	struct sockaddr_storage addr;           /* the address to connect to, doesn't include the port */
+	struct sockaddr_storage alt_addr;       /* alternate resolved address for happy eyeballs, AF_UNSPEC if none */
 	struct xprt_ops *xprt;                  /* transport-layer operations */
 	unsigned int svc_port;                  /* the port to connect to (for relevant families) */
 	unsigned down_time;			/* total time the server was down */
@@ -281,6 +303,8 @@ struct server {
 
 	int puid;				/* proxy-unique server ID, used for SNMP, and "first" LB algo */
 	int tcp_ut;                             /* for TCP, user timeout */
+	int notsent_lowat;                      /* for TCP, TCP_NOTSENT_LOWAT in bytes, 0 = unset */
+	unsigned int he_delay;                  /* happy eyeballs: delay before trying <alt_addr> (ms), 0 = disabled */
 
 	int do_check;                           /* temporary variable used during parsing to denote if health checks must be enabled */
 	int do_agent;                           /* temporary variable used during parsing to denote if an auxiliary agent check must be enabled */
@@ -332,7 +356,7 @@ struct server {
 #endif
 #ifdef USE_QUIC
 	struct quic_transport_params quic_params;          /* QUIC transport parameters */
-	struct eb_root cids;
+	struct quic_cid_tree cids;                         /* our QUIC connection IDs */
 #endif
 	struct dns_srvrq *srvrq;		/* Pointer representing the DNS SRV requeest, if any */
 	__decl_hathreads(HA_SPINLOCK_T lock);   /* may enclose the proxy's lock, must not be taken under */
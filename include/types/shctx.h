@@ -15,6 +15,7 @@
 
 #define SHCTX_E_ALLOC_CACHE -1
 #define SHCTX_E_INIT_LOCK   -2
+#define SHCTX_E_OPEN_FILE   -3
 
 #define SHCTX_F_REMOVING 0x1      /* Removing flag, does not accept new */
 
@@ -47,6 +47,7 @@ enum sink_fmt {
 	SINK_FMT_TIMED,     // syslog level then ISO
 	SINK_FMT_RFC3164,   // regular syslog
 	SINK_FMT_RFC5424,   // extended syslog
+	SINK_FMT_CBOR,      // CBOR encoded record
 };
 
 struct sink_forward_target {
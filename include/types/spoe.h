@@ -275,6 +275,8 @@ struct spoe_agent {
 		struct list     applets;        /* all SPOE applets for this agent */
 		struct list     sending_queue;  /* Queue of streams waiting to send data */
 		struct list     waiting_queue;  /* Queue of streams waiting for a ack, in async mode */
+		struct spoe_appctx *batch_appctx; /* idle applet woken up to send the queued contexts, if any */
+		unsigned int    batched;        /* # of contexts queued since <batch_appctx> was woken up */
 		__decl_hathreads(HA_SPINLOCK_T lock);
 	} *rt;
 
@@ -62,9 +62,32 @@ struct cert_key_and_chain {
  * XXX: Once we remove the multi-cert bundle support, we could merge this structure
  * with the cert_key_and_chain one.
  */
+#ifdef HAVE_SSL_CERT_COMP
+/* A compressed Certificate message (RFC 8879) */
+struct ckch_cert_comp_msg {
+	size_t len;                 /* length of the uncompressed message */
+	size_t comp_len;            /* length of the compressed message */
+	unsigned char data[0];      /* <len> bytes of message then <comp_len> compressed bytes */
+};
+
+/* Compressed certificate chain of a ckch_store, shared by the SSL_CTXs of its
+ * instances which hold a reference on it. The message depends on the TLS
+ * stack, so it is built on the first handshake, then never replaced.
+ */
+struct ckch_cert_comp {
+	unsigned int refcount;
+	struct ckch_cert_comp_msg *msg; /* NULL until built */
+};
+#endif
+
 struct ckch_store {
 	struct cert_key_and_chain *ckch;
+#ifdef HAVE_SSL_CERT_COMP
+	struct ckch_cert_comp *cert_comp; /* compressed chain, NULL until an instance uses it */
+#endif
 	unsigned int multi:1;  /* is it a multi-cert bundle ? */
+	unsigned int lazy_err:1; /* the certificate loaded on demand is invalid */
+	char *pem;             /* raw contents of a certificate loaded on demand, or NULL */
 	struct list ckch_inst; /* list of ckch_inst which uses this ckch_node */
 	struct list crtlist_entry; /* list of entries which use this store */
 	struct ebmb_node node;
@@ -86,10 +109,13 @@ struct ckch_inst {
 	struct ckch_store *ckch_store; /* pointer to the store used to generate this inst */
 	struct crtlist_entry *crtlist_entry; /* pointer to the crtlist_entry used, or NULL */
 	unsigned int is_default:1;      /* This instance is used as the default ctx for this bind_conf */
+	unsigned int lazy:1;            /* This instance was loaded on demand and may be evicted */
 	/* space for more flag there */
+	unsigned int last_use;          /* date of the last handshake using a lazy instance, in ms */
 	struct list sni_ctx; /* list of sni_ctx using this ckch_inst */
 	struct list by_ckchs; /* chained in ckch_store's list of ckch_inst */
 	struct list by_crtlist_entry; /* chained in crtlist_entry list of inst */
+	struct list by_lazy; /* chained in the list of lazy instances */
 };
 
 #endif /* USE_OPENSSL */
@@ -52,6 +52,8 @@
 #define SSL_SOCK_ST_FL_16K_WBFSIZE  0x00000002
 #define SSL_SOCK_SEND_UNLIMITED     0x00000004
 #define SSL_SOCK_RECV_HEARTBEAT     0x00000008
+#define SSL_SOCK_KTLS_ULP           0x00000010  /* the "tls" ULP is attached to the socket */
+#define SSL_SOCK_KTLS_TX            0x00000020  /* the kernel encrypts the records we send */
 
 /* bits 0xFFFF0000 are reserved to store verify errors */
 
@@ -136,6 +138,15 @@ struct sni_ctx {
 	struct ebmb_node name;    /* node holding the servername value */
 };
 
+/* SNI filter of a crt-list entry whose certificate is only loaded on the first
+ * handshake it matches ("tune.ssl.lazy-load"). Wildcards are indexed without
+ * their '*', like in the sni_w_ctx tree.
+ */
+struct sni_lazy {
+	struct crtlist_entry *entry; /* entry to instantiate */
+	struct ebmb_node name;       /* node holding the lower case servername */
+};
+
 extern struct list tlskeys_reference;
 
 struct tls_sess_key_128 {
@@ -243,6 +254,7 @@ struct ssl_sock_ctx {
 	int xprt_st;                  /* transport layer state, initialized to zero */
 	struct buffer early_buf;      /* buffer to store the early data received */
 	int sent_early_data;          /* Amount of early data we sent so far */
+	int ktls_ctrl_msg;            /* record type of the next kTLS control message, or 0 */
 
 };
 
@@ -275,6 +287,12 @@ struct global_ssl {
 	int ctx_cache; /* max number of entries in the ssl_ctx cache. */
 	int capture_cipherlist; /* Size of the cipherlist buffer. */
 	int extra_files; /* which files not defined in the configuration file are we looking for */
+	int lazy_load; /* max number of certificates loaded on demand, 0 to load them all at boot */
+	int load_threads; /* number of threads loading the certificates at boot, 0 for one per CPU */
+	int ocsp_update; /* whether the OCSP responses are periodically fetched from the responders */
+	int ocsp_update_min; /* minimum delay between two updates of an OCSP response, in seconds */
+	int ocsp_update_max; /* maximum delay between two updates of an OCSP response, in seconds */
+	int cache_shards; /* number of shards of the session cache, 0 for one per thread */
 };
 
 #if HA_OPENSSL_VERSION_NUMBER >= 0x1000200fL
@@ -35,6 +35,7 @@
 #define STAT_SHDESC     0x00000400      /* conf: show description */
 #define STAT_SHLGNDS    0x00000800      /* conf: show legends */
 #define STAT_SHOW_FDESC 0x00001000      /* show the field descriptions when possible */
+#define STAT_CHANGED    0x00002000      /* only dump the objects which recently changed */
 
 #define STAT_BOUND      0x00800000	/* bound statistics to selected proxies/types/services */
 #define STAT_STARTED    0x01000000	/* some output has occurred */
@@ -435,10 +436,70 @@ enum stat_field {
 	ST_F_RT_MAX,
 	ST_F_TT_MAX,
 	ST_F_EINT,
+	ST_F_QUIC_RX_PKTS,
+	ST_F_QUIC_TX_PKTS,
+	ST_F_QUIC_LOST_PKTS,
+	ST_F_QUIC_PTO,
+	ST_F_QUIC_RETRIES,
+	ST_F_QUIC_SRESETS,
+	ST_F_QT_P50,
+	ST_F_QT_P99,
+	ST_F_CT_P50,
+	ST_F_CT_P99,
+	ST_F_RT_P50,
+	ST_F_RT_P99,
+	ST_F_TT_P50,
+	ST_F_TT_P99,
+	ST_F_QUIC_HO_FWD,
+	ST_F_QUIC_HO_RCVD,
 
 	/* must always be the last one */
 	ST_F_TOTAL_FIELDS
 };
 
+/* Layout of the shared memory statistics file ("shm-stats-file"). All values
+ * are in the native byte order. The file starts with a header followed by
+ * <nb_objs> records of <obj_size> bytes starting at <obj_ofs>. Each record
+ * starts with a struct stats_shm_obj followed by <nb_fields> 64-bit values
+ * indexed like the "show stat" fields, then by <nb_fields> bytes holding their
+ * format (enum field_format, FF_EMPTY for the fields not reported). The signed
+ * values are sign-extended and the floats are stored as doubles. Any change
+ * to this layout other than appending fields must bump STATS_SHM_VERSION.
+ *
+ * The records are published with a sequence lock : <seq> is odd while the
+ * record is being updated. A reader must read <seq>, retry later if it is odd,
+ * read the record, then read <seq> again and retry if it changed.
+ */
+#define STATS_SHM_MAGIC    0x53504148  /* "HAPS" in little endian */
+#define STATS_SHM_VERSION  1
+#define STATS_SHM_NAME_LEN 64          /* names are truncated to 63 chars */
+#define STATS_SHM_STAT_LEN 16          /* statuses are truncated to 15 chars */
+
+struct stats_shm_hdr {
+	uint32_t magic;                 /* STATS_SHM_MAGIC */
+	uint16_t version;               /* STATS_SHM_VERSION */
+	uint16_t hdr_size;              /* size of this header */
+	uint32_t obj_ofs;               /* offset of the first record */
+	uint32_t obj_size;              /* size of each record */
+	uint32_t nb_objs;               /* number of records */
+	uint32_t nb_fields;             /* number of values per record */
+	uint32_t pid;                   /* pid of the publishing process */
+	uint32_t interval;              /* publication interval (ms) */
+	uint64_t start_date;            /* start date of the process (s since epoch) */
+	uint64_t updated;               /* date of the last complete update (ms since epoch), 0 before */
+};
+
+struct stats_shm_obj {
+	uint32_t seq;                   /* sequence number, odd during updates */
+	uint16_t type;                  /* STATS_TYPE_FE, STATS_TYPE_BE or STATS_TYPE_SV */
+	uint16_t reserved;
+	int32_t iid;                    /* unique id of the proxy */
+	int32_t sid;                    /* unique id of the server, 0 for proxies */
+	char pxname[STATS_SHM_NAME_LEN]; /* proxy name */
+	char svname[STATS_SHM_NAME_LEN]; /* server name, or "FRONTEND"/"BACKEND" */
+	char status[STATS_SHM_STAT_LEN]; /* status field, as in "show stat" */
+	uint64_t val[0];                /* values, followed by their formats */
+};
+
 
 #endif /* _TYPES_STATS_H */
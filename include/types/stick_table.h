@@ -122,6 +122,22 @@ struct stktable_data_type {
 /* stick table key type flags */
 #define STK_F_CUSTOM_KEYSIZE      0x00000001   /* this table's key size is configurable */
 
+/* maximum number of shards of a stick table, one per thread up to this */
+#define STKTABLE_MAX_SHARDS       64
+
+/* default and maximum number of rows of a stick table's count-min sketch */
+#define STKTABLE_SKETCH_DEPTH     4
+#define STKTABLE_SKETCH_MAX_DEPTH 16
+
+/* bounds of the number of bits of each generation of a stick table's reject
+ * filter, and default delay between two generations when the table does not
+ * expire (ms).
+ */
+#define STKTABLE_REJECT_MIN_BITS  4096
+#define STKTABLE_REJECT_MAX_BITS  (1U << 23)
+#define STKTABLE_REJECT_PERIOD    10000
+#define STKTABLE_REJECT_HASHES    3
+
 /* stick table keyword type */
 struct stktable_type {
 	const char *kw;           /* keyword string */
@@ -138,7 +154,7 @@ extern struct stktable_type stktable_types[];
  */
 struct stksess {
 	unsigned int expire;      /* session expiration date */
-	unsigned int ref_cnt;     /* reference count, can only purge when zero */
+	unsigned int ref_cnt;     /* reference count, can only purge when zero, atomically updated */
 	__decl_hathreads(HA_RWLOCK_T lock); /* lock related to the table entry */
 	struct eb32_node exp;     /* ebtree node used to hold the session in expiration tree */
 	struct eb32_node upd;     /* ebtree node used to hold the update sequence tree */
@@ -147,6 +163,16 @@ struct stksess {
 };
 
 
+/* A stick table's entries are spread over shards selected by the hash of
+ * their key, so that the threads working on different keys do not compete
+ * for the same lock. The expiration and purge decisions are taken per shard.
+ */
+struct stktable_shard {
+	struct eb_root keys;      /* head of sticky session tree */
+	struct eb_root exps;      /* head of sticky session expiration tree */
+	__decl_hathreads(HA_SPINLOCK_T lock); /* spin lock related to the shard's trees */
+} ALIGNED(64);
+
 /* stick table */
 struct stktable {
 	char *id;		  /* local table id name. */
@@ -159,11 +185,11 @@ struct stktable {
 		int line;             /* The line in this <file> the stick-table is declared. */
 	} conf;
 	struct ebpt_node name;    /* Stick-table are lookup by name here. */
-	struct eb_root keys;      /* head of sticky session tree */
-	struct eb_root exps;      /* head of sticky session expiration tree */
+	struct stktable_shard *shards; /* <nb_shards> shards holding the entries */
+	unsigned int nb_shards;   /* number of shards, always a power of two */
 	struct eb_root updates;   /* head of sticky updates sequence tree */
 	struct pool_head *pool;   /* pool used to allocate sticky sessions */
-	__decl_hathreads(HA_SPINLOCK_T lock); /* spin lock related to the table */
+	__decl_hathreads(HA_SPINLOCK_T lock); /* spin lock related to the updates tree */
 	struct task *exp_task;    /* expiration task */
 	struct task *sync_task;   /* sync task */
 	unsigned int update;
@@ -181,7 +207,31 @@ struct stktable {
 	unsigned int size;        /* maximum number of sticky sessions in table */
 	unsigned int current;     /* number of sticky sessions currently in table */
 	int nopurge;              /* if non-zero, don't purge sticky sessions when full */
-	int exp_next;             /* next expiration date (ticks) */
+	unsigned int sketch_width; /* number of cells per row of the sketch, 0 if none */
+	unsigned int sketch_depth; /* number of rows of the sketch */
+	char *sketch;             /* count-min sketch of the purged entries' counters */
+	struct {
+		unsigned int threshold; /* gpc0 value from which a source is rejected, 0 if none */
+		unsigned long *bits[2]; /* bloom filters of the current and previous generations */
+		unsigned int mask;    /* number of bits of each generation minus one */
+		unsigned int cur;     /* index of the current generation in <bits> */
+		int period;           /* lifetime of a generation (ms) */
+		int rotate;           /* date of the next rotation (ticks) */
+	} reject;
+	struct {
+		char *file;           /* snapshot file, NULL if the table is not persisted */
+		char *tmp;            /* file the snapshots are written to before being renamed */
+		int interval;         /* delay between two snapshots (ms), 0 for none */
+		int ready;            /* set once the previous snapshot was loaded */
+		struct task *task;    /* task loading and writing the snapshots */
+		char *map;            /* mapping of the snapshot being loaded, if any */
+		size_t map_len;       /* length of <map> */
+		size_t map_ofs;       /* offset of the next record to load from <map> */
+		unsigned int age;     /* age of the snapshot being loaded (ms) */
+		int fd;               /* snapshot being written, -1 if none */
+		unsigned int shard;   /* shard of the next entry to write */
+		struct stksess *next; /* next entry to write, referenced */
+	} persist;
 	int expire;               /* time to live for sticky sessions (milliseconds) */
 	int data_size;            /* the size of the data that is prepended *before* stksess */
 	int data_ofs[STKTABLE_DATA_TYPES]; /* negative offsets of present data types, or 0 if absent */
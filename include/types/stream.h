@@ -92,6 +92,12 @@
 
 #define SF_SRV_REUSED   0x00100000	/* the server-side connection was reused */
 
+#define SF_LOG_KEEP     0x00200000	/* the stream must be logged ("set-log-decision keep") */
+#define SF_LOG_DROP     0x00400000	/* the stream must not be logged (action or sampling) */
+#define SF_LOG_SAMPLED  0x00800000	/* the "log-sample" decision was already taken */
+#define SF_HE_ARMED     0x01000000	/* the connect attempt may fall back to the server's alternate address */
+#define SF_HE_ALT       0x02000000	/* the server's alternate address is being used */
+
 
 /* flags for the proxy of the master CLI */
 /* 0x1.. to 0x3 are reserved for ACCESS_LVL_MASK */
@@ -166,6 +172,7 @@ struct stream {
 	char **res_cap;                         /* array of captures from the response (may be NULL) */
 	struct vars vars_txn;                   /* list of variables for the txn scope. */
 	struct vars vars_reqres;                /* list of variables for the request and resp scope. */
+	struct smp_memo *smp_memo;              /* memoized sample fetches, NULL until needed */
 
 	struct stream_interface si[2];          /* client and server stream interfaces */
 	struct strm_logs logs;                  /* logs for this stream */
@@ -58,6 +58,15 @@ enum {
 	TL_CLASSES       /* must be last */
 };
 
+/* The per-thread timer wheel holds the timers of the tasks bound to this thread
+ * which expire in the near future. Its level 0 has one slot per tick, and its
+ * level 1 one slot per TW0_SLOTS ticks. Farther timers stay in the tree.
+ */
+#define TW0_BITS         8
+#define TW0_SLOTS        (1U << TW0_BITS)
+#define TW1_BITS         6
+#define TW1_SLOTS        (1U << TW1_BITS)
+
 struct notification {
 	struct list purge_me; /* Part of the list of signals to be purged in the
 	                         case of the LUA execution stack crash. */
@@ -70,11 +79,17 @@ struct notification {
 /* force to split per-thread stuff into separate cache lines */
 struct task_per_thread {
 	struct eb_root timers;  /* tree constituting the per-thread wait queue */
+	struct list wheel0[TW0_SLOTS]; /* timer wheel, level 0 (one tick per slot) */
+	struct list wheel1[TW1_SLOTS]; /* timer wheel, level 1 (TW0_SLOTS ticks per slot) */
+	unsigned int wheel_clk; /* next tick of the timer wheel to be processed */
+	unsigned int wheel_cnt[2]; /* number of tasks in each level of the wheel */
 	struct eb_root rqueue;  /* tree constituting the per-thread run queue */
 	struct mt_list shared_tasklet_list; /* Tasklet to be run, woken up by other threads */
+	struct mt_list steal_list; /* migratable tasks woken up by this thread, may be stolen */
 	struct list tasklets[TL_CLASSES]; /* tasklets (and/or tasks) to run, by class */
 	int task_list_size;     /* Number of tasks among the tasklets */
 	int rqueue_size;        /* Number of elements in the per-thread run queue */
+	unsigned int steal_size; /* Number of tasks in the steal list */
 	struct task *current;   /* current task (not tasklet) */
 	__attribute__((aligned(64))) char end[0];
 };
@@ -95,7 +110,10 @@ struct task_per_thread {
 struct task {
 	TASK_COMMON;			/* must be at the beginning! */
 	struct eb32sc_node rq;		/* ebtree node used to hold the task in the run queue */
-	struct eb32_node wq;		/* ebtree node used to hold the task in the wait queue */
+	union {
+		struct eb32_node wq;	/* ebtree node used to hold the task in the wait queue */
+		struct list wheel;	/* or element of a timer wheel slot, see TASK_WQ_WHEEL */
+	};
 	int expire;			/* next expiration date for this task, in ticks */
 	unsigned long thread_mask;	/* mask of thread IDs authorized to process the task */
 	uint64_t call_date;		/* date of the last task wakeup or call */
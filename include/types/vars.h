@@ -17,6 +17,8 @@ enum vars_scope {
 
 struct vars {
 	struct list head;
+	struct var **slots;     /* variables indexed by their name's index, or NULL */
+	unsigned int nb_slots;  /* number of entries allocated in <slots> */
 	enum vars_scope scope;
 	unsigned int size;
 	__decl_hathreads(HA_RWLOCK_T rwlock);
@@ -26,11 +28,13 @@ struct vars {
 struct var_desc {
 	const char *name; /* Contains the normalized variable name. */
 	enum vars_scope scope;
+	unsigned int idx; /* index of the name, used to find the variable */
 };
 
 struct var {
 	struct list l; /* Used for chaining vars. */
 	const char *name; /* Contains the variable name. */
+	unsigned int idx; /* index of the name in the vars' slots */
 	struct sample_data data; /* data storage. */
 };
 
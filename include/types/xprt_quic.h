@@ -25,6 +25,7 @@
 #include <sys/socket.h>
 #include <openssl/ssl.h>
 
+#include <common/hathreads.h>
 #include <common/mini-clist.h>
 
 #include <types/quic.h>
@@ -32,6 +33,8 @@
 #include <types/quic_frame.h>
 #include <types/quic_tls.h>
 #include <types/quic_loss.h>
+#include <types/quic_pacing.h>
+#include <types/quic_reasm.h>
 #include <types/task.h>
 
 #include <eb64tree.h>
@@ -43,6 +46,18 @@
 #define QUIC_CONN_MAX_PACKET  64
 
 #define QUIC_STATELESS_RESET_TOKEN_LEN 16
+/* A stateless reset is at least 5 unpredictable bytes followed by the token
+ * (RFC 9000 10.3). It is not made longer than a short header packet with our
+ * connection IDs and a minimal payload to save bandwidth.
+ */
+#define QUIC_STATELESS_RESET_PACKET_MINLEN (5 + QUIC_STATELESS_RESET_TOKEN_LEN)
+#define QUIC_STATELESS_RESET_PACKET_MAXLEN 43
+
+/* Number of scheduling classes of the STREAM frames, given by the mux. The
+ * HTTP/3 one uses the urgency and the incremental parameter of the streams
+ * (RFC 9218) as (urgency << 1) | incremental.
+ */
+#define QUIC_TX_PRIO_NB       16
 
 #define           QUIC_EV_CONN_NEW       (1ULL << 0)
 #define           QUIC_EV_CONN_INIT      (1ULL << 1)
@@ -105,6 +120,21 @@
     _a > _b ? _a : _b; })
 
 extern struct trace_source trace_quic;
+/* Number of trees the connection IDs of a listener are spread over,
+ * must be a power of 2.
+ */
+#define QUIC_CID_TREES_CNT  256
+
+/* A tree of QUIC connections indexed by connection ID, with its own lock.
+ * The listeners spread their connection IDs over QUIC_CID_TREES_CNT such
+ * trees depending on a hash of these IDs.
+ */
+struct quic_cid_tree {
+	struct eb_root root;
+	__decl_hathreads(HA_RWLOCK_T lock);
+};
+
+extern struct pool_head *pool_head_quic_dgram;
 extern struct pool_head *pool_head_quic_rx_packet;
 extern struct pool_head *pool_head_quic_tx_packet;
 extern struct pool_head *pool_head_quic_tx_frm;
@@ -140,6 +170,7 @@ struct preferred_address {
 #define QUIC_DFLT_MAX_PACKET_SIZE     65527
 #define QUIC_DFLT_ACK_DELAY_COMPONENT     3 /* milliseconds */
 #define QUIC_DFLT_MAX_ACK_DELAY          25 /* milliseconds */
+#define QUIC_DFLT_MIN_ACK_DELAY        1000 /* microseconds */
 
 /* Types of QUIC transport parameters */
 #define QUIC_TP_ORIGINAL_DESTINATION_CONNECTION_ID   0
@@ -158,6 +189,9 @@ struct preferred_address {
 #define QUIC_TP_PREFERRED_ADDRESS                   13
 #define QUIC_TP_ACTIVE_CONNECTION_ID_LIMIT          14
 #define QUIC_TP_INITIAL_SOURCE_CONNECTION_ID        15
+#define QUIC_TP_RETRY_SOURCE_CONNECTION_ID          16
+/* draft-ietf-quic-ack-frequency */
+#define QUIC_TP_MIN_ACK_DELAY               0xff02de1aULL
 
 /*
  * These defines are not for transport parameter type, but the maximum accepted value for
@@ -167,7 +201,7 @@ struct preferred_address {
 #define QUIC_TP_MAX_ACK_DELAY_LIMIT      (1UL << 14)
 
 /* The maximum length of encoded transport parameters for any QUIC peer. */
-#define QUIC_TP_MAX_ENCLEN    128
+#define QUIC_TP_MAX_ENCLEN    160
 /*
  * QUIC transport parameters.
  * Note that forbidden parameters sent by clients MUST generate TRANSPORT_PARAMETER_ERROR errors.
@@ -183,6 +217,7 @@ struct quic_transport_params {
 	uint64_t initial_max_streams_uni;
 	uint64_t ack_delay_exponent;                                   /* Default: 3, max: 20 */
 	uint64_t max_ack_delay;                                        /* Default: 3ms, max: 2^14ms*/
+	uint64_t min_ack_delay;                                        /* microseconds, 0 if not supported */
 	uint64_t active_connection_id_limit;
 
 	/* Booleans */
@@ -191,6 +226,7 @@ struct quic_transport_params {
 	uint8_t with_preferred_address;
 	uint8_t original_destination_connection_id_present;
 	uint8_t initial_source_connection_id_present;
+	uint8_t retry_source_connection_id_present;
 
 	uint8_t stateless_reset_token[QUIC_STATELESS_RESET_TOKEN_LEN]; /* Forbidden for clients */
 	/*
@@ -200,22 +236,31 @@ struct quic_transport_params {
 	struct quic_cid original_destination_connection_id;            /* Forbidden for clients */
 	/* MUST be present both for servers and clients. */
 	struct quic_cid initial_source_connection_id;
+	/* MUST be sent by servers after a Retry. */
+	struct quic_cid retry_source_connection_id;                    /* Forbidden for clients */
 	struct preferred_address preferred_address;                    /* Forbidden for clients */
 };
 
+/* Maximum number of ACK ranges stored by packet number space (power of 2).
+ * Beyond this limit, the oldest ranges (smallest packet numbers) are dropped.
+ */
+#define QUIC_MAX_ACK_RANGES   32
+
 /* Structure for ACK ranges sent in ACK frames. */
 struct quic_ack_range {
-	struct list list;
 	int64_t first;
 	int64_t last;
 };
 
 struct quic_ack_ranges {
-	/* list of ACK ranges. */
-	struct list list;
-	/* The number of ACK ranges is this lists */
+	/* Circular array of ACK ranges in descending order, the one with
+	 * the largest packet numbers being at <head> index.
+	 */
+	struct quic_ack_range arngs[QUIC_MAX_ACK_RANGES];
+	unsigned int head;
+	/* The number of ACK ranges is this array */
 	size_t sz;
-	/* The number of bytes required to encode this ACK ranges lists. */
+	/* The number of bytes required to encode these ACK ranges. */
 	size_t enc_sz;
 };
 
@@ -245,6 +290,8 @@ struct quic_pktns {
 		unsigned int pto_probe;
 		/* In flight bytes for this packet number space. */
 		size_t in_flight;
+		/* The ECN counts reported by the last ACK_ECN frame. */
+		struct quic_ecn_counts ecn_counts;
 	} tx;
 	struct {
 		/* Largest packet number */
@@ -252,6 +299,8 @@ struct quic_pktns {
 		/* Number of ack-eliciting packets. */
 		size_t nb_ack_eliciting;
 		struct quic_ack_ranges ack_ranges;
+		/* The ECN counts of the received packets. */
+		struct quic_ecn_counts ecn_counts;
 	} rx;
 	unsigned int flags;
 };
@@ -262,8 +311,107 @@ struct quic_pktns {
 /* Default QUIC connection transport parameters */
 extern struct quic_transport_params quid_dflt_transport_params;
 
+/* ECN codepoints (the two least significant bits of the IPv4 TOS field
+ * or of the IPv6 traffic class).
+ */
+#define QUIC_ECN_NOT_ECT   0x00
+#define QUIC_ECN_ECT1      0x01
+#define QUIC_ECN_ECT0      0x02
+#define QUIC_ECN_CE        0x03
+#define QUIC_ECN_MASK      0x03
+
 /* Flag a received packet as being an ack-eliciting packet. */
 #define QUIC_FL_RX_PACKET_ACK_ELICITING (1UL << 0)
+/* Flag a received packet as carrying other frames than probing ones. */
+#define QUIC_FL_RX_PACKET_NON_PROBING   (1UL << 1)
+/* Flag a received packet as coming from another address than the peer one. */
+#define QUIC_FL_RX_PACKET_NEW_PATH      (1UL << 2)
+
+/* Received UDP datagram. Its buffer of tune.bufsize bytes is shared by all
+ * the RX packets it carries, each of them holding a reference on it, so that
+ * they may be decrypted in place.
+ * <list>, <owner> and <len> are only used when the datagram has to be handed
+ * over to the thread owning its connection. <saddr> is the source address of
+ * the datagram.
+ */
+struct quic_dgram {
+	volatile unsigned int refcnt;
+	struct mt_list list;
+	void *owner;
+	size_t len;
+	struct sockaddr_storage saddr;
+	/* ECN codepoint of the IP header. */
+	unsigned char ecn;
+	/* Size of the UDP segments coalesced by GRO, 0 if not coalesced. */
+	size_t segsz;
+	unsigned char data[VAR_ARRAY];
+};
+
+/* Per-thread handler of the datagrams received by other threads for the
+ * connections this thread owns.
+ */
+struct quic_dghdlr {
+	struct mt_list dgrams;
+	struct tasklet *task;
+};
+
+/* Messages exchanged over the handover sockets of the processes started by
+ * the reloads ("quic-handover"). A HELLO is sent by a starting process to the
+ * ones still alive. A DGRAM carries a datagram received by <laddr> listener
+ * of the sender from <saddr> for a connection owned by the recipient.
+ */
+#define QUIC_HO_MAGIC      0x51484f31 /* "QHO1" */
+#define QUIC_HO_T_HELLO    0
+#define QUIC_HO_T_DGRAM    1
+/* The datagram opens a new connection and is sent to the newest process. */
+#define QUIC_HO_F_NEW      0x01
+
+struct quic_ho_hdr {
+	uint32_t magic;
+	unsigned char type;
+	unsigned char flags;
+	/* Generation of the sender. */
+	unsigned char gen;
+	/* ECN codepoint and GRO segment size of the datagram. */
+	unsigned char ecn;
+	uint32_t segsz;
+	struct sockaddr_storage laddr;
+	struct sockaddr_storage saddr;
+};
+
+/* Stages of the receive path whose CPU cycles are measured while replaying a
+ * pcap file ("debug quic replay"). The datagram stage includes the packet one.
+ */
+enum quic_replay_stage {
+	QUIC_RS_DGRAM = 0,   /* dispatching and parsing of a datagram */
+	QUIC_RS_PKT,         /* qc_lstnr_pkt_rcv(), once per packet */
+	QUIC_RS_HS,          /* connection I/O handler during the handshake */
+	QUIC_RS_CONN,        /* connection I/O handler after the handshake */
+	QUIC_RS_NB
+};
+
+/* Context of a pcap file replay, loaded at once in memory. */
+struct quic_replay {
+	unsigned char *data;
+	size_t len;
+	/* Offset of the next record. */
+	size_t pos;
+	/* The file was written with the other byte order. */
+	int swapped;
+	/* Link layer type of the records (DLT_*). */
+	unsigned int linktype;
+	unsigned int loop;
+	unsigned int loops;
+	int done;
+	uint64_t start_us;
+	unsigned long long dgrams;
+	unsigned long long bytes;
+	/* Records which are not UDP datagrams for a QUIC listener. */
+	unsigned long long skipped;
+	/* Cycles and calls of each stage, updated by all the threads. */
+	unsigned long long calls[QUIC_RS_NB];
+	unsigned long long cycles[QUIC_RS_NB];
+};
 
 struct quic_rx_packet {
 	struct list list;
@@ -277,12 +425,16 @@ struct quic_rx_packet {
 	int64_t pn;
 	/* Packet number length */
 	uint32_t pnl;
+	/* Token of Initial packets. */
+	const unsigned char *token;
 	uint64_t token_len;
 	/* Packet length */
 	uint64_t len;
 	/* Additional authenticated data length */
 	size_t aad_len;
-	unsigned char data[QUIC_PACKET_MAXLEN];
+	/* Points to the first byte of this packet in <dgram> datagram. */
+	unsigned char *data;
+	struct quic_dgram *dgram;
 	struct eb64_node pn_node;
 	volatile unsigned int refcnt;
 	unsigned int flags;
@@ -302,6 +454,12 @@ struct quic_rx_crypto_frm {
 #define QUIC_FL_TX_PACKET_PADDING       (1UL << 1)
 /* Flag a sent packet as being in flight. */
 #define QUIC_FL_TX_PACKET_IN_FLIGHT     (QUIC_FL_TX_PACKET_ACK_ELICITING | QUIC_FL_TX_PACKET_PADDING)
+/* Flag a sent packet as sent while the application was limiting the sending rate. */
+#define QUIC_FL_TX_PACKET_APP_LIMITED   (1UL << 2)
+/* Flag a sent packet as sent in a datagram with the ECT(0) codepoint. */
+#define QUIC_FL_TX_PACKET_ECT0          (1UL << 3)
+/* Flag a sent packet as being a DPLPMTUD probe. */
+#define QUIC_FL_TX_PACKET_PMTUD_PROBE   (1UL << 4)
 
 /* Structure to store enough information about TX QUIC packets. */
 struct quic_tx_packet {
@@ -311,6 +469,8 @@ struct quic_tx_packet {
 	 * for in flight TX packet.
 	 */
 	size_t in_flight_len;
+	/* The length of this packet, for qlog. */
+	size_t len;
 	struct eb64_node pn_node;
 	/* The number of bytes of CRYPTO data in this packet. */
 	size_t cdata_len;
@@ -322,6 +482,13 @@ struct quic_tx_packet {
 	struct quic_pktns *pktns;
 	/* Flags. */
 	unsigned int flags;
+	/* Delivery rate sampling: the send date (us) of this packet and
+	 * the delivery state of its path when it was sent.
+	 */
+	uint64_t time_sent_us;
+	uint64_t delivered;
+	uint64_t delivered_time;
+	uint64_t first_sent_time;
 };
 
 /* Structure to stora enough information about the TX frames. */
@@ -377,8 +544,10 @@ struct quic_enc_level {
 		struct list pqpkts;
 		/* Crypto frames */
 		struct {
+			/* Offset of the first CRYPTO byte not provided to TLS yet. */
 			uint64_t offset;
-			struct eb_root frms; /* XXX TO CHECK XXX */
+			/* The CRYPTO data received after a gap. */
+			struct quic_reasm reasm;
 		} crypto;
 	} rx;
 	struct {
@@ -395,6 +564,62 @@ struct quic_enc_level {
 	struct quic_pktns *pktns;
 };
 
+/* ECN validation states of a path (RFC 9000 13.4.2). */
+enum quic_ecn_state {
+	/* Sending ECT(0) marked packets to test the path. */
+	QUIC_ECN_ST_TESTING,
+	/* Waiting for the validation of the test packets. */
+	QUIC_ECN_ST_UNKNOWN,
+	QUIC_ECN_ST_CAPABLE,
+	QUIC_ECN_ST_FAILED,
+};
+
+/* Number of ECT(0) marked packets sent during the testing state. */
+#define QUIC_ECN_TESTING_PKTS  10
+
+struct quic_ecn {
+	enum quic_ecn_state state;
+	/* Number of ECT(0) marked packets sent and lost during the testing state. */
+	unsigned int nb_test_pkts;
+	unsigned int nb_test_lost;
+};
+
+/* DPLPMTUD states of a path (RFC 8899 5.2). */
+enum quic_pmtud_state {
+	/* Waiting for the handshake completion to start the search. */
+	QUIC_PMTUD_ST_BASE,
+	/* Sending probes to look for a larger PLPMTU. */
+	QUIC_PMTUD_ST_SEARCHING,
+	/* The largest supported PLPMTU has been found. */
+	QUIC_PMTUD_ST_COMPLETE,
+};
+
+/* Number of lost probes of a given size before considering this size as not
+ * supported by the path.
+ */
+#define QUIC_PMTUD_MAX_PROBES  3
+/* The search is complete when the range of sizes to probe is smaller. */
+#define QUIC_PMTUD_MIN_STEP   16
+/* Default and maximum values of the maximum size of sent UDP payloads. */
+#define QUIC_DFLT_MAX_DGRAM_SZ  1472
+#define QUIC_MAX_DGRAM_SZ      65527
+
+struct quic_pmtud {
+	enum quic_pmtud_state state;
+	/* The largest size acknowledged on the path, and the largest size
+	 * which has not been detected as not supported.
+	 */
+	size_t low;
+	size_t high;
+	/* The size of the current probe, and its packet number if in flight
+	 * (-1 if not).
+	 */
+	size_t size;
+	int64_t pn;
+	/* The number of lost probes of <size> bytes. */
+	unsigned int nb_lost;
+};
+
 struct quic_path {
 	/* Control congestion. */
 	struct quic_cc cc;
@@ -411,49 +636,168 @@ struct quic_path {
 	uint64_t in_flight;
 	/* Number of in flight ack-eliciting packets. */
 	uint64_t in_flight_ae_pkts;
+
+	/* Delivery rate estimation: the number of bytes delivered, the
+	 * date (us) of the last delivery, the send date (us) of the first
+	 * packet of the current sampling interval, and the <delivered>
+	 * value marking the end of an application limited period (0 if none).
+	 */
+	uint64_t delivered;
+	uint64_t delivered_time;
+	uint64_t first_sent_time;
+	uint64_t app_limited;
+
+	/* Pacing of the datagrams sent on this path. */
+	struct quic_pacer pacer;
+	/* ECN validation. */
+	struct quic_ecn ecn;
+	/* Path MTU discovery. */
+	struct quic_pmtud pmtud;
+	/* Peer address, only valid for a path which is not the current one. */
+	struct sockaddr_storage addr;
 };
 
+/* The number of network paths of a connection: the current one and the
+ * previous one kept during the validation of the current one after a
+ * migration of the peer (RFC 9000 9).
+ */
+#define QUIC_CONN_PATHS_NB 2
+
+/* Flags of the 1-RTT key update state of a connection. */
+#define QUIC_FL_KU_NXT_RX_READY  (1U << 0)  /* nxt_rx keys are derived */
+#define QUIC_FL_KU_NXT_TX_READY  (1U << 1)  /* nxt_tx keys are derived */
+
+/* Default number of packets encrypted with the same 1-RTT keys before
+ * initiating a key update ("tune.quic.key-update-pkts"), well below the
+ * AEAD confidentiality limits (RFC 9001 6.6).
+ */
+#define QUIC_DFLT_KU_PKTS  (1ULL << 22)
+
+/* Default maximum rate of the stateless resets sent per second
+ * ("tune.quic.stateless-reset-rate").
+ */
+#define QUIC_DFLT_SRESET_RATE  1000
+
 /* The number of buffers for outgoing packets (must be a power of two). */
 #define QUIC_CONN_TX_BUFS_NB 8
-#define QUIC_CONN_TX_BUF_SZ  QUIC_PACKET_MAXLEN
-
-struct quic_conn {
-	uint32_t version;
 
-	/* Transport parameters. */
-	struct quic_transport_params params;
-	unsigned char enc_params[QUIC_TP_MAX_ENCLEN]; /* encoded QUIC transport parameters */
-	size_t enc_params_len;
+/* The number of slots of the per-thread QUIC timer wheels, one per tick, so
+ * about one second (must be a power of two).
+ */
+#define QUIC_TW_SLOTS        1024
 
-	/*
-	 * Original Destination Connection ID  (comming with first client Initial packets).
-	 * Used only by servers.
-	 */
-	struct ebmb_node odcid_node;
-	struct quic_cid odcid;
+/* The client address has been validated by a token or by the receipt of
+ * a Handshake packet (RFC 9000 8.1).
+ */
+#define QUIC_FL_CONN_ADDR_VALIDATED  (1U << 0)
+/* The events of this connection are reported to qlog ("tune.quic.qlog"). */
+#define QUIC_FL_CONN_QLOG            (1U << 1)
+/* The peer asked us not to acknowledge at once the reordered packets. */
+#define QUIC_FL_CONN_ACK_IGNORE_ORDER (1U << 2)
+/* The server could not send a datagram because of the anti-amplification
+ * limit, until it receives another one from the client.
+ */
+#define QUIC_FL_CONN_AMP_LIMITED     (1U << 3)
+/* This connection was opened by a replayed datagram ("debug quic replay"). */
+#define QUIC_FL_CONN_REPLAY          (1U << 4)
 
-	struct quic_cid dcid;
-	struct ebmb_node scid_node;
-	struct quic_cid scid;
-	struct eb_root cids;
+/* Default number of ack-eliciting packets received before an ACK is sent
+ * without waiting for the ACK delay (RFC 9000 13.2.2).
+ */
+#define QUIC_DFLT_ACK_TOLERANCE      2
 
-	struct quic_enc_level els[QUIC_TLS_ENC_LEVEL_MAX];
+/* Address validation tokens (RFC 9000 8.1), sent in Retry packets or in
+ * NEW_TOKEN frames. They are made of a type, a timestamp in seconds, the
+ * original destination connection ID for Retry tokens, and a truncated
+ * HMAC-SHA256 of these fields and of the client address.
+ */
+#define QUIC_TOKEN_TYPE_RETRY        0x00
+#define QUIC_TOKEN_TYPE_NEW_TOKEN    0x01
+#define QUIC_TOKEN_HMAC_LEN            16
+#define QUIC_TOKEN_KEY_LEN             32
+#define QUIC_TOKEN_MAXLEN     (1 + 4 + 1 + QUIC_CID_MAXLEN + QUIC_TOKEN_HMAC_LEN)
+/* Validity of the tokens, in seconds. */
+#define QUIC_RETRY_TOKEN_TIMEOUT       10
+#define QUIC_NEW_TOKEN_TIMEOUT       3600
+
+/* QUIC counters of a listener, updated by all the threads */
+struct quic_counters {
+	unsigned long long rx_pkts;   /* packets received */
+	unsigned long long tx_pkts;   /* packets sent */
+	unsigned long long lost_pkts; /* packets declared lost */
+	unsigned long long pto;       /* PTO expirations */
+	unsigned long long retries;   /* Retry packets sent */
+	unsigned long long sresets;   /* stateless resets sent */
+	unsigned long long ho_fwd;    /* datagrams forwarded to another process */
+	unsigned long long ho_rcvd;   /* datagrams forwarded by another process */
+};
 
-	struct quic_transport_params rx_tps;
+/* Per-thread timer wheel of the loss detection and PTO timers of the QUIC
+ * connections. Arming a timer only moves its connection to another slot, and
+ * a unique task wakes up for all the timers of the thread.
+ */
+struct quic_timer_wheel {
+	struct list slots[QUIC_TW_SLOTS]; /* armed timers by expiration date modulo QUIC_TW_SLOTS */
+	unsigned int cur;                 /* date of the next slot to process */
+	unsigned int nb;                  /* number of armed timers */
+	struct task *task;                /* the task processing the expired slots */
+};
 
-	struct quic_pktns pktns[QUIC_TLS_PKTNS_MAX];
+/* The header protection of a burst of packets sent by a connection at the
+ * same encryption level, with <secs> as TX secrets. It is applied to all of
+ * them at once by qc_hp_batch_apply(): the samples are copied here as the
+ * packets are built, and their masks computed with a unique call.
+ */
+struct quic_hp_batch {
+	struct quic_tls_secrets *secs;
+	int nb;
+	struct {
+		unsigned char *byte0;  /* first byte of the packet */
+		unsigned char *pn;     /* packet number field */
+		size_t pnlen;          /* length of this field */
+	} pkts[QUIC_TLS_HP_BATCH];
+	unsigned char samples[QUIC_TLS_HP_BATCH * QUIC_TLS_HP_SAMPLE_LEN];
+};
 
-	/* Used only to reach the tasklet for the I/O handler from this quic_conn object. */
-	struct connection *conn;
+/* Handshake-only part of a QUIC connection, allocated apart from it and
+ * released once the handshake is confirmed.
+ */
+struct quic_conn_hs {
+	unsigned char enc_params[QUIC_TP_MAX_ENCLEN]; /* encoded QUIC transport parameters */
+	size_t enc_params_len;
 	/* Output buffer used during the handshakes. */
 	struct {
 		unsigned char data[QUIC_PACKET_MAXLEN];
 		unsigned char *pos;
 	} obuf;
+};
+
+struct quic_conn {
+	/* The fields used for each packet come first so that they share the
+	 * same few cache lines.
+	 */
+
+	/* Used only to reach the tasklet for the I/O handler from this quic_conn object. */
+	struct connection *conn;
+	/* The thread this connection is bound to, encoded in its CIDs. */
+	unsigned int tid;
+	unsigned int flags;
+	struct quic_path paths[QUIC_CONN_PATHS_NB];
+	struct quic_path *path;
+	struct quic_cid dcid;
 
 	struct {
-		/* The remaining frames to send. */
+		/* The remaining frames to send, except the new STREAM ones. */
 		struct list frms_to_send;
+		/* The new STREAM frames to send, by scheduling class, sent
+		 * after <frms_to_send> one class after the other.
+		 */
+		struct list strm_frms[QUIC_TX_PRIO_NB];
+		/* Frames queued by other threads than the one of this
+		 * connection, moved at once to <frms_to_send> by this
+		 * one before building packets.
+		 */
+		struct mt_list frms_in;
 
 		/* Array of buffers. */
 		struct q_buf **bufs;
@@ -465,6 +809,16 @@ struct quic_conn {
 		int rbuf;
 		/* Number of sent bytes. */
 		uint64_t bytes;
+		/* Number of bytes of the Initial and Handshake packets built,
+		 * which are the only ones sent before the client address is
+		 * validated.
+		 */
+		uint64_t hs_bytes;
+		/* Number of sent packets, and of those declared lost. */
+		uint64_t pkts;
+		uint64_t lost_pkts;
+		/* Number of PTO expirations. */
+		unsigned int nb_pto;
 		/* The number of datagrams which may be sent
 		 * when sending probe packets.
 		 */
@@ -473,15 +827,98 @@ struct quic_conn {
 	struct {
 		/* Number of received bytes. */
 		uint64_t bytes;
+		/* Number of received packets successfully parsed. */
+		uint64_t pkts;
+		/* Delayed ACKs of the application packets: an ACK is sent
+		 * after <ack_tolerance> ack-eliciting packets or <ack_delay>
+		 * ticks after the first one at <ack_expire> date. The peer
+		 * may update them with ACK_FREQUENCY frames, <ack_freq_seq>
+		 * being the next sequence number accepted.
+		 */
+		unsigned int ack_tolerance;
+		unsigned int ack_delay;
+		unsigned int ack_expire;
+		uint64_t ack_freq_seq;
 	} rx;
 	/* In flight CRYPTO data counter. */
 	size_t ifcdata;
 	unsigned int max_ack_delay;
-	struct quic_path paths[1];
-	struct quic_path *path;
 
-	struct task *timer_task;
+	/* Expiration date of the timer, the first of the loss detection or
+	 * PTO date <ld_timer> and of <rx.ack_expire>, and the element of a
+	 * slot of the timer wheel of its thread while it is set.
+	 */
 	unsigned int timer;
+	unsigned int ld_timer;
+	struct list tw_list;
+	/* Task to send the datagrams delayed by the pacing, allocated on demand. */
+	struct task *pacing_task;
+
+	/* 1-RTT key update (RFC 9001 6). The next generation of keys is derived
+	 * in advance so that a key phase switch only exchanges these structures.
+	 */
+	struct {
+		/* RX keys of the previous key phase, for the reordered packets. */
+		struct quic_tls_kp prv_rx;
+		/* RX and TX keys of the next key phase. */
+		struct quic_tls_kp nxt_rx;
+		struct quic_tls_kp nxt_tx;
+		/* The smallest packet number received and the first one sent
+		 * within the current key phase.
+		 */
+		int64_t rx_pn;
+		int64_t tx_pn;
+		/* The number of packets encrypted with the current TX keys. */
+		uint64_t tx_pkts;
+		unsigned int flags;
+	} ku;
+
+	struct quic_enc_level els[QUIC_TLS_ENC_LEVEL_MAX];
+
+	struct quic_pktns pktns[QUIC_TLS_PKTNS_MAX];
+
+	/* The fields below are seldom used. */
+	uint32_t version;
+
+	/* Transport parameters. */
+	struct quic_transport_params params;
+
+	struct quic_transport_params rx_tps;
+
+	/*
+	 * Original Destination Connection ID  (comming with first client Initial packets).
+	 * Used only by servers.
+	 */
+	struct ebmb_node odcid_node;
+	struct quic_cid odcid;
+
+	struct ebmb_node scid_node;
+	struct quic_cid scid;
+	/* The trees <odcid_node> and <scid_node> are attached to. */
+	struct quic_cid_tree *odcid_tree;
+	struct quic_cid_tree *scid_tree;
+	struct eb_root cids;
+
+	/* Validation of the current path (RFC 9000 8.2): the previous path to
+	 * fall back to if it fails (NULL if no validation is in progress), the
+	 * data of the PATH_CHALLENGE frame sent and the expiration date.
+	 */
+	struct {
+		struct quic_path *prev;
+		unsigned char data[QUIC_PATH_CHALLENGE_LEN];
+		unsigned int expire;
+	} pv;
+
+	/* Token sent to the client in a NEW_TOKEN frame. */
+	unsigned char token[QUIC_TOKEN_MAXLEN];
+	/* Handshake-only data, released once the handshake is confirmed. */
+	struct quic_conn_hs *hs;
+	/* Number of bytes of memory used by this connection and its mux
+	 * beyond their fixed size structures ("tune.quic.conn-mem-max").
+	 */
+	size_t mem_used;
+	/* Element of the list of the connections of its thread ("show quic"). */
+	struct list list;
 };
 
 #endif /* _TYPES_XPRT_QUIC_H */
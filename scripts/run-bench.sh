@@ -0,0 +1,149 @@
+#!/bin/sh
+
+_help()
+{
+  cat << EOF
+### run-bench.sh ###
+  Runs the load benchmark scenarios found in tests/bench and reports one JSON
+  object per scenario on the standard output, for example :
+
+    {"scenario":"h1-keepalive","requests":100000,"failed":0,"req_per_sec":51530.12,
+     "p50_us":812,"p99_us":2471,"cpu_us_per_req":17.9}
+
+  Each scenario is a configuration file loaded after tests/bench/common.cfg.
+  Its client side is described by these comment lines, where \${BENCH_PORT}
+  is replaced with the listening port :
+    #BENCH_URL=<url to request>
+    #BENCH_ARGS=<extra h2load arguments>
+
+  Run without parameters to run all scenarios, or pass their names or files :
+    run-bench.sh
+    run-bench.sh h1-keepalive tls-handshakes
+
+  The load is generated with h2load (from nghttp2), the latency percentiles
+  are computed from its per-request log, and the CPU time is the one consumed
+  by the haproxy process during the run. Note that the load generator runs on
+  the same machine, so CPU pinning (eg: taskset) is recommended to get stable
+  results.
+
+  Environment variables :
+    HAPROXY_PROGRAM  haproxy binary to test (default: ./haproxy)
+    H2LOAD_PROGRAM   h2load binary (default: h2load)
+    BENCH_REQUESTS   number of measured requests (default: 100000)
+    BENCH_WARMUP     number of requests run before measuring (default: 1000)
+    BENCH_CLIENTS    number of concurrent clients (default: 50)
+    BENCH_THREADS    number of haproxy threads (default: 1)
+    BENCH_PORT       listening port (default: 18443)
+    BENCH_CERT       certificate for the TLS and QUIC scenarios
+                     (default: reg-tests/ssl/common.pem)
+EOF
+  exit 0
+}
+
+_die()
+{
+  echo "$@" >&2
+  exit 1
+}
+
+# Reports the user+system CPU time in clock ticks consumed so far by process $1.
+_cpu_ticks()
+{
+  # skip the command name which may contain spaces
+  sed -e 's/^.*) //' "/proc/$1/stat" | awk '{ print $12 + $13 }'
+}
+
+# Runs scenario file $1 and reports its results.
+_run_scenario()
+{
+  cfg="$1"
+  name="$(basename "$cfg" .cfg)"
+  url="$(sed -n -e 's/^#BENCH_URL=//p' "$cfg" | sed -e "s/\${BENCH_PORT}/$BENCH_PORT/g")"
+  args="$(sed -n -e 's/^#BENCH_ARGS=//p' "$cfg")"
+
+  if [ -z "$url" ]; then
+    echo "{\"scenario\":\"$name\",\"error\":\"no BENCH_URL\"}"
+    return
+  fi
+
+  rm -f "$TESTDIR/pid" "$TESTDIR/log" "$TESTDIR/out"
+  if ! "$HAPROXY_PROGRAM" -q -D -p "$TESTDIR/pid" -f "$BENCHDIR/common.cfg" -f "$cfg" >"$TESTDIR/out" 2>&1; then
+    echo "{\"scenario\":\"$name\",\"error\":\"haproxy failed to start\"}"
+    sed -e 's/^/# /' "$TESTDIR/out" >&2
+    return
+  fi
+  pid="$(cat "$TESTDIR/pid")"
+
+  if [ "$BENCH_WARMUP" -gt 0 ]; then
+    $H2LOAD_PROGRAM -n "$BENCH_WARMUP" -c 1 $args "$url" >/dev/null 2>&1
+  fi
+
+  cpu0="$(_cpu_ticks "$pid")"
+  $H2LOAD_PROGRAM -n "$BENCH_REQUESTS" -c "$BENCH_CLIENTS" $args --log-file="$TESTDIR/log" "$url" >"$TESTDIR/out" 2>&1
+  ret=$?
+  cpu1="$(_cpu_ticks "$pid")"
+
+  kill "$pid" 2>/dev/null
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+
+  if [ $ret -ne 0 ] || [ ! -s "$TESTDIR/log" ]; then
+    echo "{\"scenario\":\"$name\",\"error\":\"h2load failed\"}"
+    sed -e 's/^/# /' "$TESTDIR/out" >&2
+    return
+  fi
+
+  # "finished in 1.94s, 51530.12 req/s, 6.19MB/s"
+  rps="$(sed -n -e 's/^finished in [^,]*, \([0-9.]*\) req\/s.*/\1/p' "$TESTDIR/out")"
+  # "requests: 100000 total, 100000 started, 100000 done, 99998 succeeded, 2 failed, ..."
+  done_req="$(sed -n -e 's/^requests: .* \([0-9]*\) succeeded, \([0-9]*\) failed.*/\1 \2/p' "$TESTDIR/out")"
+
+  # the log contains one "<start time> <status> <duration in us>" line per request
+  cut -f3 "$TESTDIR/log" | sort -n | awk -v name="$name" -v rps="${rps:-0}" \
+      -v done_req="$done_req" -v ticks="$((cpu1 - cpu0))" -v hz="$HZ" '
+    { lat[NR] = $1 }
+    END {
+      split(done_req, d, " ");
+      p50 = NR ? lat[int((NR - 1) * 0.50) + 1] : 0;
+      p99 = NR ? lat[int((NR - 1) * 0.99) + 1] : 0;
+      cpu = d[1] ? ticks * 1000000.0 / hz / d[1] : 0;
+      printf("{\"scenario\":\"%s\",\"requests\":%d,\"failed\":%d,\"req_per_sec\":%s,\"p50_us\":%d,\"p99_us\":%d,\"cpu_us_per_req\":%.1f}\n",
+             name, d[1], d[2], rps, p50, p99, cpu);
+    }'
+}
+
+if [ "$1" = "--help" ] || [ "$1" = "-h" ]; then
+  _help
+fi
+
+BENCHDIR="$(dirname "$0")/../tests/bench"
+HAPROXY_PROGRAM="${HAPROXY_PROGRAM:-${PWD}/haproxy}"
+H2LOAD_PROGRAM="${H2LOAD_PROGRAM:-h2load}"
+BENCH_REQUESTS="${BENCH_REQUESTS:-100000}"
+BENCH_WARMUP="${BENCH_WARMUP:-1000}"
+BENCH_CLIENTS="${BENCH_CLIENTS:-50}"
+BENCH_THREADS="${BENCH_THREADS:-1}"
+BENCH_PORT="${BENCH_PORT:-18443}"
+BENCH_CERT="${BENCH_CERT:-$(dirname "$0")/../reg-tests/ssl/common.pem}"
+export BENCH_THREADS BENCH_PORT BENCH_CERT
+
+[ -x "$HAPROXY_PROGRAM" ] || _die "haproxy not found at $HAPROXY_PROGRAM, please set HAPROXY_PROGRAM."
+command -v "$H2LOAD_PROGRAM" >/dev/null 2>&1 || _die "h2load not found, please set H2LOAD_PROGRAM."
+[ -r /proc/self/stat ] || _die "/proc is required to measure the CPU usage."
+
+HZ="$(getconf CLK_TCK)"
+TESTDIR="$(mktemp -d "${TMPDIR:-/tmp}/haproxy-bench.XXXXXX")" || _die "failed to create a temporary directory."
+trap 'rm -rf "$TESTDIR"' EXIT
+
+if [ $# -eq 0 ]; then
+  set -- "$BENCHDIR"/*.cfg
+fi
+
+for scenario in "$@"; do
+  case "$scenario" in
+    *.cfg) cfg="$scenario" ;;
+    *)     cfg="$BENCHDIR/$scenario.cfg" ;;
+  esac
+  [ "$(basename "$cfg")" = "common.cfg" ] && continue
+  [ -r "$cfg" ] || _die "scenario $scenario not found."
+  _run_scenario "$cfg"
+done
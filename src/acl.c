@@ -15,6 +15,7 @@
 #include <string.h>
 
 #include <common/config.h>
+#include <common/errors.h>
 #include <common/initcall.h>
 #include <common/mini-clist.h>
 #include <common/standard.h>
@@ -39,6 +40,11 @@ static struct acl_kw_list acl_keywords = {
 	.list = LIST_HEAD_INIT(acl_keywords.list)
 };
 
+/* List head of all the parsed conditions, so that they get optimized once the
+ * configuration is fully known.
+ */
+static struct list acl_conds = LIST_HEAD_INIT(acl_conds);
+
 /* input values are 0 or 3, output is the same */
 static inline enum acl_test_res pat2acl(struct pattern *pat)
 {
@@ -862,9 +868,127 @@ struct acl_cond *prune_acl_cond(struct acl_cond *cond)
 			free(term);
 		free(suite);
 	}
+
+	LIST_DEL(&cond->all);
+	LIST_INIT(&cond->all);
+	free(cond->prog);
+	cond->prog = NULL;
+	cond->nb_ops = cond->nb_slots = 0;
 	return cond;
 }
 
+/* Returns non-zero if the evaluation of <acl> has no side effect, so that its
+ * result may be reused and it may be evaluated in any order. Only the ACLs
+ * using fetches flagged as such and no converter are known to qualify.
+ */
+static int acl_is_pure(const struct acl *acl)
+{
+	const struct acl_expr *expr;
+
+	list_for_each_entry(expr, &acl->expr, list) {
+		if (!(expr->smp->fetch->flags & (SMP_FETCH_F_PURE|SMP_FETCH_F_MEMO)) ||
+		    !LIST_ISEMPTY(&expr->smp->conv_exprs))
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns an estimate of the cost of evaluating <acl>, which depends on the
+ * layers its fetches get their information from and on its regex matches.
+ */
+static unsigned int acl_cost(const struct acl *acl)
+{
+	const struct acl_expr *expr;
+	unsigned int cost = 0;
+
+	list_for_each_entry(expr, &acl->expr, list) {
+		unsigned int use = expr->smp->fetch->use;
+
+		if (use & (SMP_USE_HRQBO|SMP_USE_HRSBO))
+			cost += 8;
+		else if (use & (SMP_USE_L6REQ|SMP_USE_L6RES))
+			cost += 4;
+		else if (use & SMP_USE_HTTP_ANY)
+			cost += 2;
+		else
+			cost += 1;
+
+		if (expr->pat.match == pat_match_reg)
+			cost += 4;
+	}
+	return cost;
+}
+
+/* Compiles condition <cond> into a flat program. If <optimize> is set, the
+ * terms of the suites only made of pure ACLs are sorted by increasing cost,
+ * and the pure ACLs used by several terms share their result. Returns 0 on
+ * success or -1 on memory shortage, in which case the previous program is
+ * kept.
+ */
+static int acl_compile_cond(struct acl_cond *cond, int optimize)
+{
+	struct acl_term_suite *suite;
+	struct acl_term *term;
+	struct acl_op *prog, op;
+	int nb = 0, slots = 0;
+	int i, j, k, start, pure;
+
+	list_for_each_entry(suite, &cond->suites, list)
+		list_for_each_entry(term, &suite->terms, list)
+			nb++;
+
+	prog = calloc(nb ? nb : 1, sizeof(*prog));
+	if (!prog)
+		return -1;
+
+	i = 0;
+	list_for_each_entry(suite, &cond->suites, list) {
+		start = i;
+		pure = optimize;
+		list_for_each_entry(term, &suite->terms, list) {
+			prog[i].acl  = term->acl;
+			prog[i].neg  = term->neg;
+			prog[i].slot = -1;
+			if (pure && !acl_is_pure(term->acl))
+				pure = 0;
+			i++;
+		}
+
+		for (j = start; j < i; j++)
+			prog[j].next = i;
+
+		if (!pure)
+			continue;
+
+		/* stable insertion sort, the suite is a conjunction */
+		for (j = start + 1; j < i; j++) {
+			op = prog[j];
+			for (k = j; k > start && acl_cost(prog[k - 1].acl) > acl_cost(op.acl); k--)
+				prog[k] = prog[k - 1];
+			prog[k] = op;
+		}
+	}
+
+	for (i = 0; optimize && i < nb && slots < ACL_COND_MAX_SLOTS; i++) {
+		if (prog[i].slot >= 0 || !acl_is_pure(prog[i].acl))
+			continue;
+
+		for (j = i + 1; j < nb; j++) {
+			if (prog[j].acl != prog[i].acl)
+				continue;
+			if (prog[i].slot < 0)
+				prog[i].slot = slots++;
+			prog[j].slot = prog[i].slot;
+		}
+	}
+
+	free(cond->prog);
+	cond->prog = prog;
+	cond->nb_ops = nb;
+	cond->nb_slots = slots;
+	return 0;
+}
+
 /* Parse an ACL condition starting at <args>[0], relying on a list of already
  * known ACLs passed in <known_acl>. The new condition is returned (or NULL in
  * case of low memory). Supports multiple conditions separated by "or". If
@@ -894,6 +1018,7 @@ struct acl_cond *parse_acl_cond(const char **args, struct list *known_acl,
 
 	LIST_INIT(&cond->list);
 	LIST_INIT(&cond->suites);
+	LIST_INIT(&cond->all);
 	cond->pol = pol;
 	cond->val = 0;
 
@@ -1008,6 +1133,13 @@ struct acl_cond *parse_acl_cond(const char **args, struct list *known_acl,
 	}
 
 	cond->val |= suite_val;
+
+	/* the ACLs may still change, it is optimized after the parsing */
+	if (acl_compile_cond(cond, 0) < 0) {
+		memprintf(err, "out of memory when parsing condition");
+		goto out_free_suite;
+	}
+	LIST_ADDQ(&acl_conds, &cond->all);
 	return cond;
 
  out_free_term:
@@ -1062,6 +1194,52 @@ struct acl_cond *build_acl_cond(const char *file, int line, struct list *known_a
 	return cond;
 }
 
+/* Evaluates ACL <acl> by scanning all of its expressions and stopping at the
+ * first one which matches. Returns ACL_TEST_FAIL, ACL_TEST_MISS or
+ * ACL_TEST_PASS, without applying any negation. <opt> must already contain
+ * SMP_OPT_ITERATE.
+ */
+static enum acl_test_res acl_exec_acl(struct acl *acl, struct proxy *px, struct session *sess, struct stream *strm, unsigned int opt)
+{
+	struct acl_expr *expr;
+	struct sample smp;
+	enum acl_test_res acl_res;
+
+	acl_res = ACL_TEST_FAIL;
+	list_for_each_entry(expr, &acl->expr, list) {
+		/* we need to reset context and flags */
+		memset(&smp, 0, sizeof(smp));
+	fetch_next:
+		if (!sample_process(px, sess, strm, opt, expr->smp, &smp)) {
+			/* maybe we could not fetch because of missing data */
+			if (smp.flags & SMP_F_MAY_CHANGE && !(opt & SMP_OPT_FINAL))
+				acl_res |= ACL_TEST_MISS;
+			continue;
+		}
+
+		acl_res |= pat2acl(pattern_exec_match(&expr->pat, &smp, 0));
+		/*
+		 * OK now acl_res holds the result of this expression
+		 * as one of ACL_TEST_FAIL, ACL_TEST_MISS or ACL_TEST_PASS.
+		 */
+
+		/* we're ORing these terms, so a single PASS is enough */
+		if (acl_res == ACL_TEST_PASS)
+			break;
+
+		if (smp.flags & SMP_F_NOT_LAST)
+			goto fetch_next;
+
+		/* sometimes we know the fetched data is subject to change
+		 * later and give another chance for a new match (eg: request
+		 * size, time, ...)
+		 */
+		if (smp.flags & SMP_F_MAY_CHANGE && !(opt & SMP_OPT_FINAL))
+			acl_res |= ACL_TEST_MISS;
+	}
+	return acl_res;
+}
+
 /* Execute condition <cond> and return either ACL_TEST_FAIL, ACL_TEST_MISS or
  * ACL_TEST_PASS depending on the test results. ACL_TEST_MISS may only be
  * returned if <opt> does not contain SMP_OPT_FINAL, indicating that incomplete
@@ -1074,15 +1252,16 @@ struct acl_cond *build_acl_cond(const char *file, int line, struct list *known_a
  *         return 0;
  *     if (cond->pol == ACL_COND_UNLESS)
  *         res = !res;
+ *
+ * The condition is run from its compiled program, where each suite of terms is
+ * a contiguous run of operations whose <next> field points to the first
+ * operation of the next suite. The results of the ACLs assigned a slot are
+ * only computed once.
  */
 enum acl_test_res acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct session *sess, struct stream *strm, unsigned int opt)
 {
-	__label__ fetch_next;
-	struct acl_term_suite *suite;
-	struct acl_term *term;
-	struct acl_expr *expr;
-	struct acl *acl;
-	struct sample smp;
+	const struct acl_op *op, *end;
+	unsigned char res[ACL_COND_MAX_SLOTS];
 	enum acl_test_res acl_res, suite_res, cond_res;
 
 	/* ACLs are iterated over all values, so let's always set the flag to
@@ -1090,87 +1269,46 @@ enum acl_test_res acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct
 	 */
 	opt |= SMP_OPT_ITERATE;
 
-	/* We're doing a logical OR between conditions so we initialize to FAIL.
-	 * The MISS status is propagated down from the suites.
+	if (cond->nb_slots)
+		memset(res, 0xff, cond->nb_slots);
+
+	/* We're doing a logical OR between suites so we initialize to FAIL.
+	 * The MISS status is propagated down from the suites. We're doing a
+	 * logical AND between the terms of a suite, so each suite starts as
+	 * PASS and stops at the first term which does not return PASS.
 	 */
 	cond_res = ACL_TEST_FAIL;
-	list_for_each_entry(suite, &cond->suites, list) {
-		/* Evaluate condition suite <suite>. We stop at the first term
-		 * which returns ACL_TEST_FAIL. The MISS status is still propagated
-		 * in case of uncertainty in the result.
-		 */
-
-		/* we're doing a logical AND between terms, so we must set the
-		 * initial value to PASS.
-		 */
-		suite_res = ACL_TEST_PASS;
-		list_for_each_entry(term, &suite->terms, list) {
-			acl = term->acl;
-
-			/* FIXME: use cache !
-			 * check acl->cache_idx for this.
-			 */
-
-			/* ACL result not cached. Let's scan all the expressions
-			 * and use the first one to match.
-			 */
-			acl_res = ACL_TEST_FAIL;
-			list_for_each_entry(expr, &acl->expr, list) {
-				/* we need to reset context and flags */
-				memset(&smp, 0, sizeof(smp));
-			fetch_next:
-				if (!sample_process(px, sess, strm, opt, expr->smp, &smp)) {
-					/* maybe we could not fetch because of missing data */
-					if (smp.flags & SMP_F_MAY_CHANGE && !(opt & SMP_OPT_FINAL))
-						acl_res |= ACL_TEST_MISS;
-					continue;
-				}
-
-				acl_res |= pat2acl(pattern_exec_match(&expr->pat, &smp, 0));
-				/*
-				 * OK now acl_res holds the result of this expression
-				 * as one of ACL_TEST_FAIL, ACL_TEST_MISS or ACL_TEST_PASS.
-				 *
-				 * Then if (!MISS) we can cache the result, and put
-				 * (smp.flags & SMP_F_VOLATILE) in the cache flags.
-				 *
-				 * FIXME: implement cache.
-				 *
-				 */
-
-				/* we're ORing these terms, so a single PASS is enough */
-				if (acl_res == ACL_TEST_PASS)
-					break;
-
-				if (smp.flags & SMP_F_NOT_LAST)
-					goto fetch_next;
-
-				/* sometimes we know the fetched data is subject to change
-				 * later and give another chance for a new match (eg: request
-				 * size, time, ...)
-				 */
-				if (smp.flags & SMP_F_MAY_CHANGE && !(opt & SMP_OPT_FINAL))
-					acl_res |= ACL_TEST_MISS;
-			}
-			/*
-			 * Here we have the result of an ACL (cached or not).
-			 * ACLs are combined, negated or not, to form conditions.
-			 */
+	suite_res = ACL_TEST_PASS;
+	op = cond->prog;
+	end = op + cond->nb_ops;
+	while (op < end) {
+		if (op->slot >= 0 && res[op->slot] != 0xff)
+			acl_res = res[op->slot];
+		else {
+			acl_res = acl_exec_acl(op->acl, px, sess, strm, opt);
+			if (op->slot >= 0)
+				res[op->slot] = acl_res;
+		}
 
-			if (term->neg)
-				acl_res = acl_neg(acl_res);
+		if (op->neg)
+			acl_res = acl_neg(acl_res);
 
-			suite_res &= acl_res;
+		suite_res &= acl_res;
 
-			/* we're ANDing these terms, so a single FAIL or MISS is enough */
-			if (suite_res != ACL_TEST_PASS)
-				break;
+		/* still in the same suite and nothing failed yet */
+		if (suite_res == ACL_TEST_PASS && op + 1 - cond->prog < op->next) {
+			op++;
+			continue;
 		}
+
 		cond_res |= suite_res;
 
-		/* we're ORing these terms, so a single PASS is enough */
+		/* we're ORing the suites, so a single PASS is enough */
 		if (cond_res == ACL_TEST_PASS)
 			break;
+
+		op = cond->prog + op->next;
+		suite_res = ACL_TEST_PASS;
 	}
 	return cond_res;
 }
@@ -1314,6 +1452,25 @@ int init_acl()
 	return err;
 }
 
+/* Recompiles all the parsed conditions once the configuration is known, so
+ * that the pure ACLs they use may be reordered and their results shared.
+ * Returns ERR_NONE on success or ERR_ALERT|ERR_FATAL on memory shortage.
+ */
+static int acl_compile_conds()
+{
+	struct acl_cond *cond;
+
+	list_for_each_entry(cond, &acl_conds, all) {
+		if (acl_compile_cond(cond, 1) < 0) {
+			ha_alert("acl: out of memory while compiling the conditions.\n");
+			return ERR_ALERT | ERR_FATAL;
+		}
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(acl_compile_conds);
+
 /************************************************************************/
 /*      All supported sample and ACL keywords must be declared here.    */
 /************************************************************************/
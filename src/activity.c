@@ -15,10 +15,15 @@
 #include <common/standard.h>
 #include <common/hathreads.h>
 #include <common/initcall.h>
+#include <common/time.h>
 #include <types/activity.h>
+#include <types/global.h>
+#include <types/proxy.h>
+#include <types/server.h>
 #include <proto/channel.h>
 #include <proto/cli.h>
 #include <proto/freq_ctr.h>
+#include <proto/ring.h>
 #include <proto/stream_interface.h>
 
 
@@ -26,9 +31,18 @@
 unsigned int profiling = HA_PROF_TASKS_AUTO;
 unsigned long task_profiling_mask = 0;
 
+/* per-function scheduler activity, shared by all threads */
+struct sched_activity sched_activity[SCHED_ACT_HASH_BUCKETS] __attribute__((aligned(64))) = { };
+
 /* One struct per thread containing all collected measurements */
 struct activity activity[MAX_THREADS] __attribute__((aligned(64))) = { };
 
+/* runs of tasks and tasklets lasting longer than this (ns) are reported in
+ * <slow_tasks_ring>, 0 disables the reports.
+ */
+uint64_t slow_task_threshold = 0;
+static struct ring *slow_tasks_ring = NULL;
+
 
 /* Updates the current thread's statistics about stolen CPU time. The unit for
  * <stolen> is half-milliseconds.
@@ -40,6 +54,122 @@ void report_stolen_time(uint64_t stolen)
 	update_freq_ctr_period(&activity[tid].cpust_15s, 15000, stolen);
 }
 
+/* Returns the timeout the pollers must use for a poll whose timeout would be
+ * <wait_time>, the poll having started at <before_poll>. With "busy-polling",
+ * it is null for as long as the thread spins, which is forever unless a
+ * maximum spinning time was set, after which the thread goes to sleep. The
+ * spins are counted in the thread's activity.
+ */
+int poll_busy_timeout(int wait_time)
+{
+	int64_t spent;
+
+	if (!(global.tune.options & GTUNE_BUSY_POLLING) || !wait_time)
+		return wait_time;
+
+	if (global.tune.busy_poll_max) {
+		spent = (int64_t)(date.tv_sec - before_poll.tv_sec) * 1000000 +
+		        (date.tv_usec - before_poll.tv_usec);
+		if (spent >= (int64_t)global.tune.busy_poll_max)
+			return wait_time;
+	}
+
+	activity[tid].busy_spin++;
+	return 0;
+}
+
+/* Reports into the slow tasks ring that the run of function <func> for the
+ * task (or tasklet if <tasklet> is non-zero) of context <ctx> lasted <duration>
+ * nanoseconds. <owner> was sampled before the run and may be NULL.
+ */
+void report_slow_task(const void *func, const void *ctx, int tasklet,
+                      const struct slow_task_owner *owner, uint64_t duration)
+{
+	struct buffer *buf;
+	struct ist msg;
+
+	if (!slow_tasks_ring)
+		return;
+
+	buf = get_trash_chunk();
+	chunk_printf(buf, "%u.%06u thr=%d %s=", (uint)date.tv_sec, (uint)date.tv_usec,
+	             tid + 1, tasklet ? "tasklet" : "task");
+	resolve_sym_name(buf, NULL, (void *)func);
+	chunk_appendf(buf, " ctx=%p dur=%.3fms", ctx, duration / 1000000.0);
+
+	if (owner && owner->fe) {
+		chunk_appendf(buf, " strm=#%u fe=%s be=%s srv=%s", owner->uniq_id,
+		              owner->fe->id, owner->be ? owner->be->id : "<NONE>",
+		              owner->srv ? owner->srv->id : "<NONE>");
+	}
+
+	msg = ist2(buf->area, buf->data);
+	ring_write(slow_tasks_ring, ~0, NULL, 0, &msg, 1);
+}
+
+/* Sets the slow tasks threshold to <us> microseconds (0 disables the reports),
+ * allocating the ring on first use. Returns 0 on success, otherwise non-zero
+ * if the ring could not be allocated.
+ */
+static int set_slow_task_threshold(unsigned int us)
+{
+	struct ring *ring, *old = NULL;
+
+	if (us && !slow_tasks_ring) {
+		ring = ring_new(SLOW_TASKS_RING_SIZE);
+		if (!ring)
+			return 1;
+		if (!HA_ATOMIC_CAS(&slow_tasks_ring, &old, ring))
+			ring_free(ring);
+	}
+	HA_ATOMIC_STORE(&slow_task_threshold, (uint64_t)us * 1000);
+	return 0;
+}
+
+/* Parses the time in <arg> as a slow task threshold in microseconds (default
+ * unit) into <us>. Returns NULL on success, otherwise a static error message.
+ */
+static const char *parse_slow_task_threshold(const char *arg, unsigned int *us)
+{
+	const char *res;
+
+	if (!*arg)
+		return "a time is expected";
+
+	res = parse_time_err(arg, us, TIME_UNIT_US);
+	if (res == PARSE_TIME_OVER)
+		return "value is too large (maximum value is 2147483647 us or ~35 minutes)";
+	else if (res == PARSE_TIME_UNDER)
+		return "value is too small (minimum non-null value is 1 us)";
+	else if (res)
+		return "a time in microseconds (or any other time unit) is expected";
+	return NULL;
+}
+
+/* config parser for global "profiling.slow-tasks <time>" */
+static int cfg_parse_prof_slow_tasks(char **args, int section_type, struct proxy *curpx,
+                                     struct proxy *defpx, const char *file, int line,
+                                     char **err)
+{
+	const char *res;
+	unsigned int us;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	res = parse_slow_task_threshold(args[1], &us);
+	if (res) {
+		memprintf(err, "'%s' : %s.", args[0], res);
+		return -1;
+	}
+
+	if (set_slow_task_threshold(us)) {
+		memprintf(err, "'%s' : out of memory.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "profiling.tasks", accepts "on" or "off" */
 static int cfg_parse_prof_tasks(char **args, int section_type, struct proxy *curpx,
                                 struct proxy *defpx, const char *file, int line,
@@ -67,11 +197,28 @@ static int cli_parse_set_profiling(char **args, char *payload, struct appctx *ap
 	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
 		return 1;
 
+	if (strcmp(args[2], "slow-tasks") == 0) {
+		const char *res;
+		char *err = NULL;
+		unsigned int us;
+
+		res = parse_slow_task_threshold(args[3], &us);
+		if (res)
+			return cli_dynerr(appctx, memprintf(&err, "'%s %s' : %s.\n", args[1], args[2], res));
+		if (set_slow_task_threshold(us))
+			return cli_err(appctx, "Out of memory.\n");
+		return 1;
+	}
+
 	if (strcmp(args[2], "tasks") != 0)
-		return cli_err(appctx, "Expects 'tasks'.\n");
+		return cli_err(appctx, "Expects either 'tasks' or 'slow-tasks'.\n");
 
 	if (strcmp(args[3], "on") == 0) {
 		unsigned int old = profiling;
+
+		/* start a new measurement when forcing it on */
+		if ((old & HA_PROF_TASKS_MASK) != HA_PROF_TASKS_ON)
+			memset(sched_activity, 0, sizeof(sched_activity));
 		while (!_HA_ATOMIC_CAS(&profiling, &old, (old & ~HA_PROF_TASKS_MASK) | HA_PROF_TASKS_ON))
 			;
 	}
@@ -91,8 +238,113 @@ static int cli_parse_set_profiling(char **args, char *payload, struct appctx *ap
 	return 1;
 }
 
-/* This function dumps all profiling settings. It returns 0 if the output
- * buffer is full and it needs to be called again, otherwise non-zero.
+/* Appends to <buf> the <ns> nanoseconds duration using the most suitable unit */
+static void print_time_short(struct buffer *buf, uint64_t ns)
+{
+	if (ns < 1000)
+		chunk_appendf(buf, " %10lluns", (unsigned long long)ns);
+	else if (ns < 1000000)
+		chunk_appendf(buf, " %10.3fus", ns / 1000.0);
+	else if (ns < 1000000000)
+		chunk_appendf(buf, " %10.3fms", ns / 1000000.0);
+	else
+		chunk_appendf(buf, " %10.3fs ", ns / 1000000000.0);
+}
+
+/* sorts sched_activity entries by decreasing CPU time */
+static int cmp_sched_activity(const void *a, const void *b)
+{
+	const struct sched_activity *l = (const struct sched_activity *)a;
+	const struct sched_activity *r = (const struct sched_activity *)b;
+
+	if (l->cpu_time > r->cpu_time)
+		return -1;
+	else if (l->cpu_time < r->cpu_time)
+		return 1;
+	return 0;
+}
+
+/* parse a "show profiling" command. It returns 1 on failure, 0 if it starts
+ * to dump.
+ */
+static int cli_parse_show_profiling(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	appctx->ctx.cli.i0 = 0; // 0: settings, 1: per-function tasks
+	appctx->ctx.cli.i1 = 0; // next entry to dump
+
+	if (!*args[2])
+		return 0;
+
+	if (strcmp(args[2], "tasks") != 0)
+		return cli_err(appctx, "Expects either nothing or 'tasks'.\n");
+
+	appctx->ctx.cli.i0 = 1;
+	return 0;
+}
+
+/* This function dumps the per-function scheduler activity sorted by
+ * decreasing CPU time, starting at entry ctx.cli.i1. Since the entries are
+ * sorted again on each call, a dump interrupted by a full buffer may skip or
+ * repeat a few lines if the counters changed meanwhile. It returns 0 if the
+ * output buffer is full and it needs to be called again, otherwise non-zero.
+ */
+static int cli_io_handler_show_profiling_tasks(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct sched_activity tmp[SCHED_ACT_HASH_BUCKETS];
+	int nb, i;
+
+	memcpy(tmp, sched_activity, sizeof(tmp));
+	for (i = nb = 0; i < SCHED_ACT_HASH_BUCKETS; i++) {
+		if (!tmp[i].calls)
+			continue;
+		tmp[nb++] = tmp[i];
+	}
+	qsort(tmp, nb, sizeof(tmp[0]), cmp_sched_activity);
+
+	chunk_reset(&trash);
+	if (!appctx->ctx.cli.i1)
+		chunk_appendf(&trash, "%-32s %11s %12s %12s %12s %12s\n",
+		              "# function", "calls", "cpu_tot", "cpu_avg", "lat_tot", "lat_avg");
+
+	for (i = appctx->ctx.cli.i1; i < nb; i++) {
+		size_t mark = trash.data;
+
+		if (tmp[i].func == NULL)
+			chunk_appendf(&trash, "%-32s", "other");
+		else {
+			resolve_sym_name(&trash, NULL, (void *)tmp[i].func);
+			if (trash.data - mark < 32)
+				chunk_appendf(&trash, "%*s", (int)(32 - (trash.data - mark)), "");
+		}
+
+		chunk_appendf(&trash, " %11llu", (unsigned long long)tmp[i].calls);
+		print_time_short(&trash, tmp[i].cpu_time);
+		print_time_short(&trash, tmp[i].cpu_time / tmp[i].calls);
+		print_time_short(&trash, tmp[i].lat_time);
+		print_time_short(&trash, tmp[i].lat_time / tmp[i].calls);
+		chunk_appendf(&trash, "\n");
+
+		if (trash.size - trash.data < 256) {
+			if (ci_putchk(si_ic(si), &trash) == -1) {
+				si_rx_room_blk(si);
+				return 0;
+			}
+			appctx->ctx.cli.i1 = i + 1;
+			chunk_reset(&trash);
+		}
+	}
+
+	if (ci_putchk(si_ic(si), &trash) == -1) {
+		si_rx_room_blk(si);
+		return 0;
+	}
+	return 1;
+}
+
+/* This function dumps all profiling settings, or the per-function activity if
+ * "tasks" was requested. It returns 0 if the output buffer is full and it
+ * needs to be called again, otherwise non-zero.
  */
 static int cli_io_handler_show_profiling(struct appctx *appctx)
 {
@@ -102,6 +354,9 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
 		return 1;
 
+	if (appctx->ctx.cli.i0)
+		return cli_io_handler_show_profiling_tasks(appctx);
+
 	chunk_reset(&trash);
 
 	switch (profiling & HA_PROF_TASKS_MASK) {
@@ -114,6 +369,10 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 	             "Per-task CPU profiling              : %s      # set profiling tasks {on|auto|off}\n",
 	             str);
 
+	chunk_appendf(&trash,
+	              "Slow tasks reports threshold (us)   : %-6llu    # set profiling slow-tasks <time>\n",
+	              (unsigned long long)(slow_task_threshold / 1000));
+
 	if (ci_putchk(si_ic(si), &trash) == -1) {
 		/* failed, try again */
 		si_rx_room_blk(si);
@@ -122,8 +381,23 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 	return 1;
 }
 
+/* parse a "show slow-tasks" command, returns 1 if a message is returned,
+ * otherwise zero.
+ */
+static int cli_parse_show_slow_tasks(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (!cli_has_level(appctx, ACCESS_LVL_OPER))
+		return 1;
+
+	if (!slow_tasks_ring)
+		return cli_msg(appctx, LOG_INFO, "Slow tasks reports are disabled (see 'set profiling slow-tasks').\n");
+
+	return ring_attach_cli(slow_tasks_ring, appctx);
+}
+
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "profiling.slow-tasks", cfg_parse_prof_slow_tasks },
 	{ CFG_GLOBAL, "profiling.tasks",      cfg_parse_prof_tasks      },
 	{ 0, NULL, NULL }
 }};
@@ -132,8 +406,9 @@ INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
 
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
-	{ { "show", "profiling", NULL }, "show profiling : show CPU profiling options",   NULL, cli_io_handler_show_profiling, NULL },
+	{ { "show", "profiling", NULL }, "show profiling [tasks] : show CPU profiling options or per-function task profiling", cli_parse_show_profiling, cli_io_handler_show_profiling, NULL },
 	{ { "set",  "profiling", NULL }, "set  profiling : enable/disable CPU profiling", cli_parse_set_profiling,  NULL },
+	{ { "show", "slow-tasks", NULL }, "show slow-tasks : report the task runs that exceeded the slow tasks threshold", cli_parse_show_slow_tasks, NULL, NULL },
 	{{},}
 }};
 
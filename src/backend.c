@@ -160,6 +160,42 @@ void update_backend_weight(struct proxy *px)
 	}
 }
 
+/* Defers the rebuilds of the LB structures of proxy <px> which are not updated
+ * incrementally (the server map of the map-based algorithms, the lookup tables
+ * of consistent hashing) until lb_resume_updates() is called, so that a bulk
+ * of server changes only rebuilds them once. In the mean time, the lookups
+ * keep using the previous map or the trees themselves. The calls may be
+ * nested.
+ *
+ * The lbprm's lock will be used.
+ */
+void lb_defer_updates(struct proxy *px)
+{
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &px->lbprm.lock);
+	px->lbprm.defer_updates++;
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &px->lbprm.lock);
+}
+
+/* Ends a deferral started by lb_defer_updates(), and rebuilds the server map
+ * of proxy <px> if some of its servers changed in between. The lookup tables
+ * of consistent hashing are rebuilt on the next lookup.
+ *
+ * The lbprm's lock will be used.
+ */
+void lb_resume_updates(struct proxy *px)
+{
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &px->lbprm.lock);
+	if (!--px->lbprm.defer_updates && px->lbprm.pending_updates) {
+		px->lbprm.pending_updates = 0;
+		if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MAP) {
+			recount_servers(px);
+			update_backend_weight(px);
+			recalc_server_map(px);
+		}
+	}
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &px->lbprm.lock);
+}
+
 /*
  * This function tries to find a running server for the proxy <px> following
  * the source hash method. Depending on the number of active/backup servers,
@@ -525,6 +561,43 @@ static struct server *get_server_rch(struct stream *s, const struct server *avoi
 		return map_get_server_hash(px, hash);
 }
 
+/* Returns the cost of <srv> for "balance ewma", which is its average response
+ * time multiplied by the number of requests it would have to serve, or 0 if it
+ * is idle and was never measured.
+ */
+static inline unsigned long long srv_ewma_cost(const struct server *srv)
+{
+	unsigned int ewma = srv->lb_ewma;
+	unsigned int cur = MIN((unsigned int)srv->served, BE_LB_EWMA_MAX_CUR);
+
+	if (!ewma)
+		return cur ? BE_LB_EWMA_PROBE : 0;
+	return (unsigned long long)ewma * (cur + 1);
+}
+
+/* Accounts <rtime> milliseconds of response time for <srv>, whose backend uses
+ * "balance ewma". Peaks are taken into account at once, while lower values
+ * decay the average according to the time elapsed since the previous sample.
+ */
+void srv_update_ewma(struct server *srv, unsigned int rtime)
+{
+	unsigned int decay = srv->proxy->lbprm.arg_opt2;
+	unsigned int old, new, sample;
+	unsigned long long step;
+
+	sample = (MIN(rtime, BE_LB_EWMA_MAX_MS) << BE_LB_EWMA_SHIFT) + 1;
+	step = (unsigned int)(now_ms - srv->lb_ewma_date) + decay / BE_LB_EWMA_MIN_STEP;
+
+	old = srv->lb_ewma;
+	do {
+		if (sample >= old || step >= decay)
+			new = sample;
+		else
+			new = old - (old - sample) * step / decay;
+	} while (!HA_ATOMIC_CAS(&srv->lb_ewma, &old, new));
+	srv->lb_ewma_date = now_ms;
+}
+
 /* random value  */
 static struct server *get_server_rnd(struct stream *s, const struct server *avoid)
 {
@@ -540,16 +613,19 @@ static struct server *get_server_rnd(struct stream *s, const struct server *avoi
 	curr = NULL;
 	do {
 		prev = curr;
-		hash = ha_random32();
+		hash = ha_random32_local();
 		curr = chash_get_server_hash(px, hash, avoid);
 		if (!curr)
 			break;
 
 		/* compare the new server to the previous best choice and pick
-		 * the one with the least currently served requests.
+		 * the one with the least currently served requests, or with
+		 * the lowest expected response time for "balance ewma".
 		 */
 		if (prev && prev != curr &&
-		    curr->served * prev->cur_eweight > prev->served * curr->cur_eweight)
+		    ((px->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA ?
+		     srv_ewma_cost(curr) * prev->cur_eweight > srv_ewma_cost(prev) * curr->cur_eweight :
+		     curr->served * prev->cur_eweight > prev->served * curr->cur_eweight))
 			curr = prev;
 	} while (--draws > 0);
 
@@ -662,7 +738,8 @@ int assign_server(struct stream *s)
 		case BE_LB_LKUP_CHTREE:
 		case BE_LB_LKUP_MAP:
 			if ((s->be->lbprm.algo & BE_LB_KIND) == BE_LB_KIND_RR) {
-				if ((s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM)
+				if ((s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM ||
+				    (s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA)
 					srv = get_server_rnd(s, prev_srv);
 				else if ((s->be->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 					srv = chash_get_next_server(s->be, prev_srv);
@@ -1074,6 +1151,29 @@ static void assign_tproxy_address(struct stream *s)
 #endif
 }
 
+/* Tries to take over one of the connections of the <list> of thread <thr>.
+ * Returns the connection, already removed from the list, or NULL if none could
+ * be taken over.
+ */
+static struct connection *conn_backend_steal(struct mt_list *list, int thr)
+{
+	struct mt_list *elt1, elt2;
+	struct connection *conn;
+	int found = 0;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[thr]);
+	mt_list_for_each_entry_safe(conn, list, list, elt1, elt2) {
+		if (conn->mux->takeover && conn->mux->takeover(conn) == 0) {
+			MT_LIST_DEL_SAFE(elt1);
+			found = 1;
+			break;
+		}
+	}
+	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[thr]);
+
+	return found ? conn : NULL;
+}
+
 /* Attempt to get a backend connection from the specified mt_list array
  * (safe or idle connections).
  */
@@ -1081,8 +1181,9 @@ static struct connection *conn_backend_get(struct server *srv, int is_safe)
 {
 	struct mt_list *mt_list = is_safe ? srv->safe_conns : srv->idle_conns;
 	struct connection *conn;
+	unsigned int idle, best = 0;
+	int donor = -1;
 	int i;
-	int found = 0;
 
 	/* We need to lock even if this is our own list, because another
 	 * thread may be trying to migrate that connection, and we don't want
@@ -1100,24 +1201,39 @@ static struct connection *conn_backend_get(struct server *srv, int is_safe)
 		goto fix_conn;
 	}
 
-	/* Lookup all other threads for an idle connection, starting from tid + 1 */
-	for (i = tid; !found && (i = ((i + 1 == global.nbthread) ? 0 : i + 1)) != tid;) {
-		struct mt_list *elt1, elt2;
+	/* Pick as a donor the other thread with the most idle connections to
+	 * this server, from the per-thread counters and without any lock, and
+	 * try to take one of them over. The threads whose list is empty are
+	 * never locked.
+	 */
+	for (i = 0; i < global.nbthread; i++) {
+		if (i == tid || MT_LIST_ISEMPTY(&mt_list[i]))
+			continue;
+		idle = srv->curr_idle_thr[i];
+		if (donor < 0 || idle > best) {
+			donor = i;
+			best = idle;
+		}
+	}
+
+	if (donor < 0)
+		return NULL;
+
+	i = donor;
+	conn = conn_backend_steal(&mt_list[i], i);
 
-		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
-		mt_list_for_each_entry_safe(conn, &mt_list[i], list, elt1, elt2) {
-			if (conn->mux->takeover && conn->mux->takeover(conn) == 0) {
-				MT_LIST_DEL_SAFE(elt1);
-				found = 1;
+	/* Otherwise lookup the other non-empty lists, starting from tid + 1 */
+	if (!conn) {
+		for (i = tid; (i = ((i + 1 == global.nbthread) ? 0 : i + 1)) != tid;) {
+			if (i == donor || MT_LIST_ISEMPTY(&mt_list[i]))
+				continue;
+			conn = conn_backend_steal(&mt_list[i], i);
+			if (conn)
 				break;
-			}
 		}
-		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
 	}
 
-	if (!found)
-		conn = NULL;
-	else {
+	if (conn) {
 fix_conn:
 		conn->idle_time = 0;
 		_HA_ATOMIC_SUB(&srv->curr_idle_conns, 1);
@@ -1129,6 +1245,35 @@ fix_conn:
 	return conn;
 }
 
+/* Returns the connection of the current thread's available list of <srv>
+ * which carries the fewest streams, so that the streams are balanced over the
+ * multiplexed connections instead of piling on the first one. NULL is returned
+ * if all of them already carry at least "streams-per-conn" streams, in which
+ * case a new connection should be established instead.
+ */
+static struct connection *conn_backend_get_available(struct server *srv)
+{
+	struct list *head = &srv->available_conns[tid];
+	struct list *elem;
+	struct connection *conn, *best = NULL;
+	int used, best_used = INT_MAX;
+
+	for (elem = head->n; elem != head; elem = elem->n) {
+		conn = LIST_ELEM(elem, struct connection *, list);
+		used = conn->mux->used_streams(conn);
+		if (used < best_used) {
+			best = conn;
+			best_used = used;
+			if (!used)
+				break;
+		}
+	}
+
+	if (best && srv->streams_per_conn && best_used >= srv->streams_per_conn)
+		return NULL;
+	return best;
+}
+
 /*
  * This function initiates a connection to the server assigned to this stream
  * (s->target, s->si[1].addr.to). It will assign a server if none
@@ -1203,11 +1348,12 @@ int connect_server(struct stream *s)
 		 * that there is no concurrency issues.
 		 */
 		if (srv->available_conns && !LIST_ISEMPTY(&srv->available_conns[tid]) &&
-		    ((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR)) {
-			    srv_conn = LIST_ELEM(srv->available_conns[tid].n, struct connection *, list);
-			    reuse = 1;
-		}
-		else if (!srv_conn && srv->curr_idle_conns > 0) {
+		    ((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR))
+			srv_conn = conn_backend_get_available(srv);
+
+		if (srv_conn)
+			reuse = 1;
+		else if (srv->curr_idle_conns > 0) {
 			if (srv->idle_conns &&
 			    ((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR &&
 			     s->txn && (s->txn->flags & TX_NOT_FIRST)) &&
@@ -1512,6 +1658,16 @@ int connect_server(struct stream *s)
 	/* set connect timeout */
 	s->si[1].exp = tick_add_ifset(now_ms, s->be->timeout.connect);
 
+	/* happy eyeballs: if the server resolved to another address, give up
+	 * early on this one and fall back to the other one.
+	 */
+	s->flags &= ~SF_HE_ARMED;
+	if (srv && srv->he_delay && !reuse && !(s->flags & SF_HE_ALT) &&
+	    srv->alt_addr.ss_family != AF_UNSPEC && ipcmp(s->target_addr, &srv->addr) == 0) {
+		s->si[1].exp = tick_first(s->si[1].exp, tick_add(now_ms, MS_TO_TICKS(srv->he_delay)));
+		s->flags |= SF_HE_ARMED;
+	}
+
 	if (srv) {
 		int count;
 
@@ -2013,6 +2169,29 @@ void back_handle_st_cer(struct stream *s)
 	si->exp    = TICK_ETERNITY;
 	si->flags &= ~SI_FL_EXP;
 
+	/* the attempt failed or was too slow on the first address of a server
+	 * which resolved to another one: immediately retry on the other one,
+	 * without consuming a retry nor accusing the server.
+	 */
+	if ((s->flags & SF_HE_ARMED) && objt_server(s->target) &&
+	    __objt_server(s->target)->alt_addr.ss_family != AF_UNSPEC) {
+		struct server *srv = __objt_server(s->target);
+		int port = get_host_port(s->target_addr);
+
+		s->flags = (s->flags & ~SF_HE_ARMED) | SF_HE_ALT;
+		if (s->flags & SF_CURR_SESS) {
+			s->flags &= ~SF_CURR_SESS;
+			_HA_ATOMIC_SUB(&srv->cur_sess, 1);
+		}
+		*s->target_addr = srv->alt_addr;
+		set_host_port(s->target_addr, port);
+		si->flags &= ~SI_FL_ERR;
+		si->err_type = SI_ET_NONE;
+		si->state = SI_ST_ASS;
+		DBG_TRACE_STATE("falling back to the alternate address", STRM_EV_STRM_PROC|STRM_EV_SI_ST, s);
+		goto end;
+	}
+
 	/* we probably have to release last stream from the server */
 	if (objt_server(s->target)) {
 		health_adjust(objt_server(s->target), HANA_STATUS_L4_ERR);
@@ -2273,6 +2452,8 @@ const char *backend_lb_algo_str(int algo) {
 		return "first";
 	else if (algo == BE_LB_ALGO_LC)
 		return "leastconn";
+	else if (algo == BE_LB_ALGO_EWMA)
+		return "ewma";
 	else if (algo == BE_LB_ALGO_SH)
 		return "source";
 	else if (algo == BE_LB_ALGO_UH)
@@ -2347,6 +2528,64 @@ int backend_parse_balance(const char **args, char **err, struct proxy *curproxy)
 			}
 		}
 	}
+	else if (!strncmp(args[0], "ewma", 4)) {
+		const char *res;
+		unsigned int decay;
+		int arg = 1;
+
+		curproxy->lbprm.algo &= ~BE_LB_ALGO;
+		curproxy->lbprm.algo |= BE_LB_ALGO_EWMA;
+		curproxy->lbprm.arg_opt1 = 2;
+		curproxy->lbprm.arg_opt2 = BE_LB_EWMA_DECAY;
+
+		if (*(args[0] + 4) == '(' && *(args[0] + 5) != ')') { /* number of draws */
+			char *end;
+
+			curproxy->lbprm.arg_opt1 = strtol(args[0] + 5, &end, 0);
+
+			if (*end != ')') {
+				if (!*end)
+					memprintf(err, "ewma : missing closing parenthesis.");
+				else
+					memprintf(err, "ewma : unexpected character '%c' after argument.", *end);
+				return -1;
+			}
+
+			if (curproxy->lbprm.arg_opt1 < 1) {
+				memprintf(err, "ewma : number of draws must be at least 1.");
+				return -1;
+			}
+		}
+		else if (*(args[0] + 4) && strcmp(args[0] + 4, "()") != 0) {
+			memprintf(err, "unknown balancing algorithm '%s'.", args[0]);
+			return -1;
+		}
+
+		while (*args[arg]) {
+			if (!strcmp(args[arg], "decay")) {
+				if (!*args[arg+1]) {
+					memprintf(err, "ewma : '%s' expects a time value.", args[arg]);
+					return -1;
+				}
+				res = parse_time_err(args[arg+1], &decay, TIME_UNIT_MS);
+				if (res == PARSE_TIME_OVER || res == PARSE_TIME_UNDER || decay < BE_LB_EWMA_MIN_STEP) {
+					memprintf(err, "ewma : '%s' expects a time between %ums and 2147483647ms.",
+					          args[arg], BE_LB_EWMA_MIN_STEP);
+					return -1;
+				}
+				else if (res) {
+					memprintf(err, "ewma : unexpected character '%c' in '%s'.", *res, args[arg]);
+					return -1;
+				}
+				curproxy->lbprm.arg_opt2 = decay;
+				arg += 2;
+			}
+			else {
+				memprintf(err, "ewma only accepts parameter 'decay'.");
+				return -1;
+			}
+		}
+	}
 	else if (!strcmp(args[0], "source")) {
 		curproxy->lbprm.algo &= ~BE_LB_ALGO;
 		curproxy->lbprm.algo |= BE_LB_ALGO_SH;
@@ -2465,7 +2704,7 @@ int backend_parse_balance(const char **args, char **err, struct proxy *curproxy)
 		}
 	}
 	else {
-		memprintf(err, "only supports 'roundrobin', 'static-rr', 'leastconn', 'source', 'uri', 'url_param', 'hdr(name)' and 'rdp-cookie(name)' options.");
+		memprintf(err, "only supports 'roundrobin', 'static-rr', 'leastconn', 'ewma', 'source', 'uri', 'url_param', 'hdr(name)' and 'rdp-cookie(name)' options.");
 		return -1;
 	}
 	return 0;
@@ -14,6 +14,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
 #include <common/base64.h>
 #include <common/config.h>
 
@@ -40,6 +44,32 @@ int a2base64(char *in, int ilen, char *out, int olen)
 		return -1;
 
 	/* we don't need to check olen anymore */
+#if defined(__SSSE3__)
+	/* 12 input bytes are turned into 16 chars at once, but 16 bytes are
+	 * read. The 4 groups of 3 bytes are spread over 4 bytes each, the
+	 * 6-bit indexes are extracted with multiplies and turned into chars
+	 * by adding an offset depending on their range.
+	 */
+	while (ilen >= 16) {
+		__m128i v, t0, t1, idx, res;
+
+		v   = _mm_loadu_si128((const __m128i *)in);
+		v   = _mm_shuffle_epi8(v, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		t0  = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		t1  = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		idx = _mm_or_si128(t0, t1);
+
+		/* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+		res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		res = _mm_or_si128(res, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+		res = _mm_shuffle_epi8(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		                                     '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		                                     '/' - 63, 'A', 0, 0), res);
+		_mm_storeu_si128((__m128i *)out, _mm_add_epi8(res, idx));
+		out += 16;
+		in += 12; ilen -= 12;
+	}
+#endif
 	while (ilen >= 3) {
 		out[0] = base64tab[(((unsigned char)in[0]) >> 2)];
 		out[1] = base64tab[(((unsigned char)in[0] & 0x03) << 4) | (((unsigned char)in[1]) >> 4)];
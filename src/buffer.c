@@ -21,11 +21,15 @@
 #include <types/global.h>
 
 struct pool_head *pool_head_buffer;
+struct pool_head *pool_head_small_buffer;
 
 /* list of objects waiting for at least one buffer */
 struct mt_list buffer_wq = LIST_HEAD_INIT(buffer_wq);
 __decl_aligned_spinlock(buffer_wq_lock);
 
+/* recently released buffers of the current thread */
+THREAD_LOCAL struct buf_hot_cache buf_hot = { .count = 0 };
+
 /* perform minimal intializations, report 0 in case of error, 1 if OK. */
 int init_buffer()
 {
@@ -51,6 +55,13 @@ int init_buffer()
 		return 0;
 
 	pool_free(pool_head_buffer, buffer);
+
+	/* small buffers only make sense when smaller than the regular ones */
+	if (global.tune.bufsize_small && global.tune.bufsize_small < global.tune.bufsize) {
+		pool_head_small_buffer = create_pool("small_buffer", global.tune.bufsize_small, MEM_F_SHARED|MEM_F_EXACT);
+		if (!pool_head_small_buffer)
+			return 0;
+	}
 	return 1;
 }
 
@@ -95,6 +106,17 @@ void buffer_dump(FILE *o, struct buffer *b, int from, int to)
 	fflush(o);
 }
 
+/* Releases to the pool all the buffers of the current thread's hot buffer
+ * cache.
+ */
+void b_hot_flush(void)
+{
+#if CONFIG_HAP_BUF_HOT_CACHE > 0
+	while (buf_hot.count)
+		pool_free(pool_head_buffer, buf_hot.area[--buf_hot.count]);
+#endif
+}
+
 /* see offer_buffer() for details */
 void __offer_buffer(void *from, unsigned int threshold)
 {
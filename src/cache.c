@@ -11,6 +11,7 @@
  */
 
 #include <eb32tree.h>
+#include <ebistree.h>
 #include <import/sha1.h>
 
 #include <types/action.h>
@@ -24,6 +25,7 @@
 #include <proto/proxy.h>
 #include <proto/http_htx.h>
 #include <proto/filters.h>
+#include <proto/flt_http_comp.h>
 #include <proto/http_rules.h>
 #include <proto/http_ana.h>
 #include <proto/log.h>
@@ -47,15 +49,79 @@ extern struct applet http_cache_applet;
 
 struct flt_ops cache_ops;
 
+#define CACHE_MAX_SHARDS 64
+
+/* The objects of a cache are spread over <nb_shards> shards depending on their
+ * hash. Each shard is stored in its own shared context, which provides it with
+ * its own lock and its own LRU list of blocks, so that the threads looking up
+ * or storing different objects do not contend on the same lock.
+ */
+struct cache_shard {
+	struct eb_root entries;  /* head of cache entries based on keys */
+	struct eb_root paths;    /* the same, indexed on their path */
+	struct eb_root tags;     /* the same, indexed on their surrogate keys */
+};
+
+#define CACHE_PATH_LEN  256  /* max stored path length, including the trailing zero */
+#define CACHE_TAGS_LEN  128  /* max stored surrogate keys length, including the zeroes */
+#define CACHE_MAX_TAGS  4    /* max surrogate keys per object */
+
+/* what cache_purge() matches */
+#define CACHE_PURGE_PATH   0
+#define CACHE_PURGE_PREFIX 1
+#define CACHE_PURGE_TAG    2
+
 struct cache {
 	struct list list;        /* cache linked list */
-	struct eb_root entries;  /* head of cache entries based on keys */
+	struct cache_shard **shards; /* <nb_shards> shards, each in a shctx */
+	unsigned int nb_shards;  /* shards (number of) */
 	unsigned int maxage;     /* max-age */
+	unsigned int maxstale;   /* max-stale, 0 = never serve stale objects */
 	unsigned int maxblocks;
 	unsigned int maxobjsz;   /* max-object-size (in bytes) */
+	struct cache_shard *large; /* large objects tier, NULL if none */
+	char *large_file;        /* file of the large objects tier */
+	unsigned int large_blocks; /* size of the large objects tier (in blocks) */
+	unsigned int large_maxobjsz; /* max object size in this tier (in bytes) */
+	unsigned int vary_processing; /* non-zero with "process-vary on" */
+	unsigned int nb_vary_hdrs; /* number of entries in <vary_hdrs> */
+	struct ist vary_hdrs[CACHE_VARY_MAX]; /* headers the objects may vary on, accept-encoding first */
+	unsigned int collapse_timeout; /* max wait for a fill in progress (ms), 0 = no wait */
+	unsigned int comp_level; /* compression level of the stored objects, 0 = unchanged */
+	struct eb_root pending;  /* fills in progress (cache_pending) */
+	__decl_hathreads(HA_SPINLOCK_T pending_lock); /* protects <pending> */
+	unsigned int hints_max;  /* max number of URLs with learned early hints, 0 = disabled */
+	unsigned int hints_count; /* number of URLs in <hints> */
+	struct eb_root hints;    /* learned early hints (cache_hints) */
+	struct list hints_lru;   /* the same, least recently used first */
+	__decl_hathreads(HA_SPINLOCK_T hints_lock); /* protects <hints> */
 	char id[33];             /* cache name */
 };
 
+#define CACHE_HINTS_MAX_LEN 512
+
+/* The "Link: rel=preload" values of the latest 200 response for an URL, sent
+ * in a 103 Early Hints response to the next requests for this URL before
+ * their final response is known. This is local to the process.
+ */
+struct cache_hints {
+	struct eb32_node node;   /* key: first 32 bits of the hash */
+	struct list lru;         /* element of cache->hints_lru */
+	char hash[20];
+	unsigned int len;        /* length of <links> */
+	char links[CACHE_HINTS_MAX_LEN]; /* comma-separated Link values */
+};
+
+/* A fill in progress, for "collapse-misses": the first stream missing an
+ * object fetches it from the server while the next ones missing it wait for
+ * the fill to complete. This is local to the process.
+ */
+struct cache_pending {
+	struct eb32_node node;   /* key: first 32 bits of the hash */
+	char hash[20];
+	struct list waiters;     /* cache_st of the waiting streams */
+};
+
 /* cache config for filters */
 struct cache_flt_conf {
 	union {
@@ -68,57 +134,324 @@ struct cache_flt_conf {
 /*
  * cache ctx for filters
  */
+#define CACHE_ST_F_FILLER  0x00000001 /* the stream performs the fill of <pending> */
+#define CACHE_ST_F_WAITED  0x00000002 /* the stream already waited for a fill */
+#define CACHE_ST_F_COMPRESSED 0x00000004 /* the headers are stored once compressed */
+
 struct cache_st {
 	struct shared_block *first_block;
+	struct cache_shard *shard;   /* shard the object is stored into */
+	struct stream *strm;         /* stream the filter is attached to */
+	struct cache_pending *pending; /* fill performed or waited for, if any */
+	struct list wait_list;       /* element of pending->waiters when waiting */
+	unsigned int flags;          /* CACHE_ST_F_* */
+	char path[CACHE_PATH_LEN];   /* path of the request, possibly truncated */
+};
+
+/* A surrogate key of a cache entry */
+struct cache_tag {
+	struct ebpt_node node;   /* key: the surrogate key, in entry->tags */
+	struct cache_entry *entry; /* entry carrying it */
 };
 
 struct cache_entry {
 	unsigned int latest_validation;     /* latest validation date */
 	unsigned int expire;      /* expiration date */
 	unsigned int age;         /* Origin server "Age" header value */
+	unsigned int stale_revalidate; /* stale-while-revalidate duration after <expire> */
+	unsigned int stale_error; /* stale-if-error duration after <expire> */
+	unsigned int refresh;     /* date the refresh of the stale object started, 0 if none */
 
 	struct eb32_node eb;     /* ebtree node used to hold the cache object */
+	struct cache_shard *shard; /* shard the object is stored in */
+	unsigned int vary_sig;   /* bit <i> set if the object varies on cache->vary_hdrs[i] */
+	unsigned int vary_hash[CACHE_VARY_MAX]; /* hashes of these headers in the request */
 	char hash[20];
+	struct ebpt_node path_node; /* indexed on <path> in shard->paths */
+	unsigned int nb_tags;    /* number of <tag_nodes> */
+	struct cache_tag tag_nodes[CACHE_MAX_TAGS]; /* indexed on <tags> in shard->tags */
+	char path[CACHE_PATH_LEN]; /* path of the request, possibly truncated */
+	char tags[CACHE_TAGS_LEN]; /* zero-terminated surrogate keys */
 	unsigned char data[0];
 };
 
 #define CACHE_BLOCKSIZE 1024
+#define CACHE_LARGE_BLOCKSIZE 16384 /* block size of the large objects tier */
 #define CACHE_ENTRY_MAX_AGE 2147483648U
+#define CACHE_REFRESH_TIMEOUT 10 /* seconds before another stream may refresh a stale object */
 
 static struct list caches = LIST_HEAD_INIT(caches);
 static struct list caches_config = LIST_HEAD_INIT(caches_config); /* cache config to init */
 static struct cache *tmp_cache_config = NULL;
 
 DECLARE_STATIC_POOL(pool_head_cache_st, "cache_st", sizeof(struct cache_st));
+DECLARE_STATIC_POOL(pool_head_cache_pending, "cache_pending", sizeof(struct cache_pending));
+DECLARE_STATIC_POOL(pool_head_cache_hints, "cache_hints", sizeof(struct cache_hints));
+
+static int cache_store_headers(struct stream *s, struct cache *cache, struct cache_st *cache_ctx,
+                               int comp);
 
-struct cache_entry *entry_exist(struct cache *cache, char *hash)
+/* Returns non-zero if the variant stored in <entry> suits the request whose
+ * headers hashes are <vary_hash>, that is if the request headers the object
+ * varies on are the same as for the request which produced it.
+ */
+static inline int entry_vary_match(const struct cache_entry *entry, const unsigned int *vary_hash)
 {
-	struct eb32_node *node;
+	unsigned int sig = entry->vary_sig;
+	int i;
+
+	for (i = 0; sig; i++, sig >>= 1) {
+		if ((sig & 1) && entry->vary_hash[i] != vary_hash[i])
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns the date until which <entry> may be delivered, once expired, while
+ * it is being refreshed or while its origin is failing.
+ */
+static inline unsigned int entry_stale_end(const struct cache_entry *entry)
+{
+	return entry->expire + MAX(entry->stale_revalidate, entry->stale_error);
+}
+
+/* Indexes <entry>, which was just inserted in the tree of <shard>, on its path
+ * and its surrogate keys.
+ */
+static void cache_index_entry(struct cache_shard *shard, struct cache_entry *entry)
+{
+	int i;
+
+	if (*entry->path) {
+		entry->path_node.key = entry->path;
+		ebis_insert(&shard->paths, &entry->path_node);
+	}
+	for (i = 0; i < entry->nb_tags; i++)
+		ebis_insert(&shard->tags, &entry->tag_nodes[i].node);
+}
+
+/* Removes <entry> from the tree and the indexes of its shard, so that it is
+ * not delivered anymore. Its blocks are reclaimed later. The shard's lock
+ * must be held.
+ */
+static void cache_unlink_entry(struct cache_entry *entry)
+{
+	int i;
+
+	eb32_delete(&entry->eb);
+	entry->eb.key = 0;
+	ebpt_delete(&entry->path_node);
+	for (i = 0; i < entry->nb_tags; i++)
+		ebpt_delete(&entry->tag_nodes[i].node);
+}
+
+/* Returns the valid entry of <shard> for the object of hash <hash> and the
+ * request headers hashes <vary_hash>, or NULL if there is none. Several
+ * variants of an object share the same key and are all checked. The returned
+ * entry may be expired but still within its stale period, the other expired
+ * ones are removed from the tree on the way.
+ */
+struct cache_entry *entry_exist(struct cache_shard *shard, char *hash, const unsigned int *vary_hash)
+{
+	struct eb32_node *node, *next;
 	struct cache_entry *entry;
 
-	node = eb32_lookup(&cache->entries, read_u32(hash));
-	if (!node)
+	node = eb32_lookup(&shard->entries, read_u32(hash));
+	for (; node; node = next) {
+		next = eb32_next_dup(node);
+		entry = eb32_entry(node, struct cache_entry, eb);
+
+		/* if that's not the right node */
+		if (memcmp(entry->hash, hash, sizeof(entry->hash)))
+			continue;
+
+		if (entry_stale_end(entry) <= now.tv_sec) {
+			cache_unlink_entry(entry);
+			continue;
+		}
+
+		if (entry_vary_match(entry, vary_hash))
+			return entry;
+	}
+	return NULL;
+
+}
+
+static inline struct shared_context *shctx_ptr(struct cache_shard *shard)
+{
+	return (struct shared_context *)((unsigned char *)shard - ((struct shared_context *)NULL)->data);
+}
+
+/* Returns the shard of <cache> the object of hash <hash> belongs to. The first
+ * 4 bytes of the hash are the key in the shard's tree, the next ones are used
+ * to pick the shard.
+ */
+static inline struct cache_shard *cache_shard(struct cache *cache, const char *hash)
+{
+	return cache->shards[read_u32(hash + 4) % cache->nb_shards];
+}
+
+/* Removes from <shard> the variant of hash <hash> suiting the request
+ * headers hashes <vary_hash> if any, so that it is replaced by the one being
+ * stored. If <keep_stale> is set, an expired variant is kept to be delivered
+ * until the new one is completely stored.
+ */
+static void cache_remove_entry(struct cache_shard *shard, char *hash, const unsigned int *vary_hash,
+                               int keep_stale)
+{
+	struct shared_context *shctx = shctx_ptr(shard);
+	struct cache_entry *old;
+
+	shctx_lock(shctx);
+	old = entry_exist(shard, hash, vary_hash);
+	if (old && !(keep_stale && old->expire <= now.tv_sec))
+		cache_unlink_entry(old);
+	shctx_unlock(shctx);
+}
+
+/* Returns the first node of tree <root>, made of zero-terminated strings,
+ * whose key starts with the <len> first bytes of <prefix>, or NULL if there is
+ * none. The next matching ones follow it in the tree's order. All the keys
+ * sharing the prefix are below the first node whose bit is beyond it.
+ */
+static struct ebpt_node *cache_first_prefix(struct eb_root *root, const char *prefix, int len)
+{
+	struct ebpt_node *node;
+	eb_troot_t *troot;
+	int bit;
+
+	troot = root->b[EB_LEFT];
+	if (!troot)
 		return NULL;
 
-	entry = eb32_entry(node, struct cache_entry, eb);
+	while (eb_gettag(troot) != EB_LEAF) {
+		node = container_of(eb_untag(troot, EB_NODE), struct ebpt_node, node.branches);
+		bit = node->node.bit;
+		if (bit < 0 || bit >= len * 8)
+			break;
+		troot = node->node.branches.b[(((unsigned char *)prefix)[bit >> 3] >> (~bit & 7)) & 1];
+	}
 
-	/* if that's not the right node */
-	if (memcmp(entry->hash, hash, sizeof(entry->hash)))
+	/* the leftmost leaf of this subtree tells if its keys match */
+	while (eb_gettag(troot) != EB_LEAF)
+		troot = (eb_untag(troot, EB_NODE))->b[EB_LEFT];
+	node = container_of(eb_untag(troot, EB_LEAF), struct ebpt_node, node.branches);
+	if (strncmp(node->key, prefix, len) != 0)
 		return NULL;
+	return node;
+}
 
-	if (entry->expire > now.tv_sec) {
-		return entry;
-	} else {
-		eb32_delete(node);
-		entry->eb.key = 0;
+/* Purges from all the shards of <cache> the entries whose path is <str>
+ * (CACHE_PURGE_PATH), whose path starts with <str> (CACHE_PURGE_PREFIX) or
+ * which carry the surrogate key <str> (CACHE_PURGE_TAG), using the indexes so
+ * that only the matching entries are visited. Since the stored paths are
+ * truncated, so is <str> for the paths. Returns the number of entries purged.
+ */
+static unsigned int cache_purge(struct cache *cache, int type, const char *str)
+{
+	struct cache_shard *shard;
+	struct ebpt_node *node, *next;
+	unsigned int i, count = 0;
+	size_t len = strlen(str);
+
+	if (type != CACHE_PURGE_TAG && len > CACHE_PATH_LEN - 1)
+		len = CACHE_PATH_LEN - 1;
+
+	for (i = 0; i < cache->nb_shards + !!cache->large; i++) {
+		shard = (i < cache->nb_shards) ? cache->shards[i] : cache->large;
+
+		shctx_lock(shctx_ptr(shard));
+		if (type == CACHE_PURGE_TAG) {
+			for (node = ebis_lookup(&shard->tags, str); node; node = next) {
+				next = ebpt_next_dup(node);
+				cache_unlink_entry(container_of(node, struct cache_tag, node)->entry);
+				count++;
+			}
+		}
+		else {
+			node = len ? cache_first_prefix(&shard->paths, str, len) : ebpt_first(&shard->paths);
+			for (; node && strncmp(node->key, str, len) == 0; node = next) {
+				next = ebpt_next(node);
+				if (type == CACHE_PURGE_PATH && ((char *)node->key)[len])
+					continue;
+				cache_unlink_entry(container_of(node, struct cache_entry, path_node));
+				count++;
+			}
+		}
+		shctx_unlock(shctx_ptr(shard));
 	}
-	return NULL;
+	return count;
+}
 
+/* Makes the stream of <st> wait for the fill in progress of the object of hash
+ * <hash> in <cache>, if any, otherwise registers it as the one doing this
+ * fill. Returns non-zero if the stream must wait.
+ */
+static int cache_collapse_miss(struct cache *cache, struct cache_st *st, const char *hash)
+{
+	struct cache_pending *pending;
+	struct eb32_node *node;
+	int ret = 0;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->pending_lock);
+	for (node = eb32_lookup(&cache->pending, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		pending = container_of(node, struct cache_pending, node);
+		if (memcmp(pending->hash, hash, sizeof(pending->hash)) == 0)
+			break;
+	}
+
+	if (node) {
+		LIST_ADDQ(&pending->waiters, &st->wait_list);
+		st->pending = pending;
+		st->flags |= CACHE_ST_F_WAITED;
+		ret = 1;
+	}
+	else {
+		/* if it cannot be allocated, the other ones will not wait */
+		pending = pool_alloc(pool_head_cache_pending);
+		if (pending) {
+			memcpy(pending->hash, hash, sizeof(pending->hash));
+			pending->node.key = read_u32(hash);
+			LIST_INIT(&pending->waiters);
+			eb32_insert(&cache->pending, &pending->node);
+			st->pending = pending;
+			st->flags |= CACHE_ST_F_FILLER;
+		}
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->pending_lock);
+	return ret;
 }
 
-static inline struct shared_context *shctx_ptr(struct cache *cache)
+/* Detaches <st> from the fill it performs or waits for in <cache>, if any. The
+ * end of a fill wakes all the streams waiting for it up, which will find the
+ * object in the cache if it could be stored.
+ */
+static void cache_release_pending(struct cache *cache, struct cache_st *st)
 {
-	return (struct shared_context *)((unsigned char *)cache - ((struct shared_context *)NULL)->data);
+	struct cache_st *waiter, *back;
+
+	if (!st->pending)
+		return;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->pending_lock);
+	if (!st->pending)
+		goto end;
+
+	if (st->flags & CACHE_ST_F_FILLER) {
+		list_for_each_entry_safe(waiter, back, &st->pending->waiters, wait_list) {
+			LIST_DEL_INIT(&waiter->wait_list);
+			waiter->pending = NULL;
+			task_wakeup(waiter->strm->task, TASK_WOKEN_MSG);
+		}
+		eb32_delete(&st->pending->node);
+		pool_free(pool_head_cache_pending, st->pending);
+		st->flags &= ~CACHE_ST_F_FILLER;
+	}
+	else
+		LIST_DEL_INIT(&st->wait_list);
+	st->pending = NULL;
+  end:
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->pending_lock);
 }
 
 static inline struct shared_block *block_ptr(struct cache_entry *entry)
@@ -149,7 +482,6 @@ cache_store_check(struct proxy *px, struct flt_conf *fconf)
 	struct cache_flt_conf *cconf = fconf->conf;
 	struct flt_conf *f;
 	struct cache *cache;
-	int comp = 0;
 
 	/* Find the cache corresponding to the name in the filter config.  The
 	*  cache will not be referenced now in the filter config because it is
@@ -169,22 +501,12 @@ cache_store_check(struct proxy *px, struct flt_conf *fconf)
 	/* Here <cache> points on the cache the filter must use and <cconf>
 	 * points on the cache filter configuration. */
 
-	/* Check all filters for proxy <px> to know if the compression is
-	 * enabled and if it is after the cache. When the compression is before
-	 * the cache, an error is returned. Also check if the cache filter must
-	 * be explicitly declaired or not. */
+	/* Check if the cache filter must be explicitly declaired or not. When
+	 * the compression is declared before the cache, the cache stores the
+	 * compressed responses.
+	 */
 	list_for_each_entry(f, &px->filter_configs, list) {
-		if (f == fconf) {
-			/* The compression filter must be evaluated after the cache. */
-			if (comp) {
-				ha_alert("config: %s '%s': unable to enable the compression filter before "
-					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-				return 1;
-			}
-		}
-		else if (f->id == http_comp_flt_id)
-			comp = 1;
-		else if (f->id == fcgi_flt_id)
+		if (f == fconf || f->id == http_comp_flt_id || f->id == fcgi_flt_id)
 			continue;
 		else if ((f->id != fconf->id) && (cconf->flags & CACHE_FLT_F_IMPLICIT_DECL)) {
 			/* Implicit declaration is only allowed with the
@@ -209,10 +531,13 @@ cache_store_strm_init(struct stream *s, struct filter *filter)
 		return -1;
 
 	st->first_block = NULL;
+	st->shard       = NULL;
+	st->strm        = s;
+	st->pending     = NULL;
+	LIST_INIT(&st->wait_list);
+	st->flags       = 0;
+	st->path[0]     = 0;
 	filter->ctx     = st;
-
-	/* Register post-analyzer on AN_RES_WAIT_HTTP */
-	filter->post_analyzers |= AN_RES_WAIT_HTTP;
 	return 1;
 }
 
@@ -221,12 +546,15 @@ cache_store_strm_deinit(struct stream *s, struct filter *filter)
 {
 	struct cache_st *st = filter->ctx;
 	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
+	struct shared_context *shctx;
+
+	if (st)
+		cache_release_pending(cconf->c.cache, st);
 
 	/* Everything should be released in the http_end filter, but we need to do it
 	 * there too, in case of errors */
 	if (st && st->first_block) {
+		shctx = shctx_ptr(st->shard);
 		shctx_lock(shctx);
 		shctx_row_dec_hot(shctx, st->first_block);
 		shctx_unlock(shctx);
@@ -237,40 +565,22 @@ cache_store_strm_deinit(struct stream *s, struct filter *filter)
 	}
 }
 
-static int
-cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel *chn,
-			 unsigned an_bit)
-{
-	struct http_txn *txn = s->txn;
-	struct http_msg *msg = &txn->rsp;
-	struct cache_st *st = filter->ctx;
-
-	if (an_bit != AN_RES_WAIT_HTTP)
-		goto end;
-
-	/* Here we need to check if any compression filter precedes the cache
-	 * filter. This is only possible when the compression is configured in
-	 * the frontend while the cache filter is configured on the
-	 * backend. This case cannot be detected during HAProxy startup. So in
-	 * such cases, the cache is disabled.
-	 */
-	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
-	}
-
-  end:
-	return 1;
-}
-
 static int
 cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
 {
 	struct cache_st *st = filter->ctx;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
 
 	if (!(msg->chn->flags & CF_ISRESP) || !st)
 		return 1;
 
+	/* the compression filter placed before has rewritten the headers */
+	if (st->flags & CACHE_ST_F_COMPRESSED) {
+		st->flags &= ~CACHE_ST_F_COMPRESSED;
+		if (!cache_store_headers(s, cconf->c.cache, st, 1))
+			cache_release_pending(cconf->c.cache, st);
+	}
+
 	if (st->first_block)
 		register_data_filter(s, msg->chn, filter);
 	return 1;
@@ -279,6 +589,7 @@ cache_store_http_headers(struct stream *s, struct filter *filter, struct http_ms
 static inline void disable_cache_entry(struct cache_st *st,
                                        struct filter *filter, struct shared_context *shctx)
 {
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
 	struct cache_entry *object;
 
 	object = (struct cache_entry *)st->first_block->data;
@@ -287,6 +598,7 @@ static inline void disable_cache_entry(struct cache_st *st,
 	shctx_row_dec_hot(shctx, st->first_block);
 	object->eb.key = 0;
 	shctx_unlock(shctx);
+	cache_release_pending(cconf->c.cache, st);
 	pool_free(pool_head_cache_st, st);
 }
 
@@ -294,8 +606,7 @@ static int
 cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 			 unsigned int offset, unsigned int len)
 {
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_context *shctx;
 	struct cache_st *st = filter->ctx;
 	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct htx_blk *blk;
@@ -312,6 +623,7 @@ cache_store_http_payload(struct stream *s, struct filter *filter, struct http_ms
 		return len;
 	}
 
+	shctx = shctx_ptr(st->shard);
 	chunk_reset(&trash);
 	orig_len = len;
 	to_forward = 0;
@@ -388,9 +700,8 @@ cache_store_http_end(struct stream *s, struct filter *filter,
 {
 	struct cache_st *st = filter->ctx;
 	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
-	struct cache_entry *object;
+	struct shared_context *shctx;
+	struct cache_entry *object, *old;
 
 	if (!(msg->chn->flags & CF_ISRESP))
 		return 1;
@@ -398,20 +709,32 @@ cache_store_http_end(struct stream *s, struct filter *filter,
 	if (st && st->first_block) {
 
 		object = (struct cache_entry *)st->first_block->data;
+		shctx = shctx_ptr(st->shard);
 
 		/* does not need to test if the insertion worked, if it
 		 * doesn't, the blocks will be reused anyway */
 
 		shctx_lock(shctx);
-		if (eb32_insert(&cache->entries, &object->eb) != &object->eb) {
+		old = entry_exist(st->shard, object->hash, object->vary_hash);
+		if (old && old->expire > now.tv_sec) {
+			/* the same variant was stored meanwhile */
 			object->eb.key = 0;
 		}
+		else {
+			/* replace the stale variant, if any */
+			if (old)
+				cache_unlink_entry(old);
+			eb32_insert(&st->shard->entries, &object->eb);
+			cache_index_entry(st->shard, object);
+		}
 		/* remove from the hotlist */
 		shctx_row_dec_hot(shctx, st->first_block);
 		shctx_unlock(shctx);
 
 	}
 	if (st) {
+		/* the waiting streams will find the object, if stored */
+		cache_release_pending(cconf->c.cache, st);
 		pool_free(pool_head_cache_st, st);
 		filter->ctx = NULL;
 	}
@@ -509,84 +832,159 @@ int http_calc_maxage(struct stream *s, struct cache *cache)
 
 }
 
+/*
+ * Computes into <revalidate> and <error> the durations in seconds during
+ * which an HTTP response may still be delivered once expired, from the
+ * stale-while-revalidate and stale-if-error directives of its Cache-Control
+ * header (RFC 5861), both limited to the max-stale of the cache.
+ */
+static void http_calc_stale(struct stream *s, struct cache *cache,
+                            unsigned int *revalidate, unsigned int *error)
+{
+	struct htx *htx = htxbuf(&s->res.buf);
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	const char *value, *end;
+
+	*revalidate = *error = 0;
+	if (!cache->maxstale)
+		return;
+
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		end = ctx.value.ptr + ctx.value.len;
+
+		value = directive_value(ctx.value.ptr, ctx.value.len, "stale-while-revalidate", 22);
+		if (value)
+			*revalidate = read_uint(&value, end);
+
+		value = directive_value(ctx.value.ptr, ctx.value.len, "stale-if-error", 14);
+		if (value)
+			*error = read_uint(&value, end);
+	}
+
+	*revalidate = MIN(*revalidate, cache->maxstale);
+	*error = MIN(*error, cache->maxstale);
+}
+
 
 static void cache_free_blocks(struct shared_block *first, struct shared_block *block)
 {
 	struct cache_entry *object = (struct cache_entry *)block->data;
 
 	if (first == block && object->eb.key)
-		eb32_delete(&object->eb);
+		cache_unlink_entry(object);
 	object->eb.key = 0;
 }
 
+/* Stores into <object> the surrogate keys listed in the Surrogate-Key headers
+ * of the response <htx>, separated by spaces. Those which do not fit and the
+ * duplicates are ignored.
+ */
+static void cache_store_tags(struct cache_entry *object, struct htx *htx)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	unsigned int len = 0;
+	int i;
+
+	while (object->nb_tags < CACHE_MAX_TAGS &&
+	       http_find_header(htx, ist("Surrogate-Key"), &ctx, 1)) {
+		const char *p = ctx.value.ptr, *end = p + ctx.value.len;
+
+		while (p < end && object->nb_tags < CACHE_MAX_TAGS) {
+			const char *tag;
+
+			while (p < end && HTTP_IS_LWS(*p))
+				p++;
+			tag = p;
+			while (p < end && !HTTP_IS_LWS(*p))
+				p++;
+			if (p == tag || len + (p - tag) + 1 > sizeof(object->tags))
+				continue;
+
+			memcpy(object->tags + len, tag, p - tag);
+			object->tags[len + (p - tag)] = 0;
+			for (i = 0; i < object->nb_tags; i++) {
+				if (strcmp(object->tag_nodes[i].node.key, object->tags + len) == 0)
+					break;
+			}
+			if (i < object->nb_tags)
+				continue;
+
+			object->tag_nodes[i].node.node.leaf_p = NULL;
+			object->tag_nodes[i].node.key = object->tags + len;
+			object->tag_nodes[i].entry = object;
+			object->nb_tags++;
+			len += (p - tag) + 1;
+		}
+	}
+}
+
 /*
- * This function will store the headers of the response in a buffer and then
- * register a filter to store the data
+ * Stores the headers of the response of <s> into a new entry of <cache> which
+ * is registered in the filter context <cache_ctx> to be filled with the data.
+ * <comp> is non-zero if the response passes through a compression filter
+ * before the cache, in which case the stored object varies on the
+ * Accept-Encoding request header. Returns 1 on success or 0 if the response
+ * is not stored.
  */
-enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
-					struct session *sess, struct stream *s, int flags)
+static int cache_store_headers(struct stream *s, struct cache *cache, struct cache_st *cache_ctx,
+                               int comp)
 {
 	unsigned int age;
 	long long hdr_age;
 	struct http_txn *txn = s->txn;
 	struct http_msg *msg = &txn->rsp;
-	struct filter *filter;
 	struct shared_block *first = NULL;
-	struct cache_flt_conf *cconf = rule->arg.act.p[0];
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
-	struct cache_st *cache_ctx = NULL;
-	struct cache_entry *object, *old;
+	struct cache_shard *shard = cache_shard(cache, txn->cache_hash);
+	struct shared_context *shctx = shctx_ptr(shard);
+	struct cache_entry *object;
 	unsigned int key = read_u32(txn->cache_hash);
 	struct htx *htx;
 	struct http_hdr_ctx ctx;
 	size_t hdrs_len = 0;
+	unsigned int vary_sig;
 	int32_t pos;
 
-	/* Don't cache if the response came from a cache */
-	if ((obj_type(s->target) == OBJ_TYPE_APPLET) &&
-	    s->target == &http_cache_applet.obj_type) {
-		goto out;
-	}
-
-	/* cache only HTTP/1.1 */
-	if (!(txn->req.flags & HTTP_MSGF_VER_11))
-		goto out;
-
-	/* cache only GET method */
-	if (txn->meth != HTTP_METH_GET)
-		goto out;
+	htx = htxbuf(&s->res.buf);
 
-	/* cache key was not computed */
-	if (!key)
-		goto out;
+	/* Do not cache too big objects, unless they fit in the large objects
+	 * tier. This is only possible when their size is known.
+	 */
+	if ((msg->flags & HTTP_MSGF_CNT_LEN) && shctx->max_obj_size > 0 &&
+	    htx->data + htx->extra > shctx->max_obj_size) {
+		if (!cache->large ||
+		    htx->data + htx->extra > shctx_ptr(cache->large)->max_obj_size)
+			goto out;
+		shard = cache->large;
+		shctx = shctx_ptr(shard);
+	}
 
-	/* cache only 200 status code */
-	if (txn->status != 200)
-		goto out;
+	/* Only the variants on the request headers the cache knows may be
+	 * stored, under a secondary key made of these headers. The responses
+	 * which may be compressed before being stored depend on the encodings
+	 * accepted by the client.
+	 */
+	vary_sig = comp ? 1 : 0;
+	ctx.blk = NULL;
+	while (http_find_header(htx, ist("Vary"), &ctx, 0)) {
+		int i;
 
-	/* Find the corresponding filter instance for the current stream */
-	list_for_each_entry(filter, &s->strm_flt.filters, list) {
-		if (FLT_ID(filter) == cache_store_flt_id  && FLT_CONF(filter) == cconf) {
-			/* No filter ctx, don't cache anything */
-			if (!filter->ctx)
-				goto out;
-			cache_ctx = filter->ctx;
-			break;
+		for (i = 0; i < cache->nb_vary_hdrs; i++) {
+			if (isteqi(ctx.value, cache->vary_hdrs[i]))
+				break;
 		}
-	}
 
-	/* from there, cache_ctx is always defined */
-	htx = htxbuf(&s->res.buf);
+		/* the Vary header added by the compression is always supported */
+		if (comp && i == 0)
+			continue;
 
-	/* Do not cache too big objects. */
-	if ((msg->flags & HTTP_MSGF_CNT_LEN) && shctx->max_obj_size > 0 &&
-	    htx->data + htx->extra > shctx->max_obj_size)
-		goto out;
+		if (!cache->vary_processing)
+			goto out;
 
-	/* Does not manage Vary at the moment. We will need a secondary key later for that */
-	ctx.blk = NULL;
-	if (http_find_header(htx, ist("Vary"), &ctx, 0))
-		goto out;
+		/* "*" or an unsupported header */
+		if (i == cache->nb_vary_hdrs)
+			goto out;
+		vary_sig |= 1U << i;
+	}
 
 	http_check_response_for_cacheability(s, &s->res);
 
@@ -635,7 +1033,14 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	object = (struct cache_entry *)first->data;
 	object->eb.node.leaf_p = NULL;
 	object->eb.key = 0;
+	object->path_node.node.leaf_p = NULL;
+	object->nb_tags = 0;
 	object->age = age;
+	object->shard = shard;
+	object->vary_sig = vary_sig;
+	memcpy(object->vary_hash, txn->cache_vary_hash, sizeof(object->vary_hash));
+	strcpy(object->path, cache_ctx->path);
+	cache_store_tags(object, htx);
 
 	/* reserve space for the cache_entry structure */
 	first->len = sizeof(struct cache_entry);
@@ -652,28 +1057,27 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 		goto out;
 
 	/* register the buffer in the filter ctx for filling it with data*/
-	if (cache_ctx) {
-		cache_ctx->first_block = first;
-
-		object->eb.key = key;
-
-		memcpy(object->hash, txn->cache_hash, sizeof(object->hash));
-		/* Insert the node later on caching success */
-
-		shctx_lock(shctx);
-
-		old = entry_exist(cconf->c.cache, txn->cache_hash);
-		if (old) {
-			eb32_delete(&old->eb);
-			old->eb.key = 0;
-		}
-		shctx_unlock(shctx);
-
-		/* store latest value and expiration time */
-		object->latest_validation = now.tv_sec;
-		object->expire = now.tv_sec + http_calc_maxage(s, cconf->c.cache);
-		return ACT_RET_CONT;
-	}
+	cache_ctx->first_block = first;
+	cache_ctx->shard = shard;
+
+	object->eb.key = key;
+
+	memcpy(object->hash, txn->cache_hash, sizeof(object->hash));
+	/* Insert the node later on caching success */
+
+	/* a stale variant in the same tier is kept until it is replaced */
+	cache_remove_entry(cache_shard(cache, txn->cache_hash), txn->cache_hash, txn->cache_vary_hash,
+	                   shard != cache->large);
+	if (cache->large)
+		cache_remove_entry(cache->large, txn->cache_hash, txn->cache_vary_hash,
+		                   shard == cache->large);
+
+	/* store latest value and expiration time */
+	object->latest_validation = now.tv_sec;
+	object->expire = now.tv_sec + http_calc_maxage(s, cache);
+	http_calc_stale(s, cache, &object->stale_revalidate, &object->stale_error);
+	object->refresh = 0;
+	return 1;
 
 out:
 	/* if does not cache */
@@ -684,6 +1088,224 @@ out:
 		shctx_row_dec_hot(shctx, first);
 		shctx_unlock(shctx);
 	}
+	return 0;
+}
+
+/* Returns the early hints learned by <cache> for the object of hash <hash>, or
+ * NULL if there are none. Must be called with the hints lock held.
+ */
+static struct cache_hints *cache_hints_lookup(struct cache *cache, const char *hash)
+{
+	struct eb32_node *node;
+	struct cache_hints *hints;
+
+	for (node = eb32_lookup(&cache->hints, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		hints = eb32_entry(node, struct cache_hints, node);
+		if (memcmp(hints->hash, hash, sizeof(hints->hash)) == 0)
+			return hints;
+	}
+	return NULL;
+}
+
+/* Learns from the 200 response <htx> to the request of hash <hash> the
+ * "Link" header values with the "preload" relation, they replace the ones
+ * previously learned for this object. They are forgotten if the response has
+ * none. The least recently used URL is evicted when <cache> learned as many
+ * as its "early-hints" setting.
+ */
+static void cache_learn_hints(struct cache *cache, const char *hash, struct htx *htx)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct cache_hints *hints;
+	char links[CACHE_HINTS_MAX_LEN];
+	unsigned int len = 0;
+
+	while (http_find_header(htx, ist("link"), &ctx, 0)) {
+		if (!strnistr(ctx.value.ptr, ctx.value.len, "preload", 7))
+			continue;
+		if (len + (len ? 2 : 0) + ctx.value.len > sizeof(links))
+			break;
+		if (len) {
+			memcpy(links + len, ", ", 2);
+			len += 2;
+		}
+		memcpy(links + len, ctx.value.ptr, ctx.value.len);
+		len += ctx.value.len;
+	}
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->hints_lock);
+	hints = cache_hints_lookup(cache, hash);
+	if (!len) {
+		if (hints) {
+			eb32_delete(&hints->node);
+			LIST_DEL(&hints->lru);
+			cache->hints_count--;
+			pool_free(pool_head_cache_hints, hints);
+		}
+		goto end;
+	}
+
+	if (!hints) {
+		if (cache->hints_count >= cache->hints_max) {
+			/* recycle the least recently used one */
+			hints = LIST_ELEM(cache->hints_lru.n, struct cache_hints *, lru);
+			eb32_delete(&hints->node);
+			LIST_DEL(&hints->lru);
+		}
+		else {
+			hints = pool_alloc(pool_head_cache_hints);
+			if (!hints)
+				goto end;
+			cache->hints_count++;
+		}
+		memcpy(hints->hash, hash, sizeof(hints->hash));
+		hints->node.key = read_u32(hash);
+		eb32_insert(&cache->hints, &hints->node);
+	}
+	else
+		LIST_DEL(&hints->lru);
+
+	LIST_ADDQ(&cache->hints_lru, &hints->lru);
+	memcpy(hints->links, links, len);
+	hints->len = len;
+  end:
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->hints_lock);
+}
+
+/* Sends a 103 Early Hints response made of the "Link" header values learned
+ * by <cache> for the request of stream <s>, whose hash must already be
+ * computed. Nothing is sent to HTTP/1.0 clients nor if nothing was learned.
+ * Returns 0 if the response could not be emitted, otherwise 1.
+ */
+static int cache_send_hints(struct cache *cache, struct stream *s)
+{
+	struct channel *res = &s->res;
+	struct htx *htx;
+	struct cache_hints *hints;
+	struct buffer *links;
+	struct htx_sl *sl;
+	unsigned int flags = (HTX_SL_F_IS_RESP|HTX_SL_F_VER_11|
+			      HTX_SL_F_XFER_LEN|HTX_SL_F_BODYLESS);
+
+	if (!cache->hints_max || !(s->txn->req.flags & HTTP_MSGF_VER_11))
+		return 1;
+
+	links = alloc_trash_chunk();
+	if (!links)
+		return 0;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->hints_lock);
+	hints = cache_hints_lookup(cache, s->txn->cache_hash);
+	if (hints) {
+		chunk_memcat(links, hints->links, hints->len);
+		LIST_DEL(&hints->lru);
+		LIST_ADDQ(&cache->hints_lru, &hints->lru);
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->hints_lock);
+
+	if (!b_data(links))
+		goto end;
+
+	htx = htx_from_buf(&res->buf);
+	sl = htx_add_stline(htx, HTX_BLK_RES_SL, flags,
+			    ist("HTTP/1.1"), ist("103"), ist("Early Hints"));
+	if (!sl)
+		goto error;
+	sl->info.res.status = 103;
+
+	if (!htx_add_header(htx, ist("Link"), ist2(b_orig(links), b_data(links))) ||
+	    !htx_add_endof(htx, HTX_BLK_EOH) ||
+	    !http_forward_proxy_resp(s, 0))
+		goto error;
+
+  end:
+	free_trash_chunk(links);
+	return 1;
+
+  error:
+	channel_htx_truncate(res, htx);
+	free_trash_chunk(links);
+	return 0;
+}
+
+/*
+ * This function will store the headers of the response in a buffer and then
+ * register a filter to store the data. When the response is compressed by a
+ * filter placed before the cache, the headers are only stored once rewritten
+ * by the compression, from the cache filter's http_headers callback, so that
+ * the compressed response is stored.
+ */
+enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
+					struct session *sess, struct stream *s, int flags)
+{
+	struct http_txn *txn = s->txn;
+	struct http_msg *msg = &txn->rsp;
+	struct filter *filter;
+	struct cache_flt_conf *cconf = rule->arg.act.p[0];
+	struct cache *cache = cconf->c.cache;
+	struct cache_st *cache_ctx = NULL;
+	unsigned int key = read_u32(txn->cache_hash);
+	int comp = 0;
+
+	/* Don't cache if the response came from a cache */
+	if ((obj_type(s->target) == OBJ_TYPE_APPLET) &&
+	    s->target == &http_cache_applet.obj_type) {
+		goto out;
+	}
+
+	/* cache only HTTP/1.1 */
+	if (!(txn->req.flags & HTTP_MSGF_VER_11))
+		goto out;
+
+	/* cache only GET method */
+	if (txn->meth != HTTP_METH_GET)
+		goto out;
+
+	/* cache only 200 status code */
+	if (txn->status != 200)
+		goto out;
+
+	/* the early hints are learned even from the uncacheable responses */
+	if (cache->hints_max && key)
+		cache_learn_hints(cache, txn->cache_hash, htxbuf(&s->res.buf));
+
+	/* Find the corresponding filter instance for the current stream, and
+	 * check if the data will pass through a compression filter first.
+	 */
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) == cache_store_flt_id  && FLT_CONF(filter) == cconf) {
+			cache_ctx = filter->ctx;
+			break;
+		}
+		if (FLT_ID(filter) == http_comp_flt_id)
+			comp = 1;
+	}
+
+	/* No filter ctx, don't cache anything */
+	if (!cache_ctx)
+		goto out;
+
+	/* cache key was not computed */
+	if (!key)
+		goto out;
+
+	if (comp && (msg->flags & HTTP_MSGF_COMPRESSING)) {
+		/* the compression of the objects stored once and delivered
+		 * many times may be much stronger.
+		 */
+		if (cache->comp_level)
+			http_comp_set_level(s, cache->comp_level);
+		cache_ctx->flags |= CACHE_ST_F_COMPRESSED;
+		return ACT_RET_CONT;
+	}
+
+	if (cache_store_headers(s, cache, cache_ctx, comp))
+		return ACT_RET_CONT;
+
+out:
+	/* the streams waiting for this object will not find it */
+	if (cache_ctx && !cache_ctx->first_block)
+		cache_release_pending(cache, cache_ctx);
 
 	return ACT_RET_CONT;
 }
@@ -696,22 +1318,20 @@ out:
 
 static void http_cache_applet_release(struct appctx *appctx)
 {
-	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
 	struct cache_entry *cache_ptr = appctx->ctx.cache.entry;
-	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache_ptr->shard);
 	struct shared_block *first = block_ptr(cache_ptr);
 
-	shctx_lock(shctx_ptr(cache));
-	shctx_row_dec_hot(shctx_ptr(cache), first);
-	shctx_unlock(shctx_ptr(cache));
+	shctx_lock(shctx);
+	shctx_row_dec_hot(shctx, first);
+	shctx_unlock(shctx);
 }
 
 
 static unsigned int htx_cache_dump_blk(struct appctx *appctx, struct htx *htx, enum htx_blk_type type,
 				       uint32_t info, struct shared_block *shblk, unsigned int offset)
 {
-	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_context *shctx = shctx_ptr(appctx->ctx.cache.entry->shard);
 	struct htx_blk *blk;
 	char *ptr;
 	unsigned int max, total;
@@ -755,10 +1375,11 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 					    uint32_t info, struct shared_block *shblk, unsigned int offset)
 {
 
-	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_context *shctx = shctx_ptr(appctx->ctx.cache.entry->shard);
+	struct htx_ret htxret;
 	unsigned int max, total, rem_data;
-	uint32_t blksz;
+	uint32_t blksz, room;
+	char *ptr;
 
 	max = htx_get_max_blksz(htx, channel_htx_recv_max(si_ic(appctx->owner), htx));
 	if (!max)
@@ -778,22 +1399,42 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 		blksz = max;
 	}
 
-	while (blksz) {
+	/* The room is reserved once in the HTX message and the shared blocks
+	 * are copied there back-to-back, instead of appending them one at a
+	 * time, which would have to find again the tail block and the free
+	 * space for each of them.
+	 */
+	htxret = htx_reserve_max_data(htx);
+	if (!htxret.blk)
+		goto end;
+	ptr  = htx_get_blk_ptr(htx, htxret.blk) + htxret.ret;
+	room = htx_get_blksz(htxret.blk) - htxret.ret;
+
+	while (blksz && room) {
 		size_t sz;
 
-		max = MIN(blksz, shctx->block_size - offset);
-		sz  = htx_add_data(htx, ist2(shblk->data + offset, max));
+		sz = MIN(blksz, shctx->block_size - offset);
+		if (sz > room)
+			sz = room;
+		memcpy(ptr, shblk->data + offset, sz);
+		ptr    += sz;
+		room   -= sz;
 		offset += sz;
 		blksz  -= sz;
-		total  += sz;
-		if (sz < max)
-			break;
-		if (blksz || offset == shctx->block_size) {
+		total  += sz;
+		if (offset == shctx->block_size) {
 			shblk = LIST_NEXT(&shblk->list, typeof(shblk), list);
 			offset = 0;
 		}
 	}
 
+	/* give back the unused room */
+	if (!htxret.ret && room == htx_get_blksz(htxret.blk))
+		htx_remove_blk(htx, htxret.blk);
+	else
+		htx_change_blk_value_len(htx, htxret.blk, htx_get_blksz(htxret.blk) - room);
+
+  end:
 	appctx->ctx.cache.offset   = offset;
 	appctx->ctx.cache.next     = shblk;
 	appctx->ctx.cache.sent    += total;
@@ -804,8 +1445,7 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 static size_t htx_cache_dump_msg(struct appctx *appctx, struct htx *htx, unsigned int len,
 				 enum htx_blk_type mark)
 {
-	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_context *shctx = shctx_ptr(appctx->ctx.cache.entry->shard);
 	struct shared_block   *shblk;
 	unsigned int offset, sz;
 	unsigned int ret, total = 0;
@@ -1100,6 +1740,91 @@ int sha1_hosturi(struct stream *s)
 	return 1;
 }
 
+/* Returns a hash of the encodings accepted by the Accept-Encoding headers of
+ * <htx>, which does not depend on their order, their case, the spaces nor the
+ * weights, except for the refused ones (q=0) which are ignored. It is zero if
+ * there is no such header.
+ */
+static unsigned int accept_encoding_hash(struct htx *htx)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	unsigned int hash = 0;
+	int found = 0;
+	char token[32];
+
+	while (http_find_header(htx, ist("accept-encoding"), &ctx, 0)) {
+		const char *p = ctx.value.ptr;
+		const char *end = p + ctx.value.len;
+		const char *q;
+		int len = 0;
+
+		found = 1;
+
+		/* lower case token, up to the parameters */
+		for (; p < end && *p != ';' && *p != ' ' && *p != '\t'; p++) {
+			if (len < sizeof(token))
+				token[len++] = tolower((unsigned char)*p);
+		}
+
+		/* a zero weight means that this encoding is refused */
+		q = memchr(p, '=', end - p);
+		if (q && q - p >= 2 && (q[-1] == 'q' || q[-1] == 'Q')) {
+			for (q++; q < end && (*q == '0' || *q == '.'); q++)
+				;
+			if (q == end || *q == ' ' || *q == '\t' || *q == ';')
+				continue;
+		}
+
+		/* the order does not matter */
+		hash += hash_crc32(token, len);
+	}
+	return hash ? hash : found;
+}
+
+/* Computes into the transaction of <s> the hashes of the request headers the
+ * objects of <cache> may vary on. The first one is the Accept-Encoding header,
+ * the other ones are compared as a whole. An absent header hashes to zero.
+ */
+static void cache_vary_hashes(struct stream *s, struct cache *cache)
+{
+	struct htx *htx = htxbuf(&s->req.buf);
+	struct http_hdr_ctx ctx;
+	unsigned int hash;
+	int i;
+
+	s->txn->cache_vary_hash[0] = accept_encoding_hash(htx);
+	for (i = 1; cache->vary_processing && i < cache->nb_vary_hdrs; i++) {
+		hash = 0;
+		ctx.blk = NULL;
+		while (http_find_header(htx, cache->vary_hdrs[i], &ctx, 1))
+			hash = hash * 33 + hash_crc32(ctx.value.ptr, ctx.value.len) + 1;
+		s->txn->cache_vary_hash[i] = hash;
+	}
+}
+
+/* Returns non-zero if the expired entry <entry> may be delivered to the stream
+ * <s>, which is the case while it is being refreshed by another stream during
+ * its stale-while-revalidate period, or while the backend has no server
+ * available during its stale-if-error period. Otherwise, the stream becomes
+ * the one refreshing it if it is not done yet. The shard of the entry must be
+ * locked.
+ */
+static int cache_deliver_stale(struct stream *s, struct cache_entry *entry)
+{
+	if (now.tv_sec < entry->expire + entry->stale_revalidate) {
+		if (entry->refresh && now.tv_sec < entry->refresh + CACHE_REFRESH_TIMEOUT)
+			return 1;
+		entry->refresh = now.tv_sec;
+		return 0;
+	}
+
+	if (now.tv_sec < entry->expire + entry->stale_error &&
+	    (s->be->cap & PR_CAP_BE) && !s->be->srv_act && !s->be->srv_bck)
+		return 1;
+
+	return 0;
+}
+
 enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *px,
                                          struct session *sess, struct stream *s, int flags)
 {
@@ -1108,6 +1833,10 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	struct cache_entry *res;
 	struct cache_flt_conf *cconf = rule->arg.act.p[0];
 	struct cache *cache = cconf->c.cache;
+	struct cache_shard *shard;
+	struct shared_context *shctx;
+	struct cache_st *st = NULL;
+	struct filter *filter;
 
 	/* Ignore cache for HTTP/1.0 requests and for requests other than GET
 	 * and HEAD */
@@ -1123,20 +1852,63 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	if (!sha1_hosturi(s))
 		return ACT_RET_CONT;
 
+	/* the filter context holds the state of the collapsed misses and the
+	 * path the object will be indexed on.
+	 */
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) == cache_store_flt_id && FLT_CONF(filter) == cconf) {
+			st = filter->ctx;
+			break;
+		}
+	}
+
+	if (st && !st->path[0]) {
+		struct ist path = http_get_path(htx_sl_req_uri(http_get_stline(htxbuf(&s->req.buf))));
+
+		if (path.len) {
+			path.len = MIN(path.len, sizeof(st->path) - 1);
+			memcpy(st->path, path.ptr, path.len);
+			st->path[path.len] = 0;
+		}
+	}
+
+	/* the objects compressed before being stored vary on Accept-Encoding
+	 * even when the Vary processing is disabled.
+	 */
+	cache_vary_hashes(s, cache);
+
 	if (s->txn->flags & TX_CACHE_IGNORE)
 		return ACT_RET_CONT;
 
-	if (px == strm_fe(s))
-		_HA_ATOMIC_ADD(&px->fe_counters.p.http.cache_lookups, 1);
-	else
-		_HA_ATOMIC_ADD(&px->be_counters.p.http.cache_lookups, 1);
+	/* we were waiting for another stream's fill, which is either complete
+	 * or too long.
+	 */
+	if (st && st->pending && !(st->flags & CACHE_ST_F_FILLER))
+		cache_release_pending(cache, st);
 
-	shctx_lock(shctx_ptr(cache));
-	res = entry_exist(cache, s->txn->cache_hash);
+	if (flags & ACT_OPT_FIRST) {
+		if (px == strm_fe(s))
+			_HA_ATOMIC_ADD(&px->fe_counters.p.http.cache_lookups, 1);
+		else
+			_HA_ATOMIC_ADD(&px->be_counters.p.http.cache_lookups, 1);
+	}
+
+	shard = cache_shard(cache, s->txn->cache_hash);
+  lookup:
+	shctx = shctx_ptr(shard);
+	shctx_lock(shctx);
+	res = entry_exist(shard, s->txn->cache_hash, s->txn->cache_vary_hash);
+	if (res && res->expire <= now.tv_sec && !cache_deliver_stale(s, res)) {
+		/* this stream fetches the object again, the stale one is not
+		 * in the other tier.
+		 */
+		shctx_unlock(shctx);
+		goto miss;
+	}
 	if (res) {
 		struct appctx *appctx;
-		shctx_row_inc_hot(shctx_ptr(cache), block_ptr(res));
-		shctx_unlock(shctx_ptr(cache));
+		shctx_row_inc_hot(shctx, block_ptr(res));
+		shctx_unlock(shctx);
 		s->target = &http_cache_applet.obj_type;
 		if ((appctx = si_register_handler(&s->si[1], objt_applet(s->target)))) {
 			appctx->st0 = HTX_CACHE_INIT;
@@ -1151,13 +1923,34 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 				_HA_ATOMIC_ADD(&px->be_counters.p.http.cache_hits, 1);
 			return ACT_RET_CONT;
 		} else {
-			shctx_lock(shctx_ptr(cache));
-			shctx_row_dec_hot(shctx_ptr(cache), block_ptr(res));
-			shctx_unlock(shctx_ptr(cache));
+			shctx_lock(shctx);
+			shctx_row_dec_hot(shctx, block_ptr(res));
+			shctx_unlock(shctx);
 			return ACT_RET_YIELD;
 		}
 	}
-	shctx_unlock(shctx_ptr(cache));
+	shctx_unlock(shctx);
+
+	/* the large objects are in their own tier */
+	if (cache->large && shard != cache->large) {
+		shard = cache->large;
+		goto lookup;
+	}
+
+  miss:
+	/* the preload hints are sent once, while the server is working */
+	if ((flags & ACT_OPT_FIRST) && !cache_send_hints(cache, s))
+		return ACT_RET_ERR;
+
+	/* wait once for the same object being fetched by another stream,
+	 * instead of fetching it again.
+	 */
+	if (cache->collapse_timeout && st && !st->pending &&
+	    !(st->flags & CACHE_ST_F_WAITED) && !(flags & ACT_OPT_FINAL) &&
+	    cache_collapse_miss(cache, st, s->txn->cache_hash)) {
+		s->req.analyse_exp = tick_add(now_ms, cache->collapse_timeout);
+		return ACT_RET_YIELD;
+	}
 	return ACT_RET_CONT;
 }
 
@@ -1175,6 +1968,158 @@ enum act_parse_ret parse_cache_use(const char **args, int *orig_arg, struct prox
 	return ACT_RET_PRS_OK;
 }
 
+/* This function executes the "cache-early-hints" action. It sends a 103 Early
+ * Hints response made of the "Link" headers learned by the cache for the
+ * request's URL, if any, without looking the object up.
+ */
+enum act_return http_action_req_cache_hints(struct act_rule *rule, struct proxy *px,
+                                            struct session *sess, struct stream *s, int flags)
+{
+	struct cache_flt_conf *cconf = rule->arg.act.p[0];
+	struct cache *cache = cconf->c.cache;
+
+	if (s->txn->meth != HTTP_METH_GET && s->txn->meth != HTTP_METH_HEAD)
+		return ACT_RET_CONT;
+
+	if (!sha1_hosturi(s))
+		return ACT_RET_CONT;
+
+	if (!cache_send_hints(cache, s))
+		return ACT_RET_ERR;
+	return ACT_RET_CONT;
+}
+
+enum act_parse_ret parse_cache_hints(const char **args, int *orig_arg, struct proxy *proxy,
+                                     struct act_rule *rule, char **err)
+{
+	rule->action       = ACT_CUSTOM;
+	rule->action_ptr   = http_action_req_cache_hints;
+
+	if (!parse_cache_rule(proxy, args[*orig_arg], rule, err))
+		return ACT_RET_PRS_ERR;
+
+	(*orig_arg)++;
+	return ACT_RET_PRS_OK;
+}
+
+/* This function executes the "cache-purge" action. It purges from the cache
+ * the objects carrying the surrogate keys listed in the Surrogate-Key request
+ * headers if any, otherwise the object of the request's path, or all those
+ * starting with it if it ends with a '*'. The number of objects purged is
+ * reported in a 200 response.
+ */
+enum act_return http_action_req_cache_purge(struct act_rule *rule, struct proxy *px,
+                                            struct session *sess, struct stream *s, int flags)
+{
+	struct cache_flt_conf *cconf = rule->arg.act.p[0];
+	struct cache *cache = cconf->c.cache;
+	struct htx *req_htx = htxbuf(&s->req.buf);
+	struct channel *res = &s->res;
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *body = NULL;
+	struct htx *htx;
+	struct htx_sl *sl;
+	struct ist path;
+	unsigned int count = 0;
+	int tags = 0;
+
+	body = alloc_trash_chunk();
+	if (!body)
+		goto fail;
+
+	while (http_find_header(req_htx, ist("Surrogate-Key"), &ctx, 1)) {
+		const char *p = ctx.value.ptr, *end = p + ctx.value.len;
+
+		while (p < end) {
+			const char *tag;
+
+			while (p < end && HTTP_IS_LWS(*p))
+				p++;
+			tag = p;
+			while (p < end && !HTTP_IS_LWS(*p))
+				p++;
+			if (p == tag)
+				continue;
+			chunk_reset(body);
+			if (!chunk_memcat(body, tag, p - tag) || !chunk_memcat(body, "", 1))
+				continue;
+			count += cache_purge(cache, CACHE_PURGE_TAG, b_orig(body));
+			tags++;
+		}
+	}
+
+	if (!tags) {
+		path = http_get_path(htx_sl_req_uri(http_get_stline(req_htx)));
+		chunk_reset(body);
+		if (path.len && chunk_memcat(body, path.ptr, path.len) && chunk_memcat(body, "", 1)) {
+			if (path.ptr[path.len - 1] == '*') {
+				b_orig(body)[path.len - 1] = 0;
+				count = cache_purge(cache, CACHE_PURGE_PREFIX, b_orig(body));
+			}
+			else
+				count = cache_purge(cache, CACHE_PURGE_PATH, b_orig(body));
+		}
+	}
+
+	chunk_printf(body, "%u objects purged.\n", count);
+
+	htx = htx_from_buf(&res->buf);
+	channel_htx_truncate(res, htx);
+	sl = htx_add_stline(htx, HTX_BLK_RES_SL, HTX_SL_F_IS_RESP|HTX_SL_F_VER_11|HTX_SL_F_XFER_LEN|HTX_SL_F_CLEN,
+			    ist("HTTP/1.1"), ist("200"), ist("OK"));
+	if (!sl)
+		goto fail;
+	sl->info.res.status = 200;
+	s->txn->status = 200;
+
+	if (!htx_add_header(htx, ist("content-length"), ist(ultoa(b_data(body)))) ||
+	    !htx_add_header(htx, ist("content-type"), ist("text/plain")) ||
+	    !htx_add_header(htx, ist("cache-control"), ist("no-cache")) ||
+	    !htx_add_endof(htx, HTX_BLK_EOH) ||
+	    !htx_add_data_atonce(htx, ist2(b_orig(body), b_data(body))) ||
+	    !htx_add_endof(htx, HTX_BLK_EOM))
+		goto fail;
+
+	htx_to_buf(htx, &res->buf);
+	if (!http_forward_proxy_resp(s, 1))
+		goto fail;
+
+	free_trash_chunk(body);
+
+	/* let's log the request time */
+	s->logs.tv_request = now;
+	s->req.analysers &= AN_REQ_FLT_END;
+	if (s->sess->fe == s->be) /* report it if the request was intercepted by the frontend */
+		_HA_ATOMIC_ADD(&s->sess->fe->fe_counters.intercepted_req, 1);
+
+	if (!(s->flags & SF_ERR_MASK))
+		s->flags |= SF_ERR_LOCAL;
+	if (!(s->flags & SF_FINST_MASK))
+		s->flags |= SF_FINST_R;
+	return ACT_RET_ABRT;
+
+  fail:
+	channel_htx_truncate(res, htxbuf(&res->buf));
+	free_trash_chunk(body);
+	if (!(s->flags & SF_ERR_MASK))
+		s->flags |= SF_ERR_RESOURCE;
+	return ACT_RET_ERR;
+}
+
+enum act_parse_ret parse_cache_purge(const char **args, int *orig_arg, struct proxy *proxy,
+                                     struct act_rule *rule, char **err)
+{
+	rule->action       = ACT_CUSTOM;
+	rule->action_ptr   = http_action_req_cache_purge;
+	rule->flags       |= ACT_FLAG_FINAL;
+
+	if (!parse_cache_rule(proxy, args[*orig_arg], rule, err))
+		return ACT_RET_PRS_ERR;
+
+	(*orig_arg)++;
+	return ACT_RET_PRS_OK;
+}
+
 int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 {
 	int err_code = 0;
@@ -1210,6 +2155,14 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			tmp_cache_config->maxage = 60;
 			tmp_cache_config->maxblocks = 0;
 			tmp_cache_config->maxobjsz = 0;
+			tmp_cache_config->nb_shards = 1;
+			tmp_cache_config->vary_hdrs[0] = ist("accept-encoding");
+			tmp_cache_config->nb_vary_hdrs = 1;
+			tmp_cache_config->pending = EB_ROOT;
+			HA_SPIN_INIT(&tmp_cache_config->pending_lock);
+			tmp_cache_config->hints = EB_ROOT;
+			LIST_INIT(&tmp_cache_config->hints_lru);
+			HA_SPIN_INIT(&tmp_cache_config->hints_lock);
 		}
 	} else if (strcmp(args[0], "total-max-size") == 0) {
 		unsigned long int maxsize;
@@ -1251,6 +2204,23 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 		}
 
 		tmp_cache_config->maxage = atoi(args[1]);
+	} else if (strcmp(args[0], "max-stale") == 0) {
+		unsigned long int maxstale;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		maxstale = strtoul(args[1], &err, 10);
+		if (!*args[1] || *err != '\0' || maxstale > INT_MAX) {
+			ha_alert("parsing [%s:%d]: '%s' expects a duration in seconds.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->maxstale = maxstale;
 	} else if (strcmp(args[0], "max-object-size") == 0) {
 		unsigned int maxobjsz;
 		char *err;
@@ -1274,6 +2244,167 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 		tmp_cache_config->maxobjsz = maxobjsz;
+	} else if (strcmp(args[0], "shards") == 0) {
+		unsigned int shards;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		shards = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !shards || shards > CACHE_MAX_SHARDS) {
+			ha_alert("parsing [%s:%d]: '%s' expects a number of shards between 1 and %d.\n",
+			         file, linenum, args[0], CACHE_MAX_SHARDS);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->nb_shards = shards;
+	} else if (strcmp(args[0], "collapse-misses") == 0) {
+		const char *res;
+		unsigned int timeout;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a timeout.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &timeout, TIME_UNIT_MS);
+		if (res == PARSE_TIME_OVER || res == PARSE_TIME_UNDER) {
+			ha_alert("parsing [%s:%d]: timer overflow or underflow in argument <%s> to '%s'.\n",
+			         file, linenum, args[1], args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		else if (res) {
+			ha_alert("parsing [%s:%d]: unexpected character '%c' in argument to '%s'.\n",
+			         file, linenum, *res, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->collapse_timeout = timeout;
+	} else if (strcmp(args[0], "compression-level") == 0) {
+		unsigned long int level;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		level = strtoul(args[1], &err, 10);
+		if (!*args[1] || *err != '\0' || level < 1 || level > 9) {
+			ha_alert("parsing [%s:%d]: '%s' expects a compression level between 1 and 9.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->comp_level = level;
+	} else if (strcmp(args[0], "early-hints") == 0) {
+		unsigned long int entries;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		entries = strtoul(args[1], &err, 10);
+		if (!*args[1] || *err != '\0' || entries > INT_MAX) {
+			ha_alert("parsing [%s:%d]: '%s' expects a number of URLs.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->hints_max = entries;
+	} else if (strcmp(args[0], "process-vary") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->vary_processing = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->vary_processing = 0;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"on\" or \"off\".\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "vary-headers") == 0) {
+		int cur_arg;
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects at least one header name.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		for (cur_arg = 1; *args[cur_arg]; cur_arg++) {
+			char *name;
+
+			if (strcasecmp(args[cur_arg], "accept-encoding") == 0)
+				continue;
+
+			if (tmp_cache_config->nb_vary_hdrs >= CACHE_VARY_MAX) {
+				ha_alert("parsing [%s:%d]: '%s' : no more than %d headers are supported, including accept-encoding.\n",
+				         file, linenum, args[0], CACHE_VARY_MAX);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				goto out;
+			}
+
+			name = strdup(args[cur_arg]);
+			if (!name) {
+				ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				goto out;
+			}
+			tmp_cache_config->vary_hdrs[tmp_cache_config->nb_vary_hdrs++] = ist(name);
+		}
+	} else if (strcmp(args[0], "large-objects") == 0) {
+		unsigned long int maxsize;
+		char *err;
+
+		if (alertif_too_many_args(2, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1] || !*args[2]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a file name and a size in megabytes.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		maxsize = strtoul(args[2], &err, 10);
+		if (err == args[2] || *err != '\0' || !maxsize ||
+		    maxsize > INT_MAX / (1024 * 1024 / CACHE_LARGE_BLOCKSIZE)) {
+			ha_alert("parsing [%s:%d]: '%s' expects a size between 1 and %d megabytes.\n",
+			         file, linenum, args[0], INT_MAX / (1024 * 1024 / CACHE_LARGE_BLOCKSIZE));
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		free(tmp_cache_config->large_file);
+		tmp_cache_config->large_file = strdup(args[1]);
+		if (!tmp_cache_config->large_file) {
+			ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->large_blocks = maxsize * (1024 * 1024 / CACHE_LARGE_BLOCKSIZE);
 	}
 	else if (*args[0] != 0) {
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in 'cache' section\n", file, linenum, args[0]);
@@ -1288,6 +2419,7 @@ out:
 
 int cfg_post_parse_section_cache()
 {
+	unsigned int shard_blocks;
 	int err_code = 0;
 
 	if (tmp_cache_config) {
@@ -1298,17 +2430,32 @@ int cfg_post_parse_section_cache()
 			goto out;
 		}
 
+		/* each shard gets its part of the blocks */
+		shard_blocks = tmp_cache_config->maxblocks / tmp_cache_config->nb_shards;
+
 		if (!tmp_cache_config->maxobjsz) {
 			/* Default max. file size is a 256th of the cache size. */
 			tmp_cache_config->maxobjsz =
 				(tmp_cache_config->maxblocks * CACHE_BLOCKSIZE) >> 8;
+			if (tmp_cache_config->maxobjsz > shard_blocks * CACHE_BLOCKSIZE / 2)
+				tmp_cache_config->maxobjsz = shard_blocks * CACHE_BLOCKSIZE / 2;
 		}
-		else if (tmp_cache_config->maxobjsz > tmp_cache_config->maxblocks * CACHE_BLOCKSIZE / 2) {
-			ha_alert("\"max-object-size\" is limited to an half of \"total-max-size\" => %u\n", tmp_cache_config->maxblocks * CACHE_BLOCKSIZE / 2);
+		else if (tmp_cache_config->maxobjsz > shard_blocks * CACHE_BLOCKSIZE / 2) {
+			ha_alert("\"max-object-size\" is limited to an half of \"total-max-size\" divided by \"shards\" => %u\n", shard_blocks * CACHE_BLOCKSIZE / 2);
 			err_code |= ERR_FATAL | ERR_ALERT;
 			goto out;
 		}
 
+		/* the large objects tier accepts the objects up to an half of
+		 * its size.
+		 */
+		if (tmp_cache_config->large_file) {
+			unsigned long long large_max;
+
+			large_max = (unsigned long long)tmp_cache_config->large_blocks * CACHE_LARGE_BLOCKSIZE / 2;
+			tmp_cache_config->large_maxobjsz = MIN(large_max, UINT_MAX);
+		}
+
 		/* add to the list of cache to init and reinit tmp_cache_config
 		 * for next cache section, if any.
 		 */
@@ -1317,6 +2464,13 @@ int cfg_post_parse_section_cache()
 		return err_code;
 	}
 out:
+	if (tmp_cache_config) {
+		int i;
+
+		free(tmp_cache_config->large_file);
+		for (i = 1; i < tmp_cache_config->nb_vary_hdrs; i++)
+			free(tmp_cache_config->vary_hdrs[i].ptr);
+	}
 	free(tmp_cache_config);
 	tmp_cache_config = NULL;
 	return err_code;
@@ -1326,35 +2480,71 @@ out:
 int post_check_cache()
 {
 	struct proxy *px;
-	struct cache *back, *cache_config, *cache;
+	struct cache *back, *cache;
+	struct cache_shard *shard;
 	struct shared_context *shctx;
+	unsigned int i;
 	int ret_shctx;
 	int err_code = 0;
 
-	list_for_each_entry_safe(cache_config, back, &caches_config, list) {
-
-		ret_shctx = shctx_init(&shctx, cache_config->maxblocks, CACHE_BLOCKSIZE,
-		                       cache_config->maxobjsz, sizeof(struct cache), 1);
-
-		if (ret_shctx <= 0) {
-			if (ret_shctx == SHCTX_E_INIT_LOCK)
-				ha_alert("Unable to initialize the lock for the cache.\n");
-			else
-				ha_alert("Unable to allocate cache.\n");
+	list_for_each_entry_safe(cache, back, &caches_config, list) {
 
+		cache->shards = calloc(cache->nb_shards, sizeof(*cache->shards));
+		if (!cache->shards) {
+			ha_alert("Unable to allocate cache.\n");
 			err_code |= ERR_FATAL | ERR_ALERT;
 			goto out;
 		}
-		shctx->free_block = cache_free_blocks;
-		/* the cache structure is stored in the shctx and added to the
-		 * caches list, we can remove the entry from the caches_config
-		 * list */
-		memcpy(shctx->data, cache_config, sizeof(struct cache));
-		cache = (struct cache *)shctx->data;
-		cache->entries = EB_ROOT_UNIQUE;
+
+		for (i = 0; i < cache->nb_shards; i++) {
+			ret_shctx = shctx_init(&shctx, cache->maxblocks / cache->nb_shards, CACHE_BLOCKSIZE,
+			                       cache->maxobjsz, sizeof(struct cache_shard), 1);
+
+			if (ret_shctx <= 0) {
+				if (ret_shctx == SHCTX_E_INIT_LOCK)
+					ha_alert("Unable to initialize the lock for the cache.\n");
+				else
+					ha_alert("Unable to allocate cache.\n");
+
+				err_code |= ERR_FATAL | ERR_ALERT;
+				goto out;
+			}
+			shctx->free_block = cache_free_blocks;
+			/* the shard's tree is stored in the shctx so that it is
+			 * shared between processes like the objects.
+			 */
+			shard = (struct cache_shard *)shctx->data;
+			shard->entries = EB_ROOT;
+			shard->paths = EB_ROOT;
+			shard->tags = EB_ROOT;
+			cache->shards[i] = shard;
+		}
+
+		if (cache->large_file) {
+			ret_shctx = shctx_init_file(&shctx, cache->large_file, cache->large_blocks,
+			                            CACHE_LARGE_BLOCKSIZE, cache->large_maxobjsz,
+			                            sizeof(struct cache_shard));
+			if (ret_shctx <= 0) {
+				if (ret_shctx == SHCTX_E_INIT_LOCK)
+					ha_alert("Unable to initialize the lock for the cache.\n");
+				else
+					ha_alert("Unable to create the large objects file '%s' of cache '%s'.\n",
+					         cache->large_file, cache->id);
+				err_code |= ERR_FATAL | ERR_ALERT;
+				goto out;
+			}
+			shctx->free_block = cache_free_blocks;
+			cache->large = (struct cache_shard *)shctx->data;
+			cache->large->entries = EB_ROOT;
+			cache->large->paths = EB_ROOT;
+			cache->large->tags = EB_ROOT;
+		}
+
+		/* the cache is ready, it moves from the caches_config list
+		 * to the caches list.
+		 */
+		LIST_DEL(&cache->list);
 		LIST_ADDQ(&caches, &cache->list);
-		LIST_DEL(&cache_config->list);
-		free(cache_config);
 
 		/* Find all references for this cache in the existing filters
 		 * (over all proxies) and reference it in matching filters.
@@ -1391,9 +2581,6 @@ struct flt_ops cache_ops = {
 	.attach = cache_store_strm_init,
 	.detach = cache_store_strm_deinit,
 
-	/* Handle channels activity */
-	.channel_post_analyze = cache_store_post_analyze,
-
 	/* Filter HTTP requests and responses */
 	.http_headers        = cache_store_http_headers,
 	.http_payload        = cache_store_http_payload,
@@ -1473,6 +2660,39 @@ parse_cache_flt(char **args, int *cur_arg, struct proxy *px,
 	return -1;
 }
 
+/* Parses "purge cache <name> { path | prefix | tag } <value>" */
+static int cli_parse_purge_cache(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	struct cache *cache;
+	char *msg = NULL;
+	int type;
+
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	if (!*args[2] || !*args[3] || !*args[4])
+		return cli_err(appctx, "Usage: purge cache <name> { path | prefix | tag } <value>.\n");
+
+	list_for_each_entry(cache, &caches, list) {
+		if (strcmp(cache->id, args[2]) == 0)
+			break;
+	}
+	if (&cache->list == &caches)
+		return cli_err(appctx, "No such cache.\n");
+
+	if (strcmp(args[3], "path") == 0)
+		type = CACHE_PURGE_PATH;
+	else if (strcmp(args[3], "prefix") == 0)
+		type = CACHE_PURGE_PREFIX;
+	else if (strcmp(args[3], "tag") == 0)
+		type = CACHE_PURGE_TAG;
+	else
+		return cli_err(appctx, "Expects 'path', 'prefix' or 'tag'.\n");
+
+	return cli_dynmsg(appctx, LOG_INFO, memprintf(&msg, "%u objects purged.\n",
+	                                              cache_purge(cache, type, args[4])));
+}
+
 static int cli_parse_show_cache(char **args, char *payload, struct appctx *appctx, void *private)
 {
 	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
@@ -1494,10 +2714,17 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 		struct eb32_node *node = NULL;
 		unsigned int next_key;
 		struct cache_entry *entry;
+		struct cache_shard *shard;
 
 		next_key = appctx->ctx.cli.i0;
-		if (!next_key) {
-			chunk_printf(&trash, "%p: %s (shctx:%p, available blocks:%d)\n", cache, cache->id, shctx_ptr(cache), shctx_ptr(cache)->nbav);
+		if (!next_key && !appctx->ctx.cli.i1) {
+			unsigned int i, nbav = 0;
+
+			for (i = 0; i < cache->nb_shards; i++)
+				nbav += shctx_ptr(cache->shards[i])->nbav;
+			chunk_printf(&trash, "%p: %s (shctx:%p, available blocks:%d, shards:%u)\n", cache, cache->id, shctx_ptr(cache->shards[0]), nbav, cache->nb_shards);
+			if (cache->large)
+				chunk_appendf(&trash, "%p: %s large objects in %s (shctx:%p, available blocks:%d)\n", cache, cache->id, cache->large_file, shctx_ptr(cache->large), shctx_ptr(cache->large)->nbav);
 			if (ci_putchk(si_ic(si), &trash) == -1) {
 				si_rx_room_blk(si);
 				return 0;
@@ -1506,29 +2733,41 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 
 		appctx->ctx.cli.p0 = cache;
 
-		while (1) {
+		while (appctx->ctx.cli.i1 < cache->nb_shards + !!cache->large) {
+			/* the large objects tier comes after the shards */
+			if (appctx->ctx.cli.i1 < cache->nb_shards)
+				shard = cache->shards[appctx->ctx.cli.i1];
+			else
+				shard = cache->large;
 
-			shctx_lock(shctx_ptr(cache));
-			node = eb32_lookup_ge(&cache->entries, next_key);
+			shctx_lock(shctx_ptr(shard));
+			node = eb32_lookup_ge(&shard->entries, next_key);
 			if (!node) {
-				shctx_unlock(shctx_ptr(cache));
-				appctx->ctx.cli.i0 = 0;
-				break;
+				shctx_unlock(shctx_ptr(shard));
+				/* continue with the next shard */
+				next_key = appctx->ctx.cli.i0 = 0;
+				appctx->ctx.cli.i1++;
+				continue;
 			}
 
-			entry = container_of(node, struct cache_entry, eb);
-			chunk_printf(&trash, "%p hash:%u size:%u (%u blocks), refcount:%u, expire:%d\n", entry, read_u32(entry->hash), block_ptr(entry)->len, block_ptr(entry)->block_count, block_ptr(entry)->refcount, entry->expire - (int)now.tv_sec);
-
+			/* all the variants sharing a key are dumped at once */
+			chunk_reset(&trash);
 			next_key = node->key + 1;
+			for (; node; node = eb32_next_dup(node)) {
+				entry = container_of(node, struct cache_entry, eb);
+				chunk_appendf(&trash, "%p hash:%u size:%u (%u blocks), refcount:%u, expire:%d\n", entry, read_u32(entry->hash), block_ptr(entry)->len, block_ptr(entry)->block_count, block_ptr(entry)->refcount, entry->expire - (int)now.tv_sec);
+			}
+
 			appctx->ctx.cli.i0 = next_key;
 
-			shctx_unlock(shctx_ptr(cache));
+			shctx_unlock(shctx_ptr(shard));
 
 			if (ci_putchk(si_ic(si), &trash) == -1) {
 				si_rx_room_blk(si);
 				return 0;
 			}
 		}
+		appctx->ctx.cli.i1 = 0;
 
 	}
 
@@ -1546,6 +2785,7 @@ static struct flt_kw_list filter_kws = { "CACHE", { }, {
 INITCALL1(STG_REGISTER, flt_register_keywords, &filter_kws);
 
 static struct cli_kw_list cli_kws = {{},{
+	{ { "purge", "cache", NULL }, "purge cache    : remove objects from a cache by path, prefix or tag", cli_parse_purge_cache, NULL, NULL, NULL },
 	{ { "show", "cache", NULL }, "show cache     : show cache status", cli_parse_show_cache, cli_io_handler_show_cache, NULL, NULL },
 	{{},}
 }};
@@ -1563,6 +2803,8 @@ INITCALL1(STG_REGISTER, http_res_keywords_register, &http_res_actions);
 
 static struct action_kw_list http_req_actions = {
 	.kw = {
+		{ "cache-early-hints", parse_cache_hints },
+		{ "cache-purge", parse_cache_purge },
 		{ "cache-use", parse_cache_use },
 		{ NULL, NULL }
 	}
@@ -66,6 +66,11 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		global.tune.options &= ~GTUNE_USE_EPOLL;
 	}
+	else if (!strcmp(args[0], "nouring")) {
+		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+			goto out;
+		global.tune.options &= ~GTUNE_USE_URING;
+	}
 	else if (!strcmp(args[0], "nokqueue")) {
 		if (alertif_too_many_args(0, file, linenum, args, &err_code))
 			goto out;
@@ -81,13 +86,37 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		global.tune.options &= ~GTUNE_USE_POLL;
 	}
-	else if (!strcmp(args[0], "busy-polling")) { /* "no busy-polling" or "busy-polling" */
-		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+	else if (!strcmp(args[0], "busy-polling")) { /* "no busy-polling" or "busy-polling [<time>]" */
+		if (alertif_too_many_args(kwm == KWM_NO ? 0 : 1, file, linenum, args, &err_code))
 			goto out;
-		if (kwm == KWM_NO)
+		if (kwm == KWM_NO) {
 			global.tune.options &= ~GTUNE_BUSY_POLLING;
-		else
-			global.tune.options |=  GTUNE_BUSY_POLLING;
+			goto out;
+		}
+		global.tune.options |=  GTUNE_BUSY_POLLING;
+		global.tune.busy_poll_max = 0;
+		if (*args[1]) {
+			const char *res = parse_time_err(args[1], &global.tune.busy_poll_max, TIME_UNIT_US);
+
+			if (res == PARSE_TIME_OVER) {
+				ha_alert("parsing [%s:%d]: timer overflow in argument <%s> to <%s>, maximum value is 4294967295 us (~71 minutes).\n",
+					 file, linenum, args[1], args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (res == PARSE_TIME_UNDER) {
+				ha_alert("parsing [%s:%d]: timer underflow in argument <%s> to <%s>, minimum non-null value is 1 us.\n",
+					 file, linenum, args[1], args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (res) {
+				ha_alert("parsing [%s:%d]: unexpected character '%c' in argument to <%s>.\n",
+					 file, linenum, *res, args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+		}
 	}
 	else if (!strcmp(args[0], "set-dumpable")) { /* "no set-dumpable" or "set-dumpable" */
 		if (alertif_too_many_args(0, file, linenum, args, &err_code))
@@ -259,6 +288,23 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 	}
+	else if (!strcmp(args[0], "tune.bufsize.small")) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code))
+			goto out;
+		if (*(args[1]) == 0) {
+			ha_alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.bufsize_small = atol(args[1]);
+		/* round it up to support a two-pointer alignment at the end */
+		global.tune.bufsize_small = (global.tune.bufsize_small + 2 * sizeof(void *) - 1) & -(2 * sizeof(void *));
+		if (global.tune.bufsize_small && global.tune.bufsize_small < 1024) {
+			ha_alert("parsing [%s:%d] : '%s' expects 0 or a value of at least 1024.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
 	else if (!strcmp(args[0], "tune.maxrewrite")) {
 		if (alertif_too_many_args(1, file, linenum, args, &err_code))
 			goto out;
@@ -994,6 +1040,11 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		}
 		global.max_spread_checks = val;
 	}
+	else if (!strcmp(args[0], "share-checks")) {  /* one check per address and ruleset */
+		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+			goto out;
+		global.tune.options |= GTUNE_SHARE_CHECKS;
+	}
 	else if (strcmp(args[0], "cpu-map") == 0) {
 		/* map a process list to a CPU set */
 #ifdef USE_CPU_AFFINITY
@@ -1205,30 +1256,24 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			global.tune.options |= GTUNE_STRICT_LIMITS;
 	}
 	else {
-		struct cfg_kw_list *kwl;
-		int index;
+		struct cfg_keyword *kw;
 		int rc;
 
-		list_for_each_entry(kwl, &cfg_keywords.list, list) {
-			for (index = 0; kwl->kw[index].kw != NULL; index++) {
-				if (kwl->kw[index].section != CFG_GLOBAL)
-					continue;
-				if (strcmp(kwl->kw[index].kw, args[0]) == 0) {
-					rc = kwl->kw[index].parse(args, CFG_GLOBAL, NULL, NULL, file, linenum, &errmsg);
-					if (rc < 0) {
-						ha_alert("parsing [%s:%d] : %s\n", file, linenum, errmsg);
-						err_code |= ERR_ALERT | ERR_FATAL;
-					}
-					else if (rc > 0) {
-						ha_warning("parsing [%s:%d] : %s\n", file, linenum, errmsg);
-						err_code |= ERR_WARN;
-						goto out;
-					}
-					goto out;
-				}
+		kw = cfg_find_keyword(CFG_GLOBAL, args[0]);
+		if (kw) {
+			rc = kw->parse(args, CFG_GLOBAL, NULL, NULL, file, linenum, &errmsg);
+			if (rc < 0) {
+				ha_alert("parsing [%s:%d] : %s\n", file, linenum, errmsg);
+				err_code |= ERR_ALERT | ERR_FATAL;
+			}
+			else if (rc > 0) {
+				ha_warning("parsing [%s:%d] : %s\n", file, linenum, errmsg);
+				err_code |= ERR_WARN;
+				goto out;
 			}
+			goto out;
 		}
-		
+
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in '%s' section\n", file, linenum, args[0], "global");
 		err_code |= ERR_ALERT | ERR_FATAL;
 	}
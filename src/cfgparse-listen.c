@@ -271,6 +271,7 @@ int cfg_parse_listen(const char *file, int linenum, char **args, int kwm)
 			curproxy->maxconn = defproxy.maxconn;
 			curproxy->backlog = defproxy.backlog;
 			curproxy->fe_sps_lim = defproxy.fe_sps_lim;
+			curproxy->log_sample = defproxy.log_sample;
 
 			curproxy->to_log = defproxy.to_log & ~LW_COOKIE & ~LW_REQHDR & ~ LW_RSPHDR;
 			curproxy->max_out_conns = defproxy.max_out_conns;
@@ -3136,29 +3137,23 @@ stats_error_parsing:
 		goto out;
 	}
 	else {
-		struct cfg_kw_list *kwl;
-		int index;
-
-		list_for_each_entry(kwl, &cfg_keywords.list, list) {
-			for (index = 0; kwl->kw[index].kw != NULL; index++) {
-				if (kwl->kw[index].section != CFG_LISTEN)
-					continue;
-				if (strcmp(kwl->kw[index].kw, args[0]) == 0) {
-					/* prepare error message just in case */
-					rc = kwl->kw[index].parse(args, CFG_LISTEN, curproxy, &defproxy, file, linenum, &errmsg);
-					if (rc < 0) {
-						ha_alert("parsing [%s:%d] : %s\n", file, linenum, errmsg);
-						err_code |= ERR_ALERT | ERR_FATAL;
-						goto out;
-					}
-					else if (rc > 0) {
-						ha_warning("parsing [%s:%d] : %s\n", file, linenum, errmsg);
-						err_code |= ERR_WARN;
-						goto out;
-					}
-					goto out;
-				}
+		struct cfg_keyword *kw;
+
+		kw = cfg_find_keyword(CFG_LISTEN, args[0]);
+		if (kw) {
+			/* prepare error message just in case */
+			rc = kw->parse(args, CFG_LISTEN, curproxy, &defproxy, file, linenum, &errmsg);
+			if (rc < 0) {
+				ha_alert("parsing [%s:%d] : %s\n", file, linenum, errmsg);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
 			}
+			else if (rc > 0) {
+				ha_warning("parsing [%s:%d] : %s\n", file, linenum, errmsg);
+				err_code |= ERR_WARN;
+				goto out;
+			}
+			goto out;
 		}
 
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in '%s' section\n", file, linenum, args[0], cursection);
@@ -268,6 +268,8 @@ static int ssl_parse_global_int(char **args, int section_type, struct proxy *cur
 
 	if (strcmp(args[0], "tune.ssl.cachesize") == 0)
 		target = &global.tune.sslcachesize;
+	else if (strcmp(args[0], "tune.ssl.cache-shards") == 0)
+		target = &global_ssl.cache_shards;
 	else if (strcmp(args[0], "tune.ssl.maxrecord") == 0)
 		target = (int *)&global_ssl.max_record;
 	else if (strcmp(args[0], "tune.ssl.ssl-ctx-cache-size") == 0)
@@ -276,6 +278,14 @@ static int ssl_parse_global_int(char **args, int section_type, struct proxy *cur
 		target = &global.maxsslconn;
 	else if (strcmp(args[0], "tune.ssl.capture-cipherlist-size") == 0)
 		target = &global_ssl.capture_cipherlist;
+	else if (strcmp(args[0], "tune.ssl.lazy-load") == 0)
+		target = &global_ssl.lazy_load;
+	else if (strcmp(args[0], "tune.ssl.load-threads") == 0)
+		target = &global_ssl.load_threads;
+	else if (strcmp(args[0], "tune.ssl.ocsp-update.min-delay") == 0)
+		target = &global_ssl.ocsp_update_min;
+	else if (strcmp(args[0], "tune.ssl.ocsp-update.max-delay") == 0)
+		target = &global_ssl.ocsp_update_max;
 	else {
 		memprintf(err, "'%s' keyword not unhandled (please report this bug).", args[0]);
 		return -1;
@@ -840,6 +850,18 @@ static int bind_parse_no_tls_tickets(char **args, int cur_arg, struct proxy *px,
 	return 0;
 }
 
+/* parse the "ktls" bind keyword */
+static int bind_parse_ktls(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+#ifdef HAVE_SSL_KTLS
+	conf->ssl_options |= BC_SSL_O_KTLS;
+	return 0;
+#else
+	memprintf(err, "'%s' : library does not support kernel TLS offload (OpenSSL >= 3.0 on Linux required).", args[cur_arg]);
+	return ERR_ALERT | ERR_FATAL;
+#endif
+}
+
 /* parse the "allow-0rtt" bind keyword */
 static int ssl_bind_parse_allow_0rtt(char **args, int cur_arg, struct proxy *px, struct ssl_bind_conf *conf, char **err)
 {
@@ -1458,6 +1480,18 @@ static int srv_parse_no_ssl_reuse(char **args, int *cur_arg, struct proxy *px, s
 	return 0;
 }
 
+/* parse the "ktls" server keyword */
+static int srv_parse_ktls(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
+{
+#ifdef HAVE_SSL_KTLS
+	newsrv->ssl_ctx.options |= SRV_SSL_O_KTLS;
+	return 0;
+#else
+	memprintf(err, "'%s' : library does not support kernel TLS offload (OpenSSL >= 3.0 on Linux required).", args[*cur_arg]);
+	return ERR_ALERT | ERR_FATAL;
+#endif
+}
+
 /* parse the "no-tls-tickets" server keyword */
 static int srv_parse_no_tls_tickets(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
 {
@@ -1673,6 +1707,23 @@ static int ssl_parse_skip_self_issued_ca(char **args, int section_type, struct p
 	return 0;
 }
 
+/* parse the "ssl-ocsp-update" keyword in global section. */
+static int ssl_parse_global_ocsp_update(char **args, int section_type, struct proxy *curpx,
+                                        struct proxy *defpx, const char *file, int line,
+                                        char **err)
+{
+#if ((defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP) && !defined OPENSSL_IS_BORINGSSL)
+	if (too_many_args(0, args, err, NULL))
+		return -1;
+
+	global_ssl.ocsp_update = 1;
+	return 0;
+#else
+	memprintf(err, "'%s' is not supported by your SSL library.", args[0]);
+	return -1;
+#endif
+}
+
 
 
 
@@ -1733,6 +1784,7 @@ static struct bind_kw_list bind_kws = { "SSL", { }, {
 	{ "force-tlsv12",          bind_parse_tls_method_options, 0 }, /* force TLSv12 */
 	{ "force-tlsv13",          bind_parse_tls_method_options, 0 }, /* force TLSv13 */
 	{ "generate-certificates", bind_parse_generate_certs,     0 }, /* enable the server certificates generation */
+	{ "ktls",                  bind_parse_ktls,               0 }, /* let the kernel encrypt the records */
 	{ "no-ca-names",           bind_parse_no_ca_names,        0 }, /* do not send ca names to clients (ca_file related) */
 	{ "no-sslv3",              bind_parse_tls_method_options, 0 }, /* disable SSLv3 */
 	{ "no-tlsv10",             bind_parse_tls_method_options, 0 }, /* disable TLSv10 */
@@ -1778,6 +1830,7 @@ static struct srv_kw_list srv_kws = { "SSL", { }, {
 	{ "force-tlsv11",            srv_parse_tls_method_options, 0, 1 }, /* force TLSv11 */
 	{ "force-tlsv12",            srv_parse_tls_method_options, 0, 1 }, /* force TLSv12 */
 	{ "force-tlsv13",            srv_parse_tls_method_options, 0, 1 }, /* force TLSv13 */
+	{ "ktls",                    srv_parse_ktls,               0, 1 }, /* let the kernel encrypt the records */
 	{ "no-check-ssl",            srv_parse_no_check_ssl,       0, 1 }, /* disable SSL for health checks */
 	{ "no-send-proxy-v2-ssl",    srv_parse_no_send_proxy_ssl,  0, 1 }, /* do not send PROXY protocol header v2 with SSL info */
 	{ "no-send-proxy-v2-ssl-cn", srv_parse_no_send_proxy_cn,   0, 1 }, /* do not send PROXY protocol header v2 with CN */
@@ -1819,14 +1872,20 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 #ifndef OPENSSL_NO_ENGINE
 	{ CFG_GLOBAL, "ssl-engine",  ssl_parse_global_ssl_engine },
 #endif
+	{ CFG_GLOBAL, "ssl-ocsp-update", ssl_parse_global_ocsp_update },
 	{ CFG_GLOBAL, "ssl-skip-self-issued-ca", ssl_parse_skip_self_issued_ca },
 	{ CFG_GLOBAL, "tune.ssl.cachesize", ssl_parse_global_int },
+	{ CFG_GLOBAL, "tune.ssl.cache-shards", ssl_parse_global_int },
 #ifndef OPENSSL_NO_DH
 	{ CFG_GLOBAL, "tune.ssl.default-dh-param", ssl_parse_global_default_dh },
 #endif
 	{ CFG_GLOBAL, "tune.ssl.force-private-cache",  ssl_parse_global_private_cache },
+	{ CFG_GLOBAL, "tune.ssl.lazy-load", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.lifetime", ssl_parse_global_lifetime },
+	{ CFG_GLOBAL, "tune.ssl.load-threads", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.maxrecord", ssl_parse_global_int },
+	{ CFG_GLOBAL, "tune.ssl.ocsp-update.max-delay", ssl_parse_global_int },
+	{ CFG_GLOBAL, "tune.ssl.ocsp-update.min-delay", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.ssl-ctx-cache-size", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.capture-cipherlist-size", ssl_parse_global_capture_cipherlist },
 	{ CFG_GLOBAL, "ssl-default-bind-ciphers", ssl_parse_global_ciphers },
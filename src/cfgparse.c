@@ -105,6 +105,18 @@ struct cfg_kw_list cfg_keywords = {
 	.list = LIST_HEAD_INIT(cfg_keywords.list)
 };
 
+/* Index of the keywords of cfg_keywords by name, built on the first lookup
+ * and released when the list changes, so that each configuration line does
+ * not have to scan all the registered keywords.
+ */
+struct cfg_kw_idx {
+	struct ebpt_node node;          /* key is the keyword's name */
+	struct cfg_keyword *kw;
+};
+
+static struct eb_root cfg_kw_index = EB_ROOT;
+static int cfg_kw_indexed;
+
 /*
  * converts <str> to a list of listeners which are dynamically allocated.
  * The format is "{addr|'*'}:port[-end][,{addr|'*'}:port[-end]]*", where :
@@ -454,6 +466,8 @@ void init_default_instance()
 	defproxy.defsrv.slowstart = 0;
 	defproxy.defsrv.onerror = DEF_HANA_ONERR;
 	defproxy.defsrv.consecutive_errors_limit = DEF_HANA_ERRLIMIT;
+	defproxy.defsrv.eject_time = DEF_EJECT_TIME;
+	defproxy.defsrv.eject_max_pct = DEF_EJECT_MAX_PCT;
 	defproxy.defsrv.uweight = defproxy.defsrv.iweight = 1;
 
 	defproxy.email_alert.level = LOG_ALERT;
@@ -1039,6 +1053,7 @@ int cfg_parse_resolvers(const char *file, int linenum, char **args, int kwm)
 		/* the nameservers are linked backward first */
 		LIST_ADDQ(&curr_resolvers->nameservers, &newnameserver->list);
 		newnameserver->resolvers = curr_resolvers;
+		LIST_INIT(&newnameserver->tcp_queries);
 		newnameserver->conf.file = strdup(file);
 		newnameserver->conf.line = linenum;
 		newnameserver->id = strdup(args[1]);
@@ -1174,6 +1189,7 @@ int cfg_parse_resolvers(const char *file, int linenum, char **args, int kwm)
 			}
 
 			newnameserver->resolvers = curr_resolvers;
+			LIST_INIT(&newnameserver->tcp_queries);
 			newnameserver->conf.line = resolv_linenum;
 			newnameserver->addr = *sk;
 
@@ -1271,6 +1287,11 @@ resolv_out:
 		}
 		curr_resolvers->resolve_retries = atoi(args[1]);
 	}
+	else if (strcmp(args[0], "tcp-fallback") == 0) {
+		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+			goto out;
+		curr_resolvers->tcp_fallback = 1;
+	}
 	else if (strcmp(args[0], "timeout") == 0) {
 		if (!*args[1]) {
 			ha_alert("parsing [%s:%d] : '%s' expects 'retry' or 'resolve' and <time> as arguments.\n",
@@ -3176,24 +3197,35 @@ out_uri_auth_compat:
 		 * in order to avoid combinatory explosion if all servers have the same
 		 * name. We do that only for servers which do not have an explicit ID,
 		 * because these IDs were made also for distinguishing them and we don't
-		 * want to annoy people who correctly manage them.
+		 * want to annoy people who correctly manage them. The servers without
+		 * an ID are indexed by name first so that each one is only compared
+		 * to the previous ones, then those with an ID are added to the index.
 		 */
 		for (newsrv = curproxy->srv; newsrv; newsrv = newsrv->next) {
-			struct server *other_srv;
+			struct ebpt_node *node;
 
 			if (newsrv->puid)
 				continue;
 
-			for (other_srv = curproxy->srv; other_srv && other_srv != newsrv; other_srv = other_srv->next) {
-				if (!other_srv->puid && strcmp(other_srv->id, newsrv->id) == 0) {
-					ha_alert("parsing [%s:%d] : %s '%s', another server named '%s' was already defined at line %d, please use distinct names.\n",
-						   newsrv->conf.file, newsrv->conf.line,
-						   proxy_type_str(curproxy), curproxy->id,
-						   newsrv->id, other_srv->conf.line);
-					cfgerr++;
-					break;
-				}
+			node = ebis_lookup(&curproxy->conf.used_server_name, newsrv->id);
+			if (node) {
+				struct server *other_srv = container_of(node, struct server, conf.name);
+
+				ha_alert("parsing [%s:%d] : %s '%s', another server named '%s' was already defined at line %d, please use distinct names.\n",
+					   newsrv->conf.file, newsrv->conf.line,
+					   proxy_type_str(curproxy), curproxy->id,
+					   newsrv->id, other_srv->conf.line);
+				cfgerr++;
 			}
+			newsrv->conf.name.key = newsrv->id;
+			ebis_insert(&curproxy->conf.used_server_name, &newsrv->conf.name);
+		}
+
+		for (newsrv = curproxy->srv; newsrv; newsrv = newsrv->next) {
+			if (!newsrv->puid)
+				continue;
+			newsrv->conf.name.key = newsrv->id;
+			ebis_insert(&curproxy->conf.used_server_name, &newsrv->conf.name);
 		}
 
 		/* assign automatic UIDs to servers which don't have one yet */
@@ -3207,8 +3239,6 @@ out_uri_auth_compat:
 				next_id = get_next_id(&curproxy->conf.used_server_id, next_id);
 				newsrv->conf.id.key = newsrv->puid = next_id;
 				eb32_insert(&curproxy->conf.used_server_id, &newsrv->conf.id);
-				newsrv->conf.name.key = newsrv->id;
-				ebis_insert(&curproxy->conf.used_server_name, &newsrv->conf.name);
 			}
 			next_id++;
 			newsrv = newsrv->next;
@@ -3235,6 +3265,16 @@ out_uri_auth_compat:
 				newsrv->minconn = newsrv->maxconn;
 			}
 
+			if (newsrv->flags & SRV_F_ADAPTIVE) {
+				if (!newsrv->maxconn) {
+					ha_alert("config : %s '%s', server '%s': 'adaptive-maxconn' requires 'maxconn', which bounds the limit.\n",
+						 proxy_type_str(curproxy), curproxy->id, newsrv->id);
+					cfgerr++;
+				}
+				/* start from the configured limit */
+				newsrv->adapt_limit = newsrv->maxconn;
+			}
+
 			/* this will also properly set the transport layer for prod and checks */
 			if (newsrv->use_ssl == 1 || newsrv->check.use_ssl == 1 || (newsrv->proxy->options & PR_O_TCPCHK_SSL)) {
 				if (is_sa_family_quic(&newsrv->addr)) {
@@ -3359,7 +3399,8 @@ out_uri_auth_compat:
 			if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_STATIC) {
 				curproxy->lbprm.algo |= BE_LB_LKUP_MAP;
 				init_server_map(curproxy);
-			} else if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM) {
+			} else if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM ||
+			           (curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA) {
 				curproxy->lbprm.algo |= BE_LB_LKUP_CHTREE | BE_LB_PROP_DYN;
 				chash_init_server_tree(curproxy);
 			} else {
@@ -3388,7 +3429,7 @@ out_uri_auth_compat:
 			}
 			break;
 		}
-		HA_SPIN_INIT(&curproxy->lbprm.lock);
+		HA_RWLOCK_INIT(&curproxy->lbprm.lock);
 
 		if (curproxy->options & PR_O_LOGASAP)
 			curproxy->to_log &= ~LW_BYTES;
@@ -4129,6 +4170,21 @@ out_uri_auth_compat:
 	return err_code;
 }
 
+/* Releases the index of the registered keywords */
+static void cfg_kw_index_free()
+{
+	struct ebpt_node *node, *next;
+
+	for (node = ebpt_first(&cfg_kw_index); node; node = next) {
+		next = ebpt_next(node);
+		ebpt_delete(node);
+		free(container_of(node, struct cfg_kw_idx, node));
+	}
+	cfg_kw_indexed = 0;
+}
+
+REGISTER_POST_DEINIT(cfg_kw_index_free);
+
 /*
  * Registers the CFG keyword list <kwl> as a list of valid keywords for next
  * parsing sessions.
@@ -4136,6 +4192,7 @@ out_uri_auth_compat:
 void cfg_register_keywords(struct cfg_kw_list *kwl)
 {
 	LIST_ADDQ(&cfg_keywords.list, &kwl->list);
+	cfg_kw_index_free();
 }
 
 /*
@@ -4145,6 +4202,54 @@ void cfg_unregister_keywords(struct cfg_kw_list *kwl)
 {
 	LIST_DEL(&kwl->list);
 	LIST_INIT(&kwl->list);
+	cfg_kw_index_free();
+}
+
+/*
+ * Returns the first registered keyword named <kw> valid in <section>, or NULL
+ * if there is none. The keywords are indexed in the order of their lists so
+ * that the same one as with a linear scan is found.
+ */
+struct cfg_keyword *cfg_find_keyword(int section, const char *kw)
+{
+	struct cfg_kw_list *kwl;
+	struct cfg_kw_idx *idx;
+	struct ebpt_node *node;
+	int index;
+
+	if (!cfg_kw_indexed) {
+		list_for_each_entry(kwl, &cfg_keywords.list, list) {
+			for (index = 0; kwl->kw[index].kw != NULL; index++) {
+				idx = calloc(1, sizeof(*idx));
+				if (!idx)
+					goto scan;
+				idx->kw = &kwl->kw[index];
+				idx->node.key = (void *)kwl->kw[index].kw;
+				ebis_insert(&cfg_kw_index, &idx->node);
+			}
+		}
+		cfg_kw_indexed = 1;
+	}
+
+	for (node = ebis_lookup(&cfg_kw_index, kw); node; node = ebpt_next(node)) {
+		idx = container_of(node, struct cfg_kw_idx, node);
+		if (strcmp(idx->kw->kw, kw) != 0)
+			break;
+		if (idx->kw->section == section)
+			return idx->kw;
+	}
+	return NULL;
+
+ scan:
+	/* out of memory, fall back to the linear scan */
+	cfg_kw_index_free();
+	list_for_each_entry(kwl, &cfg_keywords.list, list) {
+		for (index = 0; kwl->kw[index].kw != NULL; index++) {
+			if (kwl->kw[index].section == section && strcmp(kwl->kw[index].kw, kw) == 0)
+				return &kwl->kw[index];
+		}
+	}
+	return NULL;
 }
 
 /* this function register new section in the haproxy configuration file.
@@ -30,6 +30,8 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
+#include <ebmbtree.h>
+
 #include <common/cfgparse.h>
 #include <common/chunk.h>
 #include <common/compat.h>
@@ -1682,8 +1684,35 @@ static enum tcpcheck_eval_ret tcpcheck_eval_connect(struct check *check, struct
 	struct protocol *proto;
 	struct xprt_ops *xprt;
 	struct tcpcheck_rule *next;
+	struct sess_srv_list *srv_list;
 	int status, port;
 
+	/* The connection kept by the previous check is reused if it is still
+	 * alive ("check-keep-alive"). It is the only one of the session.
+	 */
+	if (check->sess && !LIST_ISEMPTY(&check->sess->srv_list)) {
+		srv_list = LIST_NEXT(&check->sess->srv_list, struct sess_srv_list *, srv_list);
+		conn = LIST_NEXT(&srv_list->conn_list, struct connection *, session_list);
+		if (conn->flags & CO_FL_SESS_IDLE) {
+			conn->flags &= ~CO_FL_SESS_IDLE;
+			check->sess->idle_conns--;
+		}
+
+		cs = conn->mux->attach(conn, check->sess);
+		if (cs) {
+			tasklet_set_tid(check->wait_list.tasklet, tid);
+			check->wait_list.events = 0;
+			check->cs = cs;
+			cs_attach(cs, check, &check_conn_cb);
+			t->expire = tick_add(now_ms, MS_TO_TICKS(check->inter));
+			goto out;
+		}
+
+		/* no stream available anymore, release it and reconnect */
+		conn->mux->destroy(conn->ctx);
+		conn = NULL;
+	}
+
 	/* For a connect action we'll create a new connection. We may also have
 	 * to kill a previous one. But we don't want to leave *without* a
 	 * connection if we came here from the connection layer, hence with a
@@ -2030,7 +2059,7 @@ static enum tcpcheck_eval_ret tcpcheck_eval_send(struct check *check, struct tcp
 			body = send->http.body;
 		clen = ist((!istlen(body) ? "0" : ultoa(istlen(body))));
 
-		if (!htx_add_header(htx, ist("Connection"), ist("close")) ||
+		if (!htx_add_header(htx, ist("Connection"), (check->keep_alive ? ist("keep-alive") : ist("close"))) ||
 		    !htx_add_header(htx, ist("Content-length"), clen))
 			goto error_htx;
 
@@ -2697,8 +2726,11 @@ static int tcpcheck_main(struct check *check)
         else {
 		struct tcpcheck_var *var;
 
-		/* First evaluation, create a session */
-		check->sess = session_new(&checks_fe, NULL, &check->obj_type);
+		/* First evaluation, create a session, unless one was kept with
+		 * its connection by the previous check.
+		 */
+		if (!check->sess)
+			check->sess = session_new(&checks_fe, NULL, &check->obj_type);
 		if (!check->sess) {
 			chunk_printf(&trash, "TCPCHK error allocating check session");
 			set_server_check_status(check, HCHK_STATUS_SOCKERR, trash.area);
@@ -3401,6 +3433,38 @@ static struct task *process_chk_proc(struct task *t, void *context, unsigned sho
 /**************************************************************************/
 /***************** Health-checks based on connections *********************/
 /**************************************************************************/
+/* Returns non-zero if the connection of the check <check>, which just ended,
+ * may be kept for the next check ("check-keep-alive"). This is only the case
+ * after a successful HTTP check whose response was fully received, on a
+ * connection without error nor shutdown, and if the connect rule is the only
+ * one, since it is the one reusing the connection.
+ */
+static int tcpcheck_may_keep_conn(struct check *check)
+{
+	struct conn_stream *cs = check->cs;
+	struct connection *conn = cs_conn(cs);
+	struct tcpcheck_rule *rule;
+	int connects = 0;
+
+	if (!check->keep_alive || !check->server || !conn || !conn->mux || !check->sess ||
+	    (check->result != CHK_RES_PASSED && check->result != CHK_RES_CONDPASS) ||
+	    (check->tcpcheck_rules->flags & TCPCHK_RULES_PROTO_CHK) != TCPCHK_RULES_HTTP_CHK)
+		return 0;
+
+	if ((conn->flags & (CO_FL_ERROR|CO_FL_SOCK_RD_SH|CO_FL_SOCK_WR_SH|CO_FL_WAIT_XPRT)) ||
+	    (cs->flags & (CS_FL_ERROR|CS_FL_EOS|CS_FL_SHR|CS_FL_SHW)))
+		return 0;
+
+	if (!IS_HTX_CS(cs) || htx_get_tail_type(htxbuf(&check->bi)) != HTX_BLK_EOM)
+		return 0;
+
+	list_for_each_entry(rule, check->tcpcheck_rules->list, list) {
+		if (rule->action == TCPCHK_ACT_CONNECT && ++connects > 1)
+			return 0;
+	}
+	return 1;
+}
+
 /* This function is used only for server health-checks. It handles connection
  * status updates including errors. If necessary, it wakes the check task up.
  * It returns 0 on normal cases, <0 if at least one close() has happened on the
@@ -3437,11 +3501,13 @@ static int wake_srv_chk(struct conn_stream *cs)
 
 	if (check->result != CHK_RES_UNKNOWN) {
 		/* Check complete or aborted. If connection not yet closed do it
-		 * now and wake the check task up to be sure the result is
-		 * handled ASAP. */
-		conn_sock_drain(conn);
-		cs_close(cs);
-		ret = -1;
+		 * now, unless it is kept for the next check, and wake the check
+		 * task up to be sure the result is handled ASAP. */
+		if (!tcpcheck_may_keep_conn(check)) {
+			conn_sock_drain(conn);
+			cs_close(cs);
+			ret = -1;
+		}
 		/* We may have been scheduled to run, and the
 		 * I/O handler expects to have a cs, so remove
 		 * the tasklet
@@ -3486,7 +3552,7 @@ static struct task *process_chk_conn(struct task *t, void *context, unsigned sho
 	struct proxy *proxy = check->proxy;
 	struct conn_stream *cs = check->cs;
 	struct connection *conn = cs_conn(cs);
-	int rv;
+	int rv, keep;
 	int expired = tick_is_expired(t->expire, now_ms);
 
 	if (check->server)
@@ -3501,8 +3567,15 @@ static struct task *process_chk_conn(struct task *t, void *context, unsigned sho
 		 * is disabled.
 		 */
 		if (((check->state & (CHK_ST_ENABLED | CHK_ST_PAUSED)) != CHK_ST_ENABLED) ||
-		    proxy->state == PR_STSTOPPED)
+		    proxy->state == PR_STSTOPPED) {
+			/* release the connection kept by the last check */
+			if (check->sess) {
+				session_free(check->sess);
+				check->sess = NULL;
+				task_set_affinity(t, MAX_THREADS_MASK);
+			}
 			goto reschedule;
+		}
 
 		/* we'll initiate a new check */
 		set_server_check_status(check, HCHK_STATUS_START, NULL);
@@ -3534,7 +3607,15 @@ static struct task *process_chk_conn(struct task *t, void *context, unsigned sho
 
 		check->current_step = NULL;
 
-		if (conn && conn->xprt) {
+		/* A connection kept for the next check stays in the session,
+		 * where the mux leaves it once the conn-stream is released.
+		 */
+		keep = tcpcheck_may_keep_conn(check);
+		if (keep && LIST_ISEMPTY(&conn->session_list) &&
+		    !session_add_conn(check->sess, conn, conn->target))
+			keep = 0;
+
+		if (conn && conn->xprt && !keep) {
 			/* The check was aborted and the connection was not yet closed.
 			 * This can happen upon timeout, or when an external event such
 			 * as a failed response coupled with "observe layer7" caused the
@@ -3559,8 +3640,14 @@ static struct task *process_chk_conn(struct task *t, void *context, unsigned sho
 
 		if (check->sess != NULL) {
 			vars_prune(&check->vars, check->sess, NULL);
-			session_free(check->sess);
-			check->sess = NULL;
+			/* the mux may have closed the connection on detach */
+			if (keep && !LIST_ISEMPTY(&check->sess->srv_list))
+				vars_prune_per_sess(&check->sess->vars);
+			else {
+				session_free(check->sess);
+				check->sess = NULL;
+				keep = 0;
+			}
 		}
 
 		if (check->server) {
@@ -3577,7 +3664,9 @@ static struct task *process_chk_conn(struct task *t, void *context, unsigned sho
 				check_notify_success(check);
 			}
 		}
-		task_set_affinity(t, MAX_THREADS_MASK);
+		/* the kept connection may only be used by this thread */
+		if (!keep)
+			task_set_affinity(t, MAX_THREADS_MASK);
 		check->state &= ~CHK_ST_INPROGRESS;
 
 		if (check->server) {
@@ -5061,6 +5150,331 @@ static struct task *server_warmup(struct task *t, void *context, unsigned short
 	return t;
 }
 
+/* Returns the time (ms) server <s> remains ejected for the next time, which is
+ * doubled on each consecutive ejection up to 1 << EJECT_MAX_SHIFT times the
+ * base ejection time.
+ */
+static unsigned int srv_eject_duration(const struct server *s)
+{
+	unsigned long long duration;
+
+	duration = (unsigned long long)s->eject_time << MIN(s->eject_count, EJECT_MAX_SHIFT);
+	return MIN(duration, INT_MAX);
+}
+
+/* Ejects server <s> from the load balancing for the reason in <msg>, unless
+ * this would eject more than "eject-max-percent" of the backend's servers.
+ * Must be called with the server lock held.
+ */
+static void srv_eject(struct server *s, const char *msg)
+{
+	struct proxy *px = s->proxy;
+	unsigned int duration, max;
+
+	/* ejected servers are not accounted in srv_act/srv_bck anymore */
+	max = (px->srv_act + px->srv_bck + px->srv_ejected) * s->eject_max_pct / 100;
+	if (_HA_ATOMIC_ADD(&px->srv_ejected, 1) > max) {
+		_HA_ATOMIC_SUB(&px->srv_ejected, 1);
+		return;
+	}
+
+	duration = srv_eject_duration(s);
+	s->eject_count++;
+	s->eject_exp = tick_add(now_ms, MS_TO_TICKS(duration));
+	server_recalc_eweight(s, 1);
+	task_schedule(s->eject_task, s->eject_exp);
+
+	chunk_printf(&trash, "Server %s/%s ejected for %u ms: %s.",
+	             px->id, s->id, duration, msg);
+	ha_warning("%s\n", trash.area);
+	send_log(px, LOG_NOTICE, "%s\n", trash.area);
+}
+
+/* Accounts the outcome of a stream to the outlier detection of server <s>. A
+ * failure is a 5xx response or a server error or timeout, reported through a
+ * non-zero <failed>, and <rtime> is the response time (ms), negative if it is
+ * unknown. The server is ejected after "eject-errors" consecutive failures, or
+ * once the average of its last EJECT_RTIME_SAMPLES response times exceeds
+ * "eject-latency" times the backend's average one. Use srv_observe_outlier().
+ */
+void __srv_observe_outlier(struct server *s, int failed, int rtime)
+{
+	struct proxy *px = s->proxy;
+	unsigned int be_rtime;
+
+	/* streams still running on an ejected server are not accounted */
+	if (tick_isset(s->eject_exp))
+		return;
+
+	if (!failed) {
+		if (s->eject_fails)
+			s->eject_fails = 0;
+	}
+	else if (s->eject_errors && _HA_ATOMIC_ADD(&s->eject_fails, 1) >= s->eject_errors) {
+		HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+		if (!tick_isset(s->eject_exp) && s->eject_fails >= s->eject_errors) {
+			chunk_printf(&trash, "%u consecutive failures", s->eject_fails);
+			s->eject_fails = 0;
+			srv_eject(s, trash.area);
+		}
+		HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+		return;
+	}
+
+	if (!s->eject_latency || rtime < 0)
+		return;
+
+	swrate_add(&s->eject_rtime, EJECT_RTIME_SAMPLES, rtime);
+	if (s->eject_samples < EJECT_RTIME_SAMPLES) {
+		_HA_ATOMIC_ADD(&s->eject_samples, 1);
+		return;
+	}
+
+	/* the backend's averages include this server's response times */
+	if (px->be_counters.cum_lbconn < TIME_STATS_SAMPLES)
+		return;
+
+	be_rtime = swrate_avg(px->be_counters.c_time, TIME_STATS_SAMPLES) +
+	           swrate_avg(px->be_counters.d_time, TIME_STATS_SAMPLES);
+	if (!be_rtime || swrate_avg(s->eject_rtime, EJECT_RTIME_SAMPLES) <= be_rtime * s->eject_latency)
+		return;
+
+	HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+	if (!tick_isset(s->eject_exp) && s->eject_samples >= EJECT_RTIME_SAMPLES) {
+		chunk_printf(&trash, "average response time %u ms above %u times the backend's %u ms",
+		             swrate_avg(s->eject_rtime, EJECT_RTIME_SAMPLES), s->eject_latency, be_rtime);
+		s->eject_rtime = s->eject_samples = 0;
+		srv_eject(s, trash.area);
+	}
+	HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+}
+
+/* Re-admits the server ejected by the outlier detection once its ejection
+ * time is elapsed. The count of consecutive ejections used for the backoff is
+ * reset once the server stayed admitted as long as it would be ejected again.
+ */
+static struct task *server_eject_task(struct task *t, void *context, unsigned short state)
+{
+	struct server *s = context;
+
+	t->expire = TICK_ETERNITY;
+	HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+
+	if (!tick_isset(s->eject_exp)) {
+		s->eject_count = 0;
+		goto out;
+	}
+
+	if (!tick_is_expired(s->eject_exp, now_ms)) {
+		t->expire = s->eject_exp;
+		goto out;
+	}
+
+	s->eject_exp = TICK_ETERNITY;
+	s->eject_fails = s->eject_rtime = s->eject_samples = 0;
+	_HA_ATOMIC_SUB(&s->proxy->srv_ejected, 1);
+	server_recalc_eweight(s, 1);
+	t->expire = tick_add(now_ms, MS_TO_TICKS(srv_eject_duration(s)));
+
+	chunk_printf(&trash, "Server %s/%s re-admitted after its ejection.",
+	             s->proxy->id, s->id);
+	ha_warning("%s\n", trash.area);
+	send_log(s->proxy, LOG_NOTICE, "%s\n", trash.area);
+ out:
+	HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+	return t;
+}
+
+/* What makes the health checks of two servers equivalent, so that only one of
+ * them is run when "share-checks" is set. It is used as the key of the shared
+ * checks tree, so it must be zeroed before being filled.
+ */
+struct check_share_key {
+	struct sockaddr_storage addr;           /* address and port to check */
+	struct list *rules;                     /* tcp-check ruleset */
+	const struct mux_proto_list *mux_proto; /* mux used by the checks */
+	unsigned int rules_flags;               /* TCPCHK_RULES_* */
+	int type;                               /* PR_O2_*_CHK */
+	int send_proxy;
+	int via_socks4;
+	int inter, fastinter, downinter;
+	int rise, fall;
+	int timeout_check;                      /* check and connect timeouts of the proxy */
+	int timeout_connect;
+	int disable404;                         /* PR_O_DISABLE404 option of the proxy */
+};
+
+/* A shared health check, indexed by its check_share_key */
+struct check_share_node {
+	struct server *srv;                     /* server running the check */
+	struct ebmb_node node;                  /* followed by the key */
+};
+
+/* Returns non-zero if the rules of <rules> give the same result whatever the
+ * server they are run for: no log-format string which could depend on the
+ * server, no custom action and no TCP connection using TLS.
+ */
+static int tcpcheck_rules_shareable(const struct tcpcheck_rules *rules)
+{
+	struct tcpcheck_rule *rule;
+	struct tcpcheck_http_hdr *hdr;
+	struct logformat_node *lf;
+
+	if (!LIST_ISEMPTY(&rules->preset_vars))
+		return 0;
+
+	list_for_each_entry(rule, rules->list, list) {
+		switch (rule->action) {
+		case TCPCHK_ACT_CONNECT:
+			if ((rule->connect.options & TCPCHK_OPT_SSL) || rule->connect.port_expr)
+				return 0;
+			break;
+		case TCPCHK_ACT_SEND:
+			if (rule->send.type == TCPCHK_SEND_STRING_LF ||
+			    rule->send.type == TCPCHK_SEND_BINARY_LF)
+				return 0;
+			if (rule->send.type != TCPCHK_SEND_HTTP)
+				break;
+			if (rule->send.http.flags & (TCPCHK_SND_HTTP_FL_URI_FMT|TCPCHK_SND_HTTP_FL_BODY_FMT))
+				return 0;
+			list_for_each_entry(hdr, &rule->send.http.hdrs, list) {
+				list_for_each_entry(lf, &hdr->value, list) {
+					if (lf->type != LOG_FMT_TEXT)
+						return 0;
+				}
+			}
+			break;
+		case TCPCHK_ACT_EXPECT:
+			if (rule->expect.type == TCPCHK_EXPECT_STRING_LF ||
+			    rule->expect.type == TCPCHK_EXPECT_BINARY_LF ||
+			    rule->expect.type == TCPCHK_EXPECT_HTTP_BODY_LF ||
+			    (rule->expect.type == TCPCHK_EXPECT_HTTP_HEADER &&
+			     (rule->expect.flags & (TCPCHK_EXPT_FL_HTTP_HNAME_FMT|TCPCHK_EXPT_FL_HTTP_HVAL_FMT))))
+				return 0;
+			break;
+		case TCPCHK_ACT_COMMENT:
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Fills <key> with what identifies the health check of <srv>. Returns 0 if
+ * this check cannot be shared with other servers, otherwise non-zero.
+ */
+static int check_share_key_init(struct check_share_key *key, struct server *srv)
+{
+	struct check *check = &srv->check;
+	struct proxy *px = srv->proxy;
+	const struct sockaddr_storage *addr;
+	int port;
+
+	/* servers whose address may change, TLS checks, whose settings are
+	 * per server, and checks bound to a source address are not shared.
+	 */
+	if (!(check->state & CHK_ST_CONFIGURED) || check->type == PR_O2_EXT_CHK ||
+	    srv->track || srv->hostname || check->use_ssl > 0 ||
+	    srv->conn_src.opts || px->conn_src.opts ||
+	    !check->tcpcheck_rules || !tcpcheck_rules_shareable(check->tcpcheck_rules))
+		return 0;
+
+	/* the address and port used by tcpcheck_eval_connect() */
+	addr = is_addr(&check->addr) ? &check->addr : &srv->addr;
+	port = check->port;
+	if (!port && is_inet_addr(&check->addr))
+		port = get_host_port(&check->addr);
+	if (!port)
+		port = srv->svc_port;
+
+	memset(key, 0, sizeof(*key));
+	switch (addr->ss_family) {
+	case AF_INET:
+		((struct sockaddr_in *)&key->addr)->sin_addr = ((struct sockaddr_in *)addr)->sin_addr;
+		break;
+	case AF_INET6:
+		((struct sockaddr_in6 *)&key->addr)->sin6_addr = ((struct sockaddr_in6 *)addr)->sin6_addr;
+		((struct sockaddr_in6 *)&key->addr)->sin6_scope_id = ((struct sockaddr_in6 *)addr)->sin6_scope_id;
+		break;
+	default:
+		return 0;
+	}
+	key->addr.ss_family = addr->ss_family;
+	set_host_port(&key->addr, port);
+
+	key->rules           = check->tcpcheck_rules->list;
+	key->rules_flags     = check->tcpcheck_rules->flags;
+	key->mux_proto       = check->mux_proto;
+	key->type            = check->type;
+	key->send_proxy      = check->send_proxy;
+	key->via_socks4      = check->via_socks4;
+	key->inter           = check->inter;
+	key->fastinter       = check->fastinter;
+	key->downinter       = check->downinter;
+	key->rise            = check->rise;
+	key->fall            = check->fall;
+	key->timeout_check   = px->timeout.check;
+	key->timeout_connect = px->timeout.connect;
+	key->disable404      = px->options & PR_O_DISABLE404;
+	return 1;
+}
+
+/* Only keeps one health check out of all the equivalent ones, which is the
+ * case when "share-checks" is set. The servers of the other ones track the
+ * server of the first one instead, so that its results are reported to all
+ * of them. Returns 0 if OK, ERR_FATAL on error.
+ */
+static int share_checks()
+{
+	struct eb_root root = EB_ROOT_UNIQUE;
+	struct check_share_node *node, *new = NULL;
+	struct check_share_key key;
+	struct ebmb_node *eb;
+	struct proxy *px;
+	struct server *s;
+	int err = 0;
+
+	for (px = proxies_list; px && !err; px = px->next) {
+		for (s = px->srv; s; s = s->next) {
+			if (!check_share_key_init(&key, s))
+				continue;
+
+			if (!new) {
+				new = malloc(sizeof(*new) + sizeof(key));
+				if (!new) {
+					ha_alert("Starting [%s:%s] check: out of memory.\n", px->id, s->id);
+					err = ERR_ALERT | ERR_FATAL;
+					break;
+				}
+			}
+			new->srv = s;
+			memcpy(new->node.key, &key, sizeof(key));
+			eb = ebmb_insert(&root, &new->node, sizeof(key));
+			if (eb == &new->node) {
+				/* first check of this kind, it is run */
+				new = NULL;
+				continue;
+			}
+
+			/* the same check is already run for another server */
+			node = ebmb_entry(eb, struct check_share_node, node);
+			s->check.state &= ~CHK_ST_CONFIGURED;
+			s->do_check    = 0;
+			s->track       = node->srv;
+			s->tracknext   = node->srv->trackers;
+			node->srv->trackers = s;
+		}
+	}
+	free(new);
+
+	while ((eb = ebmb_first(&root))) {
+		ebmb_delete(eb);
+		free(ebmb_entry(eb, struct check_share_node, node));
+	}
+	return err;
+}
+
 /*
  * Start health-check.
  * Returns 0 if OK, ERR_FATAL on error, and prints the error in this case.
@@ -5081,6 +5495,14 @@ static int start_checks()
 	checks_fe.conn_retries = CONN_RETRIES;
 	checks_fe.options2 |= PR_O2_INDEPSTR | PR_O2_SMARTCON | PR_O2_SMARTACC;
 	checks_fe.timeout.client = TICK_ETERNITY;
+	checks_fe.max_out_conns = 1; /* the connection kept by "check-keep-alive" */
+
+	if (global.tune.options & GTUNE_SHARE_CHECKS) {
+		int err = share_checks();
+
+		if (err)
+			return err;
+	}
 
 	/* 1- count the checkers to run simultaneously.
 	 * We also determine the minimum interval among all of those which
@@ -5107,6 +5529,17 @@ static int start_checks()
 					task_schedule(s->warmup, tick_add(now_ms, MS_TO_TICKS(MAX(1000, (now.tv_sec - s->last_change)) / 20)));
 			}
 
+			if (s->eject_errors || s->eject_latency) {
+				if ((t = task_new(MAX_THREADS_MASK)) == NULL) {
+					ha_alert("Starting [%s:%s] outlier detection: out of memory.\n", px->id, s->id);
+					return ERR_ALERT | ERR_FATAL;
+				}
+				/* this task re-admits the server after its ejection */
+				s->eject_task = t;
+				t->process = server_eject_task;
+				t->context = s;
+			}
+
 			if (s->check.state & CHK_ST_CONFIGURED) {
 				nbcheck++;
 				if ((srv_getinter(&s->check) >= SRV_CHK_INTER_THRES) &&
@@ -7554,6 +7987,22 @@ static int srv_parse_check_send_proxy(char **args, int *cur_arg, struct proxy *c
 	return 0;
 }
 
+/* Parse the "check-keep-alive" server keyword */
+static int srv_parse_check_keep_alive(char **args, int *cur_arg, struct proxy *curpx, struct server *srv,
+				      char **errmsg)
+{
+	srv->check.keep_alive = 1;
+	return 0;
+}
+
+/* Parse the "no-check-keep-alive" server keyword */
+static int srv_parse_no_check_keep_alive(char **args, int *cur_arg, struct proxy *curpx, struct server *srv,
+					 char **errmsg)
+{
+	srv->check.keep_alive = 0;
+	return 0;
+}
+
 /* Parse the "check-via-socks4" server keyword */
 static int srv_parse_check_via_socks4(char **args, int *cur_arg, struct proxy *curpx, struct server *srv,
 				      char **errmsg)
@@ -7832,11 +8281,13 @@ static struct srv_kw_list srv_kws = { "CHK", { }, {
 	{ "agent-port",          srv_parse_agent_port,          1,  1 }, /* Set the TCP port used for agent checks. */
 	{ "agent-send",          srv_parse_agent_send,          1,  1 }, /* Set string to send to agent. */
 	{ "check",               srv_parse_check,               0,  1 }, /* Enable health checks */
+	{ "check-keep-alive",    srv_parse_check_keep_alive,    0,  1 }, /* Keep the connection between HTTP health checks */
 	{ "check-proto",         srv_parse_check_proto,         1,  1 }, /* Set the mux protocol for health checks  */
 	{ "check-send-proxy",    srv_parse_check_send_proxy,    0,  1 }, /* Enable PROXY protocol for health checks */
 	{ "check-via-socks4",    srv_parse_check_via_socks4,    0,  1 }, /* Enable socks4 proxy for health checks */
 	{ "no-agent-check",      srv_parse_no_agent_check,      0,  1 }, /* Do not enable any auxiliary agent check */
 	{ "no-check",            srv_parse_no_check,            0,  1 }, /* Disable health checks */
+	{ "no-check-keep-alive", srv_parse_no_check_keep_alive, 0,  1 }, /* Close the connection after each HTTP health check */
 	{ "no-check-send-proxy", srv_parse_no_check_send_proxy, 0,  1 }, /* Disable PROXY protol for health checks */
 	{ "rise",                srv_parse_check_rise,          1,  1 }, /* Set rise value for health checks */
 	{ "fall",                srv_parse_check_fall,          1,  1 }, /* Set fall value for health checks */
@@ -41,7 +41,7 @@
 #include <proto/stream.h>
 
 
-#if defined(USE_ZLIB)
+#if defined(USE_ZLIB) || defined(USE_BROTLI) || defined(USE_ZSTD)
 __decl_spinlock(comp_pool_lock);
 #endif
 
@@ -94,6 +94,48 @@ static int deflate_end(struct comp_ctx **comp_ctx);
 
 #endif /* USE_ZLIB */
 
+#if defined(USE_BROTLI) || defined(USE_ZSTD)
+
+static void *comp_lib_alloc(void *opaque, size_t size);
+static void comp_lib_free(void *opaque, void *ptr);
+
+/* The brotli and zstd encoders' memory is taken from pools of the sizes they
+ * request, up to COMP_LIB_MAX_POOLS different sizes, so that the memory of
+ * the terminated streams is reused by the next ones.
+ */
+#define COMP_LIB_MAX_POOLS 32
+static struct pool_head *comp_lib_pools[COMP_LIB_MAX_POOLS];
+static size_t comp_lib_pool_sizes[COMP_LIB_MAX_POOLS];
+static unsigned int comp_lib_nb_pools;
+
+#endif
+
+#if defined(USE_BROTLI)
+
+static int global_tune_brotli_quality = -1;  /* brotli quality, -1 = the compression level */
+static int global_tune_brotli_window = 0;    /* brotli window (log2), 0 = brotli's default */
+
+static int brotli_init(struct comp_ctx **comp_ctx, int level);
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_end(struct comp_ctx **comp_ctx);
+
+#endif /* USE_BROTLI */
+
+#if defined(USE_ZSTD)
+
+static int global_tune_zstd_level = -1;      /* zstd level, -1 = the compression level */
+static int global_tune_zstd_window = 0;      /* zstd window (log2), 0 = zstd's default */
+
+static int zstd_init(struct comp_ctx **comp_ctx, int level);
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_end(struct comp_ctx **comp_ctx);
+
+#endif /* USE_ZSTD */
+
 
 const struct comp_algo comp_algos[] =
 {
@@ -107,6 +149,12 @@ const struct comp_algo comp_algos[] =
 	{ "raw-deflate", 11, "deflate",  7, raw_def_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
 	{ "gzip",         4, "gzip",     4, gzip_init,     deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
 #endif /* USE_ZLIB */
+#if defined(USE_BROTLI)
+	{ "brotli",       6, "br",       2, brotli_init,   brotli_add_data,   brotli_flush,   brotli_finish,   brotli_end },
+#endif
+#if defined(USE_ZSTD)
+	{ "zstd",         4, "zstd",     4, zstd_init,     zstd_add_data,     zstd_flush,     zstd_finish,     zstd_end },
+#endif
 	{ NULL,       0, NULL,          0, NULL ,         NULL,              NULL,           NULL,           NULL }
 };
 
@@ -145,7 +193,24 @@ int comp_append_algo(struct comp *comp, const char *algo)
 	return -1;
 }
 
-#if defined(USE_ZLIB) || defined(USE_SLZ)
+/*
+ * Returns non-zero if the add_data() and flush() functions of <algo> may be
+ * called from a thread which is not one of haproxy's threads, which is the
+ * case of the deflate encoders since they do not allocate memory once
+ * initialized. This is used by the compression threads.
+ */
+int comp_algo_thread_safe(const struct comp_algo *algo)
+{
+#if defined(USE_SLZ)
+	return algo->add_data == rfc195x_add_data;
+#elif defined(USE_ZLIB)
+	return algo->add_data == deflate_add_data;
+#else
+	return 0;
+#endif
+}
+
+#if defined(USE_ZLIB) || defined(USE_SLZ) || defined(USE_BROTLI) || defined(USE_ZSTD)
 DECLARE_STATIC_POOL(pool_comp_ctx, "comp_ctx", sizeof(struct comp_ctx));
 
 /*
@@ -175,6 +240,12 @@ static inline int init_comp_ctx(struct comp_ctx **comp_ctx)
 	strm->zalloc = alloc_zlib;
 	strm->zfree = free_zlib;
 	strm->opaque = *comp_ctx;
+#endif
+#if defined(USE_BROTLI)
+	(*comp_ctx)->brotli = NULL;
+#endif
+#if defined(USE_ZSTD)
+	(*comp_ctx)->zstd = NULL;
 #endif
 	return 0;
 }
@@ -696,12 +767,403 @@ static int zlib_parse_global_windowsize(char **args, int section_type, struct pr
 
 #endif /* USE_ZLIB */
 
+#if defined(USE_BROTLI) || defined(USE_ZSTD)
+
+/* Header placed before the areas given to brotli and zstd, to find the pool
+ * they come from. It is as large as the alignment malloc() guarantees.
+ */
+union comp_lib_area {
+	struct pool_head *pool;   /* pool of the area, NULL if allocated by malloc() */
+	long double align;
+};
+
+/* Allocates <size> bytes for brotli or zstd from the pool of this size,
+ * which is created on the fly. Once COMP_LIB_MAX_POOLS pools were created, the
+ * areas of other sizes are allocated using malloc(). The pools are only ever
+ * added, so that they may be looked up without lock.
+ */
+static void *comp_lib_alloc(void *opaque, size_t size)
+{
+	union comp_lib_area *area;
+	struct pool_head *pool = NULL;
+	unsigned int i, nb;
+
+	size += sizeof(*area);
+	nb = comp_lib_nb_pools;
+	__ha_barrier_load();
+	for (i = 0; i < nb; i++) {
+		if (comp_lib_pool_sizes[i] == size) {
+			pool = comp_lib_pools[i];
+			break;
+		}
+	}
+
+	if (!pool && nb < COMP_LIB_MAX_POOLS) {
+		HA_SPIN_LOCK(COMP_POOL_LOCK, &comp_pool_lock);
+		for (i = 0; i < comp_lib_nb_pools; i++) {
+			if (comp_lib_pool_sizes[i] == size) {
+				pool = comp_lib_pools[i];
+				break;
+			}
+		}
+		if (!pool && comp_lib_nb_pools < COMP_LIB_MAX_POOLS) {
+			pool = create_pool("comp_lib", size, MEM_F_SHARED);
+			if (pool) {
+				comp_lib_pools[comp_lib_nb_pools] = pool;
+				comp_lib_pool_sizes[comp_lib_nb_pools] = size;
+				__ha_barrier_store();
+				comp_lib_nb_pools++;
+			}
+		}
+		HA_SPIN_UNLOCK(COMP_POOL_LOCK, &comp_pool_lock);
+	}
+
+	area = pool ? pool_alloc(pool) : malloc(size);
+	if (!area)
+		return NULL;
+	area->pool = pool;
+	return area + 1;
+}
+
+/* Releases the area <ptr> allocated by comp_lib_alloc() */
+static void comp_lib_free(void *opaque, void *ptr)
+{
+	union comp_lib_area *area;
+
+	if (!ptr)
+		return;
+
+	area = (union comp_lib_area *)ptr - 1;
+	if (area->pool)
+		pool_free(area->pool, area);
+	else
+		free(area);
+}
+
+/* Returns the level of an algorithm which may be tuned to <tuned>, or -1 if
+ * not, for the requested compression <level>. The tuned level only replaces
+ * the level of the live traffic, the higher ones, requested for the objects
+ * stored in a cache, are used as is.
+ */
+static inline int comp_lib_level(int level, int tuned)
+{
+	if (tuned >= 0 && level <= global.tune.comp_maxlevel)
+		return tuned;
+	return level;
+}
+
+#endif /* USE_BROTLI || USE_ZSTD */
+
+#if defined(USE_BROTLI)
+
+/**************************
+****  brotli algorithm ****
+***************************/
+static int brotli_init(struct comp_ctx **comp_ctx, int level)
+{
+	BrotliEncoderState *state;
+
+	if (init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	level = comp_lib_level(level, global_tune_brotli_quality);
+	if (level > BROTLI_MAX_QUALITY)
+		level = BROTLI_MAX_QUALITY;
+
+	state = BrotliEncoderCreateInstance(comp_lib_alloc, comp_lib_free, NULL);
+	if (!state)
+		goto fail;
+
+	if (!BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, level) ||
+	    (global_tune_brotli_window &&
+	     !BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, global_tune_brotli_window))) {
+		BrotliEncoderDestroyInstance(state);
+		goto fail;
+	}
+
+	(*comp_ctx)->brotli = state;
+	(*comp_ctx)->cur_lvl = level;
+	return 0;
+
+  fail:
+	deinit_comp_ctx(comp_ctx);
+	return -1;
+}
+
+/* Runs the brotli encoder with operation <op> on <in_len> bytes of <in_data>
+ * and writes its output to <out>. The remaining output of an uncompleted
+ * flush is emitted first, as brotli does not accept new data before. Returns
+ * the number of input bytes consumed, or -1 on error. The number of bytes
+ * emitted is stored into <out_len>.
+ */
+static int brotli_stream(struct comp_ctx *comp_ctx, BrotliEncoderOperation op,
+                         const char *in_data, int in_len, struct buffer *out, int *out_len)
+{
+	BrotliEncoderState *state = comp_ctx->brotli;
+	const uint8_t *next_in = (const uint8_t *)(in_data ? in_data : "");
+	size_t avail_in = in_len;
+	uint8_t *next_out = (uint8_t *)b_tail(out);
+	size_t avail_out = b_room(out);
+	size_t room = avail_out;
+
+	while (BrotliEncoderHasMoreOutput(state) && avail_out) {
+		const uint8_t *none_in = next_in;
+		size_t none = 0;
+
+		if (!BrotliEncoderCompressStream(state, BROTLI_OPERATION_FLUSH, &none, &none_in,
+		                                 &avail_out, &next_out, NULL))
+			return -1;
+	}
+
+	if (BrotliEncoderHasMoreOutput(state))
+		goto end;
+
+	do {
+		if (!BrotliEncoderCompressStream(state, op, &avail_in, &next_in,
+		                                 &avail_out, &next_out, NULL))
+			return -1;
+	} while (avail_out && (avail_in || BrotliEncoderHasMoreOutput(state) ||
+	                       (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(state))));
+
+  end:
+	b_add(out, room - avail_out);
+	*out_len = room - avail_out;
+	return in_len - avail_in;
+}
+
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	int out_len;
+
+	return brotli_stream(comp_ctx, BROTLI_OPERATION_PROCESS, in_data, in_len, out, &out_len);
+}
+
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int out_len;
+
+	if (brotli_stream(comp_ctx, BROTLI_OPERATION_FLUSH, NULL, 0, out, &out_len) < 0)
+		return -1;
+	return out_len;
+}
+
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int out_len;
+
+	if (brotli_stream(comp_ctx, BROTLI_OPERATION_FINISH, NULL, 0, out, &out_len) < 0)
+		return -1;
+	return out_len;
+}
+
+static int brotli_end(struct comp_ctx **comp_ctx)
+{
+	BrotliEncoderDestroyInstance((*comp_ctx)->brotli);
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+/* config parser for global "tune.brotli.quality" */
+static int brotli_parse_global_quality(char **args, int section_type, struct proxy *curpx,
+                                       struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.",
+		          args[0], BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY);
+		return -1;
+	}
+
+	global_tune_brotli_quality = atoi(args[1]);
+	if (global_tune_brotli_quality < BROTLI_MIN_QUALITY || global_tune_brotli_quality > BROTLI_MAX_QUALITY) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.",
+		          args[0], BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.brotli.windowsize" */
+static int brotli_parse_global_windowsize(char **args, int section_type, struct proxy *curpx,
+                                          struct proxy *defpx, const char *file, int line,
+                                          char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.",
+		          args[0], BROTLI_MIN_WINDOW_BITS, BROTLI_MAX_WINDOW_BITS);
+		return -1;
+	}
+
+	global_tune_brotli_window = atoi(args[1]);
+	if (global_tune_brotli_window < BROTLI_MIN_WINDOW_BITS || global_tune_brotli_window > BROTLI_MAX_WINDOW_BITS) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.",
+		          args[0], BROTLI_MIN_WINDOW_BITS, BROTLI_MAX_WINDOW_BITS);
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* USE_BROTLI */
+
+#if defined(USE_ZSTD)
+
+/**************************
+****   zstd algorithm  ****
+***************************/
+static int zstd_init(struct comp_ctx **comp_ctx, int level)
+{
+	ZSTD_customMem mem = { comp_lib_alloc, comp_lib_free, NULL };
+	ZSTD_CCtx *cctx;
+
+	if (init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	/* zstd's level 0 is its default level */
+	level = comp_lib_level(level, global_tune_zstd_level);
+	if (level < 1)
+		level = 1;
+	if (level > ZSTD_maxCLevel())
+		level = ZSTD_maxCLevel();
+
+	cctx = ZSTD_createCCtx_advanced(mem);
+	if (!cctx)
+		goto fail;
+
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)) ||
+	    (global_tune_zstd_window &&
+	     ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, global_tune_zstd_window)))) {
+		ZSTD_freeCCtx(cctx);
+		goto fail;
+	}
+
+	(*comp_ctx)->zstd = cctx;
+	(*comp_ctx)->cur_lvl = level;
+	return 0;
+
+  fail:
+	deinit_comp_ctx(comp_ctx);
+	return -1;
+}
+
+/* Runs the zstd encoder with directive <mode> on <in_len> bytes of <in_data>
+ * and writes its output to <out>. Returns the number of input bytes consumed,
+ * or -1 on error. The number of bytes emitted is stored into <out_len>.
+ */
+static int zstd_stream(struct comp_ctx *comp_ctx, ZSTD_EndDirective mode,
+                       const char *in_data, int in_len, struct buffer *out, int *out_len)
+{
+	ZSTD_inBuffer in = { in_data, in_len, 0 };
+	ZSTD_outBuffer outbuf = { b_tail(out), b_room(out), 0 };
+	size_t ret;
+
+	do {
+		ret = ZSTD_compressStream2(comp_ctx->zstd, &outbuf, &in, mode);
+		if (ZSTD_isError(ret))
+			return -1;
+	} while (outbuf.pos < outbuf.size &&
+	         (mode == ZSTD_e_continue ? in.pos < in.size : ret != 0));
+
+	b_add(out, outbuf.pos);
+	*out_len = outbuf.pos;
+	return in.pos;
+}
+
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	int out_len;
+
+	return zstd_stream(comp_ctx, ZSTD_e_continue, in_data, in_len, out, &out_len);
+}
+
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int out_len;
+
+	if (zstd_stream(comp_ctx, ZSTD_e_flush, NULL, 0, out, &out_len) < 0)
+		return -1;
+	return out_len;
+}
+
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int out_len;
+
+	if (zstd_stream(comp_ctx, ZSTD_e_end, NULL, 0, out, &out_len) < 0)
+		return -1;
+	return out_len;
+}
+
+static int zstd_end(struct comp_ctx **comp_ctx)
+{
+	ZSTD_freeCCtx((*comp_ctx)->zstd);
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+/* config parser for global "tune.zstd.level" */
+static int zstd_parse_global_level(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a numeric value between 1 and %d.", args[0], ZSTD_maxCLevel());
+		return -1;
+	}
+
+	global_tune_zstd_level = atoi(args[1]);
+	if (global_tune_zstd_level < 1 || global_tune_zstd_level > ZSTD_maxCLevel()) {
+		memprintf(err, "'%s' expects a numeric value between 1 and %d.", args[0], ZSTD_maxCLevel());
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.zstd.windowsize" */
+static int zstd_parse_global_windowsize(char **args, int section_type, struct proxy *curpx,
+                                        struct proxy *defpx, const char *file, int line,
+                                        char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a numeric value between 10 and 27.", args[0]);
+		return -1;
+	}
+
+	global_tune_zstd_window = atoi(args[1]);
+	if (global_tune_zstd_window < 10 || global_tune_zstd_window > 27) {
+		memprintf(err, "'%s' expects a numeric value between 10 and 27.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* USE_ZSTD */
+
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
 #ifdef USE_ZLIB
 	{ CFG_GLOBAL, "tune.zlib.memlevel",   zlib_parse_global_memlevel },
 	{ CFG_GLOBAL, "tune.zlib.windowsize", zlib_parse_global_windowsize },
+#endif
+#ifdef USE_BROTLI
+	{ CFG_GLOBAL, "tune.brotli.quality",    brotli_parse_global_quality },
+	{ CFG_GLOBAL, "tune.brotli.windowsize", brotli_parse_global_windowsize },
+#endif
+#ifdef USE_ZSTD
+	{ CFG_GLOBAL, "tune.zstd.level",        zstd_parse_global_level },
+	{ CFG_GLOBAL, "tune.zstd.windowsize",   zstd_parse_global_windowsize },
 #endif
 	{ 0, NULL, NULL }
 }};
@@ -733,6 +1195,15 @@ static void comp_register_build_opts(void)
 	memprintf(&ptr, "Built with libslz for stateless compression.");
 #else
 	memprintf(&ptr, "Built without compression support (neither USE_ZLIB nor USE_SLZ are set).");
+#endif
+#ifdef USE_BROTLI
+	memprintf(&ptr, "%s\nBuilt with brotli version : %u.%u.%u", ptr,
+	          BrotliEncoderVersion() >> 24, (BrotliEncoderVersion() >> 12) & 0xfff,
+	          BrotliEncoderVersion() & 0xfff);
+#endif
+#ifdef USE_ZSTD
+	memprintf(&ptr, "%s\nBuilt with zstd version : " ZSTD_VERSION_STRING, ptr);
+	memprintf(&ptr, "%s\nRunning on zstd version : %s", ptr, ZSTD_versionString());
 #endif
 	memprintf(&ptr, "%s\nCompression algorithms supported :", ptr);
 
@@ -64,12 +64,14 @@ void ha_thread_dump(struct buffer *buf, int thr, int calling_tid)
 		      ha_get_pthread_id(thr),
 		      thread_has_tasks(),
 	              !!(global_tasks_mask & thr_bit),
-	              !eb_is_empty(&task_per_thread[thr].timers),
+	              !eb_is_empty(&task_per_thread[thr].timers) ||
+	              !!(task_per_thread[thr].wheel_cnt[0] | task_per_thread[thr].wheel_cnt[1]),
 	              !eb_is_empty(&task_per_thread[thr].rqueue),
 	              !(LIST_ISEMPTY(&task_per_thread[thr].tasklets[TL_URGENT]) &&
 			LIST_ISEMPTY(&task_per_thread[thr].tasklets[TL_NORMAL]) &&
 			LIST_ISEMPTY(&task_per_thread[thr].tasklets[TL_BULK]) &&
-			MT_LIST_ISEMPTY(&task_per_thread[thr].shared_tasklet_list)),
+			MT_LIST_ISEMPTY(&task_per_thread[thr].shared_tasklet_list) &&
+			MT_LIST_ISEMPTY(&task_per_thread[thr].steal_list)),
 	              task_per_thread[thr].task_list_size,
 	              task_per_thread[thr].rqueue_size,
 	              stuck,
@@ -10,6 +10,8 @@
  *
  */
 
+#define _GNU_SOURCE
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -17,7 +19,9 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <common/cfgparse.h>
 #include <common/errors.h>
@@ -26,6 +30,8 @@
 #include <common/ticks.h>
 #include <common/net_helper.h>
 
+#include <import/xxhash.h>
+
 #include <types/action.h>
 #include <types/applet.h>
 #include <types/cli.h>
@@ -51,6 +57,10 @@
 #include <proto/tcp_rules.h>
 #include <proto/vars.h>
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define DNS_USE_SENDMMSG
+#endif
+
 struct list dns_resolvers  = LIST_HEAD_INIT(dns_resolvers);
 struct list dns_srvrq_list = LIST_HEAD_INIT(dns_srvrq_list);
 
@@ -58,11 +68,27 @@ static THREAD_LOCAL uint64_t dns_query_id_seed = 0; /* random seed */
 
 DECLARE_STATIC_POOL(dns_answer_item_pool, "dns_answer_item", sizeof(struct dns_answer_item));
 DECLARE_STATIC_POOL(dns_resolution_pool,  "dns_resolution",  sizeof(struct dns_resolution));
+DECLARE_STATIC_POOL(dns_tcp_query_pool,   "dns_tcp_query",   sizeof(struct dns_tcp_query));
 DECLARE_POOL(dns_requester_pool,  "dns_requester",  sizeof(struct dns_requester));
 
 static unsigned int resolution_uuid = 1;
 unsigned int dns_failed_resolutions = 0;
 
+/* The answers cache shared by all the resolvers sections. It holds at most
+ * <dns_cache_size> entries ("tune.dns.cache-size"), it is disabled when zero.
+ * The entries are indexed by the hash of their name and query type and are
+ * chained in insertion order so that the oldest one is evicted first when it
+ * is full.
+ */
+static unsigned int dns_cache_size = 0;
+static unsigned int dns_cache_count = 0;
+static struct eb_root dns_cache_tree = EB_ROOT;
+static struct list dns_cache_list = LIST_HEAD_INIT(dns_cache_list);
+__decl_spinlock(dns_cache_lock);
+
+static int dns_resolution_from_cache(struct dns_resolution *res);
+static void dns_tcp_io_handler(int fd);
+
 /* Returns a pointer to the resolvers matching the id <id>. NULL is returned if
  * no match is found.
  */
@@ -185,6 +211,112 @@ static void dns_update_resolvers_timeout(struct dns_resolvers *resolvers)
 	task_queue(resolvers->t);
 }
 
+/* Computes the cache key of the <name_dn> domain name label of <len> bytes for
+ * the <query_type> queries. The lower case name is copied into <lc> which must
+ * be at least <len> bytes long.
+ */
+static uint64_t dns_cache_key(const char *name_dn, int len, int query_type, char *lc)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		lc[i] = tolower((unsigned char)name_dn[i]);
+	return XXH64(lc, len, query_type);
+}
+
+/* Returns the cache entry of <key> for the <lc> lower case name of <len> bytes
+ * and <query_type>, or NULL if none. Must be called with the cache lock held.
+ */
+static struct dns_cache_entry *dns_cache_lookup(uint64_t key, const char *lc, int len,
+                                                int query_type)
+{
+	struct eb64_node *node;
+	struct dns_cache_entry *entry;
+
+	for (node = eb64_lookup(&dns_cache_tree, key); node; node = eb64_next_dup(node)) {
+		entry = eb64_entry(node, struct dns_cache_entry, node);
+		if (entry->query_type == query_type && entry->name_len == len &&
+		    memcmp(entry->name, lc, len) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Removes <entry> from the cache and releases it. Must be called with the
+ * cache lock held.
+ */
+static void dns_cache_free_entry(struct dns_cache_entry *entry)
+{
+	eb64_delete(&entry->node);
+	LIST_DEL(&entry->list);
+	dns_cache_count--;
+	free(entry);
+}
+
+/* Stores into the cache the <status> answer of <res> for its name and its
+ * preferred query type, with the <len> bytes of the raw response <data>. The
+ * answer is kept for <lifetime> milliseconds. It replaces the previous answer
+ * of the same name, if any, and the oldest entry is evicted if the cache is
+ * full. Nothing is done if the cache is disabled or the lifetime is null.
+ */
+static void dns_cache_store(struct dns_resolution *res, int status,
+                            const unsigned char *data, int len, unsigned int lifetime)
+{
+	struct dns_cache_entry *entry, *old;
+
+	if (!dns_cache_size || !lifetime || !res->hostname_dn ||
+	    res->hostname_dn_len > DNS_MAX_NAME_SIZE)
+		return;
+
+	entry = malloc(sizeof(*entry) + len);
+	if (!entry)
+		return;
+
+	entry->node.key   = dns_cache_key(res->hostname_dn, res->hostname_dn_len,
+	                                  res->prefered_query_type, entry->name);
+	entry->expire     = tick_add(now_ms, lifetime);
+	entry->status     = status;
+	entry->query_type = res->prefered_query_type;
+	entry->name_len   = res->hostname_dn_len;
+	entry->len        = len;
+	if (len)
+		memcpy(entry->data, data, len);
+
+	HA_SPIN_LOCK(DNS_CACHE_LOCK, &dns_cache_lock);
+	old = dns_cache_lookup(entry->node.key, entry->name, entry->name_len, entry->query_type);
+	if (old)
+		dns_cache_free_entry(old);
+	while (dns_cache_count >= dns_cache_size)
+		dns_cache_free_entry(LIST_NEXT(&dns_cache_list, struct dns_cache_entry *, list));
+	eb64_insert(&dns_cache_tree, &entry->node);
+	LIST_ADDQ(&dns_cache_list, &entry->list);
+	dns_cache_count++;
+	HA_SPIN_UNLOCK(DNS_CACHE_LOCK, &dns_cache_lock);
+}
+
+/* Returns the number of seconds the answers just received into <dns_p> may be
+ * cached for, which is the lowest TTL of these records, capped to
+ * DNS_CACHE_MAX_TTL. 0 is returned if they must not be cached.
+ */
+static unsigned int dns_response_min_ttl(struct dns_response_packet *dns_p)
+{
+	struct dns_answer_item *item;
+	unsigned int ttl = DNS_CACHE_MAX_TTL;
+	int found = 0;
+
+	list_for_each_entry(item, &dns_p->answer_list, list) {
+		/* older records not seen in this response are kept apart */
+		if (item->last_seen != now.tv_sec)
+			continue;
+		if (item->ttl <= 0)
+			return 0;
+		if (item->ttl < ttl)
+			ttl = item->ttl;
+		found = 1;
+	}
+	return found ? ttl : 0;
+}
+
 /* Opens an UDP socket on the namesaver's IP/Port, if required. Returns 0 on
  * success, -1 otherwise.
  */
@@ -278,28 +410,42 @@ static int dns_build_query(int query_id, int query_type, unsigned int accepted_p
 	return (p - buf);
 }
 
-/* Sends a DNS query to resolvers associated to a resolution. It returns 0 on
- * success, -1 otherwise.
+/* Queues the DNS query of a resolution so that it is sent to all the name
+ * servers of its resolvers section by the next call to dns_send_queries(),
+ * along with the other queued ones. It returns 0 on success, -1 otherwise.
  */
 static int dns_send_query(struct dns_resolution *resolution)
 {
 	struct dns_resolvers  *resolvers = resolution->resolvers;
-	struct dns_nameserver *ns;
-	int len;
 
 	/* Update resolution */
 	resolution->nb_queries   = 0;
 	resolution->nb_responses = 0;
 	resolution->last_query   = now_ms;
+	resolution->queued       = 1;
 
-	len = dns_build_query(resolution->query_id, resolution->query_type,
-	                      resolvers->accepted_payload_size,
-	                      resolution->hostname_dn, resolution->hostname_dn_len,
-	                      trash.area, trash.size);
+	/* Push the resolution at the end of the active list */
+	LIST_DEL(&resolution->list);
+	LIST_ADDQ(&resolvers->resolutions.curr, &resolution->list);
+	return 0;
+}
+
+/* Sends to all the name servers of <resolvers> the <nb> queries of <iov>
+ * built for the resolutions of <res>. Those which failed to be built have
+ * a null length and are reported as sending errors.
+ */
+static void dns_send_batch(struct dns_resolvers *resolvers, struct dns_resolution **res,
+                           struct iovec *iov, int nb)
+{
+	struct dns_nameserver *ns;
+	int i;
 
 	list_for_each_entry(ns, &resolvers->nameservers, list) {
 		int fd = ns->dgram->t.sock.fd;
 		int ret;
+#ifdef DNS_USE_SENDMMSG
+		int sent = 0;
+#endif
 
 		if (fd == -1) {
 			if (dns_connect_namesaver(ns) == -1)
@@ -308,31 +454,176 @@ static int dns_send_query(struct dns_resolution *resolution)
 			resolvers->nb_nameservers++;
 		}
 
-		if (len < 0)
-			goto snd_error;
+		for (i = 0; i < nb; i++) {
+			if (iov[i].iov_len)
+				continue;
+			ns->counters.snd_error++;
+			res[i]->nb_queries++;
+		}
 
-		ret = send(fd, trash.area, len, 0);
-		if (ret == len) {
-			ns->counters.sent++;
-			resolution->nb_queries++;
-			continue;
+#ifdef DNS_USE_SENDMMSG
+		{
+			struct mmsghdr msgs[DNS_SEND_BATCH];
+			int nbmsg = 0;
+
+			for (i = 0; i < nb; i++) {
+				if (!iov[i].iov_len)
+					continue;
+				memset(&msgs[nbmsg], 0, sizeof(msgs[nbmsg]));
+				msgs[nbmsg].msg_hdr.msg_iov = &iov[i];
+				msgs[nbmsg].msg_hdr.msg_iovlen = 1;
+				nbmsg++;
+			}
+			if (!nbmsg)
+				continue;
+
+			do {
+				ret = sendmmsg(fd, msgs, nbmsg, 0);
+			} while (ret < 0 && errno == EINTR);
+
+			if (ret < 0 && errno != EAGAIN)
+				sent = -1;
+			else if (ret > 0)
+				sent = ret;
+			if (sent >= 0 && sent < nbmsg) {
+				/* retry the other ones once the socket is ready */
+				fd_cant_send(fd);
+			}
 		}
+#endif
+		for (i = 0; i < nb; i++) {
+			if (!iov[i].iov_len)
+				continue;
+#ifdef DNS_USE_SENDMMSG
+			if (sent > 0) {
+				/* sent by sendmmsg() */
+				sent--;
+				ns->counters.sent++;
+				res[i]->nb_queries++;
+				continue;
+			}
+			if (!sent)
+				break;
+#else
+			ret = send(fd, iov[i].iov_base, iov[i].iov_len, 0);
+			if (ret == (int)iov[i].iov_len) {
+				ns->counters.sent++;
+				res[i]->nb_queries++;
+				continue;
+			}
 
-		if (ret == -1 && errno == EAGAIN) {
-			/* retry once the socket is ready */
-			fd_cant_send(fd);
+			if (ret == -1 && errno == EAGAIN) {
+				/* retry once the socket is ready */
+				fd_cant_send(fd);
+				break;
+			}
+#endif
+			ns->counters.snd_error++;
+			res[i]->nb_queries++;
+		}
+	}
+}
+
+/* Sends the queries queued by dns_send_query() for the resolutions of
+ * <resolvers>, by batches of DNS_SEND_BATCH queries per name server.
+ */
+static void dns_send_queries(struct dns_resolvers *resolvers)
+{
+	unsigned char buf[DNS_SEND_BATCH][DNS_MAX_QUERY_SIZE];
+	struct dns_resolution *batch[DNS_SEND_BATCH];
+	struct iovec iov[DNS_SEND_BATCH];
+	struct dns_resolution *res;
+	int nb = 0, len;
+
+	list_for_each_entry(res, &resolvers->resolutions.curr, list) {
+		if (!res->queued)
 			continue;
+		res->queued = 0;
+
+		len = dns_build_query(res->query_id, res->query_type,
+		                      resolvers->accepted_payload_size,
+		                      res->hostname_dn, res->hostname_dn_len,
+		                      (char *)buf[nb], sizeof(buf[nb]));
+		batch[nb] = res;
+		iov[nb].iov_base = buf[nb];
+		iov[nb].iov_len  = len < 0 ? 0 : len;
+		if (++nb == DNS_SEND_BATCH) {
+			dns_send_batch(resolvers, batch, iov, nb);
+			nb = 0;
 		}
+	}
+	if (nb)
+		dns_send_batch(resolvers, batch, iov, nb);
+}
 
-	snd_error:
-		ns->counters.snd_error++;
-		resolution->nb_queries++;
+/* Starts to send over TCP to <ns> the current query of <res>, whose response
+ * was truncated. The response is processed by dns_tcp_io_handler() once fully
+ * received. Returns 0 on success, -1 otherwise.
+ */
+static int dns_tcp_query_start(struct dns_resolution *res, struct dns_nameserver *ns)
+{
+	struct dns_tcp_query *tq;
+	int fd, len;
+
+	tq = pool_alloc(dns_tcp_query_pool);
+	if (!tq)
+		return -1;
+
+	tq->buf = malloc(DNS_MAX_TCP_MESSAGE + 2);
+	if (!tq->buf)
+		goto fail;
+
+	len = dns_build_query(res->query_id, res->query_type,
+	                      res->resolvers->accepted_payload_size,
+	                      res->hostname_dn, res->hostname_dn_len,
+	                      (char *)tq->buf + 2, DNS_MAX_QUERY_SIZE);
+	if (len < 0)
+		goto fail;
+	tq->buf[0] = len >> 8;
+	tq->buf[1] = len;
+
+	if ((fd = socket(ns->addr.ss_family, SOCK_STREAM, IPPROTO_TCP)) == -1)
+		goto fail;
+	if (fd >= global.maxsock) {
+		close(fd);
+		goto fail;
 	}
 
-	/* Push the resolution at the end of the active list */
-	LIST_DEL(&resolution->list);
-	LIST_ADDQ(&resolvers->resolutions.curr, &resolution->list);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	if (connect(fd, (struct sockaddr*)&ns->addr, get_addr_len(&ns->addr)) == -1 &&
+	    errno != EINPROGRESS) {
+		close(fd);
+		goto fail;
+	}
+
+	tq->ns      = ns;
+	tq->res     = res;
+	tq->fd      = fd;
+	tq->sending = 1;
+	tq->len     = len + 2;
+	tq->done    = 0;
+	LIST_ADDQ(&ns->tcp_queries, &tq->list);
+	res->tcp = tq;
+
+	fd_insert(fd, ns, dns_tcp_io_handler, MAX_THREADS_MASK);
+	fd_want_send(fd);
 	return 0;
+
+  fail:
+	free(tq->buf);
+	pool_free(dns_tcp_query_pool, tq);
+	return -1;
+}
+
+/* Aborts the TCP query <tq>, closing its connection, and releases it. */
+static void dns_tcp_query_free(struct dns_tcp_query *tq)
+{
+	LIST_DEL(&tq->list);
+	if (tq->res)
+		tq->res->tcp = NULL;
+	fd_delete(tq->fd);
+	free(tq->buf);
+	pool_free(dns_tcp_query_pool, tq);
 }
 
 /* Prepares and sends a DNS resolution. It returns 1 if the query was sent, 0 if
@@ -355,6 +646,10 @@ dns_run_resolution(struct dns_resolution *resolution)
 	if (resolution->step != RSLV_STEP_NONE)
 		return 0;
 
+	/* Don't query the name servers if the answer is already known */
+	if (dns_resolution_from_cache(resolution))
+		return 0;
+
 	/* Generates a new query id. We try at most 100 times to find a free
 	 * query id */
 	for (i = 0; i < 100; ++i) {
@@ -416,8 +711,13 @@ static void dns_reset_resolution(struct dns_resolution *resolution)
 	resolution->last_resolution = now_ms;
 	resolution->nb_queries      = 0;
 	resolution->nb_responses    = 0;
+	resolution->queued          = 0;
 	resolution->query_type      = resolution->prefered_query_type;
 
+	/* abort the TCP query in progress, if any */
+	if (resolution->tcp)
+		dns_tcp_query_free(resolution->tcp);
+
 	/* clean up query id */
 	eb32_delete(&resolution->qid);
 	resolution->query_id = 0;
@@ -1393,6 +1693,53 @@ int dns_get_ip_from_response(struct dns_response_packet *dns_p,
 	return DNS_UPD_SRVIP_NOT_FOUND;
 }
 
+/* Searches in <dns_p> an alternate address to connect to instead of <cur>,
+ * preferably of the other family as suggested by RFC8305. On success, it is
+ * copied to <alt> with a null port and 1 is returned. Otherwise <alt>'s family
+ * is set to AF_UNSPEC and 0 is returned. Like for dns_get_ip_from_response(),
+ * <dns_p> must have been validated first.
+ */
+int dns_get_alt_ip_from_response(struct dns_response_packet *dns_p,
+                                 const struct sockaddr_storage *cur,
+                                 struct sockaddr_storage *alt)
+{
+	struct dns_answer_item *record;
+	struct sockaddr_storage addr;
+	int found = 0;
+
+	memset(alt, 0, sizeof(*alt));
+
+	list_for_each_entry(record, &dns_p->answer_list, list) {
+		memset(&addr, 0, sizeof(addr));
+		if (record->type == DNS_RTYPE_A) {
+			addr.ss_family = AF_INET;
+			((struct sockaddr_in *)&addr)->sin_addr = ((struct sockaddr_in *)&record->address)->sin_addr;
+		}
+		else if (record->type == DNS_RTYPE_AAAA) {
+			addr.ss_family = AF_INET6;
+			((struct sockaddr_in6 *)&addr)->sin6_addr = ((struct sockaddr_in6 *)&record->address)->sin6_addr;
+		}
+		else
+			continue;
+
+		if (ipcmp(&addr, (struct sockaddr_storage *)cur) == 0)
+			continue;
+
+		if (addr.ss_family != cur->ss_family) {
+			/* the other family is the best choice */
+			*alt = addr;
+			return 1;
+		}
+
+		if (!found) {
+			/* same family, in case there's nothing better */
+			*alt = addr;
+			found = 1;
+		}
+	}
+	return found;
+}
+
 /* Turns a domain name label into a string.
  *
  * <dn> must be a null-terminated string. <dn_len> must include the terminating
@@ -1750,6 +2097,340 @@ void dns_unlink_resolution(struct dns_requester *requester)
 	}
 }
 
+/* Reports the <code> error of <res> to its requesters and moves it back to the
+ * wait list.
+ */
+static void dns_report_resolution_error(struct dns_resolution *res, int code)
+{
+	struct dns_requester *req;
+
+	list_for_each_entry(req, &res->requesters, list)
+		req->requester_error_cb(req, code);
+	dns_reset_resolution(res);
+	LIST_DEL(&res->list);
+	LIST_ADDQ(&res->resolvers->resolutions.wait, &res->list);
+}
+
+/* Reports the valid response of <res> received from <ns> to its requesters and
+ * moves it back to the wait list. <ns> is NULL if the response comes from the
+ * answers cache.
+ */
+static void dns_report_resolution_success(struct dns_resolution *res, struct dns_nameserver *ns)
+{
+	struct dns_requester *req;
+
+	/* Only the 1rst requester s managed by the server, others are
+	 * from the cache */
+	list_for_each_entry(req, &res->requesters, list) {
+		struct server *s = objt_server(req->owner);
+
+		if (s)
+			HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+		req->requester_cb(req, ns);
+		if (s)
+			HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+		ns = NULL;
+	}
+
+	dns_reset_resolution(res);
+	LIST_DEL(&res->list);
+	LIST_ADDQ(&res->resolvers->resolutions.wait, &res->list);
+}
+
+/* Serves <res> from the answers cache if a fresh answer is known for its name
+ * and its preferred query type. The requesters are notified the same way as
+ * if a name server responded. Returns 1 if it was served, 0 if the name
+ * servers have to be queried. Must be called with the resolvers lock held.
+ */
+static int dns_resolution_from_cache(struct dns_resolution *res)
+{
+	unsigned char buf[DNS_MAX_UDP_MESSAGE];
+	char lc[DNS_MAX_NAME_SIZE + 1];
+	struct dns_cache_entry *entry;
+	uint64_t key;
+	int status = RSLV_STATUS_NONE;
+	int len = 0;
+
+	if (!dns_cache_size || res->hostname_dn_len > DNS_MAX_NAME_SIZE)
+		return 0;
+
+	key = dns_cache_key(res->hostname_dn, res->hostname_dn_len, res->prefered_query_type, lc);
+
+	HA_SPIN_LOCK(DNS_CACHE_LOCK, &dns_cache_lock);
+	entry = dns_cache_lookup(key, lc, res->hostname_dn_len, res->prefered_query_type);
+	if (entry && tick_is_expired(entry->expire, now_ms)) {
+		dns_cache_free_entry(entry);
+		entry = NULL;
+	}
+	/* the response must also fit in what this resolvers section accepts */
+	if (entry && entry->len <= res->resolvers->accepted_payload_size) {
+		status = entry->status;
+		len    = entry->len;
+		memcpy(buf, entry->data, len);
+	}
+	HA_SPIN_UNLOCK(DNS_CACHE_LOCK, &dns_cache_lock);
+
+	if (status == RSLV_STATUS_NX) {
+		res->status = RSLV_STATUS_NX;
+		dns_report_resolution_error(res, DNS_RESP_NX_DOMAIN);
+		return 1;
+	}
+
+	if (status != RSLV_STATUS_VALID ||
+	    dns_validate_dns_response(buf, buf + len, res,
+	                              (res->resolvers->accepted_payload_size - DNS_HEADER_SIZE) / DNS_MIN_RECORD_SIZE) != DNS_RESP_VALID)
+		return 0;
+
+	res->status     = RSLV_STATUS_VALID;
+	res->last_valid = now_ms;
+	dns_report_resolution_success(res, NULL);
+	return 1;
+}
+
+/* Processes the <buflen> bytes DNS response <buf> received from <ns>, over
+ * TCP if <tcp> is set. The resolution it belongs to is looked up from the
+ * query ID and its requesters are notified of the result, unless more
+ * responses are expected. Must be called with the resolvers lock held.
+ */
+static void dns_handle_response(struct dns_nameserver *ns, unsigned char *buf, int buflen, int tcp)
+{
+	struct dns_resolvers  *resolvers = ns->resolvers;
+	struct dns_resolution *res;
+	struct dns_query_item *query;
+	unsigned char *bufend;
+	int dns_resp;
+	int max_answer_records;
+	unsigned short query_id;
+	struct eb32_node *eb;
+
+	/* initializing variables */
+	bufend = buf + buflen;	/* pointer to mark the end of the buffer */
+
+	/* read the query id from the packet (16 bits) */
+	if (buf + 2 > bufend) {
+		ns->counters.invalid++;
+		return;
+	}
+	query_id = dns_response_get_query_id(buf);
+
+	/* search the query_id in the pending resolution tree */
+	eb = eb32_lookup(&resolvers->query_ids, query_id);
+	if (eb == NULL) {
+		/* unknown query id means an outdated response and can be safely ignored */
+		ns->counters.outdated++;
+		return;
+	}
+
+	/* known query id means a resolution in progress */
+	res = eb32_entry(eb, struct dns_resolution, qid);
+
+	/* retry the truncated responses over TCP, including the SRV ones
+	 * which could only be partially exploited */
+	if (!tcp && resolvers->tcp_fallback && !res->tcp && buflen > 2 &&
+	    (buf[2] & (DNS_FLAG_TRUNCATED >> 8)) && dns_tcp_query_start(res, ns) == 0) {
+		ns->counters.tcp++;
+		return;
+	}
+
+	/* number of responses received */
+	res->nb_responses++;
+
+	max_answer_records = ((tcp ? buflen : resolvers->accepted_payload_size) - DNS_HEADER_SIZE) / DNS_MIN_RECORD_SIZE;
+	dns_resp = dns_validate_dns_response(buf, bufend, res, max_answer_records);
+
+	switch (dns_resp) {
+		case DNS_RESP_VALID:
+			break;
+
+		case DNS_RESP_INVALID:
+		case DNS_RESP_QUERY_COUNT_ERROR:
+		case DNS_RESP_WRONG_NAME:
+			res->status = RSLV_STATUS_INVALID;
+			ns->counters.invalid++;
+			break;
+
+		case DNS_RESP_NX_DOMAIN:
+			res->status = RSLV_STATUS_NX;
+			ns->counters.nx++;
+			break;
+
+		case DNS_RESP_REFUSED:
+			res->status = RSLV_STATUS_REFUSED;
+			ns->counters.refused++;
+			break;
+
+		case DNS_RESP_ANCOUNT_ZERO:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.any_err++;
+			break;
+
+		case DNS_RESP_CNAME_ERROR:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.cname_error++;
+			break;
+
+		case DNS_RESP_TRUNCATED:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.truncated++;
+			break;
+
+		case DNS_RESP_NO_EXPECTED_RECORD:
+		case DNS_RESP_ERROR:
+		case DNS_RESP_INTERNAL:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.other++;
+			break;
+	}
+
+	/* Wait all nameservers response to handle errors */
+	if (dns_resp != DNS_RESP_VALID && res->nb_responses < resolvers->nb_nameservers)
+		return;
+
+	/* Process error codes */
+	if (dns_resp != DNS_RESP_VALID)  {
+		if (res->prefered_query_type != res->query_type) {
+			/* The fallback on the query type was already performed,
+			 * so check the try counter. If it falls to 0, we can
+			 * report an error. Else, wait the next attempt. */
+			if (!res->try)
+				goto report_res_error;
+		}
+		else {
+			/* Fallback from A to AAAA or the opposite and re-send
+			 * the resolution immediately. try counter is not
+			 * decremented. */
+			if (res->prefered_query_type == DNS_RTYPE_A) {
+				res->query_type = DNS_RTYPE_AAAA;
+				dns_send_query(res);
+			}
+			else if (res->prefered_query_type == DNS_RTYPE_AAAA) {
+				res->query_type = DNS_RTYPE_A;
+				dns_send_query(res);
+			}
+		}
+		return;
+	}
+
+	/* Now let's check the query's dname corresponds to the one we
+	 * sent. We can check only the first query of the list. We send
+	 * one query at a time so we get one query in the response */
+	query = LIST_NEXT(&res->response.query_list, struct dns_query_item *, list);
+	if (query && dns_hostname_cmp(query->name, res->hostname_dn, res->hostname_dn_len) != 0) {
+		dns_resp = DNS_RESP_WRONG_NAME;
+		ns->counters.other++;
+		goto report_res_error;
+	}
+
+	/* So the resolution succeeded */
+	res->status     = RSLV_STATUS_VALID;
+	res->last_valid = now_ms;
+	ns->counters.valid++;
+	goto report_res_success;
+
+  report_res_error:
+	if (res->status == RSLV_STATUS_NX)
+		dns_cache_store(res, RSLV_STATUS_NX, NULL, 0, resolvers->hold.nx);
+	dns_report_resolution_error(res, dns_resp);
+	return;
+
+  report_res_success:
+	if (buflen <= resolvers->accepted_payload_size)
+		dns_cache_store(res, RSLV_STATUS_VALID, buf, buflen,
+		                dns_response_min_ttl(&res->response) * 1000);
+	dns_report_resolution_success(res, ns);
+}
+
+/* I/O handler of the TCP connections of the queries retried after a truncated
+ * response. The query is sent once the connection is established, then the
+ * response is received and processed as a UDP one would be.
+ */
+static void dns_tcp_io_handler(int fd)
+{
+	struct dns_nameserver *ns = fdtab[fd].owner;
+	struct dns_resolvers  *resolvers = ns->resolvers;
+	struct dns_tcp_query  *tq;
+	unsigned char *buf;
+	int ret, len;
+
+	HA_SPIN_LOCK(DNS_LOCK, &resolvers->lock);
+
+	list_for_each_entry(tq, &ns->tcp_queries, list) {
+		if (tq->fd == fd)
+			goto found;
+	}
+	/* the query was aborted in the mean time */
+	goto out;
+
+  found:
+	if (tq->sending) {
+		if (!fd_send_ready(fd))
+			goto out;
+
+		while (tq->done < tq->len) {
+			ret = send(fd, tq->buf + tq->done, tq->len - tq->done, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (ret > 0) {
+				tq->done += ret;
+				continue;
+			}
+			if (ret == -1 && errno == EAGAIN) {
+				fd_cant_send(fd);
+				goto out;
+			}
+			goto error;
+		}
+
+		/* the query was sent, wait for the length of the response */
+		tq->sending = 0;
+		tq->done    = 0;
+		tq->len     = 2;
+		fd_stop_send(fd);
+		fd_want_recv(fd);
+	}
+
+	if (!fd_recv_ready(fd))
+		goto out;
+
+	while (tq->done < tq->len) {
+		ret = recv(fd, tq->buf + tq->done, tq->len - tq->done, 0);
+		if (ret > 0) {
+			tq->done += ret;
+			if (tq->done == 2 && tq->len == 2) {
+				tq->len += tq->buf[0] * 256 + tq->buf[1];
+				if (tq->len < 2 + DNS_HEADER_SIZE)
+					goto error;
+			}
+			continue;
+		}
+		if (ret == -1 && errno == EAGAIN) {
+			fd_cant_recv(fd);
+			goto out;
+		}
+		/* connection closed or error */
+		goto error;
+	}
+
+	/* The response is complete. The query is released first since the
+	 * resolution may be reset or freed while processing it.
+	 */
+	buf = tq->buf;
+	len = tq->len - 2;
+	tq->buf = NULL;
+	dns_tcp_query_free(tq);
+
+	dns_handle_response(ns, buf + 2, len, 1);
+	free(buf);
+	dns_send_queries(resolvers);
+	dns_update_resolvers_timeout(resolvers);
+	goto out;
+
+  error:
+	/* the resolution will be retried once its timeout expires */
+	ns->counters.other++;
+	dns_tcp_query_free(tq);
+  out:
+	HA_SPIN_UNLOCK(DNS_LOCK, &resolvers->lock);
+}
+
 /* Called when a network IO is generated on a name server socket for an incoming
  * packet. It performs the following actions:
  *  - check if the packet requires processing (not outdated resolution)
@@ -1759,17 +2440,10 @@ void dns_unlink_resolution(struct dns_requester *requester)
  */
 static void dns_resolve_recv(struct dgram_conn *dgram)
 {
-	struct dns_nameserver *ns, *tmpns;
+	struct dns_nameserver *ns;
 	struct dns_resolvers  *resolvers;
-	struct dns_resolution *res;
-	struct dns_query_item *query;
 	unsigned char  buf[DNS_MAX_UDP_MESSAGE + 1];
-	unsigned char *bufend;
-	int fd, buflen, dns_resp;
-	int max_answer_records;
-	unsigned short query_id;
-	struct eb32_node *eb;
-	struct dns_requester *req;
+	int fd, buflen;
 
 	fd = dgram->t.sock.fd;
 
@@ -1807,149 +2481,9 @@ static void dns_resolve_recv(struct dgram_conn *dgram)
 			continue;
 		}
 
-		/* initializing variables */
-		bufend = buf + buflen;	/* pointer to mark the end of the buffer */
-
-		/* read the query id from the packet (16 bits) */
-		if (buf + 2 > bufend) {
-			ns->counters.invalid++;
-			continue;
-		}
-		query_id = dns_response_get_query_id(buf);
-
-		/* search the query_id in the pending resolution tree */
-		eb = eb32_lookup(&resolvers->query_ids, query_id);
-		if (eb == NULL) {
-			/* unknown query id means an outdated response and can be safely ignored */
-			ns->counters.outdated++;
-			continue;
-		}
-
-		/* known query id means a resolution in progress */
-		res = eb32_entry(eb, struct dns_resolution, qid);
-		/* number of responses received */
-		res->nb_responses++;
-
-		max_answer_records = (resolvers->accepted_payload_size - DNS_HEADER_SIZE) / DNS_MIN_RECORD_SIZE;
-		dns_resp = dns_validate_dns_response(buf, bufend, res, max_answer_records);
-
-		switch (dns_resp) {
-			case DNS_RESP_VALID:
-				break;
-
-			case DNS_RESP_INVALID:
-			case DNS_RESP_QUERY_COUNT_ERROR:
-			case DNS_RESP_WRONG_NAME:
-				res->status = RSLV_STATUS_INVALID;
-				ns->counters.invalid++;
-				break;
-
-			case DNS_RESP_NX_DOMAIN:
-				res->status = RSLV_STATUS_NX;
-				ns->counters.nx++;
-				break;
-
-			case DNS_RESP_REFUSED:
-				res->status = RSLV_STATUS_REFUSED;
-				ns->counters.refused++;
-				break;
-
-			case DNS_RESP_ANCOUNT_ZERO:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.any_err++;
-				break;
-
-			case DNS_RESP_CNAME_ERROR:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.cname_error++;
-				break;
-
-			case DNS_RESP_TRUNCATED:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.truncated++;
-				break;
-
-			case DNS_RESP_NO_EXPECTED_RECORD:
-			case DNS_RESP_ERROR:
-			case DNS_RESP_INTERNAL:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.other++;
-				break;
-		}
-
-		/* Wait all nameservers response to handle errors */
-		if (dns_resp != DNS_RESP_VALID && res->nb_responses < resolvers->nb_nameservers)
-			continue;
-
-		/* Process error codes */
-		if (dns_resp != DNS_RESP_VALID)  {
-			if (res->prefered_query_type != res->query_type) {
-				/* The fallback on the query type was already performed,
-				 * so check the try counter. If it falls to 0, we can
-				 * report an error. Else, wait the next attempt. */
-				if (!res->try)
-					goto report_res_error;
-			}
-			else {
-				/* Fallback from A to AAAA or the opposite and re-send
-				 * the resolution immediately. try counter is not
-				 * decremented. */
-				if (res->prefered_query_type == DNS_RTYPE_A) {
-					res->query_type = DNS_RTYPE_AAAA;
-					dns_send_query(res);
-				}
-				else if (res->prefered_query_type == DNS_RTYPE_AAAA) {
-					res->query_type = DNS_RTYPE_A;
-					dns_send_query(res);
-				}
-			}
-			continue;
-		}
-
-		/* Now let's check the query's dname corresponds to the one we
-		 * sent. We can check only the first query of the list. We send
-		 * one query at a time so we get one query in the response */
-		query = LIST_NEXT(&res->response.query_list, struct dns_query_item *, list);
-		if (query && dns_hostname_cmp(query->name, res->hostname_dn, res->hostname_dn_len) != 0) {
-			dns_resp = DNS_RESP_WRONG_NAME;
-			ns->counters.other++;
-			goto report_res_error;
-		}
-
-		/* So the resolution succeeded */
-		res->status     = RSLV_STATUS_VALID;
-		res->last_valid = now_ms;
-		ns->counters.valid++;
-		goto report_res_success;
-
-	report_res_error:
-		list_for_each_entry(req, &res->requesters, list)
-			req->requester_error_cb(req, dns_resp);
-		dns_reset_resolution(res);
-		LIST_DEL(&res->list);
-		LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
-		continue;
-
-	report_res_success:
-		/* Only the 1rst requester s managed by the server, others are
-		 * from the cache */
-		tmpns = ns;
-		list_for_each_entry(req, &res->requesters, list) {
-			struct server *s = objt_server(req->owner);
-
-			if (s)
-				HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
-			req->requester_cb(req, tmpns);
-			if (s)
-				HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
-			tmpns = NULL;
-		}
-
-		dns_reset_resolution(res);
-		LIST_DEL(&res->list);
-		LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
-		continue;
+		dns_handle_response(ns, buf, buflen, 0);
 	}
+	dns_send_queries(resolvers);
 	dns_update_resolvers_timeout(resolvers);
 	HA_SPIN_UNLOCK(DNS_LOCK, &resolvers->lock);
 }
@@ -2041,6 +2575,8 @@ static struct task *dns_process_resolvers(struct task *t, void *context, unsigne
 			/* Notify the result to the requesters */
 			if (!res->nb_responses)
 				res->status = RSLV_STATUS_TIMEOUT;
+			else if (res->status == RSLV_STATUS_NX)
+				dns_cache_store(res, RSLV_STATUS_NX, NULL, 0, resolvers->hold.nx);
 			list_for_each_entry(req, &res->requesters, list)
 				req->requester_error_cb(req, res->status);
 
@@ -2085,6 +2621,7 @@ static struct task *dns_process_resolvers(struct task *t, void *context, unsigne
 		}
 	}
 
+	dns_send_queries(resolvers);
 	dns_update_resolvers_timeout(resolvers);
 	HA_SPIN_UNLOCK(DNS_LOCK, &resolvers->lock);
 	return t;
@@ -2104,9 +2641,17 @@ static void dns_deinit(void)
 	struct dns_resolution *res, *resback;
 	struct dns_requester  *req, *reqback;
 	struct dns_srvrq      *srvrq, *srvrqback;
+	struct dns_cache_entry *entry, *entryback;
+
+	list_for_each_entry_safe(entry, entryback, &dns_cache_list, list)
+		dns_cache_free_entry(entry);
 
 	list_for_each_entry_safe(resolvers, resolversback, &dns_resolvers, list) {
 		list_for_each_entry_safe(ns, nsback, &resolvers->nameservers, list) {
+			struct dns_tcp_query *tq, *tqback;
+
+			list_for_each_entry_safe(tq, tqback, &ns->tcp_queries, list)
+				dns_tcp_query_free(tq);
 			free(ns->id);
 			free((char *)ns->conf.file);
 			if (ns->dgram && ns->dgram->t.sock.fd != -1)
@@ -2321,6 +2866,7 @@ static int cli_io_handler_dump_resolvers_to_buffer(struct appctx *appctx)
 					chunk_appendf(&trash, "  invalid:     %lld\n", ns->counters.invalid);
 					chunk_appendf(&trash, "  too_big:     %lld\n", ns->counters.too_big);
 					chunk_appendf(&trash, "  truncated:   %lld\n", ns->counters.truncated);
+					chunk_appendf(&trash, "  tcp:         %lld\n", ns->counters.tcp);
 					chunk_appendf(&trash, "  outdated:    %lld\n",  ns->counters.outdated);
 				}
 				chunk_appendf(&trash, "\n");
@@ -2611,6 +3157,31 @@ enum act_parse_ret dns_parse_do_resolve(const char **args, int *orig_arg, struct
 	return ACT_RET_PRS_ERR;
 }
 
+/* config parser for global "tune.dns.cache-size" */
+static int dns_parse_cache_size(char **args, int section_type, struct proxy *curpx,
+                                struct proxy *defpx, const char *file, int line,
+                                char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	dns_cache_size = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-') {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.dns.cache-size", dns_parse_cache_size },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 static struct action_kw_list http_req_kws = { { }, {
 	{ "do-resolve", dns_parse_do_resolve, 1 },
 	{ /* END */ }
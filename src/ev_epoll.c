@@ -181,7 +181,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 	tv_entering_poll();
 	activity_count_runtime();
 	do {
-		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
+		int timeout = poll_busy_timeout(wait_time);
 
 		status = epoll_wait(epoll_fd[tid], epoll_events, global.tune.maxpollevents, timeout);
 		tv_update_date(timeout, status);
@@ -153,7 +153,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 	activity_count_runtime();
 
 	do {
-		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
+		int timeout = poll_busy_timeout(wait_time);
 
 		timeout_ts.tv_sec  = (timeout / 1000);
 		timeout_ts.tv_nsec = (timeout % 1000) * 1000000;
@@ -0,0 +1,637 @@
+/*
+ * FD polling functions for Linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * This poller uses the raw io_uring system calls so that it does not depend on
+ * liburing. Each thread owns a ring on which every polled FD has a single
+ * multishot poll request whose user_data is the FD itself. The polling changes
+ * are queued as submission entries by _update_fd() and are all submitted at
+ * once by the io_uring_enter() call which also waits for the completions, so
+ * that there is no more one system call per FD update as with epoll_ctl().
+ * It requires Linux 5.13 for the multishot poll requests and their update.
+ */
+
+#define _GNU_SOURCE  // for POLLRDHUP on Linux
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/debug.h>
+#include <common/hathreads.h>
+#include <common/standard.h>
+#include <common/ticks.h>
+#include <common/time.h>
+#include <common/tools.h>
+
+#include <types/global.h>
+
+#include <proto/activity.h>
+#include <proto/fd.h>
+#include <proto/signal.h>
+
+#ifndef POLLRDHUP
+/* POLLRDHUP was defined late in libc, and it appeared in kernel 2.6.17 */
+#define POLLRDHUP 0x2000
+#endif
+
+/* The user_data of the submission entries other than the poll requests carry
+ * one of these flags above the FD so that their completions may be told apart.
+ */
+#define URING_UD_UPDT    (1ULL << 62)  /* update of the events of a poll request */
+#define URING_UD_DEL     (1ULL << 63)  /* poll request removal */
+#define URING_UD_FD      0xffffffffULL /* the FD part of the user_data */
+
+/* Maximum number of completion entries of a ring. The kernel keeps the
+ * completions which do not fit, so this only avoids too large rings.
+ */
+#define URING_MAX_CQ     32768
+
+/* per-thread io_uring ring, mapped from the kernel */
+struct uring {
+	int fd;                             /* ring FD, -1 if none */
+	__decl_hathreads(HA_SPINLOCK_T lock); /* protects the submission queue */
+	unsigned int sq_tail;               /* our copy of *sq.tail */
+	unsigned int sq_mask;
+	unsigned int *sq_head;              /* advanced by the kernel */
+	unsigned int *sq_ktail;             /* advanced by us */
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int cq_mask;
+	unsigned int *cq_head;              /* advanced by us */
+	unsigned int *cq_tail;              /* advanced by the kernel */
+	struct io_uring_cqe *cqes;
+	void *ring_ptr;                     /* SQ and CQ rings (single mmap) */
+	size_t ring_sz;
+	size_t sqes_sz;
+};
+
+/* private data */
+static struct uring uring[MAX_THREADS]; // per-thread ring
+
+static inline int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                              unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Returns the number of submission entries of <r> not consumed by the kernel
+ * yet.
+ */
+static inline unsigned int uring_sq_pending(struct uring *r)
+{
+	unsigned int head = *(volatile unsigned int *)r->sq_head;
+
+	__ha_barrier_load();
+	return r->sq_tail - head;
+}
+
+/* Queues into the ring of <r> a submission entry with <opcode> for <fd> polled
+ * for <events>. <addr> and <len> are set as is. The entry is submitted with the
+ * next io_uring_enter() call, which is performed right now if the submission
+ * queue is full. If the kernel refuses to take the pending entries, the new one
+ * is lost as would be a failed epoll_ctl().
+ */
+static void uring_queue(struct uring *r, int opcode, int fd, unsigned int events,
+                        uint64_t addr, unsigned int len, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+	while (uring_sq_pending(r) > r->sq_mask) {
+		if (uring_enter(r->fd, r->sq_mask + 1, 0, 0, NULL, 0) < 0 && errno != EINTR) {
+			HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+			return;
+		}
+	}
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	/* the two halves of poll32_events are swapped on big endian */
+	events = (events << 16) | (events >> 16);
+#endif
+	idx = r->sq_tail & r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+	sqe->len = len;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+	r->sq_array[idx] = idx;
+	r->sq_tail++;
+	__ha_barrier_store();
+	*(volatile unsigned int *)r->sq_ktail = r->sq_tail;
+	HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+}
+
+/* Queues a new multishot poll request on <fd> for <events>. */
+static inline void uring_poll_add(struct uring *r, int fd, unsigned int events)
+{
+	uring_queue(r, IORING_OP_POLL_ADD, fd, events, 0, IORING_POLL_ADD_MULTI, fd);
+}
+
+/* Changes the events of the poll request on <fd> to <events>. */
+static inline void uring_poll_mod(struct uring *r, int fd, unsigned int events)
+{
+	uring_queue(r, IORING_OP_POLL_REMOVE, -1, events, fd,
+	            IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI, fd | URING_UD_UPDT);
+}
+
+/* Cancels the poll request on <fd>. */
+static inline void uring_poll_del(struct uring *r, int fd)
+{
+	uring_queue(r, IORING_OP_POLL_REMOVE, -1, 0, fd, 0, fd | URING_UD_DEL);
+}
+
+/*
+ * Immediately remove file descriptor from the rings upon close. Contrary to
+ * epoll, a pending poll request holds a reference on the file, which would
+ * not be released by close(), so it must always be cancelled, and right now
+ * for the other threads which may be waiting for a while in their poller.
+ */
+static void __fd_clo(int fd)
+{
+	unsigned long m = polled_mask[fd].poll_recv | polled_mask[fd].poll_send;
+	int i;
+
+	for (i = global.nbthread - 1; i >= 0; i--) {
+		if (!(m & (1UL << i)))
+			continue;
+		uring_poll_del(&uring[i], fd);
+		if (i != tid)
+			uring_enter(uring[i].fd, uring_sq_pending(&uring[i]), 0, 0, NULL, 0);
+	}
+}
+
+/* Forgets about the poll request of the current thread on <fd> which does not
+ * exist anymore, and makes sure a new one will be armed if needed.
+ */
+static void uring_poll_lost(int fd)
+{
+	if (!((polled_mask[fd].poll_recv | polled_mask[fd].poll_send) & tid_bit))
+		return;
+	_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~tid_bit);
+	_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~tid_bit);
+	if (fdtab[fd].owner)
+		updt_fd_polling(fd);
+}
+
+static void _update_fd(int fd)
+{
+	int en, opcode;
+	unsigned int events = 0;
+
+	en = fdtab[fd].state;
+
+	/* if we're already polling or are going to poll for this FD and it's
+	 * neither active nor ready, force it to be active so that we don't
+	 * needlessly unsubscribe then re-subscribe it.
+	 */
+	if (!(en & FD_EV_READY_R) &&
+	    ((en & FD_EV_ACTIVE_W) ||
+	     ((polled_mask[fd].poll_send | polled_mask[fd].poll_recv) & tid_bit)))
+		en |= FD_EV_ACTIVE_R;
+
+	if ((polled_mask[fd].poll_send | polled_mask[fd].poll_recv) & tid_bit) {
+		if (!(fdtab[fd].thread_mask & tid_bit) || !(en & FD_EV_ACTIVE_RW)) {
+			/* fd removed from poll list */
+			opcode = IORING_OP_POLL_REMOVE;
+			if (polled_mask[fd].poll_recv & tid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~tid_bit);
+			if (polled_mask[fd].poll_send & tid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~tid_bit);
+		}
+		else {
+			if (((en & FD_EV_ACTIVE_R) != 0) ==
+			    ((polled_mask[fd].poll_recv & tid_bit) != 0) &&
+			    ((en & FD_EV_ACTIVE_W) != 0) ==
+			    ((polled_mask[fd].poll_send & tid_bit) != 0))
+				return;
+			if (en & FD_EV_ACTIVE_R) {
+				if (!(polled_mask[fd].poll_recv & tid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, tid_bit);
+			} else {
+				if (polled_mask[fd].poll_recv & tid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~tid_bit);
+			}
+			if (en & FD_EV_ACTIVE_W) {
+				if (!(polled_mask[fd].poll_send & tid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_send, tid_bit);
+			} else {
+				if (polled_mask[fd].poll_send & tid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~tid_bit);
+			}
+			/* fd status changed */
+			opcode = -1;
+		}
+	}
+	else if ((fdtab[fd].thread_mask & tid_bit) && (en & FD_EV_ACTIVE_RW)) {
+		/* new fd in the poll list */
+		opcode = IORING_OP_POLL_ADD;
+		if (en & FD_EV_ACTIVE_R)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, tid_bit);
+		if (en & FD_EV_ACTIVE_W)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_send, tid_bit);
+	}
+	else {
+		return;
+	}
+
+	if (opcode == IORING_OP_POLL_REMOVE) {
+		uring_poll_del(&uring[tid], fd);
+		return;
+	}
+
+	/* construct the poll events based on new state */
+	if (en & FD_EV_ACTIVE_R)
+		events |= POLLIN | POLLRDHUP;
+
+	if (en & FD_EV_ACTIVE_W)
+		events |= POLLOUT;
+
+	if (opcode == IORING_OP_POLL_ADD)
+		uring_poll_add(&uring[tid], fd, events);
+	else
+		uring_poll_mod(&uring[tid], fd, events);
+}
+
+/* Processes the completion entry <cqe> of the current thread's ring. Returns
+ * non-zero if it reported events for an FD.
+ */
+static int uring_process_cqe(const struct io_uring_cqe *cqe)
+{
+	int fd = cqe->user_data & URING_UD_FD;
+	unsigned int n, e;
+
+	if (cqe->user_data & URING_UD_DEL)
+		return 0;
+
+	if (cqe->user_data & URING_UD_UPDT) {
+		/* the poll request ended before we could update it */
+		if (cqe->res == -ENOENT)
+			uring_poll_lost(fd);
+		return 0;
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE) && cqe->res != -ECANCELED) {
+		/* the kernel stopped this multishot request (error, overflow) */
+		uring_poll_lost(fd);
+	}
+
+	if (cqe->res <= 0)
+		return 0;
+
+	if (!fdtab[fd].owner) {
+		activity[tid].poll_dead++;
+		return 0;
+	}
+
+	if (!(fdtab[fd].thread_mask & tid_bit)) {
+		/* FD has been migrated */
+		activity[tid].poll_skip++;
+		if ((polled_mask[fd].poll_recv | polled_mask[fd].poll_send) & tid_bit)
+			uring_poll_del(&uring[tid], fd);
+		_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~tid_bit);
+		_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~tid_bit);
+		return 0;
+	}
+
+	e = cqe->res;
+	n = ((e & POLLIN)    ? FD_EV_READY_R : 0) |
+	    ((e & POLLOUT)   ? FD_EV_READY_W : 0) |
+	    ((e & POLLRDHUP) ? FD_EV_SHUT_R  : 0) |
+	    ((e & POLLHUP)   ? FD_EV_SHUT_RW : 0) |
+	    ((e & POLLERR)   ? FD_EV_ERR_RW  : 0);
+
+	if ((e & POLLRDHUP) && !(cur_poller.flags & HAP_POLL_F_RDHUP))
+		_HA_ATOMIC_OR(&cur_poller.flags, HAP_POLL_F_RDHUP);
+
+	fd_update_events(fd, n);
+	return 1;
+}
+
+/*
+ * Linux io_uring() poller
+ */
+static void _do_poll(struct poller *p, int exp, int wake)
+{
+	struct uring *r = &uring[tid];
+	int status;
+	int fd;
+	int updt_idx;
+	int wait_time;
+	int old_fd;
+	unsigned int head, tail;
+
+	/* first, scan the update list to find polling changes */
+	for (updt_idx = 0; updt_idx < fd_nbupdt; updt_idx++) {
+		fd = fd_updt[updt_idx];
+
+		_HA_ATOMIC_AND(&fdtab[fd].update_mask, ~tid_bit);
+		if (!fdtab[fd].owner) {
+			activity[tid].poll_drop++;
+			continue;
+		}
+
+		_update_fd(fd);
+	}
+	fd_nbupdt = 0;
+	/* Scan the global update list */
+	for (old_fd = fd = update_list.first; fd != -1; fd = fdtab[fd].update.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		}
+		else if (fd <= -3)
+			fd = -fd -4;
+		if (fd == -1)
+			break;
+		if (fdtab[fd].update_mask & tid_bit)
+			done_update_polling(fd);
+		else
+			continue;
+		if (!fdtab[fd].owner)
+			continue;
+		_update_fd(fd);
+	}
+
+	thread_harmless_now();
+
+	/* now let's submit the updates and wait for polled events */
+	wait_time = wake ? 0 : compute_poll_timeout(exp);
+	tv_entering_poll();
+	activity_count_runtime();
+	do {
+		int timeout = poll_busy_timeout(wait_time);
+		struct __kernel_timespec ts = {
+			.tv_sec  = timeout / 1000,
+			.tv_nsec = (timeout % 1000) * 1000000,
+		};
+		struct io_uring_getevents_arg arg = {
+			.ts = (unsigned long)&ts,
+		};
+
+		unsigned int pending = uring_sq_pending(r);
+
+		head = *r->cq_head;
+		tail = *(volatile unsigned int *)r->cq_tail;
+		if (tail == head || pending) {
+			/* a single call submits all the updates and waits */
+			uring_enter(r->fd, pending, (tail == head && timeout) ? 1 : 0,
+			            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			            &arg, sizeof(arg));
+			tail = *(volatile unsigned int *)r->cq_tail;
+		}
+		__ha_barrier_load();
+		status = tail - head;
+		tv_update_date(timeout, status);
+
+		if (status)
+			break;
+		if (timeout || !wait_time)
+			break;
+		if (signal_queue_len || wake)
+			break;
+		if (tick_isset(exp) && tick_is_expired(exp, now_ms))
+			break;
+	} while (1);
+
+	tv_leaving_poll(wait_time, status);
+
+	thread_harmless_end();
+	if (sleeping_thread_mask & tid_bit)
+		_HA_ATOMIC_AND(&sleeping_thread_mask, ~tid_bit);
+
+	/* process polled events */
+
+	for (; head != tail; head++)
+		uring_process_cqe(&r->cqes[head & r->cq_mask]);
+
+	__ha_barrier_store();
+	*(volatile unsigned int *)r->cq_head = head;
+
+	/* the caller will take care of cached events */
+}
+
+/* Releases the ring of <r>, if any. */
+static void uring_release(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->ring_ptr)
+		munmap(r->ring_ptr, r->ring_sz);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->sqes = NULL;
+	r->ring_ptr = NULL;
+	r->fd = -1;
+}
+
+/* Creates for <r> a ring able to queue the updates of a poller loop, and
+ * maps it. Returns 1 if OK, otherwise 0.
+ */
+static int uring_init(struct uring *r)
+{
+	struct io_uring_params p;
+	unsigned int entries = global.tune.maxpollevents;
+	size_t sq_sz, cq_sz;
+	char *ptr;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = global.maxsock;
+	if (p.cq_entries > URING_MAX_CQ)
+		p.cq_entries = URING_MAX_CQ;
+	if (p.cq_entries < 4 * entries)
+		p.cq_entries = 4 * entries;
+
+	r->fd = uring_setup(entries, &p);
+	if (r->fd < 0)
+		goto fail;
+
+	/* multishot poll requests and their updates appeared with 5.13, which
+	 * is also the first version featuring RSRC_TAGS.
+	 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_RSRC_TAGS))
+		goto fail;
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+	ptr = mmap(NULL, r->ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	           r->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->ring_ptr = ptr;
+
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	               r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_head  = (unsigned int *)(ptr + p.sq_off.head);
+	r->sq_ktail = (unsigned int *)(ptr + p.sq_off.tail);
+	r->sq_mask  = *(unsigned int *)(ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(ptr + p.sq_off.array);
+	r->sq_tail  = *r->sq_ktail;
+	r->cq_head  = (unsigned int *)(ptr + p.cq_off.head);
+	r->cq_tail  = (unsigned int *)(ptr + p.cq_off.tail);
+	r->cq_mask  = *(unsigned int *)(ptr + p.cq_off.ring_mask);
+	r->cqes     = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+	HA_SPIN_INIT(&r->lock);
+	return 1;
+
+ fail:
+	uring_release(r);
+	return 0;
+}
+
+static int init_uring_per_thread()
+{
+	int fd;
+
+	if (MAX_THREADS > 1 && tid) {
+		if (!uring_init(&uring[tid]))
+			return 0;
+	}
+
+	/* we may have to unregister some events initially registered on the
+	 * original ring when it was alone, and/or to register events on the
+	 * new ring for this thread. Let's just mark them as updated, the
+	 * poller will do the rest.
+	 */
+	for (fd = 0; fd < global.maxsock; fd++)
+		updt_fd_polling(fd);
+
+	return 1;
+}
+
+static void deinit_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid)
+		uring_release(&uring[tid]);
+}
+
+/*
+ * Initialization of the io_uring() poller.
+ * Returns 0 in case of failure, non-zero in case of success. If it fails, it
+ * disables the poller by setting its pref to 0.
+ */
+static int _do_init(struct poller *p)
+{
+	p->private = NULL;
+
+	if (!uring_init(&uring[tid]))
+		goto fail_fd;
+
+	hap_register_per_thread_init(init_uring_per_thread);
+	hap_register_per_thread_deinit(deinit_uring_per_thread);
+
+	return 1;
+
+ fail_fd:
+	p->pref = 0;
+	return 0;
+}
+
+/*
+ * Termination of the io_uring() poller.
+ * Memory is released and the poller is marked as unselectable.
+ */
+static void _do_term(struct poller *p)
+{
+	uring_release(&uring[tid]);
+
+	p->private = NULL;
+	p->pref = 0;
+}
+
+/*
+ * Check that the poller works, and that the kernel supports the multishot
+ * poll requests. Returns 1 if OK, otherwise 0.
+ */
+static int _do_test(struct poller *p)
+{
+	struct uring r = { .fd = -1 };
+
+	if (!uring_init(&r))
+		return 0;
+	uring_release(&r);
+	return 1;
+}
+
+/*
+ * Recreate the ring after a fork(). Returns 1 if OK, otherwise 0. It will
+ * ensure that all processes will not share their rings.
+ */
+static int _do_fork(struct poller *p)
+{
+	uring_release(&uring[tid]);
+	return uring_init(&uring[tid]);
+}
+
+/*
+ * It is a constructor, which means that it will automatically be called before
+ * main(). This is GCC-specific but it works at least since 2.95.
+ * Special care must be taken so that it does not need any uninitialized data.
+ */
+__attribute__((constructor))
+static void _do_register(void)
+{
+	struct poller *p;
+	int i;
+
+	if (nbpollers >= MAX_POLLERS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		uring[i].fd = -1;
+
+	p = &pollers[nbpollers++];
+
+	p->name = "uring";
+	p->pref = 350;
+	p->flags = HAP_POLL_F_ERRHUP; // note: RDHUP might be dynamically added
+	p->private = NULL;
+
+	p->clo  = __fd_clo;
+	p->test = _do_test;
+	p->init = _do_init;
+	p->term = _do_term;
+	p->poll = _do_poll;
+	p->fork = _do_fork;
+}
+
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -10,12 +10,17 @@
  *
  */
 
+#include <pthread.h>
+#include <signal.h>
+
 #include <common/buffer.h>
 #include <common/cfgparse.h>
+#include <common/hathreads.h>
 #include <common/htx.h>
 #include <common/initcall.h>
 #include <common/mini-clist.h>
 #include <common/standard.h>
+#include <common/time.h>
 
 #include <types/compression.h>
 #include <types/filters.h>
@@ -26,20 +31,68 @@
 #include <proto/filters.h>
 #include <proto/http_htx.h>
 #include <proto/http_ana.h>
+#include <proto/log.h>
 #include <proto/sample.h>
 #include <proto/stream.h>
+#include <proto/task.h>
 
 const char *http_comp_flt_id = "compression filter";
 
 struct flt_ops comp_ops;
 
+struct comp_job;
+
 struct comp_state {
 	struct comp_ctx  *comp_ctx;   /* compression context */
 	struct comp_algo *comp_algo;  /* compression algorithm if not NULL */
+	struct comp_job  *job;        /* chunk being compressed by a compression thread */
+};
+
+/* A chunk of a response compressed by a compression thread. The stream does
+ * not touch the compression context until the job is done, and the context is
+ * released with the job if the stream leaves before this happens.
+ */
+struct comp_job {
+	struct list list;              /* entry in comp_offload_queue */
+	struct mt_list done_list;      /* entry in the done list of the owner thread */
+	struct comp_algo *algo;        /* algorithm of <ctx> */
+	struct comp_ctx *ctx;          /* compression context, NULL once given back */
+	struct task *task;             /* stream to wake up, NULL if it left */
+	struct buffer in;              /* copy of the data to compress */
+	struct buffer out;             /* compressed data */
+	struct timeval now;            /* date of the owner thread for the rate checks */
+	int ret;                       /* input data consumed, -1 on error */
+	int thr;                       /* owner thread */
+	int done;                      /* set by the owner thread once the result is usable */
+};
+
+/* Per-thread list of the jobs done by the compression threads */
+struct comp_offload_thr {
+	struct mt_list done;
+	struct tasklet *tasklet;
 };
 
 /* Pools used to allocate comp_state structs */
 DECLARE_STATIC_POOL(pool_head_comp_state, "comp_state", sizeof(struct comp_state));
+DECLARE_STATIC_POOL(pool_head_comp_job, "comp_job", sizeof(struct comp_job));
+
+/* maximum number of jobs a compression thread dequeues at once */
+#define COMP_OFFLOAD_BATCH 16
+
+/* maximum number of queued jobs per compression thread, above which the data
+ * are compressed by the stream's thread.
+ */
+#define COMP_OFFLOAD_MAX_QUEUED 64
+
+static int comp_offload_threads;                 /* number of compression threads, 0 if disabled */
+static unsigned int comp_offload_size = 8192;    /* minimum size of the offloaded chunks */
+static unsigned int comp_offload_queued;         /* number of jobs not done yet */
+static struct comp_offload_thr comp_offload_thr[MAX_THREADS];
+#ifdef USE_THREAD
+static struct list comp_offload_queue = LIST_HEAD_INIT(comp_offload_queue);
+static pthread_mutex_t comp_offload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t comp_offload_cond = PTHREAD_COND_INITIALIZER;
+#endif
 
 static THREAD_LOCAL struct buffer tmpbuf;
 static THREAD_LOCAL struct buffer zbuf;
@@ -86,6 +139,152 @@ comp_flt_deinit_per_thread(struct proxy *px, struct flt_conf *fconf)
 		b_free(&zbuf);
 }
 
+/* Releases <job> and the compression context it still holds, if any */
+static void comp_job_free(struct comp_job *job)
+{
+	if (job->ctx)
+		job->algo->end(&job->ctx);
+	b_free(&job->in);
+	b_free(&job->out);
+	pool_free(pool_head_comp_job, job);
+}
+
+/* Processes the jobs done by the compression threads for the current thread:
+ * their stream is woken up to collect the result, or they are released if it
+ * left.
+ */
+static struct task *comp_offload_done_process(struct task *t, void *ctx, unsigned short state)
+{
+	struct comp_offload_thr *thr = ctx;
+	struct comp_job *job;
+
+	while ((job = MT_LIST_POP(&thr->done, struct comp_job *, done_list))) {
+		if (!job->task) {
+			comp_job_free(job);
+			continue;
+		}
+		job->done = 1;
+		task_wakeup(job->task, TASK_WOKEN_MSG);
+	}
+	return t;
+}
+
+#ifdef USE_THREAD
+
+/* compression thread */
+static void *comp_offload_thread(void *arg)
+{
+	struct comp_job *batch[COMP_OFFLOAD_BATCH];
+	struct comp_job *job;
+	sigset_t set;
+	int i, n, thr;
+
+	/* the signals are for the haproxy threads */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+	while (1) {
+		pthread_mutex_lock(&comp_offload_mutex);
+		while (LIST_ISEMPTY(&comp_offload_queue))
+			pthread_cond_wait(&comp_offload_cond, &comp_offload_mutex);
+
+		for (n = 0; n < COMP_OFFLOAD_BATCH && !LIST_ISEMPTY(&comp_offload_queue); n++) {
+			batch[n] = LIST_NEXT(&comp_offload_queue, struct comp_job *, list);
+			LIST_DEL(&batch[n]->list);
+		}
+		pthread_mutex_unlock(&comp_offload_mutex);
+
+		for (i = 0; i < n; i++) {
+			job = batch[i];
+
+			/* the compression level adjustments made by flush()
+			 * check the owner thread's idle time and the rates.
+			 */
+			ti  = &ha_thread_info[job->thr];
+			now = job->now;
+
+			job->ret = job->algo->add_data(job->ctx, b_head(&job->in), b_data(&job->in), &job->out);
+			if (job->ret >= 0 && job->algo->flush(job->ctx, &job->out) < 0)
+				job->ret = -1;
+
+			/* <job> may vanish as soon as it is in the done list */
+			thr = job->thr;
+			_HA_ATOMIC_SUB(&comp_offload_queued, 1);
+			MT_LIST_ADDQ(&comp_offload_thr[thr].done, &job->done_list);
+			tasklet_wakeup(comp_offload_thr[thr].tasklet);
+		}
+	}
+	return NULL;
+}
+
+#endif /* USE_THREAD */
+
+/* Tries to queue the compression of <data> for the stream <s> to the
+ * compression threads. Returns non-zero on success, in which case st->job is
+ * set, or 0 if the data must be compressed by the caller.
+ */
+static int comp_offload_submit(struct comp_state *st, struct stream *s, struct ist data)
+{
+#ifdef USE_THREAD
+	struct comp_job *job;
+
+	if (_HA_ATOMIC_ADD(&comp_offload_queued, 1) > COMP_OFFLOAD_MAX_QUEUED * comp_offload_threads)
+		goto fail;
+
+	job = pool_alloc(pool_head_comp_job);
+	if (!job)
+		goto fail;
+
+	job->in = job->out = BUF_NULL;
+	if (!b_alloc(&job->in) || !b_alloc(&job->out) || data.len > b_size(&job->in))
+		goto fail_free;
+
+	b_putblk(&job->in, data.ptr, data.len);
+	job->algo = st->comp_algo;
+	job->ctx  = st->comp_ctx;
+	job->task = s->task;
+	job->now  = now;
+	job->ret  = 0;
+	job->thr  = tid;
+	job->done = 0;
+	MT_LIST_INIT(&job->done_list);
+	st->job = job;
+
+	pthread_mutex_lock(&comp_offload_mutex);
+	LIST_ADDQ(&comp_offload_queue, &job->list);
+	pthread_cond_signal(&comp_offload_cond);
+	pthread_mutex_unlock(&comp_offload_mutex);
+	return 1;
+
+ fail_free:
+	job->ctx = NULL;
+	comp_job_free(job);
+ fail:
+	_HA_ATOMIC_SUB(&comp_offload_queued, 1);
+#endif
+	return 0;
+}
+
+/* Puts the compressed data of the done job of <st> into <out> and releases
+ * the job. <len> is the amount of input data the job may have consumed.
+ * Returns the amount of input data consumed, or -1 on error.
+ */
+static int comp_offload_collect(struct comp_state *st, struct buffer *out, size_t len)
+{
+	struct comp_job *job = st->job;
+	int ret = job->ret;
+
+	if (ret > (int)len || b_data(&job->out) > b_room(out))
+		ret = -1;
+	else
+		b_putblk(out, b_head(&job->out), b_data(&job->out));
+
+	st->job = NULL;
+	job->ctx = NULL;
+	comp_job_free(job);
+	return ret;
+}
+
 static int
 comp_strm_init(struct stream *s, struct filter *filter)
 {
@@ -97,6 +296,7 @@ comp_strm_init(struct stream *s, struct filter *filter)
 
 	st->comp_algo = NULL;
 	st->comp_ctx  = NULL;
+	st->job       = NULL;
 	filter->ctx   = st;
 
 	/* Register post-analyzer on AN_RES_WAIT_HTTP because we need to
@@ -115,6 +315,21 @@ comp_strm_deinit(struct stream *s, struct filter *filter)
 	if (!st)
 		return;
 
+	if (st->job) {
+		if (st->job->done) {
+			st->job->ctx = NULL;
+			comp_job_free(st->job);
+		}
+		else {
+			/* the compression thread still uses the context, it
+			 * will be released with the job.
+			 */
+			st->job->task = NULL;
+			st->comp_algo = NULL;
+		}
+		st->job = NULL;
+	}
+
 	/* release any possible compression context */
 	if (st->comp_algo)
 		st->comp_algo->end(&st->comp_ctx);
@@ -193,15 +408,34 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 				v.len -= offset;
 				if (v.len > len)
 					v.len = len;
+
+				/* Large chunks are compressed by the compression
+				 * threads when possible. The job works on a copy of
+				 * the data, which stay in the block until the stream
+				 * is woken up to collect the result.
+				 */
+				if (!st->job && comp_offload_threads && v.len >= comp_offload_size &&
+				    comp_algo_thread_safe(st->comp_algo))
+					comp_offload_submit(st, s, v);
+				if (st->job && !st->job->done)
+					goto end;
+
 				if (htx_compression_buffer_init(htx, &trash) < 0) {
 					msg->chn->flags |= CF_WAKE_WRITE;
 					goto end;
 				}
-				ret = htx_compression_buffer_add_data(st, v.ptr, v.len, &trash);
-				if (ret < 0)
-					goto error;
-				if (htx_compression_buffer_end(st, &trash, 0) < 0)
-					goto error;
+				if (st->job) {
+					ret = comp_offload_collect(st, &trash, v.len);
+					if (ret < 0)
+						goto error;
+				}
+				else {
+					ret = htx_compression_buffer_add_data(st, v.ptr, v.len, &trash);
+					if (ret < 0)
+						goto error;
+					if (htx_compression_buffer_end(st, &trash, 0) < 0)
+						goto error;
+				}
 				len -= ret;
 				consumed += ret;
 				to_forward += b_data(&trash);
@@ -273,6 +507,40 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 }
 
 
+/*
+ * Restarts the compression of the response of <s> at level <level>, before
+ * any data was compressed. This is used by the cache to store the compressed
+ * responses with a better ratio than the one affordable for the responses
+ * compressed for a single client. Returns 1 on success, or 0 if the response
+ * is not being compressed or if the new context cannot be allocated, in which
+ * case the compression continues at its current level.
+ */
+int http_comp_set_level(struct stream *s, int level)
+{
+	struct filter *filter;
+	struct comp_state *st;
+	struct comp_ctx *ctx;
+
+	if (!(s->txn->rsp.flags & HTTP_MSGF_COMPRESSING))
+		return 0;
+
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) != http_comp_flt_id)
+			continue;
+
+		st = filter->ctx;
+		if (!st || !st->comp_algo || !st->comp_ctx || st->job)
+			return 0;
+
+		if (st->comp_algo->init(&ctx, level) < 0)
+			return 0;
+		st->comp_algo->end(&st->comp_ctx);
+		st->comp_ctx = ctx;
+		return 1;
+	}
+	return 0;
+}
+
 static int
 comp_http_end(struct stream *s, struct filter *filter,
 	      struct http_msg *msg)
@@ -722,16 +990,7 @@ check_implicit_http_comp_flt(struct proxy *proxy)
 		list_for_each_entry(fconf, &proxy->filter_configs, list) {
 			if (fconf->id == http_comp_flt_id)
 				comp = 1;
-			else if (fconf->id == cache_store_flt_id) {
-				if (comp) {
-					ha_alert("config: %s '%s': unable to enable the compression filter "
-						 "before any cache filter.\n",
-						 proxy_type_str(proxy), proxy->id);
-					err++;
-					goto end;
-				}
-			}
-			else if (fconf->id == fcgi_flt_id)
+			else if (fconf->id == cache_store_flt_id || fconf->id == fcgi_flt_id)
 				continue;
 			else
 				explicit = 1;
@@ -808,9 +1067,112 @@ smp_fetch_res_comp_algo(const struct arg *args, struct sample *smp,
 	return 0;
 }
 
+/* Creates the per-thread tasklets processing the jobs done by the compression
+ * threads. Returns 0 if succeeded, an error code if not.
+ */
+static int comp_offload_init()
+{
+	struct tasklet *t;
+	int i;
+
+	if (!comp_offload_threads)
+		return 0;
+
+	for (i = 0; i < global.nbthread; i++) {
+		t = tasklet_new();
+		if (!t) {
+			ha_alert("comp-offload-threads: out of memory.\n");
+			return ERR_ALERT | ERR_FATAL;
+		}
+		t->tid = i;
+		t->process = comp_offload_done_process;
+		t->context = &comp_offload_thr[i];
+		MT_LIST_INIT(&comp_offload_thr[i].done);
+		comp_offload_thr[i].tasklet = t;
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(comp_offload_init);
+
+#ifdef USE_THREAD
+
+/* Starts the compression threads from the first thread, once the process is
+ * in its final state (after the fork in daemon mode).
+ */
+static int comp_offload_start()
+{
+	pthread_t thread;
+	int i;
+
+	if (!comp_offload_threads || tid != 0)
+		return 1;
+
+	for (i = 0; i < comp_offload_threads; i++) {
+		if (pthread_create(&thread, NULL, comp_offload_thread, NULL) != 0) {
+			ha_alert("comp-offload-threads: unable to start the compression threads.\n");
+			return 0;
+		}
+		pthread_detach(thread);
+	}
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(comp_offload_start);
+
+#endif /* USE_THREAD */
+
+/* parse the "comp-offload-threads" keyword in global section */
+static int parse_comp_offload_threads(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+#ifdef USE_THREAD
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	comp_offload_threads = strtol(args[1], &end, 10);
+	if (!*args[1] || *end || comp_offload_threads < 0 || comp_offload_threads > MAX_THREADS) {
+		memprintf(err, "'%s' expects a number of threads between 0 and %d.", args[0], MAX_THREADS);
+		return -1;
+	}
+	return 0;
+#else
+	memprintf(err, "'%s' requires threads support.", args[0]);
+	return -1;
+#endif
+}
+
+/* parse the "tune.comp.offload-size" keyword in global section */
+static int parse_comp_offload_size(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a size in bytes.", args[0]);
+		return -1;
+	}
+
+	res = parse_size_err(args[1], &comp_offload_size);
+	if (res) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'", res, args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* Declare the config parser for "compression" keyword */
 static struct cfg_kw_list cfg_kws = {ILH, {
 		{ CFG_LISTEN, "compression", parse_compression_options },
+		{ CFG_GLOBAL, "comp-offload-threads", parse_comp_offload_threads },
+		{ CFG_GLOBAL, "tune.comp.offload-size", parse_comp_offload_size },
 		{ 0, NULL, NULL },
 	}
 };
@@ -0,0 +1,468 @@
+/*
+ * Content scanning filter: looks for literal strings and regular expressions
+ * in the HTTP payload while it is forwarded.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <common/chunk.h>
+#include <common/htx.h>
+#include <common/initcall.h>
+#include <common/memory.h>
+#include <common/mini-clist.h>
+#include <common/regex.h>
+#include <common/standard.h>
+
+#include <types/filters.h>
+#include <types/proxy.h>
+#include <types/sample.h>
+#include <types/stream.h>
+
+#include <proto/filters.h>
+#include <proto/http_htx.h>
+#include <proto/sample.h>
+#include <proto/stream.h>
+
+/* Longest literal string supported. The last bytes of each DATA block are
+ * kept up to this length minus one to find the strings spanning two blocks.
+ */
+#define SCAN_MAX_LITERAL  64
+
+#define SCAN_FL_REQ       0x00000001  /* scan the request payload */
+#define SCAN_FL_RES       0x00000002  /* scan the response payload */
+#define SCAN_FL_ABORT     0x00000004  /* abort the transfer on the first match */
+
+const char *scan_flt_id = "content-scan filter";
+
+struct flt_ops scan_ops;
+
+struct scan_pattern {
+	struct list      list;   /* next pattern of the filter */
+	char            *str;    /* pattern as configured, reported by scan.match */
+	size_t           len;    /* length of the literal, 0 for a regex */
+	struct my_regex *regex;  /* compiled regex, NULL for a literal */
+};
+
+struct scan_config {
+	struct proxy *proxy;
+	struct list   patterns;  /* list of scan_pattern */
+	unsigned int  flags;     /* SCAN_FL_* */
+	size_t        keep;      /* bytes to keep between blocks: longest literal - 1 */
+};
+
+struct scan_state {
+	const struct scan_pattern *match;       /* first matching pattern, NULL if none */
+	unsigned int carry_len[2];              /* bytes in carry[], per direction */
+	char carry[2][SCAN_MAX_LITERAL - 1];    /* last bytes of the previous blocks */
+};
+
+DECLARE_STATIC_POOL(pool_head_scan_state, "scan_state", sizeof(struct scan_state));
+
+/* Returns a pointer to the first occurrence of the <nlen> bytes string <n> in
+ * the <hlen> bytes at <h>, or NULL if none is found. <nlen> must not be null.
+ * The candidates are selected at once on the first and the last bytes of the
+ * string over a whole vector, and are only compared when both match, which
+ * rejects most of the positions without ever looking at them twice.
+ */
+static const char *scan_find(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+	const char *end;
+
+	if (hlen < nlen)
+		return NULL;
+	if (nlen == 1)
+		return memchr(h, *n, hlen);
+
+	/* candidates start strictly before <end> */
+	end = h + hlen - nlen + 1;
+
+#if defined(__AVX2__)
+	{
+		const __m256i first = _mm256_set1_epi8(n[0]);
+		const __m256i last  = _mm256_set1_epi8(n[nlen - 1]);
+
+		for (; end - h >= 32; h += 32) {
+			__m256i f = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)h));
+			__m256i l = _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(h + nlen - 1)));
+			unsigned int m = _mm256_movemask_epi8(_mm256_and_si256(f, l));
+
+			for (; m; m &= m - 1) {
+				unsigned int bit = __builtin_ctz(m);
+
+				if (memcmp(h + bit + 1, n + 1, nlen - 2) == 0)
+					return h + bit;
+			}
+		}
+	}
+#elif defined(__SSE2__)
+	{
+		const __m128i first = _mm_set1_epi8(n[0]);
+		const __m128i last  = _mm_set1_epi8(n[nlen - 1]);
+
+		for (; end - h >= 16; h += 16) {
+			__m128i f = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)h));
+			__m128i l = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(h + nlen - 1)));
+			unsigned int m = _mm_movemask_epi8(_mm_and_si128(f, l));
+
+			for (; m; m &= m - 1) {
+				unsigned int bit = __builtin_ctz(m);
+
+				if (memcmp(h + bit + 1, n + 1, nlen - 2) == 0)
+					return h + bit;
+			}
+		}
+	}
+#endif
+	/* remaining candidates, or all of them without vector instructions */
+	while (h < end) {
+		h = memchr(h, n[0], end - h);
+		if (!h)
+			break;
+		if (h[nlen - 1] == n[nlen - 1] && memcmp(h + 1, n + 1, nlen - 2) == 0)
+			return h;
+		h++;
+	}
+	return NULL;
+}
+
+/* Applies the regex <regex> to the <len> bytes at <p>. Returns non-zero if it
+ * matches. Libc's regexec() needs a zero-terminated subject, which the DATA
+ * blocks are not, so the block is copied to the trash in this case only.
+ */
+static int scan_regex(const struct my_regex *regex, const char *p, size_t len)
+{
+#if defined(USE_PCRE) || defined(USE_PCRE_JIT) || defined(USE_PCRE2)
+	return regex_exec2(regex, (char *)p, len);
+#else
+	if (len >= trash.size)
+		len = trash.size - 1;
+	memcpy(trash.area, p, len);
+	return regex_exec2(regex, trash.area, len);
+#endif
+}
+
+/* Looks for the literals of <conf> in the <len> bytes at <p>. Returns the
+ * first matching pattern or NULL.
+ */
+static const struct scan_pattern *scan_literals(const struct scan_config *conf, const char *p, size_t len)
+{
+	const struct scan_pattern *pat;
+
+	list_for_each_entry(pat, &conf->patterns, list) {
+		if (pat->len && scan_find(p, len, pat->str, pat->len))
+			return pat;
+	}
+	return NULL;
+}
+
+/* Scans the <len> bytes of the DATA block at <p> travelling in direction
+ * <dir> (0 for the request, 1 for the response). The literals spanning the
+ * previous blocks and this one are looked for in a small area made of the
+ * bytes kept from the previous blocks followed by the first bytes of this
+ * one, so the blocks themselves are never linearized. The regex are applied
+ * to each block alone. Returns the first matching pattern or NULL.
+ */
+static const struct scan_pattern *scan_block(const struct scan_config *conf, struct scan_state *st,
+                                             int dir, const char *p, size_t len)
+{
+	const struct scan_pattern *pat;
+	char *carry = st->carry[dir];
+	unsigned int *clen = &st->carry_len[dir];
+
+	if (conf->keep && *clen) {
+		char junction[2 * (SCAN_MAX_LITERAL - 1)];
+		size_t head = MIN(len, conf->keep);
+
+		memcpy(junction, carry, *clen);
+		memcpy(junction + *clen, p, head);
+		pat = scan_literals(conf, junction, *clen + head);
+		if (pat)
+			return pat;
+	}
+
+	pat = scan_literals(conf, p, len);
+	if (pat)
+		return pat;
+
+	list_for_each_entry(pat, &conf->patterns, list) {
+		if (pat->regex && scan_regex(pat->regex, p, len))
+			return pat;
+	}
+
+	/* keep the last bytes for the next block */
+	if (len >= conf->keep) {
+		memcpy(carry, p + len - conf->keep, conf->keep);
+		*clen = conf->keep;
+	}
+	else {
+		if (*clen + len > conf->keep) {
+			memmove(carry, carry + *clen + len - conf->keep, conf->keep - len);
+			*clen = conf->keep - len;
+		}
+		memcpy(carry + *clen, p, len);
+		*clen += len;
+	}
+	return NULL;
+}
+
+/***********************************************************************/
+static int
+scan_flt_init(struct proxy *px, struct flt_conf *fconf)
+{
+	fconf->flags |= FLT_CFG_FL_HTX;
+	return 0;
+}
+
+static void
+scan_flt_deinit(struct proxy *px, struct flt_conf *fconf)
+{
+	struct scan_config *conf = fconf->conf;
+	struct scan_pattern *pat, *back;
+
+	if (!conf)
+		return;
+
+	list_for_each_entry_safe(pat, back, &conf->patterns, list) {
+		LIST_DEL(&pat->list);
+		regex_free(pat->regex);
+		free(pat->str);
+		free(pat);
+	}
+	free(conf);
+	fconf->conf = NULL;
+}
+
+static int
+scan_strm_init(struct stream *s, struct filter *filter)
+{
+	struct scan_state *st;
+
+	st = pool_alloc_dirty(pool_head_scan_state);
+	if (st == NULL)
+		return -1;
+
+	st->match = NULL;
+	st->carry_len[0] = st->carry_len[1] = 0;
+	filter->ctx = st;
+	return 1;
+}
+
+static void
+scan_strm_deinit(struct stream *s, struct filter *filter)
+{
+	struct scan_state *st = filter->ctx;
+
+	if (!st)
+		return;
+
+	pool_free(pool_head_scan_state, st);
+	filter->ctx = NULL;
+}
+
+static int
+scan_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
+{
+	struct scan_config *conf = FLT_CONF(filter);
+
+	if (conf->flags & ((msg->chn->flags & CF_ISRESP) ? SCAN_FL_RES : SCAN_FL_REQ))
+		register_data_filter(s, msg->chn, filter);
+	return 1;
+}
+
+static int
+scan_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
+		  unsigned int offset, unsigned int len)
+{
+	struct scan_config *conf = FLT_CONF(filter);
+	struct scan_state *st = filter->ctx;
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct htx_ret htxret;
+	struct htx_blk *blk;
+	int dir = !!(msg->chn->flags & CF_ISRESP);
+	unsigned int ret = len;
+
+	/* only the first match is reported, the rest is simply forwarded */
+	if (st->match)
+		goto end;
+
+	htxret = htx_find_offset(htx, offset);
+	blk = htxret.blk;
+	offset = htxret.ret;
+	for (; blk && len; blk = htx_get_next_blk(htx, blk)) {
+		struct ist v = htx_get_blk_value(htx, blk);
+
+		v.ptr += offset;
+		v.len -= offset;
+		offset = 0;
+		if (v.len > len)
+			v.len = len;
+		len -= v.len;
+
+		if (htx_get_blk_type(blk) != HTX_BLK_DATA || !v.len)
+			continue;
+
+		st->match = scan_block(conf, st, dir, v.ptr, v.len);
+		if (st->match) {
+			if (conf->flags & SCAN_FL_ABORT)
+				return -1;
+			break;
+		}
+	}
+  end:
+	return ret;
+}
+
+/***********************************************************************/
+struct flt_ops scan_ops = {
+	.init   = scan_flt_init,
+	.deinit = scan_flt_deinit,
+
+	.attach = scan_strm_init,
+	.detach = scan_strm_deinit,
+
+	.http_headers = scan_http_headers,
+	.http_payload = scan_http_payload,
+};
+
+/*
+ * Parses the "content-scan" filter line:
+ *   filter content-scan [request] [response] [abort]
+ *                       { string <str> | regex <regex> } ...
+ */
+static int
+parse_scan_flt(char **args, int *cur_arg, struct proxy *px,
+               struct flt_conf *fconf, char **err, void *private)
+{
+	struct scan_config  *conf;
+	struct scan_pattern *pat;
+	int                  pos = *cur_arg + 1;
+
+	conf = calloc(1, sizeof(*conf));
+	if (!conf) {
+		memprintf(err, "%s: out of memory", args[*cur_arg]);
+		return -1;
+	}
+	conf->proxy = px;
+	LIST_INIT(&conf->patterns);
+	fconf->id   = scan_flt_id;
+	fconf->conf = conf;
+	fconf->ops  = &scan_ops;
+
+	while (*args[pos]) {
+		if (!strcmp(args[pos], "request"))
+			conf->flags |= SCAN_FL_REQ;
+		else if (!strcmp(args[pos], "response"))
+			conf->flags |= SCAN_FL_RES;
+		else if (!strcmp(args[pos], "abort"))
+			conf->flags |= SCAN_FL_ABORT;
+		else if (!strcmp(args[pos], "string") || !strcmp(args[pos], "regex")) {
+			if (!*args[pos + 1]) {
+				memprintf(err, "'%s' : '%s' option without value",
+					  args[*cur_arg], args[pos]);
+				goto error;
+			}
+
+			pat = calloc(1, sizeof(*pat));
+			if (!pat || (pat->str = strdup(args[pos + 1])) == NULL) {
+				free(pat);
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+			LIST_ADDQ(&conf->patterns, &pat->list);
+
+			if (*args[pos] == 's') {
+				pat->len = strlen(pat->str);
+				if (pat->len > SCAN_MAX_LITERAL) {
+					memprintf(err, "'%s' : string '%s' is longer than %d characters",
+						  args[*cur_arg], pat->str, SCAN_MAX_LITERAL);
+					goto error;
+				}
+				if (pat->len - 1 > conf->keep)
+					conf->keep = pat->len - 1;
+			}
+			else {
+				char *errmsg = NULL;
+
+				pat->regex = regex_comp(pat->str, 1, 0, &errmsg);
+				if (!pat->regex) {
+					memprintf(err, "'%s' : invalid regex '%s' : %s",
+						  args[*cur_arg], pat->str, errmsg);
+					free(errmsg);
+					goto error;
+				}
+			}
+			pos++;
+		}
+		else
+			break;
+		pos++;
+	}
+
+	if (LIST_ISEMPTY(&conf->patterns)) {
+		memprintf(err, "'%s' : expects at least one 'string' or 'regex' pattern",
+			  args[*cur_arg]);
+		goto error;
+	}
+	if (!(conf->flags & (SCAN_FL_REQ|SCAN_FL_RES)))
+		conf->flags |= SCAN_FL_RES;
+
+	*cur_arg = pos;
+	return 0;
+
+ error:
+	scan_flt_deinit(px, fconf);
+	return -1;
+}
+
+/* string, returns the first pattern found by a content-scan filter */
+static int
+smp_fetch_scan_match(const struct arg *args, struct sample *smp, const char *kw,
+		     void *private)
+{
+	struct filter     *filter;
+	struct scan_state *st;
+
+	if (!smp->strm)
+		return 0;
+
+	list_for_each_entry(filter, &strm_flt(smp->strm)->filters, list) {
+		if (FLT_ID(filter) != scan_flt_id)
+			continue;
+
+		if (!(st = filter->ctx) || !st->match)
+			continue;
+
+		smp->flags = SMP_F_CONST;
+		smp->data.type = SMP_T_STR;
+		smp->data.u.str.area = st->match->str;
+		smp->data.u.str.data = strlen(st->match->str);
+		return 1;
+	}
+	return 0;
+}
+
+/* Declare the filter parser for "content-scan" keyword */
+static struct flt_kw_list filter_kws = { "SCAN", { }, {
+		{ "content-scan", parse_scan_flt, NULL },
+		{ NULL, NULL, NULL },
+	}
+};
+
+INITCALL1(STG_REGISTER, flt_register_keywords, &filter_kws);
+
+/* Note: must not be declared <const> as its list will be overwritten */
+static struct sample_fetch_kw_list sample_fetch_keywords = {ILH, {
+		{ "scan.match", smp_fetch_scan_match, 0, NULL, SMP_T_STR, SMP_USE_HRSHP },
+		{ /* END */ },
+	}
+};
+
+INITCALL1(STG_REGISTER, sample_register_fetches, &sample_fetch_keywords);
@@ -104,6 +104,12 @@ int curpxopts2;
 DECLARE_STATIC_POOL(pool_head_spoe_ctx,    "spoe_ctx",    sizeof(struct spoe_context));
 DECLARE_STATIC_POOL(pool_head_spoe_appctx, "spoe_appctx", sizeof(struct spoe_appctx));
 
+/* Pool of the buffers used to encode the messages and to decode the ACK
+ * frames. It is created once the configuration is checked, for buffers of
+ * tune.bufsize bytes, and is not shared with the channels' buffers so that
+ * SPOE does not compete for the reserved buffers. */
+static struct pool_head *pool_head_spoe_frame = NULL;
+
 struct flt_ops spoe_ops;
 
 static int  spoe_queue_context(struct spoe_context *ctx);
@@ -1235,6 +1241,8 @@ spoe_release_appctx(struct appctx *appctx)
 		LIST_INIT(&spoe_appctx->list);
 	}
 	HA_SPIN_UNLOCK(SPOE_APPLET_LOCK, &agent->rt[tid].lock);
+	if (agent->rt[tid].batch_appctx == spoe_appctx)
+		agent->rt[tid].batch_appctx = NULL;
 
 	/* Shutdown the server connection, if needed */
 	if (appctx->st0 != SPOE_APPCTX_ST_END) {
@@ -1681,6 +1689,11 @@ spoe_handle_processing_appctx(struct appctx *appctx)
 		}
 	}
 
+	/* The contexts batched for this applet are sent now. The following ones
+	 * will need a new wakeup. */
+	if (agent->rt[tid].batch_appctx == SPOE_APPCTX(appctx))
+		agent->rt[tid].batch_appctx = NULL;
+
 	/* send_frame loop */
 	while (!skip_sending && SPOE_APPCTX(appctx)->cur_fpa < agent->max_fpa) {
 		ret = spoe_handle_sending_frame_appctx(appctx, &skip_sending);
@@ -2089,6 +2102,17 @@ spoe_queue_context(struct spoe_context *ctx)
 		    ctx->strm, agent->counters.applets, agent->counters.idles,
 		    agent->rt[tid].processing);
 
+	/* With pipelining, all the contexts queued before an already woken up
+	 * applet runs are sent during the same pass, in a single write, as long
+	 * as it has room for more frames. So there is no need to wake another
+	 * applet up for this one. */
+	spoe_appctx = agent->rt[tid].batch_appctx;
+	if (spoe_appctx && (spoe_appctx->flags & SPOE_APPCTX_FL_PIPELINING) &&
+	    spoe_appctx->cur_fpa + agent->rt[tid].batched < agent->max_fpa) {
+		agent->rt[tid].batched++;
+		return 1;
+	}
+
 	/* Finally try to wakeup an IDLE applet. */
 	if (!eb_is_empty(&agent->rt[tid].idle_applets)) {
 		struct eb32_node *node;
@@ -2100,6 +2124,8 @@ spoe_queue_context(struct spoe_context *ctx)
 			spoe_appctx->node.key++;
 			eb32_insert(&agent->rt[tid].idle_applets, &spoe_appctx->node);
 			spoe_wakeup_appctx(spoe_appctx->owner);
+			agent->rt[tid].batch_appctx = spoe_appctx;
+			agent->rt[tid].batched      = 1;
 		}
 	}
 	return 1;
@@ -2812,8 +2838,13 @@ spoe_acquire_buffer(struct buffer *buf, struct buffer_wait *buffer_wait)
 	if (MT_LIST_ADDED(&buffer_wait->list))
 		MT_LIST_DEL(&buffer_wait->list);
 
-	if (b_alloc_margin(buf, global.tune.reserved_bufs))
+	buf->area = pool_alloc_dirty(pool_head_spoe_frame);
+	if (buf->area) {
+		buf->size = pool_head_spoe_frame->size;
+		buf->head = buf->data = 0;
 		return 1;
+	}
+	*buf = BUF_NULL;
 
 	MT_LIST_ADDQ(&buffer_wq, &buffer_wait->list);
 	return 0;
@@ -2827,7 +2858,8 @@ spoe_release_buffer(struct buffer *buf, struct buffer_wait *buffer_wait)
 
 	/* Release the buffer if needed */
 	if (buf->size) {
-		b_free(buf);
+		pool_free(pool_head_spoe_frame, buf->area);
+		*buf = BUF_NULL;
 		offer_buffers(buffer_wait->target, tasks_run_queue);
 	}
 }
@@ -3055,6 +3087,14 @@ spoe_check(struct proxy *px, struct flt_conf *fconf)
 		return 1;
 	}
 
+	if (!pool_head_spoe_frame)
+		pool_head_spoe_frame = create_pool("spoe_frame", global.tune.bufsize, MEM_F_EXACT);
+	if (!pool_head_spoe_frame) {
+		ha_alert("Proxy %s : out of memory initializing SPOE agent '%s' declared at %s:%d.\n",
+			 px->id, conf->agent->id, conf->agent->conf.file, conf->agent->conf.line);
+		return 1;
+	}
+
 	if ((conf->agent->rt = calloc(global.nbthread, sizeof(*conf->agent->rt))) == NULL) {
 		ha_alert("Proxy %s : out of memory initializing SPOE agent '%s' declared at %s:%d.\n",
 			 px->id, conf->agent->id, conf->agent->conf.file, conf->agent->conf.line);
@@ -3064,6 +3104,8 @@ spoe_check(struct proxy *px, struct flt_conf *fconf)
 		conf->agent->rt[i].engine_id    = NULL;
 		conf->agent->rt[i].frame_size   = conf->agent->max_frame_size;
 		conf->agent->rt[i].processing   = 0;
+		conf->agent->rt[i].batch_appctx = NULL;
+		conf->agent->rt[i].batched      = 0;
 		LIST_INIT(&conf->agent->rt[i].applets);
 		LIST_INIT(&conf->agent->rt[i].sending_queue);
 		LIST_INIT(&conf->agent->rt[i].waiting_queue);
@@ -10,11 +10,17 @@
  *
  */
 
+#include <stdlib.h>
+
 #include <common/config.h>
+#include <common/errors.h>
+#include <common/initcall.h>
 #include <common/standard.h>
 #include <common/time.h>
 #include <common/tools.h>
+#include <types/global.h>
 #include <proto/freq_ctr.h>
+#include <proto/log.h>
 
 /* Read a frequency counter taking history into account for missing time in
  * current period. Current second is sub-divided in 1000 chunks of one ms,
@@ -161,6 +167,129 @@ unsigned int next_event_delay(struct freq_ctr *ctr, unsigned int freq, unsigned
 	return MAX(wait, 1);
 }
 
+/* Sums the slots of per-thread frequency counter <ctr> into <sum>, which is
+ * then a regular frequency counter for the current second. The slots which
+ * were updated by a thread whose date is slightly ahead are considered as
+ * being in the current second as well.
+ */
+static void freq_ctr_thr_sum(struct freq_ctr_thr *ctr, struct freq_ctr *sum)
+{
+	const struct freq_ctr *c;
+	unsigned int curr_sec, curr, past;
+	int thr, age;
+
+	sum->curr_sec = now.tv_sec & 0x7fffffff;
+	sum->curr_ctr = sum->prev_ctr = 0;
+
+	for (thr = 0; thr < global.nbthread; thr++) {
+		c = &ctr->slot[thr].ctr;
+		curr_sec = c->curr_sec;
+		HA_BARRIER();
+		curr = c->curr_ctr;
+		past = c->prev_ctr;
+
+		age = sum->curr_sec - curr_sec;
+		if (age <= 0) {
+			sum->curr_ctr += curr;
+			sum->prev_ctr += past;
+		}
+		else if (age == 1)
+			sum->prev_ctr += curr;
+	}
+}
+
+/* Same as read_freq_ctr() for per-thread frequency counter <ctr>. */
+unsigned int read_freq_ctr_thr(struct freq_ctr_thr *ctr)
+{
+	struct freq_ctr sum;
+
+	if (!ctr->slot)
+		return read_freq_ctr(&ctr->ctr);
+
+	freq_ctr_thr_sum(ctr, &sum);
+	return read_freq_ctr(&sum);
+}
+
+/* Returns the number of events counted by per-thread frequency counter <ctr>
+ * during the current period only, like the value returned by update_freq_ctr().
+ */
+unsigned int freq_ctr_thr_curr(struct freq_ctr_thr *ctr)
+{
+	struct freq_ctr sum;
+
+	if (!ctr->slot)
+		return ctr->ctr.curr_ctr;
+
+	freq_ctr_thr_sum(ctr, &sum);
+	return sum.curr_ctr;
+}
+
+/* Same as freq_ctr_remain() for per-thread frequency counter <ctr>. */
+unsigned int freq_ctr_thr_remain(struct freq_ctr_thr *ctr, unsigned int freq, unsigned int pend)
+{
+	struct freq_ctr sum;
+
+	if (!ctr->slot)
+		return freq_ctr_remain(&ctr->ctr, freq, pend);
+
+	freq_ctr_thr_sum(ctr, &sum);
+	return freq_ctr_remain(&sum, freq, pend);
+}
+
+/* Same as next_event_delay() for per-thread frequency counter <ctr>. */
+unsigned int next_event_delay_thr(struct freq_ctr_thr *ctr, unsigned int freq, unsigned int pend)
+{
+	struct freq_ctr sum;
+
+	if (!ctr->slot)
+		return next_event_delay(&ctr->ctr, freq, pend);
+
+	freq_ctr_thr_sum(ctr, &sum);
+	return next_event_delay(&sum, freq, pend);
+}
+
+/* Allocates the per-thread slots of <ctr> once the number of threads is known.
+ * The events already counted are moved to the first slot. Returns 0 on success
+ * or -1 on memory shortage, in which case the counter remains shared.
+ */
+int freq_ctr_thr_alloc(struct freq_ctr_thr *ctr)
+{
+	struct freq_ctr_slot *slot;
+
+	if (ctr->slot)
+		return 0;
+
+	slot = calloc(global.nbthread, sizeof(*slot));
+	if (!slot)
+		return -1;
+
+	slot[0].ctr = ctr->ctr;
+	ctr->slot = slot;
+	return 0;
+}
+
+/* Releases the per-thread slots of <ctr>, if any. */
+void freq_ctr_thr_free(struct freq_ctr_thr *ctr)
+{
+	free(ctr->slot);
+	ctr->slot = NULL;
+}
+
+/* Allocates the slots of the process-wide per-thread frequency counters. */
+static int freq_ctr_thr_alloc_global()
+{
+	if (freq_ctr_thr_alloc(&global.conn_per_sec) < 0 ||
+	    freq_ctr_thr_alloc(&global.sess_per_sec) < 0 ||
+	    freq_ctr_thr_alloc(&global.ssl_per_sec) < 0 ||
+	    freq_ctr_thr_alloc(&global.out_32bps) < 0) {
+		ha_alert("Out of memory while allocating the per-thread rate counters.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(freq_ctr_thr_alloc_global);
+
 /* Reads a frequency counter taking history into account for missing time in
  * current period. The period has to be passed in number of ticks and must
  * match the one used to feed the counter. The counter value is reported for
@@ -140,17 +140,7 @@ int frontend_accept(struct stream *s)
 	if (fe->mode == PR_MODE_HTTP)
 		s->req.flags |= CF_READ_DONTWAIT; /* one read is usually enough */
 
-	if (unlikely(fe->nb_req_cap > 0)) {
-		if ((s->req_cap = pool_alloc(fe->req_cap_pool)) == NULL)
-			goto out_return;	/* no memory */
-		memset(s->req_cap, 0, fe->nb_req_cap * sizeof(void *));
-	}
-
-	if (unlikely(fe->nb_rsp_cap > 0)) {
-		if ((s->res_cap = pool_alloc(fe->rsp_cap_pool)) == NULL)
-			goto out_free_reqcap;	/* no memory */
-		memset(s->res_cap, 0, fe->nb_rsp_cap * sizeof(void *));
-	}
+	/* the capture slots are allocated on first use, see stream_req_cap() */
 
 	if (fe->http_needed) {
 		/* we have to allocate header indexes only if we know
@@ -158,7 +148,7 @@ int frontend_accept(struct stream *s)
 		 * (mode == PR_MODE_HTTP).
 		 */
 		if (unlikely(!http_alloc_txn(s)))
-			goto out_free_rspcap; /* no memory */
+			goto out_return; /* no memory */
 
 		/* and now initialize the HTTP transaction state */
 		http_init_txn(s);
@@ -168,10 +158,6 @@ int frontend_accept(struct stream *s)
 	return 1;
 
 	/* Error unrolling */
- out_free_rspcap:
-	pool_free(fe->rsp_cap_pool, s->res_cap);
- out_free_reqcap:
-	pool_free(fe->req_cap_pool, s->req_cap);
  out_return:
 	return -1;
 }
@@ -242,7 +228,7 @@ smp_fetch_fe_sess_rate(const struct arg *args, struct sample *smp, const char *k
 {
 	smp->flags = SMP_F_VOL_TEST;
 	smp->data.type = SMP_T_SINT;
-	smp->data.u.sint = read_freq_ctr(&args->data.prx->fe_sess_per_sec);
+	smp->data.u.sint = read_freq_ctr_thr(&args->data.prx->fe_sess_per_sec);
 	return 1;
 }
 
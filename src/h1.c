@@ -11,6 +11,11 @@
  */
 
 #include <ctype.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <common/config.h>
 #include <common/h1.h>
 #include <common/http-hdr.h>
@@ -217,6 +222,138 @@ void h1_parse_connection_header(struct h1m *h1m, struct ist *value)
 		}                                                         \
 	} while (0)
 
+/* Vector helpers used to skip the bulk of the header names and values. They
+ * work on H1_SIMD_LEN bytes at once, with the widest instruction set the
+ * target was built for (SSE2 is always present on x86_64, AVX2 requires
+ * building with -mavx2 or for a native CPU, NEON is always present on
+ * aarch64). Each of them returns the number of leading bytes of the block
+ * which may be skipped, and the parser processes the byte which stopped them
+ * as usual. Bytes are classified by ranges as done by picohttpparser.
+ */
+#if defined(__AVX2__)
+#define H1_SIMD_LEN 32
+
+/* Returns the number of leading bytes at <p> which are neither CR nor LF. */
+static forceinline unsigned int h1_simd_skip_val(const char *p)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	unsigned int m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+	                                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+	return m ? __builtin_ctz(m) : H1_SIMD_LEN;
+}
+
+/* Returns the number of leading bytes at <p> which are alphanumeric or '-',
+ * which covers all the header names in practice. If <lower> is set, the upper
+ * case letters among them are turned to lower case.
+ */
+static forceinline unsigned int h1_simd_skip_name(char *p, int lower)
+{
+	const __m256i idx = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	                                     16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	__m256i a = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+	__m256i ok = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(25)), a),
+	                                             _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d)),
+	                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+	unsigned int m = ~_mm256_movemask_epi8(ok);
+	unsigned int n = m ? __builtin_ctz(m) : H1_SIMD_LEN;
+
+	if (lower) {
+		__m256i u = _mm256_sub_epi8(v, _mm256_set1_epi8('A'));
+
+		u = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(u, _mm256_set1_epi8(25)), u),
+		                     _mm256_cmpgt_epi8(_mm256_set1_epi8(n), idx));
+		if (_mm256_movemask_epi8(u))
+			_mm256_storeu_si256((__m256i *)p, _mm256_or_si256(v, _mm256_and_si256(u, _mm256_set1_epi8(0x20))));
+	}
+	return n;
+}
+
+#elif defined(__SSE2__)
+#define H1_SIMD_LEN 16
+
+/* Returns the number of leading bytes at <p> which are neither CR nor LF. */
+static forceinline unsigned int h1_simd_skip_val(const char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	unsigned int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+	                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+	return m ? __builtin_ctz(m) : H1_SIMD_LEN;
+}
+
+/* Returns the number of leading bytes at <p> which are alphanumeric or '-',
+ * which covers all the header names in practice. If <lower> is set, the upper
+ * case letters among them are turned to lower case.
+ */
+static forceinline unsigned int h1_simd_skip_name(char *p, int lower)
+{
+	const __m128i idx = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i a = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(25)), a),
+	                                       _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d)),
+	                          _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+	unsigned int m = ~_mm_movemask_epi8(ok) & 0xffff;
+	unsigned int n = m ? __builtin_ctz(m) : H1_SIMD_LEN;
+
+	if (lower) {
+		__m128i u = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+
+		u = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(u, _mm_set1_epi8(25)), u),
+		                  _mm_cmpgt_epi8(_mm_set1_epi8(n), idx));
+		if (_mm_movemask_epi8(u))
+			_mm_storeu_si128((__m128i *)p, _mm_or_si128(v, _mm_and_si128(u, _mm_set1_epi8(0x20))));
+	}
+	return n;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define H1_SIMD_LEN 16
+
+/* Returns the index of the first non-zero byte of the comparison result <c>,
+ * or H1_SIMD_LEN if there is none. Each byte is narrowed to a nibble so that
+ * the result fits in a 64-bit word.
+ */
+static forceinline unsigned int h1_simd_first(uint8x16_t c)
+{
+	uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(c), 4)), 0);
+
+	return m ? __builtin_ctzll(m) >> 2 : H1_SIMD_LEN;
+}
+
+/* Returns the number of leading bytes at <p> which are neither CR nor LF. */
+static forceinline unsigned int h1_simd_skip_val(const char *p)
+{
+	uint8x16_t v = vld1q_u8((const uint8_t *)p);
+
+	return h1_simd_first(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\n'))));
+}
+
+/* Returns the number of leading bytes at <p> which are alphanumeric or '-',
+ * which covers all the header names in practice. If <lower> is set, the upper
+ * case letters among them are turned to lower case.
+ */
+static forceinline unsigned int h1_simd_skip_name(char *p, int lower)
+{
+	static const uint8_t idx[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	uint8x16_t v = vld1q_u8((const uint8_t *)p);
+	uint8x16_t ok = vorrq_u8(vorrq_u8(vcleq_u8(vsubq_u8(vorrq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8('a')), vdupq_n_u8(25)),
+	                                  vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9))),
+	                         vceqq_u8(v, vdupq_n_u8('-')));
+	unsigned int n = h1_simd_first(vmvnq_u8(ok));
+
+	if (lower) {
+		uint8x16_t u = vandq_u8(vcleq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(25)),
+		                        vcltq_u8(vld1q_u8(idx), vdupq_n_u8(n)));
+		if (vmaxvq_u8(u))
+			vst1q_u8((uint8_t *)p, vorrq_u8(v, vandq_u8(u, vdupq_n_u8(0x20))));
+	}
+	return n;
+}
+#endif /* H1_SIMD_LEN */
+
 /* This function parses a contiguous HTTP/1 headers block starting at <start>
  * and ending before <stop>, at once, and converts it a list of (name,value)
  * pairs representing header fields into the array <hdr> of size <hdr_num>,
@@ -660,13 +797,28 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 	case H1_MSG_HDR_NAME:
 	http_msg_hdr_name:
 		/* assumes sol points to the first char */
+#ifdef H1_SIMD_LEN
+		/* speedup: skip the alphanumeric chars and dashes by blocks */
+		while (ptr <= end - H1_SIMD_LEN) {
+			unsigned int n = h1_simd_skip_name(ptr, !skip_update && (h1m->flags & H1_MF_TOLOWER));
+
+			ptr += n;
+			if (n < H1_SIMD_LEN)
+				break;
+		}
+		if (ptr >= end) {
+			state = H1_MSG_HDR_NAME;
+			goto http_msg_ood;
+		}
+#endif
+	http_msg_hdr_name2:
 		if (likely(HTTP_IS_TOKEN(*ptr))) {
 			if (!skip_update) {
 				/* turn it to lower case if needed */
 				if (isupper((unsigned char)*ptr) && h1m->flags & H1_MF_TOLOWER)
 					*ptr = tolower(*ptr);
 			}
-			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 		}
 
 		if (likely(*ptr == ':')) {
@@ -683,7 +835,7 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 			h1m->err_pos = ptr - start + skip; /* >= 0 now */
 
 		/* and we still accept this non-token character */
-		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 
 	case H1_MSG_HDR_L1_SP:
 	http_msg_hdr_l1_sp:
@@ -731,7 +883,18 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 		 * and lower. In fact since most of the time is spent in the loop, we
 		 * also remove the sign bit test so that bytes 0x8e..0x0d break the
 		 * loop, but we don't care since they're very rare in header values.
+		 * When vector instructions are available, larger blocks are first
+		 * skipped up to the exact position of the first CR or LF.
 		 */
+#ifdef H1_SIMD_LEN
+		while (ptr <= end - H1_SIMD_LEN) {
+			unsigned int n = h1_simd_skip_val(ptr);
+
+			ptr += n;
+			if (n < H1_SIMD_LEN)
+				goto http_msg_hdr_val2;
+		}
+#endif
 #ifdef HA_UNALIGNED_LE64
 		while (ptr <= end - sizeof(long)) {
 			if ((*(long *)ptr - 0x0e0e0e0e0e0e0e0eULL) & 0x8080808080808080ULL)
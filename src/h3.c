@@ -766,3 +766,57 @@ int h3_make_htx_trailers(struct http_hdr *list, struct htx *htx)
  fail:
 	return -1;
 }
+
+/* Parses the <value> of a "priority" header field or of a PRIORITY_UPDATE
+ * frame (RFC 9218 #4), which is a structured field dictionary, updating the
+ * <urgency> and <incremental> parameters it holds. As required, the unknown
+ * members and the invalid values are ignored, the parameters keeping their
+ * previous value. The parsing is lenient: the parameters of the members are
+ * skipped and the strings are not checked since none of them is expected.
+ */
+void h3_parse_priority(const struct ist value, unsigned int *urgency, unsigned int *incremental)
+{
+	const char *p = value.ptr, *e = value.ptr + value.len;
+	const char *key, *v, *ve;
+	size_t klen;
+
+	while (p < e) {
+		/* skip the delimitor and the blanks before the member */
+		if (*p == ',' || HTTP_IS_SPHT(*p)) {
+			p++;
+			continue;
+		}
+
+		key = p;
+		while (p < e && *p != '=' && *p != ';' && *p != ',')
+			p++;
+		klen = p - key;
+
+		v = ve = NULL;
+		if (p < e && *p == '=') {
+			v = ++p;
+			while (p < e && *p != ';' && *p != ',')
+				p++;
+			for (ve = p; ve > v && HTTP_IS_SPHT(ve[-1]); ve--)
+				;
+		}
+
+		/* skip the parameters of the member */
+		while (p < e && *p != ',')
+			p++;
+
+		if (klen != 1)
+			continue;
+
+		if (*key == 'u') {
+			if (v && ve - v == 1 && *v >= '0' && *v <= '0' + H3_URGENCY_MAX)
+				*urgency = *v - '0';
+		}
+		else if (*key == 'i') {
+			if (!v)
+				*incremental = 1;
+			else if (ve - v == 2 && v[0] == '?' && (v[1] == '0' || v[1] == '1'))
+				*incremental = v[1] - '0';
+		}
+	}
+}
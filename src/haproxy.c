@@ -214,6 +214,9 @@ static int oldpids_sig; /* use USR1 or TERM */
 /* Path to the unix socket we use to retrieve listener sockets from the old process */
 static const char *old_unixsocket;
 
+/* set by "-dT" to report the time spent in each startup step */
+static int startup_timings;
+
 static char *cur_unixsocket = NULL;
 
 int atexit_flag = 0;
@@ -619,6 +622,27 @@ static void display_build_opts()
 /*
  * This function prints the command line usage and exits
  */
+/* Reports on stderr the time spent since the previous step of the startup and
+ * since the beginning, when enabled with "-dT". <step> describes what was just
+ * done.
+ */
+static void startup_report_step(const char *step)
+{
+	static struct timeval prev;
+	struct timeval tv;
+
+	if (!startup_timings)
+		return;
+
+	gettimeofday(&tv, NULL);
+	if (!prev.tv_sec)
+		prev = start_date;
+
+	fprintf(stderr, "[startup] %-40s %8lu ms (total %lu ms)\n", step,
+	        tv_ms_elapsed(&prev, &tv), tv_ms_elapsed(&start_date, &tv));
+	prev = tv;
+}
+
 static void usage(char *name)
 {
 	display_version();
@@ -645,6 +669,9 @@ static void usage(char *name)
 #if defined(USE_EPOLL)
 		"        -de disables epoll() usage even when available\n"
 #endif
+#if defined(USE_URING)
+		"        -du disables io_uring usage even when available\n"
+#endif
 #if defined(USE_KQUEUE)
 		"        -dk disables kqueue() usage even when available\n"
 #endif
@@ -666,6 +693,7 @@ static void usage(char *name)
 		"        -dr ignores server address resolution failures\n"
 		"        -dV disables SSL verify on servers side\n"
 		"        -dW fails if any warning is emitted\n"
+		"        -dT reports the time spent in each startup step\n"
 		"        -sf/-st [pid ]* finishes/terminates old pids.\n"
 		"        -x <unix_socket> get listening sockets from a unix socket\n"
 		"        -S <bind>[,<bind options>...] new master CLI\n"
@@ -1779,6 +1807,9 @@ static void init(int argc, char **argv)
 #if defined(USE_EPOLL)
 	global.tune.options |= GTUNE_USE_EPOLL;
 #endif
+#if defined(USE_URING)
+	global.tune.options |= GTUNE_USE_URING;
+#endif
 #if defined(USE_KQUEUE)
 	global.tune.options |= GTUNE_USE_KQUEUE;
 #endif
@@ -1821,6 +1852,10 @@ static void init(int argc, char **argv)
 			else if (*flag == 'd' && flag[1] == 'e')
 				global.tune.options &= ~GTUNE_USE_EPOLL;
 #endif
+#if defined(USE_URING)
+			else if (*flag == 'd' && flag[1] == 'u')
+				global.tune.options &= ~GTUNE_USE_URING;
+#endif
 #if defined(USE_POLL)
 			else if (*flag == 'd' && flag[1] == 'p')
 				global.tune.options &= ~GTUNE_USE_POLL;
@@ -1857,6 +1892,8 @@ static void init(int argc, char **argv)
 				mem_poison_byte = flag[2] ? strtol(flag + 2, NULL, 0) : 'P';
 			else if (*flag == 'd' && flag[1] == 'r')
 				global.tune.options |= GTUNE_RESOLVE_DONTFAIL;
+			else if (*flag == 'd' && flag[1] == 'T')
+				startup_timings = 1;
 			else if (*flag == 'd')
 				arg_mode |= MODE_DEBUG;
 			else if (*flag == 'c')
@@ -2038,6 +2075,7 @@ static void init(int argc, char **argv)
 			err_code |= ret;
 			if (err_code & ERR_ABORT)
 				exit(1);
+			startup_report_step(wl->s);
 		}
 
 		/* do not try to resolve arguments nor to spot inconsistencies when
@@ -2128,6 +2166,7 @@ static void init(int argc, char **argv)
 	}
 
 	err_code |= check_config_validity();
+	startup_report_step("check_config_validity");
 	for (px = proxies_list; px; px = px->next) {
 		struct server *srv;
 		struct post_proxy_check_fct *ppcf;
@@ -2140,12 +2179,14 @@ static void init(int argc, char **argv)
 		list_for_each_entry(ppcf, &post_proxy_check_list, list)
 			err_code |= ppcf->fct(px);
 	}
+	startup_report_step("post proxy/server checks");
 	if (err_code & (ERR_ABORT|ERR_FATAL)) {
 		ha_alert("Fatal errors found in configuration.\n");
 		exit(1);
 	}
 
 	err_code |= pattern_finalize_config();
+	startup_report_step("pattern_finalize_config");
 	if (err_code & (ERR_ABORT|ERR_FATAL)) {
 		ha_alert("Failed to finalize pattern config.\n");
 		exit(1);
@@ -2177,12 +2218,14 @@ static void init(int argc, char **argv)
 
 	/* Apply server states */
 	apply_server_state();
+	startup_report_step("apply_server_state");
 
 	for (px = proxies_list; px; px = px->next)
 		srv_compute_all_admin_states(px);
 
 	/* Apply servers' configured address */
 	err_code |= srv_init_addr();
+	startup_report_step("srv_init_addr");
 	if (err_code & (ERR_ABORT|ERR_FATAL)) {
 		ha_alert("Failed to initialize server(s) addr.\n");
 		exit(1);
@@ -2225,6 +2268,7 @@ static void init(int argc, char **argv)
 		if (err_code & (ERR_ABORT|ERR_FATAL))
 			exit(1);
 	}
+	startup_report_step("post checks");
 
 	if (cfg_maxconn > 0)
 		global.maxconn = cfg_maxconn;
@@ -2497,6 +2541,9 @@ static void init(int argc, char **argv)
 	if (!(global.tune.options & GTUNE_USE_EPOLL))
 		disable_poller("epoll");
 
+	if (!(global.tune.options & GTUNE_USE_URING))
+		disable_poller("uring");
+
 	if (!(global.tune.options & GTUNE_USE_POLL))
 		disable_poller("poll");
 
@@ -2554,6 +2601,8 @@ static void deinit_acl_cond(struct acl_cond *cond)
 		free(suite);
 	}
 
+	LIST_DEL(&cond->all);
+	free(cond->prog);
 	free(cond);
 }
 
@@ -2602,9 +2651,19 @@ void deinit(void)
 	struct post_deinit_fct *pdf;
 	struct proxy_deinit_fct *pxdf;
 	struct server_deinit_fct *srvdf;
+	struct stktable *t;
 
 	deinit_signals();
+
+	/* the persisted stick-tables are saved before they are released */
+	for (t = stktables_list; t; t = t->next)
+		stktable_persist_flush(t);
+
 	while (p) {
+		freq_ctr_thr_free(&p->fe_conn_per_sec);
+		freq_ctr_thr_free(&p->fe_sess_per_sec);
+		free(p->fe_counters.thr);
+		free(p->be_counters.thr);
 		free(p->conf.file);
 		free(p->id);
 		free(p->cookie_name);
@@ -2622,8 +2681,13 @@ void deinit(void)
 		free(p->conf.lfs_file);
 		free(p->conf.uniqueid_format_string);
 		free(p->conf.uif_file);
+		release_sample_expr(p->log_sample_key);
 		if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MAP)
 			free(p->lbprm.map.srv);
+		else if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE) {
+			free(p->lbprm.chash.act_tbl.bucket);
+			free(p->lbprm.chash.bck_tbl.bucket);
+		}
 
 		if (p->conf.logformat_sd_string != default_rfc5424_sd_log_format)
 			free(p->conf.logformat_sd_string);
@@ -2670,6 +2734,7 @@ void deinit(void)
 				prune_acl_cond(rule->cond);
 				free(rule->cond);
 			}
+			sw_dispatch_free(rule->dispatch);
 			free(rule->file);
 			free(rule);
 		}
@@ -2742,6 +2807,7 @@ void deinit(void)
 
 
 			task_destroy(s->warmup);
+			task_destroy(s->eject_task);
 
 			free(s->id);
 			free(s->cookie);
@@ -2787,6 +2853,11 @@ void deinit(void)
 			LIST_DEL(&l->by_bind);
 			free(l->name);
 			free(l->counters);
+#ifdef USE_QUIC
+			free(l->icids);
+			free(l->cids);
+			free(l->quic_fds);
+#endif
 			free(l);
 		}
 
@@ -2807,17 +2878,24 @@ void deinit(void)
 
 		free(p->desc);
 		free(p->fwdfor_hdr_name);
+		free(p->early_reject.name);
 
 		task_destroy(p->task);
 
 		pool_destroy(p->req_cap_pool);
 		pool_destroy(p->rsp_cap_pool);
-		if (p->table)
+		if (p->table) {
 			pool_destroy(p->table->pool);
+			free(p->table->shards);
+			free(p->table->sketch);
+			free(p->table->reject.bits[0]);
+			free(p->table->persist.file);
+			free(p->table->persist.tmp);
+		}
 
 		p0 = p;
 		p = p->next;
-		HA_SPIN_DESTROY(&p0->lbprm.lock);
+		HA_RWLOCK_DESTROY(&p0->lbprm.lock);
 		HA_SPIN_DESTROY(&p0->lock);
 		free(p0);
 	}/* end while(p) */
@@ -2876,6 +2954,10 @@ void deinit(void)
 	}
 
 	vars_prune(&global.vars, NULL, NULL);
+	freq_ctr_thr_free(&global.conn_per_sec);
+	freq_ctr_thr_free(&global.sess_per_sec);
+	freq_ctr_thr_free(&global.ssl_per_sec);
+	freq_ctr_thr_free(&global.out_32bps);
 	pool_destroy_all();
 	deinit_pollers();
 } /* end deinit() */
@@ -3266,6 +3348,7 @@ int main(int argc, char **argv)
 	}
 
 	err = protocol_bind_all(errmsg, sizeof(errmsg));
+	startup_report_step("protocol_bind_all");
 	if ((err & ~ERR_WARN) != ERR_NONE) {
 		if ((err & ERR_ALERT) || (err & ERR_WARN))
 			ha_alert("[%s.main()] %s.\n", argv[0], errmsg);
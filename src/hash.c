@@ -13,6 +13,13 @@
  *
  */
 
+#include <string.h>
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+#include <arm_acle.h>
+#endif
 
 #include <common/hash.h>
 
@@ -178,10 +185,30 @@ static const uint32_t crctable[256] = {
   0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L
 };
 
+/* CRC32C (Castagnoli). When the build targets a CPU providing an instruction
+ * for it, it is used on 8 bytes at a time, and only the tail is processed
+ * using the table.
+ */
 uint32_t hash_crc32c(const void *input, int len)
 {
 	const unsigned char *buf = input;
 	uint32_t crc = 0xffffffff;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+	uint64_t crc64 = crc, val;
+
+	for (; len >= 8; len -= 8, buf += 8) {
+		memcpy(&val, buf, sizeof(val));
+		crc64 = _mm_crc32_u64(crc64, val);
+	}
+	crc = crc64;
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+	uint64_t val;
+
+	for (; len >= 8; len -= 8, buf += 8) {
+		memcpy(&val, buf, sizeof(val));
+		crc = __crc32cd(crc, val);
+	}
+#endif
 	while (len-- > 0) {
 		crc = (crc >> 8) ^ crctable[(crc ^ (*buf++)) & 0xff];
 	}
@@ -23,6 +23,7 @@
 #endif
 
 #include <ebpttree.h>
+#include <ebsttree.h>
 
 #include <common/cfgparse.h>
 #include <common/compiler.h>
@@ -121,20 +122,37 @@
  * Note that the HAProxy lua functions rounded by the macro SET_SAFE_LJMP
  * and RESET_SAFE_LJMP manipulates the Lua stack, so it will be careful
  * to set mutex around these functions.
+ *
+ * The scripts loaded with "lua-load-per-thread" run in one state per thread
+ * (states 1 to nbthread), which is only ever used by its own thread. These
+ * ones do not need the lock, only the shared state (state 0) takes it.
  */
 __decl_spinlock(hlua_global_lock);
 THREAD_LOCAL jmp_buf safe_ljmp_env;
 static int hlua_panic_safe(lua_State *L) { return 0; }
 static int hlua_panic_ljmp(lua_State *L) { WILL_LJMP(longjmp(safe_ljmp_env, 1)); }
 
+/* Locks the shared state if <__id> designates it. */
+#define hlua_lock_state(__id) \
+	do { \
+		if (!(__id)) \
+			HA_SPIN_LOCK(LUA_LOCK, &hlua_global_lock); \
+	} while (0)
+
+#define hlua_unlock_state(__id) \
+	do { \
+		if (!(__id)) \
+			HA_SPIN_UNLOCK(LUA_LOCK, &hlua_global_lock); \
+	} while (0)
+
 #define SET_SAFE_LJMP(__L) \
 	({ \
 		int ret; \
-		HA_SPIN_LOCK(LUA_LOCK, &hlua_global_lock); \
+		hlua_lock_state(hlua_gethlua(__L)->state_id); \
 		if (setjmp(safe_ljmp_env) != 0) { \
 			lua_atpanic(__L, hlua_panic_safe); \
 			ret = 0; \
-			HA_SPIN_UNLOCK(LUA_LOCK, &hlua_global_lock); \
+			hlua_unlock_state(hlua_gethlua(__L)->state_id); \
 		} else { \
 			lua_atpanic(__L, hlua_panic_ljmp); \
 			ret = 1; \
@@ -148,7 +166,7 @@ static int hlua_panic_ljmp(lua_State *L) { WILL_LJMP(longjmp(safe_ljmp_env, 1));
 #define RESET_SAFE_LJMP(__L) \
 	do { \
 		lua_atpanic(__L, hlua_panic_safe); \
-		HA_SPIN_UNLOCK(LUA_LOCK, &hlua_global_lock); \
+		hlua_unlock_state(hlua_gethlua(__L)->state_id); \
 	} while(0)
 
 /* Applet status flags */
@@ -159,8 +177,35 @@ static int hlua_panic_ljmp(lua_State *L) { WILL_LJMP(longjmp(safe_ljmp_env, 1));
 #define APPLET_HTTP11   0x20 /* Last chunk sent. */
 #define APPLET_RSP_SENT 0x40 /* The response was fully sent */
 
-/* The main Lua execution context. */
-struct hlua gL;
+/* The main Lua execution context of each state. The first one is the shared
+ * state, the other ones are the per-thread states, built for each thread
+ * only if some scripts are loaded with "lua-load-per-thread".
+ */
+static struct hlua hlua_states[MAX_THREADS + 1];
+
+/* The scripts loaded in each per-thread state, in their loading order, and
+ * the paths prepended to the ones of each state, replayed for the per-thread
+ * states created after the configuration parsing.
+ */
+struct hlua_load_file {
+	struct list l;
+	char *type;  /* "path" or "cpath" for the prepended paths */
+	char *path;
+};
+
+static struct list hlua_per_thread_load = LIST_HEAD_INIT(hlua_per_thread_load);
+static struct list hlua_prepend_paths = LIST_HEAD_INIT(hlua_prepend_paths);
+
+/* The functions registered by the first per-thread state. The other ones
+ * register the same functions in the same order, <hlua_fcn_cursor> is the
+ * last one each of them registered.
+ */
+static struct list hlua_per_thread_fcns = LIST_HEAD_INIT(hlua_per_thread_fcns);
+static struct list *hlua_fcn_cursor[MAX_THREADS + 1];
+
+/* The variables shared between all the states by core.shared_set() */
+static struct eb_root hlua_shared_vars = EB_ROOT_UNIQUE;
+__decl_spinlock(hlua_shared_lock);
 
 /* This is the memory pool containing struct lua for applets
  * (including cli).
@@ -174,8 +219,8 @@ static struct server socket_tcp;
 static struct server socket_ssl;
 #endif
 
-/* List head of the function called at the initialisation time. */
-struct list hlua_init_functions = LIST_HEAD_INIT(hlua_init_functions);
+/* List head of the function called at the initialisation time, per state. */
+static struct list hlua_init_functions[MAX_THREADS + 1];
 
 /* The following variables contains the reference of the different
  * Lua classes. These references are useful for identify metadata
@@ -243,6 +288,7 @@ static struct hlua_mem_allocator hlua_global_allocator;
  * LUA stack contains arguments according with an required ARG_T
  * format.
  */
+static void hlua_init_state(int thr);
 static int hlua_arg2lua(lua_State *L, const struct arg *arg);
 static int hlua_lua2arg(lua_State *L, int ud, struct arg *arg);
 __LJMP static int hlua_lua2arg_check(lua_State *L, int first, struct arg *argp,
@@ -891,36 +937,44 @@ __LJMP void hlua_yieldk(lua_State *L, int nresults, int ctx,
  * set "already_safe" true if the context is initialized form safe
  * Lua function.
  *
+ * The coroutine is created in the <state_id> state, which is 0 for the shared
+ * one or the thread number plus one for the per-thread ones.
+ *
  * This function manipulates two Lua stacks: the main and the thread. Only
  * the main stack can fail. The thread is not manipulated. This function
  * MUST NOT manipulate the created thread stack state, because it is not
  * protected against errors thrown by the thread stack.
  */
-int hlua_ctx_init(struct hlua *lua, struct task *task, int already_safe)
+int hlua_ctx_init(struct hlua *lua, int state_id, struct task *task, int already_safe)
 {
+	lua_State *L = hlua_states[state_id].T;
+
+	lua->T = NULL;
+	lua->state_id = state_id;
 	if (!already_safe) {
-		if (!SET_SAFE_LJMP(gL.T)) {
+		if (!SET_SAFE_LJMP(L)) {
 			lua->Tref = LUA_REFNIL;
 			return 0;
 		}
 	}
 	lua->Mref = LUA_REFNIL;
+	lua->cache_ref = LUA_REFNIL;
 	lua->flags = 0;
 	lua->gc_count = 0;
 	lua->wake_time = TICK_ETERNITY;
 	LIST_INIT(&lua->com);
-	lua->T = lua_newthread(gL.T);
+	lua->T = lua_newthread(L);
 	if (!lua->T) {
 		lua->Tref = LUA_REFNIL;
 		if (!already_safe)
-			RESET_SAFE_LJMP(gL.T);
+			RESET_SAFE_LJMP(L);
 		return 0;
 	}
 	hlua_sethlua(lua);
-	lua->Tref = luaL_ref(gL.T, LUA_REGISTRYINDEX);
+	lua->Tref = luaL_ref(L, LUA_REGISTRYINDEX);
 	lua->task = task;
 	if (!already_safe)
-		RESET_SAFE_LJMP(gL.T);
+		RESET_SAFE_LJMP(L);
 	return 1;
 }
 
@@ -942,12 +996,13 @@ void hlua_ctx_destroy(struct hlua *lua)
 	if (!SET_SAFE_LJMP(lua->T))
 		return;
 	luaL_unref(lua->T, LUA_REGISTRYINDEX, lua->Mref);
+	luaL_unref(lua->T, LUA_REGISTRYINDEX, lua->cache_ref);
 	RESET_SAFE_LJMP(lua->T);
 
-	if (!SET_SAFE_LJMP(gL.T))
+	if (!SET_SAFE_LJMP(hlua_states[lua->state_id].T))
 		return;
-	luaL_unref(gL.T, LUA_REGISTRYINDEX, lua->Tref);
-	RESET_SAFE_LJMP(gL.T);
+	luaL_unref(hlua_states[lua->state_id].T, LUA_REGISTRYINDEX, lua->Tref);
+	RESET_SAFE_LJMP(hlua_states[lua->state_id].T);
 	/* Forces a garbage collecting process. If the Lua program is finished
 	 * without error, we run the GC on the thread pointer. Its freed all
 	 * the unused memory.
@@ -958,10 +1013,10 @@ void hlua_ctx_destroy(struct hlua *lua)
 	 * the garbage collection.
 	 */
 	if (lua->gc_count) {
-		if (!SET_SAFE_LJMP(gL.T))
+		if (!SET_SAFE_LJMP(hlua_states[lua->state_id].T))
 			return;
-		lua_gc(gL.T, LUA_GCCOLLECT, 0);
-		RESET_SAFE_LJMP(gL.T);
+		lua_gc(hlua_states[lua->state_id].T, LUA_GCCOLLECT, 0);
+		RESET_SAFE_LJMP(hlua_states[lua->state_id].T);
 	}
 
 	lua->T = NULL;
@@ -983,11 +1038,11 @@ static int hlua_ctx_renew(struct hlua *lua, int keep_msg)
 	int new_ref;
 
 	/* Renew the main LUA stack doesn't have sense. */
-	if (lua == &gL)
+	if (lua == &hlua_states[lua->state_id])
 		return 0;
 
 	/* New Lua coroutine. */
-	T = lua_newthread(gL.T);
+	T = lua_newthread(hlua_states[lua->state_id].T);
 	if (!T)
 		return 0;
 
@@ -1004,12 +1059,12 @@ static int hlua_ctx_renew(struct hlua *lua, int keep_msg)
 	luaL_unref(lua->T, LUA_REGISTRYINDEX, lua->Mref);
 
 	/* The thread is garbage collected by Lua. */
-	luaL_unref(gL.T, LUA_REGISTRYINDEX, lua->Tref);
+	luaL_unref(hlua_states[lua->state_id].T, LUA_REGISTRYINDEX, lua->Tref);
 
 	/* Fill the struct with the new coroutine values. */
 	lua->Mref = new_ref;
 	lua->T = T;
-	lua->Tref = luaL_ref(gL.T, LUA_REGISTRYINDEX);
+	lua->Tref = luaL_ref(hlua_states[lua->state_id].T, LUA_REGISTRYINDEX);
 
 	/* Set context. */
 	hlua_sethlua(lua);
@@ -1082,9 +1137,9 @@ static enum hlua_exec hlua_ctx_resume(struct hlua *lua, int yield_allowed)
 		lua->run_time = 0;
 
 	/* Lock the whole Lua execution. This lock must be before the
-	 * label "resume_execution".
+	 * label "resume_execution". Only the shared state needs it.
 	 */
-	HA_SPIN_LOCK(LUA_LOCK, &hlua_global_lock);
+	hlua_lock_state(lua->state_id);
 
 resume_execution:
 
@@ -1104,7 +1159,7 @@ resume_execution:
 	lua->wake_time = TICK_ETERNITY;
 
 	/* Call the function. */
-	ret = lua_resume(lua->T, gL.T, lua->nargs);
+	ret = lua_resume(lua->T, hlua_states[lua->state_id].T, lua->nargs);
 	switch (ret) {
 
 	case LUA_OK:
@@ -1224,7 +1279,7 @@ resume_execution:
 	}
 
 	/* This is the main exit point, remove the Lua lock. */
-	HA_SPIN_UNLOCK(LUA_LOCK, &hlua_global_lock);
+	hlua_unlock_state(lua->state_id);
 
 	return ret;
 }
@@ -1343,6 +1398,204 @@ static int hlua_set_map(lua_State *L)
 	return 0;
 }
 
+/* Allocates a shared variable named <name>, or throws an error. */
+__LJMP static struct hlua_shared_var *hlua_shared_var_new(lua_State *L, const char *name)
+{
+	struct hlua_shared_var *var;
+	size_t len = strlen(name);
+
+	var = calloc(1, sizeof(*var) + len + 1);
+	if (!var)
+		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
+	memcpy(var->node.key, name, len + 1);
+	return var;
+}
+
+static void hlua_shared_var_free(struct hlua_shared_var *var)
+{
+	if (var && var->type == LUA_TSTRING)
+		free(var->data.str.ptr);
+	free(var);
+}
+
+/* Stores <value> as the shared variable <name>, which is seen by all the Lua
+ * states, including the per-thread ones. Only booleans, numbers and strings
+ * may be shared, a nil value removes the variable. The values are copied, the
+ * lock is never held while calling Lua.
+ *
+ * Lua prototype:
+ *
+ *   <none> core.shared_set(<name>, <value>)
+ */
+__LJMP static int hlua_shared_set(lua_State *L)
+{
+	struct hlua_shared_var *var = NULL;
+	struct ebmb_node *node;
+	const char *name;
+	const char *str;
+	size_t len;
+	int type;
+
+	MAY_LJMP(check_args(L, 2, "shared_set"));
+
+	name = MAY_LJMP(luaL_checkstring(L, 1));
+	type = lua_type(L, 2);
+	if (type != LUA_TNIL && type != LUA_TBOOLEAN && type != LUA_TNUMBER && type != LUA_TSTRING)
+		WILL_LJMP(luaL_argerror(L, 2, "boolean, number, string or nil expected"));
+
+	if (type != LUA_TNIL) {
+		var = MAY_LJMP(hlua_shared_var_new(L, name));
+		var->type = type;
+		if (type == LUA_TBOOLEAN)
+			var->data.b = lua_toboolean(L, 2);
+		else if (type == LUA_TNUMBER && lua_isinteger(L, 2)) {
+			var->isint = 1;
+			var->data.i = lua_tointeger(L, 2);
+		}
+		else if (type == LUA_TNUMBER)
+			var->data.n = lua_tonumber(L, 2);
+		else {
+			str = lua_tolstring(L, 2, &len);
+			var->data.str.ptr = malloc(len + 1);
+			if (!var->data.str.ptr) {
+				free(var);
+				WILL_LJMP(luaL_error(L, "Lua out of memory error."));
+			}
+			memcpy(var->data.str.ptr, str, len + 1);
+			var->data.str.len = len;
+		}
+	}
+
+	HA_SPIN_LOCK(LUA_LOCK, &hlua_shared_lock);
+	node = ebst_lookup(&hlua_shared_vars, name);
+	if (node)
+		ebmb_delete(node);
+	if (var)
+		ebst_insert(&hlua_shared_vars, &var->node);
+	HA_SPIN_UNLOCK(LUA_LOCK, &hlua_shared_lock);
+
+	if (node)
+		hlua_shared_var_free(ebmb_entry(node, struct hlua_shared_var, node));
+	return 0;
+}
+
+/* Returns the value of the shared variable <name>, or nil if it is not set.
+ *
+ * Lua prototype:
+ *
+ *   <value> core.shared_get(<name>)
+ */
+__LJMP static int hlua_shared_get(lua_State *L)
+{
+	struct hlua_shared_var *var;
+	struct ebmb_node *node;
+	const char *name;
+	char *str = NULL;
+	size_t len = 0;
+	lua_Integer i = 0;
+	lua_Number n = 0;
+	int type = LUA_TNIL;
+	int isint = 0;
+	int b = 0;
+
+	MAY_LJMP(check_args(L, 1, "shared_get"));
+
+	name = MAY_LJMP(luaL_checkstring(L, 1));
+
+	HA_SPIN_LOCK(LUA_LOCK, &hlua_shared_lock);
+	node = ebst_lookup(&hlua_shared_vars, name);
+	if (node) {
+		var = ebmb_entry(node, struct hlua_shared_var, node);
+		type = var->type;
+		isint = var->isint;
+		if (type == LUA_TBOOLEAN)
+			b = var->data.b;
+		else if (type == LUA_TNUMBER && isint)
+			i = var->data.i;
+		else if (type == LUA_TNUMBER)
+			n = var->data.n;
+		else {
+			len = var->data.str.len;
+			str = malloc(len + 1);
+			if (str)
+				memcpy(str, var->data.str.ptr, len + 1);
+		}
+	}
+	HA_SPIN_UNLOCK(LUA_LOCK, &hlua_shared_lock);
+
+	switch (type) {
+	case LUA_TBOOLEAN:
+		lua_pushboolean(L, b);
+		break;
+	case LUA_TNUMBER:
+		if (isint)
+			lua_pushinteger(L, i);
+		else
+			lua_pushnumber(L, n);
+		break;
+	case LUA_TSTRING:
+		if (!str)
+			WILL_LJMP(luaL_error(L, "Lua out of memory error."));
+		lua_pushlstring(L, str, len);
+		free(str);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+	return 1;
+}
+
+/* Atomically adds <delta> to the shared integer variable <name>, which starts
+ * from zero if it is not set, and returns its new value.
+ *
+ * Lua prototype:
+ *
+ *   <integer> core.shared_add(<name>, <delta>)
+ */
+__LJMP static int hlua_shared_add(lua_State *L)
+{
+	struct hlua_shared_var *var, *cur;
+	struct ebmb_node *node;
+	const char *name;
+	lua_Integer delta;
+	lua_Integer ret = 0;
+	int isint;
+
+	MAY_LJMP(check_args(L, 2, "shared_add"));
+
+	name = MAY_LJMP(luaL_checkstring(L, 1));
+	delta = MAY_LJMP(luaL_checkinteger(L, 2));
+
+	/* in case it does not exist yet */
+	var = MAY_LJMP(hlua_shared_var_new(L, name));
+	var->type = LUA_TNUMBER;
+	var->isint = 1;
+
+	HA_SPIN_LOCK(LUA_LOCK, &hlua_shared_lock);
+	node = ebst_lookup(&hlua_shared_vars, name);
+	if (!node) {
+		ebst_insert(&hlua_shared_vars, &var->node);
+		cur = var;
+		var = NULL;
+	}
+	else
+		cur = ebmb_entry(node, struct hlua_shared_var, node);
+
+	isint = cur->type == LUA_TNUMBER && cur->isint;
+	if (isint) {
+		cur->data.i += delta;
+		ret = cur->data.i;
+	}
+	HA_SPIN_UNLOCK(LUA_LOCK, &hlua_shared_lock);
+
+	free(var);
+	if (!isint)
+		WILL_LJMP(luaL_error(L, "'shared_add': variable '%s' is not an integer", name));
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
 /* A class is a lot of memory that contain data. This data can be a table,
  * an integer or user data. This data is associated with a metatable. This
  * metatable have an original version registered in the global context with
@@ -4454,7 +4707,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 	}
 	if (!sl) {
 		hlua_pusherror(L, "Lua applet http '%s': Failed to create response.\n",
-		               appctx->appctx->rule->arg.hlua_rule->fcn.name);
+		               appctx->appctx->rule->arg.hlua_rule->fcn->name);
 		WILL_LJMP(lua_error(L));
 	}
 	sl->info.res.status = appctx->appctx->ctx.hlua_apphttp.status;
@@ -4463,7 +4716,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 	lua_pushvalue(L, 0);
 	if (lua_getfield(L, 1, "response") != LUA_TTABLE) {
 		hlua_pusherror(L, "Lua applet http '%s': AppletHTTP['response'] missing.\n",
-		               appctx->appctx->rule->arg.hlua_rule->fcn.name);
+		               appctx->appctx->rule->arg.hlua_rule->fcn->name);
 		WILL_LJMP(lua_error(L));
 	}
 
@@ -4473,7 +4726,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 		/* We expect a string as -2. */
 		if (lua_type(L, -2) != LUA_TSTRING) {
 			hlua_pusherror(L, "Lua applet http '%s': AppletHTTP['response'][] element must be a string. got %s.\n",
-				       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+				       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 			               lua_typename(L, lua_type(L, -2)));
 			WILL_LJMP(lua_error(L));
 		}
@@ -4482,7 +4735,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 		/* We expect an array as -1. */
 		if (lua_type(L, -1) != LUA_TTABLE) {
 			hlua_pusherror(L, "Lua applet http '%s': AppletHTTP['response']['%s'] element must be an table. got %s.\n",
-				       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+				       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 				       name,
 			               lua_typename(L, lua_type(L, -1)));
 			WILL_LJMP(lua_error(L));
@@ -4496,7 +4749,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 			/* We expect a number as -2. */
 			if (lua_type(L, -2) != LUA_TNUMBER) {
 				hlua_pusherror(L, "Lua applet http '%s': AppletHTTP['response']['%s'][] element must be a number. got %s.\n",
-					       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+					       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 					       name,
 				               lua_typename(L, lua_type(L, -2)));
 				WILL_LJMP(lua_error(L));
@@ -4506,7 +4759,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 			/* We expect a string as -2. */
 			if (lua_type(L, -1) != LUA_TSTRING) {
 				hlua_pusherror(L, "Lua applet http '%s': AppletHTTP['response']['%s'][%d] element must be a string. got %s.\n",
-					       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+					       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 					       name, id,
 				               lua_typename(L, lua_type(L, -1)));
 				WILL_LJMP(lua_error(L));
@@ -4523,7 +4776,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 				ret = h1_parse_cont_len_header(&h1m, &v);
 				if (ret < 0) {
 					hlua_pusherror(L, "Lua applet http '%s': Invalid '%s' header.\n",
-						       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+						       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 						       name);
 					WILL_LJMP(lua_error(L));
 				}
@@ -4534,7 +4787,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 			/* Add a new header */
 			if (!htx_add_header(htx, ist2(name, nlen), ist2(value, vlen))) {
 				hlua_pusherror(L, "Lua applet http '%s': Failed to add header '%s' in the response.\n",
-					       appctx->appctx->rule->arg.hlua_rule->fcn.name,
+					       appctx->appctx->rule->arg.hlua_rule->fcn->name,
 					       name);
 				WILL_LJMP(lua_error(L));
 			}
@@ -4580,7 +4833,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 		sl->flags |= (HTX_SL_F_XFER_ENC|H1_MF_CHNK|H1_MF_XFER_LEN);
 		if (!htx_add_header(htx, ist("transfer-encoding"), ist("chunked"))) {
 			hlua_pusherror(L, "Lua applet http '%s': Failed to add header 'transfer-encoding' in the response.\n",
-				       appctx->appctx->rule->arg.hlua_rule->fcn.name);
+				       appctx->appctx->rule->arg.hlua_rule->fcn->name);
 			WILL_LJMP(lua_error(L));
 		}
 	}
@@ -4588,7 +4841,7 @@ __LJMP static int hlua_applet_http_send_response(lua_State *L)
 	/* Finalize headers. */
 	if (!htx_add_endof(htx, HTX_BLK_EOH)) {
 		hlua_pusherror(L, "Lua applet http '%s': Failed create the response.\n",
-			       appctx->appctx->rule->arg.hlua_rule->fcn.name);
+			       appctx->appctx->rule->arg.hlua_rule->fcn->name);
 		WILL_LJMP(lua_error(L));
 	}
 
@@ -4767,6 +5020,197 @@ __LJMP static int hlua_http_res_get_headers(lua_State *L)
 	return hlua_http_get_headers(L, &htxn->s->txn->rsp);
 }
 
+/* This function pushes the full value of the <occ> occurrence of the header
+ * named by the second argument, or nil if there is none. <occ> is the third
+ * argument, it defaults to 1 for the first occurrence and negative values
+ * count from the last one. Unlike hlua_http_get_headers(), it only reads the
+ * header from the HTX message. It is a wrapper for the 2 following functions.
+ */
+__LJMP static int hlua_http_get_header(lua_State *L, struct http_msg *msg)
+{
+	size_t len;
+	const char *name = MAY_LJMP(luaL_checklstring(L, 2, &len));
+	lua_Integer occ = MAY_LJMP(luaL_optinteger(L, 3, 1));
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct http_hdr_ctx ctx;
+	lua_Integer cnt = 0;
+
+	if (occ < 0) {
+		ctx.blk = NULL;
+		while (http_find_header(htx, ist2(name, len), &ctx, 1))
+			cnt++;
+		occ += cnt + 1;
+		cnt = 0;
+	}
+
+	ctx.blk = NULL;
+	while (occ > 0 && http_find_header(htx, ist2(name, len), &ctx, 1)) {
+		if (++cnt == occ) {
+			lua_pushlstring(L, ctx.value.ptr, ctx.value.len);
+			return 1;
+		}
+	}
+	lua_pushnil(L);
+	return 1;
+}
+
+__LJMP static int hlua_http_req_get_header(lua_State *L)
+{
+	struct hlua_txn *htxn;
+
+	if (lua_gettop(L) < 2 || lua_gettop(L) > 3)
+		WILL_LJMP(luaL_error(L, "'req_get_header' needs between 2 and 3 arguments"));
+	htxn = MAY_LJMP(hlua_checkhttp(L, 1));
+
+	if (htxn->dir != SMP_OPT_DIR_REQ || !IS_HTX_STRM(htxn->s))
+		WILL_LJMP(lua_error(L));
+
+	return hlua_http_get_header(L, &htxn->s->txn->req);
+}
+
+__LJMP static int hlua_http_res_get_header(lua_State *L)
+{
+	struct hlua_txn *htxn;
+
+	if (lua_gettop(L) < 2 || lua_gettop(L) > 3)
+		WILL_LJMP(luaL_error(L, "'res_get_header' needs between 2 and 3 arguments"));
+	htxn = MAY_LJMP(hlua_checkhttp(L, 1));
+
+	if (htxn->dir != SMP_OPT_DIR_RES || !IS_HTX_STRM(htxn->s))
+		WILL_LJMP(lua_error(L));
+
+	return hlua_http_get_header(L, &htxn->s->txn->rsp);
+}
+
+/* Returns the HTX message the iterator created by hlua_http_iterate() walks
+ * through, from its upvalues: the HTTP object and the message direction.
+ */
+__LJMP static struct htx *hlua_http_iter_htx(lua_State *L)
+{
+	struct hlua_txn *htxn = MAY_LJMP(hlua_checkhttp(L, lua_upvalueindex(1)));
+	struct http_msg *msg;
+
+	msg = lua_toboolean(L, lua_upvalueindex(2)) ? &htxn->s->txn->rsp : &htxn->s->txn->req;
+	return htxbuf(&msg->chn->buf);
+}
+
+/* Returns the next block of <type> of the <htx> message an iterator reads,
+ * starting from the position stored in its third upvalue, which is updated.
+ * The walk ends at the block of type <stop>. If the message was changed during
+ * the iteration, the walk restarts from the nearest valid block. Returns NULL
+ * at the end.
+ */
+static struct htx_blk *hlua_http_iter_next(lua_State *L, struct htx *htx,
+                                           enum htx_blk_type type, enum htx_blk_type stop)
+{
+	int32_t pos = lua_tointeger(L, lua_upvalueindex(3));
+	struct htx_blk *blk;
+
+	if (pos < 0 || htx->head == -1 || pos > htx->tail)
+		return NULL;
+	if (pos < htx->head)
+		pos = htx->head;
+
+	for (; pos != -1; pos = htx_get_next(htx, pos)) {
+		blk = htx_get_blk(htx, pos);
+		if (htx_get_blk_type(blk) == stop)
+			break;
+		if (htx_get_blk_type(blk) == type) {
+			lua_pushinteger(L, pos + 1);
+			lua_replace(L, lua_upvalueindex(3));
+			return blk;
+		}
+	}
+
+	lua_pushinteger(L, -1);
+	lua_replace(L, lua_upvalueindex(3));
+	return NULL;
+}
+
+/* Iterator function returned by hlua_http_req_headers() and
+ * hlua_http_res_headers(). It returns the name and the value of the next
+ * header, read from the HTX message, or nothing after the last one.
+ */
+__LJMP static int hlua_http_headers_next(lua_State *L)
+{
+	struct htx *htx = MAY_LJMP(hlua_http_iter_htx(L));
+	struct htx_blk *blk;
+	struct ist n, v;
+
+	blk = hlua_http_iter_next(L, htx, HTX_BLK_HDR, HTX_BLK_EOH);
+	if (!blk)
+		return 0;
+
+	n = htx_get_blk_name(htx, blk);
+	v = htx_get_blk_value(htx, blk);
+	lua_pushlstring(L, n.ptr, n.len);
+	lua_pushlstring(L, v.ptr, v.len);
+	return 2;
+}
+
+/* Iterator function returned by hlua_http_req_body_chunks() and
+ * hlua_http_res_body_chunks(). It returns the next chunk of the body present
+ * in the HTX message as a string of a single DATA block, or nothing after the
+ * last one.
+ */
+__LJMP static int hlua_http_body_next(lua_State *L)
+{
+	struct htx *htx = MAY_LJMP(hlua_http_iter_htx(L));
+	struct htx_blk *blk;
+	struct ist v;
+
+	blk = hlua_http_iter_next(L, htx, HTX_BLK_DATA, HTX_BLK_EOT);
+	if (!blk)
+		return 0;
+
+	v = htx_get_blk_value(htx, blk);
+	lua_pushlstring(L, v.ptr, v.len);
+	return 1;
+}
+
+/* This function pushes an iterator function <next> walking through the HTX
+ * message of the HTTP object from its first block, in the response if <res>
+ * is set, in the request otherwise. It does not build any table, so that only
+ * the elements the caller actually reads are copied. It is a wrapper for the
+ * 4 following functions.
+ */
+__LJMP static int hlua_http_iterate(lua_State *L, char *fcn, int res, lua_CFunction next)
+{
+	struct hlua_txn *htxn;
+
+	MAY_LJMP(check_args(L, 1, fcn));
+	htxn = MAY_LJMP(hlua_checkhttp(L, 1));
+
+	if (htxn->dir != (res ? SMP_OPT_DIR_RES : SMP_OPT_DIR_REQ) || !IS_HTX_STRM(htxn->s))
+		WILL_LJMP(lua_error(L));
+
+	lua_pushvalue(L, 1);
+	lua_pushboolean(L, res);
+	lua_pushinteger(L, htx_get_first(htxbuf(res ? &htxn->s->res.buf : &htxn->s->req.buf)));
+	lua_pushcclosure(L, next, 3);
+	return 1;
+}
+
+__LJMP static int hlua_http_req_headers(lua_State *L)
+{
+	return MAY_LJMP(hlua_http_iterate(L, "req_headers", 0, hlua_http_headers_next));
+}
+
+__LJMP static int hlua_http_res_headers(lua_State *L)
+{
+	return MAY_LJMP(hlua_http_iterate(L, "res_headers", 1, hlua_http_headers_next));
+}
+
+__LJMP static int hlua_http_req_body_chunks(lua_State *L)
+{
+	return MAY_LJMP(hlua_http_iterate(L, "req_body_chunks", 0, hlua_http_body_next));
+}
+
+__LJMP static int hlua_http_res_body_chunks(lua_State *L)
+{
+	return MAY_LJMP(hlua_http_iterate(L, "res_body_chunks", 1, hlua_http_body_next));
+}
+
 /* This function replace full header, or just a value in
  * the request or in the response. It is a wrapper fir the
  * 4 following functions.
@@ -6089,14 +6533,15 @@ __LJMP static int hlua_register_init(lua_State *L)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	init->function_ref = ref;
-	LIST_ADDQ(&hlua_init_functions, &init->l);
+	LIST_ADDQ(&hlua_init_functions[hlua_gethlua(L)->state_id], &init->l);
 	return 0;
 }
 
 /* This functio is an LUA binding. It permits to register a task
  * executed in parallel of the main HAroxy activity. The task is
  * created and it is set in the HAProxy scheduler. It can be called
- * from the "init" section, "post init" or during the runtime.
+ * from the "init" section, "post init" or during the runtime. The
+ * task registered by a per-thread state only runs on its thread.
  *
  * Lua prototype:
  *
@@ -6106,6 +6551,7 @@ static int hlua_register_task(lua_State *L)
 {
 	struct hlua *hlua;
 	struct task *task;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref;
 
 	MAY_LJMP(check_args(L, 1, "register_task"));
@@ -6116,14 +6562,14 @@ static int hlua_register_task(lua_State *L)
 	if (!hlua)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
-	task = task_new(MAX_THREADS_MASK);
+	task = task_new(state_id ? 1UL << (state_id - 1) : MAX_THREADS_MASK);
 	if (!task)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	task->context = hlua;
 	task->process = hlua_process_task;
 
-	if (!hlua_ctx_init(hlua, task, 1))
+	if (!hlua_ctx_init(hlua, state_id, task, 1))
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	/* Restore the function in the stack. */
@@ -6136,6 +6582,133 @@ static int hlua_register_task(lua_State *L)
 	return 0;
 }
 
+/* Returns the state the function <fcn> runs in on the current thread: the
+ * shared one if it was registered by a script loaded with "lua-load", or
+ * the one of the thread if it was loaded with "lua-load-per-thread".
+ */
+static inline int hlua_state_id_fcn(const struct hlua_function *fcn)
+{
+	return fcn->function_ref[0] != -1 ? 0 : tid + 1;
+}
+
+/* Builds in a trash chunk the key of the result of the cacheable function
+ * <fcn> called with the arguments <arg_p>, and with the input sample <smp> for
+ * converters (NULL for sample fetches). Returns NULL if it does not fit.
+ */
+static struct buffer *hlua_cache_key(const struct hlua_function *fcn, const struct arg *arg_p,
+                                     const struct sample *smp)
+{
+	struct buffer *key = get_trash_chunk();
+	uint32_t len;
+
+	if (!chunk_memcat(key, (const char *)&fcn, sizeof(fcn)))
+		return NULL;
+
+	for (; arg_p && arg_p->type != ARGT_STOP; arg_p++) {
+		if (arg_p->type != ARGT_STR)
+			return NULL;
+		len = arg_p->data.str.data;
+		if (!chunk_memcat(key, (const char *)&len, sizeof(len)) ||
+		    !chunk_memcat(key, arg_p->data.str.area, len))
+			return NULL;
+	}
+
+	if (smp) {
+		if (smp->data.type != SMP_T_STR)
+			return NULL;
+		len = smp->data.u.str.data;
+		if (!chunk_memcat(key, (const char *)&len, sizeof(len)) ||
+		    !chunk_memcat(key, smp->data.u.str.area, len))
+			return NULL;
+	}
+	return key;
+}
+
+/* Looks in the Lua context of stream <s> for the result of the cacheable
+ * function <fcn> called with <arg_p>, and with the input sample <smp> for a
+ * converter if <conv> is set. The cached results are only valid while the
+ * stream evaluates the same rule set without receiving any data, so they are
+ * dropped otherwise. On hit, <smp> is set from the result and 1 is returned,
+ * otherwise 0.
+ */
+static int hlua_cache_get(struct stream *s, const struct hlua_function *fcn,
+                          const struct arg *arg_p, struct sample *smp, int conv)
+{
+	struct hlua *hlua = s->hlua;
+	struct buffer *key;
+	int ret = 0;
+
+	if (hlua->cache_ref != LUA_REFNIL &&
+	    (hlua->cache_rules != s->current_rule_list ||
+	     hlua->cache_in[0] != s->req.total || hlua->cache_in[1] != s->res.total)) {
+		if (!SET_SAFE_LJMP(hlua->T))
+			return 0;
+		luaL_unref(hlua->T, LUA_REGISTRYINDEX, hlua->cache_ref);
+		hlua->cache_ref = LUA_REFNIL;
+		RESET_SAFE_LJMP(hlua->T);
+	}
+
+	if (hlua->cache_ref == LUA_REFNIL)
+		return 0;
+
+	key = hlua_cache_key(fcn, arg_p, conv ? smp : NULL);
+	if (!key)
+		return 0;
+
+	if (!SET_SAFE_LJMP(hlua->T))
+		return 0;
+	if (lua_checkstack(hlua->T, 2)) {
+		lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, hlua->cache_ref);
+		lua_pushlstring(hlua->T, key->area, key->data);
+		lua_rawget(hlua->T, -2);
+		if (!lua_isnil(hlua->T, -1)) {
+			/* the table still references the value */
+			hlua_lua2smp(hlua->T, -1, smp);
+			ret = 1;
+		}
+		lua_pop(hlua->T, 2);
+	}
+	RESET_SAFE_LJMP(hlua->T);
+	return ret;
+}
+
+/* Stores the result at the top of the stack of the Lua context of stream <s>
+ * as the one of the cacheable function <fcn> called with <arg_p>, and with the
+ * input sample <smp> for a converter if <conv> is set. The result is left on
+ * the stack. Nothing is cached on error.
+ */
+static void hlua_cache_set(struct stream *s, const struct hlua_function *fcn,
+                           const struct arg *arg_p, const struct sample *smp, int conv)
+{
+	struct hlua *hlua = s->hlua;
+	struct buffer *key;
+
+	key = hlua_cache_key(fcn, arg_p, conv ? smp : NULL);
+	if (!key)
+		return;
+
+	if (!SET_SAFE_LJMP(hlua->T))
+		return;
+	if (!lua_checkstack(hlua->T, 3))
+		goto end;
+
+	if (hlua->cache_ref == LUA_REFNIL) {
+		lua_newtable(hlua->T);
+		hlua->cache_ref = luaL_ref(hlua->T, LUA_REGISTRYINDEX);
+		hlua->cache_rules = s->current_rule_list;
+		hlua->cache_in[0] = s->req.total;
+		hlua->cache_in[1] = s->res.total;
+	}
+
+	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, hlua->cache_ref);
+	lua_pushlstring(hlua->T, key->area, key->data);
+	lua_pushvalue(hlua->T, -3);
+	lua_rawset(hlua->T, -3);
+	lua_pop(hlua->T, 1);
+ end:
+	RESET_SAFE_LJMP(hlua->T);
+}
+
 /* Wrapper called by HAProxy to execute an LUA converter. This wrapper
  * doesn't allow "yield" functions because the HAProxy engine cannot
  * resume converters.
@@ -6144,6 +6717,7 @@ static int hlua_sample_conv_wrapper(const struct arg *arg_p, struct sample *smp,
 {
 	struct hlua_function *fcn = private;
 	struct stream *stream = smp->strm;
+	int state_id = hlua_state_id_fcn(fcn);
 	const char *error;
 
 	if (!stream)
@@ -6160,11 +6734,20 @@ static int hlua_sample_conv_wrapper(const struct arg *arg_p, struct sample *smp,
 			SEND_ERR(stream->be, "Lua converter '%s': can't initialize Lua context.\n", fcn->name);
 			return 0;
 		}
-		if (!hlua_ctx_init(stream->hlua, stream->task, 0)) {
+		if (!hlua_ctx_init(stream->hlua, state_id, stream->task, 0)) {
 			SEND_ERR(stream->be, "Lua converter '%s': can't initialize Lua context.\n", fcn->name);
 			return 0;
 		}
 	}
+	else if (stream->hlua->state_id != state_id) {
+		SEND_ERR(stream->be, "Lua converter '%s': cannot mix shared and per-thread Lua functions in the same stream.\n", fcn->name);
+		return 0;
+	}
+
+	/* The result may already be known. */
+	if ((fcn->flags & HLUA_FCN_F_CACHEABLE) && !HLUA_IS_RUNNING(stream->hlua) &&
+	    hlua_cache_get(stream, fcn, arg_p, smp, 1))
+		return 1;
 
 	/* If it is the first run, initialize the data for the call. */
 	if (!HLUA_IS_RUNNING(stream->hlua)) {
@@ -6187,7 +6770,7 @@ static int hlua_sample_conv_wrapper(const struct arg *arg_p, struct sample *smp,
 		}
 
 		/* Restore the function in the stack. */
-		lua_rawgeti(stream->hlua->T, LUA_REGISTRYINDEX, fcn->function_ref);
+		lua_rawgeti(stream->hlua->T, LUA_REGISTRYINDEX, fcn->function_ref[state_id]);
 
 		/* convert input sample and pust-it in the stack. */
 		if (!lua_checkstack(stream->hlua->T, 1)) {
@@ -6226,6 +6809,9 @@ static int hlua_sample_conv_wrapper(const struct arg *arg_p, struct sample *smp,
 		if (lua_gettop(stream->hlua->T) <= 0)
 			return 0;
 
+		if (fcn->flags & HLUA_FCN_F_CACHEABLE)
+			hlua_cache_set(stream, fcn, arg_p, smp, 1);
+
 		/* Convert the returned value in sample. */
 		hlua_lua2smp(stream->hlua->T, -1, smp);
 		lua_pop(stream->hlua->T, 1);
@@ -6275,6 +6861,7 @@ static int hlua_sample_fetch_wrapper(const struct arg *arg_p, struct sample *smp
 {
 	struct hlua_function *fcn = private;
 	struct stream *stream = smp->strm;
+	int state_id = hlua_state_id_fcn(fcn);
 	const char *error;
 	unsigned int hflags = HLUA_TXN_NOTERM;
 
@@ -6292,11 +6879,22 @@ static int hlua_sample_fetch_wrapper(const struct arg *arg_p, struct sample *smp
 			SEND_ERR(stream->be, "Lua sample-fetch '%s': can't initialize Lua context.\n", fcn->name);
 			return 0;
 		}
-		if (!hlua_ctx_init(stream->hlua, stream->task, 0)) {
+		if (!hlua_ctx_init(stream->hlua, state_id, stream->task, 0)) {
 			SEND_ERR(stream->be, "Lua sample-fetch '%s': can't initialize Lua context.\n", fcn->name);
 			return 0;
 		}
 	}
+	else if (stream->hlua->state_id != state_id) {
+		SEND_ERR(stream->be, "Lua sample-fetch '%s': cannot mix shared and per-thread Lua functions in the same stream.\n", fcn->name);
+		return 0;
+	}
+
+	/* The result may already be known. */
+	if ((fcn->flags & HLUA_FCN_F_CACHEABLE) && !HLUA_IS_RUNNING(stream->hlua) &&
+	    hlua_cache_get(stream, fcn, arg_p, smp, 0)) {
+		smp->flags &= ~SMP_F_MAY_CHANGE;
+		return 1;
+	}
 
 	/* If it is the first run, initialize the data for the call. */
 	if (!HLUA_IS_RUNNING(stream->hlua)) {
@@ -6319,7 +6917,7 @@ static int hlua_sample_fetch_wrapper(const struct arg *arg_p, struct sample *smp
 		}
 
 		/* Restore the function in the stack. */
-		lua_rawgeti(stream->hlua->T, LUA_REGISTRYINDEX, fcn->function_ref);
+		lua_rawgeti(stream->hlua->T, LUA_REGISTRYINDEX, fcn->function_ref[state_id]);
 
 		/* push arguments in the stack. */
 		if (!hlua_txn_new(stream->hlua->T, stream, smp->px, smp->opt & SMP_OPT_DIR, hflags)) {
@@ -6356,6 +6954,9 @@ static int hlua_sample_fetch_wrapper(const struct arg *arg_p, struct sample *smp
 		if (lua_gettop(stream->hlua->T) <= 0)
 			return 0;
 
+		if (fcn->flags & HLUA_FCN_F_CACHEABLE)
+			hlua_cache_set(stream, fcn, arg_p, smp, 0);
+
 		/* Convert the returned value in sample. */
 		hlua_lua2smp(stream->hlua->T, -1, smp);
 		lua_pop(stream->hlua->T, 1);
@@ -6398,6 +6999,46 @@ static int hlua_sample_fetch_wrapper(const struct arg *arg_p, struct sample *smp
 	}
 }
 
+/* Returns the function the <L> state is registering, named <name> if not
+ * NULL. A new one is allocated for the shared state and for the first
+ * per-thread state, which records it. The other per-thread states load the
+ * same scripts, so they register the same functions in the same order as
+ * the first one: they get the function it registered at the same rank,
+ * whose keywords are already declared, and the caller only has to set its
+ * reference in the state. Throws an error on failure.
+ */
+__LJMP static struct hlua_function *hlua_function_get(lua_State *L, const char *name)
+{
+	int state_id = hlua_gethlua(L)->state_id;
+	struct hlua_function *fcn;
+	int i;
+
+	if (state_id > 1) {
+		if (!hlua_fcn_cursor[state_id])
+			hlua_fcn_cursor[state_id] = &hlua_per_thread_fcns;
+		if (hlua_fcn_cursor[state_id]->n == &hlua_per_thread_fcns)
+			WILL_LJMP(luaL_error(L, "Lua per-thread state of thread %d registers more functions than the first one.",
+			                     state_id));
+		hlua_fcn_cursor[state_id] = hlua_fcn_cursor[state_id]->n;
+		fcn = LIST_ELEM(hlua_fcn_cursor[state_id], struct hlua_function *, l);
+		if (name && strcmp(fcn->name, name) != 0)
+			WILL_LJMP(luaL_error(L, "Lua per-thread state of thread %d registers '%s' instead of '%s'.",
+			                     state_id, name, fcn->name));
+		return fcn;
+	}
+
+	fcn = calloc(1, sizeof(*fcn));
+	if (!fcn)
+		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
+	for (i = 0; i <= MAX_THREADS; i++)
+		fcn->function_ref[i] = -1;
+	if (state_id)
+		LIST_ADDQ(&hlua_per_thread_fcns, &fcn->l);
+	else
+		LIST_INIT(&fcn->l);
+	return fcn;
+}
+
 /* This function is an LUA binding used for registering
  * "sample-conv" functions. It expects a converter name used
  * in the haproxy configuration file, and an LUA function.
@@ -6406,11 +7047,13 @@ __LJMP static int hlua_register_converters(lua_State *L)
 {
 	struct sample_conv_kw_list *sck;
 	const char *name;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref;
 	int len;
 	struct hlua_function *fcn;
 
-	MAY_LJMP(check_args(L, 2, "register_converters"));
+	if (lua_gettop(L) < 2 || lua_gettop(L) > 3)
+		WILL_LJMP(luaL_error(L, "'register_converters' needs between 2 and 3 arguments"));
 
 	/* First argument : converter name. */
 	name = MAY_LJMP(luaL_checkstring(L, 1));
@@ -6418,19 +7061,24 @@ __LJMP static int hlua_register_converters(lua_State *L)
 	/* Second argument : lua function. */
 	ref = MAY_LJMP(hlua_checkfunction(L, 2));
 
+	fcn = MAY_LJMP(hlua_function_get(L, name));
+	fcn->function_ref[state_id] = ref;
+	if (state_id > 1)
+		return 0; /* already registered by the first per-thread state */
+
+	/* Third argument : the results may be cached. */
+	if (lua_toboolean(L, 3))
+		fcn->flags |= HLUA_FCN_F_CACHEABLE;
+
 	/* Allocate and fill the sample fetch keyword struct. */
 	sck = calloc(1, sizeof(*sck) + sizeof(struct sample_conv) * 2);
 	if (!sck)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn = calloc(1, sizeof(*fcn));
-	if (!fcn)
-		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	/* Fill fcn. */
 	fcn->name = strdup(name);
 	if (!fcn->name)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn->function_ref = ref;
 
 	/* List head */
 	sck->list.n = sck->list.p = NULL;
@@ -6462,12 +7110,14 @@ __LJMP static int hlua_register_converters(lua_State *L)
 __LJMP static int hlua_register_fetches(lua_State *L)
 {
 	const char *name;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref;
 	int len;
 	struct sample_fetch_kw_list *sfk;
 	struct hlua_function *fcn;
 
-	MAY_LJMP(check_args(L, 2, "register_fetches"));
+	if (lua_gettop(L) < 2 || lua_gettop(L) > 3)
+		WILL_LJMP(luaL_error(L, "'register_fetches' needs between 2 and 3 arguments"));
 
 	/* First argument : sample-fetch name. */
 	name = MAY_LJMP(luaL_checkstring(L, 1));
@@ -6475,19 +7125,24 @@ __LJMP static int hlua_register_fetches(lua_State *L)
 	/* Second argument : lua function. */
 	ref = MAY_LJMP(hlua_checkfunction(L, 2));
 
+	fcn = MAY_LJMP(hlua_function_get(L, name));
+	fcn->function_ref[state_id] = ref;
+	if (state_id > 1)
+		return 0; /* already registered by the first per-thread state */
+
+	/* Third argument : the results may be cached. */
+	if (lua_toboolean(L, 3))
+		fcn->flags |= HLUA_FCN_F_CACHEABLE;
+
 	/* Allocate and fill the sample fetch keyword struct. */
 	sfk = calloc(1, sizeof(*sfk) + sizeof(struct sample_fetch) * 2);
 	if (!sfk)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn = calloc(1, sizeof(*fcn));
-	if (!fcn)
-		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	/* Fill fcn. */
 	fcn->name = strdup(name);
 	if (!fcn->name)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn->function_ref = ref;
 
 	/* List head */
 	sfk->list.n = sfk->list.p = NULL;
@@ -6542,6 +7197,7 @@ static enum act_return hlua_action(struct act_rule *rule, struct proxy *px,
 	char **arg;
 	unsigned int hflags = 0;
 	int dir, act_ret = ACT_RET_CONT;
+	int state_id = hlua_state_id_fcn(rule->arg.hlua_rule->fcn);
 	const char *error;
 
 	switch (rule->from) {
@@ -6563,15 +7219,20 @@ static enum act_return hlua_action(struct act_rule *rule, struct proxy *px,
 		s->hlua = pool_alloc(pool_head_hlua);
 		if (!s->hlua) {
 			SEND_ERR(px, "Lua action '%s': can't initialize Lua context.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto end;
 		}
-		if (!hlua_ctx_init(s->hlua, s->task, 0)) {
+		if (!hlua_ctx_init(s->hlua, state_id, s->task, 0)) {
 			SEND_ERR(px, "Lua action '%s': can't initialize Lua context.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto end;
 		}
 	}
+	else if (s->hlua->state_id != state_id) {
+		SEND_ERR(px, "Lua action '%s': cannot mix shared and per-thread Lua functions in the same stream.\n",
+		         rule->arg.hlua_rule->fcn->name);
+		goto end;
+	}
 
 	/* If it is the first run, initialize the data for the call. */
 	if (!HLUA_IS_RUNNING(s->hlua)) {
@@ -6583,25 +7244,25 @@ static enum act_return hlua_action(struct act_rule *rule, struct proxy *px,
 			else
 				error = "critical error";
 			SEND_ERR(px, "Lua function '%s': %s.\n",
-			         rule->arg.hlua_rule->fcn.name, error);
+			         rule->arg.hlua_rule->fcn->name, error);
 			goto end;
 		}
 
 		/* Check stack available size. */
 		if (!lua_checkstack(s->hlua->T, 1)) {
 			SEND_ERR(px, "Lua function '%s': full stack.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			RESET_SAFE_LJMP(s->hlua->T);
 			goto end;
 		}
 
 		/* Restore the function in the stack. */
-		lua_rawgeti(s->hlua->T, LUA_REGISTRYINDEX, rule->arg.hlua_rule->fcn.function_ref);
+		lua_rawgeti(s->hlua->T, LUA_REGISTRYINDEX, rule->arg.hlua_rule->fcn->function_ref[state_id]);
 
 		/* Create and and push object stream in the stack. */
 		if (!hlua_txn_new(s->hlua->T, s, px, dir, hflags)) {
 			SEND_ERR(px, "Lua function '%s': full stack.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			RESET_SAFE_LJMP(s->hlua->T);
 			goto end;
 		}
@@ -6611,7 +7272,7 @@ static enum act_return hlua_action(struct act_rule *rule, struct proxy *px,
 		for (arg = rule->arg.hlua_rule->args; arg && *arg; arg++) {
 			if (!lua_checkstack(s->hlua->T, 1)) {
 				SEND_ERR(px, "Lua function '%s': full stack.\n",
-				         rule->arg.hlua_rule->fcn.name);
+				         rule->arg.hlua_rule->fcn->name);
 				RESET_SAFE_LJMP(s->hlua->T);
 				goto end;
 			}
@@ -6676,27 +7337,27 @@ static enum act_return hlua_action(struct act_rule *rule, struct proxy *px,
 	case HLUA_E_ERRMSG:
 		/* Display log. */
 		SEND_ERR(px, "Lua function '%s': %s.\n",
-		         rule->arg.hlua_rule->fcn.name, lua_tostring(s->hlua->T, -1));
+		         rule->arg.hlua_rule->fcn->name, lua_tostring(s->hlua->T, -1));
 		lua_pop(s->hlua->T, 1);
 		goto end;
 
 	case HLUA_E_ETMOUT:
-		SEND_ERR(px, "Lua function '%s': execution timeout.\n", rule->arg.hlua_rule->fcn.name);
+		SEND_ERR(px, "Lua function '%s': execution timeout.\n", rule->arg.hlua_rule->fcn->name);
 		goto end;
 
 	case HLUA_E_NOMEM:
-		SEND_ERR(px, "Lua function '%s': out of memory error.\n", rule->arg.hlua_rule->fcn.name);
+		SEND_ERR(px, "Lua function '%s': out of memory error.\n", rule->arg.hlua_rule->fcn->name);
 		goto end;
 
 	case HLUA_E_YIELD:
 		SEND_ERR(px, "Lua function '%s': aborting Lua processing on expired timeout.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 		goto end;
 
 	case HLUA_E_ERR:
 		/* Display log. */
 		SEND_ERR(px, "Lua function '%s' return an unknown error.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 
 	default:
 		goto end;
@@ -6726,7 +7387,7 @@ static int hlua_applet_tcp_init(struct appctx *ctx, struct proxy *px, struct str
 	hlua = pool_alloc(pool_head_hlua);
 	if (!hlua) {
 		SEND_ERR(px, "Lua applet tcp '%s': out of memory.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 	HLUA_INIT(hlua);
@@ -6737,7 +7398,7 @@ static int hlua_applet_tcp_init(struct appctx *ctx, struct proxy *px, struct str
 	task = task_new(tid_bit);
 	if (!task) {
 		SEND_ERR(px, "Lua applet tcp '%s': out of memory.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 	task->nice = 0;
@@ -6750,9 +7411,9 @@ static int hlua_applet_tcp_init(struct appctx *ctx, struct proxy *px, struct str
 	 * permits to save performances because a systematic
 	 * Lua initialization cause 5% performances loss.
 	 */
-	if (!hlua_ctx_init(hlua, task, 0)) {
+	if (!hlua_ctx_init(hlua, hlua_state_id_fcn(ctx->rule->arg.hlua_rule->fcn), task, 0)) {
 		SEND_ERR(px, "Lua applet tcp '%s': can't initialize Lua context.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 
@@ -6766,25 +7427,25 @@ static int hlua_applet_tcp_init(struct appctx *ctx, struct proxy *px, struct str
 		else
 			error = "critical error";
 		SEND_ERR(px, "Lua applet tcp '%s': %s.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name, error);
+		         ctx->rule->arg.hlua_rule->fcn->name, error);
 		return 0;
 	}
 
 	/* Check stack available size. */
 	if (!lua_checkstack(hlua->T, 1)) {
 		SEND_ERR(px, "Lua applet tcp '%s': full stack.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		RESET_SAFE_LJMP(hlua->T);
 		return 0;
 	}
 
 	/* Restore the function in the stack. */
-	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, ctx->rule->arg.hlua_rule->fcn.function_ref);
+	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, ctx->rule->arg.hlua_rule->fcn->function_ref[hlua->state_id]);
 
 	/* Create and and push object stream in the stack. */
 	if (!hlua_applet_tcp_new(hlua->T, ctx)) {
 		SEND_ERR(px, "Lua applet tcp '%s': full stack.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		RESET_SAFE_LJMP(hlua->T);
 		return 0;
 	}
@@ -6794,7 +7455,7 @@ static int hlua_applet_tcp_init(struct appctx *ctx, struct proxy *px, struct str
 	for (arg = ctx->rule->arg.hlua_rule->args; arg && *arg; arg++) {
 		if (!lua_checkstack(hlua->T, 1)) {
 			SEND_ERR(px, "Lua applet tcp '%s': full stack.\n",
-			         ctx->rule->arg.hlua_rule->fcn.name);
+			         ctx->rule->arg.hlua_rule->fcn->name);
 			RESET_SAFE_LJMP(hlua->T);
 			return 0;
 		}
@@ -6853,29 +7514,29 @@ void hlua_applet_tcp_fct(struct appctx *ctx)
 	case HLUA_E_ERRMSG:
 		/* Display log. */
 		SEND_ERR(px, "Lua applet tcp '%s': %s.\n",
-		         rule->arg.hlua_rule->fcn.name, lua_tostring(hlua->T, -1));
+		         rule->arg.hlua_rule->fcn->name, lua_tostring(hlua->T, -1));
 		lua_pop(hlua->T, 1);
 		goto error;
 
 	case HLUA_E_ETMOUT:
 		SEND_ERR(px, "Lua applet tcp '%s': execution timeout.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 		goto error;
 
 	case HLUA_E_NOMEM:
 		SEND_ERR(px, "Lua applet tcp '%s': out of memory error.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 		goto error;
 
 	case HLUA_E_YIELD: /* unexpected */
 		SEND_ERR(px, "Lua applet tcp '%s': yield not allowed.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 		goto error;
 
 	case HLUA_E_ERR:
 		/* Display log. */
 		SEND_ERR(px, "Lua applet tcp '%s' return an unknown error.\n",
-		         rule->arg.hlua_rule->fcn.name);
+		         rule->arg.hlua_rule->fcn->name);
 		goto error;
 
 	default:
@@ -6915,7 +7576,7 @@ static int hlua_applet_http_init(struct appctx *ctx, struct proxy *px, struct st
 	hlua = pool_alloc(pool_head_hlua);
 	if (!hlua) {
 		SEND_ERR(px, "Lua applet http '%s': out of memory.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 	HLUA_INIT(hlua);
@@ -6930,7 +7591,7 @@ static int hlua_applet_http_init(struct appctx *ctx, struct proxy *px, struct st
 	task = task_new(tid_bit);
 	if (!task) {
 		SEND_ERR(px, "Lua applet http '%s': out of memory.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 	task->nice = 0;
@@ -6943,9 +7604,9 @@ static int hlua_applet_http_init(struct appctx *ctx, struct proxy *px, struct st
 	 * permits to save performances because a systematic
 	 * Lua initialization cause 5% performances loss.
 	 */
-	if (!hlua_ctx_init(hlua, task, 0)) {
+	if (!hlua_ctx_init(hlua, hlua_state_id_fcn(ctx->rule->arg.hlua_rule->fcn), task, 0)) {
 		SEND_ERR(px, "Lua applet http '%s': can't initialize Lua context.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		return 0;
 	}
 
@@ -6959,25 +7620,25 @@ static int hlua_applet_http_init(struct appctx *ctx, struct proxy *px, struct st
 		else
 			error = "critical error";
 		SEND_ERR(px, "Lua applet http '%s': %s.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name, error);
+		         ctx->rule->arg.hlua_rule->fcn->name, error);
 		return 0;
 	}
 
 	/* Check stack available size. */
 	if (!lua_checkstack(hlua->T, 1)) {
 		SEND_ERR(px, "Lua applet http '%s': full stack.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		RESET_SAFE_LJMP(hlua->T);
 		return 0;
 	}
 
 	/* Restore the function in the stack. */
-	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, ctx->rule->arg.hlua_rule->fcn.function_ref);
+	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, ctx->rule->arg.hlua_rule->fcn->function_ref[hlua->state_id]);
 
 	/* Create and and push object stream in the stack. */
 	if (!hlua_applet_http_new(hlua->T, ctx)) {
 		SEND_ERR(px, "Lua applet http '%s': full stack.\n",
-		         ctx->rule->arg.hlua_rule->fcn.name);
+		         ctx->rule->arg.hlua_rule->fcn->name);
 		RESET_SAFE_LJMP(hlua->T);
 		return 0;
 	}
@@ -6987,7 +7648,7 @@ static int hlua_applet_http_init(struct appctx *ctx, struct proxy *px, struct st
 	for (arg = ctx->rule->arg.hlua_rule->args; arg && *arg; arg++) {
 		if (!lua_checkstack(hlua->T, 1)) {
 			SEND_ERR(px, "Lua applet http '%s': full stack.\n",
-			         ctx->rule->arg.hlua_rule->fcn.name);
+			         ctx->rule->arg.hlua_rule->fcn->name);
 			RESET_SAFE_LJMP(hlua->T);
 			return 0;
 		}
@@ -7085,29 +7746,29 @@ void hlua_applet_http_fct(struct appctx *ctx)
 		case HLUA_E_ERRMSG:
 			/* Display log. */
 			SEND_ERR(px, "Lua applet http '%s': %s.\n",
-			         rule->arg.hlua_rule->fcn.name, lua_tostring(hlua->T, -1));
+			         rule->arg.hlua_rule->fcn->name, lua_tostring(hlua->T, -1));
 			lua_pop(hlua->T, 1);
 			goto error;
 
 		case HLUA_E_ETMOUT:
 			SEND_ERR(px, "Lua applet http '%s': execution timeout.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto error;
 
 		case HLUA_E_NOMEM:
 			SEND_ERR(px, "Lua applet http '%s': out of memory error.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto error;
 
 		case HLUA_E_YIELD: /* unexpected */
 			SEND_ERR(px, "Lua applet http '%s': yield not allowed.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto error;
 
 		case HLUA_E_ERR:
 			/* Display log. */
 			SEND_ERR(px, "Lua applet http '%s' return an unknown error.\n",
-			         rule->arg.hlua_rule->fcn.name);
+			         rule->arg.hlua_rule->fcn->name);
 			goto error;
 
 		default:
@@ -7209,7 +7870,7 @@ static enum act_parse_ret action_register_lua(const char **args, int *cur_arg, s
 	}
 
 	/* Reference the Lua function and store the reference. */
-	rule->arg.hlua_rule->fcn = *fcn;
+	rule->arg.hlua_rule->fcn = fcn;
 
 	/* Expect some arguments */
 	for (i = 0; i < fcn->nargs; i++) {
@@ -7255,7 +7916,7 @@ static enum act_parse_ret action_register_service_http(const char **args, int *c
 	}
 
 	/* Reference the Lua function and store the reference. */
-	rule->arg.hlua_rule->fcn = *fcn;
+	rule->arg.hlua_rule->fcn = fcn;
 
 	/* TODO: later accept arguments. */
 	rule->arg.hlua_rule->args = NULL;
@@ -7279,6 +7940,7 @@ __LJMP static int hlua_register_action(lua_State *L)
 {
 	struct action_kw_list *akl;
 	const char *name;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref;
 	int len;
 	struct hlua_function *fcn;
@@ -7310,20 +7972,24 @@ __LJMP static int hlua_register_action(lua_State *L)
 		if (lua_type(L, -1) != LUA_TSTRING)
 			WILL_LJMP(luaL_error(L, "register_action: second argument must be a table of strings"));
 
+		fcn = MAY_LJMP(hlua_function_get(L, name));
+		fcn->function_ref[state_id] = ref;
+		if (state_id > 1) {
+			/* already registered by the first per-thread state */
+			lua_pop(L, 1);
+			continue;
+		}
+
 		/* Check required environment. Only accepted "http" or "tcp". */
 		/* Allocate and fill the sample fetch keyword struct. */
 		akl = calloc(1, sizeof(*akl) + sizeof(struct action_kw) * 2);
 		if (!akl)
 			WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-		fcn = calloc(1, sizeof(*fcn));
-		if (!fcn)
-			WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 		/* Fill fcn. */
 		fcn->name = strdup(name);
 		if (!fcn->name)
 			WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-		fcn->function_ref = ref;
 
 		/* Set the expected number od arguments. */
 		fcn->nargs = nargs;
@@ -7381,7 +8047,7 @@ static enum act_parse_ret action_register_service_tcp(const char **args, int *cu
 	}
 
 	/* Reference the Lua function and store the reference. */
-	rule->arg.hlua_rule->fcn = *fcn;
+	rule->arg.hlua_rule->fcn = fcn;
 
 	/* TODO: later accept arguments. */
 	rule->arg.hlua_rule->args = NULL;
@@ -7406,6 +8072,7 @@ __LJMP static int hlua_register_service(lua_State *L)
 	struct action_kw_list *akl;
 	const char *name;
 	const char *env;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref;
 	int len;
 	struct hlua_function *fcn;
@@ -7421,13 +8088,16 @@ __LJMP static int hlua_register_service(lua_State *L)
 	/* Third argument : lua function. */
 	ref = MAY_LJMP(hlua_checkfunction(L, 3));
 
+	chunk_printf(&trash, "<lua.%s>", name);
+	fcn = MAY_LJMP(hlua_function_get(L, trash.area));
+	fcn->function_ref[state_id] = ref;
+	if (state_id > 1)
+		return 0; /* already registered by the first per-thread state */
+
 	/* Allocate and fill the sample fetch keyword struct. */
 	akl = calloc(1, sizeof(*akl) + sizeof(struct action_kw) * 2);
 	if (!akl)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn = calloc(1, sizeof(*fcn));
-	if (!fcn)
-		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	/* Fill fcn. */
 	len = strlen("<lua.>") + strlen(name) + 1;
@@ -7435,7 +8105,6 @@ __LJMP static int hlua_register_service(lua_State *L)
 	if (!fcn->name)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 	snprintf((char *)fcn->name, len, "<lua.%s>", name);
-	fcn->function_ref = ref;
 
 	/* List head */
 	akl->list.n = akl->list.p = NULL;
@@ -7504,7 +8173,7 @@ static int hlua_cli_parse_fct(char **args, char *payload, struct appctx *appctx,
 	appctx->ctx.hlua_cli.task->process = hlua_applet_wakeup;
 
 	/* Initialises the Lua context */
-	if (!hlua_ctx_init(hlua, appctx->ctx.hlua_cli.task, 0)) {
+	if (!hlua_ctx_init(hlua, hlua_state_id_fcn(fcn), appctx->ctx.hlua_cli.task, 0)) {
 		SEND_ERR(NULL, "Lua cli '%s': can't initialize Lua context.\n", fcn->name);
 		goto error;
 	}
@@ -7526,7 +8195,7 @@ static int hlua_cli_parse_fct(char **args, char *payload, struct appctx *appctx,
 	}
 
 	/* Restore the function in the stack. */
-	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, fcn->function_ref);
+	lua_rawgeti(hlua->T, LUA_REGISTRYINDEX, fcn->function_ref[hlua->state_id]);
 
 	/* Once the arguments parsed, the CLI is like an AppletTCP,
 	 * so push AppletTCP in the stack.
@@ -7648,6 +8317,7 @@ __LJMP static int hlua_register_cli(lua_State *L)
 {
 	struct cli_kw_list *cli_kws;
 	const char *message;
+	int state_id = hlua_gethlua(L)->state_id;
 	int ref_io;
 	int len;
 	struct hlua_function *fcn;
@@ -7666,13 +8336,15 @@ __LJMP static int hlua_register_cli(lua_State *L)
 	/* Third and fourth argument : lua function. */
 	ref_io = MAY_LJMP(hlua_checkfunction(L, 3));
 
+	fcn = MAY_LJMP(hlua_function_get(L, NULL));
+	fcn->function_ref[state_id] = ref_io;
+	if (state_id > 1)
+		return 0; /* already registered by the first per-thread state */
+
 	/* Allocate and fill the sample fetch keyword struct. */
 	cli_kws = calloc(1, sizeof(*cli_kws) + sizeof(struct cli_kw) * 2);
 	if (!cli_kws)
 		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
-	fcn = calloc(1, sizeof(*fcn));
-	if (!fcn)
-		WILL_LJMP(luaL_error(L, "Lua out of memory error."));
 
 	/* Fill path. */
 	index = 0;
@@ -7707,7 +8379,6 @@ __LJMP static int hlua_register_cli(lua_State *L)
 		strncat((char *)fcn->name, cli_kws->kw[0].str_kw[i], len);
 	}
 	strncat((char *)fcn->name, ">", len);
-	fcn->function_ref = ref_io;
 
 	/* Fill last entries. */
 	cli_kws->kw[0].private = fcn;
@@ -7802,12 +8473,11 @@ static int hlua_parse_maxmem(char **args, int section_type, struct proxy *curpx,
 }
 
 
-/* This function is called by the main configuration key "lua-load". It loads and
- * execute an lua file during the parsing of the HAProxy configuration file. It is
- * the main lua entry point.
+/* This function loads and executes the lua file <filename> in the <L> state.
+ * It is called during the parsing of the HAProxy configuration file by the
+ * main configuration key "lua-load", which is the main lua entry point.
  *
- * This function runs with the HAProxy keywords API. It returns -1 if an error
- * occurs, otherwise it returns 0.
+ * It returns -1 if an error occurs, otherwise it returns 0.
  *
  * In some error case, LUA set an error message in top of the stack. This function
  * returns this error message in the HAProxy logs and pop it from the stack.
@@ -7816,61 +8486,95 @@ static int hlua_parse_maxmem(char **args, int section_type, struct proxy *curpx,
  * We are in the configuration parsing process of HAProxy, this abort() is
  * tolerated.
  */
-static int hlua_load(char **args, int section_type, struct proxy *curpx,
-                     struct proxy *defpx, const char *file, int line,
-                     char **err)
+static int hlua_load_state(char *filename, lua_State *L, char **err)
 {
 	int error;
 
 	/* Just load and compile the file. */
-	error = luaL_loadfile(gL.T, args[1]);
+	error = luaL_loadfile(L, filename);
 	if (error) {
-		memprintf(err, "error in Lua file '%s': %s", args[1], lua_tostring(gL.T, -1));
-		lua_pop(gL.T, 1);
+		memprintf(err, "error in Lua file '%s': %s", filename, lua_tostring(L, -1));
+		lua_pop(L, 1);
 		return -1;
 	}
 
 	/* If no syntax error where detected, execute the code. */
-	error = lua_pcall(gL.T, 0, LUA_MULTRET, 0);
+	error = lua_pcall(L, 0, LUA_MULTRET, 0);
 	switch (error) {
 	case LUA_OK:
 		break;
 	case LUA_ERRRUN:
-		memprintf(err, "Lua runtime error: %s\n", lua_tostring(gL.T, -1));
-		lua_pop(gL.T, 1);
+		memprintf(err, "Lua runtime error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
 		return -1;
 	case LUA_ERRMEM:
 		memprintf(err, "Lua out of memory error.n");
 		return -1;
 	case LUA_ERRERR:
-		memprintf(err, "Lua message handler error: %s\n", lua_tostring(gL.T, -1));
-		lua_pop(gL.T, 1);
+		memprintf(err, "Lua message handler error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
 		return -1;
 	case LUA_ERRGCMM:
-		memprintf(err, "Lua garbage collector error: %s\n", lua_tostring(gL.T, -1));
-		lua_pop(gL.T, 1);
+		memprintf(err, "Lua garbage collector error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
 		return -1;
 	default:
-		memprintf(err, "Lua unknown error: %s\n", lua_tostring(gL.T, -1));
-		lua_pop(gL.T, 1);
+		memprintf(err, "Lua unknown error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
 		return -1;
 	}
 
 	return 0;
 }
 
+static int hlua_load(char **args, int section_type, struct proxy *curpx,
+                     struct proxy *defpx, const char *file, int line,
+                     char **err)
+{
+	return hlua_load_state(args[1], hlua_states[0].T, err);
+}
+
+/* Same as hlua_load() for "lua-load-per-thread": the file is loaded in the
+ * state of the first thread during the parsing, the states of the other ones
+ * load it at the end of the initialisation, once their number is known.
+ */
+static int hlua_load_per_thread(char **args, int section_type, struct proxy *curpx,
+                                struct proxy *defpx, const char *file, int line,
+                                char **err)
+{
+	struct hlua_load_file *load;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a file name as parameter.", args[0]);
+		return -1;
+	}
+
+	load = calloc(1, sizeof(*load));
+	if (!load || (load->path = strdup(args[1])) == NULL) {
+		free(load);
+		memprintf(err, "out of memory error");
+		return -1;
+	}
+	LIST_ADDQ(&hlua_per_thread_load, &load->l);
+
+	if (!hlua_states[1].T)
+		hlua_init_state(1);
+
+	return hlua_load_state(args[1], hlua_states[1].T, err);
+}
+
 /* Prepend the given <path> followed by a semicolon to the `package.<type>` variable
- * in the given <ctx>.
+ * in the given <L> state.
  */
-static int hlua_prepend_path(struct hlua ctx, char *type, char *path)
+static int hlua_prepend_path(lua_State *L, char *type, char *path)
 {
-	lua_getglobal(ctx.T, "package"); /* push package variable   */
-	lua_pushstring(ctx.T, path);     /* push given path         */
-	lua_pushstring(ctx.T, ";");      /* push semicolon          */
-	lua_getfield(ctx.T, -3, type);   /* push old path           */
-	lua_concat(ctx.T, 3);            /* concatenate to new path */
-	lua_setfield(ctx.T, -2, type);   /* store new path          */
-	lua_pop(ctx.T, 1);               /* pop package variable    */
+	lua_getglobal(L, "package"); /* push package variable   */
+	lua_pushstring(L, path);     /* push given path         */
+	lua_pushstring(L, ";");      /* push semicolon          */
+	lua_getfield(L, -3, type);   /* push old path           */
+	lua_concat(L, 3);            /* concatenate to new path */
+	lua_setfield(L, -2, type);   /* store new path          */
+	lua_pop(L, 1);               /* pop package variable    */
 
 	return 0;
 }
@@ -7879,6 +8583,7 @@ static int hlua_config_prepend_path(char **args, int section_type, struct proxy
                                     struct proxy *defpx, const char *file, int line,
                                     char **err)
 {
+	struct hlua_load_file *pp;
 	char *path;
 	char *type = "path";
 	if (too_many_args(2, args, err, NULL)) {
@@ -7899,13 +8604,27 @@ static int hlua_config_prepend_path(char **args, int section_type, struct proxy
 		type = args[2];
 	}
 
-	return hlua_prepend_path(gL, type, path);
+	/* also keep it for the per-thread states built later */
+	pp = calloc(1, sizeof(*pp));
+	if (!pp || (pp->type = strdup(type)) == NULL || (pp->path = strdup(path)) == NULL) {
+		if (pp)
+			free(pp->type);
+		free(pp);
+		memprintf(err, "out of memory error");
+		return -1;
+	}
+	LIST_ADDQ(&hlua_prepend_paths, &pp->l);
+
+	if (hlua_states[1].T)
+		hlua_prepend_path(hlua_states[1].T, type, path);
+	return hlua_prepend_path(hlua_states[0].T, type, path);
 }
 
 /* configuration keywords declaration */
 static struct cfg_kw_list cfg_kws = {{ },{
 	{ CFG_GLOBAL, "lua-prepend-path",         hlua_config_prepend_path },
 	{ CFG_GLOBAL, "lua-load",                 hlua_load },
+	{ CFG_GLOBAL, "lua-load-per-thread",      hlua_load_per_thread },
 	{ CFG_GLOBAL, "tune.lua.session-timeout", hlua_session_timeout },
 	{ CFG_GLOBAL, "tune.lua.task-timeout",    hlua_task_timeout },
 	{ CFG_GLOBAL, "tune.lua.service-timeout", hlua_applet_timeout },
@@ -7917,52 +8636,45 @@ static struct cfg_kw_list cfg_kws = {{ },{
 INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
 
 
-/* This function can fail with an abort() due to an Lua critical error.
- * We are in the initialisation process of HAProxy, this abort() is
+/* Runs the post initialisation of the <state_id> state, including the
+ * functions registered with core.register_init(). Returns 0 on failure,
+ * otherwise 1. This function can fail with an abort() due to an Lua critical
+ * error. We are in the initialisation process of HAProxy, this abort() is
  * tolerated.
  */
-int hlua_post_init()
+static int hlua_post_init_state(int state_id)
 {
 	struct hlua_init_function *init;
+	lua_State *L = hlua_states[state_id].T;
 	const char *msg;
 	enum hlua_exec ret;
 	const char *error;
 
 	/* Call post initialisation function in safe environment. */
-	if (!SET_SAFE_LJMP(gL.T)) {
-		if (lua_type(gL.T, -1) == LUA_TSTRING)
-			error = lua_tostring(gL.T, -1);
+	if (!SET_SAFE_LJMP(L)) {
+		if (lua_type(L, -1) == LUA_TSTRING)
+			error = lua_tostring(L, -1);
 		else
 			error = "critical error";
 		fprintf(stderr, "Lua post-init: %s.\n", error);
 		exit(1);
 	}
 
-#if USE_OPENSSL
-	/* Initialize SSL server. */
-	if (socket_ssl.xprt->prepare_srv) {
-		int saved_used_backed = global.ssl_used_backend;
-		// don't affect maxconn automatic computation
-		socket_ssl.xprt->prepare_srv(&socket_ssl);
-		global.ssl_used_backend = saved_used_backed;
-	}
-#endif
+	hlua_fcn_post_init(L);
+	RESET_SAFE_LJMP(L);
 
-	hlua_fcn_post_init(gL.T);
-	RESET_SAFE_LJMP(gL.T);
-
-	list_for_each_entry(init, &hlua_init_functions, l) {
-		lua_rawgeti(gL.T, LUA_REGISTRYINDEX, init->function_ref);
-		ret = hlua_ctx_resume(&gL, 0);
+	list_for_each_entry(init, &hlua_init_functions[state_id], l) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, init->function_ref);
+		ret = hlua_ctx_resume(&hlua_states[state_id], 0);
 		switch (ret) {
 		case HLUA_E_OK:
-			lua_pop(gL.T, -1);
-			return 1;
+			lua_pop(L, -1);
+			break;
 		case HLUA_E_AGAIN:
 			ha_alert("Lua init: yield not allowed.\n");
 			return 0;
 		case HLUA_E_ERRMSG:
-			msg = lua_tostring(gL.T, -1);
+			msg = lua_tostring(L, -1);
 			ha_alert("lua init: %s.\n", msg);
 			return 0;
 		case HLUA_E_ERR:
@@ -7974,6 +8686,66 @@ int hlua_post_init()
 	return 1;
 }
 
+/* This function can fail with an abort() due to an Lua critical error.
+ * We are in the initialisation process of HAProxy, this abort() is
+ * tolerated. It builds the per-thread states of all the threads but the
+ * first one, and runs the init functions of all the states.
+ */
+int hlua_post_init()
+{
+	struct hlua_load_file *load;
+	struct hlua_function *fcn;
+	char *err = NULL;
+	int thr;
+
+#if USE_OPENSSL
+	/* Initialize SSL server. */
+	if (socket_ssl.xprt->prepare_srv) {
+		int saved_used_backed = global.ssl_used_backend;
+		// don't affect maxconn automatic computation
+		socket_ssl.xprt->prepare_srv(&socket_ssl);
+		global.ssl_used_backend = saved_used_backed;
+	}
+#endif
+
+	if (!hlua_post_init_state(0))
+		return 0;
+
+	/* nothing loaded with "lua-load-per-thread" */
+	if (!hlua_states[1].T)
+		return 1;
+
+	for (thr = 2; thr <= global.nbthread; thr++) {
+		hlua_init_state(thr);
+		list_for_each_entry(load, &hlua_per_thread_load, l) {
+			if (hlua_load_state(load->path, hlua_states[thr].T, &err) != 0) {
+				ha_alert("Lua per-thread state of thread %d: %s.\n", thr, err);
+				free(err);
+				return 0;
+			}
+		}
+	}
+
+	/* All the states must register the functions referenced by the
+	 * configuration, since each thread calls the one of its state.
+	 */
+	list_for_each_entry(fcn, &hlua_per_thread_fcns, l) {
+		for (thr = 2; thr <= global.nbthread; thr++) {
+			if (fcn->function_ref[thr] == -1) {
+				ha_alert("Lua function '%s' is not registered by the per-thread state of thread %d.\n",
+				         fcn->name, thr);
+				return 0;
+			}
+		}
+	}
+
+	for (thr = 1; thr <= global.nbthread; thr++) {
+		if (!hlua_post_init_state(thr))
+			return 0;
+	}
+	return 1;
+}
+
 /* The memory allocator used by the Lua stack. <ud> is a pointer to the
  * allocator's context. <ptr> is the pointer to alloc/free/realloc. <osize>
  * is the previously allocated size or the kind of object in case of a new
@@ -7982,68 +8754,64 @@ int hlua_post_init()
 static void *hlua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 {
 	struct hlua_mem_allocator *zone = ud;
+	size_t old, new;
 
 	if (nsize == 0) {
 		/* it's a free */
 		if (ptr)
-			zone->allocated -= osize;
+			_HA_ATOMIC_SUB(&zone->allocated, osize);
 		free(ptr);
 		return NULL;
 	}
 
-	if (!ptr) {
-		/* it's a new allocation */
-		if (zone->limit && zone->allocated + nsize > zone->limit)
-			return NULL;
+	/* for a new allocation, <osize> is the kind of object */
+	if (!ptr)
+		osize = 0;
 
-		ptr = malloc(nsize);
-		if (ptr)
-			zone->allocated += nsize;
-		return ptr;
-	}
-
-	/* it's a realloc */
-	if (zone->limit && zone->allocated + nsize - osize > zone->limit)
-		return NULL;
+	/* The zone is shared by the per-thread states which may allocate
+	 * concurrently, so the room is reserved before the allocation and
+	 * released if it fails.
+	 */
+	old = zone->allocated;
+	do {
+		new = old + nsize - osize;
+		if (zone->limit && new > zone->limit)
+			return NULL;
+	} while (!_HA_ATOMIC_CAS(&zone->allocated, &old, new));
 
 	ptr = realloc(ptr, nsize);
-	if (ptr)
-		zone->allocated += nsize - osize;
+	if (!ptr)
+		_HA_ATOMIC_SUB(&zone->allocated, nsize - osize);
 	return ptr;
 }
 
-/* Ithis function can fail with an abort() due to an Lua critical error.
- * We are in the initialisation process of HAProxy, this abort() is
- * tolerated.
+/* Builds the main Lua stack of the <thr> state: 0 is the shared state, 1 to
+ * nbthread are the per-thread ones. This function can fail with an abort()
+ * due to an Lua critical error. We are in the initialisation process of
+ * HAProxy, this abort() is tolerated.
  */
-void hlua_init(void)
+static void hlua_init_state(int thr)
 {
+	struct hlua_load_file *pp;
 	int i;
 	int idx;
 	struct sample_fetch *sf;
 	struct sample_conv *sc;
 	char *p;
 	const char *error_msg;
-#ifdef USE_OPENSSL
-	struct srv_kw *kw;
-	int tmp_error;
-	char *error;
-	char *args[] = { /* SSL client configuration. */
-		"ssl",
-		"verify",
-		"none",
-		NULL
-	};
-#endif
+	lua_State *L;
 
 	/* Init main lua stack. */
-	gL.Mref = LUA_REFNIL;
-	gL.flags = 0;
-	LIST_INIT(&gL.com);
-	gL.T = lua_newstate(hlua_alloc, &hlua_global_allocator);
-	hlua_sethlua(&gL);
-	gL.Tref = LUA_REFNIL;
-	gL.task = NULL;
+	hlua_states[thr].state_id = thr;
+	hlua_states[thr].Mref = LUA_REFNIL;
+	hlua_states[thr].cache_ref = LUA_REFNIL;
+	hlua_states[thr].flags = 0;
+	LIST_INIT(&hlua_states[thr].com);
+	L = hlua_states[thr].T = lua_newstate(hlua_alloc, &hlua_global_allocator);
+	hlua_sethlua(&hlua_states[thr]);
+	hlua_states[thr].Tref = LUA_REFNIL;
+	hlua_states[thr].task = NULL;
+	LIST_INIT(&hlua_init_functions[thr]);
 
 	/* From this point, until the end of the initialisation function,
 	 * the Lua function can fail with an abort. We are in the initialisation
@@ -8051,22 +8819,24 @@ void hlua_init(void)
 	 */
 
 	/* Initialise lua. */
-	luaL_openlibs(gL.T);
+	luaL_openlibs(L);
 #define HLUA_PREPEND_PATH_TOSTRING1(x) #x
 #define HLUA_PREPEND_PATH_TOSTRING(x) HLUA_PREPEND_PATH_TOSTRING1(x)
 #ifdef HLUA_PREPEND_PATH
-	hlua_prepend_path(gL, "path", HLUA_PREPEND_PATH_TOSTRING(HLUA_PREPEND_PATH));
+	hlua_prepend_path(L, "path", HLUA_PREPEND_PATH_TOSTRING(HLUA_PREPEND_PATH));
 #endif
 #ifdef HLUA_PREPEND_CPATH
-	hlua_prepend_path(gL, "cpath", HLUA_PREPEND_PATH_TOSTRING(HLUA_PREPEND_CPATH));
+	hlua_prepend_path(L, "cpath", HLUA_PREPEND_PATH_TOSTRING(HLUA_PREPEND_CPATH));
 #endif
 #undef HLUA_PREPEND_PATH_TOSTRING
 #undef HLUA_PREPEND_PATH_TOSTRING1
+	list_for_each_entry(pp, &hlua_prepend_paths, l)
+		hlua_prepend_path(L, pp->type, pp->path);
 
 	/* Set safe environment for the initialisation. */
-	if (!SET_SAFE_LJMP(gL.T)) {
-		if (lua_type(gL.T, -1) == LUA_TSTRING)
-			error_msg = lua_tostring(gL.T, -1);
+	if (!SET_SAFE_LJMP(L)) {
+		if (lua_type(L, -1) == LUA_TSTRING)
+			error_msg = lua_tostring(L, -1);
 		else
 			error_msg = "critical error";
 		fprintf(stderr, "Lua init: %s.\n", error_msg);
@@ -8080,38 +8850,41 @@ void hlua_init(void)
 	 */
 
 	/* This table entry is the object "core" base. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Push the loglevel constants. */
 	for (i = 0; i < NB_LOG_LEVELS; i++)
-		hlua_class_const_int(gL.T, log_levels[i], i);
+		hlua_class_const_int(L, log_levels[i], i);
 
 	/* Register special functions. */
-	hlua_class_function(gL.T, "register_init", hlua_register_init);
-	hlua_class_function(gL.T, "register_task", hlua_register_task);
-	hlua_class_function(gL.T, "register_fetches", hlua_register_fetches);
-	hlua_class_function(gL.T, "register_converters", hlua_register_converters);
-	hlua_class_function(gL.T, "register_action", hlua_register_action);
-	hlua_class_function(gL.T, "register_service", hlua_register_service);
-	hlua_class_function(gL.T, "register_cli", hlua_register_cli);
-	hlua_class_function(gL.T, "yield", hlua_yield);
-	hlua_class_function(gL.T, "set_nice", hlua_set_nice);
-	hlua_class_function(gL.T, "sleep", hlua_sleep);
-	hlua_class_function(gL.T, "msleep", hlua_msleep);
-	hlua_class_function(gL.T, "add_acl", hlua_add_acl);
-	hlua_class_function(gL.T, "del_acl", hlua_del_acl);
-	hlua_class_function(gL.T, "set_map", hlua_set_map);
-	hlua_class_function(gL.T, "del_map", hlua_del_map);
-	hlua_class_function(gL.T, "tcp", hlua_socket_new);
-	hlua_class_function(gL.T, "log", hlua_log);
-	hlua_class_function(gL.T, "Debug", hlua_log_debug);
-	hlua_class_function(gL.T, "Info", hlua_log_info);
-	hlua_class_function(gL.T, "Warning", hlua_log_warning);
-	hlua_class_function(gL.T, "Alert", hlua_log_alert);
-	hlua_class_function(gL.T, "done", hlua_done);
-	hlua_fcn_reg_core_fcn(gL.T);
-
-	lua_setglobal(gL.T, "core");
+	hlua_class_function(L, "register_init", hlua_register_init);
+	hlua_class_function(L, "register_task", hlua_register_task);
+	hlua_class_function(L, "register_fetches", hlua_register_fetches);
+	hlua_class_function(L, "register_converters", hlua_register_converters);
+	hlua_class_function(L, "register_action", hlua_register_action);
+	hlua_class_function(L, "register_service", hlua_register_service);
+	hlua_class_function(L, "register_cli", hlua_register_cli);
+	hlua_class_function(L, "yield", hlua_yield);
+	hlua_class_function(L, "set_nice", hlua_set_nice);
+	hlua_class_function(L, "sleep", hlua_sleep);
+	hlua_class_function(L, "msleep", hlua_msleep);
+	hlua_class_function(L, "add_acl", hlua_add_acl);
+	hlua_class_function(L, "del_acl", hlua_del_acl);
+	hlua_class_function(L, "set_map", hlua_set_map);
+	hlua_class_function(L, "del_map", hlua_del_map);
+	hlua_class_function(L, "tcp", hlua_socket_new);
+	hlua_class_function(L, "log", hlua_log);
+	hlua_class_function(L, "Debug", hlua_log_debug);
+	hlua_class_function(L, "Info", hlua_log_info);
+	hlua_class_function(L, "Warning", hlua_log_warning);
+	hlua_class_function(L, "Alert", hlua_log_alert);
+	hlua_class_function(L, "done", hlua_done);
+	hlua_class_function(L, "shared_set", hlua_shared_set);
+	hlua_class_function(L, "shared_get", hlua_shared_get);
+	hlua_class_function(L, "shared_add", hlua_shared_add);
+	hlua_fcn_reg_core_fcn(L);
+
+	lua_setglobal(L, "core");
 
 	/*
 	 *
@@ -8120,21 +8893,21 @@ void hlua_init(void)
 	 */
 
 	/* This table entry is the object "act" base. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* push action return constants */
-	hlua_class_const_int(gL.T, "CONTINUE", ACT_RET_CONT);
-	hlua_class_const_int(gL.T, "STOP",     ACT_RET_STOP);
-	hlua_class_const_int(gL.T, "YIELD",    ACT_RET_YIELD);
-	hlua_class_const_int(gL.T, "ERROR",    ACT_RET_ERR);
-	hlua_class_const_int(gL.T, "DONE",     ACT_RET_DONE);
-	hlua_class_const_int(gL.T, "DENY",     ACT_RET_DENY);
-	hlua_class_const_int(gL.T, "ABORT",    ACT_RET_ABRT);
-	hlua_class_const_int(gL.T, "INVALID",  ACT_RET_INV);
+	hlua_class_const_int(L, "CONTINUE", ACT_RET_CONT);
+	hlua_class_const_int(L, "STOP",     ACT_RET_STOP);
+	hlua_class_const_int(L, "YIELD",    ACT_RET_YIELD);
+	hlua_class_const_int(L, "ERROR",    ACT_RET_ERR);
+	hlua_class_const_int(L, "DONE",     ACT_RET_DONE);
+	hlua_class_const_int(L, "DENY",     ACT_RET_DENY);
+	hlua_class_const_int(L, "ABORT",    ACT_RET_ABRT);
+	hlua_class_const_int(L, "INVALID",  ACT_RET_INV);
 
-	hlua_class_function(gL.T, "wake_time", hlua_set_wake_time);
+	hlua_class_function(L, "wake_time", hlua_set_wake_time);
 
-	lua_setglobal(gL.T, "act");
+	lua_setglobal(L, "act");
 
 	/*
 	 *
@@ -8143,44 +8916,44 @@ void hlua_init(void)
 	 */
 
 	/* This table entry is the object "Map" base. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* register pattern types. */
 	for (i=0; i<PAT_MATCH_NUM; i++)
-		hlua_class_const_int(gL.T, pat_match_names[i], i);
+		hlua_class_const_int(L, pat_match_names[i], i);
 	for (i=0; i<PAT_MATCH_NUM; i++) {
 		snprintf(trash.area, trash.size, "_%s", pat_match_names[i]);
-		hlua_class_const_int(gL.T, trash.area, i);
+		hlua_class_const_int(L, trash.area, i);
 	}
 
 	/* register constructor. */
-	hlua_class_function(gL.T, "new", hlua_map_new);
+	hlua_class_function(L, "new", hlua_map_new);
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register . */
-	hlua_class_function(gL.T, "lookup", hlua_map_lookup);
-	hlua_class_function(gL.T, "slookup", hlua_map_slookup);
+	hlua_class_function(L, "lookup", hlua_map_lookup);
+	hlua_class_function(L, "slookup", hlua_map_slookup);
 
-	lua_rawset(gL.T, -3);
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry.
 	 * The function hlua_register_metatable() pops the stack, so we
 	 * previously create a copy of the table.
 	 */
-	lua_pushvalue(gL.T, -1); /* Copy the -1 entry and push it on the stack. */
-	class_map_ref = hlua_register_metatable(gL.T, CLASS_MAP);
+	lua_pushvalue(L, -1); /* Copy the -1 entry and push it on the stack. */
+	class_map_ref = hlua_register_metatable(L, CLASS_MAP);
 
 	/* Assign the metatable to the mai Map object. */
-	lua_setmetatable(gL.T, -2);
+	lua_setmetatable(L, -2);
 
 	/* Set a name to the table. */
-	lua_setglobal(gL.T, "Map");
+	lua_setglobal(L, "Map");
 
 	/*
 	 *
@@ -8189,29 +8962,29 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register . */
-	hlua_class_function(gL.T, "get",         hlua_channel_get);
-	hlua_class_function(gL.T, "dup",         hlua_channel_dup);
-	hlua_class_function(gL.T, "getline",     hlua_channel_getline);
-	hlua_class_function(gL.T, "set",         hlua_channel_set);
-	hlua_class_function(gL.T, "append",      hlua_channel_append);
-	hlua_class_function(gL.T, "send",        hlua_channel_send);
-	hlua_class_function(gL.T, "forward",     hlua_channel_forward);
-	hlua_class_function(gL.T, "get_in_len",  hlua_channel_get_in_len);
-	hlua_class_function(gL.T, "get_out_len", hlua_channel_get_out_len);
-	hlua_class_function(gL.T, "is_full",     hlua_channel_is_full);
-	hlua_class_function(gL.T, "is_resp",     hlua_channel_is_resp);
-
-	lua_rawset(gL.T, -3);
+	hlua_class_function(L, "get",         hlua_channel_get);
+	hlua_class_function(L, "dup",         hlua_channel_dup);
+	hlua_class_function(L, "getline",     hlua_channel_getline);
+	hlua_class_function(L, "set",         hlua_channel_set);
+	hlua_class_function(L, "append",      hlua_channel_append);
+	hlua_class_function(L, "send",        hlua_channel_send);
+	hlua_class_function(L, "forward",     hlua_channel_forward);
+	hlua_class_function(L, "get_in_len",  hlua_channel_get_in_len);
+	hlua_class_function(L, "get_out_len", hlua_channel_get_out_len);
+	hlua_class_function(L, "is_full",     hlua_channel_is_full);
+	hlua_class_function(L, "is_resp",     hlua_channel_is_resp);
+
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_channel_ref = hlua_register_metatable(gL.T, CLASS_CHANNEL);
+	class_channel_ref = hlua_register_metatable(L, CLASS_CHANNEL);
 
 	/*
 	 *
@@ -8220,11 +8993,11 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Browse existing fetches and create the associated
 	 * object method.
@@ -8240,7 +9013,7 @@ void hlua_init(void)
 			 (sf->val_args != val_hdr))
 			continue;
 
-		/* gL.Tua doesn't support '.' and '-' in the function names, replace it
+		/* Lua doesn't support '.' and '-' in the function names, replace it
 		 * by an underscore.
 		 */
 		strncpy(trash.area, sf->kw, trash.size);
@@ -8250,16 +9023,16 @@ void hlua_init(void)
 				*p = '_';
 
 		/* Register the function. */
-		lua_pushstring(gL.T, trash.area);
-		lua_pushlightuserdata(gL.T, sf);
-		lua_pushcclosure(gL.T, hlua_run_sample_fetch, 1);
-		lua_rawset(gL.T, -3);
+		lua_pushstring(L, trash.area);
+		lua_pushlightuserdata(L, sf);
+		lua_pushcclosure(L, hlua_run_sample_fetch, 1);
+		lua_rawset(L, -3);
 	}
 
-	lua_rawset(gL.T, -3);
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_fetches_ref = hlua_register_metatable(gL.T, CLASS_FETCHES);
+	class_fetches_ref = hlua_register_metatable(L, CLASS_FETCHES);
 
 	/*
 	 *
@@ -8268,11 +9041,11 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Browse existing converters and create the associated
 	 * object method.
@@ -8285,7 +9058,7 @@ void hlua_init(void)
 		if (sc->val_args != NULL)
 			continue;
 
-		/* gL.Tua doesn't support '.' and '-' in the function names, replace it
+		/* Lua doesn't support '.' and '-' in the function names, replace it
 		 * by an underscore.
 		 */
 		strncpy(trash.area, sc->kw, trash.size);
@@ -8295,16 +9068,16 @@ void hlua_init(void)
 				*p = '_';
 
 		/* Register the function. */
-		lua_pushstring(gL.T, trash.area);
-		lua_pushlightuserdata(gL.T, sc);
-		lua_pushcclosure(gL.T, hlua_run_sample_conv, 1);
-		lua_rawset(gL.T, -3);
+		lua_pushstring(L, trash.area);
+		lua_pushlightuserdata(L, sc);
+		lua_pushcclosure(L, hlua_run_sample_conv, 1);
+		lua_rawset(L, -3);
 	}
 
-	lua_rawset(gL.T, -3);
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_converters_ref = hlua_register_metatable(gL.T, CLASS_CONVERTERS);
+	class_converters_ref = hlua_register_metatable(L, CLASS_CONVERTERS);
 
 	/*
 	 *
@@ -8313,36 +9086,42 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register Lua functions. */
-	hlua_class_function(gL.T, "req_get_headers",hlua_http_req_get_headers);
-	hlua_class_function(gL.T, "req_del_header", hlua_http_req_del_hdr);
-	hlua_class_function(gL.T, "req_rep_header", hlua_http_req_rep_hdr);
-	hlua_class_function(gL.T, "req_rep_value",  hlua_http_req_rep_val);
-	hlua_class_function(gL.T, "req_add_header", hlua_http_req_add_hdr);
-	hlua_class_function(gL.T, "req_set_header", hlua_http_req_set_hdr);
-	hlua_class_function(gL.T, "req_set_method", hlua_http_req_set_meth);
-	hlua_class_function(gL.T, "req_set_path",   hlua_http_req_set_path);
-	hlua_class_function(gL.T, "req_set_query",  hlua_http_req_set_query);
-	hlua_class_function(gL.T, "req_set_uri",    hlua_http_req_set_uri);
-
-	hlua_class_function(gL.T, "res_get_headers",hlua_http_res_get_headers);
-	hlua_class_function(gL.T, "res_del_header", hlua_http_res_del_hdr);
-	hlua_class_function(gL.T, "res_rep_header", hlua_http_res_rep_hdr);
-	hlua_class_function(gL.T, "res_rep_value",  hlua_http_res_rep_val);
-	hlua_class_function(gL.T, "res_add_header", hlua_http_res_add_hdr);
-	hlua_class_function(gL.T, "res_set_header", hlua_http_res_set_hdr);
-	hlua_class_function(gL.T, "res_set_status", hlua_http_res_set_status);
-
-	lua_rawset(gL.T, -3);
+	hlua_class_function(L, "req_get_headers",hlua_http_req_get_headers);
+	hlua_class_function(L, "req_get_header", hlua_http_req_get_header);
+	hlua_class_function(L, "req_headers",    hlua_http_req_headers);
+	hlua_class_function(L, "req_body_chunks",hlua_http_req_body_chunks);
+	hlua_class_function(L, "req_del_header", hlua_http_req_del_hdr);
+	hlua_class_function(L, "req_rep_header", hlua_http_req_rep_hdr);
+	hlua_class_function(L, "req_rep_value",  hlua_http_req_rep_val);
+	hlua_class_function(L, "req_add_header", hlua_http_req_add_hdr);
+	hlua_class_function(L, "req_set_header", hlua_http_req_set_hdr);
+	hlua_class_function(L, "req_set_method", hlua_http_req_set_meth);
+	hlua_class_function(L, "req_set_path",   hlua_http_req_set_path);
+	hlua_class_function(L, "req_set_query",  hlua_http_req_set_query);
+	hlua_class_function(L, "req_set_uri",    hlua_http_req_set_uri);
+
+	hlua_class_function(L, "res_get_headers",hlua_http_res_get_headers);
+	hlua_class_function(L, "res_get_header", hlua_http_res_get_header);
+	hlua_class_function(L, "res_headers",    hlua_http_res_headers);
+	hlua_class_function(L, "res_body_chunks",hlua_http_res_body_chunks);
+	hlua_class_function(L, "res_del_header", hlua_http_res_del_hdr);
+	hlua_class_function(L, "res_rep_header", hlua_http_res_rep_hdr);
+	hlua_class_function(L, "res_rep_value",  hlua_http_res_rep_val);
+	hlua_class_function(L, "res_add_header", hlua_http_res_add_hdr);
+	hlua_class_function(L, "res_set_header", hlua_http_res_set_hdr);
+	hlua_class_function(L, "res_set_status", hlua_http_res_set_status);
+
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_http_ref = hlua_register_metatable(gL.T, CLASS_HTTP);
+	class_http_ref = hlua_register_metatable(L, CLASS_HTTP);
 
 	/*
 	 *
@@ -8351,26 +9130,26 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register Lua functions. */
-	hlua_class_function(gL.T, "getline",   hlua_applet_tcp_getline);
-	hlua_class_function(gL.T, "receive",   hlua_applet_tcp_recv);
-	hlua_class_function(gL.T, "send",      hlua_applet_tcp_send);
-	hlua_class_function(gL.T, "set_priv",  hlua_applet_tcp_set_priv);
-	hlua_class_function(gL.T, "get_priv",  hlua_applet_tcp_get_priv);
-	hlua_class_function(gL.T, "set_var",   hlua_applet_tcp_set_var);
-	hlua_class_function(gL.T, "unset_var", hlua_applet_tcp_unset_var);
-	hlua_class_function(gL.T, "get_var",   hlua_applet_tcp_get_var);
+	hlua_class_function(L, "getline",   hlua_applet_tcp_getline);
+	hlua_class_function(L, "receive",   hlua_applet_tcp_recv);
+	hlua_class_function(L, "send",      hlua_applet_tcp_send);
+	hlua_class_function(L, "set_priv",  hlua_applet_tcp_set_priv);
+	hlua_class_function(L, "get_priv",  hlua_applet_tcp_get_priv);
+	hlua_class_function(L, "set_var",   hlua_applet_tcp_set_var);
+	hlua_class_function(L, "unset_var", hlua_applet_tcp_unset_var);
+	hlua_class_function(L, "get_var",   hlua_applet_tcp_get_var);
 
-	lua_settable(gL.T, -3);
+	lua_settable(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_applet_tcp_ref = hlua_register_metatable(gL.T, CLASS_APPLET_TCP);
+	class_applet_tcp_ref = hlua_register_metatable(L, CLASS_APPLET_TCP);
 
 	/*
 	 *
@@ -8379,29 +9158,29 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register Lua functions. */
-	hlua_class_function(gL.T, "set_priv",       hlua_applet_http_set_priv);
-	hlua_class_function(gL.T, "get_priv",       hlua_applet_http_get_priv);
-	hlua_class_function(gL.T, "set_var",        hlua_applet_http_set_var);
-	hlua_class_function(gL.T, "unset_var",      hlua_applet_http_unset_var);
-	hlua_class_function(gL.T, "get_var",        hlua_applet_http_get_var);
-	hlua_class_function(gL.T, "getline",        hlua_applet_http_getline);
-	hlua_class_function(gL.T, "receive",        hlua_applet_http_recv);
-	hlua_class_function(gL.T, "send",           hlua_applet_http_send);
-	hlua_class_function(gL.T, "add_header",     hlua_applet_http_addheader);
-	hlua_class_function(gL.T, "set_status",     hlua_applet_http_status);
-	hlua_class_function(gL.T, "start_response", hlua_applet_http_start_response);
-
-	lua_settable(gL.T, -3);
+	hlua_class_function(L, "set_priv",       hlua_applet_http_set_priv);
+	hlua_class_function(L, "get_priv",       hlua_applet_http_get_priv);
+	hlua_class_function(L, "set_var",        hlua_applet_http_set_var);
+	hlua_class_function(L, "unset_var",      hlua_applet_http_unset_var);
+	hlua_class_function(L, "get_var",        hlua_applet_http_get_var);
+	hlua_class_function(L, "getline",        hlua_applet_http_getline);
+	hlua_class_function(L, "receive",        hlua_applet_http_recv);
+	hlua_class_function(L, "send",           hlua_applet_http_send);
+	hlua_class_function(L, "add_header",     hlua_applet_http_addheader);
+	hlua_class_function(L, "set_status",     hlua_applet_http_status);
+	hlua_class_function(L, "start_response", hlua_applet_http_start_response);
+
+	lua_settable(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_applet_http_ref = hlua_register_metatable(gL.T, CLASS_APPLET_HTTP);
+	class_applet_http_ref = hlua_register_metatable(L, CLASS_APPLET_HTTP);
 
 	/*
 	 *
@@ -8410,51 +9189,51 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 	/* Register Lua functions. */
-	hlua_class_function(gL.T, "set_priv",            hlua_set_priv);
-	hlua_class_function(gL.T, "get_priv",            hlua_get_priv);
-	hlua_class_function(gL.T, "set_var",             hlua_set_var);
-	hlua_class_function(gL.T, "unset_var",           hlua_unset_var);
-	hlua_class_function(gL.T, "get_var",             hlua_get_var);
-	hlua_class_function(gL.T, "done",                hlua_txn_done);
-	hlua_class_function(gL.T, "reply",               hlua_txn_reply_new);
-	hlua_class_function(gL.T, "set_loglevel",        hlua_txn_set_loglevel);
-	hlua_class_function(gL.T, "set_tos",             hlua_txn_set_tos);
-	hlua_class_function(gL.T, "set_mark",            hlua_txn_set_mark);
-	hlua_class_function(gL.T, "set_priority_class",  hlua_txn_set_priority_class);
-	hlua_class_function(gL.T, "set_priority_offset", hlua_txn_set_priority_offset);
-	hlua_class_function(gL.T, "deflog",              hlua_txn_deflog);
-	hlua_class_function(gL.T, "log",                 hlua_txn_log);
-	hlua_class_function(gL.T, "Debug",               hlua_txn_log_debug);
-	hlua_class_function(gL.T, "Info",                hlua_txn_log_info);
-	hlua_class_function(gL.T, "Warning",             hlua_txn_log_warning);
-	hlua_class_function(gL.T, "Alert",               hlua_txn_log_alert);
-
-	lua_rawset(gL.T, -3);
+	hlua_class_function(L, "set_priv",            hlua_set_priv);
+	hlua_class_function(L, "get_priv",            hlua_get_priv);
+	hlua_class_function(L, "set_var",             hlua_set_var);
+	hlua_class_function(L, "unset_var",           hlua_unset_var);
+	hlua_class_function(L, "get_var",             hlua_get_var);
+	hlua_class_function(L, "done",                hlua_txn_done);
+	hlua_class_function(L, "reply",               hlua_txn_reply_new);
+	hlua_class_function(L, "set_loglevel",        hlua_txn_set_loglevel);
+	hlua_class_function(L, "set_tos",             hlua_txn_set_tos);
+	hlua_class_function(L, "set_mark",            hlua_txn_set_mark);
+	hlua_class_function(L, "set_priority_class",  hlua_txn_set_priority_class);
+	hlua_class_function(L, "set_priority_offset", hlua_txn_set_priority_offset);
+	hlua_class_function(L, "deflog",              hlua_txn_deflog);
+	hlua_class_function(L, "log",                 hlua_txn_log);
+	hlua_class_function(L, "Debug",               hlua_txn_log_debug);
+	hlua_class_function(L, "Info",                hlua_txn_log_info);
+	hlua_class_function(L, "Warning",             hlua_txn_log_warning);
+	hlua_class_function(L, "Alert",               hlua_txn_log_alert);
+
+	lua_rawset(L, -3);
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_txn_ref = hlua_register_metatable(gL.T, CLASS_TXN);
+	class_txn_ref = hlua_register_metatable(L, CLASS_TXN);
 
 	/*
 	 *
 	 * Register class reply
 	 *
 	 */
-	lua_newtable(gL.T);
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
-	hlua_class_function(gL.T, "set_status", hlua_txn_reply_set_status);
-	hlua_class_function(gL.T, "add_header", hlua_txn_reply_add_header);
-	hlua_class_function(gL.T, "del_header", hlua_txn_reply_del_header);
-	hlua_class_function(gL.T, "set_body",   hlua_txn_reply_set_body);
-	lua_settable(gL.T, -3); /* Sets the __index entry. */
-	class_txn_reply_ref = luaL_ref(gL.T, LUA_REGISTRYINDEX);
+	lua_newtable(L);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
+	hlua_class_function(L, "set_status", hlua_txn_reply_set_status);
+	hlua_class_function(L, "add_header", hlua_txn_reply_add_header);
+	hlua_class_function(L, "del_header", hlua_txn_reply_del_header);
+	hlua_class_function(L, "set_body",   hlua_txn_reply_set_body);
+	lua_settable(L, -3); /* Sets the __index entry. */
+	class_txn_reply_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
 
 	/*
@@ -8464,33 +9243,58 @@ void hlua_init(void)
 	 */
 
 	/* Create and fill the metatable. */
-	lua_newtable(gL.T);
+	lua_newtable(L);
 
 	/* Create and fill the __index entry. */
-	lua_pushstring(gL.T, "__index");
-	lua_newtable(gL.T);
+	lua_pushstring(L, "__index");
+	lua_newtable(L);
 
 #ifdef USE_OPENSSL
-	hlua_class_function(gL.T, "connect_ssl", hlua_socket_connect_ssl);
+	hlua_class_function(L, "connect_ssl", hlua_socket_connect_ssl);
 #endif
-	hlua_class_function(gL.T, "connect",     hlua_socket_connect);
-	hlua_class_function(gL.T, "send",        hlua_socket_send);
-	hlua_class_function(gL.T, "receive",     hlua_socket_receive);
-	hlua_class_function(gL.T, "close",       hlua_socket_close);
-	hlua_class_function(gL.T, "getpeername", hlua_socket_getpeername);
-	hlua_class_function(gL.T, "getsockname", hlua_socket_getsockname);
-	hlua_class_function(gL.T, "setoption",   hlua_socket_setoption);
-	hlua_class_function(gL.T, "settimeout",  hlua_socket_settimeout);
+	hlua_class_function(L, "connect",     hlua_socket_connect);
+	hlua_class_function(L, "send",        hlua_socket_send);
+	hlua_class_function(L, "receive",     hlua_socket_receive);
+	hlua_class_function(L, "close",       hlua_socket_close);
+	hlua_class_function(L, "getpeername", hlua_socket_getpeername);
+	hlua_class_function(L, "getsockname", hlua_socket_getsockname);
+	hlua_class_function(L, "setoption",   hlua_socket_setoption);
+	hlua_class_function(L, "settimeout",  hlua_socket_settimeout);
 
-	lua_rawset(gL.T, -3); /* Push the last 2 entries in the table at index -3 */
+	lua_rawset(L, -3); /* Push the last 2 entries in the table at index -3 */
 
 	/* Register the garbage collector entry. */
-	lua_pushstring(gL.T, "__gc");
-	lua_pushcclosure(gL.T, hlua_socket_gc, 0);
-	lua_rawset(gL.T, -3); /* Push the last 2 entries in the table at index -3 */
+	lua_pushstring(L, "__gc");
+	lua_pushcclosure(L, hlua_socket_gc, 0);
+	lua_rawset(L, -3); /* Push the last 2 entries in the table at index -3 */
 
 	/* Register previous table in the registry with reference and named entry. */
-	class_socket_ref = hlua_register_metatable(gL.T, CLASS_SOCKET);
+	class_socket_ref = hlua_register_metatable(L, CLASS_SOCKET);
+
+	RESET_SAFE_LJMP(L);
+}
+
+/* Ithis function can fail with an abort() due to an Lua critical error.
+ * We are in the initialisation process of HAProxy, this abort() is
+ * tolerated.
+ */
+void hlua_init(void)
+{
+#ifdef USE_OPENSSL
+	int idx;
+	struct srv_kw *kw;
+	int tmp_error;
+	char *error;
+	char *args[] = { /* SSL client configuration. */
+		"ssl",
+		"verify",
+		"none",
+		NULL
+	};
+#endif
+
+	/* Init the shared lua stack. */
+	hlua_init_state(0);
 
 	/* Proxy and server configuration initialisation. */
 	memset(&socket_proxy, 0, sizeof(socket_proxy));
@@ -8615,8 +9419,6 @@ void hlua_init(void)
 		}
 	}
 #endif
-
-	RESET_SAFE_LJMP(gL.T);
 }
 
 static void hlua_register_build_options(void)
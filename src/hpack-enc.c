@@ -30,7 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <common/hash.h>
 #include <common/hpack-enc.h>
+#include <common/hpack-huff.h>
 #include <common/http-hdr.h>
 #include <common/ist.h>
 
@@ -140,22 +142,45 @@ const signed short hpack_pos_len[32] = {
          /*   24: */   -1,  609,   -1,  636,   -1,   -1,   -1,   -1,
 };
 
-/* Tries to encode header whose name is <n> and value <v> into the chunk <out>.
- * Returns non-zero on success, 0 on failure (buffer full).
+/* Encodes string <str> as a string literal (7541#5.2) at position <pos> of the
+ * area <out> of <size> bytes. The string is Huffman-encoded only when this
+ * makes it shorter, which is the case for most header names and values, but
+ * not for random-looking ones (cookies, tokens) which would grow. Returns the
+ * new position on success, or 0 if it does not fit.
  */
-int hpack_encode_header(struct buffer *out, const struct ist n,
-			const struct ist v)
+int hpack_encode_str(char *out, int pos, int size, const struct ist str)
 {
-	int len = out->data;
-	int size = out->size;
-	int pos;
+	int hlen = huff_enc_len(str.ptr, str.len);
+	int start = pos;
 
-	if (len >= size)
+	if (hlen < str.len) {
+		if (!hpack_len_to_bytes(hlen) ||
+		    pos + hpack_len_to_bytes(hlen) + hlen > size)
+			return 0;
+
+		pos = hpack_encode_len(out, pos, hlen);
+		out[start] |= 0x80; /* H bit */
+		return pos + huff_enc(str.ptr, str.len, out + pos);
+	}
+
+	if (!hpack_len_to_bytes(str.len) ||
+	    pos + hpack_len_to_bytes(str.len) + str.len > size)
 		return 0;
 
-	/* look for the header field <n> in the static table */
+	pos = hpack_encode_len(out, pos, str.len);
+	memcpy(out + pos, str.ptr, str.len);
+	return pos + str.len;
+}
+
+/* Looks up header field name <n> in the static table and returns its index, or
+ * zero if it is not there.
+ */
+static int hpack_find_static_name(const struct ist n)
+{
+	int pos;
+
 	if (n.len >= sizeof(hpack_pos_len) / sizeof(hpack_pos_len[0]))
-		goto make_literal;
+		return 0;
 
 	pos = hpack_pos_len[n.len];
 	if (pos >= 0) {
@@ -166,47 +191,330 @@ int hpack_encode_header(struct buffer *out, const struct ist n,
 			pos++;
 			idx = hpack_enc_stream[pos++];
 			pos += n.len;
-			if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n)) {
-				/* emit literal with indexing (7541#6.2.1) :
-				 * [ 0 | 1 | Index (6+) ]
-				 */
-				out->area[len++] = idx | 0x40;
-				goto emit_value;
-			}
+			if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n))
+				return idx;
 		} while ((unsigned char)hpack_enc_stream[pos] == n.len);
 	}
+	return 0;
+}
 
- make_literal:
-	if (likely(n.len < 127 && len + 2 + n.len <= size)) {
-		out->area[len++] = 0x00;      /* literal without indexing -- new name */
-		out->area[len++] = n.len;     /* single-byte length encoding */
-		ist2bin(out->area + len, n);
-		len += n.len;
+/* Encodes integer <val> with a prefix of <bits> bits (7541#5.1) at position
+ * <pos> of the area <out> of <size> bytes, the first byte being ORed with
+ * <flags>. Returns the new position on success, or 0 if it does not fit.
+ */
+static int hpack_encode_int(char *out, int pos, int size, uint8_t flags, int bits, uint32_t val)
+{
+	uint32_t max = (1U << bits) - 1;
+
+	if (pos >= size)
+		return 0;
+
+	if (val < max) {
+		out[pos++] = flags | val;
+		return pos;
 	}
-	else if (hpack_len_to_bytes(n.len) &&
-		 len + 1 + hpack_len_to_bytes(n.len) + n.len <= size) {
-		out->area[len++] = 0x00;      /* literal without indexing -- new name */
-		len = hpack_encode_len(out->area, len, n.len);
-		ist2bin(out->area + len, n);
-		len += n.len;
+
+	out[pos++] = flags | max;
+	for (val -= max; val >= 128; val >>= 7) {
+		if (pos >= size)
+			return 0;
+		out[pos++] = val | 128;
 	}
-	else {
+
+	if (pos >= size)
+		return 0;
+	out[pos++] = val;
+	return pos;
+}
+
+/* Tries to encode header whose name is <n> and value <v> into the chunk <out>.
+ * Returns non-zero on success, 0 on failure (buffer full).
+ */
+int hpack_encode_header(struct buffer *out, const struct ist n,
+			const struct ist v)
+{
+	int len = out->data;
+	int size = out->size;
+	int idx;
+
+	if (len >= size)
+		return 0;
+
+	/* look for the header field <n> in the static table */
+	idx = hpack_find_static_name(n);
+	if (idx) {
+		/* emit literal with indexing (7541#6.2.1) :
+		 * [ 0 | 1 | Index (6+) ]
+		 */
+		out->area[len++] = idx | 0x40;
+		goto emit_value;
+	}
+
+	out->area[len++] = 0x00;      /* literal without indexing -- new name */
+	len = hpack_encode_str(out->area, len, size, n);
+	if (!len) {
 		/* header field name too large for the buffer */
 		return 0;
 	}
 
  emit_value:
-	/* copy literal header field value */
-	if (!hpack_len_to_bytes(v.len) ||
-	    len + hpack_len_to_bytes(v.len) + v.len > size) {
+	/* encode the literal header field value */
+	len = hpack_encode_str(out->area, len, size, v);
+	if (!len) {
 		/* header value too large for the buffer */
 		return 0;
 	}
 
-	len = hpack_encode_len(out->area, len, v.len);
-	memcpy(out->area + len, v.ptr, v.len);
-	len += v.len;
+	out->data = len;
+	return 1;
+}
+
+/* Initializes the encoder's dynamic table <edht> to store its entries into
+ * <dht>, which must have been allocated with at least <max> bytes. The table
+ * starts with the protocol's default size, 4096 bytes, which is the one the
+ * peer assumes, unless <max> is smaller, in which case a size update will be
+ * emitted with the first header block.
+ */
+void hpack_edht_init(struct hpack_edht *edht, struct hpack_dht *dht, uint32_t max)
+{
+	edht->dht = dht;
+	edht->snap = NULL;
+	edht->cnt = edht->snap_cnt = 0;
+	edht->max = max;
+	edht->flags = 0;
+	memset(edht->idx, 0, sizeof(edht->idx));
+	edht->size = 4096;
+	if (max < 4096) {
+		edht->size = max;
+		edht->flags |= HPACK_EDHT_F_SIZE_UPD;
+	}
+	hpack_dht_init(dht, edht->size);
+}
+
+/* Releases the resources attached to <edht>, except the table itself */
+void hpack_edht_deinit(struct hpack_edht *edht)
+{
+	if (edht->snap) {
+		hpack_dht_free(edht->snap);
+		edht->snap = NULL;
+	}
+}
+
+/* Applies the peer's new SETTINGS_HEADER_TABLE_SIZE <size> to <edht>. The
+ * table is emptied when its size changes and the next header block will start
+ * with the size updates making the peer do the same (7541#4.2). This must not
+ * be called while a block is being encoded.
+ */
+void hpack_edht_set_size(struct hpack_edht *edht, uint32_t size)
+{
+	if (size > edht->max)
+		size = edht->max;
+
+	if (size == edht->size)
+		return;
+
+	/* the changes of a block which was not emitted are flushed as well */
+	hpack_edht_deinit(edht);
+	edht->flags &= ~HPACK_EDHT_F_IN_BLOCK;
+	edht->size = size;
+	edht->flags |= HPACK_EDHT_F_SIZE_UPD;
+	hpack_dht_init(edht->dht, size);
+}
+
+/* Restores the table of <edht> to its state from the beginning of the
+ * current header block, which could not be emitted.
+ */
+static void hpack_edht_rollback(struct hpack_edht *edht)
+{
+	if (edht->snap) {
+		memcpy(edht->dht, edht->snap, edht->snap->size);
+		hpack_dht_free(edht->snap);
+		edht->snap = NULL;
+	}
+	else if (edht->cnt != edht->snap_cnt) {
+		/* the table was empty */
+		hpack_dht_init(edht->dht, edht->size);
+	}
+	edht->cnt = edht->snap_cnt;
+}
+
+/* Prepares <edht> for the encoding of a new header block into <out>, emitting
+ * the pending table size updates if any. If the previous block was not
+ * committed, it was not emitted and its changes are undone first. Returns
+ * non-zero on success, 0 on failure (buffer full).
+ */
+int hpack_edht_start(struct hpack_edht *edht, struct buffer *out)
+{
+	int len;
+
+	if (edht->flags & HPACK_EDHT_F_IN_BLOCK)
+		hpack_edht_rollback(edht);
+
+	edht->flags |= HPACK_EDHT_F_IN_BLOCK;
+	edht->snap_cnt = edht->cnt;
+
+	if (!(edht->flags & HPACK_EDHT_F_SIZE_UPD))
+		return 1;
+
+	/* dynamic table size update (7541#6.3) : [ 0 | 0 | 1 | Max size (5+) ].
+	 * The table was flushed, so we first ask the peer to do the same.
+	 */
+	len = hpack_encode_int(out->area, out->data, out->size, 0x20, 5, 0);
+	if (len && edht->size)
+		len = hpack_encode_int(out->area, len, out->size, 0x20, 5, edht->size);
+	if (!len)
+		return 0;
+
+	out->data = len;
+	return 1;
+}
+
+/* Validates the header block encoded since hpack_edht_start() was called on
+ * <edht>, once it is certain to be emitted.
+ */
+void hpack_edht_commit(struct hpack_edht *edht)
+{
+	edht->flags &= ~(HPACK_EDHT_F_IN_BLOCK | HPACK_EDHT_F_SIZE_UPD);
+	if (edht->snap) {
+		hpack_dht_free(edht->snap);
+		edht->snap = NULL;
+	}
+}
+
+/* Returns non-zero if header field name <n> is not worth indexing because its
+ * value changes with almost every message, which would only evict more
+ * useful entries.
+ */
+static inline int hpack_edht_volatile_name(const struct ist n)
+{
+	return isteq(n, ist("date")) ||
+	       isteq(n, ist("content-length")) ||
+	       isteq(n, ist("etag")) ||
+	       isteq(n, ist("last-modified")) ||
+	       isteq(n, ist("expires")) ||
+	       isteq(n, ist("age")) ||
+	       isteq(n, ist("content-range"));
+}
+
+/* Tries to encode header whose name is <n> and value <v> into the chunk <out>
+ * using the encoder's dynamic table <edht>, between hpack_edht_start() and
+ * hpack_edht_commit(). Fields present in the table are emitted as a single
+ * index. Other ones are emitted as literals with incremental indexing and
+ * inserted into the table, unless they are too large or too volatile, in which
+ * case they are emitted as literals without indexing. Returns non-zero on
+ * success, 0 on failure (buffer full).
+ */
+int hpack_edht_encode_header(struct hpack_edht *edht, struct buffer *out,
+                             const struct ist n, const struct ist v)
+{
+	struct hpack_dht *dht = edht->dht;
+	struct hpack_edht_slot *slot;
+	const struct hpack_dte *dte;
+	uint32_t hash, rel;
+	int len = out->data;
+	int size = out->size;
+	int idx, ret;
+
+	if (len >= size)
+		return 0;
+
+	if (edht->flags & HPACK_EDHT_F_BROKEN)
+		goto no_index;
+
+	hash = hash_djb2(n.ptr, n.len) ^ (hash_djb2(v.ptr, v.len) * 0x9e3779b1U);
+	slot = &edht->idx[hash & (HPACK_EDHT_SLOTS - 1)];
+	rel = edht->cnt - 1 - slot->seq;
+	if (slot->hash == hash && rel < dht->used) {
+		dte = hpack_get_dte(dht, rel + 1);
+		if (dte && isteq(hpack_get_name(dht, dte), n) && isteq(hpack_get_value(dht, dte), v)) {
+			/* indexed header field (7541#6.1) : [ 1 | Index (7+) ] */
+			len = hpack_encode_int(out->area, len, size, 0x80, 7, HPACK_SHT_SIZE + rel);
+			if (!len)
+				return 0;
+			out->data = len;
+			return 1;
+		}
+	}
+
+	if (n.len + v.len + 32 > edht->size / 2 || hpack_edht_volatile_name(n))
+		goto no_index;
+
+	/* save the table before its first change in this block, unless it is
+	 * empty in which case it is only reset.
+	 */
+	if (edht->cnt == edht->snap_cnt && !edht->snap && dht->used) {
+		edht->snap = hpack_dht_alloc();
+		if (!edht->snap)
+			goto no_index;
+		memcpy(edht->snap, dht, dht->size);
+	}
+
+	/* literal with incremental indexing (7541#6.2.1) :
+	 * [ 0 | 1 | Index (6+) ], and the name if the index is zero.
+	 */
+	idx = hpack_find_static_name(n);
+	len = hpack_encode_int(out->area, len, size, 0x40, 6, idx);
+	if (len && !idx)
+		len = hpack_encode_str(out->area, len, size, n);
+	if (len)
+		len = hpack_encode_str(out->area, len, size, v);
+	if (!len)
+		return 0;
+
+	/* the peer inserts the entry, so do we. A negative value indicates a
+	 * memory shortage, after which we cannot know what the peer's table
+	 * contains anymore.
+	 */
+	ret = hpack_dht_insert(dht, n, v);
+	if (ret < 0) {
+		edht->flags |= HPACK_EDHT_F_BROKEN;
+	}
+	else {
+		slot->hash = hash;
+		slot->seq = edht->cnt++;
+	}
+	out->data = len;
+	return 1;
+
+ no_index:
+	/* literal without indexing (7541#6.2.2) :
+	 * [ 0 | 0 | 0 | 0 | Index (4+) ], and the name if the index is zero.
+	 */
+	idx = hpack_find_static_name(n);
+	len = hpack_encode_int(out->area, len, size, 0x00, 4, idx);
+	if (len && !idx)
+		len = hpack_encode_str(out->area, len, size, n);
+	if (len)
+		len = hpack_encode_str(out->area, len, size, v);
+	if (!len)
+		return 0;
 
 	out->data = len;
 	return 1;
 }
+
+/* Tries to encode a :status pseudo-header with the integer status <status>
+ * into the chunk <out> using the encoder's dynamic table <edht>. The status
+ * codes of the static table are emitted as a single byte, the other ones
+ * are indexed in the dynamic table. Returns non-zero on success, 0 on failure
+ * (buffer full). The caller is responsible for ensuring that the status is
+ * comprised between 100 and 999 inclusive.
+ */
+int hpack_edht_encode_int_status(struct hpack_edht *edht, struct buffer *out,
+                                 unsigned int status)
+{
+	unsigned char c = hpack_status_sht_code(status);
+	char str[3];
+
+	if (c) {
+		if (out->data >= out->size)
+			return 0;
+		out->area[out->data++] = c;
+		return 1;
+	}
+
+	str[0] = '0' + status / 100;
+	str[1] = '0' + status / 10 % 10;
+	str[2] = '0' + status % 10;
+	return hpack_edht_encode_header(edht, out, ist(":status"), ist2(str, 3));
+}
@@ -1386,25 +1386,49 @@ struct rht rht_bit11_4[256] = {
 	/* Note, when l==30, bits 2..3 give 00:0x0a, 01:0x0d, 10:0x16, 11:EOS */
 };
 
-/* huffman-encode string <s> into the huff_tmp buffer and returns the amount
- * of output bytes. The caller must ensure the output is large enough (ie at
- * least 4 times as long as s).
- *
- * FIXME: bits are only counted for now, no code is emitted!
+/* Returns the number of bytes needed to Huffman-encode the <len> bytes of
+ * string <s>, including the final padding.
+ */
+int huff_enc_len(const char *s, int len)
+{
+	const uint8_t *p = (const uint8_t *)s;
+	const uint8_t *e = p + len;
+	int bits = 0;
+
+	while (p < e)
+		bits += ht[*p++].b;
+	return (bits + 7) / 8;
+}
+
+/* Huffman-encodes the <len> bytes of string <s> into <out> and returns the
+ * number of output bytes. The caller must ensure the output is large enough,
+ * which is known using huff_enc_len(). The code points are appended to a
+ * 64-bit accumulator from which whole bytes are emitted as soon as they are
+ * complete. Since a code point is at most 30 bits long, no more than 37 bits
+ * are ever pending. The last byte is padded with the most significant bits
+ * of the EOS code (ie ones).
  */
-int huff_enc(const char *s, char *out)
+int huff_enc(const char *s, int len, char *out)
 {
+	const uint8_t *p = (const uint8_t *)s;
+	const uint8_t *e = p + len;
+	char *o = out;
+	uint64_t acc = 0;
 	int bits = 0;
 
-	while (*s) {
-		bits += ht[(uint8_t)*s].b;
-		s++;
+	while (p < e) {
+		acc = (acc << ht[*p].b) | ht[*p].c;
+		bits += ht[*p].b;
+		p++;
+		while (bits >= 8) {
+			bits -= 8;
+			*o++ = acc >> bits;
+		}
 	}
-	bits += 7;
 
-	/*  FIXME: huffman code is not emitted yet. */
-	//memset(out, 'H', bits / 8);
-	return bits / 8;
+	if (bits)
+		*o++ = (acc << (8 - bits)) | (0xff >> bits);
+	return o - out;
 }
 
 /* pass a huffman string, it will decode it and return the new output size or
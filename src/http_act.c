@@ -455,13 +455,17 @@ static enum act_return http_action_req_capture(struct act_rule *rule, struct pro
 {
 	struct sample *key;
 	struct cap_hdr *h = rule->arg.cap.hdr;
-	char **cap = s->req_cap;
+	char **cap;
 	int len;
 
 	key = sample_fetch_as_type(s->be, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, rule->arg.cap.expr, SMP_T_STR);
 	if (!key)
 		return ACT_RET_CONT;
 
+	cap = stream_req_cap(s);
+	if (!cap) /* no more capture memory */
+		return ACT_RET_CONT;
+
 	if (cap[h->index] == NULL)
 		cap[h->index] = pool_alloc(h->pool);
 
@@ -487,7 +491,7 @@ static enum act_return http_action_req_capture_by_id(struct act_rule *rule, stru
 {
 	struct sample *key;
 	struct cap_hdr *h;
-	char **cap = s->req_cap;
+	char **cap;
 	struct proxy *fe = strm_fe(s);
 	int len;
 	int i;
@@ -503,6 +507,10 @@ static enum act_return http_action_req_capture_by_id(struct act_rule *rule, stru
 	if (!key)
 		return ACT_RET_CONT;
 
+	cap = stream_req_cap(s);
+	if (!cap) /* no more capture memory */
+		return ACT_RET_CONT;
+
 	if (cap[h->index] == NULL)
 		cap[h->index] = pool_alloc(h->pool);
 
@@ -684,7 +692,7 @@ static enum act_return http_action_res_capture_by_id(struct act_rule *rule, stru
 {
 	struct sample *key;
 	struct cap_hdr *h;
-	char **cap = s->res_cap;
+	char **cap;
 	struct proxy *fe = strm_fe(s);
 	int len;
 	int i;
@@ -700,6 +708,10 @@ static enum act_return http_action_res_capture_by_id(struct act_rule *rule, stru
 	if (!key)
 		return ACT_RET_CONT;
 
+	cap = stream_res_cap(s);
+	if (!cap) /* no more capture memory */
+		return ACT_RET_CONT;
+
 	if (cap[h->index] == NULL)
 		cap[h->index] = pool_alloc(h->pool);
 
@@ -1111,6 +1123,42 @@ static enum act_parse_ret parse_http_set_log_level(const char **args, int *orig_
 	return ACT_RET_PRS_OK;
 }
 
+/* This function executes a "set-log-decision" action. It forces the stream to
+ * be logged or not, regardless of "option dontlog-normal" and "log-sample". It
+ * always returns ACT_RET_CONT.
+ */
+static enum act_return http_action_set_log_decision(struct act_rule *rule, struct proxy *px,
+                                                    struct session *sess, struct stream *s, int flags)
+{
+	s->flags &= ~(SF_LOG_KEEP | SF_LOG_DROP);
+	s->flags |= rule->arg.http.i;
+	return ACT_RET_CONT;
+}
+
+/* Parse a "set-log-decision" action. It takes "keep" or "drop" as argument. It
+ * returns ACT_RET_PRS_OK on success, ACT_RET_PRS_ERR on error.
+ */
+static enum act_parse_ret parse_http_set_log_decision(const char **args, int *orig_arg, struct proxy *px,
+                                                      struct act_rule *rule, char **err)
+{
+	int cur_arg;
+
+	cur_arg = *orig_arg;
+	if (strcmp(args[cur_arg], "keep") == 0)
+		rule->arg.http.i = SF_LOG_KEEP;
+	else if (strcmp(args[cur_arg], "drop") == 0)
+		rule->arg.http.i = SF_LOG_DROP;
+	else {
+		memprintf(err, "expects exactly 1 argument ('keep' or 'drop')");
+		return ACT_RET_PRS_ERR;
+	}
+
+	rule->action = ACT_CUSTOM;
+	rule->action_ptr = http_action_set_log_decision;
+	*orig_arg = cur_arg + 1;
+	return ACT_RET_PRS_OK;
+}
+
 /* This function executes a early-hint action. It adds an HTTP Early Hint HTTP
  * 103 response header with <.arg.http.str> name and with a value built
  * according to <.arg.http.fmt> log line format. If it is the first early-hint
@@ -1721,21 +1769,17 @@ static enum act_return http_action_track_sc(struct act_rule *rule, struct proxy
 	}
 
 	if (ptr1 || ptr2 || ptr3 || ptr4) {
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 		if (ptr1)
-			stktable_data_cast(ptr1, http_req_cnt)++;
+			_HA_ATOMIC_ADD(&stktable_data_cast(ptr1, http_req_cnt), 1);
 		if (ptr2)
 			update_freq_ctr_period(&stktable_data_cast(ptr2, http_req_rate),
 					       t->data_arg[STKTABLE_DT_HTTP_REQ_RATE].u, 1);
 		if (ptr3)
-			stktable_data_cast(ptr3, http_err_cnt)++;
+			_HA_ATOMIC_ADD(&stktable_data_cast(ptr3, http_err_cnt), 1);
 		if (ptr4)
 			update_freq_ctr_period(&stktable_data_cast(ptr4, http_err_rate),
 					       t->data_arg[STKTABLE_DT_HTTP_ERR_RATE].u, 1);
 
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
-
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(t, ts, 0);
 	}
@@ -1930,6 +1974,7 @@ static struct action_kw_list http_req_actions = {
 		{ "replace-value",    parse_http_replace_header,       0 },
 		{ "return",           parse_http_return,               0 },
 		{ "set-header",       parse_http_set_header,           0 },
+		{ "set-log-decision", parse_http_set_log_decision,     0 },
 		{ "set-log-level",    parse_http_set_log_level,        0 },
 		{ "set-map",          parse_http_set_map,              1 },
 		{ "set-method",       parse_set_req_line,              0 },
@@ -1963,6 +2008,7 @@ static struct action_kw_list http_res_actions = {
 		{ "replace-value",   parse_http_replace_header, 0 },
 		{ "return",          parse_http_return,         0 },
 		{ "set-header",      parse_http_set_header,     0 },
+		{ "set-log-decision", parse_http_set_log_decision, 0 },
 		{ "set-log-level",   parse_http_set_log_level,  0 },
 		{ "set-map",         parse_http_set_map,        1 },
 		{ "set-mark",        parse_http_set_mark,       0 },
@@ -29,6 +29,7 @@
 #include <proto/log.h>
 #include <proto/http_ana.h>
 #include <proto/proxy.h>
+#include <proto/sample.h>
 #include <proto/server.h>
 #include <proto/stream.h>
 #include <proto/stream_interface.h>
@@ -46,7 +47,8 @@ struct pool_head *pool_head_capture = NULL;
 static void http_end_request(struct stream *s);
 static void http_end_response(struct stream *s);
 
-static void http_capture_headers(struct htx *htx, char **cap, struct cap_hdr *cap_hdr);
+static void http_capture_headers(struct htx *htx, struct stream *s, struct cap_hdr *cap_hdr,
+                                 char **(*get_cap)(struct stream *s));
 static int http_del_hdr_value(char *start, char *end, char **from, char *next);
 static size_t http_fmt_req_line(const struct htx_sl *sl, char *str, size_t len);
 static void http_debug_stline(const char *dir, struct stream *s, const struct htx_sl *sl);
@@ -396,8 +398,8 @@ int http_wait_for_request(struct stream *s, struct channel *req, int an_bit)
 		txn->flags |= TX_USE_PX_CONN;
 
 	/* 5: we may need to capture headers */
-	if (unlikely((s->logs.logwait & LW_REQHDR) && s->req_cap))
-		http_capture_headers(htx, s->req_cap, sess->fe->req_cap);
+	if (unlikely((s->logs.logwait & LW_REQHDR) && sess->fe->nb_req_cap))
+		http_capture_headers(htx, s, sess->fe->req_cap, stream_req_cap);
 
 	/* we may have to wait for the request's body */
 	if (s->be->options & PR_O_WREQ_BODY)
@@ -1791,8 +1793,8 @@ int http_wait_for_response(struct stream *s, struct channel *rep, int an_bit)
 	 * 3: we may need to capture headers
 	 */
 	s->logs.logwait &= ~LW_RESP;
-	if (unlikely((s->logs.logwait & LW_RSPHDR) && s->res_cap))
-		http_capture_headers(htx, s->res_cap, sess->fe->rsp_cap);
+	if (unlikely((s->logs.logwait & LW_RSPHDR) && sess->fe->nb_rsp_cap))
+		http_capture_headers(htx, s, sess->fe->rsp_cap, stream_res_cap);
 
 	/* Skip parsing if no content length is possible. */
 	if (unlikely((txn->meth == HTTP_METH_CONNECT && txn->status == 200) ||
@@ -2859,6 +2861,8 @@ static enum rule_result http_req_get_intercept_rule(struct proxy *px, struct lis
 				continue;
 		}
 
+		/* the action may change the message in place */
+		smp_memo_reset(s);
 		act_opts |= ACT_OPT_FIRST;
   resume_execution:
 		/* Always call the action function if defined */
@@ -3015,6 +3019,8 @@ static enum rule_result http_res_get_intercept_rule(struct proxy *px, struct lis
 				continue;
 		}
 
+		/* the action may change the message in place */
+		smp_memo_reset(s);
 		act_opts |= ACT_OPT_FIRST;
 resume_execution:
 
@@ -4883,11 +4889,14 @@ static int http_reply_100_continue(struct stream *s)
 
 /*
  * Capture headers from message <htx> according to header list <cap_hdr>, and
- * fill the <cap> pointers appropriately.
+ * fill the capture slots of stream <s> returned by <get_cap> appropriately.
+ * The slots are only retrieved, hence allocated, once a header matches.
  */
-static void http_capture_headers(struct htx *htx, char **cap, struct cap_hdr *cap_hdr)
+static void http_capture_headers(struct htx *htx, struct stream *s, struct cap_hdr *cap_hdr,
+                                 char **(*get_cap)(struct stream *s))
 {
 	struct cap_hdr *h;
+	char **cap = NULL;
 	int32_t pos;
 
 	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
@@ -4905,6 +4914,11 @@ static void http_capture_headers(struct htx *htx, char **cap, struct cap_hdr *ca
 		for (h = cap_hdr; h; h = h->next) {
 			if (h->namelen && (h->namelen == n.len) &&
 			    (strncasecmp(n.ptr, h->name, h->namelen) == 0)) {
+				if (!cap && (cap = get_cap(s)) == NULL) {
+					ha_alert("HTTP capture : out of memory.\n");
+					return;
+				}
+
 				if (cap[h->index] == NULL)
 					cap[h->index] =
 						pool_alloc(h->pool);
@@ -5107,6 +5121,7 @@ void http_init_txn(struct stream *s)
 	txn->status = -1;
 	txn->http_reply = NULL;
 	write_u32(txn->cache_hash, 0);
+	memset(txn->cache_vary_hash, 0, sizeof(txn->cache_vary_hash));
 
 	txn->cookie_first_date = 0;
 	txn->cookie_last_date = 0;
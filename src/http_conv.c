@@ -302,6 +302,8 @@ static int smp_conv_req_capture(const struct arg *args, struct sample *smp, void
 		return 0;
 
 	/* check for the memory allocation */
+	if (!stream_req_cap(smp->strm))
+		return 0;
 	if (smp->strm->req_cap[hdr->index] == NULL)
 		smp->strm->req_cap[hdr->index] = pool_alloc(hdr->pool);
 	if (smp->strm->req_cap[hdr->index] == NULL)
@@ -347,6 +349,8 @@ static int smp_conv_res_capture(const struct arg *args, struct sample *smp, void
 		return 0;
 
 	/* check for the memory allocation */
+	if (!stream_res_cap(smp->strm))
+		return 0;
 	if (smp->strm->res_cap[hdr->index] == NULL)
 		smp->strm->res_cap[hdr->index] = pool_alloc(hdr->pool);
 	if (smp->strm->res_cap[hdr->index] == NULL)
@@ -90,6 +90,147 @@ size_t http_get_hdrs_size(struct htx *htx)
 	return sz;
 }
 
+/* Index of the header names of an HTX message, used to find the headers by
+ * name without comparing all the names. It is built on the first lookup and
+ * remains valid as long as the message's generation and first block do not
+ * change. Removed headers stay in the index but are skipped since their block
+ * is unused. Each name is hashed in lower case into an open addressing table
+ * whose slots point to the first header of this name, the following ones
+ * being chained in the message order.
+ */
+#define HTTP_HDR_IDX_MAX    256                      /* max number of indexed headers */
+#define HTTP_HDR_IDX_SLOTS  (2 * HTTP_HDR_IDX_MAX)    /* hash table size, must be a power of 2 */
+
+struct http_hdr_idx {
+	const struct htx *htx;  /* indexed message, NULL if none */
+	uint32_t gen;           /* generation of the message when indexed */
+	int32_t first;          /* first block of the message when indexed */
+	int nbhdrs;             /* number of indexed headers, -1 if there were too many */
+	int16_t slots[HTTP_HDR_IDX_SLOTS]; /* first header of each name + 1, 0 if empty */
+	struct {
+		uint32_t hash;  /* hash of the lower case name */
+		int32_t  pos;   /* position of the header's block */
+		int16_t  next;  /* next header with the same name, -1 if none */
+		int16_t  last;  /* last header with the same name (first one only) */
+	} hdrs[HTTP_HDR_IDX_MAX];
+};
+
+/* one index for the requests and one for the responses */
+static THREAD_LOCAL struct http_hdr_idx http_hdr_idx[2];
+static THREAD_LOCAL int http_hdr_idx_cur;
+
+static inline uint32_t http_hdr_idx_hash(const struct ist name)
+{
+	uint32_t hash = 0;
+	size_t i;
+
+	for (i = 0; i < name.len; i++)
+		hash = hash * 31 + (name.ptr[i] | 0x20);
+	return hash;
+}
+
+/* Returns the header index of the HTX message <htx>, building it if needed, or
+ * NULL if the message has too many headers to be indexed.
+ */
+static struct http_hdr_idx *http_get_hdr_idx(const struct htx *htx)
+{
+	struct http_hdr_idx *idx;
+	struct htx_blk *blk;
+	struct ist n;
+	uint32_t hash, slot;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		idx = &http_hdr_idx[i];
+		if (idx->htx == htx && idx->gen == htx->gen && idx->first == htx->first) {
+			http_hdr_idx_cur = i;
+			return (idx->nbhdrs < 0) ? NULL : idx;
+		}
+	}
+
+	/* replace the index which was not used last */
+	http_hdr_idx_cur ^= 1;
+	idx = &http_hdr_idx[http_hdr_idx_cur];
+	idx->htx = htx;
+	idx->gen = htx->gen;
+	idx->first = htx->first;
+	idx->nbhdrs = 0;
+	memset(idx->slots, 0, sizeof(idx->slots));
+
+	for (blk = htx_get_first_blk(htx); blk; blk = htx_get_next_blk(htx, blk)) {
+		enum htx_blk_type type = htx_get_blk_type(blk);
+
+		if (type == HTX_BLK_EOH || type == HTX_BLK_EOM)
+			break;
+		if (type != HTX_BLK_HDR)
+			continue;
+
+		if (idx->nbhdrs == HTTP_HDR_IDX_MAX) {
+			idx->nbhdrs = -1;
+			return NULL;
+		}
+
+		n = htx_get_blk_name(htx, blk);
+		hash = http_hdr_idx_hash(n);
+		i = idx->nbhdrs++;
+		idx->hdrs[i].hash = hash;
+		idx->hdrs[i].pos  = htx_get_blk_pos(htx, blk);
+		idx->hdrs[i].next = -1;
+		idx->hdrs[i].last = i;
+
+		for (slot = hash & (HTTP_HDR_IDX_SLOTS - 1); idx->slots[slot]; slot = (slot + 1) & (HTTP_HDR_IDX_SLOTS - 1)) {
+			int head = idx->slots[slot] - 1;
+
+			if (idx->hdrs[head].hash == hash &&
+			    isteqi(htx_get_blk_name(htx, htx_get_blk(htx, idx->hdrs[head].pos)), n)) {
+				idx->hdrs[idx->hdrs[head].last].next = i;
+				idx->hdrs[head].last = i;
+				break;
+			}
+		}
+		if (!idx->slots[slot])
+			idx->slots[slot] = i + 1;
+	}
+	return idx;
+}
+
+/* Returns the first header block named <name> after the position <pos> (-1 to
+ * start from the beginning) using the index <idx> of the HTX message <htx>, or
+ * NULL if there is none.
+ */
+static struct htx_blk *http_hdr_idx_next(const struct http_hdr_idx *idx, const struct htx *htx,
+                                         const struct ist name, int32_t pos)
+{
+	struct htx_blk *blk, *found;
+	uint32_t hash, slot;
+	int i;
+
+	hash = http_hdr_idx_hash(name);
+	for (slot = hash & (HTTP_HDR_IDX_SLOTS - 1); idx->slots[slot]; slot = (slot + 1) & (HTTP_HDR_IDX_SLOTS - 1)) {
+		i = idx->slots[slot] - 1;
+		if (idx->hdrs[i].hash != hash)
+			continue;
+
+		/* all the headers of a chain have the same name, so the first
+		 * one still in use tells if it is the right chain.
+		 */
+		found = NULL;
+		for (; i >= 0; i = idx->hdrs[i].next) {
+			blk = htx_get_blk(htx, idx->hdrs[i].pos);
+			if (htx_get_blk_type(blk) != HTX_BLK_HDR)
+				continue;
+			if (!found && !isteqi(htx_get_blk_name(htx, blk), name))
+				break;
+			found = blk;
+			if (idx->hdrs[i].pos > pos)
+				return blk;
+		}
+		if (found)
+			return NULL;
+	}
+	return NULL;
+}
+
 /* Finds the first or next occurrence of header matching <pattern> in the HTX
  * message <htx> using the context <ctx>. This structure holds everything
  * necessary to use the header and find next occurrence. If its <blk> member is
@@ -128,9 +269,15 @@ size_t http_get_hdrs_size(struct htx *htx)
 static int __http_find_header(const struct htx *htx, const void *pattern, struct http_hdr_ctx *ctx, int flags)
 {
 	struct htx_blk *blk = ctx->blk;
+	struct http_hdr_idx *idx = NULL;
 	struct ist n, v;
 	enum htx_blk_type type;
 
+	/* exact names are looked up using the header index */
+	if ((flags & HTTP_FIND_FL_MATCH_TYPE) == HTTP_FIND_FL_MATCH_STR &&
+	    istlen(*(const struct ist *)pattern) && !htx_is_empty(htx))
+		idx = http_get_hdr_idx(htx);
+
 	if (blk) {
 		char *p;
 
@@ -156,6 +303,13 @@ static int __http_find_header(const struct htx *htx, const void *pattern, struct
 	if (htx_is_empty(htx))
 		return 0;
 
+	if (idx) {
+		blk = http_hdr_idx_next(idx, htx, *(const struct ist *)pattern, -1);
+		if (!blk)
+			goto end;
+		goto match;
+	}
+
 	for (blk = htx_get_first_blk(htx); blk; blk = htx_get_next_blk(htx, blk)) {
 	  rescan_hdr:
 		type = htx_get_blk_type(blk);
@@ -231,9 +385,15 @@ static int __http_find_header(const struct htx *htx, const void *pattern, struct
 		return 1;
 
 	  next_blk:
-		;
+		if (idx) {
+			blk = http_hdr_idx_next(idx, htx, *(const struct ist *)pattern, htx_get_blk_pos(htx, blk));
+			if (!blk)
+				break;
+			goto match;
+		}
 	}
 
+  end:
 	ctx->blk   = NULL;
 	ctx->value = ist("");
 	ctx->lws_before = ctx->lws_after = 0;
@@ -314,6 +474,7 @@ int http_add_header(struct htx *htx, const struct ist n, const struct ist v)
 
 		blk = pblk;
 	}
+	htx_new_gen(htx);
 
   end:
 	sl = http_get_stline(htx);
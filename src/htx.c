@@ -15,53 +15,145 @@
 
 struct htx htx_empty = { .size = 0, .data = 0, .head  = -1, .tail = -1, .first = -1 };
 
-/* Defragments an HTX message. It removes unused blocks and unwraps the payloads
- * part. A temporary buffer is used to do so. This function never fails. if
- * <blk> is not NULL, we replace it by the new block address, after the
- * defragmentation. The new <blk> is returned.
+/* per-thread counter used to build the generation of the HTX messages */
+THREAD_LOCAL unsigned int htx_gen = 0;
+
+/* An entry of the table used to sort the payloads by address during the
+ * defragmentation.
+ */
+struct htx_defrag_ent {
+	uint32_t addr;
+	int32_t  pos;
+};
+
+static int htx_defrag_cmp(const void *a, const void *b)
+{
+	const struct htx_defrag_ent *ea = a, *eb = b;
+
+	return (ea->addr > eb->addr) - (ea->addr < eb->addr);
+}
+
+/* Slides the payload of the block <blk> at the address <addr>, which must not
+ * be after its current one. Returns the address following the payload.
+ */
+static inline uint32_t htx_defrag_slide(struct htx *htx, struct htx_blk *blk, uint32_t addr)
+{
+	uint32_t sz = htx_get_blksz(blk);
+
+	if (blk->addr != addr) {
+		memmove((void *)htx->blocks + addr, htx_get_blk_ptr(htx, blk), sz);
+		blk->addr = addr;
+	}
+	return addr + sz;
+}
+
+/* Defragments an HTX message. It removes unused blocks, unwraps the payloads
+ * part and merges the adjacent DATA blocks. It is performed in place: the
+ * payloads are slid towards the beginning of the message in address order, so
+ * those which are already packed are not moved. A table of addresses is only
+ * needed when the payloads are not stored in the same order as their blocks.
+ * This function never fails. if <blk> is not NULL, we replace it by the new
+ * block address, after the defragmentation. The new <blk> is returned. Its
+ * payload is not preserved, it is only reserved after all other ones, because
+ * it is about to be rewritten by the caller and its size may already be the
+ * new one.
  */
-/* TODO: merge data blocks into one */
 struct htx_blk *htx_defrag(struct htx *htx, struct htx_blk *blk)
 {
-	struct buffer *chunk = get_trash_chunk();
-	struct htx *tmp = htxbuf(chunk);
-	struct htx_blk *newblk, *oldblk;
-	uint32_t new, old, blkpos;
-	uint32_t addr, blksz;
-	int32_t first = -1;
+	struct htx_defrag_ent *ents;
+	struct htx_blk *posblk, *newblk, *prevblk;
+	uint32_t addr, sz;
+	int32_t pos, new, blkpos, first, count, i;
+	int sorted, mergeable;
 
 	if (htx->head == -1)
 		return NULL;
 
-	blkpos = -1;
+	/* check if the payloads are in the same order as their blocks */
+	sorted = 1;
+	count = 0;
+	addr = 0;
+	for (pos = htx_get_head(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		posblk = htx_get_blk(htx, pos);
+		if (htx_get_blk_type(posblk) == HTX_BLK_UNUSED || posblk == blk)
+			continue;
+		if (posblk->addr < addr)
+			sorted = 0;
+		addr = posblk->addr;
+		count++;
+	}
 
-	new  = 0;
+	/* slide the payloads. There is no overlap with the payloads not moved
+	 * yet since they are processed by increasing address.
+	 */
 	addr = 0;
-	tmp->size = htx->size;
+	if (sorted) {
+		for (pos = htx_get_head(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+			posblk = htx_get_blk(htx, pos);
+			if (htx_get_blk_type(posblk) != HTX_BLK_UNUSED && posblk != blk)
+				addr = htx_defrag_slide(htx, posblk, addr);
+		}
+	}
+	else {
+		/* at most one entry per block, so it fits in a chunk */
+		ents = (struct htx_defrag_ent *)get_trash_chunk()->area;
+		i = 0;
+		for (pos = htx_get_head(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+			posblk = htx_get_blk(htx, pos);
+			if (htx_get_blk_type(posblk) == HTX_BLK_UNUSED || posblk == blk)
+				continue;
+			ents[i].addr = posblk->addr;
+			ents[i].pos  = pos;
+			i++;
+		}
+		qsort(ents, count, sizeof(*ents), htx_defrag_cmp);
+		for (i = 0; i < count; i++)
+			addr = htx_defrag_slide(htx, htx_get_blk(htx, ents[i].pos), addr);
+	}
+
+	if (blk != NULL) {
+		blk->addr = addr;
+		addr += htx_get_blksz(blk);
+	}
 
-	/* start from the head */
-	for (old = htx_get_head(htx); old != -1; old = htx_get_next(htx, old)) {
-		oldblk = htx_get_blk(htx, old);
-		if (htx_get_blk_type(oldblk) == HTX_BLK_UNUSED)
+	/* pack the blocks from the position 0, removing unused blocks and
+	 * merging each DATA block into the previous one when their payloads
+	 * are contiguous. <blk> and the first block are never merged.
+	 */
+	new = 0;
+	first = blkpos = -1;
+	prevblk = NULL;
+	mergeable = 0;
+	for (pos = htx_get_head(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		posblk = htx_get_blk(htx, pos);
+		if (htx_get_blk_type(posblk) == HTX_BLK_UNUSED)
 			continue;
 
-		newblk = htx_get_blk(tmp, new);
-		newblk->addr = addr;
-		newblk->info = oldblk->info;
-		blksz = htx_get_blksz(oldblk);
+		sz = htx_get_blksz(posblk);
+		if (mergeable && htx_get_blk_type(posblk) == HTX_BLK_DATA &&
+		    posblk != blk && pos != htx->first &&
+		    prevblk->addr + htx_get_blksz(prevblk) == posblk->addr &&
+		    htx_get_blksz(prevblk) + sz <= 0xfffffff) {
+			prevblk->info += sz;
+			continue;
+		}
 
 		/* update the start-line position */
-		if (htx->first == old)
+		if (htx->first == pos)
 			first = new;
 
 		/* if <blk> is defined, save its new position */
-		if (blk != NULL && blk == oldblk)
+		if (blk != NULL && blk == posblk)
 			blkpos = new;
 
-		memcpy((void *)tmp->blocks + addr, htx_get_blk_ptr(htx, oldblk), blksz);
+		newblk = htx_get_blk(htx, new);
+		mergeable = (htx_get_blk_type(posblk) == HTX_BLK_DATA && posblk != blk);
+		if (newblk != posblk) {
+			newblk->info = posblk->info;
+			newblk->addr = posblk->addr;
+		}
+		prevblk = newblk;
 		new++;
-		addr += blksz;
-
 	}
 
 	htx->first = first;
@@ -69,7 +161,7 @@ struct htx_blk *htx_defrag(struct htx *htx, struct htx_blk *blk)
 	htx->tail = new - 1;
 	htx->head_addr = htx->end_addr = 0;
 	htx->tail_addr = addr;
-	memcpy((void *)htx->blocks, (void *)tmp->blocks, htx->size);
+	htx_new_gen(htx);
 
 	return ((blkpos == -1) ? NULL : htx_get_blk(htx, blkpos));
 }
@@ -104,6 +196,7 @@ static void htx_defrag_blks(struct htx *htx)
 	BUG_ON(!new);
 	htx->head = 0;
 	htx->tail = new - 1;
+	htx_new_gen(htx);
 }
 
 /* Reserves a new block in the HTX message <htx> with a content of <blksz>
@@ -312,6 +405,7 @@ struct htx_blk *htx_add_blk(struct htx *htx, enum htx_blk_type type, uint32_t bl
 	BUG_ON(blk->addr > htx->size);
 
 	blk->info = (type << 28);
+	htx_new_gen(htx);
 	return blk;
 }
 
@@ -745,6 +839,7 @@ struct htx_blk *htx_replace_header(struct htx *htx, struct htx_blk *blk,
 	/* Set the new block size and update HTX message */
 	blk->info = (type << 28) + (value.len << 8) + name.len;
 	htx->data += delta;
+	htx_new_gen(htx);
 
 	/* Replace in place or at a new address is the same. We replace all the
 	 * header (name+value). Only take care to defrag the message if
@@ -1006,6 +1101,109 @@ size_t htx_add_data(struct htx *htx, const struct ist data)
 	return len;
 }
 
+/* Turns the raw buffer <buf> into an HTX message made of a single DATA block
+ * whose payload is made of the <len> bytes located at offset <ofs> from the
+ * beginning of the buffer's area, without moving them. <ofs> must not be lower
+ * than sizeof(struct htx) and there must be room for at least two blocks after
+ * the payload. The free space in front of the payload remains usable. The
+ * buffer is then considered full like after htx_to_buf(). Returns the HTX
+ * message.
+ */
+struct htx *htx_from_buf_data(struct buffer *buf, size_t ofs, uint32_t len)
+{
+	struct htx *htx = (struct htx *)buf->area;
+	struct htx_blk *blk;
+	uint32_t addr = ofs - sizeof(*htx);
+
+	BUG_ON(ofs < sizeof(*htx));
+	BUG_ON(ofs + len + 2 * sizeof(*blk) > b_size(buf));
+
+	htx->size = b_size(buf) - sizeof(*htx);
+	htx_reset(htx);
+
+	htx->head = htx->tail = htx->first = 0;
+	blk = htx_get_blk(htx, 0);
+	blk->addr = addr;
+	blk->info = (HTX_BLK_DATA << 28) + len;
+	htx->data = len;
+	htx->end_addr = addr;
+	htx->tail_addr = addr + len;
+
+	buf->head = 0;
+	b_set_data(buf, b_size(buf));
+	return htx;
+}
+
+/* Reserves the maximum possible room for DATA at the end of the message, by
+ * extending the tail DATA block or by creating a new one, so that a caller
+ * having data spread over several buffers may copy them directly to the HTX
+ * message. It returns a compound result with the HTX block and the position
+ * where the new data must be written (0 for a new block). The block's value
+ * covers the whole reserved room and must be shrunk to the really used length
+ * with htx_change_blk_value_len() once the data copied. NULL is returned
+ * instead of a pointer on an HTX block if an error occurs or if there is no
+ * space left.
+ */
+struct htx_ret htx_reserve_max_data(struct htx *htx)
+{
+	struct htx_blk *blk, *tailblk;
+	uint32_t sz, room;
+	int32_t len = htx_free_data_space(htx);
+
+	if (htx->head == -1)
+		goto rsv_new_block;
+
+	if (!len)
+		return (struct htx_ret){.ret = 0, .blk = NULL};
+
+	/* get the tail and head block */
+	tailblk = htx_get_tail_blk(htx);
+	if (tailblk == NULL)
+		goto rsv_new_block;
+	sz = htx_get_blksz(tailblk);
+
+	/* Don't try to append data if the last inserted block is not of the
+	 * same type */
+	if (htx_get_blk_type(tailblk) != HTX_BLK_DATA)
+		goto rsv_new_block;
+
+	/*
+	 * Same type and enough space: extend the block
+	 */
+	if (!htx->head_addr) {
+		if (tailblk->addr+sz != htx->tail_addr)
+			goto rsv_new_block;
+		room = (htx_pos_to_addr(htx, htx->tail) - htx->tail_addr);
+	}
+	else {
+		if (tailblk->addr+sz != htx->head_addr)
+			goto rsv_new_block;
+		room = (htx->end_addr - htx->head_addr);
+	}
+	BUG_ON((int32_t)room < 0);
+	if (room < len)
+		len = room;
+
+	/* FIXME: check v.len + len < 256MB */
+	htx_change_blk_value_len(htx, tailblk, sz+len);
+
+	BUG_ON((int32_t)htx->tail_addr < 0);
+	BUG_ON((int32_t)htx->head_addr < 0);
+	BUG_ON(htx->end_addr > htx->tail_addr);
+	BUG_ON(htx->head_addr > htx->end_addr);
+	return (struct htx_ret){.ret = sz, .blk = tailblk};
+
+  rsv_new_block:
+	if (!len)
+		return (struct htx_ret){.ret = 0, .blk = NULL};
+	/* FIXME: check len (< 256MB) */
+	blk = htx_add_blk(htx, HTX_BLK_DATA, len);
+	if (!blk)
+		return (struct htx_ret){.ret = 0, .blk = NULL};
+	blk->info += len;
+	return (struct htx_ret){.ret = 0, .blk = blk};
+}
+
 
 /* Adds an HTX block of type DATA in <htx> just after all other DATA
  * blocks. Because it relies on htx_add_data_atonce(), It may be happened to a
@@ -1033,6 +1231,7 @@ struct htx_blk *htx_add_last_data(struct htx *htx, struct ist data)
 			blk->addr += htx_get_blksz(pblk);
 		blk = pblk;
 	}
+	htx_new_gen(htx);
 
 	return blk;
 }
@@ -1056,6 +1255,7 @@ void htx_move_blk_before(struct htx *htx, struct htx_blk **blk, struct htx_blk *
 			break;
 		cblk = pblk;
 	}
+	htx_new_gen(htx);
 	*blk = cblk;
 	*ref = pblk;
 }
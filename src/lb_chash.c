@@ -47,6 +47,97 @@ static inline struct eb32_node *chash_skip_node(struct eb_root *root, struct eb3
 	return node;
 }
 
+/* Returns the lookup table of the <root> tree of proxy <p>. */
+static inline struct lb_chash_tbl *chash_tbl(struct proxy *p, struct eb_root *root)
+{
+	return (root == &p->lbprm.chash.act) ? &p->lbprm.chash.act_tbl : &p->lbprm.chash.bck_tbl;
+}
+
+/* Rebuilds the lookup table <tbl> of the <root> tree, or releases it if the
+ * tree became too small. On memory allocation failure the tree is looked up
+ * directly until its next change. The lbprm's lock must be held for writing.
+ */
+static void chash_tbl_build(struct lb_chash_tbl *tbl, struct eb_root *root)
+{
+	struct eb32_node **bucket;
+	struct eb32_node *node;
+	unsigned int nodes = 0, bits, b, shift;
+
+	tbl->dirty = 0;
+	for (node = eb32_first(root); node; node = eb32_next(node))
+		nodes++;
+
+	if (nodes < CHASH_TBL_MIN_NODES) {
+		free(tbl->bucket);
+		tbl->bucket = NULL;
+		tbl->bits = tbl->size = 0;
+		return;
+	}
+
+	for (bits = 1; bits < 31 && (1U << bits) < nodes; bits++)
+		;
+
+	if (tbl->size != 1U << bits) {
+		bucket = realloc(tbl->bucket, (1U << bits) * sizeof(*bucket));
+		if (!bucket) {
+			tbl->bits = 0;
+			return;
+		}
+		tbl->bucket = bucket;
+		tbl->size = 1U << bits;
+	}
+
+	shift = 32 - bits;
+	node = eb32_first(root);
+	for (b = 0; b < tbl->size; b++) {
+		while (node && node->key < (b << shift))
+			node = eb32_next(node);
+		tbl->bucket[b] = node;
+	}
+	tbl->bits = bits;
+}
+
+/* Rebuilds the lookup tables of proxy <p> which are not up to date, unless a
+ * bulk of changes is in progress, in which case they will be rebuilt once it
+ * is done. The lookups only take the lbprm's lock for reading and thus cannot
+ * rebuild the tables themselves. The lbprm's lock must not be held, it will
+ * be taken for writing only if a table needs to be rebuilt.
+ */
+static inline void chash_tbl_refresh(struct proxy *p)
+{
+	if (likely(!p->lbprm.chash.act_tbl.dirty && !p->lbprm.chash.bck_tbl.dirty) ||
+	    p->lbprm.defer_updates)
+		return;
+
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	if (!p->lbprm.defer_updates) {
+		if (p->lbprm.chash.act_tbl.dirty)
+			chash_tbl_build(&p->lbprm.chash.act_tbl, &p->lbprm.chash.act);
+		if (p->lbprm.chash.bck_tbl.dirty)
+			chash_tbl_build(&p->lbprm.chash.bck_tbl, &p->lbprm.chash.bck);
+	}
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+}
+
+/* Returns the first node of the <root> tree of proxy <p> whose key is greater
+ * than or equal to <hash>, or NULL if none, as eb32_lookup_ge() does. The
+ * tree is looked up directly if its table is not up to date. The lbprm's lock
+ * must be held, at least for reading.
+ */
+static inline struct eb32_node *chash_lookup_ge(struct proxy *p, struct eb_root *root, unsigned int hash)
+{
+	struct lb_chash_tbl *tbl = chash_tbl(p, root);
+	struct eb32_node *node;
+
+	if (tbl->dirty || !tbl->bits)
+		return eb32_lookup_ge(root, hash);
+
+	node = tbl->bucket[hash >> (32 - tbl->bits)];
+	while (node && node->key < hash)
+		node = eb32_next(node);
+	return node;
+}
+
 /* Remove all of a server's entries from its tree. This may be used when
  * setting a server down.
  */
@@ -59,6 +150,7 @@ static inline void chash_dequeue_srv(struct server *s)
 		if (s->proxy->lbprm.chash.last == &s->lb_nodes[s->lb_nodes_now].node)
 			s->proxy->lbprm.chash.last = chash_skip_node(s->lb_tree, s->proxy->lbprm.chash.last);
 		eb32_delete(&s->lb_nodes[s->lb_nodes_now].node);
+		chash_tbl(s->proxy, s->lb_tree)->dirty = 1;
 	}
 }
 
@@ -78,6 +170,7 @@ static inline void chash_queue_dequeue_srv(struct server *s)
 		if (s->proxy->lbprm.chash.last == &s->lb_nodes[s->lb_nodes_now].node)
 			s->proxy->lbprm.chash.last = chash_skip_node(s->lb_tree, s->proxy->lbprm.chash.last);
 		eb32_delete(&s->lb_nodes[s->lb_nodes_now].node);
+		chash_tbl(s->proxy, s->lb_tree)->dirty = 1;
 	}
 
 	/* Attempt to increase the total number of nodes, if the user
@@ -110,6 +203,7 @@ static inline void chash_queue_dequeue_srv(struct server *s)
 		if (s->proxy->lbprm.chash.last == &s->lb_nodes[s->lb_nodes_now].node)
 			s->proxy->lbprm.chash.last = chash_skip_node(s->lb_tree, s->proxy->lbprm.chash.last);
 		eb32_insert(s->lb_tree, &s->lb_nodes[s->lb_nodes_now].node);
+		chash_tbl(s->proxy, s->lb_tree)->dirty = 1;
 		s->lb_nodes_now++;
 	}
 }
@@ -129,7 +223,7 @@ static void chash_set_server_status_down(struct server *srv)
 	if (!srv_lb_status_changed(srv))
                return;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
 
 	if (srv_willbe_usable(srv))
 		goto out_update_state;
@@ -167,7 +261,7 @@ out_update_backend:
  out_update_state:
 	srv_lb_commit_status(srv);
 
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 }
 
 /* This function updates the server trees according to server <srv>'s new
@@ -186,7 +280,7 @@ static void chash_set_server_status_up(struct server *srv)
 	if (!srv_lb_status_changed(srv))
                return;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
 
 	if (!srv_willbe_usable(srv))
 		goto out_update_state;
@@ -229,7 +323,7 @@ static void chash_set_server_status_up(struct server *srv)
  out_update_state:
 	srv_lb_commit_status(srv);
 
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 }
 
 /* This function must be called after an update to server <srv>'s effective
@@ -269,7 +363,7 @@ static void chash_update_server_weight(struct server *srv)
 		return;
 	}
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
 
 	/* only adjust the server's presence in the tree */
 	chash_queue_dequeue_srv(srv);
@@ -282,7 +376,7 @@ static void chash_update_server_weight(struct server *srv)
 	update_backend_weight(p);
 	srv_lb_commit_status(srv);
 
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 }
 
 /*
@@ -320,6 +414,9 @@ int chash_server_is_eligible(struct server *s)
  * will still both receive traffic. If any server is found, it will be returned.
  * It will also skip server <avoid> if the hash result ends on this one.
  * If no valid server is found, NULL is returned.
+ *
+ * The lbprm's lock will be used for reading only, so that concurrent lookups
+ * do not wait for each other.
  */
 struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const struct server *avoid)
 {
@@ -329,7 +426,8 @@ struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const s
 	unsigned int dn, dp;
 	int loop;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	chash_tbl_refresh(p);
+	HA_RWLOCK_RDLOCK(LBPRM_LOCK, &p->lbprm.lock);
 
 	if (p->srv_act)
 		root = &p->lbprm.chash.act;
@@ -345,7 +443,7 @@ struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const s
 	}
 
 	/* find the node after and the node before */
-	next = eb32_lookup_ge(root, hash);
+	next = chash_lookup_ge(p, root, hash);
 	if (!next)
 		next = eb32_first(root);
 	if (!next) {
@@ -384,7 +482,7 @@ struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const s
 	}
 
  out:
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_RDUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 	return nsrv;
 }
 
@@ -400,7 +498,7 @@ struct server *chash_get_next_server(struct proxy *p, struct server *srvtoavoid)
 	srv = avoided = NULL;
 	avoided_node = NULL;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
 	if (p->srv_act)
 		root = &p->lbprm.chash.act;
 	else if (p->lbprm.fbck) {
@@ -459,7 +557,7 @@ struct server *chash_get_next_server(struct proxy *p, struct server *srvtoavoid)
 	}
 
  out:
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 	return srv;
 }
 
@@ -492,6 +590,8 @@ void chash_init_server_tree(struct proxy *p)
 	p->lbprm.chash.act = init_head;
 	p->lbprm.chash.bck = init_head;
 	p->lbprm.chash.last = NULL;
+	memset(&p->lbprm.chash.act_tbl, 0, sizeof(p->lbprm.chash.act_tbl));
+	memset(&p->lbprm.chash.bck_tbl, 0, sizeof(p->lbprm.chash.bck_tbl));
 
 	/* queue active and backup servers in two distinct groups */
 	for (srv = p->srv; srv; srv = srv->next) {
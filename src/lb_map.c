@@ -22,6 +22,26 @@
 #include <proto/lb_map.h>
 #include <proto/queue.h>
 
+/* Rebuilds the map of proxy <p> after a server's state changed, unless its
+ * updates are deferred, in which case the map will be rebuilt by
+ * lb_resume_updates().
+ *
+ * The lbprm's lock will be used.
+ */
+static void map_update_server_map(struct proxy *p)
+{
+	/* FIXME: could be optimized since we know what changed */
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	if (p->lbprm.defer_updates)
+		p->lbprm.pending_updates = 1;
+	else {
+		recount_servers(p);
+		update_backend_weight(p);
+		recalc_server_map(p);
+	}
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+}
+
 /* this function updates the map according to server <srv>'s new state.
  *
  * The server's lock must be held. The lbprm's lock will be used.
@@ -36,12 +56,7 @@ static void map_set_server_status_down(struct server *srv)
 	if (srv_willbe_usable(srv))
 		goto out_update_state;
 
-	/* FIXME: could be optimized since we know what changed */
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
-	recount_servers(p);
-	update_backend_weight(p);
-	recalc_server_map(p);
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	map_update_server_map(p);
  out_update_state:
 	srv_lb_commit_status(srv);
 }
@@ -60,12 +75,7 @@ static void map_set_server_status_up(struct server *srv)
 	if (!srv_willbe_usable(srv))
 		goto out_update_state;
 
-	/* FIXME: could be optimized since we know what changed */
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
-	recount_servers(p);
-	update_backend_weight(p);
-	recalc_server_map(p);
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	map_update_server_map(p);
  out_update_state:
 	srv_lb_commit_status(srv);
 }
@@ -221,7 +231,7 @@ struct server *map_get_server_rr(struct proxy *px, struct server *srvtoavoid)
 	int newidx, avoididx;
 	struct server *srv, *avoided;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &px->lbprm.lock);
+	HA_RWLOCK_WRLOCK(LBPRM_LOCK, &px->lbprm.lock);
 	if (px->lbprm.tot_weight == 0) {
 		avoided = NULL;
 		goto out;
@@ -253,7 +263,7 @@ struct server *map_get_server_rr(struct proxy *px, struct server *srvtoavoid)
 		px->lbprm.map.rr_idx = avoididx;
 
   out:
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &px->lbprm.lock);
+	HA_RWLOCK_WRUNLOCK(LBPRM_LOCK, &px->lbprm.lock);
 	/* return NULL or srvtoavoid if found */
 	return avoided;
 }
@@ -264,16 +274,16 @@ struct server *map_get_server_rr(struct proxy *px, struct server *srvtoavoid)
  * be recomputed if required before being looked up. If any server is found, it
  * will be returned.  If no valid server is found, NULL is returned.
  *
- * The lbprm's lock will be used.
+ * The lbprm's lock will be used for reading only.
  */
 struct server *map_get_server_hash(struct proxy *px, unsigned int hash)
 {
 	struct server *srv = NULL;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &px->lbprm.lock);
+	HA_RWLOCK_RDLOCK(LBPRM_LOCK, &px->lbprm.lock);
 	if (px->lbprm.tot_weight)
 		srv = px->lbprm.map.srv[hash % px->lbprm.tot_weight];
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &px->lbprm.lock);
+	HA_RWLOCK_RDUNLOCK(LBPRM_LOCK, &px->lbprm.lock);
 	return srv;
 }
 
@@ -41,6 +41,7 @@
 #include <proto/xprt_quic.h>
 #endif
 #include <proto/sample.h>
+#include <proto/stick_table.h>
 #include <proto/stream.h>
 #include <proto/task.h>
 
@@ -67,6 +68,32 @@ static struct task *manage_global_listener_queue(struct task *t, void *context,
 
 struct accept_queue_ring accept_queue_rings[MAX_THREADS] __attribute__((aligned(64))) = { };
 
+#if defined(USE_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+/* for each CPU, 1 + the thread to pass the connections whose packets were
+ * processed by this CPU to ("incoming-cpu"), or 0 if no thread is bound to it.
+ */
+static unsigned char accept_cpu_thread[LONGBITS];
+
+/* Returns the thread of <mask> bound to the CPU which processed the incoming
+ * packets of connection <fd>, or LONGBITS if there is none.
+ */
+static inline unsigned int accept_incoming_thread(int fd, unsigned long mask)
+{
+	socklen_t len = sizeof(int);
+	unsigned int thr;
+	int cpu;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1 ||
+	    cpu < 0 || cpu >= LONGBITS)
+		return LONGBITS;
+
+	thr = accept_cpu_thread[cpu];
+	if (!thr || !(mask & (1UL << (thr - 1))))
+		return LONGBITS;
+	return thr - 1;
+}
+#endif
+
 /* dequeue and process a pending connection from the local accept queue (single
  * consumer). Returns the accepted fd or -1 if none was found. The listener is
  * placed into *li. The address is copied into *addr for no more than *addr_len
@@ -191,11 +218,11 @@ static struct task *accept_queue_process(struct task *t, void *context, unsigned
 		 * may only be done once l->accept() has accepted the connection.
 		 */
 		if (!(li->options & LI_O_UNLIMITED)) {
-			HA_ATOMIC_UPDATE_MAX(&global.sps_max,
-			                     update_freq_ctr(&global.sess_per_sec, 1));
+			update_freq_ctr_thr(&global.sess_per_sec, 1);
+			HA_ATOMIC_UPDATE_MAX(&global.sps_max, freq_ctr_thr_curr(&global.sess_per_sec));
 			if (li->bind_conf && li->bind_conf->is_ssl) {
-				HA_ATOMIC_UPDATE_MAX(&global.ssl_max,
-				                     update_freq_ctr(&global.ssl_per_sec, 1));
+				update_freq_ctr_thr(&global.ssl_per_sec, 1);
+				HA_ATOMIC_UPDATE_MAX(&global.ssl_max, freq_ctr_thr_curr(&global.ssl_per_sec));
 			}
 		}
 	}
@@ -224,6 +251,25 @@ static int accept_queue_init()
 		t->context = &accept_queue_rings[i];
 		accept_queue_rings[i].tasklet = t;
 	}
+
+#if defined(USE_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+	/* each CPU goes to the thread bound to the fewest CPUs among it */
+	for (i = 0; i < global.nbthread && i < LONGBITS; i++) {
+		unsigned long cpus = global.cpu_map.thread[i];
+		int cpu;
+
+		if (global.cpu_map.proc[0])
+			cpus &= global.cpu_map.proc[0];
+
+		for (cpu = 0; cpus && cpu < LONGBITS; cpu++) {
+			if (!(cpus & (1UL << cpu)))
+				continue;
+			if (!accept_cpu_thread[cpu] ||
+			    my_popcountl(cpus) < my_popcountl(global.cpu_map.thread[accept_cpu_thread[cpu] - 1]))
+				accept_cpu_thread[cpu] = i + 1;
+		}
+	}
+#endif
 	return 0;
 }
 
@@ -231,6 +277,40 @@ REGISTER_CONFIG_POSTPARSER("multi-threaded accept queue", accept_queue_init);
 
 #endif // USE_THREAD
 
+/* Enables polling for reads on the socket of <l> listener, and on its
+ * per-thread sockets for QUIC listeners bound with one socket per thread.
+ */
+static void listener_want_recv(struct listener *l)
+{
+	fd_want_recv(l->fd);
+#ifdef USE_QUIC
+	if (l->quic_fds) {
+		int i;
+
+		for (i = 1; i < global.nbthread; i++)
+			if (l->quic_fds[i] >= 0)
+				fd_want_recv(l->quic_fds[i]);
+	}
+#endif
+}
+
+/* Disables polling for reads on the socket(s) of <l> listener. See
+ * listener_want_recv().
+ */
+static void listener_stop_recv(struct listener *l)
+{
+	fd_stop_recv(l->fd);
+#ifdef USE_QUIC
+	if (l->quic_fds) {
+		int i;
+
+		for (i = 1; i < global.nbthread; i++)
+			if (l->quic_fds[i] >= 0)
+				fd_stop_recv(l->quic_fds[i]);
+	}
+#endif
+}
+
 /* This function adds the specified listener's file descriptor to the polling
  * lists if it is in the LI_LISTEN state. The listener enters LI_READY or
  * LI_FULL state depending on its number of connections. In daemon mode, we
@@ -254,7 +334,7 @@ static void enable_listener(struct listener *listener)
 			}
 		}
 		else if (!listener->maxconn || listener->nbconn < listener->maxconn) {
-			fd_want_recv(listener->fd);
+			listener_want_recv(listener);
 			listener->state = LI_READY;
 		}
 		else {
@@ -280,7 +360,7 @@ static void disable_listener(struct listener *listener)
 	if (listener->state < LI_READY)
 		goto end;
 	if (listener->state == LI_READY)
-		fd_stop_recv(listener->fd);
+		listener_stop_recv(listener);
 	MT_LIST_DEL(&listener->wait_queue);
 	listener->state = LI_LISTEN;
   end:
@@ -319,7 +399,7 @@ int pause_listener(struct listener *l)
 
 	MT_LIST_DEL(&l->wait_queue);
 
-	fd_stop_recv(l->fd);
+	listener_stop_recv(l);
 	l->state = LI_PAUSED;
   end:
 	HA_SPIN_UNLOCK(LISTENER_LOCK, &l->lock);
@@ -399,7 +479,7 @@ int resume_listener(struct listener *l)
 		goto end;
 	}
 
-	fd_want_recv(l->fd);
+	listener_want_recv(l);
 	l->state = LI_READY;
   end:
 	HA_SPIN_UNLOCK(LISTENER_LOCK, &l->lock);
@@ -415,7 +495,7 @@ static void listener_full(struct listener *l)
 	if (l->state >= LI_READY) {
 		MT_LIST_DEL(&l->wait_queue);
 		if (l->state != LI_FULL) {
-			fd_stop_recv(l->fd);
+			listener_stop_recv(l);
 			l->state = LI_FULL;
 		}
 	}
@@ -430,7 +510,7 @@ static void limit_listener(struct listener *l, struct mt_list *list)
 	HA_SPIN_LOCK(LISTENER_LOCK, &l->lock);
 	if (l->state == LI_READY) {
 		MT_LIST_ADDQ(list, &l->wait_queue);
-		fd_stop_recv(l->fd);
+		listener_stop_recv(l);
 		l->state = LI_LIMITED;
 	}
 	HA_SPIN_UNLOCK(LISTENER_LOCK, &l->lock);
@@ -503,11 +583,27 @@ void dequeue_proxy_listeners(struct proxy *px)
 void do_unbind_listener(struct listener *listener, int do_close)
 {
 	if (listener->state == LI_READY && fd_updt)
-		fd_stop_recv(listener->fd);
+		listener_stop_recv(listener);
 
 	MT_LIST_DEL(&listener->wait_queue);
 
 	if (listener->state >= LI_PAUSED) {
+#ifdef USE_QUIC
+		if (listener->quic_fds) {
+			int i;
+
+			for (i = 1; i < global.nbthread; i++) {
+				if (listener->quic_fds[i] < 0)
+					continue;
+				if (do_close) {
+					fd_delete(listener->quic_fds[i]);
+					listener->quic_fds[i] = -1;
+				}
+				else
+					fd_remove(listener->quic_fds[i]);
+			}
+		}
+#endif
 		if (do_close) {
 			fd_delete(listener->fd);
 			listener->fd = -1;
@@ -601,8 +697,14 @@ int create_listeners(struct bind_conf *bc, const struct sockaddr_storage *ss,
 		MT_LIST_INIT(&l->wait_queue);
 		l->state = LI_INIT;
 #ifdef USE_QUIC
-		l->icids = EB_ROOT_UNIQUE;
-		l->cids = EB_ROOT_UNIQUE;
+		if (bc->is_quic) {
+			l->icids = quic_cid_trees_new();
+			l->cids = quic_cid_trees_new();
+			if (!l->icids || !l->cids) {
+				memprintf(err, "out of memory");
+				return 0;
+			}
+		}
 #endif
 
 		proto->add(l, port);
@@ -680,6 +782,9 @@ void listener_accept(int fd)
 #ifdef USE_ACCEPT4
 	static int accept4_broken;
 #endif
+#if defined(USE_THREAD)
+	unsigned long wake_mask = 0;
+#endif
 
 	if (!l)
 		return;
@@ -691,11 +796,11 @@ void listener_accept(int fd)
 	max_accept = l->maxaccept ? l->maxaccept : 1;
 
 	if (!(l->options & LI_O_UNLIMITED) && global.sps_lim) {
-		int max = freq_ctr_remain(&global.sess_per_sec, global.sps_lim, 0);
+		int max = freq_ctr_thr_remain(&global.sess_per_sec, global.sps_lim, 0);
 
 		if (unlikely(!max)) {
 			/* frontend accept rate limit was reached */
-			expire = tick_add(now_ms, next_event_delay(&global.sess_per_sec, global.sps_lim, 0));
+			expire = tick_add(now_ms, next_event_delay_thr(&global.sess_per_sec, global.sps_lim, 0));
 			goto limit_global;
 		}
 
@@ -704,11 +809,11 @@ void listener_accept(int fd)
 	}
 
 	if (!(l->options & LI_O_UNLIMITED) && global.cps_lim) {
-		int max = freq_ctr_remain(&global.conn_per_sec, global.cps_lim, 0);
+		int max = freq_ctr_thr_remain(&global.conn_per_sec, global.cps_lim, 0);
 
 		if (unlikely(!max)) {
 			/* frontend accept rate limit was reached */
-			expire = tick_add(now_ms, next_event_delay(&global.conn_per_sec, global.cps_lim, 0));
+			expire = tick_add(now_ms, next_event_delay_thr(&global.conn_per_sec, global.cps_lim, 0));
 			goto limit_global;
 		}
 
@@ -717,11 +822,11 @@ void listener_accept(int fd)
 	}
 #ifdef USE_OPENSSL
 	if (!(l->options & LI_O_UNLIMITED) && global.ssl_lim && l->bind_conf && l->bind_conf->is_ssl) {
-		int max = freq_ctr_remain(&global.ssl_per_sec, global.ssl_lim, 0);
+		int max = freq_ctr_thr_remain(&global.ssl_per_sec, global.ssl_lim, 0);
 
 		if (unlikely(!max)) {
 			/* frontend accept rate limit was reached */
-			expire = tick_add(now_ms, next_event_delay(&global.ssl_per_sec, global.ssl_lim, 0));
+			expire = tick_add(now_ms, next_event_delay_thr(&global.ssl_per_sec, global.ssl_lim, 0));
 			goto limit_global;
 		}
 
@@ -730,11 +835,11 @@ void listener_accept(int fd)
 	}
 #endif
 	if (p && p->fe_sps_lim) {
-		int max = freq_ctr_remain(&p->fe_sess_per_sec, p->fe_sps_lim, 0);
+		int max = freq_ctr_thr_remain(&p->fe_sess_per_sec, p->fe_sps_lim, 0);
 
 		if (unlikely(!max)) {
 			/* frontend accept rate limit was reached */
-			expire = tick_add(now_ms, next_event_delay(&p->fe_sess_per_sec, p->fe_sps_lim, 0));
+			expire = tick_add(now_ms, next_event_delay_thr(&p->fe_sess_per_sec, p->fe_sps_lim, 0));
 			goto limit_proxy;
 		}
 
@@ -875,6 +980,22 @@ void listener_accept(int fd)
 		if (unlikely(master == 1))
 			fcntl(cfd, F_SETFD, FD_CLOEXEC);
 
+		/* sources recently reported as abusive by the frontend's table
+		 * are closed before anything gets allocated for them.
+		 */
+		if (p && unlikely(p->early_reject.table) &&
+		    stktable_reject_addr(p->early_reject.table, &addr)) {
+			close(cfd);
+			_HA_ATOMIC_ADD(&p->fe_counters.denied_conn, 1);
+			if (l->counters)
+				_HA_ATOMIC_ADD(&l->counters->denied_conn, 1);
+			_HA_ATOMIC_SUB(&l->nbconn, 1);
+			_HA_ATOMIC_SUB(&p->feconn, 1);
+			if (!(l->options & LI_O_UNLIMITED))
+				_HA_ATOMIC_SUB(&actconn, 1);
+			continue;
+		}
+
 		/* The connection was accepted, it must be counted as such */
 		if (l->counters)
 			HA_ATOMIC_UPDATE_MAX(&l->counters->conn_max, next_conn);
@@ -885,7 +1006,8 @@ void listener_accept(int fd)
 		proxy_inc_fe_conn_ctr(l, p);
 
 		if (!(l->options & LI_O_UNLIMITED)) {
-			count = update_freq_ctr(&global.conn_per_sec, 1);
+			update_freq_ctr_thr(&global.conn_per_sec, 1);
+			count = freq_ctr_thr_curr(&global.conn_per_sec);
 			HA_ATOMIC_UPDATE_MAX(&global.cps_max, count);
 		}
 
@@ -924,6 +1046,16 @@ void listener_accept(int fd)
 			 * count), without ever missing any idle thread.
 			 */
 
+#if defined(USE_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+			/* stay on the CPU which processed the packets if a
+			 * thread of this listener is bound to it.
+			 */
+			if (l->options & LI_O_INC_CPU) {
+				t = accept_incoming_thread(cfd, mask);
+				if (t < LONGBITS)
+					goto push;
+			}
+#endif
 			/* keep a copy for the final update. thr_idx is composite
 			 * and made of (t2<<16) + t1.
 			 */
@@ -1008,12 +1140,14 @@ void listener_accept(int fd)
 			 * connection. We use deferred accepts even if it's the
 			 * local thread because tests show that it's the best
 			 * performing model, likely due to better cache locality
-			 * when processing this loop.
+			 * when processing this loop. The target threads are only
+			 * woken up once the whole batch was accepted.
 			 */
+		push:
 			ring = &accept_queue_rings[t];
 			if (accept_queue_push_mp(ring, cfd, l, &addr, laddr)) {
 				_HA_ATOMIC_ADD(&activity[t].accq_pushed, 1);
-				tasklet_wakeup(ring->tasklet);
+				wake_mask |= 1UL << t;
 				continue;
 			}
 			/* If the ring is full we do a synchronous accept on
@@ -1041,12 +1175,14 @@ void listener_accept(int fd)
 		 * may only be done once l->accept() has accepted the connection.
 		 */
 		if (!(l->options & LI_O_UNLIMITED)) {
-			count = update_freq_ctr(&global.sess_per_sec, 1);
+			update_freq_ctr_thr(&global.sess_per_sec, 1);
+			count = freq_ctr_thr_curr(&global.sess_per_sec);
 			HA_ATOMIC_UPDATE_MAX(&global.sps_max, count);
 		}
 #ifdef USE_OPENSSL
 		if (!(l->options & LI_O_UNLIMITED) && l->bind_conf && l->bind_conf->is_ssl) {
-			count = update_freq_ctr(&global.ssl_per_sec, 1);
+			update_freq_ctr_thr(&global.ssl_per_sec, 1);
+			count = freq_ctr_thr_curr(&global.ssl_per_sec);
 			HA_ATOMIC_UPDATE_MAX(&global.ssl_max, count);
 		}
 #endif
@@ -1055,6 +1191,15 @@ void listener_accept(int fd)
 	} /* end of for (max_accept--) */
 
  end:
+#if defined(USE_THREAD)
+	/* wake each thread which received connections up only once */
+	while (wake_mask) {
+		unsigned int t = my_ffsl(wake_mask) - 1;
+
+		wake_mask &= wake_mask - 1;
+		tasklet_wakeup(accept_queue_rings[t].tasklet);
+	}
+#endif
 	if (next_conn)
 		_HA_ATOMIC_SUB(&l->nbconn, 1);
 
@@ -1076,7 +1221,7 @@ void listener_accept(int fd)
 		dequeue_all_listeners();
 
 		if (p && !MT_LIST_ISEMPTY(&p->listener_queue) &&
-		    (!p->fe_sps_lim || freq_ctr_remain(&p->fe_sess_per_sec, p->fe_sps_lim, 0) > 0))
+		    (!p->fe_sps_lim || freq_ctr_thr_remain(&p->fe_sess_per_sec, p->fe_sps_lim, 0) > 0))
 			dequeue_proxy_listeners(p);
 	}
 
@@ -1144,7 +1289,7 @@ void listener_release(struct listener *l)
 	dequeue_all_listeners();
 
 	if (!MT_LIST_ISEMPTY(&fe->listener_queue) &&
-	    (!fe->fe_sps_lim || freq_ctr_remain(&fe->fe_sess_per_sec, fe->fe_sps_lim, 0) > 0))
+	    (!fe->fe_sps_lim || freq_ctr_thr_remain(&fe->fe_sess_per_sec, fe->fe_sps_lim, 0) > 0))
 		dequeue_proxy_listeners(fe);
 }
 
@@ -1486,6 +1631,22 @@ static int bind_parse_nice(char **args, int cur_arg, struct proxy *px, struct bi
 	return 0;
 }
 
+/* parse the "incoming-cpu" bind keyword */
+static int bind_parse_incoming_cpu(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+#if defined(USE_THREAD) && defined(USE_CPU_AFFINITY) && defined(SO_INCOMING_CPU)
+	struct listener *l;
+
+	list_for_each_entry(l, &conf->listeners, by_bind)
+		l->options |= LI_O_INC_CPU;
+
+	return 0;
+#else
+	memprintf(err, "'%s' : not supported on this platform or build", args[cur_arg]);
+	return ERR_ALERT | ERR_FATAL;
+#endif
+}
+
 /* parse the "process" bind keyword */
 static int bind_parse_process(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
 {
@@ -1584,6 +1745,7 @@ static struct bind_kw_list bind_kws = { "ALL", { }, {
 	{ "accept-proxy", bind_parse_accept_proxy, 0 }, /* enable PROXY protocol */
 	{ "backlog",      bind_parse_backlog,      1 }, /* set backlog of listening socket */
 	{ "id",           bind_parse_id,           1 }, /* set id of listening socket */
+	{ "incoming-cpu", bind_parse_incoming_cpu, 0 }, /* pass connections to the thread running on the CPU which received them */
 	{ "maxconn",      bind_parse_maxconn,      1 }, /* set maxconn of listening socket */
 	{ "name",         bind_parse_name,         1 }, /* set name of listening socket */
 	{ "nice",         bind_parse_nice,         1 }, /* set nice of listening socket */
@@ -10,6 +10,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdarg.h>
@@ -21,12 +22,17 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 
+#include <common/cbor.h>
+#include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/compat.h>
+#include <common/hash.h>
 #include <common/initcall.h>
+#include <common/net_helper.h>
 #include <common/standard.h>
 #include <common/time.h>
 #include <common/version.h>
@@ -84,6 +90,13 @@ static const struct log_fmt log_formats[LOG_FORMATS] = {
 			.sep2 = { .area = "", .data = 0 },
 		}
 	},
+	[LOG_FORMAT_CBOR] = {
+		.name = "cbor",
+		.pid = {
+			.sep1 = { .area = "", .data = 0 },
+			.sep2 = { .area = "", .data = 0 },
+		}
+	},
 };
 
 char *get_format_pid_sep1(int format, size_t *len)
@@ -237,6 +250,33 @@ char default_rfc5424_sd_log_format[] = "- ";
 /* total number of dropped logs */
 unsigned int dropped_logs = 0;
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define LOG_USE_SENDMMSG
+#endif
+
+/* Syslog messages sent over the UDP and UNIX datagram sockets may be
+ * accumulated per thread and per socket, then all sent at once, either when
+ * "tune.log.batch-size" of them are queued, or by the log_batch_tasklet on
+ * the way back to the polling loop. <area> is large enough to store that many
+ * messages of the max syslog length.
+ */
+struct log_batch {
+	int fd;                                 /* socket the messages are sent over */
+	int count;                              /* number of messages queued */
+	size_t used;                            /* number of bytes of <area> used */
+	size_t size;                            /* size of <area> */
+	char *area;                             /* contents of the messages queued */
+	struct iovec *iov;                      /* message <i> is <iov[i]> ... */
+	const struct sockaddr_storage **addr;   /* ... to be sent to <addr[i]> */
+#ifdef LOG_USE_SENDMMSG
+	struct mmsghdr *msgs;
+#endif
+};
+
+static unsigned int log_batch_size = 0;
+static THREAD_LOCAL struct log_batch log_batches[2]; /* UNIX, INET */
+static THREAD_LOCAL struct tasklet *log_batch_tasklet;
+
 /* This is a global syslog header, common to all outgoing messages in
  * RFC3164 format. It begins with time-based part and is updated by
  * update_log_hdr().
@@ -260,6 +300,25 @@ THREAD_LOCAL char *logline = NULL;
  */
 THREAD_LOCAL char *logline_rfc5424 = NULL;
 
+/* A buffer used to encode the CBOR records of the messages sent in "cbor"
+ * format.
+ */
+static THREAD_LOCAL char *logline_cbor = NULL;
+
+/* The keyed fields ("%{key=<name>}") of the log line being built by strm_log()
+ * or sess_log(), described by their offset and length in this line, so that
+ * they may be reported as separate fields in structured formats. Only filled
+ * when <log_nb_fields> is not negative.
+ */
+struct lf_field {
+	const char *key;
+	int ofs;
+	int len;
+};
+
+static THREAD_LOCAL struct lf_field log_fields[LOG_MAX_FIELDS];
+static THREAD_LOCAL int log_nb_fields = -1;
+
 /* A global buffer used to store all startup alerts/warnings. It will then be
  * retrieve on the CLI. */
 static struct ring *startup_logs = NULL;
@@ -338,6 +397,7 @@ int parse_logformat_var_args(char *args, struct logformat_node *node, char **err
 	int end = 0;
 	int flags = 0;  // 1 = +  2 = -
 	char *sp = NULL; // start pointer
+	char *tok = args; // token start
 
 	if (args == NULL) {
 		memprintf(err, "internal error: parse_logformat_var_args() expects non null 'args'");
@@ -361,6 +421,14 @@ int parse_logformat_var_args(char *args, struct logformat_node *node, char **err
 
 		if (*args == '\0' || *args == ',') {
 			*args = '\0';
+			if (strncmp(tok, "key=", 4) == 0) {
+				if (!tok[4]) {
+					memprintf(err, "'key=' expects a field name");
+					return 0;
+				}
+				node->key = tok + 4;
+			}
+			tok = args + 1;
 			for (i = 0; sp && var_args_list[i].name; i++) {
 				if (strcmp(sp, var_args_list[i].name) == 0) {
 					if (flags == 1) {
@@ -472,6 +540,7 @@ int add_to_logformat_list(char *start, char *end, int type, struct list *list_fo
 		strncpy(str, start, end - start);
 		str[end - start] = '\0';
 		node->arg = str;
+		node->len = end - start;
 		node->type = LOG_FMT_TEXT; // type string
 		LIST_ADDQ(list_format, &node->list);
 	} else if (type == LF_SEPARATOR) {
@@ -561,6 +630,69 @@ int add_sample_to_logformat_list(char *text, char *arg, int arg_len, struct prox
 	return 0;
 }
 
+/* Reduces the number of nodes of <list_format> which is interpreted for each
+ * log line. Since all nodes but separators reset the separator's state when
+ * they emit something, and since text nodes always do, the separators which
+ * follow a text node or another separator can be resolved once for all: the
+ * former emit one space and the latter nothing. The consecutive text nodes are
+ * then merged into a single one, copied at once using its known length. A text
+ * node ending with a resolved separator is flagged for the next separators to
+ * stay silent. Returns 0 on memory allocation failure, otherwise non-zero.
+ */
+static int lf_merge_text(struct list *list_format)
+{
+	struct logformat_node *node, *back, *prev = NULL;
+	int sep_state = 1; /* 1 if the last output is a space, 0 if not, -1 if unknown */
+	char *str;
+
+	list_for_each_entry_safe(node, back, list_format, list) {
+		if (node->type == LOG_FMT_SEPARATOR && sep_state == 1) {
+			/* no space is emitted after a space */
+			LIST_DEL(&node->list);
+			free(node);
+			continue;
+		}
+
+		if (node->type == LOG_FMT_SEPARATOR && sep_state == 0) {
+			/* one space is emitted after a text */
+			free(node->arg);
+			node->arg = strdup(" ");
+			if (!node->arg)
+				return 0;
+			node->len = 1;
+			node->type = LOG_FMT_TEXT;
+			node->options |= LOG_OPT_SEP_END;
+		}
+		else if (node->type == LOG_FMT_TEXT)
+			node->options &= ~LOG_OPT_SEP_END;
+
+		if (node->type != LOG_FMT_TEXT) {
+			sep_state = (node->type == LOG_FMT_SEPARATOR) ? 1 : -1;
+			prev = NULL;
+			continue;
+		}
+
+		sep_state = (node->options & LOG_OPT_SEP_END) ? 1 : 0;
+		if (!prev) {
+			prev = node;
+			continue;
+		}
+
+		/* append this text to the previous one */
+		str = realloc(prev->arg, prev->len + node->len + 1);
+		if (!str)
+			return 0;
+		memcpy(str + prev->len, node->arg, node->len + 1);
+		prev->arg = str;
+		prev->len += node->len;
+		prev->options = (prev->options & ~LOG_OPT_SEP_END) | (node->options & LOG_OPT_SEP_END);
+		LIST_DEL(&node->list);
+		free(node->arg);
+		free(node);
+	}
+	return 1;
+}
+
 /*
  * Parse the log_format string and fill a linked list.
  * Variable name are preceded by % and composed by characters [a-zA-Z0-9]* : %varname
@@ -733,6 +865,11 @@ int parse_logformat_string(const char *fmt, struct proxy *curproxy, struct list
 		memprintf(err, "truncated line after '%s'", var ? var : arg ? arg : "%");
 		goto fail;
 	}
+
+	if (!lf_merge_text(list_format)) {
+		memprintf(err, "out of memory error");
+		goto fail;
+	}
 	free(backfmt);
 
 	return 1;
@@ -1546,6 +1683,209 @@ void send_log(struct proxy *p, int level, const char *format, ...)
  * It overrides the last byte of the message vector with an LF character.
  * Does not return any error,
  */
+/* Sends all the messages queued in <b>, accounting the ones which could not be
+ * sent because the socket buffers are full as dropped.
+ */
+static void log_batch_flush(struct log_batch *b)
+{
+	int i, ret;
+#ifdef LOG_USE_SENDMMSG
+	for (i = 0; i < b->count; i++) {
+		memset(&b->msgs[i].msg_hdr, 0, sizeof(b->msgs[i].msg_hdr));
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+		b->msgs[i].msg_hdr.msg_name = (struct sockaddr *)b->addr[i];
+		b->msgs[i].msg_hdr.msg_namelen = get_addr_len(b->addr[i]);
+	}
+#else
+	struct msghdr msghdr = { };
+#endif
+
+	for (i = 0; i < b->count; i += ret) {
+#ifdef LOG_USE_SENDMMSG
+		ret = sendmmsg(b->fd, &b->msgs[i], b->count - i, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+		msghdr.msg_iov = &b->iov[i];
+		msghdr.msg_iovlen = 1;
+		msghdr.msg_name = (struct sockaddr *)b->addr[i];
+		msghdr.msg_namelen = get_addr_len(b->addr[i]);
+		ret = (sendmsg(b->fd, &msghdr, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) ? -1 : 1;
+#endif
+		if (ret <= 0) {
+			static char once;
+
+			if (errno == EAGAIN) {
+				/* the next ones will not pass either */
+				_HA_ATOMIC_ADD(&dropped_logs, b->count - i);
+				break;
+			}
+			if (!once) {
+				once = 1; /* note: no need for atomic ops here */
+				ha_alert("sendmsg() failed in logger batch: %s (errno=%d)\n",
+					 strerror(errno), errno);
+			}
+			/* skip this message which cannot be sent */
+			_HA_ATOMIC_ADD(&dropped_logs, 1);
+			ret = 1;
+		}
+	}
+	b->count = 0;
+	b->used = 0;
+}
+
+/* Sends the messages queued by the current thread. */
+static struct task *log_batch_process(struct task *t, void *context, unsigned short state)
+{
+	int i;
+
+	for (i = 0; i < sizeof(log_batches) / sizeof(log_batches[0]); i++) {
+		if (log_batches[i].count)
+			log_batch_flush(&log_batches[i]);
+	}
+	return NULL;
+}
+
+/* Queues into <b> the message made of the <iovcnt> parts in <iov> to be sent
+ * over <fd> to <addr>. Returns 0 if it could not be queued, in which case it
+ * must be sent immediately, otherwise non-zero.
+ */
+static int log_batch_add(struct log_batch *b, int fd, const struct sockaddr_storage *addr,
+                         const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	char *p;
+	int i;
+
+	if (!b->area)
+		return 0;
+
+	if (unlikely(!log_batch_tasklet)) {
+		log_batch_tasklet = tasklet_new();
+		if (!log_batch_tasklet)
+			return 0;
+		log_batch_tasklet->process = log_batch_process;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (b->count && (b->fd != fd || b->used + len > b->size))
+		log_batch_flush(b);
+
+	if (len > b->size)
+		return 0;
+
+	b->fd = fd;
+	p = b->area + b->used;
+	b->iov[b->count].iov_base = p;
+	b->iov[b->count].iov_len = len;
+	b->addr[b->count] = addr;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	b->used += len;
+
+	if (++b->count >= log_batch_size)
+		log_batch_flush(b);
+	else if (b->count == 1)
+		tasklet_wakeup(log_batch_tasklet);
+	return 1;
+}
+
+/* Encodes into <dst> as a CBOR map (RFC7049) the message <msg> of <size> bytes
+ * with its priority <pri>, and its <tag>, <pid> and <sd> parts which are
+ * skipped when empty. The message is reported as its keyed fields if it was
+ * built with any (only for the line of strm_log() and sess_log()), otherwise
+ * as a single "message" text. The record does not
+ * exceed <maxlen> bytes, the last value being truncated if needed. It starts
+ * at <*rec>, which is within the first two bytes of <dst>. Returns its length,
+ * or zero if even the first fields do not fit.
+ */
+size_t log_build_cbor(char *dst, size_t maxlen, char **rec, int pri,
+                      const char *tag, size_t tag_size, const char *pid, size_t pid_size,
+                      const char *sd, size_t sd_size, const char *msg, size_t size)
+{
+	const char *end = dst + maxlen;
+	char *pos = dst + 2; /* room for the map head */
+	char *next;
+	int nb = 0;
+	int i;
+
+	next = cbor_put_uint(cbor_put_text(pos, end, "time", 4, 0), end,
+	                     (uint64_t)date.tv_sec * 1000 + date.tv_usec / 1000);
+	if (!next)
+		return 0;
+	pos = next; nb++;
+
+	next = cbor_put_uint(cbor_put_text(pos, end, "priority", 8, 0), end, pri);
+	if (!next)
+		return 0;
+	pos = next; nb++;
+
+	if (global.log_send_hostname) {
+		next = cbor_put_text(cbor_put_text(pos, end, "hostname", 8, 0), end,
+		                     global.log_send_hostname, strlen(global.log_send_hostname), 0);
+		if (next) {
+			pos = next; nb++;
+		}
+	}
+
+	if (tag_size) {
+		next = cbor_put_text(cbor_put_text(pos, end, "tag", 3, 0), end, tag, tag_size, 0);
+		if (next) {
+			pos = next; nb++;
+		}
+	}
+
+	if (pid_size) {
+		next = cbor_put_text(cbor_put_text(pos, end, "pid", 3, 0), end, pid, pid_size, 0);
+		if (next) {
+			pos = next; nb++;
+		}
+	}
+
+	if (sd_size) {
+		next = cbor_put_text(cbor_put_text(pos, end, "sd", 2, 0), end, sd, sd_size, 0);
+		if (next) {
+			pos = next; nb++;
+		}
+	}
+
+	/* the keyed fields only describe the main log line */
+	if (log_nb_fields > 0 && msg == logline) {
+		for (i = 0; i < log_nb_fields; i++) {
+			const struct lf_field *f = &log_fields[i];
+
+			if (f->ofs + f->len > size)
+				break;
+			next = cbor_put_text(cbor_put_text(pos, end, f->key, strlen(f->key), 0), end,
+			                     msg + f->ofs, f->len, 1);
+			if (!next)
+				break;
+			pos = next; nb++;
+		}
+	}
+	else {
+		next = cbor_put_text(cbor_put_text(pos, end, "message", 7, 0), end, msg, size, 1);
+		if (next) {
+			pos = next; nb++;
+		}
+	}
+
+	/* <nb> is always lower than 256 */
+	if (nb < 24) {
+		dst[1] = CBOR_MT_MAP | nb;
+		*rec = dst + 1;
+	}
+	else {
+		dst[0] = CBOR_MT_MAP | 24;
+		dst[1] = nb;
+		*rec = dst;
+	}
+	return pos - *rec;
+}
+
 static inline void __do_send_log(struct logsrv *logsrv, int nblogger, char *pid_str, size_t pid_size,
                                  int level, char *message, size_t size, char *sd, size_t sd_size,
                                  char *tag_str, size_t tag_size)
@@ -1565,6 +1905,7 @@ static inline void __do_send_log(struct logsrv *logsrv, int nblogger, char *pid_
 	int *plogfd;
 	char *pid_sep1 = "", *pid_sep2 = "";
 	char logheader_short[3];
+	char cbor_len[4];
 	int sent;
 	int maxlen;
 	int hdr_max = 0;
@@ -1585,6 +1926,16 @@ static inline void __do_send_log(struct logsrv *logsrv, int nblogger, char *pid_
 	while (size && ((dataptr[size-1] == '\n' || (dataptr[size-1] == 0))))
 		size--;
 
+	if (logsrv->format == LOG_FORMAT_CBOR && logsrv->type != LOG_TARGET_BUFFER) {
+		/* the whole record is sent as the header, with no other part */
+		hdr_max = log_build_cbor(logline_cbor, logsrv->maxlen, &hdr_ptr,
+		                         (logsrv->facility << 3) + MAX(level, logsrv->minlvl),
+		                         tag_str, tag_size, pid_str, pid_size, sd, sd_size,
+		                         dataptr, size);
+		if (!hdr_max)
+			return;
+	}
+
 	if (logsrv->type == LOG_TARGET_FD) {
 		/* the socket's address is a file descriptor */
 		plogfd = (int *)&((struct sockaddr_in *)&logsrv->addr)->sin_addr.s_addr;
@@ -1651,6 +2002,10 @@ static inline void __do_send_log(struct logsrv *logsrv, int nblogger, char *pid_
 		max = MIN(size, maxlen - 1);
 		goto send;
 
+	case LOG_FORMAT_CBOR:
+		/* the record was already built */
+		goto send;
+
 	default:
 		return; /* must never happen */
 	}
@@ -1745,6 +2100,13 @@ send:
 			msg[3] = ist2(sd, sd_size);
 			sent = sink_write(logsrv->sink, msg, 1, level, logsrv->facility, &msg[1], &msg[2], &msg[3]);
 		}
+		else if (logsrv->format == LOG_FORMAT_CBOR) {
+			/* records are prefixed with their length in network order */
+			write_n32(cbor_len, hdr_max);
+			msg[0] = ist2(cbor_len, 4);
+			msg[1] = ist2(hdr_ptr, hdr_max);
+			sent = fd_write_frag_line(*plogfd, ~0, NULL, 0, msg, 2, 0);
+		}
 		else /* LOG_TARGET_FD */ {
 			msg[0] = ist2(hdr_ptr, hdr_max);
 			msg[1] = ist2(tag_str, tag_max);
@@ -1772,7 +2134,12 @@ send:
 		iovec[6].iov_base = dataptr;
 		iovec[6].iov_len  = max;
 		iovec[7].iov_base = "\n"; /* insert a \n at the end of the message */
-		iovec[7].iov_len  = 1;
+		iovec[7].iov_len  = logsrv->format != LOG_FORMAT_CBOR;
+
+		if (log_batch_size > 1 &&
+		    log_batch_add(&log_batches[plogfd == &logfdinet], *plogfd, &logsrv->addr,
+		                  iovec, NB_MSG_IOVEC_ELEMENTS))
+			return;
 
 		msghdr.msg_name = (struct sockaddr *)&logsrv->addr;
 		msghdr.msg_namelen = get_addr_len(&logsrv->addr);
@@ -1960,23 +2327,70 @@ int init_log_buffers()
 	logheader_rfc5424_end = NULL;
 	logline = my_realloc2(logline, global.max_syslog_len + 1);
 	logline_rfc5424 = my_realloc2(logline_rfc5424, global.max_syslog_len + 1);
-	if (!logheader || !logline_rfc5424 || !logline || !logline_rfc5424)
+	logline_cbor = my_realloc2(logline_cbor, global.max_syslog_len + 1);
+	if (!logheader || !logline_rfc5424 || !logline || !logline_rfc5424 || !logline_cbor)
 		return 0;
+
+	if (log_batch_size > 1) {
+		struct log_batch *b;
+		int i;
+
+		for (i = 0; i < sizeof(log_batches) / sizeof(log_batches[0]); i++) {
+			b = &log_batches[i];
+			/* one more byte per message for the trailing LF */
+			b->size = (size_t)log_batch_size * (global.max_syslog_len + 1);
+			b->area = my_realloc2(b->area, b->size);
+			b->iov = my_realloc2(b->iov, log_batch_size * sizeof(*b->iov));
+			b->addr = my_realloc2(b->addr, log_batch_size * sizeof(*b->addr));
+			if (!b->area || !b->iov || !b->addr)
+				return 0;
+#ifdef LOG_USE_SENDMMSG
+			b->msgs = my_realloc2(b->msgs, log_batch_size * sizeof(*b->msgs));
+			if (!b->msgs)
+				return 0;
+#endif
+		}
+	}
 	return 1;
 }
 
 /* Deinitialize log buffers used for syslog messages */
 void deinit_log_buffers()
 {
+	struct log_batch *b;
+	int i;
+
+	for (i = 0; i < sizeof(log_batches) / sizeof(log_batches[0]); i++) {
+		b = &log_batches[i];
+		if (b->count)
+			log_batch_flush(b);
+		free(b->area);
+		free(b->iov);
+		free(b->addr);
+#ifdef LOG_USE_SENDMMSG
+		free(b->msgs);
+		b->msgs = NULL;
+#endif
+		b->area = NULL;
+		b->iov  = NULL;
+		b->addr = NULL;
+	}
+	if (log_batch_tasklet) {
+		tasklet_free(log_batch_tasklet);
+		log_batch_tasklet = NULL;
+	}
+
 	free(logheader);
 	free(logheader_rfc5424);
 	free(logline);
 	free(logline_rfc5424);
+	free(logline_cbor);
 	ring_free(_HA_ATOMIC_XCHG(&startup_logs, NULL));
 	logheader         = NULL;
 	logheader_rfc5424 = NULL;
 	logline           = NULL;
 	logline_rfc5424   = NULL;
+	logline_cbor      = NULL;
 }
 
 /* Builds a log line in <dst> based on <list_format>, and stops before reaching
@@ -2067,6 +2481,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 		const char *src = NULL;
 		struct sample *key;
 		const struct buffer empty = { };
+		char *field = tmplog;
 
 		switch (tmp->type) {
 			case LOG_FMT_SEPARATOR:
@@ -2077,12 +2492,14 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 				break;
 
 			case LOG_FMT_TEXT: // text
-				src = tmp->arg;
-				iret = strlcpy2(tmplog, src, dst + maxsize - tmplog);
-				if (iret == 0)
+				iret = dst + maxsize - tmplog - 1;
+				if (iret <= 0)
 					goto out;
+				if (iret > tmp->len)
+					iret = tmp->len;
+				memcpy(tmplog, tmp->arg, iret);
 				tmplog += iret;
-				last_isspace = 0;
+				last_isspace = !!(tmp->options & LOG_OPT_SEP_END);
 				break;
 
 			case LOG_FMT_EXPR: // sample expression, may be request or response
@@ -2615,14 +3032,14 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_HDRREQUEST: // %hr
 				/* request header */
-				if (fe->nb_req_cap && s && s->req_cap) {
+				if (fe->nb_req_cap && s) {
 					if (tmp->options & LOG_OPT_QUOTE)
 						LOGCHAR('"');
 					LOGCHAR('{');
 					for (hdr = 0; hdr < fe->nb_req_cap; hdr++) {
 						if (hdr)
 							LOGCHAR('|');
-						if (s->req_cap[hdr] != NULL) {
+						if (s->req_cap && s->req_cap[hdr] != NULL) {
 							ret = lf_encode_string(tmplog, dst + maxsize,
 							                       '#', hdr_encode_map, s->req_cap[hdr], tmp);
 							if (ret == NULL || *ret != '\0')
@@ -2639,13 +3056,13 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_HDRREQUESTLIST: // %hrl
 				/* request header list */
-				if (fe->nb_req_cap && s && s->req_cap) {
+				if (fe->nb_req_cap && s) {
 					for (hdr = 0; hdr < fe->nb_req_cap; hdr++) {
 						if (hdr > 0)
 							LOGCHAR(' ');
 						if (tmp->options & LOG_OPT_QUOTE)
 							LOGCHAR('"');
-						if (s->req_cap[hdr] != NULL) {
+						if (s->req_cap && s->req_cap[hdr] != NULL) {
 							ret = lf_encode_string(tmplog, dst + maxsize,
 							                       '#', hdr_encode_map, s->req_cap[hdr], tmp);
 							if (ret == NULL || *ret != '\0')
@@ -2663,14 +3080,14 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_HDRRESPONS: // %hs
 				/* response header */
-				if (fe->nb_rsp_cap && s && s->res_cap) {
+				if (fe->nb_rsp_cap && s) {
 					if (tmp->options & LOG_OPT_QUOTE)
 						LOGCHAR('"');
 					LOGCHAR('{');
 					for (hdr = 0; hdr < fe->nb_rsp_cap; hdr++) {
 						if (hdr)
 							LOGCHAR('|');
-						if (s->res_cap[hdr] != NULL) {
+						if (s->res_cap && s->res_cap[hdr] != NULL) {
 							ret = lf_encode_string(tmplog, dst + maxsize,
 							                       '#', hdr_encode_map, s->res_cap[hdr], tmp);
 							if (ret == NULL || *ret != '\0')
@@ -2687,13 +3104,13 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_HDRRESPONSLIST: // %hsl
 				/* response header list */
-				if (fe->nb_rsp_cap && s && s->res_cap) {
+				if (fe->nb_rsp_cap && s) {
 					for (hdr = 0; hdr < fe->nb_rsp_cap; hdr++) {
 						if (hdr > 0)
 							LOGCHAR(' ');
 						if (tmp->options & LOG_OPT_QUOTE)
 							LOGCHAR('"');
-						if (s->res_cap[hdr] != NULL) {
+						if (s->res_cap && s->res_cap[hdr] != NULL) {
 							ret = lf_encode_string(tmplog, dst + maxsize,
 							                       '#', hdr_encode_map, s->res_cap[hdr], tmp);
 							if (ret == NULL || *ret != '\0')
@@ -2982,6 +3399,13 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 				break;
 
 		}
+
+		if (unlikely(tmp->key) && log_nb_fields >= 0 && log_nb_fields < LOG_MAX_FIELDS) {
+			log_fields[log_nb_fields].key = tmp->key;
+			log_fields[log_nb_fields].ofs = field - dst;
+			log_fields[log_nb_fields].len = tmplog - field;
+			log_nb_fields++;
+		}
 	}
 
 out:
@@ -2991,6 +3415,25 @@ out:
 
 }
 
+/* Returns non-zero if stream <s> is part of the streams logged by its frontend
+ * ("log-sample"). When the frontend has a key, the streams are selected on its
+ * hash so that the decision is the same for all the streams of a same key,
+ * otherwise one stream out of <log_sample> is selected.
+ */
+static int strm_log_sampled(struct stream *s)
+{
+	struct proxy *fe = strm_fe(s);
+	struct sample *smp;
+
+	if (fe->log_sample_key) {
+		smp = sample_fetch_as_type(fe, s->sess, s, SMP_OPT_DIR_REQ | SMP_OPT_FINAL,
+		                           fe->log_sample_key, SMP_T_BIN);
+		if (smp)
+			return ((uint64_t)hash_crc32(smp->data.u.str.area, smp->data.u.str.data) * fe->log_sample) >> 32 == 0;
+	}
+	return _HA_ATOMIC_ADD(&fe->log_sample_cnt, 1) % fe->log_sample == 0;
+}
+
 /*
  * send a log for the stream when we have enough info about it.
  * Will not log if the frontend has no log defined.
@@ -3008,12 +3451,26 @@ void strm_log(struct stream *s)
 	       (s->si[1].conn_retries != s->be->conn_retries)) ||
 	      ((sess->fe->mode == PR_MODE_HTTP) && s->txn && s->txn->status >= 500);
 
-	if (!err && (sess->fe->options2 & PR_O2_NOLOGNORM))
+	if (!err && !(s->flags & SF_LOG_KEEP) && (sess->fe->options2 & PR_O2_NOLOGNORM))
 		return;
 
 	if (LIST_ISEMPTY(&sess->fe->logsrvs))
 		return;
 
+	/* the sampling decision is taken once per stream, errors are always
+	 * logged unless explicitly dropped.
+	 */
+	if (sess->fe->log_sample && !err && !(s->flags & (SF_LOG_KEEP|SF_LOG_DROP|SF_LOG_SAMPLED))) {
+		s->flags |= SF_LOG_SAMPLED;
+		if (!strm_log_sampled(s))
+			s->flags |= SF_LOG_DROP;
+	}
+
+	if ((s->flags & (SF_LOG_KEEP|SF_LOG_DROP)) == SF_LOG_DROP) {
+		s->logs.logwait = 0;
+		return;
+	}
+
 	if (s->logs.level) { /* loglevel was overridden */
 		if (s->logs.level == -1) {
 			s->logs.logwait = 0; /* logs disabled */
@@ -3037,6 +3494,7 @@ void strm_log(struct stream *s)
 		                        &sess->fe->logformat_sd);
 	}
 
+	log_nb_fields = 0;
 	size = build_logline(s, logline, global.max_syslog_len, &sess->fe->logformat);
 	if (size > 0) {
 		_HA_ATOMIC_ADD(&sess->fe->log_count, 1);
@@ -3044,6 +3502,7 @@ void strm_log(struct stream *s)
 			   logline, size + 1, logline_rfc5424, sd_size);
 		s->logs.logwait = 0;
 	}
+	log_nb_fields = -1;
 }
 
 /*
@@ -3076,12 +3535,14 @@ void sess_log(struct session *sess)
 		                             &sess->fe->logformat_sd);
 	}
 
+	log_nb_fields = 0;
 	size = sess_build_logline(sess, NULL, logline, global.max_syslog_len, &sess->fe->logformat);
 	if (size > 0) {
 		_HA_ATOMIC_ADD(&sess->fe->log_count, 1);
 		__send_log(&sess->fe->logsrvs, &sess->fe->log_tag, level,
 			   logline, size + 1, logline_rfc5424, sd_size);
 	}
+	log_nb_fields = -1;
 }
 
 void app_log(struct list *logsrvs, struct buffer *tag, int level, const char *format, ...)
@@ -3122,6 +3583,32 @@ static struct cli_kw_list cli_kws = {{ },{
 
 INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
 
+/* config parser for global "tune.log.batch-size" */
+static int log_parse_batch_size(char **args, int section_type, struct proxy *curpx,
+                                struct proxy *defpx, const char *file, int line,
+                                char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	log_batch_size = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-' || log_batch_size > 1024) {
+		memprintf(err, "'%s' expects a number of messages between 0 and 1024.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.log.batch-size", log_parse_batch_size },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 REGISTER_PER_THREAD_ALLOC(init_log_buffers);
 REGISTER_PER_THREAD_FREE(deinit_log_buffers);
 
@@ -126,6 +126,7 @@ struct lru64 *lru64_get(unsigned long long key, struct lru64_head *lru,
 				free(old);
 			}
 			lru->cache_usage--;
+			lru->evictions++;
 		}
 	}
 	return elem;
@@ -162,6 +163,7 @@ struct lru64_head *lru64_new(int size)
 		lru->spare = NULL;
 		lru->cache_size = size;
 		lru->cache_usage = 0;
+		lru->evictions = 0;
 	}
 	return lru;
 }
@@ -461,6 +461,55 @@ static int cli_io_handler_pats_list(struct appctx *appctx)
 	return 0;
 }
 
+/* Dumps the pattern cache accounting of the references matching the display
+ * flags, one line per reference.
+ */
+static int cli_io_handler_pat_cache(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct pat_ref *ref;
+
+	switch (appctx->st2) {
+	case STAT_ST_INIT:
+		chunk_reset(&trash);
+		chunk_appendf(&trash, "# id (file) hits misses evictions skipped\n");
+		if (ci_putchk(si_ic(si), &trash) == -1) {
+			si_rx_room_blk(si);
+			return 0;
+		}
+
+		/* see cli_io_handler_pats_list() */
+		appctx->ctx.map.ref = LIST_ELEM(&pattern_reference, struct pat_ref *, list);
+		appctx->ctx.map.ref = pat_list_get_next(appctx->ctx.map.ref, &pattern_reference,
+		                                        appctx->ctx.map.display_flags);
+		appctx->st2 = STAT_ST_LIST;
+		/* fall through */
+
+	case STAT_ST_LIST:
+		while (appctx->ctx.map.ref) {
+			ref = appctx->ctx.map.ref;
+			chunk_reset(&trash);
+			chunk_appendf(&trash, "%d (%s) %llu %llu %llu %llu\n", ref->unique_id,
+			              ref->reference ? ref->reference : "",
+			              ref->lru.hits, ref->lru.misses,
+			              ref->lru.evictions, ref->lru.skipped);
+
+			if (ci_putchk(si_ic(si), &trash) == -1) {
+				si_rx_room_blk(si);
+				return 0;
+			}
+
+			appctx->ctx.map.ref = pat_list_get_next(ref, &pattern_reference,
+			                                        appctx->ctx.map.display_flags);
+		}
+		/* fall through */
+
+	default:
+		appctx->st2 = STAT_ST_FIN;
+		return 1;
+	}
+}
+
 static int cli_io_handler_map_lookup(struct appctx *appctx)
 {
 	struct stream_interface *si = appctx->owner;
@@ -491,7 +540,7 @@ static int cli_io_handler_map_lookup(struct appctx *appctx)
 
 			if (appctx->ctx.map.expr->pat_head->match &&
 			    sample_convert(&sample, appctx->ctx.map.expr->pat_head->expect_type))
-				pat = appctx->ctx.map.expr->pat_head->match(&sample, appctx->ctx.map.expr, 1);
+				pat = appctx->ctx.map.expr->pat_head->match(&sample, appctx->ctx.map.expr->live, 1);
 			else
 				pat = NULL;
 
@@ -673,6 +722,21 @@ static int cli_parse_show_map(char **args, char *payload, struct appctx *appctx,
 	return 0;
 }
 
+/* "show pattern-cache [map|acl]" */
+static int cli_parse_show_pat_cache(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (!*args[2])
+		appctx->ctx.map.display_flags = PAT_REF_MAP | PAT_REF_ACL;
+	else if (strcmp(args[2], "map") == 0)
+		appctx->ctx.map.display_flags = PAT_REF_MAP;
+	else if (strcmp(args[2], "acl") == 0)
+		appctx->ctx.map.display_flags = PAT_REF_ACL;
+	else
+		return cli_err(appctx, "'show pattern-cache' only accepts 'map' or 'acl'.\n");
+
+	return 0;
+}
+
 static int cli_parse_set_map(char **args, char *payload, struct appctx *appctx, void *private)
 {
 	if (strcmp(args[1], "map") == 0) {
@@ -743,15 +807,41 @@ static int cli_parse_set_map(char **args, char *payload, struct appctx *appctx,
 	return 1;
 }
 
-static int map_add_key_value(struct appctx *appctx, const char *key, const char *value, char **err)
+/* Parses the optional version "@<ver>" of a map or ACL command, expected in
+ * <args>[2] just after the "map" or "acl" word. Returns the number of
+ * arguments it takes, 0 or 1, after storing the version into <gen> (0 if
+ * none), or -1 if it is invalid.
+ */
+static int map_parse_gen(char **args, unsigned int *gen)
+{
+	char *end;
+
+	*gen = 0;
+	if (args[2][0] != '@')
+		return 0;
+
+	*gen = strtoul(args[2] + 1, &end, 10);
+	if (!args[2][1] || *end || !*gen)
+		return -1;
+	return 1;
+}
+
+/* Adds the entry <key> with <value> to the map or ACL of <appctx>, to the
+ * live entries if <gen> is 0, otherwise to version <gen> being prepared.
+ */
+static int map_add_key_value(struct appctx *appctx, unsigned int gen,
+                             const char *key, const char *value, char **err)
 {
 	int ret;
 
+	if (appctx->ctx.map.display_flags != PAT_REF_MAP)
+		value = NULL;
+
 	HA_SPIN_LOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
-	if (appctx->ctx.map.display_flags == PAT_REF_MAP)
-		ret = pat_ref_add(appctx->ctx.map.ref, key, value, err);
+	if (gen)
+		ret = pat_ref_add_gen(appctx->ctx.map.ref, gen, key, value, err);
 	else
-		ret = pat_ref_add(appctx->ctx.map.ref, key, NULL, err);
+		ret = pat_ref_add(appctx->ctx.map.ref, key, value, err);
 	HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
 
 	return ret;
@@ -761,6 +851,7 @@ static int cli_parse_add_map(char **args, char *payload, struct appctx *appctx,
 {
 	if (strcmp(args[1], "map") == 0 ||
 	    strcmp(args[1], "acl") == 0) {
+		unsigned int gen;
 		int ret;
 		char *err;
 
@@ -770,6 +861,12 @@ static int cli_parse_add_map(char **args, char *payload, struct appctx *appctx,
 		else
 			appctx->ctx.map.display_flags = PAT_REF_ACL;
 
+		/* An optional version may precede the identifier. */
+		ret = map_parse_gen(args, &gen);
+		if (ret < 0)
+			return cli_err(appctx, "Malformed version. Please use @<ver>.\n");
+		args += ret;
+
 		/* If the keyword is "map", we expect:
 		 *   - three parameters if there is no payload
 		 *   - one parameter if there is a payload
@@ -806,7 +903,7 @@ static int cli_parse_add_map(char **args, char *payload, struct appctx *appctx,
 		/* Add value(s). */
 		err = NULL;
 		if (!payload) {
-			ret = map_add_key_value(appctx, args[3], args[4], &err);
+			ret = map_add_key_value(appctx, gen, args[3], args[4], &err);
 			if (!ret) {
 				if (err)
 					return cli_dynerr(appctx, memprintf(&err, "%s.\n", err));
@@ -841,7 +938,7 @@ static int cli_parse_add_map(char **args, char *payload, struct appctx *appctx,
 					payload++;
 				value[l] = 0;
 
-				ret = map_add_key_value(appctx, key, value, &err);
+				ret = map_add_key_value(appctx, gen, key, value, &err);
 				if (!ret) {
 					if (err)
 						return cli_dynerr(appctx, memprintf(&err, "%s.\n", err));
@@ -929,12 +1026,22 @@ static int cli_parse_del_map(char **args, char *payload, struct appctx *appctx,
 static int cli_parse_clear_map(char **args, char *payload, struct appctx *appctx, void *private)
 {
 	if (strcmp(args[1], "map") == 0 || strcmp(args[1], "acl") == 0) {
+		unsigned int gen;
+		char *err = NULL;
+		int ret;
+
 		/* Set ACL or MAP flags. */
 		if (args[1][0] == 'm')
 			appctx->ctx.map.display_flags = PAT_REF_MAP;
 		else
 			appctx->ctx.map.display_flags = PAT_REF_ACL;
 
+		/* An optional version may precede the identifier. */
+		ret = map_parse_gen(args, &gen);
+		if (ret < 0)
+			return cli_err(appctx, "Malformed version. Please use @<ver>.\n");
+		args += ret;
+
 		/* no parameter */
 		if (!*args[2]) {
 			if (appctx->ctx.map.display_flags == PAT_REF_MAP)
@@ -953,9 +1060,108 @@ static int cli_parse_clear_map(char **args, char *payload, struct appctx *appctx
 				return cli_err(appctx, "Unknown ACL identifier. Please use #<id> or <file>.\n");
 		}
 
-		/* Clear all. */
+		/* Clear all, or only the version being prepared. */
 		HA_SPIN_LOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
-		pat_ref_prune(appctx->ctx.map.ref);
+		if (gen) {
+			if (!pat_ref_clear_gen(appctx->ctx.map.ref, gen, &err)) {
+				HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+				return cli_dynerr(appctx, memprintf(&err, "%s.\n", err));
+			}
+		}
+		else
+			pat_ref_prune(appctx->ctx.map.ref);
+		HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+
+		/* return response */
+		appctx->st0 = CLI_ST_PROMPT;
+		return 1;
+	}
+	return 0;
+}
+
+static int cli_parse_prepare_map(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (strcmp(args[1], "map") == 0 || strcmp(args[1], "acl") == 0) {
+		unsigned int gen;
+		char *err = NULL;
+
+		/* Set ACL or MAP flags. */
+		if (args[1][0] == 'm')
+			appctx->ctx.map.display_flags = PAT_REF_MAP;
+		else
+			appctx->ctx.map.display_flags = PAT_REF_ACL;
+
+		/* no parameter */
+		if (!*args[2]) {
+			if (appctx->ctx.map.display_flags == PAT_REF_MAP)
+				return cli_err(appctx, "Missing map identifier.\n");
+			else
+				return cli_err(appctx, "Missing ACL identifier.\n");
+		}
+
+		/* lookup into the refs and check the map flag */
+		appctx->ctx.map.ref = pat_ref_lookup_ref(args[2]);
+		if (!appctx->ctx.map.ref ||
+		    !(appctx->ctx.map.ref->flags & appctx->ctx.map.display_flags)) {
+			if (appctx->ctx.map.display_flags == PAT_REF_MAP)
+				return cli_err(appctx, "Unknown map identifier. Please use #<id> or <file>.\n");
+			else
+				return cli_err(appctx, "Unknown ACL identifier. Please use #<id> or <file>.\n");
+		}
+
+		HA_SPIN_LOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+		if (!pat_ref_prepare(appctx->ctx.map.ref, &gen, &err)) {
+			HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+			return cli_dynerr(appctx, memprintf(&err, "%s.\n", err));
+		}
+		HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+
+		return cli_dynmsg(appctx, LOG_INFO, memprintf(&err, "New version created: %u\n", gen));
+	}
+	return 0;
+}
+
+static int cli_parse_commit_map(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (strcmp(args[1], "map") == 0 || strcmp(args[1], "acl") == 0) {
+		unsigned int gen;
+		char *err = NULL;
+		int ret;
+
+		/* Set ACL or MAP flags. */
+		if (args[1][0] == 'm')
+			appctx->ctx.map.display_flags = PAT_REF_MAP;
+		else
+			appctx->ctx.map.display_flags = PAT_REF_ACL;
+
+		/* the version is mandatory */
+		ret = map_parse_gen(args, &gen);
+		if (ret <= 0)
+			return cli_err(appctx, "Missing or malformed version. Please use @<ver>.\n");
+		args += ret;
+
+		if (!*args[2]) {
+			if (appctx->ctx.map.display_flags == PAT_REF_MAP)
+				return cli_err(appctx, "Missing map identifier.\n");
+			else
+				return cli_err(appctx, "Missing ACL identifier.\n");
+		}
+
+		/* lookup into the refs and check the map flag */
+		appctx->ctx.map.ref = pat_ref_lookup_ref(args[2]);
+		if (!appctx->ctx.map.ref ||
+		    !(appctx->ctx.map.ref->flags & appctx->ctx.map.display_flags)) {
+			if (appctx->ctx.map.display_flags == PAT_REF_MAP)
+				return cli_err(appctx, "Unknown map identifier. Please use #<id> or <file>.\n");
+			else
+				return cli_err(appctx, "Unknown ACL identifier. Please use #<id> or <file>.\n");
+		}
+
+		HA_SPIN_LOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+		if (!pat_ref_commit(appctx->ctx.map.ref, gen, &err)) {
+			HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+			return cli_dynerr(appctx, memprintf(&err, "%s.\n", err));
+		}
 		HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
 
 		/* return response */
@@ -969,16 +1175,21 @@ static int cli_parse_clear_map(char **args, char *payload, struct appctx *appctx
 
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "add",   "acl", NULL }, "add acl        : add acl entry", cli_parse_add_map, NULL },
-	{ { "clear", "acl", NULL }, "clear acl <id> : clear the content of this acl", cli_parse_clear_map, NULL },
+	{ { "clear", "acl", NULL }, "clear acl [@<ver>] <id> : clear the content of this acl", cli_parse_clear_map, NULL },
+	{ { "commit", "acl", NULL }, "commit acl @<ver> <id> : replace the content of this acl with a prepared version", cli_parse_commit_map, NULL },
 	{ { "del",   "acl", NULL }, "del acl        : delete acl entry", cli_parse_del_map, NULL },
 	{ { "get",   "acl", NULL }, "get acl        : report the patterns matching a sample for an ACL", cli_parse_get_map, cli_io_handler_map_lookup, cli_release_mlook },
+	{ { "prepare", "acl", NULL }, "prepare acl <id> : start a new version of this acl, to be committed", cli_parse_prepare_map, NULL },
 	{ { "show",  "acl", NULL }, "show acl [id]  : report available acls or dump an acl's contents", cli_parse_show_map, NULL },
 	{ { "add",   "map", NULL }, "add map        : add map entry", cli_parse_add_map, NULL },
-	{ { "clear", "map", NULL }, "clear map <id> : clear the content of this map", cli_parse_clear_map, NULL },
+	{ { "clear", "map", NULL }, "clear map [@<ver>] <id> : clear the content of this map", cli_parse_clear_map, NULL },
+	{ { "commit", "map", NULL }, "commit map @<ver> <id> : replace the content of this map with a prepared version", cli_parse_commit_map, NULL },
 	{ { "del",   "map", NULL }, "del map        : delete map entry", cli_parse_del_map, NULL },
 	{ { "get",   "map", NULL }, "get map        : report the keys and values matching a sample for a map", cli_parse_get_map, cli_io_handler_map_lookup, cli_release_mlook },
+	{ { "prepare", "map", NULL }, "prepare map <id> : start a new version of this map, to be committed", cli_parse_prepare_map, NULL },
 	{ { "set",   "map", NULL }, "set map        : modify map entry", cli_parse_set_map, NULL },
 	{ { "show",  "map", NULL }, "show map [id]  : report available maps or dump a map's contents", cli_parse_show_map, NULL },
+	{ { "show",  "pattern-cache", NULL }, "show pattern-cache [map|acl] : report the pattern cache usage of the maps and acls", cli_parse_show_pat_cache, cli_io_handler_pat_cache },
 	{ { NULL }, NULL, NULL, NULL }
 }};
 
@@ -33,6 +33,7 @@
 #include <proto/log.h>
 #include <proto/stream_interface.h>
 #include <proto/stats.h>
+#include <proto/task.h>
 
 /* These are the most common pools, expected to be initialized first. These
  * ones are allocated from an array, allowing to map them to an index.
@@ -45,10 +46,48 @@ struct pool_cache_head pool_cache[MAX_THREADS][MAX_BASE_POOLS];
 static struct list pool_lru_head[MAX_THREADS];           /* oldest objects   */
 THREAD_LOCAL size_t pool_cache_bytes = 0;                /* total cache size */
 THREAD_LOCAL size_t pool_cache_count = 0;                /* #cache objects   */
+#ifdef CONFIG_HAP_LOCKLESS_POOLS
+THREAD_LOCAL unsigned int pool_node = 0;                 /* NUMA node's lists */
+#endif
 
 static struct list pools = LIST_HEAD_INIT(pools);
 int mem_poison_byte = -1;
 
+/* memory governor, enabled by "tune.memory.soft-limit" */
+#define POOL_GOVERNOR_INTERVAL 1000     /* ms between two checks */
+unsigned int pool_mem_pressure = 0;     /* non-zero above the soft limit */
+static unsigned long pool_soft_limit;   /* in bytes, 0 if disabled */
+
+#ifndef DEBUG_UAF
+/* number of object sizes the huge pages arena has slabs for */
+#define POOL_ARENA_CLASSES (2 * MAX_BASE_POOLS)
+/* minimum size of the slabs carved out of the huge pages arena */
+#define POOL_ARENA_SLAB (256 * 1024)
+
+/* MAP_HUGE_SHIFT is only provided by recent libc headers */
+#ifdef MAP_HUGE_SHIFT
+#define POOL_MAP_HUGE_SHIFT MAP_HUGE_SHIFT
+#else
+#define POOL_MAP_HUGE_SHIFT 26
+#endif
+
+/* objects of a given size in the huge pages arena */
+struct pool_arena_class {
+	size_t size;            /* size of the objects, 0 if unused */
+	void *free;             /* objects released to this class */
+	char *cur;              /* next never used object in the current slab */
+	char *end;              /* end of the current slab */
+};
+
+char *pool_arena_start = NULL;          /* first byte of the arena, NULL if none */
+char *pool_arena_end = NULL;            /* first byte after the arena */
+static char *pool_arena_cur;            /* first byte never carved */
+static size_t pool_arena_size;          /* "tune.memory.hugepages", in bytes */
+static int pool_arena_prefault;         /* fault the arena in at startup */
+static struct pool_arena_class pool_arena_cls[POOL_ARENA_CLASSES];
+__decl_hathreads(static HA_SPINLOCK_T pool_arena_lock);
+#endif
+
 #ifdef DEBUG_FAIL_ALLOC
 static int mem_fail_rate = 0;
 static int mem_should_fail(const struct pool_head *);
@@ -146,6 +185,31 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 }
 
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
+/* Tries to retrieve an object from the free lists of the NUMA nodes other than
+ * the current thread's one in pool <pool>, and accounts it as used. Returns
+ * NULL if none is available.
+ */
+static void *pool_get_from_other_nodes(struct pool_head *pool)
+{
+	void *ptr;
+	int node;
+
+	for (node = 0; node < CONFIG_HAP_POOL_NODES; node++) {
+		if (node == pool_node)
+			continue;
+		ptr = __pool_get_from_node(pool, node);
+		if (ptr) {
+			_HA_ATOMIC_ADD(&pool->used, 1);
+#ifdef DEBUG_MEMORY_POOLS
+			/* keep track of where the element was allocated from */
+			*POOL_LINK(pool, ptr) = (void *)pool;
+#endif
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
 /* Allocates new entries for pool <pool> until there are at least <avail> + 1
  * available, then returns the last one for immediate use, so that at least
  * <avail> are left available in the pool upon return. NULL is returned if the
@@ -168,13 +232,19 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 	while (1) {
 		if (limit && allocated >= limit) {
 			_HA_ATOMIC_ADD(&pool->allocated, allocated - allocated_orig);
+			/* the objects released by the other nodes still count
+			 * in the limit, better reuse them than fail.
+			 */
+			ptr = pool_get_from_other_nodes(pool);
+			if (ptr)
+				return ptr;
 			activity[tid].pool_fail++;
 			return NULL;
 		}
 
 		pool_avg_bump(&pool->needed_avg, pool->allocated);
 
-		ptr = malloc(size + POOL_EXTRA);
+		ptr = pool_alloc_area(size + POOL_EXTRA);
 		if (!ptr) {
 			_HA_ATOMIC_ADD(&pool->failed, 1);
 			if (failed) {
@@ -188,11 +258,11 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 		if (++allocated > avail)
 			break;
 
-		free_list = pool->free_list;
+		free_list = pool->node[pool_node].free_list;
 		do {
 			*POOL_LINK(pool, ptr) = free_list;
 			__ha_barrier_store();
-		} while (_HA_ATOMIC_CAS(&pool->free_list, &free_list, ptr) == 0);
+		} while (_HA_ATOMIC_CAS(&pool->node[pool_node].free_list, &free_list, ptr) == 0);
 	}
 	__ha_barrier_atomic_store();
 
@@ -220,26 +290,28 @@ void pool_flush(struct pool_head *pool)
 	struct pool_free_list cmp, new;
 	void **next, *temp;
 	int removed = 0;
+	int node;
 
 	if (!pool)
 		return;
-	HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
-	do {
-		cmp.free_list = pool->free_list;
-		cmp.seq = pool->seq;
-		new.free_list = NULL;
-		new.seq = cmp.seq + 1;
-	} while (!_HA_ATOMIC_DWCAS(&pool->free_list, &cmp, &new));
-	__ha_barrier_atomic_store();
-	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
-	next = cmp.free_list;
-	while (next) {
-		temp = next;
-		next = *POOL_LINK(pool, temp);
-		removed++;
-		free(temp);
+	for (node = 0; node < CONFIG_HAP_POOL_NODES; node++) {
+		HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
+		do {
+			cmp.free_list = pool->node[node].free_list;
+			cmp.seq = pool->node[node].seq;
+			new.free_list = NULL;
+			new.seq = cmp.seq + 1;
+		} while (!_HA_ATOMIC_DWCAS(&pool->node[node].free_list, &cmp, &new));
+		__ha_barrier_atomic_store();
+		HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
+		next = cmp.free_list;
+		while (next) {
+			temp = next;
+			next = *POOL_LINK(pool, temp);
+			removed++;
+			pool_free_area(temp, pool->size + POOL_EXTRA);
+		}
 	}
-	pool->free_list = next;
 	_HA_ATOMIC_SUB(&pool->allocated, removed);
 	/* here, we should have pool->allocate == pool->used */
 }
@@ -252,27 +324,22 @@ void pool_flush(struct pool_head *pool)
 void pool_gc(struct pool_head *pool_ctx)
 {
 	struct pool_head *entry;
+	void *ptr;
+	int node;
 	int isolated = thread_isolated();
 
 	if (!isolated)
 		thread_isolate();
 
 	list_for_each_entry(entry, &pools, list) {
-		while ((int)((volatile int)entry->allocated - (volatile int)entry->used) > (int)entry->minavail) {
-			struct pool_free_list cmp, new;
-
-			cmp.seq = entry->seq;
-			__ha_barrier_load();
-			cmp.free_list = entry->free_list;
-			__ha_barrier_load();
-			if (cmp.free_list == NULL)
-				break;
-			new.free_list = *POOL_LINK(entry, cmp.free_list);
-			new.seq = cmp.seq + 1;
-			if (HA_ATOMIC_DWCAS(&entry->free_list, &cmp, &new) == 0)
-				continue;
-			free(cmp.free_list);
-			_HA_ATOMIC_SUB(&entry->allocated, 1);
+		for (node = 0; node < CONFIG_HAP_POOL_NODES; node++) {
+			while ((int)((volatile int)entry->allocated - (volatile int)entry->used) > (int)entry->minavail) {
+				ptr = __pool_get_from_node(entry, node);
+				if (!ptr)
+					break;
+				pool_free_area(ptr, entry->size + POOL_EXTRA);
+				_HA_ATOMIC_SUB(&entry->allocated, 1);
+			}
 		}
 	}
 
@@ -435,6 +502,167 @@ void pool_gc(struct pool_head *pool_ctx)
 }
 #endif
 
+#ifndef DEBUG_UAF
+/* Allocates an area of <size> bytes from the huge pages arena, carving it out
+ * of the slab of the objects of this size, and falls back to malloc() once the
+ * arena is exhausted. The areas are 16-bytes aligned just like with malloc().
+ */
+void *pool_arena_alloc(size_t size)
+{
+	struct pool_arena_class *cls;
+	size_t slab;
+	void *ret = NULL;
+
+	size = (size + 15) & -16;
+	HA_SPIN_LOCK(POOL_LOCK, &pool_arena_lock);
+	for (cls = pool_arena_cls; cls < pool_arena_cls + POOL_ARENA_CLASSES; cls++) {
+		if (cls->size == size || !cls->size)
+			break;
+	}
+
+	if (cls == pool_arena_cls + POOL_ARENA_CLASSES)
+		goto end; // too many different sizes
+
+	cls->size = size;
+	if (cls->free) {
+		ret = cls->free;
+		cls->free = *(void **)ret;
+		goto end;
+	}
+
+	if (cls->end - cls->cur < size) {
+		/* the rest of the current slab is lost */
+		slab = MAX(size * 16, POOL_ARENA_SLAB);
+		if (slab > pool_arena_end - pool_arena_cur)
+			slab = pool_arena_end - pool_arena_cur;
+		if (slab < size)
+			goto end; // arena exhausted
+		cls->cur = pool_arena_cur;
+		cls->end = cls->cur + slab;
+		pool_arena_cur += slab;
+	}
+	ret = cls->cur;
+	cls->cur += size;
+ end:
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool_arena_lock);
+	if (!ret)
+		ret = malloc(size);
+	return ret;
+}
+
+/* Releases <area> of <size> bytes allocated from the huge pages arena to the
+ * objects of this size. Arena areas are never returned to the system.
+ */
+void pool_arena_free(void *area, size_t size)
+{
+	struct pool_arena_class *cls;
+
+	size = (size + 15) & -16;
+	HA_SPIN_LOCK(POOL_LOCK, &pool_arena_lock);
+	for (cls = pool_arena_cls; cls < pool_arena_cls + POOL_ARENA_CLASSES; cls++) {
+		if (cls->size == size) {
+			*(void **)area = cls->free;
+			cls->free = area;
+			break;
+		}
+	}
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool_arena_lock);
+}
+
+/* Reserves the huge pages arena configured by "tune.memory.hugepages". This
+ * is done by the first thread to start so that the arena belongs to the worker
+ * and never to the master process. Explicit huge pages are tried first (1 GB
+ * ones if the size allows it), then transparent huge pages. The whole arena
+ * is faulted in if "prefault" was set. Always returns 1.
+ */
+static int pool_arena_init()
+{
+	static int done;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char *area = MAP_FAILED;
+	size_t ofs;
+
+	if (done || !pool_arena_size || master)
+		return 1;
+	done = 1;
+
+	HA_SPIN_INIT(&pool_arena_lock);
+#ifdef MAP_POPULATE
+	if (pool_arena_prefault)
+		flags |= MAP_POPULATE;
+#endif
+#ifdef MAP_HUGETLB
+	if (!(pool_arena_size & ((1UL << 30) - 1)))
+		area = mmap(NULL, pool_arena_size, PROT_READ | PROT_WRITE,
+		            flags | MAP_HUGETLB | (30 << POOL_MAP_HUGE_SHIFT), -1, 0);
+	if (area == MAP_FAILED)
+		area = mmap(NULL, pool_arena_size, PROT_READ | PROT_WRITE,
+		            flags | MAP_HUGETLB, -1, 0);
+#endif
+	if (area == MAP_FAILED) {
+		area = mmap(NULL, pool_arena_size, PROT_READ | PROT_WRITE,
+		            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == MAP_FAILED) {
+			ha_warning("tune.memory.hugepages: cannot reserve %lu MB (%s), using malloc().\n",
+			           (unsigned long)(pool_arena_size >> 20), strerror(errno));
+			return 1;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(area, pool_arena_size, MADV_HUGEPAGE);
+#endif
+		ha_warning("tune.memory.hugepages: no huge pages available for %lu MB, using transparent huge pages.\n",
+		           (unsigned long)(pool_arena_size >> 20));
+		if (pool_arena_prefault) {
+			for (ofs = 0; ofs < pool_arena_size; ofs += 4096)
+				area[ofs] = 0;
+		}
+	}
+
+	pool_arena_cur = area;
+	pool_arena_end = area + pool_arena_size;
+	__ha_barrier_store();
+	pool_arena_start = area;
+	return 1;
+}
+
+REGISTER_PER_THREAD_ALLOC(pool_arena_init);
+
+/* config parser for global "tune.memory.hugepages" */
+static int mem_parse_global_hugepages(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+	char *end;
+	unsigned long mb;
+
+	if (too_many_args(2, args, err, NULL))
+		return -1;
+
+	mb = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-' || mb > (SIZE_MAX >> 21)) {
+		memprintf(err, "'%s' expects a size in megabytes, 0 to disable.", args[0]);
+		return -1;
+	}
+
+	if (*args[2] && strcmp(args[2], "prefault") != 0) {
+		memprintf(err, "'%s' only supports 'prefault' after the size, got '%s'.", args[0], args[2]);
+		return -1;
+	}
+
+	/* explicit huge pages are at least 2 MB large */
+	pool_arena_size = ((mb + 1) & ~1UL) << 20;
+	pool_arena_prefault = !!*args[2];
+	return 0;
+}
+
+static struct cfg_kw_list mem_arena_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.memory.hugepages", mem_parse_global_hugepages },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &mem_arena_kws);
+#endif /* DEBUG_UAF */
+
 /*
  * This function destroys a pool by freeing it completely, unless it's still
  * in use. This should be called only under extreme circumstances. It always
@@ -501,6 +729,15 @@ void dump_pools_to_trash()
 	}
 	chunk_appendf(&trash, "Total: %d pools, %lu bytes allocated, %lu used.\n",
 		 nbpools, allocated, used);
+	if (pool_soft_limit)
+		chunk_appendf(&trash, "Soft limit: %lu bytes, memory pressure: %s.\n",
+		              pool_soft_limit, pool_mem_pressure ? "yes" : "no");
+#ifndef DEBUG_UAF
+	if (pool_arena_start)
+		chunk_appendf(&trash, "Huge pages arena: %lu bytes carved out of %lu.\n",
+		              (unsigned long)(pool_arena_cur - pool_arena_start),
+		              (unsigned long)(pool_arena_end - pool_arena_start));
+#endif
 }
 
 /* Dump statistics on pools usage. */
@@ -573,6 +810,84 @@ void create_pool_callback(struct pool_head **ptr, char *name, unsigned int size)
 	}
 }
 
+/* Periodically compares the memory allocated by the pools to the soft limit.
+ * Above it, the pools switch to the memory pressure state where the released
+ * objects bypass the thread-local caches and go back to the system as soon as
+ * the pool holds more than its minimum, and where their users release their
+ * idle resources more aggressively. The free objects are garbage-collected at
+ * each check while above the limit. The state is left once the pools are back
+ * below 7/8 of the limit.
+ */
+static struct task *pool_governor(struct task *t, void *context, unsigned short state)
+{
+	unsigned long allocated = pool_total_allocated();
+
+	if (allocated > pool_soft_limit) {
+		if (!pool_mem_pressure) {
+			pool_mem_pressure = 1;
+			send_log(NULL, LOG_WARNING, "Memory pressure: pools use %lu MB, above the soft limit of %lu MB.\n",
+			         allocated >> 20, pool_soft_limit >> 20);
+		}
+		pool_gc(NULL);
+	}
+	else if (pool_mem_pressure && allocated <= pool_soft_limit / 8 * 7) {
+		pool_mem_pressure = 0;
+		send_log(NULL, LOG_NOTICE, "Memory pressure is over: pools use %lu MB.\n", allocated >> 20);
+	}
+
+	t->expire = tick_add(now_ms, MS_TO_TICKS(POOL_GOVERNOR_INTERVAL));
+	return t;
+}
+
+/* Starts the memory governor if a soft limit is set. Returns 0 if OK, or an
+ * error code.
+ */
+static int pool_governor_init()
+{
+	struct task *t;
+
+	if (!pool_soft_limit)
+		return 0;
+
+	t = task_new(MAX_THREADS_MASK);
+	if (!t) {
+		ha_alert("tune.memory.soft-limit: out of memory while creating the memory governor.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	t->process = pool_governor;
+	task_wakeup(t, TASK_WOKEN_INIT);
+	return 0;
+}
+
+REGISTER_POST_CHECK(pool_governor_init);
+
+/* config parser for global "tune.memory.soft-limit" */
+static int mem_parse_global_soft_limit(char **args, int section_type, struct proxy *curpx,
+                                       struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	char *end;
+	unsigned long mb;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	mb = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-' || mb > (ULONG_MAX >> 20)) {
+		memprintf(err, "'%s' expects a size in megabytes, 0 to disable.", args[0]);
+		return -1;
+	}
+	pool_soft_limit = mb << 20;
+	return 0;
+}
+
+static struct cfg_kw_list mem_governor_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.memory.soft-limit", mem_parse_global_soft_limit },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &mem_governor_kws);
+
 /* Initializes all per-thread arrays on startup */
 static void init_pools()
 {
@@ -589,6 +904,72 @@ static void init_pools()
 
 INITCALL0(STG_PREPARE, init_pools);
 
+#if defined(CONFIG_HAP_LOCKLESS_POOLS) && defined(USE_CPU_AFFINITY) && defined(__linux__)
+/* CPUs of each NUMA node, limited to the ones which may appear in a cpu-map */
+static unsigned long pool_node_cpus[CONFIG_HAP_POOL_NODES];
+
+/* Discovers the CPUs of each NUMA node from sysfs, which must be done before
+ * the chroot. If it is not available, all threads use the first node's free
+ * lists. Always returns 0.
+ */
+static int pool_init_nodes()
+{
+	char path[64], line[1024];
+	unsigned long first, last;
+	char *p, *end;
+	FILE *f;
+	int node;
+
+	for (node = 0; ; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		f = fopen(path, "r");
+		if (!f)
+			break;
+		p = fgets(line, sizeof(line), f);
+		fclose(f);
+
+		/* the format is a comma-delimited list of CPUs or ranges */
+		while (p && *p >= '0' && *p <= '9') {
+			first = last = strtoul(p, &end, 10);
+			if (*end == '-')
+				last = strtoul(end + 1, &end, 10);
+			for (; first <= last && first < LONGBITS; first++)
+				pool_node_cpus[node % CONFIG_HAP_POOL_NODES] |= 1UL << first;
+			p = (*end == ',') ? end + 1 : NULL;
+		}
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(pool_init_nodes);
+
+/* Makes the current thread use the free lists of the NUMA node its "cpu-map"
+ * CPUs belong to. The threads which are not bound or which are bound to CPUs
+ * of several nodes stay on the first node. Always returns 1.
+ */
+static int pool_init_thread_node()
+{
+	unsigned long mask = global.cpu_map.thread[tid];
+	unsigned long proc = global.cpu_map.proc[relative_pid - 1];
+	int node;
+
+	if (!tid && global.cpu_map.proc_t1[relative_pid - 1])
+		proc = global.cpu_map.proc_t1[relative_pid - 1];
+	if (proc)
+		mask = mask ? mask & proc : proc;
+
+	for (node = 0; mask && node < CONFIG_HAP_POOL_NODES; node++) {
+		if (!(mask & ~pool_node_cpus[node])) {
+			pool_node = node;
+			break;
+		}
+	}
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(pool_init_thread_node);
+#endif
+
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "show", "pools",  NULL }, "show pools     : report information about the memory pools usage", NULL, cli_io_handler_dump_pools },
@@ -1635,6 +1635,23 @@ static int fcgi_conn_handle_values_result(struct fcgi_conn *fconn)
 		fconn->streams_limit = 1;
 		TRACE_STATE("no mpxs for streams_limit to 1", FCGI_EV_RX_RECORD|FCGI_EV_RX_GETVAL, fconn->conn);
 	}
+	else if (!fconn->streams_limit) {
+		/* FCGI_MAX_REQS set to 0 or garbage, it cannot mean "no request" */
+		fconn->streams_limit = 1;
+		TRACE_STATE("invalid max reqs for streams_limit to 1", FCGI_EV_RX_RECORD|FCGI_EV_RX_GETVAL, fconn->conn);
+	}
+
+	/* The connection was created for a stream and may now accept more of
+	 * them. If it is shareable, advertise it on the server's list of
+	 * available connections so that the next streams are multiplexed on
+	 * it instead of opening new connections to the application.
+	 */
+	if (fconn->nb_cs && !(fconn->conn->flags & CO_FL_PRIVATE) &&
+	    MT_LIST_ISEMPTY(&fconn->conn->list) &&
+	    fcgi_avail_streams(fconn->conn) > 0 && objt_server(fconn->conn->target)) {
+		LIST_ADD(&__objt_server(fconn->conn->target)->available_conns[tid], mt_list_to_list(&fconn->conn->list));
+		TRACE_STATE("connection available for more streams", FCGI_EV_RX_RECORD|FCGI_EV_RX_GETVAL, fconn->conn);
+	}
 
 	/* We must be sure to have read exactly the announced record length, no
 	 * more no less
@@ -76,7 +76,8 @@
 #define H1S_F_BUF_FLUSH      0x00000100 /* Flush input buffer and don't read more data */
 #define H1S_F_SPLICED_DATA   0x00000200 /* Set when the kernel splicing is in used */
 #define H1S_F_PARSING_DONE   0x00000400 /* Set when incoming message parsing is finished (EOM added) */
-/* 0x00000800 .. 0x00001000 unused */
+#define H1S_F_SPLICED_CRLF   0x00000800 /* The CRLF ending a spliced chunk must still be emitted */
+/* 0x00001000 unused */
 #define H1S_F_HAVE_SRV_NAME  0x00002000 /* Set during output process if the server name header was added to the request */
 #define H1S_F_HAVE_O_CONN    0x00004000 /* Set during output process to know connection mode was processed */
 
@@ -113,6 +114,7 @@ struct h1s {
 
 	enum http_meth_t meth; /* HTTP resquest method */
 	uint16_t status;       /* HTTP response status */
+	unsigned int spliced_chk; /* bytes left to splice in the current output chunk */
 };
 
 /* Map of headers used to convert outgoing headers */
@@ -130,6 +132,11 @@ struct h1_hdr_entry  {
 /* Declare the headers map */
 static struct h1_hdrs_map hdrs_map = { .name = NULL, .map  = EB_ROOT };
 
+/* set by "tune.h1.pipeline-read-ahead" to keep reading pipelined requests on
+ * frontend connections while the current response is being produced.
+ */
+static int h1_pipeline_read_ahead = 0;
+
 
 /* trace source and events */
 static void h1_trace(enum trace_level level, uint64_t mask,
@@ -356,11 +363,14 @@ static void h1_trace(enum trace_level level, uint64_t mask, const struct trace_s
  *   - if the input buffer failed to be allocated or is full , we must not try
  *     to receive
  *   - if he input processing is busy waiting for the output side, we may
- *     attempt to receive
+ *     attempt to receive only on frontend connections when pipelined requests
+ *     may be read ahead (see h1_reading_ahead())
  *   - otherwise must may not attempt to receive
  */
 static inline int h1_recv_allowed(const struct h1c *h1c)
 {
+	int blocked = H1C_F_IN_ALLOC|H1C_F_IN_FULL|H1C_F_IN_BUSY;
+
 	if (h1c->flags & H1C_F_CS_ERROR) {
 		TRACE_DEVEL("recv not allowed because of error on h1c", H1_EV_H1C_RECV|H1_EV_H1C_BLK, h1c->conn);
 		return 0;
@@ -371,13 +381,29 @@ static inline int h1_recv_allowed(const struct h1c *h1c)
 		return 0;
 	}
 
-	if (!(h1c->flags & (H1C_F_IN_ALLOC|H1C_F_IN_FULL|H1C_F_IN_BUSY)))
+	if (h1_pipeline_read_ahead && !conn_is_back(h1c->conn))
+		blocked &= ~H1C_F_IN_BUSY;
+
+	if (!(h1c->flags & blocked))
 		return 1;
 
 	TRACE_DEVEL("recv not allowed because input is blocked", H1_EV_H1C_RECV|H1_EV_H1C_BLK, h1c->conn);
 	return 0;
 }
 
+/*
+ * Indicates whether the data received now on a frontend connection belong to
+ * the next pipelined requests and not to the current stream, which has fully
+ * received its request and waits for its response. The data are then only
+ * stored in the input buffer and neither the stream nor its request are
+ * notified, the read0 is only reported to the stream parsing the next request.
+ */
+static inline int h1_reading_ahead(const struct h1c *h1c, const struct h1s *h1s)
+{
+	return (h1_pipeline_read_ahead && !conn_is_back(h1c->conn) &&
+		(h1c->flags & H1C_F_IN_BUSY) && h1s && h1s->req.state == H1_MSG_DONE);
+}
+
 /*
  * Tries to grab a buffer and to re-enables processing on mux <target>. The h1
  * flags are used to figure what buffer was requested. It returns 1 if the
@@ -532,6 +558,7 @@ static struct h1s *h1s_create(struct h1c *h1c, struct conn_stream *cs, struct se
 
 	h1s->status = 0;
 	h1s->meth   = HTTP_METH_OTHER;
+	h1s->spliced_chk = 0;
 
 	if (h1c->flags & H1C_F_WAIT_NEXT_REQ)
 		h1s->flags |= H1S_F_NOT_FIRST;
@@ -1284,7 +1311,8 @@ static size_t h1_process_data(struct h1s *h1s, struct h1m *h1m, struct htx **htx
 		goto end;
 	}
 
-	if (h1m->state == H1_MSG_DATA && h1m->curr_len && h1s->cs)
+	if (h1m->state == H1_MSG_DATA && h1m->curr_len && h1s->cs &&
+	    (!(h1m->flags & H1_MF_CHNK) || h1m->curr_len >= MIN_SPLICE_FORWARD))
 		h1s->cs->flags |= CS_FL_MAY_SPLICE;
 	else if (h1s->cs)
 		h1s->cs->flags &= ~CS_FL_MAY_SPLICE;
@@ -1574,7 +1602,7 @@ static size_t h1_process_output(struct h1c *h1c, struct buffer *buf, size_t coun
 	 * the HTX blocks.
 	 */
 	if (!b_data(&h1c->obuf)) {
-		if (htx_nbblks(chn_htx) == 1 &&
+		if (htx_nbblks(chn_htx) == 1 && !(h1s->flags & H1S_F_SPLICED_CRLF) &&
 		    htx_get_blk_type(blk) == HTX_BLK_DATA &&
 		    htx_get_blk_value(chn_htx, blk).len == count) {
 			void *old_area = h1c->obuf.area;
@@ -1615,6 +1643,14 @@ static size_t h1_process_output(struct h1c *h1c, struct buffer *buf, size_t coun
 
 	tmp.data = 0;
 	tmp.size = b_room(&h1c->obuf);
+
+	/* the last spliced chunk must be ended first */
+	if (h1s->flags & H1S_F_SPLICED_CRLF) {
+		if (!chunk_memcat(&tmp, "\r\n", 2))
+			goto full;
+		h1s->flags &= ~H1S_F_SPLICED_CRLF;
+	}
+
 	while (count && !(h1s->flags & errflag) && blk) {
 		struct htx_sl *sl;
 		struct ist n, v;
@@ -1825,6 +1861,61 @@ static size_t h1_process_output(struct h1c *h1c, struct buffer *buf, size_t coun
 
 				TRACE_PROTO("sending message data", H1_EV_TX_DATA|H1_EV_TX_BODY, h1c->conn, h1s, chn_htx, (size_t[]){sz});
 
+				/* If the headers were formatted in the empty mux's
+				 * buffer and the DATA block is the last one, it
+				 * could be possible to copy them, with the chunk
+				 * size if needed, just before the DATA block's
+				 * payload and to swap the buffers. This way, the
+				 * headers and the data are sent in a single call
+				 * without copying the data.
+				 */
+				if (tmp.area == h1c->obuf.area + h1c->obuf.head &&
+				    blk == htx_get_tail_blk(chn_htx) && vlen == count) {
+					size_t chksz = vlen;
+
+					chklen = 0;
+					if (h1m->flags & H1_MF_CHNK) {
+						chklen = 2; /* CRLF */
+						do {
+							chklen++;
+						} while (chksz >>= 4);
+					}
+
+					v = htx_get_blk_value(chn_htx, blk);
+					if (tmp.data + chklen <= v.ptr - buf->area) {
+						void *old_area = h1c->obuf.area;
+
+						TRACE_PROTO("sending message headers and data (zero-copy)", H1_EV_TX_DATA|H1_EV_TX_BODY, h1c->conn, h1s, chn_htx, (size_t[]){vlen});
+						h1c->obuf.area = buf->area;
+						h1c->obuf.head = v.ptr - buf->area;
+						h1c->obuf.data = vlen;
+						if (h1m->flags & H1_MF_CHNK) {
+							h1_emit_chunk_size(&h1c->obuf, vlen);
+							h1_emit_chunk_crlf(&h1c->obuf);
+						}
+
+						/* <tmp> is in the old area, copy it before reusing it */
+						h1c->obuf.head -= tmp.data;
+						memcpy(b_head(&h1c->obuf), tmp.area, tmp.data);
+						b_add(&h1c->obuf, tmp.data);
+
+						buf->area = old_area;
+						buf->data = buf->head = 0;
+
+						chn_htx = (struct htx *)buf->area;
+						htx_reset(chn_htx);
+
+						total += vlen;
+						if (h1m->state == H1_MSG_DATA)
+							TRACE_PROTO((!(h1m->flags & H1_MF_RESP) ? "H1 request payload data xferred" : "H1 response payload data xferred"),
+								    H1_EV_TX_DATA|H1_EV_TX_BODY, h1c->conn, h1s,, (size_t[]){vlen});
+						else
+							TRACE_PROTO((!(h1m->flags & H1_MF_RESP) ? "H1 request tunneled data xferred" : "H1 response tunneled data xferred"),
+								    H1_EV_TX_DATA|H1_EV_TX_BODY, h1c->conn, h1s,, (size_t[]){vlen});
+						goto out;
+					}
+				}
+
 
 				if (vlen > count) {
 					/* Get the maximum amount of data we can xferred */
@@ -1990,6 +2081,7 @@ static int h1_recv(struct h1c *h1c)
 	size_t ret = 0, max;
 	int rcvd = 0;
 	int flags = 0;
+	int ahead;
 
 	TRACE_ENTER(H1_EV_H1C_RECV, h1c->conn);
 
@@ -2025,6 +2117,8 @@ static int h1_recv(struct h1c *h1c)
 	if (b_data(&h1c->ibuf) > 0 && b_data(&h1c->ibuf) < 128)
 		b_slow_realign(&h1c->ibuf, trash.area, 0);
 
+	ahead = h1_reading_ahead(h1c, h1s);
+
 	/* avoid useless reads after first responses */
 	if (h1s && (h1s->req.state == H1_MSG_RQBEFORE || h1s->res.state == H1_MSG_RPBEFORE))
 		flags |= CO_RFL_READ_ONCE;
@@ -2048,7 +2142,9 @@ static int h1_recv(struct h1c *h1c)
 	if (ret > 0) {
 		TRACE_DATA("data received", H1_EV_H1C_RECV, h1c->conn,,, (size_t[]){ret});
 		rcvd = 1;
-		if (h1s && h1s->cs) {
+		if (ahead)
+			TRACE_STATE("pipelined data read ahead", H1_EV_H1C_RECV, h1c->conn, h1s);
+		else if (h1s && h1s->cs) {
 			h1s->cs->flags |= (CS_FL_READ_PARTIAL|CS_FL_RCV_MORE);
 			if (h1s->csinfo.t_idle == -1)
 				h1s->csinfo.t_idle = tv_ms_elapsed(&h1s->csinfo.tv_create, &now) - h1s->csinfo.t_handshake;
@@ -2064,6 +2160,9 @@ static int h1_recv(struct h1c *h1c)
 	conn->xprt->subscribe(conn, conn->xprt_ctx, SUB_RETRY_RECV, &h1c->wait_event);
 
   end:
+	if (h1_reading_ahead(h1c, h1s) && !(conn->flags & CO_FL_ERROR))
+		goto skip_stream;
+
 	if (ret > 0 || (conn->flags & CO_FL_ERROR) || conn_xprt_read0_pending(conn))
 		h1_wake_stream_for_recv(h1s);
 
@@ -2073,6 +2172,7 @@ static int h1_recv(struct h1c *h1c)
 		rcvd = 1;
 	}
 
+  skip_stream:
 	if (!b_data(&h1c->ibuf))
 		h1_release_buf(h1c, &h1c->ibuf);
 	else if (!buf_room_for_htx_data(&h1c->ibuf)) {
@@ -2165,8 +2265,13 @@ static int h1_process(struct h1c * h1c)
 		return -1;
 
 	if (!h1s) {
+		/* pipelined requests read ahead before a read0 are still
+		 * processed, the read0 is reported once they are parsed.
+		 */
 		if (h1c->flags & (H1C_F_CS_ERROR|H1C_F_CS_SHUTDOWN) ||
-		    conn->flags & (CO_FL_ERROR|CO_FL_SOCK_RD_SH|CO_FL_SOCK_WR_SH))
+		    conn->flags & (CO_FL_ERROR|CO_FL_SOCK_WR_SH) ||
+		    ((conn->flags & CO_FL_SOCK_RD_SH) &&
+		     (conn_is_back(conn) || !(h1c->flags & H1C_F_CS_IDLE) || !b_data(&h1c->ibuf))))
 			goto release;
 		if (!conn_is_back(conn) && (h1c->flags & H1C_F_CS_IDLE)) {
 			TRACE_STATE("K/A incoming connection, create new H1 stream", H1_EV_H1C_WAKE, conn);
@@ -2181,7 +2286,7 @@ static int h1_process(struct h1c * h1c)
 	if (b_data(&h1c->ibuf) && h1s->csinfo.t_idle == -1)
 		h1s->csinfo.t_idle = tv_ms_elapsed(&h1s->csinfo.tv_create, &now) - h1s->csinfo.t_handshake;
 
-	if (conn_xprt_read0_pending(conn)) {
+	if (conn_xprt_read0_pending(conn) && !h1_reading_ahead(h1c, h1s)) {
 		h1s->flags |= H1S_F_REOS;
 		TRACE_STATE("read0 on connection", H1_EV_H1C_RECV, conn, h1s);
 	}
@@ -2759,7 +2864,11 @@ static int h1_rcv_pipe(struct conn_stream *cs, struct pipe *pipe, unsigned int c
 
 	TRACE_ENTER(H1_EV_STRM_RECV, cs->conn, h1s,, (size_t[]){count});
 
-	if ((h1m->flags & H1_MF_CHNK) || (h1m->state != H1_MSG_DATA && h1m->state != H1_MSG_TUNNEL)) {
+	/* chunked messages are only spliced inside the chunks, the chunks
+	 * envelopes are parsed from the input buffer.
+	 */
+	if ((h1m->state != H1_MSG_DATA && h1m->state != H1_MSG_TUNNEL) ||
+	    ((h1m->flags & H1_MF_CHNK) && !h1m->curr_len)) {
 		h1s->flags &= ~(H1S_F_BUF_FLUSH|H1S_F_SPLICED_DATA);
 		TRACE_STATE("disable splicing on !(msg_data|msg_tunnel)", H1_EV_STRM_RECV, cs->conn, h1s);
 		if (!(h1s->h1c->wait_event.events & SUB_RETRY_RECV)) {
@@ -2786,6 +2895,11 @@ static int h1_rcv_pipe(struct conn_stream *cs, struct pipe *pipe, unsigned int c
 		if (!h1m->curr_len) {
 			h1s->flags &= ~(H1S_F_BUF_FLUSH|H1S_F_SPLICED_DATA);
 			TRACE_STATE("disable splicing on !curr_len", H1_EV_STRM_RECV, cs->conn, h1s);
+			if ((h1m->flags & H1_MF_CHNK) && !(h1s->h1c->wait_event.events & SUB_RETRY_RECV)) {
+				/* the next chunk size must be read */
+				TRACE_STATE("end of chunk, subscribing", H1_EV_STRM_RECV, cs->conn, h1s);
+				cs->conn->xprt->subscribe(cs->conn, cs->conn->xprt_ctx, SUB_RETRY_RECV, &h1s->h1c->wait_event);
+			}
 		}
 	}
 
@@ -2806,14 +2920,62 @@ static int h1_rcv_pipe(struct conn_stream *cs, struct pipe *pipe, unsigned int c
 static int h1_snd_pipe(struct conn_stream *cs, struct pipe *pipe)
 {
 	struct h1s *h1s = cs->ctx;
+	struct h1c *h1c = h1s->h1c;
+	struct h1m *h1m = (!conn_is_back(cs->conn) ? &h1s->res : &h1s->req);
 	int ret = 0;
 
 	TRACE_ENTER(H1_EV_STRM_SEND, cs->conn, h1s,, (size_t[]){pipe->data});
 
-	if (b_data(&h1s->h1c->obuf))
+	if (b_data(&h1c->obuf) || !pipe->data)
+		goto end;
+
+	if (!(h1m->flags & H1_MF_CHNK)) {
+		ret = cs->conn->xprt->snd_pipe(cs->conn, cs->conn->xprt_ctx, pipe);
 		goto end;
+	}
+
+	/* The output message is chunked: the spliced data are sent in chunks
+	 * of the size of the pipe's contents when they are started. The chunk
+	 * size is emitted before, preceded by the CRLF ending the previous
+	 * chunk if any. The CRLF ending the last one is emitted with the next
+	 * data or the last chunk.
+	 */
+	if (!h1s->spliced_chk) {
+		char chksz[32];
+		int len;
+
+		if (!h1_get_buf(h1c, &h1c->obuf)) {
+			h1c->flags |= H1C_F_OUT_ALLOC;
+			TRACE_STATE("waiting for h1c obuf allocation", H1_EV_STRM_SEND|H1_EV_H1S_BLK, cs->conn, h1s);
+			goto end;
+		}
+
+		len = snprintf(chksz, sizeof(chksz), "%s%x\r\n",
+			       (h1s->flags & H1S_F_SPLICED_CRLF) ? "\r\n" : "", pipe->data);
+		b_putblk(&h1c->obuf, chksz, len);
+		h1s->flags &= ~H1S_F_SPLICED_CRLF;
+		h1s->spliced_chk = pipe->data;
+		TRACE_PROTO("sending spliced chunk size", H1_EV_STRM_SEND, cs->conn, h1s,, (size_t[]){h1s->spliced_chk});
+		h1_send(h1c);
+		if (b_data(&h1c->obuf))
+			goto end;
+	}
+
+	if (pipe->data > h1s->spliced_chk) {
+		/* only send the current chunk */
+		int extra = pipe->data - h1s->spliced_chk;
+
+		pipe->data -= extra;
+		ret = cs->conn->xprt->snd_pipe(cs->conn, cs->conn->xprt_ctx, pipe);
+		pipe->data += extra;
+	}
+	else
+		ret = cs->conn->xprt->snd_pipe(cs->conn, cs->conn->xprt_ctx, pipe);
+
+	h1s->spliced_chk -= ret;
+	if (!h1s->spliced_chk)
+		h1s->flags |= H1S_F_SPLICED_CRLF;
 
-	ret = cs->conn->xprt->snd_pipe(cs->conn, cs->conn->xprt_ctx, pipe);
   end:
 	if (pipe->data) {
 		if (!(h1s->h1c->wait_event.events & SUB_RETRY_SEND)) {
@@ -3093,10 +3255,30 @@ static int cfg_parse_h1_headers_case_adjust_file(char **args, int section_type,
 }
 
 
+/* config parser for global "tune.h1.pipeline-read-ahead" */
+static int cfg_parse_h1_pipeline_read_ahead(char **args, int section_type, struct proxy *curpx,
+					    struct proxy *defpx, const char *file, int line,
+					    char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		h1_pipeline_read_ahead = 1;
+	else if (strcmp(args[1], "off") == 0)
+		h1_pipeline_read_ahead = 0;
+	else {
+		memprintf(err, "'%s' expects 'on' or 'off' as argument.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {{ }, {
 		{ CFG_GLOBAL, "h1-case-adjust", cfg_parse_h1_header_case_adjust },
 		{ CFG_GLOBAL, "h1-case-adjust-file", cfg_parse_h1_headers_case_adjust_file },
+		{ CFG_GLOBAL, "tune.h1.pipeline-read-ahead", cfg_parse_h1_pipeline_read_ahead },
 		{ 0, NULL, NULL },
 	}
 };
@@ -65,6 +65,15 @@ static const struct h2s *h2_idle_stream;
 #define H2_CF_WAIT_FOR_HS       0x00004000  // We did check that at least a stream was waiting for handshake
 #define H2_CF_IS_BACK           0x00008000  // this is an outgoing connection
 #define H2_CF_WINDOW_OPENED     0x00010000 // demux increased window already advertised
+#define H2_CF_SND_DEFERRED      0x00020000 // the last flush was deferred to let notified streams fill mbuf
+#define H2_CF_BDP_PING          0x00040000 // a PING was sent to estimate the BDP, waiting for its ACK
+#define H2_CF_NOTSENT_LOWAT     0x00080000 // the socket uses TCP_NOTSENT_LOWAT, limit the DATA queued in mbuf
+
+/* Below this amount of pending output data, a flush may be deferred by one
+ * tasklet pass when some streams were notified and did not send yet, so that
+ * their frames are merged into the same TLS record and the same syscall.
+ */
+#define H2_SND_COALESCE_MAX     16384
 
 /* H2 connection state, in h2c->st0 */
 enum h2_cs {
@@ -96,9 +105,13 @@ struct h2c {
 	int32_t max_id; /* highest ID known on this connection, <0 before preface */
 	uint32_t rcvd_c; /* newly received data to ACK for the connection */
 	uint32_t rcvd_s; /* newly received data to ACK for the current stream (dsi) */
+	uint32_t rxw; /* receive window granted to each stream, grown by autotuning */
+	uint32_t bdp; /* data received since the last BDP ping was sent */
+	uint32_t rtt; /* last RTT measured by a BDP ping, in milliseconds */
 
 	/* states for the demux direction */
 	struct hpack_dht *ddht; /* demux dynamic header table */
+	struct hpack_edht *edht; /* mux dynamic header table (frontend only), or NULL */
 	struct buffer dbuf;    /* demux buffer */
 
 	int32_t dsi; /* demux stream ID (<0 = idle) */
@@ -201,6 +214,7 @@ struct h2s {
 	int32_t id; /* stream ID */
 	uint32_t flags;      /* H2_SF_* */
 	int sws;             /* stream window size, to be added to the mux's initial window size */
+	uint32_t rxw;        /* receive window granted to the peer for this stream */
 	enum h2_err errcode; /* H2 err code (H2_ERR_*) */
 	enum h2_ss st;
 	uint16_t status;     /* HTTP response status */
@@ -382,6 +396,9 @@ DECLARE_STATIC_POOL(pool_head_h2c, "h2c", sizeof(struct h2c));
 /* the h2s stream pool */
 DECLARE_STATIC_POOL(pool_head_h2s, "h2s", sizeof(struct h2s));
 
+/* the encoder-side dynamic header tables */
+DECLARE_STATIC_POOL(pool_head_hpack_edht, "hpack_edht", sizeof(struct hpack_edht));
+
 /* The default connection window size is 65535, it may only be enlarged using
  * a WINDOW_UPDATE message. Since the window must never be larger than 2G-1,
  * we'll pretend we already received the difference between the two to send
@@ -389,14 +406,27 @@ DECLARE_STATIC_POOL(pool_head_h2s, "h2s", sizeof(struct h2s));
  */
 #define H2_INITIAL_WINDOW_INCREMENT ((1U<<31)-1 - 65535)
 
+/* marker placed in the first half of the payload of the BDP pings, the second
+ * half carrying the date they were sent at.
+ */
+#define H2_BDP_PING_MARK 0x48324244 /* "H2BD" */
+
 /* maximum amount of data we're OK with re-aligning for buffer optimizations */
 #define MAX_DATA_REALIGN 1024
 
 /* a few settings from the global section */
 static int h2_settings_header_table_size      =  4096; /* initial value */
+static int h2_settings_encoder_table_size     =  4096; /* 0 = no dynamic table for responses */
 static int h2_settings_initial_window_size    = 65535; /* initial value */
 static unsigned int h2_settings_max_concurrent_streams = 100;
 static int h2_settings_max_frame_size         = 0;     /* unset */
+static int h2_settings_max_window_size        = 0;     /* 0 = no window autotuning */
+static unsigned int h2_settings_max_window_mem = 0;    /* 0 = unlimited */
+
+/* total amount of receive window granted by autotuning above the initial one,
+ * on all connections.
+ */
+static unsigned int h2_window_mem = 0;
 
 /* a dmumy closed stream */
 static const struct h2s *h2_closed_stream = &(const struct h2s){
@@ -648,7 +678,7 @@ static int h2_buf_available(void *target)
 	struct h2c *h2c = target;
 	struct h2s *h2s;
 
-	if ((h2c->flags & H2_CF_DEM_DALLOC) && b_alloc_margin(&h2c->dbuf, 0)) {
+	if ((h2c->flags & H2_CF_DEM_DALLOC) && b_alloc_small_margin(&h2c->dbuf, 0)) {
 		h2c->flags &= ~H2_CF_DEM_DALLOC;
 		h2c_restart_reading(h2c, 1);
 		return 1;
@@ -688,6 +718,22 @@ static inline struct buffer *h2_get_buf(struct h2c *h2c, struct buffer *bptr)
 	return buf;
 }
 
+/* Same as h2_get_buf() for the demux buffer, which starts small when small
+ * buffers are enabled and is grown by h2_recv() once full.
+ */
+static inline struct buffer *h2_get_dbuf(struct h2c *h2c)
+{
+	struct buffer *buf = NULL;
+
+	if (likely(!MT_LIST_ADDED(&h2c->buf_wait.list)) &&
+	    unlikely((buf = b_alloc_small_margin(&h2c->dbuf, 0)) == NULL)) {
+		h2c->buf_wait.target = h2c;
+		h2c->buf_wait.wakeup_cb = h2_buf_available;
+		MT_LIST_ADDQ(&buffer_wq, &h2c->buf_wait.list);
+	}
+	return buf;
+}
+
 static inline void h2_release_buf(struct h2c *h2c, struct buffer *bptr)
 {
 	if (bptr->size) {
@@ -772,6 +818,43 @@ static int h2_avail_streams(struct connection *conn)
 /* functions below are dedicated to the mux setup and management */
 /*****************************************************************/
 
+/* Allocates the encoder-side dynamic header table of a frontend connection.
+ * Returns NULL if it is disabled or if memory is lacking, in which case the
+ * responses are only encoded using the static table.
+ */
+static struct hpack_edht *h2_edht_alloc()
+{
+	struct hpack_edht *edht;
+	struct hpack_dht *dht;
+
+	if (!h2_settings_encoder_table_size)
+		return NULL;
+
+	edht = pool_alloc(pool_head_hpack_edht);
+	if (!edht)
+		return NULL;
+
+	dht = hpack_dht_alloc();
+	if (!dht) {
+		pool_free(pool_head_hpack_edht, edht);
+		return NULL;
+	}
+
+	/* the table cannot be larger than the allocated area */
+	hpack_edht_init(edht, dht, MIN(h2_settings_encoder_table_size, h2_settings_header_table_size));
+	return edht;
+}
+
+/* Releases the encoder-side dynamic header table <edht> if not NULL */
+static void h2_edht_free(struct hpack_edht *edht)
+{
+	if (!edht)
+		return;
+	hpack_edht_deinit(edht);
+	hpack_dht_free(edht->dht);
+	pool_free(pool_head_hpack_edht, edht);
+}
+
 /* Initialize the mux once it's attached. For outgoing connections, the context
  * is already initialized before installing the mux, so we detect incoming
  * connections from the fact that the context is still NULL (even during mux
@@ -803,6 +886,14 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 			h2c->shut_timeout = prx->timeout.clientfin;
 	}
 
+	/* when the kernel is told to keep little unsent data, we must do the
+	 * same and let DATA wait in the streams' buffers where they may still
+	 * be prioritized or aborted.
+	 */
+	if ((objt_listener(conn->target) && __objt_listener(conn->target)->notsent_lowat) ||
+	    (objt_server(conn->target) && __objt_server(conn->target)->notsent_lowat))
+		h2c->flags |= H2_CF_NOTSENT_LOWAT;
+
 	h2c->proxy = prx;
 	h2c->task = NULL;
 	if (tick_isset(h2c->timeout)) {
@@ -827,6 +918,10 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	if (!h2c->ddht)
 		goto fail;
 
+	h2c->edht = NULL;
+	if (!(h2c->flags & H2_CF_IS_BACK))
+		h2c->edht = h2_edht_alloc();
+
 	/* Initialise the context. */
 	h2c->st0 = H2_CS_PREFACE;
 	h2c->conn = conn;
@@ -835,6 +930,9 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	h2c->errcode = H2_ERR_NO_ERROR;
 	h2c->rcvd_c = 0;
 	h2c->rcvd_s = 0;
+	h2c->rxw = h2_settings_initial_window_size;
+	h2c->bdp = 0;
+	h2c->rtt = 0;
 	h2c->nb_streams = 0;
 	h2c->nb_cs = 0;
 	h2c->nb_reserved = 0;
@@ -880,6 +978,7 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	return 0;
   fail_stream:
 	hpack_dht_free(h2c->ddht);
+	h2_edht_free(h2c->edht);
   fail:
 	task_destroy(t);
 	if (h2c->wait_event.tasklet)
@@ -936,7 +1035,10 @@ static void h2_release(struct h2c *h2c)
 			conn = h2c->conn;
 
 		TRACE_DEVEL("freeing h2c", H2_EV_H2C_END, conn);
+		if (h2c->rxw > h2_settings_initial_window_size)
+			_HA_ATOMIC_SUB(&h2_window_mem, h2c->rxw - h2_settings_initial_window_size);
 		hpack_dht_free(h2c->ddht);
+		h2_edht_free(h2c->edht);
 
 		if (MT_LIST_ADDED(&h2c->buf_wait.list))
 			MT_LIST_DEL(&h2c->buf_wait.list);
@@ -1300,6 +1402,7 @@ static struct h2s *h2s_new(struct h2c *h2c, int id)
 	h2s->h2c       = h2c;
 	h2s->cs        = NULL;
 	h2s->sws       = 0;
+	h2s->rxw       = h2_settings_initial_window_size;
 	h2s->flags     = H2_SF_NONE;
 	h2s->errcode   = H2_ERR_NO_ERROR;
 	h2s->st        = H2_SS_IDLE;
@@ -2027,6 +2130,13 @@ static int h2c_handle_settings(struct h2c *h2c)
 			}
 			h2c->mfs = arg;
 			break;
+		case H2_SETTINGS_HEADER_TABLE_SIZE:
+			/* our encoder follows the size the peer's decoder
+			 * supports, with our own limit.
+			 */
+			if (h2c->edht)
+				hpack_edht_set_size(h2c->edht, (uint32_t)arg);
+			break;
 		case H2_SETTINGS_ENABLE_PUSH:
 			if (arg < 0 || arg > 1) { // RFC7540#6.5.2
 				error = H2_ERR_PROTOCOL_ERROR;
@@ -2105,6 +2215,40 @@ static int h2c_ack_settings(struct h2c *h2c)
 	return ret;
 }
 
+/* Updates the receive window granted to the streams of connection <h2c> once
+ * the ACK of the BDP ping was received, <rtt> milliseconds after it was sent.
+ * The amount of data received in the mean time is an estimate of the BDP. If
+ * the peer managed to fill more than 2/3 of the window during this time, the
+ * window is likely the bottleneck and it is set to twice the measured BDP,
+ * within the limits of tune.h2.max-window-size and tune.h2.max-window-mem.
+ * The streams get the extra window with their next WINDOW_UPDATE frame.
+ */
+static void h2c_update_rxw(struct h2c *h2c, uint32_t rtt)
+{
+	uint64_t target;
+	uint32_t grow;
+
+	h2c->flags &= ~H2_CF_BDP_PING;
+	h2c->rtt = rtt;
+
+	if ((uint64_t)h2c->bdp * 3 < (uint64_t)h2c->rxw * 2)
+		return;
+
+	target = MIN((uint64_t)h2c->bdp * 2, (uint64_t)h2_settings_max_window_size);
+	if (target <= h2c->rxw)
+		return;
+
+	grow = target - h2c->rxw;
+	if (_HA_ATOMIC_ADD(&h2_window_mem, grow) > h2_settings_max_window_mem &&
+	    h2_settings_max_window_mem) {
+		_HA_ATOMIC_SUB(&h2_window_mem, grow);
+		return;
+	}
+
+	TRACE_STATE("growing stream receive window", H2_EV_RX_FRAME|H2_EV_RX_PING, h2c->conn,,, (void *)(long)target);
+	h2c->rxw = target;
+}
+
 /* processes a PING frame and schedules an ACK if needed. The caller must pass
  * the pointer to the payload in <payload>. Returns > 0 on success or zero on
  * missing data. The caller must have already verified frame length
@@ -2112,9 +2256,24 @@ static int h2c_ack_settings(struct h2c *h2c)
  */
 static int h2c_handle_ping(struct h2c *h2c)
 {
+	char str[8];
+
 	/* schedule a response */
-	if (!(h2c->dff & H2_F_PING_ACK))
+	if (!(h2c->dff & H2_F_PING_ACK)) {
 		h2c->st0 = H2_CS_FRAME_A;
+		return 1;
+	}
+
+	if (!(h2c->flags & H2_CF_BDP_PING))
+		return 1;
+
+	if (b_data(&h2c->dbuf) < 8)
+		return 0;
+
+	/* this may be the ACK of our BDP ping */
+	h2_get_buf_bytes(str, 8, &h2c->dbuf, 0);
+	if (read_n32(str) == H2_BDP_PING_MARK)
+		h2c_update_rxw(h2c, (uint32_t)now_ms - read_n32(str + 4));
 	return 1;
 }
 
@@ -2272,6 +2431,45 @@ static int h2c_ack_ping(struct h2c *h2c)
 	return ret;
 }
 
+/* try to send a PING frame used to estimate the BDP, its payload is made of
+ * H2_BDP_PING_MARK followed by the current date. This frame is optional, so
+ * it is only sent if it fits into the current mux buffer, and it never blocks
+ * the demux. Returns > 0 on success, otherwise 0.
+ */
+static int h2c_send_bdp_ping(struct h2c *h2c)
+{
+	struct buffer *res;
+	char str[17];
+	int ret = 0;
+
+	TRACE_ENTER(H2_EV_TX_FRAME|H2_EV_TX_PING, h2c->conn);
+
+	if (h2c_mux_busy(h2c, NULL))
+		goto out;
+
+	res = br_tail(h2c->mbuf);
+	if (!b_size(res))
+		goto out;
+
+	memcpy(str,
+	       "\x00\x00\x08"     /* length : 8 */
+	       "\x06" "\x00"      /* type   : 6, flags : none */
+	       "\x00\x00\x00\x00" /* stream ID */, 9);
+	write_n32(str + 9, H2_BDP_PING_MARK);
+	write_n32(str + 13, now_ms);
+
+	ret = b_istput(res, ist2(str, 17));
+	if (ret > 0) {
+		h2c->flags |= H2_CF_BDP_PING;
+		h2c->bdp = 0;
+	}
+	else
+		ret = 0;
+ out:
+	TRACE_LEAVE(H2_EV_TX_FRAME|H2_EV_TX_PING, h2c->conn);
+	return ret;
+}
+
 /* processes a WINDOW_UPDATE frame whose payload is <payload> for <plen> bytes.
  * Returns > 0 on success or zero on missing data. It may return an error in
  * h2c or h2s. The caller must have already verified frame length and stream ID
@@ -3134,6 +3332,13 @@ static void h2_process_demux(struct h2c *h2c)
 			if (h2c->st0 == H2_CS_FRAME_A) {
 				TRACE_PROTO("sending stream WINDOW_UPDATE frame", H2_EV_TX_FRAME|H2_EV_TX_WU, h2c->conn, h2s);
 				ret = h2c_send_strm_wu(h2c);
+
+				/* start a new BDP measurement if the window may still grow */
+				if (ret > 0 && h2c->rxw < h2_settings_max_window_size &&
+				    !(h2c->flags & H2_CF_BDP_PING)) {
+					TRACE_PROTO("sending H2 BDP PING frame", H2_EV_TX_FRAME|H2_EV_TX_PING, h2c->conn, h2s);
+					h2c_send_bdp_ping(h2c);
+				}
 			}
 			break;
 
@@ -3274,6 +3479,51 @@ static void h2_resume_each_sending_h2s(struct h2c *h2c, struct list *head)
 	TRACE_LEAVE(H2_EV_H2C_SEND|H2_EV_H2S_WAKE, h2c->conn);
 }
 
+/* Returns non-zero if at least one stream of <head> was notified it could send
+ * and did not get a chance to do it yet.
+ */
+static inline int h2_have_notified_senders(const struct list *head)
+{
+	const struct h2s *h2s;
+
+	list_for_each_entry(h2s, head, list) {
+		if (h2s->flags & H2_SF_NOTIFIED)
+			return 1;
+	}
+	return 0;
+}
+
+/* Decides whether the flush of the output data may be deferred by one tasklet
+ * pass. This is only done once in a row, when the connection is healthy, less
+ * than H2_SND_COALESCE_MAX bytes are pending in a single mux buffer and some
+ * streams which were notified they could send are expected to run before the
+ * connection's tasklet. Returns non-zero if the flush must be deferred, in
+ * which case the tasklet was woken up. As long as the tasklet is still queued,
+ * subsequent calls are deferred as well.
+ */
+static int h2_defer_send(struct h2c *h2c)
+{
+	struct buffer *buf = br_head(h2c->mbuf);
+
+	if (h2c->flags & H2_CF_SND_DEFERRED)
+		return !LIST_ISEMPTY(&h2c->wait_event.tasklet->list);
+
+	if (h2c->flags & (H2_CF_MUX_BLOCK_ANY | H2_CF_DEM_MROOM) ||
+	    h2c->st0 >= H2_CS_ERROR || h2c->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_WR_SH))
+		return 0;
+
+	if (br_head_idx(h2c->mbuf) != br_tail_idx(h2c->mbuf) || !b_data(buf) || b_data(buf) >= H2_SND_COALESCE_MAX)
+		return 0;
+
+	if (!h2_have_notified_senders(&h2c->send_list) &&
+	    !h2_have_notified_senders(&h2c->fctl_list))
+		return 0;
+
+	h2c->flags |= H2_CF_SND_DEFERRED;
+	tasklet_wakeup(h2c->wait_event.tasklet);
+	return 1;
+}
+
 /* process Tx frames from streams to be multiplexed. Returns > 0 if it reached
  * the end.
  */
@@ -3357,7 +3607,7 @@ static int h2_recv(struct h2c *h2c)
 		return 1;
 	}
 
-	buf = h2_get_buf(h2c, &h2c->dbuf);
+	buf = h2_get_dbuf(h2c);
 	if (!buf) {
 		h2c->flags |= H2_CF_DEM_DALLOC;
 		TRACE_DEVEL("leaving on !alloc", H2_EV_H2C_RECV, h2c->conn);
@@ -3382,6 +3632,14 @@ static int h2_recv(struct h2c *h2c)
 
 	ret = max ? conn->xprt->rcv_buf(conn, conn->xprt_ctx, buf, max, 0) : 0;
 
+	if (ret && b_full(buf) && b_is_small(buf) && b_grow_margin(buf, 0)) {
+		/* the frames don't fit in a small buffer, continue with a
+		 * regular one. It will be released once empty.
+		 */
+		TRACE_STATE("demux buffer grown", H2_EV_H2C_RECV, h2c->conn);
+		ret += conn->xprt->rcv_buf(conn, conn->xprt_ctx, buf, b_room(buf), 0);
+	}
+
 	if (max && !ret && h2_recv_allowed(h2c)) {
 		TRACE_DATA("failed to receive data, subscribing", H2_EV_H2C_RECV, h2c->conn);
 		conn->xprt->subscribe(conn, conn->xprt_ctx, SUB_RETRY_RECV, &h2c->wait_event);
@@ -3441,6 +3699,12 @@ static int h2_send(struct h2c *h2c)
 	 * but that would be problematic for ACKs until we have an absolute
 	 * guarantee that all waiters have at least one byte to send. The
 	 * latter should possibly not be set for now.
+	 *
+	 * Before the first send of a pass, a small amount of pending data may
+	 * be kept for one more tasklet pass when streams were notified and
+	 * are about to produce their frames (see h2_defer_send()). The usual
+	 * case is a series of small responses on many streams, which then go
+	 * out in a single TLS record instead of one per stream.
 	 */
 
 	done = 0;
@@ -3459,7 +3723,14 @@ static int h2_send(struct h2c *h2c)
 		if (conn->flags & CO_FL_ERROR)
 			break;
 
-		if (h2c->flags & (H2_CF_MUX_MFULL | H2_CF_DEM_MBUSY | H2_CF_DEM_MROOM))
+		if (!sent && h2_defer_send(h2c)) {
+			TRACE_DEVEL("leaving with output deferred", H2_EV_H2C_SEND, h2c->conn);
+			return 0;
+		}
+		h2c->flags &= ~H2_CF_SND_DEFERRED;
+
+		if (h2c->flags & (H2_CF_MUX_MFULL | H2_CF_DEM_MBUSY | H2_CF_DEM_MROOM) ||
+		    br_head_idx(h2c->mbuf) != br_tail_idx(h2c->mbuf))
 			flags |= CO_SFL_MSG_MORE;
 
 		for (buf = br_head(h2c->mbuf); b_size(buf); buf = br_del_head(h2c->mbuf)) {
@@ -3660,8 +3931,9 @@ static int h2_process(struct h2c *h2c)
 	    h2c->st0 == H2_CS_ERROR2 || (h2c->flags & H2_CF_GOAWAY_FAILED) ||
 	    (h2c->st0 != H2_CS_ERROR &&
 	     !br_data(h2c->mbuf) &&
-	     (h2c->mws <= 0 || LIST_ISEMPTY(&h2c->fctl_list)) &&
-	     ((h2c->flags & H2_CF_MUX_BLOCK_ANY) || LIST_ISEMPTY(&h2c->send_list))))
+	     (unlikely(pool_mem_pressure) ||
+	      ((h2c->mws <= 0 || LIST_ISEMPTY(&h2c->fctl_list)) &&
+	       ((h2c->flags & H2_CF_MUX_BLOCK_ANY) || LIST_ISEMPTY(&h2c->send_list))))))
 		h2_release_mbuf(h2c);
 
 	if (h2c->task) {
@@ -4495,6 +4767,55 @@ next_frame:
 	goto done;
 }
 
+/* Tries to turn the demux buffer into the rxbuf of stream <h2s> when the latter
+ * is empty and the payload of the current DATA frame sits where the DATA block
+ * of an HTX message would be, as prepared by h2_recv(). This also works for the
+ * beginning of a frame larger than the buffer. The few bytes following the
+ * payload, if any, are moved to a new demux buffer, which is the former empty
+ * rxbuf when it was allocated. This way the payload is not copied at all. Only
+ * regular buffers are swapped. Returns the number of payload bytes now present
+ * in the stream's rxbuf, or zero if nothing was done.
+ */
+static unsigned int h2_frt_xfer_dbuf(struct h2s *h2s)
+{
+	struct h2c *h2c = h2s->h2c;
+	struct buffer *dbuf = &h2c->dbuf;
+	struct buffer nbuf = BUF_NULL;
+	size_t ofs = b_head_ofs(dbuf);
+	unsigned int flen, left;
+
+	if (b_data(&h2s->rxbuf) || !b_data(dbuf) || b_is_small(dbuf))
+		return 0;
+
+	flen = MIN(h2c->dfl - h2c->dpl, b_data(dbuf));
+	left = b_data(dbuf) - flen;
+	if (!flen || left >= flen || left > MAX_DATA_REALIGN)
+		return 0;
+
+	if (ofs < sizeof(struct htx) ||
+	    ofs + flen + 2 * sizeof(struct htx_blk) > b_size(dbuf))
+		return 0;
+
+	if (b_size(&h2s->rxbuf)) {
+		nbuf = h2s->rxbuf;
+		b_reset(&nbuf);
+	}
+	else if (left && !b_alloc_margin(&nbuf, 0))
+		return 0;
+
+	if (left) {
+		/* pre-align the next frame like h2_recv() does */
+		nbuf.head = sizeof(struct htx) - 9;
+		b_getblk(dbuf, b_head(&nbuf), left, flen);
+		b_set_data(&nbuf, left);
+	}
+
+	h2s->rxbuf = *dbuf;
+	*dbuf = nbuf;
+	htx_from_buf_data(&h2s->rxbuf, ofs, flen);
+	return flen;
+}
+
 /* Transfer the payload of a DATA frame to the HTTP/1 side. The HTTP/2 frame
  * parser state is automatically updated. Returns > 0 if it could completely
  * send the current frame, 0 if it couldn't complete, in which case
@@ -4517,6 +4838,14 @@ static int h2_frt_transfer_data(struct h2s *h2s)
 
 	h2c->flags &= ~H2_CF_DEM_SFULL;
 
+	sent = h2_frt_xfer_dbuf(h2s);
+	if (sent) {
+		TRACE_DATA("move demux buffer to h2s rxbuf", H2_EV_RX_FRAME|H2_EV_RX_DATA, h2c->conn, h2s,, (void *)(long)sent);
+		csbuf = &h2s->rxbuf;
+		htx = htxbuf(csbuf);
+		goto transferred;
+	}
+
 	csbuf = h2_get_buf(h2c, &h2s->rxbuf);
 	if (!csbuf) {
 		h2c->flags |= H2_CF_DEM_SALLOC;
@@ -4554,9 +4883,11 @@ try_again:
 	TRACE_DATA("move some data to h2s rxbuf", H2_EV_RX_FRAME|H2_EV_RX_DATA, h2c->conn, h2s,, (void *)(long)sent);
 
 	b_del(&h2c->dbuf, sent);
+ transferred:
 	h2c->dfl    -= sent;
 	h2c->rcvd_c += sent;
 	h2c->rcvd_s += sent;  // warning, this can also affect the closed streams!
+	h2c->bdp    += sent;
 
 	if (h2s->flags & H2_SF_DATA_CLEN) {
 		h2s->body_len -= sent;
@@ -4587,6 +4918,12 @@ try_again:
 	h2c->rcvd_c += h2c->dpl;
 	h2c->rcvd_s += h2c->dpl;
 	h2c->dpl = 0;
+
+	/* grant the stream the extra window obtained by autotuning */
+	if (h2s->rxw < h2c->rxw && !(h2c->dff & H2_F_DATA_END_STREAM)) {
+		h2c->rcvd_s += h2c->rxw - h2s->rxw;
+		h2s->rxw = h2c->rxw;
+	}
 	h2c->st0 = H2_CS_FRAME_A; // send the corresponding window update
 	htx_to_buf(htx, csbuf);
 	TRACE_LEAVE(H2_EV_RX_FRAME|H2_EV_RX_DATA, h2c->conn, h2s);
@@ -4716,8 +5053,17 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	/* the dynamic table changes are undone if the frame is not sent */
+	if (h2c->edht && !hpack_edht_start(h2c->edht, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode status, which necessarily is the first one */
-	if (!hpack_encode_int_status(&outbuf, h2s->status)) {
+	if (!(h2c->edht ?
+	      hpack_edht_encode_int_status(h2c->edht, &outbuf, h2s->status) :
+	      hpack_encode_int_status(&outbuf, h2s->status))) {
 		if (b_space_wraps(mbuf))
 			goto realign_again;
 		goto full;
@@ -4740,7 +5086,9 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 		if (isteq(list[hdr].n, ist("")))
 			break; // end
 
-		if (!hpack_encode_header(&outbuf, list[hdr].n, list[hdr].v)) {
+		if (!(h2c->edht ?
+		      hpack_edht_encode_header(h2c->edht, &outbuf, list[hdr].n, list[hdr].v) :
+		      hpack_encode_header(&outbuf, list[hdr].n, list[hdr].v))) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -4777,6 +5125,8 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_USER("sent H2 response", H2_EV_TX_FRAME|H2_EV_TX_HDR, h2c->conn, h2s, htx);
 	b_add(mbuf, outbuf.data);
+	if (h2c->edht)
+		hpack_edht_commit(h2c->edht);
 
 	/* indicates the HEADERS frame was sent, except for 1xx responses. For
 	 * 1xx responses, another HEADERS frame is expected.
@@ -5192,6 +5542,20 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
  * happened subsequently to a successful send. Returns the number of data bytes
  * consumed, or zero if nothing done. Note that EOM count for 1 byte.
  */
+/* Returns a new tail buffer in the connection's mbuf ring to append DATA
+ * frames to, or NULL if none may be used. When the socket uses
+ * TCP_NOTSENT_LOWAT, DATA frames are not allowed to extend the ring once it
+ * already holds other buffers, so that they remain in the streams' buffers
+ * until the kernel is ready to take them.
+ */
+static inline struct buffer *h2_data_tail_add(struct h2c *h2c)
+{
+	if ((h2c->flags & H2_CF_NOTSENT_LOWAT) &&
+	    br_head_idx(h2c->mbuf) != br_tail_idx(h2c->mbuf))
+		return NULL;
+	return br_tail_add(h2c->mbuf);
+}
+
 static size_t h2s_frt_make_resp_data(struct h2s *h2s, struct buffer *buf, size_t count)
 {
 	struct h2c *h2c = h2s->h2c;
@@ -5291,7 +5655,7 @@ static size_t h2s_frt_make_resp_data(struct h2s *h2s, struct buffer *buf, size_t
 				goto copy;
 			}
 
-			if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
+			if ((mbuf = h2_data_tail_add(h2c)) != NULL)
 				goto retry;
 
 			h2c->flags |= H2_CF_MUX_MFULL;
@@ -5336,7 +5700,7 @@ static size_t h2s_frt_make_resp_data(struct h2s *h2s, struct buffer *buf, size_t
 	}
 
 	if (outbuf.size < 9) {
-		if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
+		if ((mbuf = h2_data_tail_add(h2c)) != NULL)
 			goto retry;
 		h2c->flags |= H2_CF_MUX_MFULL;
 		h2s->flags |= H2_SF_BLK_MROOM;
@@ -5399,7 +5763,7 @@ static size_t h2s_frt_make_resp_data(struct h2s *h2s, struct buffer *buf, size_t
 
 		if (fsize <= 0) {
 			/* no need to send an empty frame here */
-			if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
+			if ((mbuf = h2_data_tail_add(h2c)) != NULL)
 				goto retry;
 			h2c->flags |= H2_CF_MUX_MFULL;
 			h2s->flags |= H2_SF_BLK_MROOM;
@@ -5565,6 +5929,13 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	/* the dynamic table changes are undone if the frame is not sent */
+	if (h2c->edht && !hpack_edht_start(h2c->edht, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode all headers */
 	for (idx = 0; idx < hdr; idx++) {
 		/* these ones do not exist in H2 or must not appear in
@@ -5584,7 +5955,9 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 		if (*(list[idx].n.ptr) == ':')
 			continue;
 
-		if (!hpack_encode_header(&outbuf, list[idx].n, list[idx].v)) {
+		if (!(h2c->edht ?
+		      hpack_edht_encode_header(h2c->edht, &outbuf, list[idx].n, list[idx].v) :
+		      hpack_encode_header(&outbuf, list[idx].n, list[idx].v))) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -5618,6 +5991,8 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_PROTO("sent H2 trailers HEADERS frame", H2_EV_TX_FRAME|H2_EV_TX_HDR|H2_EV_TX_EOI, h2c->conn, h2s);
 	b_add(mbuf, outbuf.data);
+	if (h2c->edht)
+		hpack_edht_commit(h2c->edht);
 	h2s->flags |= H2_SF_ES_SENT;
 
 	if (h2s->st == H2_SS_OPEN)
@@ -5952,8 +6327,7 @@ static size_t h2_snd_buf(struct conn_stream *cs, struct buffer *buf, size_t coun
 	if (total > 0) {
 		if (!(h2s->h2c->wait_event.events & SUB_RETRY_SEND))
 			TRACE_DEVEL("data queued, waking up h2c sender", H2_EV_H2S_SEND|H2_EV_H2C_SEND, h2s->h2c->conn, h2s);
-			tasklet_wakeup(h2s->h2c->wait_event.tasklet);
-
+		tasklet_wakeup(h2s->h2c->wait_event.tasklet);
 	}
 	/* If we're waiting for flow control, and we got a shutr on the
 	 * connection, we will never be unlocked, so add an error on
@@ -6015,7 +6389,7 @@ static void h2_show_fd(struct buffer *msg, struct connection *conn)
 	chunk_appendf(msg, " h2c.st0=%s .err=%d .maxid=%d .lastid=%d .flg=0x%04x"
 		      " .nbst=%u .nbcs=%u .fctl_cnt=%d .send_cnt=%d .tree_cnt=%d"
 		      " .orph_cnt=%d .sub=%d .dsi=%d .dbuf=%u@%p+%u/%u .msi=%d"
-		      " .mbuf=[%u..%u|%u],h=[%u@%p+%u/%u],t=[%u@%p+%u/%u]",
+		      " .mbuf=[%u..%u|%u],h=[%u@%p+%u/%u],t=[%u@%p+%u/%u] .rxw=%u .rtt=%u",
 		      h2c_st_to_str(h2c->st0), h2c->errcode, h2c->max_id, h2c->last_sid, h2c->flags,
 		      h2c->nb_streams, h2c->nb_cs, fctl_cnt, send_cnt, tree_cnt, orph_cnt,
 		      h2c->wait_event.events, h2c->dsi,
@@ -6026,7 +6400,8 @@ static void h2_show_fd(struct buffer *msg, struct connection *conn)
 		      (unsigned int)b_data(hmbuf), b_orig(hmbuf),
 		      (unsigned int)b_head_ofs(hmbuf), (unsigned int)b_size(hmbuf),
 		      (unsigned int)b_data(tmbuf), b_orig(tmbuf),
-		      (unsigned int)b_head_ofs(tmbuf), (unsigned int)b_size(tmbuf));
+		      (unsigned int)b_head_ofs(tmbuf), (unsigned int)b_size(tmbuf),
+		      h2c->rxw, h2c->rtt);
 
 	if (h2s) {
 		chunk_appendf(msg, " last_h2s=%p .id=%d .st=%s.flg=0x%04x .rxbuf=%u@%p+%u/%u .cs=%p",
@@ -6104,6 +6479,22 @@ static int h2_parse_header_table_size(char **args, int section_type, struct prox
 	return 0;
 }
 
+/* config parser for global "tune.h2.encoder-table-size" */
+static int h2_parse_encoder_table_size(char **args, int section_type, struct proxy *curpx,
+                                       struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	h2_settings_encoder_table_size = atoi(args[1]);
+	if (h2_settings_encoder_table_size < 0 || h2_settings_encoder_table_size > 65536) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 65536.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "tune.h2.initial-window-size" */
 static int h2_parse_initial_window_size(char **args, int section_type, struct proxy *curpx,
                                         struct proxy *defpx, const char *file, int line,
@@ -6136,6 +6527,40 @@ static int h2_parse_max_concurrent_streams(char **args, int section_type, struct
 	return 0;
 }
 
+/* config parser for global "tune.h2.max-window-size" */
+static int h2_parse_max_window_size(char **args, int section_type, struct proxy *curpx,
+                                    struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	h2_settings_max_window_size = atoi(args[1]);
+	if (h2_settings_max_window_size < 0) {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.h2.max-window-mem" */
+static int h2_parse_max_window_mem(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	res = parse_size_err(args[1], &h2_settings_max_window_mem);
+	if (res) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'", res, args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "tune.h2.max-frame-size" */
 static int h2_parse_max_frame_size(char **args, int section_type, struct proxy *curpx,
                                    struct proxy *defpx, const char *file, int line,
@@ -6187,10 +6612,13 @@ INITCALL1(STG_REGISTER, register_mux_proto, &mux_proto_h2);
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.h2.encoder-table-size",     h2_parse_encoder_table_size     },
 	{ CFG_GLOBAL, "tune.h2.header-table-size",      h2_parse_header_table_size      },
 	{ CFG_GLOBAL, "tune.h2.initial-window-size",    h2_parse_initial_window_size    },
 	{ CFG_GLOBAL, "tune.h2.max-concurrent-streams", h2_parse_max_concurrent_streams },
 	{ CFG_GLOBAL, "tune.h2.max-frame-size",         h2_parse_max_frame_size         },
+	{ CFG_GLOBAL, "tune.h2.max-window-mem",         h2_parse_max_window_mem         },
+	{ CFG_GLOBAL, "tune.h2.max-window-size",        h2_parse_max_window_size        },
 	{ 0, NULL, NULL }
 }};
 
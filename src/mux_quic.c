@@ -11,144 +11,2178 @@
  */
 
 #include <common/config.h>
+#include <common/h3.h>
+#include <common/htx.h>
 #include <common/initcall.h>
+#include <common/qpack-dec.h>
+#include <common/qpack-enc.h>
 #include <proto/connection.h>
+#include <proto/http_rules.h>
+#include <proto/mux_quic.h>
+#include <proto/server.h>
+#include <proto/session.h>
 #include <proto/stream.h>
 #include <proto/task.h>
+#include <proto/xprt_quic.h>
+#include <types/action.h>
+#include <types/global.h>
+#include <types/quic_frame.h>
+#include <types/session.h>
+#include <eb64tree.h>
 
-struct mux_quic_ctx {
-	struct conn_stream *cs;
+/* QUIC stream ID bits (see RFC draft-ietf-quic-transport section 2.1) */
+#define QCS_ID_SRV_INITIATOR_BIT  0x1  /* stream initiated by the server */
+#define QCS_ID_DIR_BIT            0x2  /* unidirectional stream */
+#define QCS_ID_TYPE_MASK          0x3
+#define QCS_ID_TYPE_SHIFT           2
+
+/* Maximum length of the data carried by a STREAM frame, so that it always
+ * fits into a packet whatever the path MTU.
+ */
+#define QCS_STREAM_FRM_MAXLEN    1024
+
+/* QPACK dynamic table capacity and maximum number of blocked streams we
+ * advertise to the HTTP/3 clients.
+ */
+#define QCC_H3_QPACK_MAX_CAP     4096
+#define QCC_H3_QPACK_MAX_BLOCKED   16
+
+/* type of a remote unidirectional stream not received yet */
+#define QCS_H3_TYPE_UNSET        ((uint64_t)-1)
+
+/* qcc flags */
+#define QC_CF_NONE              0x00000000
+#define QC_CF_IS_BACK           0x00000001  /* this is an outgoing connection */
+#define QC_CF_PARAMS_SET        0x00000002  /* local flow control limits initialized */
+#define QC_CF_BLK_MFCTL         0x00000004  /* blocked by the peer connection flow control */
+#define QC_CF_ERROR             0x00000008  /* connection closed by us on error */
+#define QC_CF_H3                0x00000010  /* HTTP/3 application layer (HTX mux) */
+#define QC_CF_H3_RCTRL          0x00000020  /* remote control stream opened */
+#define QC_CF_H3_RENC           0x00000040  /* remote QPACK encoder stream opened */
+#define QC_CF_H3_RDEC           0x00000080  /* remote QPACK decoder stream opened */
+#define QC_CF_H3_SETTINGS       0x00000100  /* SETTINGS frame received */
+
+/* QUIC connection context */
+struct qcc {
 	struct connection *conn;
-	struct wait_event wait_event;
+	uint32_t flags;           /* QC_CF_* */
+	unsigned int nb_streams;  /* number of streams in the tree */
+	unsigned int nb_cs;       /* number of attached conn_streams */
+	struct eb_root streams_by_id; /* all active streams by their ID */
+	struct {
+		uint64_t max_bidi;    /* number of remote bidi streams the peer may open */
+		uint64_t max_uni;     /* number of remote uni streams the peer may open */
+		uint64_t nb_bidi;     /* number of remote bidi streams opened by the peer */
+		uint64_t nb_uni;      /* number of remote uni streams opened by the peer */
+		uint64_t closed_bidi; /* remote bidi streams closed since the last MAX_STREAMS */
+		uint64_t closed_uni;  /* remote uni streams closed since the last MAX_STREAMS */
+		uint64_t max_data;    /* connection flow control limit advertised to the peer */
+		uint64_t offsets;     /* sum of the highest offsets received for all the streams */
+		uint64_t consumed;    /* data consumed by the upper layer for all the streams */
+	} rx;
+	struct {
+		uint64_t max_bidi;    /* number of local bidi streams we may open */
+		uint64_t nb_bidi;     /* number of local bidi streams opened */
+		uint64_t max_uni;     /* number of local uni streams we may open */
+		uint64_t nb_uni;      /* number of local uni streams opened */
+		uint64_t max_data;    /* connection flow control limit from the peer */
+		uint64_t offsets;     /* sum of the data sent for all the streams */
+	} tx;
+	struct {
+		struct qpack_dec dec; /* QPACK decoder fed by the remote encoder stream */
+		struct qcs *ctrl;     /* local control stream */
+		struct qcs *qpdec;    /* local QPACK decoder stream, opened on demand */
+	} h3;
+	struct wait_event wait_event;  /* To be used if we're waiting for I/Os */
 };
 
-DECLARE_STATIC_POOL(pool_head_quic_ctx, "mux_quic", sizeof(struct mux_quic_ctx));
+/* qcs flags */
+#define QC_SF_NONE              0x00000000
+#define QC_SF_FIN_RECV          0x00000001  /* the final size of the stream is known */
+#define QC_SF_FIN_SENT          0x00000002  /* a STREAM frame with FIN bit was emitted */
+#define QC_SF_FIN_ACKED         0x00000004  /* a STREAM frame with FIN bit was acknowledged */
+#define QC_SF_BLK_SFCTL         0x00000008  /* blocked by the peer stream flow control */
+#define QC_SF_RESET             0x00000010  /* reset by the peer */
+#define QC_SF_RESET_SENT        0x00000020  /* a RESET_STREAM frame was emitted */
+#define QC_SF_APP               0x00000040  /* remote uni stream handled by the application layer */
+#define QC_SF_DEM_FULL          0x00000080  /* demux blocked on a full upper layer buffer */
+#define QC_SF_H3_FRAME          0x00000100  /* demuxing the payload of an HTTP/3 frame */
+#define QC_SF_H3_HDRS           0x00000200  /* request headers received */
+#define QC_SF_H3_TLRS           0x00000400  /* request trailers received */
+#define QC_SF_H3_CLEN           0x00000800  /* content-length announced in the request */
+#define QC_SF_H3_BLOCKED        0x00001000  /* HEADERS frame blocked on the QPACK encoder stream */
+#define QC_SF_H3_EOM            0x00002000  /* end of message reported to the upper layer */
+#define QC_SF_H3_PRIO           0x00004000  /* priority updated by a PRIORITY_UPDATE frame */
+#define QC_SF_H3_PRIO_RULE      0x00008000  /* priority set by an http-request rule */
+
+/* Out of order received data or acknowledged ranges */
+struct qcs_frm {
+	struct eb64_node offset_node;
+	uint64_t len;
+	unsigned char data[0];
+};
+
+/* QUIC stream context */
+struct qcs {
+	struct qcc *qcc;
+	struct conn_stream *cs;
+	struct eb64_node by_id;   /* place in qcc's streams_by_id */
+	uint32_t flags;           /* QC_SF_* */
+	struct {
+		struct buffer buf;    /* in order data not yet consumed by the upper layer */
+		struct eb_root frms;  /* out of order data (struct qcs_frm) */
+		uint64_t offset;      /* offset of the next in order data to store in <buf> */
+		uint64_t max_offset;  /* highest offset received */
+		uint64_t final_size;  /* valid with QC_SF_FIN_RECV only */
+		uint64_t consumed;    /* data consumed by the upper layer */
+		uint64_t max_data;    /* stream flow control limit advertised to the peer */
+		uint64_t window;      /* initial value of <max_data> */
+	} rx;
+	struct {
+		struct buffer buf;    /* data sent and not yet acknowledged */
+		uint64_t offset;      /* offset of the next data to send */
+		uint64_t ack_offset;  /* offset of the first data not acknowledged */
+		struct eb_root acked; /* acknowledged ranges beyond <ack_offset> (struct qcs_frm) */
+		uint64_t max_data;    /* stream flow control limit from the peer */
+	} tx;
+	struct {
+		uint64_t type;        /* type of a remote uni stream, QCS_H3_TYPE_UNSET if unknown */
+		uint64_t ft;          /* type of the frame being demuxed (QC_SF_H3_FRAME) */
+		uint64_t flen;        /* remaining length of its payload */
+		unsigned long long body_len; /* remaining body length (QC_SF_H3_CLEN) */
+		unsigned char prio;   /* scheduling class of the STREAM frames, see qcs_h3_prio() */
+	} h3;
+	struct wait_event *subs;  /* wait_event the conn_stream associated is waiting on (via mux_quic_subscribe) */
+};
+
+DECLARE_STATIC_POOL(pool_head_qcc, "qcc", sizeof(struct qcc));
+DECLARE_STATIC_POOL(pool_head_qcs, "qcs", sizeof(struct qcs));
+DECLARE_STATIC_POOL(pool_head_qcs_ack, "qcs_ack", sizeof(struct qcs_frm));
+
+static void qcc_h3_init(struct qcc *qcc);
+static int mux_quic_avail_streams(struct connection *conn);
+
+static inline int qcs_id_uni(uint64_t id)
+{
+	return !!(id & QCS_ID_DIR_BIT);
+}
+
+/* Returns 1 if the stream with <id> as ID has been initiated by <qcc> side. */
+static inline int qcs_id_local(const struct qcc *qcc, uint64_t id)
+{
+	return !(id & QCS_ID_SRV_INITIATOR_BIT) == !!(qcc->flags & QC_CF_IS_BACK);
+}
+
+/* Returns the scheduling class of the STREAM frames of a stream with <urgency>
+ * and <incremental> as RFC 9218 priority parameters. The lower the class, the
+ * sooner the frames are sent. For a same urgency, the frames of the streams
+ * which are not incremental are sent before the other ones.
+ */
+static inline unsigned char qcs_h3_prio(unsigned int urgency, unsigned int incremental)
+{
+	return (urgency << 1) | !!incremental;
+}
+
+/* Initialize the flow control limits of <qcc> from the transport parameters
+ * of its QUIC connection if not already done. These parameters are not known
+ * yet when the mux is initialized.
+ */
+static void qcc_init_params(struct qcc *qcc)
+{
+	struct quic_conn *qc = qcc->conn->quic_conn;
+
+	if (qcc->flags & QC_CF_PARAMS_SET)
+		return;
+
+	qcc->rx.max_bidi = qc->params.initial_max_streams_bidi;
+	qcc->rx.max_uni  = qc->params.initial_max_streams_uni;
+	qcc->rx.max_data = qc->params.initial_max_data;
+	qcc->flags |= QC_CF_PARAMS_SET;
+
+	if (qcc->flags & QC_CF_H3)
+		qcc_h3_init(qcc);
+}
+
+/* Update the TX limits of <qcc> from the transport parameters of the peer
+ * which are not known before the handshake has progressed, the limits
+ * received through MAX_* frames being always greater.
+ */
+static void qcc_update_tx_params(struct qcc *qcc)
+{
+	struct quic_conn *qc = qcc->conn->quic_conn;
+
+	qcc->tx.max_bidi = MAX(qcc->tx.max_bidi, qc->rx_tps.initial_max_streams_bidi);
+	qcc->tx.max_uni  = MAX(qcc->tx.max_uni, qc->rx_tps.initial_max_streams_uni);
+	qcc->tx.max_data = MAX(qcc->tx.max_data, qc->rx_tps.initial_max_data);
+}
+
+/* Same as above for <qcs> stream. */
+static void qcs_update_tx_params(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct quic_conn *qc = qcc->conn->quic_conn;
+	uint64_t id = qcs->by_id.key;
+	uint64_t max;
+
+	if (qcs_id_uni(id))
+		max = qcs_id_local(qcc, id) ? qc->rx_tps.initial_max_stream_data_uni : 0;
+	else if (qcs_id_local(qcc, id))
+		max = qc->rx_tps.initial_max_stream_data_bidi_remote;
+	else
+		max = qc->rx_tps.initial_max_stream_data_bidi_local;
+	qcs->tx.max_data = MAX(qcs->tx.max_data, max);
+	qcc_update_tx_params(qcc);
+}
+
+/* Queue <frm> frame to be sent by the transport layer for <qcc>.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static inline int qcc_send_frm(struct qcc *qcc, const struct quic_frame *frm)
+{
+	return qc_snd_frm(qcc->conn, frm);
+}
+
+/* Returns the application error code to use for <qcc> to close a stream
+ * without error.
+ */
+static inline uint64_t qcc_no_error(const struct qcc *qcc)
+{
+	return (qcc->flags & QC_CF_H3) ? H3_EC_NO_ERROR : 0;
+}
+
+/* attempt to notify the data layer of recv availability */
+static void qcs_notify_recv(struct qcs *qcs)
+{
+	if (qcs->subs && qcs->subs->events & SUB_RETRY_RECV) {
+		tasklet_wakeup(qcs->subs->tasklet);
+		qcs->subs->events &= ~SUB_RETRY_RECV;
+		if (!qcs->subs->events)
+			qcs->subs = NULL;
+	}
+}
+
+/* attempt to notify the data layer of send availability */
+static void qcs_notify_send(struct qcs *qcs)
+{
+	if (qcs->subs && qcs->subs->events & SUB_RETRY_SEND) {
+		tasklet_wakeup(qcs->subs->tasklet);
+		qcs->subs->events &= ~SUB_RETRY_SEND;
+		if (!qcs->subs->events)
+			qcs->subs = NULL;
+	}
+}
+
+/* alerts the data layer, trying to wake it up by all means: for recv, for
+ * send or via its ->wake() callback if it was subscribed to neither.
+ */
+static void qcs_alert(struct qcs *qcs)
+{
+	if (qcs->subs) {
+		qcs_notify_recv(qcs);
+		qcs_notify_send(qcs);
+	}
+	else if (qcs->cs && qcs->cs->data_cb->wake)
+		qcs->cs->data_cb->wake(qcs->cs);
+}
+
+/* Close <qcc> connection on error with <err> as application error code. The
+ * data received later are ignored and the error is reported to all the
+ * attached streams.
+ */
+static void qcc_close(struct qcc *qcc, uint64_t err)
+{
+	struct quic_frame frm;
+	struct eb64_node *node;
+
+	if (qcc->flags & QC_CF_ERROR)
+		return;
+
+	frm.type = QUIC_FT_CONNECTION_CLOSE_APP;
+	frm.connection_close_app.error_code = err;
+	frm.connection_close_app.reason_phrase_len = 0;
+	frm.connection_close_app.reason_phrase = NULL;
+	qcc_send_frm(qcc, &frm);
+	qcc->flags |= QC_CF_ERROR;
+
+	for (node = eb64_first(&qcc->streams_by_id); node; node = eb64_next(node)) {
+		struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+		if (qcs->cs) {
+			qcs->cs->flags |= CS_FL_ERR_PENDING;
+			qcs_alert(qcs);
+		}
+	}
+}
+
+/* Look up the stream with <id> as ID for <qcc>. */
+static inline struct qcs *qcc_get_qcs(struct qcc *qcc, uint64_t id)
+{
+	struct eb64_node *node;
+
+	node = eb64_lookup(&qcc->streams_by_id, id);
+	return node ? eb64_entry(&node->node, struct qcs, by_id) : NULL;
+}
+
+/* Allocates a new stream with <id> as ID for <qcc> connection and adds it
+ * into its stream tree. Returns the stream if succeeded, NULL if not.
+ */
+static struct qcs *qcs_new(struct qcc *qcc, uint64_t id)
+{
+	struct quic_transport_params *params = &qcc->conn->quic_conn->params;
+	struct qcs *qcs;
+
+	qcs = pool_alloc(pool_head_qcs);
+	if (!qcs)
+		return NULL;
+
+	qcs->qcc = qcc;
+	qcs->cs = NULL;
+	qcs->flags = QC_SF_NONE;
+	qcs->subs = NULL;
+
+	qcs->rx.buf = BUF_NULL;
+	qcs->rx.frms = EB_ROOT_UNIQUE;
+	qcs->rx.offset = qcs->rx.max_offset = 0;
+	qcs->rx.final_size = 0;
+	qcs->rx.consumed = 0;
+	if (qcs_id_uni(id))
+		qcs->rx.window = params->initial_max_stream_data_uni;
+	else if (qcs_id_local(qcc, id))
+		qcs->rx.window = params->initial_max_stream_data_bidi_local;
+	else
+		qcs->rx.window = params->initial_max_stream_data_bidi_remote;
+	qcs->rx.max_data = qcs->rx.window;
+
+	qcs->tx.buf = BUF_NULL;
+	qcs->tx.offset = qcs->tx.ack_offset = 0;
+	qcs->tx.acked = EB_ROOT_UNIQUE;
+	qcs->tx.max_data = 0;
+
+	qcs->h3.type = QCS_H3_TYPE_UNSET;
+	qcs->h3.ft = qcs->h3.flen = 0;
+	qcs->h3.body_len = 0;
+	qcs->h3.prio = qcs_h3_prio(H3_URGENCY_DFLT, 0);
+
+	qcs->by_id.key = id;
+	eb64_insert(&qcc->streams_by_id, &qcs->by_id);
+	qcc->nb_streams++;
+
+	return qcs;
+}
+
+/* Releases <frm> out of order data of <qcs>, already removed from its tree. */
+static inline void qcs_rx_frm_free(struct qcs *qcs, struct qcs_frm *frm)
+{
+	qc_mem_sub(qcs->qcc->conn->quic_conn, sizeof *frm + frm->len);
+	free(frm);
+}
+
+/* Free all the frames of <root> tree of <qcs>. <data> must be set if they hold
+ * data.
+ */
+static void qcs_frms_free(struct qcs *qcs, struct eb_root *root, int data)
+{
+	struct eb64_node *node;
+
+	while ((node = eb64_first(root))) {
+		struct qcs_frm *frm = eb64_entry(&node->node, struct qcs_frm, offset_node);
+
+		eb64_delete(node);
+		if (data)
+			qcs_rx_frm_free(qcs, frm);
+		else
+			pool_free(pool_head_qcs_ack, frm);
+	}
+}
+
+/* Send a MAX_STREAMS frame to the peer if enough remote streams of the type
+ * of the stream with <id> as ID were closed for <qcc>.
+ */
+static void qcc_remote_stream_closed(struct qcc *qcc, uint64_t id)
+{
+	struct quic_frame frm;
+	uint64_t *closed, *max, window;
+	struct quic_transport_params *params = &qcc->conn->quic_conn->params;
+
+	if (qcs_id_uni(id)) {
+		closed = &qcc->rx.closed_uni;
+		max = &qcc->rx.max_uni;
+		window = params->initial_max_streams_uni;
+	}
+	else {
+		closed = &qcc->rx.closed_bidi;
+		max = &qcc->rx.max_bidi;
+		window = params->initial_max_streams_bidi;
+	}
+
+	if (++*closed < (window + 1) / 2)
+		return;
+
+	*max += *closed;
+	*closed = 0;
+	if (qcs_id_uni(id)) {
+		frm.type = QUIC_FT_MAX_STREAMS_UNI;
+		frm.max_streams_uni.max_streams = *max;
+	}
+	else {
+		frm.type = QUIC_FT_MAX_STREAMS_BIDI;
+		frm.max_streams_bidi.max_streams = *max;
+	}
+	qcc_send_frm(qcc, &frm);
+}
+
+/* Releases <qcs> stream and removes it from its connection tree. */
+static void qcs_destroy(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+	uint64_t id = qcs->by_id.key;
+
+	eb64_delete(&qcs->by_id);
+	qcc->nb_streams--;
+	if (!qcs_id_local(qcc, id))
+		qcc_remote_stream_closed(qcc, id);
+
+	if (qcs->flags & QC_SF_H3_BLOCKED)
+		qpack_dec_unblock(&qcc->h3.dec);
+
+	qcs_frms_free(qcs, &qcs->rx.frms, 1);
+	qcs_frms_free(qcs, &qcs->tx.acked, 0);
+	if (b_size(&qcs->rx.buf) || b_size(&qcs->tx.buf)) {
+		b_free(&qcs->rx.buf);
+		b_free(&qcs->tx.buf);
+		offer_buffers(NULL, tasks_run_queue);
+	}
+
+	if (qcs->subs)
+		qcs->subs->events = 0;
+
+	pool_free(pool_head_qcs, qcs);
+}
+
+/* Returns 1 if all the data of <qcs> have been received and consumed. */
+static inline int qcs_rx_done(const struct qcs *qcs)
+{
+	return (qcs->flags & QC_SF_FIN_RECV) && qcs->rx.consumed == qcs->rx.final_size;
+}
+
+/* Returns 1 if all the data of <qcs> have been received, even if not consumed. */
+static inline int qcs_rx_complete(const struct qcs *qcs)
+{
+	return (qcs->flags & QC_SF_FIN_RECV) && qcs->rx.offset == qcs->rx.final_size;
+}
+
+/* Returns 1 if all the data of <qcs> have been sent and acknowledged, or if
+ * nothing was ever sent or if it was reset.
+ */
+static inline int qcs_tx_done(const struct qcs *qcs)
+{
+	if (qcs_id_uni(qcs->by_id.key) && !qcs_id_local(qcs->qcc, qcs->by_id.key))
+		return 1;
+
+	if (qcs->flags & QC_SF_RESET_SENT)
+		return 1;
+
+	if (!(qcs->flags & QC_SF_FIN_SENT))
+		return !qcs->tx.offset;
+
+	return (qcs->flags & QC_SF_FIN_ACKED) && qcs->tx.ack_offset == qcs->tx.offset;
+}
+
+/* Returns 1 if some upper layer is interested in the data of <qcs>. */
+static inline int qcs_has_upper(const struct qcs *qcs)
+{
+	return qcs->cs || (qcs->flags & QC_SF_APP);
+}
+
+/* Release <qcs> if it has no more upper layer and nothing more to send.
+ * The data received later for this stream are ignored.
+ * Returns 1 if it was released, 0 if not.
+ */
+static int qcs_try_release(struct qcs *qcs)
+{
+	if (qcs_has_upper(qcs) || !qcs_tx_done(qcs))
+		return 0;
+
+	qcs_destroy(qcs);
+	return 1;
+}
+
+/* Account for <bytes> bytes of <qcs> consumed by the upper layer, sending
+ * MAX_STREAM_DATA and MAX_DATA frames when half of the windows are consumed.
+ * Under memory pressure, the windows are shrunk to a quarter of their size.
+ */
+static void qcs_consume(struct qcs *qcs, uint64_t bytes)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct quic_conn *qc = qcc->conn->quic_conn;
+	uint64_t window = qcs->rx.window;
+	uint64_t conn_window = qc->params.initial_max_data;
+	struct quic_frame frm;
+
+	if (!bytes)
+		return;
+
+	qcs->rx.consumed += bytes;
+	qcc->rx.consumed += bytes;
+
+	if (qc_mem_pressure(qc)) {
+		window /= 4;
+		conn_window /= 4;
+	}
+
+	if (!(qcs->flags & QC_SF_FIN_RECV) &&
+	    qcs->rx.max_data - qcs->rx.consumed < window / 2) {
+		qcs->rx.max_data = qcs->rx.consumed + window;
+		frm.type = QUIC_FT_MAX_STREAM_DATA;
+		frm.max_stream_data.id = qcs->by_id.key;
+		frm.max_stream_data.max_stream_data = qcs->rx.max_data;
+		qcc_send_frm(qcc, &frm);
+	}
+
+	if (qcc->rx.max_data - qcc->rx.consumed < conn_window / 2) {
+		qcc->rx.max_data = qcc->rx.consumed + conn_window;
+		frm.type = QUIC_FT_MAX_DATA;
+		frm.max_data.max_data = qcc->rx.max_data;
+		qcc_send_frm(qcc, &frm);
+	}
+}
+
+/* Move as much out of order data as possible from the tree of <qcs> to its
+ * RX buffer.
+ */
+static void qcs_rx_drain(struct qcs *qcs)
+{
+	struct eb64_node *node;
+
+	while ((node = eb64_first(&qcs->rx.frms))) {
+		struct qcs_frm *frm = eb64_entry(&node->node, struct qcs_frm, offset_node);
+		uint64_t end = frm->offset_node.key + frm->len;
+		size_t ret;
+
+		if (frm->offset_node.key > qcs->rx.offset)
+			break;
+
+		if (end > qcs->rx.offset) {
+			if (!b_size(&qcs->rx.buf) && !b_alloc_margin(&qcs->rx.buf, 0))
+				break;
+
+			ret = b_putblk(&qcs->rx.buf,
+			               (char *)frm->data + qcs->rx.offset - frm->offset_node.key,
+			               end - qcs->rx.offset);
+			qcs->rx.offset += ret;
+			if (qcs->rx.offset < end)
+				break;
+		}
+
+		eb64_delete(node);
+		qcs_rx_frm_free(qcs, frm);
+	}
+}
+
+/* Store a copy of <len> bytes of <data> received at <offset> for <qcs> out of
+ * its RX buffer. Returns 1 if succeeded, 0 if not.
+ */
+static int qcs_rx_store(struct qcs *qcs, uint64_t offset,
+                        const unsigned char *data, uint64_t len)
+{
+	struct eb64_node *node;
+	struct qcs_frm *frm;
+
+	/* Ignore the exact duplicates. */
+	node = eb64_lookup(&qcs->rx.frms, offset);
+	if (node && eb64_entry(&node->node, struct qcs_frm, offset_node)->len >= len)
+		return 1;
+
+	frm = malloc(sizeof *frm + len);
+	if (!frm)
+		return 0;
+
+	frm->offset_node.key = offset;
+	frm->len = len;
+	memcpy(frm->data, data, len);
+	eb64_insert(&qcs->rx.frms, &frm->offset_node);
+	qc_mem_add(qcs->qcc->conn->quic_conn, sizeof *frm + len);
+
+	return 1;
+}
+
+/* Queue a STREAM frame with the FIN bit set and no data for <qcs>. */
+static void qcs_send_fin(struct qcs *qcs)
+{
+	struct quic_frame frm;
+
+	if (qcs->flags & (QC_SF_FIN_SENT | QC_SF_RESET_SENT))
+		return;
+
+	frm.type = QUIC_FT_STREAM_8 | QUIC_STREAM_FRAME_OFF_BIT |
+		QUIC_STREAM_FRAME_LEN_BIT | QUIC_STREAM_FRAME_FIN_BIT;
+	frm.stream.id = qcs->by_id.key;
+	frm.stream.offset = qcs->tx.offset;
+	frm.stream.len = 0;
+	frm.stream.data = NULL;
+	frm.stream.prio = qcs->h3.prio;
+	if (qcc_send_frm(qcs->qcc, &frm))
+		qcs->flags |= QC_SF_FIN_SENT;
+}
+
+/* Tell the peer we will not read the data of <qcs> anymore, with <err> as
+ * application error code.
+ */
+static void qcs_stop_sending(struct qcs *qcs, uint64_t err)
+{
+	struct quic_frame frm;
+
+	if (qcs->flags & QC_SF_FIN_RECV)
+		return;
+
+	frm.type = QUIC_FT_STOP_SENDING;
+	frm.stop_sending_frame.id = qcs->by_id.key;
+	frm.stop_sending_frame.app_error_code = err;
+	qcc_send_frm(qcs->qcc, &frm);
+}
+
+/* Abort <qcs> stream in both directions on error with <err> as application
+ * error code, reporting the error to the attached conn_stream if any.
+ */
+static void qcs_reset(struct qcs *qcs, uint64_t err)
+{
+	struct quic_frame frm;
+
+	if (!(qcs->flags & QC_SF_RESET_SENT)) {
+		frm.type = QUIC_FT_RESET_STREAM;
+		frm.reset_stream.id = qcs->by_id.key;
+		frm.reset_stream.app_error_code = err;
+		frm.reset_stream.final_size = qcs->tx.offset;
+		qcc_send_frm(qcs->qcc, &frm);
+		qcs->flags |= QC_SF_RESET_SENT;
+	}
+
+	qcs_stop_sending(qcs, err);
+	if (qcs->cs) {
+		qcs->cs->flags |= CS_FL_ERR_PENDING;
+		qcs_alert(qcs);
+	}
+}
+
+/* Returns the number of contiguous bytes which may be written at the tail of
+ * the TX buffer of <qcs>, allocating it if needed, and sending the
+ * STREAM_DATA_BLOCKED or DATA_BLOCKED frames if blocked by the peer flow
+ * control.
+ */
+static size_t qcs_tx_room(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct quic_frame frm;
+	size_t room;
+
+	qcs_update_tx_params(qcs);
+	if (qcs->tx.offset >= qcs->tx.max_data) {
+		if (!(qcs->flags & QC_SF_BLK_SFCTL)) {
+			qcs->flags |= QC_SF_BLK_SFCTL;
+			frm.type = QUIC_FT_STREAM_DATA_BLOCKED;
+			frm.stream_data_blocked.id = qcs->by_id.key;
+			frm.stream_data_blocked.limit = qcs->tx.max_data;
+			qcc_send_frm(qcc, &frm);
+		}
+		return 0;
+	}
+
+	if (qcc->tx.offsets >= qcc->tx.max_data) {
+		if (!(qcc->flags & QC_CF_BLK_MFCTL)) {
+			qcc->flags |= QC_CF_BLK_MFCTL;
+			frm.type = QUIC_FT_DATA_BLOCKED;
+			frm.data_blocked.limit = qcc->tx.max_data;
+			qcc_send_frm(qcc, &frm);
+		}
+		return 0;
+	}
+
+	if (!b_size(&qcs->tx.buf) && !b_alloc_margin(&qcs->tx.buf, 0))
+		return 0;
+
+	room = b_contig_space(&qcs->tx.buf);
+	room = MIN(room, qcs->tx.max_data - qcs->tx.offset);
+	room = MIN(room, qcc->tx.max_data - qcc->tx.offsets);
+	return room;
+}
+
+/* Sends the <len> bytes written at the tail of the TX buffer of <qcs> as
+ * STREAM frames pointing to this buffer. <len> must not be larger than the
+ * value returned by qcs_tx_room(). The data stay in the buffer until they are
+ * acknowledged.
+ */
+static void qcs_tx_commit(struct qcs *qcs, size_t len)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct quic_frame frm;
+	unsigned char *data = (unsigned char *)b_tail(&qcs->tx.buf);
+
+	b_add(&qcs->tx.buf, len);
+	while (len) {
+		size_t flen = MIN(len, QCS_STREAM_FRM_MAXLEN);
+
+		frm.type = QUIC_FT_STREAM_8 | QUIC_STREAM_FRAME_OFF_BIT | QUIC_STREAM_FRAME_LEN_BIT;
+		frm.stream.id = qcs->by_id.key;
+		frm.stream.offset = qcs->tx.offset;
+		frm.stream.len = flen;
+		frm.stream.data = data;
+		frm.stream.prio = qcs->h3.prio;
+		/* The data are already part of the stream: we cannot recover. */
+		if (!qcc_send_frm(qcc, &frm))
+			qcc->conn->flags |= CO_FL_ERROR;
+
+		qcs->tx.offset += flen;
+		qcc->tx.offsets += flen;
+		data += flen;
+		len -= flen;
+	}
+}
+
+/* Sends <len> bytes from <data> on <qcs>. Returns the number of bytes sent,
+ * which may be less than <len> if blocked by the flow control.
+ */
+static size_t qcs_send_raw(struct qcs *qcs, const char *data, size_t len)
+{
+	size_t sent = 0;
+
+	while (sent < len) {
+		size_t room = MIN(qcs_tx_room(qcs), len - sent);
+
+		if (!room)
+			break;
+
+		memcpy(b_tail(&qcs->tx.buf), data + sent, room);
+		qcs_tx_commit(qcs, room);
+		sent += room;
+	}
+
+	return sent;
+}
+
+/* Opens a new local unidirectional stream of type <type> for <qcc>, for the
+ * application layer. Returns the stream if succeeded, NULL if not.
+ */
+static struct qcs *qcc_local_uni_new(struct qcc *qcc, uint64_t type)
+{
+	unsigned char buf[8], *pos = buf;
+	struct qcs *qcs;
+	uint64_t id;
+
+	qcc_update_tx_params(qcc);
+	if (qcc->tx.nb_uni >= qcc->tx.max_uni)
+		return NULL;
+
+	id = (qcc->tx.nb_uni << QCS_ID_TYPE_SHIFT) | QCS_ID_DIR_BIT;
+	if (!(qcc->flags & QC_CF_IS_BACK))
+		id |= QCS_ID_SRV_INITIATOR_BIT;
+
+	qcs = qcs_new(qcc, id);
+	if (!qcs)
+		return NULL;
+
+	qcc->tx.nb_uni++;
+	qcs->flags |= QC_SF_APP;
+	/* The control and QPACK streams are never delayed by the requests. */
+	qcs->h3.prio = qcs_h3_prio(0, 0);
+	quic_enc_int(&pos, buf + sizeof(buf), type);
+	if (qcs_send_raw(qcs, (char *)buf, pos - buf) != pos - buf) {
+		qcc_close(qcc, H3_EC_INTERNAL_ERROR);
+		return NULL;
+	}
+
+	return qcs;
+}
+
+/* Reads a QUIC variable-length integer at offset <*ofs> of <b> into <val>,
+ * updating <*ofs>. Returns 1 if succeeded, 0 if <b> does not hold the whole
+ * integer yet.
+ */
+static int qcs_peek_int(const struct buffer *b, size_t *ofs, uint64_t *val)
+{
+	unsigned char c;
+	size_t len, i;
+
+	if (*ofs >= b_data(b))
+		return 0;
+
+	c = *b_peek(b, *ofs);
+	len = 1 << (c >> 6);
+	if (*ofs + len > b_data(b))
+		return 0;
+
+	*val = c & 0x3f;
+	for (i = 1; i < len; i++)
+		*val = (*val << 8) | (unsigned char)*b_peek(b, *ofs + i);
+	*ofs += len;
+	return 1;
+}
+
+/* Reads the header of the next HTTP/3 frame of <qcs> if not already done,
+ * adding the number of bytes removed from its RX buffer to <consumed>.
+ * Returns 1 if succeeded, 0 if not enough data were received yet.
+ */
+static int qcs_h3_frame_hdr(struct qcs *qcs, size_t *consumed)
+{
+	uint64_t ft, flen;
+	size_t ofs = 0;
+
+	if (qcs->flags & QC_SF_H3_FRAME)
+		return 1;
+
+	if (!qcs_peek_int(&qcs->rx.buf, &ofs, &ft) ||
+	    !qcs_peek_int(&qcs->rx.buf, &ofs, &flen))
+		return 0;
+
+	b_del(&qcs->rx.buf, ofs);
+	*consumed += ofs;
+	qcs->h3.ft = ft;
+	qcs->h3.flen = flen;
+	qcs->flags |= QC_SF_H3_FRAME;
+	return 1;
+}
+
+/* Makes the whole payload of the current HTTP/3 frame of <qcs> contiguous at
+ * the head of its RX buffer. Returns 1 if succeeded, 0 if not enough data
+ * were received yet, or -1 if the payload cannot fit into a buffer.
+ */
+static int qcs_h3_frame_payload(struct qcs *qcs)
+{
+	struct buffer *rxbuf = &qcs->rx.buf;
+
+	if (qcs->h3.flen > global.tune.bufsize)
+		return -1;
+
+	if (b_data(rxbuf) < qcs->h3.flen)
+		return 0;
+
+	if (b_contig_data(rxbuf, 0) < qcs->h3.flen)
+		b_slow_realign(rxbuf, trash.area, 0);
+	return 1;
+}
+
+/* Removes the current frame payload of <qcs> from its RX buffer, as much as
+ * possible. Returns 1 once the whole payload was removed, 0 if not.
+ */
+static int qcs_h3_skip_frame(struct qcs *qcs, size_t *consumed)
+{
+	size_t len = MIN(qcs->h3.flen, b_data(&qcs->rx.buf));
+
+	b_del(&qcs->rx.buf, len);
+	*consumed += len;
+	qcs->h3.flen -= len;
+	return !qcs->h3.flen;
+}
+
+/* Sends the QPACK decoder instructions of <inst> on the decoder stream of
+ * <qcc>, opening it if not already done.
+ */
+static void qcc_h3_send_dec_inst(struct qcc *qcc, const struct buffer *inst)
+{
+	if (!b_data(inst))
+		return;
+
+	if (!qcc->h3.qpdec)
+		qcc->h3.qpdec = qcc_local_uni_new(qcc, H3_UNI_QPACK_DEC);
+
+	/* A lost instruction would leave the peer's encoder out of sync. */
+	if (!qcc->h3.qpdec ||
+	    qcs_send_raw(qcc->h3.qpdec, b_head(inst), b_data(inst)) != b_data(inst))
+		qcc_close(qcc, H3_EC_INTERNAL_ERROR);
+}
+
+/* Wakes up the request streams of <qcc> blocked on the QPACK encoder stream
+ * so that they try again to decode their field section.
+ */
+static void qcc_h3_wake_blocked(struct qcc *qcc)
+{
+	struct eb64_node *node;
+
+	if (!qcc->h3.dec.nb_blocked)
+		return;
+
+	for (node = eb64_first(&qcc->streams_by_id); node; node = eb64_next(node)) {
+		struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+		if (!(qcs->flags & QC_SF_H3_BLOCKED))
+			continue;
+
+		qcs->flags &= ~QC_SF_H3_BLOCKED;
+		qpack_dec_unblock(&qcc->h3.dec);
+		qcs_notify_recv(qcs);
+	}
+}
+
+/* Parses the SETTINGS frame of <qcs> control stream whose payload is at the
+ * head of its RX buffer. Returns 1 if succeeded, 0 if not, the connection
+ * being closed.
+ */
+static int qcs_h3_parse_settings(struct qcs *qcs)
+{
+	const unsigned char *pos = (const unsigned char *)b_head(&qcs->rx.buf);
+	const unsigned char *end = pos + qcs->h3.flen;
+	uint64_t id, value;
+
+	while (pos < end) {
+		if (!quic_dec_int(&id, &pos, end) || !quic_dec_int(&value, &pos, end)) {
+			qcc_close(qcs->qcc, H3_EC_FRAME_ERROR);
+			return 0;
+		}
+
+		switch (id) {
+		case H3_SETTINGS_ENABLE_PUSH ... H3_SETTINGS_MAX_FRAME_SIZE:
+			/* reserved HTTP/2 settings */
+			qcc_close(qcs->qcc, H3_EC_SETTINGS_ERROR);
+			return 0;
+		default:
+			/* Our encoder only uses the static table so the QPACK
+			 * settings are useless to us, we do not enforce
+			 * MAX_FIELD_SECTION_SIZE and the unknown settings must
+			 * be ignored.
+			 */
+			break;
+		}
+	}
+
+	return 1;
+}
+
+/* Sets the priority of <qcs> request stream from the <value> of a "priority"
+ * header field or of PRIORITY_UPDATE frame. The parameters it does not hold
+ * take their default value (RFC 9218 #4).
+ */
+static void qcs_h3_set_priority(struct qcs *qcs, const struct ist value)
+{
+	unsigned int urgency = H3_URGENCY_DFLT, incremental = 0;
+
+	h3_parse_priority(value, &urgency, &incremental);
+	qcs->h3.prio = qcs_h3_prio(urgency, incremental);
+}
+
+/* Parses the PRIORITY_UPDATE frame of <qcs> control stream whose payload is
+ * at the head of its RX buffer, updating the priority of the request stream it
+ * designates, unless set by a rule. Returns 1 if succeeded, 0 if not, the
+ * connection being closed.
+ */
+static int qcs_h3_parse_priority_update(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+	const unsigned char *pos = (const unsigned char *)b_head(&qcs->rx.buf);
+	const unsigned char *end = pos + qcs->h3.flen;
+	struct qcs *req;
+	uint64_t id;
+
+	/* Only the clients send this frame (RFC 9218 #7.1). */
+	if (qcc->flags & QC_CF_IS_BACK) {
+		qcc_close(qcc, H3_EC_FRAME_UNEXPECTED);
+		return 0;
+	}
+
+	if (!quic_dec_int(&id, &pos, end)) {
+		qcc_close(qcc, H3_EC_FRAME_ERROR);
+		return 0;
+	}
+
+	if (qcs_id_uni(id) || qcs_id_local(qcc, id)) {
+		qcc_close(qcc, H3_EC_ID_ERROR);
+		return 0;
+	}
+
+	/* The updates of the streams not opened yet are not buffered, their
+	 * "priority" header field being used instead.
+	 */
+	req = qcc_get_qcs(qcc, id);
+	if (!req || (req->flags & QC_SF_H3_PRIO_RULE))
+		return 1;
+
+	qcs_h3_set_priority(req, ist2((const char *)pos, end - pos));
+	req->flags |= QC_SF_H3_PRIO;
+	return 1;
+}
+
+/* Handles the frames received on <qcs> remote control stream. Returns 1 if
+ * some progress was made, 0 if not.
+ */
+static int qcs_h3_ctrl_recv(struct qcs *qcs, size_t *consumed)
+{
+	struct qcc *qcc = qcs->qcc;
+	size_t done = *consumed;
+	int ret;
+
+	while (!(qcc->flags & QC_CF_ERROR)) {
+		if (!qcs_h3_frame_hdr(qcs, consumed))
+			break;
+
+		if (!(qcc->flags & QC_CF_H3_SETTINGS) && qcs->h3.ft != H3_FRM_SETTINGS) {
+			qcc_close(qcc, H3_EC_MISSING_SETTINGS);
+			break;
+		}
+
+		switch (qcs->h3.ft) {
+		case H3_FRM_SETTINGS:
+		case H3_FRM_GOAWAY:
+		case H3_FRM_MAX_PUSH_ID:
+		case H3_FRM_CANCEL_PUSH:
+		case H3_FRM_PRIORITY_UPDATE_REQ:
+		case H3_FRM_PRIORITY_UPDATE_PUSH:
+			ret = qcs_h3_frame_payload(qcs);
+			if (ret < 0) {
+				qcc_close(qcc, H3_EC_EXCESSIVE_LOAD);
+				return 1;
+			}
+			if (!ret)
+				goto out;
+
+			if (qcs->h3.ft == H3_FRM_SETTINGS) {
+				if (qcc->flags & QC_CF_H3_SETTINGS) {
+					qcc_close(qcc, H3_EC_FRAME_UNEXPECTED);
+					return 1;
+				}
+				if (!qcs_h3_parse_settings(qcs))
+					return 1;
+				qcc->flags |= QC_CF_H3_SETTINGS;
+			}
+			else if (qcs->h3.ft == H3_FRM_PRIORITY_UPDATE_REQ) {
+				if (!qcs_h3_parse_priority_update(qcs))
+					return 1;
+			}
+			/* We never push and we do not need to wait for the
+			 * requests when stopping: GOAWAY, MAX_PUSH_ID,
+			 * CANCEL_PUSH and the PRIORITY_UPDATE frames of the
+			 * pushes are ignored.
+			 */
+			qcs_h3_skip_frame(qcs, consumed);
+			break;
+		case H3_FRM_DATA:
+		case H3_FRM_HEADERS:
+		case H3_FRM_PUSH_PROMISE:
+			qcc_close(qcc, H3_EC_FRAME_UNEXPECTED);
+			return 1;
+		default:
+			/* unknown and reserved frame types are ignored */
+			if (!qcs_h3_skip_frame(qcs, consumed))
+				goto out;
+			break;
+		}
+
+		qcs->flags &= ~QC_SF_H3_FRAME;
+	}
+
+ out:
+	return *consumed != done;
+}
+
+/* Handles the instructions received on <qcs> remote QPACK encoder stream.
+ * Returns 1 if some progress was made, 0 if not.
+ */
+static int qcs_h3_qpack_enc_recv(struct qcs *qcs, size_t *consumed)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct buffer *rxbuf = &qcs->rx.buf;
+	uint64_t ins_cnt = qcc->h3.dec.ins_cnt;
+	char area[16];
+	struct buffer inst = b_make(area, sizeof(area), 0, 0);
+	int ret;
+
+	if (!b_data(rxbuf))
+		return 0;
+
+	if (b_contig_data(rxbuf, 0) < b_data(rxbuf))
+		b_slow_realign(rxbuf, trash.area, 0);
+
+	ret = qpack_decode_enc(&qcc->h3.dec, (const uint8_t *)b_head(rxbuf),
+	                       b_data(rxbuf), get_trash_chunk());
+	if (ret < 0) {
+		qcc_close(qcc, H3_EC_QPACK_ENCODER_STREAM_ERROR);
+		return 0;
+	}
+
+	if (!ret) {
+		/* an instruction which does not fit into a buffer */
+		if (b_full(rxbuf))
+			qcc_close(qcc, H3_EC_EXCESSIVE_LOAD);
+		return 0;
+	}
+
+	b_del(rxbuf, ret);
+	*consumed += ret;
+
+	if (qcc->h3.dec.ins_cnt != ins_cnt) {
+		qpack_enc_insert_count_inc(&inst, &qcc->h3.dec);
+		qcc_h3_send_dec_inst(qcc, &inst);
+		qcc_h3_wake_blocked(qcc);
+	}
+
+	return 1;
+}
+
+/* Handles the data received on <qcs> remote unidirectional stream for the
+ * HTTP/3 application layer. The errors are handled by closing the
+ * connection.
+ */
+static void qcs_h3_recv_uni(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct buffer *rxbuf = &qcs->rx.buf;
+	size_t consumed = 0;
+	uint64_t type;
+	size_t ofs;
+	int progress;
+
+	do {
+		qcs_rx_drain(qcs);
+		if (qcc->flags & QC_CF_ERROR)
+			break;
+
+		if (qcs->h3.type == QCS_H3_TYPE_UNSET) {
+			ofs = 0;
+			if (!qcs_peek_int(rxbuf, &ofs, &type))
+				break;
+
+			b_del(rxbuf, ofs);
+			consumed += ofs;
+			switch (type) {
+			case H3_UNI_CTRL:
+			case H3_UNI_QPACK_ENC:
+			case H3_UNI_QPACK_DEC: {
+				uint32_t flag = type == H3_UNI_CTRL ? QC_CF_H3_RCTRL :
+					type == H3_UNI_QPACK_ENC ? QC_CF_H3_RENC : QC_CF_H3_RDEC;
+
+				if (qcc->flags & flag) {
+					qcc_close(qcc, H3_EC_STREAM_CREATION_ERROR);
+					goto out;
+				}
+				qcc->flags |= flag;
+				break;
+			}
+			case H3_UNI_PUSH:
+				/* only servers may push */
+				qcc_close(qcc, H3_EC_STREAM_CREATION_ERROR);
+				goto out;
+			default:
+				/* unknown or reserved stream types: abort
+				 * reading, the stream is discarded.
+				 */
+				qcs_stop_sending(qcs, H3_EC_STREAM_CREATION_ERROR);
+				qcs->flags &= ~QC_SF_APP;
+				qcs_frms_free(qcs, &qcs->rx.frms, 1);
+				b_reset(rxbuf);
+				qcs->rx.offset = qcs->rx.max_offset;
+				qcs_consume(qcs, qcs->rx.max_offset - qcs->rx.consumed);
+				qcs_try_release(qcs);
+				return;
+			}
+			qcs->h3.type = type;
+		}
+
+		switch (qcs->h3.type) {
+		case H3_UNI_CTRL:
+			progress = qcs_h3_ctrl_recv(qcs, &consumed);
+			break;
+		case H3_UNI_QPACK_ENC:
+			progress = qcs_h3_qpack_enc_recv(qcs, &consumed);
+			break;
+		default:
+			/* Our encoder never uses the dynamic table: the
+			 * decoder instructions are ignored.
+			 */
+			progress = !!b_data(rxbuf);
+			consumed += b_data(rxbuf);
+			b_reset(rxbuf);
+			break;
+		}
+	} while (progress);
+
+	/* the critical streams must never be closed */
+	if (qcs->h3.type != QCS_H3_TYPE_UNSET && (qcs->flags & QC_SF_FIN_RECV))
+		qcc_close(qcc, H3_EC_CLOSED_CRITICAL_STREAM);
+
+ out:
+	qcs_consume(qcs, consumed);
+	if (!b_data(rxbuf) && b_size(rxbuf)) {
+		b_free(rxbuf);
+		offer_buffers(NULL, tasks_run_queue);
+	}
+}
+
+/* Decodes the HEADERS frame of <qcs> request stream into <htx>, adding the
+ * number of bytes removed from its RX buffer to <consumed>. Returns 1 if
+ * succeeded, 0 if it must be retried later, -1 on error.
+ */
+static int qcs_h3_decode_headers(struct qcs *qcs, struct htx *htx, size_t *consumed)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct buffer *rxbuf = &qcs->rx.buf;
+	struct buffer *tmp = get_trash_chunk();
+	struct http_hdr list[global.tune.max_http_hdr * 2];
+	char area[16];
+	struct buffer inst = b_make(area, sizeof(area), 0, 0);
+	unsigned int msgf;
+	uint64_t ric;
+	int outlen;
+	int ret;
+
+	if (qcs->flags & QC_SF_H3_TLRS) {
+		qcc_close(qcc, H3_EC_FRAME_UNEXPECTED);
+		return -1;
+	}
+
+	ret = qcs_h3_frame_payload(qcs);
+	if (ret < 0) {
+		qcs_reset(qcs, H3_EC_EXCESSIVE_LOAD);
+		return -1;
+	}
+
+	if (!ret) {
+		if (qcs_rx_complete(qcs)) {
+			qcc_close(qcc, H3_EC_FRAME_ERROR);
+			return -1;
+		}
+		return 0;
+	}
+
+	/* The decoding cannot fail for lack of room once the QPACK decoder is
+	 * updated, so we wait for the upper layer to consume everything, as
+	 * the H2 mux does.
+	 */
+	if (!htx_is_empty(htx)) {
+		qcs->flags |= QC_SF_DEM_FULL;
+		return 0;
+	}
+
+	outlen = qpack_decode_fs(&qcc->h3.dec, (const uint8_t *)b_head(rxbuf), qcs->h3.flen,
+	                         list, sizeof(list) / sizeof(list[0]), tmp, &ric);
+	if (outlen == -QPACK_ERR_BLOCKED) {
+		if (!qpack_dec_block(&qcc->h3.dec)) {
+			qcc_close(qcc, H3_EC_QPACK_DECOMPRESSION_FAILED);
+			return -1;
+		}
+		qcs->flags |= QC_SF_H3_BLOCKED;
+		return 0;
+	}
+
+	if (outlen == -QPACK_ERR_TOO_LARGE) {
+		qcs_reset(qcs, H3_EC_EXCESSIVE_LOAD);
+		return -1;
+	}
+
+	if (outlen < 0) {
+		qcc_close(qcc, H3_EC_QPACK_DECOMPRESSION_FAILED);
+		return -1;
+	}
+
+	b_del(rxbuf, qcs->h3.flen);
+	*consumed += qcs->h3.flen;
+	qcs->h3.flen = 0;
+
+	if (ric) {
+		qpack_enc_section_ack(&inst, &qcc->h3.dec, qcs->by_id.key, ric);
+		qcc_h3_send_dec_inst(qcc, &inst);
+	}
+
+	if (qcs->flags & QC_SF_H3_HDRS) {
+		/* This is a second HEADERS frame hence trailers */
+		if (h3_make_htx_trailers(list, htx) <= 0) {
+			qcs_reset(qcs, H3_EC_GENERAL_PROTOCOL_ERROR);
+			return -1;
+		}
+		qcs->flags |= QC_SF_H3_TLRS;
+		return 1;
+	}
+
+	/* A PRIORITY_UPDATE frame received first prevails (RFC 9218 #7). */
+	if (!(qcs->flags & (QC_SF_H3_PRIO | QC_SF_H3_PRIO_RULE))) {
+		int i;
+
+		for (i = 0; list[i].n.len; i++) {
+			if (list[i].n.ptr && isteq(list[i].n, ist("priority")))
+				qcs_h3_set_priority(qcs, list[i].v);
+		}
+	}
+
+	/* The end of the message is the end of the stream. */
+	msgf = (qcs_rx_complete(qcs) && !b_data(rxbuf)) ? 0 : H3_MSGF_BODY;
+	if (h3_make_htx_request(list, htx, &msgf, &qcs->h3.body_len) < 0) {
+		qcs_reset(qcs, H3_EC_GENERAL_PROTOCOL_ERROR);
+		return -1;
+	}
+
+	if ((msgf & H3_MSGF_BODY) && (msgf & H3_MSGF_BODY_CL)) {
+		qcs->flags |= QC_SF_H3_CLEN;
+		htx->extra = qcs->h3.body_len;
+	}
+
+	qcs->flags |= QC_SF_H3_HDRS;
+	return 1;
+}
+
+/* Transfers the payload of the DATA frame of <qcs> request stream into <htx>,
+ * adding the number of bytes removed from its RX buffer to <consumed>. The
+ * data are copied once, straight from the reassembled stream data to the
+ * HTX message of the upper layer. Returns 1 once the whole payload was
+ * transferred, 0 if not, -1 on error.
+ */
+static int qcs_h3_transfer_data(struct qcs *qcs, struct htx *htx, size_t *consumed)
+{
+	struct buffer *rxbuf = &qcs->rx.buf;
+	size_t len, sent;
+
+	if (!(qcs->flags & QC_SF_H3_HDRS) || (qcs->flags & QC_SF_H3_TLRS)) {
+		qcc_close(qcs->qcc, H3_EC_FRAME_UNEXPECTED);
+		return -1;
+	}
+
+	while (qcs->h3.flen) {
+		len = MIN(qcs->h3.flen, b_data(rxbuf));
+		if (!len) {
+			if (qcs_rx_complete(qcs)) {
+				qcc_close(qcs->qcc, H3_EC_FRAME_ERROR);
+				return -1;
+			}
+			return 0;
+		}
+
+		len = MIN(len, htx_free_data_space(htx));
+		len = MIN(len, b_contig_data(rxbuf, 0));
+		if (!len) {
+			qcs->flags |= QC_SF_DEM_FULL;
+			return 0;
+		}
+
+		if ((qcs->flags & QC_SF_H3_CLEN) && len > qcs->h3.body_len) {
+			qcs_reset(qcs, H3_EC_GENERAL_PROTOCOL_ERROR);
+			return -1;
+		}
+
+		sent = htx_add_data(htx, ist2(b_head(rxbuf), len));
+		b_del(rxbuf, sent);
+		*consumed += sent;
+		qcs->h3.flen -= sent;
+
+		if (qcs->flags & QC_SF_H3_CLEN) {
+			qcs->h3.body_len -= sent;
+			htx->extra = qcs->h3.body_len;
+		}
+
+		if (sent < len) {
+			qcs->flags |= QC_SF_DEM_FULL;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Decodes the HTTP/3 frames received on <qcs> request stream into the HTX
+ * message of <buf>. Returns the number of bytes added to <buf>.
+ */
+static size_t qcs_h3_rcv_buf(struct qcs *qcs, struct buffer *buf, size_t count)
+{
+	struct qcc *qcc = qcs->qcc;
+	struct conn_stream *cs = qcs->cs;
+	struct htx *htx;
+	size_t consumed = 0;
+	size_t data;
+	int ret = 1;
+
+	htx = htx_from_buf(buf);
+	data = htx->data;
+	qcs->flags &= ~QC_SF_DEM_FULL;
+
+	while (!(qcs->flags & (QC_SF_H3_BLOCKED | QC_SF_H3_EOM | QC_SF_RESET_SENT)) &&
+	       !(qcc->flags & QC_CF_ERROR)) {
+		qcs_rx_drain(qcs);
+		if (!qcs_h3_frame_hdr(qcs, &consumed)) {
+			if (b_data(&qcs->rx.buf) && qcs_rx_complete(qcs)) {
+				qcc_close(qcc, H3_EC_FRAME_ERROR);
+				break;
+			}
+			ret = 0;
+			break;
+		}
+
+		switch (qcs->h3.ft) {
+		case H3_FRM_HEADERS:
+			ret = qcs_h3_decode_headers(qcs, htx, &consumed);
+			break;
+		case H3_FRM_DATA:
+			ret = qcs_h3_transfer_data(qcs, htx, &consumed);
+			break;
+		case H3_FRM_CANCEL_PUSH:
+		case H3_FRM_SETTINGS:
+		case H3_FRM_PUSH_PROMISE:
+		case H3_FRM_GOAWAY:
+		case H3_FRM_MAX_PUSH_ID:
+			qcc_close(qcc, H3_EC_FRAME_UNEXPECTED);
+			ret = -1;
+			break;
+		default:
+			/* unknown and reserved frame types are ignored */
+			ret = qcs_h3_skip_frame(qcs, &consumed);
+			break;
+		}
+
+		if (ret <= 0)
+			break;
+
+		qcs->flags &= ~QC_SF_H3_FRAME;
+	}
+
+	qcs_consume(qcs, consumed);
+
+	/* end of the request once all the frames were decoded */
+	if (!ret && !(qcs->flags & (QC_SF_H3_FRAME | QC_SF_H3_EOM | QC_SF_RESET_SENT)) &&
+	    !(qcc->flags & QC_CF_ERROR) && qcs_rx_done(qcs)) {
+		if (!(qcs->flags & QC_SF_H3_HDRS))
+			qcs_reset(qcs, H3_EC_REQUEST_INCOMPLETE);
+		else if ((qcs->flags & QC_SF_H3_CLEN) && qcs->h3.body_len)
+			qcs_reset(qcs, H3_EC_GENERAL_PROTOCOL_ERROR);
+		else if (!htx_add_endof(htx, HTX_BLK_EOM))
+			qcs->flags |= QC_SF_DEM_FULL;
+		else
+			qcs->flags |= QC_SF_H3_EOM;
+	}
+
+	if (qcs->flags & QC_SF_DEM_FULL)
+		cs->flags |= (CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
+	else
+		cs->flags &= ~(CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
+
+	if (qcs->flags & QC_SF_H3_EOM)
+		cs->flags |= CS_FL_EOI;
+
+	data = htx->data - data;
+	htx_to_buf(htx, buf);
+	return data;
+}
+
+/* Encodes the HTTP/3 HEADERS frame for the response headers or the trailers
+ * at the head of <htx> for <qcs>. Returns the number of HTX bytes consumed,
+ * or 0 if there is not enough room yet or on error.
+ */
+static size_t qcs_h3_make_headers(struct qcs *qcs, struct htx *htx)
+{
+	struct htx_blk *blk = htx_get_head_blk(htx);
+	enum htx_blk_type type = htx_get_blk_type(blk);
+	enum htx_blk_type end_type = type == HTX_BLK_TLR ? HTX_BLK_EOT : HTX_BLK_EOH;
+	unsigned char *pos;
+	struct buffer outbuf;
+	struct htx_sl *sl;
+	size_t room, hlen;
+	size_t ret = 0;
+
+	/* The frame header is written once the payload length is known, with
+	 * 4 bytes reserved for this length, the payload being moved if needed.
+	 */
+	room = qcs_tx_room(qcs);
+	if (room <= 5)
+		return 0;
+
+	outbuf = b_make(b_tail(&qcs->tx.buf) + 5, room - 5, 0, 0);
+	if (!qpack_encode_prefix(&outbuf))
+		goto full;
+
+	if (type == HTX_BLK_RES_SL) {
+		sl = htx_get_blk_ptr(htx, blk);
+		if (!qpack_encode_int_status(&outbuf, sl->info.res.status)) {
+			if (sl->info.res.status < 100 || sl->info.res.status > 999)
+				goto fail;
+			goto full;
+		}
+		blk = htx_get_next_blk(htx, blk);
+	}
+
+	for (; blk; blk = htx_get_next_blk(htx, blk)) {
+		struct ist n, v;
+
+		type = htx_get_blk_type(blk);
+		if (type == HTX_BLK_UNUSED)
+			continue;
+
+		if (type == end_type)
+			break;
+
+		if (type != HTX_BLK_HDR && type != HTX_BLK_TLR)
+			goto fail;
+
+		n = htx_get_blk_name(htx, blk);
+		v = htx_get_blk_value(htx, blk);
+
+		/* these ones do not exist in H3 and must be dropped. */
+		if (isteq(n, ist("connection")) ||
+		    isteq(n, ist("proxy-connection")) ||
+		    isteq(n, ist("keep-alive")) ||
+		    isteq(n, ist("upgrade")) ||
+		    isteq(n, ist("transfer-encoding")))
+			continue;
+
+		if (!qpack_encode_header(&outbuf, n, v))
+			goto full;
+	}
+
+	/* incomplete headers */
+	if (!blk)
+		return 0;
+
+	pos = (unsigned char *)b_tail(&qcs->tx.buf);
+	hlen = 1 + quic_int_getsize(outbuf.data);
+	if (hlen < 5)
+		memmove(pos + hlen, pos + 5, outbuf.data);
+	*pos++ = H3_FRM_HEADERS;
+	quic_enc_int(&pos, pos + 4, outbuf.data);
+	qcs_tx_commit(qcs, hlen + outbuf.data);
+
+	/* remove all the blocks up to the end of headers included */
+	while (1) {
+		blk = htx_get_head_blk(htx);
+		type = htx_get_blk_type(blk);
+		ret += htx_get_blksz(blk);
+		htx_remove_blk(htx, blk);
+		if (type == end_type)
+			break;
+	}
+
+	return ret;
+
+ full:
+	/* Never enough room even in an empty buffer: the headers are too large. */
+	if (b_data(&qcs->tx.buf) || room < b_size(&qcs->tx.buf))
+		return 0;
+ fail:
+	qcs_reset(qcs, H3_EC_INTERNAL_ERROR);
+	return 0;
+}
+
+/* Encodes an HTTP/3 DATA frame for at most <count> bytes of the DATA block at
+ * the head of <htx> for <qcs>. Returns the number of HTX bytes consumed.
+ */
+static size_t qcs_h3_make_data(struct qcs *qcs, struct htx *htx, size_t count)
+{
+	struct htx_blk *blk = htx_get_head_blk(htx);
+	unsigned char *pos;
+	size_t len, hlen, room;
+
+	len = MIN(htx_get_blksz(blk), count);
+	room = qcs_tx_room(qcs);
+	hlen = 1 + quic_int_getsize(len);
+	if (hlen + len > room) {
+		if (room <= hlen)
+			return 0;
+		len = room - hlen;
+		hlen = 1 + quic_int_getsize(len);
+	}
+
+	pos = (unsigned char *)b_tail(&qcs->tx.buf);
+	*pos++ = H3_FRM_DATA;
+	quic_enc_int(&pos, pos + 8, len);
+	memcpy(pos, htx_get_blk_ptr(htx, blk), len);
+	qcs_tx_commit(qcs, hlen + len);
+
+	if (len == htx_get_blksz(blk))
+		htx_remove_blk(htx, blk);
+	else
+		htx_cut_data_blk(htx, blk, len);
+
+	return len;
+}
+
+/* Encodes the HTX response of <buf> into HTTP/3 frames for <qcs>, for no more
+ * than <count> bytes. Returns the number of HTX bytes consumed.
+ */
+static size_t qcs_h3_snd_buf(struct qcs *qcs, struct buffer *buf, size_t count)
+{
+	struct htx *htx = htx_from_buf(buf);
+	struct htx_blk *blk;
+	size_t total = 0;
+	size_t ret;
+
+	while (count && !htx_is_empty(htx) &&
+	       !(qcs->flags & (QC_SF_FIN_SENT | QC_SF_RESET_SENT)) &&
+	       !(qcs->qcc->flags & QC_CF_ERROR)) {
+		blk = htx_get_head_blk(htx);
+		switch (htx_get_blk_type(blk)) {
+		case HTX_BLK_RES_SL:
+		case HTX_BLK_TLR:
+			ret = qcs_h3_make_headers(qcs, htx);
+			break;
+		case HTX_BLK_DATA:
+			ret = qcs_h3_make_data(qcs, htx, count);
+			break;
+		case HTX_BLK_EOM:
+			ret = htx_get_blksz(blk);
+			htx_remove_blk(htx, blk);
+			qcs_send_fin(qcs);
+			break;
+		default:
+			/* unused blocks and lone end of trailers */
+			ret = htx_get_blksz(blk);
+			htx_remove_blk(htx, blk);
+			break;
+		}
+
+		if (!ret)
+			break;
+
+		total += ret;
+		count -= MIN(ret, count);
+	}
+
+	htx_to_buf(htx, buf);
+	return total;
+}
+
+/* Opens the local control stream of <qcc> and sends our SETTINGS frame. */
+static void qcc_h3_init(struct qcc *qcc)
+{
+	unsigned char buf[32], *pos = buf + 2, *end = buf + sizeof(buf);
+	size_t len;
+
+	qcc->h3.ctrl = qcc_local_uni_new(qcc, H3_UNI_CTRL);
+	if (!qcc->h3.ctrl)
+		return;
+
+	if (qcc->h3.dec.max_cap) {
+		quic_enc_int(&pos, end, H3_SETTINGS_QPACK_MAX_TABLE_CAPACITY);
+		quic_enc_int(&pos, end, qcc->h3.dec.max_cap);
+		quic_enc_int(&pos, end, H3_SETTINGS_QPACK_BLOCKED_STREAMS);
+		quic_enc_int(&pos, end, qcc->h3.dec.max_blocked);
+	}
+
+	/* the payload is less than 64 bytes long: 1-byte length */
+	len = pos - (buf + 2);
+	buf[0] = H3_FRM_SETTINGS;
+	buf[1] = len;
+	if (qcs_send_raw(qcc->h3.ctrl, (char *)buf, len + 2) != len + 2)
+		qcc_close(qcc, H3_EC_INTERNAL_ERROR);
+}
+
+/* Creates a new remote stream with <id> as ID for <qcc> frontend connection,
+ * with a new conn_stream and a new stream attached to it for bidirectional
+ * streams. Under memory pressure, the requests are rejected instead so that
+ * the client may retry them later. Returns the stream if succeeded, NULL if
+ * not.
+ */
+static struct qcs *qcc_remote_stream_new(struct qcc *qcc, uint64_t id)
+{
+	struct session *sess = qcc->conn->owner;
+	struct conn_stream *cs;
+	struct qcs *qcs;
+
+	qcs = qcs_new(qcc, id);
+	if (!qcs)
+		return NULL;
+
+	if (qcs_id_uni(id) || (qcc->flags & QC_CF_IS_BACK)) {
+		/* the HTTP/3 layer reads the type of the uni streams */
+		if (qcs_id_uni(id) && (qcc->flags & QC_CF_H3))
+			qcs->flags |= QC_SF_APP;
+		return qcs;
+	}
+
+	if (qc_mem_pressure(qcc->conn->quic_conn)) {
+		qcs_reset(qcs, H3_EC_REQUEST_REJECTED);
+		return qcs;
+	}
+
+	cs = cs_new(qcc->conn);
+	if (!cs)
+		goto out_destroy;
+
+	if (qcc->rx.nb_bidi > 1)
+		cs->flags |= CS_FL_NOT_FIRST;
+	qcs->cs = cs;
+	cs->ctx = qcs;
+	qcc->nb_cs++;
+
+	if (stream_create_from_cs(cs) < 0)
+		goto out_free_cs;
+
+	/* We want the accept date presented to the next stream to be the one
+	 * we have now, the handshake time to be null (since the next stream
+	 * is not delayed by a handshake), and the idle time to count since
+	 * right now.
+	 */
+	sess->accept_date = date;
+	sess->tv_accept   = now;
+	sess->t_handshake = 0;
+
+	return qcs;
+
+ out_free_cs:
+	qcc->nb_cs--;
+	cs_free(cs);
+	qcs->cs = NULL;
+ out_destroy:
+	qcs_destroy(qcs);
+	return NULL;
+}
+
+/* Returns the stream with <id> as ID for <qcc>, opening it (and all the
+ * remote streams of the same type with a lower ID) if it is a new remote
+ * stream. <*qcs> is set to NULL if the stream is already closed.
+ * Returns 1 if succeeded, 0 if not (stream limit or state error, or memory
+ * allocation failure).
+ */
+static int qcc_lookup_qcs(struct qcc *qcc, uint64_t id, struct qcs **qcs)
+{
+	uint64_t idx = id >> QCS_ID_TYPE_SHIFT;
+	uint64_t *nb, max;
+
+	qcc_init_params(qcc);
+	*qcs = qcc_get_qcs(qcc, id);
+	if (*qcs)
+		return 1;
+
+	if (qcs_id_local(qcc, id)) {
+		/* Local uni stream or not opened local bidi stream. */
+		if (qcs_id_uni(id) || idx >= qcc->tx.nb_bidi)
+			return 0;
+
+		/* Already closed. */
+		return 1;
+	}
+
+	if (qcs_id_uni(id)) {
+		nb = &qcc->rx.nb_uni;
+		max = qcc->rx.max_uni;
+	}
+	else {
+		nb = &qcc->rx.nb_bidi;
+		max = qcc->rx.max_bidi;
+	}
+
+	/* Already closed. */
+	if (idx < *nb)
+		return 1;
+
+	if (idx >= max)
+		return 0;
+
+	while (*nb <= idx) {
+		uint64_t nid = (*nb << QCS_ID_TYPE_SHIFT) | (id & QCS_ID_TYPE_MASK);
+
+		++*nb;
+		*qcs = qcc_remote_stream_new(qcc, nid);
+		if (!*qcs)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Handle a STREAM frame received for the stream with <id> as ID on <conn>
+ * connection, carrying <len> bytes of <data> at <offset>, with <fin> set if
+ * the FIN bit was set. Returns 1 if succeeded, 0 if not.
+ */
+int qcc_recv_stream(struct connection *conn, uint64_t id, uint64_t offset,
+                    const unsigned char *data, uint64_t len, int fin)
+{
+	struct qcc *qcc = conn->ctx;
+	struct qcs *qcs;
+	uint64_t end = offset + len;
+
+	if (qcc->flags & QC_CF_ERROR)
+		return 1;
+
+	if (!qcc_lookup_qcs(qcc, id, &qcs))
+		return 0;
+
+	if (!qcs)
+		return 1;
+
+	/* We never receive anything on our uni streams. */
+	if (qcs_id_uni(id) && qcs_id_local(qcc, id))
+		return 0;
+
+	/* Flow control and final size checks. */
+	if (end > qcs->rx.max_data)
+		return 0;
+
+	if (qcs->flags & QC_SF_FIN_RECV) {
+		if (end > qcs->rx.final_size || (fin && end != qcs->rx.final_size))
+			return 0;
+	}
+	else if (fin) {
+		if (end < qcs->rx.max_offset)
+			return 0;
+
+		qcs->rx.final_size = end;
+		qcs->flags |= QC_SF_FIN_RECV;
+	}
+
+	if (end > qcs->rx.max_offset) {
+		qcc->rx.offsets += end - qcs->rx.max_offset;
+		if (qcc->rx.offsets > qcc->rx.max_data)
+			return 0;
+
+		/* No upper layer: the data are discarded. */
+		if (!qcs_has_upper(qcs)) {
+			qcs->rx.offset = end;
+			qcs_consume(qcs, end - qcs->rx.max_offset);
+		}
+		qcs->rx.max_offset = end;
+	}
+
+	if (!qcs_has_upper(qcs)) {
+		qcs_try_release(qcs);
+		return 1;
+	}
+
+	/* Already received data. */
+	if (end <= qcs->rx.offset)
+		goto out;
+
+	if (offset < qcs->rx.offset) {
+		data += qcs->rx.offset - offset;
+		len -= qcs->rx.offset - offset;
+		offset = qcs->rx.offset;
+	}
+
+	if (offset == qcs->rx.offset &&
+	    (b_size(&qcs->rx.buf) || b_alloc_margin(&qcs->rx.buf, 0))) {
+		size_t ret;
+
+		ret = b_putblk(&qcs->rx.buf, (const char *)data, len);
+		qcs->rx.offset += ret;
+		data += ret;
+		len -= ret;
+		offset += ret;
+		if (ret)
+			qcs_rx_drain(qcs);
+	}
+
+	if (len && !qcs_rx_store(qcs, offset, data, len))
+		return 0;
+
+ out:
+	if (qcs->flags & QC_SF_APP)
+		qcs_h3_recv_uni(qcs);
+	else if (b_data(&qcs->rx.buf) || qcs_rx_done(qcs))
+		qcs_notify_recv(qcs);
+	return 1;
+}
+
+/* Handle a RESET_STREAM frame received for the stream with <id> as ID on
+ * <conn> connection. Returns 1 if succeeded, 0 if not.
+ */
+int qcc_recv_reset_stream(struct connection *conn, uint64_t id, uint64_t final_size)
+{
+	struct qcc *qcc = conn->ctx;
+	struct qcs *qcs;
+
+	if (qcc->flags & QC_CF_ERROR)
+		return 1;
+
+	if (!qcc_lookup_qcs(qcc, id, &qcs))
+		return 0;
+
+	if (!qcs)
+		return 1;
+
+	if (qcs_id_uni(id) && qcs_id_local(qcc, id))
+		return 0;
+
+	if (final_size < qcs->rx.max_offset ||
+	    ((qcs->flags & QC_SF_FIN_RECV) && final_size != qcs->rx.final_size))
+		return 0;
+
+	qcc->rx.offsets += final_size - qcs->rx.max_offset;
+	qcs->rx.max_offset = qcs->rx.final_size = final_size;
+	qcs->flags |= QC_SF_FIN_RECV | QC_SF_RESET;
+	if (qcs->flags & QC_SF_APP) {
+		/* only the critical streams may have a known type here */
+		if (qcs->h3.type != QCS_H3_TYPE_UNSET) {
+			qcc_close(qcc, H3_EC_CLOSED_CRITICAL_STREAM);
+			return 1;
+		}
+		qcs->flags &= ~QC_SF_APP;
+	}
+
+	if (qcs->cs)
+		qcs->cs->flags |= CS_FL_ERROR;
+	qcs_alert(qcs);
+	qcs_try_release(qcs);
+
+	return 1;
+}
+
+/* Handle a MAX_DATA frame received on <conn> connection. */
+int qcc_recv_max_data(struct connection *conn, uint64_t max)
+{
+	struct qcc *qcc = conn->ctx;
+	struct eb64_node *node;
+
+	qcc_update_tx_params(qcc);
+	if (max <= qcc->tx.max_data)
+		return 1;
+
+	qcc->tx.max_data = max;
+	if (!(qcc->flags & QC_CF_BLK_MFCTL))
+		return 1;
+
+	qcc->flags &= ~QC_CF_BLK_MFCTL;
+	for (node = eb64_first(&qcc->streams_by_id); node; node = eb64_next(node)) {
+		struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+		if (!(qcs->flags & QC_SF_BLK_SFCTL))
+			qcs_notify_send(qcs);
+	}
+
+	return 1;
+}
+
+/* Handle a MAX_STREAM_DATA frame received for the stream with <id> as ID on
+ * <conn> connection. Returns 1 if succeeded, 0 if not.
+ */
+int qcc_recv_max_stream_data(struct connection *conn, uint64_t id, uint64_t max)
+{
+	struct qcc *qcc = conn->ctx;
+	struct qcs *qcs;
+
+	if (!qcc_lookup_qcs(qcc, id, &qcs))
+		return 0;
+
+	if (!qcs)
+		return 1;
+
+	qcs_update_tx_params(qcs);
+	if (max <= qcs->tx.max_data)
+		return 1;
+
+	qcs->tx.max_data = max;
+	if (qcs->flags & QC_SF_BLK_SFCTL) {
+		qcs->flags &= ~QC_SF_BLK_SFCTL;
+		qcs_notify_send(qcs);
+	}
+
+	return 1;
+}
+
+/* Handle a MAX_STREAMS frame received on <conn> connection, for unidirectional
+ * streams if <uni> is set. Only bidirectional streams are opened locally.
+ */
+int qcc_recv_max_streams(struct connection *conn, uint64_t max, int uni)
+{
+	struct qcc *qcc = conn->ctx;
+
+	if (!uni) {
+		qcc_update_tx_params(qcc);
+		qcc->tx.max_bidi = MAX(qcc->tx.max_bidi, max);
+	}
+
+	return 1;
+}
+
+/* Called by the transport layer when the <len> bytes of the STREAM frame at
+ * <offset> of the stream with <id> as ID have been acknowledged, <fin> being
+ * set if this frame had its FIN bit set.
+ */
+void qcc_stream_acked(struct connection *conn, uint64_t id,
+                      uint64_t offset, uint64_t len, int fin)
+{
+	struct qcc *qcc = conn->ctx;
+	struct qcs *qcs;
+	struct eb64_node *node;
+	uint64_t end = offset + len;
+
+	qcs = qcc_get_qcs(qcc, id);
+	if (!qcs)
+		return;
+
+	if (fin)
+		qcs->flags |= QC_SF_FIN_ACKED;
+
+	if (offset > qcs->tx.ack_offset) {
+		struct qcs_frm *rng;
+
+		rng = pool_alloc(pool_head_qcs_ack);
+		if (rng) {
+			rng->offset_node.key = offset;
+			rng->len = len;
+			eb64_insert(&qcs->tx.acked, &rng->offset_node);
+		}
+		return;
+	}
+
+	/* Release the data acknowledged in order. */
+	while (1) {
+		if (end > qcs->tx.ack_offset) {
+			b_del(&qcs->tx.buf, end - qcs->tx.ack_offset);
+			qcs->tx.ack_offset = end;
+		}
+
+		node = eb64_first(&qcs->tx.acked);
+		if (!node || node->key > qcs->tx.ack_offset)
+			break;
+
+		end = node->key + eb64_entry(&node->node, struct qcs_frm, offset_node)->len;
+		eb64_delete(node);
+		pool_free(pool_head_qcs_ack, eb64_entry(&node->node, struct qcs_frm, offset_node));
+	}
+
+	if (qcs->tx.ack_offset == qcs->tx.offset && b_size(&qcs->tx.buf)) {
+		b_free(&qcs->tx.buf);
+		offer_buffers(NULL, tasks_run_queue);
+	}
 
-static void mux_quic_destroy(struct mux_quic_ctx *ctx)
+	if (!qcs_try_release(qcs))
+		qcs_notify_send(qcs);
+}
+
+/* Release <qcc> and the associated connection if still attached to it */
+static void qcc_release(struct qcc *qcc)
 {
-	fprintf(stderr, "%s\n", __func__);
-	/* The connection must be aattached to this mux to be released */
-	if (ctx && ctx->conn && ctx->conn->ctx == ctx) {
-		struct connection *conn = ctx->conn;
+	struct eb64_node *node;
+
+	if (!qcc)
+		return;
+
+	while ((node = eb64_first(&qcc->streams_by_id))) {
+		struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+		if (qcs->cs)
+			qcs->cs->ctx = NULL;
+		qcs_destroy(qcs);
+	}
+	qpack_dec_deinit(&qcc->h3.dec);
+
+	/* The connection must be attached to this mux to be released */
+	if (qcc->conn && qcc->conn->ctx == qcc) {
+		struct connection *conn = qcc->conn;
 
 		conn_stop_tracking(conn);
 		conn_full_close(conn);
-		tasklet_free(ctx->wait_event.tasklet);
+		tasklet_free(qcc->wait_event.tasklet);
 		conn->mux = NULL;
 		conn->ctx = NULL;
 		if (conn->destroy_cb)
 			conn->destroy_cb(conn);
 		/* We don't bother unsubscribing here, as we're about to destroy
-		 * both the connection and the mux_quic_ctx
+		 * both the connection and the qcc
 		 */
 		conn_free(conn);
 	}
-	pool_free(pool_head_quic_ctx, ctx);
+	else if (qcc->wait_event.tasklet)
+		tasklet_free(qcc->wait_event.tasklet);
+	pool_free(pool_head_qcc, qcc);
 }
 
 /* Callback, used when we get I/Os while in idle mode */
 static struct task *mux_quic_io_cb(struct task *t, void *tctx, unsigned short status)
 {
-	struct mux_quic_ctx *ctx = tctx;
-
-	fprintf(stderr, "%s\n", __func__);
-	if (ctx->cs) {
-		/* There's a small race condition.
-		 * mux_quic_io_cb() is only supposed to be called if we have no
-		 * stream attached. However, maybe the tasklet got woken up,
-		 * and this connection was then attached to a new stream.
-		 * If this happened, just wake the tasklet up if anybody
-		 * subscribed to receive events, and otherwise call the wake
-		 * method, to make sure the event is noticed.
-		 */
-		if (ctx->conn->subs) {
-			ctx->conn->subs->events = 0;
-			tasklet_wakeup(ctx->conn->subs->tasklet);
-			ctx->conn->subs = NULL;
-		} else if (ctx->cs->data_cb->wake)
-			ctx->cs->data_cb->wake(ctx->cs);
+	struct qcc *qcc = tctx;
+
+	if (qcc->nb_cs)
 		return NULL;
-	}
-	conn_sock_drain(ctx->conn);
-	if (ctx->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH))
-		mux_quic_destroy(ctx);
+
+	if (qcc->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH))
+		qcc_release(qcc);
 	else
-		ctx->conn->xprt->subscribe(ctx->conn, ctx->conn->xprt_ctx, SUB_RETRY_RECV,
-		    &ctx->wait_event);
+		qcc->conn->xprt->subscribe(qcc->conn, qcc->conn->xprt_ctx, SUB_RETRY_RECV,
+		    &qcc->wait_event);
 
 	return NULL;
 }
 
+/* Opens a new local bidirectional stream for <qcc>, attaching <cs> to it.
+ * Returns the stream if succeeded, NULL if not.
+ */
+static struct qcs *qcc_local_stream_new(struct qcc *qcc, struct conn_stream *cs)
+{
+	struct qcs *qcs;
+	uint64_t id;
+
+	id = qcc->tx.nb_bidi << QCS_ID_TYPE_SHIFT;
+	if (!(qcc->flags & QC_CF_IS_BACK))
+		id |= QCS_ID_SRV_INITIATOR_BIT;
+
+	qcs = qcs_new(qcc, id);
+	if (!qcs)
+		return NULL;
+
+	qcc->tx.nb_bidi++;
+	qcs->cs = cs;
+	cs->ctx = qcs;
+	qcc->nb_cs++;
+
+	return qcs;
+}
+
 /* Initialize the mux once it's attached. It is expected that conn->ctx
  * points to the existing conn_stream (for outgoing connections) or NULL (for
- * incoming ones, in which case one will be allocated and a new stream will be
- * instanciated). Returns < 0 on error.
+ * incoming ones, in which case the streams will be instanciated upon STREAM
+ * frame receipt). Returns < 0 on error.
  */
 static int mux_quic_init(struct connection *conn, struct proxy *prx, struct session *sess,
 		       struct buffer *input)
 {
 	struct conn_stream *cs = conn->ctx;
-	struct mux_quic_ctx *ctx = pool_alloc(pool_head_quic_ctx);
+	struct qcc *qcc = pool_alloc(pool_head_qcc);
 
-	fprintf(stderr, "%s\n", __func__);
-	if (!ctx)
+	if (!qcc)
 		goto fail;
 
-	ctx->wait_event.tasklet = tasklet_new();
-	if (!ctx->wait_event.tasklet)
-		goto fail_free_ctx;
-	ctx->wait_event.tasklet->context = ctx;
-	ctx->wait_event.tasklet->process = mux_quic_io_cb;
-	ctx->wait_event.events = 0;
-	ctx->conn = conn;
+	qcc->wait_event.tasklet = tasklet_new();
+	if (!qcc->wait_event.tasklet)
+		goto fail_free_qcc;
+	qcc->wait_event.tasklet->context = qcc;
+	qcc->wait_event.tasklet->process = mux_quic_io_cb;
+	qcc->wait_event.events = 0;
+	qcc->conn = conn;
+	qcc->flags = conn_is_back(conn) ? QC_CF_IS_BACK : QC_CF_NONE;
+	qcc->nb_streams = 0;
+	qcc->nb_cs = 0;
+	qcc->streams_by_id = EB_ROOT_UNIQUE;
+	memset(&qcc->rx, 0, sizeof qcc->rx);
+	memset(&qcc->tx, 0, sizeof qcc->tx);
+	qcc->h3.ctrl = qcc->h3.qpdec = NULL;
 
-	if (!cs) {
-		cs = cs_new(conn);
-		if (!cs)
-			goto fail_free_ctx;
+	/* the HTX flavour of the mux runs the HTTP/3 application layer */
+	if (conn->mux->flags & MX_FL_HTX)
+		qcc->flags |= QC_CF_H3;
 
-		if (stream_create_from_cs(cs) < 0)
-			goto fail_free;
+	if (!qpack_dec_init(&qcc->h3.dec, (qcc->flags & QC_CF_H3) ? QCC_H3_QPACK_MAX_CAP : 0,
+	                    QCC_H3_QPACK_MAX_BLOCKED))
+		goto fail_free_qcc;
 
-	}
-	conn->ctx = ctx;
-	ctx->cs = cs;
-	cs->flags |= CS_FL_RCV_MORE;
-	if (global.tune.options & GTUNE_USE_SPLICE)
-		cs->flags |= CS_FL_MAY_SPLICE;
+	if (cs && !qcc_local_stream_new(qcc, cs))
+		goto fail_free_dec;
+
+	conn->ctx = qcc;
 	return 0;
 
- fail_free:
-	cs_free(cs);
-fail_free_ctx:
-	if (ctx->wait_event.tasklet)
-		tasklet_free(ctx->wait_event.tasklet);
-	pool_free(pool_head_quic_ctx, ctx);
+ fail_free_dec:
+	qpack_dec_deinit(&qcc->h3.dec);
+ fail_free_qcc:
+	if (qcc->wait_event.tasklet)
+		tasklet_free(qcc->wait_event.tasklet);
+	pool_free(pool_head_qcc, qcc);
  fail:
 	return -1;
 }
 
-/* callback to be used by default for the pass-through mux. It calls the data
- * layer wake() callback if it is set otherwise returns 0.
+/* callback used by the transport layer to report activity. Errors are
+ * reported to all the attached streams. Returns 0 or -1 if the connection
+ * was released.
  */
 static int mux_quic_wake(struct connection *conn)
 {
-	struct mux_quic_ctx *ctx = conn->ctx;
-	struct conn_stream *cs = ctx->cs;
-	int ret = 0;
+	struct qcc *qcc = conn->ctx;
+	struct eb64_node *node;
 
-	fprintf(stderr, "%s\n", __func__);
-	if (cs) {
-		ret = cs->data_cb->wake ? cs->data_cb->wake(cs) : 0;
-
-		if (ret < 0)
-			return ret;
-	} else {
-		conn_sock_drain(conn);
-		if (conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH)) {
-			mux_quic_destroy(ctx);
+	if (conn->flags & CO_FL_ERROR) {
+		if (!qcc->nb_cs) {
+			qcc_release(qcc);
 			return -1;
 		}
+
+		for (node = eb64_first(&qcc->streams_by_id); node; node = eb64_next(node)) {
+			struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+			if (qcs->cs) {
+				qcs->cs->flags |= CS_FL_ERR_PENDING;
+				qcs_alert(qcs);
+			}
+		}
 	}
 
 	/* If we had early data, and we're done with the handshake
@@ -157,7 +2191,7 @@ static int mux_quic_wake(struct connection *conn)
 	if ((conn->flags & (CO_FL_EARLY_DATA | CO_FL_EARLY_SSL_HS | CO_FL_WAIT_XPRT)) ==
 	    CO_FL_EARLY_DATA)
 		conn->flags &= ~CO_FL_EARLY_DATA;
-	return ret;
+	return 0;
 }
 
 /*
@@ -167,119 +2201,179 @@ static int mux_quic_wake(struct connection *conn)
 static struct conn_stream *mux_quic_attach(struct connection *conn, struct session *sess)
 {
 	struct conn_stream *cs;
-	struct mux_quic_ctx *ctx = conn->ctx;
+	struct qcc *qcc = conn->ctx;
 
-	fprintf(stderr, "%s\n", __func__);
-	if (ctx->wait_event.events)
-		conn->xprt->unsubscribe(ctx->conn, conn->xprt_ctx, SUB_RETRY_RECV, &ctx->wait_event);
+	if (qcc->wait_event.events)
+		conn->xprt->unsubscribe(qcc->conn, conn->xprt_ctx, SUB_RETRY_RECV, &qcc->wait_event);
 	cs = cs_new(conn);
 	if (!cs)
 		goto fail;
 
-	ctx->cs = cs;
-	cs->flags |= CS_FL_RCV_MORE;
-	return (cs);
-fail:
+	if (!qcc_local_stream_new(qcc, cs))
+		goto fail_free;
+
+	return cs;
+
+ fail_free:
+	cs_free(cs);
+ fail:
 	return NULL;
 }
 
-/* Retrieves a valid conn_stream from this connection, or returns NULL. For
- * this mux, it's easy as we can only store a single conn_stream.
- */
+/* Retrieves the first valid conn_stream from this connection, or returns NULL. */
 static const struct conn_stream *mux_quic_get_first_cs(const struct connection *conn)
 {
-	struct mux_quic_ctx *ctx = conn->ctx;
-	struct conn_stream *cs = ctx->cs;
+	struct qcc *qcc = conn->ctx;
+	struct eb64_node *node;
 
-	fprintf(stderr, "%s\n", __func__);
-	return cs;
+	for (node = eb64_first(&qcc->streams_by_id); node; node = eb64_next(node)) {
+		struct qcs *qcs = eb64_entry(&node->node, struct qcs, by_id);
+
+		if (qcs->cs)
+			return qcs->cs;
+	}
+
+	return NULL;
 }
 
 /* Destroy the mux and the associated connection if still attached to this mux
  * and no longer used */
 static void mux_quic_destroy_meth(void *ctx)
 {
-	struct mux_quic_ctx *quic = ctx;
+	struct qcc *qcc = ctx;
 
-	fprintf(stderr, "%s\n", __func__);
-	if (!(quic->cs) || !(quic->conn) || quic->conn->ctx != quic)
-		mux_quic_destroy(quic);
+	if (!qcc->nb_cs || !qcc->conn || qcc->conn->ctx != qcc)
+		qcc_release(qcc);
 }
 
 /*
  * Detach the stream from the connection and possibly release the connection.
+ * The stream itself is kept until all its data have been acknowledged.
  */
 static void mux_quic_detach(struct conn_stream *cs)
 {
 	struct connection *conn = cs->conn;
-	struct mux_quic_ctx *ctx = cs->conn->ctx;
+	struct qcs *qcs = cs->ctx;
+	struct qcc *qcc = conn->ctx;
+
+	cs->ctx = NULL;
+	if (qcs) {
+		qcs->cs = NULL;
+		qcc->nb_cs--;
+		/* The data not consumed yet are discarded. */
+		qcs_frms_free(qcs, &qcs->rx.frms, 1);
+		b_reset(&qcs->rx.buf);
+		qcs->rx.offset = qcs->rx.max_offset;
+		qcs_consume(qcs, qcs->rx.max_offset - qcs->rx.consumed);
+		if (qcc->flags & QC_CF_H3) {
+			char area[16];
+			struct buffer inst = b_make(area, sizeof(area), 0, 0);
+
+			/* An incomplete response must not look complete. */
+			if (!(qcs->flags & QC_SF_FIN_SENT))
+				qcs_reset(qcs, H3_EC_INTERNAL_ERROR);
+
+			if (qcs->flags & QC_SF_H3_BLOCKED) {
+				qcs->flags &= ~QC_SF_H3_BLOCKED;
+				qpack_dec_unblock(&qcc->h3.dec);
+			}
+
+			/* the encoder may release its references to our stream */
+			if (qcc->h3.dec.max_cap && !qcs_rx_complete(qcs) &&
+			    qpack_enc_stream_cancel(&inst, qcs->by_id.key))
+				qcc_h3_send_dec_inst(qcc, &inst);
+		}
+		qcs_send_fin(qcs);
+		qcs_stop_sending(qcs, qcc_no_error(qcc));
+		qcs_try_release(qcs);
+	}
+
+	if ((qcc->flags & QC_CF_IS_BACK) && objt_server(conn->target) &&
+	    !(conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH))) {
+		struct server *srv = __objt_server(conn->target);
+
+		/* Never ever allow to reuse a connection from a non-reuse backend */
+		if ((srv->proxy->options & PR_O_REUSE_MASK) == PR_O_REUSE_NEVR)
+			conn->flags |= CO_FL_PRIVATE;
+
+		if (!qcc->nb_cs) {
+			if (conn->owner &&
+			    session_check_idle_conn(conn->owner, conn) != 0) {
+				/* At this point either the connection is destroyed,
+				 * or it's been added to the server idle list.
+				 */
+				return;
+			}
+			if (!(conn->flags & CO_FL_PRIVATE)) {
+				/* The connections are never taken over by another
+				 * thread: all the QUIC connection states, and its
+				 * timers, are bound to the thread which opened it.
+				 */
+				if (!srv_add_to_idle_list(srv, conn, 1)) {
+					/* The server doesn't want it, let's kill the connection right away */
+					qcc_release(qcc);
+					return;
+				}
+				/* Subscribe, to know if we got disconnected while idle */
+				conn->xprt->subscribe(conn, conn->xprt_ctx, SUB_RETRY_RECV, &qcc->wait_event);
+				return;
+			}
+		}
+		else if (MT_LIST_ISEMPTY(&conn->list) && mux_quic_avail_streams(conn) > 0) {
+			LIST_ADD(&srv->available_conns[tid], mt_list_to_list(&conn->list));
+		}
+	}
+
+	if (qcc->nb_cs)
+		return;
 
-	fprintf(stderr, "%s\n", __func__);
 	/* Subscribe, to know if we got disconnected */
 	if (conn->owner != NULL &&
-	    !(conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH))) {
-		ctx->cs = NULL;
-		conn->xprt->subscribe(conn, conn->xprt_ctx, SUB_RETRY_RECV, &ctx->wait_event);
-	} else
+	    !(conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH)))
+		conn->xprt->subscribe(conn, conn->xprt_ctx, SUB_RETRY_RECV, &qcc->wait_event);
+	else
 		/* There's no session attached to that connection, destroy it */
-		mux_quic_destroy(ctx);
+		qcc_release(qcc);
 }
 
 /* returns the number of streams in use on a connection */
 static int mux_quic_used_streams(struct connection *conn)
 {
-	struct mux_quic_ctx *ctx = conn->ctx;
+	struct qcc *qcc = conn->ctx;
 
-	fprintf(stderr, "%s\n", __func__);
-	return ctx->cs ? 1 : 0;
+	return qcc->nb_cs;
 }
 
 /* returns the number of streams still available on a connection */
 static int mux_quic_avail_streams(struct connection *conn)
 {
-	fprintf(stderr, "%s\n", __func__);
-	return 1 - mux_quic_used_streams(conn);
+	struct qcc *qcc = conn->ctx;
+
+	qcc_update_tx_params(qcc);
+	if (qcc->tx.nb_bidi >= qcc->tx.max_bidi)
+		return 0;
+
+	return MIN(qcc->tx.max_bidi - qcc->tx.nb_bidi, INT_MAX);
 }
 
 static void mux_quic_shutr(struct conn_stream *cs, enum cs_shr_mode mode)
 {
-	fprintf(stderr, "%s\n", __func__);
-#if 0
-	if (cs->flags & CS_FL_SHR)
+	struct qcs *qcs = cs->ctx;
+
+	if (cs->flags & CS_FL_SHR || !qcs)
 		return;
-	cs->flags &= ~(CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
-	if (conn_xprt_ready(cs->conn) && cs->conn->xprt->shutr)
-		cs->conn->xprt->shutr(cs->conn, cs->conn->xprt_ctx,
-		    (mode == CS_SHR_DRAIN));
-	if (cs->flags & CS_FL_SHW)
-		conn_full_close(cs->conn);
-	/* Maybe we've been put in the list of available idle connections,
-	 * get ouf of here
-	 */
-	MT_LIST_DEL(&cs->conn->list);
-	MT_LIST_INIT(&cs->conn->list);
-#endif
+
+	qcs_stop_sending(qcs, qcc_no_error(qcs->qcc));
 }
 
 static void mux_quic_shutw(struct conn_stream *cs, enum cs_shw_mode mode)
 {
-	fprintf(stderr, "%s\n", __func__);
-#if 0
-	if (cs->flags & CS_FL_SHW)
+	struct qcs *qcs = cs->ctx;
+
+	if (cs->flags & CS_FL_SHW || !qcs)
 		return;
-	if (conn_xprt_ready(cs->conn) && cs->conn->xprt->shutw)
-		cs->conn->xprt->shutw(cs->conn, cs->conn->xprt_ctx,
-		    (mode == CS_SHW_NORMAL));
-	if (!(cs->flags & CS_FL_SHR))
-		conn_sock_shutw(cs->conn, (mode == CS_SHW_NORMAL));
-	else
-		conn_full_close(cs->conn);
-	/* Maybe we've been put in the list of available idle connections,
-	 * get ouf of here
-	 */
-	MT_LIST_DEL(&cs->conn->list);
-	MT_LIST_INIT(&cs->conn->list);
-#endif
+
+	qcs_send_fin(qcs);
 }
 
 /*
@@ -287,37 +2381,85 @@ static void mux_quic_shutw(struct conn_stream *cs, enum cs_shw_mode mode)
  */
 static size_t mux_quic_rcv_buf(struct conn_stream *cs, struct buffer *buf, size_t count, int flags)
 {
+	struct qcs *qcs = cs->ctx;
 	size_t ret;
 
-	fprintf(stderr, "%s\n", __func__);
 	if (!count) {
 		cs->flags |= (CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
 		return 0;
 	}
+
+	if (qcs->qcc->flags & QC_CF_H3) {
+		/* The frames are decoded straight from the stream data to
+		 * the HTX message of <buf>, which are copied only once.
+		 */
+		ret = qcs_h3_rcv_buf(qcs, buf, count);
+		if (cs->flags & CS_FL_EOI && qcs_rx_done(qcs))
+			cs->flags |= CS_FL_EOS;
+		if (!b_data(&qcs->rx.buf) && b_size(&qcs->rx.buf)) {
+			b_free(&qcs->rx.buf);
+			offer_buffers(NULL, tasks_run_queue);
+		}
+		goto end;
+	}
+
 	b_realign_if_empty(buf);
-	ret = cs->conn->xprt->rcv_buf(cs->conn, cs->conn->xprt_ctx, buf, count, flags);
-	if (conn_xprt_read0_pending(cs->conn)) {
+	ret = b_xfer(buf, &qcs->rx.buf, MIN(count, b_room(buf)));
+	qcs_rx_drain(qcs);
+	qcs_consume(qcs, ret);
+
+	if (b_data(&qcs->rx.buf))
+		cs->flags |= (CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
+	else {
 		cs->flags &= ~(CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
-		cs->flags |= CS_FL_EOS;
+		if (qcs_rx_done(qcs))
+			cs->flags |= CS_FL_EOI | CS_FL_EOS;
+		if (b_size(&qcs->rx.buf)) {
+			b_free(&qcs->rx.buf);
+			offer_buffers(NULL, tasks_run_queue);
+		}
 	}
-	if (cs->conn->flags & CO_FL_ERROR) {
+
+ end:
+	if (cs->conn->flags & CO_FL_ERROR || qcs->flags & (QC_SF_RESET | QC_SF_RESET_SENT) ||
+	    qcs->qcc->flags & QC_CF_ERROR) {
 		cs->flags &= ~(CS_FL_RCV_MORE | CS_FL_WANT_ROOM);
 		cs->flags |= CS_FL_ERROR;
 	}
 	return ret;
 }
 
-/* Called from the upper layer, to send data */
+/* Called from the upper layer, to send data. The data are copied in the TX
+ * buffer of the stream where they remain until they are acknowledged, the
+ * STREAM frames pointing to them. This buffer is never realigned. Returns
+ * the number of bytes consumed from <buf>.
+ */
 static size_t mux_quic_snd_buf(struct conn_stream *cs, struct buffer *buf, size_t count, int flags)
 {
-	size_t ret;
+	struct qcs *qcs = cs->ctx;
+	size_t total = 0;
 
-	fprintf(stderr, "%s\n", __func__);
-	ret = cs->conn->xprt->snd_buf(cs->conn, cs->conn->xprt_ctx, buf, count, flags);
+	if (qcs->flags & (QC_SF_FIN_SENT | QC_SF_RESET_SENT) || qcs_id_uni(qcs->by_id.key))
+		return 0;
 
-	if (ret > 0)
-		b_del(buf, ret);
-	return ret;
+	if (qcs->qcc->flags & QC_CF_H3)
+		return qcs_h3_snd_buf(qcs, buf, count);
+
+	while (count) {
+		size_t len = MIN(count, qcs_tx_room(qcs));
+
+		if (!len)
+			break;
+
+		b_getblk(buf, b_tail(&qcs->tx.buf), len, total);
+		qcs_tx_commit(qcs, len);
+		total += len;
+		count -= len;
+	}
+
+	if (total)
+		b_del(buf, total);
+	return total;
 }
 
 /* Called from the upper layer, to subscribe <es> to events <event_type>. The
@@ -327,8 +2469,14 @@ static size_t mux_quic_snd_buf(struct conn_stream *cs, struct buffer *buf, size_
  */
 static int mux_quic_subscribe(struct conn_stream *cs, int event_type, struct wait_event *es)
 {
-	fprintf(stderr, "%s xprt %s\n", __func__, cs->conn->xprt->name);
-	return cs->conn->xprt->subscribe(cs->conn, cs->conn->xprt_ctx, event_type, es);
+	struct qcs *qcs = cs->ctx;
+
+	BUG_ON(event_type & ~(SUB_RETRY_SEND|SUB_RETRY_RECV));
+	BUG_ON(qcs->subs && qcs->subs != es);
+
+	es->events |= event_type;
+	qcs->subs = es;
+	return 0;
 }
 
 /* Called from the upper layer, to unsubscribe <es> from events <event_type>.
@@ -337,14 +2485,21 @@ static int mux_quic_subscribe(struct conn_stream *cs, int event_type, struct wai
  */
 static int mux_quic_unsubscribe(struct conn_stream *cs, int event_type, struct wait_event *es)
 {
-	fprintf(stderr, "%s\n", __func__);
-	return cs->conn->xprt->unsubscribe(cs->conn, cs->conn->xprt_ctx, event_type, es);
+	struct qcs *qcs = cs->ctx;
+
+	BUG_ON(event_type & ~(SUB_RETRY_SEND|SUB_RETRY_RECV));
+	BUG_ON(qcs->subs && qcs->subs != es);
+
+	es->events &= ~event_type;
+	if (!es->events)
+		qcs->subs = NULL;
+	return 0;
 }
 
 static int mux_quic_ctl(struct connection *conn, enum mux_ctl_type mux_ctl, void *output)
 {
 	int ret = 0;
-	fprintf(stderr, "%s\n", __func__);
+
 	switch (mux_ctl) {
 	case MUX_STATUS:
 		if (!(conn->flags & CO_FL_WAIT_XPRT))
@@ -355,6 +2510,23 @@ static int mux_quic_ctl(struct connection *conn, enum mux_ctl_type mux_ctl, void
 	}
 }
 
+/* for debugging with CLI's "show fd" and "show quic" commands */
+static void mux_quic_show_fd(struct buffer *msg, struct connection *conn)
+{
+	struct qcc *qcc = conn->ctx;
+
+	if (!qcc)
+		return;
+
+	chunk_appendf(msg, " qcc.flg=0x%08x .nbst=%u .nbcs=%u"
+		      " .rx=[bidi=%llu/%llu,uni=%llu/%llu] .tx=[bidi=%llu/%llu,uni=%llu/%llu]",
+		      qcc->flags, qcc->nb_streams, qcc->nb_cs,
+		      (unsigned long long)qcc->rx.nb_bidi, (unsigned long long)qcc->rx.max_bidi,
+		      (unsigned long long)qcc->rx.nb_uni, (unsigned long long)qcc->rx.max_uni,
+		      (unsigned long long)qcc->tx.nb_bidi, (unsigned long long)qcc->tx.max_bidi,
+		      (unsigned long long)qcc->tx.nb_uni, (unsigned long long)qcc->tx.max_uni);
+}
+
 /* The mux operations */
 const struct mux_ops mux_quic_ops = {
 	.init = mux_quic_init,
@@ -372,12 +2544,88 @@ const struct mux_ops mux_quic_ops = {
 	.ctl = mux_quic_ctl,
 	.shutr = mux_quic_shutr,
 	.shutw = mux_quic_shutw,
+	.show_fd = mux_quic_show_fd,
 	.flags = MX_FL_NONE,
 	.name = "QUIC",
 };
 
+/* The same running HTTP/3 over the QUIC streams, for HTTP frontends */
+const struct mux_ops mux_quic_h3_ops = {
+	.init = mux_quic_init,
+	.wake = mux_quic_wake,
+	.rcv_buf = mux_quic_rcv_buf,
+	.snd_buf = mux_quic_snd_buf,
+	.subscribe = mux_quic_subscribe,
+	.unsubscribe = mux_quic_unsubscribe,
+	.attach = mux_quic_attach,
+	.get_first_cs = mux_quic_get_first_cs,
+	.detach = mux_quic_detach,
+	.avail_streams = mux_quic_avail_streams,
+	.used_streams = mux_quic_used_streams,
+	.destroy = mux_quic_destroy_meth,
+	.ctl = mux_quic_ctl,
+	.shutr = mux_quic_shutr,
+	.shutw = mux_quic_shutw,
+	.show_fd = mux_quic_show_fd,
+	.flags = MX_FL_HTX,
+	.name = "H3",
+};
+
 /* PROT selection : default mux has empty name */
 static struct mux_proto_list mux_proto_quic =
 	{ .token = IST(""), .mode = PROTO_MODE_QUIC, .side = PROTO_SIDE_BOTH, .mux = &mux_quic_ops };
 
+static struct mux_proto_list mux_proto_quic_h3 =
+	{ .token = IST("h3"), .mode = PROTO_MODE_HTTP, .side = PROTO_SIDE_FE, .mux = &mux_quic_h3_ops };
+
 INITCALL1(STG_REGISTER, register_mux_proto, &mux_proto_quic);
+INITCALL1(STG_REGISTER, register_mux_proto, &mux_proto_quic_h3);
+
+/* Action function for "http-request set-h3-priority": sets the priority of the
+ * HTTP/3 request stream of <s> to the one of <rule>. The client may not update
+ * it anymore. Does nothing for the other streams.
+ */
+static enum act_return qcs_h3_action_set_priority(struct act_rule *rule, struct proxy *px,
+                                                  struct session *sess, struct stream *s, int flags)
+{
+	struct conn_stream *cs = objt_cs(s->si[0].end);
+	struct qcs *qcs;
+
+	if (!cs || cs->conn->mux != &mux_quic_h3_ops)
+		return ACT_RET_CONT;
+
+	qcs = cs->ctx;
+	qcs->h3.prio = rule->arg.http.i;
+	qcs->flags |= QC_SF_H3_PRIO_RULE;
+	return ACT_RET_CONT;
+}
+
+/* Parses "http-request set-h3-priority <value>", <value> being a priority
+ * field value as found in the "priority" header (RFC 9218 #4), such as
+ * "u=7, i". Returns ACT_RET_PRS_OK on success, ACT_RET_PRS_ERR on error.
+ */
+static enum act_parse_ret qcs_h3_parse_set_priority(const char **args, int *orig_arg, struct proxy *px,
+                                                    struct act_rule *rule, char **err)
+{
+	unsigned int urgency = H3_URGENCY_DFLT, incremental = 0;
+
+	if (!*args[*orig_arg]) {
+		memprintf(err, "expects a priority such as 'u=7, i'");
+		return ACT_RET_PRS_ERR;
+	}
+
+	h3_parse_priority(ist2(args[*orig_arg], strlen(args[*orig_arg])), &urgency, &incremental);
+	rule->arg.http.i = qcs_h3_prio(urgency, incremental);
+	(*orig_arg)++;
+
+	rule->action     = ACT_CUSTOM;
+	rule->action_ptr = qcs_h3_action_set_priority;
+	return ACT_RET_PRS_OK;
+}
+
+static struct action_kw_list http_req_kws = {ILH, {
+	{ "set-h3-priority", qcs_h3_parse_set_priority },
+	{ /* END */ }
+}};
+
+INITCALL1(STG_REGISTER, http_req_keywords_register, &http_req_kws);
@@ -13,6 +13,11 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include <common/config.h>
 #include <common/net_helper.h>
@@ -156,6 +161,8 @@ static THREAD_LOCAL struct sample_data static_sample_data;
 /* This is the root of the list of all pattern_ref avalaibles. */
 struct list pattern_reference = LIST_HEAD_INIT(pattern_reference);
 
+unsigned int pat_ref_idx_gen = 0;
+
 static THREAD_LOCAL struct lru64_head *pat_lru_tree;
 static unsigned long long pat_lru_seed;
 
@@ -188,6 +195,70 @@ static inline unsigned int make_4delim(unsigned char d1, unsigned char d2, unsig
 	return d1 << 24 | d2 << 16 | d3 << 8 | d4;
 }
 
+/* delimiters of the words looked up by the domain match */
+#define PAT_DOM_DELIMITERS make_4delim('/', '?', '.', ':')
+
+/* Closes the current accounting window of the cache lookups of <expr> once it
+ * reached PAT_LRU_WINDOW lookups, and decides whether the expression should
+ * only cache a sample of its keys in the next window. The windows are shared
+ * by all threads so a few lookups may be accounted in the next one.
+ */
+static inline void pat_lru_account(struct pattern_expr *expr, int hit)
+{
+	unsigned int hits;
+
+	if (hit)
+		HA_ATOMIC_ADD(&expr->lru_hits, 1);
+	if (HA_ATOMIC_ADD(&expr->lru_lookups, 1) != PAT_LRU_WINDOW)
+		return;
+
+	hits = HA_ATOMIC_XCHG(&expr->lru_hits, 0);
+	expr->lru_bypass = hits * PAT_LRU_MIN_RATIO < PAT_LRU_WINDOW;
+	HA_ATOMIC_STORE(&expr->lru_lookups, 0);
+}
+
+/* Looks up the string of <smp> in the pattern cache for <expr>. Returns the
+ * cache entry, which holds the result if its domain is set, or which must be
+ * committed with the result of the lookup otherwise. NULL is returned if the
+ * result must not be cached, either because there is no cache or because
+ * <expr> has too low a hit ratio and this key is not part of the sample it
+ * still caches.
+ */
+static inline struct lru64 *pat_lru_get(struct sample *smp, struct pattern_expr *expr)
+{
+	unsigned long long key, evictions;
+	struct pat_ref *ref = expr->ref;
+	struct lru64 *lru;
+
+	if (!pat_lru_tree)
+		return NULL;
+
+	key = XXH64(smp->data.u.str.area, smp->data.u.str.data, pat_lru_seed ^ (long)expr);
+	if (expr->lru_bypass && (key & PAT_LRU_SAMPLE_MASK)) {
+		if (ref)
+			HA_ATOMIC_ADD(&ref->lru.skipped, 1);
+		return NULL;
+	}
+
+	evictions = pat_lru_tree->evictions;
+	lru = lru64_get(key, pat_lru_tree, expr, expr->revision);
+	if (!lru)
+		return NULL;
+
+	pat_lru_account(expr, !!lru->domain);
+	if (!ref)
+		return lru;
+
+	if (lru->domain)
+		HA_ATOMIC_ADD(&ref->lru.hits, 1);
+	else {
+		HA_ATOMIC_ADD(&ref->lru.misses, 1);
+		if (pat_lru_tree->evictions != evictions)
+			HA_ATOMIC_ADD(&ref->lru.evictions, 1);
+	}
+	return lru;
+}
+
 
 /*
  *
@@ -449,6 +520,761 @@ struct pattern *pat_match_nothing(struct sample *smp, struct pattern_expr *expr,
 }
 
 
+/* Returns the node reached from node <node> of automaton <ac> with character
+ * <c>, or 0 if there is no such edge.
+ */
+static inline unsigned int pat_ac_goto(const struct pat_ac *ac, unsigned int node, unsigned char c)
+{
+	const struct pat_ac_edge *edge;
+	unsigned int lo, hi, mid;
+
+	if (!node)
+		return ac->root[c];
+
+	edge = ac->edges + ac->nodes[node].edges;
+	lo = 0;
+	hi = ac->nodes[node].nb_edges;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (edge[mid].c == c)
+			return edge[mid].node;
+		if (edge[mid].c < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+/* Returns the node reached from node <node> of automaton <ac> after character
+ * <c> was read from the tested string, following the failure links.
+ */
+static inline unsigned int pat_ac_next(const struct pat_ac *ac, unsigned int node, unsigned char c)
+{
+	unsigned int next;
+
+	while (node) {
+		next = pat_ac_goto(ac, node, c);
+		if (next)
+			return next;
+		node = ac->nodes[node].fail;
+	}
+	return ac->root[c];
+}
+
+/* Returns the character <c> of a tested string for an expression with the
+ * <mflags> flags, as it was indexed.
+ */
+static inline unsigned char pat_ac_fold(unsigned char c, int mflags)
+{
+	return (mflags & PAT_MF_IGNORE_CASE) ? tolower(c) : c;
+}
+
+/* Returns the part of pattern <pat> indexed in the automaton of <expr> and
+ * sets its length in <len>. The domain patterns are stripped of their leading
+ * and trailing delimiters, as match_word() does.
+ */
+static inline const char *pat_ac_key(const struct pattern_expr *expr, const struct pattern *pat, int *len)
+{
+	const char *ps = pat->ptr.str;
+	int pl = pat->len;
+
+	if (expr->pat_head->match == pat_match_dom) {
+		while (pl > 0 && is_delimiter(*ps, PAT_DOM_DELIMITERS)) {
+			pl--;
+			ps++;
+		}
+		while (pl > 0 && is_delimiter(ps[pl - 1], PAT_DOM_DELIMITERS))
+			pl--;
+	}
+	*len = pl;
+	return ps;
+}
+
+/* Returns non-zero if the automaton of <expr> is up to date and may be used
+ * instead of its list of patterns.
+ */
+static inline int pat_ac_usable(const struct pattern_expr *expr)
+{
+	return expr->ac && expr->ac->revision == expr->revision;
+}
+
+/* Looks up the first pattern of <expr>'s list included in <smp>. */
+static struct pattern *pat_ac_match_sub(struct sample *smp, struct pattern_expr *expr)
+{
+	const struct pat_ac *ac = expr->ac;
+	const unsigned char *c = (unsigned char *)smp->data.u.str.area;
+	const unsigned char *end = c + smp->data.u.str.data;
+	unsigned int node = 0, best = ac->nodes[0].best;
+
+	for (; c < end && best; c++) {
+		node = pat_ac_next(ac, node, pat_ac_fold(*c, expr->mflags));
+		if (ac->nodes[node].best < best)
+			best = ac->nodes[node].best;
+	}
+	return best == PAT_AC_NONE ? NULL : ac->pats[best];
+}
+
+/* Looks up the first pattern of <expr>'s list ending <smp>. */
+static struct pattern *pat_ac_match_end(struct sample *smp, struct pattern_expr *expr)
+{
+	const struct pat_ac *ac = expr->ac;
+	const unsigned char *c = (unsigned char *)smp->data.u.str.area;
+	const unsigned char *end = c + smp->data.u.str.data;
+	unsigned int node = 0, best;
+
+	for (; c < end; c++)
+		node = pat_ac_next(ac, node, pat_ac_fold(*c, expr->mflags));
+	best = ac->nodes[node].best;
+	return best == PAT_AC_NONE ? NULL : ac->pats[best];
+}
+
+/* Looks up the first pattern of <expr>'s list starting <smp>, or equal to
+ * <smp> if <exact> is set.
+ */
+static struct pattern *pat_ac_match_beg(struct sample *smp, struct pattern_expr *expr, int exact)
+{
+	const struct pat_ac *ac = expr->ac;
+	const unsigned char *c = (unsigned char *)smp->data.u.str.area;
+	const unsigned char *end = c + smp->data.u.str.data;
+	unsigned int node = 0, best = ac->nodes[0].own;
+
+	for (; c < end; c++) {
+		node = pat_ac_goto(ac, node, pat_ac_fold(*c, expr->mflags));
+		if (!node)
+			break;
+		if (ac->nodes[node].own < best)
+			best = ac->nodes[node].own;
+	}
+	if (exact)
+		best = (c == end) ? ac->nodes[node].own : PAT_AC_NONE;
+	return best == PAT_AC_NONE ? NULL : ac->pats[best];
+}
+
+/* Looks up the first pattern of <expr>'s list found in <smp> between the
+ * domain delimiters or the beginning or end of the string, as match_word()
+ * does. The patterns are only looked up from the beginning of each word, and
+ * are only reported if they end at the end of one, so that the cost depends
+ * on the number of words and on their length but not on the number of
+ * patterns.
+ */
+static struct pattern *pat_ac_match_dom(struct sample *smp, struct pattern_expr *expr)
+{
+	const struct pat_ac *ac = expr->ac;
+	const unsigned char *beg = (unsigned char *)smp->data.u.str.area;
+	const unsigned char *end = beg + smp->data.u.str.data;
+	const unsigned char *w, *c;
+	unsigned int node, best = PAT_AC_NONE;
+
+	for (w = beg; w < end && best; w++) {
+		if (is_delimiter(*w, PAT_DOM_DELIMITERS))
+			continue;
+		if (w > beg && !is_delimiter(w[-1], PAT_DOM_DELIMITERS))
+			continue;
+
+		node = 0;
+		for (c = w; c < end; c++) {
+			node = pat_ac_goto(ac, node, pat_ac_fold(*c, expr->mflags));
+			if (!node)
+				break;
+			if (ac->nodes[node].own < best &&
+			    (c + 1 == end || is_delimiter(c[1], PAT_DOM_DELIMITERS)))
+				best = ac->nodes[node].own;
+		}
+	}
+	return best == PAT_AC_NONE ? NULL : ac->pats[best];
+}
+
+/* Releases automaton <ac>. */
+static void pat_ac_free(struct pat_ac *ac)
+{
+	if (!ac)
+		return;
+	free(ac->pats);
+	free(ac->nodes);
+	free(ac->edges);
+	free(ac);
+}
+
+#ifdef USE_HYPERSCAN
+/* Hyperscan needs a scratch space per thread, large enough for all the
+ * databases it is used with. <pat_hs_proto> is grown for each new database
+ * and is only used to be cloned by the threads when <pat_hs_gen> changes.
+ */
+static hs_scratch_t *pat_hs_proto;
+static unsigned int pat_hs_gen;
+__decl_hathreads(static HA_SPINLOCK_T pat_hs_lock);
+static THREAD_LOCAL hs_scratch_t *pat_hs_scratch;
+static THREAD_LOCAL unsigned int pat_hs_scratch_gen;
+
+/* Context of a set lookup passed to pat_hs_match() */
+struct pat_hs_ctx {
+	const struct pat_rs *rs;
+	struct sample *smp;
+	unsigned int best;              /* lowest rank found so far */
+};
+
+/* Returns the scratch space of the current thread, or NULL if it cannot be
+ * allocated.
+ */
+static inline hs_scratch_t *pat_hs_get_scratch()
+{
+	if (unlikely(pat_hs_scratch_gen != pat_hs_gen)) {
+		HA_SPIN_LOCK(PATEXP_LOCK, &pat_hs_lock);
+		hs_free_scratch(pat_hs_scratch);
+		pat_hs_scratch = NULL;
+		if (hs_clone_scratch(pat_hs_proto, &pat_hs_scratch) == HS_SUCCESS)
+			pat_hs_scratch_gen = pat_hs_gen;
+		HA_SPIN_UNLOCK(PATEXP_LOCK, &pat_hs_lock);
+	}
+	return pat_hs_scratch;
+}
+
+/* Called by hs_scan() for each pattern of rank <id> matching the sample of
+ * <ctx>. Keeps the lowest rank, after confirming it if the database is not
+ * exact, and stops the scan once the first pattern was found.
+ */
+static int pat_hs_match(unsigned int id, unsigned long long from, unsigned long long to,
+                        unsigned int flags, void *ctx)
+{
+	struct pat_hs_ctx *hctx = ctx;
+
+	if (id >= hctx->best)
+		return 0;
+	if (!hctx->rs->exact &&
+	    !regex_exec2(hctx->rs->pats[id]->ptr.reg, hctx->smp->data.u.str.area, hctx->smp->data.u.str.data))
+		return 0;
+	hctx->best = id;
+	return id == 0;
+}
+
+/* Compiles the <nb> patterns of <rs> in a Hyperscan database. The patterns
+ * using constructs Hyperscan does not support are compiled approximated, the
+ * database then only reporting candidates. Returns 0 if no database could be
+ * built.
+ */
+static int pat_hs_build(struct pat_rs *rs, unsigned int nb, int mflags)
+{
+	const char **exprs;
+	unsigned int *flags, *ids;
+	hs_compile_error_t *cerr;
+	unsigned int i;
+
+	exprs = calloc(nb, sizeof(*exprs));
+	flags = calloc(nb, sizeof(*flags));
+	ids   = calloc(nb, sizeof(*ids));
+	if (!exprs || !flags || !ids)
+		goto out;
+
+	for (i = 0; i < nb; i++) {
+		exprs[i] = rs->pats[i]->ref->pattern;
+		flags[i] = HS_FLAG_SINGLEMATCH | HS_FLAG_ALLOWEMPTY;
+		if (mflags & PAT_MF_IGNORE_CASE)
+			flags[i] |= HS_FLAG_CASELESS;
+		ids[i] = i;
+	}
+
+	rs->exact = 1;
+	if (hs_compile_multi(exprs, flags, ids, nb, HS_MODE_BLOCK, NULL, &rs->db, &cerr) != HS_SUCCESS) {
+		hs_free_compile_error(cerr);
+		for (i = 0; i < nb; i++)
+			flags[i] |= HS_FLAG_PREFILTER;
+		rs->exact = 0;
+		if (hs_compile_multi(exprs, flags, ids, nb, HS_MODE_BLOCK, NULL, &rs->db, &cerr) != HS_SUCCESS) {
+			hs_free_compile_error(cerr);
+			rs->db = NULL;
+			goto out;
+		}
+	}
+
+	HA_SPIN_LOCK(PATEXP_LOCK, &pat_hs_lock);
+	if (hs_alloc_scratch(rs->db, &pat_hs_proto) == HS_SUCCESS)
+		pat_hs_gen++;
+	else {
+		hs_free_database(rs->db);
+		rs->db = NULL;
+	}
+	HA_SPIN_UNLOCK(PATEXP_LOCK, &pat_hs_lock);
+ out:
+	free(exprs);
+	free(flags);
+	free(ids);
+	return rs->db != NULL;
+}
+#endif /* USE_HYPERSCAN */
+
+/* Returns non-zero if the set of <expr> is up to date and may be used before
+ * or instead of its list of patterns.
+ */
+static inline int pat_rs_usable(const struct pattern_expr *expr)
+{
+	return expr->rs && expr->rs->revision == expr->revision;
+}
+
+/* Looks up the rank of the first pattern of <expr>'s list matching <smp> in
+ * its set. Returns PAT_RS_NONE if none matches, or PAT_RS_LIST if the list
+ * must be walked to know it.
+ */
+static unsigned int pat_rs_lookup(struct sample *smp, struct pattern_expr *expr)
+{
+	const struct pat_rs *rs = expr->rs;
+
+#ifdef USE_HYPERSCAN
+	if (rs->db) {
+		struct pat_hs_ctx ctx = { .rs = rs, .smp = smp, .best = PAT_RS_NONE };
+		hs_scratch_t *scratch = pat_hs_get_scratch();
+		hs_error_t err;
+
+		if (!scratch)
+			return PAT_RS_LIST;
+		err = hs_scan(rs->db, smp->data.u.str.area, smp->data.u.str.data, 0,
+		              scratch, pat_hs_match, &ctx);
+		if (err != HS_SUCCESS && err != HS_SCAN_TERMINATED)
+			return PAT_RS_LIST;
+		return ctx.best;
+	}
+#endif
+	if (!regex_exec2(rs->alt, smp->data.u.str.area, smp->data.u.str.data))
+		return PAT_RS_NONE;
+	return PAT_RS_LIST;
+}
+
+/* Releases set <rs>. */
+static void pat_rs_free(struct pat_rs *rs)
+{
+	if (!rs)
+		return;
+#ifdef USE_HYPERSCAN
+	hs_free_database(rs->db);
+#endif
+	regex_free(rs->alt);
+	free(rs->pats);
+	free(rs);
+}
+
+/* Returns non-zero if regex <str> keeps its meaning once enclosed in a group
+ * of an alternation. It does not if it refers to groups by number, which
+ * would designate the ones of the previous patterns, or if it uses quotes,
+ * comments, or verbs which could swallow or alter the end of the group.
+ * The check is purposely coarse and may reject valid cases.
+ */
+static int pat_rs_alt_compatible(const char *str)
+{
+	for (; *str; str++) {
+		if (*str == '\\') {
+			str++;
+			if (!*str || isdigit((unsigned char)*str) || strchr("gkQE", *str))
+				return 0;
+		}
+		else if (*str == '(' && (str[1] == '*' || (str[1] == '?' && str[2] && strchr("RP&+-0123456789x", str[2]))))
+			return 0;
+		else if (*str == '(' && str[1] == '?') {
+			/* option settings such as (?si:...) */
+			const char *opt;
+
+			for (opt = str + 2; isalpha((unsigned char)*opt) || *opt == '-'; opt++)
+				if (*opt == 'x')
+					return 0;
+		}
+	}
+	return 1;
+}
+
+/* Builds the set of the regex patterns of <expr>, replacing the previous one.
+ * Lists shorter than PAT_RS_MIN_PATTERNS are not compiled. The expression
+ * must be locked. Returns 0 on memory allocation failure, in which case the
+ * list is used.
+ */
+static int pat_rs_build(struct pattern_expr *expr)
+{
+	struct pattern_list *lst;
+	struct pat_rs *rs = NULL;
+	unsigned int nb = 0, i;
+	int alt = 1, ret = 0;
+	size_t len = 0;
+
+	pat_rs_free(expr->rs);
+	expr->rs = NULL;
+
+	list_for_each_entry(lst, &expr->patterns, list) {
+		/* the original string of the regex is needed */
+		if (!lst->pat.ref)
+			return 1;
+		if (alt && !pat_rs_alt_compatible(lst->pat.ref->pattern))
+			alt = 0;
+		len += strlen(lst->pat.ref->pattern) + 5;
+		nb++;
+	}
+	if (nb < PAT_RS_MIN_PATTERNS)
+		return 1;
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		goto out;
+	rs->pats = calloc(nb, sizeof(*rs->pats));
+	if (!rs->pats)
+		goto out;
+
+	i = 0;
+	list_for_each_entry(lst, &expr->patterns, list)
+		rs->pats[i++] = &lst->pat;
+
+#ifdef USE_HYPERSCAN
+	if (pat_hs_build(rs, nb, expr->mflags))
+		goto done;
+#endif
+#if defined(USE_PCRE) || defined(USE_PCRE2)
+	/* build "(?:pat1)|(?:pat2)|..." */
+	if (alt) {
+		char *str, *p, *err = NULL;
+
+		str = p = malloc(len);
+		if (!str)
+			goto out;
+		for (i = 0; i < nb; i++)
+			p += sprintf(p, "%s(?:%s)", i ? "|" : "", rs->pats[i]->ref->pattern);
+		rs->alt = regex_comp(str, !(expr->mflags & PAT_MF_IGNORE_CASE), 0, &err);
+		free(err);
+		free(str);
+		if (rs->alt)
+			goto done;
+	}
+#endif
+	/* no set may be built, the list will be used */
+	ret = 1;
+	goto out;
+
+ done:
+	rs->revision = expr->revision;
+	expr->rs = rs;
+	rs = NULL;
+	ret = 1;
+ out:
+	pat_rs_free(rs);
+	return ret;
+}
+
+/* Returns non-zero if the multibit trie of <expr> is up to date and may be
+ * used instead of its IPv4 tree.
+ */
+static inline int pat_lpm_usable(const struct pattern_expr *expr)
+{
+	return expr->lpm && expr->lpm->revision == expr->revision;
+}
+
+/* Looks up the longest IPv4 prefix of <expr> matching <addr> (in host byte
+ * order) in its multibit trie. Returns NULL if none matches.
+ */
+static inline struct pattern_tree *pat_lpm_lookup(const struct pattern_expr *expr, unsigned int addr)
+{
+	const struct pat_lpm *lpm = expr->lpm;
+	unsigned int e;
+
+	e = lpm->root[addr >> 16];
+	if (e & PAT_LPM_CHUNK) {
+		e = lpm->chunks[((e & ~PAT_LPM_CHUNK) << 8) + ((addr >> 8) & 0xff)];
+		if (e & PAT_LPM_CHUNK)
+			e = lpm->chunks[((e & ~PAT_LPM_CHUNK) << 8) + (addr & 0xff)];
+	}
+	return e ? lpm->leaves[e - 1] : NULL;
+}
+
+/* Releases multibit trie <lpm>. */
+static void pat_lpm_free(struct pat_lpm *lpm)
+{
+	if (!lpm)
+		return;
+	free(lpm->leaves);
+	free(lpm->chunks);
+	free(lpm);
+}
+
+/* Allocates a new chunk in <lpm> whose entries all inherit <e>. Returns its
+ * index, or -1 on memory allocation failure. Note that this may move all the
+ * chunks, so they must be designated by their index only.
+ */
+static int pat_lpm_new_chunk(struct pat_lpm *lpm, unsigned int e)
+{
+	unsigned int *chunks;
+	unsigned int i;
+
+	if (lpm->nb_chunks == lpm->alloc_chunks) {
+		if (lpm->alloc_chunks >= (PAT_LPM_CHUNK >> 1))
+			return -1;
+		i = lpm->alloc_chunks ? lpm->alloc_chunks * 2 : 64;
+		chunks = realloc(lpm->chunks, (size_t)i * 256 * sizeof(*chunks));
+		if (!chunks)
+			return -1;
+		lpm->chunks = chunks;
+		lpm->alloc_chunks = i;
+	}
+
+	chunks = lpm->chunks + ((size_t)lpm->nb_chunks << 8);
+	for (i = 0; i < 256; i++)
+		chunks[i] = e;
+	return lpm->nb_chunks++;
+}
+
+/* Returns the index of the chunk entry <e> designates, first replacing it with
+ * a new chunk inheriting it if it designates a prefix. Returns -1 on memory
+ * allocation failure.
+ */
+static int pat_lpm_get_chunk(struct pat_lpm *lpm, unsigned int *e)
+{
+	int c;
+
+	if (*e & PAT_LPM_CHUNK)
+		return *e & ~PAT_LPM_CHUNK;
+
+	c = pat_lpm_new_chunk(lpm, *e);
+	if (c >= 0)
+		*e = PAT_LPM_CHUNK | c;
+	return c;
+}
+
+/* Builds the multibit trie of the IPv4 prefixes of <expr>, replacing the
+ * previous one. Trees of less than PAT_LPM_MIN_PATTERNS prefixes are not
+ * indexed. The expression must be locked. Returns 0 on memory allocation
+ * failure, in which case the tree is used.
+ */
+static int pat_lpm_build(struct pattern_expr *expr)
+{
+	struct ebmb_node *node;
+	struct pattern_tree *elt, *prev;
+	struct pat_lpm *lpm = NULL;
+	struct pattern_tree **sorted = NULL;
+	unsigned int start[34];
+	unsigned int nb = 0, rank, addr, prev_addr = 0, len, beg, end, e, i;
+	int c, ret = 0;
+
+	pat_lpm_free(expr->lpm);
+	expr->lpm = NULL;
+
+	memset(start, 0, sizeof(start));
+	for (node = ebmb_first(&expr->pattern_tree); node; node = ebmb_next(node)) {
+		start[node->node.pfx + 1]++;
+		nb++;
+	}
+	if (nb < PAT_LPM_MIN_PATTERNS)
+		return 1;
+
+	lpm = calloc(1, sizeof(*lpm));
+	sorted = calloc(nb, sizeof(*sorted));
+	if (!lpm || !sorted)
+		goto out;
+	lpm->leaves = calloc(nb, sizeof(*lpm->leaves));
+	if (!lpm->leaves)
+		goto out;
+
+	/* sort the prefixes by increasing length, keeping the tree order for
+	 * the same length so that duplicates remain adjacent.
+	 */
+	for (i = 1; i < 34; i++)
+		start[i] += start[i - 1];
+	for (node = ebmb_first(&expr->pattern_tree); node; node = ebmb_next(node))
+		sorted[start[node->node.pfx]++] = ebmb_entry(node, struct pattern_tree, node);
+
+	/* expand each prefix over the entries it covers, the longer ones
+	 * overwriting the shorter ones. Since the prefixes are sorted, the
+	 * entries covered by a prefix were never turned into chunks yet.
+	 */
+	rank = 0;
+	prev = NULL;
+	for (i = 0; i < nb; i++) {
+		elt = sorted[i];
+		len = elt->node.node.pfx;
+		addr = ntohl(read_u32(elt->node.key));
+		addr &= len ? ~0U << (32 - len) : 0;
+
+		/* keep the first one of the same prefixes, as the tree does
+		 * for the duplicates.
+		 */
+		if (prev && prev->node.node.pfx == len && prev_addr == addr)
+			continue;
+		prev = elt;
+		prev_addr = addr;
+
+		lpm->leaves[rank] = elt;
+		e = ++rank;
+
+		if (len <= 16) {
+			beg = addr >> 16;
+			end = beg + (1U << (16 - len));
+			while (beg < end)
+				lpm->root[beg++] = e;
+			continue;
+		}
+
+		c = pat_lpm_get_chunk(lpm, &lpm->root[addr >> 16]);
+		if (c < 0)
+			goto out;
+
+		if (len <= 24) {
+			beg = ((unsigned int)c << 8) + ((addr >> 8) & 0xff);
+			end = beg + (1U << (24 - len));
+			while (beg < end)
+				lpm->chunks[beg++] = e;
+			continue;
+		}
+
+		beg = ((unsigned int)c << 8) + ((addr >> 8) & 0xff);
+		e = lpm->chunks[beg];
+		c = pat_lpm_get_chunk(lpm, &e);
+		if (c < 0)
+			goto out;
+		lpm->chunks[beg] = e;
+		e = rank;
+
+		beg = ((unsigned int)c << 8) + (addr & 0xff);
+		end = beg + (1U << (32 - len));
+		while (beg < end)
+			lpm->chunks[beg++] = e;
+	}
+
+	lpm->revision = expr->revision;
+	expr->lpm = lpm;
+	lpm = NULL;
+	ret = 1;
+ out:
+	pat_lpm_free(lpm);
+	free(sorted);
+	return ret;
+}
+
+/* Builds the automaton of the list of string patterns of <expr>, for the
+ * match methods which may use one, replacing the previous one. Lists shorter
+ * than PAT_AC_MIN_PATTERNS are not indexed. The lists of regex patterns are
+ * compiled as a set instead, and the trees of IPv4 prefixes are expanded in a
+ * multibit trie. The expression must be locked. Returns 0 on memory allocation
+ * failure, in which case the list or the tree is used.
+ */
+static int pat_ac_build(struct pattern_expr *expr)
+{
+	struct pattern_list *lst;
+	struct pat_ac_node *node;
+	struct pat_ac *ac = NULL;
+	unsigned int *child = NULL, *sibling = NULL, *queue = NULL;
+	unsigned char *chr = NULL;
+	unsigned int nb_pats = 0, nb_nodes = 1, len = 0;
+	unsigned int i, n, u, v, f, head, tail, rank, *prev;
+	int klen, ret = 0;
+
+	pat_ac_free(expr->ac);
+	expr->ac = NULL;
+	expr->ac_revision = expr->revision;
+
+	if (expr->pat_head->match == pat_match_reg ||
+	    expr->pat_head->match == pat_match_regm)
+		return pat_rs_build(expr);
+
+	if (expr->pat_head->match == pat_match_ip)
+		return pat_lpm_build(expr);
+
+	if (expr->pat_head->match != pat_match_sub &&
+	    expr->pat_head->match != pat_match_end &&
+	    expr->pat_head->match != pat_match_beg &&
+	    expr->pat_head->match != pat_match_dom &&
+	    expr->pat_head->match != pat_match_str)
+		return 1;
+
+	list_for_each_entry(lst, &expr->patterns, list) {
+		nb_pats++;
+		len += lst->pat.len;
+	}
+	if (nb_pats < PAT_AC_MIN_PATTERNS)
+		return 1;
+
+	ac = calloc(1, sizeof(*ac));
+	if (!ac)
+		goto out;
+	ac->pats   = calloc(nb_pats, sizeof(*ac->pats));
+	ac->nodes  = calloc(len + 1, sizeof(*ac->nodes));
+	ac->edges  = calloc(len + 1, sizeof(*ac->edges));
+	child      = calloc(len + 1, sizeof(*child));
+	sibling    = calloc(len + 1, sizeof(*sibling));
+	queue      = calloc(len + 1, sizeof(*queue));
+	chr        = calloc(len + 1, sizeof(*chr));
+	if (!ac->pats || !ac->nodes || !ac->edges || !child || !sibling || !queue || !chr)
+		goto out;
+
+	/* build the trie, the children of each node being sorted by character
+	 * in a list starting at <child>, chained with <sibling>.
+	 */
+	ac->nodes[0].own = PAT_AC_NONE;
+	rank = 0;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		const char *key = pat_ac_key(expr, &lst->pat, &klen);
+
+		ac->pats[rank] = &lst->pat;
+		if (!klen && expr->pat_head->match == pat_match_dom) {
+			/* an empty domain never matches */
+			rank++;
+			continue;
+		}
+		u = 0;
+		for (i = 0; i < klen; i++) {
+			unsigned char c = pat_ac_fold(key[i], expr->mflags);
+
+			for (prev = &child[u]; *prev && chr[*prev] < c; prev = &sibling[*prev])
+				;
+			if (!*prev || chr[*prev] != c) {
+				v = nb_nodes++;
+				chr[v] = c;
+				ac->nodes[v].own = PAT_AC_NONE;
+				sibling[v] = *prev;
+				*prev = v;
+			}
+			u = *prev;
+		}
+		if (ac->nodes[u].own == PAT_AC_NONE)
+			ac->nodes[u].own = rank;
+		rank++;
+	}
+
+	/* store the edges by node in breadth-first order, then compute the
+	 * failure links of the children of each node when it is dequeued :
+	 * they only lead to shallower nodes, whose edges are already known.
+	 */
+	n = 0;
+	head = tail = 0;
+	queue[tail++] = 0;
+	ac->nodes[0].best = ac->nodes[0].own;
+	while (head < tail) {
+		u = queue[head++];
+		node = &ac->nodes[u];
+		node->edges = n;
+		for (v = child[u]; v; v = sibling[v]) {
+			ac->edges[n].c = chr[v];
+			ac->edges[n].node = v;
+			n++;
+			queue[tail++] = v;
+			if (!u)
+				ac->root[chr[v]] = v;
+		}
+		node->nb_edges = n - node->edges;
+
+		for (v = child[u]; v; v = sibling[v]) {
+			f = u ? pat_ac_next(ac, node->fail, chr[v]) : 0;
+			ac->nodes[v].fail = f;
+			ac->nodes[v].best = ac->nodes[v].own;
+			if (ac->nodes[f].best < ac->nodes[v].best)
+				ac->nodes[v].best = ac->nodes[f].best;
+		}
+	}
+
+	ac->revision = expr->revision;
+	expr->ac = ac;
+	ac = NULL;
+	ret = 1;
+ out:
+	pat_ac_free(ac);
+	free(child);
+	free(sibling);
+	free(queue);
+	free(chr);
+	return ret;
+}
+
 /* NB: For two strings to be identical, it is required that their length match */
 struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -485,17 +1311,15 @@ struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int
 	}
 
 	/* look in the list */
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
-		}
-	}
 
+	if (pat_ac_usable(expr)) {
+		ret = pat_ac_match_beg(smp, expr, 1);
+		goto leave;
+	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
@@ -511,6 +1335,7 @@ struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->revision, NULL);
 
@@ -525,16 +1350,9 @@ struct pattern *pat_match_bin(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
 
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
-
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
-		}
-	}
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
@@ -563,6 +1381,22 @@ struct pattern *pat_match_regm(struct sample *smp, struct pattern_expr *expr, in
 	struct pattern_list *lst;
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
+	unsigned int rank;
+
+	if (pat_rs_usable(expr)) {
+		rank = pat_rs_lookup(smp, expr);
+		if (rank == PAT_RS_NONE)
+			return NULL;
+		if (rank != PAT_RS_LIST) {
+			/* only this one has to fill the matching array */
+			pattern = expr->rs->pats[rank];
+			if (regex_exec_match2(pattern->ptr.reg, smp->data.u.str.area, smp->data.u.str.data,
+			                      MAX_MATCH, pmatch, 0)) {
+				smp->ctx.a[0] = pmatch;
+				return pattern;
+			}
+		}
+	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
@@ -588,14 +1422,16 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
 
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
+	if (pat_rs_usable(expr)) {
+		unsigned int rank = pat_rs_lookup(smp, expr);
+
+		if (rank != PAT_RS_LIST) {
+			ret = (rank == PAT_RS_NONE) ? NULL : expr->rs->pats[rank];
+			goto leave;
 		}
 	}
 
@@ -608,6 +1444,7 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->revision, NULL);
 
@@ -651,15 +1488,13 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 	}
 
 	/* look in the list */
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
-		}
+	if (pat_ac_usable(expr)) {
+		ret = pat_ac_match_beg(smp, expr, 0);
+		goto leave;
 	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
@@ -677,6 +1512,7 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 		break;
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->revision, NULL);
 
@@ -692,15 +1528,13 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
 
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
-		}
+	if (pat_ac_usable(expr)) {
+		ret = pat_ac_match_end(smp, expr);
+		goto leave;
 	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
@@ -718,14 +1552,15 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 		break;
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->revision, NULL);
 
 	return ret;
 }
 
-/* Checks that the pattern is included inside the tested string.
- * NB: Suboptimal, should be rewritten using a Boyer-Moore method.
+/* Checks that the pattern is included inside the tested string. Large lists
+ * are looked up at once using their automaton once it is built.
  */
 struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -737,15 +1572,13 @@ struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
 
-	if (pat_lru_tree) {
-		unsigned long long seed = pat_lru_seed ^ (long)expr;
+	lru = pat_lru_get(smp, expr);
+	if (lru && lru->domain)
+		return lru->data;
 
-		lru = lru64_get(XXH64(smp->data.u.str.area, smp->data.u.str.data, seed),
-				pat_lru_tree, expr, expr->revision);
-		if (lru && lru->domain) {
-			ret = lru->data;
-			return ret;
-		}
+	if (pat_ac_usable(expr)) {
+		ret = pat_ac_match_sub(smp, expr);
+		goto leave;
 	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
@@ -864,9 +1697,12 @@ struct pattern *pat_match_dom(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern_list *lst;
 	struct pattern *pattern;
 
+	if (pat_ac_usable(expr))
+		return pat_ac_match_dom(smp, expr);
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
-		if (match_word(smp, pattern, expr->mflags, make_4delim('/', '?', '.', ':')))
+		if (match_word(smp, pattern, expr->mflags, PAT_DOM_DELIMITERS))
 			return pattern;
 	}
 	return NULL;
@@ -918,7 +1754,12 @@ struct pattern *pat_match_ip(struct sample *smp, struct pattern_expr *expr, int
 		 * the longest match method.
 		 */
 		s = &smp->data.u.ipv4;
-		node = ebmb_lookup_longest(&expr->pattern_tree, &s->s_addr);
+		if (pat_lpm_usable(expr)) {
+			elt = pat_lpm_lookup(expr, ntohl(s->s_addr));
+			node = elt ? &elt->node : NULL;
+		}
+		else
+			node = ebmb_lookup_longest(&expr->pattern_tree, &s->s_addr);
 		if (node) {
 			if (fill) {
 				elt = ebmb_entry(node, struct pattern_tree, node);
@@ -993,7 +1834,12 @@ struct pattern *pat_match_ip(struct sample *smp, struct pattern_expr *expr, int
 			/* Lookup an IPv4 address in the expression's pattern tree using the longest
 			 * match method.
 			 */
-			node = ebmb_lookup_longest(&expr->pattern_tree, &v4);
+			if (pat_lpm_usable(expr)) {
+				elt = pat_lpm_lookup(expr, ntohl(v4));
+				node = elt ? &elt->node : NULL;
+			}
+			else
+				node = ebmb_lookup_longest(&expr->pattern_tree, &v4);
 			if (node) {
 				if (fill) {
 					elt = ebmb_entry(node, struct pattern_tree, node);
@@ -1076,6 +1922,8 @@ void pat_prune_val(struct pattern_expr *expr)
 	free_pattern_tree(&expr->pattern_tree);
 	free_pattern_tree(&expr->pattern_tree_2);
 	LIST_INIT(&expr->patterns);
+	pat_lpm_free(expr->lpm);
+	expr->lpm = NULL;
 }
 
 void pat_prune_ptr(struct pattern_expr *expr)
@@ -1091,6 +1939,8 @@ void pat_prune_ptr(struct pattern_expr *expr)
 	free_pattern_tree(&expr->pattern_tree);
 	free_pattern_tree(&expr->pattern_tree_2);
 	LIST_INIT(&expr->patterns);
+	pat_ac_free(expr->ac);
+	expr->ac = NULL;
 }
 
 void pat_prune_reg(struct pattern_expr *expr)
@@ -1106,6 +1956,8 @@ void pat_prune_reg(struct pattern_expr *expr)
 	free_pattern_tree(&expr->pattern_tree);
 	free_pattern_tree(&expr->pattern_tree_2);
 	LIST_INIT(&expr->patterns);
+	pat_rs_free(expr->rs);
+	expr->rs = NULL;
 }
 
 /*
@@ -1521,6 +2373,16 @@ void pattern_init_expr(struct pattern_expr *expr)
 	expr->revision = 0;
 	expr->pattern_tree = EB_ROOT;
 	expr->pattern_tree_2 = EB_ROOT;
+	expr->ac = NULL;
+	expr->rs = NULL;
+	expr->lpm = NULL;
+	expr->ac_revision = 0;
+	expr->ac_next = 0;
+	expr->live = expr;
+	expr->shadow = NULL;
+	expr->lru_lookups = 0;
+	expr->lru_hits = 0;
+	expr->lru_bypass = 0;
 }
 
 void pattern_init_head(struct pattern_head *head)
@@ -1612,6 +2474,7 @@ int pat_ref_delete_by_id(struct pat_ref *ref, struct pat_ref_elt *refelt)
 			free(elt->sample);
 			free(elt->pattern);
 			free(elt);
+			pat_ref_touch(ref);
 			return 1;
 		}
 	}
@@ -1659,6 +2522,7 @@ int pat_ref_delete(struct pat_ref *ref, const char *key)
 
 	if (!found)
 		return 0;
+	pat_ref_touch(ref);
 	return 1;
 }
 
@@ -1713,7 +2577,7 @@ static inline int pat_ref_set_elt(struct pat_ref *ref, struct pat_ref_elt *elt,
 			continue;
 
 		HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
-		data = pattern_find_smp(expr, elt);
+		data = pattern_find_smp(expr->live, elt);
 		if (data && *data && !expr->pat_head->parse_smp(sample, *data))
 			*data = NULL;
 		HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
@@ -1821,6 +2685,10 @@ struct pat_ref *pat_ref_new(const char *reference, const char *display, unsigned
 
 	LIST_INIT(&ref->head);
 	LIST_INIT(&ref->pat);
+	LIST_INIT(&ref->pending);
+	ref->last_gen = 0;
+	ref->next_gen = 0;
+	memset(&ref->lru, 0, sizeof(ref->lru));
 	HA_SPIN_INIT(&ref->lock);
 	LIST_ADDQ(&pattern_reference, &ref->list);
 
@@ -1857,6 +2725,10 @@ struct pat_ref *pat_ref_newid(int unique_id, const char *display, unsigned int f
 	ref->unique_id = unique_id;
 	LIST_INIT(&ref->head);
 	LIST_INIT(&ref->pat);
+	LIST_INIT(&ref->pending);
+	ref->last_gen = 0;
+	ref->next_gen = 0;
+	memset(&ref->lru, 0, sizeof(ref->lru));
 	HA_SPIN_INIT(&ref->lock);
 	LIST_ADDQ(&pattern_reference, &ref->list);
 
@@ -1899,17 +2771,14 @@ int pat_ref_append(struct pat_ref *ref, char *pattern, char *sample, int line)
 	return 1;
 }
 
-/* This function create sample found in <elt>, parse the pattern also
- * found in <elt> and insert it in <expr>. The function copy <patflags>
- * in <expr>. If the function fails, it returns0 and <err> is filled.
- * In succes case, the function returns 1.
+/* This function create sample found in <elt> and parse the pattern also
+ * found in <elt> into <pattern>, for <expr>. If the function fails, it
+ * returns 0 and <err> is filled. In succes case, the function returns 1.
  */
-static inline
-int pat_ref_push(struct pat_ref_elt *elt, struct pattern_expr *expr,
-                 int patflags, char **err)
+static int pat_ref_parse_elt(struct pat_ref_elt *elt, struct pattern_expr *expr,
+                             struct pattern *pattern, char **err)
 {
 	struct sample_data *data;
-	struct pattern pattern;
 
 	/* Create sample */
 	if (elt->sample && expr->pat_head->parse_smp) {
@@ -1930,21 +2799,37 @@ int pat_ref_push(struct pat_ref_elt *elt, struct pattern_expr *expr,
 		data = NULL;
 
 	/* initialise pattern */
-	memset(&pattern, 0, sizeof(pattern));
-	pattern.data = data;
-	pattern.ref = elt;
+	memset(pattern, 0, sizeof(*pattern));
+	pattern->data = data;
+	pattern->ref = elt;
 
 	/* parse pattern */
-	if (!expr->pat_head->parse(elt->pattern, &pattern, expr->mflags, err)) {
+	if (!expr->pat_head->parse(elt->pattern, pattern, expr->mflags, err)) {
 		free(data);
 		return 0;
 	}
-
+	return 1;
+}
+
+/* This function create sample found in <elt>, parse the pattern also
+ * found in <elt> and insert it in the live patterns of <expr>. If the
+ * function fails, it returns0 and <err> is filled. In succes case, the
+ * function returns 1.
+ */
+static inline
+int pat_ref_push(struct pat_ref_elt *elt, struct pattern_expr *expr,
+                 int patflags, char **err)
+{
+	struct pattern pattern;
+
+	if (!pat_ref_parse_elt(elt, expr, &pattern, err))
+		return 0;
+
 	HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
 	/* index pattern */
-	if (!expr->pat_head->index(expr, &pattern, err)) {
+	if (!expr->pat_head->index(expr->live, &pattern, err)) {
 		HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
-		free(data);
+		free(pattern.data);
 		return 0;
 	}
 	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
@@ -1952,47 +2837,60 @@ int pat_ref_push(struct pat_ref_elt *elt, struct pattern_expr *expr,
 	return 1;
 }
 
-/* This function adds entry to <ref>. It can failed with memory error. The new
- * entry is added at all the pattern_expr registered in this reference. The
- * function stop on the first error encountered. It returns 0 and err is
- * filled. If an error is encountered, the complete add operation is cancelled.
- * If the insertion is a success the function returns 1.
+/* This function allocates an entry for <pattern> and <sample>, which may be
+ * NULL, not chained yet. It returns NULL and fills <err> on memory error.
  */
-int pat_ref_add(struct pat_ref *ref,
-                const char *pattern, const char *sample,
-                char **err)
+static struct pat_ref_elt *pat_ref_alloc_elt(const char *pattern, const char *sample, char **err)
 {
 	struct pat_ref_elt *elt;
-	struct pattern_expr *expr;
 
 	elt = malloc(sizeof(*elt));
-	if (!elt) {
-		memprintf(err, "out of memory error");
-		return 0;
-	}
+	if (!elt)
+		goto fail;
 
 	elt->line = -1;
 
 	elt->pattern = strdup(pattern);
-	if (!elt->pattern) {
-		free(elt);
-		memprintf(err, "out of memory error");
-		return 0;
-	}
+	if (!elt->pattern)
+		goto fail_elt;
 
 	if (sample) {
 		elt->sample = strdup(sample);
-		if (!elt->sample) {
-			free(elt->pattern);
-			free(elt);
-			memprintf(err, "out of memory error");
-			return 0;
-		}
+		if (!elt->sample)
+			goto fail_pattern;
 	}
 	else
 		elt->sample = NULL;
 
 	LIST_INIT(&elt->back_refs);
+	return elt;
+
+ fail_pattern:
+	free(elt->pattern);
+ fail_elt:
+	free(elt);
+ fail:
+	memprintf(err, "out of memory error");
+	return NULL;
+}
+
+/* This function adds entry to <ref>. It can failed with memory error. The new
+ * entry is added at all the pattern_expr registered in this reference. The
+ * function stop on the first error encountered. It returns 0 and err is
+ * filled. If an error is encountered, the complete add operation is cancelled.
+ * If the insertion is a success the function returns 1.
+ */
+int pat_ref_add(struct pat_ref *ref,
+                const char *pattern, const char *sample,
+                char **err)
+{
+	struct pat_ref_elt *elt;
+	struct pattern_expr *expr;
+
+	elt = pat_ref_alloc_elt(pattern, sample, err);
+	if (!elt)
+		return 0;
+
 	LIST_ADDQ(&ref->head, &elt->list);
 
 	list_for_each_entry(expr, &ref->pat, list) {
@@ -2003,30 +2901,19 @@ int pat_ref_add(struct pat_ref *ref,
 		}
 	}
 
+	pat_ref_touch(ref);
 	return 1;
 }
 
-/* This function prunes <ref>, replaces all references by the references
- * of <replace>, and reindexes all the news values.
- *
- * The patterns are loaded in best effort and the errors are ignored,
- * but written in the logs.
+/* Releases all the elements of list <head>. The watchers of each of them
+ * are moved to the next one, or left at the end of the list.
  */
-void pat_ref_reload(struct pat_ref *ref, struct pat_ref *replace)
+static void pat_ref_free_elts(struct list *head)
 {
-	struct pattern_expr *expr;
 	struct pat_ref_elt *elt, *safe;
 	struct bref *bref, *back;
-	struct pattern pattern;
-
-
-	HA_SPIN_LOCK(PATREF_LOCK, &ref->lock);
-	list_for_each_entry(expr, &ref->pat, list) {
-		HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
-	}
 
-	/* all expr are locked, we can safely remove all pat_ref */
-	list_for_each_entry_safe(elt, safe, &ref->head, list) {
+	list_for_each_entry_safe(elt, safe, head, list) {
 		list_for_each_entry_safe(bref, back, &elt->back_refs, users) {
 			/*
 			 * we have to unlink all watchers. We must not relink them if
@@ -2034,7 +2921,7 @@ void pat_ref_reload(struct pat_ref *ref, struct pat_ref *replace)
 			 */
 			LIST_DEL(&bref->users);
 			LIST_INIT(&bref->users);
-			if (elt->list.n != &ref->head)
+			if (elt->list.n != head)
 				LIST_ADDQ(&LIST_ELEM(elt->list.n, typeof(elt), list)->back_refs, &bref->users);
 			bref->ref = elt->list.n;
 		}
@@ -2043,58 +2930,235 @@ void pat_ref_reload(struct pat_ref *ref, struct pat_ref *replace)
 		free(elt->sample);
 		free(elt);
 	}
+}
 
-	/* switch pat_ret_elt lists */
-	LIST_ADD(&replace->head, &ref->head);
-	LIST_DEL(&replace->head);
+/* Returns the patterns buffer of <expr> which is not looked up, in which a
+ * version may be prepared, or NULL if it was not allocated yet.
+ */
+static inline struct pattern_expr *pat_expr_spare(struct pattern_expr *expr)
+{
+	return (expr->live == expr) ? expr->shadow : expr;
+}
+
+/* Makes sure that all the expressions of <ref> have a spare patterns buffer.
+ * The shadow ones are never released before the end, so that a lookup may
+ * always safely read the buffer it was switched from. Returns 0 on memory
+ * allocation failure.
+ */
+static int pat_ref_alloc_spares(struct pat_ref *ref)
+{
+	struct pattern_expr *expr, *shadow;
 
 	list_for_each_entry(expr, &ref->pat, list) {
-		expr->pat_head->prune(expr);
-		list_for_each_entry(elt, &ref->head, list) {
-			char *err = NULL;
-			struct sample_data *data = NULL;
-
-			/* Create sample */
-			if (elt->sample && expr->pat_head->parse_smp) {
-				/* New sample. */
-				data = malloc(sizeof(*data));
-				if (!data)
-					continue;
+		if (pat_expr_spare(expr))
+			continue;
 
-				/* Parse value. */
-				if (!expr->pat_head->parse_smp(elt->sample, data)) {
-					memprintf(&err, "unable to parse '%s'", elt->sample);
-					send_log(NULL, LOG_NOTICE, "%s", err);
-					free(err);
-					free(data);
-					continue;
-				}
+		shadow = malloc(sizeof(*shadow));
+		if (!shadow)
+			return 0;
 
-			}
+		pattern_init_expr(shadow);
+		shadow->mflags = expr->mflags;
+		shadow->pat_head = expr->pat_head;
+		shadow->ref = ref;
+		LIST_INIT(&shadow->list);
+		HA_RWLOCK_INIT(&shadow->lock);
+		expr->shadow = shadow;
+	}
+	return 1;
+}
 
-			/* initialise pattern */
-			memset(&pattern, 0, sizeof(pattern));
-			pattern.data = data;
-			pattern.ref = elt;
+/* Discards the version being prepared for <ref>, if any. */
+static void pat_ref_discard(struct pat_ref *ref)
+{
+	struct pattern_expr *expr, *spare;
 
-			/* parse pattern */
-			if (!expr->pat_head->parse(elt->pattern, &pattern, expr->mflags, &err)) {
-				send_log(NULL, LOG_NOTICE, "%s", err);
-				free(err);
-				free(data);
-				continue;
-			}
+	list_for_each_entry(expr, &ref->pat, list) {
+		spare = pat_expr_spare(expr);
+		if (spare) {
+			expr->pat_head->prune(spare);
+			spare->revision = rdtsc();
+		}
+	}
+	pat_ref_free_elts(&ref->pending);
+	ref->next_gen = 0;
+}
 
-			/* index pattern */
-			if (!expr->pat_head->index(expr, &pattern, &err)) {
-				send_log(NULL, LOG_NOTICE, "%s", err);
-				free(err);
-				free(data);
-				continue;
-			}
+/* Inserts <elt> in the spare patterns buffer of all the expressions of <ref>.
+ * These buffers are not looked up so they are changed without locking the
+ * expressions. It is inserted in as many of them as possible. On error the
+ * function returns 0 and <err> is filled with the first error.
+ */
+static int pat_ref_stage_elt(struct pat_ref *ref, struct pat_ref_elt *elt, char **err)
+{
+	struct pattern_expr *expr, *spare;
+	struct pattern pattern;
+	int ret = 1;
+
+	list_for_each_entry(expr, &ref->pat, list) {
+		spare = pat_expr_spare(expr);
+		if (!pat_ref_parse_elt(elt, spare, &pattern, ret ? err : NULL)) {
+			ret = 0;
+			continue;
+		}
+		if (!expr->pat_head->index(spare, &pattern, ret ? err : NULL)) {
+			free(pattern.data);
+			ret = 0;
 		}
+	}
+	return ret;
+}
+
+/* Makes the version prepared for <ref> the live one: each expression switches
+ * to its spare patterns buffer, then the previous patterns and entries are
+ * released. The expressions' lock is only held during the switch, which also
+ * ensures that no lookup still uses the previous buffer once it is released.
+ * Each expression is switched at once, but not all of them at the same time.
+ */
+static void pat_ref_publish(struct pat_ref *ref)
+{
+	struct pattern_expr *expr, *spare, *prev;
+
+	list_for_each_entry(expr, &ref->pat, list) {
+		spare = pat_expr_spare(expr);
+		pat_ac_build(spare);
+
+		HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
+		prev = expr->live;
+		expr->live = spare;
 		HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
+
+		expr->pat_head->prune(prev);
+		prev->revision = rdtsc();
+	}
+
+	/* switch pat_ret_elt lists */
+	pat_ref_free_elts(&ref->head);
+	LIST_ADD(&ref->pending, &ref->head);
+	LIST_DEL(&ref->pending);
+	LIST_INIT(&ref->pending);
+	ref->next_gen = 0;
+	pat_ref_touch(ref);
+}
+
+/* Starts a new version of the entries of <ref>, initially empty, and returns
+ * its number in <gen>. The version which was being prepared, if any, is
+ * discarded. The reference must be locked. If the function fails, it returns
+ * 0 and <err> is filled.
+ */
+int pat_ref_prepare(struct pat_ref *ref, unsigned int *gen, char **err)
+{
+	pat_ref_discard(ref);
+	if (!pat_ref_alloc_spares(ref)) {
+		memprintf(err, "out of memory error");
+		return 0;
+	}
+
+	if (!++ref->last_gen)
+		ref->last_gen++;
+	ref->next_gen = ref->last_gen;
+	*gen = ref->next_gen;
+	return 1;
+}
+
+/* Returns non-zero if <gen> is the version being prepared for <ref>, otherwise
+ * fills <err> and returns 0.
+ */
+static int pat_ref_check_gen(struct pat_ref *ref, unsigned int gen, char **err)
+{
+	if (gen && gen == ref->next_gen)
+		return 1;
+	memprintf(err, "version %u is not being prepared", gen);
+	return 0;
+}
+
+/* Adds an entry to version <gen> of <ref>, which is being prepared. It is
+ * indexed immediately but only looked up once the version is committed. The
+ * reference must be locked. If the function fails, nothing is added, it
+ * returns 0 and <err> is filled.
+ */
+int pat_ref_add_gen(struct pat_ref *ref, unsigned int gen,
+                    const char *pattern, const char *sample, char **err)
+{
+	struct pattern_expr *expr;
+	struct pat_ref_elt *elt;
+
+	if (!pat_ref_check_gen(ref, gen, err))
+		return 0;
+
+	elt = pat_ref_alloc_elt(pattern, sample, err);
+	if (!elt)
+		return 0;
+
+	LIST_ADDQ(&ref->pending, &elt->list);
+	if (!pat_ref_stage_elt(ref, elt, err)) {
+		list_for_each_entry(expr, &ref->pat, list)
+			expr->pat_head->delete(pat_expr_spare(expr), elt);
+		LIST_DEL(&elt->list);
+		free(elt->sample);
+		free(elt->pattern);
+		free(elt);
+		return 0;
+	}
+	return 1;
+}
+
+/* Replaces the entries of <ref> with the ones of version <gen> being
+ * prepared. The reference must be locked. If the function fails, it returns 0
+ * and <err> is filled.
+ */
+int pat_ref_commit(struct pat_ref *ref, unsigned int gen, char **err)
+{
+	if (!pat_ref_check_gen(ref, gen, err))
+		return 0;
+	pat_ref_publish(ref);
+	return 1;
+}
+
+/* Discards version <gen> being prepared for <ref>. The reference must be
+ * locked. If the function fails, it returns 0 and <err> is filled.
+ */
+int pat_ref_clear_gen(struct pat_ref *ref, unsigned int gen, char **err)
+{
+	if (!pat_ref_check_gen(ref, gen, err))
+		return 0;
+	pat_ref_discard(ref);
+	return 1;
+}
+
+/* This function replaces all references of <ref> by the references of
+ * <replace>. The new values are indexed aside then switched to, so that
+ * the lookups are never blocked longer than this switch. A version which
+ * was being prepared is discarded.
+ *
+ * The patterns are loaded in best effort and the errors are ignored,
+ * but written in the logs.
+ */
+void pat_ref_reload(struct pat_ref *ref, struct pat_ref *replace)
+{
+	struct pat_ref_elt *elt, *safe;
+	char *err = NULL;
+
+	HA_SPIN_LOCK(PATREF_LOCK, &ref->lock);
+	pat_ref_discard(ref);
+	if (!pat_ref_alloc_spares(ref)) {
+		send_log(NULL, LOG_NOTICE, "out of memory error while reloading '%s'",
+		         ref->reference ? ref->reference : ref->display);
+		HA_SPIN_UNLOCK(PATREF_LOCK, &ref->lock);
+		return;
+	}
+
+	list_for_each_entry_safe(elt, safe, &replace->head, list) {
+		LIST_DEL(&elt->list);
+		LIST_ADDQ(&ref->pending, &elt->list);
+		if (!pat_ref_stage_elt(ref, elt, &err)) {
+			send_log(NULL, LOG_NOTICE, "%s", err);
+			free(err);
+			err = NULL;
+		}
 	}
+
+	pat_ref_publish(ref);
 	HA_SPIN_UNLOCK(PATREF_LOCK, &ref->lock);
 }
 
@@ -2109,9 +3173,10 @@ void pat_ref_prune(struct pat_ref *ref)
 
 	list_for_each_entry(expr, &ref->pat, list) {
 		HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
-		expr->pat_head->prune(expr);
+		expr->pat_head->prune(expr->live);
 		HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
 	}
+	pat_ref_touch(ref);
 
 	/* we trash pat_ref_elt in a second time to ensure that data is
 	   free once there is no ref on it */
@@ -2237,6 +3302,112 @@ struct pattern_expr *pattern_new_expr(struct pattern_head *head, struct pat_ref
 	return expr;
 }
 
+/* Contents of a pattern file, mapped in memory or read when it cannot be
+ * mapped (eg: pipes), and the position of the next line to be parsed.
+ */
+struct pat_file {
+	char *area;
+	size_t len;
+	size_t pos;
+	int mapped;
+};
+
+/* Loads the contents of pattern file <filename> into <pf>. Returns 0 and fills
+ * <err> on error.
+ */
+static int pat_file_open(struct pat_file *pf, const char *filename, char **err)
+{
+	struct stat st;
+	size_t size = 0;
+	ssize_t ret;
+	char *area;
+	int fd;
+
+	memset(pf, 0, sizeof(*pf));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		memprintf(err, "failed to open pattern file <%s>", filename);
+		return 0;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		area = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (area != MAP_FAILED) {
+			madvise(area, st.st_size, MADV_SEQUENTIAL);
+			pf->area = area;
+			pf->len = st.st_size;
+			pf->mapped = 1;
+			close(fd);
+			return 1;
+		}
+	}
+
+	while (1) {
+		if (pf->len == size) {
+			size = size ? size * 2 : 65536;
+			area = realloc(pf->area, size);
+			if (!area) {
+				memprintf(err, "out of memory when loading patterns from file <%s>", filename);
+				goto fail;
+			}
+			pf->area = area;
+		}
+		ret = read(fd, pf->area + pf->len, size - pf->len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			memprintf(err, "error encountered while reading  <%s> : %s",
+			          filename, strerror(errno));
+			goto fail;
+		}
+		if (!ret)
+			break;
+		pf->len += ret;
+	}
+	close(fd);
+	return 1;
+ fail:
+	free(pf->area);
+	pf->area = NULL;
+	close(fd);
+	return 0;
+}
+
+/* Copies the next line of <pf> into <dst> of <size> bytes, the same way as
+ * fgets() does. Returns NULL once the whole file was read.
+ */
+static char *pat_file_gets(char *dst, size_t size, struct pat_file *pf)
+{
+	const char *src = pf->area + pf->pos;
+	const char *nl;
+	size_t len;
+
+	if (pf->pos >= pf->len || size < 2)
+		return NULL;
+
+	len = pf->len - pf->pos;
+	if (len > size - 1)
+		len = size - 1;
+	nl = memchr(src, '\n', len);
+	if (nl)
+		len = nl - src + 1;
+
+	memcpy(dst, src, len);
+	dst[len] = 0;
+	pf->pos += len;
+	return dst;
+}
+
+/* Releases the contents of <pf>. */
+static void pat_file_close(struct pat_file *pf)
+{
+	if (pf->mapped)
+		munmap(pf->area, pf->len);
+	else
+		free(pf->area);
+	pf->area = NULL;
+}
+
 /* Reads patterns from a file. If <err_msg> is non-NULL, an error message will
  * be returned there on errors and the caller will have to free it.
  *
@@ -2261,7 +3432,7 @@ struct pattern_expr *pattern_new_expr(struct pattern_head *head, struct pat_ref
  */
 int pat_ref_read_from_file_smp(struct pat_ref *ref, const char *filename, char **err)
 {
-	FILE *file;
+	struct pat_file file;
 	char *c;
 	int ret = 0;
 	int line = 0;
@@ -2270,17 +3441,14 @@ int pat_ref_read_from_file_smp(struct pat_ref *ref, const char *filename, char *
 	char *value_beg;
 	char *value_end;
 
-	file = fopen(filename, "r");
-	if (!file) {
-		memprintf(err, "failed to open pattern file <%s>", filename);
+	if (!pat_file_open(&file, filename, err))
 		return 0;
-	}
 
 	/* now parse all patterns. The file may contain only one pattern
 	 * followed by one value per line. The start spaces, separator spaces
 	 * and and spaces are stripped. Each can contain comment started by '#'
 	 */
-	while (fgets(trash.area, trash.size, file) != NULL) {
+	while (pat_file_gets(trash.area, trash.size, &file) != NULL) {
 		line++;
 		c = trash.area;
 
@@ -2328,41 +3496,175 @@ int pat_ref_read_from_file_smp(struct pat_ref *ref, const char *filename, char *
 		}
 	}
 
-	if (ferror(file)) {
-		memprintf(err, "error encountered while reading  <%s> : %s",
-				filename, strerror(errno));
-		goto out_close;
-	}
 	/* succes */
 	ret = 1;
 
  out_close:
-	fclose(file);
+	pat_file_close(&file);
 	return ret;
 }
 
+/* The references loaded from a file with at least PAT_BULK_MIN_ELTS entries
+ * are pushed into the trees of the expressions in key order, which is much
+ * cheaper than in file order since every insertion then happens next to the
+ * previous one. The list of patterns is put back in file order afterwards.
+ */
+#define PAT_BULK_MIN_ELTS 256
+
+struct pat_bulk_ent {
+	struct pat_ref_elt *elt;
+	unsigned int key;               /* IPv4 address in host order for the IP trees */
+	unsigned int rank;              /* rank in the reference, to keep duplicates in order */
+};
+
+static int pat_bulk_cmp_str(const void *a, const void *b)
+{
+	const struct pat_bulk_ent *ea = a, *eb = b;
+	int ret;
+
+	ret = strcmp(ea->elt->pattern, eb->elt->pattern);
+	if (ret)
+		return ret;
+	return (ea->rank > eb->rank) - (ea->rank < eb->rank);
+}
+
+static int pat_bulk_cmp_ip(const void *a, const void *b)
+{
+	const struct pat_bulk_ent *ea = a, *eb = b;
+
+	if (ea->key != eb->key)
+		return (ea->key > eb->key) - (ea->key < eb->key);
+	return (ea->rank > eb->rank) - (ea->rank < eb->rank);
+}
+
+static int pat_bulk_cmp_line(const void *a, const void *b)
+{
+	const struct pattern_list *la = *(const struct pattern_list **)a;
+	const struct pattern_list *lb = *(const struct pattern_list **)b;
+
+	return (la->pat.ref->line > lb->pat.ref->line) - (la->pat.ref->line < lb->pat.ref->line);
+}
+
+/* Returns an allocated array of the entries of <ref> sorted by the key under
+ * which <expr> indexes them in its trees and sets their number into <nb>.
+ * NULL is returned if <expr> doesn't use trees, if <ref> is too short, if its
+ * entries don't come from a file in line order or if one of the IP addresses
+ * is not a plain IPv4 address, in which case the entries are pushed in the
+ * reference order.
+ */
+static struct pat_bulk_ent *pat_bulk_sort(struct pat_ref *ref, struct pattern_expr *expr,
+                                          unsigned int *nb)
+{
+	int (*cmp)(const void *, const void *);
+	struct pat_bulk_ent *ents;
+	struct pat_ref_elt *elt;
+	struct in_addr addr;
+	char ip[16];
+	unsigned int n = 0;
+	size_t len;
+	int line = 0;
+
+	if ((expr->pat_head->index == pat_idx_tree_str ||
+	     expr->pat_head->index == pat_idx_tree_pfx) &&
+	    !(expr->mflags & PAT_MF_IGNORE_CASE))
+		cmp = pat_bulk_cmp_str;
+	else if (expr->pat_head->index == pat_idx_tree_ip)
+		cmp = pat_bulk_cmp_ip;
+	else
+		return NULL;
+
+	/* the file order is restored from the line numbers */
+	list_for_each_entry(elt, &ref->head, list) {
+		if (elt->line <= line)
+			return NULL;
+		line = elt->line;
+		n++;
+	}
+
+	if (n < PAT_BULK_MIN_ELTS)
+		return NULL;
+
+	ents = calloc(n, sizeof(*ents));
+	if (!ents)
+		return NULL;
+
+	n = 0;
+	list_for_each_entry(elt, &ref->head, list) {
+		ents[n].elt = elt;
+		ents[n].rank = n;
+		if (cmp == pat_bulk_cmp_ip) {
+			len = strcspn(elt->pattern, "/");
+			if (len >= sizeof(ip))
+				goto unsorted;
+			memcpy(ip, elt->pattern, len);
+			ip[len] = 0;
+			if (inet_pton(AF_INET, ip, &addr) != 1)
+				goto unsorted;
+			ents[n].key = ntohl(addr.s_addr);
+		}
+		n++;
+	}
+
+	qsort(ents, n, sizeof(*ents), cmp);
+	*nb = n;
+	return ents;
+
+ unsorted:
+	free(ents);
+	return NULL;
+}
+
+/* Puts back the list of patterns of <expr> in the line order of their
+ * references. Returns 0 on memory allocation failure, otherwise 1.
+ */
+static int pat_bulk_restore_list(struct pattern_expr *expr)
+{
+	struct pattern_list **pats, *pat;
+	unsigned int n = 0, i;
+
+	list_for_each_entry(pat, &expr->patterns, list)
+		n++;
+
+	if (n < 2)
+		return 1;
+
+	pats = calloc(n, sizeof(*pats));
+	if (!pats)
+		return 0;
+
+	n = 0;
+	list_for_each_entry(pat, &expr->patterns, list)
+		pats[n++] = pat;
+
+	qsort(pats, n, sizeof(*pats), pat_bulk_cmp_line);
+
+	LIST_INIT(&expr->patterns);
+	for (i = 0; i < n; i++)
+		LIST_ADDQ(&expr->patterns, &pats[i]->list);
+
+	free(pats);
+	return 1;
+}
+
 /* Reads patterns from a file. If <err_msg> is non-NULL, an error message will
  * be returned there on errors and the caller will have to free it.
  */
 int pat_ref_read_from_file(struct pat_ref *ref, const char *filename, char **err)
 {
-	FILE *file;
+	struct pat_file file;
 	char *c;
 	char *arg;
 	int ret = 0;
 	int line = 0;
 
-	file = fopen(filename, "r");
-	if (!file) {
-		memprintf(err, "failed to open pattern file <%s>", filename);
+	if (!pat_file_open(&file, filename, err))
 		return 0;
-	}
 
 	/* now parse all patterns. The file may contain only one pattern per
 	 * line. If the line contains spaces, they will be part of the pattern.
 	 * The pattern stops at the first CR, LF or EOF encountered.
 	 */
-	while (fgets(trash.area, trash.size, file) != NULL) {
+	while (pat_file_gets(trash.area, trash.size, &file) != NULL) {
 		line++;
 		c = trash.area;
 
@@ -2390,15 +3692,10 @@ int pat_ref_read_from_file(struct pat_ref *ref, const char *filename, char **err
 		}
 	}
 
-	if (ferror(file)) {
-		memprintf(err, "error encountered while reading  <%s> : %s",
-				filename, strerror(errno));
-		goto out_close;
-	}
 	ret = 1; /* success */
 
  out_close:
-	fclose(file);
+	pat_file_close(&file);
 	return ret;
 }
 
@@ -2409,6 +3706,8 @@ int pattern_read_from_file(struct pattern_head *head, unsigned int refflags,
 	struct pat_ref *ref;
 	struct pattern_expr *expr;
 	struct pat_ref_elt *elt;
+	struct pat_bulk_ent *ents;
+	unsigned int nb, i;
 	int reuse = 0;
 
 	/* Lookup for the existing reference. */
@@ -2497,17 +3796,65 @@ int pattern_read_from_file(struct pattern_head *head, unsigned int refflags,
 	if (reuse)
 		return 1;
 
-	/* Load reference content in the pattern expression. */
-	list_for_each_entry(elt, &ref->head, list) {
-		if (!pat_ref_push(elt, expr, patflags, err)) {
-			if (elt->line > 0)
-				memprintf(err, "%s at line %d of file '%s'",
-				          *err, elt->line, filename);
+	/* Load reference content in the pattern expression, in key order for
+	 * the large files indexed in trees.
+	 */
+	ents = pat_bulk_sort(ref, expr, &nb);
+	if (ents) {
+		for (i = 0; i < nb; i++) {
+			elt = ents[i].elt;
+			if (!pat_ref_push(elt, expr, patflags, err)) {
+				free(ents);
+				goto fail_elt;
+			}
+		}
+		free(ents);
+
+		if (!pat_bulk_restore_list(expr)) {
+			memprintf(err, "out of memory");
 			return 0;
 		}
+		return 1;
+	}
+
+	list_for_each_entry(elt, &ref->head, list) {
+		if (!pat_ref_push(elt, expr, patflags, err))
+			goto fail_elt;
 	}
 
 	return 1;
+
+ fail_elt:
+	if (elt->line > 0)
+		memprintf(err, "%s at line %d of file '%s'",
+		          *err, elt->line, filename);
+	return 0;
+}
+
+/* Rebuilds the automaton of <expr> if its patterns were changed at runtime and
+ * it was not rebuilt for PAT_AC_REBUILD_DELAY, so that a series of updates
+ * does not trigger as many rebuilds. Meanwhile the list of patterns is used.
+ * Nothing is done if the expression is being used by another thread.
+ */
+static inline void pat_ac_refresh(struct pattern_expr *expr)
+{
+	struct pattern_expr *live = expr->live;
+
+	if (likely(live->ac_revision == live->revision))
+		return;
+
+	if (live->ac_next && !tick_is_expired(live->ac_next, now_ms))
+		return;
+
+	if (HA_RWLOCK_TRYWRLOCK(PATEXP_LOCK, &expr->lock) != 0)
+		return;
+
+	live = expr->live;
+	if (live->ac_revision != live->revision) {
+		pat_ac_build(live);
+		live->ac_next = tick_add(now_ms, PAT_AC_REBUILD_DELAY);
+	}
+	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
 }
 
 /* This function executes a pattern match on a sample. It applies pattern <expr>
@@ -2537,8 +3884,9 @@ struct pattern *pattern_exec_match(struct pattern_head *head, struct sample *smp
 		return NULL;
 
 	list_for_each_entry(list, &head->head, list) {
+		pat_ac_refresh(list->expr);
 		HA_RWLOCK_RDLOCK(PATEXP_LOCK, &list->expr->lock);
-		pat = head->match(smp, list->expr, fill);
+		pat = head->match(smp, list->expr->live, fill);
 		if (pat) {
 			/* We duplicate the pattern cause it could be modified
 			   by another thread */
@@ -2589,6 +3937,10 @@ void pattern_prune(struct pattern_head *head)
 			LIST_DEL(&list->expr->list);
 			HA_RWLOCK_WRLOCK(PATEXP_LOCK, &list->expr->lock);
 			head->prune(list->expr);
+			if (list->expr->shadow) {
+				head->prune(list->expr->shadow);
+				free(list->expr->shadow);
+			}
 			HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &list->expr->lock);
 			free(list->expr);
 		}
@@ -2637,7 +3989,7 @@ struct sample_data **pattern_find_smp(struct pattern_expr *expr, struct pat_ref_
 int pattern_delete(struct pattern_expr *expr, struct pat_ref_elt *ref)
 {
 	HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
-	expr->pat_head->delete(expr, ref);
+	expr->pat_head->delete(expr->live, ref);
 	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
 	return 1;
 }
@@ -2669,6 +4021,18 @@ int pattern_finalize_config(void)
 
 	pat_lru_seed = ha_random();
 
+	/* index the lists of patterns loaded from the configuration */
+	list_for_each_entry(ref, &pattern_reference, list) {
+		struct pattern_expr *expr;
+
+		list_for_each_entry(expr, &ref->pat, list) {
+			if (!pat_ac_build(expr)) {
+				ha_alert("Out of memory error.\n");
+				return ERR_ALERT | ERR_FATAL;
+			}
+		}
+	}
+
 	/* Count pat_refs with user defined unique_id and totalt count */
 	list_for_each_entry(ref, &pattern_reference, list) {
 		len++;
@@ -2737,3 +4101,29 @@ static void pattern_per_thread_lru_free()
 
 REGISTER_PER_THREAD_ALLOC(pattern_per_thread_lru_alloc);
 REGISTER_PER_THREAD_FREE(pattern_per_thread_lru_free);
+
+#ifdef USE_HYPERSCAN
+static void pattern_per_thread_hs_free()
+{
+	hs_free_scratch(pat_hs_scratch);
+	pat_hs_scratch = NULL;
+}
+
+static void pattern_hs_deinit()
+{
+	hs_free_scratch(pat_hs_proto);
+	pat_hs_proto = NULL;
+}
+
+static void pattern_hs_register_build_options()
+{
+	char *ptr = NULL;
+
+	memprintf(&ptr, "Built with Hyperscan version : %s", hs_version());
+	hap_register_build_opts(ptr, 1);
+}
+
+REGISTER_PER_THREAD_FREE(pattern_per_thread_hs_free);
+REGISTER_POST_DEINIT(pattern_hs_deinit);
+INITCALL0(STG_REGISTER, pattern_hs_register_build_options);
+#endif
@@ -247,6 +247,11 @@ struct peer_prep_params {
 
 #define PEER_STKT_CACHE_MAX_ENTRIES       128
 
+/* Maximum number of stick-table updates referenced at once when they are
+ * taught to a peer.
+ */
+#define PEER_TEACH_BATCH                  64
+
 /**********************************/
 /* Peer Session IO handler states */
 /**********************************/
@@ -1148,22 +1153,28 @@ static inline int peer_send_error_protomsg(struct appctx *appctx)
 /*
  * Function used to lookup for recent stick-table updates associated with
  * <st> shared stick-table when a lesson must be taught a peer (PEER_F_LEARN_ASSIGN flag set).
+ * The lookup starts after the <from> update ID. When <from> is the last update
+ * pushed to the peer and nothing remains to be pushed, the peer is marked as up
+ * to date.
  */
-static inline struct stksess *peer_teach_process_stksess_lookup(struct shared_table *st)
+static inline struct stksess *peer_teach_process_stksess_lookup(struct shared_table *st,
+                                                                unsigned int from)
 {
 	struct eb32_node *eb;
 
-	eb = eb32_lookup_ge(&st->table->updates, st->last_pushed+1);
+	eb = eb32_lookup_ge(&st->table->updates, from+1);
 	if (!eb) {
 		eb = eb32_first(&st->table->updates);
-		if (!eb || ((int)(eb->key - st->last_pushed) <= 0)) {
-			st->table->commitupdate = st->last_pushed = st->table->localupdate;
+		if (!eb || ((int)(eb->key - from) <= 0)) {
+			if (from == st->last_pushed)
+				st->table->commitupdate = st->last_pushed = st->table->localupdate;
 			return NULL;
 		}
 	}
 
 	if ((int)(eb->key - st->table->localupdate) > 0) {
-		st->table->commitupdate = st->last_pushed = st->table->localupdate;
+		if (from == st->last_pushed)
+			st->table->commitupdate = st->last_pushed = st->table->localupdate;
 		return NULL;
 	}
 
@@ -1172,18 +1183,22 @@ static inline struct stksess *peer_teach_process_stksess_lookup(struct shared_ta
 
 /*
  * Function used to lookup for recent stick-table updates associated with
- * <st> shared stick-table during teach state 1 step.
+ * <st> shared stick-table during teach state 1 step, after the <from> update ID.
+ * The step is over once nothing remains after the last update pushed to the peer.
  */
-static inline struct stksess *peer_teach_stage1_stksess_lookup(struct shared_table *st)
+static inline struct stksess *peer_teach_stage1_stksess_lookup(struct shared_table *st,
+                                                               unsigned int from)
 {
 	struct eb32_node *eb;
 
-	eb = eb32_lookup_ge(&st->table->updates, st->last_pushed+1);
+	eb = eb32_lookup_ge(&st->table->updates, from+1);
 	if (!eb) {
-		st->flags |= SHTABLE_F_TEACH_STAGE1;
-		eb = eb32_first(&st->table->updates);
-		if (eb)
-			st->last_pushed = eb->key - 1;
+		if (from == st->last_pushed) {
+			st->flags |= SHTABLE_F_TEACH_STAGE1;
+			eb = eb32_first(&st->table->updates);
+			if (eb)
+				st->last_pushed = eb->key - 1;
+		}
 		return NULL;
 	}
 
@@ -1192,15 +1207,18 @@ static inline struct stksess *peer_teach_stage1_stksess_lookup(struct shared_tab
 
 /*
  * Function used to lookup for recent stick-table updates associated with
- * <st> shared stick-table during teach state 2 step.
+ * <st> shared stick-table during teach state 2 step, after the <from> update ID.
+ * The step is over once nothing remains after the last update pushed to the peer.
  */
-static inline struct stksess *peer_teach_stage2_stksess_lookup(struct shared_table *st)
+static inline struct stksess *peer_teach_stage2_stksess_lookup(struct shared_table *st,
+                                                               unsigned int from)
 {
 	struct eb32_node *eb;
 
-	eb = eb32_lookup_ge(&st->table->updates, st->last_pushed+1);
+	eb = eb32_lookup_ge(&st->table->updates, from+1);
 	if (!eb || eb->key > st->teaching_origin) {
-		st->flags |= SHTABLE_F_TEACH_STAGE2;
+		if (from == st->last_pushed)
+			st->flags |= SHTABLE_F_TEACH_STAGE2;
 		return NULL;
 	}
 
@@ -1213,8 +1231,11 @@ static inline struct stksess *peer_teach_stage2_stksess_lookup(struct shared_tab
  * <locked> must be set to 1 if the shared table <st> is already locked when entering
  * this function, 0 if not.
  *
- * This function temporary unlock/lock <st> when it sends stick-table updates or
- * when decrementing its refcount in case of any error when it sends this updates.
+ * The updates are looked up by batches of up to PEER_TEACH_BATCH entries which
+ * are referenced under a single lock of <st>, then sent with <st> unlocked.
+ * The lookup may only conclude that nothing remains to be sent once all the
+ * updates of the previous batch were sent, so that none of the updates
+ * which could have been added meanwhile is missed.
  *
  * Return 0 if any message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
  * Returns -1 if there was not enough room left to send the message,
@@ -1224,10 +1245,13 @@ static inline struct stksess *peer_teach_stage2_stksess_lookup(struct shared_tab
  * unlocked if not already locked when entering this function.
  */
 static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
-                                      struct stksess *(*peer_stksess_lookup)(struct shared_table *),
+                                      struct stksess *(*peer_stksess_lookup)(struct shared_table *, unsigned int),
                                       struct shared_table *st, int locked)
 {
+	struct stksess *batch[PEER_TEACH_BATCH];
+	unsigned int updateids[PEER_TEACH_BATCH];
 	int ret, new_pushed, use_timed;
+	int i, n;
 
 	ret = 1;
 	use_timed = 0;
@@ -1250,39 +1274,49 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 
 	while (1) {
 		struct stksess *ts;
-		unsigned updateid;
+		unsigned int from = st->last_pushed;
 
-		/* push local updates */
-		ts = peer_stksess_lookup(st);
-		if (!ts)
+		/* reference the next local updates to push */
+		for (n = 0; n < PEER_TEACH_BATCH; n++) {
+			ts = peer_stksess_lookup(st, from);
+			if (!ts)
+				break;
+
+			HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+			batch[n] = ts;
+			from = updateids[n] = ts->upd.key;
+		}
+
+		if (!n)
 			break;
 
-		updateid = ts->upd.key;
-		ts->ref_cnt++;
 		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
 
-		ret = peer_send_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
-		if (ret <= 0) {
-			HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-			ts->ref_cnt--;
-			if (!locked)
-				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
-			return ret;
+		for (i = 0; i < n; i++) {
+			ret = peer_send_updatemsg(st, appctx, batch[i], updateids[i], new_pushed, use_timed);
+			if (ret <= 0)
+				break;
+
+			st->last_pushed = updateids[i];
+			/* identifier may not needed in next update message */
+			new_pushed = 0;
 		}
 
 		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-		ts->ref_cnt--;
-		st->last_pushed = updateid;
+		while (n--)
+			HA_ATOMIC_SUB(&batch[n]->ref_cnt, 1);
 
 		if (peer_stksess_lookup == peer_teach_process_stksess_lookup &&
 		    (int)(st->last_pushed - st->table->commitupdate) > 0)
 			st->table->commitupdate = st->last_pushed;
 
-		/* identifier may not needed in next update message */
-		new_pushed = 0;
+		if (ret <= 0) {
+			if (!locked)
+				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+			return ret;
+		}
 	}
 
- out:
 	if (!locked)
 		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
 	return 1;
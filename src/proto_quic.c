@@ -25,6 +25,17 @@
 #include <netinet/udp.h>
 #include <netinet/in.h>
 
+#if defined(__linux__) && defined(SO_TXTIME)
+#include <time.h>
+#include <linux/net_tstamp.h>
+#define QUIC_USE_TXTIME
+#endif
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#define QUIC_USE_REUSEPORT_CBPF
+#endif
+
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/debug.h>
@@ -33,10 +44,12 @@
 #include <common/mini-clist.h>
 #include <common/standard.h>
 #include <common/namespace.h>
+#include <common/openssl-compat.h>
 
 #include <types/action.h>
 #include <types/connection.h>
 #include <types/global.h>
+#include <types/quic.h>
 #include <types/stream.h>
 
 #include <proto/arg.h>
@@ -48,6 +61,7 @@
 #include <proto/port_range.h>
 #include <proto/protocol.h>
 #include <proto/proto_quic.h>
+#include <proto/quic_cc.h>
 #include <proto/proxy.h>
 #include <proto/server.h>
 #include <proto/task.h>
@@ -272,6 +286,70 @@ static int create_server_socket(struct connection *conn)
  * it's invalid and the caller has nothing to do.
  */
 
+/* Let the kernel pace the datagrams sent by <fd> socket at the departure
+ * dates given by the QUIC pacer when "tune.quic.pacing-txtime" is enabled.
+ * If the kernel does not support it, this option is disabled for all the
+ * sockets.
+ */
+static void quic_set_txtime(int fd)
+{
+#ifdef QUIC_USE_TXTIME
+	struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+
+	if ((global.tune.options & GTUNE_QUIC_TXTIME) &&
+	    setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof txtime) == -1)
+		HA_ATOMIC_AND(&global.tune.options, ~GTUNE_QUIC_TXTIME);
+#endif
+}
+
+/* Ask the kernel to report the TOS field (IPv4) or the traffic class (IPv6),
+ * and thus the ECN codepoint, of the datagrams received by <fd> socket of
+ * <family> address family, unless "tune.quic.ecn" is off. An IPv6 socket
+ * also receives the IPv4 datagrams with IPv4-mapped addresses.
+ */
+static void quic_set_recv_ecn(int fd, int family)
+{
+#if defined(IP_RECVTOS) && defined(IPV6_RECVTCLASS)
+	if (global.tune.options & GTUNE_QUIC_NO_ECN)
+		return;
+
+	setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &one, sizeof(one));
+	if (family == AF_INET6 || family == AF_CUST_QUIC6)
+		setsockopt(fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &one, sizeof(one));
+#endif
+}
+
+/* Let the kernel coalesce the UDP segments received by <fd> socket from the
+ * same peer (UDP_GRO) when "tune.quic.gro" is enabled.
+ */
+static void quic_set_gro(int fd)
+{
+#if defined(__linux__) && defined(UDP_GRO)
+	if (global.tune.options & GTUNE_QUIC_GRO)
+		setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+#endif
+}
+
+/* Set the DF bit on the datagrams sent by <fd> socket of <family> address
+ * family without limiting their size to the path MTU known by the kernel,
+ * the QUIC path MTU discovery sending its own probes (RFC 8899).
+ */
+static void quic_set_pmtud_probe(int fd, int family)
+{
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+	int val = IP_PMTUDISC_PROBE;
+
+	setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val));
+#endif
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+	if (family == AF_INET6 || family == AF_CUST_QUIC6) {
+		int val6 = IPV6_PMTUDISC_PROBE;
+
+		setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val6, sizeof(val6));
+	}
+#endif
+}
+
 int quic_connect_server(struct connection *conn, int flags)
 {
 	int fd, ret;
@@ -464,6 +542,11 @@ int quic_connect_server(struct connection *conn, int flags)
 	if (global.tune.server_rcvbuf)
                 setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &global.tune.server_rcvbuf, sizeof(global.tune.server_rcvbuf));
 
+	quic_set_txtime(fd);
+	quic_set_recv_ecn(fd, conn->dst->ss_family);
+	quic_set_pmtud_probe(fd, conn->dst->ss_family);
+	quic_set_gro(fd);
+
 	addr = (conn->flags & CO_FL_SOCKS4) ? &srv->socks4_addr : conn->dst;
 	addr->ss_family = addr->ss_family == AF_CUST_QUIC ? AF_INET :
 		addr->ss_family == AF_CUST_QUIC6 ? AF_INET6 : -1;
@@ -665,75 +748,25 @@ static int quic_find_compatible_fd(struct listener *l)
 }
 #undef L1_MANDATORY_FLAGS
 
-/* This function tries to bind a UDPv4/v6 listener. It may return a warning or
- * an error message in <errmsg> if the message is at most <errlen> bytes long
- * (including '\0'). Note that <errmsg> may be NULL if <errlen> is also zero.
- * The return value is composed from ERR_ABORT, ERR_WARN,
- * ERR_ALERT, ERR_RETRYABLE and ERR_FATAL. ERR_NONE indicates that everything
- * was alright and that no message was returned. ERR_RETRYABLE means that an
- * error occurred but that it may vanish after a retry (eg: port in use), and
- * ERR_FATAL indicates a non-fixable error. ERR_WARN and ERR_ALERT do not alter
- * the meaning of the error, but just indicate that a message is present which
- * should be displayed with the respective level. Last, ERR_ABORT indicates
- * that it's pointless to try to start other listeners. No error message is
- * returned if errlen is NULL.
+/* Set the options of <fd> socket for <listener> then bind it, <ext> being
+ * non-zero if it was inherited from another process, in which case it is
+ * already bound. SO_REUSEPORT is enabled if <reuseport> is non-zero.
+ * ERR_* flags are added to <err> and <msg> is set to the last error message.
+ * Returns 0 if the socket is not usable and must be closed, 1 if not.
  */
-int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
+static int quic_setup_sock(struct listener *listener, int fd, int ext, int reuseport,
+                           int *err, const char **msg)
 {
-	__label__ quic_return, quic_close_return;
-	int fd, err;
-	int ext;
-	const char *msg = NULL;
-
-	/* ensure we never return garbage */
-	if (errlen)
-		*errmsg = 0;
-
-	if (listener->state != LI_ASSIGNED)
-		return ERR_NONE; /* already bound */
-
-	err = ERR_NONE;
-
-	if (listener->fd == -1)
-		listener->fd = quic_find_compatible_fd(listener);
-
-	/* if the listener already has an fd assigned, then we were offered the
-	 * fd by an external process (most likely the parent), and we don't want
-	 * to create a new socket. However we still want to set a few flags on
-	 * the socket.
-	 */
-	fd = listener->fd;
-	ext = (fd >= 0);
-
-	if (!ext) {
-		sa_family_t sa_family = listener->addr.ss_family == AF_CUST_QUIC ? AF_INET :
-			                    listener->addr.ss_family == AF_CUST_QUIC6 ? AF_INET6 : -1;
-
-		fd = my_socketat(listener->netns, sa_family, SOCK_DGRAM, IPPROTO_UDP);
-
-		if (fd == -1) {
-			err |= ERR_RETRYABLE | ERR_ALERT;
-			msg = "cannot create listening socket";
-			goto quic_return;
-		}
-	}
-
-	if (fd >= global.maxsock) {
-		err |= ERR_FATAL | ERR_ABORT | ERR_ALERT;
-		msg = "not enough free sockets (raise '-n' parameter)";
-		goto quic_close_return;
-	}
-
 	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
-		err |= ERR_FATAL | ERR_ALERT;
-		msg = "cannot make socket non-blocking";
-		goto quic_close_return;
+		*err |= ERR_FATAL | ERR_ALERT;
+		*msg = "cannot make socket non-blocking";
+		return 0;
 	}
 
 	if (!ext && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) {
 		/* not fatal but should be reported */
-		msg = "cannot do so_reuseaddr";
-		err |= ERR_ALERT;
+		*msg = "cannot do so_reuseaddr";
+		*err |= ERR_ALERT;
 	}
 
 	if (listener->options & LI_O_NOLINGER)
@@ -754,7 +787,7 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
 	/* OpenBSD and Linux 3.9 support this. As it's present in old libc versions of
 	 * Linux, it might return an error that we will silently ignore.
 	 */
-	if (!ext && (global.tune.options & GTUNE_USE_REUSEPORT))
+	if (!ext && reuseport)
 		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 #endif
 
@@ -775,8 +808,8 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
 			    && (setsockopt(fd, SOL_SOCKET, SO_BINDANY, &one, sizeof(one)) == -1)
 #endif
 			    ) {
-				msg = "cannot make listening socket transparent";
-				err |= ERR_ALERT;
+				*msg = "cannot make listening socket transparent";
+				*err |= ERR_ALERT;
 			}
 		break;
 		case AF_CUST_QUIC6:
@@ -794,8 +827,8 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
 			    && (setsockopt(fd, SOL_SOCKET, SO_BINDANY, &one, sizeof(one)) == -1)
 #endif
 			    ) {
-				msg = "cannot make listening socket transparent";
-				err |= ERR_ALERT;
+				*msg = "cannot make listening socket transparent";
+				*err |= ERR_ALERT;
 			}
 		break;
 		}
@@ -806,8 +839,8 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
 	if (!ext && listener->interface) {
 		if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE,
 			       listener->interface, strlen(listener->interface) + 1) == -1) {
-			msg = "cannot bind listener to device";
-			err |= ERR_WARN;
+			*msg = "cannot bind listener to device";
+			*err |= ERR_WARN;
 		}
 	}
 #endif
@@ -818,6 +851,11 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
                 setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
 #endif
 
+	quic_set_txtime(fd);
+	quic_set_recv_ecn(fd, listener->addr.ss_family);
+	quic_set_pmtud_probe(fd, listener->addr.ss_family);
+	quic_set_gro(fd);
+
 	if (!ext) {
 		int ret;
 		sa_family_t sa_family;
@@ -828,18 +866,206 @@ int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
 		ret = bind(fd, (struct sockaddr *)&listener->addr, listener->proto->sock_addrlen);
 		listener->addr.ss_family = sa_family;
 		if (ret == -1) {
+			*err |= ERR_RETRYABLE | ERR_ALERT;
+			*msg = "cannot bind socket";
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+#ifdef QUIC_USE_REUSEPORT_CBPF
+/* Attach to <fd> socket the classic BPF program which makes the kernel select
+ * the socket of the SO_REUSEPORT group of <fd> from the thread ID encoded in
+ * the first byte of our connection IDs (see new_quic_connection_id()), the
+ * sockets having joined the group in thread order. Initial packets and packets
+ * whose DCID is not one of our CIDs return an out of range index so that the
+ * kernel falls back to its 4-tuple hash.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int quic_attach_reuseport_cbpf(int fd)
+{
+	struct sock_filter code[] = {
+		/* The offsets are relative to the UDP payload. */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 0),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, QUIC_PACKET_LONG_HEADER_BIT, 2, 0),
+		/* Short header: the DCID follows the first byte. */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 1),
+		BPF_JUMP(BPF_JMP | BPF_JA, 4, 0, 0),
+		/* Long header: Initial packets have 0 as type. */
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,
+		         QUIC_PACKET_TYPE_BITMASK << QUIC_PACKET_TYPE_SHIFT, 0, 5),
+		/* The DCID length follows the 4 bytes of the version. */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 5),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, QUIC_CID_LEN, 0, 3),
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 6),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, global.nbthread),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof code / sizeof *code,
+		.filter = code,
+	};
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) != -1;
+}
+#endif
+
+/* Open and bind one socket per thread for <listener> in addition to its ->fd
+ * one, which is bound to the first thread, as enabled by
+ * "tune.quic.socket-per-thread". They all belong to the same SO_REUSEPORT group
+ * and are installed in ->quic_fds in thread order. ERR_* flags are added to
+ * <err> and <msg> is set to the last error message.
+ * Returns 1 if succeeded, 0 if not, all the per-thread sockets being closed.
+ */
+static int quic_bind_thread_socks(struct listener *listener, int *err, const char **msg)
+{
+	int i, fd;
+	sa_family_t sa_family = listener->addr.ss_family == AF_CUST_QUIC ? AF_INET :
+		                    listener->addr.ss_family == AF_CUST_QUIC6 ? AF_INET6 : -1;
+
+	if (!listener->quic_fds) {
+		listener->quic_fds = calloc(global.nbthread, sizeof *listener->quic_fds);
+		if (!listener->quic_fds) {
+			*msg = "out of memory while allocating per-thread sockets";
+			*err |= ERR_WARN;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < global.nbthread; i++)
+		listener->quic_fds[i] = -1;
+	listener->quic_fds[0] = listener->fd;
+
+	for (i = 1; i < global.nbthread; i++) {
+		fd = my_socketat(listener->netns, sa_family, SOCK_DGRAM, IPPROTO_UDP);
+		if (fd == -1) {
+			*msg = "cannot create per-thread listening socket";
+			goto err;
+		}
+
+		if (fd >= global.maxsock) {
+			close(fd);
+			*msg = "not enough free sockets for per-thread listening sockets";
+			goto err;
+		}
+
+		if (!quic_setup_sock(listener, fd, 0, 1, err, msg)) {
+			close(fd);
+			goto err;
+		}
+
+		listener->quic_fds[i] = fd;
+	}
+
+#ifdef QUIC_USE_REUSEPORT_CBPF
+	if (!quic_attach_reuseport_cbpf(listener->fd)) {
+		*msg = "cannot attach the reuseport BPF program, datagrams will be hashed";
+		*err |= ERR_WARN;
+	}
+#endif
+
+	for (i = 1; i < global.nbthread; i++)
+		fd_insert(listener->quic_fds[i], listener, quic_fd_handler, 1UL << i);
+
+	return 1;
+
+ err:
+	/* Not fatal: fall back to only one socket shared by all the threads. */
+	*err &= ~(ERR_FATAL | ERR_RETRYABLE | ERR_ALERT);
+	*err |= ERR_WARN;
+	for (i = 1; i < global.nbthread; i++)
+		if (listener->quic_fds[i] >= 0)
+			close(listener->quic_fds[i]);
+	free(listener->quic_fds);
+	listener->quic_fds = NULL;
+	return 0;
+}
+
+/* This function tries to bind a UDPv4/v6 listener. It may return a warning or
+ * an error message in <errmsg> if the message is at most <errlen> bytes long
+ * (including '\0'). Note that <errmsg> may be NULL if <errlen> is also zero.
+ * The return value is composed from ERR_ABORT, ERR_WARN,
+ * ERR_ALERT, ERR_RETRYABLE and ERR_FATAL. ERR_NONE indicates that everything
+ * was alright and that no message was returned. ERR_RETRYABLE means that an
+ * error occurred but that it may vanish after a retry (eg: port in use), and
+ * ERR_FATAL indicates a non-fixable error. ERR_WARN and ERR_ALERT do not alter
+ * the meaning of the error, but just indicate that a message is present which
+ * should be displayed with the respective level. Last, ERR_ABORT indicates
+ * that it's pointless to try to start other listeners. No error message is
+ * returned if errlen is NULL.
+ * When "tune.quic.socket-per-thread" is enabled, one socket is bound for each
+ * thread, the listener being run on all the threads.
+ */
+int quic_bind_listener(struct listener *listener, char *errmsg, int errlen)
+{
+	__label__ quic_return, quic_close_return;
+	int fd, err;
+	int ext, per_thread;
+	unsigned long mask;
+	const char *msg = NULL;
+
+	/* ensure we never return garbage */
+	if (errlen)
+		*errmsg = 0;
+
+	if (listener->state != LI_ASSIGNED)
+		return ERR_NONE; /* already bound */
+
+	err = ERR_NONE;
+
+	if (listener->fd == -1)
+		listener->fd = quic_find_compatible_fd(listener);
+
+	/* if the listener already has an fd assigned, then we were offered the
+	 * fd by an external process (most likely the parent), and we don't want
+	 * to create a new socket. However we still want to set a few flags on
+	 * the socket.
+	 */
+	fd = listener->fd;
+	ext = (fd >= 0);
+
+	mask = thread_mask(listener->bind_conf->bind_thread) & all_threads_mask;
+	per_thread = 0;
+#ifdef SO_REUSEPORT
+	per_thread = !ext && global.nbthread > 1 && mask == all_threads_mask &&
+		(global.tune.options & GTUNE_QUIC_SOCK_PER_THR);
+#endif
+
+	if (!ext) {
+		sa_family_t sa_family = listener->addr.ss_family == AF_CUST_QUIC ? AF_INET :
+			                    listener->addr.ss_family == AF_CUST_QUIC6 ? AF_INET6 : -1;
+
+		fd = my_socketat(listener->netns, sa_family, SOCK_DGRAM, IPPROTO_UDP);
+
+		if (fd == -1) {
 			err |= ERR_RETRYABLE | ERR_ALERT;
-			msg = "cannot bind socket";
-			goto quic_close_return;
+			msg = "cannot create listening socket";
+			goto quic_return;
 		}
 	}
 
+	if (fd >= global.maxsock) {
+		err |= ERR_FATAL | ERR_ABORT | ERR_ALERT;
+		msg = "not enough free sockets (raise '-n' parameter)";
+		goto quic_close_return;
+	}
+
+	if (!quic_setup_sock(listener, fd, ext,
+	                     per_thread || (global.tune.options & GTUNE_USE_REUSEPORT),
+	                     &err, &msg))
+		goto quic_close_return;
+
 	/* the socket is ready */
 	listener->fd = fd;
 	listener->state = LI_LISTEN;
 
-	fd_insert(fd, listener, quic_fd_handler,
-	          thread_mask(listener->bind_conf->bind_thread) & all_threads_mask);
+	if (per_thread && quic_bind_thread_socks(listener, &err, &msg))
+		mask = 1UL;
+
+	fd_insert(fd, listener, quic_fd_handler, mask);
 
  quic_return:
 	if (msg && errlen) {
@@ -914,6 +1140,65 @@ int quic_pause_listener(struct listener *l)
 	return 1;
 }
 
+/* parse the "quic-cc-algo" bind keyword */
+static int bind_parse_quic_cc_algo(char **args, int cur_arg, struct proxy *px,
+                                   struct bind_conf *conf, char **err)
+{
+	struct quic_cc_algo *algo;
+
+	if (!*args[cur_arg + 1]) {
+		memprintf(err, "'%s' : missing congestion control algorithm", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	algo = quic_cc_algo_lookup(args[cur_arg + 1]);
+	if (!algo) {
+		memprintf(err, "'%s' : unknown congestion control algorithm '%s' (supported: newreno, cubic, bbr)",
+		          args[cur_arg], args[cur_arg + 1]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	conf->quic_cc_algo = algo;
+	return 0;
+}
+
+/* parse the "quic-disable-migration" bind keyword */
+static int bind_parse_quic_disable_migration(char **args, int cur_arg, struct proxy *px,
+                                             struct bind_conf *conf, char **err)
+{
+	conf->quic_params.disable_active_migration = 1;
+	return 0;
+}
+
+/* parse the "quic-cert-compression" bind keyword */
+static int bind_parse_quic_cert_comp(char **args, int cur_arg, struct proxy *px,
+                                     struct bind_conf *conf, char **err)
+{
+#ifdef HAVE_SSL_CERT_COMP
+	conf->quic_cert_comp = 1;
+	return 0;
+#else
+	memprintf(err, "'%s' : certificate compression is not supported by this build (BoringSSL with zlib required)", args[cur_arg]);
+	return ERR_ALERT | ERR_FATAL;
+#endif
+}
+
+/* Note: must not be declared <const> as its list will be overwritten.
+ * Please take care of keeping this list alphabetically sorted, doing so helps
+ * all code contributors.
+ * Optional keywords are also declared with a NULL ->parse() function so that
+ * the config parser can report an appropriate error when a known keyword was
+ * not enabled.
+ */
+static struct bind_kw_list bind_kws = { "QUIC", { }, {
+	{ "quic-cc-algo",           bind_parse_quic_cc_algo,           1 }, /* congestion control algorithm */
+	{ "quic-cert-compression",  bind_parse_quic_cert_comp,         0 }, /* RFC 8879 certificate compression */
+	{ "quic-disable-migration", bind_parse_quic_disable_migration, 0 }, /* send the disable_active_migration transport parameter */
+	{ NULL, NULL, 0 },
+}};
+
+INITCALL1(STG_REGISTER, bind_register_keywords, &bind_kws);
+
 /*
  * Local variables:
  *  c-indent-level: 8
@@ -508,6 +508,11 @@ int tcp_connect_server(struct connection *conn, int flags)
 		setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &srv->tcp_ut, sizeof(srv->tcp_ut));
 #endif
 
+#ifdef TCP_NOTSENT_LOWAT
+	if (srv && srv->notsent_lowat)
+		setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &srv->notsent_lowat, sizeof(srv->notsent_lowat));
+#endif
+
 	if (use_fastopen) {
 #if defined(TCP_FASTOPEN_CONNECT)
                 setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
@@ -926,6 +931,24 @@ int tcp_bind_listener(struct listener *listener, char *errmsg, int errlen)
 		setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &zero,
 		    sizeof(zero));
 #endif
+#if defined(TCP_NOTSENT_LOWAT)
+	/* inherited by the accepted sockets */
+	if (listener->notsent_lowat &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+		       &listener->notsent_lowat, sizeof(listener->notsent_lowat)) == -1) {
+		msg = "cannot set TCP_NOTSENT_LOWAT";
+		err |= ERR_WARN;
+	}
+#endif
+#if defined(SO_BUSY_POLL)
+	/* inherited by the accepted sockets */
+	if (listener->busy_poll &&
+	    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+		       &listener->busy_poll, sizeof(listener->busy_poll)) == -1) {
+		msg = "cannot set SO_BUSY_POLL";
+		err |= ERR_WARN;
+	}
+#endif
 #if defined(TCP_DEFER_ACCEPT)
 	if (listener->options & LI_O_DEF_ACCEPT) {
 		/* defer accept by up to one second */
@@ -1814,6 +1837,86 @@ static int bind_parse_tcp_ut(char **args, int cur_arg, struct proxy *px, struct
 }
 #endif
 
+#ifdef SO_BUSY_POLL
+/* parse the "busy-poll" bind keyword */
+static int bind_parse_busy_poll(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	const char *ptr = NULL;
+	struct listener *l;
+	unsigned int timeout;
+
+	if (!*args[cur_arg + 1]) {
+		memprintf(err, "'%s' : missing busy polling time", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	ptr = parse_time_err(args[cur_arg + 1], &timeout, TIME_UNIT_US);
+	if (ptr == PARSE_TIME_OVER) {
+		memprintf(err, "timer overflow in argument '%s' to '%s' (maximum value is 2147483647 us or ~35 minutes)",
+			  args[cur_arg+1], args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (ptr == PARSE_TIME_UNDER) {
+		memprintf(err, "timer underflow in argument '%s' to '%s' (minimum non-null value is 1 us)",
+			  args[cur_arg+1], args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (ptr) {
+		memprintf(err, "'%s' : expects a positive delay in microseconds", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	list_for_each_entry(l, &conf->listeners, by_bind) {
+		if (l->addr.ss_family == AF_INET || l->addr.ss_family == AF_INET6)
+			l->busy_poll = timeout;
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef TCP_NOTSENT_LOWAT
+/* parses the size in <arg> for the "tcp-notsent-lowat" keyword <kw> into
+ * <size>. Returns 0 on success, otherwise an error code with <err> filled.
+ */
+static int tcp_parse_notsent_lowat(const char *kw, const char *arg, int *size, char **err)
+{
+	const char *res;
+	unsigned int val;
+
+	if (!*arg) {
+		memprintf(err, "'%s' : missing size", kw);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	res = parse_size_err(arg, &val);
+	if (res || (int)val < 0) {
+		memprintf(err, "'%s' : expects a positive size in bytes (got '%s')", kw, arg);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	*size = val;
+	return 0;
+}
+
+/* parse the "tcp-notsent-lowat" bind keyword */
+static int bind_parse_notsent_lowat(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	struct listener *l;
+	int size, ret;
+
+	ret = tcp_parse_notsent_lowat(args[cur_arg], args[cur_arg + 1], &size, err);
+	if (ret)
+		return ret;
+
+	list_for_each_entry(l, &conf->listeners, by_bind) {
+		if (l->addr.ss_family == AF_INET || l->addr.ss_family == AF_INET6)
+			l->notsent_lowat = size;
+	}
+	return 0;
+}
+#endif
+
 #ifdef SO_BINDTODEVICE
 /* parse the "interface" bind keyword */
 static int bind_parse_interface(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
@@ -1862,6 +1965,22 @@ static int bind_parse_namespace(char **args, int cur_arg, struct proxy *px, stru
 }
 #endif
 
+#ifdef TCP_NOTSENT_LOWAT
+/* parse the "tcp-notsent-lowat" server keyword */
+static int srv_parse_notsent_lowat(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
+{
+	int size, ret;
+
+	ret = tcp_parse_notsent_lowat(args[*cur_arg], args[*cur_arg + 1], &size, err);
+	if (ret)
+		return ret;
+
+	if (newsrv->addr.ss_family == AF_INET || newsrv->addr.ss_family == AF_INET6)
+		newsrv->notsent_lowat = size;
+	return 0;
+}
+#endif
+
 #ifdef TCP_USER_TIMEOUT
 /* parse the "tcp-ut" server keyword */
 static int srv_parse_tcp_ut(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
@@ -1904,10 +2023,10 @@ static int srv_parse_tcp_ut(char **args, int *cur_arg, struct proxy *px, struct
  * instance v4/v6 must be declared v4.
  */
 static struct sample_fetch_kw_list sample_fetch_keywords = {ILH, {
-	{ "dst",      smp_fetch_dst,   0, NULL, SMP_T_IPV4, SMP_USE_L4CLI },
+	{ "dst",      smp_fetch_dst,   0, NULL, SMP_T_IPV4, SMP_USE_L4CLI, .flags = SMP_FETCH_F_PURE },
 	{ "dst_is_local", smp_fetch_dst_is_local, 0, NULL, SMP_T_BOOL, SMP_USE_L4CLI },
 	{ "dst_port", smp_fetch_dport, 0, NULL, SMP_T_SINT, SMP_USE_L4CLI },
-	{ "src",      smp_fetch_src,   0, NULL, SMP_T_IPV4, SMP_USE_L4CLI },
+	{ "src",      smp_fetch_src,   0, NULL, SMP_T_IPV4, SMP_USE_L4CLI, .flags = SMP_FETCH_F_PURE },
 	{ "src_is_local", smp_fetch_src_is_local, 0, NULL, SMP_T_BOOL, SMP_USE_L4CLI },
 	{ "src_port", smp_fetch_sport, 0, NULL, SMP_T_SINT, SMP_USE_L4CLI },
 #ifdef TCP_INFO
@@ -1939,6 +2058,9 @@ INITCALL1(STG_REGISTER, sample_register_fetches, &sample_fetch_keywords);
  * not enabled.
  */
 static struct bind_kw_list bind_kws = { "TCP", { }, {
+#ifdef SO_BUSY_POLL
+	{ "busy-poll",     bind_parse_busy_poll,    1 }, /* set SO_BUSY_POLL on listening socket */
+#endif
 #ifdef TCP_DEFER_ACCEPT
 	{ "defer-accept",  bind_parse_defer_accept, 0 }, /* wait for some data for 1 second max before doing accept */
 #endif
@@ -1948,6 +2070,9 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 #ifdef TCP_MAXSEG
 	{ "mss",           bind_parse_mss,          1 }, /* set MSS of listening socket */
 #endif
+#ifdef TCP_NOTSENT_LOWAT
+	{ "tcp-notsent-lowat", bind_parse_notsent_lowat, 1 }, /* set TCP_NOTSENT_LOWAT on listening socket */
+#endif
 #ifdef TCP_USER_TIMEOUT
 	{ "tcp-ut",        bind_parse_tcp_ut,       1 }, /* set User Timeout on listening socket */
 #endif
@@ -1977,6 +2102,9 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 INITCALL1(STG_REGISTER, bind_register_keywords, &bind_kws);
 
 static struct srv_kw_list srv_kws = { "TCP", { }, {
+#ifdef TCP_NOTSENT_LOWAT
+	{ "tcp-notsent-lowat", srv_parse_notsent_lowat, 1, 1 }, /* set TCP_NOTSENT_LOWAT on server connections */
+#endif
 #ifdef TCP_USER_TIMEOUT
 	{ "tcp-ut",        srv_parse_tcp_ut,        1,  1 }, /* set TCP user timeout on server */
 #endif
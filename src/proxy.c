@@ -46,6 +46,7 @@
 #include <proto/proto_tcp.h>
 #include <proto/http_ana.h>
 #include <proto/proxy.h>
+#include <proto/sample.h>
 #include <proto/server.h>
 #include <proto/signal.h>
 #include <proto/stream.h>
@@ -412,6 +413,76 @@ static int proxy_parse_max_ka_queue(char **args, int section, struct proxy *prox
 	return retval;
 }
 
+/* This function parses a "log-sample" statement in a proxy section. It returns
+ * -1 if there is any error, 1 for warning, otherwise 0. If it does not return
+ * zero, it will write an error or warning message into a preallocated buffer
+ * returned at <err>.
+ */
+static int proxy_parse_log_sample(char **args, int section, struct proxy *curpx,
+                                  struct proxy *defpx, const char *file, int line,
+                                  char **err)
+{
+	struct sample_expr *expr = NULL;
+	int retval = 0;
+	int cur_arg;
+	unsigned int val;
+	char *res;
+
+	if (*args[1] == 0) {
+		memprintf(err, "'%s' expects the number of streams out of which one is logged", args[0]);
+		return -1;
+	}
+
+	val = strtoul(args[1], &res, 10);
+	if (*res || !val) {
+		memprintf(err, "'%s' : invalid value '%s', expects a strictly positive integer", args[0], args[1]);
+		return -1;
+	}
+
+	if (*args[2]) {
+		if (strcmp(args[2], "key") != 0 || !*args[3]) {
+			memprintf(err, "'%s' only supports 'key <expression>' after the ratio (got '%s')", args[0], args[2]);
+			return -1;
+		}
+
+		if (curpx == defpx) {
+			memprintf(err, "'%s %s' is not supported in a defaults section", args[0], args[2]);
+			return -1;
+		}
+
+		cur_arg = 3;
+		curpx->conf.args.ctx = ARGC_LOG;
+		expr = sample_parse_expr(args, &cur_arg, file, line, err, &curpx->conf.args, NULL);
+		if (!expr)
+			return -1;
+
+		if (!(expr->fetch->val & SMP_VAL_FE_LOG_END)) {
+			memprintf(err, "'%s' : fetch method '%s' extracts information from '%s', none of which is available at log time",
+			          args[0], expr->fetch->kw, sample_src_names(expr->fetch->use));
+			release_sample_expr(expr);
+			return -1;
+		}
+
+		if (*args[cur_arg]) {
+			memprintf(err, "'%s' : unexpected argument '%s' after the key", args[0], args[cur_arg]);
+			release_sample_expr(expr);
+			return -1;
+		}
+	}
+
+	if (curpx != defpx && !(curpx->cap & PR_CAP_FE)) {
+		memprintf(err, "%s will be ignored because %s '%s' has no frontend capability",
+		          args[0], proxy_type_str(curpx), curpx->id);
+		retval = 1;
+	}
+
+	/* a ratio of one is the same as no sampling */
+	curpx->log_sample = val > 1 ? val : 0;
+	release_sample_expr(curpx->log_sample_key);
+	curpx->log_sample_key = expr;
+	return retval;
+}
+
 /* This function parses a "declare" statement in a proxy section. It returns -1
  * if there is any error, 1 for warning, otherwise 0. If it does not return zero,
  * it will write an error or warning message into a preallocated buffer returned
@@ -782,10 +853,27 @@ struct proxy *proxy_find_best_match(int cap, const char *name, int id, int *diff
 struct server *findserver(const struct proxy *px, const char *name) {
 
 	struct server *cursrv, *target = NULL;
+	struct ebpt_node *node;
 
 	if (!px)
 		return NULL;
 
+	/* the servers are indexed by name once the configuration is checked */
+	if (!eb_is_empty(&px->conf.used_server_name)) {
+		node = ebis_lookup(&((struct proxy *)px)->conf.used_server_name, name);
+		if (!node)
+			return NULL;
+
+		target = container_of(node, struct server, conf.name);
+		node = ebpt_next(node);
+		if (node && strcmp(node->key, name) == 0) {
+			ha_alert("Refusing to use duplicated server '%s' found in proxy: %s!\n",
+				 name, px->id);
+			return NULL;
+		}
+		return target;
+	}
+
 	for (cursrv = px->srv; cursrv; cursrv = cursrv->next) {
 		if (strcmp(cursrv->id, name))
 			continue;
@@ -891,6 +979,7 @@ void init_new_proxy(struct proxy *p)
 	p->retry_type = PR_RE_CONN_FAILED;
 
 	HA_SPIN_INIT(&p->lock);
+	HA_SPIN_INIT(&p->queue_lock);
 }
 
 /*
@@ -1024,7 +1113,7 @@ struct task *manage_proxy(struct task *t, void *context, unsigned short state)
 		p->state = PR_STREADY;
 
 	if (p->fe_sps_lim &&
-	    (wait = next_event_delay(&p->fe_sess_per_sec, p->fe_sps_lim, 0))) {
+	    (wait = next_event_delay_thr(&p->fe_sess_per_sec, p->fe_sps_lim, 0))) {
 		/* we're blocking because a limit was reached on the number of
 		 * requests/s on the frontend. We want to re-check ASAP, which
 		 * means in 1 ms before estimated expiration date, because the
@@ -1670,6 +1759,54 @@ void proxy_adjust_all_maxconn()
 	}
 }
 
+/* Allocates the per-thread slots of the rate counters updated for each
+ * connection and session accepted by frontend <px>. The backends do not need
+ * them.
+ */
+static int proxy_alloc_freq_ctrs(struct proxy *px)
+{
+	if (!(px->cap & PR_CAP_FE))
+		return ERR_NONE;
+
+	if (freq_ctr_thr_alloc(&px->fe_conn_per_sec) < 0 ||
+	    freq_ctr_thr_alloc(&px->fe_sess_per_sec) < 0) {
+		ha_alert("Proxy '%s': out of memory while allocating the per-thread rate counters.\n", px->id);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_PROXY_CHECK(proxy_alloc_freq_ctrs);
+
+/* Allocates the per-thread shares of the counters of the sides of proxy <px>
+ * which are in use. This is pointless with a single thread, as well as for
+ * the disabled proxies.
+ */
+static int proxy_alloc_thr_counters(struct proxy *px)
+{
+	if (global.nbthread <= 1 || px->state == PR_STSTOPPED)
+		return ERR_NONE;
+
+	if (px->cap & PR_CAP_FE) {
+		px->fe_counters.thr = calloc(global.nbthread, sizeof(*px->fe_counters.thr));
+		if (!px->fe_counters.thr)
+			goto out_of_memory;
+	}
+
+	if (px->cap & PR_CAP_BE) {
+		px->be_counters.thr = calloc(global.nbthread, sizeof(*px->be_counters.thr));
+		if (!px->be_counters.thr)
+			goto out_of_memory;
+	}
+	return ERR_NONE;
+
+ out_of_memory:
+	ha_alert("Proxy '%s': out of memory while allocating the per-thread counters.\n", px->id);
+	return ERR_ALERT | ERR_FATAL;
+}
+
+REGISTER_POST_PROXY_CHECK(proxy_alloc_thr_counters);
+
 /* Config keywords below */
 
 static struct cfg_kw_list cfg_kws = {ILH, {
@@ -1680,6 +1817,7 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 	{ CFG_LISTEN, "srvtimeout", proxy_parse_timeout }, /* This keyword actually fails to parse, this line remains for better error messages. */
 	{ CFG_LISTEN, "rate-limit", proxy_parse_rate_limit },
 	{ CFG_LISTEN, "max-keep-alive-queue", proxy_parse_max_ka_queue },
+	{ CFG_LISTEN, "log-sample", proxy_parse_log_sample },
 	{ CFG_LISTEN, "declare", proxy_parse_declare },
 	{ CFG_LISTEN, "retry-on", proxy_parse_retry_on },
 	{ 0, NULL, NULL },
@@ -0,0 +1,539 @@
+/*
+ * QPACK decompressor (draft-ietf-quic-qpack)
+ *
+ * Copyright 2020 HAProxy Technologies, Frédéric Lécaille <flecaille@haproxy.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/standard.h>
+#include <common/buf.h>
+#include <common/chunk.h>
+#include <common/h3.h>
+#include <common/hpack-huff.h>
+#include <common/hpack-tbl.h>
+#include <common/ist.h>
+#include <common/qpack-dec.h>
+#include <common/qpack-tbl.h>
+
+
+#if defined(DEBUG_QPACK)
+#define qpack_debug_printf printf
+#else
+#define qpack_debug_printf(...) do { } while (0)
+#endif
+
+/* reads a varint from <raw>'s lowest <b> bits and <len> bytes max (raw included).
+ * returns the 64-bit value on success after updating raw_in and len_in. Forces
+ * len_in to (uint64_t)-1 on truncated input or on a value which does not fit
+ * into 62 bits, which is the largest value QPACK may have to transport.
+ */
+static uint64_t qpack_get_varint(const uint8_t **raw_in, uint64_t *len_in, int b)
+{
+	uint64_t ret = 0;
+	uint64_t len = *len_in;
+	const uint8_t *raw = *raw_in;
+	uint8_t shift = 0;
+
+	if (!len)
+		goto too_short;
+
+	len--;
+	ret = *(raw++) & ((1 << b) - 1);
+	if (ret != (uint64_t)((1 << b) - 1))
+		goto end;
+
+	while (len && (*raw & 128)) {
+		ret += ((uint64_t)(*raw++) & 127) << shift;
+		shift += 7;
+		len--;
+		if (shift > 56)
+			goto too_short;
+	}
+
+	/* last 7 bits */
+	if (!len)
+		goto too_short;
+	len--;
+	ret += ((uint64_t)(*raw++) & 127) << shift;
+
+ end:
+	*raw_in = raw;
+	*len_in = len;
+	return ret;
+
+ too_short:
+	*len_in = (uint64_t)-1;
+	return 0;
+}
+
+/* returns the H3_PHDR_IDX_* pseudo-header the static table entry <idx>
+ * corresponds to, or 0 if this is a regular header.
+ */
+static inline int qpack_idx_to_phdr(uint64_t idx)
+{
+	if (idx == 0)
+		return H3_PHDR_IDX_AUTH;
+	if (idx == 1)
+		return H3_PHDR_IDX_PATH;
+	if (idx >= 15 && idx <= 21)
+		return H3_PHDR_IDX_METH;
+	if (idx == 22 || idx == 23)
+		return H3_PHDR_IDX_SCHM;
+	if ((idx >= 24 && idx <= 28) || (idx >= 63 && idx <= 71))
+		return H3_PHDR_IDX_STAT;
+	return 0;
+}
+
+/* Allocates some room from chunk <store> to duplicate <in> into it and returns
+ * the string allocated there. This is used for strings which belong to the
+ * dynamic table since its entries may move or be evicted. In case of
+ * allocation failure, returns a string whose pointer is NULL.
+ */
+static inline struct ist qpack_alloc_string(struct buffer *store, struct ist in)
+{
+	struct ist out;
+
+	out.len = in.len;
+	out.ptr = chunk_newstr(store);
+	if (unlikely(!out.ptr))
+		return out;
+
+	if (unlikely(store->data + out.len > store->size)) {
+		out.ptr = NULL;
+		return out;
+	}
+
+	store->data += out.len;
+	memcpy(out.ptr, in.ptr, out.len);
+	return out;
+}
+
+/* Reads a string literal whose length is encoded with a <b>-bit prefix, the
+ * huffman flag being the bit just above this prefix, from <raw> for <len>
+ * bytes. Huffman-encoded strings are decoded into <tmp>, the other ones
+ * point to <raw>. <raw> and <len> are updated. Returns 0 if succeeded or the
+ * opposite of one of the QPACK_ERR_* codes if not.
+ */
+static int qpack_get_str(const uint8_t **raw, uint64_t *len, int b,
+                         struct buffer *tmp, struct ist *out)
+{
+	uint64_t slen;
+	int huff;
+
+	if (!*len)
+		return -QPACK_ERR_TRUNCATED;
+
+	huff = **raw & (1 << b);
+	slen = qpack_get_varint(raw, len, b);
+	if (*len == (uint64_t)-1 || *len < slen)
+		return -QPACK_ERR_TRUNCATED;
+
+	*out = ist2((const char *)*raw, slen);
+	*raw += slen;
+	*len -= slen;
+
+	if (huff) {
+		char *trash = chunk_newstr(tmp);
+		int dlen;
+
+		if (!trash)
+			return -QPACK_ERR_TOO_LARGE;
+
+		dlen = huff_dec((const uint8_t *)out->ptr, out->len, trash,
+		                tmp->size - tmp->data);
+		if (dlen < 0)
+			return -QPACK_ERR_HUFFMAN;
+
+		tmp->data += dlen;
+		*out = ist2(trash, dlen);
+	}
+
+	return 0;
+}
+
+/* Decodes the instructions received on the encoder stream of <dec> from <raw>
+ * for <len> bytes, using <tmp> as temporary storage. Only complete
+ * instructions are consumed, so that the caller may call this function again
+ * once it has received the remaining part of a truncated one. Returns the
+ * number of bytes consumed, or the opposite one of the QPACK_ERR_* codes on
+ * failure, which is a connection error (QPACK_ENCODER_STREAM_ERROR).
+ */
+int qpack_decode_enc(struct qpack_dec *dec, const uint8_t *raw, uint64_t len,
+                     struct buffer *tmp)
+{
+	const uint8_t *start = raw;
+	const uint8_t *inst;
+	const struct hpack_dte *dte;
+	struct ist name, value;
+	uint64_t idx;
+	int ret;
+
+	while (len) {
+		inst = raw;
+		chunk_reset(tmp);
+
+		if (*raw & 0x80) {
+			/* 1Txxxxxx: insert with name reference */
+			int stat = *raw & 0x40;
+
+			idx = qpack_get_varint(&raw, &len, 6);
+			if (len == (uint64_t)-1)
+				goto truncated;
+
+			if (stat) {
+				if (idx >= QPACK_SHT_SIZE)
+					return -QPACK_ERR_INVALID_IDX;
+				name = qpack_sht[idx].n;
+			}
+			else {
+				/* relative index, 0 being the newest entry */
+				if (idx >= dec->ins_cnt)
+					return -QPACK_ERR_INVALID_IDX;
+				dte = qpack_get_dte(dec, dec->ins_cnt - 1 - idx);
+				if (!dte)
+					return -QPACK_ERR_INVALID_IDX;
+				name = qpack_alloc_string(tmp, hpack_get_name(dec->dht, dte));
+				if (!isttest(name))
+					return -QPACK_ERR_TOO_LARGE;
+			}
+
+			ret = qpack_get_str(&raw, &len, 7, tmp, &value);
+		}
+		else if (*raw & 0x40) {
+			/* 01Hxxxxx: insert with literal name */
+			ret = qpack_get_str(&raw, &len, 5, tmp, &name);
+			if (!ret)
+				ret = qpack_get_str(&raw, &len, 7, tmp, &value);
+		}
+		else if (*raw & 0x20) {
+			/* 001xxxxx: set dynamic table capacity */
+			idx = qpack_get_varint(&raw, &len, 5);
+			if (len == (uint64_t)-1)
+				goto truncated;
+
+			if (idx > dec->max_cap)
+				return -QPACK_ERR_INVALID_CAPACITY;
+
+			dec->cap = idx;
+			continue;
+		}
+		else {
+			/* 000xxxxx: duplicate */
+			idx = qpack_get_varint(&raw, &len, 5);
+			if (len == (uint64_t)-1)
+				goto truncated;
+
+			if (idx >= dec->ins_cnt)
+				return -QPACK_ERR_INVALID_IDX;
+			dte = qpack_get_dte(dec, dec->ins_cnt - 1 - idx);
+			if (!dte)
+				return -QPACK_ERR_INVALID_IDX;
+
+			name = qpack_alloc_string(tmp, hpack_get_name(dec->dht, dte));
+			value = qpack_alloc_string(tmp, hpack_get_value(dec->dht, dte));
+			if (!isttest(name) || !isttest(value))
+				return -QPACK_ERR_TOO_LARGE;
+			ret = 0;
+		}
+
+		if (ret == -QPACK_ERR_TRUNCATED)
+			goto truncated;
+		if (ret < 0)
+			return ret;
+
+		qpack_debug_printf("[QPACK-DEC] insert #%llu <%.*s: %.*s>\n",
+		                   (unsigned long long)dec->ins_cnt,
+		                   (int)name.len, name.ptr, (int)value.len, value.ptr);
+
+		ret = qpack_dht_insert(dec, name, value);
+		if (ret < 0)
+			return ret;
+	}
+
+	return raw - start;
+
+ truncated:
+	/* wait for the end of this instruction */
+	return inst - start;
+}
+
+/* Decodes the Required Insert Count of a field section encoded as <enc_ric>
+ * for <dec> (see 4.5.1.1). Returns 0 if succeeded with the result in <ric>,
+ * or the opposite one of the QPACK_ERR_* codes if not.
+ */
+static int qpack_decode_ric(const struct qpack_dec *dec, uint64_t enc_ric, uint64_t *ric)
+{
+	uint64_t max_entries, full_range, max_value, max_wrapped;
+
+	*ric = 0;
+	if (!enc_ric)
+		return 0;
+
+	max_entries = dec->max_cap / 32;
+	full_range = 2 * max_entries;
+	if (enc_ric > full_range)
+		return -QPACK_ERR_INVALID_RIC;
+
+	max_value = dec->ins_cnt + max_entries;
+	max_wrapped = (max_value / full_range) * full_range;
+	*ric = max_wrapped + enc_ric - 1;
+
+	if (*ric > max_value) {
+		if (*ric <= full_range)
+			return -QPACK_ERR_INVALID_RIC;
+		*ric -= full_range;
+	}
+
+	if (!*ric)
+		return -QPACK_ERR_INVALID_RIC;
+
+	return 0;
+}
+
+/* Returns the dynamic table entry of <dec> with <idx> as absolute index if it
+ * may be referenced by a field section whose Required Insert Count is <ric>,
+ * or NULL if not.
+ */
+static inline const struct hpack_dte *qpack_fs_get_dte(const struct qpack_dec *dec,
+                                                       uint64_t idx, uint64_t ric)
+{
+	if (idx >= ric)
+		return NULL;
+	return qpack_get_dte(dec, idx);
+}
+
+/* decode a QPACK encoded field section starting at <raw> for <len> bytes,
+ * using the decoder state <dec>, produces the output into list <list> of
+ * <list_size> entries max, and uses pre-allocated buffer <tmp> for temporary
+ * storage (some list elements will point to it). Some <list> name entries may
+ * be made of a NULL pointer and a len, in which case they will designate a
+ * pseudo header index among H3_PHDR_IDX_*, as expected by
+ * h3_make_htx_request(). The Required Insert Count of the section is stored
+ * into <ric>, the caller having to acknowledge the section on the decoder
+ * stream if it is not null. The number of <list> entries used is returned on
+ * success, or <0 on failure, with the opposite one of the QPACK_ERR_* codes.
+ * -QPACK_ERR_BLOCKED is returned if the section references entries which were
+ * not received yet on the encoder stream, in which case the caller must block
+ * the stream (see qpack_dec_block()) and try again later. A last element is
+ * always zeroed and is not counted in the number of returned entries. This
+ * way the caller can use list[].n.len == 0 as a marker for the end of list.
+ */
+int qpack_decode_fs(struct qpack_dec *dec, const uint8_t *raw, uint64_t len,
+                    struct http_hdr *list, int list_size,
+                    struct buffer *tmp, uint64_t *ric)
+{
+	const struct hpack_dte *dte;
+	struct ist name, value;
+	uint64_t enc_ric, delta, base, idx;
+	int sign;
+	int ret;
+
+	chunk_reset(tmp);
+
+	/* field section prefix */
+	enc_ric = qpack_get_varint(&raw, &len, 8);
+	if (len == (uint64_t)-1 || !len)
+		return -QPACK_ERR_TRUNCATED;
+
+	ret = qpack_decode_ric(dec, enc_ric, ric);
+	if (ret < 0)
+		return ret;
+
+	sign = *raw & 0x80;
+	delta = qpack_get_varint(&raw, &len, 7);
+	if (len == (uint64_t)-1)
+		return -QPACK_ERR_TRUNCATED;
+
+	if (sign) {
+		if (delta >= *ric)
+			return -QPACK_ERR_INVALID_RIC;
+		base = *ric - delta - 1;
+	}
+	else
+		base = *ric + delta;
+
+	if (*ric > dec->ins_cnt)
+		return -QPACK_ERR_BLOCKED;
+
+	ret = 0;
+	while (len) {
+		if (*raw & 0x80) {
+			/* 1Txxxxxx: indexed field line */
+			int stat = *raw & 0x40;
+
+			idx = qpack_get_varint(&raw, &len, 6);
+			if (len == (uint64_t)-1)
+				return -QPACK_ERR_TRUNCATED;
+
+			if (stat) {
+				if (idx >= QPACK_SHT_SIZE)
+					return -QPACK_ERR_INVALID_IDX;
+				name = ist2(NULL, qpack_idx_to_phdr(idx));
+				if (!name.len)
+					name = qpack_sht[idx].n;
+				value = qpack_sht[idx].v;
+				goto store;
+			}
+
+			if (idx >= base)
+				return -QPACK_ERR_INVALID_IDX;
+			idx = base - 1 - idx;
+			goto dyn_entry;
+		}
+		else if ((*raw & 0xf0) == 0x10) {
+			/* 0001xxxx: indexed field line with post-base index */
+			idx = qpack_get_varint(&raw, &len, 4);
+			if (len == (uint64_t)-1)
+				return -QPACK_ERR_TRUNCATED;
+			idx += base;
+
+		dyn_entry:
+			dte = qpack_fs_get_dte(dec, idx, *ric);
+			if (!dte)
+				return -QPACK_ERR_INVALID_IDX;
+
+			name = qpack_alloc_string(tmp, hpack_get_name(dec->dht, dte));
+			value = qpack_alloc_string(tmp, hpack_get_value(dec->dht, dte));
+			if (!isttest(name) || !isttest(value))
+				return -QPACK_ERR_TOO_LARGE;
+			goto store;
+		}
+		else if (*raw & 0x40) {
+			/* 01NTxxxx: literal field line with name reference */
+			int stat = *raw & 0x10;
+
+			idx = qpack_get_varint(&raw, &len, 4);
+			if (len == (uint64_t)-1)
+				return -QPACK_ERR_TRUNCATED;
+
+			if (stat) {
+				if (idx >= QPACK_SHT_SIZE)
+					return -QPACK_ERR_INVALID_IDX;
+				name = ist2(NULL, qpack_idx_to_phdr(idx));
+				if (!name.len)
+					name = qpack_sht[idx].n;
+				goto literal_value;
+			}
+
+			if (idx >= base)
+				return -QPACK_ERR_INVALID_IDX;
+			idx = base - 1 - idx;
+			goto dyn_name;
+		}
+		else if (!(*raw & 0x20)) {
+			/* 0000Nxxx: literal field line with post-base name reference */
+			idx = qpack_get_varint(&raw, &len, 3);
+			if (len == (uint64_t)-1)
+				return -QPACK_ERR_TRUNCATED;
+			idx += base;
+
+		dyn_name:
+			dte = qpack_fs_get_dte(dec, idx, *ric);
+			if (!dte)
+				return -QPACK_ERR_INVALID_IDX;
+
+			name = qpack_alloc_string(tmp, hpack_get_name(dec->dht, dte));
+			if (!isttest(name))
+				return -QPACK_ERR_TOO_LARGE;
+		}
+		else {
+			/* 001NHxxx: literal field line with literal name */
+			int err = qpack_get_str(&raw, &len, 3, tmp, &name);
+
+			if (err < 0)
+				return err;
+		}
+
+	literal_value:
+		{
+			int err = qpack_get_str(&raw, &len, 7, tmp, &value);
+
+			if (err < 0)
+				return err;
+		}
+
+	store:
+		/* here <name> and <value> are set and point to stable values */
+		if (ret >= list_size)
+			return -QPACK_ERR_TOO_LARGE;
+
+		qpack_debug_printf("[QPACK-DEC] <%.*s: %.*s>\n",
+		                   (int)name.len, name.ptr ? name.ptr : "(phdr)",
+		                   (int)value.len, value.ptr);
+
+		list[ret].n = name;
+		list[ret].v = value;
+		ret++;
+	}
+
+	if (ret >= list_size)
+		return -QPACK_ERR_TOO_LARGE;
+
+	/* put an end marker */
+	list[ret].n = list[ret].v = ist2(NULL, 0);
+	return ret;
+}
+
+/* Appends to <out> a Section Acknowledgment decoder instruction for the field
+ * section with <ric> as Required Insert Count received on stream <id>,
+ * updating the insert count known by the encoder of <dec>. Returns 1 if
+ * succeeded, 0 if there was not enough room in <out>.
+ */
+int qpack_enc_section_ack(struct buffer *out, struct qpack_dec *dec,
+                          uint64_t id, uint64_t ric)
+{
+	if (!qpack_put_varint(out, 0x80, 7, id))
+		return 0;
+
+	if (ric > dec->known_rcvd)
+		dec->known_rcvd = ric;
+	return 1;
+}
+
+/* Appends to <out> a Stream Cancellation decoder instruction for stream <id>.
+ * Returns 1 if succeeded, 0 if there was not enough room in <out>.
+ */
+int qpack_enc_stream_cancel(struct buffer *out, uint64_t id)
+{
+	return qpack_put_varint(out, 0x40, 6, id);
+}
+
+/* Appends to <out> an Insert Count Increment decoder instruction for the
+ * insertions of <dec> not known by the encoder yet, if any. Returns 1 if
+ * succeeded, 0 if there was not enough room in <out>.
+ */
+int qpack_enc_insert_count_inc(struct buffer *out, struct qpack_dec *dec)
+{
+	if (dec->ins_cnt == dec->known_rcvd)
+		return 1;
+
+	if (!qpack_put_varint(out, 0x00, 6, dec->ins_cnt - dec->known_rcvd))
+		return 0;
+
+	dec->known_rcvd = dec->ins_cnt;
+	return 1;
+}
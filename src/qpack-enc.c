@@ -0,0 +1,158 @@
+/*
+ * QPACK compressor (draft-ietf-quic-qpack)
+ *
+ * Copyright 2020 HAProxy Technologies, Frédéric Lécaille <flecaille@haproxy.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/buf.h>
+#include <common/ist.h>
+#include <common/qpack-enc.h>
+#include <common/qpack-tbl.h>
+
+/* Our encoder only relies on the static table and never inserts anything into
+ * the peer's dynamic table. This way the Required Insert Count of all our
+ * field sections is zero, our encoder stream stays empty and we never block
+ * any of the peer's streams, whatever its SETTINGS_QPACK_BLOCKED_STREAMS.
+ */
+
+/* Looks up the static table for <n>:<v>. Returns the index of the entry
+ * matching both the name and the value if any, with <exact> set to 1, or the
+ * index of the first entry matching the name with <exact> set to 0, or -1 if
+ * no entry matches the name.
+ */
+static int qpack_sht_lookup(const struct ist n, const struct ist v, int *exact)
+{
+	int idx, name_idx = -1;
+
+	for (idx = 0; idx < QPACK_SHT_SIZE; idx++) {
+		if (!isteq(qpack_sht[idx].n, n))
+			continue;
+
+		if (isteq(qpack_sht[idx].v, v)) {
+			*exact = 1;
+			return idx;
+		}
+
+		if (name_idx < 0)
+			name_idx = idx;
+	}
+
+	*exact = 0;
+	return name_idx;
+}
+
+/* Appends the string <str> to <out> as a non huffman-encoded string literal
+ * whose length is encoded with a <b>-bit prefix, <flags> being the bits of
+ * the first byte above this prefix, the huffman flag excluded. Returns 1 if
+ * succeeded, 0 if there was not enough room.
+ */
+static int qpack_encode_str(struct buffer *out, uint8_t flags, int b, const struct ist str)
+{
+	if (!qpack_put_varint(out, flags, b, str.len))
+		return 0;
+
+	if (b_room(out) < str.len)
+		return 0;
+
+	b_putblk(out, str.ptr, str.len);
+	return 1;
+}
+
+/* Appends to <out> the prefix of a field section which does not reference
+ * the dynamic table: a zero Required Insert Count and a zero Base. Returns 1
+ * if succeeded, 0 if there was not enough room.
+ */
+int qpack_encode_prefix(struct buffer *out)
+{
+	if (b_room(out) < 2)
+		return 0;
+
+	b_putchr(out, 0);
+	b_putchr(out, 0);
+	return 1;
+}
+
+/* Appends the field line <n>:<v> to <out>. <n> is expected to be lower case.
+ * Returns 1 if succeeded, or 0 if there was not enough room, in which case
+ * <out> is left untouched.
+ */
+int qpack_encode_header(struct buffer *out, const struct ist n, const struct ist v)
+{
+	size_t data = b_data(out);
+	int exact, idx;
+
+	idx = qpack_sht_lookup(n, v, &exact);
+	if (idx >= 0 && exact) {
+		/* 11xxxxxx: indexed field line, static table */
+		if (!qpack_put_varint(out, 0xc0, 6, idx))
+			goto fail;
+		return 1;
+	}
+
+	if (idx >= 0) {
+		/* 0101xxxx: literal field line with static name reference,
+		 * N bit cleared.
+		 */
+		if (!qpack_put_varint(out, 0x50, 4, idx))
+			goto fail;
+	}
+	else {
+		/* 0010 0xxx: literal field line with literal name, N and H
+		 * bits cleared.
+		 */
+		if (!qpack_encode_str(out, 0x20, 3, n))
+			goto fail;
+	}
+
+	if (!qpack_encode_str(out, 0x00, 7, v))
+		goto fail;
+
+	return 1;
+
+ fail:
+	out->data = data;
+	return 0;
+}
+
+/* Appends the :status pseudo-header field line for <status> to <out>.
+ * Returns 1 if succeeded, or 0 if there was not enough room, in which case
+ * <out> is left untouched.
+ */
+int qpack_encode_int_status(struct buffer *out, unsigned int status)
+{
+	char str[4];
+
+	if (status < 100 || status > 999)
+		return 0;
+
+	str[0] = '0' + status / 100;
+	str[1] = '0' + status / 10 % 10;
+	str[2] = '0' + status % 10;
+	str[3] = 0;
+	return qpack_encode_header(out, ist(":status"), ist2(str, 3));
+}
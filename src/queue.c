@@ -38,8 +38,16 @@
  *   - the proxy's queue lock must be held at least when manipulating the
  *     proxy's queue, which is when adding a pendconn to the queue and when
  *     removing a pendconn from the queue. It protects the queue's integrity.
+ *     It is a dedicated lock (px->queue_lock) and not the proxy's lock, so
+ *     that queuing does not contend with the other users of the proxy.
  *
- *   - both locks are compatible and may be held at the same time.
+ *   - both locks are compatible and may be held at the same time, the
+ *     server's lock first.
+ *
+ *   - a single thread at a time dequeues for a given server. The threads
+ *     calling process_srv_queue() while another one is doing so only account
+ *     their call in srv->queue_calls and leave, and the dequeuing thread
+ *     performs one more pass for them before leaving.
  *
  *   - a pendconn_add() is only performed by the stream which will own the
  *     pendconn ; the pendconn is allocated at this moment and returned ; it is
@@ -76,6 +84,7 @@
 #include <common/hathreads.h>
 #include <eb32tree.h>
 
+#include <proto/freq_ctr.h>
 #include <proto/http_rules.h>
 #include <proto/http_ana.h>
 #include <proto/queue.h>
@@ -100,7 +109,7 @@ DECLARE_POOL(pool_head_pendconn, "pendconn", sizeof(struct pendconn));
  * expected that 0 < s->minconn <= s->maxconn when this is called. If the
  * server is currently warming up, the slowstart is also applied to the
  * resulting value, which can be lower than minconn in this case, but never
- * less than 1.
+ * less than 1. The adaptive limit, if enabled, caps the result.
  */
 unsigned int srv_dynamic_maxconn(const struct server *s)
 {
@@ -122,9 +131,74 @@ unsigned int srv_dynamic_maxconn(const struct server *s)
 		ratio = 100 * (now.tv_sec - s->last_change) / s->slowstart;
 		max = MAX(1, max * ratio / 100);
 	}
+
+	if (s->adapt_limit && s->adapt_limit < max)
+		max = s->adapt_limit;
 	return max;
 }
 
+/* Accounts the outcome of a stream to the adaptive concurrency limit of server
+ * <s> (see srv_observe_concurrency()). Every ADAPT_RTIME_SAMPLES responses, the
+ * average of their response times is compared to its baseline, the lowest
+ * average seen, which slowly follows the averages above it so that a server
+ * which became durably slower is not throttled forever. The limit is then
+ * moved towards "limit * baseline / average + log2(limit)" : it shrinks when
+ * the queueing on the server makes its response times grow, and keeps growing
+ * by a few connections while they remain close to the baseline. An overloaded
+ * server reduces the limit by 10% right away. The limit remains between the
+ * server's minconn if lower than its maxconn, or 1, and its maxconn, and the
+ * streams in excess wait in the queues.
+ */
+void __srv_observe_concurrency(struct server *s, int overloaded, int rtime)
+{
+	unsigned int limit, floor, target, sum, base, grad;
+
+	if (rtime >= 0)
+		swrate_add(&s->adapt_rtime, ADAPT_RTIME_SAMPLES, rtime);
+	else if (!overloaded)
+		return;
+
+	if (_HA_ATOMIC_ADD(&s->adapt_samples, 1) < ADAPT_RTIME_SAMPLES && !overloaded)
+		return;
+
+	HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+	if (s->adapt_samples < ADAPT_RTIME_SAMPLES && !overloaded) {
+		/* another thread already adjusted the limit */
+		HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+		return;
+	}
+
+	limit = s->adapt_limit;
+	if (overloaded)
+		limit -= MAX(limit / 10, 1);
+	else {
+		/* the sums keep a precision of 1/ADAPT_RTIME_SAMPLES ms */
+		s->adapt_samples = 0;
+		sum = MAX(s->adapt_rtime, 1);
+		base = s->adapt_base;
+		if (!base || sum < base)
+			base = sum;
+		else
+			base += (sum - base + 31) / 32;
+		s->adapt_base = base;
+
+		/* gradient between 0.5 and 1, in 1/1024 */
+		grad = (unsigned long long)base * 1024 / sum;
+		grad = MAX(grad, 512);
+		target = (unsigned long long)limit * grad / 1024 + my_flsl(limit);
+
+		/* smooth the changes, still moving by at least one connection */
+		if (target > limit)
+			limit = (limit * 3 + target + 3) / 4;
+		else
+			limit = (limit * 3 + target) / 4;
+	}
+
+	floor = s->minconn < s->maxconn ? MAX(s->minconn, 1) : 1;
+	s->adapt_limit = MAX(MIN(limit, s->maxconn), floor);
+	HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+}
+
 /* Remove the pendconn from the server/proxy queue. At this stage, the
  * connection is not really dequeued. It will be done during the
  * process_stream. It also decreases the pending count.
@@ -154,7 +228,7 @@ static inline void pendconn_queue_lock(struct pendconn *p)
 	if (p->srv)
 		HA_SPIN_LOCK(SERVER_LOCK, &p->srv->lock);
 	else
-		HA_SPIN_LOCK(PROXY_LOCK, &p->px->lock);
+		HA_SPIN_LOCK(QUEUE_LOCK, &p->px->queue_lock);
 }
 
 /* Unlocks the queue the pendconn element belongs to. This relies on both p->px
@@ -166,7 +240,7 @@ static inline void pendconn_queue_unlock(struct pendconn *p)
 	if (p->srv)
 		HA_SPIN_UNLOCK(SERVER_LOCK, &p->srv->lock);
 	else
-		HA_SPIN_UNLOCK(PROXY_LOCK, &p->px->lock);
+		HA_SPIN_UNLOCK(QUEUE_LOCK, &p->px->queue_lock);
 }
 
 /* Removes the pendconn from the server/proxy queue. At this stage, the
@@ -306,23 +380,37 @@ static int pendconn_process_next_strm(struct server *srv, struct proxy *px)
 }
 
 /* Manages a server's connection queue. This function will try to dequeue as
- * many pending streams as possible, and wake them up.
+ * many pending streams as possible, and wake them up. If another thread is
+ * already dequeuing for this server, it is left to do it on our behalf, so
+ * that the threads releasing connections do not wait in turn for the locks
+ * only to find the queue already processed.
  */
 void process_srv_queue(struct server *s)
 {
 	struct proxy  *p = s->proxy;
+	unsigned int calls;
 	int maxconn;
 
-	HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
-	HA_SPIN_LOCK(PROXY_LOCK,  &p->lock);
-	maxconn = srv_dynamic_maxconn(s);
-	while (s->served < maxconn) {
-		int ret = pendconn_process_next_strm(s, p);
-		if (!ret)
-			break;
-	}
-	HA_SPIN_UNLOCK(PROXY_LOCK,  &p->lock);
-	HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+	if (HA_ATOMIC_ADD(&s->queue_calls, 1) != 1)
+		return;
+
+	calls = s->queue_calls;
+	do {
+		HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+		HA_SPIN_LOCK(QUEUE_LOCK,  &p->queue_lock);
+		maxconn = srv_dynamic_maxconn(s);
+		while (s->served < maxconn) {
+			int ret = pendconn_process_next_strm(s, p);
+			if (!ret)
+				break;
+		}
+		HA_SPIN_UNLOCK(QUEUE_LOCK,  &p->queue_lock);
+		HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+
+		/* other calls arrived meanwhile if the counter changed, in
+		 * which case they are all served by another pass.
+		 */
+	} while (!HA_ATOMIC_CAS(&s->queue_calls, &calls, 0));
 }
 
 /* Adds the stream <strm> to the pending connection queue of server <strm>->srv
@@ -426,7 +514,7 @@ int pendconn_redistribute(struct server *s)
  * the server coming up. The server's weight is checked before being assigned
  * connections it may not be able to handle. The total number of transferred
  * connections is returned. It must be called with the server lock held, and
- * will take the proxy's lock.
+ * will take the proxy's queue lock.
  */
 int pendconn_grab_from_px(struct server *s)
 {
@@ -445,7 +533,7 @@ int pendconn_grab_from_px(struct server *s)
 	     ((s != s->proxy->lbprm.fbck) && !(s->proxy->options & PR_O_USE_ALL_BK))))
 		return 0;
 
-	HA_SPIN_LOCK(PROXY_LOCK, &s->proxy->lock);
+	HA_SPIN_LOCK(QUEUE_LOCK, &s->proxy->queue_lock);
 	maxconn = srv_dynamic_maxconn(s);
 	while ((p = pendconn_first(&s->proxy->pendconns))) {
 		if (s->maxconn && s->served + xferred >= maxconn)
@@ -457,7 +545,7 @@ int pendconn_grab_from_px(struct server *s)
 		task_wakeup(p->strm->task, TASK_WOKEN_RES);
 		xferred++;
 	}
-	HA_SPIN_UNLOCK(PROXY_LOCK, &s->proxy->lock);
+	HA_SPIN_UNLOCK(QUEUE_LOCK, &s->proxy->queue_lock);
 	return xferred;
 }
 
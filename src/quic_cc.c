@@ -20,14 +20,37 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <string.h>
+
 #include <common/buf.h>
 
 #include <types/quic_cc.h>
 #include <types/xprt_quic.h>
 
+#include <proto/quic_qlog.h>
+
 
 struct quic_cc_algo *default_quic_cc_algo = &quic_cc_algo_nr;
 
+/* The congestion control algorithms which may be selected by name. */
+static struct quic_cc_algo *quic_cc_algos[] = {
+	&quic_cc_algo_nr,
+	&quic_cc_algo_cubic,
+	&quic_cc_algo_bbr,
+};
+
+/* Return the congestion control algorithm named <name>, NULL if not found. */
+struct quic_cc_algo *quic_cc_algo_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof quic_cc_algos / sizeof *quic_cc_algos; i++)
+		if (strcmp(quic_cc_algos[i]->name, name) == 0)
+			return quic_cc_algos[i];
+
+	return NULL;
+}
+
 /*
  * Initialize <cc> congestion control with <algo> as algorithm depending on <ipv4>
  * a boolean which is true for an IPv4 path.
@@ -41,10 +64,24 @@ void quic_cc_init(struct quic_cc *cc,
 		(cc->algo->init(cc));
 }
 
-/* Send <ev> event to <cc> congestion controller. */
+/* Send <ev> event to <cc> congestion controller. The state changes are
+ * reported to qlog for the sampled connections.
+ */
 void quic_cc_event(struct quic_cc *cc, struct quic_cc_event *ev)
 {
+	const char *prev = NULL;
+
+	if (cc->qc && quic_qlog_enabled(cc->qc))
+		prev = cc->algo->state_name(cc);
+
 	cc->algo->event(cc, ev);
+
+	if (prev) {
+		const char *cur = cc->algo->state_name(cc);
+
+		if (strcmp(prev, cur) != 0)
+			quic_qlog_cc_state_updated(cc->qc, prev, cur);
+	}
 }
 
 void quic_cc_state_trace(struct buffer *buf, const struct quic_cc *cc)
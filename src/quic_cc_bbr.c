@@ -0,0 +1,375 @@
+/*
+ * BBR (v1) congestion control algorithm.
+ *
+ * This file contains definitions for QUIC congestion control.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <common/standard.h>
+#include <common/time.h>
+
+#include <types/xprt_quic.h>
+
+#include <proto/quic_cc.h>
+#include <proto/trace.h>
+#include <proto/xprt_quic.h>
+
+#define TRACE_SOURCE    &trace_quic
+
+/* The gains are expressed in BBR_UNIT units. */
+#define BBR_UNIT                      256
+/* 2/ln(2) to double the sending rate each round trip during startup. */
+#define BBR_HIGH_GAIN                 739
+/* Inverse of the high gain to drain the queue built during startup. */
+#define BBR_DRAIN_GAIN                 89
+#define BBR_CWND_GAIN     (2 * BBR_UNIT)
+/* Number of round trips of the bottleneck bandwidth max filter window. */
+#define BBR_BTLBW_FILTER_LEN           10
+/* Duration (ms) of the RTprop min filter window. */
+#define BBR_RTPROP_FILTER_LEN       10000
+/* Minimum duration (ms) of the ProbeRTT state. */
+#define BBR_PROBE_RTT_DURATION        200
+/* The bottleneck bandwidth must grow by 25% each round trip during startup. */
+#define BBR_FULL_BW_THRESH_NUM          5
+#define BBR_FULL_BW_THRESH_DEN          4
+#define BBR_FULL_BW_CNT                 3
+/* Minimum congestion window in segments. */
+#define BBR_MIN_PIPE_CWND               4
+
+/* ProbeBW state pacing gain cycle. */
+static const unsigned int bbr_pacing_gain[] = {
+	BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4,
+	BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT,
+};
+#define BBR_GAIN_CYCLE_LEN (sizeof bbr_pacing_gain / sizeof *bbr_pacing_gain)
+
+static const char *quic_cc_bbr_state_str(enum quic_cc_bbr_state state)
+{
+	switch (state) {
+	case QUIC_CC_BBR_ST_STARTUP:
+		return "startup";
+	case QUIC_CC_BBR_ST_DRAIN:
+		return "drain";
+	case QUIC_CC_BBR_ST_PROBE_BW:
+		return "probe_bw";
+	case QUIC_CC_BBR_ST_PROBE_RTT:
+		return "probe_rtt";
+	default:
+		return "unknown";
+	}
+}
+
+/* Reset <m> windowed max filter to <v> value at <t> time. */
+static inline uint64_t quic_cc_minmax_reset(struct quic_cc_minmax_sample *m,
+                                            uint32_t t, uint64_t v)
+{
+	m[0].t = m[1].t = m[2].t = t;
+	m[0].v = m[1].v = m[2].v = v;
+	return v;
+}
+
+/* Update <m> windowed max filter with <v> value at <t> time, <win> being
+ * the length of its window. The three best samples of the window are kept
+ * as described by Kathleen Nichols.
+ * Returns the maximum value of the window.
+ */
+static uint64_t quic_cc_minmax_running_max(struct quic_cc_minmax_sample *m,
+                                           uint32_t win, uint32_t t, uint64_t v)
+{
+	struct quic_cc_minmax_sample val = { .t = t, .v = v };
+	uint32_t dt;
+
+	if (v >= m[0].v || t - m[2].t > win)
+		return quic_cc_minmax_reset(m, t, v);
+
+	if (v >= m[1].v)
+		m[2] = m[1] = val;
+	else if (v >= m[2].v)
+		m[2] = val;
+
+	/* Make the samples age. */
+	dt = t - m[0].t;
+	if (dt > win) {
+		m[0] = m[1];
+		m[1] = m[2];
+		m[2] = val;
+		if (t - m[0].t > win) {
+			m[0] = m[1];
+			m[1] = m[2];
+			m[2] = val;
+		}
+	}
+	else if (m[1].t == m[0].t && dt > win / 4) {
+		m[2] = m[1] = val;
+	}
+	else if (m[2].t == m[1].t && dt > win / 2) {
+		m[2] = val;
+	}
+
+	return m[0].v;
+}
+
+/* Return the bottleneck bandwidth estimation of <b> (bytes/s). */
+static inline uint64_t quic_cc_bbr_btlbw(const struct bbr *b)
+{
+	return b->btlbw[0].v;
+}
+
+/* Return the bandwidth-delay product of <b> multiplied by <gain> in bytes,
+ * or 0 if there is no estimation yet.
+ */
+static inline uint64_t quic_cc_bbr_bdp(const struct bbr *b, unsigned int gain)
+{
+	if (b->min_rtt == ~0U)
+		return 0;
+
+	return quic_cc_bbr_btlbw(b) * b->min_rtt / 1000000 * gain / BBR_UNIT;
+}
+
+static int quic_cc_bbr_init(struct quic_cc *cc)
+{
+	struct quic_path *path;
+	struct bbr *b = &cc->algo_state.bbr;
+
+	path = container_of(cc, struct quic_path, cc);
+	memset(b, 0, sizeof *b);
+	b->state = QUIC_CC_BBR_ST_STARTUP;
+	b->cwnd = path->cwnd;
+	b->min_rtt = ~0U;
+	b->min_rtt_stamp = now_ms;
+	b->pacing_gain = BBR_HIGH_GAIN;
+	b->cwnd_gain = BBR_HIGH_GAIN;
+	/* The pacer derives its rate from the window until the first
+	 * delivery rate sample.
+	 */
+	path->pacer.cc_rate = 0;
+
+	return 1;
+}
+
+/* Enter the ProbeBW state, starting the gain cycle at a random phase but
+ * the draining one.
+ */
+static void quic_cc_bbr_enter_probe_bw(struct bbr *b)
+{
+	b->state = QUIC_CC_BBR_ST_PROBE_BW;
+	b->cwnd_gain = BBR_CWND_GAIN;
+	b->cycle_idx = ha_random32() % (BBR_GAIN_CYCLE_LEN - 1);
+	if (b->cycle_idx >= 1)
+		b->cycle_idx++;
+	b->pacing_gain = bbr_pacing_gain[b->cycle_idx];
+	b->cycle_stamp = now_ms;
+}
+
+/* Advance the ProbeBW gain cycle of <b> if needed. */
+static void quic_cc_bbr_update_gain_cycle(struct bbr *b, struct quic_path *path)
+{
+	int next;
+	uint32_t min_rtt_ms = b->min_rtt == ~0U ? 0 : b->min_rtt / 1000;
+
+	next = (int32_t)(now_ms - b->cycle_stamp) > (int32_t)min_rtt_ms;
+	/* Probing for more bandwidth until the pipe is filled. */
+	if (b->pacing_gain > BBR_UNIT)
+		next = next && path->in_flight >= quic_cc_bbr_bdp(b, b->pacing_gain);
+	/* Draining until the queue is empty. */
+	else if (b->pacing_gain < BBR_UNIT)
+		next = next || path->in_flight <= quic_cc_bbr_bdp(b, BBR_UNIT);
+
+	if (next) {
+		b->cycle_idx = (b->cycle_idx + 1) % BBR_GAIN_CYCLE_LEN;
+		b->pacing_gain = bbr_pacing_gain[b->cycle_idx];
+		b->cycle_stamp = now_ms;
+	}
+}
+
+/* Update the ProbeRTT state of <b>, entering or leaving it. */
+static void quic_cc_bbr_update_probe_rtt(struct bbr *b, struct quic_path *path,
+                                         int rtprop_expired)
+{
+	if (b->state != QUIC_CC_BBR_ST_PROBE_RTT) {
+		if (!rtprop_expired)
+			return;
+
+		b->state = QUIC_CC_BBR_ST_PROBE_RTT;
+		b->pacing_gain = b->cwnd_gain = BBR_UNIT;
+		b->prior_cwnd = b->cwnd;
+		b->probe_rtt_done_stamp = 0;
+		return;
+	}
+
+	if (!b->probe_rtt_done_stamp) {
+		if (path->in_flight <= BBR_MIN_PIPE_CWND * path->mtu) {
+			b->probe_rtt_done_stamp = (now_ms + BBR_PROBE_RTT_DURATION) ? : 1;
+			b->probe_rtt_round_done = 0;
+			b->next_round_delivered = path->delivered;
+		}
+		return;
+	}
+
+	if (b->round_start)
+		b->probe_rtt_round_done = 1;
+	if (b->probe_rtt_round_done &&
+	    (int32_t)(now_ms - b->probe_rtt_done_stamp) >= 0) {
+		b->min_rtt_stamp = now_ms;
+		b->cwnd = max(b->cwnd, b->prior_cwnd);
+		if (b->filled_pipe)
+			quic_cc_bbr_enter_probe_bw(b);
+		else {
+			b->state = QUIC_CC_BBR_ST_STARTUP;
+			b->pacing_gain = b->cwnd_gain = BBR_HIGH_GAIN;
+		}
+	}
+}
+
+/* Update the BBR model of <cc> upon <ev> ACK event. */
+static void quic_cc_bbr_ack(struct quic_cc *cc, struct quic_path *path,
+                            struct quic_cc_event *ev)
+{
+	struct bbr *b = &cc->algo_state.bbr;
+	uint64_t btlbw, target, rate;
+	int rtprop_expired;
+
+	/* Round trip counting. */
+	b->round_start = 0;
+	if (ev->ack.prior_delivered >= b->next_round_delivered) {
+		b->next_round_delivered = path->delivered;
+		b->round_count++;
+		b->round_start = 1;
+	}
+
+	/* Bottleneck bandwidth: the application limited samples are used
+	 * only if they are greater than the current estimation.
+	 */
+	btlbw = quic_cc_bbr_btlbw(b);
+	if (ev->ack.rate && (!ev->ack.app_limited || ev->ack.rate >= btlbw))
+		btlbw = quic_cc_minmax_running_max(b->btlbw, BBR_BTLBW_FILTER_LEN,
+		                                   b->round_count, ev->ack.rate);
+
+	if (b->state == QUIC_CC_BBR_ST_PROBE_BW)
+		quic_cc_bbr_update_gain_cycle(b, path);
+
+	/* Full pipe detection. */
+	if (!b->filled_pipe && b->round_start && !ev->ack.app_limited) {
+		if (btlbw >= b->full_bw * BBR_FULL_BW_THRESH_NUM / BBR_FULL_BW_THRESH_DEN) {
+			b->full_bw = btlbw;
+			b->full_bw_cnt = 0;
+		}
+		else if (++b->full_bw_cnt >= BBR_FULL_BW_CNT)
+			b->filled_pipe = 1;
+	}
+
+	if (b->state == QUIC_CC_BBR_ST_STARTUP && b->filled_pipe) {
+		b->state = QUIC_CC_BBR_ST_DRAIN;
+		b->pacing_gain = BBR_DRAIN_GAIN;
+		b->cwnd_gain = BBR_HIGH_GAIN;
+	}
+	if (b->state == QUIC_CC_BBR_ST_DRAIN &&
+	    path->in_flight <= quic_cc_bbr_bdp(b, BBR_UNIT))
+		quic_cc_bbr_enter_probe_bw(b);
+
+	/* RTprop */
+	rtprop_expired = (int32_t)(now_ms - b->min_rtt_stamp) > BBR_RTPROP_FILTER_LEN;
+	if (ev->ack.rtt_us && (ev->ack.rtt_us <= b->min_rtt || rtprop_expired)) {
+		b->min_rtt = ev->ack.rtt_us;
+		b->min_rtt_stamp = now_ms;
+	}
+	quic_cc_bbr_update_probe_rtt(b, path, rtprop_expired);
+
+	/* Pacing rate: do not decrease it until the pipe is filled. */
+	rate = btlbw * b->pacing_gain / BBR_UNIT;
+	if (rate && (b->filled_pipe || rate > path->pacer.cc_rate))
+		path->pacer.cc_rate = rate;
+
+	/* Congestion window */
+	target = quic_cc_bbr_bdp(b, b->cwnd_gain);
+	if (target)
+		target += 3 * path->mtu;
+	else
+		target = path->cwnd;
+	if (b->filled_pipe)
+		b->cwnd = min(b->cwnd + ev->ack.acked, target);
+	else if (b->cwnd < target || path->delivered < path->cwnd)
+		b->cwnd += ev->ack.acked;
+	b->cwnd = max(b->cwnd, (uint64_t)BBR_MIN_PIPE_CWND * path->mtu);
+	if (b->state == QUIC_CC_BBR_ST_PROBE_RTT)
+		b->cwnd = min(b->cwnd, (uint64_t)BBR_MIN_PIPE_CWND * path->mtu);
+	path->cwnd = b->cwnd;
+}
+
+static void quic_cc_bbr_event(struct quic_cc *cc, struct quic_cc_event *ev)
+{
+	struct quic_path *path;
+	struct bbr *b = &cc->algo_state.bbr;
+
+	TRACE_ENTER(QUIC_EV_CONN_CC, cc->qc->conn, ev);
+	path = container_of(cc, struct quic_path, cc);
+	switch (ev->type) {
+	case QUIC_CC_EVT_ACK:
+		path->in_flight -= ev->ack.acked;
+		quic_cc_bbr_ack(cc, path, ev);
+		break;
+
+	case QUIC_CC_EVT_LOSS:
+		/* The losses are not a congestion signal for BBR: only
+		 * deduce the lost bytes from the window.
+		 */
+		path->in_flight -= ev->loss.lost_bytes;
+		if (quic_loss_persistent_congestion(&path->loss,
+		                                    ev->loss.period,
+		                                    ev->loss.now_ms,
+		                                    ev->loss.max_ack_delay))
+			b->cwnd = path->min_cwnd;
+		else if (b->cwnd > ev->loss.lost_bytes + path->min_cwnd)
+			b->cwnd -= ev->loss.lost_bytes;
+		else
+			b->cwnd = path->min_cwnd;
+		path->cwnd = b->cwnd;
+		break;
+
+	case QUIC_CC_EVT_ECN_CE:
+		/* BBR v1 does not react to the ECN marks. */
+		break;
+	}
+	TRACE_LEAVE(QUIC_EV_CONN_CC, cc->qc->conn,, cc);
+}
+
+static void quic_cc_bbr_state_trace(struct buffer *buf, const struct quic_cc *cc)
+{
+	const struct bbr *b = &cc->algo_state.bbr;
+	const struct quic_path *path = container_of(cc, struct quic_path, cc);
+
+	chunk_appendf(buf, " state=%s cwnd=%llu btlbw=%llu min_rtt=%u pacing_rate=%llu"
+	              " pacing_gain=%u cwnd_gain=%u round=%u filled_pipe=%u",
+	              quic_cc_bbr_state_str(b->state),
+	              (unsigned long long)b->cwnd,
+	              (unsigned long long)quic_cc_bbr_btlbw(b), b->min_rtt,
+	              (unsigned long long)path->pacer.rate,
+	              b->pacing_gain, b->cwnd_gain, b->round_count, b->filled_pipe);
+}
+
+static const char *quic_cc_bbr_state_name(const struct quic_cc *cc)
+{
+	return quic_cc_bbr_state_str(cc->algo_state.bbr.state);
+}
+
+struct quic_cc_algo quic_cc_algo_bbr = {
+	.type        = QUIC_CC_ALGO_TP_BBR,
+	.name        = "bbr",
+	.init        = quic_cc_bbr_init,
+	.event       = quic_cc_bbr_event,
+	.state_trace = quic_cc_bbr_state_trace,
+	.state_name  = quic_cc_bbr_state_name,
+};
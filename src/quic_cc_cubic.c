@@ -0,0 +1,301 @@
+/*
+ * CUBIC congestion control algorithm (RFC 8312).
+ *
+ * This file contains definitions for QUIC congestion control.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <common/time.h>
+
+#include <types/xprt_quic.h>
+
+#include <proto/quic_cc.h>
+#include <proto/trace.h>
+#include <proto/xprt_quic.h>
+
+#define TRACE_SOURCE    &trace_quic
+
+/* The window is multiplied by beta = 0.7 (7/10) upon congestion event, and
+ * by (1 + beta) / 2 = 17/20 for the fast convergence. The standard TCP window
+ * estimation grows by alpha = 3 * (1 - beta) / (1 + beta) = 9/17 segment
+ * by window.
+ */
+#define QUIC_CUBIC_BETA_NUM          7
+#define QUIC_CUBIC_BETA_DEN         10
+#define QUIC_CUBIC_FAST_CONV_NUM    17
+#define QUIC_CUBIC_FAST_CONV_DEN    20
+#define QUIC_CUBIC_ALPHA_NUM         9
+#define QUIC_CUBIC_ALPHA_DEN        17
+/* Do not compute the cubic function for more than 100s from the origin. */
+#define QUIC_CUBIC_MAX_DT       100000
+
+/* Return the integer cube root of <val>. */
+static uint64_t quic_cubic_root(uint64_t val)
+{
+	int s;
+	uint64_t y, b;
+
+	y = 0;
+	for (s = 63; s >= 0; s -= 3) {
+		y <<= 1;
+		b = 3 * y * (y + 1) + 1;
+		if ((val >> s) >= b) {
+			val -= b << s;
+			y++;
+		}
+	}
+
+	return y;
+}
+
+/* Return the value in bytes of C * dt^3 with C = 0.4 segment by s^3,
+ * <dt> being in milliseconds and <mtu> the size of segments.
+ */
+static inline uint64_t quic_cubic_delta(uint64_t dt, size_t mtu)
+{
+	if (dt > QUIC_CUBIC_MAX_DT)
+		dt = QUIC_CUBIC_MAX_DT;
+
+	return dt * dt * dt / 1000 * 4 * mtu / 10000000;
+}
+
+static int quic_cc_cubic_init(struct quic_cc *cc)
+{
+	struct quic_path *path;
+	struct cubic *c = &cc->algo_state.cubic;
+
+	path = container_of(cc, struct quic_path, cc);
+	c->state = QUIC_CC_ST_SS;
+	c->cwnd = path->cwnd;
+	c->ssthresh = QUIC_CC_INFINITE_SSTHESH;
+	c->recovery_start_time = 0;
+	c->last_max_cwnd = 0;
+	c->origin_point = 0;
+	c->K = 0;
+	c->epoch_start = 0;
+	c->tcp_cwnd = 0;
+	c->tcp_acked = 0;
+
+	return 1;
+}
+
+/* Enter a recovery period because of a congestion event,
+ * reducing the window of <cc> whose path is <path>.
+ */
+static void quic_cc_cubic_reduce(struct quic_cc *cc, struct quic_path *path)
+{
+	struct cubic *c = &cc->algo_state.cubic;
+
+	c->recovery_start_time = now_ms;
+	c->epoch_start = 0;
+	/* Fast convergence: release some bandwidth for the new flows. */
+	if (c->cwnd < c->last_max_cwnd)
+		c->last_max_cwnd = c->cwnd * QUIC_CUBIC_FAST_CONV_NUM / QUIC_CUBIC_FAST_CONV_DEN;
+	else
+		c->last_max_cwnd = c->cwnd;
+	c->cwnd = max(c->cwnd * QUIC_CUBIC_BETA_NUM / QUIC_CUBIC_BETA_DEN,
+	              (uint64_t)path->min_cwnd);
+	c->ssthresh = c->cwnd;
+}
+
+/* Handle a loss event for <cc> whose path is <path>, from both the slow start
+ * and the congestion avoidance states.
+ */
+static void quic_cc_cubic_loss(struct quic_cc *cc, struct quic_path *path,
+                               struct quic_cc_event *ev)
+{
+	struct cubic *c = &cc->algo_state.cubic;
+
+	path->in_flight -= ev->loss.lost_bytes;
+	if (ev->loss.newest_time_sent > c->recovery_start_time)
+		quic_cc_cubic_reduce(cc, path);
+	c->state = QUIC_CC_ST_CA;
+	if (quic_loss_persistent_congestion(&path->loss,
+	                                    ev->loss.period,
+	                                    ev->loss.now_ms,
+	                                    ev->loss.max_ack_delay)) {
+		c->cwnd = path->min_cwnd;
+		c->epoch_start = 0;
+		/* Re-entering slow start state. */
+		c->state = QUIC_CC_ST_SS;
+	}
+	path->cwnd = c->cwnd;
+}
+
+/* Handle an ECN-CE count increase for <cc> whose path is <path> as a
+ * congestion event, the bytes in flight being not modified.
+ */
+static void quic_cc_cubic_ecn_ce(struct quic_cc *cc, struct quic_path *path,
+                                 struct quic_cc_event *ev)
+{
+	struct cubic *c = &cc->algo_state.cubic;
+
+	if (ev->ecn.time_sent <= c->recovery_start_time)
+		return;
+
+	quic_cc_cubic_reduce(cc, path);
+	c->state = QUIC_CC_ST_CA;
+	path->cwnd = c->cwnd;
+}
+
+/* Slow start callback. */
+static void quic_cc_cubic_ss_cb(struct quic_cc *cc, struct quic_cc_event *ev)
+{
+	struct quic_path *path;
+	struct cubic *c = &cc->algo_state.cubic;
+
+	TRACE_ENTER(QUIC_EV_CONN_CC, cc->qc->conn, ev);
+	path = container_of(cc, struct quic_path, cc);
+	switch (ev->type) {
+	case QUIC_CC_EVT_ACK:
+		path->in_flight -= ev->ack.acked;
+		/* Do not increase the congestion window in recovery period. */
+		if (ev->ack.time_sent <= c->recovery_start_time)
+			goto out;
+
+		c->cwnd += ev->ack.acked;
+		/* Exit to congestion avoidance if slow start threshold is reached. */
+		if (c->cwnd > c->ssthresh)
+			c->state = QUIC_CC_ST_CA;
+		path->cwnd = c->cwnd;
+		break;
+
+	case QUIC_CC_EVT_LOSS:
+		quic_cc_cubic_loss(cc, path, ev);
+		break;
+
+	case QUIC_CC_EVT_ECN_CE:
+		quic_cc_cubic_ecn_ce(cc, path, ev);
+		break;
+	}
+
+ out:
+	TRACE_LEAVE(QUIC_EV_CONN_CC, cc->qc->conn,, cc);
+}
+
+/* Congestion avoidance callback. */
+static void quic_cc_cubic_ca_cb(struct quic_cc *cc, struct quic_cc_event *ev)
+{
+	struct quic_path *path;
+	struct cubic *c = &cc->algo_state.cubic;
+	uint32_t t;
+	uint64_t target, delta;
+
+	TRACE_ENTER(QUIC_EV_CONN_CC, cc->qc->conn, ev);
+	path = container_of(cc, struct quic_path, cc);
+	switch (ev->type) {
+	case QUIC_CC_EVT_ACK:
+		path->in_flight -= ev->ack.acked;
+		/* Do not increase the congestion window in recovery period. */
+		if (ev->ack.time_sent <= c->recovery_start_time)
+			goto out;
+
+		if (!c->epoch_start) {
+			/* New epoch: 0 is reserved to mark the absence of epoch. */
+			c->epoch_start = now_ms ? now_ms : 1;
+			if (c->cwnd < c->last_max_cwnd) {
+				/* K = cubic_root((W_max - cwnd) / C) in ms */
+				c->K = quic_cubic_root((c->last_max_cwnd - c->cwnd) *
+				                       2500000000ULL / path->mtu);
+				c->origin_point = c->last_max_cwnd;
+			}
+			else {
+				c->K = 0;
+				c->origin_point = c->cwnd;
+			}
+			c->tcp_cwnd = c->cwnd;
+			c->tcp_acked = 0;
+		}
+
+		/* W_cubic(t) = C * (t - K)^3 + W_max */
+		t = now_ms - c->epoch_start;
+		if (t < c->K) {
+			delta = quic_cubic_delta(c->K - t, path->mtu);
+			target = c->origin_point > delta ? c->origin_point - delta : 0;
+		}
+		else {
+			delta = quic_cubic_delta(t - c->K, path->mtu);
+			target = c->origin_point + delta;
+		}
+
+		/* Never more than 50% of increase by window. */
+		if (target > c->cwnd + (c->cwnd >> 1))
+			target = c->cwnd + (c->cwnd >> 1);
+		if (target > c->cwnd)
+			c->cwnd += (target - c->cwnd) * ev->ack.acked / c->cwnd;
+
+		/* TCP friendly region: at least as fast as a standard TCP. */
+		c->tcp_acked += ev->ack.acked;
+		if (c->tcp_acked >= c->tcp_cwnd * QUIC_CUBIC_ALPHA_DEN / QUIC_CUBIC_ALPHA_NUM) {
+			c->tcp_acked -= c->tcp_cwnd * QUIC_CUBIC_ALPHA_DEN / QUIC_CUBIC_ALPHA_NUM;
+			c->tcp_cwnd += path->mtu;
+		}
+		if (c->tcp_cwnd > c->cwnd)
+			c->cwnd = c->tcp_cwnd;
+		path->cwnd = c->cwnd;
+		break;
+
+	case QUIC_CC_EVT_LOSS:
+		quic_cc_cubic_loss(cc, path, ev);
+		break;
+
+	case QUIC_CC_EVT_ECN_CE:
+		quic_cc_cubic_ecn_ce(cc, path, ev);
+		break;
+	}
+
+ out:
+	TRACE_LEAVE(QUIC_EV_CONN_CC, cc->qc->conn,, cc);
+}
+
+static void quic_cc_cubic_state_trace(struct buffer *buf, const struct quic_cc *cc)
+{
+	const struct cubic *c = &cc->algo_state.cubic;
+
+	chunk_appendf(buf, " state=%s cwnd=%llu ssthresh=%lld recovery_start_time=%llu"
+	              " W_max=%llu K=%u epoch_start=%u",
+	              quic_cc_state_str(c->state),
+	              (unsigned long long)c->cwnd,
+	              (long long)c->ssthresh,
+	              (unsigned long long)c->recovery_start_time,
+	              (unsigned long long)c->last_max_cwnd,
+	              c->K, c->epoch_start);
+}
+
+static const char *quic_cc_cubic_state_name(const struct quic_cc *cc)
+{
+	return quic_cc_state_name(cc->algo_state.cubic.state);
+}
+
+static void (*quic_cc_cubic_state_cbs[])(struct quic_cc *cc,
+                                         struct quic_cc_event *ev) = {
+	[QUIC_CC_ST_SS] = quic_cc_cubic_ss_cb,
+	[QUIC_CC_ST_CA] = quic_cc_cubic_ca_cb,
+};
+
+static void quic_cc_cubic_event(struct quic_cc *cc, struct quic_cc_event *ev)
+{
+	return quic_cc_cubic_state_cbs[cc->algo_state.cubic.state](cc, ev);
+}
+
+struct quic_cc_algo quic_cc_algo_cubic = {
+	.type        = QUIC_CC_ALGO_TP_CUBIC,
+	.name        = "cubic",
+	.init        = quic_cc_cubic_init,
+	.event       = quic_cc_cubic_event,
+	.state_trace = quic_cc_cubic_state_trace,
+	.state_name  = quic_cc_cubic_state_name,
+};
@@ -41,6 +41,22 @@ static int quic_cc_nr_init(struct quic_cc *cc)
 	return 1;
 }
 
+/* Upon an ECN-CE count increase, enter a recovery period as for a loss,
+ * except for the bytes in flight which are not modified.
+ */
+static void quic_cc_nr_ecn_ce(struct quic_cc *cc, struct quic_path *path,
+                              struct quic_cc_event *ev)
+{
+	if (ev->ecn.time_sent <= cc->algo_state.nr.recovery_start_time)
+		return;
+
+	cc->algo_state.nr.recovery_start_time = now_ms;
+	cc->algo_state.nr.cwnd = max(cc->algo_state.nr.cwnd >> 1, path->min_cwnd);
+	path->cwnd = cc->algo_state.nr.ssthresh = cc->algo_state.nr.cwnd;
+	/* Exit to congestion avoidance. */
+	cc->algo_state.nr.state = QUIC_CC_ST_CA;
+}
+
 /* Slow start callback. */
 static void quic_cc_nr_ss_cb(struct quic_cc *cc, struct quic_cc_event *ev)
 {
@@ -71,7 +87,7 @@ static void quic_cc_nr_ss_cb(struct quic_cc *cc, struct quic_cc_event *ev)
 		break;
 
 	case QUIC_CC_EVT_ECN_CE:
-		/* XXX TO DO XXX */
+		quic_cc_nr_ecn_ce(cc, path, ev);
 		break;
 	}
 	TRACE_LEAVE(QUIC_EV_CONN_CC, cc->qc->conn,, cc);
@@ -117,7 +133,7 @@ static void quic_cc_nr_ca_cb(struct quic_cc *cc, struct quic_cc_event *ev)
 		break;
 
 	case QUIC_CC_EVT_ECN_CE:
-		/* XXX TO DO XXX */
+		quic_cc_nr_ecn_ce(cc, path, ev);
 		break;
 	}
 
@@ -134,6 +150,11 @@ static void quic_cc_nr_state_trace(struct buffer *buf, const struct quic_cc *cc)
 	              cc->algo_state.nr.recovery_start_time);
 }
 
+static const char *quic_cc_nr_state_name(const struct quic_cc *cc)
+{
+	return quic_cc_state_name(cc->algo_state.nr.state);
+}
+
 static void (*quic_cc_nr_state_cbs[])(struct quic_cc *cc,
                                       struct quic_cc_event *ev) = {
 	[QUIC_CC_ST_SS] = quic_cc_nr_ss_cb,
@@ -147,8 +168,10 @@ static void quic_cc_nr_event(struct quic_cc *cc, struct quic_cc_event *ev)
 
 struct quic_cc_algo quic_cc_algo_nr = {
 	.type        = QUIC_CC_ALGO_TP_NEWRENO,
+	.name        = "newreno",
 	.init        = quic_cc_nr_init,
 	.event       = quic_cc_nr_event,
 	.state_trace = quic_cc_nr_state_trace,
+	.state_name  = quic_cc_nr_state_name,
 };
 
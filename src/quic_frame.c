@@ -25,7 +25,7 @@ const char *quic_frame_type_string(enum quic_frame_type ft)
 	case QUIC_FT_ACK:
 		return "ACK";
 	case QUIC_FT_ACK_ECN:
-		return "ACK_ENC";
+		return "ACK_ECN";
 	case QUIC_FT_RESET_STREAM:
 		return "RESET_STREAM";
 	case QUIC_FT_STOP_SENDING:
@@ -82,6 +82,8 @@ const char *quic_frame_type_string(enum quic_frame_type ft)
 		return "CONNECTION_CLOSE_APP";
 	case QUIC_FT_HANDSHAKE_DONE:
 		return "HANDSHAKE_DONE";
+	case QUIC_FT_ACK_FREQUENCY:
+		return "ACK_FREQUENCY";
 	default:
 		return "UNKNOWN";
 	}
@@ -117,6 +119,11 @@ static int quic_parse_padding_frame(struct quic_frame *frm,
 
 	beg = *buf;
 	padding->len = 1;
+	/* The padded Initial packets may carry more than a thousand of
+	 * PADDING frames: they are skipped eight at a time.
+	 */
+	while (end - *buf >= 8 && !read_u64(*buf))
+		*buf += 8;
 	while (*buf < end && !**buf)
 		(*buf)++;
 	padding->len += *buf - beg;
@@ -155,17 +162,18 @@ static int quic_build_ack_frame(unsigned char **buf, const unsigned char *end,
 {
 	struct quic_tx_ack *tx_ack = &frm->tx_ack;
 	struct quic_ack_range *ack_range, *next_ack_range;
+	size_t i;
 
-	ack_range =  LIST_NEXT(&tx_ack->ack_ranges->list, struct quic_ack_range *, list);
+	ack_range = quic_ack_range_get(tx_ack->ack_ranges, 0);
 	TRACE_PROTO("ack range", QUIC_EV_CONN_PRSAFRM, conn->conn,, &ack_range->last, &ack_range->first);
 	if (!quic_enc_int(buf, end, ack_range->last) ||
 	    !quic_enc_int(buf, end, tx_ack->ack_delay) ||
-	    !quic_enc_int(buf, end, tx_ack->ack_ranges->sz - 1) ||
+	    !quic_enc_int(buf, end, tx_ack->nb_ranges - 1) ||
 	    !quic_enc_int(buf, end, ack_range->last - ack_range->first))
 		return 0;
 
-	next_ack_range = LIST_NEXT(&ack_range->list, struct quic_ack_range *, list);
-	while (&next_ack_range->list != &tx_ack->ack_ranges->list) {
+	for (i = 1; i < tx_ack->nb_ranges; i++) {
+		next_ack_range = quic_ack_range_get(tx_ack->ack_ranges, i);
 		TRACE_PROTO("ack range", QUIC_EV_CONN_PRSAFRM, conn->conn,,
 		            &next_ack_range->last, &next_ack_range->first);
 		if (!quic_enc_int(buf, end, ack_range->first - next_ack_range->last - 2) ||
@@ -173,14 +181,15 @@ static int quic_build_ack_frame(unsigned char **buf, const unsigned char *end,
 			return 0;
 
 		ack_range = next_ack_range;
-		next_ack_range = LIST_NEXT(&ack_range->list, struct quic_ack_range *, list);
 	}
 
 	return 1;
 }
 
 /*
- * Parse an ACK frame header from <buf> buffer with <end> as end into <frm> frame.
+ * Parse an ACK or ACK_ECN frame header from <buf> buffer with <end> as end into
+ * <frm> frame. The ACK ranges and the ECN counts which follow are parsed by
+ * the caller.
  * Return 1 if succeeded (enough room to parse this frame), 0 if not.
  */
 static int quic_parse_ack_frame_header(struct quic_frame *frm,
@@ -216,33 +225,18 @@ static int quic_parse_ack_frame_header(struct quic_frame *frm,
 }
 
 /*
- * Encode a ACK_ECN frame.
+ * Encode a ACK_ECN frame: an ACK frame followed by the ECN counts.
  * Returns 1 if succeded (enough room in <buf> to encode the frame), 0 if not.
  */
 static int quic_build_ack_ecn_frame(unsigned char **buf, const unsigned char *end,
                                     struct quic_frame *frm, struct quic_conn *conn)
 {
-	struct quic_ack *ack = &frm->ack;
+	const struct quic_ecn_counts *ecn_counts = frm->tx_ack.ecn_counts;
 
-	return quic_enc_int(buf, end, ack->largest_ack) &&
-		quic_enc_int(buf, end, ack->ack_delay) &&
-		quic_enc_int(buf, end, ack->first_ack_range) &&
-		quic_enc_int(buf, end, ack->ack_range_num);
-}
-
-/*
- * Parse an ACK_ECN frame from <buf> buffer with <end> as end into <frm> frame.
- * Return 1 if succeeded (enough room to parse this frame), 0 if not.
- */
-static int quic_parse_ack_ecn_frame(struct quic_frame *frm,
-                                    const unsigned char **buf, const unsigned char *end)
-{
-	struct quic_ack *ack = &frm->ack;
-
-	return quic_dec_int(&ack->largest_ack, buf, end) &&
-		quic_dec_int(&ack->ack_delay, buf, end) &&
-		quic_dec_int(&ack->first_ack_range, buf, end) &&
-		quic_dec_int(&ack->ack_range_num, buf, end);
+	return quic_build_ack_frame(buf, end, frm, conn) &&
+		quic_enc_int(buf, end, ecn_counts->ect0) &&
+		quic_enc_int(buf, end, ecn_counts->ect1) &&
+		quic_enc_int(buf, end, ecn_counts->ce);
 }
 
 /*
@@ -897,6 +891,26 @@ static int quic_parse_handshake_done_frame(struct quic_frame *frm,
 	return 1;
 }
 
+/*
+ * Parse an ACK_FREQUENCY frame from <buf> buffer with <end> as end into <frm> frame.
+ * Return 1 if succeeded (enough room to parse this frame and valid fields), 0 if not.
+ */
+static int quic_parse_ack_frequency_frame(struct quic_frame *frm,
+                                          const unsigned char **buf, const unsigned char *end)
+{
+	struct quic_ack_frequency *ack_frequency = &frm->ack_frequency;
+
+	if (!quic_dec_int(&ack_frequency->seq_num, buf, end) ||
+	    !quic_dec_int(&ack_frequency->pkt_tolerance, buf, end) ||
+	    !quic_dec_int(&ack_frequency->max_ack_delay, buf, end) ||
+	    end <= *buf)
+		return 0;
+
+	ack_frequency->ignore_order = *(*buf)++;
+
+	return ack_frequency->pkt_tolerance && ack_frequency->ignore_order <= 1;
+}
+
 struct quic_frame_builder {
 	int (*func)(unsigned char **buf, const unsigned char *end,
                  struct quic_frame *frm, struct quic_conn *conn);
@@ -947,7 +961,7 @@ struct quic_frame_parser quic_frame_parsers[] = {
 	[QUIC_FT_PADDING]              = { .func = quic_parse_padding_frame,              .mask = QUIC_FT_PKT_TYPE_IH01_BITMASK, },
 	[QUIC_FT_PING]                 = { .func = quic_parse_ping_frame,                 .mask = QUIC_FT_PKT_TYPE_IH01_BITMASK, },
 	[QUIC_FT_ACK]                  = { .func = quic_parse_ack_frame_header,           .mask = QUIC_FT_PKT_TYPE_IH_1_BITMASK, },
-	[QUIC_FT_ACK_ECN]              = { .func = quic_parse_ack_ecn_frame,              .mask = QUIC_FT_PKT_TYPE_IH_1_BITMASK, },
+	[QUIC_FT_ACK_ECN]              = { .func = quic_parse_ack_frame_header,           .mask = QUIC_FT_PKT_TYPE_IH_1_BITMASK, },
 	[QUIC_FT_RESET_STREAM]         = { .func = quic_parse_reset_stream_frame,         .mask = QUIC_FT_PKT_TYPE___01_BITMASK, },
 	[QUIC_FT_STOP_SENDING]         = { .func = quic_parse_stop_sending_frame,         .mask = QUIC_FT_PKT_TYPE___01_BITMASK, },
 	[QUIC_FT_CRYPTO]               = { .func = quic_parse_crypto_frame,               .mask = QUIC_FT_PKT_TYPE_IH_1_BITMASK, },
@@ -975,8 +989,190 @@ struct quic_frame_parser quic_frame_parsers[] = {
 	[QUIC_FT_CONNECTION_CLOSE]     = { .func = quic_parse_connection_close_frame,     .mask = QUIC_FT_PKT_TYPE_IH01_BITMASK, },
 	[QUIC_FT_CONNECTION_CLOSE_APP] = { .func = quic_parse_connection_close_app_frame, .mask = QUIC_FT_PKT_TYPE___01_BITMASK, },
 	[QUIC_FT_HANDSHAKE_DONE]       = { .func = quic_parse_handshake_done_frame,       .mask = QUIC_FT_PKT_TYPE____1_BITMASK, },
+	[QUIC_FT_ACK_FREQUENCY]        = { .func = quic_parse_ack_frequency_frame,        .mask = QUIC_FT_PKT_TYPE___01_BITMASK, },
 };
 
+/* Return the gap value between <p> and <q> ACK ranges. */
+static inline size_t sack_gap(struct quic_ack_range *p,
+                              struct quic_ack_range *q)
+{
+	return p->first - q->last - 2;
+}
+
+/*
+ * Return the number of bytes required to encode the <nb> first ACK ranges of
+ * <qars>, without taking into an account the ACK delay.
+ *
+ *    Descending order
+ *    ------------->
+ *                range1                  range2
+ *    ..........|--------|..............|--------|
+ *              ^        ^              ^        ^
+ *              |        |              |        |
+ *            last1     first1        last2    first2
+ *    ..........+--------+--------------+--------+......
+ *                 diff1       gap12       diff2
+ *
+ * To encode the previous ranges we must encode integers as follows:
+ *          enc(last1),enc(nb - 1),enc(diff1),enc(gap12),enc(diff2)
+ *  with diff1 = last1 - first1
+ *       diff2 = last2 - first2
+ *       gap12 = first1 - last2 - 2
+ */
+static size_t quic_ack_ranges_enc_sz(struct quic_ack_ranges *qars, size_t nb)
+{
+	size_t i, enc_sz;
+	struct quic_ack_range *ar, *prev;
+
+	if (!nb)
+		return 0;
+
+	ar = quic_ack_range_get(qars, 0);
+	enc_sz = quic_int_getsize(ar->last) + quic_int_getsize(nb - 1) +
+		quic_int_getsize(ar->last - ar->first);
+	for (i = 1; i < nb; i++) {
+		prev = ar;
+		ar = quic_ack_range_get(qars, i);
+		enc_sz += quic_int_getsize(sack_gap(prev, ar)) +
+			quic_int_getsize(ar->last - ar->first);
+	}
+
+	return enc_sz;
+}
+
+/*
+ * Return the number of the first ACK ranges of <qars> which may be encoded
+ * with less than <limit> bytes, setting <enc_sz> to their encoded size.
+ * Returns 0 if not even the first one can be encoded.
+ */
+size_t quic_ack_ranges_fit(struct quic_ack_ranges *qars, size_t limit,
+                                  size_t *enc_sz)
+{
+	size_t nb, sz;
+	struct quic_ack_range *ar, *prev;
+
+	if (qars->enc_sz <= limit) {
+		*enc_sz = qars->enc_sz;
+		return qars->sz;
+	}
+
+	/* Same computation as quic_ack_ranges_enc_sz() but without the number
+	 * of ranges, which is added for each candidate count.
+	 */
+	ar = quic_ack_range_get(qars, 0);
+	sz = quic_int_getsize(ar->last) + quic_int_getsize(ar->last - ar->first);
+	if (sz + 1 > limit)
+		return 0;
+
+	*enc_sz = sz + 1;
+	for (nb = 1; nb < qars->sz; nb++) {
+		prev = ar;
+		ar = quic_ack_range_get(qars, nb);
+		sz += quic_int_getsize(sack_gap(prev, ar)) +
+			quic_int_getsize(ar->last - ar->first);
+		if (sz + quic_int_getsize(nb) > limit)
+			break;
+
+		*enc_sz = sz + quic_int_getsize(nb);
+	}
+
+	return nb;
+}
+
+/*
+ * Update <qars> ACK ranges with <pn> new packet number.
+ * In order packet numbers, which extend the first range, are accounted in
+ * constant time, as for the encoded size of the ranges. Other packet numbers
+ * are inserted by moving the ranges in front of them, which are the most
+ * recent ones, and the encoded size is computed again. When the array is full,
+ * the oldest range is dropped, as for packet numbers older than all the ranges.
+ * Always succeeds.
+ */
+int quic_update_ack_ranges(struct quic_ack_ranges *qars, int64_t pn)
+{
+	size_t i, j;
+	struct quic_ack_range *ar, *next;
+
+	if (!qars->sz) {
+		qars->head = 0;
+		ar = quic_ack_range_get(qars, 0);
+		ar->first = ar->last = pn;
+		qars->sz = 1;
+		/* Add the size of this new encoded range and the
+		 * encoded number of ranges after the first one
+		 * which is 0 (1 byte).
+		 */
+		qars->enc_sz = quic_int_getsize(pn) + 2;
+		return 1;
+	}
+
+	ar = quic_ack_range_get(qars, 0);
+	if (ar->last + 1 == pn) {
+		/* Increment the encoded size of the largest acked packet number
+		 * and of the first range diff by 1.
+		 */
+		qars->enc_sz += quic_incint_size_diff(ar->last - ar->first) +
+			quic_incint_size_diff(ar->last);
+		ar->last = pn;
+		return 1;
+	}
+
+	for (i = 0; i < qars->sz; i++) {
+		ar = quic_ack_range_get(qars, i);
+		if (pn > ar->last + 1)
+			break;
+
+		if (pn == ar->last + 1) {
+			/* Cannot be contiguous with the previous range, else
+			 * it would have been merged with it below.
+			 */
+			ar->last = pn;
+			goto out;
+		}
+
+		/* Already existing packet number */
+		if (pn >= ar->first)
+			return 1;
+
+		if (pn + 1 == ar->first) {
+			ar->first = pn;
+			next = i + 1 < qars->sz ? quic_ack_range_get(qars, i + 1) : NULL;
+			if (next && next->last + 1 == pn) {
+				/* <ar> and <next> ranges are merged into <next>. */
+				next->last = ar->last;
+				for (j = i; j > 0; j--)
+					*quic_ack_range_get(qars, j) = *quic_ack_range_get(qars, j - 1);
+				qars->head = (qars->head + 1) & (QUIC_MAX_ACK_RANGES - 1);
+				qars->sz--;
+			}
+			goto out;
+		}
+	}
+
+	if (qars->sz == QUIC_MAX_ACK_RANGES) {
+		/* Older than all the ranges we can store. */
+		if (i == qars->sz)
+			return 1;
+
+		/* Drop the oldest range. */
+		qars->sz--;
+	}
+
+	if (i < qars->sz) {
+		/* Range insertion before the one with <i> as rank. */
+		qars->head = (qars->head - 1) & (QUIC_MAX_ACK_RANGES - 1);
+		for (j = 0; j < i; j++)
+			*quic_ack_range_get(qars, j) = *quic_ack_range_get(qars, j + 1);
+	}
+	ar = quic_ack_range_get(qars, i);
+	ar->first = ar->last = pn;
+	qars->sz++;
+
+ out:
+	qars->enc_sz = quic_ack_ranges_enc_sz(qars, qars->sz);
+	return 1;
+}
+
 /*
  * Decode a QUIC frame from <buf> buffer into <frm> frame.
  * Returns 1 if succeded (enough data to parse the frame), 0 if not.
@@ -986,26 +1182,60 @@ int qc_parse_frm(struct quic_frame *frm, struct quic_rx_packet *pkt,
                  struct quic_conn *conn)
 {
 	struct quic_frame_parser *parser;
+	uint64_t type;
+	int ret;
 
-	if (end <= *buf) {
+	/* The frame types are variable-length integers, the ones of the
+	 * extensions being encoded with more than one byte.
+	 */
+	if (end <= *buf || !quic_dec_int(&type, buf, end)) {
 		TRACE_DEVEL("wrong frame", QUIC_EV_CONN_PRSFRM, conn->conn);
 		return 0;
 	}
 
-	frm->type = *(*buf)++;
-	if (frm->type > QUIC_FT_MAX) {
-		TRACE_DEVEL("wrong frame type", QUIC_EV_CONN_PRSFRM, conn->conn, frm);
+	if (type >= QUIC_FT_MAX) {
+		TRACE_DEVEL("wrong frame type", QUIC_EV_CONN_PRSFRM, conn->conn);
 		return 0;
 	}
 
+	frm->type = type;
 	parser = &quic_frame_parsers[frm->type];
+	/* The unsupported frame types from the table gaps have no mask. */
 	if (!(parser->mask & (1 << pkt->type))) {
 		TRACE_DEVEL("unauthorized frame", QUIC_EV_CONN_PRSFRM, conn->conn, frm);
 		return 0;
 	}
 
 	TRACE_PROTO("frame", QUIC_EV_CONN_PRSFRM, conn->conn, frm);
-	if (!quic_frame_parsers[frm->type].func(frm, buf, end)) {
+	/* The most frequent frames are parsed by direct calls so that their
+	 * parsers may be inlined here, the other ones through the table.
+	 */
+	switch (frm->type) {
+	case QUIC_FT_PADDING:
+		ret = quic_parse_padding_frame(frm, buf, end);
+		break;
+	case QUIC_FT_ACK:
+	case QUIC_FT_ACK_ECN:
+		ret = quic_parse_ack_frame_header(frm, buf, end);
+		break;
+	case QUIC_FT_CRYPTO:
+		ret = quic_parse_crypto_frame(frm, buf, end);
+		break;
+	case QUIC_FT_STREAM_8:
+	case QUIC_FT_STREAM_9:
+	case QUIC_FT_STREAM_A:
+	case QUIC_FT_STREAM_B:
+	case QUIC_FT_STREAM_C:
+	case QUIC_FT_STREAM_D:
+	case QUIC_FT_STREAM_E:
+	case QUIC_FT_STREAM_F:
+		ret = quic_parse_stream_frame(frm, buf, end);
+		break;
+	default:
+		ret = parser->func(frm, buf, end);
+	}
+
+	if (!ret) {
 		TRACE_DEVEL("parsing error", QUIC_EV_CONN_PRSFRM, conn->conn, frm);
 		return 0;
 	}
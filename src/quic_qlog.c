@@ -0,0 +1,258 @@
+/*
+ * qlog events of the QUIC connections (draft-ietf-quic-qlog-main-schema,
+ * JSON-SEQ serialization), written to a ring or another sink.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/cfgparse.h>
+#include <common/chunk.h>
+#include <common/config.h>
+#include <common/ist.h>
+#include <common/standard.h>
+#include <common/time.h>
+
+#include <types/global.h>
+#include <types/quic.h>
+#include <types/xprt_quic.h>
+
+#include <proto/connection.h>
+#include <proto/log.h>
+#include <proto/quic_qlog.h>
+#include <proto/sink.h>
+
+/* qlog JSON-SEQ records start with the ASCII record separator. */
+#define QUIC_QLOG_RS    "\x1e"
+
+/* Name of the sink the qlog events are written to ("tune.quic.qlog"), and
+ * this sink once resolved. No event is emitted if there is none.
+ */
+static char *quic_qlog_sink_name;
+static struct sink *quic_qlog_sink;
+/* One connection out of <quic_qlog_sampling> is reported to qlog
+ * ("tune.quic.qlog-sampling"). The decision is taken once for all when
+ * the connection is initialized so that the others never pay for it.
+ */
+static unsigned int quic_qlog_sampling = 1;
+static THREAD_LOCAL unsigned int quic_qlog_cnt;
+
+/* Return the qlog name of <type> packet type. */
+static inline const char *quic_qlog_pkt_type_str(enum quic_pkt_type type)
+{
+	switch (type) {
+	case QUIC_PACKET_TYPE_INITIAL:
+		return "initial";
+	case QUIC_PACKET_TYPE_0RTT:
+		return "0RTT";
+	case QUIC_PACKET_TYPE_HANDSHAKE:
+		return "handshake";
+	case QUIC_PACKET_TYPE_RETRY:
+		return "retry";
+	case QUIC_PACKET_TYPE_SHORT:
+		return "1RTT";
+	default:
+		return "unknown";
+	}
+}
+
+/* Starts into <buf> the record of the <name> event of <qc> connection, up to
+ * its "data" member which must be filled and closed by the caller. The group
+ * ID is the original destination connection ID for the listeners so that
+ * the records of a connection may be grouped in the ring shared by all of
+ * them.
+ */
+static void quic_qlog_start_record(struct buffer *buf, const struct quic_conn *qc,
+                                   const char *name)
+{
+	const struct quic_cid *cid = qc->odcid.len ? &qc->odcid : &qc->scid;
+	int i;
+
+	chunk_appendf(buf, QUIC_QLOG_RS "{\"time\":%llu.%03u,\"name\":\"%s\",\"group_id\":\"",
+	              (unsigned long long)date.tv_sec * 1000 + date.tv_usec / 1000,
+	              (unsigned int)date.tv_usec % 1000, name);
+	for (i = 0; i < cid->len; i++)
+		chunk_appendf(buf, "%02x", cid->data[i]);
+	chunk_appendf(buf, "\",\"data\":{");
+}
+
+/* Writes to the qlog sink the record built into <buf>, closing it. The record
+ * is dropped and accounted as such by the sink if it cannot be written at once.
+ */
+static void quic_qlog_write(struct buffer *buf)
+{
+	struct ist line;
+
+	chunk_appendf(buf, "}}");
+	line = ist2(buf->area, buf->data);
+	sink_write(quic_qlog_sink, &line, 1, 0, 0, NULL, NULL, NULL);
+}
+
+/* Decides if the events of <qc> new connection are reported to qlog, in which
+ * case a "connectivity:connection_started" event is emitted.
+ */
+void quic_qlog_conn_start(struct quic_conn *qc)
+{
+	struct buffer *buf;
+	struct connection *conn = qc->conn;
+	char addr[INET6_ADDRSTRLEN];
+
+	if (!quic_qlog_sink || ++quic_qlog_cnt < quic_qlog_sampling)
+		return;
+
+	quic_qlog_cnt = 0;
+	qc->flags |= QUIC_FL_CONN_QLOG;
+
+	buf = get_trash_chunk();
+	quic_qlog_start_record(buf, qc, "connectivity:connection_started");
+	chunk_appendf(buf, "\"protocol\":\"QUIC\",\"version\":\"%08x\"", qc->version);
+	if (conn && conn->dst && addr_to_str(conn->dst, addr, sizeof addr) > 0)
+		chunk_appendf(buf, ",\"%s_ip\":\"%s\",\"%s_port\":%d",
+		              objt_listener(conn->target) ? "src" : "dst", addr,
+		              objt_listener(conn->target) ? "src" : "dst",
+		              get_host_port(conn->dst));
+	quic_qlog_write(buf);
+}
+
+/* Emits the <name> event for the <pn> packet of <len> bytes and <type> sent
+ * or received by <qc>.
+ */
+void __quic_qlog_packet(struct quic_conn *qc, const char *name,
+                        enum quic_pkt_type type, uint64_t pn, size_t len)
+{
+	struct buffer *buf = get_trash_chunk();
+
+	quic_qlog_start_record(buf, qc, name);
+	chunk_appendf(buf, "\"header\":{\"packet_type\":\"%s\",\"packet_number\":%llu},"
+	              "\"raw\":{\"length\":%llu}",
+	              quic_qlog_pkt_type_str(type), (unsigned long long)pn,
+	              (unsigned long long)len);
+	quic_qlog_write(buf);
+}
+
+/* Emits a "recovery:metrics_updated" event with the RTT estimations (ms) and
+ * the congestion state of the current path of <qc>.
+ */
+void __quic_qlog_metrics_updated(struct quic_conn *qc)
+{
+	struct buffer *buf = get_trash_chunk();
+	const struct quic_path *path = qc->path;
+
+	quic_qlog_start_record(buf, qc, "recovery:metrics_updated");
+	chunk_appendf(buf, "\"min_rtt\":%u,\"smoothed_rtt\":%u,\"latest_rtt\":%u,"
+	              "\"rtt_variance\":%u,\"pto_count\":%u,\"congestion_window\":%llu,"
+	              "\"bytes_in_flight\":%llu,\"pacing_rate\":%llu",
+	              path->loss.rtt_min, path->loss.srtt >> 3, path->loss.latest_rtt,
+	              path->loss.rtt_var >> 2, path->loss.pto_count,
+	              (unsigned long long)path->cwnd, (unsigned long long)path->in_flight,
+	              (unsigned long long)path->pacer.rate * 8);
+	quic_qlog_write(buf);
+}
+
+/* Emits a "recovery:congestion_state_updated" event for <qc> whose congestion
+ * controller switched from <old> to <new> state.
+ */
+void quic_qlog_cc_state_updated(struct quic_conn *qc, const char *old, const char *new)
+{
+	struct buffer *buf = get_trash_chunk();
+
+	quic_qlog_start_record(buf, qc, "recovery:congestion_state_updated");
+	chunk_appendf(buf, "\"old\":\"%s\",\"new\":\"%s\"", old, new);
+	quic_qlog_write(buf);
+}
+
+/* Resolves the sink configured by "tune.quic.qlog". Returns 0 if succeeded,
+ * an error code if not.
+ */
+static int quic_qlog_resolve_sink()
+{
+	if (!quic_qlog_sink_name)
+		return 0;
+
+	quic_qlog_sink = sink_find(quic_qlog_sink_name);
+	if (!quic_qlog_sink) {
+		ha_alert("tune.quic.qlog: no such ring or sink '%s'.\n", quic_qlog_sink_name);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(quic_qlog_resolve_sink);
+
+static void quic_qlog_deinit()
+{
+	free(quic_qlog_sink_name);
+	quic_qlog_sink_name = NULL;
+}
+
+REGISTER_POST_DEINIT(quic_qlog_deinit);
+
+/* config parser for global "tune.quic.qlog" */
+static int quic_parse_qlog(char **args, int section_type, struct proxy *curpx,
+                           struct proxy *defpx, const char *file, int line,
+                           char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects the name of a ring or sink.", args[0]);
+		return -1;
+	}
+
+	free(quic_qlog_sink_name);
+	quic_qlog_sink_name = strdup(args[1]);
+	if (!quic_qlog_sink_name) {
+		memprintf(err, "'%s' : out of memory.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.qlog-sampling" */
+static int quic_parse_qlog_sampling(char **args, int section_type, struct proxy *curpx,
+                                    struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_qlog_sampling = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-' || !quic_qlog_sampling) {
+		memprintf(err, "'%s' expects a strictly positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.quic.qlog", quic_parse_qlog },
+	{ CFG_GLOBAL, "tune.quic.qlog-sampling", quic_parse_qlog_sampling },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,180 @@
+/*
+ * Reassembly of the QUIC CRYPTO and STREAM data received out of order.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <common/compat.h>
+#include <common/memory.h>
+#include <common/standard.h>
+
+#include <types/quic_reasm.h>
+
+#include <proto/quic_reasm.h>
+
+DECLARE_STATIC_POOL(pool_head_quic_reasm_buf, "quic_reasm_buf", sizeof(struct quic_reasm_buf));
+
+/* Sets the bits of <map> from <from> to <to> excluded, with <to> not greater
+ * than QUIC_REASM_SZ. Returns the number of bits which were not already set.
+ */
+static size_t quic_reasm_map_set(unsigned long *map, size_t from, size_t to)
+{
+	size_t ret = 0;
+
+	while (from < to) {
+		size_t bit = from % LONGBITS;
+		size_t cnt = MIN(LONGBITS - bit, to - from);
+		unsigned long mask = nbits(cnt) << bit;
+
+		ret += my_popcountl(mask & ~map[from / LONGBITS]);
+		map[from / LONGBITS] |= mask;
+		from += cnt;
+	}
+
+	return ret;
+}
+
+/* Clears the bits of <map> from <from> to <to> excluded, with <to> not greater
+ * than QUIC_REASM_SZ. Returns the number of bits which were set.
+ */
+static size_t quic_reasm_map_clr(unsigned long *map, size_t from, size_t to)
+{
+	size_t ret = 0;
+
+	while (from < to) {
+		size_t bit = from % LONGBITS;
+		size_t cnt = MIN(LONGBITS - bit, to - from);
+		unsigned long mask = nbits(cnt) << bit;
+
+		ret += my_popcountl(mask & map[from / LONGBITS]);
+		map[from / LONGBITS] &= ~mask;
+		from += cnt;
+	}
+
+	return ret;
+}
+
+/* Returns the number of bits of <map> set from <from>, up to the end of the
+ * map, a word at a time.
+ */
+static size_t quic_reasm_map_run(const unsigned long *map, size_t from)
+{
+	size_t pos = from;
+
+	while (pos < QUIC_REASM_SZ) {
+		/* the bits above those of the word are seen as set */
+		unsigned long holes = ~map[pos / LONGBITS] >> (pos % LONGBITS);
+
+		if (holes) {
+			pos += my_ffsl(holes) - 1;
+			break;
+		}
+		pos += LONGBITS - pos % LONGBITS;
+	}
+
+	return MIN(pos, QUIC_REASM_SZ) - from;
+}
+
+/* Stores into <r> the <len> bytes of <data> found at <off> offset of the
+ * stream whose first byte not delivered yet is at <base> offset. The bytes
+ * already delivered are ignored.
+ * Returns 1 if succeeded, 0 if the data do not fit in the reassembly window
+ * or if the buffer could not be allocated.
+ */
+int quic_reasm_add(struct quic_reasm *r, uint64_t base, uint64_t off,
+                   const unsigned char *data, size_t len)
+{
+	if (off + len <= base)
+		return 1;
+
+	if (off < base) {
+		data += base - off;
+		len -= base - off;
+		off = base;
+	}
+
+	if (off + len > base + QUIC_REASM_SZ)
+		return 0;
+
+	if (!r->buf) {
+		r->buf = pool_alloc(pool_head_quic_reasm_buf);
+		if (!r->buf)
+			return 0;
+
+		memset(r->buf->map, 0, sizeof r->buf->map);
+	}
+
+	while (len) {
+		size_t pos = off & (QUIC_REASM_SZ - 1);
+		size_t cnt = MIN(len, QUIC_REASM_SZ - pos);
+
+		memcpy(r->buf->area + pos, data, cnt);
+		r->nb += quic_reasm_map_set(r->buf->map, pos, pos + cnt);
+		off += cnt;
+		data += cnt;
+		len -= cnt;
+	}
+
+	return 1;
+}
+
+/* Returns the address of the contiguous data stored in <r> from <base>
+ * offset, the first byte not delivered yet, setting <len> to their length,
+ * or NULL if there is none. These data may be followed by others at the
+ * beginning of the ring if they wrap.
+ */
+const unsigned char *quic_reasm_get(const struct quic_reasm *r, uint64_t base, size_t *len)
+{
+	size_t pos;
+
+	*len = 0;
+	if (!r->nb)
+		return NULL;
+
+	pos = base & (QUIC_REASM_SZ - 1);
+	*len = quic_reasm_map_run(r->buf->map, pos);
+
+	return *len ? r->buf->area + pos : NULL;
+}
+
+/* Removes from <r> the <len> bytes from <base> offset which have been
+ * delivered, as returned by quic_reasm_get(). The buffer is released once
+ * empty.
+ */
+void quic_reasm_del(struct quic_reasm *r, uint64_t base, size_t len)
+{
+	size_t pos = base & (QUIC_REASM_SZ - 1);
+
+	r->nb -= quic_reasm_map_clr(r->buf->map, pos, pos + len);
+	if (!r->nb)
+		quic_reasm_release(r);
+}
+
+/* Releases the buffer of <r> and the data it contains. */
+void quic_reasm_release(struct quic_reasm *r)
+{
+	pool_free(pool_head_quic_reasm_buf, r->buf);
+	r->buf = NULL;
+	r->nb = 0;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -13,7 +13,9 @@
 #include <common/chunk.h>
 
 #include <types/quic_tls.h>
+#include <types/xprt_quic.h>
 
+#include <proto/quic_tls.h>
 #include <proto/xprt_quic.h>
 
 __attribute__((format (printf, 3, 4)))
@@ -221,6 +223,119 @@ int quic_tls_derive_keys(const EVP_CIPHER *aead, const EVP_CIPHER *hp,
 	return 1;
 }
 
+/*
+ * Allocate the AEAD and header protection cipher contexts of <secs> and key
+ * them with its ->key and ->hp_key keys, for encryption if <enc> is true, for
+ * decryption if not. The previous contexts, if any, are released.
+ * Returns 1 if succeeded, 0 if not.
+ */
+int quic_tls_secrets_ctx_init(struct quic_tls_secrets *secs, int enc)
+{
+	const EVP_CIPHER *hp_ecb;
+
+	quic_tls_secrets_ctx_free(secs);
+
+	secs->ctx = EVP_CIPHER_CTX_new();
+	secs->hp_ctx = EVP_CIPHER_CTX_new();
+	if (!secs->ctx || !secs->hp_ctx ||
+	    !EVP_CipherInit_ex(secs->ctx, secs->aead, NULL, secs->key, NULL, enc) ||
+	    !EVP_CipherInit_ex(secs->hp_ctx, secs->hp, NULL, secs->hp_key, NULL, enc))
+		goto err;
+
+	/* Only used to protect the headers of the packets we send. */
+	hp_ecb = enc ? tls_hp_ecb(secs->hp) : NULL;
+	if (hp_ecb) {
+		secs->hp_ecb_ctx = EVP_CIPHER_CTX_new();
+		if (!secs->hp_ecb_ctx ||
+		    !EVP_EncryptInit_ex(secs->hp_ecb_ctx, hp_ecb, NULL, secs->hp_key, NULL))
+			goto err;
+
+		EVP_CIPHER_CTX_set_padding(secs->hp_ecb_ctx, 0);
+	}
+
+	return 1;
+
+ err:
+	quic_tls_secrets_ctx_free(secs);
+	return 0;
+}
+
+/*
+ * Compute into <masks> the header protection masks of the <n> samples of
+ * QUIC_TLS_HP_SAMPLE_LEN bytes found one after the other at <samples> with the
+ * header protection key of <secs> (RFC 9001 5.4). Each mask is made of the
+ * QUIC_TLS_HP_SAMPLE_LEN bytes located at the same offset in <masks> as its
+ * sample, only its first 5 bytes being significant. As AES-ECB encrypts each
+ * block independently, all the AES masks are computed with a unique call. The
+ * ChaCha20 ones are computed one after the other, the sample being the IV.
+ * Returns 1 if succeeded, 0 if not.
+ */
+int quic_tls_hp_masks(struct quic_tls_secrets *secs, unsigned char *samples,
+                      unsigned char *masks, int n)
+{
+	int i, outlen;
+
+	if (secs->hp_ecb_ctx)
+		return EVP_EncryptUpdate(secs->hp_ecb_ctx, masks, &outlen,
+		                         samples, n * QUIC_TLS_HP_SAMPLE_LEN);
+
+	for (i = 0; i < n; i++) {
+		unsigned char *mask = masks + i * QUIC_TLS_HP_SAMPLE_LEN;
+
+		memset(mask, 0, 5);
+		if (!EVP_EncryptInit_ex(secs->hp_ctx, NULL, NULL, NULL,
+		                        samples + i * QUIC_TLS_HP_SAMPLE_LEN) ||
+		    !EVP_EncryptUpdate(secs->hp_ctx, mask, &outlen, mask, 5) ||
+		    !EVP_EncryptFinal_ex(secs->hp_ctx, mask, &outlen))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Derive into <kp> the next generation of the packet protection material of
+ * <secs> (RFC 9001 6.1): the next secret is derived from the current one
+ * with the "quic ku" label, then the AEAD key and IV from this new secret.
+ * The cipher context of <kp> is keyed for encryption if <enc> is true, for
+ * decryption if not, so that the key phase switch costs nothing.
+ * Returns 1 if succeeded, 0 if not.
+ */
+int quic_tls_kp_derive(struct quic_tls_kp *kp, const struct quic_tls_secrets *secs,
+                       int enc)
+{
+	size_t aead_keylen = (size_t)EVP_CIPHER_key_length(secs->aead);
+	size_t aead_ivlen = (size_t)EVP_CIPHER_iv_length(secs->aead);
+	const unsigned char ku_label[] = "quic ku";
+	const unsigned char key_label[] = "quic key";
+	const unsigned char iv_label[] = "quic iv";
+
+	if (!secs->secretlen || aead_keylen > sizeof kp->key || aead_ivlen > sizeof kp->iv)
+		return 0;
+
+	kp->secretlen = secs->secretlen;
+	if (!quic_hkdf_expand_label(secs->md, kp->secret, kp->secretlen,
+	                            secs->secret, secs->secretlen,
+	                            ku_label, sizeof ku_label - 1) ||
+	    !quic_hkdf_expand_label(secs->md, kp->key, aead_keylen,
+	                            kp->secret, kp->secretlen,
+	                            key_label, sizeof key_label - 1) ||
+	    !quic_hkdf_expand_label(secs->md, kp->iv, aead_ivlen,
+	                            kp->secret, kp->secretlen,
+	                            iv_label, sizeof iv_label - 1))
+		return 0;
+
+	if (!kp->ctx && !(kp->ctx = EVP_CIPHER_CTX_new()))
+		return 0;
+
+	if (!EVP_CipherInit_ex(kp->ctx, secs->aead, NULL, kp->key, NULL, enc)) {
+		quic_tls_kp_free(kp);
+		return 0;
+	}
+
+	return 1;
+}
+
 /*
  * Derive the initial secret from <secret> and QUIC version dependent salt.
  * Returns the size of the derived secret if succeeded, 0 if not.
@@ -334,66 +449,136 @@ int quic_aead_iv_build(unsigned char *iv, size_t ivlen,
  * key and IV (see for example [AEBounds]). This might be lower than the packet number limit.
  * An endpoint MUST initiate a key update (Section 6) prior to exceeding any limit set for
  * the AEAD that is in use.
+ *
+ * <ctx> must be a cipher context already keyed by quic_tls_secrets_ctx_init(),
+ * so that only the <iv> IV has to be set here.
+ * Returns 1 if succeeded, 0 if not.
  */
-
 int quic_tls_encrypt(unsigned char *buf, size_t len,
                      const unsigned char *aad, size_t aad_len,
-                     const EVP_CIPHER *aead, const unsigned char *key, const unsigned char *iv)
+                     EVP_CIPHER_CTX *ctx, const unsigned char *iv)
 {
-	EVP_CIPHER_CTX *ctx;
-	int ret, outlen;
-
-	ret = 0;
-	ctx = EVP_CIPHER_CTX_new();
-	if (!ctx)
-		return 0;
+	int outlen;
 
-	if (!EVP_EncryptInit_ex(ctx, aead, NULL, key, iv) ||
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) ||
 		!EVP_EncryptUpdate(ctx, NULL, &outlen, aad, aad_len) ||
 		!EVP_EncryptUpdate(ctx, buf, &outlen, buf, len) ||
 		!EVP_EncryptFinal_ex(ctx, buf + outlen, &outlen) ||
 		!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, QUIC_TLS_TAG_LEN, buf + len))
-		goto out;
-
-	ret = 1;
-
- out:
-	EVP_CIPHER_CTX_free(ctx);
+		return 0;
 
-	return ret;
+	return 1;
 }
 
+/*
+ * Decrypt in place <buf> with <len> as length, the authentication tag
+ * included, with <aad> as AAD and <iv> as IV, <ctx> being a cipher context
+ * already keyed with quic_tls_secrets_ctx_init().
+ * Returns the length of the decrypted data if succeeded, 0 if not.
+ */
 int quic_tls_decrypt(unsigned char *buf, size_t len,
                      unsigned char *aad, size_t aad_len,
-                     const EVP_CIPHER *aead, const unsigned char *key, const unsigned char *iv)
+                     EVP_CIPHER_CTX *ctx, const unsigned char *iv)
 {
-	int ret, outlen;
+	int outlen;
 	size_t off;
-	EVP_CIPHER_CTX *ctx;
 
-	ret = 0;
 	off = 0;
-	ctx = EVP_CIPHER_CTX_new();
-	if (!ctx)
-		return 0;
-
-	if (!EVP_DecryptInit_ex(ctx, aead, NULL, key, iv) ||
+	if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) ||
 		!EVP_DecryptUpdate(ctx, NULL, &outlen, aad, aad_len) ||
 		!EVP_DecryptUpdate(ctx, buf, &outlen, buf, len - QUIC_TLS_TAG_LEN))
-		goto out;
+		return 0;
 
 	off += outlen;
 
 	if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, QUIC_TLS_TAG_LEN,
 	                         buf + len - QUIC_TLS_TAG_LEN) ||
 	    !EVP_DecryptFinal_ex(ctx, buf + off, &outlen))
-		goto out;
+		return 0;
 
 	off += outlen;
 
 	HEXDUMP(buf, off, "Decrypted buf(%zu):\n", off);
-	ret = off;
 
+	return off;
+}
+
+/*
+ * Decrypt in place the <n> packets of <decs> (at most QUIC_TLS_DEC_BATCH),
+ * all protected with the same AEAD key, <ctx> being the cipher context keyed
+ * with it and <aead_iv> the static IV of <aead_ivlen> bytes of this key.
+ * All the nonces are built first, then the packets are decrypted in a row so
+ * that the key schedule and the cipher context remain hot in the cache. The
+ * result of each packet is stored in its <ret> member.
+ * Returns the number of packets successfully decrypted.
+ */
+int quic_tls_decrypt_batch(struct quic_tls_dec *decs, int n, EVP_CIPHER_CTX *ctx,
+                           unsigned char *aead_iv, size_t aead_ivlen)
+{
+	unsigned char ivs[QUIC_TLS_DEC_BATCH][12];
+	int i, ret;
+
+	for (i = 0; i < n; i++)
+		decs[i].ret = 0;
+
+	for (i = 0; i < n; i++)
+		if (!quic_aead_iv_build(ivs[i], sizeof ivs[i], aead_iv, aead_ivlen, decs[i].pn))
+			return 0;
+
+	ret = 0;
+	for (i = 0; i < n; i++) {
+		decs[i].ret = quic_tls_decrypt(decs[i].buf, decs[i].len,
+		                               decs[i].aad, decs[i].aad_len, ctx, ivs[i]);
+		if (decs[i].ret)
+			ret++;
+	}
+
+	return ret;
+}
+
+/* Key and nonce of the Retry packet integrity tag for draft-25 to draft-28 QUIC
+ * versions.
+ */
+static const unsigned char quic_tls_retry_key[16] = {
+	0x4d, 0x32, 0xec, 0xdb, 0x2a, 0x21, 0x33, 0xc8,
+	0x41, 0xe4, 0x04, 0x3d, 0xf2, 0x7d, 0x44, 0x30,
+};
+
+static const unsigned char quic_tls_retry_nonce[12] = {
+	0x4d, 0x16, 0x11, 0xd0, 0x55, 0x13, 0xa5, 0x52,
+	0xc5, 0x87, 0xd5, 0x75,
+};
+
+/*
+ * Compute the integrity tag of the Retry packet found in <buf> with <len> as
+ * length and sent in response to a packet with <odcid> as destination
+ * connection ID. The tag is the one of an AES-128-GCM encryption of an empty
+ * plaintext with the Retry pseudo-packet as AAD. It is written after the
+ * packet, so <buf> must have QUIC_TLS_TAG_LEN bytes of room available after
+ * <len> bytes.
+ * Returns 1 if succeeded, 0 if not.
+ */
+int quic_tls_retry_integrity_tag(unsigned char *buf, size_t len,
+                                 const unsigned char *odcid, unsigned char odcid_len)
+{
+	int outlen, ret = 0;
+	EVP_CIPHER_CTX *ctx;
+
+	ctx = EVP_CIPHER_CTX_new();
+	if (!ctx)
+		return 0;
+
+	/* The pseudo-packet is the ODCID prefixed by its length, followed by the packet. */
+	if (!EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL,
+	                        quic_tls_retry_key, quic_tls_retry_nonce) ||
+	    !EVP_EncryptUpdate(ctx, NULL, &outlen, &odcid_len, sizeof odcid_len) ||
+	    !EVP_EncryptUpdate(ctx, NULL, &outlen, odcid, odcid_len) ||
+	    !EVP_EncryptUpdate(ctx, NULL, &outlen, buf, len) ||
+	    !EVP_EncryptFinal_ex(ctx, buf + len, &outlen) ||
+	    !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, QUIC_TLS_TAG_LEN, buf + len))
+		goto out;
+
+	ret = 1;
  out:
 	EVP_CIPHER_CTX_free(ctx);
 	return ret;
@@ -0,0 +1,415 @@
+/*
+ * Token bucket rate limiting ("rate-limit" action).
+ *
+ * Each "rate-limit" rule owns a fixed table of token buckets indexed by the
+ * hash of its key. The table is split into small sets of buckets, each set
+ * being protected by one of a few striped locks, and a key evicts the least
+ * recently refilled bucket of its set when it is not found. In order to avoid
+ * taking a lock for each request, every thread keeps a small local cache of
+ * tokens taken by batches from the shared buckets. The tokens left in a local
+ * cache are given back to their bucket once they are too old or when the slot
+ * is needed for another key, so that they are rebalanced between the threads.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <import/xxhash.h>
+
+#include <common/cfgparse.h>
+#include <common/config.h>
+#include <common/hathreads.h>
+#include <common/initcall.h>
+#include <common/standard.h>
+#include <common/ticks.h>
+#include <common/time.h>
+
+#include <types/action.h>
+#include <types/global.h>
+
+#include <proto/arg.h>
+#include <proto/http_rules.h>
+#include <proto/log.h>
+#include <proto/proxy.h>
+#include <proto/sample.h>
+#include <proto/stream.h>
+#include <proto/tcp_rules.h>
+
+#define RL_WAYS        4    /* buckets per set */
+#define RL_LOCKS       64   /* striped locks per table, power of 2 */
+#define RL_LOCAL_SLOTS 256  /* local cache slots per thread, power of 2 */
+#define RL_DEF_SIZE    65536 /* default number of buckets */
+
+/* A shared bucket. Its credit is expressed in tokens multiplied by the
+ * period so that the refill never loses precision.
+ */
+struct rl_bucket {
+	uint64_t hash;           /* hash of the key, 0 = unused */
+	uint64_t credit;         /* tokens * period */
+	unsigned int last;       /* date of the last refill (ticks) */
+};
+
+/* Tokens cached by a thread for a key */
+struct rl_local {
+	uint64_t hash;           /* hash of the key, 0 = unused */
+	unsigned int tokens;     /* tokens left */
+	unsigned int expire;     /* date after which they are given back (ticks) */
+};
+
+struct rate_limit {
+	struct list list;        /* element of the rate_limits list */
+	struct sample_expr *expr; /* key */
+	unsigned int rate;       /* tokens added per period */
+	unsigned int period;     /* in milliseconds */
+	unsigned int burst;      /* max tokens in a bucket */
+	unsigned int size;       /* requested number of buckets */
+	unsigned int set_mask;   /* number of sets - 1 */
+	unsigned int batch;      /* tokens taken at once by a thread */
+	unsigned int local_ttl;  /* lifetime of the tokens of a local cache (ms) */
+	struct rl_bucket *buckets; /* (set_mask + 1) * RL_WAYS buckets */
+	struct rl_local *local;  /* RL_LOCAL_SLOTS per thread */
+	__decl_hathreads(HA_SPINLOCK_T locks[RL_LOCKS]);
+};
+
+/* all the rules' tables, allocated once the number of threads is known */
+static struct list rate_limits = LIST_HEAD_INIT(rate_limits);
+
+/* Refills bucket <b> of <rl> up to now */
+static inline void rl_refill(const struct rate_limit *rl, struct rl_bucket *b)
+{
+	uint64_t max = (uint64_t)rl->burst * rl->period;
+	unsigned int elapsed = now_ms - b->last;
+
+	if ((uint64_t)elapsed * rl->rate >= max - b->credit)
+		b->credit = max;
+	else
+		b->credit += (uint64_t)elapsed * rl->rate;
+	b->last = now_ms;
+}
+
+/* Returns the bucket of <rl> for <hash> in set <set>, after having created
+ * it if needed, in which case it is full. The set's lock must be held.
+ */
+static struct rl_bucket *rl_get_bucket(struct rate_limit *rl, unsigned int set, uint64_t hash)
+{
+	struct rl_bucket *b = &rl->buckets[set * RL_WAYS];
+	struct rl_bucket *old = b;
+	int i;
+
+	for (i = 0; i < RL_WAYS; i++) {
+		if (b[i].hash == hash) {
+			rl_refill(rl, &b[i]);
+			return &b[i];
+		}
+		if (!b[i].hash || (int)(b[i].last - old->last) < 0)
+			old = &b[i];
+		if (!b[i].hash)
+			break;
+	}
+
+	old->hash = hash;
+	old->credit = (uint64_t)rl->burst * rl->period;
+	old->last = now_ms;
+	return old;
+}
+
+/* Gives <tokens> taken for <hash> back to their bucket if it still exists */
+static void rl_give_back(struct rate_limit *rl, uint64_t hash, unsigned int tokens)
+{
+	unsigned int set = hash & rl->set_mask;
+	struct rl_bucket *b = &rl->buckets[set * RL_WAYS];
+	uint64_t max = (uint64_t)rl->burst * rl->period;
+	int i;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &rl->locks[set & (RL_LOCKS - 1)]);
+	for (i = 0; i < RL_WAYS; i++) {
+		if (b[i].hash == hash) {
+			b[i].credit += (uint64_t)tokens * rl->period;
+			if (b[i].credit > max)
+				b[i].credit = max;
+			break;
+		}
+	}
+	HA_SPIN_UNLOCK(OTHER_LOCK, &rl->locks[set & (RL_LOCKS - 1)]);
+}
+
+/* Takes one token for <hash>. Returns non-zero on success, or zero if the
+ * key exceeds its rate.
+ */
+static int rl_take(struct rate_limit *rl, uint64_t hash)
+{
+	struct rl_local *local = &rl->local[tid * RL_LOCAL_SLOTS + (hash & (RL_LOCAL_SLOTS - 1))];
+	unsigned int set = hash & rl->set_mask;
+	struct rl_bucket *b;
+	unsigned int take;
+
+	if (local->hash == hash && local->tokens && tick_is_lt(now_ms, local->expire)) {
+		local->tokens--;
+		return 1;
+	}
+
+	/* the slot's tokens are given back before taking new ones */
+	if (local->tokens && local->hash != hash)
+		rl_give_back(rl, local->hash, local->tokens);
+
+	HA_SPIN_LOCK(OTHER_LOCK, &rl->locks[set & (RL_LOCKS - 1)]);
+	b = rl_get_bucket(rl, set, hash);
+	if (local->tokens && local->hash == hash)
+		b->credit += (uint64_t)local->tokens * rl->period;
+
+	take = MIN(rl->batch, b->credit / rl->period);
+	b->credit -= (uint64_t)take * rl->period;
+	HA_SPIN_UNLOCK(OTHER_LOCK, &rl->locks[set & (RL_LOCKS - 1)]);
+
+	local->hash = hash;
+	local->tokens = take ? take - 1 : 0;
+	local->expire = tick_add(now_ms, rl->local_ttl);
+	return take != 0;
+}
+
+/* This function executes the "rate-limit" action. It takes a token from the
+ * bucket of the rule's key and denies the request or the connection when
+ * there is none left. Requests without key are not limited. HTTP requests are
+ * denied with a 429 status code.
+ */
+static enum act_return rate_limit_action(struct act_rule *rule, struct proxy *px,
+                                         struct session *sess, struct stream *s, int flags)
+{
+	struct rate_limit *rl = rule->arg.act.p[0];
+	struct sample *smp;
+	uint64_t hash;
+
+	smp = sample_fetch_as_type(px, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, rl->expr, SMP_T_BIN);
+	if (!smp)
+		return ACT_RET_CONT;
+
+	hash = XXH64(smp->data.u.str.area, smp->data.u.str.data, 0);
+	if (!hash)
+		hash = 1;
+
+	if (rl_take(rl, hash))
+		return ACT_RET_CONT;
+
+	if (rule->from == ACT_F_HTTP_REQ)
+		s->txn->status = 429;
+	else if (rule->from == ACT_F_TCP_REQ_CON) {
+		/* nobody else accounts for the connections denied here */
+		_HA_ATOMIC_ADD(&sess->fe->fe_counters.denied_conn, 1);
+		if (sess->listener && sess->listener->counters)
+			_HA_ATOMIC_ADD(&sess->listener->counters->denied_conn, 1);
+	}
+	return ACT_RET_DENY;
+}
+
+static void release_rate_limit(struct act_rule *rule)
+{
+	struct rate_limit *rl = rule->arg.act.p[0];
+	int i;
+
+	if (!rl)
+		return;
+
+	LIST_DEL(&rl->list);
+	release_sample_expr(rl->expr);
+	for (i = 0; i < RL_LOCKS; i++)
+		HA_SPIN_DESTROY(&rl->locks[i]);
+	free(rl->buckets);
+	free(rl->local);
+	free(rl);
+}
+
+/* Parses the "rate-limit" action :
+ *
+ *   rate-limit <rate> per <period> key <sample> [burst <tokens>] [size <keys>]
+ *
+ * It returns ACT_RET_PRS_OK on success, ACT_RET_PRS_ERR on error.
+ */
+static enum act_parse_ret parse_rate_limit(const char **args, int *orig_arg, struct proxy *px,
+                                           struct act_rule *rule, char **err)
+{
+	struct rate_limit *rl;
+	unsigned int where;
+	const char *res;
+	char *end;
+	int cur_arg = *orig_arg;
+	int i;
+
+	switch (rule->from) {
+	case ACT_F_TCP_REQ_CON:
+		where = SMP_VAL_FE_CON_ACC;
+		break;
+	case ACT_F_TCP_REQ_CNT:
+		where = ((px->cap & PR_CAP_FE) ? SMP_VAL_FE_REQ_CNT : 0) |
+			((px->cap & PR_CAP_BE) ? SMP_VAL_BE_REQ_CNT : 0);
+		break;
+	case ACT_F_HTTP_REQ:
+		where = ((px->cap & PR_CAP_FE) ? SMP_VAL_FE_HRQ_HDR : 0) |
+			((px->cap & PR_CAP_BE) ? SMP_VAL_BE_HRQ_HDR : 0);
+		break;
+	default:
+		memprintf(err,
+			  "internal error, unexpected rule->from=%d, please report this bug!",
+			  rule->from);
+		return ACT_RET_PRS_ERR;
+	}
+
+	rl = calloc(1, sizeof(*rl));
+	if (!rl) {
+		memprintf(err, "out of memory");
+		return ACT_RET_PRS_ERR;
+	}
+	LIST_INIT(&rl->list);
+	rl->size = RL_DEF_SIZE;
+	for (i = 0; i < RL_LOCKS; i++)
+		HA_SPIN_INIT(&rl->locks[i]);
+	rule->arg.act.p[0] = rl;
+
+	rl->rate = strtoul(args[cur_arg], &end, 10);
+	if (!*args[cur_arg] || *end || !rl->rate) {
+		memprintf(err, "expects a rate in events per period as first argument");
+		goto error;
+	}
+	cur_arg++;
+
+	if (strcmp(args[cur_arg], "per") != 0 || !*args[cur_arg + 1]) {
+		memprintf(err, "expects 'per' followed by a period after the rate");
+		goto error;
+	}
+	res = parse_time_err(args[cur_arg + 1], &rl->period, TIME_UNIT_MS);
+	if (res == PARSE_TIME_OVER || res == PARSE_TIME_UNDER) {
+		memprintf(err, "timer overflow or underflow in period '%s'", args[cur_arg + 1]);
+		goto error;
+	}
+	else if (res) {
+		memprintf(err, "unexpected character '%c' in period", *res);
+		goto error;
+	}
+	if (!rl->period) {
+		memprintf(err, "the period must not be null");
+		goto error;
+	}
+	cur_arg += 2;
+
+	while (*args[cur_arg] && strcmp(args[cur_arg], "if") != 0 && strcmp(args[cur_arg], "unless") != 0) {
+		if (strcmp(args[cur_arg], "key") == 0) {
+			cur_arg++;
+			release_sample_expr(rl->expr);
+			rl->expr = sample_parse_expr((char **)args, &cur_arg, px->conf.args.file, px->conf.args.line,
+			                             err, &px->conf.args, NULL);
+			if (!rl->expr)
+				goto error;
+
+			if (!(rl->expr->fetch->val & where)) {
+				memprintf(err,
+					  "fetch method '%s' extracts information from '%s', none of which is available here",
+					  args[cur_arg - 1], sample_src_names(rl->expr->fetch->use));
+				goto error;
+			}
+		}
+		else if (strcmp(args[cur_arg], "burst") == 0) {
+			rl->burst = strtoul(args[cur_arg + 1], &end, 10);
+			if (!*args[cur_arg + 1] || *end || !rl->burst) {
+				memprintf(err, "'%s' expects a positive number of tokens", args[cur_arg]);
+				goto error;
+			}
+			cur_arg += 2;
+		}
+		else if (strcmp(args[cur_arg], "size") == 0) {
+			rl->size = strtoul(args[cur_arg + 1], &end, 10);
+			if (!*args[cur_arg + 1] || *end || !rl->size || rl->size > (1U << 30)) {
+				memprintf(err, "'%s' expects a number of keys between 1 and %u", args[cur_arg], 1U << 30);
+				goto error;
+			}
+			cur_arg += 2;
+		}
+		else {
+			memprintf(err, "unknown argument '%s', expects 'key', 'burst' or 'size'", args[cur_arg]);
+			goto error;
+		}
+	}
+
+	if (!rl->expr) {
+		memprintf(err, "expects a 'key' argument");
+		goto error;
+	}
+
+	if (!rl->burst)
+		rl->burst = rl->rate;
+
+	LIST_ADDQ(&rate_limits, &rl->list);
+	rule->action     = ACT_CUSTOM;
+	rule->action_ptr = rate_limit_action;
+	rule->release_ptr = release_rate_limit;
+	*orig_arg = cur_arg;
+	return ACT_RET_PRS_OK;
+
+  error:
+	release_rate_limit(rule);
+	rule->arg.act.p[0] = NULL;
+	return ACT_RET_PRS_ERR;
+}
+
+/* Allocates the tables of all the rules once the number of threads is known.
+ * The threads take up to a quarter of their share of the burst at once, and
+ * give back what is left after a 16th of the period.
+ */
+static int rate_limit_init()
+{
+	struct rate_limit *rl;
+	unsigned int sets;
+
+	list_for_each_entry(rl, &rate_limits, list) {
+		sets = 1;
+		while (sets * RL_WAYS < rl->size)
+			sets <<= 1;
+		rl->set_mask = sets - 1;
+
+		rl->batch = (global.nbthread > 1) ? rl->burst / (global.nbthread * 4) : 1;
+		if (!rl->batch)
+			rl->batch = 1;
+		rl->local_ttl = MAX(rl->period / 16, 1);
+
+		rl->buckets = calloc((size_t)sets * RL_WAYS, sizeof(*rl->buckets));
+		rl->local = calloc((size_t)global.nbthread * RL_LOCAL_SLOTS, sizeof(*rl->local));
+		if (!rl->buckets || !rl->local) {
+			ha_alert("Unable to allocate the rate-limit tables.\n");
+			return ERR_ALERT | ERR_FATAL;
+		}
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(rate_limit_init);
+
+static struct action_kw_list tcp_req_conn_actions = {ILH, {
+	{ "rate-limit", parse_rate_limit },
+	{ /* END */ }
+}};
+
+INITCALL1(STG_REGISTER, tcp_req_conn_keywords_register, &tcp_req_conn_actions);
+
+static struct action_kw_list tcp_req_cont_actions = {ILH, {
+	{ "rate-limit", parse_rate_limit },
+	{ /* END */ }
+}};
+
+INITCALL1(STG_REGISTER, tcp_req_cont_keywords_register, &tcp_req_cont_actions);
+
+static struct action_kw_list http_req_actions = {ILH, {
+	{ "rate-limit", parse_rate_limit },
+	{ /* END */ }
+}};
+
+INITCALL1(STG_REGISTER, http_req_keywords_register, &http_req_actions);
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
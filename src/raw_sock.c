@@ -161,7 +161,7 @@ int raw_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe,
 		 * limited to 4GB and that it's not enough per second.
 		 */
 		_HA_ATOMIC_ADD(&global.out_bytes, retval);
-		update_freq_ctr(&global.out_32bps, (retval + 16) / 32);
+		update_freq_ctr_thr(&global.out_32bps, (retval + 16) / 32);
 	}
 	return retval;
 
@@ -416,7 +416,7 @@ static size_t raw_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 		 * limited to 4GB and that it's not enough per second.
 		 */
 		_HA_ATOMIC_ADD(&global.out_bytes, done);
-		update_freq_ctr(&global.out_32bps, (done + 16) / 32);
+		update_freq_ctr_thr(&global.out_32bps, (done + 16) / 32);
 	}
 	return done;
 }
@@ -18,11 +18,16 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <common/buf.h>
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/hathreads.h>
+#include <common/standard.h>
 #include <types/applet.h>
 #include <proto/cli.h>
 #include <proto/ring.h>
@@ -51,6 +56,8 @@ struct ring *ring_new(size_t size)
 	LIST_INIT(&ring->waiters);
 	ring->readers_count = 0;
 	ring->ofs = 0;
+	ring->storage = NULL;
+	ring->storage_size = 0;
 	ring->buf = b_make(area, size, 0, 0);
 	/* write the initial RC byte */
 	b_putchr(&ring->buf, 0);
@@ -64,7 +71,10 @@ struct ring *ring_new(size_t size)
 /* Resizes existing ring <ring> to <size> which must be larger, without losing
  * its contents. The new size must be at least as large as the previous one or
  * no change will be performed. The pointer to the ring is returned on success,
- * or NULL on allocation failure. This will lock the ring for writes.
+ * or NULL on allocation failure. This will lock the ring for writes, but
+ * since messages are copied outside of the lock, this must only be done
+ * before the ring is used by other threads (e.g. during the configuration
+ * parsing). A ring backed by a file cannot be resized.
  */
 struct ring *ring_resize(struct ring *ring, size_t size)
 {
@@ -73,6 +83,9 @@ struct ring *ring_resize(struct ring *ring, size_t size)
 	if (b_size(&ring->buf) >= size)
 		return ring;
 
+	if (ring->storage)
+		return NULL;
+
 	area = malloc(size);
 	if (!area)
 		return NULL;
@@ -99,17 +112,131 @@ void ring_free(struct ring *ring)
 {
 	if (!ring)
 		return;
-	free(ring->buf.area);
+	if (ring->storage)
+		munmap(ring->storage, ring->storage_size);
+	else
+		free(ring->buf.area);
 	free(ring);
 }
 
+/* Reports the buffer's position of <ring> to its file's header, if any, for
+ * the external readers. It must be called under the ring's write lock.
+ */
+static inline void ring_sync_storage(struct ring *ring)
+{
+	struct ring_storage *storage = ring->storage;
+
+	if (!storage)
+		return;
+
+	storage->seq++;
+	__ha_barrier_store();
+	storage->ofs  = ring->ofs;
+	storage->head = ring->buf.head;
+	storage->data = ring->buf.data;
+	__ha_barrier_store();
+	storage->seq++;
+}
+
+/* Moves the storage area of <ring> to the file <path>, created with the
+ * current size of the ring, so that external processes may read the messages
+ * in place. The file is prepared under a temporary name then renamed, so that
+ * the readers of a previous process never see a partial one. As for resizing,
+ * this must be done before the ring is used by other threads. Returns non-zero
+ * on success, otherwise zero with <err> filled.
+ */
+int ring_set_backing_file(struct ring *ring, const char *path, char **err)
+{
+	struct ring_storage *storage;
+	size_t size = b_size(&ring->buf);
+	size_t map_size = sizeof(*storage) + size;
+	char *tmp = NULL;
+	void *area;
+	int fd = -1;
+
+	if (ring->storage) {
+		memprintf(err, "ring already has a backing file");
+		return 0;
+	}
+
+	if (!memprintf(&tmp, "%s.%d.tmp", path, (int)getpid())) {
+		memprintf(err, "out of memory");
+		return 0;
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0 || ftruncate(fd, map_size) < 0) {
+		memprintf(err, "cannot create '%s' : %s", tmp, strerror(errno));
+		goto fail;
+	}
+
+	area = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED) {
+		memprintf(err, "cannot map '%s' : %s", tmp, strerror(errno));
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	storage = area;
+	storage->magic    = RING_STORAGE_MAGIC;
+	storage->version  = RING_STORAGE_VERSION;
+	storage->hdr_size = sizeof(*storage);
+	storage->size     = size;
+	storage->pid      = getpid();
+
+	HA_RWLOCK_WRLOCK(LOGSRV_LOCK, &ring->lock);
+	b_getblk(&ring->buf, (char *)(storage + 1), ring->buf.data, 0);
+	area = HA_ATOMIC_XCHG(&ring->buf.area, (char *)(storage + 1));
+	ring->buf.head = 0;
+	ring->storage = storage;
+	ring->storage_size = map_size;
+	ring_sync_storage(ring);
+	HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
+	free(area);
+
+	if (rename(tmp, path) < 0) {
+		memprintf(err, "cannot rename '%s' to '%s' : %s", tmp, path, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		return 0;
+	}
+	free(tmp);
+	return 1;
+
+ fail:
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	return 0;
+}
+
+/* Copies <len> bytes from <blk> to <pos> in the storage area of <buf>, wrapping
+ * at its end if needed, and returns the position following the copied bytes.
+ * It does not update the buffer, whose room must have been reserved.
+ */
+static inline char *ring_putblk(struct buffer *buf, char *pos, const char *blk, size_t len)
+{
+	size_t half = b_wrap(buf) - pos;
+
+	if (len >= half) {
+		memcpy(pos, blk, half);
+		blk += half;
+		len -= half;
+		pos = b_orig(buf);
+	}
+	memcpy(pos, blk, len);
+	return pos + len;
+}
+
 /* Tries to send <npfx> parts from <prefix> followed by <nmsg> parts from <msg>
  * to ring <ring>. The message is sent atomically. It may be truncated to
  * <maxlen> bytes if <maxlen> is non-null. There is no distinction between the
  * two lists, it's just a convenience to help the caller prepend some prefixes
- * when necessary. It takes the ring's write lock to make sure no other thread
- * will touch the buffer during the update. Returns the number of bytes sent,
- * or <=0 on failure.
+ * when necessary. It only takes the ring's write lock to reserve the room for
+ * the message, whose payload is then copied without the lock and committed
+ * (see types/ring.h). Returns the number of bytes sent, or <=0 on failure.
  */
 ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], size_t npfx, const struct ist msg[], size_t nmsg)
 {
@@ -119,7 +246,7 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 	size_t lenlen;
 	uint64_t dellen;
 	int dellenlen;
-	ssize_t sent = 0;
+	char *rc, *pos;
 	int i;
 
 	/* we have to find some room to add our message (the buffer is
@@ -142,7 +269,7 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 
 	HA_RWLOCK_WRLOCK(LOGSRV_LOCK, &ring->lock);
 	if (lenlen + totlen + 1 + 1 > b_size(buf))
-		goto done_buf;
+		goto fail;
 
 	while (b_room(buf) < lenlen + totlen + 1) {
 		/* we need to delete the oldest message (from the end),
@@ -153,19 +280,29 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 		 * payload (0 bytes min).
 		 */
 		if (*b_head(buf))
-			goto done_buf;
+			goto fail;
 		dellenlen = b_peek_varint(buf, 1, &dellen);
 		if (!dellenlen)
-			goto done_buf;
+			goto fail;
 		BUG_ON(b_data(buf) < 1 + dellenlen + dellen);
 
 		b_del(buf, 1 + dellenlen + dellen);
 		ring->ofs += 1 + dellenlen + dellen;
 	}
 
-	/* OK now we do have room */
+	/* OK now we do have room, let's reserve it: readers will not go past
+	 * the previous counter until we commit, nor will writers delete it.
+	 */
+	rc = b_peek(buf, b_data(buf) - 1);
+	HA_ATOMIC_OR(rc, RING_RC_UNCOMMITTED);
 	__b_put_varint(buf, totlen);
+	pos = b_tail(buf);
+	buf->data += totlen;
+	*b_tail(buf) = 0; buf->data++; // new read counter
+	ring_sync_storage(ring);
+	HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
 
+	/* the reserved room cannot move nor be reused until committed */
 	totlen = 0;
 	for (i = 0; i < npfx; i++) {
 		size_t len = pfx[i].len;
@@ -173,7 +310,7 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 		if (len + totlen > maxlen)
 			len = maxlen - totlen;
 		if (len)
-			__b_putblk(buf, pfx[i].ptr, len);
+			pos = ring_putblk(buf, pos, pfx[i].ptr, len);
 		totlen += len;
 	}
 
@@ -183,20 +320,27 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 		if (len + totlen > maxlen)
 			len = maxlen - totlen;
 		if (len)
-			__b_putblk(buf, msg[i].ptr, len);
+			pos = ring_putblk(buf, pos, msg[i].ptr, len);
 		totlen += len;
 	}
 
-	*b_tail(buf) = 0; buf->data++;; // new read counter
-	sent = lenlen + totlen + 1;
+	/* commit the message (full barrier) */
+	HA_ATOMIC_AND(rc, ~RING_RC_UNCOMMITTED);
 
 	/* notify potential readers */
-	list_for_each_entry(appctx, &ring->waiters, wait_entry)
-		appctx_wakeup(appctx);
+	if (!LIST_ISEMPTY(&ring->waiters)) {
+		HA_RWLOCK_RDLOCK(LOGSRV_LOCK, &ring->lock);
+		list_for_each_entry(appctx, &ring->waiters, wait_entry)
+			appctx_wakeup(appctx);
+		HA_RWLOCK_RDUNLOCK(LOGSRV_LOCK, &ring->lock);
+	}
+	return lenlen + totlen + 1;
 
- done_buf:
+ fail:
+	/* some messages may have been deleted */
+	ring_sync_storage(ring);
 	HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
-	return sent;
+	return 0;
 }
 
 /* Tries to attach appctx <appctx> as a new reader on ring <ring>. This is
@@ -211,7 +355,7 @@ int ring_attach(struct ring *ring)
 	int users = ring->readers_count;
 
 	do {
-		if (users >= 255)
+		if (users >= RING_MAX_READERS)
 			return 0;
 	} while (!_HA_ATOMIC_CAS(&ring->readers_count, &users, users + 1));
 	return 1;
@@ -247,7 +391,7 @@ int ring_attach_cli(struct ring *ring, struct appctx *appctx)
 {
 	if (!ring_attach(ring))
 		return cli_err(appctx,
-		               "Sorry, too many watchers (255) on this ring buffer. "
+		               "Sorry, too many watchers (127) on this ring buffer. "
 		               "What could it have so interesting to attract so many watchers ?");
 
 	if (!appctx->io_handler)
@@ -318,7 +462,7 @@ int cli_io_handler_show_ring(struct appctx *appctx)
 	 * stop before the end (ret=0).
 	 */
 	ret = 1;
-	while (ofs + 1 < b_data(buf)) {
+	while (ofs + 1 < b_data(buf) && ring_msg_committed(buf, ofs)) {
 		cnt = 1;
 		len = b_peek_varint(buf, ofs + cnt, &msg_len);
 		if (!len)
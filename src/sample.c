@@ -16,10 +16,15 @@
 #include <arpa/inet.h>
 #include <stdio.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include <types/global.h>
 
 #include <common/chunk.h>
 #include <common/hash.h>
+#include <common/htx.h>
 #include <common/http.h>
 #include <common/initcall.h>
 #include <common/net_helper.h>
@@ -35,6 +40,7 @@
 #include <proto/sample.h>
 #include <proto/sink.h>
 #include <proto/stick_table.h>
+#include <proto/stream.h>
 #include <proto/vars.h>
 
 #include <import/sha1.h>
@@ -56,6 +62,9 @@ const char *smp_to_type[SMP_TYPES] = {
 /* static sample used in sample_process() when <p> is NULL */
 static THREAD_LOCAL struct sample temp_smp;
 
+/* memoized fetches of the streams */
+DECLARE_STATIC_POOL(pool_head_smp_memo, "smp_memo", sizeof(struct smp_memo));
+
 /* list head of all known sample fetch keywords */
 static struct sample_fetch_kw_list sample_fetches = {
 	.list = LIST_HEAD_INIT(sample_fetches.list)
@@ -1024,6 +1033,248 @@ out_error:
 	goto out;
 }
 
+/* Forgets all the values remembered in <memo>. */
+static void smp_memo_clear(struct smp_memo *memo)
+{
+	int i;
+
+	for (i = 0; i < SMP_MEMO_ENTRIES; i++)
+		memo->ent[i].fetch = NULL;
+	memo->rec = NULL;
+	memo->next = 0;
+	memo->used = 0;
+}
+
+/* Forgets the fetches memoized by stream <s>. This must be called before any
+ * action which may modify the messages in place, since such changes are not
+ * always visible in the messages' signature.
+ */
+void smp_memo_reset(struct stream *s)
+{
+	if (s->smp_memo)
+		smp_memo_clear(s->smp_memo);
+}
+
+/* Releases the fetches memoized by stream <s>. */
+void smp_memo_release(struct stream *s)
+{
+	pool_free(pool_head_smp_memo, s->smp_memo);
+	s->smp_memo = NULL;
+}
+
+/* Fills <sig> with the signature of the messages of stream <s>. It changes as
+ * soon as blocks are added, moved or resized, or data are received or sent.
+ */
+static inline void smp_memo_sig(const struct stream *s, uint32_t *sig)
+{
+	if (IS_HTX_STRM(s)) {
+		const struct htx *req = htxbuf(&s->req.buf);
+		const struct htx *res = htxbuf(&s->res.buf);
+
+		sig[0] = req->gen;
+		sig[1] = req->data;
+		sig[2] = res->gen;
+		sig[3] = res->data;
+	}
+	else {
+		sig[0] = s->req.total;
+		sig[1] = b_data(&s->req.buf);
+		sig[2] = s->res.total;
+		sig[3] = b_data(&s->res.buf);
+	}
+}
+
+/* Returns non-zero if the arguments lists <a> and <b> are equal. Only the
+ * strings and integers are compared, other types are considered different.
+ */
+int smp_args_eq(const struct arg *a, const struct arg *b)
+{
+	if (a == b)
+		return 1;
+	if (!a || !b)
+		return 0;
+
+	for (;; a++, b++) {
+		if (a->type != b->type)
+			return 0;
+		switch (a->type) {
+		case ARGT_STOP:
+			return 1;
+		case ARGT_SINT:
+			if (a->data.sint != b->data.sint)
+				return 0;
+			break;
+		case ARGT_STR:
+			if (a->data.str.data != b->data.str.data ||
+			    memcmp(a->data.str.area, b->data.str.area, a->data.str.data) != 0)
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+}
+
+/* Returns non-zero if <ptr> points into one of the channels' buffers of
+ * stream <s>.
+ */
+static inline int smp_memo_in_buf(const struct stream *s, const char *ptr)
+{
+	return (ptr >= b_orig(&s->req.buf) && ptr < b_orig(&s->req.buf) + b_size(&s->req.buf)) ||
+	       (ptr >= b_orig(&s->res.buf) && ptr < b_orig(&s->res.buf) + b_size(&s->res.buf));
+}
+
+/* Records the result <ret> of the fetch called for <smp> into the entry being
+ * recorded in <memo>. The recording is abandoned if the value may change or
+ * cannot be kept.
+ */
+static void smp_memo_record(struct smp_memo *memo, struct sample *smp, int ret)
+{
+	struct smp_memo_ent *ent = memo->rec;
+	struct sample_data *data;
+
+	if (smp->flags & SMP_F_MAY_CHANGE)
+		goto abort;
+
+	if (!ret) {
+		ent->end = smp->flags;
+		ent->nb = ent->cnt;
+		memo->rec = NULL;
+		return;
+	}
+
+	if (ent->cnt == SMP_MEMO_VALUES)
+		goto abort;
+
+	data = &ent->data[ent->cnt];
+	*data = smp->data;
+	switch (data->type) {
+	case SMP_T_BOOL:
+	case SMP_T_SINT:
+	case SMP_T_IPV4:
+	case SMP_T_IPV6:
+		break;
+	case SMP_T_STR:
+	case SMP_T_BIN:
+		/* the messages cannot change without the signature changing */
+		if ((smp->flags & SMP_F_CONST) && smp_memo_in_buf(smp->strm, data->u.str.area))
+			break;
+		if (data->u.str.data > SMP_MEMO_AREA - memo->used)
+			goto abort;
+		memcpy(memo->area + memo->used, data->u.str.area, data->u.str.data);
+		data->u.str.area = memo->area + memo->used;
+		data->u.str.size = data->u.str.data;
+		memo->used += data->u.str.data;
+		break;
+	default:
+		goto abort;
+	}
+
+	ent->flags[ent->cnt++] = smp->flags;
+	if (!(smp->flags & SMP_F_NOT_LAST)) {
+		ent->end = smp->flags;
+		ent->nb = ent->cnt;
+		memo->rec = NULL;
+	}
+	return;
+
+  abort:
+	ent->fetch = NULL;
+	memo->rec = NULL;
+}
+
+/* Returns into <smp> the value <idx> remembered in <ent>, or 0 if there are
+ * no more values, exactly as the fetch did.
+ */
+static int smp_memo_replay(struct smp_memo_ent *ent, int idx, struct sample *smp)
+{
+	if (idx >= ent->nb) {
+		smp->flags = ent->end & ~SMP_F_NOT_LAST;
+		return 0;
+	}
+
+	smp->data = ent->data[idx];
+	smp->flags = ent->flags[idx];
+	if (smp->data.type == SMP_T_STR || smp->data.type == SMP_T_BIN)
+		smp->flags |= SMP_F_CONST;
+
+	/* no fetch will ever see this context, it only serves to continue */
+	smp->ctx.a[0] = ent;
+	smp->ctx.a[1] = (void *)(long)(idx + 1);
+	return 1;
+}
+
+/* Calls the fetch of expression <expr> for sample <smp> on behalf of an ACL,
+ * or replays the values it returned for the previous ACLs if the messages did
+ * not change since. The iterations are replayed as well, by tagging the
+ * sample's context with the entry it comes from. Returns the fetch's result.
+ */
+static int smp_memo_fetch(struct sample_expr *expr, struct sample *smp)
+{
+	struct stream *s = smp->strm;
+	struct smp_memo *memo = s->smp_memo;
+	struct smp_memo_ent *ent;
+	uint32_t sig[4];
+	int ret, i;
+
+	if (!memo) {
+		memo = s->smp_memo = pool_alloc(pool_head_smp_memo);
+		if (!memo)
+			goto fetch;
+		smp_memo_clear(memo);
+		memset(memo->sig, 0, sizeof(memo->sig));
+	}
+
+	smp_memo_sig(s, sig);
+	if (memcmp(sig, memo->sig, sizeof(sig)) != 0) {
+		smp_memo_clear(memo);
+		memcpy(memo->sig, sig, sizeof(sig));
+	}
+
+	if (smp->flags & SMP_F_NOT_LAST) {
+		/* next occurrence of an iteration */
+		ent = smp->ctx.a[0];
+		if (ent >= memo->ent && ent < memo->ent + SMP_MEMO_ENTRIES) {
+			if (ent->fetch == expr->fetch && ent->nb >= 0)
+				return smp_memo_replay(ent, (long)smp->ctx.a[1], smp);
+			/* forgotten in the middle of the iteration */
+			smp->flags &= ~SMP_F_NOT_LAST;
+			return 0;
+		}
+
+		ret = expr->fetch->process(expr->arg_p, smp, expr->fetch->kw, expr->fetch->private);
+		if (memo->rec && memo->rec_smp == smp)
+			smp_memo_record(memo, smp, ret);
+		return ret;
+	}
+
+	for (i = 0; i < SMP_MEMO_ENTRIES; i++) {
+		ent = &memo->ent[i];
+		if (ent->fetch == expr->fetch && ent->nb >= 0 &&
+		    ent->opt == smp->opt && ent->px == smp->px &&
+		    smp_args_eq(ent->args, expr->arg_p))
+			return smp_memo_replay(ent, 0, smp);
+	}
+
+	ret = expr->fetch->process(expr->arg_p, smp, expr->fetch->kw, expr->fetch->private);
+
+	ent = &memo->ent[memo->next];
+	memo->next = (memo->next + 1) % SMP_MEMO_ENTRIES;
+	ent->fetch = expr->fetch;
+	ent->args  = expr->arg_p;
+	ent->px    = smp->px;
+	ent->opt   = smp->opt;
+	ent->nb    = -1;
+	ent->cnt   = 0;
+	memo->rec  = ent;
+	memo->rec_smp = smp;
+	smp_memo_record(memo, smp, ret);
+	return ret;
+
+  fetch:
+	return expr->fetch->process(expr->arg_p, smp, expr->fetch->kw, expr->fetch->private);
+}
+
 /*
  * Process a fetch + format conversion of defined by the sample expression <expr>
  * on request or response considering the <opt> parameter.
@@ -1060,7 +1311,13 @@ struct sample *sample_process(struct proxy *px, struct session *sess,
 	}
 
 	smp_set_owner(p, px, sess, strm, opt);
-	if (!expr->fetch->process(expr->arg_p, p, expr->fetch->kw, expr->fetch->private))
+
+	/* only the ACLs, which iterate, use the memoized fetches */
+	if ((expr->fetch->flags & SMP_FETCH_F_MEMO) && (opt & SMP_OPT_ITERATE) && strm) {
+		if (!smp_memo_fetch(expr, p))
+			return NULL;
+	}
+	else if (!expr->fetch->process(expr->arg_p, p, expr->fetch->kw, expr->fetch->private))
 		return NULL;
 
 	list_for_each_entry(conv_expr, &expr->conv_exprs, list) {
@@ -1885,6 +2142,25 @@ static int sample_conv_bin2hex(const struct arg *arg_p, struct sample *smp, void
 	int ptr = 0;
 
 	trash->data = 0;
+#if defined(__SSE2__)
+	/* 16 bytes at once: the nibbles are turned into '0'..'9' and 'A'..'F'
+	 * then interleaved.
+	 */
+	while (ptr + 16 <= smp->data.u.str.data && trash->data + 32 <= trash->size) {
+		__m128i v  = _mm_loadu_si128((const __m128i *)(smp->data.u.str.area + ptr));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+		__m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+
+		hi = _mm_add_epi8(_mm_add_epi8(hi, _mm_set1_epi8('0')),
+		                  _mm_and_si128(_mm_cmpgt_epi8(hi, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10)));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, _mm_set1_epi8('0')),
+		                  _mm_and_si128(_mm_cmpgt_epi8(lo, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10)));
+		_mm_storeu_si128((__m128i *)(trash->area + trash->data), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(trash->area + trash->data + 16), _mm_unpackhi_epi8(hi, lo));
+		trash->data += 32;
+		ptr += 16;
+	}
+#endif
 	while (ptr < smp->data.u.str.data && trash->data <= trash->size - 2) {
 		c = smp->data.u.str.area[ptr++];
 		trash->area[trash->data++] = hextab[(c >> 4) & 0xF];
@@ -1933,31 +2209,55 @@ static int sample_conv_length(const struct arg *arg_p, struct sample *smp, void
 }
 
 
-static int sample_conv_str2lower(const struct arg *arg_p, struct sample *smp, void *private)
+/* Adds <delta> to all the chars of the <len> bytes string <str> which are
+ * within <from> and <to> included, which must both be ASCII letters. The
+ * vector variants rely on the bytes above 0x7f being negative, thus below
+ * <from>.
+ */
+static inline void smp_str_shift_range(char *str, size_t len, char from, char to, char delta)
 {
-	int i;
+	size_t i = 0;
 
+#if defined(__AVX2__)
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+		__m256i m = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(from - 1)),
+		                             _mm256_cmpgt_epi8(_mm256_set1_epi8(to + 1), v));
+
+		_mm256_storeu_si256((__m256i *)(str + i),
+		                    _mm256_add_epi8(v, _mm256_and_si256(m, _mm256_set1_epi8(delta))));
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+		__m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(from - 1)),
+		                          _mm_cmpgt_epi8(_mm_set1_epi8(to + 1), v));
+
+		_mm_storeu_si128((__m128i *)(str + i), _mm_add_epi8(v, _mm_and_si128(m, _mm_set1_epi8(delta))));
+	}
+#endif
+	for (; i < len; i++) {
+		if ((str[i] >= from) && (str[i] <= to))
+			str[i] += delta;
+	}
+}
+
+static int sample_conv_str2lower(const struct arg *arg_p, struct sample *smp, void *private)
+{
 	if (!smp_make_rw(smp))
 		return 0;
 
-	for (i = 0; i < smp->data.u.str.data; i++) {
-		if ((smp->data.u.str.area[i] >= 'A') && (smp->data.u.str.area[i] <= 'Z'))
-			smp->data.u.str.area[i] += 'a' - 'A';
-	}
+	smp_str_shift_range(smp->data.u.str.area, smp->data.u.str.data, 'A', 'Z', 'a' - 'A');
 	return 1;
 }
 
 static int sample_conv_str2upper(const struct arg *arg_p, struct sample *smp, void *private)
 {
-	int i;
-
 	if (!smp_make_rw(smp))
 		return 0;
 
-	for (i = 0; i < smp->data.u.str.data; i++) {
-		if ((smp->data.u.str.area[i] >= 'a') && (smp->data.u.str.area[i] <= 'z'))
-			smp->data.u.str.area[i] += 'A' - 'a';
-	}
+	smp_str_shift_range(smp->data.u.str.area, smp->data.u.str.data, 'a', 'z', 'A' - 'a');
 	return 1;
 }
 
@@ -3658,8 +3958,8 @@ static int smp_fetch_uuid(const struct arg *args, struct sample *smp, const char
  * instance IPv4/IPv6 must be declared IPv4.
  */
 static struct sample_fetch_kw_list smp_kws = {ILH, {
-	{ "always_false", smp_fetch_false, 0,            NULL, SMP_T_BOOL, SMP_USE_INTRN },
-	{ "always_true",  smp_fetch_true,  0,            NULL, SMP_T_BOOL, SMP_USE_INTRN },
+	{ "always_false", smp_fetch_false, 0,            NULL, SMP_T_BOOL, SMP_USE_INTRN, .flags = SMP_FETCH_F_PURE },
+	{ "always_true",  smp_fetch_true,  0,            NULL, SMP_T_BOOL, SMP_USE_INTRN, .flags = SMP_FETCH_F_PURE },
 	{ "env",          smp_fetch_env,   ARG1(1,STR),  NULL, SMP_T_STR,  SMP_USE_INTRN },
 	{ "date",         smp_fetch_date,  ARG2(0,SINT,STR), smp_check_date_unit, SMP_T_SINT, SMP_USE_INTRN },
 	{ "date_us",      smp_fetch_date_us,  0,         NULL, SMP_T_SINT, SMP_USE_INTRN },
@@ -45,6 +45,9 @@
 #include <proto/stats.h>
 #include <proto/task.h>
 #include <proto/dns.h>
+#ifdef USE_QUIC
+#include <proto/xprt_quic.h>
+#endif
 #include <netinet/tcp.h>
 
 #include <ebsttree.h>
@@ -274,6 +277,14 @@ static int srv_parse_backup(char **args, int *cur_arg,
 	return 0;
 }
 
+/* Parse the "adaptive-maxconn" server keyword */
+static int srv_parse_adaptive_maxconn(char **args, int *cur_arg,
+                                      struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	newsrv->flags |= SRV_F_ADAPTIVE;
+	return 0;
+}
+
 
 /* Parse the "cookie" server keyword */
 static int srv_parse_cookie(char **args, int *cur_arg,
@@ -330,6 +341,39 @@ static int srv_parse_max_reuse(char **args, int *cur_arg, struct proxy *curproxy
 	return 0;
 }
 
+/* Parse the "happy-eyeballs" server keyword */
+static int srv_parse_happy_eyeballs(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	const char *res;
+	char *arg;
+	unsigned int time;
+
+	arg = args[*cur_arg + 1];
+	if (!*arg) {
+		memprintf(err, "'%s' expects <delay> as argument.\n", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	res = parse_time_err(arg, &time, TIME_UNIT_MS);
+	if (res == PARSE_TIME_OVER) {
+		memprintf(err, "timer overflow in argument '%s' to '%s' (maximum value is 2147483647 ms or ~24.8 days)",
+			  args[*cur_arg+1], args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (res == PARSE_TIME_UNDER) {
+		memprintf(err, "timer underflow in argument '%s' to '%s' (minimum non-null value is 1 ms)",
+			  args[*cur_arg+1], args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (res) {
+		memprintf(err, "unexpected character '%c' in argument to <%s>.\n",
+		    *res, args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	newsrv->he_delay = time;
+
+	return 0;
+}
+
 static int srv_parse_pool_purge_delay(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
 {
 	const char *res;
@@ -381,6 +425,112 @@ static int srv_parse_pool_max_conn(char **args, int *cur_arg, struct proxy *curp
 	return 0;
 }
 
+/* parse the "pool-min-idle" server keyword */
+static int srv_parse_pool_min_idle(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	char *arg, *end;
+
+	arg = args[*cur_arg + 1];
+	if (!*arg) {
+		memprintf(err, "'%s' expects <value> as argument.\n", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	newsrv->min_idle_conns = strtoul(arg, &end, 10);
+	if (*end || *arg == '-') {
+		memprintf(err, "'%s' expects a positive integer value", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	return 0;
+}
+
+/* parse the "eject-errors", "eject-latency" and "eject-max-percent" server
+ * keywords, which all take a positive integer.
+ */
+static int srv_parse_eject_num(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	unsigned int val;
+	char *arg, *end;
+
+	arg = args[*cur_arg + 1];
+	if (!*arg) {
+		memprintf(err, "'%s' expects <value> as argument.\n", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	val = strtoul(arg, &end, 10);
+	if (*end || *arg == '-') {
+		memprintf(err, "'%s' expects a positive integer value", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	if (!strcmp(args[*cur_arg], "eject-errors"))
+		newsrv->eject_errors = val;
+	else if (!strcmp(args[*cur_arg], "eject-latency"))
+		newsrv->eject_latency = val;
+	else {
+		if (val > 100) {
+			memprintf(err, "'%s' expects a percentage between 0 and 100", args[*cur_arg]);
+			return ERR_ALERT | ERR_FATAL;
+		}
+		newsrv->eject_max_pct = val;
+	}
+	return 0;
+}
+
+/* parse the "eject-time" server keyword */
+static int srv_parse_eject_time(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	const char *res;
+	char *arg;
+	unsigned int time;
+
+	arg = args[*cur_arg + 1];
+	if (!*arg) {
+		memprintf(err, "'%s' expects <time> as argument.\n", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	res = parse_time_err(arg, &time, TIME_UNIT_MS);
+	if (res == PARSE_TIME_OVER) {
+		memprintf(err, "timer overflow in argument '%s' to '%s' (maximum value is 2147483647 ms or ~24.8 days)",
+			  args[*cur_arg+1], args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (res == PARSE_TIME_UNDER || (!res && !time)) {
+		memprintf(err, "timer underflow in argument '%s' to '%s' (minimum non-null value is 1 ms)",
+			  args[*cur_arg+1], args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	else if (res) {
+		memprintf(err, "unexpected character '%c' in argument to <%s>.\n",
+		    *res, args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	newsrv->eject_time = time;
+	return 0;
+}
+
+/* parse the "streams-per-conn" server keyword */
+static int srv_parse_streams_per_conn(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	char *arg, *end;
+
+	arg = args[*cur_arg + 1];
+	if (!*arg) {
+		memprintf(err, "'%s' expects <value> as argument.\n", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	newsrv->streams_per_conn = strtoul(arg, &end, 10);
+	if (*end || *arg == '-') {
+		memprintf(err, "'%s' expects a positive integer value", args[*cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	return 0;
+}
+
 /* parse the "id" server keyword */
 static int srv_parse_id(char **args, int *cur_arg, struct proxy *curproxy, struct server *newsrv, char **err)
 {
@@ -463,6 +613,14 @@ static int srv_parse_no_backup(char **args, int *cur_arg,
 	return 0;
 }
 
+/* Parse the "no-adaptive-maxconn" server keyword */
+static int srv_parse_no_adaptive_maxconn(char **args, int *cur_arg,
+                                         struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	newsrv->flags &= ~SRV_F_ADAPTIVE;
+	return 0;
+}
+
 
 /* Disable server PROXY protocol flags. */
 static inline int srv_disable_pp_flags(struct server *srv, unsigned int flags)
@@ -1249,13 +1407,20 @@ void srv_compute_all_admin_states(struct proxy *px)
  * Note: -1 as ->skip value means that the number of arguments are variable.
  */
 static struct srv_kw_list srv_kws = { "ALL", { }, {
+	{ "adaptive-maxconn",    srv_parse_adaptive_maxconn,    0,  1 }, /* Adapt the concurrency limit to the response times */
 	{ "backup",              srv_parse_backup,              0,  1 }, /* Flag as backup server */
 	{ "cookie",              srv_parse_cookie,              1,  1 }, /* Assign a cookie to the server */
 	{ "disabled",            srv_parse_disabled,            0,  1 }, /* Start the server in 'disabled' state */
+	{ "eject-errors",        srv_parse_eject_num,           1,  1 }, /* Eject the server after this number of consecutive failures */
+	{ "eject-latency",       srv_parse_eject_num,           1,  1 }, /* Eject the server slower than this times the backend */
+	{ "eject-max-percent",   srv_parse_eject_num,           1,  1 }, /* Max percentage of the backend's servers ejected at once */
+	{ "eject-time",          srv_parse_eject_time,          1,  1 }, /* Base time a server remains ejected */
 	{ "enabled",             srv_parse_enabled,             0,  1 }, /* Start the server in 'enabled' state */
+	{ "happy-eyeballs",      srv_parse_happy_eyeballs,      1,  1 }, /* Delay before trying the alternate resolved address */
 	{ "id",                  srv_parse_id,                  1,  0 }, /* set id# of server */
 	{ "max-reuse",           srv_parse_max_reuse,           1,  1 }, /* Set the max number of requests on a connection, -1 means unlimited */
 	{ "namespace",           srv_parse_namespace,           1,  1 }, /* Namespace the server socket belongs to (if supported) */
+	{ "no-adaptive-maxconn", srv_parse_no_adaptive_maxconn, 0,  1 }, /* Use the static concurrency limit */
 	{ "no-backup",           srv_parse_no_backup,           0,  1 }, /* Flag as non-backup server */
 	{ "no-send-proxy",       srv_parse_no_send_proxy,       0,  1 }, /* Disable use of PROXY V1 protocol */
 	{ "no-send-proxy-v2",    srv_parse_no_send_proxy_v2,    0,  1 }, /* Disable use of PROXY V2 protocol */
@@ -1263,6 +1428,7 @@ static struct srv_kw_list srv_kws = { "ALL", { }, {
 	{ "non-stick",           srv_parse_non_stick,           0,  1 }, /* Disable stick-table persistence */
 	{ "observe",             srv_parse_observe,             1,  1 }, /* Enables health adjusting based on observing communication with the server */
 	{ "pool-max-conn",       srv_parse_pool_max_conn,       1,  1 }, /* Set the max number of orphan idle connections, 0 means unlimited */
+	{ "pool-min-idle",       srv_parse_pool_min_idle,       1,  1 }, /* Set the number of idle connections per thread not purged */
 	{ "pool-purge-delay",    srv_parse_pool_purge_delay,    1,  1 }, /* Set the time before we destroy orphan idle connections, defaults to 1s */
 	{ "proto",               srv_parse_proto,               1,  1 }, /* Set the proto to use for all outgoing connections */
 	{ "proxy-v2-options",    srv_parse_proxy_v2_options,    1,  1 }, /* options for send-proxy-v2 */
@@ -1271,6 +1437,7 @@ static struct srv_kw_list srv_kws = { "ALL", { }, {
 	{ "send-proxy-v2",       srv_parse_send_proxy_v2,       0,  1 }, /* Enforce use of PROXY V2 protocol */
 	{ "source",              srv_parse_source,             -1,  1 }, /* Set the source address to be used to connect to the server */
 	{ "stick",               srv_parse_stick,               0,  1 }, /* Enable stick-table persistence */
+	{ "streams-per-conn",    srv_parse_streams_per_conn,    1,  1 }, /* Set the desired max number of streams per multiplexed connection */
 	{ "tfo",                 srv_parse_tfo,                 0,  1 }, /* enable TCP Fast Open of server */
 	{ "track",               srv_parse_track,               1,  1 }, /* Set the current state of the server, tracking another one */
 	{ "socks4",              srv_parse_socks4,              1,  1 }, /* Set the socks4 proxy of the server*/
@@ -1305,6 +1472,10 @@ void server_recalc_eweight(struct server *sv, int must_update)
 	else
 		w = px->lbprm.wdiv;
 
+	/* servers ejected by the outlier detection must not get any traffic */
+	if (tick_isset(sv->eject_exp))
+		w = 0;
+
 	sv->next_eweight = (sv->uweight * w + px->lbprm.wmult - 1) / px->lbprm.wmult;
 
 	/* propagate changes only if needed (i.e. not recursively) */
@@ -1695,6 +1866,10 @@ static void srv_settings_cpy(struct server *srv, struct server *src, int srv_tmp
 	if (src->trackit != NULL)
 		srv->trackit = strdup(src->trackit);
 	srv->consecutive_errors_limit = src->consecutive_errors_limit;
+	srv->eject_errors = src->eject_errors;
+	srv->eject_latency = src->eject_latency;
+	srv->eject_time = src->eject_time;
+	srv->eject_max_pct = src->eject_max_pct;
 	srv->uweight = srv->iweight   = src->iweight;
 
 	srv->check.send_proxy         = src->check.send_proxy;
@@ -1733,16 +1908,21 @@ static void srv_settings_cpy(struct server *srv, struct server *src, int srv_tmp
 #endif
 #ifdef TCP_USER_TIMEOUT
 	srv->tcp_ut = src->tcp_ut;
+	srv->notsent_lowat = src->notsent_lowat;
+	srv->he_delay = src->he_delay;
 #endif
 	srv->mux_proto = src->mux_proto;
 	srv->pool_purge_delay = src->pool_purge_delay;
 	srv->max_idle_conns = src->max_idle_conns;
+	srv->min_idle_conns = src->min_idle_conns;
 	srv->max_reuse = src->max_reuse;
+	srv->streams_per_conn = src->streams_per_conn;
 
 	if (srv_tmpl)
 		srv->srvrq = src->srvrq;
 
 	srv->check.via_socks4         = src->check.via_socks4;
+	srv->check.keep_alive         = src->check.keep_alive;
 	srv->socks4_addr              = src->socks4_addr;
 #ifdef USE_QUIC
 	srv->quic_params              = src->quic_params;
@@ -1782,7 +1962,7 @@ struct server *new_server(struct proxy *proxy)
 		srv->xprt  = srv->check.xprt = srv->agent.xprt = xprt_get(XPRT_RAW);
 	}
 #ifdef USE_QUIC
-	srv->cids = EB_ROOT_UNIQUE;
+	quic_cid_tree_init(&srv->cids);
 #endif
 
 	/* please don't put default server settings here, they are set in
@@ -3897,6 +4077,12 @@ int snr_resolution_cb(struct dns_requester *requester, struct dns_nameserver *na
 	update_server_addr(s, firstip, firstip_sin_family, (char *) chk->area);
 
  update_status:
+	if (s->he_delay) {
+		if (has_no_ip || resolution->status != RSLV_STATUS_VALID)
+			s->alt_addr.ss_family = AF_UNSPEC;
+		else
+			dns_get_alt_ip_from_response(&resolution->response, &s->addr, &s->alt_addr);
+	}
 	snr_update_srv_status(s, has_no_ip);
 	return 1;
 
@@ -4276,11 +4462,80 @@ struct server *cli_find_server(struct appctx *appctx, char *arg)
 
 
 /* grabs the server lock */
+static int cli_parse_set_server(char **args, char *payload, struct appctx *appctx, void *private);
+
+/* Applies the "set server" commands found in <payload>, one per line, each of
+ * them made of the arguments following "set server" (e.g. "bk/srv1 weight 10").
+ * The rebuilds of the LB structures are deferred until all of them are
+ * applied. The processing stops at the first failed command, which is reported
+ * with its line number, the previous ones remaining applied. It always
+ * returns 1.
+ */
+static int cli_parse_set_server_bulk(char *payload, struct appctx *appctx)
+{
+	char *args[MAX_STATS_ARGS + 1];
+	unsigned int st0 = appctx->st0;
+	struct proxy *px;
+	char *line, *next, *err = NULL;
+	int arg, linenum = 0;
+
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	for (px = proxies_list; px; px = px->next) {
+		if (px->cap & PR_CAP_BE)
+			lb_defer_updates(px);
+	}
+
+	for (line = payload; *line; line = next) {
+		linenum++;
+		next = line + strcspn(line, "\n");
+		if (*next)
+			*next++ = 0;
+
+		args[0] = "set";
+		args[1] = "server";
+		for (arg = 2; arg < MAX_STATS_ARGS; arg++) {
+			line += strspn(line, " \t");
+			if (!*line)
+				break;
+			args[arg] = line;
+			line += strcspn(line, " \t");
+			if (*line)
+				*line++ = 0;
+		}
+		if (arg == 2)
+			continue;
+		while (arg <= MAX_STATS_ARGS)
+			args[arg++] = "";
+
+		cli_parse_set_server(args, NULL, appctx, NULL);
+		if (appctx->st0 == CLI_ST_PRINT_ERR) {
+			memprintf(&err, "line %d: %s", linenum, appctx->ctx.cli.msg);
+			break;
+		}
+		/* notices and warnings are not reported for bulk updates */
+		appctx->st0 = st0;
+	}
+
+	for (px = proxies_list; px; px = px->next) {
+		if (px->cap & PR_CAP_BE)
+			lb_resume_updates(px);
+	}
+
+	if (err)
+		return cli_dynerr(appctx, err);
+	return 1;
+}
+
 static int cli_parse_set_server(char **args, char *payload, struct appctx *appctx, void *private)
 {
 	struct server *sv;
 	const char *warning;
 
+	if (!*args[2] && payload)
+		return cli_parse_set_server_bulk(payload, appctx);
+
 	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
 		return 1;
 
@@ -5272,6 +5527,9 @@ struct task *srv_cleanup_idle_connections(struct task *task, void *context, unsi
 		exceed_conns = srv->curr_used_conns + curr_idle -
 		               srv->max_used_conns;
 		exceed_conns = to_kill = exceed_conns / 2 + (exceed_conns & 1);
+		/* under memory pressure, all idle connections are killed */
+		if (unlikely(pool_mem_pressure))
+			exceed_conns = to_kill = curr_idle;
 		srv->max_used_conns = srv->curr_used_conns;
 
 		for (i = 0; i < global.nbthread && to_kill > 0; i++) {
@@ -5281,6 +5539,11 @@ struct task *srv_cleanup_idle_connections(struct task *task, void *context, unsi
 
 			max_conn = (exceed_conns * srv->curr_idle_thr[i]) /
 			           curr_idle + 1;
+
+			/* keep "pool-min-idle" connections ready on each thread */
+			if (!pool_mem_pressure &&
+			    max_conn > (int)(srv->curr_idle_thr[i] - srv->min_idle_conns))
+				max_conn = (int)(srv->curr_idle_thr[i] - srv->min_idle_conns);
 			HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
 			for (j = 0; j < max_conn; j++) {
 				struct connection *conn = MT_LIST_POP(&srv->idle_conns[i], struct connection *, list);
@@ -13,6 +13,8 @@
 
 #include <sys/mman.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <ebmbtree.h>
 #include <types/global.h>
 #include <common/mini-clist.h>
@@ -40,7 +42,7 @@ struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
 	int remain;
 
 	/* not enough usable blocks */
-	if (data_len > shctx->nbav * shctx->block_size)
+	if (data_len > (unsigned long long)shctx->nbav * shctx->block_size)
 		goto out;
 
 	/* Check the object size limit. */
@@ -288,11 +290,13 @@ int shctx_row_data_get(struct shared_context *shctx, struct shared_block *first,
 /* Allocate shared memory context.
  * <maxblocks> is maximum blocks.
  * If <maxblocks> is set to less or equal to 0, ssl cache is disabled.
+ * The area is anonymous memory, unless <fd> is a file descriptor, in which
+ * case it maps this file, which is resized accordingly.
  * Returns: -1 on alloc failure, <maxblocks> if it performs context alloc,
  * and 0 if cache is already allocated.
  */
-int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
-               unsigned int maxobjsz, int extra, int shared)
+static int __shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
+                        unsigned int maxobjsz, int extra, int shared, int fd)
 {
 	int i;
 	struct shared_context *shctx;
@@ -304,6 +308,7 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 #endif
 	void *cur;
 	int maptype = MAP_PRIVATE;
+	size_t size;
 
 	if (maxblocks <= 0)
 		return 0;
@@ -317,8 +322,19 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 		maptype = MAP_SHARED;
 #endif
 
-	shctx = (struct shared_context *)mmap(NULL, sizeof(struct shared_context) + extra + (maxblocks * (sizeof(struct shared_block) + blocksize)),
-	                                      PROT_READ | PROT_WRITE, maptype | MAP_ANON, -1, 0);
+	size = sizeof(struct shared_context) + extra + (maxblocks * (sizeof(struct shared_block) + blocksize));
+	if (fd >= 0) {
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0) {
+			shctx = NULL;
+			ret = SHCTX_E_ALLOC_CACHE;
+			goto err;
+		}
+		/* a private mapping would not write the data to the file */
+		shctx = (struct shared_context *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	else
+		shctx = (struct shared_context *)mmap(NULL, size, PROT_READ | PROT_WRITE, maptype | MAP_ANON, -1, 0);
+
 	if (!shctx || shctx == MAP_FAILED) {
 		shctx = NULL;
 		ret = SHCTX_E_ALLOC_CACHE;
@@ -331,7 +347,7 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 	if (maptype == MAP_SHARED) {
 #ifdef USE_PTHREAD_PSHARED
 		if (pthread_mutexattr_init(&attr)) {
-			munmap(shctx, sizeof(struct shared_context) + extra + (maxblocks * (sizeof(struct shared_block) + blocksize)));
+			munmap(shctx, size);
 			shctx = NULL;
 			ret = SHCTX_E_INIT_LOCK;
 			goto err;
@@ -339,7 +355,7 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 
 		if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) {
 			pthread_mutexattr_destroy(&attr);
-			munmap(shctx, sizeof(struct shared_context) + extra + (maxblocks * (sizeof(struct shared_block) + blocksize)));
+			munmap(shctx, size);
 			shctx = NULL;
 			ret = SHCTX_E_INIT_LOCK;
 			goto err;
@@ -347,7 +363,7 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 
 		if (pthread_mutex_init(&shctx->mutex, &attr)) {
 			pthread_mutexattr_destroy(&attr);
-			munmap(shctx, sizeof(struct shared_context) + extra + (maxblocks * (sizeof(struct shared_block) + blocksize)));
+			munmap(shctx, size);
 			shctx = NULL;
 			ret = SHCTX_E_INIT_LOCK;
 			goto err;
@@ -383,3 +399,31 @@ err:
 	return ret;
 }
 
+/* Allocate shared memory context, see __shctx_init() above. */
+int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
+               unsigned int maxobjsz, int extra, int shared)
+{
+	return __shctx_init(orig_shctx, maxblocks, blocksize, maxobjsz, extra, shared, -1);
+}
+
+/* Allocate a shared context stored in the file <path>, which is created if
+ * needed and whose previous contents are discarded. The data are paged in and
+ * out by the system, so that the context may be larger than the memory.
+ * The context is always shared between processes. Returns the same values as
+ * shctx_init(), or SHCTX_E_OPEN_FILE if the file cannot be opened.
+ */
+int shctx_init_file(struct shared_context **orig_shctx, const char *path, int maxblocks,
+                    int blocksize, unsigned int maxobjsz, int extra)
+{
+	int fd, ret;
+
+	*orig_shctx = NULL;
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return SHCTX_E_OPEN_FILE;
+
+	/* the mapping remains valid once the file is closed */
+	ret = __shctx_init(orig_shctx, maxblocks, blocksize, maxobjsz, extra, 1, fd);
+	close(fd);
+	return ret;
+}
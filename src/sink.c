@@ -19,10 +19,12 @@
  */
 
 #include <common/cfgparse.h>
+#include <common/chunk.h>
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/ist.h>
 #include <common/mini-clist.h>
+#include <common/net_helper.h>
 #include <common/time.h>
 #include <proto/cli.h>
 #include <proto/log.h>
@@ -147,6 +149,62 @@ struct sink *sink_new_buf(const char *name, const char *desc, enum sink_fmt fmt,
  * messages when there are any. It returns >0 if it could write anything,
  * <=0 otherwise.
  */
+/* Emits to <sink> the message made of the <nmsg> parts of <msg> as a single
+ * CBOR record, see log_build_cbor(). The records written to a file descriptor
+ * are prefixed with their length in network order. Returns the same as
+ * __sink_write().
+ */
+static ssize_t sink_write_cbor(struct sink *sink, const struct ist msg[], size_t nmsg,
+                               int level, int facility, struct ist *tag,
+                               struct ist *pid, struct ist *sd)
+{
+	struct buffer *line = NULL, *rec = NULL;
+	const char *ptr = msg[0].ptr;
+	size_t len = msg[0].len;
+	char *rec_ptr;
+	struct ist out[2];
+	char hdr[4];
+	ssize_t sent = 0;
+	size_t i;
+
+	rec = alloc_trash_chunk();
+	if (!rec)
+		goto end;
+
+	if (nmsg > 1) {
+		line = alloc_trash_chunk();
+		if (!line)
+			goto end;
+		for (i = 0; i < nmsg; i++)
+			chunk_memcat(line, msg[i].ptr, msg[i].len);
+		ptr = line->area;
+		len = line->data;
+	}
+
+	rec->data = log_build_cbor(rec->area, MIN(sink->maxlen, rec->size), &rec_ptr,
+	                           (facility << 3) + level,
+	                           tag ? tag->ptr : NULL, tag ? tag->len : 0,
+	                           pid ? pid->ptr : NULL, pid ? pid->len : 0,
+	                           sd ? sd->ptr : NULL, sd ? sd->len : 0,
+	                           ptr, len);
+	if (!rec->data)
+		goto end;
+
+	out[0] = ist2(rec_ptr, rec->data);
+	if (sink->type == SINK_TYPE_FD) {
+		write_n32(hdr, rec->data);
+		out[1] = out[0];
+		out[0] = ist2(hdr, 4);
+		sent = fd_write_frag_line(sink->ctx.fd, ~0, NULL, 0, out, 2, 0);
+	}
+	else if (sink->type == SINK_TYPE_BUFFER)
+		sent = ring_write(sink->ctx.ring, ~0, NULL, 0, out, 1);
+ end:
+	free_trash_chunk(line);
+	free_trash_chunk(rec);
+	return sent;
+}
+
 ssize_t __sink_write(struct sink *sink, const struct ist msg[], size_t nmsg,
 	             int level, int facility, struct ist *tag,
 		     struct ist *pid, struct ist *sd)
@@ -161,6 +219,9 @@ ssize_t __sink_write(struct sink *sink, const struct ist msg[], size_t nmsg,
 	if (sink->fmt == SINK_FMT_RAW)
 		goto send;
 
+	if (sink->fmt == SINK_FMT_CBOR)
+		return sink_write_cbor(sink, msg, nmsg, level, facility, tag, pid, sd);
+
 	if (sink->fmt == SINK_FMT_SHORT || sink->fmt == SINK_FMT_TIMED) {
 		short_hdr[0] = '<';
 		short_hdr[1] = '0' + level;
@@ -418,7 +479,7 @@ static void sink_forward_io_handler(struct appctx *appctx)
 	 */
 	if (si_opposite(si)->state == SI_ST_EST) {
 		ret = 1;
-		while (ofs + 1 < b_data(buf)) {
+		while (ofs + 1 < b_data(buf) && ring_msg_committed(buf, ofs)) {
 			cnt = 1;
 			len = b_peek_varint(buf, ofs + cnt, &msg_len);
 			if (!len)
@@ -558,7 +619,7 @@ static void sink_forward_oc_io_handler(struct appctx *appctx)
 	 */
 	if (si_opposite(si)->state == SI_ST_EST) {
 		ret = 1;
-		while (ofs + 1 < b_data(buf)) {
+		while (ofs + 1 < b_data(buf) && ring_msg_committed(buf, ofs)) {
 			cnt = 1;
 			len = b_peek_varint(buf, ofs + cnt, &msg_len);
 			if (!len)
@@ -851,7 +912,35 @@ int cfg_parse_ring(const char *file, int linenum, char **args, int kwm)
 
 		if (!cfg_sink || (cfg_sink->type != SINK_TYPE_BUFFER)
 		              || !ring_resize(cfg_sink->ctx.ring, size)) {
-			ha_alert("parsing [%s:%d] : fail to set sink buffer size '%s'.\n", file, linenum, args[1]);
+			ha_alert("parsing [%s:%d] : fail to set sink buffer size '%s' (it must be set before 'backing-file').\n", file, linenum, args[1]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto err;
+		}
+	}
+	else if (strcmp(args[0], "backing-file") == 0) {
+		char *err = NULL;
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d] : '%s' expects a file path.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto err;
+		}
+
+		if (!cfg_sink || (cfg_sink->type != SINK_TYPE_BUFFER)) {
+			ha_alert("parsing [%s:%d] : unable to set a backing file.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto err;
+		}
+
+		if (global.nbproc > 1) {
+			ha_alert("parsing [%s:%d] : '%s' is not supported with nbproc > 1.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto err;
+		}
+
+		if (!ring_set_backing_file(cfg_sink->ctx.ring, args[1], &err)) {
+			ha_alert("parsing [%s:%d] : unable to set backing file '%s' : %s.\n", file, linenum, args[1], err);
+			free(err);
 			err_code |= ERR_ALERT | ERR_FATAL;
 			goto err;
 		}
@@ -927,6 +1016,9 @@ int cfg_parse_ring(const char *file, int linenum, char **args, int kwm)
 		else if (strcmp(args[1], "rfc5424") == 0) {
 			cfg_sink->fmt = SINK_FMT_RFC5424;
 		}
+		else if (strcmp(args[1], "cbor") == 0) {
+			cfg_sink->fmt = SINK_FMT_CBOR;
+		}
 		else {
 			ha_alert("parsing [%s:%d] : unknown format '%s'.\n", file, linenum, args[1]);
 			err_code |= ERR_ALERT | ERR_FATAL;
@@ -1026,7 +1118,7 @@ int cfg_post_parse_ring()
 
 				/* mark server attached to the ring */
 				if (!ring_attach(cfg_sink->ctx.ring)) {
-					ha_alert("server '%s' sets too many watchers > 255 on ring '%s'.\n", srv->id, cfg_sink->name);
+					ha_alert("server '%s' sets too many watchers > 127 on ring '%s'.\n", srv->id, cfg_sink->name);
 					err_code |= ERR_ALERT | ERR_FATAL;
 				}
 				cfg_sink->sft = sft;
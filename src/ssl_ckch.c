@@ -38,6 +38,10 @@
 #include <proto/ssl_utils.h>
 #include <proto/stream_interface.h>
 
+#ifdef HAVE_SSL_CERT_COMP
+#include <zlib.h>
+#endif
+
 /* Uncommitted CKCH transaction */
 
 static struct {
@@ -743,10 +747,92 @@ void ckch_store_free(struct ckch_store *store)
 	list_for_each_entry_safe(inst, inst_s, &store->ckch_inst, by_ckchs) {
 		ckch_inst_free(inst);
 	}
+#ifdef HAVE_SSL_CERT_COMP
+	ckch_cert_comp_release(store->cert_comp);
+#endif
+	free(store->pem);
 	ebmb_delete(&store->node);
 	free(store);
 }
 
+#ifdef HAVE_SSL_CERT_COMP
+/*
+ * Return the compressed certificate chain of <store>, allocating it if needed,
+ * with a new reference the caller must release with ckch_cert_comp_release().
+ * Return NULL upon failure.
+ */
+struct ckch_cert_comp *ckch_store_get_cert_comp(struct ckch_store *store)
+{
+	if (!store->cert_comp) {
+		store->cert_comp = calloc(1, sizeof(*store->cert_comp));
+		if (!store->cert_comp)
+			return NULL;
+
+		/* This reference is owned by <store>. */
+		store->cert_comp->refcount = 1;
+	}
+
+	HA_ATOMIC_ADD(&store->cert_comp->refcount, 1);
+	return store->cert_comp;
+}
+
+/*
+ * Release a reference on <cc> compressed certificate chain, freeing it with
+ * its message once it is not referenced anymore.
+ */
+void ckch_cert_comp_release(struct ckch_cert_comp *cc)
+{
+	if (!cc || HA_ATOMIC_SUB(&cc->refcount, 1))
+		return;
+
+	free(cc->msg);
+	free(cc);
+}
+
+/*
+ * Return the zlib compression (RFC 8879) of the <msg> Certificate message of
+ * <len> bytes. The first compressed message of <cc> is cached, <*cached> being
+ * set when the returned one is this cached message, which must not be freed.
+ * Otherwise the caller must free() it. Return NULL upon failure.
+ */
+const struct ckch_cert_comp_msg *ckch_cert_comp_get_msg(struct ckch_cert_comp *cc,
+                                                        const unsigned char *msg, size_t len,
+                                                        int *cached)
+{
+	struct ckch_cert_comp_msg *m, *old;
+	uLongf comp_len;
+
+	*cached = 0;
+	m = cc->msg;
+	if (m && m->len == len && memcmp(m->data, msg, len) == 0) {
+		*cached = 1;
+		return m;
+	}
+
+	comp_len = compressBound(len);
+	m = malloc(sizeof(*m) + len + comp_len);
+	if (!m)
+		return NULL;
+
+	if (compress2(m->data + len, &comp_len, msg, len, Z_BEST_COMPRESSION) != Z_OK) {
+		free(m);
+		return NULL;
+	}
+
+	memcpy(m->data, msg, len);
+	m->len = len;
+	m->comp_len = comp_len;
+	/* Another thread may have cached its message first, in which case it
+	 * is never replaced, so that it may be used without any lock.
+	 */
+	old = NULL;
+	if (HA_ATOMIC_CAS(&cc->msg, &old, m))
+		*cached = 1;
+
+	return m;
+}
+#endif
+
 /*
  * create and initialize a ckch_store
  * <path> is the key name
@@ -887,6 +973,158 @@ end:
 }
 
 
+#ifdef USE_THREAD
+/* Work shared by the threads of ckchs_preload() */
+struct ckchs_preload_ctx {
+	char **paths;               /* files to load */
+	struct ckch_store **stores; /* the stores loaded from <paths>, or NULL */
+	unsigned int count;         /* number of <paths> */
+	unsigned int next;          /* next path to load */
+};
+
+/* Loads the stores of the ckchs_preload_ctx <arg> until there are no more. */
+static void *ckchs_preload_thread(void *arg)
+{
+	struct ckchs_preload_ctx *ctx = arg;
+	struct ckch_store *store;
+	struct stat st;
+	char *err = NULL;
+	unsigned int i;
+
+	/* some of the extra files are read into the trash */
+	if (!alloc_trash_buffers_per_thread())
+		goto end;
+
+	while ((i = HA_ATOMIC_XADD(&ctx->next, 1)) < ctx->count) {
+		if (stat(ctx->paths[i], &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		store = ckch_store_new(ctx->paths[i], 1);
+		if (!store)
+			continue;
+
+		if (ssl_sock_load_files_into_ckch(store->path, store->ckch, &err) == 1) {
+			/* the error will be reported by the regular loading */
+			ckch_store_free(store);
+			free(err);
+			err = NULL;
+			continue;
+		}
+		ctx->stores[i] = store;
+	}
+ end:
+	free_trash_buffers_per_thread();
+	return NULL;
+}
+#endif
+
+/*
+ * Loads in parallel in the ckchs tree the certificates of the <count> files of
+ * <paths> which are not there yet, so that they are found there once they are
+ * used. This is only done at boot, with "tune.ssl.load-threads" threads. The
+ * files which cannot be loaded are ignored, the error will be reported when
+ * they are loaded again by ckchs_load_cert_file(). Multi-cert bundles are not
+ * supported.
+ */
+void ckchs_preload(char **paths, int count)
+{
+#ifdef USE_THREAD
+	pthread_t threads[MAX_THREADS];
+	struct ckchs_preload_ctx ctx;
+	struct ebmb_node *node;
+	int nbthr, i;
+
+	ctx.paths = calloc(count, sizeof(*ctx.paths));
+	ctx.stores = calloc(count, sizeof(*ctx.stores));
+	ctx.count = ctx.next = 0;
+	if (!ctx.paths || !ctx.stores)
+		goto end;
+
+	for (i = 0; i < count; i++) {
+		if (!ckchs_lookup(paths[i]))
+			ctx.paths[ctx.count++] = paths[i];
+	}
+
+	nbthr = global_ssl.load_threads;
+	if (!nbthr)
+		nbthr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbthr > MAX_THREADS)
+		nbthr = MAX_THREADS;
+	if (nbthr > ctx.count)
+		nbthr = ctx.count;
+	if (nbthr <= 1)
+		goto end;
+
+	for (i = 0; i < nbthr; i++) {
+		if (pthread_create(&threads[i], NULL, ckchs_preload_thread, &ctx) != 0)
+			break;
+	}
+	nbthr = i;
+	for (i = 0; i < nbthr; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < ctx.count; i++) {
+		if (!ctx.stores[i])
+			continue;
+
+		/* the same file may be listed several times */
+		node = ebst_insert(&ckchs_tree, &ctx.stores[i]->node);
+		if (node != &ctx.stores[i]->node)
+			ckch_store_free(ctx.stores[i]);
+	}
+ end:
+	free(ctx.stores);
+	free(ctx.paths);
+#endif
+}
+
+/*
+ * This function allocates a ckch_store which only keeps the raw contents of
+ * the <path> PEM file, for a certificate loaded on demand. It is not indexed
+ * in the ckchs tree since it cannot be manipulated from the CLI.
+ */
+struct ckch_store *ckchs_new_lazy(char *path, char **err)
+{
+	struct ckch_store *ckchs = NULL;
+	struct stat st;
+	ssize_t ret;
+	size_t len = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		memprintf(err, "%scannot open the file '%s'.\n", err && *err ? *err : "", path);
+		goto end;
+	}
+
+	ckchs = ckch_store_new(path, 1);
+	if (ckchs)
+		ckchs->pem = malloc(st.st_size + 1);
+	if (!ckchs || !ckchs->pem) {
+		memprintf(err, "%sunable to allocate memory.\n", err && *err ? *err : "");
+		goto end;
+	}
+
+	while (len < st.st_size) {
+		ret = read(fd, ckchs->pem + len, st.st_size - len);
+		if (ret <= 0) {
+			memprintf(err, "%san error occurred while reading the file '%s'.\n",
+			          err && *err ? *err : "", path);
+			goto end;
+		}
+		len += ret;
+	}
+	ckchs->pem[len] = 0;
+	close(fd);
+	return ckchs;
+
+end:
+	if (fd >= 0)
+		close(fd);
+	ckch_store_free(ckchs);
+	return NULL;
+}
+
 /********************  ckch_inst functions ******************************/
 
 /* unlink a ckch_inst, free all SNIs, free the ckch_inst */
@@ -901,11 +1139,14 @@ void ckch_inst_free(struct ckch_inst *inst)
 	list_for_each_entry_safe(sni, sni_s, &inst->sni_ctx, by_ckch_inst) {
 		SSL_CTX_free(sni->ctx);
 		LIST_DEL(&sni->by_ckch_inst);
+		if (sni->name.node.leaf_p)
+			inst->bind_conf->sni_gen++;
 		ebmb_delete(&sni->name);
 		free(sni);
 	}
 	LIST_DEL(&inst->by_ckchs);
 	LIST_DEL(&inst->by_crtlist_entry);
+	LIST_DEL(&inst->by_lazy);
 	free(inst);
 }
 
@@ -921,6 +1162,7 @@ struct ckch_inst *ckch_inst_new()
 	LIST_INIT(&ckch_inst->sni_ctx);
 	LIST_INIT(&ckch_inst->by_ckchs);
 	LIST_INIT(&ckch_inst->by_crtlist_entry);
+	LIST_INIT(&ckch_inst->by_lazy);
 
 	return ckch_inst;
 }
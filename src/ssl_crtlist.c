@@ -321,6 +321,122 @@ error:
 
 
 
+/* Loads in parallel the <count> certificate files of <paths> (see
+ * ckchs_preload()), then frees them.
+ */
+static void crtlist_preload(char **paths, int count)
+{
+	ckchs_preload(paths, count);
+	while (count--)
+		free(paths[count]);
+	free(paths);
+}
+
+/* Loads in parallel the certificates of the lines of the crt-list file <f>
+ * before they are parsed one at a time, then rewinds it. This is not done when
+ * some of them may be loaded on demand.
+ */
+static void crtlist_preload_file(FILE *f)
+{
+	char thisline[CRT_LINESIZE];
+	char path[MAXPATHLEN+1];
+	char **paths = NULL, **new_paths;
+	int count = 0, size = 0;
+	char *line, *end;
+
+	if (global_ssl.lazy_load)
+		return;
+
+	while (fgets(thisline, sizeof(thisline), f) != NULL) {
+		line = thisline;
+		while (isspace((unsigned char)*line))
+			line++;
+		if (*line == '#' || !*line)
+			continue;
+
+		for (end = line; *end && *end != '[' && !isspace((unsigned char)*end); end++)
+			;
+		*end = 0;
+
+		if (*line != '/' && global_ssl.crt_base) {
+			if (snprintf(path, sizeof(path), "%s/%s", global_ssl.crt_base, line) >= sizeof(path))
+				continue;
+			line = path;
+		}
+
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			new_paths = realloc(paths, size * sizeof(*paths));
+			if (!new_paths)
+				break;
+			paths = new_paths;
+		}
+		paths[count] = strdup(line);
+		if (!paths[count])
+			break;
+		count++;
+	}
+
+	crtlist_preload(paths, count);
+	rewind(f);
+}
+
+/* Loads in parallel the certificates of the <n> files of <de_list> found in the
+ * directory <path>, except the bundles and the extra files.
+ */
+static void crtlist_preload_dir(const char *path, struct dirent **de_list, int n)
+{
+	char **paths;
+	char *end;
+	int i, count = 0;
+#if HA_OPENSSL_VERSION_NUMBER >= 0x1000200fL
+	int j;
+#endif
+
+	paths = calloc(n, sizeof(*paths));
+	if (!paths)
+		return;
+
+	for (i = 0; i < n; i++) {
+		end = strrchr(de_list[i]->d_name, '.');
+		if (end && (!strcmp(end, ".issuer") || !strcmp(end, ".ocsp") || !strcmp(end, ".sctl") || !strcmp(end, ".key")))
+			continue;
+#if HA_OPENSSL_VERSION_NUMBER >= 0x1000200fL
+		if ((global_ssl.extra_files & SSL_GF_BUNDLE) && end) {
+			for (j = 0; j < SSL_SOCK_NUM_KEYTYPES; j++) {
+				if (!strcmp(end + 1, SSL_SOCK_KEYTYPE_NAMES[j]))
+					break;
+			}
+			if (j < SSL_SOCK_NUM_KEYTYPES)
+				continue;
+		}
+#endif
+		if (memprintf(&paths[count], "%s/%s", path, de_list[i]->d_name))
+			count++;
+	}
+
+	crtlist_preload(paths, count);
+}
+
+/* Returns non-zero if the certificate of <entry> may be loaded on demand by
+ * <crtlist> ("tune.ssl.lazy-load"). It must not be the first entry, which may
+ * provide the default certificate, and since the names of the certificate are
+ * not known before it is loaded, it must only be selected by positive filters.
+ */
+static int crtlist_entry_lazy(const struct crtlist_entry *entry, const struct crtlist *crtlist)
+{
+	int i;
+
+	if (!global_ssl.lazy_load || !entry->fcount || LIST_ISEMPTY(&crtlist->ord_entries))
+		return 0;
+
+	for (i = 0; i < entry->fcount; i++) {
+		if (*entry->filters[i] == '!' || strcmp(entry->filters[i], "*") == 0)
+			return 0;
+	}
+	return 1;
+}
+
 /* This function parse a crt-list file and store it in a struct crtlist, each line is a crtlist_entry structure
  * Fill the <crtlist> argument with a pointer to a new crtlist struct
  *
@@ -349,6 +465,8 @@ int crtlist_parse_file(char *file, struct bind_conf *bind_conf, struct proxy *cu
 		goto error;
 	}
 
+	crtlist_preload_file(f);
+
 	while (fgets(thisline, sizeof(thisline), f) != NULL) {
 		char *end;
 		char *line = thisline;
@@ -403,8 +521,12 @@ int crtlist_parse_file(char *file, struct bind_conf *bind_conf, struct proxy *cu
 		/* Look for a ckch_store or create one */
 		ckchs = ckchs_lookup(crt_path);
 		if (ckchs == NULL) {
-			if (stat(crt_path, &buf) == 0)
-				ckchs = ckchs_load_cert_file(crt_path, 0,  err);
+			if (stat(crt_path, &buf) == 0) {
+				if (crtlist_entry_lazy(entry, newlist))
+					ckchs = ckchs_new_lazy(crt_path, err);
+				else
+					ckchs = ckchs_load_cert_file(crt_path, 0,  err);
+			}
 			else
 				ckchs = ckchs_load_cert_file(crt_path, 1,  err);
 		}
@@ -472,6 +594,8 @@ int crtlist_load_cert_dir(char *path, struct bind_conf *bind_conf, struct crtlis
 		cfgerr |= ERR_ALERT | ERR_FATAL;
 	}
 	else {
+		crtlist_preload_dir(path, de_list, n);
+
 		for (i = 0; i < n; i++) {
 			struct crtlist_entry *entry;
 			struct dirent *de = de_list[i];
@@ -1235,6 +1359,7 @@ static int cli_parse_del_crtlist(char **args, char *payload, struct appctx *appc
 
 		HA_RWLOCK_WRLOCK(SNI_LOCK, &inst->bind_conf->sni_lock);
 		list_for_each_entry_safe(sni, sni_s, &inst->sni_ctx, by_ckch_inst) {
+			inst->bind_conf->sni_gen++;
 			ebmb_delete(&sni->name);
 			LIST_DEL(&sni->by_ckch_inst);
 			SSL_CTX_free(sni->ctx);
@@ -0,0 +1,414 @@
+/*
+ * Offloading of the private key operations of the handshakes to dedicated
+ * threads ("ssl-offload-threads").
+ *
+ * The RSA private key operations and the ECDSA signatures are performed by
+ * methods which, when they are called from an OpenSSL ASYNC job (that is
+ * when "ssl-mode-async" is enabled), queue the operation to a pool of crypto
+ * threads and pause the job. The job is resumed by the usual async fd
+ * processing of the SSL layer once a pipe owned by the SSL's wait context is
+ * written to by the crypto thread, so the I/O thread keeps on serving the
+ * other connections in the mean time. The operations not called from a job
+ * are still performed synchronously.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <common/cfgparse.h>
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/hathreads.h>
+#include <common/initcall.h>
+#include <common/mini-clist.h>
+#include <common/openssl-compat.h>
+#include <common/standard.h>
+
+#include <types/global.h>
+#include <types/ssl_ckch.h>
+#include <types/ssl_sock.h>
+
+#include <proto/log.h>
+#include <proto/ssl_sock.h>
+
+/* The key methods are ignored by the providers of OpenSSL 3.0 */
+#if defined(USE_THREAD) && (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && (HA_OPENSSL_VERSION_NUMBER < 0x30000000L) && \
+    !defined(OPENSSL_NO_ASYNC) && !defined(OPENSSL_IS_BORINGSSL) && !defined(LIBRESSL_VERSION_NUMBER)
+#define SSL_OFFLOAD_SUPPORTED
+#endif
+
+#ifdef SSL_OFFLOAD_SUPPORTED
+
+#include <openssl/async.h>
+
+/* type of offloaded operations */
+enum ssl_offload_type {
+	SSL_OFFLOAD_RSA_PRIV_ENC = 0,
+	SSL_OFFLOAD_RSA_PRIV_DEC,
+	SSL_OFFLOAD_ECDSA_SIGN,
+};
+
+/* An offloaded operation. It lives in the stack of the paused job until the
+ * crypto thread sets <done>, so the crypto thread must not touch it anymore
+ * once it did so.
+ */
+struct ssl_offload_op {
+	struct list list;                /* entry in ssl_offload_queue */
+	enum ssl_offload_type type;
+	union {
+		struct {
+			int flen;
+			const unsigned char *from;
+			unsigned char *to;
+			RSA *rsa;
+			int padding;
+		} rsa;
+		struct {
+			int type;
+			const unsigned char *dgst;
+			int dlen;
+			unsigned char *sig;
+			unsigned int *siglen;
+			const BIGNUM *kinv;
+			const BIGNUM *r;
+			EC_KEY *eckey;
+		} ec;
+	};
+	int ret;                         /* result of the operation */
+	int wfd;                         /* pipe to write to once done */
+	int done;                        /* set once the result is available */
+};
+
+/* maximum number of operations a crypto thread dequeues at once */
+#define SSL_OFFLOAD_BATCH 16
+
+static int ssl_offload_threads;          /* number of crypto threads, 0 if disabled */
+static struct list ssl_offload_queue = LIST_HEAD_INIT(ssl_offload_queue);
+static pthread_mutex_t ssl_offload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ssl_offload_cond = PTHREAD_COND_INITIALIZER;
+static const char ssl_offload_key[] = "haproxy-offload"; /* key of the fd in the wait contexts */
+
+static RSA_METHOD *ssl_offload_rsa_meth;
+static EC_KEY_METHOD *ssl_offload_ec_meth;
+
+/* the original methods, called by the crypto threads */
+static int (*ssl_offload_rsa_priv_enc_orig)(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int (*ssl_offload_rsa_priv_dec_orig)(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int (*ssl_offload_ecdsa_sign_orig)(int type, const unsigned char *dgst, int dlen, unsigned char *sig,
+                                          unsigned int *siglen, const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+
+/* Performs <op> with the original methods */
+static void ssl_offload_run(struct ssl_offload_op *op)
+{
+	switch (op->type) {
+	case SSL_OFFLOAD_RSA_PRIV_ENC:
+		op->ret = ssl_offload_rsa_priv_enc_orig(op->rsa.flen, op->rsa.from, op->rsa.to, op->rsa.rsa, op->rsa.padding);
+		break;
+	case SSL_OFFLOAD_RSA_PRIV_DEC:
+		op->ret = ssl_offload_rsa_priv_dec_orig(op->rsa.flen, op->rsa.from, op->rsa.to, op->rsa.rsa, op->rsa.padding);
+		break;
+	case SSL_OFFLOAD_ECDSA_SIGN:
+		op->ret = ssl_offload_ecdsa_sign_orig(op->ec.type, op->ec.dgst, op->ec.dlen, op->ec.sig,
+		                                      op->ec.siglen, op->ec.kinv, op->ec.r, op->ec.eckey);
+		break;
+	}
+}
+
+/* Closes the pipe of a wait context when the SSL is released */
+static void ssl_offload_fd_cleanup(ASYNC_WAIT_CTX *ctx, const void *key, OSSL_ASYNC_FD fd, void *custom)
+{
+	int *wfd = custom;
+
+	close(fd);
+	close(*wfd);
+	free(wfd);
+}
+
+/* Queues <op> to the crypto threads and pauses the current job until it is
+ * done. Returns 0 if the operation could not be offloaded, in which case the
+ * caller must perform it, otherwise non-zero with the result in <op>.
+ */
+static int ssl_offload_submit(struct ssl_offload_op *op)
+{
+	ASYNC_JOB *job;
+	ASYNC_WAIT_CTX *waitctx;
+	OSSL_ASYNC_FD rfd;
+	void *custom;
+	int fds[2];
+	int *wfd;
+	char c;
+
+	job = ASYNC_get_current_job();
+	if (!job)
+		return 0;
+
+	waitctx = ASYNC_get_wait_ctx(job);
+	if (!waitctx)
+		return 0;
+
+	/* the pipe is reused by all the operations of the SSL */
+	if (!ASYNC_WAIT_CTX_get_fd(waitctx, ssl_offload_key, &rfd, &custom)) {
+		if (pipe(fds) < 0)
+			return 0;
+
+		wfd = malloc(sizeof(*wfd));
+		if (!wfd ||
+		    fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1)
+			goto fail_pipe;
+
+		*wfd = fds[1];
+		if (!ASYNC_WAIT_CTX_set_wait_fd(waitctx, ssl_offload_key, fds[0], wfd, ssl_offload_fd_cleanup))
+			goto fail_pipe;
+		rfd = fds[0];
+		custom = wfd;
+	}
+
+	op->wfd = *(int *)custom;
+	op->done = 0;
+
+	pthread_mutex_lock(&ssl_offload_mutex);
+	LIST_ADDQ(&ssl_offload_queue, &op->list);
+	pthread_cond_signal(&ssl_offload_cond);
+	pthread_mutex_unlock(&ssl_offload_mutex);
+
+	/* The job may be resumed for other reasons than our notification,
+	 * and a notification may be left from a previous operation.
+	 */
+	while (!HA_ATOMIC_LOAD(&op->done)) {
+		ASYNC_pause_job();
+		while (read(rfd, &c, 1) > 0)
+			;
+	}
+	return 1;
+
+ fail_pipe:
+	free(wfd);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
+
+/* crypto thread */
+static void *ssl_offload_thread(void *arg)
+{
+	struct ssl_offload_op *batch[SSL_OFFLOAD_BATCH];
+	struct ssl_offload_op *op;
+	sigset_t set;
+	int i, n, wfd;
+	char c = 0;
+
+	/* the signals are for the haproxy threads */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+	while (1) {
+		pthread_mutex_lock(&ssl_offload_mutex);
+		while (LIST_ISEMPTY(&ssl_offload_queue))
+			pthread_cond_wait(&ssl_offload_cond, &ssl_offload_mutex);
+
+		for (n = 0; n < SSL_OFFLOAD_BATCH && !LIST_ISEMPTY(&ssl_offload_queue); n++) {
+			batch[n] = LIST_NEXT(&ssl_offload_queue, struct ssl_offload_op *, list);
+			LIST_DEL(&batch[n]->list);
+		}
+		pthread_mutex_unlock(&ssl_offload_mutex);
+
+		for (i = 0; i < n; i++) {
+			op = batch[i];
+			ssl_offload_run(op);
+			wfd = op->wfd;
+			/* <op> may vanish as soon as <done> is set */
+			HA_ATOMIC_STORE(&op->done, 1);
+			if (write(wfd, &c, 1) < 0 && errno != EAGAIN)
+				send_log(NULL, LOG_ERR, "ssl-offload-threads: unable to notify the completion of an operation.\n");
+		}
+	}
+	return NULL;
+}
+
+static int ssl_offload_rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding)
+{
+	struct ssl_offload_op op = {
+		.type = SSL_OFFLOAD_RSA_PRIV_ENC,
+		.rsa  = { .flen = flen, .from = from, .to = to, .rsa = rsa, .padding = padding },
+	};
+
+	if (!ssl_offload_submit(&op))
+		return ssl_offload_rsa_priv_enc_orig(flen, from, to, rsa, padding);
+	return op.ret;
+}
+
+static int ssl_offload_rsa_priv_dec(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding)
+{
+	struct ssl_offload_op op = {
+		.type = SSL_OFFLOAD_RSA_PRIV_DEC,
+		.rsa  = { .flen = flen, .from = from, .to = to, .rsa = rsa, .padding = padding },
+	};
+
+	if (!ssl_offload_submit(&op))
+		return ssl_offload_rsa_priv_dec_orig(flen, from, to, rsa, padding);
+	return op.ret;
+}
+
+static int ssl_offload_ecdsa_sign(int type, const unsigned char *dgst, int dlen, unsigned char *sig,
+                                  unsigned int *siglen, const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey)
+{
+	struct ssl_offload_op op = {
+		.type = SSL_OFFLOAD_ECDSA_SIGN,
+		.ec   = { .type = type, .dgst = dgst, .dlen = dlen, .sig = sig, .siglen = siglen,
+		          .kinv = kinv, .r = r, .eckey = eckey },
+	};
+
+	if (!ssl_offload_submit(&op))
+		return ssl_offload_ecdsa_sign_orig(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+	return op.ret;
+}
+
+/* Makes the private key <pkey> use the offloading methods */
+static void ssl_offload_set_pkey(EVP_PKEY *pkey)
+{
+	if (!pkey)
+		return;
+
+	switch (EVP_PKEY_base_id(pkey)) {
+	case EVP_PKEY_RSA:
+		RSA_set_method(EVP_PKEY_get0_RSA(pkey), ssl_offload_rsa_meth);
+		break;
+	case EVP_PKEY_EC:
+		EC_KEY_set_method(EVP_PKEY_get0_EC_KEY(pkey), ssl_offload_ec_meth);
+		break;
+	}
+}
+
+/* Builds the offloading methods, makes them the default ones for the keys
+ * loaded from now on and switches the certificates already loaded to them.
+ * Returns 0 if succeeded, an error code if not.
+ */
+static int ssl_offload_init()
+{
+	struct ebmb_node *node;
+	struct ckch_store *ckchs;
+	int n;
+
+	if (!ssl_offload_threads)
+		return 0;
+
+	ssl_offload_rsa_meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+	ssl_offload_ec_meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+	if (!ssl_offload_rsa_meth || !ssl_offload_ec_meth) {
+		ha_alert("ssl-offload-threads: out of memory.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	ssl_offload_rsa_priv_enc_orig = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL());
+	ssl_offload_rsa_priv_dec_orig = RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL());
+	RSA_meth_set1_name(ssl_offload_rsa_meth, "haproxy offloaded RSA");
+	RSA_meth_set_priv_enc(ssl_offload_rsa_meth, ssl_offload_rsa_priv_enc);
+	RSA_meth_set_priv_dec(ssl_offload_rsa_meth, ssl_offload_rsa_priv_dec);
+
+	EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &ssl_offload_ecdsa_sign_orig, NULL, NULL);
+	{
+		int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+		ECDSA_SIG *(*sign_sig)(const unsigned char *, int, const BIGNUM *, const BIGNUM *, EC_KEY *);
+
+		EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), NULL, &sign_setup, &sign_sig);
+		EC_KEY_METHOD_set_sign(ssl_offload_ec_meth, ssl_offload_ecdsa_sign, sign_setup, sign_sig);
+	}
+
+	RSA_set_default_method(ssl_offload_rsa_meth);
+	EC_KEY_set_default_method(ssl_offload_ec_meth);
+
+	for (node = ebmb_first(&ckchs_tree); node; node = ebmb_next(node)) {
+		ckchs = ebmb_entry(node, struct ckch_store, node);
+		if (!ckchs->multi) {
+			ssl_offload_set_pkey(ckchs->ckch->key);
+			continue;
+		}
+		for (n = 0; n < SSL_SOCK_NUM_KEYTYPES; n++)
+			ssl_offload_set_pkey(ckchs->ckch[n].key);
+	}
+
+	/* each SSL keeps a pipe once it offloaded an operation */
+	global.ssl_used_async_engines += 2;
+	return 0;
+}
+
+REGISTER_POST_CHECK(ssl_offload_init);
+
+/* Starts the crypto threads from the first thread, once the process is in
+ * its final state (after the fork in daemon mode).
+ */
+static int ssl_offload_start()
+{
+	pthread_t thread;
+	int i;
+
+	if (!ssl_offload_threads || tid != 0)
+		return 1;
+
+	for (i = 0; i < ssl_offload_threads; i++) {
+		if (pthread_create(&thread, NULL, ssl_offload_thread, NULL) != 0) {
+			ha_alert("ssl-offload-threads: unable to start the crypto threads.\n");
+			return 0;
+		}
+		pthread_detach(thread);
+	}
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(ssl_offload_start);
+
+#endif /* SSL_OFFLOAD_SUPPORTED */
+
+/* parse the "ssl-offload-threads" keyword in global section. It implies
+ * "ssl-mode-async".
+ */
+static int ssl_parse_global_offload_threads(char **args, int section_type, struct proxy *curpx,
+                                            struct proxy *defpx, const char *file, int line,
+                                            char **err)
+{
+#ifdef SSL_OFFLOAD_SUPPORTED
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	ssl_offload_threads = strtol(args[1], &end, 10);
+	if (!*args[1] || *end || ssl_offload_threads < 0 || ssl_offload_threads > MAX_THREADS) {
+		memprintf(err, "'%s' expects a number of threads between 0 and %d.", args[0], MAX_THREADS);
+		return -1;
+	}
+
+	if (ssl_offload_threads && !global_ssl.async) {
+		global_ssl.async = 1;
+		global.ssl_used_async_engines = nb_engines;
+	}
+	return 0;
+#else
+	memprintf(err, "'%s' requires threads support and an openssl library supporting async mode and key methods.", args[0]);
+	return -1;
+#endif
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "ssl-offload-threads", ssl_parse_global_offload_threads },
+	{ 0, NULL, NULL },
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -51,6 +51,9 @@
 #include <common/errors.h>
 #include <common/initcall.h>
 #include <common/openssl-compat.h>
+#ifdef HAVE_SSL_KTLS
+#include <linux/tls.h>
+#endif
 #include <common/standard.h>
 #include <common/ticks.h>
 #include <common/time.h>
@@ -82,6 +85,7 @@
 #include <proto/stream_interface.h>
 #include <proto/log.h>
 #include <proto/proxy.h>
+#include <proto/session.h>
 #include <proto/shctx.h>
 #include <proto/ssl_ckch.h>
 #include <proto/ssl_crtlist.h>
@@ -143,6 +147,8 @@ struct global_ssl global_ssl = {
 	.ctx_cache = DEFAULT_SSL_CTX_CACHE,
 	.capture_cipherlist = 0,
 	.extra_files = SSL_GF_ALL,
+	.ocsp_update_min = 300,
+	.ocsp_update_max = 3600,
 };
 
 static BIO_METHOD *ha_meth;
@@ -152,6 +158,93 @@ DECLARE_STATIC_POOL(ssl_sock_ctx_pool, "ssl_sock_ctx_pool", sizeof(struct ssl_so
 static struct task *ssl_sock_io_cb(struct task *, void *, unsigned short);
 static int ssl_sock_handshake(struct connection *conn, unsigned int flag);
 
+#ifdef HAVE_SSL_KTLS
+/* Sends the <num> bytes of <buf> as a single record of the type OpenSSL asked
+ * for (alert, handshake...) on the kTLS socket of <ctx>. Returns the number
+ * of bytes sent, or 0 if nothing could be sent, in which case the connection
+ * flags are updated like the raw sockets do.
+ */
+static int ha_ssl_ktls_send_ctrl(struct ssl_sock_ctx *ctx, const char *buf, int num)
+{
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = num };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+	                      .msg_control = cbuf, .msg_controllen = sizeof(cbuf) };
+	struct cmsghdr *cmsg;
+	int fd = ctx->conn->handle.fd;
+	int ret;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = ctx->ktls_ctrl_msg;
+
+	while (1) {
+		ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret >= 0)
+			return ret;
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == ENOTCONN)
+			fd_cant_send(fd);
+		else
+			ctx->conn->flags |= CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH;
+		return 0;
+	}
+}
+
+/* Hands the TX keys described by <info> over to the kernel for the socket of
+ * <ctx>. Only the transmit side is offloaded since the records received must
+ * still be inspected by OpenSSL. Returns 1 on success, 0 if the kernel or the
+ * cipher does not support it, in which case OpenSSL keeps encrypting.
+ */
+static int ha_ssl_set_ktls(struct ssl_sock_ctx *ctx, int is_tx, const struct tls_crypto_info *info)
+{
+	struct connection *conn = ctx->conn;
+	socklen_t len;
+
+	if (!is_tx || !conn_ctrl_ready(conn) || (ctx->xprt_st & SSL_SOCK_KTLS_TX))
+		return 0;
+
+	switch (info->cipher_type) {
+	case TLS_CIPHER_AES_GCM_128:
+		len = sizeof(struct tls12_crypto_info_aes_gcm_128);
+		break;
+#ifdef TLS_CIPHER_AES_GCM_256
+	case TLS_CIPHER_AES_GCM_256:
+		len = sizeof(struct tls12_crypto_info_aes_gcm_256);
+		break;
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+	case TLS_CIPHER_AES_CCM_128:
+		len = sizeof(struct tls12_crypto_info_aes_ccm_128);
+		break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		len = sizeof(struct tls12_crypto_info_chacha20_poly1305);
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	if (!(ctx->xprt_st & SSL_SOCK_KTLS_ULP)) {
+		if (setsockopt(conn->handle.fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0)
+			return 0;
+		ctx->xprt_st |= SSL_SOCK_KTLS_ULP;
+	}
+
+	if (setsockopt(conn->handle.fd, SOL_TLS, TLS_TX, info, len) < 0)
+		return 0;
+
+	ctx->xprt_st |= SSL_SOCK_KTLS_TX;
+	conn->flags &= ~CO_FL_NO_SND_PIPE;
+	return 1;
+}
+#endif /* HAVE_SSL_KTLS */
+
 /* Methods to implement OpenSSL BIO */
 static int ha_ssl_write(BIO *h, const char *buf, int num)
 {
@@ -160,11 +253,20 @@ static int ha_ssl_write(BIO *h, const char *buf, int num)
 	int ret;
 
 	ctx = BIO_get_data(h);
+#ifdef HAVE_SSL_KTLS
+	if (ctx->ktls_ctrl_msg) {
+		ret = ha_ssl_ktls_send_ctrl(ctx, buf, num);
+		goto done;
+	}
+#endif
 	tmpbuf.size = num;
 	tmpbuf.area = (void *)(uintptr_t)buf;
 	tmpbuf.data = num;
 	tmpbuf.head = 0;
 	ret = ctx->xprt->snd_buf(ctx->conn, ctx->xprt_ctx, &tmpbuf, num, 0);
+#ifdef HAVE_SSL_KTLS
+ done:
+#endif
 	if (ret == 0 && !(ctx->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_WR_SH))) {
 		BIO_set_retry_write(h);
 		ret = -1;
@@ -208,12 +310,32 @@ static int ha_ssl_read(BIO *h, char *buf, int size)
 
 static long ha_ssl_ctrl(BIO *h, int cmd, long arg1, void *arg2)
 {
+#ifdef HAVE_SSL_KTLS
+	struct ssl_sock_ctx *ctx = BIO_get_data(h);
+#endif
 	int ret = 0;
 	switch (cmd) {
 	case BIO_CTRL_DUP:
 	case BIO_CTRL_FLUSH:
 		ret = 1;
 		break;
+#ifdef HAVE_SSL_KTLS
+	case BIO_CTRL_SET_KTLS:
+		if (ctx)
+			ret = ha_ssl_set_ktls(ctx, arg1, arg2);
+		break;
+	case BIO_CTRL_GET_KTLS_SEND:
+		ret = ctx && (ctx->xprt_st & SSL_SOCK_KTLS_TX);
+		break;
+	case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+		if (ctx)
+			ctx->ktls_ctrl_msg = arg1;
+		break;
+	case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+		if (ctx)
+			ctx->ktls_ctrl_msg = 0;
+		break;
+#endif
 	}
 	return ret;
 }
@@ -505,8 +627,21 @@ const char *SSL_SOCK_KEYTYPE_NAMES[] = {
 };
 #endif
 
-static struct shared_context *ssl_shctx = NULL; /* ssl shared session cache */
-static struct eb_root *sh_ssl_sess_tree; /* ssl shared session tree */
+/* The SSL session cache is split into shards ("tune.ssl.cache-shards"), each
+ * with its own lock, tree and LRU, so that the handshakes of the threads do
+ * not all serialize on a single lock. The shard of a session is chosen from
+ * a hash of its ID.
+ */
+#define SSL_SHCTX_MAX_SHARDS 64
+static struct shared_context *ssl_shctx[SSL_SHCTX_MAX_SHARDS]; /* ssl shared session cache shards */
+static struct eb_root *sh_ssl_sess_tree[SSL_SHCTX_MAX_SHARDS]; /* ssl shared session tree of each shard */
+static unsigned int ssl_shctx_shards; /* number of shards, 0 if there is no cache */
+
+/* Returns the cache shard of the session whose zero-padded ID is <key> */
+static inline unsigned int sh_ssl_sess_shard(const unsigned char *key)
+{
+	return XXH32(key, SSL_MAX_SSL_SESSION_ID_LENGTH, 0) % ssl_shctx_shards;
+}
 
 /* Dedicated callback functions for heartbeat and clienthello.
  */
@@ -700,14 +835,14 @@ void ssl_async_fd_free(int fd)
 	_HA_ATOMIC_SUB(&jobs, 1);
 }
 /*
- * function used to manage a returned SSL_ERROR_WANT_ASYNC
- * and enable/disable polling for async fds
+ * function used to manage a returned SSL_ERROR_WANT_ASYNC for <ssl>
+ * and enable/disable polling for async fds. The new fds are registered
+ * with <owner> as owner and <iocb> as I/O handler.
  */
-static inline void ssl_async_process_fds(struct ssl_sock_ctx *ctx)
+void ssl_async_update_fds(SSL *ssl, void *owner, void (*iocb)(int fd))
 {
 	OSSL_ASYNC_FD add_fd[32];
 	OSSL_ASYNC_FD del_fd[32];
-	SSL *ssl = ctx->ssl;
 	size_t num_add_fds = 0;
 	size_t num_del_fds = 0;
 	int i;
@@ -727,7 +862,7 @@ static inline void ssl_async_process_fds(struct ssl_sock_ctx *ctx)
 
 	/* We add new fds to the fdtab */
 	for (i=0 ; i < num_add_fds ; i++) {
-		fd_insert(add_fd[i], ctx, ssl_async_fd_handler, tid_bit);
+		fd_insert(add_fd[i], owner, iocb, tid_bit);
 	}
 
 	num_add_fds = 0;
@@ -751,6 +886,15 @@ static inline void ssl_async_process_fds(struct ssl_sock_ctx *ctx)
 	}
 
 }
+
+/*
+ * function used to manage a returned SSL_ERROR_WANT_ASYNC
+ * for the SSL connection with <ctx> as context.
+ */
+static inline void ssl_async_process_fds(struct ssl_sock_ctx *ctx)
+{
+	ssl_async_update_fds(ctx->ssl, ctx, ssl_async_fd_handler);
+}
 #endif
 
 #if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
@@ -836,6 +980,13 @@ nosec:
 	return -1;
 }
 
+/* An OCSP response in DER format, and the date it must not be stapled anymore */
+struct ocsp_response {
+	long expire;
+	size_t len;
+	unsigned char data[VAR_ARRAY];
+};
+
 /*
  * struct alignment works here such that the key.key is the same as key_data
  * Do not change the placement of key_data
@@ -843,8 +994,16 @@ nosec:
 struct certificate_ocsp {
 	struct ebmb_node key;
 	unsigned char key_data[OCSP_MAX_CERTID_ASN1_LENGTH];
-	struct buffer response;
-	long expire;
+	struct ocsp_response *resp;     /* stapled response or NULL, atomically replaced */
+	struct ocsp_response *old_resp; /* previous response, released on the next update */
+	/* the fields below are only used by the updater ("ssl-ocsp-update") */
+	OCSP_CERTID *cid;               /* certificate ID, to build the requests */
+	char *host;                     /* responder's host name, NULL if not updated */
+	char *path;                     /* responder's path */
+	int port;                       /* responder's port */
+	struct sockaddr_storage addr;   /* responder's address, resolved at boot */
+	unsigned int fails;             /* number of consecutive failed updates */
+	struct eb32_node upd_node;      /* in ssl_ocsp_upd_tree, key is the tick of the next update */
 };
 
 struct ocsp_cbk_arg {
@@ -864,13 +1023,32 @@ struct ocsp_cbk_arg {
 
 static struct eb_root cert_ocsp_tree = EB_ROOT_UNIQUE;
 
+/* protects the replacement of the OCSP responses and the updater's tree */
+__decl_hathreads(static HA_SPINLOCK_T ocsp_lock);
+
+/* Replaces the response stapled for <ocsp> by <resp>. The stapling callback
+ * reads the pointer without any lock, so the previous response is only
+ * released on the next replacement, leaving plenty of time to the handshakes
+ * still copying it.
+ */
+static void ssl_sock_set_ocsp_response(struct certificate_ocsp *ocsp, struct ocsp_response *resp)
+{
+	struct ocsp_response *old;
+
+	HA_SPIN_LOCK(OCSP_LOCK, &ocsp_lock);
+	old = HA_ATOMIC_XCHG(&ocsp->resp, resp);
+	free(ocsp->old_resp);
+	ocsp->old_resp = old;
+	HA_SPIN_UNLOCK(OCSP_LOCK, &ocsp_lock);
+}
+
 /* This function starts to check if the OCSP response (in DER format) contained
  * in chunk 'ocsp_response' is valid (else exits on error).
  * If 'cid' is not NULL, it will be compared to the OCSP certificate ID
  * contained in the OCSP Response and exits on error if no match.
  * If it's a valid OCSP Response:
  *  If 'ocsp' is not NULL, the chunk is copied in the OCSP response's container
- * pointed by 'ocsp'.
+ * pointed by 'ocsp', atomically replacing the previous one.
  *  If 'ocsp' is NULL, the function looks up into the OCSP response's
  * containers tree (using as index the ASN1 form of the OCSP Certificate ID extracted
  * from the response) and exits on error if not found. Finally, If an OCSP response is
@@ -889,6 +1067,7 @@ static int ssl_sock_load_ocsp_response(struct buffer *ocsp_response,
 	OCSP_BASICRESP *bs = NULL;
 	OCSP_SINGLERESP *sr;
 	OCSP_CERTID *id;
+	struct ocsp_response *new;
 	unsigned char *p = (unsigned char *) ocsp_response->area;
 	int rc , count_sr;
 	ASN1_GENERALIZEDTIME *revtime, *thisupd, *nextupd = NULL;
@@ -977,14 +1156,16 @@ static int ssl_sock_load_ocsp_response(struct buffer *ocsp_response,
 		}
 	}
 
-	/* According to comments on "chunk_dup", the
-	   previous chunk buffer will be freed */
-	if (!chunk_dup(&ocsp->response, ocsp_response)) {
+	new = malloc(sizeof(*new) + ocsp_response->data);
+	if (!new) {
 		memprintf(err, "OCSP response: Memory allocation error");
 		goto out;
 	}
 
-	ocsp->expire = asn1_generalizedtime_to_epoch(nextupd) - OCSP_MAX_RESPONSE_TIME_SKEW;
+	new->expire = asn1_generalizedtime_to_epoch(nextupd) - OCSP_MAX_RESPONSE_TIME_SKEW;
+	new->len = ocsp_response->data;
+	memcpy(new->data, ocsp_response->area, ocsp_response->data);
+	ssl_sock_set_ocsp_response(ocsp, new);
 
 	ret = 0;
 out:
@@ -1215,6 +1396,7 @@ int ssl_sock_get_ocsp_arg_kt_index(int evp_keytype)
 int ssl_sock_ocsp_stapling_cbk(SSL *ssl, void *arg)
 {
 	struct certificate_ocsp *ocsp;
+	struct ocsp_response *resp;
 	struct ocsp_cbk_arg *ocsp_arg;
 	char *ssl_buf;
 	EVP_PKEY *ssl_pkey;
@@ -1244,18 +1426,20 @@ int ssl_sock_ocsp_stapling_cbk(SSL *ssl, void *arg)
 
 	}
 
-	if (!ocsp ||
-	    !ocsp->response.area ||
-	    !ocsp->response.data ||
-	    (ocsp->expire < now.tv_sec))
+	if (!ocsp)
 		return SSL_TLSEXT_ERR_NOACK;
 
-	ssl_buf = OPENSSL_malloc(ocsp->response.data);
+	/* may be replaced at any time, see ssl_sock_set_ocsp_response() */
+	resp = HA_ATOMIC_LOAD(&ocsp->resp);
+	if (!resp || !resp->len || (resp->expire < now.tv_sec))
+		return SSL_TLSEXT_ERR_NOACK;
+
+	ssl_buf = OPENSSL_malloc(resp->len);
 	if (!ssl_buf)
 		return SSL_TLSEXT_ERR_NOACK;
 
-	memcpy(ssl_buf, ocsp->response.area, ocsp->response.data);
-	SSL_set_tlsext_status_ocsp_resp(ssl, ssl_buf, ocsp->response.data);
+	memcpy(ssl_buf, resp->data, resp->len);
+	SSL_set_tlsext_status_ocsp_resp(ssl, ssl_buf, resp->len);
 
 	return SSL_TLSEXT_ERR_OK;
 }
@@ -1263,6 +1447,401 @@ int ssl_sock_ocsp_stapling_cbk(SSL *ssl, void *arg)
 #endif
 
 #if ((defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP) || defined OPENSSL_IS_BORINGSSL)
+#ifndef OPENSSL_IS_BORINGSSL
+/*
+ * OCSP responses updater ("ssl-ocsp-update"). The responses of the
+ * certificates whose OCSP stapling is enabled are periodically fetched over
+ * HTTP from the responder found in the certificate, one at a time, by an
+ * applet connecting to it through an internal proxy. The delay before the
+ * next update is half of the remaining validity of the current response,
+ * bounded by "tune.ssl.ocsp-update.min-delay" and "max-delay". A failed
+ * update is retried after an exponentially growing delay, starting from the
+ * minimum one.
+ */
+static struct proxy ssl_ocsp_proxy;
+static struct server ssl_ocsp_server;
+static struct task *ssl_ocsp_task;
+static struct eb_root ssl_ocsp_upd_tree = EB_ROOT;
+static struct certificate_ocsp *ssl_ocsp_updating; /* update in progress, or NULL */
+
+/* Records into <ocsp> what the updater needs to fetch the responses of the <x>
+ * certificate identified by <cid>: a copy of this ID and the location of the
+ * first plain HTTP responder advertised in its AIA extension. The response is
+ * never updated if there is none.
+ */
+static void ssl_ocsp_update_prepare(struct certificate_ocsp *ocsp, X509 *x, OCSP_CERTID *cid)
+{
+	STACK_OF(OPENSSL_STRING) *uris;
+	char *host, *port, *path;
+	int i, use_ssl;
+
+	uris = X509_get1_ocsp(x);
+	if (!uris)
+		return;
+
+	for (i = 0; i < sk_OPENSSL_STRING_num(uris); i++) {
+		if (!OCSP_parse_url(sk_OPENSSL_STRING_value(uris, i), &host, &port, &path, &use_ssl))
+			continue;
+
+		if (!use_ssl) {
+			ocsp->cid = OCSP_CERTID_dup(cid);
+			ocsp->host = strdup(host);
+			ocsp->path = strdup(path);
+			ocsp->port = atoi(port);
+		}
+		OPENSSL_free(host);
+		OPENSSL_free(port);
+		OPENSSL_free(path);
+
+		if (ocsp->host)
+			break;
+	}
+	X509_email_free(uris);
+
+	if (!ocsp->cid || !ocsp->host || !ocsp->path) {
+		OCSP_CERTID_free(ocsp->cid);
+		free(ocsp->host);
+		free(ocsp->path);
+		ocsp->cid = NULL;
+		ocsp->host = ocsp->path = NULL;
+	}
+}
+
+/* Schedules the next update of <ocsp>, after a failed one if <failed> is set.
+ * Must be called with the ocsp_lock held (or during boot).
+ */
+static void ssl_ocsp_update_schedule(struct certificate_ocsp *ocsp, int failed)
+{
+	struct ocsp_response *resp = ocsp->resp;
+	unsigned long long delay;
+
+	if (failed) {
+		delay = (unsigned long long)global_ssl.ocsp_update_min << MIN(ocsp->fails, 16);
+		ocsp->fails++;
+	}
+	else {
+		ocsp->fails = 0;
+		delay = 0;
+		if (resp && resp->expire > now.tv_sec)
+			delay = (resp->expire - now.tv_sec) / 2;
+	}
+
+	/* an invalid response is replaced at once */
+	if (delay || failed) {
+		if (delay < global_ssl.ocsp_update_min)
+			delay = global_ssl.ocsp_update_min;
+		if (delay > global_ssl.ocsp_update_max)
+			delay = global_ssl.ocsp_update_max;
+		/* the ticks must not wrap */
+		if (delay > 20 * 86400)
+			delay = 20 * 86400;
+		/* spread the updates of the responses issued at the same time */
+		if (delay >= 8)
+			delay -= ha_random32() % (delay / 8);
+	}
+
+	ocsp->upd_node.key = tick_add(now_ms, delay * 1000);
+	eb32_insert(&ssl_ocsp_upd_tree, &ocsp->upd_node);
+}
+
+/* Terminates the update of <ocsp>. <body> is the payload of the HTTP response,
+ * or NULL if it could not be retrieved. The next update is scheduled.
+ */
+static void ssl_ocsp_update_done(struct certificate_ocsp *ocsp, struct buffer *body)
+{
+	char *err = NULL;
+	int failed = 1;
+
+	if (!body)
+		send_log(NULL, LOG_WARNING, "ssl-ocsp-update: failed to fetch an OCSP response from '%s'.\n",
+		         ocsp->host);
+	else if (ssl_sock_load_ocsp_response(body, ocsp, ocsp->cid, &err) != 0)
+		send_log(NULL, LOG_WARNING, "ssl-ocsp-update: invalid OCSP response from '%s': %s.\n",
+		         ocsp->host, err ? err : "unknown error");
+	else
+		failed = 0;
+	free(err);
+
+	HA_SPIN_LOCK(OCSP_LOCK, &ocsp_lock);
+	ssl_ocsp_update_schedule(ocsp, failed);
+	ssl_ocsp_updating = NULL;
+	HA_SPIN_UNLOCK(OCSP_LOCK, &ocsp_lock);
+	task_wakeup(ssl_ocsp_task, TASK_WOKEN_MSG);
+}
+
+/* Terminates the update performed by <appctx> with what was received so far,
+ * only considering it if it is a complete HTTP response with a 200 status.
+ * The responder closes the connection once the response was sent.
+ */
+static void ssl_ocsp_update_finish(struct appctx *appctx)
+{
+	struct certificate_ocsp *ocsp = appctx->ctx.ssl_ocsp.ocsp;
+	struct buffer *buf = &appctx->ctx.ssl_ocsp.buf;
+	struct buffer body;
+	const char *p;
+
+	appctx->ctx.ssl_ocsp.ocsp = NULL;
+
+	p = (appctx->ctx.ssl_ocsp.sent && b_data(buf) >= 12) ?
+		my_memmem(b_orig(buf), b_data(buf), "\r\n\r\n", 4) : NULL;
+	if (!p || strncmp(b_orig(buf), "HTTP/1.", 7) != 0 || strncmp(b_orig(buf) + 8, " 200", 4) != 0) {
+		ssl_ocsp_update_done(ocsp, NULL);
+		return;
+	}
+
+	p += 4;
+	body = b_make((char *)p, b_tail(buf) - p, 0, b_tail(buf) - p);
+	ssl_ocsp_update_done(ocsp, &body);
+}
+
+/* The applet sends the request prepared in its buffer, then collects the
+ * response in the same buffer until the responder closes.
+ */
+static void ssl_ocsp_update_io_handler(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct channel *res = si_oc(si);
+	struct buffer *buf = &appctx->ctx.ssl_ocsp.buf;
+	int ret;
+
+	if (!appctx->ctx.ssl_ocsp.ocsp)
+		return;
+
+	if (!appctx->ctx.ssl_ocsp.sent) {
+		ret = ci_putblk(si_ic(si), b_orig(buf), b_data(buf));
+		if (ret < 0) {
+			if (ret == -1 || (ret == -3 && b_is_null(&si_ic(si)->buf))) {
+				si_rx_room_blk(si);
+				return;
+			}
+			goto end;
+		}
+		appctx->ctx.ssl_ocsp.sent = 1;
+		b_reset(buf);
+	}
+
+	while (co_data(res)) {
+		ret = MIN(co_data(res), b_room(buf));
+		if (!ret) {
+			/* too large for an OCSP response */
+			b_reset(buf);
+			goto end;
+		}
+		co_getblk(res, b_tail(buf), ret, 0);
+		b_add(buf, ret);
+		co_skip(res, ret);
+	}
+
+	if (!(res->flags & CF_SHUTW))
+		return;
+
+ end:
+	ssl_ocsp_update_finish(appctx);
+	si_shutw(si);
+	si_shutr(si);
+	si_ic(si)->flags |= CF_READ_NULL;
+}
+
+static void ssl_ocsp_update_release(struct appctx *appctx)
+{
+	if (appctx->ctx.ssl_ocsp.ocsp)
+		ssl_ocsp_update_finish(appctx);
+	free(b_orig(&appctx->ctx.ssl_ocsp.buf));
+}
+
+static struct applet ssl_ocsp_applet = {
+	.obj_type = OBJ_TYPE_APPLET,
+	.name = "<OCSP>", /* used for logging */
+	.fct = ssl_ocsp_update_io_handler,
+	.release = ssl_ocsp_update_release,
+};
+
+/* Starts the update of <ocsp>: builds the HTTP/1.0 request and creates the
+ * applet and the stream connecting to the responder. Returns 0 if it could
+ * not be started, non-zero otherwise, ssl_ocsp_update_done() being called
+ * once it terminates.
+ */
+static int ssl_ocsp_update_start(struct certificate_ocsp *ocsp)
+{
+	OCSP_REQUEST *req;
+	OCSP_CERTID *cid;
+	unsigned char *der = NULL;
+	struct appctx *appctx;
+	struct session *sess;
+	struct stream *s;
+	char *area;
+	int len;
+
+	req = OCSP_REQUEST_new();
+	if (!req)
+		return 0;
+
+	cid = OCSP_CERTID_dup(ocsp->cid);
+	if (!cid || !OCSP_request_add0_id(req, cid)) {
+		OCSP_CERTID_free(cid);
+		goto fail;
+	}
+
+	len = i2d_OCSP_REQUEST(req, &der);
+	if (len <= 0)
+		goto fail;
+
+	appctx = appctx_new(&ssl_ocsp_applet, tid_bit);
+	if (!appctx)
+		goto fail;
+
+	area = malloc(global.tune.bufsize);
+	if (!area)
+		goto fail_appctx;
+
+	appctx->ctx.ssl_ocsp.ocsp = ocsp;
+	appctx->ctx.ssl_ocsp.sent = 0;
+	appctx->ctx.ssl_ocsp.buf = b_make(area, global.tune.bufsize, 0, 0);
+	if (chunk_printf(&appctx->ctx.ssl_ocsp.buf,
+	                 "POST %s HTTP/1.0\r\n"
+	                 "Host: %s\r\n"
+	                 "Content-Type: application/ocsp-request\r\n"
+	                 "Content-Length: %d\r\n"
+	                 "\r\n", ocsp->path, ocsp->host, len) < 0 ||
+	    !chunk_memcat(&appctx->ctx.ssl_ocsp.buf, (char *)der, len))
+		goto fail_area;
+
+	sess = session_new(&ssl_ocsp_proxy, NULL, &appctx->obj_type);
+	if (!sess)
+		goto fail_area;
+
+	s = stream_new(sess, &appctx->obj_type);
+	if (!s)
+		goto fail_sess;
+
+	/* the connection fails if the address cannot be set */
+	if (sockaddr_alloc(&s->target_addr)) {
+		*s->target_addr = ocsp->addr;
+		s->flags |= SF_ADDR_SET;
+	}
+
+	si_set_state(&s->si[1], SI_ST_ASS);
+	s->flags |= SF_DIRECT | SF_ASSIGNED | SF_BE_ASSIGNED;
+	s->target = &ssl_ocsp_server.obj_type;
+
+	OPENSSL_free(der);
+	OCSP_REQUEST_free(req);
+	return 1;
+
+ fail_sess:
+	session_free(sess);
+ fail_area:
+	free(area);
+ fail_appctx:
+	appctx_free(appctx);
+ fail:
+	OPENSSL_free(der);
+	OCSP_REQUEST_free(req);
+	return 0;
+}
+
+/* Starts the update of the first response whose date has come, if no other
+ * one is in progress.
+ */
+static struct task *ssl_ocsp_update_task(struct task *t, void *context, unsigned short state)
+{
+	struct certificate_ocsp *ocsp = NULL;
+	struct eb32_node *node;
+
+	HA_SPIN_LOCK(OCSP_LOCK, &ocsp_lock);
+	t->expire = TICK_ETERNITY;
+
+	/* we are woken up once the update in progress is done */
+	if (ssl_ocsp_updating)
+		goto out;
+
+	node = eb32_lookup_ge(&ssl_ocsp_upd_tree, now_ms - TIMER_LOOK_BACK);
+	if (!node)
+		node = eb32_first(&ssl_ocsp_upd_tree);
+	if (!node)
+		goto out;
+
+	if (!tick_is_expired(node->key, now_ms)) {
+		t->expire = node->key;
+		goto out;
+	}
+
+	eb32_delete(node);
+	ocsp = eb32_entry(node, struct certificate_ocsp, upd_node);
+	ssl_ocsp_updating = ocsp;
+ out:
+	HA_SPIN_UNLOCK(OCSP_LOCK, &ocsp_lock);
+
+	if (ocsp && !ssl_ocsp_update_start(ocsp))
+		ssl_ocsp_update_done(ocsp, NULL);
+	return t;
+}
+
+/* Resolves the responders of the OCSP responses to update, sets up the
+ * internal proxy used to reach them and schedules the first updates.
+ * Returns 0 if succeeded, an error code if not.
+ */
+static int ssl_ocsp_update_init()
+{
+	struct certificate_ocsp *ocsp;
+	struct ebmb_node *node;
+
+	if (!global_ssl.ocsp_update)
+		return 0;
+
+	if (global_ssl.ocsp_update_max < global_ssl.ocsp_update_min) {
+		ha_alert("ssl-ocsp-update: 'tune.ssl.ocsp-update.max-delay' must not be lower than 'tune.ssl.ocsp-update.min-delay'.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	for (node = ebmb_first(&cert_ocsp_tree); node; node = ebmb_next(node)) {
+		ocsp = ebmb_entry(node, struct certificate_ocsp, key);
+		if (!ocsp->host)
+			continue;
+
+		if (!str2ip2(ocsp->host, &ocsp->addr, 1)) {
+			ha_warning("ssl-ocsp-update: unable to resolve the OCSP responder '%s', its responses will not be updated.\n",
+			           ocsp->host);
+			continue;
+		}
+		set_host_port(&ocsp->addr, ocsp->port);
+		ssl_ocsp_update_schedule(ocsp, 0);
+	}
+
+	if (eb_is_empty(&ssl_ocsp_upd_tree))
+		return 0;
+
+	init_new_proxy(&ssl_ocsp_proxy);
+	ssl_ocsp_proxy.last_change = now.tv_sec;
+	ssl_ocsp_proxy.id = "OCSP-UPDATE";
+	ssl_ocsp_proxy.cap = PR_CAP_FE | PR_CAP_BE;
+	ssl_ocsp_proxy.options2 |= PR_O2_INDEPSTR;
+	ssl_ocsp_proxy.timeout.connect = 5000;
+	ssl_ocsp_proxy.timeout.client = 10000;
+	ssl_ocsp_proxy.timeout.server = 10000;
+
+	ssl_ocsp_server.proxy = &ssl_ocsp_proxy;
+	ssl_ocsp_server.obj_type = OBJ_TYPE_SERVER;
+	LIST_INIT(&ssl_ocsp_server.actconns);
+	ssl_ocsp_server.pendconns = EB_ROOT;
+	ssl_ocsp_server.next_state = SRV_ST_RUNNING;
+	ssl_ocsp_server.id = "OCSP-RESPONDER";
+	ssl_ocsp_server.uweight = ssl_ocsp_server.iweight = ssl_ocsp_proxy.defsrv.iweight;
+	ssl_ocsp_server.xprt = xprt_get(XPRT_RAW);
+
+	ssl_ocsp_task = task_new(MAX_THREADS_MASK);
+	if (!ssl_ocsp_task) {
+		ha_alert("ssl-ocsp-update: out of memory.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	ssl_ocsp_task->process = ssl_ocsp_update_task;
+	task_wakeup(ssl_ocsp_task, TASK_WOKEN_INIT);
+	return 0;
+}
+
+REGISTER_POST_CHECK(ssl_ocsp_update_init);
+#endif /* OPENSSL_IS_BORINGSSL */
+
 /*
  * This function enables the handling of OCSP status extension on 'ctx' if a
  * ocsp_response buffer was found in the cert_key_and_chain.  To enable OCSP
@@ -1324,8 +1903,11 @@ static int ssl_sock_load_ocsp(SSL_CTX *ctx, const struct cert_key_and_chain *ckc
 	i2d_OCSP_CERTID(cid, &p);
 
 	iocsp = (struct certificate_ocsp *)ebmb_insert(&cert_ocsp_tree, &ocsp->key, OCSP_MAX_CERTID_ASN1_LENGTH);
-	if (iocsp == ocsp)
+	if (iocsp == ocsp) {
 		ocsp = NULL;
+		if (global_ssl.ocsp_update)
+			ssl_ocsp_update_prepare(iocsp, x, cid);
+	}
 
 #ifndef SSL_CTX_get_tlsext_status_cb
 # define SSL_CTX_get_tlsext_status_cb(ctx, cb) \
@@ -1396,8 +1978,10 @@ out:
 	if (cid)
 		OCSP_CERTID_free(cid);
 
-	if (ocsp)
+	if (ocsp) {
+		free(ocsp->resp);
 		free(ocsp);
+	}
 
 	if (warn)
 		free(warn);
@@ -2126,6 +2710,216 @@ static void ssl_sock_switchctx_set(SSL *ssl, SSL_CTX *ctx)
 	SSL_set_SSL_CTX(ssl, ctx);
 }
 
+/* Each thread keeps the last SNI resolutions in a small set-associative cache
+ * so that the most frequent names do not have to go through the name trees
+ * and walk the duplicates for every handshake. An entry is only valid for the
+ * generation of the SNI trees of the bind_conf it was resolved for, which is
+ * bumped each time an sni_ctx is inserted or removed. Since this is done under
+ * the SNI write lock, the sni_ctx of a valid entry may safely be used under
+ * the read lock. Names longer than SSL_SNI_CACHE_NAME_LEN are never cached.
+ */
+#define SSL_SNI_CACHE_SETS      64   /* must be a power of 2 */
+#define SSL_SNI_CACHE_WAYS      4
+#define SSL_SNI_CACHE_NAME_LEN  64
+
+struct ssl_sni_cache_entry {
+	const struct bind_conf *bind_conf; /* NULL if unused */
+	struct sni_ctx *sni;               /* resolved sni_ctx, NULL for no match */
+	unsigned int gen;                  /* SNI trees generation of <bind_conf> */
+	unsigned int last_use;             /* for LRU eviction within the set */
+	unsigned int hash;                 /* hash of the name */
+	unsigned char sig;                 /* signature algorithms flags */
+	unsigned char len;                 /* name length */
+	char name[SSL_SNI_CACHE_NAME_LEN]; /* lower case name, not zero-terminated */
+};
+
+static THREAD_LOCAL struct ssl_sni_cache_entry ssl_sni_cache[SSL_SNI_CACHE_SETS][SSL_SNI_CACHE_WAYS];
+static THREAD_LOCAL unsigned int ssl_sni_cache_clock;
+
+/* Looks up in the calling thread's cache the resolution of the lower case
+ * <name> of <len> bytes and <hash> for <s> with the <sig> signature algorithms
+ * flags. Returns 1 and sets <sni> (possibly to NULL if nothing matched) if it
+ * is known, otherwise 0. The SNI lock of <s> must be held.
+ */
+static int ssl_sni_cache_get(const struct bind_conf *s, const char *name, size_t len,
+                             unsigned int hash, unsigned int sig, struct sni_ctx **sni)
+{
+	struct ssl_sni_cache_entry *set = ssl_sni_cache[hash & (SSL_SNI_CACHE_SETS - 1)];
+	int i;
+
+	if (len > SSL_SNI_CACHE_NAME_LEN)
+		return 0;
+
+	for (i = 0; i < SSL_SNI_CACHE_WAYS; i++) {
+		if (set[i].bind_conf == s && set[i].hash == hash && set[i].sig == sig &&
+		    set[i].len == len && set[i].gen == s->sni_gen &&
+		    memcmp(set[i].name, name, len) == 0) {
+			set[i].last_use = ++ssl_sni_cache_clock;
+			*sni = set[i].sni;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Stores in the calling thread's cache <sni> as the resolution of the lower
+ * case <name> of <len> bytes and <hash> for <s> with the <sig> signature
+ * algorithms flags, evicting the least recently used entry of its set. The SNI
+ * lock of <s> must be held.
+ */
+static void ssl_sni_cache_set(const struct bind_conf *s, const char *name, size_t len,
+                              unsigned int hash, unsigned int sig, struct sni_ctx *sni)
+{
+	struct ssl_sni_cache_entry *set = ssl_sni_cache[hash & (SSL_SNI_CACHE_SETS - 1)];
+	struct ssl_sni_cache_entry *entry = &set[0];
+	int i;
+
+	if (len > SSL_SNI_CACHE_NAME_LEN)
+		return;
+
+	for (i = 1; i < SSL_SNI_CACHE_WAYS; i++) {
+		if ((int)(set[i].last_use - entry->last_use) < 0)
+			entry = &set[i];
+	}
+
+	entry->bind_conf = s;
+	entry->sni = sni;
+	entry->gen = s->sni_gen;
+	entry->last_use = ++ssl_sni_cache_clock;
+	entry->hash = hash;
+	entry->sig = sig;
+	entry->len = len;
+	memcpy(entry->name, name, len);
+}
+
+/* Instances of the certificates loaded on demand ("tune.ssl.lazy-load"), and
+ * their number. Both are protected by the ckch_lock.
+ */
+static struct list ssl_lazy_insts = LIST_HEAD_INIT(ssl_lazy_insts);
+static unsigned int ssl_lazy_count;
+
+/* Releases the least recently used instance of a certificate loaded on demand.
+ * The parsed certificate is released with its last instance, only its PEM
+ * contents are kept. Must be called with the ckch_lock held.
+ */
+static void ssl_sock_lazy_evict()
+{
+	struct ckch_inst *inst, *victim = NULL;
+	struct ckch_store *store;
+	struct bind_conf *bind_conf;
+
+	list_for_each_entry(inst, &ssl_lazy_insts, by_lazy) {
+		if (!victim || (int)(inst->last_use - victim->last_use) < 0)
+			victim = inst;
+	}
+	if (!victim)
+		return;
+
+	store = victim->ckch_store;
+	bind_conf = victim->bind_conf;
+	HA_RWLOCK_WRLOCK(SNI_LOCK, &bind_conf->sni_lock);
+	ckch_inst_free(victim);
+	HA_RWLOCK_WRUNLOCK(SNI_LOCK, &bind_conf->sni_lock);
+	ssl_lazy_count--;
+
+	if (LIST_ISEMPTY(&store->ckch_inst)) {
+		ssl_sock_free_cert_key_and_chain_contents(store->ckch);
+#ifdef HAVE_SSL_CERT_COMP
+		ckch_cert_comp_release(store->cert_comp);
+		store->cert_comp = NULL;
+#endif
+	}
+}
+
+/* Instantiates for <s> the certificate loaded on demand whose SNI filters match
+ * the lower case <name>, or its wildcard part <wildp> if not NULL, evicting the
+ * least recently used one if there are too many. Returns 1 if an instance was
+ * created (possibly by another thread), 0 if there is no such certificate, or
+ * -1 if it could not be loaded now. The contents of the trash are lost. Must be
+ * called without the SNI lock.
+ */
+static int ssl_sock_lazy_load(struct bind_conf *s, const char *name, const char *wildp)
+{
+	struct ebmb_node *node;
+	struct crtlist_entry *entry;
+	struct ckch_store *store;
+	struct ckch_inst *inst = NULL;
+	struct sni_ctx *sc0, *sc0s;
+	char *err = NULL;
+	int ret = 1;
+
+	/* the sni_lazy tree never changes once the configuration is parsed */
+	node = ebst_lookup(&s->sni_lazy, name);
+	if (!node && wildp)
+		node = ebst_lookup(&s->sni_lazy, wildp);
+	if (!node)
+		return 0;
+
+	entry = container_of(node, struct sni_lazy, name)->entry;
+	store = entry->node.key;
+	if (store->lazy_err)
+		return 0;
+
+	/* never wait for an operation on the certificates from the CLI */
+	if (HA_SPIN_TRYLOCK(CKCH_LOCK, &ckch_lock))
+		return -1;
+
+	list_for_each_entry(inst, &entry->ckch_inst, by_crtlist_entry) {
+		if (inst->bind_conf == s)
+			goto end;
+	}
+	inst = NULL;
+
+	while (ssl_lazy_count >= global_ssl.lazy_load)
+		ssl_sock_lazy_evict();
+
+	if (!store->ckch->cert) {
+		if (ssl_sock_load_pem_into_ckch(store->path, store->pem, store->ckch, &err) != 0)
+			goto fail;
+		if (!store->ckch->key || !X509_check_private_key(store->ckch->cert, store->ckch->key)) {
+			memprintf(&err, "%sno private key matching the certificate in '%s'.\n",
+			          err ? err : "", store->path);
+			goto fail;
+		}
+	}
+
+	if (ckch_inst_new_load_store(store->path, store, s, entry->ssl_conf, entry->filters,
+	                             entry->fcount, &inst, &err) & ERR_CODE)
+		goto fail;
+
+	list_for_each_entry_safe(sc0, sc0s, &inst->sni_ctx, by_ckch_inst) {
+		/* all the sni_ctx share the same SSL_CTX */
+		if (!sc0->order && (ssl_sock_prepare_ctx(s, inst->ssl_conf, sc0->ctx, &err) & ERR_CODE))
+			goto fail;
+	}
+
+	HA_RWLOCK_WRLOCK(SNI_LOCK, &s->sni_lock);
+	ssl_sock_load_cert_sni(inst, s);
+	HA_RWLOCK_WRUNLOCK(SNI_LOCK, &s->sni_lock);
+
+	inst->lazy = 1;
+	inst->last_use = now_ms;
+	inst->crtlist_entry = entry;
+	LIST_ADDQ(&store->ckch_inst, &inst->by_ckchs);
+	LIST_ADDQ(&entry->ckch_inst, &inst->by_crtlist_entry);
+	LIST_ADDQ(&ssl_lazy_insts, &inst->by_lazy);
+	ssl_lazy_count++;
+ end:
+	HA_SPIN_UNLOCK(CKCH_LOCK, &ckch_lock);
+	return ret;
+
+ fail:
+	/* this will not work better next time */
+	store->lazy_err = 1;
+	ckch_inst_free(inst);
+	ssl_sock_free_cert_key_and_chain_contents(store->ckch);
+	send_log(NULL, LOG_ERR, "Failed to load the certificate '%s' on demand: %s",
+	         store->path, err ? err : "unknown error\n");
+	free(err);
+	ret = 0;
+	goto end;
+}
+
 #if ((HA_OPENSSL_VERSION_NUMBER >= 0x10101000L) || defined(OPENSSL_IS_BORINGSSL))
 
 int ssl_sock_switchctx_err_cbk(SSL *ssl, int *al, void *priv)
@@ -2156,8 +2950,11 @@ int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *arg)
 	const uint8_t *servername;
 	size_t servername_len;
 	struct ebmb_node *node, *n, *node_ecdsa = NULL, *node_rsa = NULL, *node_anonymous = NULL;
+	struct sni_ctx *sni = NULL;
+	unsigned int hash, sig;
 	int allow_early = 0;
-	int i;
+	int lazy_ret = 0;
+	int i, len;
 
 	conn = SSL_get_ex_data(ssl, ssl_app_data_index);
 	s = __objt_listener(conn->target)->bind_conf;
@@ -2296,15 +3093,24 @@ int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *arg)
 		}
 	}
 
+	/* the name must be built again after a certificate was loaded on demand */
+ sni_lookup:
+	wildp = NULL;
 	for (i = 0; i < trash.size && i < servername_len; i++) {
 		trash.area[i] = tolower(servername[i]);
 		if (!wildp && (trash.area[i] == '.'))
 			wildp = &trash.area[i];
 	}
 	trash.area[i] = 0;
+	len = i;
+	hash = XXH32(trash.area, len, 0);
+	sig = has_ecdsa_sig | (has_rsa_sig << 1);
 
 	HA_RWLOCK_RDLOCK(SNI_LOCK, &s->sni_lock);
 
+	if (ssl_sni_cache_get(s, trash.area, len, hash, sig, &sni))
+		goto sni_resolved;
+
 	for (i = 0; i < 2; i++) {
 		if (i == 0) 	/* lookup in full qualified names */
 			node = ebst_lookup(&s->sni_ctx, trash.area);
@@ -2339,20 +3145,41 @@ int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *arg)
 				 : node_rsa                   /* no rsa signature case (far far away) */
 				 )));
 		if (node) {
-			/* switch ctx */
-			struct ssl_bind_conf *conf = container_of(node, struct sni_ctx, name)->conf;
-			ssl_sock_switchctx_set(ssl, container_of(node, struct sni_ctx, name)->ctx);
-			if (conf) {
-				methodVersions[conf->ssl_methods.min].ssl_set_version(ssl, SET_MIN);
-				methodVersions[conf->ssl_methods.max].ssl_set_version(ssl, SET_MAX);
-				if (conf->early_data)
-					allow_early = 1;
-			}
-			HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
-			goto allow_early;
+			sni = container_of(node, struct sni_ctx, name);
+			break;
 		}
 	}
 
+	if (!sni && !lazy_ret && !eb_is_empty(&s->sni_lazy)) {
+		HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
+		lazy_ret = ssl_sock_lazy_load(s, trash.area, wildp);
+		if (lazy_ret > 0)
+			goto sni_lookup;
+		HA_RWLOCK_RDLOCK(SNI_LOCK, &s->sni_lock);
+	}
+
+	/* a temporary failure to load a certificate must not be remembered */
+	if (lazy_ret >= 0)
+		ssl_sni_cache_set(s, trash.area, len, hash, sig, sni);
+
+ sni_resolved:
+	if (sni) {
+		/* switch ctx */
+		struct ssl_bind_conf *conf = sni->conf;
+
+		if (sni->ckch_inst->lazy)
+			sni->ckch_inst->last_use = now_ms;
+		ssl_sock_switchctx_set(ssl, sni->ctx);
+		if (conf) {
+			methodVersions[conf->ssl_methods.min].ssl_set_version(ssl, SET_MIN);
+			methodVersions[conf->ssl_methods.max].ssl_set_version(ssl, SET_MAX);
+			if (conf->early_data)
+				allow_early = 1;
+		}
+		HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
+		goto allow_early;
+	}
+
 	HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
 #if (!defined SSL_NO_GENERATE_CERTIFICATES)
 	if (s->generate_certs && ssl_sock_generate_certificate(trash.area, s, ssl)) {
@@ -2398,6 +3225,9 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv)
 	const char *wildp = NULL;
 	struct ebmb_node *node, *n;
 	struct bind_conf *s = priv;
+	struct sni_ctx *sni = NULL;
+	unsigned int hash;
+	int lazy_ret = 0;
 	int i;
 	(void)al; /* shut gcc stupid warning */
 
@@ -2415,6 +3245,9 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv)
 		return SSL_TLSEXT_ERR_NOACK;
 	}
 
+	/* the name must be built again after a certificate was loaded on demand */
+ sni_lookup:
+	wildp = NULL;
 	for (i = 0; i < trash.size; i++) {
 		if (!servername[i])
 			break;
@@ -2423,9 +3256,16 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv)
 			wildp = &trash.area[i];
 	}
 	trash.area[i] = 0;
+	hash = XXH32(trash.area, i, 0);
 
 	HA_RWLOCK_RDLOCK(SNI_LOCK, &s->sni_lock);
 	node = NULL;
+	if (ssl_sni_cache_get(s, trash.area, i, hash, 0, &sni)) {
+		if (sni)
+			node = &sni->name;
+		goto sni_resolved;
+	}
+
 	/* lookup in full qualified names */
 	for (n = ebst_lookup(&s->sni_ctx, trash.area); n; n = ebmb_next_dup(n)) {
 		/* lookup a not neg filter */
@@ -2444,6 +3284,21 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv)
 			}
 		}
 	}
+
+	if (!node && !lazy_ret && !eb_is_empty(&s->sni_lazy)) {
+		HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
+		lazy_ret = ssl_sock_lazy_load(s, trash.area, wildp);
+		if (lazy_ret > 0)
+			goto sni_lookup;
+		HA_RWLOCK_RDLOCK(SNI_LOCK, &s->sni_lock);
+	}
+
+	/* a temporary failure to load a certificate must not be remembered */
+	if (lazy_ret >= 0)
+		ssl_sni_cache_set(s, trash.area, i, hash, 0,
+		                  node ? container_of(node, struct sni_ctx, name) : NULL);
+
+ sni_resolved:
 	if (!node) {
 #if (!defined SSL_NO_GENERATE_CERTIFICATES)
 		if (s->generate_certs && ssl_sock_generate_certificate(servername, s, ssl)) {
@@ -2462,7 +3317,10 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv)
 	}
 
 	/* switch ctx */
-	ssl_sock_switchctx_set(ssl, container_of(node, struct sni_ctx, name)->ctx);
+	sni = container_of(node, struct sni_ctx, name);
+	if (sni->ckch_inst->lazy)
+		sni->ckch_inst->last_use = now_ms;
+	ssl_sock_switchctx_set(ssl, sni->ctx);
 	HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
 	return SSL_TLSEXT_ERR_OK;
 }
@@ -2782,6 +3640,7 @@ void ssl_sock_load_cert_sni(struct ckch_inst *ckch_inst, struct bind_conf *bind_
 			ebst_insert(&bind_conf->sni_w_ctx, &sc0->name);
 		else
 			ebst_insert(&bind_conf->sni_ctx, &sc0->name);
+		bind_conf->sni_gen++;
 
 		/* replace the default_ctx if required with the first ctx */
 		if (ckch_inst->is_default && !def) {
@@ -3317,6 +4176,68 @@ int ckch_inst_new_load_multi_store(const char *path, struct ckch_store *ckchs,
  *     ERR_ALERT if the reason of the error is available in err
  *     ERR_WARN if a warning is available into err
  */
+#ifdef HAVE_SSL_CERT_COMP
+static int ssl_cert_comp_index = -1;
+
+/* Release the reference of an SSL_CTX on the compressed certificate chain of
+ * its ckch_store.
+ */
+static void ssl_sock_cert_comp_free_func(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+	ckch_cert_comp_release(ptr);
+}
+
+/* BoringSSL callback compressing with zlib the <in> Certificate message of
+ * <in_len> bytes into <out>. The chain compressed once for the ckch_store of
+ * the SSL_CTX of <ssl> is reused. Returns 1 if succeeded, 0 if not.
+ */
+static int ssl_sock_cert_compress_zlib(SSL *ssl, CBB *out, const uint8_t *in, size_t in_len)
+{
+	struct ckch_cert_comp *cc;
+	const struct ckch_cert_comp_msg *msg;
+	int cached, ret;
+
+	cc = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ssl_cert_comp_index);
+	if (!cc)
+		return 0;
+
+	msg = ckch_cert_comp_get_msg(cc, in, in_len, &cached);
+	if (!msg)
+		return 0;
+
+	ret = CBB_add_bytes(out, msg->data + msg->len, msg->comp_len);
+	if (!cached)
+		free((void *)msg);
+	return ret;
+}
+
+/* Enable the certificate compression (RFC 8879) on <ctx> SSL_CTX built from
+ * <ckchs>, whose compressed chain is shared by all its instances.
+ * Returns an ERR_* code.
+ */
+static int ssl_sock_set_cert_comp(const char *path, struct ckch_store *ckchs, SSL_CTX *ctx, char **err)
+{
+	struct ckch_cert_comp *cc;
+
+	cc = ckch_store_get_cert_comp(ckchs);
+	if (!cc || !SSL_CTX_set_ex_data(ctx, ssl_cert_comp_index, cc)) {
+		ckch_cert_comp_release(cc);
+		goto err;
+	}
+
+	if (!SSL_CTX_add_cert_compression_alg(ctx, HA_TLS_CERT_COMP_ZLIB,
+	                                      ssl_sock_cert_compress_zlib, NULL))
+		goto err;
+
+	return 0;
+
+ err:
+	memprintf(err, "%sunable to enable the certificate compression for cert '%s'.\n",
+	          err && *err ? *err : "", path);
+	return ERR_ALERT | ERR_FATAL;
+}
+#endif
+
 int ckch_inst_new_load_store(const char *path, struct ckch_store *ckchs, struct bind_conf *bind_conf,
                                     struct ssl_bind_conf *ssl_conf, char **sni_filter, int fcount, struct ckch_inst **ckchi, char **err)
 {
@@ -3353,6 +4274,14 @@ int ckch_inst_new_load_store(const char *path, struct ckch_store *ckchs, struct
 	if (errcode & ERR_CODE)
 		goto error;
 
+#ifdef HAVE_SSL_CERT_COMP
+	if (bind_conf->quic_cert_comp) {
+		errcode |= ssl_sock_set_cert_comp(path, ckchs, ctx, err);
+		if (errcode & ERR_CODE)
+			goto error;
+	}
+#endif
+
 	ckch_inst = ckch_inst_new();
 	if (!ckch_inst) {
 		memprintf(err, "%sunable to allocate SSL context for cert '%s'.\n",
@@ -3512,6 +4441,35 @@ int ssl_initialize_random()
 	return random_initialized;
 }
 
+/* Indexes in the sni_lazy tree of <bind_conf> the SNI filters of <entry>, whose
+ * certificate is loaded on demand. Returns a set of ERR_* flags possibly with
+ * an error in <err>.
+ */
+static int ssl_sock_index_lazy(struct crtlist_entry *entry, struct bind_conf *bind_conf, char **err)
+{
+	struct sni_lazy *sl;
+	const char *name;
+	int i, j, len;
+
+	for (i = 0; i < entry->fcount; i++) {
+		name = entry->filters[i];
+		if (*name == '*')
+			name++;
+		len = strlen(name);
+
+		sl = malloc(sizeof(*sl) + len + 1);
+		if (!sl) {
+			memprintf(err, "%sCan't alloc memory!\n", err && *err ? *err : "");
+			return ERR_ALERT | ERR_FATAL;
+		}
+		for (j = 0; j <= len; j++)
+			sl->name.key[j] = tolower((unsigned char)name[j]);
+		sl->entry = entry;
+		ebst_insert(&bind_conf->sni_lazy, &sl->name);
+	}
+	return 0;
+}
+
 /*  Load a crt-list file, this is done in 2 parts:
  *  - store the content of the file in a crtlist structure with crtlist_entry structures
  *  - generate the instances by iterating on entries in the crtlist struct
@@ -3568,6 +4526,13 @@ int ssl_sock_load_cert_list_file(char *file, int dir, struct bind_conf *bind_con
 		struct ckch_inst *ckch_inst = NULL;
 
 		store = entry->node.key;
+		if (store->pem) {
+			/* loaded on demand */
+			cfgerr |= ssl_sock_index_lazy(entry, bind_conf, err);
+			if (cfgerr & ERR_CODE)
+				goto error;
+			continue;
+		}
 		cfgerr |= ssl_sock_load_ckchs(store->path, store, bind_conf, entry->ssl_conf, entry->filters, entry->fcount, &ckch_inst, err);
 		if (cfgerr & ERR_CODE) {
 			memprintf(err, "error processing line %d in file '%s' : %s", entry->linenum, file, *err);
@@ -3756,6 +4721,10 @@ ssl_sock_initial_ctx(struct bind_conf *bind_conf)
 		options |= SSL_OP_NO_TICKET;
 	if (bind_conf->ssl_options & BC_SSL_O_PREF_CLIE_CIPH)
 		options &= ~SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef HAVE_SSL_KTLS
+	if (bind_conf->ssl_options & BC_SSL_O_KTLS)
+		options |= SSL_OP_ENABLE_KTLS;
+#endif
 
 #ifdef SSL_OP_NO_RENEGOTIATION
 	options |= SSL_OP_NO_RENEGOTIATION;
@@ -3805,18 +4774,19 @@ static inline struct shared_block *sh_ssl_sess_first_block(struct sh_ssl_sess_hd
 
 }
 
-/* store a session into the cache
+/* store a session into the cache shard <shard>
  * s_id : session id padded with zero to SSL_MAX_SSL_SESSION_ID_LENGTH
  * data: asn1 encoded session
  * data_len: asn1 encoded session length
  * Returns 1 id session was stored (else 0)
  */
-static int sh_ssl_sess_store(unsigned char *s_id, unsigned char *data, int data_len)
+static int sh_ssl_sess_store(unsigned int shard, unsigned char *s_id, unsigned char *data, int data_len)
 {
+	struct shared_context *shctx = ssl_shctx[shard];
 	struct shared_block *first;
 	struct sh_ssl_sess_hdr *sh_ssl_sess, *oldsh_ssl_sess;
 
-	first = shctx_row_reserve_hot(ssl_shctx, NULL, data_len + sizeof(struct sh_ssl_sess_hdr));
+	first = shctx_row_reserve_hot(shctx, NULL, data_len + sizeof(struct sh_ssl_sess_hdr));
 	if (!first) {
 		/* Could not retrieve enough free blocks to store that session */
 		return 0;
@@ -3829,25 +4799,25 @@ static int sh_ssl_sess_store(unsigned char *s_id, unsigned char *data, int data_
 
 	/* it returns the already existing node
            or current node if none, never returns null */
-	oldsh_ssl_sess = sh_ssl_sess_tree_insert(sh_ssl_sess);
+	oldsh_ssl_sess = sh_ssl_sess_tree_insert(sh_ssl_sess_tree[shard], sh_ssl_sess);
 	if (oldsh_ssl_sess != sh_ssl_sess) {
 		 /* NOTE: Row couldn't be in use because we lock read & write function */
 		/* release the reserved row */
-		shctx_row_dec_hot(ssl_shctx, first);
+		shctx_row_dec_hot(shctx, first);
 		/* replace the previous session already in the tree */
 		sh_ssl_sess = oldsh_ssl_sess;
 		/* ignore the previous session data, only use the header */
 		first = sh_ssl_sess_first_block(sh_ssl_sess);
-		shctx_row_inc_hot(ssl_shctx, first);
+		shctx_row_inc_hot(shctx, first);
 		first->len = sizeof(struct sh_ssl_sess_hdr);
 	}
 
-	if (shctx_row_data_append(ssl_shctx, first, NULL, data, data_len) < 0) {
-		shctx_row_dec_hot(ssl_shctx, first);
+	if (shctx_row_data_append(shctx, first, NULL, data, data_len) < 0) {
+		shctx_row_dec_hot(shctx, first);
 		return 0;
 	}
 
-	shctx_row_dec_hot(ssl_shctx, first);
+	shctx_row_dec_hot(shctx, first);
 
 	return 1;
 }
@@ -3892,7 +4862,7 @@ int sh_ssl_sess_new_cb(SSL *ssl, SSL_SESSION *sess)
 	unsigned char encid[SSL_MAX_SSL_SESSION_ID_LENGTH];   /* encoded id */
 	unsigned char *p;
 	int data_len;
-	unsigned int sid_length;
+	unsigned int sid_length, shard;
 	const unsigned char *sid_data;
 
 	/* Session id is already stored in to key and session id is known
@@ -3929,10 +4899,11 @@ int sh_ssl_sess_new_cb(SSL *ssl, SSL_SESSION *sess)
 	i2d_SSL_SESSION(sess, &p);
 
 
-	shctx_lock(ssl_shctx);
+	shard = sh_ssl_sess_shard(encid);
+	shctx_lock(ssl_shctx[shard]);
 	/* store to cache */
-	sh_ssl_sess_store(encid, encsess, data_len);
-	shctx_unlock(ssl_shctx);
+	sh_ssl_sess_store(shard, encid, encsess, data_len);
+	shctx_unlock(ssl_shctx[shard]);
 err:
 	/* reset original length values */
 	SSL_SESSION_set1_id(sess, encid, sid_length);
@@ -3949,6 +4920,7 @@ SSL_SESSION *sh_ssl_sess_get_cb(SSL *ssl, __OPENSSL_110_CONST__ unsigned char *k
 	unsigned char tmpkey[SSL_MAX_SSL_SESSION_ID_LENGTH];
 	SSL_SESSION *sess;
 	struct shared_block *first;
+	unsigned int shard;
 
 	global.shctx_lookups++;
 
@@ -3963,13 +4935,14 @@ SSL_SESSION *sh_ssl_sess_get_cb(SSL *ssl, __OPENSSL_110_CONST__ unsigned char *k
 	}
 
 	/* lock cache */
-	shctx_lock(ssl_shctx);
+	shard = sh_ssl_sess_shard(key);
+	shctx_lock(ssl_shctx[shard]);
 
 	/* lookup for session */
-	sh_ssl_sess = sh_ssl_sess_tree_lookup(key);
+	sh_ssl_sess = sh_ssl_sess_tree_lookup(sh_ssl_sess_tree[shard], key);
 	if (!sh_ssl_sess) {
 		/* no session found: unlock cache and exit */
-		shctx_unlock(ssl_shctx);
+		shctx_unlock(ssl_shctx[shard]);
 		global.shctx_misses++;
 		return NULL;
 	}
@@ -3977,9 +4950,9 @@ SSL_SESSION *sh_ssl_sess_get_cb(SSL *ssl, __OPENSSL_110_CONST__ unsigned char *k
 	/* sh_ssl_sess (shared_block->data) is at the end of shared_block */
 	first = sh_ssl_sess_first_block(sh_ssl_sess);
 
-	shctx_row_data_get(ssl_shctx, first, data, sizeof(struct sh_ssl_sess_hdr), first->len-sizeof(struct sh_ssl_sess_hdr));
+	shctx_row_data_get(ssl_shctx[shard], first, data, sizeof(struct sh_ssl_sess_hdr), first->len-sizeof(struct sh_ssl_sess_hdr));
 
-	shctx_unlock(ssl_shctx);
+	shctx_unlock(ssl_shctx[shard]);
 
 	/* decode ASN1 session */
 	p = data;
@@ -3999,7 +4972,7 @@ void sh_ssl_sess_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
 {
 	struct sh_ssl_sess_hdr *sh_ssl_sess;
 	unsigned char tmpkey[SSL_MAX_SSL_SESSION_ID_LENGTH];
-	unsigned int sid_length;
+	unsigned int sid_length, shard;
 	const unsigned char *sid_data;
 	(void)ctx;
 
@@ -4011,17 +4984,18 @@ void sh_ssl_sess_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
 		sid_data = tmpkey;
 	}
 
-	shctx_lock(ssl_shctx);
+	shard = sh_ssl_sess_shard(sid_data);
+	shctx_lock(ssl_shctx[shard]);
 
 	/* lookup for session */
-	sh_ssl_sess = sh_ssl_sess_tree_lookup(sid_data);
+	sh_ssl_sess = sh_ssl_sess_tree_lookup(sh_ssl_sess_tree[shard], sid_data);
 	if (sh_ssl_sess) {
 		/* free session */
 		sh_ssl_sess_tree_delete(sh_ssl_sess);
 	}
 
 	/* unlock cache */
-	shctx_unlock(ssl_shctx);
+	shctx_unlock(ssl_shctx[shard]);
 }
 
 /* Set session cache mode to server and disable openssl internal cache.
@@ -4031,7 +5005,7 @@ void ssl_set_shctx(SSL_CTX *ctx)
 {
 	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)SHCTX_APPNAME, strlen(SHCTX_APPNAME));
 
-	if (!ssl_shctx) {
+	if (!ssl_shctx_shards) {
 		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
 		return;
 	}
@@ -4527,6 +5501,10 @@ int ssl_sock_prepare_srv_ctx(struct server *srv)
 
 	if (srv->ssl_ctx.options & SRV_SSL_O_NO_TLS_TICKETS)
 		options |= SSL_OP_NO_TICKET;
+#ifdef HAVE_SSL_KTLS
+	if (srv->ssl_ctx.options & SRV_SSL_O_KTLS)
+		options |= SSL_OP_ENABLE_KTLS;
+#endif
 	SSL_CTX_set_options(ctx, options);
 
 #if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
@@ -4752,23 +5730,37 @@ int ssl_sock_prepare_bind_conf(struct bind_conf *bind_conf)
 			return -1;
 		}
 	}
-	if (!ssl_shctx && global.tune.sslcachesize) {
-		alloc_ctx = shctx_init(&ssl_shctx, global.tune.sslcachesize,
-		                       sizeof(struct sh_ssl_sess_hdr) + SHSESS_BLOCK_MIN_SIZE, -1,
-		                       sizeof(*sh_ssl_sess_tree),
-		                       ((global.nbthread > 1) || (!global_ssl.private_cache && (global.nbproc > 1))) ? 1 : 0);
-		if (alloc_ctx <= 0) {
-			if (alloc_ctx == SHCTX_E_INIT_LOCK)
-				ha_alert("Unable to initialize the lock for the shared SSL session cache. You can retry using the global statement 'tune.ssl.force-private-cache' but it could increase CPU usage due to renegotiations if nbproc > 1.\n");
-			else
-				ha_alert("Unable to allocate SSL session cache.\n");
-			return -1;
+	if (!ssl_shctx_shards && global.tune.sslcachesize) {
+		unsigned int shards = global_ssl.cache_shards;
+		unsigned int i;
+
+		/* one shard per thread by default */
+		if (!shards)
+			shards = global.nbthread;
+		if (shards > SSL_SHCTX_MAX_SHARDS)
+			shards = SSL_SHCTX_MAX_SHARDS;
+		if (shards > global.tune.sslcachesize)
+			shards = global.tune.sslcachesize;
+
+		for (i = 0; i < shards; i++) {
+			alloc_ctx = shctx_init(&ssl_shctx[i], (global.tune.sslcachesize + shards - 1) / shards,
+			                       sizeof(struct sh_ssl_sess_hdr) + SHSESS_BLOCK_MIN_SIZE, -1,
+			                       sizeof(*sh_ssl_sess_tree[i]),
+			                       ((global.nbthread > 1) || (!global_ssl.private_cache && (global.nbproc > 1))) ? 1 : 0);
+			if (alloc_ctx <= 0) {
+				if (alloc_ctx == SHCTX_E_INIT_LOCK)
+					ha_alert("Unable to initialize the lock for the shared SSL session cache. You can retry using the global statement 'tune.ssl.force-private-cache' but it could increase CPU usage due to renegotiations if nbproc > 1.\n");
+				else
+					ha_alert("Unable to allocate SSL session cache.\n");
+				return -1;
+			}
+			/* free block callback */
+			ssl_shctx[i]->free_block = sh_ssl_sess_free_blocks;
+			/* init the root tree within the extra space */
+			sh_ssl_sess_tree[i] = (void *)ssl_shctx[i] + sizeof(struct shared_context);
+			*sh_ssl_sess_tree[i] = EB_ROOT_UNIQUE;
 		}
-		/* free block callback */
-		ssl_shctx->free_block = sh_ssl_sess_free_blocks;
-		/* init the root tree within the extra space */
-		sh_ssl_sess_tree = (void *)ssl_shctx + sizeof(struct shared_context);
-		*sh_ssl_sess_tree = EB_ROOT_UNIQUE;
+		ssl_shctx_shards = shards;
 	}
 	err = 0;
 	/* initialize all certificate contexts */
@@ -4832,6 +5824,15 @@ void ssl_sock_free_all_ctx(struct bind_conf *bind_conf)
 		free(sni);
 		node = back;
 	}
+
+	node = ebmb_first(&bind_conf->sni_lazy);
+	while (node) {
+		back = ebmb_next(node);
+		ebmb_delete(node);
+		free(ebmb_entry(node, struct sni_lazy, name));
+		node = back;
+	}
+
 	SSL_CTX_free(bind_conf->initial_ctx);
 	bind_conf->initial_ctx = NULL;
 	SSL_CTX_free(bind_conf->default_ctx);
@@ -5024,7 +6025,10 @@ static int ssl_sock_init(struct connection *conn, void **xprt_ctx)
 	ctx->conn = conn;
 	ctx->subs = NULL;
 	ctx->xprt_st = 0;
+	ctx->ktls_ctrl_msg = 0;
 	ctx->xprt_ctx = NULL;
+	/* nothing may be spliced until the kernel encrypts the records */
+	conn->flags |= CO_FL_NO_SND_PIPE;
 
 	/* Only work with sockets for now, this should be adapted when we'll
 	 * add QUIC support.
@@ -5800,6 +6804,24 @@ static size_t ssl_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 	goto leave;
 }
 
+#if defined(HAVE_SSL_KTLS) && defined(USE_LINUX_SPLICE)
+/* Send spliced data from <pipe> once the kernel encrypts the records for us
+ * (kTLS). The data then go unmodified to the underlying transport layer. The
+ * connection is never elected for splicing before that, this is only a safety
+ * net. Returns the number of bytes sent.
+ */
+static int ssl_sock_from_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe)
+{
+	struct ssl_sock_ctx *ctx = xprt_ctx;
+
+	if (!ctx || !(ctx->xprt_st & SSL_SOCK_KTLS_TX) || ctx->ktls_ctrl_msg || !ctx->xprt->snd_pipe) {
+		conn->flags |= CO_FL_ERROR;
+		return 0;
+	}
+	return ctx->xprt->snd_pipe(conn, ctx->xprt_ctx, pipe);
+}
+#endif
+
 static void ssl_sock_close(struct connection *conn, void *xprt_ctx) {
 
 	struct ssl_sock_ctx *ctx = xprt_ctx;
@@ -6510,7 +7532,11 @@ struct xprt_ops ssl_sock = {
 	.remove_xprt = ssl_remove_xprt,
 	.add_xprt = ssl_add_xprt,
 	.rcv_pipe = NULL,
+#if defined(HAVE_SSL_KTLS) && defined(USE_LINUX_SPLICE)
+	.snd_pipe = ssl_sock_from_pipe,
+#else
 	.snd_pipe = NULL,
+#endif
 	.shutr    = NULL,
 	.shutw    = ssl_sock_shutw,
 	.close    = ssl_sock_close,
@@ -6608,6 +7634,9 @@ static void __ssl_sock_init(void)
 #endif
 #if (HA_OPENSSL_VERSION_NUMBER >= 0x1000200fL && !defined OPENSSL_NO_TLSEXT && !defined OPENSSL_IS_BORINGSSL)
 	sctl_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, ssl_sock_sctl_free_func);
+#endif
+#ifdef HAVE_SSL_CERT_COMP
+	ssl_cert_comp_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, ssl_sock_cert_comp_free_func);
 #endif
 	ssl_app_data_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
 	ssl_capture_ptr_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, ssl_sock_capture_free_func);
@@ -6643,6 +7672,9 @@ static void __ssl_sock_init(void)
 	BIO_meth_set_gets(ha_meth, ha_ssl_gets);
 
 	HA_SPIN_INIT(&ckch_lock);
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	HA_SPIN_INIT(&ocsp_lock);
+#endif
 
 	/* Try to register dedicated SSL/TLS protocol message callbacks for
 	 * heartbleed attack (CVE-2014-0160) and clienthello.
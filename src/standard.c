@@ -1796,11 +1796,24 @@ const char *csv_enc_append(const char *str, int quote, struct buffer *output)
 int url_decode(char *string, int in_form)
 {
 	char *in, *out;
+	size_t len;
 	int ret = -1;
 
 	in = string;
 	out = string;
 	while (*in) {
+		/* the libc usually scans several bytes at once, so let's
+		 * copy the runs of characters needing no decoding together.
+		 */
+		len = strcspn(in, "+%?");
+		if (len) {
+			if (out != in)
+				memmove(out, in, len);
+			in += len;
+			out += len;
+			continue;
+		}
+
 		switch (*in) {
 		case '+' :
 			*out++ = in_form ? ' ' : *in;
@@ -4672,6 +4685,24 @@ uint64_t ha_random64()
 	return result;
 }
 
+/* Per-thread random number generator state, see ha_random64_local() */
+THREAD_LOCAL uint64_t ha_random_local_state[2];
+
+/* Seeds the per-thread random state of the calling thread from the shared
+ * generator, once the latter was seeded and moved to the sequence of the
+ * current process.
+ */
+static int ha_random_init_per_thread()
+{
+	do {
+		ha_random_local_state[0] = ha_random64();
+		ha_random_local_state[1] = ha_random64();
+	} while (!ha_random_local_state[0] && !ha_random_local_state[1]);
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(ha_random_init_per_thread);
+
 /* seeds the random state using up to <len> bytes from <seed>, starting with
  * the first non-zero byte.
  */
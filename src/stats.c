@@ -51,6 +51,7 @@
 #include <proto/checks.h>
 #include <proto/cli.h>
 #include <proto/compression.h>
+#include <proto/counters.h>
 #include <proto/dns.h>
 #include <proto/stats.h>
 #include <proto/fd.h>
@@ -251,6 +252,22 @@ const struct name_desc stat_fields[ST_F_TOTAL_FIELDS] = {
 	[ST_F_RT_MAX]                        = { .name = "rtime_max",                   .desc = "Maximum observed time spent waiting for a server response, in milliseconds (backend/server)" },
 	[ST_F_TT_MAX]                        = { .name = "ttime_max",                   .desc = "Maximum observed total request+response time (request+queue+connect+response+processing), in milliseconds (backend/server)" },
 	[ST_F_EINT]                          = { .name = "eint",                        .desc = "Total number of internal errors since process started"},
+	[ST_F_QUIC_RX_PKTS]                  = { .name = "quic_rx_pkts",                .desc = "Total number of QUIC packets received on this frontend/listener since the worker process started" },
+	[ST_F_QUIC_TX_PKTS]                  = { .name = "quic_tx_pkts",                .desc = "Total number of QUIC packets sent on this frontend/listener since the worker process started" },
+	[ST_F_QUIC_LOST_PKTS]                = { .name = "quic_lost_pkts",              .desc = "Total number of QUIC packets declared lost on this frontend/listener since the worker process started" },
+	[ST_F_QUIC_PTO]                      = { .name = "quic_pto",                    .desc = "Total number of QUIC probe timeout expirations on this frontend/listener since the worker process started" },
+	[ST_F_QUIC_RETRIES]                  = { .name = "quic_retries",                .desc = "Total number of QUIC Retry packets sent on this frontend/listener since the worker process started" },
+	[ST_F_QUIC_SRESETS]                  = { .name = "quic_sresets",                .desc = "Total number of QUIC stateless resets sent on this frontend/listener since the worker process started" },
+	[ST_F_QT_P50]                        = { .name = "qtime_p50",                   .desc = "Median of the observed times spent in the queue, in milliseconds (backend/server)" },
+	[ST_F_QT_P99]                        = { .name = "qtime_p99",                   .desc = "99th percentile of the observed times spent in the queue, in milliseconds (backend/server)" },
+	[ST_F_CT_P50]                        = { .name = "ctime_p50",                   .desc = "Median of the observed times spent waiting for a connection to complete, in milliseconds (backend/server)" },
+	[ST_F_CT_P99]                        = { .name = "ctime_p99",                   .desc = "99th percentile of the observed times spent waiting for a connection to complete, in milliseconds (backend/server)" },
+	[ST_F_RT_P50]                        = { .name = "rtime_p50",                   .desc = "Median of the observed times spent waiting for a server response, in milliseconds (backend/server)" },
+	[ST_F_RT_P99]                        = { .name = "rtime_p99",                   .desc = "99th percentile of the observed times spent waiting for a server response, in milliseconds (backend/server)" },
+	[ST_F_TT_P50]                        = { .name = "ttime_p50",                   .desc = "Median of the observed total request+response times, in milliseconds (backend/server)" },
+	[ST_F_TT_P99]                        = { .name = "ttime_p99",                   .desc = "99th percentile of the observed total request+response times, in milliseconds (backend/server)" },
+	[ST_F_QUIC_HO_FWD]                   = { .name = "quic_ho_fwd",                 .desc = "Total number of QUIC datagrams received on this frontend/listener and forwarded to another process since the worker process started" },
+	[ST_F_QUIC_HO_RCVD]                  = { .name = "quic_ho_rcvd",                .desc = "Total number of QUIC datagrams forwarded by another process to this frontend/listener since the worker process started" },
 };
 
 /* one line of info */
@@ -1392,6 +1409,34 @@ static int stats_dump_one_line(const struct field *stats, struct proxy *px, stru
 	return ret;
 }
 
+/* Fill the latency percentile fields of <stats> with the histograms of <cnt> */
+static void stats_fill_lat_percentiles(struct field *stats, const struct be_counters *cnt)
+{
+	stats[ST_F_QT_P50] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->q_hist, 50));
+	stats[ST_F_QT_P99] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->q_hist, 99));
+	stats[ST_F_CT_P50] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->c_hist, 50));
+	stats[ST_F_CT_P99] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->c_hist, 99));
+	stats[ST_F_RT_P50] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->d_hist, 50));
+	stats[ST_F_RT_P99] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->d_hist, 99));
+	stats[ST_F_TT_P50] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->t_hist, 50));
+	stats[ST_F_TT_P99] = mkf_u32(FN_GAUGE, lat_hist_percentile(&cnt->t_hist, 99));
+}
+
+#ifdef USE_QUIC
+/* Fill the QUIC fields of <stats> with <cnt> counters. */
+static void stats_fill_quic_counters(struct field *stats, const struct quic_counters *cnt)
+{
+	stats[ST_F_QUIC_RX_PKTS]   = mkf_u64(FN_COUNTER, cnt->rx_pkts);
+	stats[ST_F_QUIC_TX_PKTS]   = mkf_u64(FN_COUNTER, cnt->tx_pkts);
+	stats[ST_F_QUIC_LOST_PKTS] = mkf_u64(FN_COUNTER, cnt->lost_pkts);
+	stats[ST_F_QUIC_PTO]       = mkf_u64(FN_COUNTER, cnt->pto);
+	stats[ST_F_QUIC_RETRIES]   = mkf_u64(FN_COUNTER, cnt->retries);
+	stats[ST_F_QUIC_SRESETS]   = mkf_u64(FN_COUNTER, cnt->sresets);
+	stats[ST_F_QUIC_HO_FWD]    = mkf_u64(FN_COUNTER, cnt->ho_fwd);
+	stats[ST_F_QUIC_HO_RCVD]   = mkf_u64(FN_COUNTER, cnt->ho_rcvd);
+}
+#endif
+
 /* Fill <stats> with the frontend statistics. <stats> is
  * preallocated array of length <len>. The length of the array
  * must be at least ST_F_TOTAL_FIELDS. If this length is less then
@@ -1411,8 +1456,8 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	stats[ST_F_SMAX]     = mkf_u32(FN_MAX, px->fe_counters.conn_max);
 	stats[ST_F_SLIM]     = mkf_u32(FO_CONFIG|FN_LIMIT, px->maxconn);
 	stats[ST_F_STOT]     = mkf_u64(FN_COUNTER, px->fe_counters.cum_sess);
-	stats[ST_F_BIN]      = mkf_u64(FN_COUNTER, px->fe_counters.bytes_in);
-	stats[ST_F_BOUT]     = mkf_u64(FN_COUNTER, px->fe_counters.bytes_out);
+	stats[ST_F_BIN]      = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, bytes_in));
+	stats[ST_F_BOUT]     = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, bytes_out));
 	stats[ST_F_DREQ]     = mkf_u64(FN_COUNTER, px->fe_counters.denied_req);
 	stats[ST_F_DRESP]    = mkf_u64(FN_COUNTER, px->fe_counters.denied_resp);
 	stats[ST_F_EREQ]     = mkf_u64(FN_COUNTER, px->fe_counters.failed_req);
@@ -1423,20 +1468,28 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	stats[ST_F_IID]      = mkf_u32(FO_KEY|FS_SERVICE, px->uuid);
 	stats[ST_F_SID]      = mkf_u32(FO_KEY|FS_SERVICE, 0);
 	stats[ST_F_TYPE]     = mkf_u32(FO_CONFIG|FS_SERVICE, STATS_TYPE_FE);
-	stats[ST_F_RATE]     = mkf_u32(FN_RATE, read_freq_ctr(&px->fe_sess_per_sec));
+	stats[ST_F_RATE]     = mkf_u32(FN_RATE, read_freq_ctr_thr(&px->fe_sess_per_sec));
 	stats[ST_F_RATE_LIM] = mkf_u32(FO_CONFIG|FN_LIMIT, px->fe_sps_lim);
 	stats[ST_F_RATE_MAX] = mkf_u32(FN_MAX, px->fe_counters.sps_max);
 	stats[ST_F_WREW]     = mkf_u64(FN_COUNTER, px->fe_counters.failed_rewrites);
 	stats[ST_F_EINT]     = mkf_u64(FN_COUNTER, px->fe_counters.internal_errors);
+#ifdef USE_QUIC
+	{
+		struct quic_counters qcnt;
+
+		if (proxy_fe_quic_counters(px, &qcnt))
+			stats_fill_quic_counters(stats, &qcnt);
+	}
+#endif
 
 	/* http response: 1xx, 2xx, 3xx, 4xx, 5xx, other */
 	if (px->mode == PR_MODE_HTTP) {
-		stats[ST_F_HRSP_1XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[1]);
-		stats[ST_F_HRSP_2XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[2]);
-		stats[ST_F_HRSP_3XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[3]);
-		stats[ST_F_HRSP_4XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[4]);
-		stats[ST_F_HRSP_5XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[5]);
-		stats[ST_F_HRSP_OTHER]  = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[0]);
+		stats[ST_F_HRSP_1XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[1]));
+		stats[ST_F_HRSP_2XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[2]));
+		stats[ST_F_HRSP_3XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[3]));
+		stats[ST_F_HRSP_4XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[4]));
+		stats[ST_F_HRSP_5XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[5]));
+		stats[ST_F_HRSP_OTHER]  = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.rsp[0]));
 		stats[ST_F_INTERCEPTED] = mkf_u64(FN_COUNTER, px->fe_counters.intercepted_req);
 		stats[ST_F_CACHE_LOOKUPS] = mkf_u64(FN_COUNTER, px->fe_counters.p.http.cache_lookups);
 		stats[ST_F_CACHE_HITS]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.cache_hits);
@@ -1445,7 +1498,7 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	/* requests : req_rate, req_rate_max, req_tot, */
 	stats[ST_F_REQ_RATE]     = mkf_u32(FN_RATE, read_freq_ctr(&px->fe_req_per_sec));
 	stats[ST_F_REQ_RATE_MAX] = mkf_u32(FN_MAX, px->fe_counters.p.http.rps_max);
-	stats[ST_F_REQ_TOT]      = mkf_u64(FN_COUNTER, px->fe_counters.p.http.cum_req);
+	stats[ST_F_REQ_TOT]      = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->fe_counters, p.http.cum_req));
 
 	/* compression: in, out, bypassed, responses */
 	stats[ST_F_COMP_IN]      = mkf_u64(FN_COUNTER, px->fe_counters.comp_in);
@@ -1454,7 +1507,7 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	stats[ST_F_COMP_RSP]     = mkf_u64(FN_COUNTER, px->fe_counters.p.http.comp_rsp);
 
 	/* connections : conn_rate, conn_rate_max, conn_tot, conn_max */
-	stats[ST_F_CONN_RATE]     = mkf_u32(FN_RATE, read_freq_ctr(&px->fe_conn_per_sec));
+	stats[ST_F_CONN_RATE]     = mkf_u32(FN_RATE, read_freq_ctr_thr(&px->fe_conn_per_sec));
 	stats[ST_F_CONN_RATE_MAX] = mkf_u32(FN_MAX, px->fe_counters.cps_max);
 	stats[ST_F_CONN_TOT]      = mkf_u64(FN_COUNTER, px->fe_counters.cum_conn);
 
@@ -1522,6 +1575,10 @@ int stats_fill_li_stats(struct proxy *px, struct listener *l, int flags,
 	stats[ST_F_TYPE]     = mkf_u32(FO_CONFIG|FS_SERVICE, STATS_TYPE_SO);
 	stats[ST_F_WREW]     = mkf_u64(FN_COUNTER, l->counters->failed_rewrites);
 	stats[ST_F_EINT]     = mkf_u64(FN_COUNTER, l->counters->internal_errors);
+#ifdef USE_QUIC
+	if (l->bind_conf->is_quic)
+		stats_fill_quic_counters(stats, &l->quic_counters);
+#endif
 
 	if (flags & STAT_SHLGNDS) {
 		char str[INET6_ADDRSTRLEN];
@@ -1824,6 +1881,7 @@ int stats_fill_sv_stats(struct proxy *px, struct server *sv, int flags,
 	stats[ST_F_CT_MAX] = mkf_u32(FN_MAX, sv->counters.ctime_max);
 	stats[ST_F_RT_MAX] = mkf_u32(FN_MAX, sv->counters.dtime_max);
 	stats[ST_F_TT_MAX] = mkf_u32(FN_MAX, sv->counters.ttime_max);
+	stats_fill_lat_percentiles(stats, &sv->counters);
 
 	if (flags & STAT_SHLGNDS) {
 		switch (addr_to_str(&sv->addr, str, sizeof(str))) {
@@ -1893,8 +1951,8 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_SMAX]     = mkf_u32(FN_MAX, px->be_counters.conn_max);
 	stats[ST_F_SLIM]     = mkf_u32(FO_CONFIG|FN_LIMIT, px->fullconn);
 	stats[ST_F_STOT]     = mkf_u64(FN_COUNTER, px->be_counters.cum_conn);
-	stats[ST_F_BIN]      = mkf_u64(FN_COUNTER, px->be_counters.bytes_in);
-	stats[ST_F_BOUT]     = mkf_u64(FN_COUNTER, px->be_counters.bytes_out);
+	stats[ST_F_BIN]      = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, bytes_in));
+	stats[ST_F_BOUT]     = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, bytes_out));
 	stats[ST_F_DREQ]     = mkf_u64(FN_COUNTER, px->be_counters.denied_req);
 	stats[ST_F_DRESP]    = mkf_u64(FN_COUNTER, px->be_counters.denied_resp);
 	stats[ST_F_ECON]     = mkf_u64(FN_COUNTER, px->be_counters.failed_conns);
@@ -1930,13 +1988,13 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 
 	/* http response: 1xx, 2xx, 3xx, 4xx, 5xx, other */
 	if (px->mode == PR_MODE_HTTP) {
-		stats[ST_F_REQ_TOT]     = mkf_u64(FN_COUNTER, px->be_counters.p.http.cum_req);
-		stats[ST_F_HRSP_1XX]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[1]);
-		stats[ST_F_HRSP_2XX]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[2]);
-		stats[ST_F_HRSP_3XX]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[3]);
-		stats[ST_F_HRSP_4XX]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[4]);
-		stats[ST_F_HRSP_5XX]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[5]);
-		stats[ST_F_HRSP_OTHER]  = mkf_u64(FN_COUNTER, px->be_counters.p.http.rsp[0]);
+		stats[ST_F_REQ_TOT]     = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.cum_req));
+		stats[ST_F_HRSP_1XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[1]));
+		stats[ST_F_HRSP_2XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[2]));
+		stats[ST_F_HRSP_3XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[3]));
+		stats[ST_F_HRSP_4XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[4]));
+		stats[ST_F_HRSP_5XX]    = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[5]));
+		stats[ST_F_HRSP_OTHER]  = mkf_u64(FN_COUNTER, COUNTERS_GET(&px->be_counters, p.http.rsp[0]));
 		stats[ST_F_CACHE_LOOKUPS] = mkf_u64(FN_COUNTER, px->be_counters.p.http.cache_lookups);
 		stats[ST_F_CACHE_HITS]    = mkf_u64(FN_COUNTER, px->be_counters.p.http.cache_hits);
 	}
@@ -1951,7 +2009,7 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_COMP_RSP]     = mkf_u64(FN_COUNTER, px->be_counters.p.http.comp_rsp);
 	stats[ST_F_LASTSESS]     = mkf_s32(FN_AGE, be_lastsession(px));
 
-	be_samples_counter = (px->mode == PR_MODE_HTTP) ? px->be_counters.p.http.cum_req : px->be_counters.cum_lbconn;
+	be_samples_counter = (px->mode == PR_MODE_HTTP) ? COUNTERS_GET(&px->be_counters, p.http.cum_req) : px->be_counters.cum_lbconn;
 	if (be_samples_counter < TIME_STATS_SAMPLES && be_samples_counter > 0)
 		be_samples_window = be_samples_counter;
 
@@ -1964,6 +2022,7 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_CT_MAX]       = mkf_u32(FN_MAX, px->be_counters.ctime_max);
 	stats[ST_F_RT_MAX]       = mkf_u32(FN_MAX, px->be_counters.dtime_max);
 	stats[ST_F_TT_MAX]       = mkf_u32(FN_MAX, px->be_counters.ttime_max);
+	stats_fill_lat_percentiles(stats, &px->be_counters);
 
 	return 1;
 }
@@ -2115,12 +2174,45 @@ static void stats_dump_html_px_end(struct stream_interface *si, struct proxy *px
 	chunk_appendf(&trash, "<p>\n");
 }
 
+/* Maximum number of objects a stats dump may examine per call before yielding
+ * ("tune.stats.dump-budget"), 0 for no limit.
+ */
+static unsigned int stats_dump_budget = STATS_DUMP_BUDGET;
+
+/* Returns non-zero if the stats dump of <appctx> must yield before examining
+ * one more object, and accounts for this object otherwise.
+ */
+static inline int stats_dump_must_yield(struct appctx *appctx)
+{
+	if (appctx->ctx.stats.budget <= 0)
+		return 1;
+	appctx->ctx.stats.budget--;
+	return 0;
+}
+
+/* Returns non-zero if server <sv> has had some activity or changed its state
+ * since date <since>, used by the "changed" dumps.
+ */
+static inline int stats_sv_changed(const struct server *sv, unsigned long since)
+{
+	return sv->cur_sess || sv->counters.last_sess >= since || (unsigned long)sv->last_change >= since;
+}
+
+/* Returns non-zero if the backend of <px> has had some activity or changed its
+ * state since date <since>, used by the "changed" dumps.
+ */
+static inline int stats_be_changed(const struct proxy *px, unsigned long since)
+{
+	return px->beconn || px->be_counters.last_sess >= since || (unsigned long)px->last_change >= since;
+}
+
 /*
  * Dumps statistics for a proxy. The output is sent to the stream interface's
  * input buffer. Returns 0 if it had to stop dumping data because of lack of
- * buffer space, or non-zero if everything completed. This function is used
- * both by the CLI and the HTTP entry points, and is able to dump the output
- * in HTML or CSV formats. If the later, <uri> must be NULL.
+ * buffer space or because its budget of objects was exhausted, or non-zero if
+ * everything completed. This function is used both by the CLI and the HTTP
+ * entry points, and is able to dump the output in HTML or CSV formats. If the
+ * later, <uri> must be NULL.
  */
 int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
 			       struct proxy *px, struct uri_auth *uri)
@@ -2211,6 +2303,9 @@ int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
 					goto full;
 			}
 
+			if (stats_dump_must_yield(appctx))
+				goto yield;
+
 			l = LIST_ELEM(appctx->ctx.stats.l, struct listener *, by_fe);
 			if (!l->counters)
 				continue;
@@ -2246,6 +2341,9 @@ int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
 					goto full;
 			}
 
+			if (stats_dump_must_yield(appctx))
+				goto yield;
+
 			sv = appctx->ctx.stats.sv;
 
 			if (appctx->ctx.stats.flags & STAT_BOUND) {
@@ -2270,6 +2368,11 @@ int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
 				continue;
 			}
 
+			/* only report the servers which changed when asked to */
+			if ((appctx->ctx.stats.flags & STAT_CHANGED) &&
+			    !stats_sv_changed(sv, appctx->ctx.stats.since))
+				continue;
+
 			if (stats_dump_sv_stats(si, px, sv)) {
 				if (!stats_putchk(rep, htx, &trash))
 					goto full;
@@ -2281,7 +2384,9 @@ int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
 
 	case STAT_PX_ST_BE:
 		/* print the backend */
-		if (stats_dump_be_stats(si, px)) {
+		if ((!(appctx->ctx.stats.flags & STAT_CHANGED) ||
+		     stats_be_changed(px, appctx->ctx.stats.since)) &&
+		    stats_dump_be_stats(si, px)) {
 			if (!stats_putchk(rep, htx, &trash))
 				goto full;
 		}
@@ -2310,6 +2415,11 @@ int stats_dump_proxy_to_buffer(struct stream_interface *si, struct htx *htx,
   full:
 	si_rx_room_blk(si);
 	return 0;
+
+  yield:
+	/* let other tasks run, we'll be called again */
+	si_rx_endp_more(si);
+	return 0;
 }
 
 /* Dumps the HTTP stats head block to the trash for and uses the per-uri
@@ -2439,7 +2549,7 @@ static void stats_dump_html_info(struct stream_interface *si, struct uri_auth *u
 	unsigned int up = (now.tv_sec - start_date.tv_sec);
 	char scope_txt[STAT_SCOPE_TXT_MAXLEN + sizeof STAT_SCOPE_PATTERN];
 	const char *scope_ptr = stats_scope_ptr(appctx, si);
-	unsigned long long bps = (unsigned long long)read_freq_ctr(&global.out_32bps) * 32;
+	unsigned long long bps = (unsigned long long)read_freq_ctr_thr(&global.out_32bps) * 32;
 
 	/* Turn the bytes per second to bits per second and take care of the
 	 * usual ethernet overhead in order to help figure how far we are from
@@ -2504,7 +2614,7 @@ static void stats_dump_html_info(struct stream_interface *si, struct uri_auth *u
 	              global.rlimit_memmax ? " MB" : "",
 	              global.rlimit_nofile,
 	              global.maxsock, global.maxconn, global.maxpipes,
-	              actconn, pipes_used, pipes_used+pipes_free, read_freq_ctr(&global.conn_per_sec),
+	              actconn, pipes_used, pipes_used+pipes_free, read_freq_ctr_thr(&global.conn_per_sec),
 		      bps >= 1000000000UL ? (bps / 1000000000.0) : bps >= 1000000UL ? (bps / 1000000.0) : (bps / 1000.0),
 		      bps >= 1000000000UL ? 'G' : bps >= 1000000UL ? 'M' : 'k',
 	              tasks_run_queue_cur, nb_tasks_cur, ti->idle_pct
@@ -2725,6 +2835,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct htx *ht
 	struct proxy *px;
 
 	chunk_reset(&trash);
+	appctx->ctx.stats.budget = stats_dump_budget ? stats_dump_budget : INT_MAX;
 
 	switch (appctx->st2) {
 	case STAT_ST_INIT:
@@ -2775,6 +2886,11 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct htx *ht
 					goto full;
 			}
 
+			if (appctx->ctx.stats.px_st == STAT_PX_ST_INIT && stats_dump_must_yield(appctx)) {
+				si_rx_endp_more(si);
+				return 0;
+			}
+
 			px = appctx->ctx.stats.px;
 			/* skip the disabled proxies, global frontend and non-networked ones */
 			if (px->state != PR_STSTOPPED && px->uuid > 0 && (px->cap & (PR_CAP_FE | PR_CAP_BE)))
@@ -3418,7 +3534,7 @@ int stats_fill_info(struct field *info, int len)
 	struct buffer *out = get_trash_chunk();
 
 #ifdef USE_OPENSSL
-	int ssl_sess_rate = read_freq_ctr(&global.ssl_per_sec);
+	int ssl_sess_rate = read_freq_ctr_thr(&global.ssl_per_sec);
 	int ssl_key_rate = read_freq_ctr(&global.ssl_fe_keys_per_sec);
 	int ssl_reuse = 0;
 
@@ -3466,10 +3582,10 @@ int stats_fill_info(struct field *info, int len)
 	info[INF_MAXPIPES]                       = mkf_u32(FO_CONFIG|FN_LIMIT, global.maxpipes);
 	info[INF_PIPES_USED]                     = mkf_u32(0, pipes_used);
 	info[INF_PIPES_FREE]                     = mkf_u32(0, pipes_free);
-	info[INF_CONN_RATE]                      = mkf_u32(FN_RATE, read_freq_ctr(&global.conn_per_sec));
+	info[INF_CONN_RATE]                      = mkf_u32(FN_RATE, read_freq_ctr_thr(&global.conn_per_sec));
 	info[INF_CONN_RATE_LIMIT]                = mkf_u32(FO_CONFIG|FN_LIMIT, global.cps_lim);
 	info[INF_MAX_CONN_RATE]                  = mkf_u32(FN_MAX, global.cps_max);
-	info[INF_SESS_RATE]                      = mkf_u32(FN_RATE, read_freq_ctr(&global.sess_per_sec));
+	info[INF_SESS_RATE]                      = mkf_u32(FN_RATE, read_freq_ctr_thr(&global.sess_per_sec));
 	info[INF_SESS_RATE_LIMIT]                = mkf_u32(FO_CONFIG|FN_LIMIT, global.sps_lim);
 	info[INF_MAX_SESS_RATE]                  = mkf_u32(FN_RATE, global.sps_max);
 
@@ -3508,7 +3624,7 @@ int stats_fill_info(struct field *info, int len)
 	info[INF_BUSY_POLLING]                   = mkf_u32(0, !!(global.tune.options & GTUNE_BUSY_POLLING));
 	info[INF_FAILED_RESOLUTIONS]             = mkf_u32(0, dns_failed_resolutions);
 	info[INF_TOTAL_BYTES_OUT]                = mkf_u64(0, global.out_bytes);
-	info[INF_BYTES_OUT_RATE]                 = mkf_u64(FN_RATE, (unsigned long long)read_freq_ctr(&global.out_32bps) * 32);
+	info[INF_BYTES_OUT_RATE]                 = mkf_u64(FN_RATE, (unsigned long long)read_freq_ctr_thr(&global.out_32bps) * 32);
 	info[INF_DEBUG_COMMANDS_ISSUED]          = mkf_u32(0, debug_commands_issued);
 
 	return 1;
@@ -3787,8 +3903,8 @@ static int cli_parse_clear_counters(char **args, char *payload, struct appctx *a
 
 	for (px = proxies_list; px; px = px->next) {
 		if (clrall) {
-			memset(&px->be_counters, 0, sizeof(px->be_counters));
-			memset(&px->fe_counters, 0, sizeof(px->fe_counters));
+			be_counters_clear(&px->be_counters);
+			fe_counters_clear(&px->fe_counters);
 		}
 		else {
 			px->be_counters.conn_max = 0;
@@ -3809,7 +3925,7 @@ static int cli_parse_clear_counters(char **args, char *payload, struct appctx *a
 
 		for (sv = px->srv; sv; sv = sv->next)
 			if (clrall)
-				memset(&sv->counters, 0, sizeof(sv->counters));
+				be_counters_clear(&sv->counters);
 			else {
 				sv->counters.cur_sess_max = 0;
 				sv->counters.nbpend_max = 0;
@@ -3823,7 +3939,7 @@ static int cli_parse_clear_counters(char **args, char *payload, struct appctx *a
 		list_for_each_entry(li, &px->conf.listeners, by_fe)
 			if (li->counters) {
 				if (clrall)
-					memset(li->counters, 0, sizeof(*li->counters));
+					fe_counters_clear(li->counters);
 				else
 					li->counters->conn_max = 0;
 			}
@@ -3897,6 +4013,21 @@ static int cli_parse_show_stat(char **args, char *payload, struct appctx *appctx
 			appctx->ctx.stats.flags = (appctx->ctx.stats.flags & ~STAT_FMT_MASK) | STAT_FMT_JSON;
 		else if (strcmp(args[arg], "desc") == 0)
 			appctx->ctx.stats.flags |= STAT_SHOW_FDESC;
+		else if (strcmp(args[arg], "changed") == 0) {
+			unsigned int delay;
+			const char *res;
+
+			if (!*args[arg+1])
+				return cli_err(appctx, "'changed' expects a delay in seconds.\n");
+
+			res = parse_time_err(args[arg+1], &delay, TIME_UNIT_S);
+			if (res)
+				return cli_err(appctx, "Invalid delay after 'changed'.\n");
+
+			appctx->ctx.stats.flags |= STAT_CHANGED;
+			appctx->ctx.stats.since = now.tv_sec > delay ? now.tv_sec - delay : 0;
+			arg++;
+		}
 		arg++;
 	}
 
@@ -3925,13 +4056,39 @@ static int cli_io_handler_dump_json_schema(struct appctx *appctx)
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "clear", "counters",  NULL }, "clear counters : clear max statistics counters (add 'all' for all counters)", cli_parse_clear_counters, NULL, NULL },
 	{ { "show", "info",  NULL }, "show info      : report information about the running process [desc|json|typed]*", cli_parse_show_info, cli_io_handler_dump_info, NULL },
-	{ { "show", "stat",  NULL }, "show stat      : report counters for each proxy and server [desc|json|typed]*", cli_parse_show_stat, cli_io_handler_dump_stat, NULL },
+	{ { "show", "stat",  NULL }, "show stat      : report counters for each proxy and server [desc|json|typed|changed <delay>]*", cli_parse_show_stat, cli_io_handler_dump_stat, NULL },
 	{ { "show", "schema",  "json", NULL }, "show schema json : report schema used for stats", NULL, cli_io_handler_dump_json_schema, NULL },
 	{{},}
 }};
 
 INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
 
+/* config parser for global "tune.stats.dump-budget" */
+static int stats_parse_dump_budget(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	stats_dump_budget = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-' || stats_dump_budget > INT_MAX) {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.stats.dump-budget", stats_parse_dump_budget },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 struct applet http_stats_applet = {
 	.obj_type = OBJ_TYPE_APPLET,
 	.name = "<STATS>", /* used for logging */
@@ -0,0 +1,363 @@
+/*
+ * Publication of the statistics in a shared memory file ("shm-stats-file").
+ *
+ * The proxies and servers known at boot time are given one record each in a
+ * file mapped in memory, which a task refreshes periodically from their
+ * counters. External exporters may map the same file and read the counters
+ * at any rate without involving the process, the consistency of each record
+ * being ensured by a sequence lock (see struct stats_shm_obj).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <common/cfgparse.h>
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/hathreads.h>
+#include <common/initcall.h>
+#include <common/standard.h>
+#include <common/ticks.h>
+#include <common/time.h>
+
+#include <types/global.h>
+#include <types/stats.h>
+
+#include <proto/log.h>
+#include <proto/proxy.h>
+#include <proto/stats.h>
+#include <proto/task.h>
+
+/* number of records updated per task wakeup */
+#define STATS_SHM_BATCH 64
+
+/* object published in a record */
+struct stats_shm_desc {
+	struct proxy *px;
+	struct server *sv;              /* NULL for proxies */
+	int type;                       /* STATS_TYPE_* */
+};
+
+static char *stats_shm_path;                     /* "shm-stats-file" */
+static unsigned int stats_shm_interval = 1000;   /* "shm-stats-interval" (ms) */
+
+static struct stats_shm_hdr *stats_shm_area;     /* mapped file */
+static size_t stats_shm_size;                    /* size of the mapping */
+static struct stats_shm_desc *stats_shm_descs;   /* objects by record */
+static unsigned int stats_shm_pos;               /* next record to update */
+static struct task *stats_shm_task;
+static struct field stats_shm_fields[ST_F_TOTAL_FIELDS];
+
+/* Returns the record number <idx> of the mapped file */
+static inline struct stats_shm_obj *stats_shm_obj(unsigned int idx)
+{
+	return (struct stats_shm_obj *)((char *)stats_shm_area + stats_shm_area->obj_ofs +
+	                                (size_t)idx * stats_shm_area->obj_size);
+}
+
+/* Returns <f> as a 64-bit value to be stored in a record */
+static inline uint64_t stats_shm_value(const struct field *f)
+{
+	uint64_t v = 0;
+
+	switch (field_format(f, 0)) {
+	case FF_S32: return (int64_t)f->u.s32;
+	case FF_U32: return f->u.u32;
+	case FF_S64: return (uint64_t)f->u.s64;
+	case FF_U64: return f->u.u64;
+	case FF_FLT: memcpy(&v, &f->u.flt, sizeof(v)); return v;
+	default:     return 0;
+	}
+}
+
+/* Copies at most <len>-1 chars of <src> to <dst> and pads it with zeroes */
+static void stats_shm_strcpy(char *dst, const char *src, size_t len)
+{
+	strncpy(dst, src ? src : "", len - 1);
+	dst[len - 1] = 0;
+}
+
+/* Updates record <idx> from the counters of its object. The record is odd
+ * while it is being written, so that the readers retry.
+ */
+static void stats_shm_update(unsigned int idx)
+{
+	const struct stats_shm_desc *desc = &stats_shm_descs[idx];
+	struct stats_shm_obj *obj = stats_shm_obj(idx);
+	unsigned char *fmt = (unsigned char *)&obj->val[stats_shm_area->nb_fields];
+	struct field *f = stats_shm_fields;
+	uint32_t seq = obj->seq;
+	int i, ret;
+
+	memset(f, 0, sizeof(stats_shm_fields));
+	if (desc->type == STATS_TYPE_FE)
+		ret = stats_fill_fe_stats(desc->px, f, ST_F_TOTAL_FIELDS);
+	else if (desc->type == STATS_TYPE_BE)
+		ret = stats_fill_be_stats(desc->px, 0, f, ST_F_TOTAL_FIELDS);
+	else
+		ret = stats_fill_sv_stats(desc->px, desc->sv, 0, f, ST_F_TOTAL_FIELDS);
+
+	if (!ret)
+		return;
+
+	obj->seq = seq + 1;
+	__ha_barrier_store();
+
+	for (i = 0; i < ST_F_TOTAL_FIELDS; i++) {
+		obj->val[i] = stats_shm_value(&f[i]);
+		fmt[i] = field_format(f, i);
+	}
+	if (field_format(f, ST_F_STATUS) == FF_STR)
+		stats_shm_strcpy(obj->status, f[ST_F_STATUS].u.str, sizeof(obj->status));
+	else
+		memset(obj->status, 0, sizeof(obj->status));
+
+	__ha_barrier_store();
+	obj->seq = seq + 2;
+}
+
+/* Task refreshing the records, STATS_SHM_BATCH at a time so as not to hold a
+ * thread for too long with many servers, then every <stats_shm_interval> ms.
+ */
+static struct task *stats_shm_process(struct task *t, void *context, unsigned short state)
+{
+	unsigned int end = stats_shm_pos + STATS_SHM_BATCH;
+
+	if (relative_pid != 1) {
+		/* with nbproc, only the first process publishes */
+		t->expire = TICK_ETERNITY;
+		return t;
+	}
+
+	if (!stats_shm_pos)
+		stats_shm_area->pid = getpid();
+
+	if (end > stats_shm_area->nb_objs)
+		end = stats_shm_area->nb_objs;
+
+	for (; stats_shm_pos < end; stats_shm_pos++)
+		stats_shm_update(stats_shm_pos);
+
+	if (stats_shm_pos < stats_shm_area->nb_objs) {
+		task_wakeup(t, TASK_WOKEN_OTHER);
+		return t;
+	}
+
+	stats_shm_area->updated = (uint64_t)date.tv_sec * 1000 + date.tv_usec / 1000;
+	stats_shm_pos = 0;
+	t->expire = tick_add(now_ms, MS_TO_TICKS(stats_shm_interval));
+	return t;
+}
+
+/* Lists the proxies and servers to publish in <stats_shm_descs>, or only
+ * counts them if it is NULL. Returns their number.
+ */
+static unsigned int stats_shm_list_objs(struct stats_shm_desc *descs)
+{
+	struct proxy *px;
+	struct server *sv;
+	unsigned int nb = 0;
+
+	for (px = proxies_list; px; px = px->next) {
+		if (px->cap & PR_CAP_FE) {
+			if (descs)
+				descs[nb] = (struct stats_shm_desc){ .px = px, .type = STATS_TYPE_FE };
+			nb++;
+		}
+		if (!(px->cap & PR_CAP_BE))
+			continue;
+		for (sv = px->srv; sv; sv = sv->next) {
+			if (descs)
+				descs[nb] = (struct stats_shm_desc){ .px = px, .sv = sv, .type = STATS_TYPE_SV };
+			nb++;
+		}
+		if (descs)
+			descs[nb] = (struct stats_shm_desc){ .px = px, .type = STATS_TYPE_BE };
+		nb++;
+	}
+	return nb;
+}
+
+/* Creates the file, maps it and starts the task publishing the records. The
+ * file is prepared under a temporary name then renamed, so that the readers
+ * of a previous process are never presented a partial one.
+ */
+static int stats_shm_init()
+{
+	struct stats_shm_obj *obj;
+	char *tmp = NULL;
+	unsigned int nb, i;
+	size_t obj_size;
+	int fd = -1;
+	void *area;
+
+	if (!stats_shm_path || (global.mode & MODE_CHECK))
+		return 0;
+
+	nb = stats_shm_list_objs(NULL);
+	stats_shm_descs = calloc(nb ? nb : 1, sizeof(*stats_shm_descs));
+	if (!stats_shm_descs)
+		goto oom;
+	stats_shm_list_objs(stats_shm_descs);
+
+	obj_size = sizeof(struct stats_shm_obj) + ST_F_TOTAL_FIELDS * sizeof(uint64_t);
+	obj_size += (ST_F_TOTAL_FIELDS + 7) & -8;
+	stats_shm_size = sizeof(struct stats_shm_hdr) + nb * obj_size;
+
+	if (memprintf(&tmp, "%s.%d.tmp", stats_shm_path, (int)getpid()) == NULL)
+		goto oom;
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, stats_shm_size) < 0) {
+		ha_alert("shm-stats-file: cannot create '%s' : %s.\n", tmp, strerror(errno));
+		goto fail;
+	}
+
+	area = mmap(NULL, stats_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED) {
+		ha_alert("shm-stats-file: cannot map '%s' : %s.\n", tmp, strerror(errno));
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	stats_shm_area = area;
+	stats_shm_area->magic      = STATS_SHM_MAGIC;
+	stats_shm_area->version    = STATS_SHM_VERSION;
+	stats_shm_area->hdr_size   = sizeof(struct stats_shm_hdr);
+	stats_shm_area->obj_ofs    = sizeof(struct stats_shm_hdr);
+	stats_shm_area->obj_size   = obj_size;
+	stats_shm_area->nb_objs    = nb;
+	stats_shm_area->nb_fields  = ST_F_TOTAL_FIELDS;
+	stats_shm_area->pid        = getpid();
+	stats_shm_area->interval   = stats_shm_interval;
+	stats_shm_area->start_date = start_date.tv_sec;
+
+	for (i = 0; i < nb; i++) {
+		const struct stats_shm_desc *desc = &stats_shm_descs[i];
+
+		obj = stats_shm_obj(i);
+		obj->type = desc->type;
+		obj->iid  = desc->px->uuid;
+		obj->sid  = desc->sv ? desc->sv->puid : 0;
+		stats_shm_strcpy(obj->pxname, desc->px->id, sizeof(obj->pxname));
+		stats_shm_strcpy(obj->svname,
+		                 desc->sv ? desc->sv->id : desc->type == STATS_TYPE_FE ? "FRONTEND" : "BACKEND",
+		                 sizeof(obj->svname));
+	}
+
+	if (rename(tmp, stats_shm_path) < 0) {
+		ha_alert("shm-stats-file: cannot rename '%s' to '%s' : %s.\n", tmp, stats_shm_path, strerror(errno));
+		goto fail;
+	}
+	free(tmp);
+	tmp = NULL;
+
+	stats_shm_task = task_new(MAX_THREADS_MASK);
+	if (!stats_shm_task)
+		goto oom;
+	stats_shm_task->process = stats_shm_process;
+	task_wakeup(stats_shm_task, TASK_WOKEN_INIT);
+	return 0;
+
+ oom:
+	ha_alert("shm-stats-file: out of memory.\n");
+ fail:
+	if (fd >= 0)
+		close(fd);
+	if (tmp)
+		unlink(tmp);
+	free(tmp);
+	return ERR_ALERT | ERR_FATAL;
+}
+
+REGISTER_POST_CHECK(stats_shm_init);
+
+/* Releases the mapping. The file is left in place for the readers. */
+static void stats_shm_deinit()
+{
+	task_destroy(stats_shm_task);
+	stats_shm_task = NULL;
+	if (stats_shm_area)
+		munmap(stats_shm_area, stats_shm_size);
+	stats_shm_area = NULL;
+	free(stats_shm_descs);
+	stats_shm_descs = NULL;
+	free(stats_shm_path);
+	stats_shm_path = NULL;
+}
+
+REGISTER_POST_DEINIT(stats_shm_deinit);
+
+/* parse the "shm-stats-file" and "shm-stats-interval" global keywords */
+static int stats_shm_parse_global(char **args, int section_type, struct proxy *curpx,
+                                  struct proxy *defpx, const char *file, int line,
+                                  char **err)
+{
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects an argument.", args[0]);
+		return -1;
+	}
+
+	if (strcmp(args[0], "shm-stats-file") == 0) {
+		free(stats_shm_path);
+		stats_shm_path = strdup(args[1]);
+		if (!stats_shm_path) {
+			memprintf(err, "'%s' : out of memory.", args[0]);
+			return -1;
+		}
+		return 0;
+	}
+
+	res = parse_time_err(args[1], &stats_shm_interval, TIME_UNIT_MS);
+	if (res == PARSE_TIME_OVER) {
+		memprintf(err, "timer overflow in argument '%s' to '%s' (maximum value is 2147483647 ms or ~24.8 days)",
+		          args[1], args[0]);
+		return -1;
+	}
+	else if (res == PARSE_TIME_UNDER) {
+		memprintf(err, "timer underflow in argument '%s' to '%s' (minimum non-null value is 1 ms)",
+		          args[1], args[0]);
+		return -1;
+	}
+	else if (res) {
+		memprintf(err, "unexpected character '%c' in argument to '%s'.", *res, args[0]);
+		return -1;
+	}
+
+	if (stats_shm_interval < 10) {
+		memprintf(err, "'%s' expects a delay of at least 10 ms.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "shm-stats-file",     stats_shm_parse_global },
+	{ CFG_GLOBAL, "shm-stats-interval", stats_shm_parse_global },
+	{ 0, NULL, NULL },
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
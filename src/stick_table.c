@@ -11,8 +11,13 @@
  *
  */
 
-#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <common/config.h>
 #include <common/cfgparse.h>
@@ -23,6 +28,8 @@
 #include <common/standard.h>
 #include <common/time.h>
 
+#include <import/xxhash.h>
+
 #include <ebmbtree.h>
 #include <ebsttree.h>
 
@@ -78,39 +85,416 @@ struct stktable *stktable_find_by_name(const char *name)
 	return NULL;
 }
 
+/*
+ * Returns the shard of table <t> the entries of key <key> of <len> bytes
+ * belong to.
+ */
+static inline struct stktable_shard *stktable_shard_of(const struct stktable *t,
+                                                       const void *key, size_t len)
+{
+	if (t->nb_shards == 1)
+		return t->shards;
+	return &t->shards[XXH32(key, len, 0) & (t->nb_shards - 1)];
+}
+
+/*
+ * Returns the shard of table <t> the entries of key <key> belong to. String
+ * keys are hashed up to the length they are looked up with.
+ */
+static inline struct stktable_shard *stktable_key_shard(const struct stktable *t,
+                                                        const struct stktable_key *key)
+{
+	if (t->type == SMP_T_STR)
+		return stktable_shard_of(t, key->key,
+		                         strnlen(key->key, MIN(key->key_len, t->key_size - 1)));
+	return stktable_shard_of(t, key->key, t->key_size);
+}
+
+/*
+ * Returns the shard of table <t> which holds or will hold sticky session <ts>,
+ * depending on its key.
+ */
+struct stktable_shard *stksess_shard(const struct stktable *t, const struct stksess *ts)
+{
+	if (t->type == SMP_T_STR)
+		return stktable_shard_of(t, ts->key.key, strlen((char *)ts->key.key));
+	return stktable_shard_of(t, ts->key.key, t->key_size);
+}
+
+/* Returns non-zero if the data of type <type> stored in table <t> are counters
+ * accumulated into the table's sketch. The tags, the server and the current
+ * connections are not.
+ */
+static inline int stktable_sketch_type(const struct stktable *t, int type)
+{
+	if (!t->data_ofs[type])
+		return 0;
+
+	switch (stktable_data_types[type].std_type) {
+	case STD_T_UINT:
+		return type != STKTABLE_DT_GPT0 && type != STKTABLE_DT_CONN_CUR;
+	case STD_T_ULL:
+	case STD_T_FRQP:
+		return 1;
+	}
+	return 0;
+}
+
+/* Fills <cells> with the sketch cells of table <t> the key <key> of <len> bytes
+ * maps to, one per row. Each cell is laid out as the data of an entry, which
+ * precede the entry's address, so it may be passed to __stktable_data_ptr() as
+ * if it were one.
+ */
+static void stktable_sketch_cells(const struct stktable *t, const void *key, size_t len,
+                                  struct stksess **cells)
+{
+	size_t stride = round_ptr_size(t->data_size);
+	unsigned int row, col;
+
+	for (row = 0; row < t->sketch_depth; row++) {
+		col = row * t->sketch_width + XXH32(key, len, row) % t->sketch_width;
+		cells[row] = (struct stksess *)(t->sketch + (col + 1) * stride);
+	}
+}
+
+/* Same as above for the cells of entry <ts>. */
+static inline void stksess_sketch_cells(const struct stktable *t, const struct stksess *ts,
+                                        struct stksess **cells)
+{
+	stktable_sketch_cells(t, ts->key.key,
+	                      (t->type == SMP_T_STR) ? strlen((char *)ts->key.key) : t->key_size,
+	                      cells);
+}
+
+/* Returns the estimate of the sketch of table <t> for the data of type <type>
+ * in <cells>, the smallest value of these cells.
+ */
+static unsigned long long stktable_sketch_estimate(const struct stktable *t, struct stksess **cells,
+                                                   int type)
+{
+	unsigned long long est = ~0ULL, cur;
+	unsigned int row;
+	void *ptr;
+
+	for (row = 0; row < t->sketch_depth; row++) {
+		ptr = __stktable_data_ptr((struct stktable *)t, cells[row], type);
+		switch (stktable_data_types[type].std_type) {
+		case STD_T_UINT:
+			cur = stktable_data_cast(ptr, std_t_uint);
+			break;
+		case STD_T_ULL:
+			cur = _HA_ATOMIC_LOAD(&stktable_data_cast(ptr, std_t_ull));
+			break;
+		default:
+			cur = read_freq_ctr_period(&stktable_data_cast(ptr, std_t_frqp), t->data_arg[type].u);
+			break;
+		}
+		if (cur < est)
+			est = cur;
+	}
+	return est;
+}
+
+/* Returns non-zero if the sketch of table <t> has a non-null estimate for any
+ * of the counters of key <key>.
+ */
+static int stktable_sketch_knows(const struct stktable *t, const struct stktable_key *key)
+{
+	struct stksess *cells[STKTABLE_SKETCH_MAX_DEPTH];
+	int type;
+
+	if (t->type == SMP_T_STR)
+		stktable_sketch_cells(t, key->key, strnlen(key->key, MIN(key->key_len, t->key_size - 1)), cells);
+	else
+		stktable_sketch_cells(t, key->key, t->key_size, cells);
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (stktable_sketch_type(t, type) && stktable_sketch_estimate(t, cells, type))
+			return 1;
+	}
+	return 0;
+}
+
+/* Accounts the counters of entry <ts> being purged from table <t> into the
+ * table's sketch, so that they are not lost if the key comes back.
+ */
+static void stktable_sketch_fold(struct stktable *t, struct stksess *ts)
+{
+	struct stksess *cells[STKTABLE_SKETCH_MAX_DEPTH];
+	unsigned int row, val;
+	void *src, *dst;
+	int type;
+
+	stksess_sketch_cells(t, ts, cells);
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (!stktable_sketch_type(t, type))
+			continue;
+
+		src = __stktable_data_ptr(t, ts, type);
+		for (row = 0; row < t->sketch_depth; row++) {
+			dst = __stktable_data_ptr(t, cells[row], type);
+			switch (stktable_data_types[type].std_type) {
+			case STD_T_UINT:
+				_HA_ATOMIC_ADD(&stktable_data_cast(dst, std_t_uint), stktable_data_cast(src, std_t_uint));
+				break;
+			case STD_T_ULL:
+				_HA_ATOMIC_ADD(&stktable_data_cast(dst, std_t_ull), stktable_data_cast(src, std_t_ull));
+				break;
+			case STD_T_FRQP:
+				val = read_freq_ctr_period(&stktable_data_cast(src, std_t_frqp), t->data_arg[type].u);
+				if (val)
+					update_freq_ctr_period(&stktable_data_cast(dst, std_t_frqp), t->data_arg[type].u, val);
+				break;
+			}
+		}
+	}
+}
+
+/* Initializes the counters of new entry <ts> of table <t> from the estimates
+ * of the table's sketch. The cumulated counters taken back from the sketch are
+ * removed from it so that they are not accounted twice when the entry is
+ * purged again, the rates are left to decay.
+ */
+static void stktable_sketch_seed(struct stktable *t, struct stksess *ts)
+{
+	struct stksess *cells[STKTABLE_SKETCH_MAX_DEPTH];
+	unsigned long long est, old, new;
+	struct freq_ctr_period *frqp;
+	unsigned int row;
+	int type;
+	void *ptr;
+
+	stksess_sketch_cells(t, ts, cells);
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		int std_type = stktable_data_types[type].std_type;
+
+		if (!stktable_sketch_type(t, type))
+			continue;
+
+		est = stktable_sketch_estimate(t, cells, type);
+		if (!est)
+			continue;
+
+		ptr = __stktable_data_ptr(t, ts, type);
+		if (std_type == STD_T_FRQP) {
+			/* report the estimate as the previous period's events */
+			frqp = &stktable_data_cast(ptr, std_t_frqp);
+			frqp->curr_tick = now_ms & ~0x1;
+			frqp->curr_ctr = 0;
+			frqp->prev_ctr = est;
+			continue;
+		}
+
+		if (std_type == STD_T_UINT)
+			stktable_data_cast(ptr, std_t_uint) = est;
+		else
+			stktable_data_cast(ptr, std_t_ull) = est;
+
+		for (row = 0; row < t->sketch_depth; row++) {
+			ptr = __stktable_data_ptr(t, cells[row], type);
+			if (std_type == STD_T_UINT) {
+				unsigned int old32, new32;
+
+				old32 = stktable_data_cast(ptr, std_t_uint);
+				do {
+					new32 = (old32 > est) ? old32 - est : 0;
+				} while (!_HA_ATOMIC_CAS(&stktable_data_cast(ptr, std_t_uint), &old32, new32));
+			}
+			else {
+				old = stktable_data_cast(ptr, std_t_ull);
+				do {
+					new = (old > est) ? old - est : 0;
+				} while (!_HA_ATOMIC_CAS(&stktable_data_cast(ptr, std_t_ull), &old, new));
+			}
+		}
+	}
+}
+
+/* Fills <pos> with the positions of the bits of the reject filter of table <t>
+ * covering the address <key>.
+ */
+static inline void stktable_reject_pos(const struct stktable *t, const void *key, unsigned int *pos)
+{
+	unsigned long long h = XXH64(key, t->key_size, 0);
+	unsigned int h1 = h;
+	unsigned int h2 = (h >> 32) | 1;
+	int i;
+
+	for (i = 0; i < STKTABLE_REJECT_HASHES; i++)
+		pos[i] = (h1 + i * h2) & t->reject.mask;
+}
+
+/* Starts a new generation of the reject filter of table <t> if the current one
+ * is older than the table's period. The generation before the previous one is
+ * recycled, so that a source stops being rejected between one and two periods
+ * after it was last reported. Only the thread winning the rotation date clears
+ * the bits, the others keep using the current generation meanwhile.
+ */
+static void stktable_reject_rotate(struct stktable *t)
+{
+	int exp = t->reject.rotate;
+	unsigned int next;
+
+	if (!tick_is_expired(exp, now_ms))
+		return;
+
+	if (!_HA_ATOMIC_CAS(&t->reject.rotate, &exp, tick_add(now_ms, t->reject.period)))
+		return;
+
+	next = t->reject.cur ^ 1;
+	memset(t->reject.bits[next], 0, (t->reject.mask + 1) / 8);
+	HA_ATOMIC_STORE(&t->reject.cur, next);
+}
+
+/* Reports address <key> of table <t> into the current generation of its
+ * reject filter.
+ */
+static void stktable_reject_mark(struct stktable *t, const void *key)
+{
+	unsigned int pos[STKTABLE_REJECT_HASHES];
+	unsigned long *bits;
+	int i;
+
+	stktable_reject_rotate(t);
+	stktable_reject_pos(t, key, pos);
+	bits = t->reject.bits[t->reject.cur];
+	for (i = 0; i < STKTABLE_REJECT_HASHES; i++)
+		_HA_ATOMIC_OR(&bits[pos[i] / LONGBITS], 1UL << (pos[i] % LONGBITS));
+}
+
+/* To be called with the new value <gpc0> of the gpc0 counter of entry <ts> of
+ * table <t>, reports the entry's address to the reject filter once the value
+ * reaches the table's threshold.
+ */
+static inline void stktable_reject_update(struct stktable *t, struct stksess *ts, unsigned int gpc0)
+{
+	if (t->reject.bits[0] && gpc0 >= t->reject.threshold)
+		stktable_reject_mark(t, ts->key.key);
+}
+
+/* Returns non-zero if the source address <addr> was reported to the reject
+ * filter of table <t> during the last one to two periods, otherwise zero. The
+ * filter is only read, so this is cheap enough to be called for every accepted
+ * connection. False positives are possible, at a rate depending on the number
+ * of reported sources compared to the number of bits of the filter.
+ */
+int stktable_reject_addr(struct stktable *t, struct sockaddr_storage *addr)
+{
+	unsigned int pos[STKTABLE_REJECT_HASHES];
+	struct in6_addr in6;
+	struct in_addr in4;
+	const unsigned long *bits;
+	const void *key;
+	int gen, i;
+
+	if (!t->reject.bits[0])
+		return 0;
+
+	switch (addr->ss_family) {
+	case AF_INET:
+		key = &((struct sockaddr_in *)addr)->sin_addr;
+		if (t->type == SMP_T_IPV6) {
+			v4tov6(&in6, (struct in_addr *)key);
+			key = &in6;
+		}
+		break;
+	case AF_INET6:
+		key = &((struct sockaddr_in6 *)addr)->sin6_addr;
+		if (t->type == SMP_T_IPV4) {
+			if (!v6tov4(&in4, (struct in6_addr *)key))
+				return 0;
+			key = &in4;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	stktable_reject_rotate(t);
+	stktable_reject_pos(t, key, pos);
+	for (gen = 0; gen < 2; gen++) {
+		bits = t->reject.bits[gen];
+		for (i = 0; i < STKTABLE_REJECT_HASHES; i++)
+			if (!(bits[pos[i] / LONGBITS] & (1UL << (pos[i] % LONGBITS))))
+				break;
+		if (i == STKTABLE_REJECT_HASHES)
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Free an allocated sticky session <ts>, and decrease sticky sessions counter
  * in table <t>.
  */
 void __stksess_free(struct stktable *t, struct stksess *ts)
 {
-	t->current--;
+	HA_ATOMIC_SUB(&t->current, 1);
 	pool_free(t->pool, (void *)ts - round_ptr_size(t->data_size));
 }
 
 /*
  * Free an allocated sticky session <ts>, and decrease sticky sessions counter
- * in table <t>.
- * This function locks the table
+ * in table <t>. The session must not be stored in the table, so there is
+ * nothing to lock.
  */
 void stksess_free(struct stktable *t, struct stksess *ts)
 {
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
 	__stksess_free(t, ts);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
 }
 
 /*
- * Kill an stksess (only if its ref_cnt is zero).
+ * Unlink an stksess from table <t> (only if its ref_cnt is zero). The lock of
+ * its shard must be held. The peers may still take a reference from the
+ * updates tree, so this is checked again under the table's lock before
+ * unlinking the entry from it. Returns 1 if unlinked, otherwise 0.
  */
-int __stksess_kill(struct stktable *t, struct stksess *ts)
+static int __stksess_unlink(struct stktable *t, struct stksess *ts)
 {
 	if (ts->ref_cnt)
 		return 0;
 
+	__ha_barrier_load();
+	if (ts->upd.node.leaf_p) {
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+		if (ts->ref_cnt) {
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+			return 0;
+		}
+		eb32_delete(&ts->upd);
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	}
+
 	eb32_delete(&ts->exp);
-	eb32_delete(&ts->upd);
 	ebmb_delete(&ts->key);
+	return 1;
+}
+
+/*
+ * Kill an stksess (only if its ref_cnt is zero). The lock of its shard must be
+ * held.
+ */
+int __stksess_kill(struct stktable *t, struct stksess *ts)
+{
+	if (!__stksess_unlink(t, ts))
+		return 0;
+
+	__stksess_free(t, ts);
+	return 1;
+}
+
+/*
+ * Kill an stksess purged from its shard, whose lock is held, because it expired
+ * or to make room, after having accounted its counters into the table's sketch
+ * if any. Returns 1 if it was killed, 0 if it is referenced.
+ */
+static int __stksess_purge(struct stktable *t, struct stksess *ts)
+{
+	if (!__stksess_unlink(t, ts))
+		return 0;
+
+	if (t->sketch)
+		stktable_sketch_fold(t, ts);
 	__stksess_free(t, ts);
 	return 1;
 }
@@ -118,17 +502,18 @@ int __stksess_kill(struct stktable *t, struct stksess *ts)
 /*
  * Decrease the refcount if decrefcnt is not 0.
  * and try to kill the stksess
- * This function locks the table
+ * This function locks the entry's shard
  */
 int stksess_kill(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
+	struct stktable_shard *shard __maybe_unused = stksess_shard(t, ts);
 	int ret;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
 	if (decrefcnt)
-		ts->ref_cnt--;
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 	ret = __stksess_kill(t, ts);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
 
 	return ret;
 }
@@ -165,17 +550,17 @@ static struct stksess *__stksess_init(struct stktable *t, struct stksess * ts)
 }
 
 /*
- * Trash oldest <to_batch> sticky sessions from table <t>
- * Returns number of trashed sticky sessions.
+ * Trash oldest <to_batch> sticky sessions from shard <shard> of table <t>,
+ * whose lock must be held. Returns number of trashed sticky sessions.
  */
-int __stktable_trash_oldest(struct stktable *t, int to_batch)
+static int __stktable_trash_oldest(struct stktable *t, struct stktable_shard *shard, int to_batch)
 {
 	struct stksess *ts;
 	struct eb32_node *eb;
 	int batched = 0;
 	int looped = 0;
 
-	eb = eb32_lookup_ge(&t->exps, now_ms - TIMER_LOOK_BACK);
+	eb = eb32_lookup_ge(&shard->exps, now_ms - TIMER_LOOK_BACK);
 
 	while (batched < to_batch) {
 
@@ -188,7 +573,7 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 			if (looped)
 				break;
 			looped = 1;
-			eb = eb32_first(&t->exps);
+			eb = eb32_first(&shard->exps);
 			if (likely(!eb))
 				break;
 		}
@@ -208,7 +593,7 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 				continue;
 
 			ts->exp.key = ts->expire;
-			eb32_insert(&t->exps, &ts->exp);
+			eb32_insert(&shard->exps, &ts->exp);
 
 			if (!eb || eb->key > ts->exp.key)
 				eb = &ts->exp;
@@ -216,10 +601,11 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 			continue;
 		}
 
-		/* session expired, trash it */
-		ebmb_delete(&ts->key);
-		eb32_delete(&ts->upd);
-		__stksess_free(t, ts);
+		/* session expired, trash it unless a peer just caught it */
+		if (!__stksess_purge(t, ts)) {
+			eb32_insert(&shard->exps, &ts->exp);
+			continue;
+		}
 		batched++;
 	}
 
@@ -229,15 +615,23 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 /*
  * Trash oldest <to_batch> sticky sessions from table <t>
  * Returns number of trashed sticky sessions.
- * This function locks the table
+ * This function locks the shards one at a time, starting from a different
+ * one on each call so that the purge is spread over all of them.
  */
 int stktable_trash_oldest(struct stktable *t, int to_batch)
 {
-	int ret;
-
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ret = __stktable_trash_oldest(t, to_batch);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	static THREAD_LOCAL unsigned int next_shard;
+	struct stktable_shard *shard;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < t->nb_shards && ret < to_batch; i++) {
+		shard = &t->shards[(next_shard + i) & (t->nb_shards - 1)];
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+		ret += __stktable_trash_oldest(t, shard, to_batch - ret);
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+	}
+	next_shard += i;
 
 	return ret;
 }
@@ -246,23 +640,30 @@ int stktable_trash_oldest(struct stktable *t, int to_batch)
  * The new sticky session is returned or NULL in case of lack of memory.
  * Sticky sessions should only be allocated this way, and must be freed using
  * stksess_free(). Table <t>'s sticky session counter is increased. If <key>
- * is not NULL, it is assigned to the new session.
+ * is not NULL, it is assigned to the new session. If the table is full, the
+ * oldest entries of <shard> are purged, whose lock must be held, or those of
+ * any shard if <shard> is NULL, in which case no lock may be held.
  */
-struct stksess *__stksess_new(struct stktable *t, struct stktable_key *key)
+static struct stksess *__stksess_new(struct stktable *t, struct stktable_shard *shard,
+                                     struct stktable_key *key)
 {
 	struct stksess *ts;
 
-	if (unlikely(t->current == t->size)) {
+	if (unlikely(t->current >= t->size)) {
 		if ( t->nopurge )
 			return NULL;
 
-		if (!__stktable_trash_oldest(t, (t->size >> 8) + 1))
+		if (shard) {
+			if (!__stktable_trash_oldest(t, shard, (t->size >> 8) / t->nb_shards + 1))
+				return NULL;
+		}
+		else if (!stktable_trash_oldest(t, (t->size >> 8) + 1))
 			return NULL;
 	}
 
 	ts = pool_alloc(t->pool);
 	if (ts) {
-		t->current++;
+		HA_ATOMIC_ADD(&t->current, 1);
 		ts = (void *)ts + round_ptr_size(t->data_size);
 		__stksess_init(t, ts);
 		if (key)
@@ -277,31 +678,56 @@ struct stksess *__stksess_new(struct stktable *t, struct stktable_key *key)
  * Sticky sessions should only be allocated this way, and must be freed using
  * stksess_free(). Table <t>'s sticky session counter is increased. If <key>
  * is not NULL, it is assigned to the new session.
- * This function locks the table
+ * This function locks the shards it has to purge
  */
 struct stksess *stksess_new(struct stktable *t, struct stktable_key *key)
 {
-	struct stksess *ts;
+	return __stksess_new(t, NULL, key);
+}
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts = __stksess_new(t, key);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+/* Brings the expiration task of table <t> forward to <expire> if it is
+ * earlier than its current date. The shards update it concurrently, hence
+ * the CAS.
+ */
+static inline void stktable_requeue_exp(struct stktable *t, int expire)
+{
+	int old_exp, new_exp;
+
+	old_exp = t->exp_task->expire;
+	do {
+		new_exp = tick_first(expire, old_exp);
+	} while (new_exp != old_exp &&
+	         !HA_ATOMIC_CAS(&t->exp_task->expire, &old_exp, new_exp));
+	task_queue(t->exp_task);
+}
 
-	return ts;
+/* Insert new sticky session <ts> in shard <shard> of the table. It is assumed
+ * that it does not yet exist (the caller must check this). The table's timeout
+ * is updated if it is set. <ts> is returned.
+ */
+static void __stktable_store(struct stktable *t, struct stktable_shard *shard, struct stksess *ts)
+{
+
+	ebmb_insert(&shard->keys, &ts->key, t->key_size);
+	ts->exp.key = ts->expire;
+	eb32_insert(&shard->exps, &ts->exp);
+	if (t->expire)
+		stktable_requeue_exp(t, ts->expire);
 }
 
 /*
- * Looks in table <t> for a sticky session matching key <key>.
+ * Looks in shard <shard> of table <t> for a sticky session matching key <key>.
  * Returns pointer on requested sticky session or NULL if none was found.
  */
-struct stksess *__stktable_lookup_key(struct stktable *t, struct stktable_key *key)
+static struct stksess *__stktable_lookup_key(struct stktable *t, struct stktable_shard *shard,
+                                             struct stktable_key *key)
 {
 	struct ebmb_node *eb;
 
 	if (t->type == SMP_T_STR)
-		eb = ebst_lookup_len(&t->keys, key->key, key->key_len+1 < t->key_size ? key->key_len : t->key_size-1);
+		eb = ebst_lookup_len(&shard->keys, key->key, key->key_len+1 < t->key_size ? key->key_len : t->key_size-1);
 	else
-		eb = ebmb_lookup(&t->keys, key->key, t->key_size);
+		eb = ebmb_lookup(&shard->keys, key->key, t->key_size);
 
 	if (unlikely(!eb)) {
 		/* no session found */
@@ -315,33 +741,43 @@ struct stksess *__stktable_lookup_key(struct stktable *t, struct stktable_key *k
  * Looks in table <t> for a sticky session matching key <key>.
  * Returns pointer on requested sticky session or NULL if none was found.
  * The refcount of the found entry is increased and this function
- * is protected using the table lock
+ * is protected using the lock of the key's shard
  */
 struct stksess *stktable_lookup_key(struct stktable *t, struct stktable_key *key)
 {
+	struct stktable_shard *shard = stktable_key_shard(t, key);
 	struct stksess *ts;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts = __stktable_lookup_key(t, key);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	ts = __stktable_lookup_key(t, shard, key);
+	if (!ts && t->sketch && stktable_sketch_knows(t, key)) {
+		/* the key was purged, bring it back from the sketch */
+		ts = __stksess_new(t, shard, key);
+		if (ts) {
+			stktable_sketch_seed(t, ts);
+			__stktable_store(t, shard, ts);
+		}
+	}
 	if (ts)
-		ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
 
 	return ts;
 }
 
 /*
- * Looks in table <t> for a sticky session with same key as <ts>.
- * Returns pointer on requested sticky session or NULL if none was found.
+ * Looks in shard <shard> of table <t> for a sticky session with same key as
+ * <ts>. Returns pointer on requested sticky session or NULL if none was found.
  */
-struct stksess *__stktable_lookup(struct stktable *t, struct stksess *ts)
+static struct stksess *__stktable_lookup(struct stktable *t, struct stktable_shard *shard,
+                                         struct stksess *ts)
 {
 	struct ebmb_node *eb;
 
 	if (t->type == SMP_T_STR)
-		eb = ebst_lookup(&(t->keys), (char *)ts->key.key);
+		eb = ebst_lookup(&(shard->keys), (char *)ts->key.key);
 	else
-		eb = ebmb_lookup(&(t->keys), ts->key.key, t->key_size);
+		eb = ebmb_lookup(&(shard->keys), ts->key.key, t->key_size);
 
 	if (unlikely(!eb))
 		return NULL;
@@ -353,17 +789,18 @@ struct stksess *__stktable_lookup(struct stktable *t, struct stksess *ts)
  * Looks in table <t> for a sticky session with same key as <ts>.
  * Returns pointer on requested sticky session or NULL if none was found.
  * The refcount of the found entry is increased and this function
- * is protected using the table lock
+ * is protected using the lock of the key's shard
  */
 struct stksess *stktable_lookup(struct stktable *t, struct stksess *ts)
 {
+	struct stktable_shard *shard = stksess_shard(t, ts);
 	struct stksess *lts;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	lts = __stktable_lookup(t, ts);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	lts = __stktable_lookup(t, shard, ts);
 	if (lts)
-		lts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_ADD(&lts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
 
 	return lts;
 }
@@ -371,19 +808,20 @@ struct stksess *stktable_lookup(struct stktable *t, struct stksess *ts)
 /* Update the expiration timer for <ts> but do not touch its expiration node.
  * The table's expiration timer is updated if set.
  * The node will be also inserted into the update tree if needed, at a position
- * depending if the update is a local or coming from a remote node
+ * depending if the update is a local or coming from a remote node. The caller
+ * must hold a reference on <ts>, the table's lock is taken to manipulate the
+ * updates tree.
  */
-void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local, int expire)
+static void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local, int expire)
 {
 	struct eb32_node * eb;
 	ts->expire = expire;
-	if (t->expire) {
-		t->exp_task->expire = t->exp_next = tick_first(ts->expire, t->exp_next);
-		task_queue(t->exp_task);
-	}
+	if (t->expire)
+		stktable_requeue_exp(t, ts->expire);
 
 	/* If sync is enabled */
 	if (t->sync_task) {
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
 		if (local) {
 			/* If this entry is not in the tree
 			   or not scheduled for at least one peer */
@@ -399,6 +837,7 @@ void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local
 					eb32_insert(&t->updates, &ts->upd);
 				}
 			}
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
 			task_wakeup(t->sync_task, TASK_WOKEN_MSG);
 		}
 		else {
@@ -411,6 +850,7 @@ void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local
 					eb32_insert(&t->updates, &ts->upd);
 				}
 			}
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
 		}
 	}
 }
@@ -423,11 +863,9 @@ void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local
  */
 void stktable_touch_remote(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
 	__stktable_touch_with_exp(t, ts, 0, ts->expire);
 	if (decrefcnt)
-		ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 }
 
 /* Update the expiration timer for <ts> but do not touch its expiration node.
@@ -440,119 +878,114 @@ void stktable_touch_local(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
 	int expire = tick_add(now_ms, MS_TO_TICKS(t->expire));
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	/* the data counters were updated with relaxed atomics and without the
+	 * entry's lock, make them visible before the entry is scheduled for
+	 * the peers.
+	 */
+	__ha_barrier_atomic_store();
 	__stktable_touch_with_exp(t, ts, 1, expire);
 	if (decrefcnt)
-		ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 }
 /* Just decrease the ref_cnt of the current session. Does nothing if <ts> is NULL */
 static void stktable_release(struct stktable *t, struct stksess *ts)
 {
 	if (!ts)
 		return;
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
-}
-
-/* Insert new sticky session <ts> in the table. It is assumed that it does not
- * yet exist (the caller must check this). The table's timeout is updated if it
- * is set. <ts> is returned.
- */
-void __stktable_store(struct stktable *t, struct stksess *ts)
-{
-
-	ebmb_insert(&t->keys, &ts->key, t->key_size);
-	ts->exp.key = ts->expire;
-	eb32_insert(&t->exps, &ts->exp);
-	if (t->expire) {
-		t->exp_task->expire = t->exp_next = tick_first(ts->expire, t->exp_next);
-		task_queue(t->exp_task);
-	}
+	HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 }
 
 /* Returns a valid or initialized stksess for the specified stktable_key in the
  * specified table, or NULL if the key was NULL, or if no entry was found nor
  * could be created. The entry's expiration is updated.
+ * This function locks the key's shard, and the refcount of the entry is increased.
  */
-struct stksess *__stktable_get_entry(struct stktable *table, struct stktable_key *key)
+struct stksess *stktable_get_entry(struct stktable *table, struct stktable_key *key)
 {
+	struct stktable_shard *shard;
 	struct stksess *ts;
 
 	if (!key)
 		return NULL;
 
-	ts = __stktable_lookup_key(table, key);
+	shard = stktable_key_shard(table, key);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	ts = __stktable_lookup_key(table, shard, key);
 	if (ts == NULL) {
 		/* entry does not exist, initialize a new one */
-		ts = __stksess_new(table, key);
-		if (!ts)
-			return NULL;
-		__stktable_store(table, ts);
+		ts = __stksess_new(table, shard, key);
+		if (ts) {
+			if (table->sketch)
+				stktable_sketch_seed(table, ts);
+			__stktable_store(table, shard, ts);
+		}
 	}
-	return ts;
-}
-/* Returns a valid or initialized stksess for the specified stktable_key in the
- * specified table, or NULL if the key was NULL, or if no entry was found nor
- * could be created. The entry's expiration is updated.
- * This function locks the table, and the refcount of the entry is increased.
- */
-struct stksess *stktable_get_entry(struct stktable *table, struct stktable_key *key)
-{
-	struct stksess *ts;
-
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->lock);
-	ts = __stktable_get_entry(table, key);
 	if (ts)
-		ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->lock);
+		HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
 
 	return ts;
 }
 
 /* Lookup for an entry with the same key and store the submitted
  * stksess if not found.
+ * This function locks the key's shard, and the refcount of the entry is increased.
  */
-struct stksess *__stktable_set_entry(struct stktable *table, struct stksess *nts)
+struct stksess *stktable_set_entry(struct stktable *table, struct stksess *nts)
 {
+	struct stktable_shard *shard = stksess_shard(table, nts);
 	struct stksess *ts;
 
-	ts = __stktable_lookup(table, nts);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	ts = __stktable_lookup(table, shard, nts);
 	if (ts == NULL) {
 		ts = nts;
-		__stktable_store(table, ts);
+		__stktable_store(table, shard, ts);
 	}
+	HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+
 	return ts;
 }
 
-/* Lookup for an entry with the same key and store the submitted
- * stksess if not found.
- * This function locks the table, and the refcount of the entry is increased.
+/* Returns the first entry of table <t> found in the shards starting at
+ * <*shard>, which is updated to the shard the entry belongs to, with its
+ * refcount increased. NULL is returned if there is none. This is used to walk
+ * over the whole table, the next entries of the same shard being found under
+ * its lock with ebmb_next().
  */
-struct stksess *stktable_set_entry(struct stktable *table, struct stksess *nts)
+struct stksess *stktable_first_entry(struct stktable *t, unsigned int *shard)
 {
+	struct ebmb_node *eb;
 	struct stksess *ts;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->lock);
-	ts = __stktable_set_entry(table, nts);
-	ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->lock);
-
-	return ts;
+	for (; *shard < t->nb_shards; (*shard)++) {
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[*shard].lock);
+		eb = ebmb_first(&t->shards[*shard].keys);
+		if (eb) {
+			ts = ebmb_entry(eb, struct stksess, key);
+			HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[*shard].lock);
+			return ts;
+		}
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[*shard].lock);
+	}
+	return NULL;
 }
+
 /*
- * Trash expired sticky sessions from table <t>. The next expiration date is
- * returned.
+ * Trash expired sticky sessions from shard <shard> of table <t>. The next
+ * expiration date is returned.
  */
-static int stktable_trash_expired(struct stktable *t)
+static int stktable_trash_expired(struct stktable *t, struct stktable_shard *shard)
 {
 	struct stksess *ts;
 	struct eb32_node *eb;
+	int exp_next = TICK_ETERNITY;
 	int looped = 0;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	eb = eb32_lookup_ge(&t->exps, now_ms - TIMER_LOOK_BACK);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	eb = eb32_lookup_ge(&shard->exps, now_ms - TIMER_LOOK_BACK);
 
 	while (1) {
 		if (unlikely(!eb)) {
@@ -564,15 +997,15 @@ static int stktable_trash_expired(struct stktable *t)
 			if (looped)
 				break;
 			looped = 1;
-			eb = eb32_first(&t->exps);
+			eb = eb32_first(&shard->exps);
 			if (likely(!eb))
 				break;
 		}
 
 		if (likely(tick_is_lt(now_ms, eb->key))) {
 			/* timer not expired yet, revisit it later */
-			t->exp_next = eb->key;
-			goto out_unlock;
+			exp_next = eb->key;
+			break;
 		}
 
 		/* timer looks expired, detach it from the queue */
@@ -590,24 +1023,20 @@ static int stktable_trash_expired(struct stktable *t)
 				continue;
 
 			ts->exp.key = ts->expire;
-			eb32_insert(&t->exps, &ts->exp);
+			eb32_insert(&shard->exps, &ts->exp);
 
 			if (!eb || eb->key > ts->exp.key)
 				eb = &ts->exp;
 			continue;
 		}
 
-		/* session expired, trash it */
-		ebmb_delete(&ts->key);
-		eb32_delete(&ts->upd);
-		__stksess_free(t, ts);
+		/* session expired, trash it unless a peer just caught it */
+		if (!__stksess_purge(t, ts))
+			eb32_insert(&shard->exps, &ts->exp);
 	}
 
-	/* We have found no task to expire in any tree */
-	t->exp_next = TICK_ETERNITY;
-out_unlock:
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
-	return t->exp_next;
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+	return exp_next;
 }
 
 /*
@@ -617,23 +1046,613 @@ out_unlock:
 static struct task *process_table_expire(struct task *task, void *context, unsigned short state)
 {
 	struct stktable *t = context;
+	int exp_next = TICK_ETERNITY;
+	unsigned int i;
+
+	for (i = 0; i < t->nb_shards; i++)
+		exp_next = tick_first(exp_next, stktable_trash_expired(t, &t->shards[i]));
+	task->expire = exp_next;
+	return task;
+}
+
+/* Stick-tables snapshots.
+ *
+ * A snapshot starts with the STKTABLE_PERSIST_MAGIC string followed by the
+ * table's type, key size, the date the snapshot was written (ms), the mask
+ * of the stored data types and the argument of each of them, all of them
+ * encoded as variable-length integers. Each entry follows, preceded by its
+ * length, with the same layout as a timed update message of the peers
+ * protocol, without the update ID: the remaining time before it expires,
+ * its key then its data. The dictionary entries are not stored.
+ */
+#define STKTABLE_PERSIST_MAGIC     "HASTKT01"
+#define STKTABLE_PERSIST_MAGIC_LEN 8
+
+/* Maximum length of a variable-length integer */
+#define STKTABLE_PERSIST_VARINT_MAXLEN 10
+
+/* Maximum number of entries written or loaded at once by a snapshot task */
+#define STKTABLE_PERSIST_BATCH     1000
+
+/* Returns the current date in milliseconds. */
+static inline uint64_t stktable_persist_date()
+{
+	return (uint64_t)date.tv_sec * 1000 + date.tv_usec / 1000;
+}
+
+/* Returns the mask of the data types stored in table <t>. */
+static uint64_t stktable_persist_mask(const struct stktable *t)
+{
+	uint64_t mask = 0;
+	int type;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (t->data_ofs[type])
+			mask |= 1ULL << type;
+	}
+	return mask;
+}
+
+/* Returns the maximum length of the record of an entry of table <t>. */
+static size_t stktable_persist_maxrec(const struct stktable *t)
+{
+	size_t len = STKTABLE_PERSIST_VARINT_MAXLEN + sizeof(uint32_t) + STKTABLE_PERSIST_VARINT_MAXLEN + t->key_size;
+	int type;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (!t->data_ofs[type])
+			continue;
+		if (stktable_data_types[type].std_type == STD_T_FRQP)
+			len += 3 * STKTABLE_PERSIST_VARINT_MAXLEN;
+		else
+			len += STKTABLE_PERSIST_VARINT_MAXLEN;
+	}
+	return len;
+}
+
+/* Encodes the header of a snapshot of table <t> at <buf>. Returns its length. */
+static int stktable_persist_encode_hdr(const struct stktable *t, char *buf)
+{
+	char *cursor = buf;
+	int type;
+
+	memcpy(cursor, STKTABLE_PERSIST_MAGIC, STKTABLE_PERSIST_MAGIC_LEN);
+	cursor += STKTABLE_PERSIST_MAGIC_LEN;
+	intencode(t->type, &cursor);
+	intencode(t->key_size, &cursor);
+	intencode(stktable_persist_date(), &cursor);
+	intencode(stktable_persist_mask(t), &cursor);
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (t->data_ofs[type])
+			intencode(t->data_arg[type].u, &cursor);
+	}
+	return cursor - buf;
+}
+
+/* Encodes the record of entry <ts> of table <t> at <buf>, which must have
+ * room for stktable_persist_maxrec() bytes. Returns its length.
+ */
+static int stktable_persist_encode(struct stktable *t, struct stksess *ts, char *buf)
+{
+	char *cursor, *rec;
+	uint32_t netinteger;
+	int type, reclen;
+	void *ptr;
+
+	cursor = rec = buf + STKTABLE_PERSIST_VARINT_MAXLEN;
+
+	netinteger = htonl(t->expire ? tick_remain(now_ms, ts->expire) : 0);
+	memcpy(cursor, &netinteger, sizeof(netinteger));
+	cursor += sizeof(netinteger);
+
+	if (t->type == SMP_T_STR) {
+		int stlen = strlen((char *)ts->key.key);
+
+		intencode(stlen, &cursor);
+		memcpy(cursor, ts->key.key, stlen);
+		cursor += stlen;
+	}
+	else if (t->type == SMP_T_SINT) {
+		netinteger = htonl(read_u32(ts->key.key));
+		memcpy(cursor, &netinteger, sizeof(netinteger));
+		cursor += sizeof(netinteger);
+	}
+	else {
+		memcpy(cursor, ts->key.key, t->key_size);
+		cursor += t->key_size;
+	}
+
+	HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &ts->lock);
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		ptr = stktable_data_ptr(t, ts, type);
+		if (!ptr)
+			continue;
+
+		switch (stktable_data_types[type].std_type) {
+		case STD_T_SINT:
+			intencode(stktable_data_cast(ptr, std_t_sint), &cursor);
+			break;
+		case STD_T_UINT:
+			intencode(stktable_data_cast(ptr, std_t_uint), &cursor);
+			break;
+		case STD_T_ULL:
+			intencode(stktable_data_cast(ptr, std_t_ull), &cursor);
+			break;
+		case STD_T_FRQP: {
+			struct freq_ctr_period *frqp = &stktable_data_cast(ptr, std_t_frqp);
+
+			intencode((unsigned int)(now_ms - frqp->curr_tick), &cursor);
+			intencode(frqp->curr_ctr, &cursor);
+			intencode(frqp->prev_ctr, &cursor);
+			break;
+		}
+		case STD_T_DICT:
+			/* not stored */
+			intencode(0, &cursor);
+			break;
+		}
+	}
+	HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
+
+	reclen = cursor - rec;
+	cursor = buf;
+	intencode(reclen, &cursor);
+	memmove(cursor, rec, reclen);
+	return (cursor - buf) + reclen;
+}
+
+/* Writes the <len> bytes at <buf> to the snapshot of table <t> being written.
+ * Returns 0 if succeeded, -1 if not.
+ */
+static int stktable_persist_send(struct stktable *t, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(t->persist.fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Drops the snapshot of table <t> being written, if any. */
+static void stktable_persist_abort(struct stktable *t)
+{
+	if (t->persist.next) {
+		stksess_kill_if_expired(t, t->persist.next, 1);
+		t->persist.next = NULL;
+	}
+	if (t->persist.fd >= 0) {
+		close(t->persist.fd);
+		t->persist.fd = -1;
+		unlink(t->persist.tmp);
+	}
+}
+
+/* Starts a new snapshot of table <t>. Returns 0 if succeeded, -1 if not. */
+static int stktable_persist_start(struct stktable *t)
+{
+	struct buffer *chunk = get_trash_chunk();
+
+	t->persist.fd = open(t->persist.tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (t->persist.fd < 0)
+		goto fail;
+
+	t->persist.shard = 0;
+	t->persist.next = NULL;
+	chunk->data = stktable_persist_encode_hdr(t, chunk->area);
+	if (stktable_persist_send(t, chunk->area, chunk->data) < 0)
+		goto fail;
+	return 0;
+
+ fail:
+	send_log(NULL, LOG_WARNING, "stick-table '%s': failed to write snapshot '%s' : %s.\n",
+	         t->id, t->persist.tmp, strerror(errno));
+	stktable_persist_abort(t);
+	return -1;
+}
+
+/* Writes up to <max> entries of table <t> to the snapshot being written, every
+ * shard being locked only while a buffer is filled. Returns 1 once the whole
+ * table was written and the snapshot replaced the previous one, 0 if some
+ * entries remain to be written, -1 if the snapshot failed.
+ */
+static int stktable_persist_write(struct stktable *t, int max)
+{
+	struct buffer *chunk = get_trash_chunk();
+	size_t maxrec = stktable_persist_maxrec(t);
+	struct stktable_shard *shard __maybe_unused;
+	struct ebmb_node *eb;
+	struct stksess *ts;
+	int done = 0;
+
+	if (maxrec > chunk->size) {
+		errno = ENOBUFS;
+		goto fail;
+	}
+
+	while (done < max) {
+		if (!t->persist.next) {
+			t->persist.next = stktable_first_entry(t, &t->persist.shard);
+			if (!t->persist.next)
+				break;
+		}
+
+		shard = &t->shards[t->persist.shard];
+		chunk->data = 0;
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+		ts = t->persist.next;
+		while (ts && done < max && b_room(chunk) >= maxrec) {
+			chunk->data += stktable_persist_encode(t, ts, b_tail(chunk));
+			done++;
+			eb = ebmb_next(&ts->key);
+			ts = eb ? ebmb_entry(eb, struct stksess, key) : NULL;
+		}
+
+		/* move the reference to the next entry to write */
+		if (ts)
+			HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+		HA_ATOMIC_SUB(&t->persist.next->ref_cnt, 1);
+		__stksess_kill_if_expired(t, t->persist.next);
+		t->persist.next = ts;
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+
+		if (!ts)
+			t->persist.shard++;
+
+		if (stktable_persist_send(t, chunk->area, chunk->data) < 0)
+			goto fail;
+	}
+
+	if (t->persist.next || t->persist.shard < t->nb_shards)
+		return 0;
+
+	/* the snapshot only replaces the previous one once on disk */
+	if (fsync(t->persist.fd) < 0 || close(t->persist.fd) < 0) {
+		t->persist.fd = -1;
+		unlink(t->persist.tmp);
+		goto fail;
+	}
+	t->persist.fd = -1;
+	if (rename(t->persist.tmp, t->persist.file) < 0) {
+		unlink(t->persist.tmp);
+		goto fail;
+	}
+	return 1;
+
+ fail:
+	send_log(NULL, LOG_WARNING, "stick-table '%s': failed to write snapshot '%s' : %s.\n",
+	         t->id, t->persist.tmp, strerror(errno));
+	stktable_persist_abort(t);
+	return -1;
+}
+
+/* Releases the snapshot of table <t> being loaded. */
+static void stktable_persist_unmap(struct stktable *t)
+{
+	munmap(t->persist.map, t->persist.map_len);
+	t->persist.map = NULL;
+	t->persist.ready = 1;
+}
+
+/* Maps the snapshot of table <t> and checks it was written for the same table
+ * definition. <t> is ready to be written once there is nothing to load.
+ */
+static void stktable_persist_open(struct stktable *t)
+{
+	char *cursor, *end;
+	struct stat st;
+	uint64_t written, now_date;
+	int type, fd;
+
+	fd = open(t->persist.file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			send_log(NULL, LOG_WARNING, "stick-table '%s': failed to open snapshot '%s' : %s.\n",
+			         t->id, t->persist.file, strerror(errno));
+		goto ready;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < STKTABLE_PERSIST_MAGIC_LEN) {
+		close(fd);
+		goto ignore;
+	}
+
+	/* the entries are loaded at most once, in order */
+	t->persist.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (t->persist.map == MAP_FAILED) {
+		t->persist.map = NULL;
+		goto ignore;
+	}
+	t->persist.map_len = st.st_size;
+	madvise(t->persist.map, t->persist.map_len, MADV_SEQUENTIAL);
+
+	cursor = t->persist.map;
+	end = cursor + t->persist.map_len;
+	if (memcmp(cursor, STKTABLE_PERSIST_MAGIC, STKTABLE_PERSIST_MAGIC_LEN) != 0)
+		goto unmap;
+	cursor += STKTABLE_PERSIST_MAGIC_LEN;
+
+	if (intdecode(&cursor, end) != t->type || !cursor ||
+	    intdecode(&cursor, end) != t->key_size || !cursor)
+		goto unmap;
+
+	written = intdecode(&cursor, end);
+	if (!cursor)
+		goto unmap;
+
+	if (intdecode(&cursor, end) != stktable_persist_mask(t) || !cursor)
+		goto unmap;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (!t->data_ofs[type])
+			continue;
+		if (intdecode(&cursor, end) != t->data_arg[type].u || !cursor)
+			goto unmap;
+	}
+
+	now_date = stktable_persist_date();
+	t->persist.age = now_date > written ? MIN(now_date - written, (uint64_t)INT_MAX) : 0;
+	t->persist.map_ofs = cursor - t->persist.map;
+	return;
+
+ unmap:
+	stktable_persist_unmap(t);
+ ignore:
+	send_log(NULL, LOG_WARNING, "stick-table '%s': ignoring snapshot '%s' which does not match the table definition.\n",
+	         t->id, t->persist.file);
+ ready:
+	t->persist.ready = 1;
+}
+
+/* Loads up to <max> entries of table <t> from its snapshot. The entries which
+ * expired since the snapshot was written are skipped, as well as those which
+ * already exist in <t>. Returns 1 once the whole snapshot was loaded, 0 if
+ * some entries remain to be loaded.
+ */
+static int stktable_persist_load(struct stktable *t, int max)
+{
+	char *cursor = t->persist.map + t->persist.map_ofs;
+	char *end = t->persist.map + t->persist.map_len;
+	unsigned int age = t->persist.age;
+	struct stksess *ts, *newts;
+	char *recend;
+	uint64_t reclen, val;
+	uint32_t netinteger;
+	int type;
+	void *ptr;
+
+	for (; max > 0 && cursor < end; max--, cursor = recend) {
+		reclen = intdecode(&cursor, end);
+		if (!cursor || reclen < sizeof(netinteger) || reclen > end - cursor)
+			goto malformed;
+		recend = cursor + reclen;
+
+		memcpy(&netinteger, cursor, sizeof(netinteger));
+		cursor += sizeof(netinteger);
+		netinteger = ntohl(netinteger);
+		if (t->expire && netinteger <= age)
+			continue;
+
+		/* the live entries must not be purged for the old ones */
+		if (t->current >= t->size)
+			goto done;
+
+		newts = stksess_new(t, NULL);
+		if (!newts)
+			goto done;
+
+		if (t->expire)
+			newts->expire = tick_add(now_ms, MS_TO_TICKS(netinteger - age));
+
+		if (t->type == SMP_T_STR) {
+			unsigned int to_read, to_store;
+
+			to_read = intdecode(&cursor, recend);
+			if (!cursor || to_read > recend - cursor)
+				goto malformed_free;
+
+			to_store = MIN(to_read, t->key_size - 1);
+			memcpy(newts->key.key, cursor, to_store);
+			newts->key.key[to_store] = 0;
+			cursor += to_read;
+		}
+		else if (t->type == SMP_T_SINT) {
+			if (sizeof(netinteger) > recend - cursor)
+				goto malformed_free;
+
+			memcpy(&netinteger, cursor, sizeof(netinteger));
+			netinteger = ntohl(netinteger);
+			memcpy(newts->key.key, &netinteger, sizeof(netinteger));
+			cursor += sizeof(netinteger);
+		}
+		else {
+			if (t->key_size > recend - cursor)
+				goto malformed_free;
+
+			memcpy(newts->key.key, cursor, t->key_size);
+			cursor += t->key_size;
+		}
+
+		/* the entry is not visible yet, no lock is needed */
+		for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+			ptr = stktable_data_ptr(t, newts, type);
+			if (!ptr)
+				continue;
+
+			val = intdecode(&cursor, recend);
+			if (!cursor)
+				goto malformed_free;
+
+			switch (stktable_data_types[type].std_type) {
+			case STD_T_SINT:
+				stktable_data_cast(ptr, std_t_sint) = val;
+				break;
+			case STD_T_UINT:
+				stktable_data_cast(ptr, std_t_uint) = val;
+				break;
+			case STD_T_ULL:
+				stktable_data_cast(ptr, std_t_ull) = val;
+				break;
+			case STD_T_FRQP: {
+				struct freq_ctr_period *frqp = &stktable_data_cast(ptr, std_t_frqp);
+				unsigned int curr_ctr, prev_ctr;
+
+				curr_ctr = intdecode(&cursor, recend);
+				if (!cursor)
+					goto malformed_free;
+				prev_ctr = intdecode(&cursor, recend);
+				if (!cursor)
+					goto malformed_free;
+
+				/* nothing remains of the periods older than the previous one */
+				val += age;
+				if (val < 2 * (uint64_t)t->data_arg[type].u) {
+					frqp->curr_tick = tick_add(now_ms, -(int)val) & ~0x1;
+					frqp->curr_ctr = curr_ctr;
+					frqp->prev_ctr = prev_ctr;
+				}
+				break;
+			}
+			case STD_T_DICT:
+				/* not stored */
+				break;
+			}
+		}
+
+		ts = stktable_set_entry(t, newts);
+		if (ts != newts)
+			stksess_free(t, newts);
+		stksess_kill_if_expired(t, ts, 1);
+	}
+
+	t->persist.map_ofs = cursor - t->persist.map;
+	if (cursor < end)
+		return 0;
+	goto done;
+
+ malformed_free:
+	stksess_free(t, newts);
+ malformed:
+	send_log(NULL, LOG_WARNING, "stick-table '%s': truncated or malformed snapshot '%s', ignoring the remaining entries.\n",
+	         t->id, t->persist.file);
+ done:
+	stktable_persist_unmap(t);
+	return 1;
+}
+
+/* Task loading the previous snapshot of the table in <context> by batches, then
+ * writing a new one every "persist-interval", also by batches.
+ */
+static struct task *process_table_persist(struct task *task, void *context, unsigned short state)
+{
+	struct stktable *t = context;
+	int ret;
+
+	if (!t->persist.ready && !t->persist.map) {
+		stktable_persist_open(t);
+		if (t->persist.interval)
+			task->expire = tick_add(now_ms, MS_TO_TICKS(t->persist.interval));
+	}
+
+	if (t->persist.map) {
+		if (!stktable_persist_load(t, STKTABLE_PERSIST_BATCH))
+			goto yield;
+	}
+
+	if (!t->persist.interval) {
+		task->expire = TICK_ETERNITY;
+		return task;
+	}
 
-	task->expire = stktable_trash_expired(t);
+	if (t->persist.fd < 0) {
+		if (!tick_is_expired(task->expire, now_ms))
+			return task;
+		if (stktable_persist_start(t) < 0)
+			goto next;
+	}
+
+	ret = stktable_persist_write(t, STKTABLE_PERSIST_BATCH);
+	if (!ret)
+		goto yield;
+
+ next:
+	task->expire = tick_add(now_ms, MS_TO_TICKS(t->persist.interval));
 	return task;
+
+ yield:
+	task_wakeup(task, TASK_WOKEN_OTHER);
+	return task;
+}
+
+/* Writes a last snapshot of table <t> if it is persisted, at once. This is
+ * done on exit. Nothing is written as long as the previous snapshot was not
+ * loaded, so that it is not lost.
+ */
+void stktable_persist_flush(struct stktable *t)
+{
+	if (!t->persist.file || !t->persist.ready)
+		return;
+
+	stktable_persist_abort(t);
+	if (stktable_persist_start(t) == 0)
+		stktable_persist_write(t, INT_MAX);
 }
 
 /* Perform minimal stick table intializations, report 0 in case of error, 1 if OK. */
 int stktable_init(struct stktable *t)
 {
+	unsigned int i;
+
 	if (t->size) {
-		t->keys = EB_ROOT_UNIQUE;
-		memset(&t->exps, 0, sizeof(t->exps));
+		/* one shard per thread rounded up to a power of two */
+		t->nb_shards = 1;
+		while (t->nb_shards < global.nbthread && t->nb_shards < STKTABLE_MAX_SHARDS)
+			t->nb_shards <<= 1;
+
+		t->shards = calloc(t->nb_shards, sizeof(*t->shards));
+		if (!t->shards)
+			return 0;
+
+		for (i = 0; i < t->nb_shards; i++) {
+			t->shards[i].keys = EB_ROOT_UNIQUE;
+			memset(&t->shards[i].exps, 0, sizeof(t->shards[i].exps));
+			HA_SPIN_INIT(&t->shards[i].lock);
+		}
 		t->updates = EB_ROOT_UNIQUE;
 		HA_SPIN_INIT(&t->lock);
 
 		t->pool = create_pool("sticktables", sizeof(struct stksess) + round_ptr_size(t->data_size) + t->key_size, MEM_F_SHARED);
 
-		t->exp_next = TICK_ETERNITY;
+		if (t->sketch_width && t->data_size) {
+			t->sketch = calloc((size_t)t->sketch_depth * t->sketch_width,
+			                   round_ptr_size(t->data_size));
+			if (!t->sketch)
+				return 0;
+		}
+
+		if (t->reject.threshold) {
+			unsigned int nbits = STKTABLE_REJECT_MIN_BITS;
+
+			while (nbits < STKTABLE_REJECT_MAX_BITS && nbits < (unsigned long long)t->size * 16)
+				nbits <<= 1;
+
+			t->reject.bits[0] = calloc(2, nbits / 8);
+			if (!t->reject.bits[0])
+				return 0;
+			t->reject.bits[1] = t->reject.bits[0] + nbits / LONGBITS;
+			t->reject.mask = nbits - 1;
+			t->reject.period = t->expire ? t->expire : STKTABLE_REJECT_PERIOD;
+			t->reject.rotate = tick_add(now_ms, t->reject.period);
+		}
+
 		if ( t->expire ) {
 			t->exp_task = task_new(MAX_THREADS_MASK);
 			if (!t->exp_task)
@@ -645,6 +1664,16 @@ int stktable_init(struct stktable *t)
 			peers_register_table(t->peers.p, t);
 		}
 
+		t->persist.fd = -1;
+		if (t->persist.file) {
+			t->persist.task = task_new(MAX_THREADS_MASK);
+			if (!t->persist.task)
+				return 0;
+			t->persist.task->process = process_table_persist;
+			t->persist.task->context = (void *)t;
+			task_wakeup(t->persist.task, TASK_WOKEN_INIT);
+		}
+
 		return t->pool != NULL;
 	}
 	return 1;
@@ -742,16 +1771,60 @@ int parse_stick_table(const char *file, int linenum, char **args,
 				err_code |= ERR_ALERT | ERR_FATAL;
 				goto out;
 			}
-			if ((err = parse_size_err(args[idx], &t->size))) {
+			if ((err = parse_size_err(args[idx], &t->size))) {
+				ha_alert("parsing [%s:%d] : %s: unexpected character '%c' in argument of '%s'.\n",
+					 file, linenum, args[0], *err, args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			idx++;
+		}
+		/* This argument does not exit in "peers" section. */
+		else if (!peers && strcmp(args[idx], "peers") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			t->peers.name = strdup(args[idx++]);
+		}
+		else if (strcmp(args[idx], "expire") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			err = parse_time_err(args[idx], &val, TIME_UNIT_MS);
+			if (err == PARSE_TIME_OVER) {
+				ha_alert("parsing [%s:%d]: %s: timer overflow in argument <%s> to <%s>, maximum value is 2147483647 ms (~24.8 days).\n",
+					 file, linenum, args[0], args[idx], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (err == PARSE_TIME_UNDER) {
+				ha_alert("parsing [%s:%d]: %s: timer underflow in argument <%s> to <%s>, minimum non-null value is 1 ms.\n",
+					 file, linenum, args[0], args[idx], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (err) {
 				ha_alert("parsing [%s:%d] : %s: unexpected character '%c' in argument of '%s'.\n",
 					 file, linenum, args[0], *err, args[idx-1]);
 				err_code |= ERR_ALERT | ERR_FATAL;
 				goto out;
 			}
+			t->expire = val;
 			idx++;
 		}
-		/* This argument does not exit in "peers" section. */
-		else if (!peers && strcmp(args[idx], "peers") == 0) {
+		else if (strcmp(args[idx], "nopurge") == 0) {
+			t->nopurge = 1;
+			idx++;
+		}
+		else if (strcmp(args[idx], "sketch") == 0) {
 			idx++;
 			if (!*(args[idx])) {
 				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
@@ -759,9 +1832,64 @@ int parse_stick_table(const char *file, int linenum, char **args,
 				err_code |= ERR_ALERT | ERR_FATAL;
 				goto out;
 			}
-			t->peers.name = strdup(args[idx++]);
+			if ((err = parse_size_err(args[idx], &t->sketch_width))) {
+				ha_alert("parsing [%s:%d] : %s: unexpected character '%c' in argument of '%s'.\n",
+					 file, linenum, args[0], *err, args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			if (!t->sketch_width) {
+				ha_alert("parsing [%s:%d] : %s: '%s' expects a non-null number of cells.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			idx++;
 		}
-		else if (strcmp(args[idx], "expire") == 0) {
+		else if (strcmp(args[idx], "sketch-depth") == 0) {
+			idx++;
+			val = *(args[idx]) ? atoi(args[idx]) : 0;
+			if (val < 1 || val > STKTABLE_SKETCH_MAX_DEPTH) {
+				ha_alert("parsing [%s:%d] : %s: '%s' expects a number of rows between 1 and %d.\n",
+					 file, linenum, args[0], args[idx-1], STKTABLE_SKETCH_MAX_DEPTH);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			t->sketch_depth = val;
+			idx++;
+		}
+		else if (strcmp(args[idx], "reject-gpc0") == 0) {
+			idx++;
+			val = *(args[idx]) ? atoi(args[idx]) : 0;
+			if (val < 1) {
+				ha_alert("parsing [%s:%d] : %s: '%s' expects a positive threshold.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			t->reject.threshold = val;
+			idx++;
+		}
+		else if (strcmp(args[idx], "persist") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing file name after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			free(t->persist.file);
+			free(t->persist.tmp);
+			t->persist.tmp = NULL;
+			t->persist.file = strdup(args[idx]);
+			if (!t->persist.file || !memprintf(&t->persist.tmp, "%s.tmp", args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: out of memory.\n", file, linenum, args[0]);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				goto out;
+			}
+			idx++;
+		}
+		else if (strcmp(args[idx], "persist-interval") == 0) {
 			idx++;
 			if (!*(args[idx])) {
 				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
@@ -788,11 +1916,7 @@ int parse_stick_table(const char *file, int linenum, char **args,
 				err_code |= ERR_ALERT | ERR_FATAL;
 				goto out;
 			}
-			t->expire = val;
-			idx++;
-		}
-		else if (strcmp(args[idx], "nopurge") == 0) {
-			t->nopurge = 1;
+			t->persist.interval = val;
 			idx++;
 		}
 		else if (strcmp(args[idx], "type") == 0) {
@@ -894,6 +2018,43 @@ int parse_stick_table(const char *file, int linenum, char **args,
 		goto out;
 	}
 
+	if (t->sketch_width) {
+		if (t->nopurge) {
+			ha_alert("parsing [%s:%d] : %s: 'sketch' and 'nopurge' are incompatible.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (!t->sketch_depth)
+			t->sketch_depth = STKTABLE_SKETCH_DEPTH;
+	}
+	else if (t->sketch_depth) {
+		ha_warning("parsing [%s:%d] : %s: 'sketch-depth' ignored without 'sketch'.\n",
+			   file, linenum, args[0]);
+		err_code |= ERR_WARN;
+	}
+
+	if (t->reject.threshold) {
+		if (t->type != SMP_T_IPV4 && t->type != SMP_T_IPV6) {
+			ha_alert("parsing [%s:%d] : %s: 'reject-gpc0' requires a table of type 'ip' or 'ipv6'.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (!t->data_ofs[STKTABLE_DT_GPC0]) {
+			ha_alert("parsing [%s:%d] : %s: 'reject-gpc0' requires 'store gpc0'.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
+
+	if (t->persist.interval && !t->persist.file) {
+		ha_warning("parsing [%s:%d] : %s: 'persist-interval' ignored without 'persist'.\n",
+			   file, linenum, args[0]);
+		err_code |= ERR_WARN;
+	}
+
  out:
 	return err_code;
 }
@@ -1662,7 +2823,7 @@ static int sample_conv_table_kbytes_in(const struct arg *arg_p, struct sample *s
 
 	ptr = stktable_data_ptr(t, ts, STKTABLE_DT_BYTES_IN_CNT);
 	if (ptr)
-		smp->data.u.sint = stktable_data_cast(ptr, bytes_in_cnt) >> 10;
+		smp->data.u.sint = _HA_ATOMIC_LOAD(&stktable_data_cast(ptr, bytes_in_cnt)) >> 10;
 
 	stktable_release(t, ts);
 	return !!ptr;
@@ -1698,7 +2859,7 @@ static int sample_conv_table_kbytes_out(const struct arg *arg_p, struct sample *
 
 	ptr = stktable_data_ptr(t, ts, STKTABLE_DT_BYTES_OUT_CNT);
 	if (ptr)
-		smp->data.u.sint = stktable_data_cast(ptr, bytes_out_cnt) >> 10;
+		smp->data.u.sint = _HA_ATOMIC_LOAD(&stktable_data_cast(ptr, bytes_out_cnt)) >> 10;
 
 	stktable_release(t, ts);
 	return !!ptr;
@@ -1867,16 +3028,13 @@ static enum act_return action_inc_gpc0(struct act_rule *rule, struct proxy *px,
 		ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_GPC0_RATE);
 		ptr2 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_GPC0);
 		if (ptr1 || ptr2) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 			if (ptr1)
 				update_freq_ctr_period(&stktable_data_cast(ptr1, gpc0_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_GPC0_RATE].u, 1);
 
 			if (ptr2)
-				stktable_data_cast(ptr2, gpc0)++;
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+				stktable_reject_update(stkctr->table, ts,
+				                       _HA_ATOMIC_ADD(&stktable_data_cast(ptr2, gpc0), 1));
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(stkctr->table, ts, 0);
@@ -1949,16 +3107,12 @@ static enum act_return action_inc_gpc1(struct act_rule *rule, struct proxy *px,
 		ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_GPC1_RATE);
 		ptr2 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_GPC1);
 		if (ptr1 || ptr2) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
 			if (ptr1)
 				update_freq_ctr_period(&stktable_data_cast(ptr1, gpc1_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_GPC1_RATE].u, 1);
 
 			if (ptr2)
-				stktable_data_cast(ptr2, gpc1)++;
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+				_HA_ATOMIC_ADD(&stktable_data_cast(ptr2, gpc1), 1);
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(stkctr->table, ts, 0);
@@ -2061,11 +3215,7 @@ static enum act_return action_set_gpt0(struct act_rule *rule, struct proxy *px,
 			value = (unsigned int)(smp->data.u.sint);
 		}
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
-		stktable_data_cast(ptr, gpt0) = value;
-
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+		_HA_ATOMIC_STORE(&stktable_data_cast(ptr, gpt0), value);
 
 		stktable_touch_local(stkctr->table, ts, 0);
 	}
@@ -2342,12 +3492,8 @@ smp_fetch_sc_get_gpt0(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, gpt0);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2383,12 +3529,8 @@ smp_fetch_sc_get_gpc0(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, gpc0);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2424,12 +3566,8 @@ smp_fetch_sc_get_gpc1(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, gpc1);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2464,13 +3602,9 @@ smp_fetch_sc_gpc0_rate(const struct arg *args, struct sample *smp, const char *k
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, gpc0_rate),
 		                  stkctr->table->data_arg[STKTABLE_DT_GPC0_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2505,13 +3639,9 @@ smp_fetch_sc_gpc1_rate(const struct arg *args, struct sample *smp, const char *k
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, gpc1_rate),
 		                  stkctr->table->data_arg[STKTABLE_DT_GPC1_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2549,18 +3679,16 @@ smp_fetch_sc_inc_gpc0(const struct arg *args, struct sample *smp, const char *kw
 		ptr1 = stktable_data_ptr(stkctr->table, stkctr_entry(stkctr), STKTABLE_DT_GPC0_RATE);
 		ptr2 = stktable_data_ptr(stkctr->table, stkctr_entry(stkctr), STKTABLE_DT_GPC0);
 		if (ptr1 || ptr2) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 			if (ptr1) {
 				update_freq_ctr_period(&stktable_data_cast(ptr1, gpc0_rate),
 						       stkctr->table->data_arg[STKTABLE_DT_GPC0_RATE].u, 1);
 				smp->data.u.sint = (&stktable_data_cast(ptr1, gpc0_rate))->curr_ctr;
 			}
 
-			if (ptr2)
-				smp->data.u.sint = ++stktable_data_cast(ptr2, gpc0);
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+			if (ptr2) {
+				smp->data.u.sint = _HA_ATOMIC_ADD(&stktable_data_cast(ptr2, gpc0), 1);
+				stktable_reject_update(stkctr->table, stkctr_entry(stkctr), smp->data.u.sint);
+			}
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(stkctr->table, stkctr_entry(stkctr), (stkctr == &tmpstkctr) ? 1 : 0);
@@ -2602,8 +3730,6 @@ smp_fetch_sc_inc_gpc1(const struct arg *args, struct sample *smp, const char *kw
 		ptr1 = stktable_data_ptr(stkctr->table, stkctr_entry(stkctr), STKTABLE_DT_GPC1_RATE);
 		ptr2 = stktable_data_ptr(stkctr->table, stkctr_entry(stkctr), STKTABLE_DT_GPC1);
 		if (ptr1 || ptr2) {
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 			if (ptr1) {
 				update_freq_ctr_period(&stktable_data_cast(ptr1, gpc1_rate),
 						       stkctr->table->data_arg[STKTABLE_DT_GPC1_RATE].u, 1);
@@ -2611,9 +3737,7 @@ smp_fetch_sc_inc_gpc1(const struct arg *args, struct sample *smp, const char *kw
 			}
 
 			if (ptr2)
-				smp->data.u.sint = ++stktable_data_cast(ptr2, gpc1);
-
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+				smp->data.u.sint = _HA_ATOMIC_ADD(&stktable_data_cast(ptr2, gpc1), 1);
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			stktable_touch_local(stkctr->table, stkctr_entry(stkctr), (stkctr == &tmpstkctr) ? 1 : 0);
@@ -2655,12 +3779,7 @@ smp_fetch_sc_clr_gpc0(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
-		smp->data.u.sint = stktable_data_cast(ptr, gpc0);
-		stktable_data_cast(ptr, gpc0) = 0;
-
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+		smp->data.u.sint = _HA_ATOMIC_XCHG(&stktable_data_cast(ptr, gpc0), 0);
 
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(stkctr->table, stkctr_entry(stkctr), (stkctr == &tmpstkctr) ? 1 : 0);
@@ -2699,12 +3818,7 @@ smp_fetch_sc_clr_gpc1(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
-		smp->data.u.sint = stktable_data_cast(ptr, gpc1);
-		stktable_data_cast(ptr, gpc1) = 0;
-
-		HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+		smp->data.u.sint = _HA_ATOMIC_XCHG(&stktable_data_cast(ptr, gpc1), 0);
 
 		/* If data was modified, we need to touch to re-schedule sync */
 		stktable_touch_local(stkctr->table, stkctr_entry(stkctr), (stkctr == &tmpstkctr) ? 1 : 0);
@@ -2739,12 +3853,8 @@ smp_fetch_sc_conn_cnt(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, conn_cnt);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 
@@ -2780,13 +3890,9 @@ smp_fetch_sc_conn_rate(const struct arg *args, struct sample *smp, const char *k
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, conn_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_CONN_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2831,11 +3937,7 @@ smp_fetch_src_updt_conn_cnt(const struct arg *args, struct sample *smp, const ch
 
 	smp->data.type = SMP_T_SINT;
 
-	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
-
-	smp->data.u.sint = ++stktable_data_cast(ptr, conn_cnt);
-
-	HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+	smp->data.u.sint = _HA_ATOMIC_ADD(&stktable_data_cast(ptr, conn_cnt), 1);
 
 	smp->flags = SMP_F_VOL_TEST;
 
@@ -2872,12 +3974,8 @@ smp_fetch_sc_conn_cur(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, conn_cur);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2911,12 +4009,8 @@ smp_fetch_sc_sess_cnt(const struct arg *args, struct sample *smp, const char *kw
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, sess_cnt);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2949,13 +4043,9 @@ smp_fetch_sc_sess_rate(const struct arg *args, struct sample *smp, const char *k
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, sess_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_SESS_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -2989,12 +4079,8 @@ smp_fetch_sc_http_req_cnt(const struct arg *args, struct sample *smp, const char
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, http_req_cnt);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3028,13 +4114,9 @@ smp_fetch_sc_http_req_rate(const struct arg *args, struct sample *smp, const cha
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, http_req_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_HTTP_REQ_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3068,12 +4150,8 @@ smp_fetch_sc_http_err_cnt(const struct arg *args, struct sample *smp, const char
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = stktable_data_cast(ptr, http_err_cnt);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3107,13 +4185,9 @@ smp_fetch_sc_http_err_rate(const struct arg *args, struct sample *smp, const cha
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, http_err_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_HTTP_ERR_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3147,11 +4221,7 @@ smp_fetch_sc_kbytes_in(const struct arg *args, struct sample *smp, const char *k
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
-		smp->data.u.sint = stktable_data_cast(ptr, bytes_in_cnt) >> 10;
-
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+		smp->data.u.sint = _HA_ATOMIC_LOAD(&stktable_data_cast(ptr, bytes_in_cnt)) >> 10;
 
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
@@ -3186,13 +4256,9 @@ smp_fetch_sc_bytes_in_rate(const struct arg *args, struct sample *smp, const cha
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, bytes_in_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_BYTES_IN_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3226,11 +4292,7 @@ smp_fetch_sc_kbytes_out(const struct arg *args, struct sample *smp, const char *
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
-		smp->data.u.sint = stktable_data_cast(ptr, bytes_out_cnt) >> 10;
-
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
+		smp->data.u.sint = _HA_ATOMIC_LOAD(&stktable_data_cast(ptr, bytes_out_cnt)) >> 10;
 
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
@@ -3265,13 +4327,9 @@ smp_fetch_sc_bytes_out_rate(const struct arg *args, struct sample *smp, const ch
 			return 0; /* parameter not stored */
 		}
 
-		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		smp->data.u.sint = read_freq_ctr_period(&stktable_data_cast(ptr, bytes_out_rate),
 					       stkctr->table->data_arg[STKTABLE_DT_BYTES_OUT_RATE].u);
 
-		HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &stkctr_entry(stkctr)->lock);
-
 		if (stkctr == &tmpstkctr)
 			stktable_release(stkctr->table, stkctr_entry(stkctr));
 	}
@@ -3345,16 +4403,18 @@ static int table_dump_head_to_buffer(struct buffer *msg,
 }
 
 /* Dump a table entry to a stream interface's
- * read buffer. It returns 0 if the output buffer is full
- * and needs to be called again, otherwise non-zero.
+ * read buffer. <addr> is the address reported for the entry, which differs
+ * from <entry> when a copy of it is dumped. It returns 0 if the output buffer
+ * is full and needs to be called again, otherwise non-zero.
  */
 static int table_dump_entry_to_buffer(struct buffer *msg,
                                       struct stream_interface *si,
-                                      struct stktable *t, struct stksess *entry)
+                                      struct stktable *t, struct stksess *entry,
+                                      const void *addr)
 {
 	int dt;
 
-	chunk_appendf(msg, "%p:", entry);
+	chunk_appendf(msg, "%p:", addr);
 
 	if (t->type == SMP_T_IPV4) {
 		char addr[INET_ADDRSTRLEN];
@@ -3500,7 +4560,7 @@ static int table_process_entry_per_key(struct appctx *appctx, char **args)
 			return 0;
 		}
 		HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &ts->lock);
-		if (!table_dump_entry_to_buffer(&trash, si, t, ts)) {
+		if (!table_dump_entry_to_buffer(&trash, si, t, ts, ts)) {
 			HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
 			stktable_release(t, ts);
 			return 0;
@@ -3642,7 +4702,8 @@ static int cli_parse_table_req(char **args, char *payload, struct appctx *appctx
 	for (i = 0; i < STKTABLE_FILTER_LEN; i++)
 		appctx->ctx.table.data_type[i] = -1;
 	appctx->ctx.table.target = NULL;
-	appctx->ctx.table.entry = NULL;
+	appctx->ctx.table.batch_cnt = 0;
+	appctx->ctx.table.binary = 0;
 	appctx->ctx.table.action = (long)private; // keyword argument, one of STK_CLI_ACT_*
 
 	if (*args[2]) {
@@ -3660,6 +4721,14 @@ static int cli_parse_table_req(char **args, char *payload, struct appctx *appctx
 		return table_process_entry_per_key(appctx, args);
 	else if (strncmp(args[3], "data.", 5) == 0)
 		return table_prepare_data_request(appctx, args);
+	else if (strcmp(args[3], "binary") == 0 &&
+		 appctx->ctx.table.action == STK_CLI_ACT_SHOW && !*args[4]) {
+		if (!cli_has_level(appctx, ACCESS_LVL_OPER))
+			return 1;
+		if (stktable_persist_maxrec(appctx->ctx.table.target) > trash.size)
+			return cli_err(appctx, "The entries of this table are too large for a binary dump\n");
+		appctx->ctx.table.binary = 1;
+	}
 	else if (*args[3])
 		goto err_args;
 
@@ -3668,7 +4737,7 @@ static int cli_parse_table_req(char **args, char *payload, struct appctx *appctx
 err_args:
 	switch (appctx->ctx.table.action) {
 	case STK_CLI_ACT_SHOW:
-		return cli_err(appctx, "Optional argument only supports \"data.<store_data_type>\" <operator> <value> and key <key>\n");
+		return cli_err(appctx, "Optional argument only supports \"data.<store_data_type>\" <operator> <value>, key <key> and binary\n");
 	case STK_CLI_ACT_CLR:
 		return cli_err(appctx, "Required arguments: <table> \"data.<store_data_type>\" <operator> <value> or <table> key <key>\n");
 	case STK_CLI_ACT_SET:
@@ -3678,6 +4747,141 @@ err_args:
 	}
 }
 
+/* Copies entry <ts> of table <t> with its data to <buf> so that it may be
+ * dumped without holding its lock, which must be held by the caller. Returns
+ * the copy, or NULL if <buf> is too small.
+ */
+static struct stksess *table_copy_entry(struct stktable *t, struct stksess *ts, struct buffer *buf)
+{
+	size_t ofs = round_ptr_size(t->data_size);
+	size_t len = ofs + sizeof(*ts) + t->key_size;
+
+	if (len > buf->size)
+		return NULL;
+	memcpy(buf->area, (char *)ts - ofs, len);
+	return (struct stksess *)(buf->area + ofs);
+}
+
+/* Releases the references held on the entries of the batch of <appctx>, and
+ * removes those which were cleared or expired. The lock of the shard they
+ * belong to must be held.
+ */
+static void __table_dump_release_batch(struct appctx *appctx)
+{
+	struct stktable *t = appctx->ctx.table.t;
+	struct stksess *ts;
+	unsigned int i;
+
+	for (i = 0; i < appctx->ctx.table.batch_cnt; i++) {
+		ts = appctx->ctx.table.batch[i];
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
+		if (appctx->ctx.table.kill_mask & (1U << i))
+			__stksess_kill(t, ts);
+		else
+			__stksess_kill_if_expired(t, ts);
+	}
+	appctx->ctx.table.batch_cnt = appctx->ctx.table.batch_pos = 0;
+	appctx->ctx.table.kill_mask = 0;
+}
+
+/* Replaces the batch of entries of <appctx> with the next entries of the table
+ * being dumped, starting after the last entry of the current batch, or with
+ * the first entry of the current shard if the batch is empty. Each shard is
+ * locked only once per batch, and a reference is held on each collected entry
+ * so that it may be dumped after the lock is released. The batch is left empty
+ * once the whole table was walked.
+ */
+static void table_dump_next_batch(struct appctx *appctx)
+{
+	struct stktable *t = appctx->ctx.table.t;
+	struct stktable_shard *shard __maybe_unused;
+	struct ebmb_node *eb;
+	struct stksess *ts;
+
+	for (; appctx->ctx.table.shard < t->nb_shards; appctx->ctx.table.shard++) {
+		shard = &t->shards[appctx->ctx.table.shard];
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+		if (appctx->ctx.table.batch_cnt)
+			eb = ebmb_next(&appctx->ctx.table.batch[appctx->ctx.table.batch_cnt - 1]->key);
+		else
+			eb = ebmb_first(&shard->keys);
+		__table_dump_release_batch(appctx);
+
+		while (eb && appctx->ctx.table.batch_cnt < STKTABLE_DUMP_BATCH) {
+			ts = ebmb_entry(eb, struct stksess, key);
+			HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+			appctx->ctx.table.batch[appctx->ctx.table.batch_cnt++] = ts;
+			eb = ebmb_next(eb);
+		}
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+
+		if (appctx->ctx.table.batch_cnt)
+			break;
+	}
+}
+
+/* Returns non-zero if entry <ts> of table <t> must be skipped according to the
+ * data filters of <appctx>.
+ */
+static int table_dump_skip_entry(struct appctx *appctx, struct stktable *t, struct stksess *ts)
+{
+	void *ptr;
+	int dt, i;
+	signed char op;
+	long long data, value;
+
+	for (i = 0; i < STKTABLE_FILTER_LEN; i++) {
+		if (appctx->ctx.table.data_type[i] == -1)
+			break;
+		dt = appctx->ctx.table.data_type[i];
+		ptr = stktable_data_ptr(t, ts, dt);
+
+		data = 0;
+		switch (stktable_data_types[dt].std_type) {
+		case STD_T_SINT:
+			data = stktable_data_cast(ptr, std_t_sint);
+			break;
+		case STD_T_UINT:
+			data = stktable_data_cast(ptr, std_t_uint);
+			break;
+		case STD_T_ULL:
+			data = stktable_data_cast(ptr, std_t_ull);
+			break;
+		case STD_T_FRQP:
+			data = read_freq_ctr_period(&stktable_data_cast(ptr, std_t_frqp),
+						    t->data_arg[dt].u);
+			break;
+		}
+
+		op = appctx->ctx.table.data_op[i];
+		value = appctx->ctx.table.value[i];
+
+		/* skip the entry if the data does not match the test and the value */
+		if ((data < value &&
+		     (op == STD_OP_EQ || op == STD_OP_GT || op == STD_OP_GE)) ||
+		    (data == value &&
+		     (op == STD_OP_NE || op == STD_OP_GT || op == STD_OP_LT)) ||
+		    (data > value &&
+		     (op == STD_OP_EQ || op == STD_OP_LT || op == STD_OP_LE)))
+			return 1;
+	}
+	return 0;
+}
+
+/* Releases the entries still referenced by a table dump or clear. */
+static void cli_release_show_table(struct appctx *appctx)
+{
+	struct stktable_shard *shard __maybe_unused;
+
+	if (appctx->st2 == STAT_ST_LIST) {
+		shard = &appctx->ctx.table.t->shards[appctx->ctx.table.shard];
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+		__table_dump_release_batch(appctx);
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+		appctx->st2 = STAT_ST_FIN;
+	}
+}
+
 /* This function is used to deal with table operations (dump or clear depending
  * on the action stored in appctx->private). It returns 0 if the output buffer is
  * full and it needs to be called again, otherwise non-zero.
@@ -3686,7 +4890,8 @@ static int cli_io_handler_table(struct appctx *appctx)
 {
 	struct stream_interface *si = appctx->owner;
 	struct stream *s = si_strm(si);
-	struct ebmb_node *eb;
+	struct stktable_shard *shard __maybe_unused;
+	struct stksess *ts, *copy;
 	int skip_entry;
 	int show = appctx->ctx.table.action == STK_CLI_ACT_SHOW;
 
@@ -3694,19 +4899,22 @@ static int cli_io_handler_table(struct appctx *appctx)
 	 * We have 3 possible states in appctx->st2 :
 	 *   - STAT_ST_INIT : the first call
 	 *   - STAT_ST_INFO : the proxy pointer points to the next table to
-	 *     dump, the entry pointer is NULL ;
+	 *     dump, the batch is empty ;
 	 *   - STAT_ST_LIST : the proxy pointer points to the current table
-	 *     and the entry pointer points to the next entry to be dumped,
-	 *     and the refcount on the next entry is held ;
+	 *     and the batch holds a refcount on the next entries to be dumped,
+	 *     the next one being at batch_pos ;
 	 *   - STAT_ST_END : nothing left to dump, the buffer may contain some
 	 *     data though.
+	 *
+	 * The entries are collected by batches under their shard's lock, then
+	 * each of them is copied under its own lock and formatted from the copy,
+	 * so that neither the shard nor the entry is locked while the output is
+	 * produced.
 	 */
 
 	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW))) {
 		/* in case of abort, remove any refcount we might have set on an entry */
-		if (appctx->st2 == STAT_ST_LIST) {
-			stksess_kill_if_expired(appctx->ctx.table.t, appctx->ctx.table.entry, 1);
-		}
+		cli_release_show_table(appctx);
 		return 1;
 	}
 
@@ -3719,7 +4927,8 @@ static int cli_io_handler_table(struct appctx *appctx)
 			if (!appctx->ctx.table.t)
 				appctx->ctx.table.t = stktables_list;
 
-			appctx->ctx.table.entry = NULL;
+			appctx->ctx.table.batch_cnt = appctx->ctx.table.batch_pos = 0;
+			appctx->ctx.table.kill_mask = 0;
 			appctx->st2 = STAT_ST_INFO;
 			break;
 
@@ -3732,115 +4941,76 @@ static int cli_io_handler_table(struct appctx *appctx)
 			}
 
 			if (appctx->ctx.table.t->size) {
-				if (show && !table_dump_head_to_buffer(&trash, si, appctx->ctx.table.t, appctx->ctx.table.target))
+				if (appctx->ctx.table.binary) {
+					trash.data = stktable_persist_encode_hdr(appctx->ctx.table.t, trash.area);
+					if (ci_putchk(si_ic(si), &trash) == -1) {
+						si_rx_room_blk(si);
+						return 0;
+					}
+				}
+				else if (show && !table_dump_head_to_buffer(&trash, si, appctx->ctx.table.t, appctx->ctx.table.target))
 					return 0;
 
 				if (appctx->ctx.table.target &&
 				    (strm_li(s)->bind_conf->level & ACCESS_LVL_MASK) >= ACCESS_LVL_OPER) {
 					/* dump entries only if table explicitly requested */
-					HA_SPIN_LOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
-					eb = ebmb_first(&appctx->ctx.table.t->keys);
-					if (eb) {
-						appctx->ctx.table.entry = ebmb_entry(eb, struct stksess, key);
-						appctx->ctx.table.entry->ref_cnt++;
+					appctx->ctx.table.shard = 0;
+					table_dump_next_batch(appctx);
+					if (appctx->ctx.table.batch_cnt) {
 						appctx->st2 = STAT_ST_LIST;
-						HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
 						break;
 					}
-					HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
 				}
 			}
 			appctx->ctx.table.t = appctx->ctx.table.t->next;
 			break;
 
 		case STAT_ST_LIST:
-			skip_entry = 0;
-
-			HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &appctx->ctx.table.entry->lock);
-
-			if (appctx->ctx.table.data_type[0] >= 0) {
-				/* we're filtering on some data contents */
-				void *ptr;
-				int dt, i;
-				signed char op;
-				long long data, value;
-
-
-				for (i = 0; i < STKTABLE_FILTER_LEN; i++) {
-					if (appctx->ctx.table.data_type[i] == -1)
-						break;
-					dt = appctx->ctx.table.data_type[i];
-					ptr = stktable_data_ptr(appctx->ctx.table.t,
-								appctx->ctx.table.entry,
-								dt);
-
-					data = 0;
-					switch (stktable_data_types[dt].std_type) {
-					case STD_T_SINT:
-						data = stktable_data_cast(ptr, std_t_sint);
-						break;
-					case STD_T_UINT:
-						data = stktable_data_cast(ptr, std_t_uint);
-						break;
-					case STD_T_ULL:
-						data = stktable_data_cast(ptr, std_t_ull);
-						break;
-					case STD_T_FRQP:
-						data = read_freq_ctr_period(&stktable_data_cast(ptr, std_t_frqp),
-									    appctx->ctx.table.t->data_arg[dt].u);
-						break;
-					}
-
-					op = appctx->ctx.table.data_op[i];
-					value = appctx->ctx.table.value[i];
-
-					/* skip the entry if the data does not match the test and the value */
-					if ((data < value &&
-					     (op == STD_OP_EQ || op == STD_OP_GT || op == STD_OP_GE)) ||
-					    (data == value &&
-					     (op == STD_OP_NE || op == STD_OP_GT || op == STD_OP_LT)) ||
-					    (data > value &&
-					     (op == STD_OP_EQ || op == STD_OP_LT || op == STD_OP_LE))) {
-						skip_entry = 1;
-						break;
-					}
+			if (appctx->ctx.table.batch_pos == appctx->ctx.table.batch_cnt) {
+				table_dump_next_batch(appctx);
+				if (!appctx->ctx.table.batch_cnt) {
+					appctx->ctx.table.t = appctx->ctx.table.t->next;
+					appctx->st2 = STAT_ST_INFO;
+					break;
 				}
 			}
 
-			if (show && !skip_entry &&
-			    !table_dump_entry_to_buffer(&trash, si, appctx->ctx.table.t, appctx->ctx.table.entry)) {
-				HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &appctx->ctx.table.entry->lock);
-				return 0;
-			}
+			ts = appctx->ctx.table.batch[appctx->ctx.table.batch_pos];
 
-			HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &appctx->ctx.table.entry->lock);
-
-			HA_SPIN_LOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
-			appctx->ctx.table.entry->ref_cnt--;
-
-			eb = ebmb_next(&appctx->ctx.table.entry->key);
-			if (eb) {
-				struct stksess *old = appctx->ctx.table.entry;
-				appctx->ctx.table.entry = ebmb_entry(eb, struct stksess, key);
-				if (show)
-					__stksess_kill_if_expired(appctx->ctx.table.t, old);
-				else if (!skip_entry && !appctx->ctx.table.entry->ref_cnt)
-					__stksess_kill(appctx->ctx.table.t, old);
-				appctx->ctx.table.entry->ref_cnt++;
-				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
+			if (appctx->ctx.table.binary) {
+				/* the records are small and encoded under the entry's lock */
+				trash.data = stktable_persist_encode(appctx->ctx.table.t, ts, trash.area);
+				if (ci_putchk(si_ic(si), &trash) == -1) {
+					si_rx_room_blk(si);
+					return 0;
+				}
+				appctx->ctx.table.batch_pos++;
 				break;
 			}
 
+			HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &ts->lock);
+			copy = table_copy_entry(appctx->ctx.table.t, ts, get_trash_chunk());
+			if (copy)
+				HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
+
+			/* we may be filtering on some data contents */
+			skip_entry = appctx->ctx.table.data_type[0] >= 0 &&
+				table_dump_skip_entry(appctx, appctx->ctx.table.t, copy ? copy : ts);
 
-			if (show)
-				__stksess_kill_if_expired(appctx->ctx.table.t, appctx->ctx.table.entry);
-			else if (!skip_entry && !appctx->ctx.table.entry->ref_cnt)
-				__stksess_kill(appctx->ctx.table.t, appctx->ctx.table.entry);
+			if (show && !skip_entry &&
+			    !table_dump_entry_to_buffer(&trash, si, appctx->ctx.table.t, copy ? copy : ts, ts)) {
+				if (!copy)
+					HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
+				return 0;
+			}
 
-			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
+			if (!copy)
+				HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
 
-			appctx->ctx.table.t = appctx->ctx.table.t->next;
-			appctx->st2 = STAT_ST_INFO;
+			/* the cleared entries are removed with the batch */
+			if (!show && !skip_entry)
+				appctx->ctx.table.kill_mask |= 1U << appctx->ctx.table.batch_pos;
+			appctx->ctx.table.batch_pos++;
 			break;
 
 		case STAT_ST_END:
@@ -3851,13 +5021,63 @@ static int cli_io_handler_table(struct appctx *appctx)
 	return 1;
 }
 
-static void cli_release_show_table(struct appctx *appctx)
+/* parse the "early-reject" frontend keyword */
+static int stk_parse_early_reject(char **args, int section_type, struct proxy *curpx,
+                                  struct proxy *defpx, const char *file, int line,
+                                  char **err)
 {
-	if (appctx->st2 == STAT_ST_LIST) {
-		stksess_kill_if_expired(appctx->ctx.table.t, appctx->ctx.table.entry, 1);
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a stick-table name", args[0]);
+		return -1;
+	}
+
+	if (curpx == defpx) {
+		memprintf(err, "'%s' is not supported in 'defaults' sections", args[0]);
+		return -1;
+	}
+
+	if (!(curpx->cap & PR_CAP_FE)) {
+		memprintf(err, "'%s' will be ignored because %s '%s' has no frontend capability",
+			  args[0], proxy_type_str(curpx), curpx->id);
+		return 1;
+	}
+
+	free(curpx->early_reject.name);
+	curpx->early_reject.name = strdup(args[1]);
+	if (!curpx->early_reject.name) {
+		memprintf(err, "'%s' : out of memory", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* resolves the table of the "early-reject" keyword of proxy <px> */
+static int stk_resolve_early_reject(struct proxy *px)
+{
+	struct stktable *t;
+
+	if (!px->early_reject.name)
+		return ERR_NONE;
+
+	t = stktable_find_by_name(px->early_reject.name);
+	if (!t) {
+		ha_alert("Proxy '%s': unable to find stick-table '%s' in 'early-reject'.\n",
+			 px->id, px->early_reject.name);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	if (!t->reject.threshold) {
+		ha_alert("Proxy '%s': stick-table '%s' used by 'early-reject' has no 'reject-gpc0' threshold.\n",
+			 px->id, px->early_reject.name);
+		return ERR_ALERT | ERR_FATAL;
 	}
+
+	px->early_reject.table = t;
+	return ERR_NONE;
 }
 
+REGISTER_POST_PROXY_CHECK(stk_resolve_early_reject);
+
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "clear", "table", NULL }, "clear table    : remove an entry from a table", cli_parse_table_req, cli_io_handler_table, cli_release_show_table, (void *)STK_CLI_ACT_CLR },
@@ -4087,3 +5307,10 @@ static struct sample_conv_kw_list sample_conv_kws = {ILH, {
 }};
 
 INITCALL1(STG_REGISTER, sample_register_convs, &sample_conv_kws);
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_LISTEN, "early-reject", stk_parse_early_reject },
+	{ 0, NULL, NULL },
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
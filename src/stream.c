@@ -10,6 +10,7 @@
  *
  */
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -23,6 +24,8 @@
 #include <common/initcall.h>
 #include <common/memory.h>
 
+#include <ebsttree.h>
+
 #include <types/applet.h>
 #include <types/capture.h>
 #include <types/cli.h>
@@ -39,6 +42,7 @@
 #include <proto/checks.h>
 #include <proto/cli.h>
 #include <proto/connection.h>
+#include <proto/counters.h>
 #include <proto/dict.h>
 #include <proto/dns.h>
 #include <proto/stats.h>
@@ -53,6 +57,7 @@
 #include <proto/raw_sock.h>
 #include <proto/session.h>
 #include <proto/stream.h>
+#include <proto/pattern.h>
 #include <proto/pipe.h>
 #include <proto/http_ana.h>
 #include <proto/proxy.h>
@@ -429,6 +434,7 @@ struct stream *stream_new(struct session *sess, enum obj_type *origin)
 	 */
 	vars_init(&s->vars_txn,    SCOPE_TXN);
 	vars_init(&s->vars_reqres, SCOPE_REQ);
+	s->smp_memo = NULL;
 
 	/* this part should be common with other protocols */
 	if (si_reset(&s->si[0]) < 0)
@@ -665,6 +671,7 @@ static void stream_free(struct stream *s)
 		vars_prune(&s->vars_txn, s->sess, s);
 	if (!LIST_ISEMPTY(&s->vars_reqres.head))
 		vars_prune(&s->vars_reqres, s->sess, s);
+	smp_memo_release(s);
 
 	stream_store_counters(s);
 
@@ -703,6 +710,7 @@ static void stream_free(struct stream *s)
 
 	/* We may want to free the maximum amount of pools if the proxy is stopping */
 	if (fe && unlikely(fe->state == PR_STSTOPPED)) {
+		b_hot_flush();
 		pool_flush(pool_head_buffer);
 		pool_flush(pool_head_http_txn);
 		pool_flush(pool_head_requri);
@@ -774,8 +782,8 @@ void stream_process_counters(struct stream *s)
 	bytes = s->req.total - s->logs.bytes_in;
 	s->logs.bytes_in = s->req.total;
 	if (bytes) {
-		_HA_ATOMIC_ADD(&sess->fe->fe_counters.bytes_in, bytes);
-		_HA_ATOMIC_ADD(&s->be->be_counters.bytes_in,    bytes);
+		COUNTERS_ADD(&sess->fe->fe_counters, bytes_in, bytes);
+		COUNTERS_ADD(&s->be->be_counters,    bytes_in, bytes);
 
 		if (objt_server(s->target))
 			_HA_ATOMIC_ADD(&objt_server(s->target)->counters.bytes_in, bytes);
@@ -794,16 +802,14 @@ void stream_process_counters(struct stream *s)
 					continue;
 			}
 
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 			ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_IN_CNT);
 			if (ptr1)
-				stktable_data_cast(ptr1, bytes_in_cnt) += bytes;
+				_HA_ATOMIC_ADD(&stktable_data_cast(ptr1, bytes_in_cnt), bytes);
 
 			ptr2 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_IN_RATE);
 			if (ptr2)
 				update_freq_ctr_period(&stktable_data_cast(ptr2, bytes_in_rate),
 						       stkctr->table->data_arg[STKTABLE_DT_BYTES_IN_RATE].u, bytes);
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			if (ptr1 || ptr2)
@@ -814,8 +820,8 @@ void stream_process_counters(struct stream *s)
 	bytes = s->res.total - s->logs.bytes_out;
 	s->logs.bytes_out = s->res.total;
 	if (bytes) {
-		_HA_ATOMIC_ADD(&sess->fe->fe_counters.bytes_out, bytes);
-		_HA_ATOMIC_ADD(&s->be->be_counters.bytes_out,    bytes);
+		COUNTERS_ADD(&sess->fe->fe_counters, bytes_out, bytes);
+		COUNTERS_ADD(&s->be->be_counters,    bytes_out, bytes);
 
 		if (objt_server(s->target))
 			_HA_ATOMIC_ADD(&objt_server(s->target)->counters.bytes_out, bytes);
@@ -834,16 +840,14 @@ void stream_process_counters(struct stream *s)
 					continue;
 			}
 
-			HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 			ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_OUT_CNT);
 			if (ptr1)
-				stktable_data_cast(ptr1, bytes_out_cnt) += bytes;
+				_HA_ATOMIC_ADD(&stktable_data_cast(ptr1, bytes_out_cnt), bytes);
 
 			ptr2 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_OUT_RATE);
 			if (ptr2)
 				update_freq_ctr_period(&stktable_data_cast(ptr2, bytes_out_rate),
 						       stkctr->table->data_arg[STKTABLE_DT_BYTES_OUT_RATE].u, bytes);
-			HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
 
 			/* If data was modified, we need to touch to re-schedule sync */
 			if (ptr1 || ptr2)
@@ -1022,6 +1026,251 @@ enum act_return process_use_service(struct act_rule *rule, struct proxy *px,
 	return ACT_RET_STOP;
 }
 
+/* Returns the ACL tested by switching rule <rule> if it is made of a single
+ * non-negated ACL with the "if" polarity, otherwise NULL.
+ */
+static struct acl *sw_rule_acl(const struct switching_rule *rule)
+{
+	struct acl_term_suite *suite;
+	struct acl_term *term;
+
+	if (!rule->cond || rule->cond->pol != ACL_COND_IF)
+		return NULL;
+
+	if (LIST_ISEMPTY(&rule->cond->suites) ||
+	    rule->cond->suites.n != rule->cond->suites.p)
+		return NULL;
+
+	suite = LIST_ELEM(rule->cond->suites.n, struct acl_term_suite *, list);
+	if (LIST_ISEMPTY(&suite->terms) || suite->terms.n != suite->terms.p)
+		return NULL;
+
+	term = LIST_ELEM(suite->terms.n, struct acl_term *, list);
+	return term->neg ? NULL : term->acl;
+}
+
+/* Returns non-zero if all the expressions of ACL <acl> match the same sample
+ * against exact strings, which must also be the ones of <*expr> and <*icase>
+ * unless <*expr> is NULL, in which case they are set.
+ */
+static int sw_acl_indexable(const struct acl *acl, struct sample_expr **expr, int *icase)
+{
+	struct acl_expr *aexpr;
+	struct pattern_expr_list *lst;
+	struct pat_ref_elt *elt;
+	int ic;
+
+	if (LIST_ISEMPTY(&acl->expr))
+		return 0;
+
+	list_for_each_entry(aexpr, &acl->expr, list) {
+		if (aexpr->pat.match != pat_match_str ||
+		    aexpr->smp->fetch->out_type != SMP_T_STR ||
+		    !LIST_ISEMPTY(&aexpr->smp->conv_exprs))
+			return 0;
+
+		list_for_each_entry(lst, &aexpr->pat.head, list) {
+			if (!lst->expr->ref)
+				return 0;
+			ic = !!(lst->expr->mflags & PAT_MF_IGNORE_CASE);
+			if (!*expr) {
+				*expr = aexpr->smp;
+				*icase = ic;
+			}
+			else if ((*expr)->fetch != aexpr->smp->fetch ||
+			         !smp_args_eq((*expr)->arg_p, aexpr->smp->arg_p) ||
+			         *icase != ic)
+				return 0;
+
+			list_for_each_entry(elt, &lst->expr->ref->head, list) {
+				if (strlen(elt->pattern) >= SW_DISPATCH_MAX_KEY)
+					return 0;
+			}
+		}
+	}
+	return *expr != NULL;
+}
+
+/* Indexes the keys of the <nb> consecutive switching rules starting at <first>
+ * which were found to be indexable. Nothing is done if there are not enough
+ * of them to be worth it. Returns 0 on success or -1 on memory shortage.
+ */
+static int sw_dispatch_build(struct switching_rule *first, int nb, struct sample_expr *expr, int icase)
+{
+	struct sw_dispatch *d;
+	struct switching_rule *rule;
+	struct acl_expr *aexpr;
+	struct pattern_expr_list *lst;
+	struct pat_ref_elt *elt;
+	struct sw_dispatch_key *key;
+	size_t len, i;
+	int idx;
+
+	if (nb < SW_DISPATCH_MIN_RULES)
+		return 0;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return -1;
+
+	d->rules = calloc(nb, sizeof(*d->rules));
+	if (!d->rules) {
+		free(d);
+		return -1;
+	}
+
+	d->expr = expr;
+	d->icase = icase;
+	d->nb_rules = nb;
+	d->keys = EB_ROOT_UNIQUE;
+
+	rule = first;
+	for (idx = 0; idx < nb; idx++) {
+		d->rules[idx] = rule;
+		list_for_each_entry(aexpr, &sw_rule_acl(rule)->expr, list) {
+			list_for_each_entry(lst, &aexpr->pat.head, list) {
+				lst->expr->ref->flags |= PAT_REF_IDX;
+				list_for_each_entry(elt, &lst->expr->ref->head, list) {
+					len = strlen(elt->pattern);
+					key = malloc(sizeof(*key) + len + 1);
+					if (!key) {
+						sw_dispatch_free(d);
+						return -1;
+					}
+					key->idx = idx;
+					for (i = 0; i < len; i++)
+						key->node.key[i] = icase ? tolower((unsigned char)elt->pattern[i]) : elt->pattern[i];
+					key->node.key[len] = 0;
+
+					/* the first rule declaring a key wins */
+					if (ebst_insert(&d->keys, &key->node) != &key->node)
+						free(key);
+				}
+			}
+		}
+		rule = LIST_NEXT(&rule->list, struct switching_rule *, list);
+	}
+
+	d->gen = pat_ref_idx_gen;
+	first->dispatch = d;
+	return 0;
+}
+
+/* Releases dispatch table <d>. */
+void sw_dispatch_free(struct sw_dispatch *d)
+{
+	struct ebmb_node *node, *next;
+
+	if (!d)
+		return;
+
+	node = ebmb_first(&d->keys);
+	while (node) {
+		next = ebmb_next(node);
+		ebmb_delete(node);
+		free(container_of(node, struct sw_dispatch_key, node));
+		node = next;
+	}
+	free(d->rules);
+	free(d);
+}
+
+/* Looks for the sequences of consecutive switching rules of all proxies which
+ * only match the same sample against exact strings, and indexes them so that
+ * they are evaluated with a single lookup. Returns ERR_NONE on success or
+ * ERR_ALERT|ERR_FATAL on memory shortage.
+ */
+static int sw_dispatch_build_all()
+{
+	struct proxy *px;
+	struct switching_rule *rule, *first;
+	struct sample_expr *expr, *cur;
+	struct acl *acl;
+	int icase, ic, nb;
+
+	for (px = proxies_list; px; px = px->next) {
+		first = NULL;
+		expr = NULL;
+		icase = nb = 0;
+
+		list_for_each_entry(rule, &px->switching_rules, list) {
+			acl = sw_rule_acl(rule);
+			if (first && acl && sw_acl_indexable(acl, &expr, &icase)) {
+				nb++;
+				continue;
+			}
+
+			/* this rule ends the current sequence, if any */
+			if (first && sw_dispatch_build(first, nb, expr, icase) < 0)
+				goto out_of_memory;
+
+			first = NULL;
+			cur = NULL;
+			ic = 0;
+			if (acl && sw_acl_indexable(acl, &cur, &ic)) {
+				first = rule;
+				expr = cur;
+				icase = ic;
+				nb = 1;
+			}
+		}
+
+		if (first && sw_dispatch_build(first, nb, expr, icase) < 0)
+			goto out_of_memory;
+	}
+	return ERR_NONE;
+
+ out_of_memory:
+	ha_alert("Out of memory while indexing the switching rules of proxy '%s'.\n", px->id);
+	return ERR_ALERT | ERR_FATAL;
+}
+
+REGISTER_POST_CHECK(sw_dispatch_build_all);
+
+/* Evaluates with a single lookup the sequence of switching rules indexed in
+ * <d>. Returns 1 if one of them matches, in which case <rule> is set to the
+ * first matching one, or 0 if none matches, in which case <rule> is set to
+ * the last rule of the sequence.
+ */
+static int sw_dispatch_exec(struct sw_dispatch *d, struct proxy *px, struct session *sess,
+                            struct stream *s, struct switching_rule **rule)
+{
+	char buf[SW_DISPATCH_MAX_KEY];
+	struct ebmb_node *node;
+	struct sample smp;
+	size_t len, i;
+	int best = d->nb_rules;
+	int idx;
+
+	memset(&smp, 0, sizeof(smp));
+	do {
+		if (!sample_process(px, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL|SMP_OPT_ITERATE, d->expr, &smp))
+			break;
+
+		len = smp.data.u.str.data;
+		if (len >= sizeof(buf))
+			continue;
+
+		for (i = 0; i < len; i++)
+			buf[i] = d->icase ? tolower((unsigned char)smp.data.u.str.area[i]) : smp.data.u.str.area[i];
+		buf[len] = 0;
+
+		node = ebst_lookup(&d->keys, buf);
+		if (node) {
+			idx = container_of(node, struct sw_dispatch_key, node)->idx;
+			if (idx < best)
+				best = idx;
+		}
+	} while (best && (smp.flags & SMP_F_NOT_LAST));
+
+	if (best < d->nb_rules) {
+		*rule = d->rules[best];
+		return 1;
+	}
+	*rule = d->rules[d->nb_rules - 1];
+	return 0;
+}
+
 /* This stream analyser checks the switching rules and changes the backend
  * if appropriate. The default_backend rule is also considered, then the
  * target backend's forced persistence rules are also evaluated last if any.
@@ -1046,7 +1295,10 @@ static int process_switching_rules(struct stream *s, struct channel *req, int an
 		list_for_each_entry(rule, &fe->switching_rules, list) {
 			int ret = 1;
 
-			if (rule->cond) {
+			/* the dispatch table is ignored once its patterns changed */
+			if (rule->dispatch && rule->dispatch->gen == pat_ref_idx_gen)
+				ret = sw_dispatch_exec(rule->dispatch, fe, sess, s, &rule);
+			else if (rule->cond) {
 				ret = acl_exec_cond(rule->cond, fe, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL);
 				ret = acl_pass(ret);
 				if (rule->cond->pol == ACL_COND_UNLESS)
@@ -1477,6 +1729,42 @@ static int process_store_rules(struct stream *s, struct channel *rep, int an_bit
 		}							\
 	}
 
+/* Returns non-zero if stream <s> only forwards data in both directions without
+ * anything to analyse: both stream interfaces are established and error-free,
+ * there is neither analyser nor filter, both channels are already set to
+ * forward forever and no shutdown, error, timeout or one-shot event is pending
+ * on them. Kernel splicing, when it may still be automatically enabled, must
+ * already be in use. Such a stream doesn't need the full processing when it is
+ * only woken up for I/O.
+ */
+static inline int stream_may_fast_forward(const struct stream *s)
+{
+	const struct channel *req = &s->req;
+	const struct channel *res = &s->res;
+
+	if (req->analysers || res->analysers || HAS_FILTERS(s))
+		return 0;
+
+	if (s->si[0].state != SI_ST_EST || s->si[1].state != SI_ST_EST ||
+	    ((s->si[0].flags | s->si[1].flags) & (SI_FL_ERR|SI_FL_EXP)))
+		return 0;
+
+	if (req->to_forward != CHN_INFINITE_FORWARD || res->to_forward != CHN_INFINITE_FORWARD)
+		return 0;
+
+	if ((req->flags | res->flags) &
+	    (CF_SHUTR|CF_SHUTW|CF_SHUTR_NOW|CF_SHUTW_NOW|CF_READ_ERROR|CF_WRITE_ERROR|
+	     CF_READ_TIMEOUT|CF_WRITE_TIMEOUT|CF_ANA_TIMEOUT|CF_READ_ATTACHED|CF_WAKE_ONCE))
+		return 0;
+
+	if (((strm_fe(s)->options2 | s->be->options2) & PR_O2_SPLIC_AUT) &&
+	    (global.tune.options & GTUNE_USE_SPLICE) &&
+	    !(req->flags & res->flags & CF_KERN_SPLICING))
+		return 0;
+
+	return 1;
+}
+
 /* Processes the client, server, request and response jobs of a stream task,
  * then puts it back to the wait queue in a clean state, or cleans up its
  * resources if it must be deleted. Returns in <next> the date the task wants
@@ -1536,6 +1824,23 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	/* update pending events */
 	s->pending_events |= (state & TASK_WOKEN_ANY);
 
+	/* Fast path for streams which only forward data and were only woken up
+	 * for I/O : we just try to send what was received and update the stream
+	 * interfaces. If anything changed in the mean time, the full processing
+	 * below takes over.
+	 */
+	if (!(s->pending_events & (TASK_WOKEN_ANY & ~TASK_WOKEN_IO)) &&
+	    stream_may_fast_forward(s)) {
+		si_sync_send(si_b);
+		si_sync_send(si_f);
+		if (likely(stream_may_fast_forward(s))) {
+			DBG_TRACE_DEVEL("fast forwarding", STRM_EV_STRM_PROC, s);
+			si_f->flags &= ~SI_FL_DONT_WAKE;
+			si_b->flags &= ~SI_FL_DONT_WAKE;
+			goto update_both_and_leave;
+		}
+	}
+
 	/* 1a: Check for low level timeouts if needed. We just set a flag on
 	 * stream interfaces when their timeouts have expired.
 	 */
@@ -2042,6 +2347,7 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	    (objt_cs(si_f->end) && __objt_cs(si_f->end)->conn->xprt && __objt_cs(si_f->end)->conn->xprt->rcv_pipe &&
 	     __objt_cs(si_f->end)->conn->mux && __objt_cs(si_f->end)->conn->mux->rcv_pipe) &&
 	    (objt_cs(si_b->end) && __objt_cs(si_b->end)->conn->xprt && __objt_cs(si_b->end)->conn->xprt->snd_pipe &&
+	     !(__objt_cs(si_b->end)->conn->flags & CO_FL_NO_SND_PIPE) &&
 	     __objt_cs(si_b->end)->conn->mux && __objt_cs(si_b->end)->conn->mux->snd_pipe) &&
 	    (pipes_used < global.maxpipes) &&
 	    (((sess->fe->options2|s->be->options2) & PR_O2_SPLIC_REQ) ||
@@ -2233,6 +2539,7 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	    res->to_forward &&
 	    (global.tune.options & GTUNE_USE_SPLICE) &&
 	    (objt_cs(si_f->end) && __objt_cs(si_f->end)->conn->xprt && __objt_cs(si_f->end)->conn->xprt->snd_pipe &&
+	     !(__objt_cs(si_f->end)->conn->flags & CO_FL_NO_SND_PIPE) &&
 	     __objt_cs(si_f->end)->conn->mux && __objt_cs(si_f->end)->conn->mux->snd_pipe) &&
 	    (objt_cs(si_b->end) && __objt_cs(si_b->end)->conn->xprt && __objt_cs(si_b->end)->conn->xprt->rcv_pipe &&
 	     __objt_cs(si_b->end)->conn->mux && __objt_cs(si_b->end)->conn->mux->rcv_pipe) &&
@@ -2328,6 +2635,7 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	}
 
 	if (likely((si_f->state != SI_ST_CLO) || !si_state_in(si_b->state, SI_SB_INI|SI_SB_CLO))) {
+	update_both_and_leave:
 		if ((sess->fe->options & PR_O_CONTSTATS) && (s->flags & SF_BE_ASSIGNED) && !(s->flags & SF_IGNORE))
 			stream_process_counters(s);
 
@@ -2405,12 +2713,12 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 			n = 0;
 
 		if (sess->fe->mode == PR_MODE_HTTP) {
-			_HA_ATOMIC_ADD(&sess->fe->fe_counters.p.http.rsp[n], 1);
+			COUNTERS_ADD(&sess->fe->fe_counters, p.http.rsp[n], 1);
 		}
 		if ((s->flags & SF_BE_ASSIGNED) &&
 		    (s->be->mode == PR_MODE_HTTP)) {
-			_HA_ATOMIC_ADD(&s->be->be_counters.p.http.rsp[n], 1);
-			_HA_ATOMIC_ADD(&s->be->be_counters.p.http.cum_req, 1);
+			COUNTERS_ADD(&s->be->be_counters, p.http.rsp[n], 1);
+			COUNTERS_ADD(&s->be->be_counters, p.http.cum_req, 1);
 		}
 	}
 
@@ -2423,6 +2731,24 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 		s->do_log(s);
 	}
 
+	/* report the outcome of this stream to the outlier detection and to
+	 * the adaptive concurrency limit.
+	 */
+	srv = objt_server(s->target);
+	if (srv && (srv->eject_task || srv->adapt_limit)) {
+		int err = s->flags & SF_ERR_MASK;
+		int rtime = (s->be->mode == PR_MODE_HTTP) ? s->logs.t_data : s->logs.t_connect;
+
+		if (rtime >= 0)
+			rtime -= s->logs.t_queue;
+		srv_observe_outlier(srv,
+		                    (s->txn && s->txn->status >= 500) ||
+		                    err == SF_ERR_SRVTO || err == SF_ERR_SRVCL, rtime);
+		srv_observe_concurrency(srv,
+		                        (s->txn && s->txn->status == 503) ||
+		                        err == SF_ERR_SRVTO || err == SF_ERR_SRVCL, rtime);
+	}
+
 	/* update time stats for this stream */
 	stream_update_time_stats(s);
 
@@ -2474,9 +2800,16 @@ void stream_update_time_stats(struct stream *s)
 		HA_ATOMIC_UPDATE_MAX(&srv->counters.ctime_max, t_connect);
 		HA_ATOMIC_UPDATE_MAX(&srv->counters.dtime_max, t_data);
 		HA_ATOMIC_UPDATE_MAX(&srv->counters.ttime_max, t_close);
-	}
-	samples_window = (((s->be->mode == PR_MODE_HTTP) ?
-		s->be->be_counters.p.http.cum_req : s->be->be_counters.cum_lbconn) > TIME_STATS_SAMPLES) ? TIME_STATS_SAMPLES : 0;
+		lat_hist_add(&srv->counters.q_hist, t_queue);
+		lat_hist_add(&srv->counters.c_hist, t_connect);
+		lat_hist_add(&srv->counters.d_hist, t_data);
+		lat_hist_add(&srv->counters.t_hist, t_close);
+		if ((srv->proxy->lbprm.algo & BE_LB_ALGO) == BE_LB_ALGO_EWMA)
+			srv_update_ewma(srv, t_connect + t_data);
+	}
+	samples_window = ((s->be->mode == PR_MODE_HTTP) ?
+		COUNTERS_ABOVE(&s->be->be_counters, p.http.cum_req, TIME_STATS_SAMPLES) :
+		s->be->be_counters.cum_lbconn > TIME_STATS_SAMPLES) ? TIME_STATS_SAMPLES : 0;
 	swrate_add_dynamic(&s->be->be_counters.q_time, samples_window, t_queue);
 	swrate_add_dynamic(&s->be->be_counters.c_time, samples_window, t_connect);
 	swrate_add_dynamic(&s->be->be_counters.d_time, samples_window, t_data);
@@ -2485,6 +2818,10 @@ void stream_update_time_stats(struct stream *s)
 	HA_ATOMIC_UPDATE_MAX(&s->be->be_counters.ctime_max, t_connect);
 	HA_ATOMIC_UPDATE_MAX(&s->be->be_counters.dtime_max, t_data);
 	HA_ATOMIC_UPDATE_MAX(&s->be->be_counters.ttime_max, t_close);
+	lat_hist_add(&s->be->be_counters.q_hist, t_queue);
+	lat_hist_add(&s->be->be_counters.c_hist, t_connect);
+	lat_hist_add(&s->be->be_counters.d_hist, t_data);
+	lat_hist_add(&s->be->be_counters.t_hist, t_close);
 }
 
 /*
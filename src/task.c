@@ -12,6 +12,7 @@
 
 #include <string.h>
 
+#include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/memory.h>
 #include <common/mini-clist.h>
@@ -56,6 +57,99 @@ static unsigned int rqueue_ticks;  /* insertion count */
 
 struct task_per_thread task_per_thread[MAX_THREADS];
 
+#ifdef USE_THREAD
+/* Returns non-zero if task <t> may be queued into the steal list of the current
+ * thread instead of the global run queue. This is only the case with work
+ * stealing enabled, for non-niced tasks which may run on any thread: the
+ * list is FIFO and any thread may steal from it.
+ */
+static inline int task_is_stealable(const struct task *t)
+{
+	return (global.tune.options & GTUNE_SCHED_STEAL) && !t->nice &&
+	       (t->thread_mask & all_threads_mask) == all_threads_mask;
+}
+
+/* Queues migratable task <t> into the steal list of the current thread. It
+ * will be run from there by this thread unless an idle thread steals it. If
+ * the list is too long to be processed in one round, a sleeping thread is
+ * woken up to take its share.
+ */
+static void __task_wakeup_stealable(struct task *t)
+{
+	struct mt_list *elt = (struct mt_list *)&((struct tasklet *)t)->list;
+	unsigned long m;
+
+	_HA_ATOMIC_ADD(&tasks_run_queue, 1);
+	if (task_profiling_mask & tid_bit)
+		t->call_date = now_mono_time();
+
+	MT_LIST_INIT(elt);
+	MT_LIST_ADDQ(&sched->steal_list, elt);
+	if (_HA_ATOMIC_ADD(&sched->steal_size, 1) <= global.tune.runqueue_depth)
+		return;
+
+	m = sleeping_thread_mask & all_threads_mask & ~tid_bit;
+	if (m) {
+		m = (m & (m - 1)) ^ m; // keep lowest bit set
+		_HA_ATOMIC_AND(&sleeping_thread_mask, ~m);
+		wake_thread(my_ffsl(m) - 1);
+	}
+}
+
+/* Moves up to <max> tasks from the steal list of thread <thr> to the list of
+ * the normal tasks of the current thread. Returns the number of tasks moved.
+ */
+static int task_take_stealable(int thr, int max)
+{
+	struct task_per_thread *src = &task_per_thread[thr];
+	struct tasklet *tl;
+	int done = 0;
+
+	while (done < max) {
+		tl = MT_LIST_POP(&src->steal_list, struct tasklet *, list);
+		if (!tl)
+			break;
+		_HA_ATOMIC_SUB(&src->steal_size, 1);
+		_HA_ATOMIC_SUB(&tasks_run_queue, 1);
+		LIST_INIT(&tl->list);
+		tasklet_insert_into_tasklet_list(&sched->tasklets[TL_NORMAL], tl);
+		sched->task_list_size++;
+		activity[tid].tasksw++;
+		done++;
+	}
+	return done;
+}
+
+/* Called by a thread with nothing to do, to steal half of the migratable tasks
+ * of the most loaded thread, if it has at least two of them. Returns the number
+ * of tasks stolen.
+ */
+static int task_steal()
+{
+	unsigned int best = 1;
+	int thr, victim = -1;
+	int done;
+
+	for (thr = 0; thr < global.nbthread; thr++) {
+		unsigned int size = task_per_thread[thr].steal_size;
+
+		if (thr != tid && size > best) {
+			best = size;
+			victim = thr;
+		}
+	}
+
+	if (victim < 0)
+		return 0;
+
+	if (best > global.tune.runqueue_depth)
+		best = global.tune.runqueue_depth;
+	done = task_take_stealable(victim, (best + 1) / 2);
+	activity[tid].stolen += done;
+	return done;
+}
+#endif
+
 /* Puts the task <t> in run queue at a position depending on t->nice. <t> is
  * returned. The nice value assigns boosts in 32th of the run queue size. A
  * nice value of -1024 sets the task to -tasks_run_queue*32, while a nice value
@@ -67,6 +161,11 @@ struct task_per_thread task_per_thread[MAX_THREADS];
 void __task_wakeup(struct task *t, struct eb_root *root)
 {
 #ifdef USE_THREAD
+	if (root == &rqueue && task_is_stealable(t)) {
+		__task_wakeup_stealable(t);
+		return;
+	}
+
 	if (root == &rqueue) {
 		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
 	}
@@ -122,6 +221,124 @@ void __task_wakeup(struct task *t, struct eb_root *root)
 	return;
 }
 
+/* Inserts task <t> whose wq key is already set into the timer wheel of <tt>,
+ * the current thread's scheduler context. The wheel's clock is moved to the
+ * current date when it is empty. Dates in the past are put into the slot of
+ * the next tick to be processed. Returns 0 if the date is too far for the wheel,
+ * in which case the task must go to the tree.
+ */
+static int __task_queue_wheel(struct task_per_thread *tt, struct task *t)
+{
+	unsigned int exp = t->wq.key;
+	unsigned int clk;
+	struct list *slot;
+	int level;
+
+	if (!(tt->wheel_cnt[0] | tt->wheel_cnt[1]))
+		tt->wheel_clk = now_ms;
+	clk = tt->wheel_clk;
+
+	if ((int)(exp - clk) < (int)TW0_SLOTS) {
+		if ((int)(exp - clk) < 0)
+			exp = clk;
+		level = 0;
+		slot = &tt->wheel0[exp & (TW0_SLOTS - 1)];
+	}
+	else if ((exp >> TW0_BITS) - (clk >> TW0_BITS) < TW1_SLOTS) {
+		level = 1;
+		slot = &tt->wheel1[(exp >> TW0_BITS) & (TW1_SLOTS - 1)];
+	}
+	else
+		return 0;
+
+	LIST_ADDQ(slot, &t->wheel);
+	t->wq.node.leaf_p = TASK_WQ_WHEEL;
+	t->wq.node.bit = level;
+	t->wq.node.pfx = tt - task_per_thread;
+	tt->wheel_cnt[level]++;
+	return 1;
+}
+
+/* Wakes up the tasks of the current thread's timer wheel whose timer expired,
+ * processing one slot per tick from the wheel's clock up to now_ms. The tasks
+ * whose timer was pushed later are queued again, possibly in the tree. The
+ * slots of level 1 are moved to level 0 when the clock reaches them, and the
+ * empty level 0 slots are skipped.
+ */
+static void wake_expired_wheel(struct task_per_thread *tt)
+{
+	struct list *slot;
+	struct task *task;
+
+	while ((tt->wheel_cnt[0] | tt->wheel_cnt[1]) && !tick_is_lt(now_ms, tt->wheel_clk)) {
+		if (!(tt->wheel_clk & (TW0_SLOTS - 1)) && tt->wheel_cnt[1]) {
+			slot = &tt->wheel1[(tt->wheel_clk >> TW0_BITS) & (TW1_SLOTS - 1)];
+			while (!LIST_ISEMPTY(slot)) {
+				task = LIST_ELEM(slot->n, struct task *, wheel);
+				__task_unlink_wq(task);
+				__task_queue_wheel(tt, task);
+			}
+		}
+
+		if (!tt->wheel_cnt[0]) {
+			/* nothing to do before the next slot of level 1, but the
+			 * clock must not go past now_ms + 1 so that the timers
+			 * queued in the mean time are not put in its past.
+			 */
+			unsigned int next = (tt->wheel_clk | (TW0_SLOTS - 1)) + 1;
+
+			tt->wheel_clk = ((int)(next - now_ms) > 1) ? now_ms + 1 : next;
+			continue;
+		}
+
+		slot = &tt->wheel0[tt->wheel_clk & (TW0_SLOTS - 1)];
+		while (!LIST_ISEMPTY(slot)) {
+			task = LIST_ELEM(slot->n, struct task *, wheel);
+			__task_unlink_wq(task);
+
+			/* same as for the tree, see wake_expired_tasks() */
+			if (!tick_is_expired(task->expire, now_ms)) {
+				if (tick_isset(task->expire))
+					__task_queue(task, &tt->timers);
+				continue;
+			}
+			task_wakeup(task, TASK_WOKEN_TIMER);
+		}
+		tt->wheel_clk++;
+	}
+}
+
+/* Returns the date of the first non-empty slot of the timer wheel of <tt>, or
+ * TICK_ETERNITY if it is empty. For a slot of level 1, this is the date it is
+ * moved to level 0. The one of the clock's period is only left to be moved
+ * when the clock is at its beginning.
+ */
+static int wheel_next_expiry(const struct task_per_thread *tt)
+{
+	unsigned int clk = tt->wheel_clk;
+	unsigned int i;
+	int ret = TICK_ETERNITY;
+
+	if (tt->wheel_cnt[1]) {
+		for (i = !!(clk & (TW0_SLOTS - 1)); i < TW1_SLOTS; i++) {
+			if (!LIST_ISEMPTY(&tt->wheel1[((clk >> TW0_BITS) + i) & (TW1_SLOTS - 1)])) {
+				ret = tick_add(((clk >> TW0_BITS) + i) << TW0_BITS, 0);
+				break;
+			}
+		}
+	}
+
+	if (tt->wheel_cnt[0]) {
+		for (i = 0; i < TW0_SLOTS; i++) {
+			if (!LIST_ISEMPTY(&tt->wheel0[(clk + i) & (TW0_SLOTS - 1)])) {
+				ret = tick_first(ret, tick_add(clk + i, 0));
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
 /*
  * __task_queue()
  *
@@ -136,6 +353,9 @@ void __task_wakeup(struct task *t, struct eb_root *root)
  * before deciding to call __task_queue(). Moreover this function doesn't care
  * at all about locking so the caller must be careful when deciding whether to
  * lock or not around this call.
+ *
+ * When <wq> is the current thread's wait queue, the near timers are put into
+ * the thread's timer wheel instead of the tree.
  */
 void __task_queue(struct task *task, struct eb_root *wq)
 {
@@ -150,6 +370,9 @@ void __task_queue(struct task *task, struct eb_root *wq)
 		return;
 #endif
 
+	if (wq == &sched->timers && __task_queue_wheel(sched, task))
+		return;
+
 	eb32_insert(wq, &task->wq);
 }
 
@@ -164,6 +387,8 @@ void wake_expired_tasks()
 	struct eb32_node *eb;
 	__decl_hathreads(int key);
 
+	wake_expired_wheel(tt);
+
 	while (1) {
   lookup_next_local:
 		eb = eb32_lookup_ge(&tt->timers, now_ms - TIMER_LOOK_BACK);
@@ -299,6 +524,8 @@ int next_timer_expiry()
 	if (eb)
 		ret = eb->key;
 
+	ret = tick_first(ret, wheel_next_expiry(tt));
+
 #ifdef USE_THREAD
 	if (!eb_is_empty(&timers)) {
 		HA_RWLOCK_RDLOCK(TASK_WQ_LOCK, &wq_lock);
@@ -315,6 +542,36 @@ int next_timer_expiry()
 	return ret;
 }
 
+/* Samples into <owner> what the run of <process> with context <ctx> is
+ * working for, so that it may be reported if the run turns out to be slow.
+ */
+static inline void slow_task_sample_owner(struct slow_task_owner *owner,
+                                          const void *process, const void *ctx)
+{
+	const struct stream *s = ctx;
+
+	memset(owner, 0, sizeof(*owner));
+	if (process != process_stream || !s)
+		return;
+
+	owner->fe = strm_fe(s);
+	owner->be = s->be;
+	owner->srv = objt_server(s->target);
+	owner->uniq_id = s->uniq_id;
+}
+
+/* Reports the run of <process> with context <ctx> which started at <start> if
+ * it exceeded the slow tasks threshold. <tasklet> indicates a tasklet.
+ */
+static inline void task_check_slow_run(const void *process, const void *ctx, int tasklet,
+                                       const struct slow_task_owner *owner, uint64_t start)
+{
+	uint64_t duration = now_mono_time() - start;
+
+	if (unlikely(duration >= slow_task_threshold))
+		report_slow_task(process, ctx, tasklet, owner, duration);
+}
+
 /* Walks over tasklet list <list> and run at most <max> of them. Returns
  * the number of entries effectively processed (tasks and tasklets merged).
  * The count of tasks in the list for the current thread is adjusted.
@@ -322,6 +579,10 @@ int next_timer_expiry()
 int run_tasks_from_list(struct list *list, int max)
 {
 	struct task *(*process)(struct task *t, void *ctx, unsigned short state);
+	struct sched_activity *profile_entry;
+	struct slow_task_owner owner;
+	uint64_t prof_start = 0;
+	uint64_t slow_start;
 	struct task *t;
 	unsigned short state;
 	void *ctx;
@@ -338,11 +599,30 @@ int run_tasks_from_list(struct list *list, int max)
 		t->calls++;
 		sched->current = t;
 
+		/* per-function accounting, only while profiling this thread */
+		profile_entry = NULL;
+		if (unlikely(task_profiling_mask & tid_bit) && process) {
+			profile_entry = sched_activity_entry(sched_activity, process);
+			_HA_ATOMIC_ADD(&profile_entry->calls, 1);
+			prof_start = now_mono_time();
+		}
+
+		/* slow runs detection, only when a threshold is set */
+		slow_start = 0;
+		if (unlikely(slow_task_threshold) && process) {
+			slow_task_sample_owner(&owner, process, ctx);
+			slow_start = now_mono_time();
+		}
+
 		if (TASK_IS_TASKLET(t)) {
 			state = _HA_ATOMIC_XCHG(&t->state, state);
 			__ha_barrier_atomic_store();
 			__tasklet_remove_from_tasklet_list((struct tasklet *)t);
 			process(t, ctx, state);
+			if (unlikely(profile_entry))
+				_HA_ATOMIC_ADD(&profile_entry->cpu_time, now_mono_time() - prof_start);
+			if (unlikely(slow_start))
+				task_check_slow_run(process, ctx, 1, &owner, slow_start);
 			done++;
 			sched->current = NULL;
 			__ha_barrier_store();
@@ -360,6 +640,8 @@ int run_tasks_from_list(struct list *list, int max)
 			uint64_t now_ns = now_mono_time();
 
 			t->lat_time += now_ns - t->call_date;
+			if (profile_entry)
+				_HA_ATOMIC_ADD(&profile_entry->lat_time, now_ns - t->call_date);
 			t->call_date = now_ns;
 		}
 
@@ -378,6 +660,11 @@ int run_tasks_from_list(struct list *list, int max)
 			 */
 			continue;
 		}
+		/* the task may have been freed, only the entry remains valid */
+		if (unlikely(profile_entry))
+			_HA_ATOMIC_ADD(&profile_entry->cpu_time, now_mono_time() - prof_start);
+		if (unlikely(slow_start))
+			task_check_slow_run(process, ctx, 0, &owner, slow_start);
 		sched->current = NULL;
 		__ha_barrier_store();
 		/* If there is a pending state  we have to wake up the task
@@ -425,8 +712,13 @@ void process_runnable_tasks()
 	ti->flags &= ~TI_FL_STUCK; // this thread is still running
 
 	if (!thread_has_tasks()) {
-		activity[tid].empty_rq++;
-		return;
+#ifdef USE_THREAD
+		if (!(global.tune.options & GTUNE_SCHED_STEAL) || !task_steal())
+#endif
+		{
+			activity[tid].empty_rq++;
+			return;
+		}
 	}
 	/* Merge the list of tasklets waken up by other threads to the
 	 * main list.
@@ -512,6 +804,12 @@ void process_runnable_tasks()
 		grq = NULL;
 	}
 
+#ifdef USE_THREAD
+	/* then the migratable tasks we woke up, unless stolen in the mean time */
+	if (tt->task_list_size < (3 * max_processed + 3) / 4 && !MT_LIST_ISEMPTY(&tt->steal_list))
+		task_take_stealable(tid, (3 * max_processed + 3) / 4 - tt->task_list_size);
+#endif
+
 	/* run between 0.4*max_processed and max_processed/2 regular tasks */
 	done = run_tasks_from_list(&tt->tasklets[TL_NORMAL], (3 * max_processed + 3) / 4);
 	max_processed -= done;
@@ -577,7 +875,7 @@ void work_list_destroy(struct work_list *work, int nbthread)
 void mworker_cleantasks()
 {
 	struct task *t;
-	int i;
+	int i, j;
 	struct eb32_node *tmp_wq = NULL;
 	struct eb32sc_node *tmp_rq = NULL;
 
@@ -612,13 +910,21 @@ void mworker_cleantasks()
 			tmp_wq = eb32_next(tmp_wq);
 			task_destroy(t);
 		}
+		/* and the per thread timer wheel */
+		for (j = 0; j < TW0_SLOTS + TW1_SLOTS; j++) {
+			struct list *slot = (j < TW0_SLOTS) ? &task_per_thread[i].wheel0[j] :
+				&task_per_thread[i].wheel1[j - TW0_SLOTS];
+
+			while (!LIST_ISEMPTY(slot))
+				task_destroy(LIST_ELEM(slot->n, struct task *, wheel));
+		}
 	}
 }
 
 /* perform minimal intializations */
 static void init_task()
 {
-	int i;
+	int i, j;
 
 #ifdef USE_THREAD
 	memset(&timers, 0, sizeof(timers));
@@ -629,10 +935,41 @@ static void init_task()
 		LIST_INIT(&task_per_thread[i].tasklets[TL_URGENT]);
 		LIST_INIT(&task_per_thread[i].tasklets[TL_NORMAL]);
 		LIST_INIT(&task_per_thread[i].tasklets[TL_BULK]);
+		for (j = 0; j < TW0_SLOTS; j++)
+			LIST_INIT(&task_per_thread[i].wheel0[j]);
+		for (j = 0; j < TW1_SLOTS; j++)
+			LIST_INIT(&task_per_thread[i].wheel1[j]);
 		MT_LIST_INIT(&task_per_thread[i].shared_tasklet_list);
+		MT_LIST_INIT(&task_per_thread[i].steal_list);
 	}
 }
 
+/* config parser for global "tune.sched.work-stealing", accepts "on" or "off" */
+static int cfg_parse_tune_sched_steal(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		global.tune.options |= GTUNE_SCHED_STEAL;
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_SCHED_STEAL;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.sched.work-stealing", cfg_parse_tune_sched_steal },
+	{ 0, NULL, NULL },
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 INITCALL0(STG_PREPARE, init_task);
 
 /*
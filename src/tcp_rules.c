@@ -149,6 +149,8 @@ int tcp_inspect_request(struct stream *s, struct channel *req, int an_bit)
 		}
 
 		if (ret) {
+			/* the action may change the message in place */
+			smp_memo_reset(s);
 			act_opts |= ACT_OPT_FIRST;
 resume_execution:
 
@@ -302,6 +304,8 @@ int tcp_inspect_response(struct stream *s, struct channel *rep, int an_bit)
 		}
 
 		if (ret) {
+			/* the action may change the message in place */
+			smp_memo_reset(s);
 			act_opts |= ACT_OPT_FIRST;
 resume_execution:
 			/* Always call the action function if defined */
@@ -679,7 +683,7 @@ static enum act_return tcp_action_capture(struct act_rule *rule, struct proxy *p
 {
 	struct sample *key;
 	struct cap_hdr *h = rule->arg.cap.hdr;
-	char **cap = s->req_cap;
+	char **cap;
 	int len, opt;
 
 	opt = ((rule->from == ACT_F_TCP_REQ_CNT) ? SMP_OPT_DIR_REQ : SMP_OPT_DIR_RES);
@@ -693,6 +697,10 @@ static enum act_return tcp_action_capture(struct act_rule *rule, struct proxy *p
 	if ((key->flags & SMP_F_MAY_CHANGE) && !(flags & ACT_FLAG_FINAL))
 		return ACT_RET_YIELD; /* key might appear later */
 
+	cap = stream_req_cap(s);
+	if (!cap) /* no more capture memory, ignore error */
+		goto end;
+
 	if (cap[h->index] == NULL) {
 		cap[h->index] = pool_alloc(h->pool);
 		if (cap[h->index] == NULL) /* no more capture memory, ignore error */
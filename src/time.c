@@ -21,6 +21,7 @@
 
 THREAD_LOCAL unsigned int   ms_left_scaled;  /* milliseconds left for current second (0..2^32-1) */
 THREAD_LOCAL unsigned int   now_ms;          /* internal date in milliseconds (may wrap) */
+THREAD_LOCAL uint64_t       now_us;          /* internal date in microseconds */
 THREAD_LOCAL unsigned int   samp_time;       /* total elapsed time over current sample */
 THREAD_LOCAL unsigned int   idle_time;       /* total idle time over current sample */
 THREAD_LOCAL struct timeval now;             /* internal date is a monotonic function of real clock */
@@ -232,6 +233,12 @@ void tv_update_date(int max_wait, int interrupted)
 		 */
 		new_now = (((unsigned long long)tmp_adj.tv_sec) << 32) + (unsigned int)tmp_adj.tv_usec;
 
+		/* another thread already reached this date, there's no need
+		 * to write the shared cache line again.
+		 */
+		if (new_now == old_now)
+			break;
+
 		/* let's try to update the global <now> or loop again */
 	} while (!_HA_ATOMIC_CAS(&global_now, &old_now, new_now));
 
@@ -262,6 +269,7 @@ void tv_update_date(int max_wait, int interrupted)
 	 */
 	ms_left_scaled = (999U - curr_sec_ms) * 4294967U;
 	now_ms = now.tv_sec * 1000 + curr_sec_ms;
+	now_us = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
 	return;
 }
 
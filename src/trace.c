@@ -29,6 +29,7 @@
 #include <proto/trace.h>
 
 struct list trace_sources = LIST_HEAD_INIT(trace_sources);
+unsigned int trace_sources_active = 0; /* number of non-stopped sources */
 THREAD_LOCAL struct buffer trace_buf = { };
 
 /* allocates the trace buffers. Returns 0 in case of failure. It is safe to
@@ -145,7 +146,7 @@ void __trace(enum trace_level level, uint64_t mask, struct trace_source *src,
 			return;
 
 		/* TODO: add update of lockon+lockon_ptr here */
-		HA_ATOMIC_STORE(&src->state, TRACE_STATE_RUNNING);
+		trace_set_state(src, TRACE_STATE_RUNNING);
 	}
 
 	/* we may want to lock on a particular object */
@@ -235,11 +236,11 @@ void __trace(enum trace_level level, uint64_t mask, struct trace_source *src,
 	/* check if we need to stop the trace now */
 	if ((src->stop_events & mask) != 0) {
 		HA_ATOMIC_STORE(&src->lockon_ptr, NULL);
-		HA_ATOMIC_STORE(&src->state, TRACE_STATE_STOPPED);
+		trace_set_state(src, TRACE_STATE_STOPPED);
 	}
 	else if ((src->pause_events & mask) != 0) {
 		HA_ATOMIC_STORE(&src->lockon_ptr, NULL);
-		HA_ATOMIC_STORE(&src->state, TRACE_STATE_WAITING);
+		trace_set_state(src, TRACE_STATE_WAITING);
 	}
 }
 
@@ -288,7 +289,7 @@ static int cli_parse_trace(char **args, char *payload, struct appctx *appctx, vo
 	if (strcmp(args[1], "0") == 0) {
 		/* emergency stop of all traces */
 		list_for_each_entry(src, &trace_sources, source_link)
-			HA_ATOMIC_STORE(&src->state, TRACE_STATE_STOPPED);
+			trace_set_state(src, TRACE_STATE_STOPPED);
 		return cli_msg(appctx, LOG_NOTICE, "All traces now stopped");
 	}
 
@@ -349,14 +350,14 @@ static int cli_parse_trace(char **args, char *payload, struct appctx *appctx, vo
 			HA_ATOMIC_STORE(ev_ptr, 0);
 			if (ev_ptr == &src->pause_events) {
 				HA_ATOMIC_STORE(&src->lockon_ptr, NULL);
-				HA_ATOMIC_STORE(&src->state, TRACE_STATE_WAITING);
+				trace_set_state(src, TRACE_STATE_WAITING);
 			}
 			else if (ev_ptr == &src->start_events) {
-				HA_ATOMIC_STORE(&src->state, TRACE_STATE_RUNNING);
+				trace_set_state(src, TRACE_STATE_RUNNING);
 			}
 			else if (ev_ptr == &src->stop_events) {
 				HA_ATOMIC_STORE(&src->lockon_ptr, NULL);
-				HA_ATOMIC_STORE(&src->state, TRACE_STATE_STOPPED);
+				trace_set_state(src, TRACE_STATE_STOPPED);
 			}
 			return 0;
 		}
@@ -62,6 +62,49 @@ static inline struct vars *get_vars(struct session *sess, struct stream *strm, e
 	}
 }
 
+/* Returns non-zero if the variables <vars> may be accessed by several threads
+ * at once. The txn, req and res scopes belong to a stream, which is only ever
+ * processed by one thread, so their variables are never locked.
+ */
+static inline int vars_shared(const struct vars *vars)
+{
+	return vars->scope < SCOPE_TXN || vars->scope > SCOPE_RES;
+}
+
+static inline void vars_rdlock(struct vars *vars)
+{
+	if (vars_shared(vars))
+		HA_RWLOCK_RDLOCK(VARS_LOCK, &vars->rwlock);
+}
+
+static inline void vars_rdunlock(struct vars *vars)
+{
+	if (vars_shared(vars))
+		HA_RWLOCK_RDUNLOCK(VARS_LOCK, &vars->rwlock);
+}
+
+static inline void vars_wrlock(struct vars *vars)
+{
+	if (vars_shared(vars))
+		HA_RWLOCK_WRLOCK(VARS_LOCK, &vars->rwlock);
+}
+
+static inline void vars_wrunlock(struct vars *vars)
+{
+	if (vars_shared(vars))
+		HA_RWLOCK_WRUNLOCK(VARS_LOCK, &vars->rwlock);
+}
+
+/* Releases the slots of <vars>, which must not reference any variable
+ * anymore.
+ */
+static inline void vars_free_slots(struct vars *vars)
+{
+	free(vars->slots);
+	vars->slots = NULL;
+	vars->nb_slots = 0;
+}
+
 /* This function adds or remove memory size from the accounting. The inner
  * pointers may be null when setting the outer ones only.
  */
@@ -136,7 +179,7 @@ scope_sess:
 }
 
 /* This fnuction remove a variable from the list and free memory it used */
-unsigned int var_clear(struct var *var)
+unsigned int var_clear(struct vars *vars, struct var *var)
 {
 	unsigned int size = 0;
 
@@ -148,6 +191,7 @@ unsigned int var_clear(struct var *var)
 		free(var->data.u.meth.str.area);
 		size += var->data.u.meth.str.data;
 	}
+	vars->slots[var->idx] = NULL;
 	LIST_DEL(&var->l);
 	pool_free(var_pool, var);
 	size += sizeof(struct var);
@@ -162,11 +206,12 @@ void vars_prune(struct vars *vars, struct session *sess, struct stream *strm)
 	struct var *var, *tmp;
 	unsigned int size = 0;
 
-	HA_RWLOCK_WRLOCK(VARS_LOCK, &vars->rwlock);
+	vars_wrlock(vars);
 	list_for_each_entry_safe(var, tmp, &vars->head, l) {
-		size += var_clear(var);
+		size += var_clear(vars, var);
 	}
-	HA_RWLOCK_WRUNLOCK(VARS_LOCK, &vars->rwlock);
+	vars_free_slots(vars);
+	vars_wrunlock(vars);
 	var_accounting_diff(vars, sess, strm, -size);
 }
 
@@ -178,11 +223,12 @@ void vars_prune_per_sess(struct vars *vars)
 	struct var *var, *tmp;
 	unsigned int size = 0;
 
-	HA_RWLOCK_WRLOCK(VARS_LOCK, &vars->rwlock);
+	vars_wrlock(vars);
 	list_for_each_entry_safe(var, tmp, &vars->head, l) {
-		size += var_clear(var);
+		size += var_clear(vars, var);
 	}
-	HA_RWLOCK_WRUNLOCK(VARS_LOCK, &vars->rwlock);
+	vars_free_slots(vars);
+	vars_wrunlock(vars);
 
 	_HA_ATOMIC_SUB(&vars->size, size);
 	_HA_ATOMIC_SUB(&global.vars.size, size);
@@ -193,6 +239,8 @@ void vars_prune_per_sess(struct vars *vars)
 void vars_init(struct vars *vars, enum vars_scope scope)
 {
 	LIST_INIT(&vars->head);
+	vars->slots = NULL;
+	vars->nb_slots = 0;
 	vars->scope = scope;
 	vars->size = 0;
 	HA_RWLOCK_INIT(&vars->rwlock);
@@ -202,7 +250,9 @@ void vars_init(struct vars *vars, enum vars_scope scope)
  * on the string identifying the name. This function assures that
  * the same name exists only once.
  *
- * This function check if the variable name is acceptable.
+ * This function check if the variable name is acceptable. The index
+ * of the name, which identifies the variable in its scope, is stored
+ * into <idx>.
  *
  * The function returns NULL if an error occurs, and <err> is filled.
  * In this case, the HAProxy must be stopped because the structs are
@@ -210,7 +260,7 @@ void vars_init(struct vars *vars, enum vars_scope scope)
  * name.
  */
 static char *register_name(const char *name, int len, enum vars_scope *scope,
-			   int alloc, char **err)
+			   unsigned int *idx, int alloc, char **err)
 {
 	int i;
 	char **var_names2;
@@ -270,6 +320,7 @@ static char *register_name(const char *name, int len, enum vars_scope *scope,
 	for (i = 0; i < var_names_nb; i++)
 		if (strncmp(var_names[i], name, len) == 0 && var_names[i][len] == '\0') {
 			res = var_names[i];
+			*idx = i;
 			goto end;
 		}
 
@@ -307,6 +358,7 @@ static char *register_name(const char *name, int len, enum vars_scope *scope,
 		tmp++;
 	}
 	res = var_names[var_names_nb - 1];
+	*idx = var_names_nb - 1;
 
   end:
 	if (alloc)
@@ -317,15 +369,12 @@ static char *register_name(const char *name, int len, enum vars_scope *scope,
 	return res;
 }
 
-/* This function returns an existing variable or returns NULL. */
-static inline struct var *var_get(struct vars *vars, const char *name)
+/* This function returns the existing variable of name index <idx> or
+ * returns NULL.
+ */
+static inline struct var *var_get(const struct vars *vars, unsigned int idx)
 {
-	struct var *var;
-
-	list_for_each_entry(var, &vars->head, l)
-		if (var->name == name)
-			return var;
-	return NULL;
+	return idx < vars->nb_slots ? vars->slots[idx] : NULL;
 }
 
 /* Returns 0 if fails, else returns 1. */
@@ -340,12 +389,12 @@ static int smp_fetch_var(const struct arg *args, struct sample *smp, const char
 	if (!vars || vars->scope != var_desc->scope)
 		return 0;
 
-	HA_RWLOCK_RDLOCK(VARS_LOCK, &vars->rwlock);
-	var = var_get(vars, var_desc->name);
+	vars_rdlock(vars);
+	var = var_get(vars, var_desc->idx);
 
 	/* check for the variable avalaibility */
 	if (!var) {
-		HA_RWLOCK_RDUNLOCK(VARS_LOCK, &vars->rwlock);
+		vars_rdunlock(vars);
 		return 0;
 	}
 
@@ -355,21 +404,21 @@ static int smp_fetch_var(const struct arg *args, struct sample *smp, const char
 	smp_dup(smp);
 	smp->flags |= SMP_F_CONST;
 
-	HA_RWLOCK_RDUNLOCK(VARS_LOCK, &vars->rwlock);
+	vars_rdunlock(vars);
 	return 1;
 }
 
-/* This function search in the <head> a variable with the same
- * pointer value that the <name>. If the variable doesn't exists,
- * create it. The function stores a copy of smp> if the variable.
- * It returns 0 if fails, else returns 1.
+/* This function looks in <vars> for the variable of name <name> and
+ * index <idx>. If the variable doesn't exists, create it. The function
+ * stores a copy of smp> if the variable. It returns 0 if fails, else
+ * returns 1.
  */
-static int sample_store(struct vars *vars, const char *name, struct sample *smp)
+static int sample_store(struct vars *vars, const char *name, unsigned int idx, struct sample *smp)
 {
 	struct var *var;
 
 	/* Look for existing variable name. */
-	var = var_get(vars, name);
+	var = var_get(vars, idx);
 
 	if (var) {
 		/* free its used memory. */
@@ -394,8 +443,28 @@ static int sample_store(struct vars *vars, const char *name, struct sample *smp)
 		var = pool_alloc(var_pool);
 		if (!var)
 			return 0;
+
+		/* Make room for its slot. The slots are only allocated
+		 * with a variable so that an empty list never holds any.
+		 */
+		if (idx >= vars->nb_slots) {
+			unsigned int nb = (idx + 8) & ~7U;
+			struct var **slots;
+
+			slots = realloc(vars->slots, nb * sizeof(*slots));
+			if (!slots) {
+				pool_free(var_pool, var);
+				var_accounting_diff(vars, smp->sess, smp->strm, -(int)sizeof(struct var));
+				return 0;
+			}
+			memset(slots + vars->nb_slots, 0, (nb - vars->nb_slots) * sizeof(*slots));
+			vars->slots = slots;
+			vars->nb_slots = nb;
+		}
 		LIST_ADDQ(&vars->head, &var->l);
+		vars->slots[idx] = var;
 		var->name = name;
+		var->idx = idx;
 	}
 
 	/* Set type. */
@@ -456,7 +525,7 @@ static int sample_store(struct vars *vars, const char *name, struct sample *smp)
 }
 
 /* Returns 0 if fails, else returns 1. Note that stream may be null for SCOPE_SESS. */
-static inline int sample_store_stream(const char *name, enum vars_scope scope, struct sample *smp)
+static inline int sample_store_stream(const char *name, unsigned int idx, enum vars_scope scope, struct sample *smp)
 {
 	struct vars *vars;
 	int ret;
@@ -465,14 +534,14 @@ static inline int sample_store_stream(const char *name, enum vars_scope scope, s
 	if (!vars || vars->scope != scope)
 		return 0;
 
-	HA_RWLOCK_WRLOCK(VARS_LOCK, &vars->rwlock);
-	ret = sample_store(vars, name, smp);
-	HA_RWLOCK_WRUNLOCK(VARS_LOCK, &vars->rwlock);
+	vars_wrlock(vars);
+	ret = sample_store(vars, name, idx, smp);
+	vars_wrunlock(vars);
 	return ret;
 }
 
 /* Returns 0 if fails, else returns 1. Note that stream may be null for SCOPE_SESS. */
-static inline int sample_clear_stream(const char *name, enum vars_scope scope, struct sample *smp)
+static inline int sample_clear_stream(unsigned int idx, enum vars_scope scope, struct sample *smp)
 {
 	struct vars *vars;
 	struct var  *var;
@@ -483,26 +552,28 @@ static inline int sample_clear_stream(const char *name, enum vars_scope scope, s
 		return 0;
 
 	/* Look for existing variable name. */
-	HA_RWLOCK_WRLOCK(VARS_LOCK, &vars->rwlock);
-	var = var_get(vars, name);
+	vars_wrlock(vars);
+	var = var_get(vars, idx);
 	if (var) {
-		size = var_clear(var);
+		size = var_clear(vars, var);
 		var_accounting_diff(vars, smp->sess, smp->strm, -size);
+		if (LIST_ISEMPTY(&vars->head))
+			vars_free_slots(vars);
 	}
-	HA_RWLOCK_WRUNLOCK(VARS_LOCK, &vars->rwlock);
+	vars_wrunlock(vars);
 	return 1;
 }
 
 /* Returns 0 if fails, else returns 1. */
 static int smp_conv_store(const struct arg *args, struct sample *smp, void *private)
 {
-	return sample_store_stream(args[0].data.var.name, args[0].data.var.scope, smp);
+	return sample_store_stream(args[0].data.var.name, args[0].data.var.idx, args[0].data.var.scope, smp);
 }
 
 /* Returns 0 if fails, else returns 1. */
 static int smp_conv_clear(const struct arg *args, struct sample *smp, void *private)
 {
-	return sample_clear_stream(args[0].data.var.name, args[0].data.var.scope, smp);
+	return sample_clear_stream(args[0].data.var.idx, args[0].data.var.scope, smp);
 }
 
 /* This functions check an argument entry and fill it with a variable
@@ -513,6 +584,7 @@ int vars_check_arg(struct arg *arg, char **err)
 {
 	char *name;
 	enum vars_scope scope;
+	unsigned int idx;
 
 	/* Check arg type. */
 	if (arg->type != ARGT_STR) {
@@ -522,8 +594,7 @@ int vars_check_arg(struct arg *arg, char **err)
 
 	/* Register new variable name. */
 	name = register_name(arg->data.str.area, arg->data.str.data, &scope,
-			     1,
-			     err);
+			     &idx, 1, err);
 	if (!name)
 		return 0;
 
@@ -534,6 +605,7 @@ int vars_check_arg(struct arg *arg, char **err)
 	arg->type = ARGT_VAR;
 	arg->data.var.name = name;
 	arg->data.var.scope = scope;
+	arg->data.var.idx = idx;
 	return 1;
 }
 
@@ -544,13 +616,14 @@ int vars_check_arg(struct arg *arg, char **err)
 int vars_set_by_name_ifexist(const char *name, size_t len, struct sample *smp)
 {
 	enum vars_scope scope;
+	unsigned int idx;
 
 	/* Resolve name and scope. */
-	name = register_name(name, len, &scope, 0, NULL);
+	name = register_name(name, len, &scope, &idx, 0, NULL);
 	if (!name)
 		return 0;
 
-	return sample_store_stream(name, scope, smp);
+	return sample_store_stream(name, idx, scope, smp);
 }
 
 
@@ -560,13 +633,14 @@ int vars_set_by_name_ifexist(const char *name, size_t len, struct sample *smp)
 int vars_set_by_name(const char *name, size_t len, struct sample *smp)
 {
 	enum vars_scope scope;
+	unsigned int idx;
 
 	/* Resolve name and scope. */
-	name = register_name(name, len, &scope, 1, NULL);
+	name = register_name(name, len, &scope, &idx, 1, NULL);
 	if (!name)
 		return 0;
 
-	return sample_store_stream(name, scope, smp);
+	return sample_store_stream(name, idx, scope, smp);
 }
 
 /* This function unset a variable if it was already defined.
@@ -575,13 +649,14 @@ int vars_set_by_name(const char *name, size_t len, struct sample *smp)
 int vars_unset_by_name_ifexist(const char *name, size_t len, struct sample *smp)
 {
 	enum vars_scope scope;
+	unsigned int idx;
 
 	/* Resolve name and scope. */
-	name = register_name(name, len, &scope, 0, NULL);
+	name = register_name(name, len, &scope, &idx, 0, NULL);
 	if (!name)
 		return 0;
 
-	return sample_clear_stream(name, scope, smp);
+	return sample_clear_stream(idx, scope, smp);
 }
 
 
@@ -594,9 +669,10 @@ int vars_get_by_name(const char *name, size_t len, struct sample *smp)
 	struct vars *vars;
 	struct var *var;
 	enum vars_scope scope;
+	unsigned int idx;
 
 	/* Resolve name and scope. */
-	name = register_name(name, len, &scope, 1, NULL);
+	name = register_name(name, len, &scope, &idx, 1, NULL);
 	if (!name)
 		return 0;
 
@@ -606,7 +682,7 @@ int vars_get_by_name(const char *name, size_t len, struct sample *smp)
 		return 0;
 
 	/* Get the variable entry. */
-	var = var_get(vars, name);
+	var = var_get(vars, idx);
 	if (!var)
 		return 0;
 
@@ -633,7 +709,7 @@ int vars_get_by_desc(const struct var_desc *var_desc, struct sample *smp)
 		return 0;
 
 	/* Get the variable entry. */
-	var = var_get(vars, var_desc->name);
+	var = var_get(vars, var_desc->idx);
 	if (!var)
 		return 0;
 
@@ -671,7 +747,7 @@ static enum act_return action_store(struct act_rule *rule, struct proxy *px,
 		return ACT_RET_CONT;
 
 	/* Store the sample, and ignore errors. */
-	sample_store_stream(rule->arg.vars.name, rule->arg.vars.scope, &smp);
+	sample_store_stream(rule->arg.vars.name, rule->arg.vars.idx, rule->arg.vars.scope, &smp);
 	return ACT_RET_CONT;
 }
 
@@ -685,7 +761,7 @@ static enum act_return action_clear(struct act_rule *rule, struct proxy *px,
 	smp_set_owner(&smp, px, sess, s, SMP_OPT_FINAL);
 
 	/* Clear the variable using the sample context, and ignore errors. */
-	sample_clear_stream(rule->arg.vars.name, rule->arg.vars.scope, &smp);
+	sample_clear_stream(rule->arg.vars.idx, rule->arg.vars.scope, &smp);
 	return ACT_RET_CONT;
 }
 
@@ -749,7 +825,8 @@ static enum act_parse_ret parse_store(const char **args, int *arg, struct proxy
 		return ACT_RET_PRS_ERR;
 	}
 
-	rule->arg.vars.name = register_name(var_name, var_len, &rule->arg.vars.scope, 1, err);
+	rule->arg.vars.name = register_name(var_name, var_len, &rule->arg.vars.scope,
+	                                    &rule->arg.vars.idx, 1, err);
 	if (!rule->arg.vars.name)
 		return ACT_RET_PRS_ERR;
 
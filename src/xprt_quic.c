@@ -15,14 +15,20 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include <openssl/hmac.h>
 
 #include <common/buffer.h>
+#include <common/cfgparse.h>
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/debug.h>
@@ -30,15 +36,21 @@
 #include <common/ticks.h>
 #include <common/time.h>
 
+#include <proto/channel.h>
+#include <proto/cli.h>
 #include <proto/connection.h>
 #include <proto/fd.h>
 #include <proto/freq_ctr.h>
 #include <proto/log.h>
+#include <proto/mux_quic.h>
 #include <proto/pipe.h>
 #include <proto/proxy.h>
 #include <proto/quic_cc.h>
 #include <proto/quic_frame.h>
 #include <proto/quic_loss.h>
+#include <proto/quic_pacing.h>
+#include <proto/quic_qlog.h>
+#include <proto/quic_reasm.h>
 #include <proto/quic_tls.h>
 #include <proto/ssl_sock.h>
 #include <proto/stream_interface.h>
@@ -46,6 +58,7 @@
 #include <proto/trace.h>
 #include <proto/xprt_quic.h>
 
+#include <types/cli.h>
 #include <types/global.h>
 
 struct quic_conn_ctx {
@@ -200,32 +213,205 @@ void hexdump(const void *buf, size_t buflen, const char *title_fmt, ...) {}
 
 DECLARE_STATIC_POOL(pool_head_quic_conn, "quic_conn", sizeof(struct quic_conn));
 
+DECLARE_STATIC_POOL(pool_head_quic_conn_hs, "quic_conn_hs", sizeof(struct quic_conn_hs));
+
 DECLARE_POOL(pool_head_quic_connection_id,
              "quic_connnection_id_pool", sizeof(struct quic_connection_id));
 
+struct pool_head *pool_head_quic_dgram = NULL;
+
 DECLARE_POOL(pool_head_quic_rx_packet, "quic_rx_packet_pool", sizeof(struct quic_rx_packet));
 
 DECLARE_POOL(pool_head_quic_tx_packet, "quic_tx_packet_pool", sizeof(struct quic_tx_packet));
 
 DECLARE_STATIC_POOL(pool_head_quic_conn_ctx, "quic_conn_ctx_pool", sizeof(struct quic_conn_ctx));
 
-DECLARE_STATIC_POOL(pool_head_quic_rx_crypto_frm, "quic_rx_crypto_frm_pool", sizeof(struct quic_rx_crypto_frm));
-
 DECLARE_POOL(pool_head_quic_tx_frm, "quic_tx_frm_pool", sizeof(struct quic_tx_frm));
 
 DECLARE_STATIC_POOL(pool_head_quic_crypto_buf, "quic_crypto_buf_pool", sizeof(struct quic_crypto_buf));
 
 DECLARE_STATIC_POOL(pool_head_quic_frame, "quic_frame_pool", sizeof(struct quic_frame));
 
-DECLARE_STATIC_POOL(pool_head_quic_ack_range, "quic_ack_range_pool", sizeof(struct quic_ack_range));
 
 static BIO_METHOD *ha_quic_meth;
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define QUIC_USE_RECVMMSG
+#define QUIC_USE_SENDMMSG
+#endif
+
+#if defined(__linux__) && defined(UDP_SEGMENT)
+#define QUIC_USE_GSO
+/* Set as soon as the kernel refuses UDP segmentation offload. */
+static int quic_gso_disabled;
+#endif
+
+#if defined(__linux__) && defined(UDP_GRO)
+/* Segments coalesced by the kernel on reception ("tune.quic.gro"). */
+#define QUIC_USE_GRO
+/* The size of the receive buffers: the maximum size of a GRO packet. */
+#define QUIC_GRO_BUFSZ 65535
+#endif
+
+#if defined(QUIC_USE_SENDMMSG) && defined(SO_TXTIME)
+/* Departure dates of the datagrams given to the kernel ("tune.quic.pacing-txtime"). */
+#define QUIC_USE_TXTIME
+#endif
+
+#if defined(QUIC_USE_SENDMMSG) && defined(IP_RECVTOS) && defined(IPV6_RECVTCLASS)
+/* ECN marks set and read with control messages ("tune.quic.ecn"). */
+#define QUIC_USE_ECN
+#endif
+
+/* Size of the control messages buffers of the sent datagrams: enough room for
+ * UDP_SEGMENT or SCM_TXTIME, and IP_TOS or IPV6_TCLASS, and of the received
+ * datagrams: IP_TOS, IPV6_TCLASS and UDP_GRO.
+ */
+#define QUIC_TX_CMSG_SPACE (CMSG_SPACE(sizeof(uint64_t)) + CMSG_SPACE(sizeof(int)))
+#define QUIC_RX_CMSG_SPACE (3 * CMSG_SPACE(sizeof(int)))
+
+union quic_rx_cmsg {
+	char buf[QUIC_RX_CMSG_SPACE];
+	struct cmsghdr align;
+};
+
+/* Append a control message of <level> and <type> with <len> bytes of <data>
+ * to <msg> whose control buffer must be large enough and suitably aligned.
+ */
+static inline void quic_cmsg_append(struct msghdr *msg, int level, int type,
+                                    const void *data, size_t len)
+{
+	struct cmsghdr *cmsg;
+
+	cmsg = (struct cmsghdr *)((char *)msg->msg_control + msg->msg_controllen);
+	memset(cmsg, 0, CMSG_SPACE(len));
+	cmsg->cmsg_level = level;
+	cmsg->cmsg_type = type;
+	cmsg->cmsg_len = CMSG_LEN(len);
+	memcpy(CMSG_DATA(cmsg), data, len);
+	msg->msg_controllen += CMSG_SPACE(len);
+}
+
+/* Maximum number of datagrams received by a single recvmmsg() call
+ * ("tune.quic.rx-batch"). A value of 1 disables batching.
+ */
+#define QUIC_DFLT_RX_BATCH      16
+#define QUIC_MAX_RX_BATCH     1024
+static unsigned int quic_rx_batch = QUIC_DFLT_RX_BATCH;
+/* The size of the datagram buffers, tune.bufsize or QUIC_GRO_BUFSZ with GRO. */
+static size_t quic_dgram_bufsz;
+
+/* Number of packets encrypted with the same 1-RTT keys before initiating a
+ * key update ("tune.quic.key-update-pkts"), 0 to never initiate them.
+ */
+static unsigned long long quic_ku_pkts = QUIC_DFLT_KU_PKTS;
+
+/* Maximum size of the UDP payloads sent ("tune.quic.max-dgram-size"), which is
+ * also the size of the TX buffers. The path MTU discovery never probes above.
+ */
+static unsigned int quic_max_dgram_sz = QUIC_DFLT_MAX_DGRAM_SZ;
+
+/* Rate of the Initial packets opening new connections above which the client
+ * addresses are validated by a Retry ("tune.quic.retry-threshold"), -1 to
+ * never send any Retry.
+ */
+static int quic_retry_threshold = -1;
+static struct freq_ctr quic_initial_freq;
+/* Key of the HMAC protecting the address validation tokens. */
+static unsigned char quic_token_key[QUIC_TOKEN_KEY_LEN];
+/* Key of the HMAC deriving the stateless reset tokens from the connection IDs,
+ * derived from "cluster-secret" so that the processes started by a reload
+ * still recognize the connection IDs of the previous ones.
+ */
+static unsigned char quic_sreset_key[QUIC_TOKEN_KEY_LEN];
+static int quic_sreset_key_set;
+/* Maximum rate of the stateless resets sent for unknown connection IDs
+ * ("tune.quic.stateless-reset-rate"), 0 to never send any.
+ */
+static unsigned int quic_sreset_rate = QUIC_DFLT_SRESET_RATE;
+
+/* Number of bytes of memory used by all the QUIC connections, and the limits
+ * of this total ("tune.quic.mem-max") and of each connection usage
+ * ("tune.quic.conn-mem-max") above which the peers are slowed down, 0 meaning
+ * unlimited.
+ */
+unsigned long quic_mem_used;
+unsigned int quic_mem_max;
+unsigned int quic_conn_mem_max;
+
+/* Prefix of the paths of the UNIX sockets over which the processes started by
+ * the reloads forward each other the datagrams of their connections
+ * ("quic-handover"), NULL if disabled.
+ */
+static char *quic_ho_path;
+static int quic_ho_fd = -1;
+/* Generation of this process, embedded in the second byte of its CIDs, or -1
+ * if the handover is disabled.
+ */
+int quic_proc_gen = -1;
+/* Generation of the newest process which announced itself, -1 if none. */
+static int quic_next_gen = -1;
+/* Generations of the other processes known to be alive. */
+static long quic_ho_gens[256 / LONGBITS];
+static struct freq_ctr quic_sreset_freq;
+
+/* Per-thread lists of the QUIC connections, for the "show quic" CLI command. */
+static struct list quic_conns[MAX_THREADS];
+
+/* Per-thread timer wheel of the QUIC connections. */
+static THREAD_LOCAL struct quic_timer_wheel *quic_tw;
+
+/* The pcap file replayed by "debug quic replay", whose data are only set
+ * during the replay, and the flag set while the current thread replays it.
+ */
+static struct quic_replay quic_replay;
+static THREAD_LOCAL int quic_replaying;
+
+/* Accounts for the cycles elapsed since <start> in <stage> of the replay. */
+static inline void quic_replay_account(enum quic_replay_stage stage,
+                                       unsigned long long start)
+{
+	_HA_ATOMIC_ADD(&quic_replay.calls[stage], 1);
+	_HA_ATOMIC_ADD(&quic_replay.cycles[stage], rdtsc() - start);
+}
+
+/* Adds <v> to the <cnt> QUIC counter of the listener of <qc> connection, if
+ * any. These are updated by all the threads.
+ */
+#define qc_counters_add(qc, cnt, v) do {                                    \
+		struct listener *__l = objt_listener((qc)->conn->target);   \
+		if (__l)                                                    \
+			_HA_ATOMIC_ADD(&__l->quic_counters.cnt, (v));       \
+	} while (0)
+
+#ifdef QUIC_USE_RECVMMSG
+/* Per-thread ring of datagram buffers filled by recvmmsg(). Each of the
+ * <quic_rx_batch> slots is made of a message header, an I/O vector, a
+ * source address, a control messages buffer and a datagram buffer from
+ * pool_head_quic_dgram.
+ */
+struct quic_rx_dgrams {
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct sockaddr_storage *addrs;
+	union quic_rx_cmsg *cmsgs;
+	struct quic_dgram **dgrams;
+};
+
+static THREAD_LOCAL struct quic_rx_dgrams quic_rx_dgrams;
+#endif
+
+#ifdef USE_THREAD
+/* Datagrams handed over to the thread owning their connection. */
+static struct quic_dghdlr quic_dghdlrs[MAX_THREADS];
+#endif
+
 
 static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int pkt_type,
-                                  struct quic_enc_level *qel);
+                                  struct quic_enc_level *qel, int padding);
 
 static int qc_prep_phdshk_pkts(struct quic_conn *qc);
+static int qc_tls_ku_prepare(struct quic_conn *qc);
 
 /* Add traces to <buf> depending on <frm> TX frame type. */
 static inline void chunk_tx_frm_appendf(struct buffer *buf,
@@ -538,7 +724,7 @@ static void quic_trace(enum trace_level level, uint64_t mask, const struct trace
 				}
 			}
 
-			if (!(mask & QUIC_EV_CONN_SPTO) && qc->timer_task) {
+			if (!(mask & QUIC_EV_CONN_SPTO) && tick_isset(qc->timer)) {
 				chunk_appendf(&trace_buf,
 				              " expire=%dms", TICKS_TO_MS(qc->timer - now_ms));
 			}
@@ -573,7 +759,7 @@ static inline int quic_peer_validated_addr(struct quic_conn_ctx *ctx)
 	struct quic_conn *qc;
 
 	qc = ctx->conn->quic_conn;
-	if (objt_server(qc->conn->target))
+	if (objt_server(qc->conn->target) || (qc->flags & QUIC_FL_CONN_ADDR_VALIDATED))
 		return 1;
 
 	if ((qc->els[QUIC_TLS_ENC_LEVEL_HANDSHAKE].pktns->flags & QUIC_FL_PKTNS_ACK_RECEIVED) ||
@@ -584,6 +770,83 @@ static inline int quic_peer_validated_addr(struct quic_conn_ctx *ctx)
 	return 0;
 }
 
+/* Returns the number of bytes <qc> may still send to its peer because of the
+ * anti-amplification limit: a server must not send more than three times the
+ * bytes it received until the client address is validated (RFC 9000 8.1).
+ * Returns (size_t)-1 if there is no limit.
+ */
+static inline size_t qc_amp_room(const struct quic_conn *qc)
+{
+	uint64_t limit;
+
+	if (objt_server(qc->conn->target) || (qc->flags & QUIC_FL_CONN_ADDR_VALIDATED))
+		return (size_t)-1;
+
+	limit = 3 * qc->rx.bytes;
+	return limit > qc->tx.hs_bytes ? limit - qc->tx.hs_bytes : 0;
+}
+
+/* Returns the end of the room left to build a handshake packet into <wbuf>
+ * datagram for <qc>: the MTU of its path, below its anti-amplification budget.
+ */
+static inline const unsigned char *qc_hdshk_dgram_end(struct q_buf *wbuf,
+                                                      const struct quic_conn *qc)
+{
+	const unsigned char *end = q_buf_end_mtu(wbuf, qc->path->mtu);
+	size_t room = qc_amp_room(qc);
+
+	/* The packets already in <wbuf> have been accounted for. */
+	if (room < end - q_buf_getpos(wbuf))
+		end = q_buf_getpos(wbuf) + room;
+	return end;
+}
+
+/* Arms the timer of <qc> at <expire> date, or disarms it if <expire> is not
+ * set. This only moves <qc> to another slot of the timer wheel of the current
+ * thread, which must be the one of <qc>. The timers which already expired
+ * go to the slot of the next tick as the slots up to the current one may
+ * have been processed already.
+ */
+static inline void qc_timer_arm(struct quic_conn *qc, unsigned int expire)
+{
+	struct quic_timer_wheel *tw = quic_tw;
+	unsigned int date;
+
+	if (!LIST_ISEMPTY(&qc->tw_list)) {
+		LIST_DEL_INIT(&qc->tw_list);
+		tw->nb--;
+	}
+
+	qc->timer = expire;
+	if (!tick_isset(expire))
+		return;
+
+	if (!tw->nb++)
+		tw->cur = now_ms;
+	date = tick_is_expired(expire, now_ms) ? tick_add(now_ms, 1) : expire;
+	LIST_ADDQ(&tw->slots[date & (QUIC_TW_SLOTS - 1)], &qc->tw_list);
+	task_schedule(tw->task, date);
+}
+
+/* Releases the handshake-only data of <qc> once its handshake is confirmed,
+ * or when it is freed.
+ */
+static inline void qc_release_hs(struct quic_conn *qc)
+{
+	if (qc->hs)
+		qc_mem_sub(qc, sizeof *qc->hs);
+	pool_free(pool_head_quic_conn_hs, qc->hs);
+	qc->hs = NULL;
+}
+
+/* Re-arms the timer of <qc> for the first of its loss detection or PTO date
+ * and of its delayed ACK expiration date.
+ */
+static inline void qc_timer_update(struct quic_conn *qc)
+{
+	qc_timer_arm(qc, tick_first(qc->ld_timer, qc->rx.ack_expire));
+}
+
 /* Set the timer attached to the QUIC connection with <ctx> as I/O handler and used for
  * both loss detection and PTO and schedule the task assiated to this timer if needed.
  */
@@ -591,34 +854,52 @@ static inline void qc_set_timer(struct quic_conn_ctx *ctx)
 {
 	struct quic_conn *qc;
 	struct quic_pktns *pktns;
-	unsigned int pto;
+	unsigned int pto, expire;
 
 	TRACE_ENTER(QUIC_EV_CONN_STIMER, ctx->conn);
 	qc = ctx->conn->quic_conn;
+	expire = TICK_ETERNITY;
 	pktns = quic_loss_pktns(qc);
 	if (tick_isset(pktns->tx.loss_time)) {
-		qc->timer = pktns->tx.loss_time;
+		expire = pktns->tx.loss_time;
 		goto out;
 	}
 
-	/* XXX TODO: anti-amplification: the timer must be
-	 * cancelled for a server which reached the anti-amplification limit.
+	/* A server blocked by the anti-amplification limit cannot send any
+	 * probe: the timer is armed again once a datagram is received
+	 * (RFC 9002 6.2.2.1).
 	 */
+	if (qc->flags & QUIC_FL_CONN_AMP_LIMITED)
+		goto out;
 
 	if (!qc->path->in_flight_ae_pkts && quic_peer_validated_addr(ctx)) {
 		/* Timer cancellation. */
-		qc->timer = TICK_ETERNITY;
 		goto out;
 	}
 
 	pktns = quic_pto_pktns(qc, ctx->state & QUIC_HS_ST_COMPLETE, &pto);
 	if (tick_isset(pto))
-		qc->timer = pto;
+		expire = pto;
  out:
-	task_schedule(qc->timer_task, qc->timer);
+	qc->ld_timer = expire;
+	qc_timer_update(qc);
 	TRACE_LEAVE(QUIC_EV_CONN_STIMER, ctx->conn, pktns);
 }
 
+/* Keep a copy of <secret> of <secret_len> bytes from which the keys of <secs>
+ * are derived if they are 1-RTT ones (<level>), for the next key phases.
+ */
+static inline void quic_tls_keep_secret(struct quic_tls_secrets *secs,
+                                        enum ssl_encryption_level_t level,
+                                        const uint8_t *secret, size_t secret_len)
+{
+	if (level != ssl_encryption_application || secret_len > sizeof secs->secret)
+		return;
+
+	memcpy(secs->secret, secret, secret_len);
+	secs->secretlen = secret_len;
+}
+
 #ifndef OPENSSL_IS_BORINGSSL
 int ha_quic_set_encryption_secrets(SSL *ssl, enum ssl_encryption_level_t level,
                                    const uint8_t *read_secret,
@@ -637,6 +918,10 @@ int ha_quic_set_encryption_secrets(SSL *ssl, enum ssl_encryption_level_t level,
 	HEXDUMP(read_secret, secret_len, "read_secret (level %d):\n", level);
 	HEXDUMP(write_secret, secret_len, "write_secret:\n");
 
+	/* Only one of the secrets is provided for the 0-RTT level. */
+	if (!read_secret)
+		goto write;
+
 	if (!quic_tls_derive_keys(tls_ctx->rx.aead, tls_ctx->rx.hp, tls_ctx->rx.md,
 	                          tls_ctx->rx.key, sizeof tls_ctx->rx.key,
 	                          tls_ctx->rx.iv, sizeof tls_ctx->rx.iv,
@@ -646,7 +931,18 @@ int ha_quic_set_encryption_secrets(SSL *ssl, enum ssl_encryption_level_t level,
 		return 0;
 	}
 
+	if (!quic_tls_secrets_ctx_init(&tls_ctx->rx, 0)) {
+		TRACE_DEVEL("RX cipher contexts initialization failed", QUIC_EV_CONN_RWSEC, conn);
+		return 0;
+	}
+
+	quic_tls_keep_secret(&tls_ctx->rx, level, read_secret, secret_len);
 	tls_ctx->rx.flags |= QUIC_FL_TLS_SECRETS_SET;
+
+ write:
+	if (!write_secret)
+		goto out;
+
 	if (!quic_tls_derive_keys(tls_ctx->tx.aead, tls_ctx->tx.hp, tls_ctx->tx.md,
 	                          tls_ctx->tx.key, sizeof tls_ctx->tx.key,
 	                          tls_ctx->tx.iv, sizeof tls_ctx->tx.iv,
@@ -656,7 +952,18 @@ int ha_quic_set_encryption_secrets(SSL *ssl, enum ssl_encryption_level_t level,
 		return 0;
 	}
 
+	if (!quic_tls_secrets_ctx_init(&tls_ctx->tx, 1)) {
+		TRACE_DEVEL("TX cipher contexts initialization failed", QUIC_EV_CONN_RWSEC, conn);
+		return 0;
+	}
+
+	quic_tls_keep_secret(&tls_ctx->tx, level, write_secret, secret_len);
 	tls_ctx->tx.flags |= QUIC_FL_TLS_SECRETS_SET;
+	if (level == ssl_encryption_application && !qc_tls_ku_prepare(conn->quic_conn)) {
+		TRACE_DEVEL("next key phase derivation failed", QUIC_EV_CONN_RWSEC, conn);
+		return 0;
+	}
+
 	if (objt_server(conn->target) && level == ssl_encryption_application) {
 		const unsigned char *buf;
 		size_t buflen;
@@ -668,6 +975,8 @@ int ha_quic_set_encryption_secrets(SSL *ssl, enum ssl_encryption_level_t level,
 		if (!quic_transport_params_store(conn->quic_conn, 1, buf, buf + buflen))
 			return 0;
 	}
+
+ out:
 	TRACE_LEAVE(QUIC_EV_CONN_RWSEC, conn, &level);
 
 	return 1;
@@ -701,6 +1010,11 @@ int ha_set_rsec(SSL *ssl, enum ssl_encryption_level_t level,
 		goto err;
 	}
 
+	if (!quic_tls_secrets_ctx_init(&tls_ctx->rx, 0)) {
+		TRACE_DEVEL("RX cipher contexts initialization failed", QUIC_EV_CONN_RSEC, conn);
+		goto err;
+	}
+
 	if (objt_server(conn->target) && level == ssl_encryption_application) {
 		const unsigned char *buf;
 		size_t buflen;
@@ -713,6 +1027,12 @@ int ha_set_rsec(SSL *ssl, enum ssl_encryption_level_t level,
 			goto err;
 	}
 
+	quic_tls_keep_secret(&tls_ctx->rx, level, secret, secret_len);
+	if (level == ssl_encryption_application && !qc_tls_ku_prepare(conn->quic_conn)) {
+		TRACE_DEVEL("next key phase derivation failed", QUIC_EV_CONN_RSEC, conn);
+		goto err;
+	}
+
 	tls_ctx->rx.flags |= QUIC_FL_TLS_SECRETS_SET;
 	TRACE_LEAVE(QUIC_EV_CONN_RSEC, conn, &level, secret, &secret_len);
 
@@ -750,6 +1070,17 @@ int ha_set_wsec(SSL *ssl, enum ssl_encryption_level_t level,
 		goto err;
 	}
 
+	if (!quic_tls_secrets_ctx_init(&tls_ctx->tx, 1)) {
+		TRACE_DEVEL("TX cipher contexts initialization failed", QUIC_EV_CONN_WSEC, conn);
+		goto err;
+	}
+
+	quic_tls_keep_secret(&tls_ctx->tx, level, secret, secret_len);
+	if (level == ssl_encryption_application && !qc_tls_ku_prepare(conn->quic_conn)) {
+		TRACE_DEVEL("next key phase derivation failed", QUIC_EV_CONN_WSEC, conn);
+		goto err;
+	}
+
 	tls_ctx->tx.flags |= QUIC_FL_TLS_SECRETS_SET;
 	TRACE_LEAVE(QUIC_EV_CONN_WSEC, conn, &level, secret, &secret_len);
 
@@ -769,7 +1100,7 @@ int ha_set_wsec(SSL *ssl, enum ssl_encryption_level_t level,
  * store all the data.
  * Note that CRYPTO data may exist at any encryption level except at 0-RTT.
  */
-static int quic_crypto_data_cpy(struct quic_enc_level *qel,
+static int quic_crypto_data_cpy(struct quic_conn *qc, struct quic_enc_level *qel,
                                 const unsigned char *data, size_t len)
 {
 	struct quic_crypto_buf **qcb;
@@ -810,6 +1141,7 @@ static int quic_crypto_data_cpy(struct quic_enc_level *qel,
 					QDPRINTF("%s: crypto allocation failed\n", __func__);
 					return 0;
 				}
+				qc_mem_add(qc, sizeof **qcb);
 				(*qcb)->sz = 0;
 				++*nb_buf;
 			}
@@ -862,7 +1194,7 @@ int ha_quic_add_handshake_data(SSL *ssl, enum ssl_encryption_level_t level,
 		goto err;
 	}
 
-	if (!quic_crypto_data_cpy(qel, data, len)) {
+	if (!quic_crypto_data_cpy(conn->quic_conn, qel, data, len)) {
 		TRACE_PROTO("Could not bufferize", QUIC_EV_CONN_ADDDATA, conn);
 		goto err;
 	}
@@ -938,7 +1270,17 @@ int ssl_quic_initial_ctx(struct bind_conf *bind_conf)
 	ctx = SSL_CTX_new(TLS_server_method());
 	bind_conf->initial_ctx = ctx;
 
+	/* The TLS 1.3 tickets are stateless, encrypted with the "tls-ticket-keys"
+	 * if any, unless disabled in which case OpenSSL issues stateful tickets
+	 * stored in the shared session cache, as for TCP. In both cases, the
+	 * callbacks are installed on this context by ssl_sock_prepare_ctx(),
+	 * which is the one OpenSSL uses for the resumption, whatever the SNI.
+	 */
+	if (bind_conf->ssl_options & BC_SSL_O_NO_TLS_TICKETS)
+		options |= SSL_OP_NO_TICKET;
 	SSL_CTX_set_options(ctx, options);
+	if (global_ssl.life_time)
+		SSL_CTX_set_timeout(ctx, global_ssl.life_time);
 #if 0
 	if (SSL_CTX_set_cipher_list(ctx, ciphers) != 1) {
 		ha_alert("Proxy '%s': unable to set TLS 1.3 cipher list to '%s' "
@@ -958,6 +1300,10 @@ int ssl_quic_initial_ctx(struct bind_conf *bind_conf)
 	}
 
 	SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+	if (global_ssl.async)
+		SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+#endif
 	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
 	SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
 	SSL_CTX_set_default_verify_paths(ctx);
@@ -968,8 +1314,12 @@ int ssl_quic_initial_ctx(struct bind_conf *bind_conf)
 	SSL_CTX_set_tlsext_servername_callback(ctx, ssl_sock_switchctx_err_cbk);
 #elif (HA_OPENSSL_VERSION_NUMBER >= 0x10101000L)
 	if (bind_conf->ssl_conf.early_data) {
+		/* As for TCP, the replay protection is left to the "wait-for-handshake"
+		 * action. The QUIC flow control limits the early data, so the TLS
+		 * max_early_data_size must be set to 0xffffffff.
+		 */
 		SSL_CTX_set_options(ctx, SSL_OP_NO_ANTI_REPLAY);
-		SSL_CTX_set_max_early_data(ctx, global.tune.bufsize - global.tune.maxrewrite);
+		SSL_CTX_set_max_early_data(ctx, 0xffffffff);
 	}
 	SSL_CTX_set_client_hello_cb(ctx, ssl_sock_switchctx_cbk, NULL);
 	SSL_CTX_set_tlsext_servername_callback(ctx, ssl_sock_switchctx_err_cbk);
@@ -1161,11 +1511,231 @@ static size_t quic_conn_from_buf(struct connection *conn, void *xprt_ctx, const
 		 * limited to 4GB and that it's not enough per second.
 		 */
 		_HA_ATOMIC_ADD(&global.out_bytes, done);
-		update_freq_ctr(&global.out_32bps, (done + 16) / 32);
+		update_freq_ctr_thr(&global.out_32bps, (done + 16) / 32);
 	}
 	return done;
 }
 
+#ifdef QUIC_USE_GSO
+/* Returns 1 if the <nb> datagrams of <bufs> may be sent as a single UDP GSO
+ * super-datagram, i.e. if they all have the same size except the last one
+ * which may be shorter, 0 if not.
+ */
+static inline int quic_dgrams_gso_compatible(struct q_buf **bufs, int nb)
+{
+	int i;
+
+	for (i = 1; i < nb - 1; i++)
+		if (bufs[i]->data != bufs[0]->data)
+			return 0;
+
+	return bufs[nb - 1]->data <= bufs[0]->data;
+}
+#endif
+
+#ifdef QUIC_USE_ECN
+/* Append to <msg> the control message setting the <ecn> codepoint of the
+ * datagram sent to <dst>: IP_TOS for IPv4 and IPv4-mapped IPv6 addresses,
+ * IPV6_TCLASS for the other IPv6 addresses.
+ */
+static inline void quic_cmsg_append_ecn(struct msghdr *msg,
+                                        const struct sockaddr_storage *dst,
+                                        unsigned char ecn)
+{
+	int tos = ecn;
+
+	if (dst->ss_family == AF_INET6 &&
+	    !IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *)dst)->sin6_addr))
+		quic_cmsg_append(msg, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof tos);
+	else
+		quic_cmsg_append(msg, IPPROTO_IP, IP_TOS, &tos, sizeof tos);
+}
+#endif
+
+/* Send the <nb> datagrams stored in <bufs> buffers to <conn> peer with as few
+ * system calls as possible: one sendmsg() call with UDP segmentation offload
+ * when the kernel supports it and the datagrams sizes allow it, else one
+ * sendmmsg() call, or one sendto() call by datagram on systems without
+ * sendmmsg(). If not NULL, <txtimes> are the departure dates (ns on the
+ * monotonic clock) of the datagrams which are passed to the kernel with
+ * SCM_TXTIME control messages, in which case the segmentation offload is
+ * not used. <ecn> is the ECN codepoint of the datagrams, ignored on systems
+ * without sendmmsg(). The connection's flags are updated as done by
+ * quic_conn_from_buf(). Returns the number of datagrams which have been sent,
+ * these are always the first ones of <bufs>.
+ */
+static int quic_conn_send_dgrams(struct connection *conn, struct q_buf **bufs, int nb,
+                                 uint64_t *txtimes, unsigned char ecn)
+{
+	int i, ret = 0, sent = 0;
+	size_t done = 0;
+	int fd = conn->handle.fd;
+	struct iovec iovs[QUIC_CONN_TX_BUFS_NB];
+
+	if (!conn_ctrl_ready(conn))
+		return 0;
+
+	if (!fd_send_ready(fd))
+		return 0;
+
+	for (i = 0; i < nb; i++) {
+		iovs[i].iov_base = bufs[i]->area;
+		iovs[i].iov_len = bufs[i]->data;
+	}
+
+#ifdef QUIC_USE_GSO
+	if (nb > 1 && !txtimes && !quic_gso_disabled && quic_dgrams_gso_compatible(bufs, nb)) {
+		union {
+			char buf[QUIC_TX_CMSG_SPACE];
+			struct cmsghdr align;
+		} cbuf;
+		struct msghdr msg = {
+			.msg_name       = conn->dst,
+			.msg_namelen    = get_addr_len(conn->dst),
+			.msg_iov        = iovs,
+			.msg_iovlen     = nb,
+			.msg_control    = cbuf.buf,
+			.msg_controllen = 0,
+		};
+		uint16_t segsz = bufs[0]->data;
+
+		quic_cmsg_append(&msg, SOL_UDP, UDP_SEGMENT, &segsz, sizeof segsz);
+#ifdef QUIC_USE_ECN
+		if (ecn)
+			quic_cmsg_append_ecn(&msg, conn->dst, ecn);
+#endif
+
+		do {
+			ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret >= 0) {
+			sent = nb;
+			done = ret;
+			goto out;
+		}
+
+		/* A datagram larger than the local MTU (a path MTU discovery
+		 * probe) makes the whole batch fail: the datagrams are sent one
+		 * by one to drop only this one.
+		 */
+		if (errno != EMSGSIZE) {
+			if (errno != EIO && errno != EINVAL && errno != EOPNOTSUPP && errno != ENOPROTOOPT)
+				goto err;
+
+			/* No GSO support from the kernel or the device: never try again. */
+			quic_gso_disabled = 1;
+		}
+	}
+#endif
+
+#ifdef QUIC_USE_SENDMMSG
+	{
+		struct mmsghdr msgs[QUIC_CONN_TX_BUFS_NB];
+		union {
+			char buf[QUIC_TX_CMSG_SPACE];
+			struct cmsghdr align;
+		} cbufs[QUIC_CONN_TX_BUFS_NB];
+
+		memset(msgs, 0, nb * sizeof *msgs);
+		for (i = 0; i < nb; i++) {
+			msgs[i].msg_hdr.msg_name = conn->dst;
+			msgs[i].msg_hdr.msg_namelen = get_addr_len(conn->dst);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = cbufs[i].buf;
+#ifdef QUIC_USE_TXTIME
+			if (txtimes)
+				quic_cmsg_append(&msgs[i].msg_hdr, SOL_SOCKET, SCM_TXTIME,
+				                 &txtimes[i], sizeof txtimes[i]);
+#endif
+#ifdef QUIC_USE_ECN
+			if (ecn)
+				quic_cmsg_append_ecn(&msgs[i].msg_hdr, conn->dst, ecn);
+#endif
+			if (!msgs[i].msg_hdr.msg_controllen)
+				msgs[i].msg_hdr.msg_control = NULL;
+		}
+
+		do {
+			ret = sendmmsg(fd, msgs, nb, MSG_DONTWAIT | MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+
+#ifdef QUIC_USE_TXTIME
+		if (ret < 0 && txtimes && errno == EINVAL) {
+			/* SO_TXTIME is not enabled on this socket: the datagrams
+			 * will be paced by the pacing task only from now on.
+			 */
+			HA_ATOMIC_AND(&global.tune.options, ~GTUNE_QUIC_TXTIME);
+			for (i = 0; i < nb; i++) {
+				msgs[i].msg_hdr.msg_control = cbufs[i].buf;
+				msgs[i].msg_hdr.msg_controllen = 0;
+#ifdef QUIC_USE_ECN
+				if (ecn)
+					quic_cmsg_append_ecn(&msgs[i].msg_hdr, conn->dst, ecn);
+#endif
+				if (!msgs[i].msg_hdr.msg_controllen)
+					msgs[i].msg_hdr.msg_control = NULL;
+			}
+			do {
+				ret = sendmmsg(fd, msgs, nb, MSG_DONTWAIT | MSG_NOSIGNAL);
+			} while (ret < 0 && errno == EINTR);
+		}
+#endif
+
+		if (ret <= 0)
+			goto err;
+
+		sent = ret;
+		for (i = 0; i < sent; i++)
+			done += msgs[i].msg_len;
+	}
+#else
+	while (sent < nb) {
+		ret = sendto(fd, iovs[sent].iov_base, iovs[sent].iov_len,
+		             MSG_DONTWAIT | MSG_NOSIGNAL,
+		             (struct sockaddr *)conn->dst, get_addr_len(conn->dst));
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			goto err;
+		}
+
+		done += ret;
+		sent++;
+	}
+#endif
+	goto out;
+
+ err:
+	if (ret == 0 || errno == EAGAIN || errno == ENOTCONN || errno == EINPROGRESS) {
+		/* nothing written, we need to poll for write first */
+		fd_cant_send(fd);
+	}
+	else if (errno == EMSGSIZE) {
+		/* This datagram, a path MTU discovery probe, is larger than the
+		 * local MTU: it is dropped as it would be on the path.
+		 */
+		sent++;
+	}
+	else {
+		conn->flags |= CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH;
+	}
+
+ out:
+	if (done > 0) {
+		/* A send succeeded, so we can consier ourself connected */
+		conn->flags |= CO_FL_WAIT_L4L6;
+		if (unlikely(conn->flags & CO_FL_WAIT_L4_CONN))
+			conn->flags &= ~CO_FL_WAIT_L4_CONN;
+
+		_HA_ATOMIC_ADD(&global.out_bytes, done);
+		update_freq_ctr_thr(&global.out_32bps, (done + 16) / 32);
+	}
+
+	return sent;
+}
+
 static int quic_conn_subscribe(struct connection *conn, void *xprt_ctx, int event_type, struct wait_event *es)
 {
 	return conn_subscribe(conn, xprt_ctx, event_type, es);
@@ -1223,7 +1793,6 @@ static int qc_do_rm_hp(struct quic_rx_packet *pkt, struct quic_tls_ctx *tls_ctx,
 	unsigned char mask[5] = {0};
 	unsigned char *sample;
 	EVP_CIPHER_CTX *cctx;
-	unsigned char *hp_key;
 
 	TRACE_ENTER(QUIC_EV_CONN_RMHP, ctx->conn, pkt);
 	/* Check there is enough data in this packet. */
@@ -1232,17 +1801,11 @@ static int qc_do_rm_hp(struct quic_rx_packet *pkt, struct quic_tls_ctx *tls_ctx,
 		return 0;
 	}
 
-	cctx = EVP_CIPHER_CTX_new();
-	if (!cctx) {
-		TRACE_DEVEL("memory allocation failed", QUIC_EV_CONN_RMHP, ctx->conn, pkt);
-		return 0;
-	}
-
 	ret = 0;
 	sample = pn + QUIC_PACKET_PN_MAXLEN;
 
-	hp_key = tls_ctx->rx.hp_key;
-	if (!EVP_DecryptInit_ex(cctx, tls_ctx->rx.hp, NULL, hp_key, sample) ||
+	cctx = tls_ctx->rx.hp_ctx;
+	if (!EVP_DecryptInit_ex(cctx, NULL, NULL, NULL, sample) ||
 	    !EVP_DecryptUpdate(cctx, mask, &outlen, mask, sizeof mask) ||
 	    !EVP_DecryptFinal_ex(cctx, mask, &outlen)) {
 		TRACE_DEVEL("decryption failed", QUIC_EV_CONN_RMHP, ctx->conn, pkt);
@@ -1264,7 +1827,6 @@ static int qc_do_rm_hp(struct quic_rx_packet *pkt, struct quic_tls_ctx *tls_ctx,
 	ret = 1;
 
  out:
-	EVP_CIPHER_CTX_free(cctx);
 	TRACE_LEAVE(QUIC_EV_CONN_RMHP, ctx->conn, pkt, &ret);
 
 	return ret;
@@ -1290,8 +1852,7 @@ static int quic_packet_encrypt(unsigned char *payload, size_t payload_len,
 		return 0;
 	}
 
-	if (!quic_tls_encrypt(payload, payload_len, aad, aad_len,
-	                      tls_ctx->tx.aead, tls_ctx->tx.key, iv)) {
+	if (!quic_tls_encrypt(payload, payload_len, aad, aad_len, tls_ctx->tx.ctx, iv)) {
 		TRACE_DEVEL("QUIC packet encryption failed", QUIC_EV_CONN_HPKT, conn);
 		return 0;
 	}
@@ -1299,16 +1860,135 @@ static int quic_packet_encrypt(unsigned char *payload, size_t payload_len,
 	return 1;
 }
 
+/* Derive the next generation of the 1-RTT keys of <qc> connection for the
+ * directions where it is not already done, out of the packet protection paths.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int qc_tls_ku_prepare(struct quic_conn *qc)
+{
+	struct quic_tls_ctx *tls_ctx = &qc->els[QUIC_TLS_ENC_LEVEL_APP].tls_ctx;
+
+	if (!(qc->ku.flags & QUIC_FL_KU_NXT_RX_READY) && tls_ctx->rx.secretlen) {
+		if (!quic_tls_kp_derive(&qc->ku.nxt_rx, &tls_ctx->rx, 0))
+			return 0;
+		qc->ku.flags |= QUIC_FL_KU_NXT_RX_READY;
+	}
+
+	if (!(qc->ku.flags & QUIC_FL_KU_NXT_TX_READY) && tls_ctx->tx.secretlen) {
+		if (!quic_tls_kp_derive(&qc->ku.nxt_tx, &tls_ctx->tx, 1))
+			return 0;
+		qc->ku.flags |= QUIC_FL_KU_NXT_TX_READY;
+	}
+
+	return 1;
+}
+
+/* Switch the TX keys of <qc> connection to the next key phase, <pn> being
+ * the number of the first packet to be sent with them.
+ */
+static inline void qc_tls_ku_tx_switch(struct quic_conn *qc, int64_t pn)
+{
+	struct quic_tls_ctx *tls_ctx = &qc->els[QUIC_TLS_ENC_LEVEL_APP].tls_ctx;
+
+	quic_tls_kp_swap(&tls_ctx->tx, &qc->ku.nxt_tx);
+	tls_ctx->tx.flags ^= QUIC_FL_TLS_KP_BIT_SET;
+	qc->ku.flags &= ~QUIC_FL_KU_NXT_TX_READY;
+	qc->ku.tx_pn = pn;
+	qc->ku.tx_pkts = 0;
+}
+
+/* Switch the RX keys of <qc> connection to the next key phase after a packet
+ * numbered <pn> has been successfully decrypted with them, the current ones
+ * being kept for the reordered packets. If this key update was initiated by
+ * the peer, the TX keys are updated too.
+ */
+static inline void qc_tls_ku_rx_switch(struct quic_conn *qc, int64_t pn)
+{
+	struct quic_enc_level *qel = &qc->els[QUIC_TLS_ENC_LEVEL_APP];
+	struct quic_tls_ctx *tls_ctx = &qel->tls_ctx;
+
+	/* previous <- current <- next, the old previous ones to be derived again. */
+	quic_tls_kp_swap(&tls_ctx->rx, &qc->ku.prv_rx);
+	quic_tls_kp_swap(&tls_ctx->rx, &qc->ku.nxt_rx);
+	tls_ctx->rx.flags ^= QUIC_FL_TLS_KP_BIT_SET;
+	qc->ku.flags &= ~QUIC_FL_KU_NXT_RX_READY;
+	qc->ku.rx_pn = pn;
+	if (!(tls_ctx->rx.flags & QUIC_FL_TLS_KP_BIT_SET) !=
+	    !(tls_ctx->tx.flags & QUIC_FL_TLS_KP_BIT_SET) &&
+	    (qc->ku.flags & QUIC_FL_KU_NXT_TX_READY))
+		qc_tls_ku_tx_switch(qc, qel->pktns->tx.next_pn + 1);
+}
+
+/* Initiate a 1-RTT key update for <qc> connection if enough packets have been
+ * encrypted with the current TX keys ("tune.quic.key-update-pkts"). This is
+ * possible only after the handshake confirmation, if the peer has updated its
+ * keys after the previous key update and acknowledged a packet sent with the
+ * current ones (RFC 9001 6.1).
+ */
+static inline void qc_tls_ku_initiate(struct quic_conn *qc)
+{
+	struct quic_enc_level *qel = &qc->els[QUIC_TLS_ENC_LEVEL_APP];
+	struct quic_tls_ctx *tls_ctx = &qel->tls_ctx;
+	struct quic_conn_ctx *ctx = qc->conn->xprt_ctx;
+
+	if (!quic_ku_pkts || qc->ku.tx_pkts < quic_ku_pkts ||
+	    ctx->state < QUIC_HS_ST_CONFIRMED ||
+	    (qc->ku.flags & (QUIC_FL_KU_NXT_RX_READY|QUIC_FL_KU_NXT_TX_READY)) !=
+	    (QUIC_FL_KU_NXT_RX_READY|QUIC_FL_KU_NXT_TX_READY) ||
+	    !(tls_ctx->rx.flags & QUIC_FL_TLS_KP_BIT_SET) !=
+	    !(tls_ctx->tx.flags & QUIC_FL_TLS_KP_BIT_SET) ||
+	    qel->pktns->tx.largest_acked_pn < qc->ku.tx_pn)
+		return;
+
+	TRACE_PROTO("key update", QUIC_EV_CONN_PAPKT, qc->conn);
+	qc_tls_ku_tx_switch(qc, qel->pktns->tx.next_pn + 1);
+}
+
+/* Returns 1 if <qpkt> is a short header packet of another key phase than the
+ * current one of <tls_ctx>, 0 if not.
+ */
+static inline int qc_pkt_other_kp(const struct quic_rx_packet *qpkt,
+                                  const struct quic_tls_ctx *tls_ctx)
+{
+	return !qc_pkt_long(qpkt) &&
+		!(qpkt->data[0] & QUIC_PACKET_KEY_PHASE_BIT) != !(tls_ctx->rx.flags & QUIC_FL_TLS_KP_BIT_SET);
+}
+
 /*
- * Decrypt <qpkt> QUIC packet with <tls_ctx> as QUIC TLS cryptographic context.
+ * Decrypt <qpkt> QUIC packet with <tls_ctx> as QUIC TLS cryptographic context
+ * of <qc> connection. The short header packets whose key phase bit differs from
+ * the current one are decrypted with the keys of the previous key phase if older
+ * than the first packet of the current one, with the next ones if not. In this
+ * latter case, the RX keys are switched to the next key phase.
  * Returns 1 if succeeded, 0 if not.
  */
-static int qc_pkt_decrypt(struct quic_rx_packet *qpkt, struct quic_tls_ctx *tls_ctx)
+static int qc_pkt_decrypt(struct quic_rx_packet *qpkt, struct quic_tls_ctx *tls_ctx,
+                          struct quic_conn *qc)
 {
 	int ret;
 	unsigned char iv[12];
 	unsigned char *rx_iv = tls_ctx->rx.iv;
 	size_t rx_iv_sz = sizeof tls_ctx->rx.iv;
+	EVP_CIPHER_CTX *rx_ctx = tls_ctx->rx.ctx;
+	struct quic_tls_kp *kp = NULL;
+
+	if (qc_pkt_other_kp(qpkt, tls_ctx)) {
+		if (qpkt->pn < qc->ku.rx_pn) {
+			kp = &qc->ku.prv_rx;
+		}
+		else {
+			if (!(qc->ku.flags & QUIC_FL_KU_NXT_RX_READY)) {
+				QDPRINTF("%s: next key phase keys not available\n", __func__);
+				return 0;
+			}
+			kp = &qc->ku.nxt_rx;
+		}
+		if (!kp->ctx)
+			return 0;
+
+		rx_iv = kp->iv;
+		rx_ctx = kp->ctx;
+	}
 
 	if (!quic_aead_iv_build(iv, sizeof iv, rx_iv, rx_iv_sz, qpkt->pn)) {
 		QDPRINTF("%s AEAD IV building failed\n", __func__);
@@ -1317,13 +1997,16 @@ static int qc_pkt_decrypt(struct quic_rx_packet *qpkt, struct quic_tls_ctx *tls_
 
 	ret = quic_tls_decrypt(qpkt->data + qpkt->aad_len, qpkt->len - qpkt->aad_len,
 	                       qpkt->data, qpkt->aad_len,
-	                       tls_ctx->rx.aead, tls_ctx->rx.key, iv);
+	                       rx_ctx, iv);
 	if (!ret) {
 		QDPRINTF("%s: qpkt #%lu long %d decryption failed\n",
 		         __func__, qpkt->pn, qc_pkt_long(qpkt));
 		return 0;
 	}
 
+	if (kp == &qc->ku.nxt_rx)
+		qc_tls_ku_rx_switch(qc, qpkt->pn);
+
 	/* Update the packet length (required to parse the frames). */
 	qpkt->len = qpkt->aad_len + ret;
 	QDPRINTF("QUIC packet #%lu long header? %d decryption done\n",
@@ -1332,19 +2015,157 @@ static int qc_pkt_decrypt(struct quic_rx_packet *qpkt, struct quic_tls_ctx *tls_
 	return 1;
 }
 
-/* Treat <frm> frame whose packet it is attached to has just been acknowledged. */
-static inline void qc_treat_acked_tx_frm(struct quic_tx_frm *frm,
-                                         struct quic_conn_ctx *ctx)
+/* Decrypts the packets of an RX packet tree from <*node> with <tls_ctx>, with
+ * <qc> as connection, moving <*node> to the first packet not decrypted. Up to
+ * QUIC_TLS_DEC_BATCH consecutive packets protected with the current keys are
+ * decrypted at once. A packet of another key phase is decrypted alone by
+ * qc_pkt_decrypt() as it may switch the RX keys. The packets are stored into
+ * <pkts>, and the result of their decryption (1 if succeeded, 0 if not) into
+ * <ok>. Returns the number of packets stored into <pkts>.
+ */
+static int qc_pkts_decrypt(struct eb64_node **node, struct quic_rx_packet **pkts, int *ok,
+                           struct quic_tls_ctx *tls_ctx, struct quic_conn *qc)
 {
-	TRACE_PROTO("Removing frame", QUIC_EV_CONN_PRSAFRM, ctx->conn, frm);
-	switch (frm->type) {
-	case QUIC_FT_CRYPTO:
-		ctx->conn->quic_conn->ifcdata -= frm->crypto.len;
-		break;
+	struct quic_tls_dec decs[QUIC_TLS_DEC_BATCH];
+	int n, i;
+
+	for (n = 0; *node && n < QUIC_TLS_DEC_BATCH; n++) {
+		struct quic_rx_packet *pkt;
+
+		pkt = eb64_entry(&(*node)->node, struct quic_rx_packet, pn_node);
+		if (qc_pkt_other_kp(pkt, tls_ctx)) {
+			if (n)
+				break;
+
+			*node = eb64_next(*node);
+			pkts[0] = pkt;
+			ok[0] = qc_pkt_decrypt(pkt, tls_ctx, qc);
+			return 1;
+		}
+
+		*node = eb64_next(*node);
+		pkts[n] = pkt;
+		decs[n].buf = pkt->data + pkt->aad_len;
+		decs[n].len = pkt->len - pkt->aad_len;
+		decs[n].aad = pkt->data;
+		decs[n].aad_len = pkt->aad_len;
+		decs[n].pn = pkt->pn;
 	}
-	LIST_DEL(&frm->list);
-	pool_free(pool_head_quic_tx_frm, frm);
-}
+
+	quic_tls_decrypt_batch(decs, n, tls_ctx->rx.ctx, tls_ctx->rx.iv, sizeof tls_ctx->rx.iv);
+	for (i = 0; i < n; i++) {
+		ok[i] = !!decs[i].ret;
+		/* Update the packet length (required to parse the frames). */
+		if (ok[i])
+			pkts[i]->len = pkts[i]->aad_len + decs[i].ret;
+	}
+
+	return n;
+}
+
+/* Returns 1 if the streams of <conn> are handled by the QUIC mux. */
+static inline int qc_has_mux(const struct connection *conn)
+{
+	return (conn->mux == &mux_quic_ops || conn->mux == &mux_quic_h3_ops) && conn->ctx;
+}
+
+/* Appends <qf> frame to the frames to send of <qc>: the new STREAM frames to
+ * the list of their scheduling class, the other ones to <frms_to_send>.
+ */
+static inline void qc_enqueue_frm(struct quic_conn *qc, struct quic_frame *qf)
+{
+	if (qf->type >= QUIC_FT_STREAM_8 && qf->type <= QUIC_FT_STREAM_F)
+		LIST_ADDQ(&qc->tx.strm_frms[qf->stream.prio], &qf->list);
+	else
+		LIST_ADDQ(&qc->tx.frms_to_send, &qf->list);
+}
+
+/* Returns 1 if there are frames to send by <qc> after the handshake, 0 if not. */
+static inline int qc_has_frms_to_send(const struct quic_conn *qc)
+{
+	int i;
+
+	if (!LIST_ISEMPTY(&qc->tx.frms_to_send))
+		return 1;
+
+	for (i = 0; i < QUIC_TX_PRIO_NB; i++)
+		if (!LIST_ISEMPTY(&qc->tx.strm_frms[i]))
+			return 1;
+	return 0;
+}
+
+/* Queue a copy of <frm> frame to be sent after the handshake by <conn> QUIC
+ * connection and wake up its I/O handler. Used by the mux to send the STREAM
+ * and flow control frames. The frames queued from another thread than the one
+ * of the connection go through its lock-free <tx.frms_in> queue so that the
+ * connection thread never has to lock its own lists. Returns 1 if succeeded,
+ * 0 if not.
+ */
+int qc_snd_frm(struct connection *conn, const struct quic_frame *frm)
+{
+	struct quic_conn_ctx *ctx = conn->xprt_ctx;
+	struct quic_conn *qc = conn->quic_conn;
+	struct quic_frame *qf;
+
+	qf = pool_alloc(pool_head_quic_frame);
+	if (!qf)
+		return 0;
+
+	*qf = *frm;
+	if (likely(qc->tid == tid))
+		qc_enqueue_frm(qc, qf);
+	else {
+		MT_LIST_INIT(&qf->mt_list);
+		MT_LIST_ADDQ(&qc->tx.frms_in, &qf->mt_list);
+	}
+	tasklet_wakeup(ctx->wait_event.tasklet);
+
+	return 1;
+}
+
+/* Move at once to the list of frames to send of <qc> the frames queued by the
+ * other threads, preserving their order. Must be called by the thread of <qc>.
+ */
+static inline void qc_drain_frms_in(struct quic_conn *qc)
+{
+	struct mt_list *elt, *next;
+
+	if (MT_LIST_ISEMPTY(&qc->tx.frms_in))
+		return;
+
+	for (elt = MT_LIST_BEHEAD(&qc->tx.frms_in); elt; elt = next) {
+		struct quic_frame *qf = MT_LIST_ELEM(elt, struct quic_frame *, mt_list);
+
+		/* The last element of a beheaded list has no next one. */
+		next = elt->next;
+		qc_enqueue_frm(qc, qf);
+	}
+}
+
+/* Treat <frm> frame whose packet it is attached to has just been acknowledged. */
+static inline void qc_treat_acked_tx_frm(struct quic_tx_frm *frm,
+                                         struct quic_conn_ctx *ctx)
+{
+	struct quic_frame *qf;
+
+	TRACE_PROTO("Removing frame", QUIC_EV_CONN_PRSAFRM, ctx->conn, frm);
+	LIST_DEL(&frm->list);
+	if (frm->type == QUIC_FT_CRYPTO) {
+		ctx->conn->quic_conn->ifcdata -= frm->crypto.len;
+		pool_free(pool_head_quic_tx_frm, frm);
+		return;
+	}
+
+	/* The other frames were queued by qc_snd_frm() or built after the
+	 * handshake as quic_frame objects.
+	 */
+	qf = container_of(frm, struct quic_frame, list);
+	if (qf->type >= QUIC_FT_STREAM_8 && qf->type <= QUIC_FT_STREAM_F &&
+	    qc_has_mux(ctx->conn))
+		qcc_stream_acked(ctx->conn, qf->stream.id, qf->stream.offset, qf->stream.len,
+		                 qf->type & QUIC_STREAM_FRAME_FIN_BIT);
+	pool_free(pool_head_quic_frame, qf);
+}
 
 /*
  * Remove <largest> down to <smallest> node entries from <pkts> tree of TX packet,
@@ -1396,13 +2217,19 @@ static inline void qc_treat_nacked_tx_frm(struct quic_tx_frm *frm,
                                           struct quic_conn_ctx *ctx)
 {
 	TRACE_PROTO("to resend frame", QUIC_EV_CONN_PRSAFRM, ctx->conn, frm);
-	switch (frm->type) {
-	case QUIC_FT_CRYPTO:
+	LIST_DEL(&frm->list);
+	if (frm->type == QUIC_FT_CRYPTO) {
 		ctx->conn->quic_conn->ifcdata -= frm->crypto.len;
-		break;
+		LIST_ADD(&pktns->tx.frms, &frm->list);
+	}
+	else if (container_of(frm, struct quic_frame, list)->type == QUIC_FT_PATH_RESPONSE) {
+		/* Never resent: a new one is sent for each PATH_CHALLENGE (RFC 9000 8.2.2). */
+		pool_free(pool_head_quic_frame, container_of(frm, struct quic_frame, list));
+	}
+	else {
+		/* Post-handshake frames are resent as is. */
+		LIST_ADDQ(&ctx->conn->quic_conn->tx.frms_to_send, &frm->list);
 	}
-	LIST_DEL(&frm->list);
-	LIST_ADD(&pktns->tx.frms, &frm->list);
 }
 
 
@@ -1440,6 +2267,121 @@ static inline void qc_cc_loss_event(struct quic_conn *qc,
 	};
 
 	quic_cc_event(&qc->path->cc, &ev);
+	quic_qlog_metrics_updated(qc);
+}
+
+/* Update the delivery rate estimation of <path> upon <pkt> packet
+ * acknowledgement at <now_us> date, filling the delivery rate sample
+ * fields of <ev> ACK event. The rate is measured over the longest of
+ * the send and ACK intervals to protect against the ACK compression.
+ */
+static inline void qc_delivery_rate_sample(struct quic_path *path,
+                                           struct quic_tx_packet *pkt,
+                                           uint64_t now_us,
+                                           struct quic_cc_event *ev)
+{
+	uint64_t send_elapsed, ack_elapsed, interval;
+
+	ev->ack.rate = 0;
+	ev->ack.prior_delivered = pkt->delivered;
+	ev->ack.app_limited = !!(pkt->flags & QUIC_FL_TX_PACKET_APP_LIMITED);
+	ev->ack.rtt_us = 0;
+	if (!pkt->in_flight_len)
+		return;
+
+	path->delivered += pkt->in_flight_len;
+	path->delivered_time = now_us;
+	/* End of the application limited period. */
+	if (path->app_limited && path->delivered > path->app_limited)
+		path->app_limited = 0;
+
+	/* The next sampling interval starts at this packet send date. */
+	path->first_sent_time = pkt->time_sent_us;
+	if (now_us > pkt->time_sent_us)
+		ev->ack.rtt_us = now_us - pkt->time_sent_us;
+	send_elapsed = pkt->time_sent_us - pkt->first_sent_time;
+	ack_elapsed = now_us - pkt->delivered_time;
+	interval = max(send_elapsed, ack_elapsed);
+	if (interval)
+		ev->ack.rate = (path->delivered - pkt->delivered) * 1000000 / interval;
+}
+
+/* Select the size of the next DPLPMTUD probe of <pmtud> between its lower and
+ * upper bounds, or complete the search if this range is too small.
+ */
+static inline void qc_pmtud_next_probe(struct quic_pmtud *pmtud)
+{
+	pmtud->pn = -1;
+	pmtud->nb_lost = 0;
+	if (pmtud->high < pmtud->low + QUIC_PMTUD_MIN_STEP) {
+		pmtud->state = QUIC_PMTUD_ST_COMPLETE;
+		return;
+	}
+
+	pmtud->size = (pmtud->low + pmtud->high + 1) / 2;
+}
+
+/* Start the path MTU discovery (RFC 8899) for the path of <qc> connection. The
+ * largest size allowed by "tune.quic.max-dgram-size" and by the peer
+ * "max_packet_size" transport parameter is probed first, the search going on
+ * with a binary search if it is not supported.
+ */
+static inline void qc_pmtud_start(struct quic_conn *qc)
+{
+	struct quic_path *path = qc->path;
+	struct quic_pmtud *pmtud = &path->pmtud;
+
+	pmtud->low = path->mtu;
+	pmtud->high = min((uint64_t)quic_max_dgram_sz, qc->rx_tps.max_packet_size);
+	pmtud->size = pmtud->high;
+	pmtud->pn = -1;
+	pmtud->nb_lost = 0;
+	pmtud->state = pmtud->high < pmtud->low + QUIC_PMTUD_MIN_STEP ?
+		QUIC_PMTUD_ST_COMPLETE : QUIC_PMTUD_ST_SEARCHING;
+}
+
+/* Return 1 if a DPLPMTUD probe may be sent on <path>, 0 if not. There is
+ * only one probe in flight at a time and it must fit in the congestion window.
+ */
+static inline int qc_pmtud_probe_needed(struct quic_path *path)
+{
+	struct quic_pmtud *pmtud = &path->pmtud;
+
+	return pmtud->state == QUIC_PMTUD_ST_SEARCHING && pmtud->pn < 0 &&
+		path->in_flight + pmtud->size <= path->cwnd;
+}
+
+/* Raise the MTU of <path> upon <pkt> DPLPMTUD probe acknowledgement. */
+static inline void qc_pmtud_probe_acked(struct quic_path *path,
+                                        struct quic_tx_packet *pkt)
+{
+	struct quic_pmtud *pmtud = &path->pmtud;
+
+	if ((int64_t)pkt->pn_node.key != pmtud->pn)
+		return;
+
+	pmtud->low = path->mtu = pmtud->size;
+	path->min_cwnd = path->mtu << 1;
+	qc_pmtud_next_probe(pmtud);
+}
+
+/* Handle the loss of <pkt> DPLPMTUD probe sent on <path>. Its size is
+ * considered as not supported after QUIC_PMTUD_MAX_PROBES losses.
+ */
+static inline void qc_pmtud_probe_lost(struct quic_path *path,
+                                       struct quic_tx_packet *pkt)
+{
+	struct quic_pmtud *pmtud = &path->pmtud;
+
+	if ((int64_t)pkt->pn_node.key != pmtud->pn)
+		return;
+
+	pmtud->pn = -1;
+	if (++pmtud->nb_lost < QUIC_PMTUD_MAX_PROBES)
+		return;
+
+	pmtud->high = pmtud->size - 1;
+	qc_pmtud_next_probe(pmtud);
 }
 
 /* Send a packet ack event nofication for each newly acked packet of
@@ -1450,16 +2392,21 @@ static inline void qc_treat_newly_acked_pkts(struct quic_conn_ctx *ctx,
                                              struct list *newly_acked_pkts)
 {
 	struct quic_conn *qc = ctx->conn->quic_conn;
+	struct quic_path *path = qc->path;
 	struct quic_tx_packet *pkt, *tmp;
 	struct quic_cc_event ev = { .type = QUIC_CC_EVT_ACK, };
+	uint64_t now_us = quic_now_us();
 
 	list_for_each_entry_safe(pkt, tmp, newly_acked_pkts, list) {
 		pkt->pktns->tx.in_flight -= pkt->in_flight_len;
 		if (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING)
-			qc->path->in_flight_ae_pkts--;
+			path->in_flight_ae_pkts--;
 		ev.ack.acked = pkt->in_flight_len;
 		ev.ack.time_sent = pkt->time_sent;
-		quic_cc_event(&qc->path->cc, &ev);
+		qc_delivery_rate_sample(path, pkt, now_us, &ev);
+		quic_cc_event(&path->cc, &ev);
+		if (pkt->flags & QUIC_FL_TX_PACKET_PMTUD_PROBE)
+			qc_pmtud_probe_acked(path, pkt);
 		LIST_DEL(&pkt->list);
 		eb64_delete(&pkt->pn_node);
 		pool_free(pool_head_quic_tx_packet, pkt);
@@ -1467,6 +2414,22 @@ static inline void qc_treat_newly_acked_pkts(struct quic_conn_ctx *ctx,
 
 }
 
+/* Account the loss of an ECT(0) marked packet sent on <path>. The ECN
+ * validation fails if all the packets sent during the testing state are lost,
+ * the path or a middlebox possibly dropping the ECN marked packets.
+ */
+static inline void qc_ecn_lost_pkt(struct quic_path *path)
+{
+	struct quic_ecn *ecn = &path->ecn;
+
+	if (ecn->state != QUIC_ECN_ST_TESTING && ecn->state != QUIC_ECN_ST_UNKNOWN)
+		return;
+
+	ecn->nb_test_lost++;
+	if (ecn->state == QUIC_ECN_ST_UNKNOWN && ecn->nb_test_lost >= ecn->nb_test_pkts)
+		ecn->state = QUIC_ECN_ST_FAILED;
+}
+
 /* Handle <pkts> list of lost packets detected at <now_us> handling
  * their TX frames.
  * Send a packet loss event to the congestion controller if
@@ -1487,14 +2450,26 @@ static inline void qc_release_lost_pkts(struct quic_pktns *pktns,
 	lost_bytes = 0;
 	oldest_lost = newest_lost = NULL;
 	list_for_each_entry_safe(pkt, tmp, pkts, list) {
-		lost_bytes += pkt->in_flight_len;
 		pkt->pktns->tx.in_flight -= pkt->in_flight_len;
 		if (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING)
 			qc->path->in_flight_ae_pkts--;
+		if (pkt->flags & QUIC_FL_TX_PACKET_ECT0)
+			qc_ecn_lost_pkt(qc->path);
 		/* Treat the frames of this lost packet. */
 		list_for_each_entry_safe(frm, frmbak, &pkt->frms, list)
 			qc_treat_nacked_tx_frm(frm, pktns, ctx);
 		LIST_DEL(&pkt->list);
+		if (pkt->flags & QUIC_FL_TX_PACKET_PMTUD_PROBE) {
+			/* The loss of a probe is not a congestion signal. */
+			qc->path->in_flight -= pkt->in_flight_len;
+			qc_pmtud_probe_lost(qc->path, pkt);
+			pool_free(pool_head_quic_tx_packet, pkt);
+			continue;
+		}
+
+		lost_bytes += pkt->in_flight_len;
+		qc->tx.lost_pkts++;
+		qc_counters_add(qc, lost_pkts, 1);
 		if (!oldest_lost) {
 			oldest_lost = newest_lost = pkt;
 		}
@@ -1569,6 +2544,67 @@ static void qc_packet_loss_lookup(struct quic_pktns *pktns,
 	TRACE_LEAVE(QUIC_EV_CONN_PKTLOSS, qc->conn, pktns, lost_pkts);
 }
 
+/* Validate the ECN counts of <frm> ACK frame received for <pktns> packet
+ * number space of <qc> connection against <newly_acked_pkts> list of the
+ * packets it newly acknowledges (RFC 9000 13.4.2), then notify the congestion
+ * controller of any increase of the ECN-CE count. Stop marking the packets
+ * if the validation fails.
+ * Never fails.
+ */
+static inline void qc_ecn_ack_process(struct quic_conn *qc, struct quic_pktns *pktns,
+                                      struct quic_frame *frm,
+                                      struct list *newly_acked_pkts)
+{
+	struct quic_ecn *ecn = &qc->path->ecn;
+	struct quic_ecn_counts *prev = &pktns->tx.ecn_counts;
+	const struct quic_ecn_counts *cur = &frm->ack.ecn_counts;
+	struct quic_tx_packet *pkt, *largest;
+	uint64_t nb_ect0;
+
+	if (ecn->state == QUIC_ECN_ST_FAILED)
+		return;
+
+	nb_ect0 = 0;
+	largest = NULL;
+	list_for_each_entry(pkt, newly_acked_pkts, list) {
+		if (!(pkt->flags & QUIC_FL_TX_PACKET_ECT0))
+			continue;
+
+		nb_ect0++;
+		if (!largest || pkt->pn_node.key > largest->pn_node.key)
+			largest = pkt;
+	}
+
+	if (frm->type != QUIC_FT_ACK_ECN) {
+		/* The ECN marks were removed or are not reported. */
+		if (nb_ect0)
+			goto fail;
+		return;
+	}
+
+	if (cur->ect0 < prev->ect0 || cur->ect1 < prev->ect1 || cur->ce < prev->ce ||
+	    cur->ect0 - prev->ect0 + cur->ce - prev->ce < nb_ect0)
+		goto fail;
+
+	if (nb_ect0)
+		ecn->state = QUIC_ECN_ST_CAPABLE;
+
+	if (largest && cur->ce > prev->ce) {
+		struct quic_cc_event ev = {
+			.type = QUIC_CC_EVT_ECN_CE,
+			.ecn.time_sent = largest->time_sent,
+		};
+
+		quic_cc_event(&qc->path->cc, &ev);
+	}
+	*prev = *cur;
+	return;
+
+ fail:
+	TRACE_PROTO("ECN validation failed", QUIC_EV_CONN_PRSAFRM, qc->conn);
+	ecn->state = QUIC_ECN_ST_FAILED;
+}
+
 /*
  * Parse ACK frame into <frm> from a buffer at <buf> address with <end> being at
  * one byte past the end of this buffer. Also update <rtt_sample> if needed, i.e.
@@ -1586,6 +2622,7 @@ static inline int qc_parse_ack_frm(struct quic_frame *frm, struct quic_conn_ctx
 	struct eb_root *pkts;
 	struct eb64_node *largest_node;
 	unsigned int time_sent, pkt_flags;
+	uint64_t time_sent_us = 0;
 	struct list newly_acked_pkts = LIST_HEAD_INIT(newly_acked_pkts);
 	struct list lost_pkts = LIST_HEAD_INIT(lost_pkts);
 
@@ -1618,6 +2655,8 @@ static inline int qc_parse_ack_frm(struct quic_frame *frm, struct quic_conn_ctx
 
 		time_sent = eb64_entry(&largest_node->node,
 		                       struct quic_tx_packet, pn_node)->time_sent;
+		time_sent_us = eb64_entry(&largest_node->node,
+		                          struct quic_tx_packet, pn_node)->time_sent_us;
 	}
 
 	TRACE_PROTO("ack range", QUIC_EV_CONN_PRSAFRM,
@@ -1659,11 +2698,29 @@ static inline int qc_parse_ack_frm(struct quic_frame *frm, struct quic_conn_ctx
 		            ctx->conn,, &largest, &smallest);
 	} while (1);
 
+	if (frm->type == QUIC_FT_ACK_ECN &&
+	    (!quic_dec_int(&ack->ecn_counts.ect0, pos, end) ||
+	     !quic_dec_int(&ack->ecn_counts.ect1, pos, end) ||
+	     !quic_dec_int(&ack->ecn_counts.ce, pos, end))) {
+		TRACE_DEVEL("wrong ECN counts", QUIC_EV_CONN_PRSAFRM, ctx->conn);
+		goto err;
+	}
+
 	/* Flag this packet number space as having received an ACK. */
 	qel->pktns->flags |= QUIC_FL_PKTNS_ACK_RECEIVED;
 
+	/* Only the ACK frames which increase the largest acknowledged packet
+	 * number are used for the ECN validation.
+	 */
+	if (time_sent)
+		qc_ecn_ack_process(ctx->conn->quic_conn, qel->pktns, frm, &newly_acked_pkts);
+
 	if (time_sent && (pkt_flags & QUIC_FL_TX_PACKET_ACK_ELICITING)) {
-		*rtt_sample = now_ms - time_sent;
+		/* use the departure date in microseconds, rounded to the
+		 * closest millisecond, rather than the difference of two
+		 * millisecond dates which may be off by one.
+		 */
+		*rtt_sample = now_us > time_sent_us ? (now_us - time_sent_us + 500) / 1000 : 0;
 		qel->pktns->tx.largest_acked_pn = ack->largest_ack;
 	}
 
@@ -1688,6 +2745,96 @@ static inline int qc_parse_ack_frm(struct quic_frame *frm, struct quic_conn_ctx
 	return 0;
 }
 
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+/* I/O handler of the async engine fds of a QUIC connection during its
+ * handshake: the connection tasklet resumes the suspended handshake job.
+ */
+static void quic_async_fd_handler(int fd)
+{
+	struct quic_conn_ctx *ctx = fdtab[fd].owner;
+
+	fd_stop_recv(fd);
+	fd_cant_recv(fd);
+	tasklet_wakeup(ctx->wait_event.tasklet);
+}
+
+/* I/O handler of the async engine fds of a QUIC connection closed while a
+ * handshake job was pending: the job is over, its fds may be removed.
+ */
+static void quic_async_fd_drop(int fd)
+{
+	SSL *ssl = fdtab[fd].owner;
+	OSSL_ASYNC_FD all_fd[32];
+	size_t num_all_fds = 0;
+	int i;
+
+	SSL_get_all_async_fds(ssl, NULL, &num_all_fds);
+	if (num_all_fds > 32)
+		return;
+
+	SSL_get_all_async_fds(ssl, all_fd, &num_all_fds);
+	for (i = 0; i < num_all_fds; i++)
+		fd_remove(all_fd[i]);
+}
+#endif
+
+/* Makes the TLS handshake of the QUIC connection with <ctx> as I/O handler
+ * context progress. With "ssl-mode-async", the job may be suspended while an
+ * asynchronous engine does the cryptographic operations, so that the other
+ * connections of the thread are not delayed by them. The connection tasklet
+ * is woken up again when the engine is done.
+ * Returns 1 if succeeded, even if the handshake is not completed, 0 if not.
+ */
+static int qc_ssl_do_hdshk(struct quic_conn_ctx *ctx)
+{
+	int ssl_err;
+
+	ssl_err = SSL_do_handshake(ctx->ssl);
+	if (ssl_err != 1) {
+		ssl_err = SSL_get_error(ctx->ssl, ssl_err);
+		if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+			TRACE_PROTO("SSL handshake",
+			            QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state, &ssl_err);
+			return 1;
+		}
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+		if (ssl_err == SSL_ERROR_WANT_ASYNC) {
+			TRACE_PROTO("SSL handshake waiting for async engine",
+			            QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state, &ssl_err);
+			ssl_async_update_fds(ctx->ssl, ctx, quic_async_fd_handler);
+			return 1;
+		}
+#endif
+
+		TRACE_DEVEL("SSL handshake error",
+		            QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state, &ssl_err);
+		/* free resumed session if exists */
+		if (objt_server(ctx->conn->target)) {
+			struct server *srv = __objt_server(ctx->conn->target);
+
+			free(srv->ssl_ctx.reused_sess[tid].ptr);
+			srv->ssl_ctx.reused_sess[tid].ptr = NULL;
+		}
+		return 0;
+	}
+
+	TRACE_PROTO("SSL handshake OK", QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state);
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+	/* The async mode is only used for the handshake, as for TCP. */
+	if (global_ssl.async)
+		SSL_clear_mode(ctx->ssl, SSL_MODE_ASYNC);
+#endif
+	/* The early data, if any, can no longer be replayed. */
+	ctx->conn->flags &= ~CO_FL_EARLY_SSL_HS;
+	if (objt_listener(ctx->conn->target)) {
+		ctx->state = QUIC_HS_ST_CONFIRMED;
+		qc_release_hs(ctx->conn->quic_conn);
+	}
+	else
+		ctx->state = QUIC_HS_ST_COMPLETE;
+	return 1;
+}
+
 /*
  * Provide CRYPTO data to the TLS stack found at <data> with <len> as length
  * from <qel> encryption level with <ctx> as QUIC connection context.
@@ -1715,25 +2862,8 @@ static inline int qc_provide_cdata(struct quic_enc_level *el,
 	            QUIC_EV_CONN_SSLDATA, ctx->conn,, cf, ctx->ssl);
 
 	if (ctx->state < QUIC_HS_ST_COMPLETE) {
-		ssl_err = SSL_do_handshake(ctx->ssl);
-		if (ssl_err != 1) {
-			ssl_err = SSL_get_error(ctx->ssl, ssl_err);
-			if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
-				TRACE_PROTO("SSL handshake",
-				            QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state, &ssl_err);
-				goto out;
-			}
-
-			TRACE_DEVEL("SSL handshake error",
-						QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state, &ssl_err);
+		if (!qc_ssl_do_hdshk(ctx))
 			goto err;
-		}
-
-		TRACE_PROTO("SSL handshake OK", QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state);
-		if (objt_listener(ctx->conn->target))
-			ctx->state = QUIC_HS_ST_CONFIRMED;
-		else
-			ctx->state = QUIC_HS_ST_COMPLETE;
 	} else {
 		ssl_err = SSL_process_quic_post_handshake(ctx->ssl);
 		if (ssl_err != 1) {
@@ -1762,6 +2892,140 @@ static inline int qc_provide_cdata(struct quic_enc_level *el,
 	return 0;
 }
 
+/* Returns 1 if <a1> and <a2> are the same address with the same port. */
+static inline int quic_addr_eq(struct sockaddr_storage *a1, struct sockaddr_storage *a2)
+{
+	return !ipcmp(a1, a2) && get_net_port(a1) == get_net_port(a2);
+}
+
+/* Returns the PTO of <path> of <qc> connection, from the initial RTT if not
+ * measured yet.
+ */
+static inline unsigned int qc_path_pto(struct quic_conn *qc, struct quic_path *path)
+{
+	struct quic_loss *ql = &path->loss;
+
+	if (!ql->srtt)
+		return 2 * QUIC_LOSS_INITIAL_RTT;
+
+	return (ql->srtt >> 3) + max(ql->rtt_var, QUIC_TIMER_GRANULARITY) + qc->max_ack_delay;
+}
+
+/* Make <path> the current path of <qc> connection. The packets in flight
+ * are accounted to the new current path as they may be acknowledged on it.
+ */
+static inline void qc_path_switch(struct quic_conn *qc, struct quic_path *path)
+{
+	if (path == qc->path)
+		return;
+
+	path->in_flight = qc->path->in_flight;
+	path->in_flight_ae_pkts = qc->path->in_flight_ae_pkts;
+	qc->path->in_flight = qc->path->in_flight_ae_pkts = 0;
+	qc->path = path;
+}
+
+/* Fall back to the previous path of <qc> connection whose current one could
+ * not be validated, with its congestion controller state.
+ */
+static void qc_path_fallback(struct quic_conn *qc)
+{
+	struct quic_path *prev = qc->pv.prev;
+
+	qc_path_switch(qc, prev);
+	*qc->conn->dst = prev->addr;
+	qc->pv.prev = NULL;
+}
+
+/* Check the validation of the current path of <qc> connection, falling back
+ * to the previous one if it has expired.
+ */
+static inline void qc_path_check_validation(struct quic_conn *qc)
+{
+	if (qc->pv.prev && tick_is_expired(qc->pv.expire, now_ms)) {
+		TRACE_PROTO("path validation failed", QUIC_EV_CONN_PRSHPKT, qc->conn);
+		qc_path_fallback(qc);
+	}
+}
+
+/* Check the source address of <pkt> 1-RTT packet received by a listener for
+ * the connection with <ctx> as I/O handler context. The packets from a new
+ * peer address are flagged with QUIC_FL_RX_PACKET_NEW_PATH. They are dropped
+ * before the handshake has completed (RFC 9000 9), and when they come from
+ * another IP address if we sent the disable_active_migration transport
+ * parameter, only the NAT rebinding being then supported.
+ * Returns 1 if the packet may be processed, 0 if it must be dropped.
+ */
+static int qc_rx_pkt_check_path(struct quic_rx_packet *pkt, struct quic_conn_ctx *ctx)
+{
+	struct quic_conn *qc = ctx->conn->quic_conn;
+	struct sockaddr_storage *saddr = &pkt->dgram->saddr;
+	struct sockaddr_storage *dst = ctx->conn->dst;
+
+	if (!objt_listener(ctx->conn->target) || quic_addr_eq(saddr, dst))
+		return 1;
+
+	if (ctx->state < QUIC_HS_ST_COMPLETE ||
+	    (qc->params.disable_active_migration && ipcmp(saddr, dst)))
+		return 0;
+
+	pkt->flags |= QUIC_FL_RX_PACKET_NEW_PATH;
+	return 1;
+}
+
+/* Handle the migration of the peer of <qc> connection to <saddr> address, on
+ * receipt of a non-probing packet with the largest packet number from it
+ * (RFC 9000 9.3). The packets are immediately sent to this address, on a
+ * path which is validated with a PATH_CHALLENGE frame, the previous path
+ * being kept to fall back to it if this validation fails. This path keeps
+ * the congestion controller state of the previous one if only the port of
+ * the peer has changed (NAT rebinding), which is very likely the same
+ * network path (RFC 9000 9.4).
+ */
+static void qc_path_migrate(struct quic_conn *qc, struct sockaddr_storage *saddr)
+{
+	struct connection *conn = qc->conn;
+	struct quic_path *prev, *path;
+	struct quic_frame *frm;
+
+	/* A new migration while validating a path: the validation restarts
+	 * from the last validated path, which may be the new one.
+	 */
+	if (qc->pv.prev) {
+		qc_path_fallback(qc);
+		if (quic_addr_eq(saddr, conn->dst))
+			return;
+	}
+
+	frm = pool_alloc(pool_head_quic_frame);
+	if (!frm)
+		return;
+
+	if (RAND_bytes(qc->pv.data, sizeof qc->pv.data) != 1) {
+		pool_free(pool_head_quic_frame, frm);
+		return;
+	}
+
+	frm->type = QUIC_FT_PATH_CHALLENGE;
+	memcpy(frm->path_challenge.data, qc->pv.data, sizeof qc->pv.data);
+	LIST_ADDQ(&qc->tx.frms_to_send, &frm->list);
+
+	prev = qc->path;
+	prev->addr = *conn->dst;
+	path = prev == &qc->paths[0] ? &qc->paths[1] : &qc->paths[0];
+	if (!ipcmp(saddr, &prev->addr))
+		*path = *prev;
+	else
+		quic_path_init(path, saddr->ss_family == AF_INET, prev->cc.algo, qc);
+	qc_path_switch(qc, path);
+	*conn->dst = *saddr;
+
+	/* Three times the largest PTO of both paths (RFC 9000 8.2.4). */
+	qc->pv.prev = prev;
+	qc->pv.expire = tick_add(now_ms, 3 * max(qc_path_pto(qc, prev), qc_path_pto(qc, path)));
+	TRACE_PROTO("peer migration", QUIC_EV_CONN_PRSHPKT, conn);
+}
+
 /*
  * Parse all the frames of <qpkt> QUIC packet for QUIC connection with <ctx>
  * as I/O handler context and <qel> as encryption level.
@@ -1785,24 +3049,39 @@ static int qc_parse_pkt_frms(struct quic_rx_packet *pkt, struct quic_conn_ctx *c
 		if (!qc_parse_frm(&frm, pkt, &pos, end, conn))
 			goto err;
 
+		/* ACK, CRYPTO and HANDSHAKE_DONE frames are not permitted in 0-RTT packets. */
+		if (pkt->type == QUIC_PACKET_TYPE_0RTT &&
+		    (frm.type == QUIC_FT_CRYPTO || frm.type == QUIC_FT_ACK ||
+		     frm.type == QUIC_FT_ACK_ECN || frm.type == QUIC_FT_HANDSHAKE_DONE)) {
+			TRACE_PROTO("frame not permitted in 0-RTT packet",
+			            QUIC_EV_CONN_PRSHPKT, ctx->conn, pkt);
+			goto err;
+		}
+
+		if (frm.type != QUIC_FT_PADDING && frm.type != QUIC_FT_PATH_CHALLENGE &&
+		    frm.type != QUIC_FT_PATH_RESPONSE && frm.type != QUIC_FT_NEW_CONNECTION_ID)
+			pkt->flags |= QUIC_FL_RX_PACKET_NON_PROBING;
+
 		switch (frm.type) {
 		case QUIC_FT_CRYPTO:
-			if (frm.crypto.offset != qel->rx.crypto.offset) {
-				struct quic_rx_crypto_frm *cf;
-
-				cf = pool_alloc(pool_head_quic_rx_crypto_frm);
-				if (!cf) {
-					TRACE_DEVEL("CRYPTO frame allocation failed",
+			if (frm.crypto.offset != qel->rx.crypto.offset ||
+			    quic_reasm_pending(&qel->rx.crypto.reasm)) {
+				struct quic_reasm *reasm = &qel->rx.crypto.reasm;
+				int had_buf = !!reasm->buf;
+
+				/* Only the payload is kept, the packet may be released.
+				 * No reassembly buffer is allocated under memory
+				 * pressure, the peer will retransmit this packet.
+				 */
+				if ((!had_buf && qc_mem_pressure(conn)) ||
+				    !quic_reasm_add(reasm, qel->rx.crypto.offset,
+				                    frm.crypto.offset, frm.crypto.data, frm.crypto.len)) {
+					TRACE_DEVEL("CRYPTO data buffering failed",
 					            QUIC_EV_CONN_PRSHPKT, ctx->conn);
 					goto err;
 				}
-
-				cf->offset_node.key = frm.crypto.offset;
-				cf->len = frm.crypto.len;
-				cf->data = frm.crypto.data;
-				cf->pkt = pkt;
-				eb64_insert(&qel->rx.crypto.frms, &cf->offset_node);
-				quic_rx_packet_refinc(pkt);
+				if (!had_buf && reasm->buf)
+					qc_mem_add(conn, sizeof *reasm->buf);
 			}
 			else {
 				/* XXX TO DO: <cf> is used only for the traces. */
@@ -1825,6 +3104,7 @@ static int qc_parse_pkt_frms(struct quic_rx_packet *pkt, struct quic_conn_ctx *c
 			}
 			break;
 		case QUIC_FT_ACK:
+		case QUIC_FT_ACK_ECN:
 		{
 			unsigned int rtt_sample;
 
@@ -1839,6 +3119,7 @@ static int qc_parse_pkt_frms(struct quic_rx_packet *pkt, struct quic_conn_ctx *c
 					MS_TO_TICKS(min(quic_ack_delay_ms(&frm.ack, conn), conn->max_ack_delay));
 				quic_loss_srtt_update(&conn->path->loss, rtt_sample, ack_delay, conn);
 			}
+			quic_qlog_metrics_updated(conn);
 			ack_received = 1;
 			tasklet_wakeup(ctx->wait_event.tasklet);
 			break;
@@ -1849,16 +3130,110 @@ static int qc_parse_pkt_frms(struct quic_rx_packet *pkt, struct quic_conn_ctx *c
 		case QUIC_FT_CONNECTION_CLOSE:
 		case QUIC_FT_CONNECTION_CLOSE_APP:
 			break;
-		case QUIC_FT_NEW_CONNECTION_ID:
-		case QUIC_FT_STREAM_A:
-		case QUIC_FT_STREAM_B:
+		case QUIC_FT_STREAM_8 ... QUIC_FT_STREAM_F:
+			/* As for TLS over TCP, mark the connection as having received
+			 * early data until the handshake completes so that the
+			 * "wait-for-handshake" action and "ssl_fc_has_early" apply.
+			 */
+			if (pkt->type == QUIC_PACKET_TYPE_0RTT && ctx->state < QUIC_HS_ST_COMPLETE)
+				ctx->conn->flags |= CO_FL_EARLY_DATA | CO_FL_EARLY_SSL_HS;
+			if (qc_has_mux(ctx->conn) &&
+			    !qcc_recv_stream(ctx->conn, frm.stream.id,
+			                     (frm.type & QUIC_STREAM_FRAME_OFF_BIT) ? frm.stream.offset : 0,
+			                     frm.stream.data, frm.stream.len,
+			                     frm.type & QUIC_STREAM_FRAME_FIN_BIT)) {
+				TRACE_PROTO("STREAM frame not accepted", QUIC_EV_CONN_PRSHPKT, ctx->conn, pkt);
+				goto err;
+			}
 			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
 			break;
-		case QUIC_FT_HANDSHAKE_DONE:
-			if (objt_listener(ctx->conn->target))
+		case QUIC_FT_RESET_STREAM:
+			if (qc_has_mux(ctx->conn) &&
+			    !qcc_recv_reset_stream(ctx->conn, frm.reset_stream.id,
+			                           frm.reset_stream.final_size))
+				goto err;
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_MAX_DATA:
+			if (qc_has_mux(ctx->conn))
+				qcc_recv_max_data(ctx->conn, frm.max_data.max_data);
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_MAX_STREAM_DATA:
+			if (qc_has_mux(ctx->conn) &&
+			    !qcc_recv_max_stream_data(ctx->conn, frm.max_stream_data.id,
+			                              frm.max_stream_data.max_stream_data))
+				goto err;
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_MAX_STREAMS_BIDI:
+		case QUIC_FT_MAX_STREAMS_UNI:
+			if (qc_has_mux(ctx->conn))
+				qcc_recv_max_streams(ctx->conn, frm.max_streams_bidi.max_streams,
+				                     frm.type == QUIC_FT_MAX_STREAMS_UNI);
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_STOP_SENDING:
+		case QUIC_FT_DATA_BLOCKED:
+		case QUIC_FT_STREAM_DATA_BLOCKED:
+		case QUIC_FT_STREAMS_BLOCKED_BIDI:
+		case QUIC_FT_STREAMS_BLOCKED_UNI:
+		case QUIC_FT_NEW_CONNECTION_ID:
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_PATH_CHALLENGE:
+		{
+			struct quic_frame *qf;
+
+			qf = pool_alloc(pool_head_quic_frame);
+			if (!qf)
+				goto err;
+
+			qf->type = QUIC_FT_PATH_RESPONSE;
+			memcpy(qf->path_challenge_response.data, frm.path_challenge.data,
+			       sizeof qf->path_challenge_response.data);
+			LIST_ADDQ(&conn->tx.frms_to_send, &qf->list);
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		}
+		case QUIC_FT_PATH_RESPONSE:
+			if (conn->pv.prev &&
+			    !memcmp(frm.path_challenge_response.data, conn->pv.data, sizeof conn->pv.data)) {
+				TRACE_PROTO("path validated", QUIC_EV_CONN_PRSHPKT, ctx->conn, pkt);
+				conn->pv.prev = NULL;
+			}
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
+			break;
+		case QUIC_FT_HANDSHAKE_DONE:
+			if (objt_listener(ctx->conn->target))
 				goto err;
 
 			ctx->state = QUIC_HS_ST_CONFIRMED;
+			qc_release_hs(conn);
+			break;
+		case QUIC_FT_ACK_FREQUENCY:
+			/* Only allowed if we advertised our min_ack_delay, and
+			 * the ACK delay may not be updated below it.
+			 */
+			if (!conn->params.min_ack_delay ||
+			    frm.ack_frequency.max_ack_delay < conn->params.min_ack_delay) {
+				TRACE_PROTO("invalid ACK_FREQUENCY frame", QUIC_EV_CONN_PRSHPKT, ctx->conn, pkt);
+				goto err;
+			}
+
+			/* The frames received out of order are ignored. */
+			if (frm.ack_frequency.seq_num >= conn->rx.ack_freq_seq) {
+				conn->rx.ack_freq_seq = frm.ack_frequency.seq_num + 1;
+				conn->rx.ack_tolerance = frm.ack_frequency.pkt_tolerance > UINT_MAX ?
+					UINT_MAX : frm.ack_frequency.pkt_tolerance;
+				conn->rx.ack_delay = MS_TO_TICKS(min(frm.ack_frequency.max_ack_delay,
+				                                     (uint64_t)QUIC_TP_MAX_ACK_DELAY_LIMIT * 1000) / 1000);
+				if (frm.ack_frequency.ignore_order)
+					conn->flags |= QUIC_FL_CONN_ACK_IGNORE_ORDER;
+				else
+					conn->flags &= ~QUIC_FL_CONN_ACK_IGNORE_ORDER;
+			}
+			pkt->flags |= QUIC_FL_RX_PACKET_ACK_ELICITING;
 			break;
 		default:
 			goto err;
@@ -1885,19 +3260,50 @@ static int qc_parse_pkt_frms(struct quic_rx_packet *pkt, struct quic_conn_ctx *c
 	return 0;
 }
 
+/* Returns 1 if a handshake packet must be built at <qel> encryption level of
+ * <qc> QUIC connection: an ACK is required, datagrams must be sent upon PTO
+ * expiration, or CRYPTO data remain to be sent without reaching the in flight
+ * CRYPTO data limit. Returns 0 if not.
+ */
+static inline int qc_qel_tx_required(struct quic_conn *qc, struct quic_enc_level *qel)
+{
+	return (qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) ||
+		qc->tx.nb_pto_dgrams ||
+		(!LIST_ISEMPTY(&qel->pktns->tx.frms) &&
+		 qc->ifcdata < QUIC_CRYPTO_IN_FLIGHT_MAX);
+}
+
+/* Discard the Initial encryption keys of the client QUIC connection with <ctx>
+ * as I/O handler context as soon as a Handshake packet could be built.
+ */
+static inline void qc_client_hdshk_pkt_built(struct quic_conn_ctx *ctx)
+{
+	struct quic_conn *qc = ctx->conn->quic_conn;
+
+	if (ctx->state != QUIC_HS_ST_CLIENT_INITIAL)
+		return;
+
+	quic_tls_discard_keys(&qc->els[QUIC_TLS_ENC_LEVEL_INITIAL]);
+	quic_pktns_discard(qc->els[QUIC_TLS_ENC_LEVEL_INITIAL].pktns, qc);
+	qc_set_timer(ctx);
+	ctx->state = QUIC_HS_ST_CLIENT_HANDSHAKE;
+}
+
 /*
  * Prepare as much as possible handshake packets for the QUIC connection
- * with <ctx> as I/O handler context.
+ * with <ctx> as I/O handler context. Each datagram is made of one packet, or
+ * of an Initial packet followed by a Handshake packet when there is something
+ * to send at both levels. The datagrams carrying Initial packets which must be
+ * padded (all of them for a client, the ack-eliciting ones for a server) are
+ * padded once by their last packet, RFC 9000 14.1.
  * Returns 1 if succeeded, or 0 if something wrong happened.
  */
 static int qc_prep_hdshk_pkts(struct quic_conn_ctx *ctx)
 {
 	struct quic_conn *qc;
 	enum quic_tls_enc_level tel, next_tel;
-	struct quic_enc_level *qel;
+	struct quic_enc_level *qel, *next_qel;
 	struct q_buf *wbuf;
-	/* A boolean to flag <wbuf> as reusable, even if not empty. */
-	int reuse_wbuf;
 
 	TRACE_ENTER(QUIC_EV_CONN_PHPKTS, ctx->conn);
 	qc = ctx->conn->quic_conn;
@@ -1907,16 +3313,25 @@ static int qc_prep_hdshk_pkts(struct quic_conn_ctx *ctx)
 		goto err;
 	}
 
-	reuse_wbuf = 0;
 	wbuf = q_wbuf(qc);
 	qel = &qc->els[tel];
+	next_qel = &qc->els[next_tel];
 	/*
 	 * When entering this function, the writter buffer must be empty.
 	 * Most of the time it points to the reader buffer.
 	 */
-	while ((q_buf_empty(wbuf) || reuse_wbuf)) {
+	while (q_buf_empty(wbuf)) {
 		ssize_t ret;
 		enum quic_pkt_type pkt_type;
+		int padding, coalesce;
+
+		/* Select the next level when everything was sent at Initial level. */
+		if (tel == QUIC_TLS_ENC_LEVEL_INITIAL && !qc_qel_tx_required(qc, qel) &&
+		    (next_qel->tls_ctx.tx.flags & QUIC_FL_TLS_SECRETS_SET) &&
+		    qc_qel_tx_required(qc, next_qel)) {
+			tel = next_tel;
+			qel = next_qel;
+		}
 
 		TRACE_DEVEL("enc. level state", QUIC_EV_CONN_PHPKTS, ctx->conn, qel);
 		/* Do not build any more packet if no ACK are required
@@ -1924,21 +3339,37 @@ static int qc_prep_hdshk_pkts(struct quic_conn_ctx *ctx)
 		 * and if there is not more CRYPTO data available or in flight
 		 * CRYPTO data limit reached.
 		 */
-		if (!(qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) &&
-		    !qc->tx.nb_pto_dgrams &&
-		    (LIST_ISEMPTY(&qel->pktns->tx.frms) ||
-		     qc->ifcdata >= QUIC_CRYPTO_IN_FLIGHT_MAX)) {
+		if (!qc_qel_tx_required(qc, qel)) {
 			TRACE_DEVEL("nothing more to do",
 			            QUIC_EV_CONN_PHPKTS, ctx->conn);
-			/* Consume the buffer if we were supposed to reuse it. */
-			if (reuse_wbuf)
-					wbuf = q_next_wbuf(qc);
+			break;
+		}
+
+		/* Before the client address validation, a datagram is only
+		 * built if the anti-amplification budget allows it to be
+		 * padded. It is then filled with the ACK and the CRYPTO data
+		 * of the Initial packet first, the ServerHello, then with
+		 * those of the Handshake packet, up to this budget. The next
+		 * datagram from the client will wake us up.
+		 */
+		if (qc_amp_room(qc) < QUIC_INITIAL_PACKET_MINLEN) {
+			TRACE_DEVEL("anti-amplification limit reached",
+			            QUIC_EV_CONN_PHPKTS, ctx->conn);
+			qc->flags |= QUIC_FL_CONN_AMP_LIMITED;
 			break;
 		}
 
 		pkt_type = quic_tls_level_pkt_type(tel);
-		reuse_wbuf = 0;
-		ret = qc_build_hdshk_pkt(wbuf, qc, pkt_type, qel);
+		padding = coalesce = 0;
+		if (pkt_type == QUIC_PACKET_TYPE_INITIAL) {
+			padding = objt_server(qc->conn->target) ||
+				!LIST_ISEMPTY(&qel->pktns->tx.frms) || qel->pktns->tx.pto_probe;
+			/* A Handshake packet may follow this Initial packet. */
+			coalesce = (next_qel->tls_ctx.tx.flags & QUIC_FL_TLS_SECRETS_SET) &&
+				qc_qel_tx_required(qc, next_qel);
+		}
+
+		ret = qc_build_hdshk_pkt(wbuf, qc, pkt_type, qel, padding && !coalesce);
 		switch (ret) {
 		case -2:
 			goto err;
@@ -1948,42 +3379,33 @@ static int qc_prep_hdshk_pkts(struct quic_conn_ctx *ctx)
 			continue;
 		case 0:
 			goto out;
-		default:
-			/* Discard the Initial encryption keys as soon as
-			 * a handshake packet could be built.
-			 */
-			if (ctx->state == QUIC_HS_ST_CLIENT_INITIAL &&
-			    pkt_type == QUIC_PACKET_TYPE_HANDSHAKE) {
-				quic_tls_discard_keys(&qc->els[QUIC_TLS_ENC_LEVEL_INITIAL]);
-				quic_pktns_discard(qc->els[QUIC_TLS_ENC_LEVEL_INITIAL].pktns, qc);
-				qc_set_timer(ctx);
-				ctx->state = QUIC_HS_ST_CLIENT_HANDSHAKE;
-			}
-			/* Special case for Initial packets: when they have all
-			 * been sent, select the next level.
+		}
+
+		if (pkt_type == QUIC_PACKET_TYPE_HANDSHAKE)
+			qc_client_hdshk_pkt_built(ctx);
+
+		if (coalesce) {
+			/* This Handshake packet is the last one of the datagram
+			 * so it pads the datagram in place of the Initial packet.
+			 * If there is not enough room for it, the Initial packet
+			 * has already filled the datagram.
 			 */
-			if ((LIST_ISEMPTY(&qel->pktns->tx.frms) || qc->els[next_tel].pktns->tx.in_flight) &&
-			    tel == QUIC_TLS_ENC_LEVEL_INITIAL) {
-				tel = next_tel;
-				qel = &qc->els[tel];
-				if (LIST_ISEMPTY(&qel->pktns->tx.frms)) {
-					/* If there is no more data for the next level, let's
-					 * consume a buffer. This is the case for a client
-					 * which sends only one Initial packet, then wait
-					 * for additional CRYPTO data from the server to enter the
-					 * next level.
-					 */
-					wbuf = q_next_wbuf(qc);
-				}
-				else {
-					/* Let's try to reuse this buffer. */
-					reuse_wbuf = 1;
-				}
-			}
-			else {
-				wbuf = q_next_wbuf(qc);
-			}
+			ret = qc_build_hdshk_pkt(wbuf, qc, QUIC_PACKET_TYPE_HANDSHAKE,
+			                         next_qel, padding);
+			if (ret == -2)
+				goto err;
+
+			if (ret > 0)
+				qc_client_hdshk_pkt_built(ctx);
 		}
+
+		/* The Initial keys may have been discarded by a client. */
+		if (tel == QUIC_TLS_ENC_LEVEL_INITIAL &&
+		    ctx->state == QUIC_HS_ST_CLIENT_HANDSHAKE) {
+			tel = next_tel;
+			qel = next_qel;
+		}
+		wbuf = q_next_wbuf(qc);
 	}
 
  out:
@@ -1995,30 +3417,144 @@ static int qc_prep_hdshk_pkts(struct quic_conn_ctx *ctx)
 	return 0;
 }
 
+/* Return the ECN codepoint of the datagrams to be sent on <path>: ECT(0)
+ * while testing the path and after it has been validated.
+ */
+static inline unsigned char qc_ecn_codepoint(struct quic_path *path)
+{
+#ifdef QUIC_USE_ECN
+	if (path->ecn.state == QUIC_ECN_ST_TESTING || path->ecn.state == QUIC_ECN_ST_CAPABLE)
+		return QUIC_ECN_ECT0;
+#endif
+	return QUIC_ECN_NOT_ECT;
+}
+
+/* Callback called when the pacing delay of the datagrams of a QUIC
+ * connection has expired.
+ */
+static struct task *process_pacing(struct task *task, void *ctx, unsigned short state)
+{
+	struct quic_conn_ctx *conn_ctx = task->context;
+
+	task->expire = TICK_ETERNITY;
+	tasklet_wakeup(conn_ctx->wait_event.tasklet);
+
+	return task;
+}
+
+/* Wake up the I/O handler of <ctx> at <edt> departure date (us) of its next
+ * datagram, <now_us> being the current date.
+ * Return 1 if succeeded, 0 if not.
+ */
+static int qc_pacing_schedule(struct quic_conn_ctx *ctx, uint64_t edt, uint64_t now_us)
+{
+	struct quic_conn *qc = ctx->conn->quic_conn;
+	unsigned int delay;
+
+	if (!qc->pacing_task) {
+		qc->pacing_task = task_new(tid_bit);
+		if (!qc->pacing_task)
+			return 0;
+
+		qc->pacing_task->process = process_pacing;
+		qc->pacing_task->context = ctx;
+	}
+
+	/* The task timers have a millisecond resolution. */
+	delay = edt > now_us ? (edt - now_us + 999) / 1000 : 1;
+	task_schedule(qc->pacing_task, tick_add(now_ms, delay));
+
+	return 1;
+}
+
+/* Returns the type of the packets sent by <qc> in <pktns> packet number space. */
+static inline enum quic_pkt_type qc_pktns_pkt_type(const struct quic_conn *qc,
+                                                   const struct quic_pktns *pktns)
+{
+	if (pktns == &qc->pktns[QUIC_TLS_PKTNS_INITIAL])
+		return QUIC_PACKET_TYPE_INITIAL;
+	if (pktns == &qc->pktns[QUIC_TLS_PKTNS_HANDSHAKE])
+		return QUIC_PACKET_TYPE_HANDSHAKE;
+	return QUIC_PACKET_TYPE_SHORT;
+}
+
 /*
  * Send the QUIC packets which have been prepared for QUIC connections
- * with <ctx> as I/O handler context.
+ * with <ctx> as I/O handler context. The pacer of the path gives each
+ * datagram its departure date. The datagrams which may leave within the
+ * pacing horizon are passed at once to quic_conn_send_dgrams(), with their
+ * departure dates when the kernel paces them itself (SO_TXTIME). The
+ * I/O handler is woken up by the pacing task to send the remaining ones.
  */
 static int qc_send_ppkts(struct quic_conn_ctx *ctx)
 {
+	int i, nb, nb_paced, sent;
+	unsigned int time_sent;
+	unsigned char ecn;
+	uint64_t now_us, edt, horizon;
 	struct quic_conn *qc;
-	struct buffer tmpbuf = { };
-	struct q_buf *rbuf;
+	struct quic_path *path;
+	struct q_buf *bufs[QUIC_CONN_TX_BUFS_NB];
+	uint64_t edts[QUIC_CONN_TX_BUFS_NB];
+	uint64_t *txtimes = NULL;
+#ifdef QUIC_USE_TXTIME
+	uint64_t txtimes_ns[QUIC_CONN_TX_BUFS_NB];
+#endif
 
 	TRACE_ENTER(QUIC_EV_CONN_SPPKTS, ctx->conn);
 	qc = ctx->conn->quic_conn;
-	for (rbuf = q_rbuf(qc); !q_buf_empty(rbuf) ; rbuf = q_next_rbuf(qc)) {
-		struct quic_tx_packet *p, *q;
-		unsigned int time_sent;
+	path = qc->path;
+	for (nb = 0; nb < QUIC_CONN_TX_BUFS_NB; nb++) {
+		struct q_buf *buf;
+
+		buf = qc->tx.bufs[(qc->tx.rbuf + nb) & (QUIC_CONN_TX_BUFS_NB - 1)];
+		if (q_buf_empty(buf))
+			break;
+
+		bufs[nb] = buf;
+	}
+
+	if (!nb)
+		goto out;
 
-		tmpbuf.area = (char *)rbuf->area;
-		tmpbuf.size = tmpbuf.data = rbuf->data;
-	    if (ctx->xprt->snd_buf(qc->conn, qc->conn->xprt_ctx,
-	                           &tmpbuf, tmpbuf.data, 0) <= 0)
-		    break;
+	quic_pacer_update(&path->pacer, path);
+	now_us = quic_now_us();
+	horizon = now_us + QUIC_PACING_HORIZON;
+#ifdef QUIC_USE_TXTIME
+	if (path->pacer.rate && (global.tune.options & GTUNE_QUIC_TXTIME)) {
+		horizon = now_us + QUIC_PACING_TXTIME_HORIZON;
+		txtimes = txtimes_ns;
+	}
+#endif
+	edt = quic_pacer_edt(&path->pacer, now_us, path->mtu);
+	for (nb_paced = 0; nb_paced < nb && edt <= horizon; nb_paced++) {
+		edts[nb_paced] = edt;
+		edt += quic_pacer_tx_time(&path->pacer, bufs[nb_paced]->data);
+	}
+
+#ifdef QUIC_USE_TXTIME
+	if (txtimes) {
+		struct timespec ts;
+		uint64_t mono_ns;
+
+		/* The departure dates are given to the kernel on the monotonic clock. */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		mono_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		for (i = 0; i < nb_paced; i++)
+			txtimes[i] = edts[i] > now_us ? mono_ns + (edts[i] - now_us) * 1000 : mono_ns;
+	}
+#endif
+
+	ecn = qc_ecn_codepoint(path);
+	sent = nb_paced ? quic_conn_send_dgrams(qc->conn, bufs, nb_paced, txtimes, ecn) : 0;
+	time_sent = now_ms;
+	for (i = 0; i < sent; i++) {
+		struct q_buf *rbuf = bufs[i];
+		struct quic_tx_packet *p, *q;
+		uint64_t time_sent_us = edts[i] > now_us ? edts[i] : now_us;
 
-		qc->tx.bytes += tmpbuf.data;
-		time_sent = now_ms;
+		qc->tx.bytes += rbuf->data;
+		path->pacer.next = edts[i] + quic_pacer_tx_time(&path->pacer, rbuf->data);
 		/* Reset this buffer to make it available for the next packet to prepare. */
 		q_buf_reset(rbuf);
 		/* Remove from <rbuf> the packets which have just been sent. */
@@ -2026,19 +3562,312 @@ static int qc_send_ppkts(struct quic_conn_ctx *ctx)
 			p->time_sent = time_sent;
 			if (p->flags & QUIC_FL_TX_PACKET_ACK_ELICITING) {
 				p->pktns->tx.time_of_last_eliciting = time_sent;
-				qc->path->in_flight_ae_pkts++;
+				path->in_flight_ae_pkts++;
 			}
 			TRACE_PROTO("sent pkt", QUIC_EV_CONN_SPPKTS, ctx->conn, p);
-			qc->path->in_flight += p->in_flight_len;
+			/* Delivery rate sampling: a new sampling interval starts
+			 * when there is nothing in flight.
+			 */
+			if (!path->in_flight)
+				path->first_sent_time = path->delivered_time = time_sent_us;
+			p->time_sent_us = time_sent_us;
+			p->delivered = path->delivered;
+			p->delivered_time = path->delivered_time;
+			p->first_sent_time = path->first_sent_time;
+			if (path->app_limited)
+				p->flags |= QUIC_FL_TX_PACKET_APP_LIMITED;
+			if (ecn == QUIC_ECN_ECT0) {
+				p->flags |= QUIC_FL_TX_PACKET_ECT0;
+				if (path->ecn.state == QUIC_ECN_ST_TESTING &&
+				    ++path->ecn.nb_test_pkts >= QUIC_ECN_TESTING_PKTS)
+					path->ecn.state = QUIC_ECN_ST_UNKNOWN;
+			}
+			path->in_flight += p->in_flight_len;
 			p->pktns->tx.in_flight += p->in_flight_len;
 			if (p->in_flight_len)
 				qc_set_timer(ctx);
 			LIST_DEL(&p->list);
+			quic_qlog_packet_sent(qc, qc_pktns_pkt_type(qc, p->pktns),
+			                      p->pn_node.key, p->len);
+			qc->tx.pkts++;
+			qc_counters_add(qc, tx_pkts, 1);
 		}
+		q_next_rbuf(qc);
+	}
+
+	if (nb_paced < nb && sent == nb_paced) {
+		/* Delayed by the pacing. */
+		if (!qc_pacing_schedule(ctx, edt, now_us))
+			goto err;
+	}
+	else if (sent == nb && path->in_flight < path->cwnd) {
+		/* Everything prepared was sent without filling the congestion
+		 * window: the following delivery rate samples are application
+		 * limited until this data is acknowledged.
+		 */
+		path->app_limited = (path->delivered + path->in_flight) ? : 1;
 	}
+
+ out:
 	TRACE_LEAVE(QUIC_EV_CONN_SPPKTS, ctx->conn);
 
 	return 1;
+
+ err:
+	TRACE_DEVEL("leaving in error", QUIC_EV_CONN_SPPKTS, ctx->conn);
+	return 0;
+}
+
+/* Compute into <hmac> the truncated HMAC-SHA256 of the <len> bytes of <token>
+ * followed by the address of <saddr>, and by its port if <with_port> is set.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int quic_token_hmac(unsigned char *hmac, const unsigned char *token, size_t len,
+                           struct sockaddr_storage *saddr, int with_port)
+{
+	unsigned char data[QUIC_TOKEN_MAXLEN + sizeof(struct in6_addr) + sizeof(in_port_t)];
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int mdlen;
+	void *addr, *port;
+	size_t addr_len;
+
+	if (is_sa_family_ipv6(saddr)) {
+		addr = &((struct sockaddr_in6 *)saddr)->sin6_addr;
+		port = &((struct sockaddr_in6 *)saddr)->sin6_port;
+		addr_len = sizeof ((struct sockaddr_in6 *)saddr)->sin6_addr;
+	}
+	else {
+		addr = &((struct sockaddr_in *)saddr)->sin_addr;
+		port = &((struct sockaddr_in *)saddr)->sin_port;
+		addr_len = sizeof ((struct sockaddr_in *)saddr)->sin_addr;
+	}
+
+	memcpy(data, token, len);
+	memcpy(data + len, addr, addr_len);
+	len += addr_len;
+	if (with_port) {
+		memcpy(data + len, port, sizeof(in_port_t));
+		len += sizeof(in_port_t);
+	}
+
+	if (!HMAC(EVP_sha256(), quic_token_key, sizeof quic_token_key,
+	          data, len, md, &mdlen))
+		return 0;
+
+	memcpy(hmac, md, QUIC_TOKEN_HMAC_LEN);
+	return 1;
+}
+
+/* Build into <buf>, which must be at least QUIC_TOKEN_MAXLEN bytes long, an
+ * address validation token with <type> as type for <saddr> client address.
+ * <odcid> of <odcid_len> bytes is the original destination connection ID
+ * to be stored into Retry tokens. The port is only bound to the Retry tokens,
+ * the NEW_TOKEN ones being used for the next connections.
+ * Returns the length of the token if succeeded, 0 if not.
+ */
+static size_t quic_token_build(unsigned char *buf, int type,
+                               const unsigned char *odcid, unsigned char odcid_len,
+                               struct sockaddr_storage *saddr)
+{
+	unsigned char *pos = buf;
+	const unsigned char *end = buf + QUIC_TOKEN_MAXLEN;
+
+	*pos++ = type;
+	quic_write_uint32(&pos, end, now.tv_sec);
+	if (type == QUIC_TOKEN_TYPE_RETRY) {
+		*pos++ = odcid_len;
+		memcpy(pos, odcid, odcid_len);
+		pos += odcid_len;
+	}
+
+	if (!quic_token_hmac(pos, buf, pos - buf, saddr, type == QUIC_TOKEN_TYPE_RETRY))
+		return 0;
+
+	return pos + QUIC_TOKEN_HMAC_LEN - buf;
+}
+
+/* Check <token> address validation token of <len> bytes received from <saddr>
+ * client address. The original destination connection ID of the Retry tokens
+ * is copied into <odcid>.
+ * Returns the type of the token if valid, -1 if not.
+ */
+static int quic_token_check(const unsigned char *token, size_t len,
+                            struct sockaddr_storage *saddr, struct quic_cid *odcid)
+{
+	const unsigned char *pos = token, *end = token + len;
+	unsigned char hmac[QUIC_TOKEN_HMAC_LEN];
+	uint32_t ts, timeout;
+	int type;
+
+	if (len < 1 + 4 + QUIC_TOKEN_HMAC_LEN)
+		return -1;
+
+	type = *pos++;
+	quic_read_uint32(&ts, &pos, end);
+	if (type == QUIC_TOKEN_TYPE_RETRY) {
+		odcid->len = *pos++;
+		if (odcid->len > QUIC_CID_MAXLEN || end - pos != odcid->len + QUIC_TOKEN_HMAC_LEN)
+			return -1;
+
+		memcpy(odcid->data, pos, odcid->len);
+		pos += odcid->len;
+		timeout = QUIC_RETRY_TOKEN_TIMEOUT;
+	}
+	else if (type == QUIC_TOKEN_TYPE_NEW_TOKEN) {
+		if (end - pos != QUIC_TOKEN_HMAC_LEN)
+			return -1;
+
+		timeout = QUIC_NEW_TOKEN_TIMEOUT;
+	}
+	else
+		return -1;
+
+	/* Also rejects the timestamps in the future. */
+	if ((uint32_t)now.tv_sec - ts > timeout)
+		return -1;
+
+	if (!quic_token_hmac(hmac, token, pos - token, saddr, type == QUIC_TOKEN_TYPE_RETRY) ||
+	    CRYPTO_memcmp(hmac, pos, QUIC_TOKEN_HMAC_LEN) != 0)
+		return -1;
+
+	return type;
+}
+
+/* Returns 1 if the address of the clients opening new connections must be
+ * validated by a Retry, depending on the rate of such Initial packets, 0 if not.
+ */
+static inline int quic_retry_required(void)
+{
+	if (quic_retry_threshold < 0)
+		return 0;
+
+	update_freq_ctr(&quic_initial_freq, 1);
+	return read_freq_ctr(&quic_initial_freq) > quic_retry_threshold;
+}
+
+/* Send from <fd> to <saddr> a Retry packet in response to <qpkt> Initial packet
+ * whose destination connection ID, without the concatenated address, is
+ * <odcid_len> bytes long. Nothing is stored: the original destination
+ * connection ID is retrieved from the token of the next Initial packet.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int qc_send_retry(int fd, struct sockaddr_storage *saddr,
+                         struct quic_rx_packet *qpkt, unsigned char odcid_len)
+{
+	unsigned char buf[QUIC_PACKET_MAXLEN];
+	unsigned char *pos = buf;
+	const unsigned char *end = buf + sizeof buf;
+	unsigned char scid[QUIC_CID_LEN];
+	size_t toklen;
+
+	TRACE_ENTER(QUIC_EV_CONN_LPKT);
+	if (RAND_bytes(scid, sizeof scid) != 1)
+		goto err;
+
+	/* Keep the connection on this thread (see quic_cid_tid()). */
+	scid[0] = tid;
+	*pos++ = QUIC_PACKET_FIXED_BIT | QUIC_PACKET_LONG_HEADER_BIT |
+		(QUIC_PACKET_TYPE_RETRY << QUIC_PACKET_TYPE_SHIFT);
+	quic_write_uint32(&pos, end, qpkt->version);
+	*pos++ = qpkt->scid.len;
+	memcpy(pos, qpkt->scid.data, qpkt->scid.len);
+	pos += qpkt->scid.len;
+	*pos++ = sizeof scid;
+	memcpy(pos, scid, sizeof scid);
+	pos += sizeof scid;
+
+	toklen = quic_token_build(pos, QUIC_TOKEN_TYPE_RETRY, qpkt->dcid.data, odcid_len, saddr);
+	if (!toklen)
+		goto err;
+
+	pos += toklen;
+	if (!quic_tls_retry_integrity_tag(buf, pos - buf, qpkt->dcid.data, odcid_len))
+		goto err;
+
+	pos += QUIC_TLS_TAG_LEN;
+	if (sendto(fd, buf, pos - buf, MSG_DONTWAIT | MSG_NOSIGNAL,
+	           (struct sockaddr *)saddr, get_addr_len(saddr)) < 0)
+		goto err;
+
+	TRACE_LEAVE(QUIC_EV_CONN_LPKT);
+	return 1;
+
+ err:
+	TRACE_DEVEL("leaving in error", QUIC_EV_CONN_LPKT);
+	return 0;
+}
+
+/* Derive into <token> the stateless reset token of the <cid> connection ID of
+ * <cidlen> bytes. This is the truncated HMAC of this connection ID so that no
+ * state is required to send a stateless reset for it.
+ * Returns 1 if succeeded, 0 if not.
+ */
+int quic_stateless_reset_token_build(unsigned char *token,
+                                     const unsigned char *cid, size_t cidlen)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int mdlen;
+
+	if (!HMAC(EVP_sha256(), quic_sreset_key, sizeof quic_sreset_key,
+	          cid, cidlen, md, &mdlen))
+		return 0;
+
+	memcpy(token, md, QUIC_STATELESS_RESET_TOKEN_LEN);
+	return 1;
+}
+
+/* Returns 1 if a stateless reset may be sent, depending on the rate of those
+ * already sent, 0 if not.
+ */
+static inline int quic_stateless_reset_allowed(void)
+{
+	if (read_freq_ctr(&quic_sreset_freq) >= quic_sreset_rate)
+		return 0;
+
+	update_freq_ctr(&quic_sreset_freq, 1);
+	return 1;
+}
+
+/* Send from <fd> to <saddr> a stateless reset in response to the <pkt> short
+ * header packet of <len> bytes whose destination connection ID is unknown.
+ * The stateless reset must be shorter than this packet so that two endpoints
+ * never loop on them (RFC 9000 10.3.3), so nothing is sent for packets too
+ * short to be answered with the minimum stateless reset length.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int qc_send_stateless_reset(int fd, struct sockaddr_storage *saddr,
+                                   const unsigned char *pkt, size_t len)
+{
+	unsigned char buf[QUIC_STATELESS_RESET_PACKET_MAXLEN];
+	size_t rlen;
+
+	TRACE_ENTER(QUIC_EV_CONN_LPKT);
+	if (len <= QUIC_STATELESS_RESET_PACKET_MINLEN || !quic_stateless_reset_allowed())
+		goto err;
+
+	rlen = len - 1;
+	if (rlen > sizeof buf)
+		rlen = sizeof buf;
+
+	/* Unpredictable bits, then the token, looking like a short header packet. */
+	if (RAND_bytes(buf, rlen - QUIC_STATELESS_RESET_TOKEN_LEN) != 1)
+		goto err;
+
+	buf[0] = (buf[0] & ~QUIC_PACKET_LONG_HEADER_BIT) | QUIC_PACKET_FIXED_BIT;
+	if (!quic_stateless_reset_token_build(buf + rlen - QUIC_STATELESS_RESET_TOKEN_LEN,
+	                                      pkt + 1, QUIC_CID_LEN))
+		goto err;
+
+	if (sendto(fd, buf, rlen, MSG_DONTWAIT | MSG_NOSIGNAL,
+	           (struct sockaddr *)saddr, get_addr_len(saddr)) < 0)
+		goto err;
+
+	TRACE_LEAVE(QUIC_EV_CONN_LPKT);
+	return 1;
+
+ err:
+	TRACE_DEVEL("leaving in error", QUIC_EV_CONN_LPKT);
+	return 0;
 }
 
 /*
@@ -2050,6 +3879,7 @@ static int qc_send_ppkts(struct quic_conn_ctx *ctx)
 static int quic_build_post_handshake_frames(struct quic_conn *conn)
 {
 	int i;
+	size_t toklen;
 	struct quic_frame *frm;
 
 	/* Only servers must send a HANDSHAKE_DONE frame. */
@@ -2057,6 +3887,20 @@ static int quic_build_post_handshake_frames(struct quic_conn *conn)
 		frm = pool_alloc(pool_head_quic_frame);
 		frm->type = QUIC_FT_HANDSHAKE_DONE;
 		LIST_ADDQ(&conn->tx.frms_to_send, &frm->list);
+
+		/* A token to validate the address of the next connections. */
+		toklen = quic_token_build(conn->token, QUIC_TOKEN_TYPE_NEW_TOKEN,
+		                          NULL, 0, conn->conn->dst);
+		if (toklen) {
+			frm = pool_alloc(pool_head_quic_frame);
+			if (!frm)
+				goto err;
+
+			frm->type = QUIC_FT_NEW_TOKEN;
+			frm->new_token.len = toklen;
+			frm->new_token.data = conn->token;
+			LIST_ADDQ(&conn->tx.frms_to_send, &frm->list);
+		}
 	}
 
 	for (i = 1; i < conn->rx_tps.active_connection_id_limit; i++) {
@@ -2079,228 +3923,26 @@ static int quic_build_post_handshake_frames(struct quic_conn *conn)
 	return 0;
 }
 
-/* Deallocate <l> list of ACK ranges. */
-void free_ack_range_list(struct list *l)
+/* Release the packets of <el> encryption level which are still waiting for
+ * their header protection to be removed.
+ */
+static inline void qc_rx_pqpkts_flush(struct quic_enc_level *el)
 {
-	struct quic_ack_range *curr, *next;
-
-	list_for_each_entry_safe(curr, next, l, list) {
-		LIST_DEL(&curr->list);
-		free(curr);
-	}
-}
+	struct quic_rx_packet *pqpkt, *qqpkt;
 
-/* Return the gap value between <p> and <q> ACK ranges. */
-static inline size_t sack_gap(struct quic_ack_range *p,
-                              struct quic_ack_range *q)
-{
-	return p->first - q->last - 2;
+	list_for_each_entry_safe(pqpkt, qqpkt, &el->rx.pqpkts, list)
+		quic_rx_packet_list_del(pqpkt);
 }
 
-
 /*
- * Remove the last elements of <ack_ranges> list of ack range updating its
- * encoded size until it goes below <limit>.
- * Returns 1 if succeded, 0 if not (no more element to remove).
+ * Remove the header protection of packets at <el> encryption level.
+ * Always succeeds.
  */
-static int quic_rm_last_ack_ranges(struct quic_ack_ranges *qars, size_t limit)
+static inline void qc_rm_hp_pkts(struct quic_enc_level *el, struct quic_conn_ctx *ctx)
 {
-	struct list *l = &qars->list;
-	struct quic_ack_range *last, *prev_last;
-
-	last = LIST_PREV(l, struct quic_ack_range *, list);
-	while (qars->enc_sz > limit) {
-		if (l->n == l)
-			return 0;
-
-		prev_last = LIST_PREV(&last->list, struct quic_ack_range *, list);
-		if (prev_last == last)
-			return 0;
-
-		qars->enc_sz -= quic_int_getsize(last->last - last->first);
-		qars->enc_sz -= quic_int_getsize(sack_gap(prev_last, last));
-		qars->enc_sz -= quic_decint_size_diff(qars->sz);
-		--qars->sz;
-		LIST_DEL(&last->list);
-		pool_free(pool_head_quic_ack_range, last);
-		last = prev_last;
-	}
-
-	return 1;
-}
-
-/*
- * Update <l> list of ACK ranges with <pn> new packet number.
- * Note that this function computes the number of bytes required to encode
- * this list without taking into an account ->ack_delay member field.
- *
- *    Descending order
- *    ------------->
- *                range1                  range2
- *    ..........|--------|..............|--------|
- *              ^        ^              ^        ^
- *              |        |              |        |
- *            last1     first1        last2    first2
- *    ..........+--------+--------------+--------+......
- *                 diff1       gap12       diff2
- *
- * To encode the previous list of ranges we must encode integers as follows:
- *          enc(last1),enc(diff1),enc(gap12),enc(diff2)
- *  with diff1 = last1 - first1
- *       diff2 = last2 - first2
- *       gap12 = first1 - last2 - 2
- *
- * To update this encoded list, we must considered 4 cases:
- *    ->last is incremented by 1, the previous gap, if any, must be decremented by one,
- *    ->first is decremented by 1, the next gap, if any, must be decremented by one,
- *    in both previous cases <diff> value is increment by 1.
- *    -> a new range is inserted between two others, <diff>=0 (1 byte),
- *    and a gap is splitted in two other gaps, and the size of the list is incremented
- *    by 1.
- *    -> two ranges are merged.
- */
-int quic_update_ack_ranges_list(struct quic_ack_ranges *ack_ranges, int64_t pn)
-{
-	struct list *l = &ack_ranges->list;
-	size_t *sz = &ack_ranges->sz;
-	size_t *enc_sz = &ack_ranges->enc_sz;
-
-	struct quic_ack_range *curr, *prev, *next;
-	struct quic_ack_range *new_sack;
-
-	prev = NULL;
-
-	if (LIST_ISEMPTY(l)) {
-		/* Range insertion. */
-		new_sack = pool_alloc(pool_head_quic_ack_range);
-		if (!new_sack)
-			return 0;
-
-		new_sack->first = new_sack->last = pn;
-		LIST_ADD(l, &new_sack->list);
-		/* Add the size of this new encoded range and the
-		 * encoded number of ranges in this list after the first one
-		 * which is 0 (1 byte).
-		 */
-		*enc_sz += quic_int_getsize(pn) + 2;
-		++*sz;
-		return 1;
-	}
-
-	list_for_each_entry_safe(curr, next, l, list) {
-		/* Already existing packet number */
-		if (pn >= curr->first && pn <= curr->last)
-			break;
-
-		if (pn > curr->last + 1) {
-			/* Range insertion befor <curr> */
-			new_sack = pool_alloc(pool_head_quic_ack_range);
-			if (!new_sack)
-				return 0;
-
-			new_sack->first = new_sack->last = pn;
-			/* Add the size of this new encoded range and possibly
-			 * increment by 1 the encoded number of ranges in this list.
-			 */
-			*enc_sz += quic_int_getsize(pn) + 1 + quic_incint_size_diff(*sz);
-			/* Deduce the previous largest number acked. */
-			*enc_sz -= quic_int_getsize(curr->last);
-			if (prev) {
-				/* Insert <new_sack> after <prev>, before <curr>. */
-				new_sack->list.n = &curr->list;
-				new_sack->list.p = &prev->list;
-				prev->list.n = curr->list.p = &new_sack->list;
-				/* Deduce the previous gap encoding size.
-				 * Add thew new gaps between <prev> and <new_sack> and
-				 * between <new_sack> and <curr>.
-				 */
-				*enc_sz += quic_int_getsize(sack_gap(prev, new_sack)) +
-					quic_int_getsize(sack_gap(new_sack, curr)) -
-					quic_int_getsize(sack_gap(prev, curr));
-			}
-			else {
-				LIST_ADD(l, &new_sack->list);
-				/* Add the encoded size of the new gap betwen <new_sack> and <cur>. */
-				*enc_sz += quic_int_getsize(sack_gap(new_sack, curr));
-			}
-			++*sz;
-			break;
-		}
-		else if (curr->last + 1 == pn) {
-			/* Increment the encoded size of <curr> diff by 1. */
-			*enc_sz += quic_incint_size_diff(curr->last - curr->first);
-			if (prev) {
-				/* Decrement the encoded size of the previous gap by 1. */
-				*enc_sz -= quic_decint_size_diff(sack_gap(prev, curr));
-			}
-			else {
-				/* Increment the encode size of the largest acked packet number. */
-				*enc_sz += quic_incint_size_diff(curr->last);
-			}
-			curr->last = pn;
-			break;
-		}
-		else if (curr->first == pn + 1) {
-			if (&next->list != l && pn == next->last + 1) {
-				/* Two ranges <curr> and <next> are merged.
-				 * Dedude the encoded size of <curr> diff. */
-				*enc_sz -= quic_int_getsize(curr->last - curr->first);
-				/* Deduce the encoded size of the gap between <curr> and <next>. */
-				*enc_sz -= quic_int_getsize(sack_gap(curr, next));
-				/* Deduce the encode size of <next> diff. */
-				*enc_sz -= quic_int_getsize(next->last - next->first);
-				/* Add the new encoded size diff between curr->last and
-				 * next->first.
-				 */
-				*enc_sz += quic_int_getsize(curr->last - next->first);
-				next->last = curr->last;
-				LIST_DEL(&curr->list);
-				pool_free(pool_head_quic_ack_range, curr);
-				/* Possibly decrement the encoded size of this list
-				 * which is decremented by 1
-				 */
-				*enc_sz -= quic_decint_size_diff(*sz);
-				--*sz;
-			}
-			else {
-				/* Increment the encoded size of <curr> diff by 1. */
-				*enc_sz += quic_incint_size_diff(curr->last - curr->first);
-				/* Decrement the encoded size of the next gap by 1. */
-				if (&next->list != l)
-					*enc_sz -= quic_decint_size_diff(sack_gap(curr, next));
-				curr->first = pn;
-			}
-			break;
-		}
-		else if (&next->list == l) {
-			new_sack = pool_alloc(pool_head_quic_ack_range);
-			if (!new_sack)
-				return 0;
-
-			new_sack->first = new_sack->last = pn;
-			/* We only have to add the encoded size of the gap between <curr>
-			 * and <new_sack> and <new_sack> diff (0).
-			 */
-			*enc_sz += quic_int_getsize(sack_gap(curr, new_sack)) + 1;
-			LIST_ADDQ(l, &new_sack->list);
-			++*sz;
-			break;
-		}
-		prev = curr;
-	}
-
-	return 1;
-}
-
-/*
- * Remove the header protection of packets at <el> encryption level.
- * Always succeeds.
- */
-static inline void qc_rm_hp_pkts(struct quic_enc_level *el, struct quic_conn_ctx *ctx)
-{
-	struct quic_tls_ctx *tls_ctx;
-	struct quic_rx_packet *pqpkt, *qqpkt;
-	struct quic_enc_level *app_qel;
+	struct quic_tls_ctx *tls_ctx;
+	struct quic_rx_packet *pqpkt, *qqpkt;
+	struct quic_enc_level *app_qel;
 
 	TRACE_ENTER(QUIC_EV_CONN_ELRMHP, ctx->conn);
 	app_qel = &ctx->conn->quic_conn->els[QUIC_TLS_ENC_LEVEL_APP];
@@ -2340,25 +3982,20 @@ static inline void qc_rm_hp_pkts(struct quic_enc_level *el, struct quic_conn_ctx
 static inline int qc_treat_rx_crypto_frms(struct quic_enc_level *el,
                                           struct quic_conn_ctx *ctx)
 {
-	struct eb64_node *node;
+	const unsigned char *data;
+	size_t len;
 
 	TRACE_ENTER(QUIC_EV_CONN_RXCDATA, ctx->conn);
-	node = eb64_first(&el->rx.crypto.frms);
-	while (node) {
-		struct quic_rx_crypto_frm *cf;
-
-		cf = eb64_entry(&node->node, struct quic_rx_crypto_frm, offset_node);
-		if (cf->offset_node.key != el->rx.crypto.offset)
-			break;
+	while ((data = quic_reasm_get(&el->rx.crypto.reasm, el->rx.crypto.offset, &len))) {
+		uint64_t base = el->rx.crypto.offset;
 
-		HEXDUMP(cf->data, cf->len, "CRYPTO frame:\n");
-		if (!qc_provide_cdata(el, ctx, cf->data, cf->len, cf->pkt, cf))
+		HEXDUMP(data, len, "CRYPTO data:\n");
+		if (!qc_provide_cdata(el, ctx, data, len, NULL, NULL))
 			goto err;
 
-		node = eb64_next(node);
-		quic_rx_packet_refdec(cf->pkt);
-		eb64_delete(&cf->offset_node);
-		pool_free(pool_head_quic_rx_crypto_frm, cf);
+		quic_reasm_del(&el->rx.crypto.reasm, base, len);
+		if (!el->rx.crypto.reasm.buf)
+			qc_mem_sub(ctx->conn->quic_conn, sizeof(struct quic_reasm_buf));
 	}
 
 	TRACE_LEAVE(QUIC_EV_CONN_RXCDATA, ctx->conn);
@@ -2373,19 +4010,66 @@ static inline int qc_treat_rx_crypto_frms(struct quic_enc_level *el,
  * Process all the packets at <el> encryption level.
  * Return 1 if succeeded, 0 if not.
  */
+/* Accounts <pkt> ack-eliciting packet received by <qc> in its <pktns> packet
+ * number space. An ACK is required at once for the Initial and Handshake
+ * packets, for the reordered packets unless the peer asked us to ignore them,
+ * and when the ACK tolerance is reached. Otherwise the ACK is delayed by the
+ * ACK delay, the ACK delay timer being armed for the first packet.
+ */
+static inline void qc_rx_ack_eliciting(struct quic_conn *qc, struct quic_pktns *pktns,
+                                       struct quic_rx_packet *pkt)
+{
+	pktns->rx.nb_ack_eliciting++;
+	if (!quic_application_pktns(pktns, qc) ||
+	    pktns->rx.nb_ack_eliciting >= qc->rx.ack_tolerance ||
+	    (!(qc->flags & QUIC_FL_CONN_ACK_IGNORE_ORDER) && pkt->pn != pktns->rx.largest_pn + 1)) {
+		pktns->flags |= QUIC_FL_PKTNS_ACK_REQUIRED;
+		return;
+	}
+
+	if (tick_isset(qc->rx.ack_expire) || (pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED))
+		return;
+
+	/* Our advertised max_ack_delay, unless updated by an ACK_FREQUENCY frame. */
+	qc->rx.ack_expire = tick_add(now_ms, qc->rx.ack_delay ? qc->rx.ack_delay :
+	                             MS_TO_TICKS(qc->params.max_ack_delay));
+	qc_timer_update(qc);
+}
+
+/* Resets the delayed ACK state of <pktns> packet number space of <qc> after
+ * an ACK frame was built for it.
+ */
+static inline void qc_pktns_ack_sent(struct quic_conn *qc, struct quic_pktns *pktns)
+{
+	pktns->flags &= ~QUIC_FL_PKTNS_ACK_REQUIRED;
+	pktns->rx.nb_ack_eliciting = 0;
+	if (quic_application_pktns(pktns, qc))
+		qc->rx.ack_expire = TICK_ETERNITY;
+}
+
 static inline int qc_treat_rx_pkts(struct quic_enc_level *el, struct quic_conn_ctx *ctx)
 {
 	struct quic_tls_ctx *tls_ctx;
 	struct eb64_node *node;
+	struct quic_rx_packet *pkts[QUIC_TLS_DEC_BATCH];
+	int ok[QUIC_TLS_DEC_BATCH];
+	int nb, idx;
 
 	TRACE_ENTER(QUIC_EV_CONN_ELRXPKTS, ctx->conn);
 	tls_ctx = &el->tls_ctx;
 	node = eb64_first(&el->rx.pkts);
-	while (node) {
+	nb = idx = 0;
+	while (idx < nb || node) {
 		struct quic_rx_packet *pkt;
 
-		pkt = eb64_entry(&node->node, struct quic_rx_packet, pn_node);
-		if (!qc_pkt_decrypt(pkt, tls_ctx)) {
+		/* Decrypt the next batch of packets once the previous one was parsed. */
+		if (idx == nb) {
+			nb = qc_pkts_decrypt(&node, pkts, ok, tls_ctx, ctx->conn->quic_conn);
+			idx = 0;
+		}
+
+		pkt = pkts[idx];
+		if (!ok[idx++]) {
 			/* Drop the packet */
 			TRACE_PROTO("packet decryption failed -> dropped",
 						QUIC_EV_CONN_ELRXPKTS, ctx->conn, pkt);
@@ -2394,7 +4078,10 @@ static inline int qc_treat_rx_pkts(struct quic_enc_level *el, struct quic_conn_c
 			int drop;
 
 			drop = 0;
-			if (!qc_parse_pkt_frms(pkt, ctx, el))
+			if (el == &ctx->conn->quic_conn->els[QUIC_TLS_ENC_LEVEL_APP] &&
+			    !qc_rx_pkt_check_path(pkt, ctx))
+				drop = 1;
+			else if (!qc_parse_pkt_frms(pkt, ctx, el))
 				drop = 1;
 
 			if (drop) {
@@ -2403,26 +4090,50 @@ static inline int qc_treat_rx_pkts(struct quic_enc_level *el, struct quic_conn_c
 							QUIC_EV_CONN_ELRXPKTS, ctx->conn, pkt);
 			}
 			else {
-				if (pkt->flags & QUIC_FL_RX_PACKET_ACK_ELICITING) {
-					el->pktns->rx.nb_ack_eliciting++;
-					if (!(el->pktns->rx.nb_ack_eliciting & 1))
-						el->pktns->flags |= QUIC_FL_PKTNS_ACK_REQUIRED;
-				}
-
-				/* Update the largest packet number. */
-				if (pkt->pn > el->pktns->rx.largest_pn)
+				quic_qlog_packet_received(ctx->conn->quic_conn, pkt->type, pkt->pn, pkt->len);
+				/* A Handshake packet validates the client address. */
+				if (el == &ctx->conn->quic_conn->els[QUIC_TLS_ENC_LEVEL_HANDSHAKE])
+					ctx->conn->quic_conn->flags |= QUIC_FL_CONN_ADDR_VALIDATED;
+				ctx->conn->quic_conn->rx.pkts++;
+				qc_counters_add(ctx->conn->quic_conn, rx_pkts, 1);
+				if (pkt->flags & QUIC_FL_RX_PACKET_ACK_ELICITING)
+					qc_rx_ack_eliciting(ctx->conn->quic_conn, el->pktns, pkt);
+
+				/* Update the largest packet number. The peer has
+				 * migrated if it comes from a new address.
+				 */
+				if (pkt->pn > el->pktns->rx.largest_pn) {
 					el->pktns->rx.largest_pn = pkt->pn;
+					if ((pkt->flags & (QUIC_FL_RX_PACKET_NEW_PATH | QUIC_FL_RX_PACKET_NON_PROBING)) ==
+					    (QUIC_FL_RX_PACKET_NEW_PATH | QUIC_FL_RX_PACKET_NON_PROBING))
+						qc_path_migrate(ctx->conn->quic_conn, &pkt->dgram->saddr);
+				}
 
 				/* Update the list of ranges to acknowledge. */
-				if (!quic_update_ack_ranges_list(&el->pktns->rx.ack_ranges, pkt->pn)) {
+				if (!quic_update_ack_ranges(&el->pktns->rx.ack_ranges, pkt->pn)) {
 					TRACE_DEVEL("Could not update ack range list",
 					            QUIC_EV_CONN_ELRXPKTS, ctx->conn);
 					goto err;
 				}
 
+				/* Count the ECN marks to be reported to the peer. */
+				switch (pkt->dgram->ecn) {
+				case QUIC_ECN_ECT0:
+					el->pktns->rx.ecn_counts.ect0++;
+					break;
+				case QUIC_ECN_ECT1:
+					el->pktns->rx.ecn_counts.ect1++;
+					break;
+				case QUIC_ECN_CE:
+					el->pktns->rx.ecn_counts.ce++;
+					/* Report the congestion without delay. */
+					if (pkt->flags & QUIC_FL_RX_PACKET_ACK_ELICITING)
+						el->pktns->flags |= QUIC_FL_PKTNS_ACK_REQUIRED;
+					break;
+				}
+
 			}
 		}
-		node = eb64_next(node);
 		quic_rx_packet_eb64_delete(&pkt->pn_node);
 		free_quic_rx_packet(pkt);
 	}
@@ -2430,6 +4141,11 @@ static inline int qc_treat_rx_pkts(struct quic_enc_level *el, struct quic_conn_c
 	if (!qc_treat_rx_crypto_frms(el, ctx))
 		goto err;
 
+	/* Derive the keys of the next key phase after a key update. */
+	if (el == &ctx->conn->quic_conn->els[QUIC_TLS_ENC_LEVEL_APP] &&
+	    !qc_tls_ku_prepare(ctx->conn->quic_conn))
+		goto err;
+
 	TRACE_LEAVE(QUIC_EV_CONN_ELRXPKTS, ctx->conn);
 	return 1;
 
@@ -2448,7 +4164,7 @@ static int qc_do_hdshk(struct quic_conn_ctx *ctx)
 	int ssl_err;
 	struct quic_conn *quic_conn;
 	enum quic_tls_enc_level tel, next_tel;
-	struct quic_enc_level *qel, *next_qel;
+	struct quic_enc_level *qel, *next_qel, *eqel;
 	struct quic_tls_ctx *tls_ctx;
 
 	TRACE_ENTER(QUIC_EV_CONN_HDSHK, ctx->conn, &ctx->state);
@@ -2460,6 +4176,13 @@ static int qc_do_hdshk(struct quic_conn_ctx *ctx)
 
 	qel = &quic_conn->els[tel];
 	next_qel = &quic_conn->els[next_tel];
+	eqel = &quic_conn->els[QUIC_TLS_ENC_LEVEL_EARLY_DATA];
+
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+	/* Resume the handshake job suspended by an async engine. */
+	if (SSL_waiting_for_async(ctx->ssl) && !qc_ssl_do_hdshk(ctx))
+		goto err;
+#endif
 
  next_level:
 	tls_ctx = &qel->tls_ctx;
@@ -2475,6 +4198,19 @@ static int qc_do_hdshk(struct quic_conn_ctx *ctx)
 		!qc_treat_rx_pkts(qel, ctx))
 		goto err;
 
+	/* The 0-RTT packets may be processed as soon as their keys have been
+	 * derived from the ClientHello carried by the Initial packets.
+	 */
+	if (eqel->tls_ctx.rx.flags & QUIC_FL_TLS_SECRETS_SET &&
+	    !(eqel->tls_ctx.rx.flags & QUIC_FL_TLS_SECRETS_DCD)) {
+		if (!LIST_ISEMPTY(&eqel->rx.pqpkts))
+			qc_rm_hp_pkts(eqel, ctx);
+
+		if (!eb_is_empty(&eqel->rx.pkts) &&
+		    !qc_treat_rx_pkts(eqel, ctx))
+			goto err;
+	}
+
 	if (!qc_prep_hdshk_pkts(ctx))
 		goto err;
 
@@ -2497,6 +4233,9 @@ static int qc_do_hdshk(struct quic_conn_ctx *ctx)
 	/* Discard the Handshake keys. */
 	quic_tls_discard_keys(&quic_conn->els[QUIC_TLS_ENC_LEVEL_HANDSHAKE]);
 	quic_pktns_discard(quic_conn->els[QUIC_TLS_ENC_LEVEL_HANDSHAKE].pktns, quic_conn);
+	/* The 0-RTT keys are no more useful: the client must now send 1-RTT packets. */
+	quic_tls_discard_keys(eqel);
+	qc_rx_pqpkts_flush(eqel);
 	qc_set_timer(ctx);
 	if (!quic_build_post_handshake_frames(quic_conn) ||
 	    !qc_prep_phdshk_pkts(quic_conn) ||
@@ -2516,21 +4255,28 @@ static int qc_do_hdshk(struct quic_conn_ctx *ctx)
 static struct task *quic_conn_io_cb(struct task *t, void *context, unsigned short state)
 {
 	struct quic_conn_ctx *ctx = context;
+	struct quic_conn *qc = ctx->conn->quic_conn;
+	unsigned long long start = 0;
+	int hs = ctx->state < QUIC_HS_ST_COMPLETE;
+
+	if (unlikely(qc->flags & QUIC_FL_CONN_REPLAY))
+		start = rdtsc();
 
 	QDPRINTF("%s: tid: %u\n", __func__, tid);
-	if (ctx->state < QUIC_HS_ST_COMPLETE) {
+	if (hs) {
 		if (!qc_do_hdshk(ctx))
 			QDPRINTF("%s SSL handshake error\n", __func__);
 	}
 	else {
-		struct quic_conn *qc = ctx->conn->quic_conn;
-
 		/* XXX TO DO: may fail!!! XXX */
 		qc_treat_rx_pkts(&qc->els[QUIC_TLS_ENC_LEVEL_APP], ctx);
+		qc_path_check_validation(qc);
 	    qc_prep_phdshk_pkts(qc);
 	    qc_send_ppkts(ctx);
 	}
 
+	if (start)
+		quic_replay_account(hs ? QUIC_RS_HS : QUIC_RS_CONN, start);
 	return NULL;
 }
 
@@ -2556,6 +4302,8 @@ static struct quic_conn *new_quic_conn(uint32_t version)
 	if (quic_conn) {
 		memset(quic_conn, 0, sizeof *quic_conn);
 		quic_conn->version = version;
+		LIST_INIT(&quic_conn->list);
+		LIST_INIT(&quic_conn->tw_list);
 	}
 
 	return quic_conn;
@@ -2577,6 +4325,9 @@ static void quic_conn_enc_level_uninit(struct quic_enc_level *qel)
 	}
 	free(qel->tx.crypto.bufs);
 	qel->tx.crypto.bufs = NULL;
+	quic_reasm_release(&qel->rx.crypto.reasm);
+	quic_tls_secrets_ctx_free(&qel->tls_ctx.rx);
+	quic_tls_secrets_ctx_free(&qel->tls_ctx.tx);
 }
 
 /*
@@ -2594,11 +4345,15 @@ static int quic_conn_enc_level_init(struct quic_conn *qc,
 	qel->tls_ctx.rx.aead = qel->tls_ctx.tx.aead = NULL;
 	qel->tls_ctx.rx.md   = qel->tls_ctx.tx.md = NULL;
 	qel->tls_ctx.rx.hp   = qel->tls_ctx.tx.hp = NULL;
+	qel->tls_ctx.rx.ctx  = qel->tls_ctx.tx.ctx = NULL;
+	qel->tls_ctx.rx.hp_ctx = qel->tls_ctx.tx.hp_ctx = NULL;
 	qel->tls_ctx.rx.flags = 0;
 	qel->tls_ctx.tx.flags = 0;
 
 	qel->rx.pkts = EB_ROOT;
 	LIST_INIT(&qel->rx.pqpkts);
+	qel->rx.crypto.offset = 0;
+	quic_reasm_init(&qel->rx.crypto.reasm);
 
 	/* Allocate only one buffer. */
 	qel->tx.crypto.bufs = malloc(sizeof *qel->tx.crypto.bufs);
@@ -2613,6 +4368,7 @@ static int quic_conn_enc_level_init(struct quic_conn *qc,
 
 	qel->tx.crypto.bufs[0]->sz = 0;
 	qel->tx.crypto.nb_buf = 1;
+	qc_mem_add(qc, sizeof *qel->tx.crypto.bufs[0]);
 
 	qel->tx.crypto.sz = 0;
 	qel->tx.crypto.offset = 0;
@@ -2695,34 +4451,56 @@ static void quic_conn_free(struct quic_conn *conn)
 {
 	int i;
 
+	if (conn->odcid_tree)
+		quic_cid_delete(conn->odcid_tree, &conn->odcid_node);
+	if (conn->scid_tree)
+		quic_cid_delete(conn->scid_tree, &conn->scid_node);
 	free_quic_conn_cids(conn);
 	for (i = 0; i < QUIC_TLS_ENC_LEVEL_MAX; i++)
 		quic_conn_enc_level_uninit(&conn->els[i]);
+	quic_tls_kp_free(&conn->ku.prv_rx);
+	quic_tls_kp_free(&conn->ku.nxt_rx);
+	quic_tls_kp_free(&conn->ku.nxt_tx);
 	free_quic_conn_tx_bufs(conn->tx.bufs, conn->tx.nb_buf);
-	if (conn->timer_task)
-		task_destroy(conn->timer_task);
+	qc_release_hs(conn);
+	qc_timer_arm(conn, TICK_ETERNITY);
+	if (conn->pacing_task)
+		task_destroy(conn->pacing_task);
+	LIST_DEL(&conn->list);
+	/* what was not accounted for as released is released now */
+	_HA_ATOMIC_SUB(&quic_mem_used, conn->mem_used);
 	pool_free(pool_head_quic_conn, conn);
 }
 
-/* Callback called upon loss detection and PTO timer expirations. */
-static struct task *process_timer(struct task *task, void *ctx, unsigned short state)
+/* Called by the timer wheel upon loss detection, PTO and delayed ACK timer
+ * expirations of the QUIC connection with <conn_ctx> as I/O handler context.
+ */
+static void qc_process_timer(struct quic_conn_ctx *conn_ctx)
 {
-	struct quic_conn_ctx *conn_ctx;
 	struct quic_conn *qc;
 	struct quic_pktns *pktns;
 
-
-	conn_ctx = task->context;
 	qc = conn_ctx->conn->quic_conn;
 	TRACE_ENTER(QUIC_EV_CONN_PTIMER, conn_ctx->conn);
-	task->expire = TICK_ETERNITY;
+	if (tick_is_expired(qc->rx.ack_expire, now_ms)) {
+		qc->rx.ack_expire = TICK_ETERNITY;
+		qc->pktns[QUIC_TLS_PKTNS_01RTT].flags |= QUIC_FL_PKTNS_ACK_REQUIRED;
+		tasklet_wakeup(conn_ctx->wait_event.tasklet);
+	}
+
+	if (!tick_is_expired(qc->ld_timer, now_ms)) {
+		qc_timer_update(qc);
+		goto out;
+	}
+
+	qc->ld_timer = TICK_ETERNITY;
 	pktns = quic_loss_pktns(qc);
 	if (tick_isset(pktns->tx.loss_time)) {
 		struct list lost_pkts = LIST_HEAD_INIT(lost_pkts);
 
 		qc_packet_loss_lookup(pktns, qc, &lost_pkts);
 		if (!LIST_ISEMPTY(&lost_pkts))
-			qc_release_lost_pkts(pktns, ctx, &lost_pkts, now_ms);
+			qc_release_lost_pkts(pktns, conn_ctx, &lost_pkts, now_ms);
 		qc_set_timer(conn_ctx);
 		goto out;
 	}
@@ -2743,30 +4521,85 @@ static struct task *process_timer(struct task *task, void *ctx, unsigned short s
 	qc->tx.nb_pto_dgrams = QUIC_MAX_NB_PTO_DGRAMS;
 	tasklet_wakeup(conn_ctx->wait_event.tasklet);
 	qc->path->loss.pto_count++;
+	qc->tx.nb_pto++;
+	qc_counters_add(qc, pto, 1);
+	qc_timer_update(qc);
 
  out:
 	TRACE_LEAVE(QUIC_EV_CONN_PTIMER, conn_ctx->conn);
+}
 
-	return task;
+/* Processes the slots of the <ctx> timer wheel of the current thread up to the
+ * current date, running the handler of the expired timers, then schedules
+ * <t>, the task of this wheel, for the first slot which is not empty. The
+ * timers of a slot which are not expired are the ones of the next rounds.
+ */
+static struct task *quic_tw_process(struct task *t, void *ctx, unsigned short state)
+{
+	struct quic_timer_wheel *tw = ctx;
+	unsigned int n;
+
+	t->expire = TICK_ETERNITY;
+	for (n = 0; tw->nb && n < QUIC_TW_SLOTS && !tick_is_lt(now_ms, tw->cur); n++, tw->cur++) {
+		struct list *slot = &tw->slots[tw->cur & (QUIC_TW_SLOTS - 1)];
+		struct list exp = LIST_HEAD_INIT(exp);
+
+		if (LIST_ISEMPTY(slot))
+			continue;
+
+		/* Detach the slot as the handlers may re-arm their timer into it. */
+		LIST_SPLICE(&exp, slot);
+		LIST_INIT(slot);
+		while (!LIST_ISEMPTY(&exp)) {
+			struct quic_conn *qc = LIST_ELEM(exp.n, struct quic_conn *, tw_list);
+
+			LIST_DEL_INIT(&qc->tw_list);
+			if (!tick_is_expired(qc->timer, now_ms)) {
+				LIST_ADDQ(slot, &qc->tw_list);
+				continue;
+			}
+
+			tw->nb--;
+			qc->timer = TICK_ETERNITY;
+			qc_process_timer(qc->conn->xprt_ctx);
+		}
+	}
+
+	/* All the expired timers were run if a whole round was processed. */
+	if (n == QUIC_TW_SLOTS)
+		tw->cur = tick_add(now_ms, 1);
+
+	if (!tw->nb)
+		return t;
+
+	for (n = 0; n < QUIC_TW_SLOTS; n++)
+		if (!LIST_ISEMPTY(&tw->slots[(tw->cur + n) & (QUIC_TW_SLOTS - 1)]))
+			break;
+	t->expire = tick_first(t->expire, tick_add(tw->cur, n));
+	return t;
 }
 
 /*
- * Initialize <conn> QUIC connection with <quic_initial_clients> as root of QUIC
- * connections used to identify the first Initial packets of client connecting
- * to listeners. This parameter must be NULL for QUIC connections attached
- * to listeners. <dcid> is the destination connection ID with <dcid_len> as length.
+ * Initialize <conn> QUIC connection with <quic_initial_clients> as array of
+ * trees of QUIC connections used to identify the first Initial packets of
+ * client connecting to listeners. This parameter must be NULL for QUIC
+ * connections to servers. <quic_clients> is the array of trees our connection
+ * IDs are inserted into for listeners, or the unique tree of the server for
+ * QUIC connections to servers.
+ * <dcid> is the destination connection ID with <dcid_len> as length.
  * <scid> is the source connection ID with <scid_len> as length.
  * Returns 1 if succeeded, 0 if not.
  */
 static int qc_new_conn_init(struct quic_conn *conn, int ipv4,
-                            struct eb_root *quic_initial_clients,
-                            struct eb_root *quic_clients,
+                            struct quic_cid_tree *quic_initial_clients,
+                            struct quic_cid_tree *quic_clients,
                             unsigned char *dcid, size_t dcid_len,
                             unsigned char *scid, size_t scid_len)
 {
 	int i;
 	/* Initial CID. */
 	struct quic_connection_id *icid;
+	struct quic_cc_algo *cc_algo;
 
 	TRACE_ENTER(QUIC_EV_CONN_INIT, conn->conn);
 	conn->cids = EB_ROOT;
@@ -2790,8 +4623,13 @@ static int qc_new_conn_init(struct quic_conn *conn, int ipv4,
 		conn->dcid.len = dcid_len;
 	}
 
+	conn->hs = pool_alloc(pool_head_quic_conn_hs);
+	if (!conn->hs)
+		return 0;
+	qc_mem_add(conn, sizeof *conn->hs);
+
 	/* Initialize the output buffer */
-	conn->obuf.pos = conn->obuf.data;
+	conn->hs->obuf.pos = conn->hs->obuf.data;
 
 	icid = new_quic_connection_id(&conn->cids, 0);
 	if (!icid)
@@ -2800,12 +4638,28 @@ static int qc_new_conn_init(struct quic_conn *conn, int ipv4,
 	/* Select our SCID which is the first CID with 0 as sequence number. */
 	conn->scid = icid->cid;
 
-	/* Insert the DCID the QUIC client has choosen (only for listeners) */
-	if (objt_listener(conn->conn->target))
-		ebmb_insert(quic_initial_clients, &conn->odcid_node, conn->odcid.len);
+	/* Insert the DCID the QUIC client has choosen (only for listeners).
+	 * Another thread may have already inserted a connection for the same
+	 * client Initial packet. In this case, this packet is dropped.
+	 */
+	if (objt_listener(conn->conn->target)) {
+		struct quic_cid_tree *tree;
+
+		tree = quic_cid_tree_get(quic_initial_clients, conn->odcid.data, conn->odcid.len);
+		if (quic_cid_insert(tree, &conn->odcid_node, conn->odcid.len) != &conn->odcid_node) {
+			TRACE_DEVEL("already existing ODCID", QUIC_EV_CONN_INIT, conn->conn);
+			goto err;
+		}
+		conn->odcid_tree = tree;
+		quic_clients = quic_cid_tree_get(quic_clients, conn->scid.data, conn->scid.len);
+	}
 
 	/* Insert our SCID, the connection ID for the QUIC client. */
-	ebmb_insert(quic_clients, &conn->scid_node, conn->scid.len);
+	if (quic_cid_insert(quic_clients, &conn->scid_node, conn->scid.len) != &conn->scid_node) {
+		TRACE_DEVEL("already existing SCID", QUIC_EV_CONN_INIT, conn->conn);
+		goto err;
+	}
+	conn->scid_tree = quic_clients;
 
 	/* Packet number spaces initialization. */
 	for (i = 0; i < QUIC_TLS_PKTNS_MAX; i++) {
@@ -2821,31 +4675,42 @@ static int qc_new_conn_init(struct quic_conn *conn, int ipv4,
 
 	/* TX part. */
 	LIST_INIT(&conn->tx.frms_to_send);
-	conn->tx.bufs = quic_conn_tx_bufs_alloc(QUIC_CONN_TX_BUFS_NB, QUIC_CONN_TX_BUF_SZ);
+	for (i = 0; i < QUIC_TX_PRIO_NB; i++)
+		LIST_INIT(&conn->tx.strm_frms[i]);
+	MT_LIST_INIT(&conn->tx.frms_in);
+	conn->tx.bufs = quic_conn_tx_bufs_alloc(QUIC_CONN_TX_BUFS_NB, quic_max_dgram_sz);
 	if (!conn->tx.bufs)
 		goto err;
 
 	conn->tx.nb_buf = QUIC_CONN_TX_BUFS_NB;
+	qc_mem_add(conn, QUIC_CONN_TX_BUFS_NB * (sizeof **conn->tx.bufs + quic_max_dgram_sz));
 	conn->tx.wbuf = conn->tx.rbuf = 0;
 	conn->tx.bytes = 0;
+	conn->tx.hs_bytes = 0;
 	conn->tx.nb_pto_dgrams = 0;
 	/* RX part. */
 	conn->rx.bytes = 0;
+	conn->rx.ack_tolerance = QUIC_DFLT_ACK_TOLERANCE;
+	conn->rx.ack_delay = 0;
+	conn->rx.ack_expire = TICK_ETERNITY;
+	conn->rx.ack_freq_seq = 0;
 
 	conn->ifcdata = 0;
 
-	/* XXX TO DO: Only one path at this time. */
+	/* The other path is used upon peer migration. */
 	conn->path = &conn->paths[0];
-	quic_path_init(conn->path, ipv4, default_quic_cc_algo, conn);
-
-	/* Timer. */
-	conn->timer_task = task_new(MAX_THREADS_MASK);
-	if (!conn->timer_task)
-		goto err;
-
-	conn->timer = TICK_ETERNITY;
-	conn->timer_task->process = process_timer;
-	conn->timer_task->context = conn->conn->xprt_ctx;
+	conn->pv.prev = NULL;
+	cc_algo = default_quic_cc_algo;
+	if (objt_listener(conn->conn->target) &&
+	    objt_listener(conn->conn->target)->bind_conf->quic_cc_algo)
+		cc_algo = objt_listener(conn->conn->target)->bind_conf->quic_cc_algo;
+	quic_path_init(conn->path, ipv4, cc_algo, conn);
+
+	/* Timer, armed on the timer wheel of this thread. */
+	conn->tid = tid;
+	LIST_ADDQ(&quic_conns[tid], &conn->list);
+	conn->timer = conn->ld_timer = TICK_ETERNITY;
+	quic_qlog_conn_start(conn);
 
 	TRACE_LEAVE(QUIC_EV_CONN_INIT, conn->conn);
 
@@ -2895,7 +4760,8 @@ static int qc_new_isecs(struct connection *conn,
 	                          rx_ctx->key, sizeof rx_ctx->key,
 	                          rx_ctx->iv, sizeof rx_ctx->iv,
 	                          rx_ctx->hp_key, sizeof rx_ctx->hp_key,
-	                          rx_init_sec, sizeof rx_init_sec))
+	                          rx_init_sec, sizeof rx_init_sec) ||
+	    !quic_tls_secrets_ctx_init(rx_ctx, 0))
 		goto err;
 
 	rx_ctx->flags |= QUIC_FL_TLS_SECRETS_SET;
@@ -2903,7 +4769,8 @@ static int qc_new_isecs(struct connection *conn,
 	                          tx_ctx->key, sizeof tx_ctx->key,
 	                          tx_ctx->iv, sizeof tx_ctx->iv,
 	                          tx_ctx->hp_key, sizeof tx_ctx->hp_key,
-	                          tx_init_sec, sizeof tx_init_sec))
+	                          tx_init_sec, sizeof tx_init_sec) ||
+	    !quic_tls_secrets_ctx_init(tx_ctx, 1))
 		goto err;
 
 	tx_ctx->flags |= QUIC_FL_TLS_SECRETS_SET;
@@ -2987,18 +4854,34 @@ static int qc_conn_init(struct connection *conn, void **xprt_ctx)
 			goto err;
 		}
 
+		/* Resume the last TLS session negotiated with this server by
+		 * this thread, if any.
+		 */
+		if (srv->ssl_ctx.reused_sess[tid].ptr) {
+			unsigned char **ptr = &srv->ssl_ctx.reused_sess[tid].ptr;
+			const unsigned char *const_ptr = *ptr;
+			SSL_SESSION *sess;
+
+			sess = d2i_SSL_SESSION(NULL, &const_ptr, srv->ssl_ctx.reused_sess[tid].size);
+			if (sess && !SSL_set_session(ctx->ssl, sess)) {
+				free(*ptr);
+				*ptr = NULL;
+			}
+			SSL_SESSION_free(sess);
+		}
+
 		quic_conn->params = srv->quic_params;
 		/* Copy the initial source connection ID. */
 		quic_cid_cpy(&quic_conn->params.initial_source_connection_id, &quic_conn->scid);
-		quic_conn->enc_params_len =
-			quic_transport_params_encode(quic_conn->enc_params,
-			                             quic_conn->enc_params + sizeof quic_conn->enc_params,
+		quic_conn->hs->enc_params_len =
+			quic_transport_params_encode(quic_conn->hs->enc_params,
+			                             quic_conn->hs->enc_params + sizeof quic_conn->hs->enc_params,
 			                             &quic_conn->params, 0);
-		if (!quic_conn->enc_params_len) {
+		if (!quic_conn->hs->enc_params_len) {
 			QDPRINTF("QUIC transport parameters encoding failed");
 			goto err;
 		}
-		SSL_set_quic_transport_params(ctx->ssl, quic_conn->enc_params, quic_conn->enc_params_len);
+		SSL_set_quic_transport_params(ctx->ssl, quic_conn->hs->enc_params, quic_conn->hs->enc_params_len);
 		SSL_set_connect_state(ctx->ssl);
 		ssl_err = SSL_do_handshake(ctx->ssl);
 		if (ssl_err != 1) {
@@ -3070,12 +4953,27 @@ int quic_conn_prepare_srv_ctx(struct server *srv)
 		SSL_MODE_RELEASE_BUFFERS |
 		SSL_MODE_SMALL_BUFFERS;
 
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+	if (global_ssl.async)
+		mode |= SSL_MODE_ASYNC;
+#endif
 	/* Make sure openssl opens /dev/urandom before the chroot */
 	if (!ssl_initialize_random()) {
 		ha_alert("OpenSSL random data generator initialization failed.\n");
 		cfgerr++;
 	}
 
+	/* The session tickets are stored by ssl_sess_new_srv_cb(), per thread */
+	if (!srv->ssl_ctx.reused_sess) {
+		srv->ssl_ctx.reused_sess = calloc(global.nbthread, sizeof(*srv->ssl_ctx.reused_sess));
+		if (!srv->ssl_ctx.reused_sess) {
+			ha_alert("Proxy '%s', server '%s' [%s:%d] out of memory.\n",
+			         curproxy->id, srv->id,
+			         srv->conf.file, srv->conf.line);
+			return ++cfgerr;
+		}
+	}
+
 	ctx = SSL_CTX_new(TLS_client_method());
 	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
 	SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
@@ -3185,6 +5083,45 @@ int quic_conn_prepare_srv_ctx(struct server *srv)
     return cfgerr;
 }
 
+/* Called when <conn> is closed. Its QUIC connection is only removed from the
+ * list dumped by "show quic" and its timer disarmed as it must not be reached
+ * anymore from there.
+ */
+static void quic_conn_close(struct connection *conn, void *xprt_ctx)
+{
+	if (conn->quic_conn) {
+		LIST_DEL_INIT(&conn->quic_conn->list);
+		qc_timer_arm(conn->quic_conn, TICK_ETERNITY);
+	}
+#if (HA_OPENSSL_VERSION_NUMBER >= 0x1010000fL) && !defined(OPENSSL_NO_ASYNC)
+	/* An async engine job may still be pending: its end must no more
+	 * wake up the connection tasklet.
+	 */
+	if (xprt_ctx && global_ssl.async) {
+		struct quic_conn_ctx *ctx = xprt_ctx;
+		OSSL_ASYNC_FD all_fd[32];
+		size_t num_all_fds = 0;
+		int i;
+
+		SSL_get_all_async_fds(ctx->ssl, NULL, &num_all_fds);
+		if (num_all_fds > 32)
+			return;
+
+		SSL_get_all_async_fds(ctx->ssl, all_fd, &num_all_fds);
+		for (i = 0; i < num_all_fds; i++) {
+			if (SSL_waiting_for_async(ctx->ssl)) {
+				fdtab[all_fd[i]].iocb = quic_async_fd_drop;
+				fdtab[all_fd[i]].owner = ctx->ssl;
+				fd_want_recv(all_fd[i]);
+				fd_cant_recv(all_fd[i]);
+			}
+			else
+				fd_remove(all_fd[i]);
+		}
+	}
+#endif
+}
+
 /* transport-layer operations for QUIC connections. */
 static struct xprt_ops quic_conn = {
 	.snd_buf  = quic_conn_from_buf,
@@ -3194,7 +5131,7 @@ static struct xprt_ops quic_conn = {
 	.remove_xprt = quic_conn_remove_xprt,
 	.shutr    = NULL,
 	.shutw    = NULL,
-	.close    = NULL,
+	.close    = quic_conn_close,
 	.init     = qc_conn_init,
 	.prepare_bind_conf = ssl_sock_prepare_bind_conf,
 	.destroy_bind_conf = ssl_sock_destroy_bind_conf,
@@ -3207,8 +5144,12 @@ static struct xprt_ops quic_conn = {
 __attribute__((constructor))
 static void __quic_conn_init(void)
 {
+	int i;
+
 	ha_quic_meth = BIO_meth_new(0x666, "ha QUIC methods");
 	xprt_register(XPRT_QUIC, &quic_conn);
+	for (i = 0; i < MAX_THREADS; i++)
+		LIST_INIT(&quic_conns[i]);
 }
 
 __attribute__((destructor))
@@ -3241,7 +5182,8 @@ static int new_quic_cli_conn(struct quic_conn *quic_conn,
 	cli_conn->quic_conn = quic_conn;
 
 	/* XXX Not sure it is safe to keep this statement. */
-	cli_conn->handle.fd = l->fd;
+	/* With one socket per thread, use the one of the thread owning this connection. */
+	cli_conn->handle.fd = l->quic_fds ? l->quic_fds[tid] : l->fd;
 	if (saddr)
 		*cli_conn->dst = *saddr;
 	cli_conn->flags |= CO_FL_ADDR_FROM_SET;
@@ -3391,6 +5333,14 @@ static inline int qc_try_rm_hp(struct quic_rx_packet *qpkt,
 		goto err;
 	}
 
+	/* Do not store 0-RTT packets which will never be decrypted. */
+	if (tel == QUIC_TLS_ENC_LEVEL_EARLY_DATA &&
+	    (!objt_listener(ctx->conn->target) ||
+	     !__objt_listener(ctx->conn->target)->bind_conf->ssl_conf.early_data)) {
+		TRACE_PROTO("0-RTT packet dropped", QUIC_EV_CONN_TRMHP, ctx->conn);
+		goto err;
+	}
+
 	if ((qel->tls_ctx.rx.flags & QUIC_FL_TLS_SECRETS_SET) &&
 	    (tel != QUIC_TLS_ENC_LEVEL_APP || ctx->state >= QUIC_HS_ST_COMPLETE)) {
 		/*
@@ -3420,7 +5370,8 @@ static inline int qc_try_rm_hp(struct quic_rx_packet *qpkt,
 		quic_rx_packet_list_addq(&qel->rx.pqpkts, qpkt);
 	}
 
-	memcpy(qpkt->data, beg, qpkt->len);
+	/* The packet is kept in place in its datagram buffer. */
+	qpkt->data = beg;
 	/* Updtate the offset of <*buf> for the next QUIC packet. */
 	*buf = beg + qpkt->len;
 
@@ -3465,7 +5416,7 @@ static ssize_t qc_srv_pkt_rcv(unsigned char **buf, const unsigned char *end,
 	unsigned char *beg;
 	uint64_t len;
 	struct quic_conn *conn;
-	struct eb_root *cids;
+	struct quic_cid_tree *cids;
 	struct ebmb_node *node;
 	struct connection *srv_conn;
 	struct quic_conn_ctx *conn_ctx;
@@ -3494,16 +5445,13 @@ static ssize_t qc_srv_pkt_rcv(unsigned char **buf, const unsigned char *end,
 		/* For Initial packets, and for servers (QUIC clients connections),
 		 * there is no Initial connection IDs storage.
 		 */
-		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL) {
-			cids = &((struct server *)__objt_server(srv_conn->target))->cids;
+		cids = &((struct server *)__objt_server(srv_conn->target))->cids;
+		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL)
 			cid_lookup_len = qpkt->dcid.len;
-		}
-		else {
-			cids = &((struct server *)__objt_server(srv_conn->target))->cids;
+		else
 			cid_lookup_len = QUIC_CID_LEN;
-		}
 
-		node = ebmb_lookup(cids, qpkt->dcid.data, cid_lookup_len);
+		node = quic_cid_lookup(cids, qpkt->dcid.data, cid_lookup_len);
 		if (!node) {
 			QDPRINTF("Connection not found.\n");
 			goto err;
@@ -3539,7 +5487,10 @@ static ssize_t qc_srv_pkt_rcv(unsigned char **buf, const unsigned char *end,
 			goto err;
 		}
 		cids = &((struct server *)__objt_server(srv_conn->target))->cids;
-		node = ebmb_lookup(cids, *buf, QUIC_CID_LEN);
+		/* The UDP segments coalesced by GRO share the same DCID. */
+		node = dgram_ctx->dcid_node;
+		if (!node || memcmp(node->key, *buf, QUIC_CID_LEN) != 0)
+			node = quic_cid_lookup(cids, *buf, QUIC_CID_LEN);
 		if (!node) {
 			QDPRINTF("Unknonw connection ID\n");
 			goto err;
@@ -3581,11 +5532,6 @@ static ssize_t qc_srv_pkt_rcv(unsigned char **buf, const unsigned char *end,
 		goto err;
 	}
 
-	if (qpkt->len > sizeof qpkt->data) {
-		TRACE_PROTO("Too big packet", QUIC_EV_CONN_SPKT, conn->conn, qpkt, &qpkt->len);
-		goto err;
-	}
-
 	if (!qc_try_rm_hp(qpkt, buf, beg, end, conn_ctx))
 		goto err;
 
@@ -3610,7 +5556,7 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 	unsigned char *beg;
 	uint64_t len;
 	struct quic_conn *conn;
-	struct eb_root *cids;
+	struct quic_cid_tree *cids;
 	struct ebmb_node *node;
 	struct listener *l;
 	struct quic_conn_ctx *conn_ctx;
@@ -3637,31 +5583,46 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 		if (!quic_packet_read_long_header(buf, end, qpkt))
 			goto err;
 
+		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL) {
+			uint64_t token_len;
+
+			if (!quic_dec_int(&token_len, (const unsigned char **)buf, end) || end - *buf < token_len)
+				goto err;
+
+			/* The token must be provided in a Retry packet or NEW_TOKEN frame. */
+			qpkt->token = *buf;
+			qpkt->token_len = token_len;
+			*buf += token_len;
+		}
+
 		dcid_len = qpkt->dcid.len;
 		saddr_len = 0;
 		/* For Initial packets, and for servers (QUIC clients connections),
 		 * there is no Initial connection IDs storage.
+		 * 0-RTT packets may be sent with the same DCID as the Initial ones.
 		 */
-		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL) {
+		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL ||
+		    qpkt->type == QUIC_PACKET_TYPE_0RTT) {
 			/*
 			 * DCIDs of first packets coming from clients may have the same values.
 			 * Let's distinguish them concatenating the socket addresses to the DCIDs.
 			 */
 			saddr_len = quic_cid_saddr_cat(&qpkt->dcid, saddr);
-			cids = &l->icids;
+			cids = l->icids;
 		}
 		else {
 			if (qpkt->dcid.len != QUIC_CID_LEN)
 				goto err;
 
-			cids = &l->cids;
+			cids = l->cids;
 		}
 
-		node = ebmb_lookup(cids, qpkt->dcid.data, qpkt->dcid.len);
-		if (!node && qpkt->type == QUIC_PACKET_TYPE_INITIAL && dcid_len == QUIC_CID_LEN &&
-		    cids == &l->icids) {
-			/* Switch to the definitive tree ->cids containing the final CIDs. */
-			node = ebmb_lookup(&l->cids, qpkt->dcid.data, dcid_len);
+		node = quic_cid_lookup(quic_cid_tree_get(cids, qpkt->dcid.data, qpkt->dcid.len),
+		                       qpkt->dcid.data, qpkt->dcid.len);
+		if (!node && dcid_len == QUIC_CID_LEN && cids == l->icids) {
+			/* Switch to the definitive trees ->cids containing the final CIDs. */
+			node = quic_cid_lookup(quic_cid_tree_get(l->cids, qpkt->dcid.data, dcid_len),
+			                       qpkt->dcid.data, dcid_len);
 			if (node) {
 				/* If found, signal this with NULL as special value for <cids>. */
 				qpkt->dcid.len = dcid_len;
@@ -3670,13 +5631,36 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 		}
 		if (!node) {
 			struct quic_cid *odcid;
-			int ipv4;
+			struct quic_cid token_odcid;
+			int ipv4, token_type;
 
 			if (qpkt->type != QUIC_PACKET_TYPE_INITIAL) {
 				QDPRINTF("Connection not found.\n");
 				goto err;
 			}
 
+			token_type = -1;
+			if (qpkt->token_len) {
+				token_type = quic_token_check(qpkt->token, qpkt->token_len,
+				                              saddr, &token_odcid);
+				/* The invalid NEW_TOKEN tokens are ignored, but no Retry token
+				 * may be expected from a client which did not receive a Retry.
+				 */
+				if (token_type == -1 && *qpkt->token == QUIC_TOKEN_TYPE_RETRY) {
+					TRACE_PROTO("invalid Retry token", QUIC_EV_CONN_LPKT);
+					goto err;
+				}
+			}
+
+			/* Validate the address of the client before allocating anything. */
+			if (token_type == -1 && quic_retry_required()) {
+				if (qc_send_retry(l->quic_fds ? l->quic_fds[tid] : l->fd,
+				                  saddr, qpkt, dcid_len))
+					HA_ATOMIC_ADD(&l->quic_counters.retries, 1);
+				TRACE_PROTO("Retry sent", QUIC_EV_CONN_LPKT);
+				goto err;
+			}
+
 			conn =  new_quic_conn(qpkt->version);
 			if (!conn)
 				goto err;
@@ -3687,7 +5671,7 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 			}
 
 			ipv4 = saddr->ss_family == AF_INET;
-			if (!qc_new_conn_init(conn, ipv4, &l->icids, &l->cids,
+			if (!qc_new_conn_init(conn, ipv4, l->icids, l->cids,
 			                      qpkt->dcid.data, qpkt->dcid.len,
 			                      qpkt->scid.data, qpkt->scid.len))
 				goto err;
@@ -3696,44 +5680,49 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 			/* Copy the transport parameters. */
 			conn->params = l->bind_conf->quic_params;
 			/* Copy original_destination_connection_id transport parameter. */
-			memcpy(odcid->data, &qpkt->dcid, dcid_len);
-			odcid->len = dcid_len;
+			if (token_type == QUIC_TOKEN_TYPE_RETRY) {
+				/* The client DCID is the SCID of the Retry packet. */
+				quic_cid_cpy(odcid, &token_odcid);
+				memcpy(conn->params.retry_source_connection_id.data, qpkt->dcid.data, dcid_len);
+				conn->params.retry_source_connection_id.len = dcid_len;
+				conn->params.retry_source_connection_id_present = 1;
+			}
+			else {
+				memcpy(odcid->data, &qpkt->dcid, dcid_len);
+				odcid->len = dcid_len;
+			}
+			if (token_type != -1)
+				conn->flags |= QUIC_FL_CONN_ADDR_VALIDATED;
+			if (quic_replaying)
+				conn->flags |= QUIC_FL_CONN_REPLAY;
 			/* Copy the initial source connection ID. */
 			quic_cid_cpy(&conn->params.initial_source_connection_id, &conn->scid);
-			conn->enc_params_len =
-				quic_transport_params_encode(conn->enc_params,
-				                             conn->enc_params + sizeof conn->enc_params,
+			if (!quic_stateless_reset_token_build(conn->params.stateless_reset_token,
+			                                      conn->scid.data, conn->scid.len))
+				goto err;
+
+			conn->hs->enc_params_len =
+				quic_transport_params_encode(conn->hs->enc_params,
+				                             conn->hs->enc_params + sizeof conn->hs->enc_params,
 				                             &conn->params, 1);
-			if (!conn->enc_params_len)
+			if (!conn->hs->enc_params_len)
 				goto err;
 
 			/* This is the DCID sent in this packet by the client. */
 			node = &conn->odcid_node;
 			conn_ctx = conn->conn->xprt_ctx;
-			SSL_set_quic_transport_params(conn_ctx->ssl, conn->enc_params, conn->enc_params_len);
+			SSL_set_quic_transport_params(conn_ctx->ssl, conn->hs->enc_params, conn->hs->enc_params_len);
 		}
 		else {
-			if (qpkt->type == QUIC_PACKET_TYPE_INITIAL && cids == &l->icids)
+			if (cids == l->icids)
 				conn = ebmb_entry(node, struct quic_conn, odcid_node);
 			else
 				conn = ebmb_entry(node, struct quic_conn, scid_node);
 		}
 
 		if (qpkt->type == QUIC_PACKET_TYPE_INITIAL) {
-			uint64_t token_len;
 			struct quic_tls_ctx *ctx = &conn->els[QUIC_TLS_ENC_LEVEL_INITIAL].tls_ctx;
 
-			if (!quic_dec_int(&token_len, (const unsigned char **)buf, end) || end - *buf < token_len)
-				goto err;
-
-			/* XXX TO DO XXX 0 value means "the token is not present".
-			 * A server which sends an Initial packet must not set the token.
-			 * So, a client which receives an Initial packet with a token
-			 * MUST discard the packet or generate a connection error with
-			 * PROTOCOL_VIOLATION as type.
-			 * The token must be provided in a Retry packet or NEW_TOKEN frame.
-			 */
-			qpkt->token_len = token_len;
 			/*
 			 * NOTE: the socket address it concatenated to the destination ID choosen by the client
 			 * for Initial packets.
@@ -3751,10 +5740,20 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 			QDPRINTF("Too short short headder\n");
 			goto err;
 		}
-		cids = &l->cids;
-		node = ebmb_lookup(cids, *buf, QUIC_CID_LEN);
+		cids = l->cids;
+		/* The UDP segments coalesced by GRO share the same DCID, which is
+		 * only looked up for the first one.
+		 */
+		node = dgram_ctx->dcid_node;
+		if (!node || node != &dgram_ctx->quic_conn->scid_node ||
+		    memcmp(node->key, *buf, QUIC_CID_LEN) != 0)
+			node = quic_cid_lookup(quic_cid_tree_get(cids, *buf, QUIC_CID_LEN), *buf, QUIC_CID_LEN);
 		if (!node) {
 			QDPRINTF("Unknonw connection ID\n");
+			/* Short header packets are the last ones of their datagram. */
+			if (qc_send_stateless_reset(l->quic_fds ? l->quic_fds[tid] : l->fd,
+			                            saddr, beg, end - beg))
+				HA_ATOMIC_ADD(&l->quic_counters.sresets, 1);
 			goto err;
 		}
 		conn = ebmb_entry(node, struct quic_conn, scid_node);
@@ -3796,11 +5795,6 @@ static ssize_t qc_lstnr_pkt_rcv(unsigned char **buf, const unsigned char *end,
 		goto err;
 	}
 
-	if (qpkt->len > sizeof qpkt->data) {
-		TRACE_PROTO("Too big packet", QUIC_EV_CONN_LPKT, conn->conn, qpkt, &qpkt->len);
-		goto err;
-	}
-
 	if (!qc_try_rm_hp(qpkt, buf, beg, end, conn_ctx))
 		goto err;
 
@@ -3861,7 +5855,9 @@ static int quic_build_packet_short_header(unsigned char **buf, const unsigned ch
                                           size_t pn_len, struct quic_conn *conn)
 {
 	/* #0 byte flags */
-	*(*buf)++ = QUIC_PACKET_FIXED_BIT | (pn_len - 1);
+	*(*buf)++ = QUIC_PACKET_FIXED_BIT | (pn_len - 1) |
+		((conn->els[QUIC_TLS_ENC_LEVEL_APP].tls_ctx.tx.flags & QUIC_FL_TLS_KP_BIT_SET) ?
+		 QUIC_PACKET_KEY_PHASE_BIT : 0);
 	/* Destination connection ID */
 	if (conn->dcid.len) {
 		memcpy(*buf, conn->dcid.data, conn->dcid.len);
@@ -3874,42 +5870,83 @@ static int quic_build_packet_short_header(unsigned char **buf, const unsigned ch
 /*
  * Apply QUIC header protection to the packet with <buf> as first byte address,
  * <pn> as address of the Packet number field, <pnlen> being this field length
- * with <aead> as AEAD cipher and <key> as secret key.
+ * with <ctx> as header protection cipher context already keyed with the
+ * header protection key.
  * Returns 1 if succeeded or 0 if failed.
  */
 static int quic_apply_header_protection(unsigned char *buf, unsigned char *pn, size_t pnlen,
-                                        const EVP_CIPHER *aead, const unsigned char *key)
+                                        EVP_CIPHER_CTX *ctx)
 {
-	int i, ret, outlen;
-	EVP_CIPHER_CTX *ctx;
+	int i, outlen;
 	/*
 	 * We need an IV of at least 5 bytes: one byte for bytes #0
 	 * and at most 4 bytes for the packet number
 	 */
 	unsigned char mask[5] = {0};
 
-	ret = 0;
-	ctx = EVP_CIPHER_CTX_new();
-	if (!ctx)
-		return 0;
-
-	if (!EVP_EncryptInit_ex(ctx, aead, NULL, key, pn + QUIC_PACKET_PN_MAXLEN) ||
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, pn + QUIC_PACKET_PN_MAXLEN) ||
 	    !EVP_EncryptUpdate(ctx, mask, &outlen, mask, sizeof mask) ||
 	    !EVP_EncryptFinal_ex(ctx, mask, &outlen))
-		goto out;
+		return 0;
 
 	*buf ^= mask[0] & (*buf & QUIC_PACKET_LONG_HEADER_BIT ? 0xf : 0x1f);
 	for (i = 0; i < pnlen; i++)
 		pn[i] ^= mask[i + 1];
 
-	ret = 1;
+	return 1;
+}
 
- out:
-	EVP_CIPHER_CTX_free(ctx);
+/* Applies at once the header protection of the packets of <hpb> batch, then
+ * empties it. Returns 1 if succeeded, 0 if not.
+ */
+static int qc_hp_batch_apply(struct quic_hp_batch *hpb)
+{
+	unsigned char masks[QUIC_TLS_HP_BATCH * QUIC_TLS_HP_SAMPLE_LEN];
+	int i, j, ret;
+
+	if (!hpb->nb)
+		return 1;
+
+	ret = quic_tls_hp_masks(hpb->secs, hpb->samples, masks, hpb->nb);
+	if (ret) {
+		for (i = 0; i < hpb->nb; i++) {
+			unsigned char *mask = masks + i * QUIC_TLS_HP_SAMPLE_LEN;
+			unsigned char *byte0 = hpb->pkts[i].byte0;
+
+			*byte0 ^= mask[0] & (*byte0 & QUIC_PACKET_LONG_HEADER_BIT ? 0xf : 0x1f);
+			for (j = 0; j < hpb->pkts[i].pnlen; j++)
+				hpb->pkts[i].pn[j] ^= mask[j + 1];
+		}
+	}
+	hpb->nb = 0;
 
 	return ret;
 }
 
+/* Adds to <hpb> batch the packet beginning at <byte0> with <pn> as packet
+ * number field of <pnlen> bytes, whose header must be protected with <secs>
+ * TX secrets. The payload of this packet must already be encrypted as the
+ * sample is copied. The batch is applied first if full or if it was filled
+ * with other secrets. Returns 1 if succeeded, 0 if not.
+ */
+static int qc_hp_batch_add(struct quic_hp_batch *hpb, struct quic_tls_secrets *secs,
+                           unsigned char *byte0, unsigned char *pn, size_t pnlen)
+{
+	if ((hpb->nb == QUIC_TLS_HP_BATCH || (hpb->nb && hpb->secs != secs)) &&
+	    !qc_hp_batch_apply(hpb))
+		return 0;
+
+	hpb->secs = secs;
+	hpb->pkts[hpb->nb].byte0 = byte0;
+	hpb->pkts[hpb->nb].pn = pn;
+	hpb->pkts[hpb->nb].pnlen = pnlen;
+	memcpy(hpb->samples + hpb->nb * QUIC_TLS_HP_SAMPLE_LEN, pn + QUIC_PACKET_PN_MAXLEN,
+	       QUIC_TLS_HP_SAMPLE_LEN);
+	hpb->nb++;
+
+	return 1;
+}
+
 /*
  * Reduce the encoded size of <ack_frm> ACK frame removing the last
  * ACK ranges if needed to a value below <limit> in bytes.
@@ -3917,15 +5954,39 @@ static int quic_apply_header_protection(unsigned char *buf, unsigned char *pn, s
  */
 static int quic_ack_frm_reduce_sz(struct quic_frame *ack_frm, size_t limit)
 {
-	size_t room, ack_delay_sz;
+	size_t room, ack_delay_sz, ecn_sz, enc_sz;
+	const struct quic_ecn_counts *ecn_counts = ack_frm->tx_ack.ecn_counts;
 
 	ack_delay_sz = quic_int_getsize(ack_frm->tx_ack.ack_delay);
+	ecn_sz = !ecn_counts ? 0 :
+		quic_int_getsize(ecn_counts->ect0) +
+		quic_int_getsize(ecn_counts->ect1) +
+		quic_int_getsize(ecn_counts->ce);
 	/* A frame is made of 1 byte for the frame type. */
-	room = limit - ack_delay_sz - 1;
-	if (!quic_rm_last_ack_ranges(ack_frm->tx_ack.ack_ranges, room))
+	if (limit < ack_delay_sz + ecn_sz + 1)
+		return 0;
+
+	room = limit - ack_delay_sz - ecn_sz - 1;
+	ack_frm->tx_ack.nb_ranges = quic_ack_ranges_fit(ack_frm->tx_ack.ack_ranges, room, &enc_sz);
+	if (!ack_frm->tx_ack.nb_ranges)
 		return 0;
 
-	return 1 + ack_delay_sz + ack_frm->tx_ack.ack_ranges->enc_sz;
+	return 1 + ack_delay_sz + enc_sz + ecn_sz;
+}
+
+/* Prepare <ack_frm> to acknowledge the packets received for <pktns> packet
+ * number space, as an ACK_ECN frame if some of them were ECN marked.
+ */
+static inline void quic_ack_frm_init(struct quic_frame *ack_frm, struct quic_pktns *pktns)
+{
+	const struct quic_ecn_counts *ecn_counts = &pktns->rx.ecn_counts;
+
+	ack_frm->tx_ack.ack_delay = 0;
+	ack_frm->tx_ack.ack_ranges = &pktns->rx.ack_ranges;
+	if (ecn_counts->ect0 || ecn_counts->ect1 || ecn_counts->ce) {
+		ack_frm->type = QUIC_FT_ACK_ECN;
+		ack_frm->tx_ack.ecn_counts = ecn_counts;
+	}
 }
 
 /*
@@ -4016,6 +6077,9 @@ static inline int qc_build_cfrms(struct quic_tx_packet *pkt,
  * This function also update the value of <buf_pn> pointer to point to the packet
  * number field in this packet. <pn_len> will also have the packet number
  * length as value.
+ * <wbuf> is a datagram which may already contain other coalesced packets. If
+ * <padding> is set, this packet is the last one of this datagram and it is
+ * padded so that the datagram reaches QUIC_INITIAL_PACKET_MINLEN bytes.
  *
  * Return the length of the packet if succeeded minus QUIC_TLS_TAG_LEN, or -1 if
  * failed (not enough room in <wbuf> to build this packet plus QUIC_TLS_TAG_LEN
@@ -4026,7 +6090,7 @@ static ssize_t qc_do_build_hdshk_pkt(struct q_buf *wbuf,
                                      int64_t pn, size_t *pn_len,
                                      unsigned char **buf_pn,
                                      struct quic_enc_level *qel,
-                                     struct quic_conn *conn)
+                                     int padding, struct quic_conn *conn)
 {
 	unsigned char *beg, *pos;
 	const unsigned char *end;
@@ -4046,7 +6110,7 @@ static ssize_t qc_do_build_hdshk_pkt(struct q_buf *wbuf,
 	TRACE_ENTER(QUIC_EV_CONN_CHPKT, conn->conn);
 	probe_packet = 0;
 	beg = pos = q_buf_getpos(wbuf);
-	end = q_buf_end(wbuf);
+	end = qc_hdshk_dgram_end(wbuf, conn);
 
 	/* For a server, the token field of an Initial packet is empty. */
 	token_fields_len = pkt_type == QUIC_PACKET_TYPE_INITIAL ? 1 : 0;
@@ -4071,14 +6135,13 @@ static ssize_t qc_do_build_hdshk_pkt(struct q_buf *wbuf,
 	/* Build an ACK frame if required. */
 	ack_frm_len = 0;
 	if ((qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) &&
-	    !LIST_ISEMPTY(&qel->pktns->rx.ack_ranges.list)) {
-		ack_frm.tx_ack.ack_delay = 0;
-		ack_frm.tx_ack.ack_ranges = &qel->pktns->rx.ack_ranges;
+	    qel->pktns->rx.ack_ranges.sz) {
+		quic_ack_frm_init(&ack_frm, qel->pktns);
 		ack_frm_len = quic_ack_frm_reduce_sz(&ack_frm, end - pos);
 		if (!ack_frm_len)
 			goto err;
 
-		qel->pktns->flags &= ~QUIC_FL_PKTNS_ACK_REQUIRED;
+		qc_pktns_ack_sent(conn, qel->pktns);
 	}
 
 	/* Length field value without the CRYPTO frames data length. */
@@ -4089,12 +6152,7 @@ static ssize_t qc_do_build_hdshk_pkt(struct q_buf *wbuf,
 
 	add_ping_frm = 0;
 	padding_len = 0;
-	if (objt_server(conn->conn->target) &&
-	    pkt_type == QUIC_PACKET_TYPE_INITIAL &&
-	    len < QUIC_INITIAL_PACKET_MINLEN) {
-		len += padding_len = QUIC_INITIAL_PACKET_MINLEN - len;
-	}
-	else if (LIST_ISEMPTY(&pkt->frms)) {
+	if (LIST_ISEMPTY(&pkt->frms)) {
 		if (qel->pktns->tx.pto_probe) {
 			/* If we cannot send a CRYPTO frame, we send a PING frame. */
 			probe_packet = 1;
@@ -4106,9 +6164,23 @@ static ssize_t qc_do_build_hdshk_pkt(struct q_buf *wbuf,
 			len += padding_len = QUIC_PACKET_PN_MAXLEN - *pn_len;
 	}
 
-	/*
-	 * Length (of the remaining data). Must not fail because, the buffer size
-	 * has been checked above. Note that we have reserved QUIC_TLS_TAG_LEN bytes
+	if (padding) {
+		size_t dglen;
+
+		/* The datagram length: the packets before this one, this header
+		 * up to the Length field, this field and the remaining data.
+		 */
+		dglen = pos - wbuf->area + quic_int_getsize(len + QUIC_TLS_TAG_LEN) +
+			len + QUIC_TLS_TAG_LEN;
+		if (dglen < QUIC_INITIAL_PACKET_MINLEN) {
+			padding_len += QUIC_INITIAL_PACKET_MINLEN - dglen;
+			len += QUIC_INITIAL_PACKET_MINLEN - dglen;
+		}
+	}
+
+	/*
+	 * Length (of the remaining data). Must not fail because, the buffer size
+	 * has been checked above. Note that we have reserved QUIC_TLS_TAG_LEN bytes
 	 * for the encryption TAG. It must be taken into an account for the length
 	 * of this packet.
 	 */
@@ -4166,6 +6238,7 @@ static inline void quic_tx_packet_init(struct quic_tx_packet *pkt)
 {
 	pkt->cdata_len = 0;
 	pkt->in_flight_len = 0;
+	pkt->flags = 0;
 	LIST_INIT(&pkt->frms);
 }
 
@@ -4176,7 +6249,10 @@ static inline void free_quic_tx_packet(struct quic_tx_packet *pkt)
 
 	list_for_each_entry_safe(frm, frmbak, &pkt->frms, list) {
 		LIST_DEL(&frm->list);
-		pool_free(pool_head_quic_tx_frm, frm);
+		if (frm->type == QUIC_FT_CRYPTO)
+			pool_free(pool_head_quic_tx_frm, frm);
+		else
+			pool_free(pool_head_quic_frame, container_of(frm, struct quic_frame, list));
 	}
 	pool_free(pool_head_quic_tx_packet, pkt);
 }
@@ -4184,13 +6260,15 @@ static inline void free_quic_tx_packet(struct quic_tx_packet *pkt)
 /*
  * Build a handshake packet into <buf> packet buffer with <pkt_type> as packet
  * type for <qc> QUIC connection from CRYPTO data stream at <*offset> offset to
- * be encrypted at <qel> encryption level.
+ * be encrypted at <qel> encryption level. This packet is appended to the
+ * packets already coalesced into <buf>, and pads this datagram if <padding>
+ * is set (see qc_do_build_hdshk_pkt()).
  * Return -2 if the packet could not be encrypted for any reason, -1 if there was
  * not enough room in <buf> to build the packet, or the size of the built packet
  * if succeeded (may be zero if there is too much crypto data in flight to build the packet).
  */
 static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int pkt_type,
-                                  struct quic_enc_level *qel)
+                                  struct quic_enc_level *qel, int padding)
 {
 	/* The pointer to the packet number field. */
 	unsigned char *buf_pn;
@@ -4213,7 +6291,8 @@ static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int p
 	pn_len = 0;
 	buf_pn = NULL;
 	pn = qel->pktns->tx.next_pn + 1;
-	pkt_len = qc_do_build_hdshk_pkt(buf, pkt, pkt_type, pn, &pn_len, &buf_pn, qel, qc);
+	pkt_len = qc_do_build_hdshk_pkt(buf, pkt, pkt_type, pn, &pn_len, &buf_pn,
+	                                qel, padding, qc);
 	if (pkt_len <= 0) {
 		free_quic_tx_packet(pkt);
 		return pkt_len;
@@ -4230,8 +6309,7 @@ static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int p
 
 	end += QUIC_TLS_TAG_LEN;
 	pkt_len += QUIC_TLS_TAG_LEN;
-	if (!quic_apply_header_protection(beg, buf_pn, pn_len,
-	                                  tls_ctx->tx.hp, tls_ctx->tx.hp_key)) {
+	if (!quic_apply_header_protection(beg, buf_pn, pn_len, tls_ctx->tx.hp_ctx)) {
 		TRACE_DEVEL("Could not apply the header protection", QUIC_EV_CONN_HPKT, qc->conn);
 		goto err;
 	}
@@ -4248,10 +6326,12 @@ static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int p
 	/* Set the packet in fligth length for in flight packet only. */
 	if (pkt->flags & QUIC_FL_TX_PACKET_IN_FLIGHT)
 		pkt->in_flight_len = pkt_len;
+	pkt->len = pkt_len;
 	pkt->pktns = qel->pktns;
 	eb64_insert(&qel->pktns->tx.pkts, &pkt->pn_node);
 	/* Increment the number of bytes in <buf> buffer by the length of this packet. */
 	buf->data += pkt_len;
+	qc->tx.hs_bytes += pkt_len;
 	/* Update the counter of the in flight CRYPTO data. */
 	qc->ifcdata += pkt->cdata_len;
 	/* Attach this packet to <buf>. */
@@ -4266,26 +6346,62 @@ static ssize_t qc_build_hdshk_pkt(struct q_buf *buf, struct quic_conn *qc, int p
 	return -2;
 }
 
+/* Moves to <pkt> as much frames as possible of <frms> list, in order, encoding
+ * them at <*pos> without going beyond <end>. Returns 1 if all of them could be
+ * built, 0 if not, <pkt> being full.
+ */
+static inline int qc_build_frms_list(unsigned char **pos, const unsigned char *end,
+                                     struct list *frms, struct quic_tx_packet *pkt,
+                                     struct quic_conn *conn)
+{
+	struct quic_frame *frm, *sfrm;
+
+	list_for_each_entry_safe(frm, sfrm, frms, list) {
+		unsigned char *ppos;
+
+		ppos = *pos;
+		if (!qc_build_frm(&ppos, end, frm, pkt, conn)) {
+			TRACE_DEVEL("Frames not built", QUIC_EV_CONN_CPAPKT, conn->conn);
+			return 0;
+		}
+
+		LIST_DEL(&frm->list);
+		LIST_ADDQ(&pkt->frms, &frm->list);
+		*pos = ppos;
+	}
+
+	return 1;
+}
+
 /*
  * Prepare a clear post handhskake packet for <conn> QUIC connnection.
+ * If <probe_len> is not null, this packet is a DPLPMTUD probe of <probe_len>
+ * bytes made of a PING frame followed by PADDING.
  * Return the length of this packet if succeeded, -1 <wbuf> was full.
  */
 static ssize_t qc_do_build_phdshk_apkt(struct q_buf *wbuf,
                                        struct quic_tx_packet *pkt,
                                        int64_t pn, size_t *pn_len,
                                        unsigned char **buf_pn, struct quic_enc_level *qel,
-                                       struct quic_conn *conn)
+                                       size_t probe_len, struct quic_conn *conn)
 {
 	const unsigned char *beg, *end;
 	unsigned char *pos;
-	struct quic_frame *frm, *sfrm;
 	struct quic_frame ack_frm = { .type = QUIC_FT_ACK, };
 	size_t fake_len, ack_frm_len;
 	int64_t largest_acked_pn;
+	int i;
 
 	TRACE_ENTER(QUIC_EV_CONN_CPAPKT, conn->conn);
 	beg = pos = q_buf_getpos(wbuf);
-	end = q_buf_end(wbuf);
+	if (probe_len) {
+		if (probe_len > q_buf_room(wbuf))
+			goto err;
+		end = beg + probe_len;
+	}
+	else {
+		end = q_buf_end_mtu(wbuf, conn->path->mtu);
+	}
 	largest_acked_pn = qel->pktns->tx.largest_acked_pn;
 	/* Packet number length */
 	*pn_len = quic_packet_number_length(pn, largest_acked_pn);
@@ -4302,17 +6418,34 @@ static ssize_t qc_do_build_phdshk_apkt(struct q_buf *wbuf,
 	/* Packet number encoding. */
 	quic_packet_number_encode(&pos, end, pn, *pn_len);
 
-	/* Build an ACK frame if required. */
+	if (probe_len) {
+		struct quic_frame probe_frm = { .type = QUIC_FT_PING, };
+
+		if (!qc_build_frm(&pos, end, &probe_frm, pkt, conn))
+			goto err;
+
+		if (end > pos) {
+			probe_frm.type = QUIC_FT_PADDING;
+			probe_frm.padding.len = end - pos;
+			if (!qc_build_frm(&pos, end, &probe_frm, pkt, conn))
+				goto err;
+		}
+		pkt->flags |= QUIC_FL_TX_PACKET_PMTUD_PROBE;
+		goto out;
+	}
+
+	/* Build an ACK frame if required, or if an ACK is being delayed as it
+	 * may be sent at no cost with the other frames of this packet.
+	 */
 	ack_frm_len = 0;
-	if ((qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) &&
-	    !LIST_ISEMPTY(&qel->pktns->rx.ack_ranges.list)) {
-		ack_frm.tx_ack.ack_delay = 0;
-		ack_frm.tx_ack.ack_ranges = &qel->pktns->rx.ack_ranges;
+	if (((qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) || tick_isset(conn->rx.ack_expire)) &&
+	    qel->pktns->rx.ack_ranges.sz) {
+		quic_ack_frm_init(&ack_frm, qel->pktns);
 		ack_frm_len = quic_ack_frm_reduce_sz(&ack_frm, end - pos);
 		if (!ack_frm_len)
 			goto err;
 
-		qel->pktns->flags &= ~QUIC_FL_PKTNS_ACK_REQUIRED;
+		qc_pktns_ack_sent(conn, qel->pktns);
 	}
 
 	if (ack_frm_len)
@@ -4340,19 +6473,13 @@ static ssize_t qc_do_build_phdshk_apkt(struct q_buf *wbuf,
 		}
 	}
 
-	/* Encode a maximum of frames. */
-	list_for_each_entry_safe(frm, sfrm, &conn->tx.frms_to_send, list) {
-		unsigned char *ppos;
-
-		ppos = pos;
-		if (!qc_build_frm(&ppos, end, frm, pkt, conn)) {
-			TRACE_DEVEL("Frames not built", QUIC_EV_CONN_CPAPKT, conn->conn);
-			break;
-		}
-
-		LIST_DEL(&frm->list);
-		LIST_ADDQ(&pkt->frms, &frm->list);
-		pos = ppos;
+	/* Encode a maximum of frames: the control and resent ones first, then
+	 * the new STREAM frames, the most urgent class first.
+	 */
+	if (qc_build_frms_list(&pos, end, &conn->tx.frms_to_send, pkt, conn)) {
+		for (i = 0; i < QUIC_TX_PRIO_NB; i++)
+			if (!qc_build_frms_list(&pos, end, &conn->tx.strm_frms[i], pkt, conn))
+				break;
 	}
 
  out:
@@ -4366,11 +6493,14 @@ static ssize_t qc_do_build_phdshk_apkt(struct q_buf *wbuf,
 
 /*
  * Prepare a post handhskake packet at Application encryption level for <conn>
- * QUIC connnection.
+ * QUIC connnection, or a DPLPMTUD probe of <probe_len> bytes if not null.
+ * Its header protection is deferred into <hpb> batch, which must be applied
+ * before sending it.
  * Return the length of this packet if succeeded, -1 if <wbuf> was full,
  * -2 in case of major error (encryption failure).
  */
-static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, struct quic_conn *qc)
+static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, size_t probe_len,
+                                    struct quic_conn *qc, struct quic_hp_batch *hpb)
 {
 	/* A pointer to the packet number fiel in <buf> */
 	unsigned char *buf_pn;
@@ -4390,12 +6520,13 @@ static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, struct quic_conn *qc)
 	}
 
 	quic_tx_packet_init(pkt);
+	qc_tls_ku_initiate(qc);
 	beg = q_buf_getpos(wbuf);
 	qel = &qc->els[QUIC_TLS_ENC_LEVEL_APP];
 	pn_len = 0;
 	buf_pn = NULL;
 	pn = qel->pktns->tx.next_pn + 1;
-	pkt_len = qc_do_build_phdshk_apkt(wbuf, pkt, pn, &pn_len, &buf_pn, qel, qc);
+	pkt_len = qc_do_build_phdshk_apkt(wbuf, pkt, pn, &pn_len, &buf_pn, qel, probe_len, qc);
 	if (pkt_len <= 0) {
 		QDPRINTF("%s returns %zd\n", __func__, pkt_len);
 		free_quic_tx_packet(pkt);
@@ -4413,13 +6544,13 @@ static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, struct quic_conn *qc)
 
 	end += QUIC_TLS_TAG_LEN;
 	pkt_len += QUIC_TLS_TAG_LEN;
-	if (!quic_apply_header_protection(beg, buf_pn, pn_len,
-	                                  tls_ctx->tx.hp, tls_ctx->tx.hp_key)) {
+	if (!qc_hp_batch_add(hpb, &tls_ctx->tx, beg, buf_pn, pn_len)) {
 		QDPRINTF("%s: could not apply header protection\n", __func__);
 		return -2;
 	}
 
 	q_buf_setpos(wbuf, end);
+	qc->ku.tx_pkts++;
 	/* Consume a packet number. */
 	++qel->pktns->tx.next_pn;
 	/* Attach the built packet to its tree. */
@@ -4428,6 +6559,7 @@ static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, struct quic_conn *qc)
 	/* Set the packet in fligth length for in flight packet only. */
 	if (pkt->flags & QUIC_FL_TX_PACKET_IN_FLIGHT)
 		pkt->in_flight_len = pkt_len;
+	pkt->len = pkt_len;
 	pkt->pktns = qel->pktns;
 	/* Increment the number of bytes in <buf> buffer by the length of this packet. */
 	wbuf->data += pkt_len;
@@ -4441,15 +6573,20 @@ static ssize_t qc_build_phdshk_apkt(struct q_buf *wbuf, struct quic_conn *qc)
 
 /*
  * Prepare a maximum of QUIC Application level packets from <ctx> QUIC
- * connection I/O handler context.
+ * connection I/O handler context. The header protection of these packets is
+ * applied by batches.
  * Returns 1 if succeeded, 0 if not.
  */
 static int qc_prep_phdshk_pkts(struct quic_conn *qc)
 {
 	struct q_buf *wbuf;
 	struct quic_enc_level *qel;
+	struct quic_conn_ctx *ctx;
+	struct quic_pmtud *pmtud;
+	struct quic_hp_batch hpb = { .nb = 0, };
 
 	TRACE_ENTER(QUIC_EV_CONN_PAPKTS, qc->conn);
+	qc_drain_frms_in(qc);
 	wbuf = q_wbuf(qc);
 	qel = &qc->els[QUIC_TLS_ENC_LEVEL_APP];
 	while (q_buf_empty(wbuf)) {
@@ -4457,18 +6594,20 @@ static int qc_prep_phdshk_pkts(struct quic_conn *qc)
 
 		if (!(qel->pktns->flags & QUIC_FL_PKTNS_ACK_REQUIRED) &&
 		    (LIST_ISEMPTY(&qel->pktns->tx.frms) ||
-		     qc->ifcdata >= QUIC_CRYPTO_IN_FLIGHT_MAX)) {
+		     qc->ifcdata >= QUIC_CRYPTO_IN_FLIGHT_MAX) &&
+		    !qc_has_frms_to_send(qc)) {
 			TRACE_DEVEL("nothing more to do",
 			            QUIC_EV_CONN_PAPKTS, qc->conn);
 			break;
 		}
 
-		ret = qc_build_phdshk_apkt(wbuf, qc);
+		ret = qc_build_phdshk_apkt(wbuf, 0, qc, &hpb);
 		switch (ret) {
 		case -1:
 			/* Not enough room left in <wbuf>. */
 			wbuf = q_next_wbuf(qc);
 		case -2:
+			qc_hp_batch_apply(&hpb);
 			return 0;
 		default:
 			/* XXX TO CHECK: consume a buffer. */
@@ -4476,126 +6615,1730 @@ static int qc_prep_phdshk_pkts(struct quic_conn *qc)
 			continue;
 		}
 	}
+
+	/* Path MTU discovery, started after the handshake confirmation. Each probe
+	 * is alone in its datagram.
+	 */
+	ctx = qc->conn->xprt_ctx;
+	pmtud = &qc->path->pmtud;
+	if (pmtud->state == QUIC_PMTUD_ST_BASE && ctx->state >= QUIC_HS_ST_CONFIRMED)
+		qc_pmtud_start(qc);
+	if (q_buf_empty(wbuf) && qc_pmtud_probe_needed(qc->path)) {
+		ssize_t ret;
+
+		ret = qc_build_phdshk_apkt(wbuf, pmtud->size, qc, &hpb);
+		if (ret == -2) {
+			qc_hp_batch_apply(&hpb);
+			return 0;
+		}
+
+		if (ret > 0) {
+			pmtud->pn = qel->pktns->tx.next_pn;
+			q_next_wbuf(qc);
+		}
+	}
+
+	if (!qc_hp_batch_apply(&hpb))
+		return 0;
+
 	TRACE_LEAVE(QUIC_EV_CONN_PAPKTS, qc->conn);
 
 	return 1;
 }
 
 /*
- * Read all the QUIC packets found in <buf> with <len> as length (typically a UDP
- * datagram), <ctx> being the QUIC I/O handler context, from QUIC connections,
- * calling <func> function;
+ * Read all the QUIC packets found in <dgram> UDP datagram with <len> as length,
+ * <ctx> being the QUIC I/O handler context, from QUIC connections, calling
+ * <func> function. Each packet takes a reference on <dgram>.
+ * If <dgram> is made of several UDP segments coalesced by GRO, they are parsed
+ * one after the other as distinct datagrams, but sharing the same datagram
+ * context so that their DCID is looked up only once.
  * Return the number of bytes read if succeded, -1 if not.
  */
-static ssize_t quic_packets_read(char *buf, size_t len, void *ctx,
+static ssize_t quic_packets_read(struct quic_dgram *dgram, size_t len, void *ctx,
                                  struct sockaddr_storage *saddr, socklen_t *saddrlen,
                                  qpkt_read_func *func)
 {
-	unsigned char *pos;
+	unsigned char *buf = dgram->data;
+	unsigned char *pos, *seg;
 	const unsigned char *end;
+	size_t segsz;
 	struct quic_dgram_ctx dgram_ctx = {
 		.dcid_node = NULL,
 		.ctx = ctx,
 	};
 
-	pos = (unsigned char *)buf;
-	end = pos + len;
-
-	do {
-		int ret;
-		struct quic_rx_packet *qpkt;
-
-		qpkt = pool_alloc(pool_head_quic_rx_packet);
-		if (!qpkt) {
-			QDPRINTF("Not enough memory to allocate a new packet\n");
-			goto err;
-		}
-
-		memset(qpkt, 0, sizeof(*qpkt));
-		qpkt->refcnt = 1;
-		ret = func(&pos, end, qpkt, &dgram_ctx, saddr, saddrlen);
-		if (ret == -1) {
-			size_t pkt_len;
+	/* The packets are processed later, possibly from another address. */
+	if (saddr != &dgram->saddr)
+		memcpy(&dgram->saddr, saddr, *saddrlen);
+
+	segsz = dgram->segsz && dgram->segsz < len ? dgram->segsz : len;
+	pos = buf;
+	for (seg = buf; seg < buf + len; seg += segsz) {
+		pos = seg;
+		end = seg + segsz < buf + len ? seg + segsz : buf + len;
+		do {
+			int ret;
+			struct quic_rx_packet *qpkt;
+			unsigned long long start = 0;
+
+			qpkt = pool_alloc(pool_head_quic_rx_packet);
+			if (!qpkt) {
+				QDPRINTF("Not enough memory to allocate a new packet\n");
+				goto err;
+			}
 
-			pkt_len = qpkt->len;
-			free_quic_rx_packet(qpkt);
-			/* If the packet length could not be found, we cannot continue. */
-			if (!pkt_len)
-				break;
-		}
-	} while (pos < end);
+			memset(qpkt, 0, sizeof(*qpkt));
+			qpkt->refcnt = 1;
+			qpkt->dgram = dgram;
+			quic_dgram_refinc(dgram);
+			if (unlikely(quic_replaying))
+				start = rdtsc();
+			ret = func(&pos, end, qpkt, &dgram_ctx, saddr, saddrlen);
+			if (start)
+				quic_replay_account(QUIC_RS_PKT, start);
+			if (ret == -1) {
+				size_t pkt_len;
+
+				pkt_len = qpkt->len;
+				free_quic_rx_packet(qpkt);
+				/* If the packet length could not be found, we cannot continue. */
+				if (!pkt_len)
+					break;
+			}
+		} while (pos < end);
+	}
 
 	/* Increasing the received bytes counter by the UDP datagram length
 	 * if this datagram could be associated to a connection.
 	 */
-	if (dgram_ctx.quic_conn)
+	if (dgram_ctx.quic_conn) {
 		dgram_ctx.quic_conn->rx.bytes += len;
+		dgram_ctx.quic_conn->flags &= ~QUIC_FL_CONN_AMP_LIMITED;
+	}
 
-	return pos - (unsigned char *)buf;
+	return pos - buf;
 
  err:
 	return -1;
 }
 
-/*
- * QUIC I/O handler for connection to local listeners or remove servers
- * depending on <listener> boolean value, with <fd> as socket file
- * descriptor and <ctx> as context.
+#ifdef USE_THREAD
+/* Find the thread owning the connection <dgram> datagram with <len> as length
+ * received by <l> listener from <saddr> is for. Short header packets and long
+ * header packets others than Initial ones carry one of our CIDs whose first
+ * byte is the owning thread. For Initial packets, the connection is looked up.
+ * If not found, it will be created by the current thread.
+ * Returns the owning thread ID.
  */
-static size_t quic_conn_handler(int fd, void *ctx, qpkt_read_func *func)
+static unsigned int quic_lstnr_dgram_tid(struct quic_dgram *dgram, size_t len,
+                                         struct listener *l,
+                                         struct sockaddr_storage *saddr)
+{
+	unsigned char *buf = dgram->data;
+	const unsigned char *end = buf + len;
+	unsigned char type, dcid_len;
+	struct quic_cid dcid;
+	struct ebmb_node *node;
+	struct quic_conn *conn;
+
+	if (!len)
+		return tid;
+
+	if (!(*buf & QUIC_PACKET_LONG_HEADER_BIT)) {
+		if (end - buf < 1 + QUIC_CID_LEN)
+			return tid;
+
+		return quic_cid_tid(buf + 1);
+	}
+
+	/* First byte, version (4 bytes) and the DCID length. */
+	if (end - buf < 6)
+		return tid;
+
+	type = (*buf >> QUIC_PACKET_TYPE_SHIFT) & QUIC_PACKET_TYPE_BITMASK;
+	dcid_len = buf[5];
+	buf += 6;
+	if (dcid_len > QUIC_CID_MAXLEN || end - buf < dcid_len)
+		return tid;
+
+	/* The 0-RTT packets may be sent with the DCID of the Initial ones. */
+	if (type != QUIC_PACKET_TYPE_INITIAL && type != QUIC_PACKET_TYPE_0RTT)
+		return dcid_len == QUIC_CID_LEN ? quic_cid_tid(buf) : tid;
+
+	memcpy(dcid.data, buf, dcid_len);
+	dcid.len = dcid_len;
+	quic_cid_saddr_cat(&dcid, saddr);
+	node = quic_cid_lookup(quic_cid_tree_get(l->icids, dcid.data, dcid.len),
+	                       dcid.data, dcid.len);
+	if (node) {
+		conn = ebmb_entry(node, struct quic_conn, odcid_node);
+		return conn->tid;
+	}
+
+	/* The client may already use one of our CIDs. */
+	if (dcid_len == QUIC_CID_LEN)
+		return quic_cid_tid(buf);
+
+	return tid;
+}
+
+/* Hand over <dgram> datagram with <len> as length received by <l> listener
+ * from <saddr> to the thread owning its connection if not the current one.
+ * The handler of this thread takes a reference on <dgram>.
+ * Returns 1 if handed over, 0 if it must be processed by the current thread.
+ */
+static int quic_lstnr_dgram_dispatch(struct quic_dgram *dgram, size_t len,
+                                     struct listener *l,
+                                     struct sockaddr_storage *saddr, socklen_t saddrlen)
+{
+	unsigned int cid_tid;
+
+	if (global.nbthread == 1)
+		return 0;
+
+	cid_tid = quic_lstnr_dgram_tid(dgram, len, l, saddr);
+	if (cid_tid == tid)
+		return 0;
+
+	dgram->owner = l;
+	dgram->len = len;
+	memcpy(&dgram->saddr, saddr, saddrlen);
+	quic_dgram_refinc(dgram);
+	MT_LIST_ADDQ(&quic_dghdlrs[cid_tid].dgrams, &dgram->list);
+	tasklet_wakeup(quic_dghdlrs[cid_tid].task);
+
+	return 1;
+}
+
+/* Process the datagrams handed over to the current thread by the others.
+ * <ctx> is the handler of this thread.
+ */
+static struct task *quic_dghdlr_process(struct task *t, void *ctx, unsigned short state)
+{
+	struct quic_dghdlr *dghdlr = ctx;
+	struct quic_dgram *dgram;
+	int max = global.tune.maxpollevents;
+
+	while (max-- > 0 &&
+	       (dgram = MT_LIST_POP(&dghdlr->dgrams, struct quic_dgram *, list))) {
+		socklen_t saddrlen = sizeof dgram->saddr;
+
+		quic_packets_read(dgram, dgram->len, dgram->owner,
+		                  &dgram->saddr, &saddrlen, qc_lstnr_pkt_rcv);
+		quic_dgram_refdec(dgram);
+	}
+
+	/* Some datagrams remain: let the other tasks run before going on. */
+	if (!MT_LIST_ISEMPTY(&dghdlr->dgrams))
+		tasklet_wakeup((struct tasklet *)t);
+
+	return t;
+}
+
+/* Initializes the per-thread datagram handlers. Returns 0 on success,
+ * otherwise ERR_* flags.
+ */
+static int quic_dghdlrs_init()
 {
+	struct tasklet *t;
+	int i;
+
+	for (i = 0; i < global.nbthread; i++) {
+		t = tasklet_new();
+		if (!t) {
+			ha_alert("Out of memory while initializing QUIC datagram handler for thread %d\n", i);
+			return ERR_FATAL|ERR_ABORT;
+		}
+		t->tid = i;
+		t->process = quic_dghdlr_process;
+		t->context = &quic_dghdlrs[i];
+		MT_LIST_INIT(&quic_dghdlrs[i].dgrams);
+		quic_dghdlrs[i].task = t;
+	}
+	return 0;
+}
+
+REGISTER_CONFIG_POSTPARSER("QUIC datagram handlers", quic_dghdlrs_init);
+#endif
+
+/* Pass <dgram> datagram with <len> as length to quic_packets_read(), except
+ * for listeners when it is for a connection owned by another thread.
+ */
+static inline void quic_dgram_read_local(struct quic_dgram *dgram, size_t len, void *ctx,
+                                         struct sockaddr_storage *saddr, socklen_t *saddrlen,
+                                         qpkt_read_func *func)
+{
+#ifdef USE_THREAD
+	if (func == qc_lstnr_pkt_rcv &&
+	    quic_lstnr_dgram_dispatch(dgram, len, ctx, saddr, *saddrlen))
+		return;
+#endif
+	quic_packets_read(dgram, len, ctx, saddr, saddrlen, func);
+}
+
+/* Fills <addr> with the address of the handover socket of the process of
+ * generation <gen>.
+ */
+static void quic_ho_addr(struct sockaddr_un *addr, int gen)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s.%d", quic_ho_path, gen);
+}
+
+/* Returns the generation of the process owning the connection <dgram> datagram
+ * with <len> as length received by <l> listener from <saddr> is for, as found
+ * in the second byte of the DCID. For the Initial and 0-RTT packets, whose DCID
+ * may have been chosen by the client, the connection is looked up unless the
+ * DCID matches another process. Returns -1 if it opens a new connection, or -2
+ * if the datagram cannot be parsed.
+ */
+static int quic_ho_dgram_gen(struct quic_dgram *dgram, size_t len,
+                             struct listener *l, struct sockaddr_storage *saddr)
+{
+	unsigned char *buf = dgram->data;
+	const unsigned char *end = buf + len;
+	unsigned char type, dcid_len;
+	struct quic_cid dcid;
+
+	if (!len)
+		return -2;
+
+	if (!(*buf & QUIC_PACKET_LONG_HEADER_BIT)) {
+		if (end - buf < 1 + QUIC_CID_LEN)
+			return -2;
+
+		return buf[2];
+	}
+
+	/* First byte, version (4 bytes) and the DCID length. */
+	if (end - buf < 6)
+		return -2;
+
+	type = (*buf >> QUIC_PACKET_TYPE_SHIFT) & QUIC_PACKET_TYPE_BITMASK;
+	dcid_len = buf[5];
+	buf += 6;
+	if (dcid_len > QUIC_CID_MAXLEN || end - buf < dcid_len)
+		return -2;
+
+	if (type != QUIC_PACKET_TYPE_INITIAL && type != QUIC_PACKET_TYPE_0RTT)
+		return dcid_len == QUIC_CID_LEN ? buf[1] : -2;
+
+	if (dcid_len == QUIC_CID_LEN) {
+		/* The client may already use one of our CIDs, or of another process. */
+		if (buf[1] != quic_proc_gen && ha_bit_test(buf[1], quic_ho_gens))
+			return buf[1];
+		if (quic_cid_lookup(quic_cid_tree_get(l->cids, buf, dcid_len), buf, dcid_len))
+			return quic_proc_gen;
+	}
+
+	memcpy(dcid.data, buf, dcid_len);
+	dcid.len = dcid_len;
+	quic_cid_saddr_cat(&dcid, saddr);
+	if (quic_cid_lookup(quic_cid_tree_get(l->icids, dcid.data, dcid.len),
+	                    dcid.data, dcid.len))
+		return quic_proc_gen;
+
+	return -1;
+}
+
+/* Sends a <type> message with <flags> to the process of generation <gen>. For
+ * a DGRAM, <dgram> is the datagram with <len> as length received by <l>
+ * listener from <saddr>. The process is forgotten if it is not alive anymore.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int quic_ho_send(int gen, unsigned char type, unsigned char flags,
+                        struct quic_dgram *dgram, size_t len,
+                        struct listener *l, struct sockaddr_storage *saddr)
+{
+	struct quic_ho_hdr hdr;
+	struct sockaddr_un addr;
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_name       = &addr,
+		.msg_namelen    = sizeof addr,
+		.msg_iov        = iov,
+		.msg_iovlen     = 1,
+	};
+
+	memset(&hdr, 0, sizeof hdr);
+	hdr.magic = QUIC_HO_MAGIC;
+	hdr.type = type;
+	hdr.flags = flags;
+	hdr.gen = quic_proc_gen;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof hdr;
+	if (dgram) {
+		hdr.ecn = dgram->ecn;
+		hdr.segsz = dgram->segsz;
+		hdr.laddr = l->addr;
+		hdr.saddr = *saddr;
+		iov[1].iov_base = dgram->data;
+		iov[1].iov_len = len;
+		msg.msg_iovlen = 2;
+	}
+
+	quic_ho_addr(&addr, gen);
+	if (sendmsg(quic_ho_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno == ECONNREFUSED || errno == ENOENT) {
+			HA_ATOMIC_AND(&quic_ho_gens[gen / LONGBITS], ~(1UL << (gen % LONGBITS)));
+			if (quic_next_gen == gen)
+				quic_next_gen = -1;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Forwards <dgram> datagram with <len> as length received by <l> listener from
+ * <saddr> to the process owning its connection if not this one. Once stopping,
+ * the datagrams opening new connections are forwarded to the newest process,
+ * or dropped if there is none.
+ * Returns 1 if the datagram was consumed, 0 if it must be processed locally.
+ */
+static int quic_ho_dgram_forward(struct quic_dgram *dgram, size_t len,
+                                 struct listener *l, struct sockaddr_storage *saddr)
+{
+	int gen;
+
+	gen = quic_ho_dgram_gen(dgram, len, l, saddr);
+	if (gen >= 0 && gen != quic_proc_gen && ha_bit_test(gen, quic_ho_gens) &&
+	    quic_ho_send(gen, QUIC_HO_T_DGRAM, 0, dgram, len, l, saddr)) {
+		HA_ATOMIC_ADD(&l->quic_counters.ho_fwd, 1);
+		return 1;
+	}
+
+	if (gen == -1 && stopping) {
+		if (quic_next_gen >= 0 &&
+		    quic_ho_send(quic_next_gen, QUIC_HO_T_DGRAM, QUIC_HO_F_NEW, dgram, len, l, saddr))
+			HA_ATOMIC_ADD(&l->quic_counters.ho_fwd, 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Returns the QUIC listener bound to <addr>, or NULL if none. */
+static struct listener *quic_ho_listener(struct sockaddr_storage *addr)
+{
+	static struct listener *last;
+	struct proxy *px;
+	struct listener *l;
+
+	if (last && last->addr.ss_family == addr->ss_family &&
+	    get_net_port(&last->addr) == get_net_port(addr) && ipcmp(&last->addr, addr) == 0)
+		return last;
+
+	for (px = proxies_list; px; px = px->next) {
+		list_for_each_entry(l, &px->conf.listeners, by_fe) {
+			if (!l->bind_conf->is_quic || l->addr.ss_family != addr->ss_family)
+				continue;
+			if (get_net_port(&l->addr) == get_net_port(addr) && ipcmp(&l->addr, addr) == 0) {
+				last = l;
+				return l;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* I/O handler of the handover socket, on the first thread. The datagrams
+ * forwarded by the other processes are processed as if they were received by
+ * the listener bound to the same address, except that once stopping, the new
+ * connections are passed on to the newest process.
+ */
+static void quic_ho_fd_handler(int fd)
+{
+	struct quic_ho_hdr hdr;
+	struct quic_dgram *dgram;
+	struct listener *l;
+	struct iovec iov[2];
+	struct msghdr msg;
+	socklen_t saddrlen;
 	ssize_t ret;
-	size_t done = 0;
-	struct buffer *buf = get_trash_chunk();
-	/* Source address */
-	struct sockaddr_storage saddr = {0};
-	socklen_t saddrlen = sizeof saddr;
+	size_t len;
+	int max = global.tune.maxpollevents;
 
 	if (!fd_recv_ready(fd))
-		return 0;
+		return;
 
-	do {
-		ret = recvfrom(fd, buf->area, buf->size, 0,
-		               (struct sockaddr *)&saddr, &saddrlen);
+	while (max-- > 0) {
+		dgram = quic_dgram_new();
+		if (!dgram)
+			return;
+
+		memset(&msg, 0, sizeof msg);
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = sizeof hdr;
+		iov[1].iov_base = dgram->data;
+		iov[1].iov_len = quic_dgram_bufsz;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		ret = recvmsg(fd, &msg, MSG_DONTWAIT);
 		if (ret < 0) {
+			quic_dgram_refdec(dgram);
 			if (errno == EINTR)
 				continue;
 			if (errno == EAGAIN)
 				fd_cant_recv(fd);
-			goto out;
+			return;
 		}
-	} while (0);
 
-	QDPRINTF("-------------------------------------------"
-	         "-----------------\n%s: recvfrom() server (%ld)\n", __func__, ret);
+		if (ret < sizeof hdr || hdr.magic != QUIC_HO_MAGIC || hdr.gen == quic_proc_gen)
+			goto next;
 
-	done = buf->data = ret;
-	quic_packets_read(buf->area, buf->data, ctx, &saddr, &saddrlen, func);
+		HA_ATOMIC_OR(&quic_ho_gens[hdr.gen / LONGBITS], 1UL << (hdr.gen % LONGBITS));
+		if (hdr.type == QUIC_HO_T_HELLO) {
+			quic_next_gen = hdr.gen;
+			goto next;
+		}
 
- out:
-	return done;
+		l = quic_ho_listener(&hdr.laddr);
+		if (!l)
+			goto next;
+
+		len = ret - sizeof hdr;
+		dgram->ecn = hdr.ecn;
+		dgram->segsz = hdr.segsz;
+		HA_ATOMIC_ADD(&l->quic_counters.ho_rcvd, 1);
+		if (stopping && quic_ho_dgram_gen(dgram, len, l, &hdr.saddr) == -1) {
+			/* Not for one of our connections, pass it on. */
+			if (quic_next_gen >= 0)
+				quic_ho_send(quic_next_gen, QUIC_HO_T_DGRAM, QUIC_HO_F_NEW,
+				             dgram, len, l, &hdr.saddr);
+			goto next;
+		}
+
+		saddrlen = get_addr_len(&hdr.saddr);
+		quic_dgram_read_local(dgram, len, l, &hdr.saddr, &saddrlen, qc_lstnr_pkt_rcv);
+	  next:
+		quic_dgram_refdec(dgram);
+	}
 }
 
-/*
- * QUIC I/O handler for connections to local listeners with <fd> as socket
- * file descriptor.
+/* Pass <dgram> datagram with <len> as length to quic_packets_read(), except
+ * for listeners when it is for a connection owned by another thread, or by
+ * another process with "quic-handover".
  */
-void quic_fd_handler(int fd)
+static inline void quic_dgram_read(struct quic_dgram *dgram, size_t len, void *ctx,
+                                   struct sockaddr_storage *saddr, socklen_t *saddrlen,
+                                   qpkt_read_func *func)
 {
-	if (fdtab[fd].ev & FD_POLL_IN)
-		quic_conn_handler(fd, fdtab[fd].owner, &qc_lstnr_pkt_rcv);
+	if (func == qc_lstnr_pkt_rcv && quic_proc_gen >= 0 &&
+	    quic_ho_dgram_forward(dgram, len, ctx, saddr))
+		return;
+
+	quic_dgram_read_local(dgram, len, ctx, saddr, saddrlen, func);
 }
 
-/*
- * QUIC I/O handler for connections to remote servers with <fd> as socket
- * file descriptor.
+/* Set the ECN codepoint and the GRO segment size of <dgram> datagram from the
+ * control messages of <msg> with which it was received.
  */
-void quic_conn_fd_handler(int fd)
+static inline void quic_dgram_cmsgs(struct quic_dgram *dgram, struct msghdr *msg)
 {
-	if (fdtab[fd].ev & FD_POLL_IN)
-		quic_conn_handler(fd, fdtab[fd].owner, &qc_srv_pkt_rcv);
+#if defined(QUIC_USE_ECN) || defined(QUIC_USE_GRO)
+	struct cmsghdr *cmsg;
+	int val;
+#endif
+
+	dgram->ecn = QUIC_ECN_NOT_ECT;
+	dgram->segsz = 0;
+#if defined(QUIC_USE_ECN) || defined(QUIC_USE_GRO)
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef QUIC_USE_ECN
+		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS &&
+		    cmsg->cmsg_len >= CMSG_LEN(1)) {
+			dgram->ecn = *CMSG_DATA(cmsg) & QUIC_ECN_MASK;
+		}
+		else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_TCLASS &&
+		         cmsg->cmsg_len >= CMSG_LEN(sizeof val)) {
+			memcpy(&val, CMSG_DATA(cmsg), sizeof val);
+			dgram->ecn = val & QUIC_ECN_MASK;
+		}
+#endif
+#ifdef QUIC_USE_GRO
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO &&
+		    cmsg->cmsg_len >= CMSG_LEN(sizeof val)) {
+			memcpy(&val, CMSG_DATA(cmsg), sizeof val);
+			dgram->segsz = val > 0 ? val : 0;
+		}
+#endif
+	}
+#endif
 }
 
+#ifdef QUIC_USE_RECVMMSG
+/* Receive up to <quic_rx_batch> datagrams from <fd> with a single recvmmsg()
+ * call into the per-thread datagram ring, then pass each of them to
+ * quic_dgram_read() with <ctx> and <func> as for quic_conn_handler().
+ * Returns the number of bytes received.
+ */
+static size_t quic_conn_handler_batch(int fd, void *ctx, qpkt_read_func *func)
+{
+	int i, nb, ret;
+	size_t done = 0;
+	struct quic_rx_dgrams *rxd = &quic_rx_dgrams;
+
+	for (nb = 0; nb < quic_rx_batch; nb++) {
+		/* Refill the slots whose datagram is still referenced by packets. */
+		if (!rxd->dgrams[nb]) {
+			rxd->dgrams[nb] = quic_dgram_new();
+			if (!rxd->dgrams[nb])
+				break;
+			rxd->iovs[nb].iov_base = rxd->dgrams[nb]->data;
+		}
+		rxd->iovs[nb].iov_len = quic_dgram_bufsz;
+		rxd->msgs[nb].msg_hdr.msg_namelen = sizeof *rxd->addrs;
+		rxd->msgs[nb].msg_hdr.msg_control = rxd->cmsgs[nb].buf;
+		rxd->msgs[nb].msg_hdr.msg_controllen = sizeof rxd->cmsgs[nb].buf;
+		rxd->msgs[nb].msg_hdr.msg_flags = 0;
+	}
+
+	if (!nb)
+		return 0;
+
+	do {
+		ret = recvmmsg(fd, rxd->msgs, nb, 0, NULL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				fd_cant_recv(fd);
+			goto out;
+		}
+	} while (0);
+
+	QDPRINTF("-------------------------------------------"
+	         "-----------------\n%s: recvmmsg() server (%d)\n", __func__, ret);
+
+	for (i = 0; i < ret; i++) {
+		struct msghdr *msg = &rxd->msgs[i].msg_hdr;
+		size_t len = rxd->msgs[i].msg_len;
+
+		done += len;
+		/* Truncated datagrams cannot be parsed. */
+		if (msg->msg_flags & MSG_TRUNC)
+			continue;
+
+		quic_dgram_cmsgs(rxd->dgrams[i], msg);
+		quic_dgram_read(rxd->dgrams[i], len, ctx,
+		                &rxd->addrs[i], &msg->msg_namelen, func);
+		/* Keep this buffer for the next call only if no packet refers to it. */
+		if (rxd->dgrams[i]->refcnt > 1) {
+			quic_dgram_refdec(rxd->dgrams[i]);
+			rxd->dgrams[i] = NULL;
+		}
+	}
+
+ out:
+	return done;
+}
+#endif
+
+/*
+ * QUIC I/O handler for connection to local listeners or remove servers
+ * depending on <listener> boolean value, with <fd> as socket file
+ * descriptor and <ctx> as context.
+ */
+static size_t quic_conn_handler(int fd, void *ctx, qpkt_read_func *func)
+{
+	ssize_t ret;
+	size_t done = 0;
+	struct quic_dgram *dgram;
+	/* Source address */
+	struct sockaddr_storage saddr = {0};
+	socklen_t saddrlen;
+	struct iovec iov;
+	union quic_rx_cmsg cmsg;
+	struct msghdr msg = {
+		.msg_name       = &saddr,
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+	};
+
+	if (!fd_recv_ready(fd))
+		return 0;
+
+#ifdef QUIC_USE_RECVMMSG
+	if (quic_rx_batch > 1)
+		return quic_conn_handler_batch(fd, ctx, func);
+#endif
+
+	dgram = quic_dgram_new();
+	if (!dgram)
+		return 0;
+
+	iov.iov_base = dgram->data;
+	iov.iov_len = quic_dgram_bufsz;
+	do {
+		msg.msg_namelen = sizeof saddr;
+		msg.msg_control = cmsg.buf;
+		msg.msg_controllen = sizeof cmsg.buf;
+		ret = recvmsg(fd, &msg, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				fd_cant_recv(fd);
+			goto out;
+		}
+	} while (0);
+
+	QDPRINTF("-------------------------------------------"
+	         "-----------------\n%s: recvmsg() server (%ld)\n", __func__, ret);
+
+	done = ret;
+	saddrlen = msg.msg_namelen;
+	quic_dgram_cmsgs(dgram, &msg);
+	quic_dgram_read(dgram, ret, ctx, &saddr, &saddrlen, func);
+
+ out:
+	quic_dgram_refdec(dgram);
+	return done;
+}
+
+/*
+ * QUIC I/O handler for connections to local listeners with <fd> as socket
+ * file descriptor.
+ */
+void quic_fd_handler(int fd)
+{
+	if (fdtab[fd].ev & FD_POLL_IN)
+		quic_conn_handler(fd, fdtab[fd].owner, &qc_lstnr_pkt_rcv);
+}
+
+/*
+ * QUIC I/O handler for connections to remote servers with <fd> as socket
+ * file descriptor.
+ */
+void quic_conn_fd_handler(int fd)
+{
+	if (fdtab[fd].ev & FD_POLL_IN)
+		quic_conn_handler(fd, fdtab[fd].owner, &qc_srv_pkt_rcv);
+}
+
+#ifdef QUIC_USE_RECVMMSG
+/* Allocate the per-thread datagram ring used by quic_conn_handler_batch().
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int quic_alloc_rx_dgrams_per_thread()
+{
+	int i;
+	struct quic_rx_dgrams *rxd = &quic_rx_dgrams;
+
+	if (quic_rx_batch <= 1)
+		return 1;
+
+	rxd->msgs  = calloc(quic_rx_batch, sizeof *rxd->msgs);
+	rxd->iovs  = calloc(quic_rx_batch, sizeof *rxd->iovs);
+	rxd->addrs = calloc(quic_rx_batch, sizeof *rxd->addrs);
+	rxd->cmsgs = calloc(quic_rx_batch, sizeof *rxd->cmsgs);
+	rxd->dgrams = calloc(quic_rx_batch, sizeof *rxd->dgrams);
+	if (!rxd->msgs || !rxd->iovs || !rxd->addrs || !rxd->cmsgs || !rxd->dgrams)
+		return 0;
+
+	/* The datagram buffers are allocated on demand by quic_conn_handler_batch(). */
+	for (i = 0; i < quic_rx_batch; i++) {
+		rxd->msgs[i].msg_hdr.msg_iov = &rxd->iovs[i];
+		rxd->msgs[i].msg_hdr.msg_iovlen = 1;
+		rxd->msgs[i].msg_hdr.msg_name = &rxd->addrs[i];
+	}
+
+	return 1;
+}
+
+static void quic_free_rx_dgrams_per_thread()
+{
+	int i;
+	struct quic_rx_dgrams *rxd = &quic_rx_dgrams;
+
+	for (i = 0; rxd->dgrams && i < quic_rx_batch; i++)
+		if (rxd->dgrams[i])
+			quic_dgram_refdec(rxd->dgrams[i]);
+	free(rxd->msgs);
+	free(rxd->iovs);
+	free(rxd->addrs);
+	free(rxd->cmsgs);
+	free(rxd->dgrams);
+	memset(rxd, 0, sizeof *rxd);
+}
+
+REGISTER_PER_THREAD_ALLOC(quic_alloc_rx_dgrams_per_thread);
+REGISTER_PER_THREAD_FREE(quic_free_rx_dgrams_per_thread);
+#endif
+
+/* Allocate the timer wheel of the current thread and its task. Returns 1 if
+ * succeeded, 0 if not.
+ */
+static int quic_alloc_tw_per_thread()
+{
+	int i;
+
+	quic_tw = calloc(1, sizeof *quic_tw);
+	if (!quic_tw)
+		return 0;
+
+	for (i = 0; i < QUIC_TW_SLOTS; i++)
+		LIST_INIT(&quic_tw->slots[i]);
+
+	quic_tw->task = task_new(tid_bit);
+	if (!quic_tw->task)
+		return 0;
+
+	quic_tw->task->process = quic_tw_process;
+	quic_tw->task->context = quic_tw;
+	return 1;
+}
+
+static void quic_free_tw_per_thread()
+{
+	if (!quic_tw)
+		return;
+
+	if (quic_tw->task)
+		task_destroy(quic_tw->task);
+	free(quic_tw);
+	quic_tw = NULL;
+}
+
+REGISTER_PER_THREAD_ALLOC(quic_alloc_tw_per_thread);
+REGISTER_PER_THREAD_FREE(quic_free_tw_per_thread);
+
+/* initialize the RX datagram pool after the config is parsed, its buffers
+ * being tune.bufsize bytes long, or large enough for the biggest GRO packets
+ * if "tune.quic.gro" is enabled.
+ * Returns zero on success, non-zero on error.
+ */
+static int quic_init_dgram_pool()
+{
+	quic_dgram_bufsz = global.tune.bufsize;
+#ifdef QUIC_USE_GRO
+	if ((global.tune.options & GTUNE_QUIC_GRO) && quic_dgram_bufsz < QUIC_GRO_BUFSZ)
+		quic_dgram_bufsz = QUIC_GRO_BUFSZ;
+#endif
+	pool_head_quic_dgram = create_pool("quic_dgram",
+	                                   sizeof(struct quic_dgram) + quic_dgram_bufsz,
+	                                   MEM_F_SHARED);
+	if (!pool_head_quic_dgram)
+		return -1;
+	return 0;
+}
+
+REGISTER_POST_CHECK(quic_init_dgram_pool);
+
+/* Generate the key of the HMAC protecting the address validation tokens.
+ * Returns zero on success, non-zero on error.
+ */
+static int quic_init_token_key()
+{
+	if (RAND_bytes(quic_token_key, sizeof quic_token_key) != 1) {
+		ha_alert("QUIC: could not generate the token key.\n");
+		return -1;
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(quic_init_token_key);
+
+/* Generate a random key for the stateless reset tokens if it was not derived
+ * from "cluster-secret". Returns zero on success, non-zero on error.
+ */
+static int quic_init_sreset_key()
+{
+	if (!quic_sreset_key_set &&
+	    RAND_bytes(quic_sreset_key, sizeof quic_sreset_key) != 1) {
+		ha_alert("QUIC: could not generate the stateless reset key.\n");
+		return -1;
+	}
+	return 0;
+}
+
+REGISTER_POST_CHECK(quic_init_sreset_key);
+
+/* config parser for global "cluster-secret" */
+static int quic_parse_cluster_secret(char **args, int section_type, struct proxy *curpx,
+                                     struct proxy *defpx, const char *file, int line,
+                                     char **err)
+{
+	static const char label[] = "quic stateless reset";
+	unsigned int mdlen;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a secret string.", args[0]);
+		return -1;
+	}
+
+	if (!HMAC(EVP_sha256(), args[1], strlen(args[1]),
+	          (const unsigned char *)label, sizeof label - 1,
+	          quic_sreset_key, &mdlen)) {
+		memprintf(err, "'%s' : could not derive the stateless reset key.", args[0]);
+		return -1;
+	}
+	quic_sreset_key_set = 1;
+	return 0;
+}
+
+/* config parser for global "quic-handover" */
+static int quic_parse_handover(char **args, int section_type, struct proxy *curpx,
+                               struct proxy *defpx, const char *file, int line,
+                               char **err)
+{
+	struct sockaddr_un addr;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a path prefix.", args[0]);
+		return -1;
+	}
+
+	/* room for the largest generation suffix */
+	if (strlen(args[1]) + 4 >= sizeof(addr.sun_path)) {
+		memprintf(err, "'%s' : path prefix '%s' too long (%d chars max).",
+		          args[0], args[1], (int)sizeof(addr.sun_path) - 5);
+		return -1;
+	}
+
+	free(quic_ho_path);
+	quic_ho_path = strdup(args[1]);
+	if (!quic_ho_path) {
+		memprintf(err, "'%s' : out of memory.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* Keeps the QUIC listeners of <px> receiving after a soft stop with
+ * "quic-handover", so that the connections they own may be drained. They do
+ * not prevent the process from exiting once these connections are closed.
+ */
+static int quic_ho_check_proxy(struct proxy *px)
+{
+	struct listener *l;
+
+	if (!quic_ho_path)
+		return ERR_NONE;
+
+	list_for_each_entry(l, &px->conf.listeners, by_fe) {
+		if (l->bind_conf->is_quic)
+			l->options |= LI_O_NOSTOP;
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_PROXY_CHECK(quic_ho_check_proxy);
+
+/* Returns non-zero if a process is bound to <addr> handover socket. */
+static int quic_ho_alive(struct sockaddr_un *addr)
+{
+	int fd, ret;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return 0;
+
+	ret = connect(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0;
+	close(fd);
+	return ret;
+}
+
+/* Binds the handover socket of a worker to the first generation not used by
+ * a living process, starting from its PID, then announces this generation to
+ * the other living processes. This is done once by the last thread to start,
+ * before any CID has been generated.
+ * Returns 1 if succeeded, 0 if not.
+ */
+static int quic_ho_init()
+{
+	static int calls;
+	struct sockaddr_un addr;
+	int fd, gen, i;
+
+	if (!quic_ho_path || master || ++calls < global.nbthread)
+		return 1;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		ha_alert("quic-handover: cannot create the handover socket (%s).\n", strerror(errno));
+		goto err;
+	}
+
+	gen = getpid() & 0xff;
+	for (i = 0; i < 256; i++, gen = (gen + 1) & 0xff) {
+		quic_ho_addr(&addr, gen);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == 0)
+			break;
+		if (errno != EADDRINUSE || quic_ho_alive(&addr))
+			continue;
+		/* left by a dead process */
+		unlink(addr.sun_path);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == 0)
+			break;
+	}
+
+	if (i == 256) {
+		ha_alert("quic-handover: cannot bind any handover socket '%s.<gen>' (%s).\n",
+		         quic_ho_path, strerror(errno));
+		goto err;
+	}
+
+	quic_ho_fd = fd;
+	quic_proc_gen = gen;
+	for (i = 0; i < 256; i++) {
+		if (i != gen && quic_ho_send(i, QUIC_HO_T_HELLO, 0, NULL, 0, NULL, NULL))
+			ha_bit_set(i, quic_ho_gens);
+	}
+
+	fd_insert(fd, &quic_ho_fd, quic_ho_fd_handler, 1UL);
+	fd_want_recv(fd);
+	return 1;
+
+ err:
+	if (fd >= 0)
+		close(fd);
+	return 0;
+}
+
+REGISTER_PER_THREAD_INIT(quic_ho_init);
+
+/* Removes the handover socket of this process. */
+static void quic_ho_deinit()
+{
+	struct sockaddr_un addr;
+
+	if (quic_proc_gen < 0)
+		return;
+
+	quic_ho_addr(&addr, quic_proc_gen);
+	unlink(addr.sun_path);
+	free(quic_ho_path);
+}
+
+REGISTER_POST_DEINIT(quic_ho_deinit);
+
+/* config parser for global "tune.quic.mem-max" and "tune.quic.conn-mem-max" */
+static int quic_parse_mem_max(char **args, int section_type, struct proxy *curpx,
+                              struct proxy *defpx, const char *file, int line,
+                              char **err)
+{
+	unsigned int *max = strcmp(args[0], "tune.quic.mem-max") == 0 ?
+		&quic_mem_max : &quic_conn_mem_max;
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a size in bytes.", args[0]);
+		return -1;
+	}
+
+	res = parse_size_err(args[1], max);
+	if (res) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'", res, args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.rx-batch" */
+static int quic_parse_rx_batch(char **args, int section_type, struct proxy *curpx,
+                               struct proxy *defpx, const char *file, int line,
+                               char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_rx_batch = atoi(args[1]);
+	if (quic_rx_batch < 1 || quic_rx_batch > QUIC_MAX_RX_BATCH) {
+		memprintf(err, "'%s' expects a numeric value between 1 and %d.",
+		          args[0], QUIC_MAX_RX_BATCH);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.gro", accepts "on" or "off" */
+static int quic_parse_gro(char **args, int section_type, struct proxy *curpx,
+                          struct proxy *defpx, const char *file, int line,
+                          char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0) {
+#ifdef QUIC_USE_GRO
+		global.tune.options |= GTUNE_QUIC_GRO;
+#else
+		memprintf(err, "'%s' is not supported on this platform.", args[0]);
+		return -1;
+#endif
+	}
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_QUIC_GRO;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.key-update-pkts" */
+static int quic_parse_ku_pkts(char **args, int section_type, struct proxy *curpx,
+                              struct proxy *defpx, const char *file, int line,
+                              char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_ku_pkts = strtoull(args[1], &end, 10);
+	if (!*args[1] || *end) {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.max-dgram-size" */
+static int quic_parse_max_dgram_size(char **args, int section_type, struct proxy *curpx,
+                                     struct proxy *defpx, const char *file, int line,
+                                     char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_max_dgram_sz = atoi(args[1]);
+	if (quic_max_dgram_sz < QUIC_PACKET_MAXLEN || quic_max_dgram_sz > QUIC_MAX_DGRAM_SZ) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.",
+		          args[0], QUIC_PACKET_MAXLEN, QUIC_MAX_DGRAM_SZ);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.retry-threshold" */
+static int quic_parse_retry_threshold(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_retry_threshold = strtol(args[1], &end, 10);
+	if (!*args[1] || *end || quic_retry_threshold < 0) {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.stateless-reset-rate" */
+static int quic_parse_sreset_rate(char **args, int section_type, struct proxy *curpx,
+                                  struct proxy *defpx, const char *file, int line,
+                                  char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	quic_sreset_rate = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end || *args[1] == '-') {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.socket-per-thread", accepts "on" or "off" */
+static int quic_parse_sock_per_thread(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		global.tune.options |= GTUNE_QUIC_SOCK_PER_THR;
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_QUIC_SOCK_PER_THR;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.pacing-txtime", accepts "on" or "off" */
+static int quic_parse_pacing_txtime(char **args, int section_type, struct proxy *curpx,
+                                    struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0) {
+#ifdef QUIC_USE_TXTIME
+		global.tune.options |= GTUNE_QUIC_TXTIME;
+#else
+		memprintf(err, "'%s' is not supported on this platform.", args[0]);
+		return -1;
+#endif
+	}
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_QUIC_TXTIME;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.quic.ecn", accepts "on" or "off" */
+static int quic_parse_ecn(char **args, int section_type, struct proxy *curpx,
+                          struct proxy *defpx, const char *file, int line,
+                          char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		global.tune.options &= ~GTUNE_QUIC_NO_ECN;
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options |= GTUNE_QUIC_NO_ECN;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* Size of the global header of the pcap files, and of their record headers. */
+#define QUIC_PCAP_HDR_LEN      24
+#define QUIC_PCAP_REC_HDR_LEN  16
+
+/* Link layer types of the pcap files which may be replayed. */
+#define QUIC_DLT_NULL          0
+#define QUIC_DLT_EN10MB        1
+#define QUIC_DLT_RAW           101
+#define QUIC_DLT_LINUX_SLL     113
+#define QUIC_DLT_IPV4          228
+#define QUIC_DLT_IPV6          229
+
+/* Returns the 32-bit value at <p> of the pcap file of <r>. */
+static inline uint32_t quic_replay_u32(const struct quic_replay *r, const unsigned char *p)
+{
+	uint32_t v = read_u32(p);
+
+	return r->swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Returns the first QUIC listener bound to <port> (in network byte order),
+ * whatever its address, or NULL if none.
+ */
+static struct listener *quic_replay_listener(unsigned short port)
+{
+	static struct listener *last;
+	struct proxy *px;
+	struct listener *l;
+
+	if (last && get_net_port(&last->addr) == port)
+		return last;
+
+	for (px = proxies_list; px; px = px->next) {
+		list_for_each_entry(l, &px->conf.listeners, by_fe) {
+			if (l->bind_conf->is_quic && get_net_port(&l->addr) == port) {
+				last = l;
+				return l;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Finds the UDP datagram of <pkt> record with <len> as captured length of the
+ * pcap file of <r>. Sets <*data> and <*dlen> to its payload, and <*sport> and
+ * <*dport> to its ports in network byte order. Returns 1 if found, 0 if the
+ * record is not a whole unfragmented UDP datagram over IPv4 or IPv6.
+ */
+static int quic_replay_udp(const struct quic_replay *r, const unsigned char *pkt, size_t len,
+                           const unsigned char **data, size_t *dlen,
+                           unsigned short *sport, unsigned short *dport)
+{
+	const unsigned char *end = pkt + len;
+	size_t ulen;
+
+	switch (r->linktype) {
+	case QUIC_DLT_NULL:
+		/* the address family of the capturing host follows */
+		pkt += 4;
+		break;
+	case QUIC_DLT_EN10MB:
+		if (len < 14)
+			return 0;
+		/* skip one 802.1Q tag if any */
+		if (read_n16(pkt + 12) == 0x8100) {
+			if (len < 18)
+				return 0;
+			pkt += 4;
+		}
+		if (read_n16(pkt + 12) != 0x0800 && read_n16(pkt + 12) != 0x86dd)
+			return 0;
+		pkt += 14;
+		break;
+	case QUIC_DLT_LINUX_SLL:
+		if (len < 16 || (read_n16(pkt + 14) != 0x0800 && read_n16(pkt + 14) != 0x86dd))
+			return 0;
+		pkt += 16;
+		break;
+	default:
+		/* raw IPv4 or IPv6 */
+		break;
+	}
+
+	if (pkt >= end)
+		return 0;
+
+	if ((*pkt >> 4) == 4) {
+		size_t ihl = (*pkt & 0xf) * 4;
+
+		/* no fragment: neither the MF flag nor an offset */
+		if (end - pkt < 20 || ihl < 20 || end - pkt < ihl ||
+		    pkt[9] != IPPROTO_UDP || (read_n16(pkt + 6) & 0x3fff))
+			return 0;
+		pkt += ihl;
+	}
+	else if ((*pkt >> 4) == 6) {
+		/* the extension headers are not supported */
+		if (end - pkt < 40 || pkt[6] != IPPROTO_UDP)
+			return 0;
+		pkt += 40;
+	}
+	else
+		return 0;
+
+	if (end - pkt < 8)
+		return 0;
+
+	ulen = read_n16(pkt + 4);
+	if (ulen < 8 || ulen > end - pkt)
+		return 0;
+
+	*sport = read_u16(pkt);
+	*dport = read_u16(pkt + 2);
+	*data = pkt + 8;
+	*dlen = ulen - 8;
+	return 1;
+}
+
+/* Feeds the next datagram of the pcap file of <r> to the QUIC listener bound
+ * to its destination port, as if received from the loopback address so that
+ * nothing is sent back to its real source. The source port is changed at each
+ * loop so that the Initial packets open new connections instead of being
+ * ignored as duplicates. Returns 0 once the end of the file is reached,
+ * otherwise 1.
+ */
+static int quic_replay_next(struct quic_replay *r)
+{
+	const unsigned char *rec, *data;
+	struct sockaddr_storage saddr;
+	socklen_t saddrlen;
+	unsigned short sport, dport;
+	struct quic_dgram *dgram;
+	struct listener *l;
+	unsigned long long start;
+	size_t caplen, dlen;
+
+	if (r->len - r->pos < QUIC_PCAP_REC_HDR_LEN)
+		return 0;
+
+	rec = r->data + r->pos;
+	caplen = quic_replay_u32(r, rec + 8);
+	if (caplen > r->len - r->pos - QUIC_PCAP_REC_HDR_LEN)
+		return 0;
+
+	r->pos += QUIC_PCAP_REC_HDR_LEN + caplen;
+	if (!quic_replay_udp(r, rec + QUIC_PCAP_REC_HDR_LEN, caplen, &data, &dlen, &sport, &dport) ||
+	    !dlen || dlen > quic_dgram_bufsz)
+		goto skip;
+
+	l = quic_replay_listener(dport);
+	if (!l)
+		goto skip;
+
+	dgram = quic_dgram_new();
+	if (!dgram)
+		goto skip;
+
+	memcpy(dgram->data, data, dlen);
+	dgram->ecn = 0;
+	dgram->segsz = 0;
+
+	memset(&saddr, 0, sizeof saddr);
+	if (l->addr.ss_family == AF_INET6 || l->addr.ss_family == AF_CUST_QUIC6) {
+		saddr.ss_family = AF_INET6;
+		((struct sockaddr_in6 *)&saddr)->sin6_addr = in6addr_loopback;
+	}
+	else {
+		saddr.ss_family = AF_INET;
+		((struct sockaddr_in *)&saddr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+	set_host_port(&saddr, (unsigned short)(ntohs(sport) + r->loop * 7919));
+	saddrlen = get_addr_len(&saddr);
+
+	start = rdtsc();
+	quic_dgram_read_local(dgram, dlen, l, &saddr, &saddrlen, qc_lstnr_pkt_rcv);
+	quic_replay_account(QUIC_RS_DGRAM, start);
+	quic_dgram_refdec(dgram);
+	r->dgrams++;
+	r->bytes += dlen;
+	return 1;
+
+ skip:
+	r->skipped++;
+	return 1;
+}
+
+/* Parses a "debug quic replay <file> [<loops>]" CLI request, loading the whole
+ * pcap file in memory. Only one replay may run at a time. Returns 0 if it needs
+ * to continue, 1 if it wants to stop here.
+ */
+static int cli_parse_debug_quic_replay(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	struct quic_replay *r = &quic_replay;
+	unsigned char *data, *old = NULL;
+	const char *msg = NULL;
+	struct stat st;
+	uint32_t magic, linktype;
+	size_t len = 0;
+	ssize_t ret;
+	int loops = 1;
+	int fd;
+
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	if (!*args[3])
+		return cli_err(appctx, "Require a pcap file.\n");
+
+	if (*args[4]) {
+		loops = atoi(args[4]);
+		if (loops < 1)
+			return cli_err(appctx, "Require a positive number of loops.\n");
+	}
+
+	fd = open(args[3], O_RDONLY);
+	if (fd < 0)
+		return cli_err(appctx, "Cannot open this file.\n");
+
+	data = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size >= QUIC_PCAP_HDR_LEN)
+		data = malloc(st.st_size);
+	while (data && len < st.st_size) {
+		ret = read(fd, data + len, st.st_size - len);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		len += ret;
+	}
+	close(fd);
+
+	if (!data || len < QUIC_PCAP_HDR_LEN) {
+		msg = "Cannot read this pcap file.\n";
+		goto err;
+	}
+
+	/* microsecond or nanosecond timestamps, we don't use them */
+	magic = read_u32(data);
+	if (magic == 0x0a0d0d0a) {
+		msg = "pcapng files are not supported, convert them with 'editcap -F pcap'.\n";
+		goto err;
+	}
+	if (magic != 0xa1b2c3d4 && magic != 0xa1b23c4d &&
+	    magic != 0xd4c3b2a1 && magic != 0x4d3cb2a1) {
+		msg = "Not a pcap file.\n";
+		goto err;
+	}
+
+	if (!HA_ATOMIC_CAS(&r->data, &old, data)) {
+		msg = "A replay is already running.\n";
+		goto err;
+	}
+
+	r->swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+	linktype = quic_replay_u32(r, data + 20);
+	if (linktype != QUIC_DLT_NULL && linktype != QUIC_DLT_EN10MB &&
+	    linktype != QUIC_DLT_RAW && linktype != QUIC_DLT_LINUX_SLL &&
+	    linktype != QUIC_DLT_IPV4 && linktype != QUIC_DLT_IPV6) {
+		HA_ATOMIC_STORE(&r->data, NULL);
+		msg = "Unsupported link layer type.\n";
+		goto err;
+	}
+
+	r->linktype = linktype;
+	r->len = len;
+	r->pos = QUIC_PCAP_HDR_LEN;
+	r->loop = 0;
+	r->loops = loops;
+	r->done = 0;
+	r->start_us = now_us;
+	r->dgrams = r->bytes = r->skipped = 0;
+	memset(r->calls, 0, sizeof r->calls);
+	memset(r->cycles, 0, sizeof r->cycles);
+	appctx->ctx.cli.p0 = r;
+	return 0;
+
+ err:
+	free(data);
+	return cli_err(appctx, msg);
+}
+
+/* Replays the pcap file of a "debug quic replay" request by batches, letting
+ * the connections process each batch before the next one, then reports the
+ * datagrams rate and the cycles spent in each stage of the receive path.
+ * Returns 0 if it needs to be called again, otherwise non-zero.
+ */
+static int cli_io_handler_debug_quic_replay(struct appctx *appctx)
+{
+	static const char *stages[QUIC_RS_NB] = {
+		[QUIC_RS_DGRAM] = "dgram",
+		[QUIC_RS_PKT]   = "pkt",
+		[QUIC_RS_HS]    = "hs",
+		[QUIC_RS_CONN]  = "conn",
+	};
+	struct stream_interface *si = appctx->owner;
+	struct quic_replay *r = appctx->ctx.cli.p0;
+	int max = global.tune.maxpollevents;
+	uint64_t elapsed;
+	int i;
+
+	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	if (!r->done) {
+		quic_replaying = 1;
+		while (max-- > 0) {
+			if (quic_replay_next(r))
+				continue;
+
+			if (++r->loop >= r->loops) {
+				r->done = 1;
+				break;
+			}
+			r->pos = QUIC_PCAP_HDR_LEN;
+		}
+		quic_replaying = 0;
+		si_rx_endp_more(si);
+		return 0;
+	}
+
+	chunk_reset(&trash);
+	elapsed = now_us - r->start_us;
+	chunk_appendf(&trash, "dgrams=%llu bytes=%llu skipped=%llu loops=%u time=%lluus rate=%llu/s\n",
+	              r->dgrams, r->bytes, r->skipped, r->loops, (unsigned long long)elapsed,
+	              elapsed ? r->dgrams * 1000000ULL / elapsed : 0);
+	for (i = 0; i < QUIC_RS_NB; i++)
+		chunk_appendf(&trash, "%-5s calls=%llu cycles=%llu cycles/call=%llu cycles/dgram=%llu\n",
+		              stages[i], r->calls[i], r->cycles[i],
+		              r->calls[i] ? r->cycles[i] / r->calls[i] : 0,
+		              r->dgrams ? r->cycles[i] / r->dgrams : 0);
+
+	if (ci_putchk(si_ic(si), &trash) == -1) {
+		si_rx_room_blk(si);
+		return 0;
+	}
+	return 1;
+}
+
+/* Releases the pcap file of a "debug quic replay" request, so that another one
+ * may start.
+ */
+static void cli_release_debug_quic_replay(struct appctx *appctx)
+{
+	struct quic_replay *r = appctx->ctx.cli.p0;
+	unsigned char *data;
+
+	if (!r)
+		return;
+
+	data = r->data;
+	HA_ATOMIC_STORE(&r->data, NULL);
+	free(data);
+	appctx->ctx.cli.p0 = NULL;
+}
+
+/* Appends to <msg> one line describing <qc> QUIC connection. */
+static void qc_show(struct buffer *msg, struct quic_conn *qc)
+{
+	struct connection *conn = qc->conn;
+	struct quic_conn_ctx *ctx = conn->xprt_ctx;
+	struct listener *l = objt_listener(conn->target);
+	struct server *srv = objt_server(conn->target);
+	struct quic_path *path = qc->path;
+	char addr[INET6_ADDRSTRLEN];
+	int port = 0;
+
+	chunk_appendf(msg, "%p: tid=%d", qc, qc->tid);
+	if (l)
+		chunk_appendf(msg, " fe=%s", l->bind_conf->frontend->id);
+	else if (srv)
+		chunk_appendf(msg, " be=%s srv=%s", srv->proxy->id, srv->id);
+
+	if (conn->dst && addr_to_str(conn->dst, addr, sizeof addr) > 0)
+		port = get_host_port(conn->dst);
+	else
+		strcpy(addr, "-");
+	chunk_appendf(msg, " peer=%s:%d st=%s",
+	              addr, port, ctx ? quic_hdshk_state_str(ctx->state) : "-");
+
+	chunk_appendf(msg, " srtt=%u rttvar=%u rttmin=%u ptoc=%u"
+	              " cwnd=%llu in_flight=%llu mtu=%llu",
+	              path->loss.srtt >> 3, path->loss.rtt_var >> 2,
+	              path->loss.rtt_min, path->loss.pto_count,
+	              (unsigned long long)path->cwnd, (unsigned long long)path->in_flight,
+	              (unsigned long long)path->mtu);
+
+	chunk_appendf(msg, " rx=[pkts=%llu,bytes=%llu] tx=[pkts=%llu,bytes=%llu]"
+	              " lost=%llu pto=%u mem=%lu%s",
+	              (unsigned long long)qc->rx.pkts, (unsigned long long)qc->rx.bytes,
+	              (unsigned long long)qc->tx.pkts, (unsigned long long)qc->tx.bytes,
+	              (unsigned long long)qc->tx.lost_pkts, qc->tx.nb_pto,
+	              (unsigned long)qc->mem_used, qc_mem_pressure(qc) ? "(limited)" : "");
+
+	if (conn->mux && conn->mux->show_fd)
+		conn->mux->show_fd(msg, conn);
+
+	chunk_appendf(msg, "\n");
+}
+
+/* Parses a "show quic" CLI request. Returns 0 if it needs to continue, 1 if it
+ * wants to stop here. A specific connection may be requested by its address,
+ * which is stored into cli.p0, otherwise all the connections are dumped.
+ */
+static int cli_parse_show_quic(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (!cli_has_level(appctx, ACCESS_LVL_OPER))
+		return 1;
+
+	appctx->ctx.cli.i0 = 0; /* thread */
+	appctx->ctx.cli.i1 = 0; /* connections already dumped for this thread */
+	appctx->ctx.cli.p0 = NULL;
+
+	if (*args[2]) {
+		char *end;
+
+		appctx->ctx.cli.p0 = (void *)strtoul(args[2], &end, 0);
+		if (*end || !appctx->ctx.cli.p0)
+			return cli_err(appctx, "Require a valid QUIC connection address.\n");
+	}
+
+	return 0;
+}
+
+/* Dumps the QUIC connections of all the threads, one per line. Returns 0 if the
+ * output buffer is full and it needs to be called again, otherwise non-zero.
+ * The position is resumed by index in the per-thread lists, so that connections
+ * created or released between two calls may be skipped or dumped twice.
+ */
+static int cli_io_handler_show_quic(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	int thr = appctx->ctx.cli.i0;
+	int ret = 1;
+
+	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	chunk_reset(&trash);
+
+	/* isolate the threads once per round. We're limited to a buffer worth
+	 * of output anyway, it cannot last very long.
+	 */
+	thread_isolate();
+
+	/* the memory usage of all the connections, once for all */
+	if (!appctx->st2 && !appctx->ctx.cli.p0) {
+		chunk_appendf(&trash, "# mem=%lu mem-max=%u conn-mem-max=%u\n",
+		              quic_mem_used, quic_mem_max, quic_conn_mem_max);
+		if (ci_putchk(si_ic(si), &trash) == -1) {
+			si_rx_room_blk(si);
+			ret = 0;
+			goto end;
+		}
+		chunk_reset(&trash);
+	}
+	appctx->st2 = 1;
+
+	for (; thr < global.nbthread; thr++) {
+		struct quic_conn *qc;
+		int idx = 0;
+
+		list_for_each_entry(qc, &quic_conns[thr], list) {
+			if (idx++ < appctx->ctx.cli.i1)
+				continue;
+
+			if (appctx->ctx.cli.p0 && appctx->ctx.cli.p0 != qc)
+				continue;
+
+			qc_show(&trash, qc);
+			if (ci_putchk(si_ic(si), &trash) == -1) {
+				si_rx_room_blk(si);
+				appctx->ctx.cli.i0 = thr;
+				appctx->ctx.cli.i1 = idx - 1;
+				ret = 0;
+				goto end;
+			}
+			chunk_reset(&trash);
+		}
+		appctx->ctx.cli.i1 = 0;
+	}
+
+ end:
+	thread_release();
+	return ret;
+}
+
+static struct cli_kw_list cli_kws = {{ }, {
+	{ { "debug", "quic", "replay", NULL }, "debug quic replay <pcap> [n] : replay the datagrams of a pcap file n times",
+	  cli_parse_debug_quic_replay, cli_io_handler_debug_quic_replay, cli_release_debug_quic_replay, NULL, ACCESS_EXPERT },
+	{ { "show", "quic", NULL }, "show quic [conn] : dump the QUIC connections", cli_parse_show_quic, cli_io_handler_show_quic, NULL },
+	{{},}
+}};
+
+INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "cluster-secret", quic_parse_cluster_secret },
+	{ CFG_GLOBAL, "quic-handover", quic_parse_handover },
+	{ CFG_GLOBAL, "tune.quic.conn-mem-max", quic_parse_mem_max },
+	{ CFG_GLOBAL, "tune.quic.ecn", quic_parse_ecn },
+	{ CFG_GLOBAL, "tune.quic.gro", quic_parse_gro },
+	{ CFG_GLOBAL, "tune.quic.key-update-pkts", quic_parse_ku_pkts },
+	{ CFG_GLOBAL, "tune.quic.max-dgram-size", quic_parse_max_dgram_size },
+	{ CFG_GLOBAL, "tune.quic.mem-max", quic_parse_mem_max },
+	{ CFG_GLOBAL, "tune.quic.pacing-txtime", quic_parse_pacing_txtime },
+	{ CFG_GLOBAL, "tune.quic.retry-threshold", quic_parse_retry_threshold },
+	{ CFG_GLOBAL, "tune.quic.rx-batch", quic_parse_rx_batch },
+	{ CFG_GLOBAL, "tune.quic.socket-per-thread", quic_parse_sock_per_thread },
+	{ CFG_GLOBAL, "tune.quic.stateless-reset-rate", quic_parse_sreset_rate },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 /*
  * Local variables:
  *  c-indent-level: 8
@@ -0,0 +1,425 @@
+/*
+ * ebtree micro-benchmark.
+ *
+ * This program reports the cost of the insert, lookup and delete operations
+ * of the ebtree flavours used in haproxy, on key sets resembling the ones
+ * found in practice: IPv4 and IPv6 addresses (stick-tables), 8-byte QUIC
+ * connection IDs, short host names (patterns), and timer ticks (run queues
+ * and wait queues). The lookups of the binary keys are also run in batches
+ * with ebmb_lookup_batch(). Each set is tested at several sizes so that the effect of
+ * cache misses shows once the tree does not fit in the CPU caches anymore.
+ * The same lookups are also run on an open-addressing hash table and on a
+ * sorted array, which give an idea of what another index would bring. It is
+ * built against the objects of the haproxy tree and run with the largest
+ * number of keys to test (default: 1000000):
+ *
+ *   make ebtree-bench TARGET=linux-glibc
+ *   ./ebtree-bench [keys]
+ */
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eb32tree.h>
+#include <eb64tree.h>
+#include <ebmbtree.h>
+#include <ebsttree.h>
+
+#include <import/xxhash.h>
+
+#define BENCH_MAX_KEY      32
+
+/* One key of the ebmb/ebst sets, the node's key being right after it. */
+struct entry {
+	struct ebmb_node node;
+	unsigned char key[BENCH_MAX_KEY];
+};
+
+/* A set of keys of the same kind. Keys are either binary strings of <len>
+ * bytes or, if <len> is zero, NUL-terminated strings.
+ */
+struct key_set {
+	const char *name;
+	size_t len;
+	void (*gen)(unsigned char *key, unsigned int i);
+};
+
+static unsigned long long rnd_state = 0x2545f4914f6cdd1dULL;
+
+/* xorshift64*, reproducible from one run to another */
+static unsigned long long rnd64(void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545f4914f6cdd1dULL;
+}
+
+static struct timeval timeval_current(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv;
+}
+
+static double timeval_elapsed(struct timeval *tv)
+{
+	struct timeval tv2 = timeval_current();
+
+	return (tv2.tv_sec - tv->tv_sec) +
+	       (tv2.tv_usec - tv->tv_usec)*1.0e-6;
+}
+
+static void report(const char *set, unsigned int size, const char *op,
+                   unsigned long ops, struct timeval *start)
+{
+	double t = timeval_elapsed(start);
+	char name[64];
+
+	snprintf(name, sizeof name, "%s/%u %s", set, size, op);
+	printf("%-40s %12.0f ops/s %8.1f ns/op\n", name, ops / t, t * 1.0e9 / ops);
+}
+
+/* All generators below produce unique keys for distinct <i> below 2^24, the
+ * multiplications by odd constants being bijective.
+ */
+
+/* IPv4 addresses spread over 10.0.0.0/8 */
+static void gen_ipv4(unsigned char *key, unsigned int i)
+{
+	unsigned int addr = 0x0a000000 | ((i * 2654435761U) & 0xffffff);
+
+	key[0] = addr >> 24; key[1] = addr >> 16; key[2] = addr >> 8; key[3] = addr;
+}
+
+/* IPv6 addresses from 16 /48 prefixes of 2001:db8::/32 with random IIDs */
+static void gen_ipv6(unsigned char *key, unsigned int i)
+{
+	unsigned long long iid = i * 0x9e3779b97f4a7c15ULL;
+	int b;
+
+	memset(key, 0, 8);
+	key[0] = 0x20; key[1] = 0x01; key[2] = 0x0d; key[3] = 0xb8;
+	key[5] = i & 15;
+	for (b = 0; b < 8; b++)
+		key[8 + b] = iid >> (56 - b * 8);
+}
+
+/* random looking 8-byte connection IDs */
+static void gen_cid(unsigned char *key, unsigned int i)
+{
+	unsigned long long cid = (i * 0xd6e8feb86659fd93ULL) ^ 0x5851f42d4c957f2dULL;
+	int b;
+
+	for (b = 0; b < 8; b++)
+		key[b] = cid >> (56 - b * 8);
+}
+
+/* host names sharing their suffix, as found in maps and ACLs */
+static void gen_host(unsigned char *key, unsigned int i)
+{
+	snprintf((char *)key, BENCH_MAX_KEY, "app%u.example.com", (i * 2654435761U) & 0xffffff);
+}
+
+static const struct key_set key_sets[] = {
+	{ "ebmb ipv4", 4,  gen_ipv4 },
+	{ "ebmb ipv6", 16, gen_ipv6 },
+	{ "ebmb cid",  8,  gen_cid  },
+	{ "ebst host", 0,  gen_host },
+};
+
+static size_t key_len(const struct key_set *ks, const unsigned char *key)
+{
+	return ks->len ? ks->len : strlen((const char *)key);
+}
+
+static struct eb_root tree_root = EB_ROOT_UNIQUE;
+
+static struct ebmb_node *tree_insert(const struct key_set *ks, struct entry *e)
+{
+	return ks->len ? ebmb_insert(&tree_root, &e->node, ks->len) : ebst_insert(&tree_root, &e->node);
+}
+
+static struct ebmb_node *tree_lookup(const struct key_set *ks, const unsigned char *key)
+{
+	return ks->len ? ebmb_lookup(&tree_root, key, ks->len) : ebst_lookup(&tree_root, (const char *)key);
+}
+
+/* Open-addressing hash table with linear probing, storing entry pointers.
+ * Deleted slots are set to <hash_tomb> so that probing goes past them.
+ */
+static struct entry **hash_tbl;
+static unsigned int hash_mask;
+static struct entry hash_tomb;
+
+static unsigned int hash_slot(const struct key_set *ks, const unsigned char *key)
+{
+	return XXH64(key, key_len(ks, key), 0) & hash_mask;
+}
+
+static void hash_insert(const struct key_set *ks, struct entry *e)
+{
+	unsigned int slot = hash_slot(ks, e->key);
+
+	while (hash_tbl[slot] && hash_tbl[slot] != &hash_tomb)
+		slot = (slot + 1) & hash_mask;
+	hash_tbl[slot] = e;
+}
+
+static struct entry **hash_lookup(const struct key_set *ks, const unsigned char *key)
+{
+	unsigned int slot = hash_slot(ks, key);
+	size_t len = key_len(ks, key);
+
+	while (hash_tbl[slot]) {
+		if (hash_tbl[slot] != &hash_tomb && memcmp(hash_tbl[slot]->key, key, len + !ks->len) == 0)
+			return &hash_tbl[slot];
+		slot = (slot + 1) & hash_mask;
+	}
+	return NULL;
+}
+
+/* sorted array of entry pointers, for qsort() and bsearch() */
+static const struct key_set *cmp_set;
+
+static int cmp_entries(const void *a, const void *b)
+{
+	const struct entry *e1 = *(const struct entry **)a;
+	const struct entry *e2 = *(const struct entry **)b;
+
+	if (!cmp_set->len)
+		return strcmp((const char *)e1->key, (const char *)e2->key);
+	return memcmp(e1->key, e2->key, cmp_set->len);
+}
+
+/* Inserts <size> keys of set <ks> in random order into a tree, looks them all
+ * up in another random order, then deletes them. The same lookups are then
+ * run on a hash table and a sorted array of the same keys.
+ */
+static void bench_key_set(const struct key_set *ks, unsigned int size)
+{
+	struct entry *entries;
+	struct entry **sorted, **found;
+	unsigned int *order;
+	struct timeval start;
+	unsigned int i, j, tmp;
+
+	entries = calloc(size, sizeof(*entries));
+	order = calloc(size, sizeof(*order));
+	sorted = calloc(size, sizeof(*sorted));
+	for (hash_mask = 1; hash_mask < size * 2; hash_mask <<= 1)
+		;
+	hash_tbl = calloc(hash_mask, sizeof(*hash_tbl));
+	hash_mask--;
+	if (!entries || !order || !sorted || !hash_tbl) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+
+	for (i = 0; i < size; i++) {
+		ks->gen(entries[i].key, i);
+		order[i] = i;
+	}
+
+	/* the keys are already scattered, the lookups use a shuffled order */
+	for (i = size - 1; i > 0; i--) {
+		j = rnd64() % (i + 1);
+		tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		if (tree_insert(ks, &entries[i]) != &entries[i].node)
+			abort();
+	}
+	report(ks->name, size, "insert", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		if (tree_lookup(ks, entries[order[i]].key) != &entries[order[i]].node)
+			abort();
+	}
+	report(ks->name, size, "lookup", size, &start);
+
+	if (ks->len) {
+		const void *keys[EB_LOOKUP_BATCH];
+		struct ebmb_node *nodes[EB_LOOKUP_BATCH];
+		unsigned int n;
+
+		start = timeval_current();
+		for (i = 0; i < size; i += n) {
+			n = size - i < EB_LOOKUP_BATCH ? size - i : EB_LOOKUP_BATCH;
+			for (j = 0; j < n; j++)
+				keys[j] = entries[order[i + j]].key;
+			if (ebmb_lookup_batch(&tree_root, keys, ks->len, nodes, n) != n)
+				abort();
+			for (j = 0; j < n; j++) {
+				if (nodes[j] != &entries[order[i + j]].node)
+					abort();
+			}
+		}
+		report(ks->name, size, "lookup (batch)", size, &start);
+	}
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		ebmb_delete(&entries[order[i]].node);
+	report(ks->name, size, "delete", size, &start);
+
+	if (!eb_is_empty(&tree_root))
+		abort();
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		hash_insert(ks, &entries[i]);
+	report(ks->name, size, "hash insert", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		found = hash_lookup(ks, entries[order[i]].key);
+		if (!found || *found != &entries[order[i]])
+			abort();
+	}
+	report(ks->name, size, "hash lookup", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		*hash_lookup(ks, entries[order[i]].key) = &hash_tomb;
+	report(ks->name, size, "hash delete", size, &start);
+
+	for (i = 0; i < size; i++)
+		sorted[i] = &entries[i];
+	cmp_set = ks;
+	qsort(sorted, size, sizeof(*sorted), cmp_entries);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		struct entry *e = &entries[order[i]];
+
+		found = bsearch(&e, sorted, size, sizeof(*sorted), cmp_entries);
+		if (!found || *found != e)
+			abort();
+	}
+	report(ks->name, size, "sorted array lookup", size, &start);
+
+	free(hash_tbl);
+	free(sorted);
+	free(order);
+	free(entries);
+}
+
+/* The same connection IDs as above, as 64-bit integer keys. */
+static void bench_eb64(unsigned int size)
+{
+	struct eb64_node *nodes;
+	struct eb_root root = EB_ROOT_UNIQUE;
+	struct timeval start;
+	unsigned int i;
+
+	nodes = calloc(size, sizeof(*nodes));
+	if (!nodes) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+
+	for (i = 0; i < size; i++)
+		nodes[i].key = (i * 0xd6e8feb86659fd93ULL) ^ 0x5851f42d4c957f2dULL;
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		eb64_insert(&root, &nodes[i]);
+	report("eb64 cid", size, "insert", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		unsigned int n = (i * 2654435761U) % size;
+
+		if (eb64_lookup(&root, nodes[n].key) != &nodes[n])
+			abort();
+	}
+	report("eb64 cid", size, "lookup", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		eb64_delete(&nodes[i]);
+	report("eb64 cid", size, "delete", size, &start);
+
+	free(nodes);
+}
+
+/* Timer ticks within a 10s window after <now>, with duplicates, inserted then
+ * dequeued by increasing values as the scheduler does.
+ */
+static void bench_eb32_timers(unsigned int size)
+{
+	struct eb32_node *nodes, *node;
+	struct eb_root root = EB_ROOT;
+	unsigned int now = 0xfff00000;
+	struct timeval start;
+	unsigned int i;
+
+	nodes = calloc(size, sizeof(*nodes));
+	if (!nodes) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+
+	for (i = 0; i < size; i++)
+		nodes[i].key = now + rnd64() % 10000;
+
+	start = timeval_current();
+	for (i = 0; i < size; i++)
+		eb32_insert(&root, &nodes[i]);
+	report("eb32 timers", size, "insert", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		node = eb32_lookup_ge(&root, now + rnd64() % 10000);
+		if (!node)
+			node = eb32_first(&root);
+		if (!node)
+			abort();
+	}
+	report("eb32 timers", size, "lookup_ge", size, &start);
+
+	start = timeval_current();
+	for (i = 0; i < size; i++) {
+		node = eb32_first(&root);
+		eb32_delete(node);
+	}
+	report("eb32 timers", size, "first+delete", size, &start);
+
+	if (!eb_is_empty(&root))
+		abort();
+
+	free(nodes);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int sizes[3] = { 1000, 100000, 1000000 };
+	unsigned int size;
+	int s, k;
+
+	if (argc > 1) {
+		size = strtoul(argv[1], NULL, 10);
+		if (size < 1 || size > (1U << 24)) {
+			fprintf(stderr, "Usage: %s [keys (1..%u)]\n", argv[0], 1U << 24);
+			exit(1);
+		}
+		sizes[2] = size;
+	}
+
+	for (s = 0; s < 3; s++) {
+		size = sizes[s];
+		if (s < 2 && size >= sizes[2])
+			continue;
+		for (k = 0; k < sizeof(key_sets) / sizeof(key_sets[0]); k++)
+			bench_key_set(&key_sets[k], size);
+		bench_eb64(size);
+		bench_eb32_timers(size);
+	}
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * QUIC datapath micro-benchmark.
+ *
+ * This program only shows how many operations per second the QUIC packet
+ * processing primitives are able to handle with synthetic traffic: the frame
+ * builders and parsers, the AEAD packet protection, the header protection and
+ * the ACK ranges updates. It is built against the objects of the haproxy tree
+ * and run without argument, or with the number of loops of each test:
+ *
+ *   make quic-bench TARGET=linux-glibc USE_OPENSSL=1 USE_QUIC=1 SSL_INC=... SSL_LIB=...
+ *   ./quic-bench [loops]
+ */
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include <types/quic_frame.h>
+#include <types/quic_tls.h>
+#include <types/xprt_quic.h>
+
+#include <proto/quic_frame.h>
+#include <proto/quic_tls.h>
+#include <proto/trace.h>
+
+#define BENCH_PKT_LEN      1252   /* payload of a 1280 bytes datagram */
+#define BENCH_HDR_LEN      13     /* short header with 8 bytes DCID and 4 bytes PN */
+#define BENCH_STREAM_LEN   1200
+
+/* The frame and TLS objects trace to this source, which is never started. */
+struct trace_source trace_quic;
+
+void __trace(enum trace_level level, uint64_t mask, struct trace_source *src,
+             const struct ist where, const char *func,
+             const void *a1, const void *a2, const void *a3, const void *a4,
+             void (*cb)(enum trace_level level, uint64_t mask, const struct trace_source *src,
+                        const struct ist where, const struct ist func,
+                        const void *a1, const void *a2, const void *a3, const void *a4),
+             const struct ist msg)
+{
+}
+
+/* Only used by the debugging dumps of the TLS objects. */
+void hexdump(const void *buf, size_t buflen, const char *title_fmt, ...)
+{
+}
+
+int chunk_appendf(struct buffer *chk, const char *fmt, ...)
+{
+	return 0;
+}
+
+static struct quic_conn qc;
+static unsigned char payload[BENCH_STREAM_LEN];
+
+static struct timeval timeval_current(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv;
+}
+
+static double timeval_elapsed(struct timeval *tv)
+{
+	struct timeval tv2 = timeval_current();
+	return (tv2.tv_sec - tv->tv_sec) +
+	       (tv2.tv_usec - tv->tv_usec)*1.0e-6;
+}
+
+static void report(const char *name, unsigned long ops, struct timeval *start)
+{
+	double t = timeval_elapsed(start);
+
+	printf("%-32s %12.0f ops/s  (%lu ops in %.3fs)\n", name, ops / t, ops, t);
+}
+
+/* Builds then parses STREAM frames carrying BENCH_STREAM_LEN bytes. */
+static void bench_stream_frames(unsigned long loops)
+{
+	unsigned char buf[BENCH_PKT_LEN];
+	struct quic_tx_packet txpkt = { .flags = 0 };
+	struct quic_rx_packet rxpkt = { .type = QUIC_PACKET_TYPE_SHORT };
+	struct quic_frame frm = { .type = QUIC_FT_STREAM_8 | QUIC_STREAM_FRAME_OFF_BIT | QUIC_STREAM_FRAME_LEN_BIT };
+	struct quic_frame out;
+	struct timeval start;
+	unsigned long i;
+	unsigned char *pos;
+	const unsigned char *rpos;
+
+	frm.stream.id = 4;
+	frm.stream.len = sizeof payload;
+	frm.stream.data = payload;
+
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		pos = buf;
+		frm.stream.offset = i * sizeof payload;
+		if (!qc_build_frm(&pos, buf + sizeof buf, &frm, &txpkt, &qc))
+			abort();
+	}
+	report("qc_build_frm(STREAM)", loops, &start);
+
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		rpos = buf;
+		if (!qc_parse_frm(&out, &rxpkt, &rpos, pos, &qc))
+			abort();
+	}
+	report("qc_parse_frm(STREAM)", loops, &start);
+}
+
+/* Feeds the ACK ranges with in order packet numbers, one out of 16 being
+ * received late, then builds and parses the ACK frames of these ranges.
+ */
+static void bench_ack_ranges(unsigned long loops)
+{
+	static struct quic_ack_ranges qars;
+	unsigned char buf[BENCH_PKT_LEN];
+	struct quic_tx_packet txpkt = { .flags = 0 };
+	struct quic_rx_packet rxpkt = { .type = QUIC_PACKET_TYPE_SHORT };
+	struct quic_frame frm = { .type = QUIC_FT_ACK };
+	struct quic_frame out;
+	struct timeval start;
+	unsigned long i;
+	unsigned char *pos;
+	const unsigned char *rpos;
+	size_t enc_sz;
+
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		int64_t pn = i;
+
+		/* the packet numbers 16n+3 are received 8 packets late */
+		if ((i & 15) == 3)
+			continue;
+		if ((i & 15) == 11)
+			quic_update_ack_ranges(&qars, pn - 8);
+		quic_update_ack_ranges(&qars, pn);
+	}
+	report("quic_update_ack_ranges()", loops, &start);
+
+	frm.tx_ack.ack_delay = 0;
+	frm.tx_ack.ack_ranges = &qars;
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		pos = buf;
+		frm.tx_ack.nb_ranges = quic_ack_ranges_fit(&qars, sizeof buf - 1, &enc_sz);
+		if (!qc_build_frm(&pos, buf + sizeof buf, &frm, &txpkt, &qc))
+			abort();
+	}
+	report("qc_build_frm(ACK)", loops, &start);
+
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		rpos = buf;
+		if (!qc_parse_frm(&out, &rxpkt, &rpos, pos, &qc))
+			abort();
+	}
+	report("qc_parse_frm(ACK header)", loops, &start);
+}
+
+/* Protects then unprotects the payload and the header of full sized short
+ * packets with <aead> and <hp> ciphers.
+ */
+static void bench_packet_protection(const char *name, const EVP_CIPHER *aead,
+                                    const EVP_CIPHER *hp, unsigned long loops)
+{
+	static unsigned char pkts[QUIC_TLS_DEC_BATCH][BENCH_PKT_LEN];
+	static unsigned char work[QUIC_TLS_DEC_BATCH][BENCH_PKT_LEN];
+	unsigned char samples[QUIC_TLS_HP_BATCH * QUIC_TLS_HP_SAMPLE_LEN];
+	unsigned char masks[QUIC_TLS_HP_BATCH * QUIC_TLS_HP_SAMPLE_LEN];
+	unsigned char iv[12];
+	struct quic_tls_secrets tx = { .aead = aead, .hp = hp };
+	struct quic_tls_secrets rx = { .aead = aead, .hp = hp };
+	struct quic_tls_dec decs[QUIC_TLS_DEC_BATCH];
+	size_t len = BENCH_PKT_LEN - BENCH_HDR_LEN - QUIC_TLS_TAG_LEN;
+	struct timeval start;
+	char title[64];
+	unsigned long i;
+	int j;
+
+	for (j = 0; j < sizeof tx.key; j++)
+		tx.key[j] = rx.key[j] = tx.hp_key[j] = rx.hp_key[j] = j;
+	for (j = 0; j < sizeof tx.iv; j++)
+		tx.iv[j] = rx.iv[j] = 0xa0 + j;
+	if (!quic_tls_secrets_ctx_init(&tx, 1) || !quic_tls_secrets_ctx_init(&rx, 0))
+		abort();
+
+	start = timeval_current();
+	for (i = 0; i < loops; i++) {
+		unsigned char *pkt = pkts[i % QUIC_TLS_DEC_BATCH];
+
+		if (!quic_aead_iv_build(iv, sizeof iv, tx.iv, sizeof tx.iv, i) ||
+		    !quic_tls_encrypt(pkt + BENCH_HDR_LEN, len, pkt, BENCH_HDR_LEN, tx.ctx, iv))
+			abort();
+	}
+	snprintf(title, sizeof title, "%s encrypt", name);
+	report(title, loops, &start);
+
+	/* the last QUIC_TLS_DEC_BATCH packets are the ones we have to decrypt */
+	for (j = 0; j < QUIC_TLS_DEC_BATCH; j++) {
+		decs[j].buf = work[j] + BENCH_HDR_LEN;
+		decs[j].len = len + QUIC_TLS_TAG_LEN;
+		decs[j].aad = work[j];
+		decs[j].aad_len = BENCH_HDR_LEN;
+		decs[j].pn = loops - 1 - (loops - 1 - j) % QUIC_TLS_DEC_BATCH;
+	}
+	start = timeval_current();
+	for (i = 0; i < loops; i += QUIC_TLS_DEC_BATCH) {
+		memcpy(work, pkts, sizeof work);
+		if (quic_tls_decrypt_batch(decs, QUIC_TLS_DEC_BATCH, rx.ctx,
+		                           rx.iv, sizeof rx.iv) != QUIC_TLS_DEC_BATCH)
+			abort();
+	}
+	snprintf(title, sizeof title, "%s decrypt (batch)", name);
+	report(title, i, &start);
+
+	for (j = 0; j < sizeof samples; j++)
+		samples[j] = j * 7;
+	start = timeval_current();
+	for (i = 0; i < loops; i += QUIC_TLS_HP_BATCH) {
+		if (!quic_tls_hp_masks(&tx, samples, masks, QUIC_TLS_HP_BATCH))
+			abort();
+	}
+	snprintf(title, sizeof title, "%s header protection", name);
+	report(title, i, &start);
+
+	quic_tls_secrets_ctx_free(&tx);
+	quic_tls_secrets_ctx_free(&rx);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long loops = 1000000;
+
+	if (argc > 1)
+		loops = strtoul(argv[1], NULL, 10);
+	if (loops < QUIC_TLS_DEC_BATCH)
+		loops = QUIC_TLS_DEC_BATCH;
+
+	memset(payload, 'x', sizeof payload);
+	bench_stream_frames(loops);
+	bench_ack_ranges(loops);
+	bench_packet_protection("AES-128-GCM", EVP_aes_128_gcm(), EVP_aes_128_ctr(), loops);
+	bench_packet_protection("AES-256-GCM", EVP_aes_256_gcm(), EVP_aes_256_ctr(), loops);
+#ifndef OPENSSL_NO_CHACHA
+	bench_packet_protection("ChaCha20-Poly1305", EVP_chacha20_poly1305(), EVP_chacha20(), loops);
+#endif
+	return 0;
+}